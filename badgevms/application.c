@@ -16,18 +16,28 @@
 
 #include "badgevms/application.h"
 
+#include "application_private.h"
+#include "badgevms/json.h"
 #include "badgevms/pathfuncs.h"
 #include "badgevms/process.h"
+#include "badgevms/sprite.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "settings_private.h"
+#include "task.h"
 #include "thirdparty/cJSON.h"
 #include "why_io.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -37,14 +47,80 @@
 #define APPLICATION_MAGIC 0xDEADBEEF
 #define MAX_PATH_LEN      512
 
-static char applications_base_dir[MAX_PATH_LEN] = "";
+// Every application in one file, so listing them is a single read. It is
+// rebuilt from the .json files when it doesn't name the same applications.
+#define APPLICATION_INDEX_FILE    "applications.idx"
+#define APPLICATION_INDEX_MAGIC   0x58444941 // AIDX
+#define APPLICATION_INDEX_VERSION 3
+
+// Bundles are extracted in a directory of their own in here. Whatever is left
+// of one that was cut short is removed by application_init().
+#define APPLICATION_STAGING_DIR "_bundles"
+
+// Interpreters keep the compiled script in here, in the directory of the
+// application. Files are named after the first bytes of the SHA-256 of the
+// script, in hex.
+#define BYTECODE_CACHE_DIR  "[bytecode]"
+
+// Out of the directories of the applications, so settings survive an update
+#define APPLICATION_SETTINGS_DIR "_settings"
+#define BYTECODE_HASH_BYTES 8
+
+static char              applications_base_dir[MAX_PATH_LEN] = "";
+static SemaphoreHandle_t application_index_lock;
+
+typedef enum {
+    INDEX_UNIQUE_IDENTIFIER,
+    INDEX_NAME,
+    INDEX_AUTHOR,
+    INDEX_VERSION,
+    INDEX_INTERPRETER,
+    INDEX_METADATA_FILE,
+    INDEX_INSTALLED_PATH,
+    INDEX_BINARY_PATH,
+    INDEX_ICON_PATH,
+    INDEX_STRINGS,
+} application_index_string_t;
+
+// The file is used as it was read. The records are sorted by unique
+// identifier, strings are offsets from the start of the file, 0 for NULL.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t size; // Of the file
+} application_index_header_t;
+
+typedef struct {
+    uint32_t strings[INDEX_STRINGS];
+    uint32_t source;
+    uint32_t heap_grow_size;
+    uint32_t heap_trim_size;
+    uint32_t keep_warm;
+    uint32_t max_heap_pages;
+    uint32_t max_framebuffer_pages;
+    uint32_t cpu_class;
+    uint32_t frame_rate;
+} application_index_record_t;
+
+// Every application_t handed out is one of these. The strings of a borrowed
+// one point into the index its list read.
+typedef struct {
+    application_t app;
+    bool          borrowed;
+} application_entry_t;
 
 typedef struct application_list {
-    application_t **applications;
-    size_t          count;
-    size_t          current_index;
+    application_t             **applications;
+    size_t                      count;
+    size_t                      current_index;
+    application_entry_t        *entries; // For a list from the index, pointing into it
+    application_index_header_t *index;
 } application_list_t;
 
+// As written in manifest.json, by application_cpu_class_t
+static char const *const cpu_class_names[APPLICATION_CPU_MAX] = {"interactive", "background", "batch"};
+
 static bool validate_path(application_t *app, char const *path) {
     if (!path || !app)
         return false;
@@ -111,48 +187,365 @@ static cJSON *application_to_json(application_t const *app) {
     cJSON_AddStringToObject(json, "interpreter", app->interpreter ?: "");
     cJSON_AddStringToObject(json, "metadata_file", app->metadata_file ?: "");
     cJSON_AddStringToObject(json, "binary_path", app->binary_path ?: "");
+    cJSON_AddStringToObject(json, "icon_path", app->icon_path ?: "");
     cJSON_AddNumberToObject(json, "source", app->source);
+    cJSON_AddNumberToObject(json, "heap_grow_size", app->heap_grow_size);
+    cJSON_AddNumberToObject(json, "heap_trim_size", app->heap_trim_size);
+    cJSON_AddBoolToObject(json, "keep_warm", app->keep_warm);
+    cJSON_AddNumberToObject(json, "max_heap_pages", app->max_heap_pages);
+    cJSON_AddNumberToObject(json, "max_framebuffer_pages", app->max_framebuffer_pages);
+    cJSON_AddStringToObject(json, "cpu_class", cpu_class_names[app->cpu_class]);
+    cJSON_AddNumberToObject(json, "frame_rate", app->frame_rate);
 
     return json;
 }
 
-static application_t *json_to_application(cJSON *json) {
-    application_t *app = why_calloc(1, sizeof(application_t));
+// A string member of the object at token 0, NULL if it has none
+static char *json_member_strdup(json_t const *json, char const *key) {
+    int value = json_object_get(json, 0, key);
+    int len   = json_string_get(json, value, NULL, 0);
+    if (len < 0) {
+        return NULL;
+    }
+
+    char *str = why_malloc(len + 1);
+    if (str) {
+        json_string_get(json, value, str, len + 1);
+    }
+    return str;
+}
+
+static application_t *json_to_application(json_t const *json) {
+    application_t *app = why_calloc(1, sizeof(application_entry_t));
     if (!app)
         return NULL;
 
-    // Cast away const for internal modification
+    app->unique_identifier = json_member_strdup(json, "unique_identifier");
+    if (app->unique_identifier) {
+        app->installed_path = get_application_dir(app->unique_identifier);
+    }
+    app->name          = json_member_strdup(json, "name");
+    app->author        = json_member_strdup(json, "author");
+    app->version       = json_member_strdup(json, "version");
+    app->interpreter   = json_member_strdup(json, "interpreter");
+    app->metadata_file = json_member_strdup(json, "metadata_file");
+    app->binary_path   = json_member_strdup(json, "binary_path");
+    app->icon_path     = json_member_strdup(json, "icon_path");
+    if (app->icon_path && !app->icon_path[0]) {
+        why_free((void *)app->icon_path);
+        app->icon_path = NULL;
+    }
 
-    cJSON *item;
-    if ((item = cJSON_GetObjectItem(json, "unique_identifier")) && cJSON_IsString(item)) {
-        app->unique_identifier = why_strdup(item->valuestring);
-        app->installed_path    = get_application_dir(item->valuestring);
+    long long number;
+    bool      keep_warm;
+    if (json_int_get(json, json_object_get(json, 0, "source"), &number)) {
+        *((application_source_t *)&app->source) = (application_source_t)number;
     }
-    if ((item = cJSON_GetObjectItem(json, "name")) && cJSON_IsString(item)) {
-        app->name = why_strdup(item->valuestring);
+    if (json_int_get(json, json_object_get(json, 0, "heap_grow_size"), &number) && number > 0) {
+        app->heap_grow_size = (size_t)number;
     }
-    if ((item = cJSON_GetObjectItem(json, "author")) && cJSON_IsString(item)) {
-        app->author = why_strdup(item->valuestring);
+    if (json_int_get(json, json_object_get(json, 0, "heap_trim_size"), &number) && number > 0) {
+        app->heap_trim_size = (size_t)number;
     }
-    if ((item = cJSON_GetObjectItem(json, "version")) && cJSON_IsString(item)) {
-        app->version = why_strdup(item->valuestring);
+    if (json_bool_get(json, json_object_get(json, 0, "keep_warm"), &keep_warm)) {
+        app->keep_warm = keep_warm;
     }
-    if ((item = cJSON_GetObjectItem(json, "interpreter")) && cJSON_IsString(item)) {
-        app->interpreter = why_strdup(item->valuestring);
+    if (json_int_get(json, json_object_get(json, 0, "max_heap_pages"), &number) && number > 0) {
+        app->max_heap_pages = (size_t)number;
     }
-    if ((item = cJSON_GetObjectItem(json, "metadata_file")) && cJSON_IsString(item)) {
-        app->metadata_file = why_strdup(item->valuestring);
+    if (json_int_get(json, json_object_get(json, 0, "max_framebuffer_pages"), &number) && number > 0) {
+        app->max_framebuffer_pages = (size_t)number;
     }
-    if ((item = cJSON_GetObjectItem(json, "binary_path")) && cJSON_IsString(item)) {
-        app->binary_path = why_strdup(item->valuestring);
+    if (json_int_get(json, json_object_get(json, 0, "frame_rate"), &number) && number > 0) {
+        app->frame_rate = (int)number;
     }
-    if ((item = cJSON_GetObjectItem(json, "source")) && cJSON_IsNumber(item)) {
-        *((application_source_t *)&app->source) = (application_source_t)item->valueint;
+
+    char cpu_class[16];
+    if (json_string_get(json, json_object_get(json, 0, "cpu_class"), cpu_class, sizeof(cpu_class)) >= 0) {
+        for (int i = 0; i < APPLICATION_CPU_MAX; ++i) {
+            if (!strcmp(cpu_class, cpu_class_names[i])) {
+                app->cpu_class = (application_cpu_class_t)i;
+            }
+        }
     }
 
     return app;
 }
 
+static char const **application_string(application_t *app, application_index_string_t which) {
+    switch (which) {
+        case INDEX_UNIQUE_IDENTIFIER: return &app->unique_identifier;
+        case INDEX_NAME: return &app->name;
+        case INDEX_AUTHOR: return &app->author;
+        case INDEX_VERSION: return &app->version;
+        case INDEX_INTERPRETER: return &app->interpreter;
+        case INDEX_METADATA_FILE: return &app->metadata_file;
+        case INDEX_INSTALLED_PATH: return &app->installed_path;
+        case INDEX_BINARY_PATH: return &app->binary_path;
+        default: return &app->icon_path;
+    }
+}
+
+static void application_free_strings(application_t *app) {
+    // Cast away const to free the strings
+    for (int i = 0; i < INDEX_STRINGS; ++i) {
+        why_free((void *)*application_string(app, i));
+    }
+}
+
+// Give an application of a list strings of its own, before changing one
+static bool application_own(application_t *app) {
+    application_entry_t *entry = (application_entry_t *)app;
+    if (!entry->borrowed) {
+        return true;
+    }
+
+    char const *strings[INDEX_STRINGS];
+    for (int i = 0; i < INDEX_STRINGS; ++i) {
+        char const *string = *application_string(app, i);
+        strings[i]         = string ? why_strdup(string) : NULL;
+        if (string && !strings[i]) {
+            while (i--) {
+                why_free((void *)strings[i]);
+            }
+            return false;
+        }
+    }
+
+    for (int i = 0; i < INDEX_STRINGS; ++i) {
+        *application_string(app, i) = strings[i];
+    }
+    entry->borrowed = false;
+    return true;
+}
+
+static char const *application_index_string(application_index_header_t const *index, uint32_t offset) {
+    return offset ? (char const *)index + offset : NULL;
+}
+
+static application_index_record_t const *application_index_records(application_index_header_t const *index) {
+    return (application_index_record_t const *)(index + 1);
+}
+
+static bool application_index_valid(application_index_header_t const *index, size_t size) {
+    if (index->magic != APPLICATION_INDEX_MAGIC || index->version != APPLICATION_INDEX_VERSION ||
+        index->size != size || index->count > size / sizeof(application_index_record_t)) {
+        return false;
+    }
+
+    size_t strings = sizeof(application_index_header_t) + index->count * sizeof(application_index_record_t);
+    if (strings >= size || ((char const *)index)[size - 1]) {
+        return false;
+    }
+
+    application_index_record_t const *records = application_index_records(index);
+    for (size_t i = 0; i < index->count; ++i) {
+        if (!records[i].strings[INDEX_UNIQUE_IDENTIFIER]) {
+            return false;
+        }
+        for (int j = 0; j < INDEX_STRINGS; ++j) {
+            uint32_t offset = records[i].strings[j];
+            if (offset && (offset < strings || offset >= size)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The whole index with a single read, NULL if there is none or it is damaged
+static application_index_header_t *application_index_read(void) {
+    char *index_path = path_fileconcat(applications_base_dir, APPLICATION_INDEX_FILE);
+    if (!index_path) {
+        return NULL;
+    }
+
+    int fd = why_open(index_path, O_RDONLY, 0);
+    why_free(index_path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    application_index_header_t *index = NULL;
+    struct stat                 st;
+    if (why_fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(application_index_header_t)) {
+        index = why_malloc(st.st_size);
+    }
+
+    // Devices may return less than asked for
+    off_t done = 0;
+    while (index && done < st.st_size) {
+        ssize_t bytes = why_read(fd, (char *)index + done, st.st_size - done);
+        if (bytes <= 0) {
+            why_free(index);
+            index = NULL;
+            break;
+        }
+        done += bytes;
+    }
+    why_close(fd);
+
+    if (index && !application_index_valid(index, st.st_size)) {
+        ESP_LOGW(TAG, "Ignoring the damaged application index");
+        why_free(index);
+        index = NULL;
+    }
+    return index;
+}
+
+// The record of the application with this unique identifier, which need not
+// be terminated
+static application_index_record_t const *
+    application_index_find(application_index_header_t const *index, char const *unique_identifier, size_t len) {
+    application_index_record_t const *records = application_index_records(index);
+    size_t                            low     = 0;
+    size_t                            high    = index->count;
+
+    while (low < high) {
+        size_t      mid = low + (high - low) / 2;
+        char const *id  = application_index_string(index, records[mid].strings[INDEX_UNIQUE_IDENTIFIER]);
+        int         cmp = strncmp(unique_identifier, id, len);
+        if (!cmp && id[len]) {
+            cmp = -1;
+        }
+        if (!cmp) {
+            return &records[mid];
+        }
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+static void application_index_view(
+    application_index_header_t const *index, application_index_record_t const *record, application_entry_t *entry
+) {
+    application_t *app = &entry->app;
+    for (int i = 0; i < INDEX_STRINGS; ++i) {
+        *application_string(app, i) = application_index_string(index, record->strings[i]);
+    }
+    *((application_source_t *)&app->source) = (application_source_t)record->source;
+    app->heap_grow_size                     = record->heap_grow_size;
+    app->heap_trim_size                     = record->heap_trim_size;
+    app->keep_warm                          = record->keep_warm;
+    app->max_heap_pages                     = record->max_heap_pages;
+    app->max_framebuffer_pages              = record->max_framebuffer_pages;
+    app->cpu_class                          = (application_cpu_class_t)record->cpu_class;
+    app->frame_rate                         = record->frame_rate;
+    entry->borrowed                         = true;
+}
+
+static int application_compare(void const *a, void const *b) {
+    return strcmp((*(application_t **)a)->unique_identifier, (*(application_t **)b)->unique_identifier);
+}
+
+static void application_index_drop(void) {
+    char *index_path = path_fileconcat(applications_base_dir, APPLICATION_INDEX_FILE);
+    if (index_path) {
+        why_unlink(index_path);
+        why_free(index_path);
+    }
+}
+
+// Write apps, which all have a unique identifier, as the index
+static bool application_index_write(application_t **apps, size_t count) {
+    qsort(apps, count, sizeof(application_t *), application_compare);
+
+    size_t strings = sizeof(application_index_header_t) + count * sizeof(application_index_record_t);
+    size_t size    = strings + 1; // Ends in a 0 even without strings
+    for (size_t i = 0; i < count; ++i) {
+        for (int j = 0; j < INDEX_STRINGS; ++j) {
+            char const *string = *application_string(apps[i], j);
+            size              += string ? strlen(string) + 1 : 0;
+        }
+    }
+
+    application_index_header_t *index = why_calloc(1, size);
+    if (!index) {
+        return false;
+    }
+
+    index->magic   = APPLICATION_INDEX_MAGIC;
+    index->version = APPLICATION_INDEX_VERSION;
+    index->count   = count;
+    index->size    = size;
+
+    application_index_record_t *records = (application_index_record_t *)(index + 1);
+    char                       *next    = (char *)index + strings;
+    for (size_t i = 0; i < count; ++i) {
+        for (int j = 0; j < INDEX_STRINGS; ++j) {
+            char const *string = *application_string(apps[i], j);
+            if (string) {
+                size_t len             = strlen(string) + 1;
+                records[i].strings[j]  = next - (char *)index;
+                next                  += len;
+                memcpy((char *)index + records[i].strings[j], string, len);
+            }
+        }
+        records[i].source         = apps[i]->source;
+        records[i].heap_grow_size        = apps[i]->heap_grow_size;
+        records[i].heap_trim_size        = apps[i]->heap_trim_size;
+        records[i].keep_warm             = apps[i]->keep_warm;
+        records[i].max_heap_pages        = apps[i]->max_heap_pages;
+        records[i].max_framebuffer_pages = apps[i]->max_framebuffer_pages;
+        records[i].cpu_class             = apps[i]->cpu_class;
+        records[i].frame_rate            = apps[i]->frame_rate;
+    }
+
+    bool  success    = false;
+    char *index_path = path_fileconcat(applications_base_dir, APPLICATION_INDEX_FILE);
+    int   fd         = index_path ? why_open(index_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if (fd >= 0) {
+        success = why_write(fd, index, size) == (ssize_t)size;
+        success = why_close(fd) == 0 && success;
+    }
+    why_free(index_path);
+    why_free(index);
+
+    if (!success) {
+        ESP_LOGW(TAG, "Unable to write the application index");
+        application_index_drop();
+    }
+    return success;
+}
+
+// Put app into the index in place of the application with unique_identifier,
+// or only remove that one if app is NULL. Without an index there is nothing
+// to do, application_list() builds one.
+static void application_index_update(char const *unique_identifier, application_t *app) {
+    xSemaphoreTake(application_index_lock, portMAX_DELAY);
+
+    application_index_header_t *index = application_index_read();
+    if (index) {
+        application_entry_t *entries = why_malloc(index->count * sizeof(application_entry_t) + 1);
+        application_t      **apps    = why_malloc((index->count + 1) * sizeof(application_t *));
+        if (entries && apps) {
+            application_index_record_t const *records = application_index_records(index);
+            size_t                            count   = 0;
+            for (size_t i = 0; i < index->count; ++i) {
+                application_index_view(index, &records[i], &entries[i]);
+                if (strcmp(entries[i].app.unique_identifier, unique_identifier)) {
+                    apps[count++] = &entries[i].app;
+                }
+            }
+            if (app) {
+                apps[count++] = app;
+            }
+            application_index_write(apps, count);
+        } else {
+            application_index_drop();
+        }
+        why_free(apps);
+        why_free(entries);
+        why_free(index);
+    }
+
+    xSemaphoreGive(application_index_lock);
+}
+
 static bool save_application_metadata(application_t const *app) {
     if (!app || !app->unique_identifier)
         return false;
@@ -187,6 +580,7 @@ static bool save_application_metadata(application_t const *app) {
     why_free(json_string);
     why_free(metadata_path);
 
+    application_index_update(app->unique_identifier, (application_t *)app);
     return true;
 }
 
@@ -220,15 +614,30 @@ static application_t *load_application_metadata(char const *unique_identifier) {
     why_fclose(fp);
     why_free(metadata_path);
 
-    cJSON *json = cJSON_Parse(content);
+    application_t *app = application_from_manifest(content, file_size);
     why_free(content);
+    return app;
+}
 
-    if (!json)
+application_t *application_from_manifest(char const *content, size_t size) {
+    // Counted first, so the tokens take a single allocation
+    json_t json;
+    int    num_tokens = json_parse(&json, content, size, NULL, 0);
+    if (num_tokens <= 0) {
+        return NULL;
+    }
+
+    json_token_t *tokens = why_malloc(num_tokens * sizeof(json_token_t));
+    if (!tokens) {
         return NULL;
+    }
 
-    application_t *app = json_to_application(json);
-    cJSON_Delete(json);
+    application_t *app = NULL;
+    if (json_parse(&json, content, size, tokens, num_tokens) > 0) {
+        app = json_to_application(&json);
+    }
 
+    why_free(tokens);
     return app;
 }
 
@@ -237,9 +646,20 @@ bool application_init(char const *applications_dir, char const *flash_dir, char
         return false;
     }
 
+    application_index_lock = xSemaphoreCreateMutex();
+    if (!application_index_lock) {
+        return false;
+    }
+
     strncpy(applications_base_dir, applications_dir, MAX_PATH_LEN - 1);
     applications_base_dir[MAX_PATH_LEN - 1] = '\0';
 
+    char *staging_dir = path_dirconcat(applications_base_dir, APPLICATION_STAGING_DIR);
+    if (staging_dir) {
+        rm_rf(staging_dir);
+        why_free(staging_dir);
+    }
+
     if (flash_dir) {
         mkdir_p(flash_dir);
     }
@@ -287,7 +707,7 @@ application_t *application_create(
         return NULL;
     }
 
-    application_t *app = why_calloc(1, sizeof(application_t));
+    application_t *app = why_calloc(1, sizeof(application_entry_t));
     if (!app) {
         why_free(app_dir);
         return NULL;
@@ -311,7 +731,7 @@ application_t *application_create(
 }
 
 bool application_set_metadata(application_t *app, char const *metadata_file) {
-    if (!app)
+    if (!app || !application_own(app))
         return false;
 
     if (metadata_file && !validate_path(app, metadata_file)) {
@@ -325,7 +745,7 @@ bool application_set_metadata(application_t *app, char const *metadata_file) {
 }
 
 bool application_set_binary_path(application_t *app, char const *binary_path) {
-    if (!app)
+    if (!app || !application_own(app))
         return false;
 
     if (binary_path && !validate_path(app, binary_path)) {
@@ -338,8 +758,148 @@ bool application_set_binary_path(application_t *app, char const *binary_path) {
     return save_application_metadata(app);
 }
 
+// The whole sprite at path, NULL if it isn't one
+static sprite_header_t *application_icon_read(char const *path) {
+    int fd = why_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    sprite_header_t *sprite = NULL;
+    struct stat      st;
+    if (why_fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(sprite_header_t)) {
+        sprite = why_malloc(st.st_size);
+    }
+
+    off_t done = 0;
+    while (sprite && done < st.st_size) {
+        ssize_t bytes = why_read(fd, (char *)sprite + done, st.st_size - done);
+        if (bytes <= 0) {
+            why_free(sprite);
+            sprite = NULL;
+            break;
+        }
+        done += bytes;
+    }
+    why_close(fd);
+
+    if (sprite && (sprite->magic != SPRITE_MAGIC || !sprite->width || !sprite->height ||
+                   sprite_size(sprite) > (size_t)st.st_size)) {
+        ESP_LOGW(TAG, "%s is not a sprite", path);
+        why_free(sprite);
+        sprite = NULL;
+    }
+    return sprite;
+}
+
+// Scale icon to fit an APPLICATION_ICON_SIZE square, centered. Every pixel is
+// the average of the ones it covers, weighted by their alpha. Around it the
+// thumbnail is transparent.
+static sprite_header_t *application_icon_render(sprite_header_t const *icon) {
+    size_t           pixels    = APPLICATION_ICON_SIZE * APPLICATION_ICON_SIZE;
+    sprite_header_t *thumbnail = why_calloc(1, sizeof(sprite_header_t) + pixels * 3);
+    if (!thumbnail) {
+        return NULL;
+    }
+
+    thumbnail->magic  = SPRITE_MAGIC;
+    thumbnail->width  = APPLICATION_ICON_SIZE;
+    thumbnail->height = APPLICATION_ICON_SIZE;
+    thumbnail->flags  = SPRITE_FLAG_ALPHA;
+
+    int src_w   = icon->width;
+    int src_h   = icon->height;
+    int longest = src_w > src_h ? src_w : src_h;
+    int dst_w   = src_w * APPLICATION_ICON_SIZE / longest ?: 1;
+    int dst_h   = src_h * APPLICATION_ICON_SIZE / longest ?: 1;
+    int off_x   = (APPLICATION_ICON_SIZE - dst_w) / 2;
+    int off_y   = (APPLICATION_ICON_SIZE - dst_h) / 2;
+
+    uint16_t const *src       = sprite_pixels(icon);
+    uint8_t const  *src_alpha = sprite_alpha(icon);
+    uint16_t       *dst       = (uint16_t *)sprite_pixels(thumbnail);
+    uint8_t        *dst_alpha = (uint8_t *)sprite_alpha(thumbnail);
+
+    for (int y = 0; y < dst_h; ++y) {
+        int y0 = y * src_h / dst_h;
+        int y1 = (y + 1) * src_h / dst_h;
+        y1     = y1 > y0 ? y1 : y0 + 1;
+
+        for (int x = 0; x < dst_w; ++x) {
+            int x0 = x * src_w / dst_w;
+            int x1 = (x + 1) * src_w / dst_w;
+            x1     = x1 > x0 ? x1 : x0 + 1;
+
+            uint32_t r = 0, g = 0, b = 0, a = 0;
+            for (int sy = y0; sy < y1; ++sy) {
+                for (int sx = x0; sx < x1; ++sx) {
+                    size_t   i      = (size_t)sy * src_w + sx;
+                    uint32_t weight = src_alpha ? src_alpha[i] : 255;
+                    r              += ((src[i] >> 11) & 0x1F) * weight;
+                    g              += ((src[i] >> 5) & 0x3F) * weight;
+                    b              += (src[i] & 0x1F) * weight;
+                    a              += weight;
+                }
+            }
+
+            size_t i = (size_t)(off_y + y) * APPLICATION_ICON_SIZE + off_x + x;
+            if (a) {
+                dst[i] = (r / a) << 11 | (g / a) << 5 | (b / a);
+            }
+            dst_alpha[i] = a / ((y1 - y0) * (x1 - x0));
+        }
+    }
+    return thumbnail;
+}
+
+bool application_set_icon(application_t *app, char const *icon_file) {
+    if (!app || !application_own(app))
+        return false;
+
+    if (icon_file) {
+        if (!validate_path(app, icon_file)) {
+            return false;
+        }
+
+        char *icon_path      = path_concat(app->installed_path, icon_file);
+        char *thumbnail_path = path_concat(app->installed_path, APPLICATION_ICON_THUMBNAIL);
+        if (!icon_path || !thumbnail_path) {
+            why_free(icon_path);
+            why_free(thumbnail_path);
+            return false;
+        }
+
+        sprite_header_t *icon      = application_icon_read(icon_path);
+        sprite_header_t *thumbnail = icon ? application_icon_render(icon) : NULL;
+        why_free(icon);
+        why_free(icon_path);
+
+        bool success = false;
+        if (thumbnail) {
+            size_t size = sprite_size(thumbnail);
+            int    fd   = why_open(thumbnail_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0) {
+                success = why_write(fd, thumbnail, size) == (ssize_t)size;
+                success = why_close(fd) == 0 && success;
+            }
+            why_free(thumbnail);
+        }
+        why_free(thumbnail_path);
+
+        if (!success) {
+            ESP_LOGW(TAG, "Unable to render the icon of %s", app->unique_identifier);
+            return false;
+        }
+    }
+
+    why_free((void *)app->icon_path);
+    app->icon_path = icon_file ? why_strdup(APPLICATION_ICON_THUMBNAIL) : NULL;
+
+    return save_application_metadata(app);
+}
+
 bool application_set_version(application_t *app, char const *version) {
-    if (!app)
+    if (!app || !application_own(app))
         return false;
 
     why_free((void *)app->version);
@@ -349,7 +909,7 @@ bool application_set_version(application_t *app, char const *version) {
 }
 
 bool application_set_author(application_t *app, char const *author) {
-    if (!app)
+    if (!app || !application_own(app))
         return false;
 
     why_free((void *)app->author);
@@ -359,7 +919,7 @@ bool application_set_author(application_t *app, char const *author) {
 }
 
 bool application_set_name(application_t *app, char const *name) {
-    if (!app)
+    if (!app || !application_own(app))
         return false;
 
     why_free((void *)app->name);
@@ -369,7 +929,7 @@ bool application_set_name(application_t *app, char const *name) {
 }
 
 bool application_set_interpreter(application_t *app, char const *interpreter) {
-    if (!app)
+    if (!app || !application_own(app))
         return false;
 
     why_free((void *)app->interpreter);
@@ -392,6 +952,10 @@ bool application_destroy(application_t *app) {
         ESP_LOGI(TAG, "Attempting to recursively delete %s\n", app_dir);
         success = rm_rf(app_dir);
         why_free(app_dir);
+        if (success) {
+            settings_forget(unique_id);
+            application_index_update(unique_id, NULL);
+        }
     } else {
         ESP_LOGW(TAG, "No valid app_dir for %s\n", app->unique_identifier);
     }
@@ -399,6 +963,105 @@ bool application_destroy(application_t *app) {
     return success;
 }
 
+char *application_settings_path(char const *unique_identifier) {
+    char *dir  = path_dirconcat(applications_base_dir, APPLICATION_SETTINGS_DIR);
+    char *name = NULL;
+    char *path = NULL;
+
+    why_asprintf(&name, "%s.kv", unique_identifier);
+    if (dir && name && mkdir_p(dir)) {
+        path = path_fileconcat(dir, name);
+    }
+
+    why_free(name);
+    why_free(dir);
+    return path;
+}
+
+char *application_staging_dir(void) {
+    static atomic_uint next;
+    char               name[32];
+
+    snprintf(name, sizeof(name), "%s.%u", APPLICATION_STAGING_DIR, atomic_fetch_add(&next, 1));
+    char *staging_dir = path_dirconcat(applications_base_dir, name);
+    if (!staging_dir) {
+        return NULL;
+    }
+
+    rm_rf(staging_dir);
+    if (!mkdir_p(staging_dir)) {
+        why_free(staging_dir);
+        return NULL;
+    }
+    return staging_dir;
+}
+
+// DEV:[A.B] as DEV:[A]B and DEV:[A] as DEV:A, directories are renamed by the
+// name they have in their parent
+static char *dir_as_file(char const *dir) {
+    char  *file    = why_strdup(dir);
+    size_t len     = file ? strlen(file) : 0;
+    char  *bracket = file ? strchr(file, '[') : NULL;
+    if (!bracket || file[len - 1] != ']') {
+        why_free(file);
+        return NULL;
+    }
+
+    file[len - 1] = '\0';
+    char *dot     = strrchr(bracket, '.');
+    if (dot) {
+        *dot = ']';
+    } else {
+        memmove(bracket, bracket + 1, strlen(bracket));
+    }
+    return file;
+}
+
+static bool rename_dir(char const *from, char const *to) {
+    char *from_file = dir_as_file(from);
+    char *to_file   = dir_as_file(to);
+    bool  ok        = from_file && to_file && !why_rename(from_file, to_file);
+    why_free(from_file);
+    why_free(to_file);
+    return ok;
+}
+
+bool application_install_dir(application_t *app, char const *staging_dir) {
+    char *app_dir = get_application_dir(app->unique_identifier);
+    char *aside   = NULL;
+    bool  ok      = false;
+
+    why_asprintf(&aside, "%.*s-old]", (int)strlen(staging_dir) - 1, staging_dir);
+    if (!app_dir || !aside) {
+        goto out;
+    }
+
+    // The installed files move out of the way whole, so they can come back if
+    // the new ones can't be moved in. An application on another device of
+    // APPS: than the staging directory can only be removed.
+    bool moved = rename_dir(app_dir, aside);
+    if (!moved) {
+        rm_rf(app_dir);
+    }
+    if (!rename_dir(staging_dir, app_dir)) {
+        ESP_LOGE(TAG, "Unable to move %s to %s", staging_dir, app_dir);
+        if (moved) {
+            rename_dir(aside, app_dir);
+        }
+        goto out;
+    }
+
+    ok = save_application_metadata(app);
+    if (moved) {
+        rm_rf(aside);
+    }
+
+out:
+    why_free(aside);
+    why_free(app_dir);
+    return ok;
+}
+
 char *application_create_file_string(application_t *app, char const *file_path) {
     if (!app) {
         return NULL;
@@ -445,7 +1108,70 @@ FILE *application_create_file(application_t *app, char const *file_path) {
     return ret;
 }
 
+// The list is count records of the index itself from first on
+static bool
+    application_list_from_index(application_list_t *list, application_index_header_t *index, size_t first, size_t count) {
+    list->applications = why_calloc(count + 1, sizeof(application_t *));
+    list->entries      = why_malloc(count * sizeof(application_entry_t) + 1);
+    if (!list->applications || !list->entries) {
+        return false;
+    }
+
+    application_index_record_t const *records = application_index_records(index) + first;
+    for (size_t i = 0; i < count; ++i) {
+        application_index_view(index, &records[i], &list->entries[i]);
+        list->applications[i] = &list->entries[i].app;
+    }
+    list->count = count;
+    list->index = index;
+    return true;
+}
+
+// Load every .json file in dir, and write the index for next time
+static bool application_list_from_json(application_list_t *list, DIR *dir, size_t json_count) {
+    list->applications = why_calloc(json_count + 1, sizeof(application_t *));
+    if (!list->applications) {
+        return false;
+    }
+
+    struct dirent *entry;
+    why_rewinddir(dir);
+    while ((entry = why_readdir(dir)) != NULL && list->count < json_count) {
+        size_t len = strlen(entry->d_name);
+        if (len > 5 && strcmp(entry->d_name + len - 5, ".json") == 0) {
+            char *unique_id = why_malloc(len - 4);
+            if (unique_id) {
+                strncpy(unique_id, entry->d_name, len - 5);
+                unique_id[len - 5] = '\0';
+
+                application_t *app = load_application_metadata(unique_id);
+                if (app) {
+                    list->applications[list->count++] = app;
+                }
+                why_free(unique_id);
+            }
+        }
+    }
+
+    // The index is sorted in place, so hand it a copy of the list
+    application_t **apps = why_malloc((list->count + 1) * sizeof(application_t *));
+    if (apps) {
+        size_t count = 0;
+        for (size_t i = 0; i < list->count; ++i) {
+            if (list->applications[i]->unique_identifier) {
+                apps[count++] = list->applications[i];
+            }
+        }
+        application_index_write(apps, count);
+        why_free(apps);
+    }
+    return true;
+}
+
 application_list_handle application_list(application_t **out) {
+    if (out)
+        *out = NULL;
+
     if (!applications_base_dir[0])
         return NULL;
 
@@ -461,55 +1187,97 @@ application_list_handle application_list(application_t **out) {
         return NULL;
     }
 
-    // Count .json files first
+    xSemaphoreTake(application_index_lock, portMAX_DELAY);
+    application_index_header_t *index = application_index_read();
+
+    // Count .json files first, and whether the index has all of them
     struct dirent *entry;
     size_t         json_count = 0;
+    bool           indexed    = index != NULL;
 
     while ((entry = why_readdir(dir)) != NULL) {
         size_t len = strlen(entry->d_name);
         if (len > 5 && strcmp(entry->d_name + len - 5, ".json") == 0) {
             json_count++;
+            indexed = indexed && application_index_find(index, entry->d_name, len - 5);
         }
     }
+    indexed = indexed && json_count == index->count;
 
-    if (json_count == 0) {
-        why_closedir(dir);
-        if (out)
-            *out = NULL;
-        return list;
+    bool success;
+    if (indexed) {
+        success = application_list_from_index(list, index, 0, index->count);
+    } else {
+        why_free(index);
+        index   = NULL;
+        success = application_list_from_json(list, dir, json_count);
     }
+    xSemaphoreGive(application_index_lock);
 
-    list->applications = why_calloc(json_count, sizeof(application_t *));
-    if (!list->applications) {
-        why_closedir(dir);
-        why_free(list);
+    why_closedir(dir);
+
+    if (!success) {
+        if (!list->index) {
+            why_free(index);
+        }
+        application_list_close(list);
         return NULL;
     }
 
-    why_rewinddir(dir);
-    while ((entry = why_readdir(dir)) != NULL && list->count < json_count) {
-        size_t len = strlen(entry->d_name);
-        if (len > 5 && strcmp(entry->d_name + len - 5, ".json") == 0) {
-            char *unique_id = why_malloc(len - 4);
-            if (unique_id) {
-                strncpy(unique_id, entry->d_name, len - 5);
-                unique_id[len - 5] = '\0';
+    if (out && list->count > 0) {
+        *out = list->applications[0];
+    }
 
-                application_t *app = load_application_metadata(unique_id);
-                if (app) {
-                    list->applications[list->count++] = app;
-                }
-                why_free(unique_id);
-            }
+    return list;
+}
+
+application_list_handle application_list_range(size_t offset, size_t count, application_t **out, size_t *total) {
+    if (out)
+        *out = NULL;
+    if (total)
+        *total = 0;
+
+    if (!applications_base_dir[0])
+        return NULL;
+
+    xSemaphoreTake(application_index_lock, portMAX_DELAY);
+    application_index_header_t *index = application_index_read();
+    xSemaphoreGive(application_index_lock);
+
+    // No index yet, the full list writes it
+    if (!index) {
+        application_list_close(application_list(NULL));
+        xSemaphoreTake(application_index_lock, portMAX_DELAY);
+        index = application_index_read();
+        xSemaphoreGive(application_index_lock);
+        if (!index) {
+            return NULL;
         }
     }
 
-    why_closedir(dir);
+    application_list_t *list = why_calloc(1, sizeof(application_list_t));
+    if (!list) {
+        why_free(index);
+        return NULL;
+    }
+
+    size_t first = offset < index->count ? offset : index->count;
+    if (count > index->count - first) {
+        count = index->count - first;
+    }
+
+    size_t installed = index->count;
+    if (!application_list_from_index(list, index, first, count)) {
+        why_free(index);
+        application_list_close(list);
+        return NULL;
+    }
 
+    if (total) {
+        *total = installed;
+    }
     if (out && list->count > 0) {
         *out = list->applications[0];
-    } else if (out) {
-        *out = NULL;
     }
 
     return list;
@@ -532,15 +1300,22 @@ void application_list_close(application_list_handle list) {
     if (!list)
         return;
 
-    // Free all loaded applications
+    // Free all loaded applications, those from the index only if they were
+    // changed since
     for (size_t i = 0; i < list->count; i++) {
-        if (list->applications[i]) {
+        if (list->entries) {
+            if (!list->entries[i].borrowed) {
+                application_free_strings(&list->entries[i].app);
+            }
+        } else if (list->applications[i]) {
             application_t *app = (application_t *)list->applications[i];
             application_free(app);
         }
     }
 
     why_free(list->applications);
+    why_free(list->entries);
+    why_free(list->index);
     why_free(list);
 }
 
@@ -553,22 +1328,90 @@ application_t *application_get(char const *unique_identifier) {
 }
 
 void application_free(application_t *app) {
-    if (!app)
+    // Borrowed applications go with their list
+    if (!app || ((application_entry_t *)app)->borrowed)
         return;
 
-    // Cast away const to free the strings
-    why_free((void *)app->unique_identifier);
-    why_free((void *)app->name);
-    why_free((void *)app->author);
-    why_free((void *)app->version);
-    why_free((void *)app->interpreter);
-    why_free((void *)app->metadata_file);
-    why_free((void *)app->installed_path);
-    why_free((void *)app->binary_path);
-
+    application_free_strings(app);
     why_free(app);
 }
 
+static bool file_sha256(char const *path, uint8_t hash[32]) {
+    int fd = why_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    uint8_t *buffer = why_malloc(4096);
+    ssize_t  r      = -1;
+    if (buffer) {
+        mbedtls_sha256_context sha;
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts(&sha, 0);
+        while ((r = why_read(fd, buffer, 4096)) > 0) {
+            mbedtls_sha256_update(&sha, buffer, r);
+        }
+        mbedtls_sha256_finish(&sha, hash);
+        mbedtls_sha256_free(&sha);
+    }
+
+    why_free(buffer);
+    why_close(fd);
+    return r == 0;
+}
+
+// An installed application, or the path of an ELF file
+static char *interpreter_path(char const *interpreter) {
+    if (strchr(interpreter, ':')) {
+        return why_strdup(interpreter);
+    }
+
+    application_t *app  = application_get(interpreter);
+    char          *path = NULL;
+    if (app && app->binary_path && app->installed_path) {
+        path = path_concat(app->installed_path, app->binary_path);
+    }
+    application_free(app);
+    return path;
+}
+
+// Where the interpreter keeps the compiled script. Whatever was cached for an
+// earlier version of the script goes once it changed.
+static char *bytecode_cache_path(application_t *app, char const *script) {
+    uint8_t hash[32];
+    if (!file_sha256(script, hash)) {
+        return NULL;
+    }
+
+    char name[sizeof(BYTECODE_CACHE_DIR) + BYTECODE_HASH_BYTES * 2 + sizeof(".bc")];
+    int  len = snprintf(name, sizeof(name), "%s", BYTECODE_CACHE_DIR);
+    for (int i = 0; i < BYTECODE_HASH_BYTES; ++i) {
+        len += snprintf(name + len, sizeof(name) - len, "%02x", hash[i]);
+    }
+    snprintf(name + len, sizeof(name) - len, ".bc");
+
+    char *path = path_concat(app->installed_path, name);
+    if (!path) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (why_stat(path, &st) == 0) {
+        return path;
+    }
+
+    char *dir = path_dirname(path);
+    if (dir) {
+        rm_rf(dir);
+    }
+    if (!dir || !mkdir_p(dir)) {
+        why_free(path);
+        path = NULL;
+    }
+    why_free(dir);
+    return path;
+}
+
 pid_t application_launch(char const *unique_identifier) {
     if (!unique_identifier) {
         return -1;
@@ -587,8 +1430,73 @@ pid_t application_launch(char const *unique_identifier) {
         return -1;
     }
 
+    if (app->keep_warm) {
+        pid_t          pid = task_application_pid(unique_identifier);
+        process_info_t info;
+        if (pid > 0 && process_info_get(pid, &info)) {
+            why_free(binary_path);
+            application_free(app);
+            if (info.suspended && !process_resume(pid)) {
+                return -1;
+            }
+            ESP_LOGI(TAG, "%s is warm, PID %d", unique_identifier, pid);
+            return pid;
+        }
+    }
+
+    task_config_t config = {
+        .grow_size             = app->heap_grow_size,
+        .trim_size             = app->heap_trim_size,
+        .max_heap_pages        = app->max_heap_pages,
+        .max_framebuffer_pages = app->max_framebuffer_pages,
+        .cpu_class             = app->cpu_class,
+        .frame_rate            = app->frame_rate,
+    };
+
+    // A script runs as its interpreter, whose image is kept for the next one
+    char *argv[3] = {binary_path};
+    int   argc    = 0;
+    if (app->interpreter && app->interpreter[0]) {
+        argv[0] = interpreter_path(app->interpreter);
+        if (!argv[0]) {
+            ESP_LOGW(TAG, "Cannot launch %s, interpreter %s not found", unique_identifier, app->interpreter);
+            why_free(binary_path);
+            application_free(app);
+            return -1;
+        }
+        argv[1]           = binary_path;
+        argv[2]           = bytecode_cache_path(app, binary_path);
+        argc              = argv[2] ? 3 : 2;
+        config.keep_image = true;
+    }
+
     ESP_LOGI(TAG, "Attempting to launch %s", binary_path);
-    pid_t ret = process_create(binary_path, 0, 0, NULL);
+    pid_t ret = run_task_path(argv[0], 0, TASK_TYPE_ELF_PATH, argc, argv, &config);
+    if (ret > 0) {
+        task_set_application_uid(ret, unique_identifier);
+    }
+    if (argc) {
+        why_free(argv[0]);
+        why_free(argv[2]);
+    }
     why_free(binary_path);
+    application_free(app);
     return ret;
 }
+
+bool application_park(void) {
+    task_info_t *task_info = get_task_info();
+    if (task_info->type == TASK_TYPE_THREAD || !task_info->application_uid) {
+        return false;
+    }
+
+    application_t *app       = application_get(task_info->application_uid);
+    bool           keep_warm = app && app->keep_warm;
+    application_free(app);
+    if (!keep_warm) {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Parking %s", task_info->application_uid);
+    return process_suspend(task_info->pid, false);
+}
@@ -0,0 +1,412 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "application_private.h"
+#include "badgevms/application.h"
+#include "badgevms/io_ring.h"
+#include "badgevms/pathfuncs.h"
+#include "compressed_file.h"
+#include "curl/curl.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+#include "why_io.h"
+
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "bundle"
+
+// Keep in sync with misc/make_bundle.py
+#define BUNDLE_MAGIC        0x31425642 // "BVB1"
+#define BUNDLE_BLOCK_MAX    (64 * 1024)
+#define BUNDLE_MANIFEST     "manifest.json"
+#define BUNDLE_MANIFEST_MAX (16 * 1024)
+
+// A bundle is this header, then for every file an entry with its name behind
+// it and the file in LZ4 blocks, packed like OTA deltas. manifest.json comes
+// first, the other names are relative to the application directory, like
+// [DIR]FILE.EXT.
+typedef struct {
+    uint32_t magic;
+    uint32_t count; // Of the entries
+    uint32_t block_size;
+} bundle_header_t;
+
+typedef struct {
+    uint32_t size;
+    uint32_t name_len;
+} bundle_entry_t;
+
+typedef struct {
+    uint32_t packed; // The same as size if it is stored as it is
+    uint32_t size;
+} bundle_block_t;
+
+typedef enum {
+    BUNDLE_HEADER,
+    BUNDLE_ENTRY,
+    BUNDLE_NAME,
+    BUNDLE_BLOCK_HEADER,
+    BUNDLE_BLOCK,
+} bundle_stage_t;
+
+typedef struct application_bundle {
+    mbedtls_sha256_context sha; // Of everything written
+    char                  *staging_dir;
+    bool                   failed;
+
+    // What is collected of the bundle for the stage
+    bundle_stage_t stage;
+    uint8_t       *collect;
+    size_t         collect_size;
+    size_t         collected;
+
+    bundle_header_t header;
+    bundle_entry_t  entry;
+    bundle_block_t  block_header;
+    char            name[PATH_MAX_LEN + 1];
+    uint32_t        entries;  // Done
+    uint32_t        produced; // Of the entry
+    uint8_t        *packed;
+    char           *manifest;
+    size_t          manifest_size;
+
+    // Of the file being extracted. The ring's thread writes one block while
+    // the next one is extracted into the other.
+    int        fd;
+    io_ring_t *ring;
+    uint8_t   *blocks[2];
+    size_t     sizes[2];
+    bool       writing[2];
+    int        current;
+} application_bundle_t;
+
+static void bundle_collect(application_bundle_t *bundle, bundle_stage_t stage, void *dst, size_t size) {
+    bundle->stage        = stage;
+    bundle->collect      = dst;
+    bundle->collect_size = size;
+    bundle->collected    = 0;
+}
+
+static bool bundle_fail(application_bundle_t *bundle, char const *why) {
+    ESP_LOGE(TAG, "Unusable bundle: %s", why);
+    bundle->failed = true;
+    return false;
+}
+
+// Wait for the oldest block being written
+static void bundle_reap(application_bundle_t *bundle) {
+    io_completion_t completion;
+    io_ring_complete(bundle->ring, &completion, UINT32_MAX);
+
+    int block              = completion.user_data;
+    bundle->writing[block] = false;
+    if (completion.result != (ssize_t)bundle->sizes[block]) {
+        bundle_fail(bundle, strerror(completion.error));
+    }
+}
+
+// Hand size bytes of the current block to the ring, and wait until the other one is free
+static void bundle_flush(application_bundle_t *bundle, size_t size) {
+    int          block   = bundle->current;
+    io_request_t request = {
+        .op        = IO_OP_WRITE,
+        .fd        = bundle->fd,
+        .buf       = bundle->blocks[block],
+        .count     = size,
+        .offset    = -1,
+        .user_data = block,
+    };
+    if (!io_ring_submit(bundle->ring, &request)) {
+        bundle_fail(bundle, "unable to write");
+        return;
+    }
+
+    bundle->sizes[block]   = size;
+    bundle->writing[block] = true;
+    bundle->current        = !block;
+
+    while (bundle->writing[bundle->current]) {
+        bundle_reap(bundle);
+    }
+}
+
+static void bundle_file_close(application_bundle_t *bundle) {
+    while (bundle->writing[0] || bundle->writing[1]) {
+        bundle_reap(bundle);
+    }
+
+    if (bundle->fd != -1 && why_close(bundle->fd)) {
+        bundle_fail(bundle, "unable to close a file");
+    }
+    bundle->fd = -1;
+}
+
+static void bundle_entry_done(application_bundle_t *bundle) {
+    if (bundle->entries) {
+        bundle_file_close(bundle);
+    }
+
+    ++bundle->entries;
+    bundle_collect(bundle, BUNDLE_ENTRY, &bundle->entry, sizeof(bundle_entry_t));
+}
+
+static bool bundle_header(application_bundle_t *bundle) {
+    bundle_header_t const *header = &bundle->header;
+
+    if (header->magic != BUNDLE_MAGIC) {
+        return bundle_fail(bundle, "not a bundle");
+    }
+    if (!header->count || !header->block_size || header->block_size > BUNDLE_BLOCK_MAX) {
+        return bundle_fail(bundle, "bad header");
+    }
+
+    bundle->ring      = io_ring_create(2);
+    bundle->packed    = why_malloc(header->block_size);
+    bundle->blocks[0] = why_malloc(header->block_size);
+    bundle->blocks[1] = why_malloc(header->block_size);
+    if (!bundle->ring || !bundle->packed || !bundle->blocks[0] || !bundle->blocks[1]) {
+        return bundle_fail(bundle, "out of memory");
+    }
+
+    bundle_collect(bundle, BUNDLE_ENTRY, &bundle->entry, sizeof(bundle_entry_t));
+    return true;
+}
+
+static bool bundle_entry(application_bundle_t *bundle) {
+    if (bundle->entries == bundle->header.count) {
+        return bundle_fail(bundle, "more than its entries");
+    }
+    if (!bundle->entry.name_len || bundle->entry.name_len > PATH_MAX_LEN) {
+        return bundle_fail(bundle, "bad entry");
+    }
+
+    bundle_collect(bundle, BUNDLE_NAME, bundle->name, bundle->entry.name_len);
+    return true;
+}
+
+static bool bundle_name(application_bundle_t *bundle) {
+    bundle->name[bundle->entry.name_len] = '\0';
+    bundle->produced                     = 0;
+
+    if (!bundle->entries) {
+        if (strcmp(bundle->name, BUNDLE_MANIFEST) || bundle->entry.size > BUNDLE_MANIFEST_MAX) {
+            return bundle_fail(bundle, "no manifest");
+        }
+        bundle->manifest      = why_malloc(bundle->entry.size + 1);
+        bundle->manifest_size = bundle->entry.size;
+        if (!bundle->manifest) {
+            return bundle_fail(bundle, "out of memory");
+        }
+    } else {
+        // Nothing outside the application directory
+        char *path = strstr(bundle->name, "..") ? NULL : path_concat(bundle->staging_dir, bundle->name);
+        char *dir  = path ? path_dirname(path) : NULL;
+        if (dir && mkdir_p(dir)) {
+            bundle->fd = why_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        why_free(dir);
+        why_free(path);
+        if (bundle->fd == -1) {
+            ESP_LOGE(TAG, "Unable to create %s", bundle->name);
+            return bundle_fail(bundle, "bad file name");
+        }
+    }
+
+    if (!bundle->entry.size) {
+        bundle_entry_done(bundle);
+    } else {
+        bundle_collect(bundle, BUNDLE_BLOCK_HEADER, &bundle->block_header, sizeof(bundle_block_t));
+    }
+    return true;
+}
+
+// Where the current block goes unpacked
+static uint8_t *bundle_output(application_bundle_t *bundle) {
+    return bundle->entries ? bundle->blocks[bundle->current] : (uint8_t *)bundle->manifest + bundle->produced;
+}
+
+static bool bundle_block_header(application_bundle_t *bundle) {
+    bundle_block_t const *block = &bundle->block_header;
+
+    if (!block->size || block->size > bundle->header.block_size ||
+        block->size > bundle->entry.size - bundle->produced || !block->packed || block->packed > block->size) {
+        return bundle_fail(bundle, "bad block");
+    }
+
+    // Stored blocks go where they are used
+    bundle_collect(
+        bundle,
+        BUNDLE_BLOCK,
+        block->packed == block->size ? bundle_output(bundle) : bundle->packed,
+        block->packed
+    );
+    return true;
+}
+
+static bool bundle_block(application_bundle_t *bundle) {
+    bundle_block_t const *block = &bundle->block_header;
+
+    if (block->packed != block->size &&
+        !lz4_decompress(bundle->packed, block->packed, bundle_output(bundle), block->size)) {
+        return bundle_fail(bundle, "damaged block");
+    }
+    if (bundle->entries) {
+        bundle_flush(bundle, block->size);
+    }
+
+    bundle->produced += block->size;
+    if (bundle->produced == bundle->entry.size) {
+        bundle_entry_done(bundle);
+    } else {
+        bundle_collect(bundle, BUNDLE_BLOCK_HEADER, &bundle->block_header, sizeof(bundle_block_t));
+    }
+    return !bundle->failed;
+}
+
+application_bundle_handle application_bundle_open(void) {
+    application_bundle_t *bundle = why_calloc(1, sizeof(application_bundle_t));
+    if (!bundle) {
+        return NULL;
+    }
+
+    bundle->staging_dir = application_staging_dir();
+    if (!bundle->staging_dir) {
+        ESP_LOGE(TAG, "Unable to create a directory to extract the bundle in");
+        why_free(bundle);
+        return NULL;
+    }
+
+    bundle->fd = -1;
+    mbedtls_sha256_init(&bundle->sha);
+    mbedtls_sha256_starts(&bundle->sha, 0);
+    bundle_collect(bundle, BUNDLE_HEADER, &bundle->header, sizeof(bundle_header_t));
+    return bundle;
+}
+
+bool application_bundle_write(application_bundle_handle bundle, void const *data, size_t size) {
+    uint8_t const *bytes = data;
+
+    if (!bundle) {
+        return false;
+    }
+
+    if (!bundle->failed) {
+        mbedtls_sha256_update(&bundle->sha, bytes, size);
+    }
+
+    while (size && !bundle->failed) {
+        size_t n = MIN(size, bundle->collect_size - bundle->collected);
+        memcpy(bundle->collect + bundle->collected, bytes, n);
+        bundle->collected += n;
+        bytes             += n;
+        size              -= n;
+        if (bundle->collected < bundle->collect_size) {
+            break;
+        }
+
+        switch (bundle->stage) {
+            case BUNDLE_HEADER: bundle_header(bundle); break;
+            case BUNDLE_ENTRY: bundle_entry(bundle); break;
+            case BUNDLE_NAME: bundle_name(bundle); break;
+            case BUNDLE_BLOCK_HEADER: bundle_block_header(bundle); break;
+            case BUNDLE_BLOCK: bundle_block(bundle); break;
+        }
+    }
+    return !bundle->failed;
+}
+
+void application_bundle_abort(application_bundle_handle bundle) {
+    if (!bundle) {
+        return;
+    }
+
+    if (bundle->ring) {
+        bundle_file_close(bundle);
+        io_ring_destroy(bundle->ring);
+    }
+    why_free(bundle->blocks[0]);
+    why_free(bundle->blocks[1]);
+    why_free(bundle->packed);
+    why_free(bundle->manifest);
+    mbedtls_sha256_free(&bundle->sha);
+
+    // Already gone if it was installed
+    rm_rf(bundle->staging_dir);
+    why_free(bundle->staging_dir);
+    why_free(bundle);
+}
+
+application_t *application_bundle_commit(application_bundle_handle bundle, uint8_t const sha256[32]) {
+    if (!bundle) {
+        return NULL;
+    }
+
+    application_t *app = NULL;
+    uint8_t        digest[32];
+    mbedtls_sha256_finish(&bundle->sha, digest);
+
+    if (bundle->failed || bundle->stage != BUNDLE_ENTRY || bundle->collected ||
+        bundle->entries != bundle->header.count) {
+        ESP_LOGE(TAG, "The bundle is incomplete");
+    } else if (sha256 && memcmp(digest, sha256, sizeof(digest))) {
+        ESP_LOGE(TAG, "The bundle doesn't match its SHA-256");
+    } else {
+        app = application_from_manifest(bundle->manifest, bundle->manifest_size);
+        if (!app || !app->unique_identifier || !application_install_dir(app, bundle->staging_dir)) {
+            ESP_LOGE(TAG, "Unable to install the bundle");
+            application_free(app);
+            app = NULL;
+        }
+    }
+
+    application_bundle_abort(bundle);
+    return app;
+}
+
+static size_t bundle_curl_write(void *data, size_t size, size_t nmemb, void *user_data) {
+    return application_bundle_write(user_data, data, size * nmemb) ? size * nmemb : 0;
+}
+
+application_t *application_bundle_install(char const *url, uint8_t const sha256[32]) {
+    application_bundle_handle bundle = application_bundle_open();
+    CURL                     *curl   = bundle ? curl_easy_init() : NULL;
+    if (!curl) {
+        application_bundle_abort(bundle);
+        return NULL;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bundle_curl_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, bundle);
+
+    long     status = 0;
+    CURLcode res    = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_cleanup(curl);
+
+    if (res != CURLE_OK || status != 200) {
+        ESP_LOGE(TAG, "Unable to download %s: %s, status %ld", url, curl_easy_strerror(res), status);
+        application_bundle_abort(bundle);
+        return NULL;
+    }
+    return application_bundle_commit(bundle, sha256);
+}
@@ -16,6 +16,21 @@
 
 #pragma once
 
+#include "badgevms/application.h"
+
 #include <stdbool.h>
+#include <stddef.h>
 
 bool application_init(char const *applications_dir, char const *flash_dir, char const *sd_dir);
+
+// For settings.c. Where the settings of unique_identifier are kept, the
+// caller should free() the string.
+char          *application_settings_path(char const *unique_identifier);
+// For application_bundle.c. A new empty directory to extract a bundle in,
+// the caller should free() the string.
+char          *application_staging_dir(void);
+// NULL if the manifest.json or .json file of size bytes isn't valid
+application_t *application_from_manifest(char const *content, size_t size);
+// Move the files extracted in staging_dir in place of those of app, if any,
+// and write its metadata
+bool           application_install_dir(application_t *app, char const *staging_dir);
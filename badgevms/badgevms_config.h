@@ -18,6 +18,13 @@
 
 #define MIN_STACK_SIZE 16384
 
+// The bottom of the stack of a user task is watched, so an overflow kills the
+// task before it corrupts memory. A power of two, tasks get twice this on top
+// of what they asked for to align it. Watchpoint 1 is the one ESP-IDF uses for
+// the same.
+#define STACK_GUARD_SIZE       256
+#define STACK_GUARD_WATCHPOINT 1
+
 #define FRAMEBUFFER_MAX_W       720
 #define FRAMEBUFFER_MAX_H       720
 #define FRAMEBUFFER_MAX_REFRESH 60
@@ -26,11 +33,141 @@
 #define FRAMEBUFFER_BYTES (FRAMEBUFFER_MAX_W * FRAMEBUFFER_MAX_W * FRAMEBUFFER_BPP)
 
 // Maximum number of pending events for a window
-#define WINDOW_MAX_EVENTS 10
+#define WINDOW_MAX_EVENTS 64
 
 // Maximum windows allowed on the screen
 #define MAX_WINDOWS 10
 
-#define DISPLAY_FRAMEBUFFERS 3
+// Maximum overlays allowed on the screen
+#define MAX_OVERLAYS 4
+
+// High resolution timers of all applications together, see hrtimer.h. Each
+// thread that sleeps takes one as well.
+#define MAX_HRTIMERS 64
+
+// Sleeps shorter than this spin, waking up through esp_timer takes about as long
+#define SLEEP_SPIN_US 20
+
+// Where process_suspend() writes the memory of a process it hibernates, by pid
+#define HIBERNATE_PATH     "SD0:hibernate_%d.bin"
+#define HIBERNATE_PATH_MAX 32
+
+// Relocated program images are kept next to their ELF file, in a file with
+// this appended to its name, so later launches skip relocation
+#define PRELINK_SUFFIX ".prelink"
+
+// Where shared libraries a program needs are looked up by name, see library.h.
+// A program can need LIBRARY_MAX_NEEDED of them.
+#define LIBRARY_PATH       "LIBS:"
+#define LIBRARY_NAME_MAX   32
+#define LIBRARY_MAX_NEEDED 4
+
+// Frame rate budget for windows that are not in front, partly covered and
+// completely covered. Their vsync waits and presents are throttled to it.
+#define BACKGROUND_WINDOW_FPS 30
+#define HIDDEN_WINDOW_FPS     1
+
+// The panel refreshes at a lower rate once nothing was presented, no window
+// waited for a frame and no key was pressed for this many refreshes. Scanning
+// out an unchanged picture only takes PSRAM bandwidth from applications.
+#define DISPLAY_IDLE_REFRESHES (FRAMEBUFFER_MAX_REFRESH * 2)
+
+// The CPU drops to the crystal clock once nothing needed it for
+// GOVERNOR_IDLE_MS. Every GOVERNOR_SAMPLE_MS a core that ran anything but its
+// idle task and batch applications for GOVERNOR_BUSY_PERCENT of the ticks
+// brings it back to full speed, see governor.h.
+#define GOVERNOR_MIN_FREQ_MHZ 40
+#define GOVERNOR_IDLE_MS      500
+#define GOVERNOR_SAMPLE_MS    50
+#define GOVERNOR_BUSY_PERCENT 50
+
+// The panel gets DISPLAY_FRAMEBUFFERS of a megabyte each unless fewer are set
+// with display_framebuffers_set(). With three the compositor draws the next
+// frame while one is waiting to be shown, two leave more memory to applications.
+#define DISPLAY_FRAMEBUFFERS     3
+#define DISPLAY_FRAMEBUFFERS_MIN 2
+
+// Application heaps are mapped in steps of at least HEAP_GROW_SIZE and only
+// shrink once HEAP_TRIM_SIZE at the top is unused. The manifest of an
+// application can override both, see application.h.
+#define HEAP_GROW_SIZE (256 * 1024)
+#define HEAP_TRIM_SIZE (1024 * 1024)
+
+// Free PSRAM pages kept zeroed in the background for heaps and framebuffers
+#define ZEROED_PAGES_TARGET 64
+
+// Single PSRAM pages cached per core in front of the page allocator, which
+// is refilled from and drained to by half a magazine at a time
+#define PAGE_MAGAZINE_SIZE 16
+
+// Settings of applications, see badgevms/settings.h. What changed is written
+// by Hephaestus this long after the first change. The file is written anew
+// once it holds more than twice what is still set, plus this many bytes. An
+// application can't keep more than SETTINGS_STORE_MAX bytes of keys and values.
+#define SETTINGS_FLUSH_MS    1000
+#define SETTINGS_COMPACT_MIN 4096
+#define SETTINGS_STORE_MAX   (32 * 1024)
+
+// PSRAM pages kept for the read-only part of program images, see image_cache.h.
+// Images no process has mapped are dropped, least recently used first, above this.
+#define IMAGE_CACHE_MAX_PAGES 128
+
+// Memory pressure levels, by the share of PSRAM pages still free, and how long
+// an allocation that is out of pages waits for applications to release some
+#define MEMORY_PRESSURE_LOW_PERCENT      15
+#define MEMORY_PRESSURE_CRITICAL_PERCENT 5
+#define MEMORY_RECLAIM_WAIT_MS           200
+
+// Boots that trust the cached result of the full PSRAM test and only check a
+// word every PSRAM_QUICK_TEST_STRIDE bytes
+#define PSRAM_TEST_INTERVAL_BOOTS 32
+#define PSRAM_QUICK_TEST_STRIDE   4096
+
+// Check every MMU entry is in the expected state when switching address spaces
+#ifdef NDEBUG
+#define MMU_VERIFY_SWITCHES 0
+#else
+#define MMU_VERIFY_SWITCHES 1
+#endif
+
+// Kernel events kept per core for trace_dump(), a power of two. Release
+// builds compile tracing out.
+#ifdef NDEBUG
+#define TRACE_EVENTS 0
+#else
+#define TRACE_EVENTS 1024
+#endif
+
+// Console output is queued in a ring of TTY_RING_SIZE bytes, a power of two,
+// and written to the console by a kernel task. When the ring is full writers
+// wait for room with TTY_BLOCKING, otherwise what doesn't fit is dropped and
+// the console says how much.
+#define TTY_RING_SIZE (16 * 1024)
+#define TTY_BLOCKING  0
+
+// poll(), select() and wait_any() sleep on up to WAIT_MAX_DEVICES devices that
+// say when they are ready, with up to WAIT_LIST_SLOTS threads on each. Past
+// that a device is taken to be always ready.
+#define WAIT_MAX_DEVICES 8
+#define WAIT_LIST_SLOTS  8
+
+// Blocks smaller than this are left to the libc memcpy() and memset(), the PIE
+// versions only pay off once the alignment and setup is amortized
+#define FAST_MEM_MIN_SIZE 256
+
+// Internal SRAM a process can hold with malloc_fast(), and what is always left
+// to the kernel however many processes ask for it
+#define FAST_ALLOC_PROCESS_QUOTA  (32 * 1024)
+#define FAST_ALLOC_KERNEL_RESERVE (64 * 1024)
+
+// The boot profile is stored in NVS this long after boot_profile_init(), once
+// wifi is usually up. Stages after that only show for the running boot.
+#define BOOT_PROFILE_STORE_MS (20 * 1000)
 
 #define I2C0_MASTER_FREQ_HZ 100 * 1000 // i2c bus speed for the i2c bus on the carrier board, being I2C_NUM_0
+
+// Devices run at their own clock on the shared bus, those on the badge itself
+// do fast mode. Programs can ask for up to fast mode plus.
+#define TCA8418_I2C_FREQ_HZ (400 * 1000)
+#define BMI270_I2C_FREQ_HZ  (400 * 1000)
+#define I2C_MAX_FREQ_HZ     (1000 * 1000)
@@ -0,0 +1,161 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms_config.h"
+#include "boot_profile_private.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "task.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "boot_profile"
+
+#define BOOT_PROFILE_NVS_NAMESPACE "badgevms_boot"
+// Slot of the newest profile, each is stored under "profile<slot>" with only
+// the stages it has
+#define BOOT_PROFILE_NVS_LATEST    "latest"
+#define BOOT_PROFILE_HEADER_SIZE   offsetof(boot_profile_t, stages)
+
+static boot_profile_t profile;
+static bool           profile_stored;
+static portMUX_TYPE   profile_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_profile_stage(char const *name, int64_t start_us) {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL_SAFE(&profile_lock);
+    if (profile.num_stages < BOOT_PROFILE_MAX_STAGES) {
+        boot_stage_t *stage = &profile.stages[profile.num_stages++];
+        strlcpy(stage->name, name, sizeof(stage->name));
+        stage->start_us    = start_us;
+        stage->duration_us = now - start_us;
+    }
+    portEXIT_CRITICAL_SAFE(&profile_lock);
+}
+
+void boot_profile_mark(char const *name) {
+    boot_profile_stage(name, esp_timer_get_time());
+}
+
+static void profile_key(char *key, size_t size, int slot) {
+    snprintf(key, size, "profile%d", slot);
+}
+
+static bool profile_read(nvs_handle_t handle, int slot, boot_profile_t *out) {
+    char   key[NVS_KEY_NAME_MAX_SIZE];
+    size_t length = sizeof(*out);
+
+    profile_key(key, sizeof(key), slot);
+    if (nvs_get_blob(handle, key, out, &length) != ESP_OK || length < BOOT_PROFILE_HEADER_SIZE ||
+        length != BOOT_PROFILE_HEADER_SIZE + out->num_stages * sizeof(boot_stage_t)) {
+        return false;
+    }
+    return true;
+}
+
+static void profile_store(void) {
+    nvs_handle_t handle;
+    if (nvs_open(BOOT_PROFILE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to open NVS");
+        return;
+    }
+
+    // The previous boot numbers this one
+    uint8_t         latest = 0;
+    uint32_t        boot   = 1;
+    boot_profile_t *last   = malloc(sizeof(boot_profile_t));
+    if (nvs_get_u8(handle, BOOT_PROFILE_NVS_LATEST, &latest) == ESP_OK) {
+        if (last && profile_read(handle, latest % BOOT_PROFILE_HISTORY, last)) {
+            boot = last->boot + 1;
+        }
+        latest = (latest + 1) % BOOT_PROFILE_HISTORY;
+    }
+    free(last);
+
+    boot_profile_t *snapshot = malloc(sizeof(boot_profile_t));
+    if (!snapshot) {
+        nvs_close(handle);
+        return;
+    }
+    portENTER_CRITICAL(&profile_lock);
+    profile.boot = boot;
+    *snapshot    = profile;
+    portEXIT_CRITICAL(&profile_lock);
+
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    profile_key(key, sizeof(key), latest);
+    size_t size = BOOT_PROFILE_HEADER_SIZE + snapshot->num_stages * sizeof(boot_stage_t);
+    if (nvs_set_blob(handle, key, snapshot, size) != ESP_OK ||
+        nvs_set_u8(handle, BOOT_PROFILE_NVS_LATEST, latest) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to store the profile of boot %lu", boot);
+    } else {
+        profile_stored = true;
+        ESP_LOGI(TAG, "Stored the profile of boot %lu, %lu stages", boot, snapshot->num_stages);
+    }
+
+    nvs_close(handle);
+    free(snapshot);
+}
+
+// Waits for the boot to settle, wifi included, then keeps what it took
+static void chronos(void *ignored) {
+    vTaskDelay(pdMS_TO_TICKS(BOOT_PROFILE_STORE_MS));
+    profile_store();
+    vTaskDelete(NULL);
+}
+
+void boot_profile_init(void) {
+    if (create_kernel_task(chronos, "Chronos", 3072, NULL, 1, NULL, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start Chronos, boot profiles are not stored");
+    }
+}
+
+bool boot_profile_get(int ago, boot_profile_t *out) {
+    if (ago < 0 || ago >= BOOT_PROFILE_HISTORY || !out) {
+        return false;
+    }
+
+    if (ago == 0) {
+        portENTER_CRITICAL(&profile_lock);
+        *out = profile;
+        portEXIT_CRITICAL(&profile_lock);
+        return true;
+    }
+
+    nvs_handle_t handle;
+    uint8_t      latest;
+    if (nvs_open(BOOT_PROFILE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    if (nvs_get_u8(handle, BOOT_PROFILE_NVS_LATEST, &latest) != ESP_OK) {
+        nvs_close(handle);
+        return false;
+    }
+
+    // Until this boot is stored the newest one is the one before
+    int  slot = (latest + (profile_stored ? 0 : 1) - ago + BOOT_PROFILE_HISTORY) % BOOT_PROFILE_HISTORY;
+    bool ok   = profile_read(handle, slot, out);
+    nvs_close(handle);
+    return ok;
+}
@@ -0,0 +1,29 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/boot_profile.h"
+
+#include <stdint.h>
+
+// A stage that began at start_us, from esp_timer_get_time(), and ends now.
+// Safe from any task at any time, stages that don't fit are dropped.
+void boot_profile_stage(char const *name, int64_t start_us);
+// Something that happened just now
+void boot_profile_mark(char const *name);
+// Stores the profile in NVS once the boot has settled, needs NVS and tasks
+void boot_profile_init(void);
@@ -42,11 +42,14 @@
  * of where you start. There's no need to explicitly keep track of buddies this way
  * nor are there any lookups.
  *
- * The allocator works by storing double linked lists of free blocks of each order.
+ * The allocator keeps a bitmap of free blocks for each order, with a bit for every
+ * block of that order that can exist. A set bit means the block starting there is
+ * free and of that order. Finding a free block is a count leading zeroes over the
+ * words of a bitmap and finding out whether a buddy is free is testing one bit.
  * When an allocation is made, we take the smallest block that can satisfy our
  * request, and if it is too big we split it down until we have a block of the size
  * we want. With every split a new free block of a lower order gets added to the
- * free list.
+ * bitmap of that order.
  *
  * The allocator starts by pushing all of the pages into a single block at the
  * highest order.
@@ -146,40 +149,50 @@ __attribute__((always_inline)) static inline uint8_t get_order(size_t size) {
     }
 }
 
-__attribute__((always_inline)) static inline void list_init(buddy_block_t *list) {
-    list->prev = list;
-    list->next = list;
-}
+// Bit 31 of a word is the lowest block in it, so clz32() finds the first free one
+#define MAP_BIT(n) (0x80000000u >> ((n) & 31))
 
-__attribute__((always_inline)) static inline void list_push_back(buddy_block_t *list, buddy_block_t *entry) {
-    entry->in_list      = true;
-    buddy_block_t *prev = list->prev;
-    entry->prev         = prev;
-    entry->next         = list;
-    prev->next          = entry;
-    list->prev          = entry;
+__attribute__((always_inline)) static inline size_t map_words(uint8_t max_order, uint8_t order) {
+    return ((1 << (max_order - order)) + 31) / 32;
 }
 
-__attribute__((always_inline)) static inline void list_remove(buddy_block_t *entry) {
-    entry->in_list      = false;
-    buddy_block_t *prev = entry->prev;
-    buddy_block_t *next = entry->next;
-    prev->next          = next;
-    next->prev          = prev;
+__attribute__((always_inline)) static inline bool block_is_free(memory_pool_t *pool, size_t index, uint8_t order) {
+    size_t n = index >> order;
+    return pool->free_maps[order][n / 32] & MAP_BIT(n);
 }
 
-__attribute__((always_inline)) static inline bool list_empty(buddy_block_t *list) {
-    if (list->prev == list) {
-        return true;
+// A free block that starts with waste is never handed out, so it isn't counted
+// in free_blocks. The bitmaps still have it, its buddy may merge with it.
+__attribute__((always_inline)) static inline void free_map_add(memory_pool_t *pool, buddy_block_t *block) {
+    size_t n = block_to_index(pool, block) >> block->order;
+
+    pool->free_maps[block->order][n / 32] |= MAP_BIT(n);
+    if (block->zeroed) {
+        pool->zeroed_maps[block->order][n / 32] |= MAP_BIT(n);
+        pool->zeroed_pages                      += 1 << block->order;
     }
+    if (!block->is_waste) {
+        ++pool->free_blocks[block->order];
+    }
+}
 
-    return false;
+__attribute__((always_inline)) static inline void free_map_remove(memory_pool_t *pool, buddy_block_t *block) {
+    size_t n = block_to_index(pool, block) >> block->order;
+
+    pool->free_maps[block->order][n / 32] &= ~MAP_BIT(n);
+    if (block->zeroed) {
+        pool->zeroed_maps[block->order][n / 32] &= ~MAP_BIT(n);
+        pool->zeroed_pages                      -= 1 << block->order;
+    }
+    if (!block->is_waste) {
+        --pool->free_blocks[block->order];
+    }
 }
 
 /* Split a block
  *
  * The block we're splitting is always the left-most part, so we can just determine
- * the buddy and place that block on the free list.
+ * the buddy and mark that block free. Both halves of a zeroed block are zeroed.
  */
 
 static void split_block(memory_pool_t *pool, buddy_block_t *block) {
@@ -189,21 +202,18 @@ static void split_block(memory_pool_t *pool, buddy_block_t *block) {
 
     buddy_block_t *new_block = index_to_block(pool, buddy_index);
     new_block->order         = block->order;
+    new_block->zeroed        = block->zeroed && !new_block->is_waste;
 
-    if (!new_block->is_waste) {
-        list_push_back(&pool->free_lists[new_block->order], new_block); // Place buddy on the free list
-    } else {
-        list_push_back(&pool->waste_list, new_block); // Place buddy on the waste list
-    }
+    free_map_add(pool, new_block); // Mark buddy free
 }
 
 /* Try merging a block with its buddy
  *
- * First see if our buddy is free, if it is we remove it the free list
+ * First see if our buddy is free, if it is we remove it from the bitmap
  * and increase the order of ourselves.
  *
  * Merging only occurs when freeing a block, this means that the block we're starting
- * with is never itself on a free list.
+ * with is never itself in a bitmap.
  *
  * There are 3 possibilities here:
  *
@@ -212,23 +222,25 @@ static void split_block(memory_pool_t *pool, buddy_block_t *block) {
  * - The buddy is free and is to the left of us, in this case we free our buddy,
  *   switch the block pointer to our buddy, increase that order and then return that.
  * - Our buddy isn't free, we return NULL.
+ *
+ * The merged block is only zeroed if both halves were.
  */
 
 static buddy_block_t *try_merge_buddy(memory_pool_t *pool, buddy_block_t *block) {
     size_t index       = block_to_index(pool, block);
     size_t buddy_index = index ^ (1 << block->order);
 
-    if (buddy_index > pool->pages + pool->max_order_waste) {
+    if (buddy_index >= pool->pages + pool->max_order_waste) {
         return NULL;
     }
 
-    buddy_block_t *buddy = index_to_block(pool, buddy_index);
-    if (buddy->order == block->order && buddy->in_list) {
-        // list_remove(block); // The block itself is never in a list
-        list_remove(buddy);
+    if (block_is_free(pool, buddy_index, block->order)) {
+        buddy_block_t *buddy = index_to_block(pool, buddy_index);
+        free_map_remove(pool, buddy);
 
         // Return the lowest part as the merged block.
         buddy_block_t *merged_block = index <= buddy_index ? block : buddy;
+        merged_block->zeroed        = block->zeroed && buddy->zeroed;
         ++merged_block->order;
 
         return merged_block;
@@ -242,23 +254,26 @@ static buddy_block_t *try_merge_buddy(memory_pool_t *pool, buddy_block_t *block)
  * In order to free a block we need to recursively try to merge the block
  * until we reach a point where there's no more free buddies to merge with.
  *
- * Finally we push the free, merged, block to our free list.
+ * Finally we mark the free, merged, block in the bitmap of its order.
  */
 
-void free_block(allocator_t *allocator, memory_pool_t *pool, buddy_block_t *block) {
-    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+static void free_block_locked(memory_pool_t *pool, buddy_block_t *block) {
     buddy_block_t *free_block = block;
 
+    pool->free_pages += (1 << block->order);
     while ((block = try_merge_buddy(pool, block))) {
         free_block = block;
     }
 
     if (!free_block->is_waste) {
         pool->max_order_free = MAX(pool->max_order_free, free_block->order);
-        list_push_back(&pool->free_lists[free_block->order], free_block);
-    } else {
-        list_push_back(&pool->waste_list, free_block);
     }
+    free_map_add(pool, free_block);
+}
+
+void free_block(allocator_t *allocator, memory_pool_t *pool, buddy_block_t *block) {
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+    free_block_locked(pool, block);
     xSemaphoreGive(allocator->memory_pool_mutex);
 }
 
@@ -271,19 +286,34 @@ void IRAM_ATTR init_pool(allocator_t *allocator, void *mem_start, void *mem_end,
     if (!allocator->memory_pool_mutex)
         allocator->memory_pool_mutex = xSemaphoreCreateMutex();
 
-    size_t  total_pages = (mem_end - mem_start) / PAGE_SIZE;
-    uint8_t orders      = get_order(total_pages);
+    memory_pool_t *pool        = &allocator->memory_pools[allocator->memory_pool_num];
+    size_t         total_pages = (mem_end - mem_start) / PAGE_SIZE;
+    uint8_t        orders      = get_order(total_pages);
+
+    if (orders > BUDDY_MAX_ORDER) {
+        ESP_LOGW(DRAM_STR("init_pool"), "Pool too large; discarding %p", mem_start);
+        return;
+    }
 
-    size_t metadata_block_size      = sizeof(buddy_block_t) * total_pages;
-    size_t metadata_free_lists_size = sizeof(buddy_block_t) * (orders + 1);
+    // There is a block for every index up to the highest order, the ones past
+    // the end of memory are waste
+    size_t metadata_block_size = sizeof(buddy_block_t) * (1 << orders);
+    size_t metadata_maps_size  = 0;
+    for (int i = 0; i <= orders; ++i) {
+        metadata_maps_size += 2 * sizeof(uint32_t) * map_words(orders, i);
+    }
 
-    allocator->memory_pools[allocator->memory_pool_num].free_lists = mem_start;
-    allocator->memory_pools[allocator->memory_pool_num].blocks =
-        ALIGN_UP(allocator->memory_pools[allocator->memory_pool_num].free_lists + metadata_free_lists_size, 8);
+    uint32_t *map = mem_start;
+    for (int i = 0; i <= orders; ++i) {
+        pool->free_maps[i]    = map;
+        map                  += map_words(orders, i);
+        pool->zeroed_maps[i]  = map;
+        map                  += map_words(orders, i);
+    }
+    pool->blocks = ALIGN_UP(mem_start + metadata_maps_size, 8);
 
-    void *pages_start =
-        ALIGN_PAGE_UP((void *)allocator->memory_pools[allocator->memory_pool_num].blocks + metadata_block_size);
-    void *pages_end = ALIGN_PAGE_DOWN(mem_end);
+    void *pages_start = ALIGN_PAGE_UP((void *)pool->blocks + metadata_block_size);
+    void *pages_end   = ALIGN_PAGE_DOWN(mem_end);
 
     size_t   pages           = ((size_t)pages_end - (size_t)pages_start) / PAGE_SIZE;
     // NOLINTNEXTLINE
@@ -300,65 +330,46 @@ void IRAM_ATTR init_pool(allocator_t *allocator, void *mem_start, void *mem_end,
     ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Mem start: %p, pages_start, %p", mem_start, pages_start);
     ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Mem end: %p, pages_end, %p", mem_end, pages_end);
     ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Max orders: %u, max_order_waste: %lu", orders, max_order_waste);
-    ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Waste starts at: %lu", pages - max_order_waste);
+    ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Waste starts at: %lu", pages);
     ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Metadata block size: %lu", metadata_block_size);
-    ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Metadata free lists size: %lu", metadata_free_lists_size);
-
-    allocator->memory_pools[allocator->memory_pool_num].flags           = flags;
-    allocator->memory_pools[allocator->memory_pool_num].start           = mem_start;
-    allocator->memory_pools[allocator->memory_pool_num].end             = mem_end;
-    allocator->memory_pools[allocator->memory_pool_num].pages_start     = pages_start;
-    allocator->memory_pools[allocator->memory_pool_num].pages_end       = pages_end;
-    allocator->memory_pools[allocator->memory_pool_num].pages           = pages;
-    allocator->memory_pools[allocator->memory_pool_num].free_pages      = pages;
-    allocator->memory_pools[allocator->memory_pool_num].max_order       = orders;
-    allocator->memory_pools[allocator->memory_pool_num].max_order_waste = max_order_waste;
-
-    // Zero out all of our metadata
-    __builtin_memset(allocator->memory_pools[allocator->memory_pool_num].start, 0, pages_start - mem_start); // NOLINT
-
-    // Initialize our free lists to be empty
-    for (int i = 0; i <= orders; ++i) {
-        list_init(&allocator->memory_pools[allocator->memory_pool_num].free_lists[i]);
-    }
-    list_init(&allocator->memory_pools[allocator->memory_pool_num].waste_list);
+    ESP_DRAM_LOGI(DRAM_STR("init_pool"), "Metadata bitmaps size: %lu", metadata_maps_size);
+
+    pool->flags           = flags;
+    pool->start           = mem_start;
+    pool->end             = mem_end;
+    pool->pages_start     = pages_start;
+    pool->pages_end       = pages_end;
+    pool->pages           = pages;
+    pool->free_pages      = pages;
+    pool->max_order       = orders;
+    pool->max_order_waste = max_order_waste;
+
+    // Zero out all of our metadata, this also leaves all bitmaps empty
+    __builtin_memset(pool->start, 0, pages_start - mem_start); // NOLINT
 
     // Mark all of our waste pages as unusable
-    for (size_t i = pages - max_order_waste; i < total_pages; ++i) {
-        allocator->memory_pools[allocator->memory_pool_num].blocks[i].is_waste = true;
+    for (size_t i = pages; i < ((size_t)1 << orders); ++i) {
+        pool->blocks[i].is_waste = true;
     }
 
     // Create free block of all available pages
-    allocator->memory_pools[allocator->memory_pool_num].blocks[0].order = orders;
-    allocator->memory_pools[allocator->memory_pool_num].blocks[0].next =
-        &allocator->memory_pools[allocator->memory_pool_num].blocks[0];
-    allocator->memory_pools[allocator->memory_pool_num].blocks[0].prev =
-        &allocator->memory_pools[allocator->memory_pool_num].blocks[0];
-
-    // Push free block to the free list
-    list_push_back(
-        &allocator->memory_pools[allocator->memory_pool_num].free_lists[orders],
-        &allocator->memory_pools[allocator->memory_pool_num].blocks[0]
-    );
-    allocator->memory_pools[allocator->memory_pool_num].max_order_free = orders;
+    pool->blocks[0].order = orders;
+    free_map_add(pool, &pool->blocks[0]);
+
+    pool->max_order_free = orders;
     ++allocator->memory_pool_num;
 }
 
-void print_list(memory_pool_t *pool, buddy_block_t *list, size_t *total) {
-    size_t         blocks     = 0;
-    size_t         list_total = 0;
-    buddy_block_t *block      = list;
-    while (block) {
-        if (block->prev == list) {
-            break;
+void print_map(memory_pool_t *pool, uint8_t order, size_t *total) {
+    size_t blocks = 0;
+    for (size_t n = 0; n < ((size_t)1 << (pool->max_order - order)); ++n) {
+        if (block_is_free(pool, n << order, order)) {
+            ++blocks;
+            esp_rom_printf("(%u) ", n << order);
         }
-        ++blocks;
-        block       = block->prev;
-        list_total += 1 << block->order;
-        esp_rom_printf("(%u) ", block_to_index(pool, block));
     }
-    *total += list_total;
-    esp_rom_printf("%u blocks (%u pages)\n", blocks, list_total);
+    *total += blocks << order;
+    esp_rom_printf("%u blocks (%u pages)\n", blocks, blocks << order);
 }
 
 void print_allocator(allocator_t *allocator) {
@@ -369,16 +380,14 @@ void print_allocator(allocator_t *allocator) {
         size_t total = 0;
         for (int i = 0; i <= pool->max_order; ++i) {
             esp_rom_printf("Order %u, ", i);
-            print_list(pool, &pool->free_lists[i], &total);
+            print_map(pool, i, &total);
         }
 
-        esp_rom_printf("Waste: ");
-        print_list(pool, &pool->waste_list, &total);
-
         esp_rom_printf(
-            "Total free pages: (calculated) %u (stored) %u max_order_free: %u\n",
+            "Total free pages: (calculated) %u (stored) %u zeroed: %u max_order_free: %u\n",
             total - pool->max_order_waste,
             pool->free_pages,
+            pool->zeroed_pages,
             pool->max_order_free
         );
     }
@@ -406,28 +415,82 @@ size_t buddy_get_total_pages(allocator_t *allocator) {
     return ret;
 }
 
+size_t buddy_get_zeroed_pages(allocator_t *allocator) {
+    size_t ret = 0;
+
+    for (int p = 0; p < allocator->memory_pool_num; ++p) {
+        memory_pool_t *pool  = &allocator->memory_pools[p];
+        ret                 += pool->zeroed_pages;
+    }
+
+    return ret;
+}
+
+
+// A free block doesn't help past the end of the pool, its waste can't be handed out
+size_t buddy_get_largest_free(allocator_t *allocator) {
+    size_t ret = 0;
+
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+
+    for (int p = 0; p < allocator->memory_pool_num; ++p) {
+        memory_pool_t *pool = &allocator->memory_pools[p];
+
+        for (int order = pool->max_order; order >= 0 && ((size_t)1 << order) > ret; --order) {
+            if (!pool->free_blocks[order]) {
+                continue;
+            }
+
+            for (size_t n = 0; n < ((size_t)1 << (pool->max_order - order)); ++n) {
+                size_t index = n << order;
+                if (index < pool->pages && block_is_free(pool, index, order)) {
+                    ret = MAX(ret, MIN((size_t)1 << order, pool->pages - index));
+                }
+            }
+        }
+    }
+
+    xSemaphoreGive(allocator->memory_pool_mutex);
+    return ret;
+}
+
+typedef enum { BLOCK_MATCH_ANY, BLOCK_MATCH_ZEROED, BLOCK_MATCH_DIRTY } block_match_t;
 
 /* Find a suitable block
  *
- * We start by looking at the first block of the appropriate order, if we get a block
- * we validate that the allocation of the desired number of pages doesn't go into
- * a waste page. If it does we try all other pages of that order until we find one
- * that will suit our needs.
+ * We start by looking at the lowest free block of the appropriate order, if we get
+ * a block we validate that the allocation of the desired number of pages doesn't go
+ * into a waste page. If it does we try all other blocks of that order until we find
+ * one that will suit our needs. Blocks that are (not) zeroed can be skipped with
+ * match, their bitmap is masked with the zeroed one.
  */
 
 __attribute__((always_inline)) static inline buddy_block_t *
-    pool_find_block(memory_pool_t *pool, uint8_t allocation_order, size_t pages) {
+    pool_find_block(memory_pool_t *pool, uint8_t allocation_order, size_t pages, block_match_t match) {
     for (uint8_t a = allocation_order; a <= pool->max_order; ++a) {
-        buddy_block_t *list  = &pool->free_lists[a];
-        buddy_block_t *block = list;
+        if (!pool->free_blocks[a]) {
+            continue;
+        }
 
-        while (block->prev != list) {
-            block                             = block->prev;
-            buddy_block_t *request_last_block = index_to_block(pool, (block_to_index(pool, block) + pages) - 1);
+        for (size_t w = 0; w < map_words(pool->max_order, a); ++w) {
+            uint32_t bits = pool->free_maps[a][w];
+            if (match == BLOCK_MATCH_ZEROED) {
+                bits &= pool->zeroed_maps[a][w];
+            } else if (match == BLOCK_MATCH_DIRTY) {
+                bits &= ~pool->zeroed_maps[a][w];
+            }
 
-            if (!request_last_block->is_waste) {
-                list_remove(block);
-                return block;
+            while (bits) {
+                size_t n     = w * 32 + clz32(bits);
+                bits        &= ~MAP_BIT(n);
+                size_t index = n << a;
+
+                buddy_block_t *request_last_block = index_to_block(pool, index + pages - 1);
+                if (!request_last_block->is_waste) {
+                    buddy_block_t *block = index_to_block(pool, index);
+                    free_map_remove(pool, block);
+                    return block;
+                }
             }
         }
     }
@@ -435,6 +498,77 @@ __attribute__((always_inline)) static inline buddy_block_t *
     return NULL;
 }
 
+// Split a block taken off the free lists down to order and hand it out. With the pool locked.
+static void *claim_block(memory_pool_t *pool, buddy_block_t *block, uint8_t order, enum block_type type) {
+    while (block->order > order) {
+        split_block(pool, block);
+    }
+
+    while (pool->max_order_free && !pool->free_blocks[pool->max_order_free]) {
+        --pool->max_order_free;
+    }
+
+    pool->free_pages -= (1 << block->order);
+    block->type       = type;
+    return block_to_address(pool, block);
+}
+
+// Take a block off the free bitmaps to hand out, or trim, with the allocator locked
+static buddy_block_t *find_free_block(
+    allocator_t *allocator, size_t size, size_t pages, uint8_t allocation_order, uint32_t flags, memory_pool_t **pool
+) {
+    buddy_block_t *block = NULL;
+
+    *pool = NULL;
+    for (int i = 0; i < allocator->memory_pool_num; ++i) {
+        *pool = find_pool(allocator, i, allocation_order, pages, 0);
+        if (!*pool) {
+            break;
+        }
+
+        if (allocation_order == (*pool)->max_order) {
+            // NOLINTNEXTLINE
+            if (size > (1 << allocation_order) - (*pool)->max_order_waste) {
+                ESP_LOGW(TAG, "buddy_allocate(%zi) = NULL (Allocation too large)", size);
+                continue;
+            }
+        }
+
+        if (flags & BUDDY_FLAG_PREFER_ZEROED) {
+            block = pool_find_block(*pool, allocation_order, pages, BLOCK_MATCH_ZEROED);
+        }
+        if (!block) {
+            block = pool_find_block(*pool, allocation_order, pages, BLOCK_MATCH_ANY);
+        }
+        if (block)
+            break;
+    }
+
+    return block;
+}
+
+// Give the pages of a claimed block past the first pages back. What is kept
+// becomes a run of blocks of decreasing order. With the pool locked.
+static void trim_block(memory_pool_t *pool, buddy_block_t *block, size_t pages) {
+    while (pages < ((size_t)1 << block->order)) {
+        --block->order;
+        size_t         half  = 1 << block->order;
+        buddy_block_t *upper = index_to_block(pool, block_to_index(pool, block) + half);
+        upper->order         = block->order;
+        upper->zeroed        = block->zeroed && !upper->is_waste;
+
+        if (pages > half) {
+            // The lower half is kept whole, continue with the upper one
+            upper->type  = block->type;
+            pages       -= half;
+            block        = upper;
+        } else {
+            upper->type = BLOCK_TYPE_FREE;
+            free_block_locked(pool, upper);
+        }
+    }
+}
+
 /* Allocation
  *
  * Allocation works by finding the smallest possible block that can satisfy
@@ -445,71 +579,153 @@ __attribute__((always_inline)) static inline buddy_block_t *
  *
  * We split in a loop until we have a block of the appropriate size. Splitting
  * all the way to the size we need, but never any smaller.
+ *
+ * With BUDDY_FLAG_PREFER_ZEROED a zeroed block is taken if any fits, whether
+ * it was can be asked with buddy_is_zeroed().
  */
 
 void IRAM_ATTR *buddy_allocate(allocator_t *allocator, size_t size, enum block_type type, uint32_t flags) {
-    (void)flags;
     ESP_LOGD(TAG, "buddy_allocate(%zi)", size);
     if (!size) {
         return NULL;
     }
 
-    size_t         pages                     = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
-    uint8_t        allocation_order          = get_order(pages);
-    uint8_t        original_allocation_order = allocation_order;
-    buddy_block_t *block                     = NULL;
-    memory_pool_t *pool                      = NULL;
+    size_t         pages            = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
+    uint8_t        allocation_order = get_order(pages);
+    memory_pool_t *pool             = NULL;
 
     ESP_LOGD(TAG, "buddy_allocate(%zi) allocating %zi, pages, order %zi", size, pages, allocation_order);
 
     xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
 
-    for (int i = 0; i < allocator->memory_pool_num; ++i) {
-        pool = find_pool(allocator, i, allocation_order, pages, 0);
-        if (!pool) {
-            break;
-        }
+    buddy_block_t *block = find_free_block(allocator, size, pages, allocation_order, flags, &pool);
+    if (!block) {
+        ESP_LOGW(TAG, "buddy_allocate(%zi) = NULL (OOM) no pool", size);
+        xSemaphoreGive(allocator->memory_pool_mutex);
+        return NULL;
+    }
 
-        if (allocation_order == pool->max_order) {
-            // NOLINTNEXTLINE
-            if (size > (1 << allocation_order) - pool->max_order_waste) {
-                ESP_LOGW(TAG, "buddy_allocate(%zi) = NULL (Allocation too large)", size);
-                continue;
-            }
-        }
+    void *retval = claim_block(pool, block, allocation_order, type);
+    xSemaphoreGive(allocator->memory_pool_mutex);
 
-        block = pool_find_block(pool, allocation_order, pages);
-        if (block)
-            break;
+    ESP_LOGD(TAG, "buddy_allocate(%zi) returning %p", size, retval);
+    return retval;
+}
+
+/* Contiguous allocation
+ *
+ * Like buddy_allocate(), but without rounding up to a power of two. The block
+ * found is split so that only the pages asked for stay allocated, the rest is
+ * freed. The pages are a run of blocks in decreasing order, one for every bit
+ * set in the page count, each freed on its own. Their sizes follow from
+ * buddy_get_size().
+ */
+
+void IRAM_ATTR *buddy_allocate_contiguous(allocator_t *allocator, size_t size, enum block_type type, uint32_t flags) {
+    ESP_LOGD(TAG, "buddy_allocate_contiguous(%zi)", size);
+    if (!size) {
+        return NULL;
     }
 
-    if (!pool || !block) {
-        ESP_LOGW(TAG, "buddy_allocate(%zi) = NULL (OOM) no pool", size);
+    size_t         pages            = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
+    uint8_t        allocation_order = get_order(pages);
+    memory_pool_t *pool             = NULL;
+
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+
+    buddy_block_t *block = find_free_block(allocator, size, pages, allocation_order, flags, &pool);
+    if (!block) {
         xSemaphoreGive(allocator->memory_pool_mutex);
         return NULL;
     }
 
-    if (block->order != original_allocation_order) {
-        while (block->order > original_allocation_order) {
-            split_block(pool, block);
-        }
+    void *retval = claim_block(pool, block, allocation_order, type);
+    trim_block(pool, block, pages);
+    xSemaphoreGive(allocator->memory_pool_mutex);
+
+    ESP_LOGD(TAG, "buddy_allocate_contiguous(%zi) returning %p", size, retval);
+    return retval;
+}
+
+/* Allocation for zeroing
+ *
+ * Finds the largest block that isn't zeroed and is no larger than max_size,
+ * splitting a larger one if needed. The caller clears it and gives it back with
+ * buddy_deallocate_zeroed(). Running out of such blocks is normal, so nothing
+ * is logged.
+ */
+
+void IRAM_ATTR *buddy_allocate_dirty(allocator_t *allocator, size_t max_size, enum block_type type, size_t *size) {
+    size_t pages  = max_size / PAGE_SIZE;
+    void  *retval = NULL;
+
+    *size = 0;
+    if (!pages) {
+        return NULL;
     }
 
-    while (pool->max_order_free && list_empty(&pool->free_lists[pool->max_order_free])) {
-        if (pool->max_order_free)
-            --pool->max_order_free;
+    // Round down, the block may not be larger than max_size
+    uint8_t max_order = get_order(pages);
+    if (((size_t)1 << max_order) > pages) {
+        --max_order;
     }
 
-    xSemaphoreGive(allocator->memory_pool_mutex);
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
 
-    pool->free_pages -= (1 << block->order);
-    block->type       = type;
-    void *retval      = block_to_address(pool, block);
+    for (int i = 0; i < allocator->memory_pool_num && !retval; ++i) {
+        memory_pool_t *pool = &allocator->memory_pools[i];
+        if (pool->free_pages == pool->zeroed_pages) {
+            continue;
+        }
 
-    ESP_LOGD(TAG, "buddy_allocate(%zi) returning %p", size, retval);
+        for (int order = MIN(max_order, pool->max_order_free); order >= 0; --order) {
+            buddy_block_t *block = pool_find_block(pool, order, 1 << order, BLOCK_MATCH_DIRTY);
+            if (block) {
+                retval = claim_block(pool, block, order, type);
+                *size  = (1 << order) * PAGE_SIZE;
+                break;
+            }
+        }
+    }
+
+    xSemaphoreGive(allocator->memory_pool_mutex);
     return retval;
 }
 
+/* Batch allocation
+ *
+ * Takes up to count single pages with the lock held once, for page caches that
+ * refill in batches. Returns how many pages were allocated.
+ */
+
+size_t IRAM_ATTR
+    buddy_allocate_pages(allocator_t *allocator, void **pages, size_t count, enum block_type type, uint32_t flags) {
+    size_t allocated = 0;
+
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+
+    for (int i = 0; i < allocator->memory_pool_num && allocated < count; ++i) {
+        memory_pool_t *pool = &allocator->memory_pools[i];
+
+        while (allocated < count && pool->free_pages) {
+            buddy_block_t *block = NULL;
+            if (flags & BUDDY_FLAG_PREFER_ZEROED) {
+                block = pool_find_block(pool, 0, 1, BLOCK_MATCH_ZEROED);
+            }
+            if (!block) {
+                block = pool_find_block(pool, 0, 1, BLOCK_MATCH_ANY);
+            }
+            if (!block) {
+                break;
+            }
+            pages[allocated++] = claim_block(pool, block, 0, type);
+        }
+    }
+
+    xSemaphoreGive(allocator->memory_pool_mutex);
+    return allocated;
+}
+
 __attribute__((always_inline)) static inline buddy_block_t *
     buddy_get_block(allocator_t *allocator, void *ptr, memory_pool_t **pool) {
     ESP_LOGD(TAG, "buddy_get_block(%p)", ptr);
@@ -545,19 +761,88 @@ __attribute__((always_inline)) static inline buddy_block_t *
  * This means that at any time we have the largest possible allocation available.
  */
 
+static void release_block(allocator_t *allocator, void *ptr, bool zeroed) {
+    memory_pool_t *pool  = NULL;
+    buddy_block_t *block = buddy_get_block(allocator, ptr, &pool);
+
+    if (!block) {
+        return;
+    }
+
+    block->type   = BLOCK_TYPE_FREE;
+    block->zeroed = zeroed;
+    free_block(allocator, pool, block);
+}
+
 void buddy_deallocate(allocator_t *allocator, void *ptr) {
     ESP_LOGD(TAG, "buddy_deallocate(%p)", ptr);
+    release_block(allocator, ptr, false);
+}
+
+void buddy_deallocate_zeroed(allocator_t *allocator, void *ptr) {
+    ESP_LOGD(TAG, "buddy_deallocate_zeroed(%p)", ptr);
+    release_block(allocator, ptr, true);
+}
+
+void buddy_deallocate_pages(allocator_t *allocator, void **pages, size_t count) {
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+
+    for (size_t i = 0; i < count; ++i) {
+        memory_pool_t *pool  = NULL;
+        buddy_block_t *block = buddy_get_block(allocator, pages[i], &pool);
+        if (!block) {
+            continue;
+        }
+
+        block->type   = BLOCK_TYPE_FREE;
+        block->zeroed = false;
+        free_block_locked(pool, block);
+    }
+
+    xSemaphoreGive(allocator->memory_pool_mutex);
+}
+
+void buddy_deallocate_contiguous(allocator_t *allocator, void *ptr, size_t size) {
+    ESP_LOGD(TAG, "buddy_deallocate_contiguous(%p, %zi)", ptr, size);
+    size_t pages = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
+
+    xSemaphoreTake(allocator->memory_pool_mutex, portMAX_DELAY);
+
+    while (pages) {
+        memory_pool_t *pool  = NULL;
+        buddy_block_t *block = buddy_get_block(allocator, ptr, &pool);
+        if (!block) {
+            break;
+        }
 
+        size_t block_pages = 1 << block->order;
+        block->type        = BLOCK_TYPE_FREE;
+        block->zeroed      = false;
+        free_block_locked(pool, block);
+
+        ptr   += block_pages * PAGE_SIZE;
+        pages -= MIN(pages, block_pages);
+    }
+
+    xSemaphoreGive(allocator->memory_pool_mutex);
+}
+
+size_t buddy_get_size(allocator_t *allocator, void *ptr) {
     memory_pool_t *pool  = NULL;
     buddy_block_t *block = buddy_get_block(allocator, ptr, &pool);
 
     if (!block) {
-        return;
+        return 0;
     }
 
-    pool->free_pages += (1 << block->order);
-    block->type       = BLOCK_TYPE_FREE;
-    free_block(allocator, pool, block);
+    return (1 << block->order) * PAGE_SIZE;
+}
+
+bool buddy_is_zeroed(allocator_t *allocator, void *ptr) {
+    memory_pool_t *pool  = NULL;
+    buddy_block_t *block = buddy_get_block(allocator, ptr, &pool);
+
+    return block && block->zeroed;
 }
 
 #if 0
@@ -626,18 +911,4 @@ enum block_type buddy_get_type(void *ptr) {
 
     return block->type;
 }
-
-size_t buddy_get_size(void *ptr) {
-    ESP_LOGD(TAG, "buddy_get_size(%p)", ptr);
-
-    memory_pool_t *pool  = NULL;
-    buddy_block_t *block = buddy_get_block(ptr, &pool);
-
-    if (!block) {
-        return 0;
-    }
-
-    ESP_LOGD(TAG, "buddy_get_size(%p) returning %i", ptr, (1 << block->order) * PAGE_SIZE);
-    return (1 << block->order) * PAGE_SIZE;
-}
 #endif
@@ -15,6 +15,7 @@
 
 #define PAGE_SIZE        SOC_MMU_PAGE_SIZE
 #define MAX_MEMORY_POOLS 2
+#define BUDDY_MAX_ORDER  15
 
 #define ALIGN_UP(x, y)   (void *)(((size_t)(x) + (y - 1)) & ~(y - 1))
 #define ALIGN_DOWN(x, y) (void *)((size_t)(x) & ~(y - 1))
@@ -24,14 +25,15 @@
 
 enum block_type { BLOCK_TYPE_FREE, BLOCK_TYPE_USER, BLOCK_TYPE_PAGE, BLOCK_TYPE_ERROR };
 
+// Allocation flags
+#define BUDDY_FLAG_PREFER_ZEROED (1 << 0) // Take a block whose pages are known to be zero if there is one
+
 typedef struct buddy_block {
-    uint8_t             pid;
-    uint8_t             order;
-    bool                in_list;
-    bool                is_waste;
-    enum block_type     type;
-    struct buddy_block *next;
-    struct buddy_block *prev;
+    uint8_t         pid;
+    uint8_t         order;
+    bool            is_waste;
+    bool            zeroed; // All pages of the block are zero
+    enum block_type type;
 } buddy_block_t;
 
 typedef struct {
@@ -42,11 +44,13 @@ typedef struct {
     void          *pages_end;
     size_t         pages;
     size_t         free_pages;
+    size_t         zeroed_pages; // Free pages in zeroed blocks
     uint8_t        max_order;
     uint8_t        max_order_free;
     uint32_t       max_order_waste;
-    buddy_block_t  waste_list;
-    buddy_block_t *free_lists;
+    uint16_t       free_blocks[BUDDY_MAX_ORDER + 1]; // Per order, free blocks that don't start with waste
+    uint32_t      *free_maps[BUDDY_MAX_ORDER + 1];   // Per order, a bit for every block, see buddy_alloc.c
+    uint32_t      *zeroed_maps[BUDDY_MAX_ORDER + 1]; // Per order, the free blocks that are zeroed
     buddy_block_t *blocks;
 } memory_pool_t;
 
@@ -60,10 +64,26 @@ void init_pool(allocator_t *allocator, void *mem_start, void *mem_end, uint32_t
 void print_allocator(allocator_t *allocator);
 
 void  *buddy_allocate(allocator_t *allocator, size_t size, enum block_type type, uint32_t flags);
+// Exactly the pages size needs, physically contiguous, see buddy_alloc.c
+void  *buddy_allocate_contiguous(allocator_t *allocator, size_t size, enum block_type type, uint32_t flags);
+// The largest free block of at most max_size that isn't zeroed yet, for the page zeroer
+void  *buddy_allocate_dirty(allocator_t *allocator, size_t max_size, enum block_type type, size_t *size);
+// Up to count single pages with one lock, returns how many
+size_t buddy_allocate_pages(allocator_t *allocator, void **pages, size_t count, enum block_type type, uint32_t flags);
 // void           *buddy_reallocate(void *ptr, size_t size);
 void   buddy_deallocate(allocator_t *allocator, void *ptr);
+void   buddy_deallocate_pages(allocator_t *allocator, void **pages, size_t count);
+// Free a run from buddy_allocate_contiguous() of size bytes
+void   buddy_deallocate_contiguous(allocator_t *allocator, void *ptr, size_t size);
+// Give back a block the caller has cleared, it is handed out again as zeroed
+void   buddy_deallocate_zeroed(allocator_t *allocator, void *ptr);
+// Whether an allocated block came from zeroed pages
+bool   buddy_is_zeroed(allocator_t *allocator, void *ptr);
 // void            buddy_split_allocated(void *ptr);
 // enum block_type buddy_get_type(void *ptr);
-// size_t          buddy_get_size(void *ptr);
+size_t buddy_get_size(allocator_t *allocator, void *ptr);
 size_t buddy_get_free_pages(allocator_t *allocator);
 size_t buddy_get_total_pages(allocator_t *allocator);
+size_t buddy_get_zeroed_pages(allocator_t *allocator);
+// Pages of the largest run buddy_allocate_contiguous() can hand out right now
+size_t buddy_get_largest_free(allocator_t *allocator);
@@ -0,0 +1,139 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "cache_counters.h"
+
+#include "esp_attr.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "soc/cache_reg.h"
+#include "soc/soc.h"
+#include "task.h"
+
+#define TAG "cache_counters"
+
+// The hardware counters of one core. L2 counts its instruction and data bus
+// separately, they are added up.
+typedef enum {
+    RAW_L1I_HIT,
+    RAW_L1I_MISS,
+    RAW_L1D_HIT,
+    RAW_L1D_MISS,
+    RAW_L2I_HIT,
+    RAW_L2I_MISS,
+    RAW_L2D_HIT,
+    RAW_L2D_MISS,
+    RAW_MAX,
+} raw_counter_t;
+
+typedef struct {
+    uint32_t         last[RAW_MAX];
+    cache_counters_t total;
+} core_counters_t;
+
+// Read from the tick, which may run with the caches disabled
+static DRAM_ATTR uint32_t const counter_regs[portNUM_PROCESSORS][RAW_MAX] = {
+    {
+        CACHE_L1_IBUS0_ACS_HIT_CNT_REG,
+        CACHE_L1_IBUS0_ACS_MISS_CNT_REG,
+        CACHE_L1_DBUS0_ACS_HIT_CNT_REG,
+        CACHE_L1_DBUS0_ACS_MISS_CNT_REG,
+        CACHE_L2_IBUS0_ACS_HIT_CNT_REG,
+        CACHE_L2_IBUS0_ACS_MISS_CNT_REG,
+        CACHE_L2_DBUS0_ACS_HIT_CNT_REG,
+        CACHE_L2_DBUS0_ACS_MISS_CNT_REG,
+    },
+    {
+        CACHE_L1_IBUS1_ACS_HIT_CNT_REG,
+        CACHE_L1_IBUS1_ACS_MISS_CNT_REG,
+        CACHE_L1_DBUS1_ACS_HIT_CNT_REG,
+        CACHE_L1_DBUS1_ACS_MISS_CNT_REG,
+        CACHE_L2_IBUS1_ACS_HIT_CNT_REG,
+        CACHE_L2_IBUS1_ACS_MISS_CNT_REG,
+        CACHE_L2_DBUS1_ACS_HIT_CNT_REG,
+        CACHE_L2_DBUS1_ACS_MISS_CNT_REG,
+    },
+};
+
+static DRAM_ATTR core_counters_t cores[portNUM_PROCESSORS];
+
+static void IRAM_ATTR counters_add(cache_counters_t *to, cache_counters_t const *delta) {
+    to->l1i_hits   += delta->l1i_hits;
+    to->l1i_misses += delta->l1i_misses;
+    to->l1d_hits   += delta->l1d_hits;
+    to->l1d_misses += delta->l1d_misses;
+    to->l2_hits    += delta->l2_hits;
+    to->l2_misses  += delta->l2_misses;
+}
+
+void IRAM_ATTR cache_counters_fold(cache_counters_t *charge) {
+    core_counters_t *core = &cores[xPortGetCoreID()];
+    uint32_t const  *regs = counter_regs[xPortGetCoreID()];
+    uint32_t         raw[RAW_MAX];
+
+    // Unsigned, a counter that wrapped since the last fold still comes out right
+    for (int i = 0; i < RAW_MAX; ++i) {
+        uint32_t now  = REG_READ(regs[i]);
+        raw[i]        = now - core->last[i];
+        core->last[i] = now;
+    }
+
+    cache_counters_t delta = {
+        .l1i_hits   = raw[RAW_L1I_HIT],
+        .l1i_misses = raw[RAW_L1I_MISS],
+        .l1d_hits   = raw[RAW_L1D_HIT],
+        .l1d_misses = raw[RAW_L1D_MISS],
+        .l2_hits    = raw[RAW_L2I_HIT] + raw[RAW_L2D_HIT],
+        .l2_misses  = raw[RAW_L2I_MISS] + raw[RAW_L2D_MISS],
+    };
+    counters_add(&core->total, &delta);
+    if (charge) {
+        counters_add(charge, &delta);
+    }
+}
+
+// A task that never blocks is never switched out, this keeps it from running
+// long enough for the counters to wrap twice
+static void IRAM_ATTR cache_counters_tick(void) {
+    task_info_t *task_info = get_task_info_tcb();
+    cache_counters_fold(task_info->pid ? &task_info->cache : NULL);
+}
+
+void cache_counters_get(int core, cache_counters_t *counters) {
+    // Folded from the tick meanwhile, a torn read is off by one tick at most
+    *counters = cores[core].total;
+}
+
+bool cache_counters_init() {
+    REG_SET_BIT(
+        CACHE_L1_CACHE_ACS_CNT_CTRL_REG,
+        CACHE_L1_IBUS0_CNT_ENA | CACHE_L1_IBUS1_CNT_ENA | CACHE_L1_DBUS0_CNT_ENA | CACHE_L1_DBUS1_CNT_ENA
+    );
+    REG_SET_BIT(
+        CACHE_L2_CACHE_ACS_CNT_CTRL_REG,
+        CACHE_L2_IBUS0_CNT_ENA | CACHE_L2_IBUS1_CNT_ENA | CACHE_L2_DBUS0_CNT_ENA | CACHE_L2_DBUS1_CNT_ENA
+    );
+
+    for (int i = 0; i < portNUM_PROCESSORS; ++i) {
+        if (esp_register_freertos_tick_hook_for_cpu(cache_counters_tick, i) != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to register the tick hook on core %d", i);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "badgevms/process.h"
+
+#include <stdbool.h>
+
+// The access counters of the L1 and L2 caches, per core, see cache_counters_t.
+// The hardware counters are 32 bits, they are folded into 64 bit totals when
+// tasks switch and on every tick, so they can't wrap in between.
+
+// Allowed to fail, the counters are then only folded when tasks switch
+bool cache_counters_init();
+// Add what this core counted since the last fold to its totals, and to charge
+// if it isn't NULL. From the switch hooks and the tick.
+void cache_counters_fold(cache_counters_t *charge);
+// Everything a core counted up to its last fold
+void cache_counters_get(int core, cache_counters_t *counters);
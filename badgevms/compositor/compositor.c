@@ -20,23 +20,40 @@
 #include "badgevms/device.h"
 #include "badgevms/event.h"
 #include "badgevms/pixel_formats.h"
+#include "badgevms/ppa.h"
 #include "badgevms/process.h"
 #include "badgevms_config.h"
+#include "boot_profile_private.h"
 #include "compositor_private.h"
 #include "driver/ppa.h"
+#include "drivers/wifi.h"
 #include "esp_cache.h"
+#include "esp_heap_caps.h"
 #include "esp_ipc.h"
 #include "esp_log.h"
 #include "esp_private/esp_cache_private.h"
+#include "esp_timer.h"
+#include "fast_mem.h"
 #include "font.h"
+#include "framebuffer_private.h"
+#include "governor.h"
+#include "hal/cache_hal.h"
+#include "hal/cache_ll.h"
 #include "memory.h"
+#include "nvs.h"
 #include "pixel_functions.h"
+#include "scene.h"
+#include "slab.h"
 #include "task.h"
+#include "trace.h"
+#include "wait_private.h"
 #include "window_decorations.h"
 
 #include <stdatomic.h>
 
+#include <errno.h>
 #include <math.h>
+#include <stddef.h>
 #include <sys/time.h>
 
 #define TAG "compositor"
@@ -48,20 +65,102 @@
         y              = SWAP;                                                                                         \
     } while (0)
 
-static TaskHandle_t  compositor_handle;
-static lcd_device_t *lcd_device;
-static device_t     *keyboard_device;
+static TaskHandle_t        compositor_handle;
+static TaskHandle_t        input_handle;
+static ppa_client_handle_t ppa_srm_handle;
+static ppa_client_handle_t ppa_fill_handle;
+static ppa_client_handle_t ppa_blend_handle;
+// Applications drawing into their own windows wait for each operation, on
+// clients of their own, see ppa_blit()
+static ppa_client_handle_t ppa_draw_srm_handle;
+static ppa_client_handle_t ppa_draw_fill_handle;
+static ppa_client_handle_t ppa_draw_blend_handle;
+static SemaphoreHandle_t   ppa_draw_lock;
+static lcd_device_t       *lcd_device;
+static device_t           *keyboard_device;
 
-static window_t     *window_stack = NULL;
 static QueueHandle_t compositor_queue;
 
-static int        cur_fb = 0;
-static atomic_int cur_num_windows;
-static uint16_t  *framebuffers[DISPLAY_FRAMEBUFFERS];
+static int       cur_fb = 0;
+static uint16_t *framebuffers[DISPLAY_FRAMEBUFFERS];
 
-static int  background_damaged    = 7;
-static int  decoration_damaged    = 7;
-static bool visible_regions_valid = false;
+// The panel buffers as allocated by the LCD driver, in framebuffers[] order
+static managed_framebuffer_t *display_framebuffers[DISPLAY_FRAMEBUFFERS];
+static int                    num_display_framebuffers;
+static bool                   direct_scanout_available;
+static window_t              *scanout_window;
+
+static slab_cache_t window_cache =
+    SLAB_CACHE_INIT("window", sizeof(window_t), 8, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+static slab_cache_t framebuffer_cache =
+    SLAB_CACHE_INIT("framebuffer", sizeof(managed_framebuffer_t), 8, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+// Bottom to top, all drawn above the window stack
+static overlay_t *overlays[MAX_OVERLAYS];
+static int        num_overlays;
+static atomic_int cur_num_overlays;
+
+// Blits queued on the PPA that have not completed yet
+static atomic_int ppa_pending;
+
+// Applications waiting in window_present() for blits that are still in flight
+typedef struct {
+    TaskHandle_t task;
+    window_t    *window;
+    uint32_t     presented;
+} frame_notify_t;
+
+static frame_notify_t frame_notify[MAX_WINDOWS];
+static int            frame_notify_count;
+
+static uint32_t refresh_count;
+static bool     first_frame_shown;
+
+// See DISPLAY_IDLE_REFRESHES, key presses are flagged by the input task
+static atomic_bool input_seen;
+static int         idle_refreshes;
+static bool        panel_idle;
+
+// See compositor_input_latency_enable(), the compositor clears the windows on a reset
+static atomic_bool input_latency_enabled;
+static atomic_bool input_latency_reset;
+
+// The task in compositor_frame_wait()
+static _Atomic(TaskHandle_t) frame_waiter;
+
+// Telemetry. frame_stats is only touched by the compositor task and published
+// to stats once per refresh, the input task and the PPA ISR keep their own.
+static compositor_stats_t       stats;
+static portMUX_TYPE             stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static compositor_frame_stats_t frame_stats;
+static atomic_uint              input_read_us;
+static atomic_uint              ppa_busy_us;
+static int64_t                  ppa_busy_start;
+
+#define CAPTURE_BUFFERS 3
+
+// A screen capture session, see compositor_capture_start()
+typedef struct {
+    window_size_t  size;
+    window_size_t  scaled; // What the PPA writes, the rest of size is padding
+    pixel_format_t format;
+    float          scale;
+    size_t         frame_bytes;
+    void          *buffers[CAPTURE_BUFFERS];
+} capture_t;
+
+// capture is only changed by the compositor task, with capture_mutex held by
+// the caller. Readers mark the buffer they copy from in capture_reading, the
+// PPA writes to one that is neither that nor the latest.
+static capture_t        *capture;
+static SemaphoreHandle_t capture_mutex;
+static SemaphoreHandle_t capture_frame;
+static portMUX_TYPE      capture_lock      = portMUX_INITIALIZER_UNLOCKED;
+static int               capture_latest    = -1;
+static int               capture_reading   = -1;
+static int               capture_in_flight = -1;
+static uint32_t          capture_sequence;
 
 typedef enum {
     WINDOW_CREATE,
@@ -69,36 +168,73 @@ typedef enum {
     WINDOW_FLAGS,
     WINDOW_MOVE,
     WINDOW_RESIZE,
-    FRAMEBUFFER_SWAP
+    WINDOW_OPACITY,
+    FRAMEBUFFER_SWAP,
+    OVERLAY_CREATE,
+    OVERLAY_DESTROY,
+    OVERLAY_MOVE,
+    CAPTURE_SET,
+    WINDOW_PARK,
+    WINDOW_UNPARK,
+    // Window management from the input task, these act on the focused window
+    WINDOW_FOCUS_NEXT,
+    WINDOW_NUDGE,
+    WINDOW_KILL,
 } compositor_command_t;
 
 typedef struct {
     compositor_command_t   command;
     window_t              *window;
+    overlay_t             *overlay;
+    capture_t             *capture;
     window_flag_t          flags;
     window_coords_t        coords;
     window_size_t          size;
+    uint8_t                opacity;
     managed_framebuffer_t *fb_a;
     managed_framebuffer_t *fb_b;
     TaskHandle_t           caller;
 } compositor_message_t;
 
-rotation_angle_t rotation = ROTATION_ANGLE_270;
+rotation_angle_t rotation = BADGEVMS_PANEL_ROTATION;
+
+#define BACKGROUND_COLOR 0xaaaa
+// BACKGROUND_COLOR expanded the same way the PPA truncates it back to RGB565
+#define BACKGROUND_ARGB                                                                                                \
+    ((color_pixel_argb8888_data_t){                                                                                    \
+        .a = 0xff,                                                                                                     \
+        .r = (BACKGROUND_COLOR >> 8) & 0xf8,                                                                           \
+        .g = (BACKGROUND_COLOR >> 3) & 0xfc,                                                                           \
+        .b = (BACKGROUND_COLOR << 3) & 0xf8,                                                                           \
+    })
 
-#define WINDOW_MAX_W (FRAMEBUFFER_MAX_W - (2 * BORDER_PX) - SIDE_BAR_PX)
-#define WINDOW_MAX_H (FRAMEBUFFER_MAX_H - BORDER_TOP_PX - TOP_BAR_PX)
+#define LETTERBOX_ARGB ((color_pixel_argb8888_data_t){.a = 0xff, .r = 0, .g = 0, .b = 0})
 
-#define ALL_DISPLAY_FB_MASK 7 // (1 + 2 + 4)
+#define COMPOSITOR_NOTIFY_REFRESH  (1 << 0)
+#define COMPOSITOR_NOTIFY_PPA_DONE (1 << 1)
+
+// Enough for a busy frame, window_blit_rect() waits for the PPA if we run out
+#define PPA_MAX_PENDING_BLITS 32
+
+// Frame pacing for windows that are not in front, in panel refreshes
+#define BACKGROUND_FRAME_INTERVAL (FRAMEBUFFER_MAX_REFRESH / BACKGROUND_WINDOW_FPS)
+#define HIDDEN_FRAME_INTERVAL     (FRAMEBUFFER_MAX_REFRESH / HIDDEN_WINDOW_FPS)
+
+// Where display_framebuffers_set() keeps the count for the next boot
+#define DISPLAY_NVS_NAMESPACE "badgevms_disp"
+#define DISPLAY_NVS_KEY       "framebuffers"
 
 #define WINDOW_MOVE_STEP          10
-#define WINDOW_COMMANDS_PER_FRAME 5
-#define KEYBOARD_EVENTS_PER_FRAME 10
+#define COMPOSITOR_QUEUE_LENGTH   16
+#define KEYBOARD_EVENTS_PER_READ  10
+#define INPUT_POLL_MS             10
 
-static inline void mark_scene_damaged(void) {
-    visible_regions_valid = false;
-    decoration_damaged    = ALL_DISPLAY_FB_MASK;
-    background_damaged    = ALL_DISPLAY_FB_MASK;
-}
+// window_events_drain() copies events out of the ring this many at a time
+#define EVENT_DRAIN_BATCH 8
+
+// Applications get the PPA a band of rows at a time, so whatever the compositor
+// queues meanwhile never waits for more than a band
+#define PPA_DRAW_BAND_PIXELS (64 * 1024)
 
 __attribute__((always_inline)) static inline ppa_srm_rotation_angle_t rotation_to_srm(rotation_angle_t rotation) {
     switch (rotation) {
@@ -110,199 +246,684 @@ __attribute__((always_inline)) static inline ppa_srm_rotation_angle_t rotation_t
     return PPA_SRM_ROTATION_ANGLE_0;
 }
 
-__attribute__((always_inline)) static inline window_size_t window_clamp_size(window_t *window, window_size_t size) {
-    window_size_t ret;
+// The other way around, from panel to screen orientation
+__attribute__((always_inline)) static inline ppa_srm_rotation_angle_t
+    rotation_from_panel_srm(rotation_angle_t rotation) {
+    switch (rotation) {
+        case ROTATION_ANGLE_270: return PPA_SRM_ROTATION_ANGLE_270;
+        case ROTATION_ANGLE_180: return PPA_SRM_ROTATION_ANGLE_180;
+        case ROTATION_ANGLE_90: return PPA_SRM_ROTATION_ANGLE_90;
+        default:
+    }
+    return PPA_SRM_ROTATION_ANGLE_0;
+}
+
+// Presents of windows that are not in front are consumed at their throttled frame rate
+__attribute__((always_inline)) static inline bool window_present_due(window_t *window) {
+    return window == window_stack || window->present_due;
+}
 
-    size.w = size.w < 0 ? 0 : size.w;
-    size.h = size.h < 0 ? 0 : size.h;
+// A foreground full-screen app gets as much CPU time as it can handle, and the full clock
+static bool window_foreground_app(window_t *window, uint8_t cpu_class) {
+    return window == window_stack && (window->flags & WINDOW_FLAG_FULLSCREEN) &&
+           !(window->flags & WINDOW_FLAG_LOW_PRIORITY) && cpu_class == APPLICATION_CPU_INTERACTIVE;
+}
 
-    if (window->flags & WINDOW_FLAG_FULLSCREEN) {
-        ret.w = size.w > FRAMEBUFFER_MAX_W ? FRAMEBUFFER_MAX_W : size.w;
-        ret.h = size.h > FRAMEBUFFER_MAX_H ? FRAMEBUFFER_MAX_H : size.h;
-    } else {
-        ret.w = size.w > WINDOW_MAX_W ? WINDOW_MAX_W : size.w;
-        ret.h = size.h > WINDOW_MAX_H ? WINDOW_MAX_H : size.h;
+// Only bother the scheduler when the priority has to change, this also
+// leaves task_priority_lower() alone until the focus changes
+static void window_priority_update(window_t *window, task_info_t *task_info) {
+    UBaseType_t priority  = task_info->priority;
+    uint8_t     cpu_class = task_info->thread->cpu_class;
+    if (window_foreground_app(window, cpu_class)) {
+        priority = MAX(priority, TASK_PRIORITY_FOREGROUND);
+    } else if (window != window_stack && cpu_class == APPLICATION_CPU_BACKGROUND) {
+        // Out of the way of whatever is in front
+        priority = MIN(priority, TASK_PRIORITY_LOW);
     }
 
-    return ret;
+    if (priority == window->priority || eTaskGetState(task_info->handle) == eDeleted) {
+        return;
+    }
+
+    vTaskPrioritySet(task_info->handle, priority);
+    window->priority = priority;
 }
 
-__attribute__((always_inline)) static inline window_coords_t
-    window_clamp_position(window_t *window, window_coords_t position) {
-    window_coords_t ret;
+// Services that favour the process the user is looking at hear about it here
+static void focus_update() {
+    static task_thread_t const *focus;
+    static bool                 performance;
 
-    position.x = position.x < 0 ? 0 : position.x;
-    position.y = position.y < 0 ? 0 : position.y;
+    task_info_t         *owner  = window_stack ? (task_info_t *)atomic_load(&window_stack->task_info) : NULL;
+    task_thread_t const *thread = owner ? owner->thread : NULL;
+    if (thread != focus) {
+        focus = thread;
+        wifi_focus_set(thread);
+    }
 
-    if (window->flags & WINDOW_FLAG_FULLSCREEN) {
-        ret.x = 0;
-        ret.y = 0;
-    } else {
-        int max_x = FRAMEBUFFER_MAX_W - (window->rect.w + (2 * BORDER_PX)) - 1;
-        int max_y = FRAMEBUFFER_MAX_H - (window->rect.h + (BORDER_TOP_PX + BORDER_PX)) - 1;
-        ret.x     = position.x > max_x ? max_x : position.x;
-        ret.y     = position.y > max_y ? max_y : position.y;
+    bool foreground_app = thread && window_foreground_app(window_stack, thread->cpu_class);
+    if (foreground_app != performance) {
+        performance = foreground_app;
+        governor_performance_set(foreground_app);
     }
+}
 
-    return ret;
+// Workaround for the PPA hardware. It really does not like 65 pixel high strips.
+__attribute__((always_inline)) static inline bool is_problematic_block_height(int content_height, float scale) {
+    // Check if height is "N × 32 + 1"
+    int fb_height = (int)(content_height / scale);
+    if (fb_height > 32 && (fb_height % 32) == 1) {
+        return true;
+    }
+    return false;
 }
 
-__attribute__((always_inline)) static inline void push_window(window_t *window) {
-    window_t *head = window_stack;
+typedef struct {
+    void const              *in_buffer;
+    ppa_srm_rotation_angle_t rotation;
+    ppa_srm_color_mode_t     mode;
+    bool                     rgb_swap;
+    bool                     byte_swap;
+    bool                     native; // Framebuffer laid out like the panel, see native_pixel_index()
+    float                    scale;
+
+    // Where the output goes, out_rect is the output picture's position on the panel
+    void                    *out_buffer;
+    size_t                   out_buffer_size;
+    window_rect_t            out_rect;
+    ppa_srm_color_mode_t     out_mode;
+    ppa_alpha_update_mode_t  alpha_mode;
+    uint32_t                 alpha_fix_val;
+    float                    alpha_scale_ratio;
+} window_blit_t;
+
+// Formats the PPA can't read as they are, see window_convert_update()
+__attribute__((always_inline)) static inline bool framebuffer_converted(pixel_format_t format) {
+    return format == BADGEVMS_PIXELFORMAT_YUV420_ESP || format == BADGEVMS_PIXELFORMAT_INDEX8;
+}
 
-    if (head) {
-        window_t *tail = head->prev;
+// How the PPA reads a framebuffer of the given format
+static ppa_srm_color_mode_t framebuffer_srm_mode(pixel_format_t format, bool *rgb_swap) {
+    *rgb_swap = false;
 
-        window->next = head;
-        window->prev = tail;
-        head->prev   = window;
-        tail->next   = window;
-    } else {
-        window->prev = window;
-        window->next = window;
+    switch (format) {
+        case BADGEVMS_PIXELFORMAT_RGB565: *rgb_swap = true; // Fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR565: break;
+        case BADGEVMS_PIXELFORMAT_BGRA8888: *rgb_swap = true; // Fallthrough
+        case BADGEVMS_PIXELFORMAT_RGBA8888: return PPA_SRM_COLOR_MODE_ARGB8888;
+        case BADGEVMS_PIXELFORMAT_ARGB8888: *rgb_swap = true; // Fallthrough
+        case BADGEVMS_PIXELFORMAT_ABGR8888: return PPA_SRM_COLOR_MODE_ARGB8888;
+        case BADGEVMS_PIXELFORMAT_BGR24: *rgb_swap = true; // Fallthrough
+        case BADGEVMS_PIXELFORMAT_RGB24: return PPA_SRM_COLOR_MODE_RGB888;
+        // The PPA can't swap what it converts from YUV, see window_convert_update()
+        case BADGEVMS_PIXELFORMAT_YUV420_ESP: return PPA_SRM_COLOR_MODE_YUV420;
+        default:
+    }
+
+    return PPA_SRM_COLOR_MODE_RGB565;
+}
+
+static window_blit_t window_blit_params(window_t *window, managed_framebuffer_t *framebuffer, float scale) {
+    window_blit_t blit = {
+        .in_buffer = framebuffer->framebuffer.pixels,
+        .rotation  = rotation_to_srm(rotation),
+        .byte_swap = false,
+        .scale     = scale,
+
+        .out_buffer      = framebuffers[cur_fb],
+        .out_buffer_size = FRAMEBUFFER_BYTES,
+        .out_rect        = {.x = 0, .y = 0, .w = FRAMEBUFFER_MAX_W, .h = FRAMEBUFFER_MAX_H},
+        .out_mode        = PPA_SRM_COLOR_MODE_RGB565,
+        .alpha_mode      = PPA_ALPHA_NO_CHANGE,
+    };
+
+    if (window->flags & WINDOW_FLAG_NATIVE_ORIENTATION) {
+        // A straight copy, the application already rotated. Flipping is up to it as well.
+        blit.rotation = PPA_SRM_ROTATION_ANGLE_0;
+        blit.native   = true;
+    } else if (window->flags & WINDOW_FLAG_FLIP_HORIZONTAL) {
+        blit.rotation = PPA_SRM_ROTATION_ANGLE_270;
+    }
+
+    blit.mode = framebuffer_srm_mode(framebuffer->format, &blit.rgb_swap);
+
+    if (framebuffer_converted(framebuffer->format)) {
+        // Read from the converted copy, see window_convert_update()
+        blit.in_buffer = window->convert_buffer;
+        blit.mode      = PPA_SRM_COLOR_MODE_RGB565;
+        blit.rgb_swap  = true;
+    }
+
+    return blit;
+}
+
+// Wait until the PPA is done with every blit we queued. Needed before the
+// display framebuffer is shown and before window pages are moved or freed.
+static void ppa_fence(void) {
+    while (atomic_load(&ppa_pending)) {
+        ulTaskNotifyTakeIndexed(1, pdTRUE, portMAX_DELAY);
+    }
+}
+
+// Account for a PPA operation about to be queued
+static inline void ppa_begin(void) {
+    if (atomic_fetch_add(&ppa_pending, 1) == 0) {
+        ppa_busy_start = esp_timer_get_time();
+    }
+}
+
+static inline void ppa_account(ppa_operation_t operation, window_rect_t rect) {
+    frame_stats.ppa_ops    += 1;
+    frame_stats.ppa_pixels += rect.w * rect.h;
+    trace_event(TRACE_PPA_QUEUE, operation, rect.w * rect.h);
+}
+
+// The window's front buffer was consumed, notify the application with frame_notify_flush()
+static void frame_notify_add(window_t *window, TaskHandle_t task) {
+    uint32_t presented   = atomic_exchange(&window->present_time, 0);
+    uint32_t input       = atomic_exchange(&window->input_presented, 0);
+    window->present_due = false;
+
+    if (input && !window->input_composed) {
+        window->input_composed = input;
     }
 
-    window_stack = window;
-    atomic_fetch_add(&cur_num_windows, 1);
+    if (frame_notify_count < MAX_WINDOWS) {
+        frame_notify[frame_notify_count++] = (frame_notify_t){
+            .task      = task,
+            .window    = window,
+            .presented = presented,
+        };
+    }
 }
 
-__attribute__((always_inline)) static inline void remove_window(window_t *window) {
-    // If we were forcibly removed we won't be in the list
-    if (!window->prev || !window->next) {
+// Tell applications their frame was consumed, but only once the PPA has
+// stopped reading from their framebuffers
+static void frame_notify_flush(void) {
+    if (atomic_load(&ppa_pending)) {
         return;
     }
 
-    // We are the only window
-    if (window->prev == window) {
-        window_stack = NULL;
-        goto out;
+    uint32_t now = esp_timer_get_time();
+    for (int i = 0; i < frame_notify_count; ++i) {
+        frame_notify_t *notify = &frame_notify[i];
+        window_t       *window = notify->window;
+
+        window->presents += 1;
+        if (notify->presented) {
+            window->present_latency_us     = now - notify->presented;
+            window->present_latency_max_us = MAX(window->present_latency_max_us, window->present_latency_us);
+        }
+
+        if (eTaskGetState(notify->task) != eDeleted) {
+            xTaskNotifyGiveIndexed(notify->task, 1);
+        }
+    }
+    frame_notify_count = 0;
+}
+
+// Queue PPA operations, waiting for a free transaction slot if needed. out is
+// what gets written, for the statistics.
+static bool ppa_srm_queue(ppa_srm_oper_config_t const *oper_config, window_rect_t out) {
+    ppa_begin();
+    esp_err_t ppa_result = ppa_do_scale_rotate_mirror(ppa_srm_handle, oper_config);
+    if (ppa_result == ESP_FAIL) {
+        // Out of transaction slots, let the queue drain and try again
+        atomic_fetch_sub(&ppa_pending, 1);
+        ppa_fence();
+        ppa_begin();
+        ppa_result = ppa_do_scale_rotate_mirror(ppa_srm_handle, oper_config);
     }
-    window_t *prev = window->prev;
-    window_t *next = window->next;
 
-    // Only one window left
-    if (prev == next) {
-        prev->next   = prev;
-        prev->prev   = prev;
-        window_stack = prev;
-        goto out;
+    if (ppa_result != ESP_OK) {
+        atomic_fetch_sub(&ppa_pending, 1);
+        printf("PPA operation failed: %s\n", esp_err_to_name(ppa_result));
+        return false;
     }
 
-    next->prev   = prev;
-    prev->next   = next;
-    window_stack = next;
-out:
-    atomic_fetch_sub(&cur_num_windows, 1);
+    ppa_account(PPA_OPERATION_SRM, out);
+    return true;
 }
 
-// Workaround for the PPA hardware. It really does not like 65 pixel high strips.
-__attribute__((always_inline)) static inline bool is_problematic_block_height(int content_height, float scale) {
-    // Check if height is "N × 32 + 1"
-    int fb_height = (int)(content_height / scale);
-    if (fb_height > 32 && (fb_height % 32) == 1) {
-        return true;
+static bool ppa_blend_queue(ppa_blend_oper_config_t const *oper_config, window_rect_t out) {
+    ppa_begin();
+    esp_err_t ppa_result = ppa_do_blend(ppa_blend_handle, oper_config);
+    if (ppa_result == ESP_FAIL) {
+        atomic_fetch_sub(&ppa_pending, 1);
+        ppa_fence();
+        ppa_begin();
+        ppa_result = ppa_do_blend(ppa_blend_handle, oper_config);
     }
-    return false;
+
+    if (ppa_result != ESP_OK) {
+        atomic_fetch_sub(&ppa_pending, 1);
+        ESP_LOGW(TAG, "PPA blend failed: %s", esp_err_to_name(ppa_result));
+        return false;
+    }
+
+    ppa_account(PPA_OPERATION_BLEND, out);
+    return true;
 }
 
-__attribute__((always_inline)) static inline bool ppa_workaround_split_rects(rect_array_t *visible, float scale) {
-    rect_array_t new_visible = {0};
-    bool         split       = false;
+static bool ppa_fill_queue(ppa_fill_oper_config_t const *oper_config, window_rect_t out) {
+    ppa_begin();
+    esp_err_t ppa_result = ppa_do_fill(ppa_fill_handle, oper_config);
+    if (ppa_result == ESP_FAIL) {
+        atomic_fetch_sub(&ppa_pending, 1);
+        ppa_fence();
+        ppa_begin();
+        ppa_result = ppa_do_fill(ppa_fill_handle, oper_config);
+    }
+
+    if (ppa_result != ESP_OK) {
+        atomic_fetch_sub(&ppa_pending, 1);
+        ESP_LOGW(TAG, "PPA fill failed: %s", esp_err_to_name(ppa_result));
+        return false;
+    }
 
-    for (int i = 0; i < visible->count; i++) {
-        window_rect_t rect = visible->rects[i];
+    ppa_account(PPA_OPERATION_FILL, out);
+    return true;
+}
 
-        if (is_problematic_block_height(rect.h, scale)) {
-            split           = true;
-            int first_half  = (rect.h / 2) - 1;
-            int second_half = rect.h - first_half;
-            ESP_LOGW(TAG, "Splitting block of problematic height %u in %u and %u", rect.h, first_half, second_half);
+// Queue a copy of one on-screen rect of window content into the current display framebuffer
+static bool window_blit_rect(
+    window_t *window, managed_framebuffer_t *framebuffer, window_blit_t const *blit, window_rect_t visible_content
+) {
+    if (visible_content.w <= 0 || visible_content.h <= 0) {
+        return false;
+    }
 
-            new_visible.rects[new_visible.count++] =
-                (window_rect_t){.x = rect.x, .y = rect.y, .w = rect.w, .h = first_half};
+    // Native framebuffers are read column by column of the screen
+    bool transposed = blit->native && (rotation == ROTATION_ANGLE_90 || rotation == ROTATION_ANGLE_270);
 
-            if (new_visible.count < MAX_VISIBLE_RECTS) {
-                new_visible.rects[new_visible.count++] =
-                    (window_rect_t){.x = rect.x, .y = rect.y + first_half, .w = rect.w, .h = second_half};
-            }
-        } else {
-            if (new_visible.count < MAX_VISIBLE_RECTS) {
-                new_visible.rects[new_visible.count++] = rect;
-            }
-        }
+    if (transposed && is_problematic_block_height(visible_content.w, blit->scale)) {
+        int           first_half = (visible_content.w / 2) - 1;
+        window_rect_t left       = visible_content;
+        window_rect_t right      = visible_content;
+        left.w                   = first_half;
+        right.x                 += first_half;
+        right.w                 -= first_half;
+
+        bool left_ok  = window_blit_rect(window, framebuffer, blit, left);
+        bool right_ok = window_blit_rect(window, framebuffer, blit, right);
+        return left_ok || right_ok;
+    }
+
+    if (!transposed && is_problematic_block_height(visible_content.h, blit->scale)) {
+        // Damage sub-rects can end up with heights the PPA chokes on, same workaround as for visible regions
+        int           first_half = (visible_content.h / 2) - 1;
+        window_rect_t top        = visible_content;
+        window_rect_t bottom     = visible_content;
+        top.h                    = first_half;
+        bottom.y                += first_half;
+        bottom.h                -= first_half;
+
+        bool top_ok    = window_blit_rect(window, framebuffer, blit, top);
+        bool bottom_ok = window_blit_rect(window, framebuffer, blit, bottom);
+        return top_ok || bottom_ok;
+    }
+
+    window_rect_t fb_rect = content_to_framebuffer_rect(visible_content, window, blit->scale);
+    if (fb_rect.w <= 0 || fb_rect.h <= 0) {
+        return false;
+    }
+
+    window_rect_t rotated_output = rotate_rect(visible_content, rotation);
+    window_rect_t pic            = {.x = 0, .y = 0, .w = framebuffer->w, .h = framebuffer->h};
+
+    if (blit->native) {
+        fb_rect = orientation_rotate_rect(pic.w, pic.h, rotation, fb_rect);
+        pic     = orientation_rotate_rect(pic.w, pic.h, rotation, pic);
+    }
+
+    ppa_srm_oper_config_t oper_config = {
+        .in.buffer         = blit->in_buffer,
+        .in.pic_w          = pic.w,
+        .in.pic_h          = pic.h,
+        .in.block_w        = fb_rect.w,
+        .in.block_h        = fb_rect.h,
+        .in.block_offset_x = fb_rect.x,
+        .in.block_offset_y = fb_rect.y,
+        .in.srm_cm         = blit->mode,
+
+        .out.buffer         = blit->out_buffer,
+        .out.buffer_size    = blit->out_buffer_size,
+        .out.pic_w          = blit->out_rect.w,
+        .out.pic_h          = blit->out_rect.h,
+        .out.block_offset_x = rotated_output.x - blit->out_rect.x,
+        .out.block_offset_y = rotated_output.y - blit->out_rect.y,
+        .out.srm_cm         = blit->out_mode,
+
+        .rotation_angle    = blit->rotation,
+        .scale_x           = blit->scale,
+        .scale_y           = blit->scale,
+        .rgb_swap          = blit->rgb_swap,
+        .byte_swap         = blit->byte_swap,
+        .alpha_update_mode = blit->alpha_mode,
+        .mode              = PPA_TRANS_MODE_NON_BLOCKING,
+    };
+
+    if (blit->alpha_mode == PPA_ALPHA_FIX_VALUE) {
+        oper_config.alpha_fix_val = blit->alpha_fix_val;
+    } else if (blit->alpha_mode == PPA_ALPHA_SCALE) {
+        oper_config.alpha_scale_ratio = blit->alpha_scale_ratio;
+    }
+
+    return ppa_srm_queue(&oper_config, rotated_output);
+}
+
+// The PPA wants cache line aligned output buffers
+static size_t ppa_line_size(void) {
+    static size_t line_size;
+    if (!line_size) {
+        line_size = cache_hal_get_cache_line_size(CACHE_LL_LEVEL_EXT_MEM, CACHE_TYPE_DATA);
     }
+    return line_size;
+}
+
+static size_t ppa_buffer_size(size_t size) {
+    return (size + ppa_line_size() - 1) & ~(ppa_line_size() - 1);
+}
 
-    *visible = new_visible;
-    return split;
+static void *ppa_buffer_alloc(size_t size) {
+    return heap_caps_aligned_calloc(ppa_line_size(), 1, ppa_buffer_size(size), MALLOC_CAP_SPIRAM);
 }
 
-void window_calculate_visible_regions(window_t *window, window_t *window_list_head, float scale) {
-    window->visible.count    = 1;
-    window->visible.rects[0] = window->rect;
+// Look an INDEX8 framebuffer up in the window palette, the SRM engine has no
+// lookup table. Still half the bytes the application writes.
+static bool window_palette_convert(window_t *window, managed_framebuffer_t *framebuffer) {
+    if (!window->palette) {
+        return false;
+    }
 
-    if (!(window->flags & WINDOW_FLAG_FULLSCREEN)) {
-        // For occlusion we only care about our OWN content region
-        window->visible.rects[0].x += BORDER_PX;
-        window->visible.rects[0].y += BORDER_TOP_PX;
+    taskENTER_CRITICAL(&window->present_damage_lock);
+    if (window->palette_changed) {
+        memcpy(window->palette, window->palette_pending, PALETTE_SIZE * sizeof(uint16_t));
+        window->palette_changed = false;
     }
+    taskEXIT_CRITICAL(&window->present_damage_lock);
 
-    window_t *occluder = window_list_head;
+    // The blits of the last frame may still be reading it
+    ppa_fence();
 
-    while (occluder != NULL && occluder != window) {
-        rect_array_t new_visible = {0};
+    uint8_t const  *in      = (uint8_t const *)framebuffer->framebuffer.pixels;
+    uint16_t       *out     = window->convert_buffer;
+    uint16_t const *palette = window->palette;
+    size_t          pixels  = framebuffer->w * framebuffer->h;
+    for (size_t i = 0; i < pixels; ++i) {
+        out[i] = palette[in[i]];
+    }
 
-        for (int j = 0; j < window->visible.count; j++) {
-            window_rect_t occluder_rect = occluder->rect;
-            if (!(occluder->flags & WINDOW_FLAG_FULLSCREEN)) {
-                // But other window decorations do occlude us
-                occluder_rect.w += (BORDER_PX * 2);
-                occluder_rect.h += BORDER_TOP_PX + BORDER_PX;
-            }
+    int64_t sync_start = esp_timer_get_time();
+    esp_cache_msync(window->convert_buffer, window->convert_buffer_size, ESP_CACHE_MSYNC_FLAG_DIR_C2M);
+    frame_stats.cache_sync_us += esp_timer_get_time() - sync_start;
+    return true;
+}
 
-            small_rect_array_t pieces = rect_subtract(window->visible.rects[j], occluder_rect);
+// Convert a YUV or INDEX8 framebuffer to RGB565 in one go, the PPA only reads
+// YUV420 at even offsets and sizes. Anything else is read directly.
+static bool window_convert_update(window_t *window, managed_framebuffer_t *framebuffer) {
+    if (!framebuffer_converted(framebuffer->format) || window->convert_valid) {
+        return true;
+    }
 
-            for (int k = 0; k < pieces.count; k++) {
-                if (new_visible.count < MAX_VISIBLE_RECTS) {
-                    new_visible.rects[new_visible.count++] = pieces.rects[k];
-                }
-            }
+    size_t size = ppa_buffer_size(framebuffer->w * framebuffer->h * sizeof(uint16_t));
+    if (size > window->convert_buffer_size) {
+        heap_caps_free(window->convert_buffer);
+        window->convert_buffer_size = 0;
+        window->convert_buffer      = ppa_buffer_alloc(size);
+        if (!window->convert_buffer) {
+            ESP_LOGE(TAG, "Unable to allocate %zu byte conversion buffer for window %p", size, window);
+            return false;
+        }
+        window->convert_buffer_size = size;
+    }
+
+    if (framebuffer->format == BADGEVMS_PIXELFORMAT_INDEX8) {
+        window->convert_valid = window_palette_convert(window, framebuffer);
+        return window->convert_valid;
+    }
+
+    window_rect_t         rect        = {.x = 0, .y = 0, .w = framebuffer->w, .h = framebuffer->h};
+    ppa_srm_oper_config_t oper_config = {
+        .in.buffer         = framebuffer->framebuffer.pixels,
+        .in.pic_w          = rect.w,
+        .in.pic_h          = rect.h,
+        .in.block_w        = rect.w,
+        .in.block_h        = rect.h,
+        .in.block_offset_x = 0,
+        .in.block_offset_y = 0,
+        .in.srm_cm         = PPA_SRM_COLOR_MODE_YUV420,
+        // What the JPEG decoder produces
+        .in.yuv_range      = PPA_COLOR_RANGE_FULL,
+        .in.yuv_std        = PPA_COLOR_CONV_STD_RGB_YUV_BT601,
+
+        .out.buffer         = window->convert_buffer,
+        .out.buffer_size    = window->convert_buffer_size,
+        .out.pic_w          = rect.w,
+        .out.pic_h          = rect.h,
+        .out.block_offset_x = 0,
+        .out.block_offset_y = 0,
+        .out.srm_cm         = PPA_SRM_COLOR_MODE_RGB565,
+
+        .rotation_angle    = PPA_SRM_ROTATION_ANGLE_0,
+        .scale_x           = 1.0f,
+        .scale_y           = 1.0f,
+        .alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+        .mode              = PPA_TRANS_MODE_NON_BLOCKING,
+    };
+
+    // The SRM engine works in order, the blits reading the result come after this
+    window->convert_valid = ppa_srm_queue(&oper_config, rect);
+    return window->convert_valid;
+}
+
+// Rotate and scale the window content into its blend buffer, applying the window opacity on the way
+static bool window_blend_buffer_update(window_t *window, managed_framebuffer_t *framebuffer, float scale) {
+    window_rect_t panel = rotate_rect(window_content_rect(window, framebuffer), rotation);
+
+    if (window->blend_valid && !memcmp(&panel, &window->blend_rect, sizeof(window_rect_t))) {
+        return true;
+    }
+
+    size_t size = ppa_buffer_size(panel.w * panel.h * sizeof(uint32_t));
+    if (size > window->blend_buffer_size) {
+        heap_caps_free(window->blend_buffer);
+        window->blend_buffer_size = 0;
+        window->blend_buffer      = ppa_buffer_alloc(size);
+        if (!window->blend_buffer) {
+            ESP_LOGE(TAG, "Unable to allocate %zu byte blend buffer for window %p", size, window);
+            return false;
         }
+        window->blend_buffer_size = size;
+    }
 
-        window->visible = new_visible;
+    window_blit_t blit   = window_blit_params(window, framebuffer, scale);
+    blit.out_buffer      = window->blend_buffer;
+    blit.out_buffer_size = window->blend_buffer_size;
+    blit.out_rect        = panel;
+    blit.out_mode        = PPA_SRM_COLOR_MODE_ARGB8888;
 
-        if (window->visible.count == 0) {
-            break;
+    if ((window->flags & WINDOW_FLAG_ALPHA_BLEND) && window_has_alpha(framebuffer)) {
+        if (window->opacity != 255) {
+            blit.alpha_mode        = PPA_ALPHA_SCALE;
+            blit.alpha_scale_ratio = window->opacity / 255.0f;
         }
+    } else {
+        blit.alpha_mode    = PPA_ALPHA_FIX_VALUE;
+        blit.alpha_fix_val = window->opacity;
+    }
+
+    window->blend_rect  = panel;
+    window->blend_valid = window_blit_rect(window, framebuffer, &blit, window_content_rect(window, framebuffer));
 
-        occluder = occluder->next;
+    return window->blend_valid;
+}
+
+// Blend one on-screen rect of an ARGB8888 buffer in panel orientation over the
+// current display framebuffer. fg_rect is the buffer's position on the panel.
+static bool display_blend_rect(uint32_t *fg, window_rect_t fg_rect, window_rect_t rect) {
+    window_rect_t rotated = rotate_rect(rect, rotation);
+
+    ppa_blend_oper_config_t oper_config = {
+        .in_bg.buffer         = framebuffers[cur_fb],
+        .in_bg.pic_w          = FRAMEBUFFER_MAX_W,
+        .in_bg.pic_h          = FRAMEBUFFER_MAX_H,
+        .in_bg.block_w        = rotated.w,
+        .in_bg.block_h        = rotated.h,
+        .in_bg.block_offset_x = rotated.x,
+        .in_bg.block_offset_y = rotated.y,
+        .in_bg.blend_cm       = PPA_BLEND_COLOR_MODE_RGB565,
+
+        .in_fg.buffer         = fg,
+        .in_fg.pic_w          = fg_rect.w,
+        .in_fg.pic_h          = fg_rect.h,
+        .in_fg.block_w        = rotated.w,
+        .in_fg.block_h        = rotated.h,
+        .in_fg.block_offset_x = rotated.x - fg_rect.x,
+        .in_fg.block_offset_y = rotated.y - fg_rect.y,
+        .in_fg.blend_cm       = PPA_BLEND_COLOR_MODE_ARGB8888,
+
+        .out.buffer         = framebuffers[cur_fb],
+        .out.buffer_size    = FRAMEBUFFER_BYTES,
+        .out.pic_w          = FRAMEBUFFER_MAX_W,
+        .out.pic_h          = FRAMEBUFFER_MAX_H,
+        .out.block_offset_x = rotated.x,
+        .out.block_offset_y = rotated.y,
+        .out.blend_cm       = PPA_BLEND_COLOR_MODE_RGB565,
+
+        .bg_alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+        .fg_alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+        .mode                 = PPA_TRANS_MODE_NON_BLOCKING,
+    };
+
+    return ppa_blend_queue(&oper_config, rotated);
+}
+
+// Blend all visible parts of a translucent window. The blender runs separately
+// from the SRM engine, so whatever was queued below us has to land first.
+static bool window_blend(window_t *window, managed_framebuffer_t *framebuffer, float scale) {
+    if (!window->opacity) {
+        return false;
+    }
+
+    if (!window_blend_buffer_update(window, framebuffer, scale)) {
+        return false;
     }
 
-    merge_rectangles(&window->visible);
-    while (ppa_workaround_split_rects(&window->visible, scale)) {
+    ppa_fence();
+
+    window_rect_t content = window_content_rect(window, framebuffer);
+    bool          blended = false;
+    for (int i = 0; i < window->visible.count; i++) {
+        window_rect_t clipped = rect_intersection(window->visible.rects[i], content);
+        if (clipped.w && clipped.h && display_blend_rect(window->blend_buffer, window->blend_rect, clipped)) {
+            blended = true;
+        }
     }
+
+    return blended;
+}
+
+static bool display_fill_rect(window_rect_t rect, color_pixel_argb8888_data_t color) {
+    window_rect_t rotated = rotate_rect(rect, rotation);
+
+    ppa_fill_oper_config_t oper_config = {
+        .out.buffer         = framebuffers[cur_fb],
+        .out.buffer_size    = FRAMEBUFFER_BYTES,
+        .out.pic_w          = FRAMEBUFFER_MAX_W,
+        .out.pic_h          = FRAMEBUFFER_MAX_H,
+        .out.block_offset_x = rotated.x,
+        .out.block_offset_y = rotated.y,
+        .out.fill_cm        = PPA_FILL_COLOR_MODE_RGB565,
+
+        .fill_block_w    = rotated.w,
+        .fill_block_h    = rotated.h,
+        .fill_argb_color = color,
+        .mode            = PPA_TRANS_MODE_NON_BLOCKING,
+    };
+
+    return ppa_fill_queue(&oper_config, rotated);
 }
 
-window_rect_t content_to_framebuffer_rect(window_rect_t content_rect, window_t *window, float scale) {
-    if (!(window->flags & WINDOW_FLAG_FULLSCREEN)) {
-        content_rect.x -= (window->rect.x + BORDER_PX);
-        content_rect.y -= (window->rect.y + BORDER_TOP_PX);
+// Paint the bars around scaled content that doesn't fill the whole window
+static bool window_fill_letterbox(window_t *window, managed_framebuffer_t *framebuffer) {
+    window_rect_t content = window_content_rect(window, framebuffer);
+    window_rect_t area    = window_visible_content(window);
+
+    if (content.w == area.w && content.h == area.h) {
+        return false;
     }
 
-    managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+    rect_array_t bars = window->visible;
+    if (!region_subtract_rect(&bars, content)) {
+        ESP_LOGW(TAG, "Letterbox of window %p too fragmented", window);
+    }
+
+    bool filled = false;
+    for (int i = 0; i < bars.count; ++i) {
+        if (display_fill_rect(bars.rects[i], LETTERBOX_ARGB)) {
+            filled = true;
+        }
+    }
+
+    return filled;
+}
+
+// Clear whatever part of the current display framebuffer is not going to be
+// painted over by window content. Returns once the PPA is done so the CPU can
+// draw decorations on top.
+static void background_clear(void) {
+    rect_array_t background = {
+        .rects[0] = {.x = 0, .y = 0, .w = FRAMEBUFFER_MAX_W, .h = FRAMEBUFFER_MAX_H},
+        .count    = 1,
+    };
+
+    if (window_stack) {
+        window_t *window = window_stack;
+
+        do {
+            managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+            if (!framebuffer || window_is_translucent(window)) {
+                // The background shows through translucent windows
+                window = window->next;
+                continue;
+            }
+
+            // Windows paint their letterbox bars themselves
+            if (!region_subtract_rect(&background, window_visible_content(window))) {
+                // Too fragmented, clearing everything is cheap enough on the PPA
+                region_init(
+                    &background,
+                    (window_rect_t){.x = 0, .y = 0, .w = FRAMEBUFFER_MAX_W, .h = FRAMEBUFFER_MAX_H}
+                );
+                break;
+            }
 
-    int start_x = (int)(content_rect.x / scale);
-    int start_y = (int)(content_rect.y / scale);
-    int end_x   = (int)((content_rect.x + content_rect.w) / scale);
-    int end_y   = (int)((content_rect.y + content_rect.h) / scale);
+            window = window->next;
+        } while (window != window_stack);
+    }
 
-    start_x = MAX(0, MIN(start_x, (int)framebuffer->w - 1));
-    start_y = MAX(0, MIN(start_y, (int)framebuffer->h - 1));
-    end_x   = MAX(start_x, MIN(end_x, (int)framebuffer->w));
-    end_y   = MAX(start_y, MIN(end_y, (int)framebuffer->h));
+    bool filled = true;
+    for (int i = 0; i < background.count; ++i) {
+        if (!display_fill_rect(background.rects[i], BACKGROUND_ARGB)) {
+            filled = false;
+            break;
+        }
+    }
 
-    window_rect_t fb_rect = {.x = start_x, .y = start_y, .w = end_x - start_x, .h = end_y - start_y};
+    ppa_fence();
 
-    return fb_rect;
+    if (!filled) {
+        why_memset(framebuffers[cur_fb], 0xaa, FRAMEBUFFER_BYTES);
+        int64_t sync_start = esp_timer_get_time();
+        esp_cache_msync(
+            framebuffers[cur_fb],
+            FRAMEBUFFER_BYTES,
+            ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE
+        );
+        frame_stats.cache_sync_us += esp_timer_get_time() - sync_start;
+    }
 }
 
 static void reassign_vaddr(uintptr_t new_vaddr_start, size_t num_pages, allocation_range_t *head) {
@@ -319,26 +940,20 @@ static void reassign_vaddr(uintptr_t new_vaddr_start, size_t num_pages, allocati
     }
 }
 
+// Exchange the pages behind two framebuffers of the same size. Neither may
+// have dirty cache lines, window_present() writes back what the app drew and
+// the display framebuffers are synced as they are drawn.
 static void framebuffer_swap(managed_framebuffer_t *fb_a, managed_framebuffer_t *fb_b) {
     if (!fb_a || !fb_b || !fb_a->framebuffer.pixels || !fb_b->framebuffer.pixels) {
         return;
     }
 
-    // ESP_LOGV(TAG, "Attempting to swap framebuffers %p and %p", fb_a, fb_b);
-
-    esp_cache_msync(
-        fb_a->framebuffer.pixels,
-        fb_a->num_pages * SOC_MMU_PAGE_SIZE,
-        ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE
-    );
-    esp_cache_msync(
-        fb_b->framebuffer.pixels,
-        fb_b->num_pages * SOC_MMU_PAGE_SIZE,
-        ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE
-    );
+    if (fb_a->num_pages != fb_b->num_pages) {
+        ESP_LOGE(TAG, "Unable to swap framebuffers %p and %p, sizes differ", fb_a, fb_b);
+        return;
+    }
 
-    framebuffer_unmap_pages(fb_a->head_pages);
-    framebuffer_unmap_pages(fb_b->head_pages);
+    // ESP_LOGV(TAG, "Attempting to swap framebuffers %p and %p", fb_a, fb_b);
 
     uintptr_t fb_a_vaddr = fb_a->tail_pages->vaddr_start;
     uintptr_t fb_b_vaddr = fb_b->tail_pages->vaddr_start;
@@ -346,47 +961,71 @@ static void framebuffer_swap(managed_framebuffer_t *fb_a, managed_framebuffer_t
     reassign_vaddr(fb_b_vaddr, fb_a->num_pages, fb_a->head_pages);
     reassign_vaddr(fb_a_vaddr, fb_b->num_pages, fb_b->head_pages);
 
-    // Caches are already invalidated
-    framebuffer_map_pages(fb_a->head_pages, fb_a->tail_pages);
-    framebuffer_map_pages(fb_b->head_pages, fb_b->tail_pages);
+    // One critical section for the whole swap, this also invalidates the caches
+    framebuffer_swap_pages(fb_a->head_pages, fb_a->tail_pages, fb_b->head_pages, fb_b->tail_pages);
+
+    // Each framebuffer owns the pages that are now mapped at its address
+    SWAP(fb_a->head_pages, fb_b->head_pages);
+    SWAP(fb_a->tail_pages, fb_b->tail_pages);
 }
 
-framebuffer_t *framebuffer_allocate(uint32_t w, uint32_t h, pixel_format_t format) {
-    // Don't use BADGEVMS_BYTESPERPIXEL here because we also want to
-    // clamp the pixel formats we want to support here anyway
+static size_t framebuffer_format_size(pixel_format_t format, uint32_t w, uint32_t h) {
+    if (format == BADGEVMS_PIXELFORMAT_YUV420_ESP) {
+        return (w * h * 3) / 2;
+    }
+    return w * h * BADGEVMS_BYTESPERPIXEL(format);
+}
 
-    short framebuffer_bpp = 2;
+framebuffer_t *framebuffer_allocate(uint32_t w, uint32_t h, pixel_format_t format) {
+    // Only the formats the PPA can read, anything else falls back to RGB565
     switch (format) {
         case BADGEVMS_PIXELFORMAT_BGRA8888: // fallthrough
         case BADGEVMS_PIXELFORMAT_RGBA8888: // fallthrough
         case BADGEVMS_PIXELFORMAT_ARGB8888: // fallthrough
-        case BADGEVMS_PIXELFORMAT_ABGR8888: framebuffer_bpp = 4; break;
-        case BADGEVMS_PIXELFORMAT_RGB565: // fallthrough
-        case BADGEVMS_PIXELFORMAT_BGR565: break;
+        case BADGEVMS_PIXELFORMAT_ABGR8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_RGB24:    // fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR24:    // fallthrough
+        case BADGEVMS_PIXELFORMAT_RGB565:   // fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR565:   // fallthrough
+        case BADGEVMS_PIXELFORMAT_INDEX8: break;
+        case BADGEVMS_PIXELFORMAT_YUV420_ESP:
+            // The PPA converts it in blocks of 2x2 pixels
+            w = (w + 1) & ~1;
+            h = (h + 1) & ~1;
+            break;
         default: format = BADGEVMS_PIXELFORMAT_RGB565;
     }
 
-    size_t    num_pages        = 0;
-    size_t    framebuffer_size = (w * h * framebuffer_bpp) + SOC_MMU_PAGE_SIZE;
-    uintptr_t vaddr_start      = framebuffer_vaddr_allocate(framebuffer_size, &num_pages);
+    size_t    framebuffer_bytes = framebuffer_format_size(format, w, h);
+    size_t    num_pages         = 0;
+    size_t    framebuffer_size  = framebuffer_bytes + SOC_MMU_PAGE_SIZE;
+    uintptr_t vaddr_start       = framebuffer_vaddr_allocate(framebuffer_size, &num_pages);
 
     if (!vaddr_start) {
-        ESP_LOGE(TAG, "No vaddr space for frame buffer");
+        ESP_LOGE(
+            TAG,
+            "No vaddr space for frame buffer of %zi bytes, the largest free run is %zi pages",
+            framebuffer_size,
+            get_largest_free_framebuffer_pages()
+        );
         return NULL;
     }
 
-    managed_framebuffer_t *framebuffer = calloc(1, sizeof(managed_framebuffer_t));
+    managed_framebuffer_t *framebuffer = slab_alloc(&framebuffer_cache);
     if (!framebuffer) {
         ESP_LOGE(TAG, "No kernel RAM for frame buffer container");
-        framebuffer_vaddr_deallocate(vaddr_start);
+        framebuffer_vaddr_deallocate(vaddr_start, num_pages);
         return NULL;
     }
 
     allocation_range_t *tail_range = NULL;
-    if (!pages_allocate(vaddr_start, num_pages - 1, &framebuffer->head_pages, &framebuffer->tail_pages)) {
+    // Contiguous pages if there are any, fewer ranges to map and swap
+    if (!pages_allocate_contiguous(
+            vaddr_start, num_pages - 1, &framebuffer->head_pages, &framebuffer->tail_pages, NULL
+        )) {
         ESP_LOGE(TAG, "No physical memory pages for frame buffer");
-        framebuffer_vaddr_deallocate(vaddr_start);
-        free(framebuffer);
+        framebuffer_vaddr_deallocate(vaddr_start, num_pages);
+        slab_free(&framebuffer_cache, framebuffer);
         return NULL;
     }
 
@@ -411,7 +1050,9 @@ framebuffer_t *framebuffer_allocate(uint32_t w, uint32_t h, pixel_format_t forma
     framebuffer->num_pages          = num_pages;
     atomic_flag_test_and_set(&framebuffer->clean);
 
-    memset(framebuffer->framebuffer.pixels, 0, (w * h * framebuffer_bpp));
+    // Only pages that don't come from the page zeroer are cleared here. Nothing may
+    // stay dirty in the cache, the pages can be swapped to another address
+    pages_clear(framebuffer->head_pages, framebuffer->tail_pages);
 
     ESP_LOGW(
         TAG,
@@ -426,139 +1067,342 @@ framebuffer_t *framebuffer_allocate(uint32_t w, uint32_t h, pixel_format_t forma
     return (framebuffer_t *)framebuffer;
 }
 
+framebuffer_t *display_framebuffer_allocate(uint32_t w, uint32_t h) {
+    framebuffer_t *framebuffer = framebuffer_allocate(w, h, BADGEVMS_PIXELFORMAT_BGR565);
+
+    if (framebuffer && num_display_framebuffers < DISPLAY_FRAMEBUFFERS) {
+        display_framebuffers[num_display_framebuffers++] = (managed_framebuffer_t *)framebuffer;
+    }
+
+    return framebuffer;
+}
+
 void framebuffer_free(managed_framebuffer_t *framebuffer) {
     if (framebuffer) {
         framebuffer_unmap_pages(framebuffer->head_pages);
         pages_deallocate(framebuffer->head_pages);
-        framebuffer_vaddr_deallocate((uintptr_t)framebuffer->framebuffer.pixels);
+        framebuffer_vaddr_deallocate((uintptr_t)framebuffer->framebuffer.pixels, framebuffer->num_pages);
 
-        free(framebuffer);
+        slab_free(&framebuffer_cache, framebuffer);
     }
 }
 
 IRAM_ATTR static void on_refresh(void *ignored) {
-    xTaskNotifyGiveIndexed(compositor_handle, 0);
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyIndexedFromISR(compositor_handle, 0, COMPOSITOR_NOTIFY_REFRESH, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
 }
 
-// static bool IRAM_ATTR ppa_srm_callback(ppa_client_handle_t ppa_client, ppa_event_data_t *event_data, void *user_data)
-// {
-//     xTaskNotifyGiveIndexed(compositor_handle, 0);
-//     return true;
-// }
+static bool IRAM_ATTR ppa_trans_done(ppa_client_handle_t ppa_client, ppa_event_data_t *event_data, void *user_data) {
+    BaseType_t woken = pdFALSE;
 
-static void IRAM_ATTR NOINLINE_ATTR compositor(void *ignored) {
-    static ppa_client_handle_t ppa_srm_handle = NULL;
+    if (atomic_fetch_sub(&ppa_pending, 1) == 1) {
+        atomic_fetch_add(&ppa_busy_us, esp_timer_get_time() - ppa_busy_start);
+        trace_event(TRACE_PPA_DONE, 0, 0);
+        // Last blit of the frame, wake up anyone in ppa_fence() and let the main loop notify applications
+        vTaskNotifyGiveIndexedFromISR(compositor_handle, 1, &woken);
+        xTaskNotifyIndexedFromISR(compositor_handle, 0, COMPOSITOR_NOTIFY_PPA_DONE, eSetBits, &woken);
+    }
 
-    ppa_client_config_t ppa_srm_config = {
-        .oper_type             = PPA_OPERATION_SRM,
-        .max_pending_trans_num = 1,
-    };
+    return woken == pdTRUE;
+}
 
-    // ppa_event_callbacks_t srm_callbacks = {
-    //     .on_trans_done = ppa_srm_callback,
-    // };
+// A fullscreen window that renders in panel layout can be shown by handing
+// its pages to the panel instead of copying them through the PPA
+static window_t *direct_scanout_window(void) {
+    window_t *window = window_stack;
 
-    ppa_register_client(&ppa_srm_config, &ppa_srm_handle);
-    // ppa_client_register_event_callbacks(ppa_srm_handle, &srm_callbacks);
+    // Overlays have to be blended into a display framebuffer of our own
+    if (!direct_scanout_available || !window || !atomic_load(&window->task_info) || num_overlays) {
+        return NULL;
+    }
 
-    bool   fn_down               = false;
-    bool   frame_ready           = false;
-    time_t launcher_last_started = time(NULL);
+    window_flag_t required = WINDOW_FLAG_FULLSCREEN | WINDOW_FLAG_DOUBLE_BUFFERED | WINDOW_FLAG_NATIVE_ORIENTATION;
+    if ((window->flags & required) != required ||
+        (window->flags & (WINDOW_FLAG_FLIP_HORIZONTAL | WINDOW_FLAG_FLIP_VERTICAL)) || window->opacity != 255) {
+        return NULL;
+    }
 
-    while (1) {
-        bool changes   = false;
-        int  processed = 0;
-        ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+    managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+    if (!framebuffer || !window->framebuffers[window->back_fb] || framebuffer->w != FRAMEBUFFER_MAX_W ||
+        framebuffer->h != FRAMEBUFFER_MAX_H || framebuffer->format != BADGEVMS_PIXELFORMAT_BGR565 ||
+        framebuffer->num_pages != display_framebuffers[cur_fb]->num_pages) {
+        return NULL;
+    }
 
-        if (frame_ready) {
-            lcd_device->_draw(lcd_device, 0, 0, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H, framebuffers[cur_fb]);
-            cur_fb      = (cur_fb + 1) % DISPLAY_FRAMEBUFFERS;
-            frame_ready = false;
-        }
+    return window;
+}
 
-        if (!window_stack) {
-            time_t current_time = time(NULL);
-            if (current_time - launcher_last_started > 2) {
-                application_launch("badgevms_launcher");
-                launcher_last_started = current_time;
-            }
-        }
+// Swap the presented frame into the display framebuffer we are about to show.
+// The window gets the old display pages back as its front buffer.
+static bool direct_scanout_present(window_t *window, bool entering) {
+    managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+    task_info_t           *task_info   = (task_info_t *)atomic_load(&window->task_info);
+    bool                   is_clean    = atomic_flag_test_and_set(&framebuffer->clean);
 
-        compositor_message_t message;
+    if (task_info) {
+        window_priority_update(window, task_info);
+    }
 
-        while (xQueueReceive(compositor_queue, &message, 0) == pdTRUE) {
-            ++processed;
-            switch (message.command) {
-                case WINDOW_CREATE:
-                    push_window(message.window);
-                    mark_scene_damaged();
-                    break;
-                case WINDOW_DESTROY:
-                    remove_window(message.window);
-                    vQueueDelete(message.window->event_queue);
+    if (is_clean && !entering) {
+        return false;
+    }
 
-                    for (int i = 0; i < 2; ++i) {
-                        ESP_LOGW(TAG, "Destroying framebuffer %u for window %p", i, message.window);
-                        framebuffer_free(message.window->framebuffers[i]);
-                    }
+    if (!is_clean) {
+        // Nothing to track, the whole frame goes to the panel
+        window_collect_present_damage(window);
+    }
 
-                    free(message.window->title);
-                    free(message.window);
-                    mark_scene_damaged();
-                    break;
-                case WINDOW_FLAGS:
-                    // Preserve the double buffered flag
-                    bool double_buffered  = message.window->flags & WINDOW_FLAG_DOUBLE_BUFFERED;
-                    message.flags        &= ~WINDOW_FLAG_DOUBLE_BUFFERED;
-                    if (double_buffered) {
-                        message.flags |= WINDOW_FLAG_DOUBLE_BUFFERED;
-                    }
+    framebuffer_swap(framebuffer, display_framebuffers[cur_fb]);
 
-                    if (message.window->flags & WINDOW_FLAG_FULLSCREEN) {
-                        if (!(message.flags & WINDOW_FLAG_FULLSCREEN)) {
-                            message.window->rect = message.window->rect_orig;
-                        }
-                    } else {
-                        if (message.flags & WINDOW_FLAG_FULLSCREEN) {
-                            message.window->rect_orig = message.window->rect;
-                            message.window->rect.x    = 0;
-                            message.window->rect.y    = 0;
-                            message.window->rect.w    = FRAMEBUFFER_MAX_W;
-                            message.window->rect.h    = FRAMEBUFFER_MAX_H;
-                        }
-                    }
-                    message.window->flags = message.flags;
-                    mark_scene_damaged();
-                    break;
-                case WINDOW_MOVE:
-                    window_coords_t coords = window_clamp_position(message.window, message.coords);
-                    message.window->rect.x = coords.x;
-                    message.window->rect.y = coords.y;
-                    mark_scene_damaged();
-                    break;
-                case WINDOW_RESIZE:
-                    window_size_t size     = window_clamp_size(message.window, message.size);
-                    message.window->rect.w = size.w;
-                    message.window->rect.h = size.h;
-                    mark_scene_damaged();
-                    break;
-                case FRAMEBUFFER_SWAP: framebuffer_swap(message.fb_a, message.fb_b); break;
-                default: ESP_LOGE(TAG, "Unknown command %u", message.command);
+    if (!is_clean && task_info) {
+        frame_notify_add(window, task_info->handle);
+    }
+
+    return true;
+}
+
+// Windows hidden behind a scanout window still expect their presents to be consumed
+static void direct_scanout_consume_hidden(window_t *scanout) {
+    for (window_t *window = scanout->next; window != scanout; window = window->next) {
+        task_info_t           *task_info   = (task_info_t *)atomic_load(&window->task_info);
+        managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+
+        if (!framebuffer || !window_present_due(window) || atomic_flag_test_and_set(&framebuffer->clean)) {
+            continue;
+        }
+
+        window_collect_present_damage(window);
+        if (task_info) {
+            frame_notify_add(window, task_info->handle);
+        }
+    }
+}
+
+// Events that only carry the latest state of something, a newer one replaces
+// the queued one of the same kind. EVENT_NONE for everything else.
+static event_type_t event_state_kind(event_type_t type) {
+    switch (type) {
+        case EVENT_WINDOW_RESIZE:
+        case EVENT_WINDOW_FRAME:
+        case EVENT_MEMORY_PRESSURE:
+        case EVENT_WIFI_SCAN:
+        case EVENT_MOTION: return type;
+        case EVENT_WINDOW_OCCLUDED:
+        case EVENT_WINDOW_VISIBLE: return EVENT_WINDOW_VISIBLE;
+        default: return EVENT_NONE;
+    }
+}
+
+// Queue an event for the application and wake it. State events replace a
+// queued one of their kind and a key repeat replaces the repeat before it, so
+// an application that falls behind only loses events once the ring is full of
+// key presses. Those are counted for compositor_stats_get().
+static void window_event_push(window_t *window, event_t const *event) {
+    event_t      e      = *event;
+    event_type_t kind   = event_state_kind(e.type);
+    bool         queued = false;
+
+    // Key events keep the time they were read from the keyboard
+    if (!e.timestamp) {
+        e.timestamp = (uint64_t)esp_timer_get_time() * 1000ULL;
+    }
+
+    taskENTER_CRITICAL(&window->event_lock);
+    for (int i = 0; kind != EVENT_NONE && i < window->event_count; ++i) {
+        event_t *q = &window->events[(window->event_head + i) % WINDOW_MAX_EVENTS];
+        if (event_state_kind(q->type) == kind) {
+            *q     = e;
+            queued = true;
+            break;
+        }
+    }
+
+    if (!queued && e.type == EVENT_KEY_DOWN && e.keyboard.repeat && window->event_count) {
+        event_t *q = &window->events[(window->event_head + window->event_count - 1) % WINDOW_MAX_EVENTS];
+        if (q->type == EVENT_KEY_DOWN && q->keyboard.repeat && q->keyboard.scancode == e.keyboard.scancode) {
+            *q     = e;
+            queued = true;
+        }
+    }
+
+    if (!queued && window->event_count < WINDOW_MAX_EVENTS) {
+        window->events[(window->event_head + window->event_count) % WINDOW_MAX_EVENTS] = e;
+        window->event_count++;
+        queued = true;
+    }
+    taskEXIT_CRITICAL(&window->event_lock);
+
+    if (!queued) {
+        atomic_fetch_add(&window->events_dropped, 1);
+        ESP_LOGW(TAG, "Event queue of window %p full, dropping event %u", window, e.type);
+        return;
+    }
+
+    xSemaphoreGive(window->event_signal);
+    wait_wake(&window->event_waiter);
+}
+
+// Up to max queued events, oldest first
+static size_t window_event_take(window_t *window, event_t *events, size_t max) {
+    taskENTER_CRITICAL(&window->event_lock);
+    size_t count = MIN(max, (size_t)window->event_count);
+    for (size_t i = 0; i < count; ++i) {
+        events[i]          = window->events[window->event_head];
+        window->event_head = (window->event_head + 1) % WINDOW_MAX_EVENTS;
+    }
+    window->event_count -= count;
+    taskEXIT_CRITICAL(&window->event_lock);
+
+    if (atomic_load(&input_latency_enabled)) {
+        for (size_t i = 0; i < count; ++i) {
+            if (events[i].type == EVENT_KEY_DOWN || events[i].type == EVENT_KEY_UP) {
+                // The oldest key counts, the application answers them all with its next present
+                uint32_t expected = 0;
+                uint32_t read_us  = (uint32_t)(events[i].timestamp / 1000ULL) | 1;
+                atomic_compare_exchange_strong(&window->input_taken, &expected, read_us);
             }
+        }
+    }
 
-            if (message.caller) {
-                if (eTaskGetState(message.caller) != eDeleted) {
-                    xTaskNotifyGiveIndexed(message.caller, 0);
-                }
+    return count;
+}
+
+bool window_events_pending(window_t *window) {
+    return window->event_count != 0;
+}
+
+// How much of the content is on screen, while the visible regions are valid
+static int window_visible_permille(window_t *window) {
+    window_rect_t content = window_visible_content(window);
+    int           total   = content.w * content.h;
+    int           visible = 0;
+
+    for (int i = 0; i < window->visible.count; ++i) {
+        visible += window->visible.rects[i].w * window->visible.rects[i].h;
+    }
+
+    return total > 0 ? (int)((int64_t)visible * 1000 / total) : 0;
+}
+
+// Tell the application once nothing of its window is on screen any more, so it
+// can stop drawing, and once something is again
+static void window_visibility_update(window_t *window, bool hidden) {
+    int permille;
+
+    if (hidden) {
+        permille = 0;
+    } else if (window == scanout_window) {
+        permille = 1000;
+    } else if (visible_regions_valid) {
+        permille = window_visible_permille(window);
+    } else {
+        return;
+    }
+
+    atomic_store(&window->visible_permille, permille);
+    if ((permille == 0) == window->occluded) {
+        return;
+    }
+
+    window->occluded = permille == 0;
+
+    event_t e = {
+        .type       = window->occluded ? EVENT_WINDOW_OCCLUDED : EVENT_WINDOW_VISIBLE,
+        .visibility = {.visible = permille / 1000.0f},
+    };
+    window_event_push(window, &e);
+}
+
+// Called on every panel refresh, wakes up windows that are due for a new frame.
+// True if any window was waiting for one.
+static bool window_vsync_dispatch(void) {
+    bool woken = false;
+
+    if (!window_stack) {
+        return false;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t timestamp = ((uint64_t)tv.tv_sec * 1000000000ULL) + ((uint64_t)tv.tv_usec * 1000ULL);
+
+    window_t *window = window_stack;
+    do {
+        int  interval = atomic_load(&window->frame_interval);
+        bool hidden   = window != scanout_window &&
+                        (scanout_window || (visible_regions_valid && window->visible.count == 0));
+        if (window != window_stack) {
+            interval = MAX(interval, hidden ? HIDDEN_FRAME_INTERVAL : BACKGROUND_FRAME_INTERVAL);
+        }
+        window_visibility_update(window, hidden);
+
+        // Pick up a faster rate right away, e.g. when the window comes to the front
+        if (window->frame_countdown > interval) {
+            window->frame_countdown = interval;
+        }
+
+        if (--window->frame_countdown <= 0) {
+            window->frame_countdown = interval;
+            window->present_due     = true;
+
+            TaskHandle_t waiter = (TaskHandle_t)atomic_exchange(&window->vsync_waiter, (uintptr_t)NULL);
+            if (waiter && eTaskGetState(waiter) != eDeleted) {
+                xTaskNotifyGiveIndexed(waiter, 2);
+                woken = true;
             }
 
-            if (processed > WINDOW_COMMANDS_PER_FRAME) {
-                break;
+            if (atomic_exchange(&window->frame_event_requested, false)) {
+                woken = true;
+                event_t e = {
+                    .type  = EVENT_WINDOW_FRAME,
+                    .frame = {.timestamp = timestamp, .frame = refresh_count},
+                };
+                window_event_push(window, &e);
+            }
+        }
+
+        window = window->next;
+    } while (window != window_stack);
+
+    return woken;
+}
+
+static void input_send_command(compositor_command_t command, window_coords_t coords) {
+    compositor_message_t message = {
+        .command = command,
+        .coords  = coords,
+    };
+
+    if (xQueueSend(compositor_queue, &message, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Compositor queue full, dropping window command %u", command);
+    }
+}
+
+// Deliver keyboard events as soon as they come in instead of once per frame.
+// Window management keys are passed on to the compositor, everything else
+// goes straight to the focused window.
+static void input_task(void *ignored) {
+    bool fn_down = false;
+
+    while (1) {
+        event_t events[KEYBOARD_EVENTS_PER_READ];
+        int64_t read_start = esp_timer_get_time();
+        ssize_t res        = keyboard_device->_read(keyboard_device, 0, events, sizeof(events));
+        atomic_fetch_add(&input_read_us, esp_timer_get_time() - read_start);
+
+        if (res <= 0) {
+            keyboard_device_t *keyboard = (keyboard_device_t *)keyboard_device;
+            if (keyboard->_wait) {
+                keyboard->_wait(keyboard_device, UINT32_MAX);
+            } else {
+                vTaskDelay(INPUT_POLL_MS / portTICK_PERIOD_MS);
             }
+            continue;
         }
 
-        event_t events[KEYBOARD_EVENTS_PER_FRAME];
-        ssize_t res = keyboard_device->_read(keyboard_device, 0, events, sizeof(event_t) * KEYBOARD_EVENTS_PER_FRAME);
+        atomic_store(&input_seen, true);
+        governor_boost();
         for (int i = 0; i < res / sizeof(event_t); ++i) {
             event_t *c = &events[i];
             if (c->keyboard.scancode == KEY_SCANCODE_FN) {
@@ -571,600 +1415,2567 @@ static void IRAM_ATTR NOINLINE_ATTR compositor(void *ignored) {
                 c->type = EVENT_NONE;
             }
 
-            if (window_stack) {
-                ESP_LOGV(TAG, "Got scancode %02X mods %02X", c->keyboard.scancode, c->keyboard.mod);
-                if (c->keyboard.scancode == KEY_SCANCODE_TAB && c->keyboard.mod & BADGEVMS_KMOD_LALT &&
-                    c->keyboard.down) {
-                    if (window_stack->next->title) {
-                        ESP_LOGW(
-                            TAG,
-                            "ALT-TAB switching to window %p (%s)",
-                            window_stack->next,
-                            window_stack->next->title
-                        );
-                    } else {
-                        ESP_LOGW(TAG, "ALT-TAB switching to window %p (no title)", window_stack->next);
-                    }
-                    window_stack          = window_stack->next;
-                    c->type               = EVENT_NONE;
-                    // No need to redraw the background
-                    visible_regions_valid = false;
-                    decoration_damaged    = 7;
-                }
+            ESP_LOGV(TAG, "Got scancode %02X mods %02X", c->keyboard.scancode, c->keyboard.mod);
+            if (c->keyboard.scancode == KEY_SCANCODE_TAB && c->keyboard.mod & BADGEVMS_KMOD_LALT && c->keyboard.down) {
+                input_send_command(WINDOW_FOCUS_NEXT, (window_coords_t){0, 0});
+                c->type = EVENT_NONE;
+            }
 
-                if (fn_down) {
-                    if (c->keyboard.down) {
-                        window_coords_t cur_pos = {
-                            .x = window_stack->rect.x,
-                            .y = window_stack->rect.y,
-                        };
-                        switch (c->keyboard.scancode) {
-                            case KEY_SCANCODE_UP:
-                                cur_pos.y -= WINDOW_MOVE_STEP;
-                                mark_scene_damaged();
-                                break;
-                            case KEY_SCANCODE_DOWN:
-                                cur_pos.y += WINDOW_MOVE_STEP;
-                                mark_scene_damaged();
-                                break;
-                            case KEY_SCANCODE_LEFT:
-                                cur_pos.x -= WINDOW_MOVE_STEP;
-                                mark_scene_damaged();
-                                break;
-                            case KEY_SCANCODE_RIGHT:
-                                cur_pos.x += WINDOW_MOVE_STEP;
-                                mark_scene_damaged();
-                                break;
-                            case KEY_SCANCODE_CROSS:
-                                window_t    *window    = window_stack;
-                                task_info_t *task_info = (task_info_t *)atomic_load(&window->task_info);
-                                remove_window(window);
-                                // So we don't end up deleting this window twice
-                                window->next = NULL;
-                                window->prev = NULL;
-
-                                if (task_info) {
-                                    if (eTaskGetState(task_info->handle) != eDeleted) {
-                                        vTaskDelete(task_info->handle);
-                                    }
-                                }
-                                mark_scene_damaged();
-                                continue;
-                            default:
-                        }
-                        cur_pos              = window_clamp_position(window_stack, cur_pos);
-                        window_stack->rect.x = cur_pos.x;
-                        window_stack->rect.y = cur_pos.y;
+            if (fn_down) {
+                if (c->keyboard.down) {
+                    switch (c->keyboard.scancode) {
+                        case KEY_SCANCODE_UP:
+                            input_send_command(WINDOW_NUDGE, (window_coords_t){0, -WINDOW_MOVE_STEP});
+                            break;
+                        case KEY_SCANCODE_DOWN:
+                            input_send_command(WINDOW_NUDGE, (window_coords_t){0, WINDOW_MOVE_STEP});
+                            break;
+                        case KEY_SCANCODE_LEFT:
+                            input_send_command(WINDOW_NUDGE, (window_coords_t){-WINDOW_MOVE_STEP, 0});
+                            break;
+                        case KEY_SCANCODE_RIGHT:
+                            input_send_command(WINDOW_NUDGE, (window_coords_t){WINDOW_MOVE_STEP, 0});
+                            break;
+                        case KEY_SCANCODE_CROSS: input_send_command(WINDOW_KILL, (window_coords_t){0, 0}); break;
+                        case KEY_SCANCODE_T: trace_dump(); break;
+                        default:
                     }
                 }
+                continue;
+            }
 
-                if (!fn_down && c->type != EVENT_NONE) {
-                    if (xQueueSend(window_stack->event_queue, c, 0) != pdTRUE) {
-                        ESP_LOGW(TAG, "Unable to send event to task");
-                    }
-                }
+            if (c->type == EVENT_NONE) {
+                continue;
+            }
+
+            xSemaphoreTake(window_stack_lock, portMAX_DELAY);
+            if (window_stack) {
+                window_event_push(window_stack, c);
             }
+            xSemaphoreGive(window_stack_lock);
         }
+    }
+}
 
-        bool framebuffer_cleared = false;
-        if (background_damaged & (1 << cur_fb)) {
-            memset(framebuffers[cur_fb], 0xaa, FRAMEBUFFER_BYTES);
-            // Make sure the ppa will see our new background
-            esp_cache_msync(
-                framebuffers[cur_fb],
-                FRAMEBUFFER_BYTES,
-                ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE
-            );
-            background_damaged  &= ~(1 << cur_fb);
-            changes              = true;
-            framebuffer_cleared  = true;
+void compositor_broadcast_event(event_t const *event) {
+    if (!window_stack_lock) {
+        return;
+    }
+
+    xSemaphoreTake(window_stack_lock, portMAX_DELAY);
+    window_t *window = window_stack;
+    if (window) {
+        do {
+            window_event_push(window, event);
+            window = window->next;
+        } while (window != window_stack);
+    }
+    xSemaphoreGive(window_stack_lock);
+}
+
+void compositor_send_process_event(task_thread_t const *thread, event_t const *event) {
+    if (!window_stack_lock) {
+        return;
+    }
+
+    xSemaphoreTake(window_stack_lock, portMAX_DELAY);
+    window_t *window = window_stack;
+    if (window) {
+        do {
+            task_info_t *owner = (task_info_t *)atomic_load(&window->task_info);
+            if (owner && owner->thread == thread) {
+                window_event_push(window, event);
+            }
+            window = window->next;
+        } while (window != window_stack);
+    }
+    xSemaphoreGive(window_stack_lock);
+}
+
+__attribute__((always_inline)) static inline window_coords_t
+    overlay_clamp_position(overlay_t *overlay, window_coords_t coords) {
+    coords.x = MAX(0, MIN(coords.x, FRAMEBUFFER_MAX_W - overlay->rect.w));
+    coords.y = MAX(0, MIN(coords.y, FRAMEBUFFER_MAX_H - overlay->rect.h));
+    return coords;
+}
+
+static void overlay_remove(overlay_t *overlay) {
+    int j = 0;
+    for (int i = 0; i < num_overlays; ++i) {
+        if (overlays[i] != overlay) {
+            overlays[j]        = overlays[i];
+            overlays[j]->dirty = ALL_DISPLAY_FB_MASK;
+            ++j;
         }
+    }
+    num_overlays = j;
+}
 
-        if (window_stack) {
-            window_t *window = window_stack->prev; // Start with back window
+static void overlay_free(overlay_t *overlay) {
+    if (!overlay) {
+        return;
+    }
 
-            do {
-                task_info_t *task_info = (task_info_t *)atomic_load(&window->task_info);
-                if (!task_info) {
-                    remove_window(window);
-                    break;
-                }
+    for (int i = 0; i < DISPLAY_FRAMEBUFFERS; ++i) {
+        heap_caps_free(overlay->under[i]);
+    }
+    heap_caps_free(overlay->blend_buffer);
+    framebuffer_free(overlay->framebuffer);
+    free(overlay);
+}
 
-                if (eTaskGetState(task_info->handle) != eDeleted) {
-                    if ((window == window_stack) && (window_stack->flags & WINDOW_FLAG_FULLSCREEN) &&
-                        (!(window_stack->flags & WINDOW_FLAG_LOW_PRIORITY))) {
-                        // A foreground full-screen app gets as much CPU time as it can handle
-                        vTaskPrioritySet(task_info->handle, TASK_PRIORITY_FOREGROUND);
-                    } else {
-                        vTaskPrioritySet(task_info->handle, TASK_PRIORITY);
-                    }
-                }
+// Copy block, a rect on the panel, between a display framebuffer and buffer,
+// which holds the RGB565 pixels of buffer_rect on the panel
+static bool
+    display_copy_rect(int fb, uint16_t *buffer, window_rect_t buffer_rect, window_rect_t block, bool to_display) {
+    if (is_problematic_block_height(block.h, 1.0f)) {
+        int           first_half = (block.h / 2) - 1;
+        window_rect_t top        = block;
+        window_rect_t bottom     = block;
+        top.h                    = first_half;
+        bottom.y                += first_half;
+        bottom.h                -= first_half;
+
+        bool top_ok    = display_copy_rect(fb, buffer, buffer_rect, top, to_display);
+        bool bottom_ok = display_copy_rect(fb, buffer, buffer_rect, bottom, to_display);
+        return top_ok && bottom_ok;
+    }
 
-                managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+    ppa_srm_oper_config_t oper_config = {
+        .in.block_w = block.w,
+        .in.block_h = block.h,
+        .in.srm_cm  = PPA_SRM_COLOR_MODE_RGB565,
 
-                if (!framebuffer) {
-                    // Not yet allocated, or in the process of being destroyed
-                    if (!visible_regions_valid) {
-                        window_calculate_visible_regions(window, window_stack, 1.0);
-                    }
-                    window = window->prev;
-                    continue;
-                }
+        .out.srm_cm = PPA_SRM_COLOR_MODE_RGB565,
+
+        .rotation_angle    = PPA_SRM_ROTATION_ANGLE_0,
+        .scale_x           = 1.0f,
+        .scale_y           = 1.0f,
+        .alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+        .mode              = PPA_TRANS_MODE_NON_BLOCKING,
+    };
 
-                float scale_x = ((float)window->rect.w / (float)framebuffer->w);
-                float scale_y = ((float)window->rect.h / (float)framebuffer->h);
-                float scale   = fminf(scale_x, scale_y);
+    if (to_display) {
+        oper_config.in.buffer         = buffer;
+        oper_config.in.pic_w          = buffer_rect.w;
+        oper_config.in.pic_h          = buffer_rect.h;
+        oper_config.in.block_offset_x = block.x - buffer_rect.x;
+        oper_config.in.block_offset_y = block.y - buffer_rect.y;
+
+        oper_config.out.buffer         = framebuffers[fb];
+        oper_config.out.buffer_size    = FRAMEBUFFER_BYTES;
+        oper_config.out.pic_w          = FRAMEBUFFER_MAX_W;
+        oper_config.out.pic_h          = FRAMEBUFFER_MAX_H;
+        oper_config.out.block_offset_x = block.x;
+        oper_config.out.block_offset_y = block.y;
+    } else {
+        oper_config.in.buffer         = framebuffers[fb];
+        oper_config.in.pic_w          = FRAMEBUFFER_MAX_W;
+        oper_config.in.pic_h          = FRAMEBUFFER_MAX_H;
+        oper_config.in.block_offset_x = block.x;
+        oper_config.in.block_offset_y = block.y;
+
+        oper_config.out.buffer         = buffer;
+        oper_config.out.buffer_size    = ppa_buffer_size(buffer_rect.w * buffer_rect.h * FRAMEBUFFER_BPP);
+        oper_config.out.pic_w          = buffer_rect.w;
+        oper_config.out.pic_h          = buffer_rect.h;
+        oper_config.out.block_offset_x = block.x - buffer_rect.x;
+        oper_config.out.block_offset_y = block.y - buffer_rect.y;
+    }
 
-                if (!visible_regions_valid) {
-                    window_calculate_visible_regions(window, window_stack, scale);
-                }
+    return ppa_srm_queue(&oper_config, block);
+}
 
-                bool is_clean             = atomic_flag_test_and_set(&framebuffer->clean);
-                bool need_decoration_draw = decoration_damaged & (1 << cur_fb);
-                bool need_content_draw    = false;
+// Rotate a part of the overlay content, in framebuffer coordinates, into its blend buffer
+static bool overlay_blend_buffer_rect(overlay_t *overlay, window_rect_t fb_rect) {
+    if (is_problematic_block_height(fb_rect.h, 1.0f)) {
+        int           first_half = (fb_rect.h / 2) - 1;
+        window_rect_t top        = fb_rect;
+        window_rect_t bottom     = fb_rect;
+        top.h                    = first_half;
+        bottom.y                += first_half;
+        bottom.h                -= first_half;
+
+        bool top_ok    = overlay_blend_buffer_rect(overlay, top);
+        bool bottom_ok = overlay_blend_buffer_rect(overlay, bottom);
+        return top_ok && bottom_ok;
+    }
 
-                if (is_clean) {
-                    if (window->fb_dirty & (1 << cur_fb)) {
-                        need_content_draw = true;
-                    }
-                } else {
-                    window->fb_dirty  = 7;
-                    need_content_draw = true;
-                }
+    managed_framebuffer_t *framebuffer = overlay->framebuffer;
+    window_rect_t          panel       = rotate_rect(overlay->rect, rotation);
+    window_rect_t          rotated     = rotate_rect(
+        (window_rect_t){
+                         .x = overlay->rect.x + fb_rect.x,
+                         .y = overlay->rect.y + fb_rect.y,
+                         .w = fb_rect.w,
+                         .h = fb_rect.h,
+        },
+        rotation
+    );
 
-                if (framebuffer_cleared || window == window_stack) {
-                    need_decoration_draw = true;
-                    need_content_draw    = true;
-                }
+    bool                 rgb_swap;
+    ppa_srm_color_mode_t mode = framebuffer_srm_mode(framebuffer->format, &rgb_swap);
+
+    ppa_srm_oper_config_t oper_config = {
+        .in.buffer         = framebuffer->framebuffer.pixels,
+        .in.pic_w          = framebuffer->w,
+        .in.pic_h          = framebuffer->h,
+        .in.block_w        = fb_rect.w,
+        .in.block_h        = fb_rect.h,
+        .in.block_offset_x = fb_rect.x,
+        .in.block_offset_y = fb_rect.y,
+        .in.srm_cm         = mode,
+
+        .out.buffer         = overlay->blend_buffer,
+        .out.buffer_size    = overlay->blend_buffer_size,
+        .out.pic_w          = panel.w,
+        .out.pic_h          = panel.h,
+        .out.block_offset_x = rotated.x - panel.x,
+        .out.block_offset_y = rotated.y - panel.y,
+        .out.srm_cm         = PPA_SRM_COLOR_MODE_ARGB8888,
+
+        .rotation_angle    = rotation_to_srm(rotation),
+        .scale_x           = 1.0f,
+        .scale_y           = 1.0f,
+        .rgb_swap          = rgb_swap,
+        .alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+        .mode              = PPA_TRANS_MODE_NON_BLOCKING,
+    };
 
-                if (need_content_draw) {
-                    ppa_srm_rotation_angle_t ppa_rotation = rotation_to_srm(rotation);
-                    bool                     rgb_swap     = false;
-                    bool                     byte_swap    = false;
-                    ppa_srm_color_mode_t     mode         = PPA_SRM_COLOR_MODE_RGB565;
+    if (BADGEVMS_BYTESPERPIXEL(framebuffer->format) != 4) {
+        oper_config.alpha_update_mode = PPA_ALPHA_FIX_VALUE;
+        oper_config.alpha_fix_val     = 255;
+    }
 
-                    if (window->flags & WINDOW_FLAG_FLIP_HORIZONTAL) {
-                        ppa_rotation = PPA_SRM_ROTATION_ANGLE_270;
-                    }
+    return ppa_srm_queue(&oper_config, rotated);
+}
 
-                    switch (framebuffer->format) {
-                        case BADGEVMS_PIXELFORMAT_RGB565: rgb_swap = true; // Fallthrough
-                        case BADGEVMS_PIXELFORMAT_BGR565: break;
-                        case BADGEVMS_PIXELFORMAT_BGRA8888: rgb_swap = true; // Fallthrough
-                        case BADGEVMS_PIXELFORMAT_RGBA8888: mode = PPA_SRM_COLOR_MODE_ARGB8888; break;
-                        case BADGEVMS_PIXELFORMAT_ARGB8888: rgb_swap = true; // Fallthrough
-                        case BADGEVMS_PIXELFORMAT_ABGR8888: mode = PPA_SRM_COLOR_MODE_ARGB8888; break;
-                        default:
-                    }
+// Take the overlays off the given display framebuffers, topmost first, by
+// putting back what was below them
+static void overlays_restore(int fb_mask) {
+    for (int i = num_overlays - 1; i >= 0; --i) {
+        overlay_t *overlay = overlays[i];
 
-                    for (int i = 0; i < window->visible.count; i++) {
-                        window_rect_t visible_content = window->visible.rects[i];
-                        window_rect_t fb_rect         = content_to_framebuffer_rect(visible_content, window, scale);
+        for (int fb = 0; fb < display_fb_count; ++fb) {
+            if (!(overlay->drawn & fb_mask & (1 << fb))) {
+                continue;
+            }
 
-                        if (fb_rect.w <= 0 || fb_rect.h <= 0) {
-                            continue;
-                        }
+            window_rect_t panel = rotate_rect(overlay->under_rect[fb], rotation);
+            display_copy_rect(fb, overlay->under[fb], panel, panel, true);
+            overlay->drawn &= ~(1 << fb);
+        }
+    }
 
-                        window_rect_t rotated_output = rotate_rect(visible_content, rotation);
-
-                        ppa_srm_oper_config_t oper_config = {
-                            .in.buffer         = framebuffer->framebuffer.pixels,
-                            .in.pic_w          = framebuffer->w,
-                            .in.pic_h          = framebuffer->h,
-                            .in.block_w        = fb_rect.w,
-                            .in.block_h        = fb_rect.h,
-                            .in.block_offset_x = fb_rect.x,
-                            .in.block_offset_y = fb_rect.y,
-                            .in.srm_cm         = mode,
-
-                            .out.buffer         = framebuffers[cur_fb],
-                            .out.buffer_size    = FRAMEBUFFER_BYTES,
-                            .out.pic_w          = FRAMEBUFFER_MAX_W,
-                            .out.pic_h          = FRAMEBUFFER_MAX_H,
-                            .out.block_offset_x = rotated_output.x,
-                            .out.block_offset_y = rotated_output.y,
-                            .out.srm_cm         = PPA_SRM_COLOR_MODE_RGB565,
-
-                            .rotation_angle = ppa_rotation,
-                            .scale_x        = scale,
-                            .scale_y        = scale,
-                            .rgb_swap       = rgb_swap,
-                            .byte_swap      = byte_swap,
-                            .mode           = PPA_TRANS_MODE_BLOCKING,
-                        };
-
-                        esp_err_t ppa_result = ppa_do_scale_rotate_mirror(ppa_srm_handle, &oper_config);
-                        if (ppa_result != ESP_OK) {
-                            printf("PPA operation failed: %s\n", esp_err_to_name(ppa_result));
-                        } else {
-                            changes           = true;
-                            window->fb_dirty &= ~(1 << cur_fb);
-                        }
-                    }
+    // Whatever gets drawn next may come from another PPA engine, or the CPU
+    ppa_fence();
+}
 
-                    // Notify app that content was processed
-                    if (!is_clean) {
-                        if (eTaskGetState(task_info->handle) != eDeleted) {
-                            xTaskNotifyGiveIndexed(task_info->handle, 1);
-                        }
-                    }
-                }
+// Blend the overlays over the finished display framebuffer, saving what's
+// below each one first
+static bool overlays_draw(void) {
+    bool drawn = false;
 
-                if (need_decoration_draw && !(window->flags & WINDOW_FLAG_FULLSCREEN)) {
-                    // Cache sync before drawing decorations
-                    esp_cache_msync(framebuffers[cur_fb], FRAMEBUFFER_BYTES, ESP_CACHE_MSYNC_FLAG_DIR_M2C);
-
-                    draw_window_box(framebuffers[cur_fb], window, window == window_stack);
-
-                    // Cache sync after drawing decorations
-                    esp_cache_msync(
-                        framebuffers[cur_fb],
-                        FRAMEBUFFER_BYTES,
-                        ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE
-                    );
-                    changes = true;
-                }
+    for (int i = 0; i < num_overlays; ++i) {
+        overlay_t    *overlay = overlays[i];
+        window_rect_t panel   = rotate_rect(overlay->rect, rotation);
 
-                window = window->prev;
-            } while (window != window_stack->prev);
+        // Everything below us has to be in the display framebuffer before we save it
+        ppa_fence();
 
-            // Mark decorations as clean for this framebuffer
-            decoration_damaged    &= ~(1 << cur_fb);
-            visible_regions_valid  = true;
+        if (!overlay->blend_valid) {
+            overlay->blend_valid = overlay_blend_buffer_rect(
+                overlay,
+                (window_rect_t){.x = 0, .y = 0, .w = overlay->rect.w, .h = overlay->rect.h}
+            );
+            if (!overlay->blend_valid) {
+                continue;
+            }
         }
 
-        if (changes) {
-            frame_ready = true;
+        if (!display_copy_rect(cur_fb, overlay->under[cur_fb], panel, panel, false)) {
+            continue;
+        }
+        overlay->under_rect[cur_fb]  = overlay->rect;
+        overlay->drawn              |= 1 << cur_fb;
+        overlay->dirty              &= ~(1 << cur_fb);
+
+        // The blender runs separately from the SRM engine
+        ppa_fence();
+        if (display_blend_rect(overlay->blend_buffer, panel, overlay->rect)) {
+            drawn = true;
         }
     }
+
+    return drawn;
 }
 
-void get_screen_info(int *width, int *height, pixel_format_t *format, float *refresh_rate) {
-    *width        = FRAMEBUFFER_MAX_W;
-    *height       = FRAMEBUFFER_MAX_H;
-    *format       = BADGEVMS_PIXELFORMAT_RGB565;
-    *refresh_rate = FRAMEBUFFER_MAX_REFRESH;
+// Does a drawn overlay cover any part of rect on the current display framebuffer
+static bool overlays_cover(window_rect_t rect) {
+    for (int i = 0; i < num_overlays; ++i) {
+        overlay_t *overlay = overlays[i];
+        if ((overlay->drawn & (1 << cur_fb)) && rect_intersects(overlay->under_rect[cur_fb], rect)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static managed_framebuffer_t *
-    window_framebuffer_allocate(window_t *window, window_size_t size, pixel_format_t pixel_format) {
-    size.w = size.w > FRAMEBUFFER_MAX_W ? FRAMEBUFFER_MAX_W : size.w;
-    size.h = size.h > FRAMEBUFFER_MAX_H ? FRAMEBUFFER_MAX_H : size.h;
+// Overlays are taken off and drawn again only when they changed, or when
+// something below them is about to be redrawn. Otherwise they stay in place
+// and nothing below them is touched.
+static bool overlays_need_redraw(void) {
+    bool redraw = false;
 
-    size              = window_clamp_size(window, size);
-    framebuffer_t *fb = framebuffer_allocate(size.w, size.h, pixel_format);
-    if (!fb) {
-        ESP_LOGW(TAG, "Unable to allocate framebuffer");
-        return NULL;
+    for (int i = 0; i < num_overlays; ++i) {
+        overlay_t *overlay = overlays[i];
+
+        if (!atomic_flag_test_and_set(&overlay->framebuffer->clean)) {
+            overlay->dirty       = ALL_DISPLAY_FB_MASK;
+            overlay->blend_valid = false;
+        }
+
+        if (overlay->dirty & (1 << cur_fb)) {
+            redraw = true;
+        }
+    }
+
+    // With nothing of ours on this display framebuffer, there is nothing to take off either
+    window_rect_t screen = {.x = 0, .y = 0, .w = FRAMEBUFFER_MAX_W, .h = FRAMEBUFFER_MAX_H};
+    if (redraw || !overlays_cover(screen)) {
+        return redraw;
+    }
+
+    if ((background_damaged & (1 << cur_fb)) || (decoration_damaged & (1 << cur_fb)) || !visible_regions_valid) {
+        return true;
+    }
+
+    if (!window_stack) {
+        return false;
+    }
+
+    window_t *window = window_stack;
+    do {
+        managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+        if (framebuffer && overlays_cover(window_outer_rect(window)) &&
+            ((!framebuffer_peek_clean(framebuffer) && window_present_due(window)) ||
+             (window->fb_dirty & (1 << cur_fb)) || (window->letterbox_dirty & (1 << cur_fb)) ||
+             window->fb_damage[cur_fb].count)) {
+            return true;
+        }
+        window = window->next;
+    } while (window != window_stack);
+
+    return false;
+}
+
+// Paint the padding right and below of what the PPA writes black, once. Every
+// line is U or V, Y, Y for each pair of pixels.
+static void capture_padding_fill(capture_t *capture, uint8_t *buffer) {
+    size_t stride = capture->size.w * 3 / 2;
+    for (int y = 0; y < capture->size.h; ++y) {
+        int      x    = y < capture->scaled.h ? capture->scaled.w : 0;
+        uint8_t *line = buffer + y * stride;
+        for (; x < capture->size.w; x += 2) {
+            uint8_t *pair = line + x * 3 / 2;
+            pair[0]       = 0x80;
+            pair[1]       = 0x10;
+            pair[2]       = 0x10;
+        }
+    }
+    esp_cache_msync(buffer, ppa_buffer_size(capture->frame_bytes), ESP_CACHE_MSYNC_FLAG_DIR_C2M);
+}
+
+// Queue the capture of the display framebuffer we just handed to the panel.
+// A frame is skipped while the previous one is still being captured.
+static void capture_frame_queue(int fb) {
+    if (!capture || capture_in_flight >= 0) {
+        return;
+    }
+
+    int target = 0;
+    taskENTER_CRITICAL(&capture_lock);
+    while (target == capture_latest || target == capture_reading) {
+        ++target;
+    }
+    taskEXIT_CRITICAL(&capture_lock);
+
+    bool                 rgb_swap;
+    ppa_srm_color_mode_t mode = framebuffer_srm_mode(capture->format, &rgb_swap);
+
+    ppa_srm_oper_config_t oper_config = {
+        .in.buffer         = framebuffers[fb],
+        .in.pic_w          = FRAMEBUFFER_MAX_W,
+        .in.pic_h          = FRAMEBUFFER_MAX_H,
+        .in.block_w        = FRAMEBUFFER_MAX_W,
+        .in.block_h        = FRAMEBUFFER_MAX_H,
+        .in.block_offset_x = 0,
+        .in.block_offset_y = 0,
+        .in.srm_cm         = PPA_SRM_COLOR_MODE_RGB565,
+
+        .out.buffer         = capture->buffers[target],
+        .out.buffer_size    = ppa_buffer_size(capture->frame_bytes),
+        .out.pic_w          = capture->size.w,
+        .out.pic_h          = capture->size.h,
+        .out.block_offset_x = 0,
+        .out.block_offset_y = 0,
+        .out.srm_cm         = mode,
+
+        .rotation_angle    = rotation_from_panel_srm(rotation),
+        .scale_x           = capture->scale,
+        .scale_y           = capture->scale,
+        .rgb_swap          = rgb_swap,
+        .alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+        .mode              = PPA_TRANS_MODE_NON_BLOCKING,
+    };
+
+    if (BADGEVMS_BYTESPERPIXEL(capture->format) == 4) {
+        oper_config.alpha_update_mode = PPA_ALPHA_FIX_VALUE;
+        oper_config.alpha_fix_val     = 255;
+    }
+
+    window_rect_t written = {.x = 0, .y = 0, .w = capture->scaled.w, .h = capture->scaled.h};
+    if (ppa_srm_queue(&oper_config, written)) {
+        capture_in_flight = target;
+    }
+}
+
+// Hand a finished capture to compositor_capture_read(), once the PPA is done with it
+static void capture_flush(void) {
+    if (capture_in_flight < 0 || atomic_load(&ppa_pending)) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&capture_lock);
+    capture_latest    = capture_in_flight;
+    capture_sequence += 1;
+    taskEXIT_CRITICAL(&capture_lock);
+
+    capture_in_flight = -1;
+    xSemaphoreGive(capture_frame);
+}
+
+// A move or resize that a later message in the same batch overrides doesn't
+// need to be applied. Anything else touching the window or overlay in between,
+// or acting on the focused window, keeps the order intact.
+static bool command_superseded(compositor_message_t const *batch, int num_messages, int index) {
+    compositor_message_t const *message = &batch[index];
+
+    if (message->command != WINDOW_MOVE && message->command != WINDOW_RESIZE && message->command != OVERLAY_MOVE) {
+        return false;
+    }
+
+    for (int i = index + 1; i < num_messages; ++i) {
+        if ((batch[i].window || batch[i].overlay) &&
+            (batch[i].window != message->window || batch[i].overlay != message->overlay)) {
+            continue;
+        }
+
+        return batch[i].command == message->command;
+    }
+
+    return false;
+}
+
+// Slow the panel down once nothing happened for DISPLAY_IDLE_REFRESHES, the
+// first present or key press brings it back to full speed. The CPU clock
+// follows the same activity, see governor.h.
+static void panel_idle_update(bool active) {
+    if (active) {
+        governor_boost();
+    }
+    if (!lcd_device->_set_idle) {
+        return;
+    }
+
+    if (atomic_exchange(&input_seen, false) || active) {
+        idle_refreshes = 0;
+        if (panel_idle) {
+            lcd_device->_set_idle(lcd_device, false);
+            panel_idle = false;
+        }
+        return;
+    }
+
+    if (!panel_idle && ++idle_refreshes >= DISPLAY_IDLE_REFRESHES) {
+        lcd_device->_set_idle(lcd_device, true);
+        panel_idle = true;
+    }
+}
+
+// Follow the keys answered by each window one refresh towards the screen. The
+// panel starts scanning out a frame at the refresh after it was handed over,
+// and has shown all of it at the one after that.
+static void input_latency_refresh(bool flipped) {
+    if (atomic_exchange(&input_latency_reset, false) && window_stack) {
+        window_t *window = window_stack;
+        do {
+            atomic_store(&window->input_taken, 0);
+            atomic_store(&window->input_presented, 0);
+            window->input_composed   = 0;
+            window->input_flipped    = 0;
+            window->input_scanning   = 0;
+            window->input_latency_us = 0;
+            memset(window->input_latency, 0, sizeof(window->input_latency));
+            window = window->next;
+        } while (window != window_stack);
+    }
+
+    if (!atomic_load(&input_latency_enabled) || !window_stack) {
+        return;
+    }
+
+    uint32_t  now    = esp_timer_get_time();
+    window_t *window = window_stack;
+    do {
+        if (window->input_scanning) {
+            uint32_t latency = now - window->input_scanning;
+            int      bucket  = MIN(latency / COMPOSITOR_INPUT_LATENCY_BUCKET_US, COMPOSITOR_INPUT_LATENCY_BUCKETS - 1);
+
+            window->input_latency_us = latency;
+            if (window->input_latency[bucket] < UINT16_MAX) {
+                window->input_latency[bucket]++;
+            }
+        }
+
+        window->input_scanning = window->input_flipped;
+        window->input_flipped  = 0;
+        if (flipped) {
+            window->input_flipped  = window->input_composed;
+            window->input_composed = 0;
+        }
+        window = window->next;
+    } while (window != window_stack);
+}
+
+// Publish this refresh's counters for compositor_stats_get() and start over
+static void stats_publish(int64_t refresh_start, bool composited) {
+    compositor_window_stats_t windows[COMPOSITOR_STATS_MAX_WINDOWS];
+    int                       num_windows = 0;
+
+    frame_stats.compose_us  = esp_timer_get_time() - refresh_start;
+    frame_stats.input_us    = atomic_exchange(&input_read_us, 0);
+    frame_stats.ppa_busy_us = atomic_exchange(&ppa_busy_us, 0);
+
+    if (window_stack) {
+        window_t *window = window_stack;
+        do {
+            task_info_t *task_info = (task_info_t *)atomic_load(&window->task_info);
+            if (task_info && num_windows < COMPOSITOR_STATS_MAX_WINDOWS) {
+                windows[num_windows] = (compositor_window_stats_t){
+                    .pid              = task_info->pid,
+                    .presents         = window->presents,
+                    .latency_us       = window->present_latency_us,
+                    .latency_max_us   = window->present_latency_max_us,
+                    .events_dropped   = atomic_load(&window->events_dropped),
+                    .input_latency_us = window->input_latency_us,
+                };
+                memcpy(windows[num_windows].input_latency, window->input_latency, sizeof(window->input_latency));
+                num_windows++;
+            }
+            window = window->next;
+        } while (window != window_stack);
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.refreshes   = refresh_count;
+    stats.frames     += composited;
+    stats.frame       = frame_stats;
+    stats.num_windows = num_windows;
+    memcpy(stats.windows, windows, num_windows * sizeof(compositor_window_stats_t));
+    taskEXIT_CRITICAL(&stats_lock);
+
+    frame_stats = (compositor_frame_stats_t){0};
+
+    TaskHandle_t waiter = atomic_exchange(&frame_waiter, NULL);
+    if (waiter) {
+        xTaskNotifyGiveIndexed(waiter, 1);
+    }
+}
+
+void compositor_frame_wait(uint32_t timeout_ms) {
+    ulTaskNotifyValueClearIndexed(NULL, 1, UINT32_MAX);
+    atomic_store(&frame_waiter, xTaskGetCurrentTaskHandle());
+    ulTaskNotifyTakeIndexed(1, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    atomic_store(&frame_waiter, NULL);
+}
+
+static void IRAM_ATTR NOINLINE_ATTR compositor(void *ignored) {
+    ppa_client_config_t ppa_srm_config = {
+        .oper_type             = PPA_OPERATION_SRM,
+        .max_pending_trans_num = PPA_MAX_PENDING_BLITS,
+    };
+
+    ppa_event_callbacks_t ppa_callbacks = {
+        .on_trans_done = ppa_trans_done,
+    };
+
+    ppa_register_client(&ppa_srm_config, &ppa_srm_handle);
+    ppa_client_register_event_callbacks(ppa_srm_handle, &ppa_callbacks);
+
+    ppa_client_config_t ppa_fill_config = {
+        .oper_type             = PPA_OPERATION_FILL,
+        .max_pending_trans_num = PPA_MAX_PENDING_BLITS,
+    };
+
+    ppa_register_client(&ppa_fill_config, &ppa_fill_handle);
+    ppa_client_register_event_callbacks(ppa_fill_handle, &ppa_callbacks);
+
+    ppa_client_config_t ppa_blend_config = {
+        .oper_type             = PPA_OPERATION_BLEND,
+        .max_pending_trans_num = PPA_MAX_PENDING_BLITS,
+    };
+
+    ppa_register_client(&ppa_blend_config, &ppa_blend_handle);
+    ppa_client_register_event_callbacks(ppa_blend_handle, &ppa_callbacks);
+
+    bool   frame_ready           = false;
+    time_t launcher_last_started = time(NULL);
+
+    while (1) {
+        bool     changes  = false;
+        uint32_t notified = 0;
+        xTaskNotifyWaitIndexed(0, 0, UINT32_MAX, &notified, portMAX_DELAY);
+
+        if (notified & COMPOSITOR_NOTIFY_PPA_DONE) {
+            frame_notify_flush();
+            capture_flush();
+        }
+
+        if (!(notified & COMPOSITOR_NOTIFY_REFRESH)) {
+            continue;
+        }
+
+        int64_t refresh_start = esp_timer_get_time();
+        trace_event(TRACE_FRAME_BEGIN, refresh_count, 0);
+
+        bool flipped = frame_ready;
+        if (frame_ready) {
+            // Blits normally finished long before the refresh, but don't show a half drawn frame
+            ppa_fence();
+            frame_notify_flush();
+            lcd_device->_draw(lcd_device, 0, 0, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H, framebuffers[cur_fb]);
+            capture_flush();
+            capture_frame_queue(cur_fb);
+            cur_fb      = (cur_fb + 1) % display_fb_count;
+            frame_ready = false;
+            if (!first_frame_shown) {
+                boot_profile_mark("first_frame");
+                first_frame_shown = true;
+            }
+        }
+
+        ++refresh_count;
+        input_latency_refresh(flipped);
+        bool paced = window_vsync_dispatch();
+
+        if (!window_stack) {
+            time_t current_time = time(NULL);
+            if (current_time - launcher_last_started > 2) {
+                application_launch("badgevms_launcher");
+                launcher_last_started = current_time;
+            }
+        }
+
+        // The panel only switches to the frame we just handed it at the next
+        // refresh. With two buffers the one we would draw into is scanned out
+        // until then, so everything waits a refresh.
+        if (flipped && display_fb_count < 3) {
+            panel_idle_update(true);
+            stats_publish(refresh_start, false);
+            continue;
+        }
+
+        static compositor_message_t batch[COMPOSITOR_QUEUE_LENGTH];
+        int                         num_messages  = 0;
+        bool                        scene_changed = false;
+
+        // Take everything that is queued right now, later messages wait for the next refresh
+        int64_t queue_start = esp_timer_get_time();
+        while (num_messages < COMPOSITOR_QUEUE_LENGTH &&
+               xQueueReceive(compositor_queue, &batch[num_messages], 0) == pdTRUE) {
+            ++num_messages;
+        }
+
+        for (int i = 0; i < num_messages; ++i) {
+            compositor_message_t message = batch[i];
+
+            if (command_superseded(batch, num_messages, i)) {
+                continue;
+            }
+
+            switch (message.command) {
+                case WINDOW_CREATE:
+                    push_window(message.window);
+                    scene_changed = true;
+                    break;
+                case WINDOW_DESTROY:
+                    // The PPA may still be reading from this window
+                    ppa_fence();
+                    frame_notify_flush();
+                    if (message.window == scanout_window) {
+                        scanout_window = NULL;
+                    }
+                    remove_window(message.window);
+                    vSemaphoreDelete(message.window->event_signal);
+                    heap_caps_free(message.window->events);
+
+                    for (int i = 0; i < 2; ++i) {
+                        ESP_LOGW(TAG, "Destroying framebuffer %u for window %p", i, message.window);
+                        framebuffer_free(message.window->framebuffers[i]);
+                    }
+                    framebuffer_free(message.window->spare_fb);
+                    if (message.window->swap_done) {
+                        vSemaphoreDelete(message.window->swap_done);
+                    }
+
+                    window_decoration_free(message.window);
+                    heap_caps_free(message.window->blend_buffer);
+                    heap_caps_free(message.window->convert_buffer);
+                    heap_caps_free(message.window->palette);
+                    free(message.window->title);
+                    slab_free(&window_cache, message.window);
+                    scene_changed = true;
+                    break;
+                case WINDOW_FLAGS:
+                    // Preserve the double and triple buffered flags
+                    window_flag_t buffering = WINDOW_FLAG_DOUBLE_BUFFERED | WINDOW_FLAG_TRIPLE_BUFFERED;
+                    message.flags           = (message.flags & ~buffering) | (message.window->flags & buffering);
+
+                    if (message.window->flags & WINDOW_FLAG_FULLSCREEN) {
+                        if (!(message.flags & WINDOW_FLAG_FULLSCREEN)) {
+                            message.window->rect = message.window->rect_orig;
+                        }
+                    } else {
+                        if (message.flags & WINDOW_FLAG_FULLSCREEN) {
+                            message.window->rect_orig = message.window->rect;
+                            message.window->rect.x    = 0;
+                            message.window->rect.y    = 0;
+                            message.window->rect.w    = FRAMEBUFFER_MAX_W;
+                            message.window->rect.h    = FRAMEBUFFER_MAX_H;
+                        }
+                    }
+                    message.window->flags       = message.flags;
+                    message.window->blend_valid = false;
+                    scene_changed               = true;
+                    break;
+                case WINDOW_OPACITY:
+                    message.window->opacity     = message.opacity;
+                    message.window->blend_valid = false;
+                    scene_changed               = true;
+                    break;
+                case WINDOW_MOVE:
+                    window_coords_t coords = window_clamp_position(message.window, message.coords);
+                    if (coords.x != message.window->rect.x || coords.y != message.window->rect.y) {
+                        message.window->rect.x = coords.x;
+                        message.window->rect.y = coords.y;
+                        scene_changed          = true;
+                    }
+                    break;
+                case WINDOW_RESIZE:
+                    window_size_t size = window_clamp_size(message.window, message.size);
+                    if (size.w != message.window->rect.w || size.h != message.window->rect.h) {
+                        message.window->rect.w = size.w;
+                        message.window->rect.h = size.h;
+                        scene_changed          = true;
+                    }
+                    break;
+                case FRAMEBUFFER_SWAP:
+                    // Don't remap pages the PPA is still reading from
+                    ppa_fence();
+                    framebuffer_swap(message.fb_a, message.fb_b);
+                    // From a triple buffered window that didn't wait, the frame is in front now
+                    if (message.window) {
+                        atomic_flag_clear(&message.fb_a->clean);
+                        xSemaphoreGive(message.window->swap_done);
+                    }
+                    break;
+                case OVERLAY_CREATE:
+                    message.overlay->dirty   = ALL_DISPLAY_FB_MASK;
+                    overlays[num_overlays++] = message.overlay;
+                    break;
+                case OVERLAY_DESTROY:
+                    // Take every overlay off every display framebuffer, the others get drawn again
+                    ppa_fence();
+                    overlays_restore(ALL_DISPLAY_FB_MASK);
+                    overlay_remove(message.overlay);
+                    overlay_free(message.overlay);
+                    atomic_fetch_sub(&cur_num_overlays, 1);
+                    break;
+                case CAPTURE_SET:
+                    // The PPA may still be writing to the old buffers, the caller frees them
+                    ppa_fence();
+                    capture_in_flight = -1;
+                    taskENTER_CRITICAL(&capture_lock);
+                    capture         = message.capture;
+                    capture_latest  = -1;
+                    capture_reading = -1;
+                    taskEXIT_CRITICAL(&capture_lock);
+                    break;
+                case OVERLAY_MOVE:
+                    window_coords_t position = overlay_clamp_position(message.overlay, message.coords);
+                    if (position.x != message.overlay->rect.x || position.y != message.overlay->rect.y) {
+                        message.overlay->rect.x = position.x;
+                        message.overlay->rect.y = position.y;
+                        message.overlay->dirty  = ALL_DISPLAY_FB_MASK;
+                    }
+                    break;
+                case WINDOW_PARK:
+                    // Killed already
+                    if (!message.window->next) {
+                        break;
+                    }
+                    if (message.window == scanout_window) {
+                        scanout_window = NULL;
+                    }
+                    remove_window(message.window);
+                    // Like a killed window, so destroying it doesn't take it out again
+                    message.window->next   = NULL;
+                    message.window->prev   = NULL;
+                    message.window->parked = true;
+                    scene_changed          = true;
+                    break;
+                case WINDOW_UNPARK:
+                    if (message.window->parked) {
+                        message.window->parked = false;
+                        push_window(message.window);
+                        scene_changed = true;
+                    }
+                    break;
+                case WINDOW_FOCUS_NEXT:
+                    if (!window_stack) {
+                        break;
+                    }
+                    if (window_stack->next->title) {
+                        ESP_LOGW(
+                            TAG,
+                            "ALT-TAB switching to window %p (%s)",
+                            window_stack->next,
+                            window_stack->next->title
+                        );
+                    } else {
+                        ESP_LOGW(TAG, "ALT-TAB switching to window %p (no title)", window_stack->next);
+                    }
+                    xSemaphoreTake(window_stack_lock, portMAX_DELAY);
+                    window_stack = window_stack->next;
+                    xSemaphoreGive(window_stack_lock);
+                    // No need to redraw the background
+                    visible_regions_valid = false;
+                    decoration_damaged    = ALL_DISPLAY_FB_MASK;
+                    break;
+                case WINDOW_NUDGE:
+                    if (!window_stack) {
+                        break;
+                    }
+                    window_coords_t cur_pos = {
+                        .x = window_stack->rect.x + message.coords.x,
+                        .y = window_stack->rect.y + message.coords.y,
+                    };
+                    cur_pos              = window_clamp_position(window_stack, cur_pos);
+                    window_stack->rect.x = cur_pos.x;
+                    window_stack->rect.y = cur_pos.y;
+                    scene_changed        = true;
+                    break;
+                case WINDOW_KILL:
+                    if (!window_stack) {
+                        break;
+                    }
+                    window_t    *window    = window_stack;
+                    task_info_t *task_info = (task_info_t *)atomic_load(&window->task_info);
+                    remove_window(window);
+                    // So we don't end up deleting this window twice
+                    window->next = NULL;
+                    window->prev = NULL;
+
+                    if (task_info) {
+                        if (eTaskGetState(task_info->handle) != eDeleted) {
+                            vTaskDelete(task_info->handle);
+                        }
+                    }
+                    scene_changed = true;
+                    break;
+                default: ESP_LOGE(TAG, "Unknown command %u", message.command);
+            }
+        }
+
+        // Only reply once the whole batch is applied, so superseded callers see the final state
+        for (int i = 0; i < num_messages; ++i) {
+            if (batch[i].caller && eTaskGetState(batch[i].caller) != eDeleted) {
+                xTaskNotifyGiveIndexed(batch[i].caller, 0);
+            }
+        }
+
+        if (scene_changed) {
+            mark_scene_damaged();
+        }
+        focus_update();
+        frame_stats.queue_us = esp_timer_get_time() - queue_start;
+        trace_event(TRACE_FRAME_QUEUE, num_messages, 0);
+
+        window_t *scanout = direct_scanout_window();
+        if (scanout != scanout_window) {
+            if (scanout_window) {
+                // The display framebuffers hold whatever the scanout window drew
+                mark_scene_damaged();
+                mark_windows_dirty(ALL_DISPLAY_FB_MASK);
+            }
+            ESP_LOGI(TAG, "Direct scanout %s", scanout ? "enabled" : "disabled");
+        }
+
+        if (scanout) {
+            bool entering  = scanout != scanout_window;
+            scanout_window = scanout;
+
+            if (direct_scanout_present(scanout, entering)) {
+                changes = true;
+            }
+            direct_scanout_consume_hidden(scanout);
+            frame_notify_flush();
+
+            if (changes) {
+                frame_ready = true;
+            }
+            panel_idle_update(changes || paced || num_messages);
+            stats_publish(refresh_start, changes);
+            continue;
+        }
+        scanout_window = NULL;
+
+        translucent_damage_check(cur_fb);
+
+        bool overlays_redraw = overlays_need_redraw();
+        if (overlays_redraw) {
+            overlays_restore(1 << cur_fb);
+        }
+
+        bool framebuffer_cleared = false;
+        if (background_damaged & (1 << cur_fb)) {
+            background_clear();
+            background_damaged  &= ~(1 << cur_fb);
+            changes              = true;
+            framebuffer_cleared  = true;
+        }
+
+        if (window_stack) {
+            bool      stack_changed     = false;
+            bool      decorations_drawn = false;
+            window_t *window            = window_stack->prev; // Start with back window
+
+            // First pass, all the CPU side work. Decorations have to be in the
+            // framebuffer before the PPA starts writing window content to it.
+            do {
+                task_info_t *task_info = (task_info_t *)atomic_load(&window->task_info);
+                if (!task_info) {
+                    remove_window(window);
+                    stack_changed = true;
+                    break;
+                }
+
+                window_priority_update(window, task_info);
+
+                managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+
+                if (!framebuffer) {
+                    // Not yet allocated, or in the process of being destroyed
+                    if (!visible_regions_valid) {
+                        window_update_visible_regions(window, NULL, 1.0);
+                    }
+                    window = window->prev;
+                    continue;
+                }
+
+                if (!visible_regions_valid) {
+                    window_update_visible_regions(window, framebuffer, window_scale(window, framebuffer));
+                }
+
+                // Decorations are clipped to what's visible of them, so the
+                // content of other windows stays intact
+                bool need_decoration_draw = framebuffer_cleared || (decoration_damaged & (1 << cur_fb));
+                if (need_decoration_draw && !(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+                    // Syncs the cache for just the rects it touches
+                    int64_t decoration_start = esp_timer_get_time();
+                    draw_window_box(framebuffers[cur_fb], window, window == window_stack, &window->decoration_visible);
+                    frame_stats.decoration_us += esp_timer_get_time() - decoration_start;
+                    decorations_drawn          = true;
+                }
+
+                window = window->prev;
+            } while (window != window_stack->prev);
+
+            if (decorations_drawn) {
+                changes = true;
+            }
+
+            if (stack_changed) {
+                // Try again next frame with the remaining windows
+                mark_scene_damaged();
+            } else {
+                // Second pass, queue the content blits. The PPA works through them
+                // while we go back to waiting for the next refresh.
+                window = window_stack->prev;
+
+                do {
+                    task_info_t           *task_info   = (task_info_t *)atomic_load(&window->task_info);
+                    managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+
+                    if (!task_info || !framebuffer) {
+                        window = window->prev;
+                        continue;
+                    }
+
+                    float scale    = window_scale(window, framebuffer);
+                    bool  is_clean = atomic_flag_test_and_set(&framebuffer->clean);
+
+                    if (!is_clean && !window_present_due(window)) {
+                        // Over its frame budget, the application waits for the next interval
+                        atomic_flag_clear(&framebuffer->clean);
+                        is_clean = true;
+                    }
+
+                    if (!is_clean && !overlays_redraw && overlays_cover(window_outer_rect(window))) {
+                        // Presented after overlays_need_redraw() looked, leave it for the next refresh
+                        atomic_flag_clear(&framebuffer->clean);
+                        is_clean = true;
+                    }
+
+                    if (!is_clean) {
+                        window_collect_present_damage(window);
+                        window->blend_valid   = false;
+                        window->convert_valid = false;
+                    }
+
+                    bool full_redraw = window->fb_dirty & (1 << cur_fb);
+
+                    if ((full_redraw || (window->letterbox_dirty & (1 << cur_fb))) && !window_is_translucent(window)) {
+                        if (window_fill_letterbox(window, framebuffer)) {
+                            changes = true;
+                        }
+                    }
+                    window->letterbox_dirty &= ~(1 << cur_fb);
+
+                    if (!is_clean || full_redraw || window->fb_damage[cur_fb].count) {
+                        // Before the blit parameters, the conversion buffer may move
+                        bool                 converted = window_convert_update(window, framebuffer);
+                        window_blit_t        blit      = window_blit_params(window, framebuffer, scale);
+                        damage_rect_array_t *damage    = &window->fb_damage[cur_fb];
+
+                        if (!converted) {
+                            // No conversion buffer, the old content stays on the screen
+                        } else if (window_is_translucent(window)) {
+                            // translucent_damage_check() made sure everything below us was redrawn
+                            if (window_blend(window, framebuffer, scale)) {
+                                changes = true;
+                            }
+                        } else {
+                            for (int i = 0; i < window->visible.count; i++) {
+                                window_rect_t visible_content = window->visible.rects[i];
+
+                                if (full_redraw) {
+                                    if (window_blit_rect(window, framebuffer, &blit, visible_content)) {
+                                        changes = true;
+                                    }
+                                    continue;
+                                }
+
+                                // Only send the damaged parts of this visible rect through the PPA
+                                for (int j = 0; j < damage->count; j++) {
+                                    window_rect_t damaged =
+                                        framebuffer_to_content_rect(damage->rects[j], window, scale);
+                                    window_rect_t clipped = rect_intersection(visible_content, damaged);
+                                    if (window_blit_rect(window, framebuffer, &blit, clipped)) {
+                                        changes = true;
+                                    }
+                                }
+                            }
+                        }
+
+                        window->fb_dirty &= ~(1 << cur_fb);
+                        damage->count     = 0;
+
+                        // Notify app that content was processed, once the PPA is done with it
+                        if (!is_clean) {
+                            frame_notify_add(window, task_info->handle);
+                        }
+                    }
+
+                    window = window->prev;
+                } while (window != window_stack->prev);
+
+                visible_regions_valid = true;
+            }
+
+            // Mark decorations as clean for this framebuffer
+            decoration_damaged &= ~(1 << cur_fb);
+
+            // Nothing may have been queued at all
+            frame_notify_flush();
+        }
+
+        if (overlays_redraw && overlays_draw()) {
+            changes = true;
+        }
+
+        if (changes) {
+            frame_ready = true;
+        }
+        panel_idle_update(changes || paced || num_messages);
+        stats_publish(refresh_start, changes);
+        trace_event(TRACE_FRAME_END, changes, 0);
+    }
+}
+
+void get_screen_info(int *width, int *height, pixel_format_t *format, float *refresh_rate) {
+    *width        = FRAMEBUFFER_MAX_W;
+    *height       = FRAMEBUFFER_MAX_H;
+    *format       = BADGEVMS_PIXELFORMAT_RGB565;
+    *refresh_rate = FRAMEBUFFER_MAX_REFRESH;
+}
+
+int display_framebuffers_configured(void) {
+    nvs_handle_t handle;
+    uint8_t      count = DISPLAY_FRAMEBUFFERS;
+
+    if (nvs_open(DISPLAY_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u8(handle, DISPLAY_NVS_KEY, &count);
+        nvs_close(handle);
+    }
+
+    if (count < DISPLAY_FRAMEBUFFERS_MIN || count > DISPLAY_FRAMEBUFFERS) {
+        return DISPLAY_FRAMEBUFFERS;
+    }
+    return count;
+}
+
+bool display_framebuffers_set(int count) {
+    nvs_handle_t handle;
+
+    if (count < DISPLAY_FRAMEBUFFERS_MIN || count > DISPLAY_FRAMEBUFFERS) {
+        get_task_info()->_errno = EINVAL;
+        return false;
+    }
+
+    if (nvs_open(DISPLAY_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        get_task_info()->_errno = EIO;
+        return false;
+    }
+
+    bool ok = nvs_set_u8(handle, DISPLAY_NVS_KEY, count) == ESP_OK && nvs_commit(handle) == ESP_OK;
+    nvs_close(handle);
+    if (!ok) {
+        get_task_info()->_errno = EIO;
+    }
+    return ok;
+}
+
+int display_framebuffers_get(void) {
+    return display_fb_count;
+}
+
+void compositor_stats_get(compositor_stats_t *out) {
+    taskENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+void compositor_input_latency_enable(bool enable) {
+    if (enable && !atomic_exchange(&input_latency_enabled, true)) {
+        atomic_store(&input_latency_reset, true);
+    } else if (!enable) {
+        atomic_store(&input_latency_enabled, false);
+    }
+}
+
+static int compositor_device_open(void *dev, path_t *path, int flags, mode_t mode) {
+    if (path->directory || path->filename)
+        return -1;
+    return 0;
+}
+
+static int compositor_device_close(void *dev, int fd) {
+    return 0;
+}
+
+static ssize_t compositor_device_write(void *dev, int fd, void const *buf, size_t count) {
+    return -1;
+}
+
+// Every read returns a fresh compositor_stats_t
+static ssize_t compositor_device_read(void *dev, int fd, void *buf, size_t count) {
+    compositor_stats_t snapshot;
+    compositor_stats_get(&snapshot);
+
+    count = MIN(count, sizeof(compositor_stats_t));
+    memcpy(buf, &snapshot, count);
+    return count;
+}
+
+static ssize_t compositor_device_lseek(void *dev, int fd, off_t offset, int whence) {
+    return (off_t)-1;
+}
+
+device_t *compositor_device_create(void) {
+    device_t *dev = calloc(1, sizeof(device_t));
+    if (!dev) {
+        return NULL;
+    }
+
+    dev->type   = DEVICE_TYPE_BLOCK;
+    dev->_open  = compositor_device_open;
+    dev->_close = compositor_device_close;
+    dev->_write = compositor_device_write;
+    dev->_read  = compositor_device_read;
+    dev->_lseek = compositor_device_lseek;
+
+    return dev;
+}
+
+// CAPTURE0 streams frames, every read returns the next one. Opening it starts
+// a full size RGB565 capture unless one is running already.
+static bool     capture_device_opened;
+static bool     capture_device_started;
+static uint32_t capture_device_sequence;
+
+static int capture_device_open(void *dev, path_t *path, int flags, mode_t mode) {
+    if (path->directory || path->filename || capture_device_opened) {
+        return -1;
+    }
+
+    window_size_t screen = {.w = FRAMEBUFFER_MAX_W, .h = FRAMEBUFFER_MAX_H};
+    if (!compositor_capture_info(NULL, NULL, NULL)) {
+        if (!compositor_capture_start(screen, BADGEVMS_PIXELFORMAT_RGB565)) {
+            return -1;
+        }
+        capture_device_started = true;
+    }
+
+    capture_device_opened   = true;
+    capture_device_sequence = 0;
+    return 0;
+}
+
+static int capture_device_close(void *dev, int fd) {
+    if (capture_device_started) {
+        compositor_capture_stop();
+    }
+    capture_device_started = false;
+    capture_device_opened  = false;
+    return 0;
+}
+
+static ssize_t capture_device_write(void *dev, int fd, void const *buf, size_t count) {
+    return -1;
+}
+
+static ssize_t capture_device_read(void *dev, int fd, void *buf, size_t count) {
+    return compositor_capture_read(buf, count, &capture_device_sequence, UINT32_MAX);
+}
+
+static ssize_t capture_device_lseek(void *dev, int fd, off_t offset, int whence) {
+    return (off_t)-1;
+}
+
+device_t *capture_device_create(void) {
+    device_t *dev = calloc(1, sizeof(device_t));
+    if (!dev) {
+        return NULL;
+    }
+
+    dev->type   = DEVICE_TYPE_BLOCK;
+    dev->_open  = capture_device_open;
+    dev->_close = capture_device_close;
+    dev->_write = capture_device_write;
+    dev->_read  = capture_device_read;
+    dev->_lseek = capture_device_lseek;
+
+    return dev;
+}
+
+// Physical pages, without the guard page
+__attribute__((always_inline)) static inline size_t framebuffer_pages(managed_framebuffer_t const *framebuffer) {
+    return framebuffer ? framebuffer->num_pages - 1 : 0;
+}
+
+static managed_framebuffer_t *
+    window_framebuffer_allocate(window_t *window, window_size_t size, pixel_format_t pixel_format) {
+    size.w = size.w > FRAMEBUFFER_MAX_W ? FRAMEBUFFER_MAX_W : size.w;
+    size.h = size.h > FRAMEBUFFER_MAX_H ? FRAMEBUFFER_MAX_H : size.h;
+
+    size              = window_clamp_size(window, size);
+    framebuffer_t *fb = framebuffer_allocate(size.w, size.h, pixel_format);
+    if (!fb) {
+        ESP_LOGW(TAG, "Unable to allocate framebuffer");
+        return NULL;
+    }
+
+    return (managed_framebuffer_t *)fb;
+}
+
+// Count pages against the framebuffer budget of the calling process from its
+// manifest, nothing is counted if that would go over it
+static bool framebuffer_budget_take(size_t pages) {
+    task_thread_t *thread = get_task_info()->thread;
+    size_t         total  = atomic_fetch_add(&thread->framebuffer_pages, pages) + pages;
+    if (thread->max_framebuffer_pages && total > thread->max_framebuffer_pages) {
+        atomic_fetch_sub(&thread->framebuffer_pages, pages);
+        ESP_LOGW(TAG, "Over the budget of %zu framebuffer pages", thread->max_framebuffer_pages);
+        return false;
+    }
+    return true;
+}
+
+static void window_framebuffers_free(window_t *window) {
+    framebuffer_free(window->spare_fb);
+    if (window->swap_done) {
+        vSemaphoreDelete(window->swap_done);
+    }
+    framebuffer_free(window->framebuffers[0]);
+    framebuffer_free(window->framebuffers[1]);
+    window->spare_fb        = NULL;
+    window->swap_done       = NULL;
+    window->framebuffers[0] = NULL;
+    window->framebuffers[1] = NULL;
+}
+
+framebuffer_t *window_framebuffer_create(window_t *window, window_size_t size, pixel_format_t pixel_format) {
+    if (!window) {
+        return NULL;
+    }
+
+    if (window->framebuffers[0] || window->framebuffers[1]) {
+        return NULL;
+    }
+    window->front_fb = 0;
+    window->back_fb  = 0;
+
+    window->framebuffers[0] = window_framebuffer_allocate(window, size, pixel_format);
+    if (!window->framebuffers[0]) {
+        ESP_LOGW(
+            TAG,
+            "Unable to allocate framebuffer 0 for window %p, task %u",
+            window,
+            ((task_info_t *)window->task_info)->pid
+        );
+        return NULL;
+    }
+
+    if (window->flags & WINDOW_FLAG_DOUBLE_BUFFERED) {
+        window->framebuffers[1] = window_framebuffer_allocate(window, size, pixel_format);
+        if (!window->framebuffers[1]) {
+            ESP_LOGW(TAG, "Unable to allocate framebuffer 1 for window %p", window);
+            framebuffer_free(window->framebuffers[0]);
+            window->framebuffers[0] = NULL;
+            return NULL;
+        }
+        window->back_fb = 1;
+    }
+
+    if (window->flags & WINDOW_FLAG_TRIPLE_BUFFERED) {
+        window->spare_fb  = window_framebuffer_allocate(window, size, pixel_format);
+        window->swap_done = xSemaphoreCreateBinary();
+        if (!window->spare_fb || !window->swap_done) {
+            ESP_LOGW(TAG, "Unable to allocate the spare framebuffer for window %p", window);
+            window_framebuffers_free(window);
+            return NULL;
+        }
+    }
+
+    size_t pages = framebuffer_pages(window->framebuffers[0]) + framebuffer_pages(window->framebuffers[1]) +
+                   framebuffer_pages(window->spare_fb);
+    if (!framebuffer_budget_take(pages)) {
+        window_framebuffers_free(window);
+        return NULL;
+    }
+
+    if (window->framebuffers[0]->format == BADGEVMS_PIXELFORMAT_INDEX8 && !window->palette) {
+        // Black until window_palette_set()
+        window->palette = heap_caps_calloc(2 * PALETTE_SIZE, sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+        if (window->palette) {
+            window->palette_pending = window->palette + PALETTE_SIZE;
+        } else {
+            ESP_LOGE(TAG, "Unable to allocate the palette of window %p", window);
+        }
+    }
+
+    window->fb_dirty = ALL_DISPLAY_FB_MASK;
+    return (framebuffer_t *)window->framebuffers[window->back_fb];
+}
+
+window_t *window_create(char const *title, window_size_t size, window_flag_t flags) {
+    if (atomic_load(&cur_num_windows) >= MAX_WINDOWS) {
+        return NULL;
+    }
+
+    task_info_t *task_info = get_task_info();
+
+    window_t *window = slab_alloc(&window_cache);
+    if (!window) {
+        ESP_LOGW(TAG, "Unable to allocate window");
+        goto error;
+    }
+
+    if (title) {
+        window_title_set(window, title);
+        if (!window->title) {
+            ESP_LOGW(TAG, "Unable to allocate window title");
+            goto error;
+        }
+    }
+
+    window->events       = heap_caps_calloc(WINDOW_MAX_EVENTS, sizeof(event_t), MALLOC_CAP_SPIRAM);
+    window->event_signal = xSemaphoreCreateBinary();
+    if (!window->events || !window->event_signal) {
+        ESP_LOGW(TAG, "Out of memory trying to allocate window event queue");
+        goto error;
+    }
+
+    portMUX_INITIALIZE(&window->event_lock);
+    portMUX_INITIALIZE(&window->present_damage_lock);
+    atomic_store(&window->frame_interval, 1);
+    atomic_store(&window->visible_permille, 1000);
+    window->opacity = 255;
+
+    if (flags & WINDOW_FLAG_TRIPLE_BUFFERED) {
+        flags |= WINDOW_FLAG_DOUBLE_BUFFERED;
+    }
+    window->flags  = flags;
+    window->rect.x = 0;
+    window->rect.y = 0;
+    size           = window_clamp_size(window, size);
+    window->rect.w = size.w;
+    window->rect.h = size.h;
+
+    atomic_store(&window->task_info, (uintptr_t)task_info);
+    window_frame_rate_set(window, 0);
+
+    task_resource_link(&window->resource, RES_WINDOW, window);
+
+    compositor_message_t message = {
+        .command = WINDOW_CREATE,
+        .window  = window,
+        .caller  = xTaskGetCurrentTaskHandle(),
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+
+    return window;
+error:
+    if (window->event_signal) {
+        vSemaphoreDelete(window->event_signal);
+    }
+    heap_caps_free(window->events);
+    free(window->title);
+    slab_free(&window_cache, window);
+    return NULL;
+}
+
+void window_destroy_task(window_t *window) {
+    if (!window) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Destroying window %p\n", window);
+    atomic_store(&window->task_info, (uintptr_t)NULL);
+
+    compositor_message_t message = {
+        .command = WINDOW_DESTROY,
+        .window  = window,
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+}
+
+void window_park_task(window_t *window, bool parked) {
+    compositor_message_t message = {
+        .command = parked ? WINDOW_PARK : WINDOW_UNPARK,
+        .window  = window,
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+}
+
+void window_destroy(window_t *window) {
+    if (!window) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Destroying window %p\n", window);
+    // Before the compositor frees it
+    task_resource_unlink(&window->resource);
+    atomic_store(&window->task_info, (uintptr_t)NULL);
+    atomic_fetch_sub(
+        &get_task_info()->thread->framebuffer_pages,
+        framebuffer_pages(window->framebuffers[0]) + framebuffer_pages(window->framebuffers[1]) +
+            framebuffer_pages(window->spare_fb)
+    );
+
+    compositor_message_t message = {
+        .command = WINDOW_DESTROY,
+        .window  = window,
+        .caller  = xTaskGetCurrentTaskHandle(),
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+}
+
+char const *window_title_get(window_t *window) {
+    return window->title;
+}
+
+void window_title_set(window_t *window, char const *title) {
+    // window->title is either NULL or a string from strndup()
+    free(window->title);
+    if (title) {
+        window->title = strndup(title, 20);
+        if (!window->title) {
+            ESP_LOGW(TAG, "Unable to allocate window title");
+        }
+    }
+}
+
+window_coords_t window_position_get(window_t *window) {
+    window_coords_t ret = {
+        .x = window->rect.x,
+        .y = window->rect.y,
+    };
+    return ret;
+}
+
+window_coords_t window_position_set(window_t *window, window_coords_t coords) {
+    if (!window) {
+        return (window_coords_t){0, 0};
+    }
+
+    compositor_message_t message = {
+        .command = WINDOW_MOVE,
+        .coords  = coords,
+        .window  = window,
+        .caller  = xTaskGetCurrentTaskHandle(),
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+
+    return window_position_get(window);
+}
+
+window_size_t window_size_get(window_t *window) {
+    window_size_t ret = {
+        .w = window->rect.w,
+        .h = window->rect.h,
+    };
+    return ret;
+}
+
+window_size_t window_size_set(window_t *window, window_size_t size) {
+    if (!window) {
+        return (window_size_t){0, 0};
+    }
+
+    compositor_message_t message = {
+        .command = WINDOW_RESIZE,
+        .size    = size,
+        .window  = window,
+        .caller  = xTaskGetCurrentTaskHandle(),
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+
+    return window_size_get(window);
+}
+
+window_flag_t window_flags_get(window_t *window) {
+    return window->flags;
+}
+
+window_flag_t window_flags_set(window_t *window, window_flag_t flags) {
+    compositor_message_t message = {
+        .command = WINDOW_FLAGS,
+        .window  = window,
+        .flags   = flags,
+        .caller  = xTaskGetCurrentTaskHandle(),
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+    return flags;
+}
+
+uint8_t window_opacity_get(window_t *window) {
+    return window->opacity;
+}
+
+void window_opacity_set(window_t *window, uint8_t opacity) {
+    compositor_message_t message = {
+        .command = WINDOW_OPACITY,
+        .window  = window,
+        .opacity = opacity,
+        .caller  = xTaskGetCurrentTaskHandle(),
+    };
+
+    xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+}
+
+framebuffer_t *window_framebuffer_get(window_handle_t window) {
+    if (!window) {
+        return NULL;
+    }
+
+    return (framebuffer_t *)window->framebuffers[window->back_fb];
+}
+
+window_size_t window_framebuffer_size_get(window_handle_t window) {
+    if (!(window && window->framebuffers[0])) {
+        return (window_size_t){0, 0};
+    }
+
+    return (window_size_t){window->framebuffers[0]->w, window->framebuffers[0]->h};
+}
+
+window_size_t window_framebuffer_size_set(window_handle_t window, window_size_t size) {
+    return window_framebuffer_size_get(window);
+}
+
+pixel_format_t window_framebuffer_format_get(window_handle_t window) {
+    if (!(window && window->framebuffers[0])) {
+        return 0;
+    }
+
+    return window->framebuffers[0]->format;
+}
+
+void window_palette_set(window_t *window, uint32_t const *colors, int first, int num) {
+    if (!window || !window->palette || !colors || first < 0 || num <= 0 || first + num > PALETTE_SIZE) {
+        return;
+    }
+
+    // Converted before taking the lock
+    uint16_t rgb565[PALETTE_SIZE];
+    for (int i = 0; i < num; ++i) {
+        rgb565[i] = rgb888_to_rgb565(colors[i] >> 16, colors[i] >> 8, colors[i]);
+    }
+
+    // Every pixel may have changed color
+    taskENTER_CRITICAL(&window->present_damage_lock);
+    memcpy(window->palette_pending + first, rgb565, num * sizeof(uint16_t));
+    window->palette_changed     = true;
+    window->present_damage_full = true;
+    taskEXIT_CRITICAL(&window->present_damage_lock);
+}
+
+#if 0
+static inline void copy_framebuffer_rect(managed_framebuffer_t *dst, managed_framebuffer_t *src, window_rect_t rect) {
+    if (rect.x == 0 && rect.y == 0 && rect.w == dst->w && rect.h == dst->h) {
+        // Full rect damage
+        memcpy(dst->framebuffer.pixels, src->framebuffer.pixels, dst->num_pages * SOC_MMU_PAGE_SIZE);
+        return;
+    }
+
+    int max_x = MIN(dst->w, src->w);
+    int max_y = MIN(dst->h, src->h);
+
+    rect.x = MAX(0, MIN(rect.x, max_x));
+    rect.y = MAX(0, MIN(rect.y, max_y));
+    rect.w = MIN(rect.w, max_x - rect.x);
+    rect.h = MIN(rect.h, max_y - rect.y);
+
+    if (rect.w <= 0 || rect.h <= 0) {
+        return;
+    }
+
+    int      bytes_per_pixel = BADGEVMS_BYTESPERPIXEL(dst->format);
+    uint8_t *dst_pixels      = (uint8_t *)dst->framebuffer.pixels;
+    uint8_t *src_pixels      = (uint8_t *)src->framebuffer.pixels;
+
+    int dst_stride = dst->w * bytes_per_pixel;
+    int src_stride = src->w * bytes_per_pixel;
+    int copy_width = rect.w * bytes_per_pixel;
+
+    for (int y = 0; y < rect.h; y++) {
+        uint8_t *dst_row = dst_pixels + ((rect.y + y) * dst_stride) + (rect.x * bytes_per_pixel);
+        uint8_t *src_row = src_pixels + ((rect.y + y) * src_stride) + (rect.x * bytes_per_pixel);
+        memcpy(dst_row, src_row, copy_width);
+    }
+}
+#endif
+
+void window_present(window_t *window, bool block, window_rect_t *rects, int num_rects) {
+    if (!window || !window->framebuffers[0]) {
+        return;
+    }
+
+    managed_framebuffer_t *front_buffer = NULL;
+    managed_framebuffer_t *back_buffer  = NULL;
+    bool                   swap_async   = false;
+
+    if (window->flags & WINDOW_FLAG_DOUBLE_BUFFERED && window->framebuffers[1]) {
+        front_buffer = window->framebuffers[window->front_fb];
+        back_buffer  = window->framebuffers[window->back_fb];
+
+        if (!front_buffer || !back_buffer) {
+            abort();
+        }
+
+        // The spare is only ours again once the compositor swapped the last frame in
+        if (window->spare_fb && window->swap_pending) {
+            xSemaphoreTake(window->swap_done, portMAX_DELAY);
+            window->swap_pending = false;
+        }
+
+        // The compositor only remaps the pages, write back what we drew while
+        // they are still at this address. This is the app's time, not the compositor's.
+        esp_cache_msync(
+            back_buffer->framebuffer.pixels,
+            framebuffer_format_size(back_buffer->format, back_buffer->w, back_buffer->h),
+            ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_UNALIGNED
+        );
+
+        if (window->spare_fb) {
+            // The frame moves to the spare and the app draws the next one into
+            // what was there, the compositor swaps it in front when it gets to it
+            framebuffer_swap(back_buffer, window->spare_fb);
+            swap_async = true;
+            block      = false;
+        } else {
+            compositor_message_t message = {
+                .command = FRAMEBUFFER_SWAP,
+                .fb_a    = front_buffer,
+                .fb_b    = back_buffer,
+                .caller  = xTaskGetCurrentTaskHandle(),
+            };
+
+            xQueueSend(compositor_queue, &message, portMAX_DELAY);
+            ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+
+            // We've waited long enough
+            block = false;
+        }
+    } else {
+        front_buffer = window->framebuffers[window->front_fb];
+    }
+
+    // Record what changed before marking the buffer dirty, the compositor
+    // picks up the damage as soon as it sees the clean flag cleared
+    taskENTER_CRITICAL(&window->present_damage_lock);
+    if (!rects || num_rects <= 0) {
+        window->present_damage_full = true;
+    } else if (!window->present_damage_full) {
+        window_rect_t bounds = {.x = 0, .y = 0, .w = front_buffer->w, .h = front_buffer->h};
+        for (int i = 0; i < num_rects; ++i) {
+            damage_add(&window->present_damage, rect_intersection(rects[i], bounds));
+        }
+    }
+    taskEXIT_CRITICAL(&window->present_damage_lock);
+
+    // Latency is measured from the oldest frame the compositor hasn't picked up, never store 0
+    uint32_t expected = 0;
+    atomic_compare_exchange_strong(&window->present_time, &expected, (uint32_t)esp_timer_get_time() | 1);
+
+    // This frame answers the keys taken since the last one
+    uint32_t input = atomic_exchange(&window->input_taken, 0);
+    if (input) {
+        expected = 0;
+        atomic_compare_exchange_strong(&window->input_presented, &expected, input);
+    }
+
+    if (swap_async) {
+        compositor_message_t message = {
+            .command = FRAMEBUFFER_SWAP,
+            .window  = window,
+            .fb_a    = front_buffer,
+            .fb_b    = window->spare_fb,
+        };
+
+        window->swap_pending = true;
+        xQueueSend(compositor_queue, &message, portMAX_DELAY);
+    } else {
+        atomic_flag_clear(&front_buffer->clean);
+    }
+    task_launch_presented();
+
+    if (block) {
+        ulTaskNotifyTakeIndexed(1, pdTRUE, portMAX_DELAY);
+    }
+}
+
+// Formats ppa_blit() reads, what framebuffer_allocate() takes apart from YUV and INDEX8
+static bool ppa_draw_format(pixel_format_t format) {
+    switch (format) {
+        case BADGEVMS_PIXELFORMAT_BGRA8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_RGBA8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_ARGB8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_ABGR8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_RGB24:    // fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR24:    // fallthrough
+        case BADGEVMS_PIXELFORMAT_RGB565:   // fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR565: return true;
+        default: return false;
+    }
+}
+
+// The PPA goes on reading while the caller is switched out and another
+// application is mapped. What every task sees at the same address can be
+// handed to it as it is: framebuffers and dma_buffer_alloc().
+static bool ppa_draw_readable(void const *pixels, size_t size) {
+    uintptr_t start = (uintptr_t)pixels;
+    return start >= FRAMEBUFFER_HEAP_START && start + size <= FRAMEBUFFER_HEAP_START + FRAMEBUFFER_HEAP_SIZE;
+}
+
+__attribute__((always_inline)) static inline bool ppa_draw_inside(window_rect_t rect, int w, int h) {
+    return rect.w > 0 && rect.h > 0 && rect.x >= 0 && rect.y >= 0 && rect.x + rect.w <= w && rect.y + rect.h <= h;
+}
+
+static ppa_blend_color_mode_t srm_to_blend_mode(ppa_srm_color_mode_t mode) {
+    switch (mode) {
+        case PPA_SRM_COLOR_MODE_ARGB8888: return PPA_BLEND_COLOR_MODE_ARGB8888;
+        case PPA_SRM_COLOR_MODE_RGB888: return PPA_BLEND_COLOR_MODE_RGB888;
+        default: return PPA_BLEND_COLOR_MODE_RGB565;
+    }
+}
+
+static ppa_fill_color_mode_t srm_to_fill_mode(ppa_srm_color_mode_t mode) {
+    switch (mode) {
+        case PPA_SRM_COLOR_MODE_ARGB8888: return PPA_FILL_COLOR_MODE_ARGB8888;
+        case PPA_SRM_COLOR_MODE_RGB888: return PPA_FILL_COLOR_MODE_RGB888;
+        default: return PPA_FILL_COLOR_MODE_RGB565;
+    }
+}
+
+// A buffer of an application as the PPA gets to see it. Pixels in the task heap
+// are aliased where they stay put while the application is switched out.
+typedef struct {
+    framebuffer_t framebuffer;
+    void const   *task_pixels; // What was aliased, NULL if nothing was
+    size_t        size;
+} ppa_draw_buffer_t;
+
+static bool ppa_draw_buffer_get(ppa_draw_buffer_t *buffer, framebuffer_t const *framebuffer, bool output) {
+    buffer->framebuffer = *framebuffer;
+    buffer->task_pixels = NULL;
+    buffer->size        = framebuffer_format_size(framebuffer->format, framebuffer->w, framebuffer->h);
+
+    if (!framebuffer->pixels || !ppa_draw_format(framebuffer->format)) {
+        return false;
+    }
+
+    // The PPA writes whole cache lines
+    if (output && ((uintptr_t)framebuffer->pixels & (ppa_line_size() - 1))) {
+        return false;
+    }
+
+    if (ppa_draw_readable(framebuffer->pixels, buffer->size)) {
+        return true;
+    }
+
+    void *alias = memory_alias_map(framebuffer->pixels, buffer->size);
+    if (!alias) {
+        return false;
+    }
+
+    buffer->framebuffer.pixels = alias;
+    buffer->task_pixels        = framebuffer->pixels;
+    return true;
+}
+
+static void ppa_draw_buffer_put(ppa_draw_buffer_t *buffer) {
+    if (buffer->task_pixels) {
+        memory_alias_release(buffer->framebuffer.pixels, buffer->task_pixels, buffer->size);
+        buffer->task_pixels = NULL;
+    }
+}
+
+// Rows per transaction of an operation w pixels wide, a multiple of 16 so
+// every band scales to whole rows
+static int ppa_draw_band_rows(int w) {
+    return MAX(32, (PPA_DRAW_BAND_PIXELS / w) & ~15);
+}
+
+// The PPA only swaps the colors of what it reads. Reading the destination as
+// it is and swapping the source for both leaves the destination's order.
+bool ppa_blit(
+    framebuffer_t       *dst,
+    window_rect_t        dst_rect,
+    framebuffer_t const *src,
+    window_rect_t        src_rect,
+    rotation_angle_t     rotation,
+    int                  mirror
+) {
+    if (!dst || !src || !ppa_draw_lock) {
+        return false;
+    }
+
+    // The size of dst_rect before rotating
+    bool transposed = rotation == ROTATION_ANGLE_90 || rotation == ROTATION_ANGLE_270;
+    int  out_w      = transposed ? dst_rect.h : dst_rect.w;
+    int  out_h      = transposed ? dst_rect.w : dst_rect.h;
+
+    if (!ppa_draw_inside(src_rect, src->w, src->h) || !ppa_draw_inside(dst_rect, dst->w, dst->h)) {
+        return false;
+    }
+
+    // Scaling is in steps of 1/16, anything in between would come out a pixel off
+    if ((out_w * 16) % src_rect.w || (out_h * 16) % src_rect.h) {
+        return false;
+    }
+
+    ppa_draw_buffer_t in;
+    ppa_draw_buffer_t out;
+    if (!ppa_draw_buffer_get(&in, src, false)) {
+        return false;
+    }
+    if (!ppa_draw_buffer_get(&out, dst, true)) {
+        ppa_draw_buffer_put(&in);
+        return false;
+    }
+
+    bool                 in_swap;
+    bool                 out_swap;
+    ppa_srm_color_mode_t in_mode  = framebuffer_srm_mode(in.framebuffer.format, &in_swap);
+    ppa_srm_color_mode_t out_mode = framebuffer_srm_mode(out.framebuffer.format, &out_swap);
+    esp_err_t            result   = ESP_OK;
+
+    // Only a plain copy is cut into bands, each band of src lands as a band in
+    // dst. Rotated or mirrored the bands would land elsewhere.
+    bool banded = rotation == ROTATION_ANGLE_0 && !mirror;
+    int  rows   = banded ? ppa_draw_band_rows(src_rect.w) : src_rect.h;
+
+    for (int y = 0; y < src_rect.h && result == ESP_OK;) {
+        int h = MIN(rows, src_rect.h - y);
+        if (h < src_rect.h - y && is_problematic_block_height(src_rect.h - y - h, 1.0f)) {
+            // Leave the last band a height the PPA takes
+            h -= 16;
+        }
+        if (is_problematic_block_height(h, 1.0f)) {
+            // Unscaled a band can end on any row, leave the last one for the next
+            if (!banded || out_h != src_rect.h) {
+                result = ESP_ERR_NOT_SUPPORTED;
+                break;
+            }
+            h -= 1;
+        }
+
+        ppa_srm_oper_config_t oper_config = {
+            .in.buffer         = in.framebuffer.pixels,
+            .in.pic_w          = in.framebuffer.w,
+            .in.pic_h          = in.framebuffer.h,
+            .in.block_w        = src_rect.w,
+            .in.block_h        = h,
+            .in.block_offset_x = src_rect.x,
+            .in.block_offset_y = src_rect.y + y,
+            .in.srm_cm         = in_mode,
+
+            .out.buffer         = out.framebuffer.pixels,
+            .out.buffer_size    = ppa_buffer_size(out.size),
+            .out.pic_w          = out.framebuffer.w,
+            .out.pic_h          = out.framebuffer.h,
+            .out.block_offset_x = dst_rect.x,
+            .out.block_offset_y = dst_rect.y + y * out_h / src_rect.h,
+            .out.srm_cm         = out_mode,
+
+            .rotation_angle    = rotation_to_srm(rotation),
+            .scale_x           = (float)out_w / src_rect.w,
+            .scale_y           = (float)out_h / src_rect.h,
+            .mirror_x          = (mirror & PPA_MIRROR_X) != 0,
+            .mirror_y          = (mirror & PPA_MIRROR_Y) != 0,
+            .rgb_swap          = in_swap != out_swap,
+            .alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+            .mode              = PPA_TRANS_MODE_BLOCKING,
+        };
+
+        xSemaphoreTake(ppa_draw_lock, portMAX_DELAY);
+        result = ppa_do_scale_rotate_mirror(ppa_draw_srm_handle, &oper_config);
+        xSemaphoreGive(ppa_draw_lock);
+        y += h;
+    }
+
+    ppa_draw_buffer_put(&out);
+    ppa_draw_buffer_put(&in);
+
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "PPA blit failed: %s", esp_err_to_name(result));
+        return false;
+    }
+    return true;
+}
+
+bool ppa_blend(
+    framebuffer_t *dst, window_coords_t dst_pos, framebuffer_t const *src, window_rect_t src_rect, uint8_t alpha
+) {
+    if (!dst || !src || !ppa_draw_lock) {
+        return false;
+    }
+
+    window_rect_t dst_rect = {dst_pos.x, dst_pos.y, src_rect.w, src_rect.h};
+    if (!ppa_draw_inside(src_rect, src->w, src->h) || !ppa_draw_inside(dst_rect, dst->w, dst->h)) {
+        return false;
+    }
+
+    ppa_draw_buffer_t in;
+    ppa_draw_buffer_t out;
+    if (!ppa_draw_buffer_get(&in, src, false)) {
+        return false;
+    }
+    if (!ppa_draw_buffer_get(&out, dst, true)) {
+        ppa_draw_buffer_put(&in);
+        return false;
+    }
+
+    bool                 in_swap;
+    bool                 out_swap;
+    ppa_srm_color_mode_t in_mode  = framebuffer_srm_mode(in.framebuffer.format, &in_swap);
+    ppa_srm_color_mode_t out_mode = framebuffer_srm_mode(out.framebuffer.format, &out_swap);
+    int                  rows     = ppa_draw_band_rows(src_rect.w);
+    esp_err_t            result   = ESP_OK;
+
+    for (int y = 0; y < src_rect.h && result == ESP_OK; y += rows) {
+        int h = MIN(rows, src_rect.h - y);
+
+        ppa_blend_oper_config_t oper_config = {
+            .in_bg.buffer         = out.framebuffer.pixels,
+            .in_bg.pic_w          = out.framebuffer.w,
+            .in_bg.pic_h          = out.framebuffer.h,
+            .in_bg.block_w        = dst_rect.w,
+            .in_bg.block_h        = h,
+            .in_bg.block_offset_x = dst_rect.x,
+            .in_bg.block_offset_y = dst_rect.y + y,
+            .in_bg.blend_cm       = srm_to_blend_mode(out_mode),
+
+            .in_fg.buffer         = in.framebuffer.pixels,
+            .in_fg.pic_w          = in.framebuffer.w,
+            .in_fg.pic_h          = in.framebuffer.h,
+            .in_fg.block_w        = src_rect.w,
+            .in_fg.block_h        = h,
+            .in_fg.block_offset_x = src_rect.x,
+            .in_fg.block_offset_y = src_rect.y + y,
+            .in_fg.blend_cm       = srm_to_blend_mode(in_mode),
+
+            .out.buffer         = out.framebuffer.pixels,
+            .out.buffer_size    = ppa_buffer_size(out.size),
+            .out.pic_w          = out.framebuffer.w,
+            .out.pic_h          = out.framebuffer.h,
+            .out.block_offset_x = dst_rect.x,
+            .out.block_offset_y = dst_rect.y + y,
+            .out.blend_cm       = srm_to_blend_mode(out_mode),
+
+            .fg_rgb_swap          = in_swap != out_swap,
+            .bg_alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+            .fg_alpha_update_mode = PPA_ALPHA_NO_CHANGE,
+            .mode                 = PPA_TRANS_MODE_BLOCKING,
+        };
+
+        if (in_mode != PPA_SRM_COLOR_MODE_ARGB8888) {
+            oper_config.fg_alpha_update_mode = PPA_ALPHA_FIX_VALUE;
+            oper_config.fg_alpha_fix_val     = alpha;
+        } else if (alpha != 255) {
+            oper_config.fg_alpha_update_mode = PPA_ALPHA_SCALE;
+            oper_config.fg_alpha_scale_ratio = alpha / 255.0f;
+        }
+
+        xSemaphoreTake(ppa_draw_lock, portMAX_DELAY);
+        result = ppa_do_blend(ppa_draw_blend_handle, &oper_config);
+        xSemaphoreGive(ppa_draw_lock);
+    }
+
+    ppa_draw_buffer_put(&out);
+    ppa_draw_buffer_put(&in);
+
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "PPA blend failed: %s", esp_err_to_name(result));
+        return false;
+    }
+    return true;
+}
+
+bool ppa_fill(framebuffer_t *dst, window_rect_t rect, uint32_t color) {
+    if (!dst || !ppa_draw_lock || !ppa_draw_inside(rect, dst->w, dst->h)) {
+        return false;
+    }
+
+    ppa_draw_buffer_t out;
+    if (!ppa_draw_buffer_get(&out, dst, true)) {
+        return false;
+    }
+
+    bool                        out_swap;
+    ppa_srm_color_mode_t        out_mode = framebuffer_srm_mode(out.framebuffer.format, &out_swap);
+    color_pixel_argb8888_data_t argb     = {.val = color};
+    if (out_swap) {
+        uint8_t r = argb.r;
+        argb.r    = argb.b;
+        argb.b    = r;
+    }
+
+    int       rows   = ppa_draw_band_rows(rect.w);
+    esp_err_t result = ESP_OK;
+
+    for (int y = 0; y < rect.h && result == ESP_OK; y += rows) {
+        ppa_fill_oper_config_t oper_config = {
+            .out.buffer         = out.framebuffer.pixels,
+            .out.buffer_size    = ppa_buffer_size(out.size),
+            .out.pic_w          = out.framebuffer.w,
+            .out.pic_h          = out.framebuffer.h,
+            .out.block_offset_x = rect.x,
+            .out.block_offset_y = rect.y + y,
+            .out.fill_cm        = srm_to_fill_mode(out_mode),
+
+            .fill_block_w    = rect.w,
+            .fill_block_h    = MIN(rows, rect.h - y),
+            .fill_argb_color = argb,
+            .mode            = PPA_TRANS_MODE_BLOCKING,
+        };
+
+        xSemaphoreTake(ppa_draw_lock, portMAX_DELAY);
+        result = ppa_do_fill(ppa_draw_fill_handle, &oper_config);
+        xSemaphoreGive(ppa_draw_lock);
+    }
+
+    ppa_draw_buffer_put(&out);
+
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "PPA fill failed: %s", esp_err_to_name(result));
+        return false;
+    }
+    return true;
+}
+
+bool window_framebuffer_blit(
+    window_t            *window,
+    framebuffer_t const *src,
+    window_rect_t        src_rect,
+    window_rect_t        dst_rect,
+    uint8_t              alpha,
+    bool                 blend
+) {
+    if (!window || !window->framebuffers[window->back_fb]) {
+        return false;
+    }
+
+    framebuffer_t *dst = &window->framebuffers[window->back_fb]->framebuffer;
+    if (blend) {
+        // The blender doesn't scale
+        if (src_rect.w != dst_rect.w || src_rect.h != dst_rect.h) {
+            return false;
+        }
+        return ppa_blend(dst, (window_coords_t){dst_rect.x, dst_rect.y}, src, src_rect, alpha);
+    }
+
+    return ppa_blit(dst, dst_rect, src, src_rect, ROTATION_ANGLE_0, 0);
+}
+
+bool window_framebuffer_fill(window_t *window, window_rect_t rect, uint32_t color) {
+    if (!window || !window->framebuffers[window->back_fb]) {
+        return false;
+    }
+
+    return ppa_fill(&window->framebuffers[window->back_fb]->framebuffer, rect, color);
+}
+
+event_t window_event_poll(window_t *window, bool block, uint32_t timeout_msec) {
+    event_t    e;
+    TickType_t wait = block ? portMAX_DELAY : timeout_msec / portTICK_PERIOD_MS;
+    TimeOut_t  timeout;
+
+    vTaskSetTimeOutState(&timeout);
+    while (!window_event_take(window, &e, 1)) {
+        // The signal may be left over from events that were drained already,
+        // then we just look again
+        if (xTaskCheckForTimeOut(&timeout, &wait) == pdTRUE || xSemaphoreTake(window->event_signal, wait) != pdTRUE) {
+            e.type = EVENT_NONE;
+            break;
+        }
+    }
+
+    return e;
+}
+
+size_t window_events_drain(window_t *window, event_t *events, size_t max) {
+    size_t total = 0;
+
+    if (!window) {
+        return 0;
+    }
+
+    // Through the stack, so the lock isn't held while writing to application memory
+    while (total < max) {
+        event_t batch[EVENT_DRAIN_BATCH];
+        size_t  count = window_event_take(window, batch, MIN(max - total, EVENT_DRAIN_BATCH));
+        if (!count) {
+            break;
+        }
+        memcpy(events + total, batch, count * sizeof(event_t));
+        total += count;
+    }
+
+    return total;
+}
+
+void window_frame_rate_set(window_t *window, int fps) {
+    if (!window) {
+        return;
+    }
+
+    // Never faster than the manifest of the owner allows
+    task_info_t *owner = (task_info_t *)atomic_load(&window->task_info);
+    int          limit = owner ? owner->thread->frame_rate : 0;
+    if (limit > 0 && (fps <= 0 || fps > limit)) {
+        fps = limit;
+    }
+
+    int interval = 1;
+    if (fps > 0 && fps < FRAMEBUFFER_MAX_REFRESH) {
+        interval = (FRAMEBUFFER_MAX_REFRESH + (fps / 2)) / fps;
+    }
+
+    atomic_store(&window->frame_interval, interval);
+}
+
+int window_frame_rate_get(window_t *window) {
+    if (!window) {
+        return 0;
+    }
+
+    return FRAMEBUFFER_MAX_REFRESH / atomic_load(&window->frame_interval);
+}
+
+float window_visible_fraction(window_t *window) {
+    if (!window) {
+        return 0;
     }
 
-    return (managed_framebuffer_t *)fb;
+    return atomic_load(&window->visible_permille) / 1000.0f;
 }
 
-framebuffer_t *window_framebuffer_create(window_t *window, window_size_t size, pixel_format_t pixel_format) {
+void window_wait_vsync(window_t *window) {
     if (!window) {
-        return NULL;
+        return;
     }
 
-    if (window->framebuffers[0] || window->framebuffers[1]) {
-        return NULL;
+    atomic_store(&window->vsync_waiter, (uintptr_t)xTaskGetCurrentTaskHandle());
+    ulTaskNotifyTakeIndexed(2, pdTRUE, portMAX_DELAY);
+}
+
+void window_frame_callback_request(window_t *window) {
+    if (!window) {
+        return;
     }
-    window->front_fb = 0;
-    window->back_fb  = 0;
 
-    window->framebuffers[0] = window_framebuffer_allocate(window, size, pixel_format);
-    if (!window->framebuffers[0]) {
-        ESP_LOGW(
-            TAG,
-            "Unable to allocate framebuffer 0 for window %p, task %u",
-            window,
-            ((task_info_t *)window->task_info)->pid
-        );
+    atomic_store(&window->frame_event_requested, true);
+}
+
+overlay_t *overlay_create(window_size_t size, pixel_format_t pixel_format) {
+    // The blender can't swap colors converted from YUV, and overlays have no palette
+    if (size.w <= 0 || size.h <= 0 || framebuffer_converted(pixel_format)) {
         return NULL;
     }
 
-    if (window->flags & WINDOW_FLAG_DOUBLE_BUFFERED) {
-        window->framebuffers[1] = window_framebuffer_allocate(window, size, pixel_format);
-        if (!window->framebuffers[1]) {
-            ESP_LOGW(TAG, "Unable to allocate framebuffer 1 for window %p", window);
-            framebuffer_free(window->framebuffers[0]);
-            window->framebuffers[0] = NULL;
-            return NULL;
-        }
-        window->back_fb = 1;
+    if (atomic_fetch_add(&cur_num_overlays, 1) >= MAX_OVERLAYS) {
+        atomic_fetch_sub(&cur_num_overlays, 1);
+        return NULL;
     }
 
-    window->fb_dirty = 7;
-
-    return (framebuffer_t *)window->framebuffers[window->back_fb];
-}
+    size.w = size.w > FRAMEBUFFER_MAX_W ? FRAMEBUFFER_MAX_W : size.w;
+    size.h = size.h > FRAMEBUFFER_MAX_H ? FRAMEBUFFER_MAX_H : size.h;
 
-window_t *window_create(char const *title, window_size_t size, window_flag_t flags) {
-    if (atomic_load(&cur_num_windows) >= MAX_WINDOWS) {
-        return NULL;
+    overlay_t *overlay = calloc(1, sizeof(overlay_t));
+    if (!overlay) {
+        ESP_LOGW(TAG, "Unable to allocate overlay");
+        goto error;
     }
 
-    task_info_t *task_info = get_task_info();
-
-    window_t *window = calloc(1, sizeof(window_t));
-    if (!window) {
-        ESP_LOGW(TAG, "Unable to allocate window");
+    overlay->framebuffer = (managed_framebuffer_t *)framebuffer_allocate(size.w, size.h, pixel_format);
+    if (!overlay->framebuffer) {
+        ESP_LOGW(TAG, "Unable to allocate overlay framebuffer");
         goto error;
     }
 
-    if (title) {
-        window_title_set(window, title);
-        if (!window->title) {
-            ESP_LOGW(TAG, "Unable to allocate window title");
-            goto error;
-        }
+    overlay->rect              = (window_rect_t){.x = 0, .y = 0, .w = size.w, .h = size.h};
+    overlay->blend_buffer_size = ppa_buffer_size(size.w * size.h * sizeof(uint32_t));
+    overlay->blend_buffer      = ppa_buffer_alloc(overlay->blend_buffer_size);
+    overlay->under_size        = ppa_buffer_size(size.w * size.h * FRAMEBUFFER_BPP);
+
+    bool allocated = overlay->blend_buffer;
+    for (int i = 0; i < display_fb_count; ++i) {
+        overlay->under[i] = ppa_buffer_alloc(overlay->under_size);
+        allocated         = allocated && overlay->under[i];
     }
 
-    window->event_queue = xQueueCreate(WINDOW_MAX_EVENTS, sizeof(event_t));
-    if (!window->event_queue) {
-        ESP_LOGW(TAG, "Out of memory trying to allocate window event queue");
+    if (!allocated) {
+        ESP_LOGW(TAG, "Unable to allocate buffers for overlay %p", overlay);
         goto error;
     }
 
-    window->flags  = flags;
-    window->rect.x = 0;
-    window->rect.y = 0;
-    size           = window_clamp_size(window, size);
-    window->rect.w = size.w;
-    window->rect.h = size.h;
-
-    atomic_store(&window->task_info, (uintptr_t)task_info);
-
-    task_record_resource_alloc(RES_WINDOW, window);
+    if (!framebuffer_budget_take(framebuffer_pages(overlay->framebuffer))) {
+        goto error;
+    }
+    task_resource_link(&overlay->resource, RES_OVERLAY, overlay);
 
     compositor_message_t message = {
-        .command = WINDOW_CREATE,
-        .window  = window,
+        .command = OVERLAY_CREATE,
+        .overlay = overlay,
         .caller  = xTaskGetCurrentTaskHandle(),
     };
 
     xQueueSend(compositor_queue, &message, portMAX_DELAY);
     ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
 
-    return window;
+    return overlay;
 error:
-    free(window->title);
-    free(window);
+    overlay_free(overlay);
+    atomic_fetch_sub(&cur_num_overlays, 1);
     return NULL;
 }
 
-void window_destroy_task(window_t *window) {
-    if (!window) {
+void overlay_destroy_task(overlay_t *overlay) {
+    if (!overlay) {
         return;
     }
 
-    ESP_LOGI(TAG, "Destroying window %p\n", window);
-    atomic_store(&window->task_info, (uintptr_t)NULL);
-
     compositor_message_t message = {
-        .command = WINDOW_DESTROY,
-        .window  = window,
+        .command = OVERLAY_DESTROY,
+        .overlay = overlay,
     };
 
     xQueueSend(compositor_queue, &message, portMAX_DELAY);
 }
 
-void window_destroy(window_t *window) {
-    if (!window) {
+void overlay_destroy(overlay_t *overlay) {
+    if (!overlay) {
         return;
     }
 
-    ESP_LOGI(TAG, "Destroying window %p\n", window);
-    atomic_store(&window->task_info, (uintptr_t)NULL);
+    atomic_fetch_sub(&get_task_info()->thread->framebuffer_pages, framebuffer_pages(overlay->framebuffer));
+    task_resource_unlink(&overlay->resource);
 
     compositor_message_t message = {
-        .command = WINDOW_DESTROY,
-        .window  = window,
+        .command = OVERLAY_DESTROY,
+        .overlay = overlay,
         .caller  = xTaskGetCurrentTaskHandle(),
     };
 
     xQueueSend(compositor_queue, &message, portMAX_DELAY);
     ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
-
-    task_record_resource_free(RES_WINDOW, window);
 }
 
-char const *window_title_get(window_t *window) {
-    return window->title;
+framebuffer_t *overlay_framebuffer_get(overlay_t *overlay) {
+    if (!overlay) {
+        return NULL;
+    }
+
+    return (framebuffer_t *)overlay->framebuffer;
 }
 
-void window_title_set(window_t *window, char const *title) {
-    // window->title is either NULL or a string from strndup()
-    free(window->title);
-    if (title) {
-        window->title = strndup(title, 20);
-        if (!window->title) {
-            ESP_LOGW(TAG, "Unable to allocate window title");
-        }
+// The compositor picks the new content up on the next refresh. There is only
+// one buffer, tearing is possible if the application draws while we copy.
+void overlay_present(overlay_t *overlay) {
+    if (!overlay) {
+        return;
     }
+
+    atomic_flag_clear(&overlay->framebuffer->clean);
 }
 
-window_coords_t window_position_get(window_t *window) {
-    window_coords_t ret = {
-        .x = window->rect.x,
-        .y = window->rect.y,
-    };
-    return ret;
+window_coords_t overlay_position_get(overlay_t *overlay) {
+    if (!overlay) {
+        return (window_coords_t){0, 0};
+    }
+
+    return (window_coords_t){.x = overlay->rect.x, .y = overlay->rect.y};
 }
 
-window_coords_t window_position_set(window_t *window, window_coords_t coords) {
-    if (!window) {
+window_coords_t overlay_position_set(overlay_t *overlay, window_coords_t coords) {
+    if (!overlay) {
         return (window_coords_t){0, 0};
     }
 
     compositor_message_t message = {
-        .command = WINDOW_MOVE,
+        .command = OVERLAY_MOVE,
+        .overlay = overlay,
         .coords  = coords,
-        .window  = window,
         .caller  = xTaskGetCurrentTaskHandle(),
     };
 
     xQueueSend(compositor_queue, &message, portMAX_DELAY);
     ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
 
-    return window_position_get(window);
+    return overlay_position_get(overlay);
 }
 
-window_size_t window_size_get(window_t *window) {
-    window_size_t ret = {
-        .w = window->rect.w,
-        .h = window->rect.h,
-    };
-    return ret;
-}
+bool compositor_capture_start(window_size_t size, pixel_format_t pixel_format) {
+    switch (pixel_format) {
+        case BADGEVMS_PIXELFORMAT_RGB565:   // fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR565:   // fallthrough
+        case BADGEVMS_PIXELFORMAT_RGB24:    // fallthrough
+        case BADGEVMS_PIXELFORMAT_BGR24:    // fallthrough
+        case BADGEVMS_PIXELFORMAT_ARGB8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_ABGR8888: // fallthrough
+        case BADGEVMS_PIXELFORMAT_YUV420_ESP: break;
+        default: return false;
+    }
 
-window_size_t window_size_set(window_t *window, window_size_t size) {
-    if (!window) {
-        return (window_size_t){0, 0};
+    // Only downscaling, in the 1/16 steps the PPA scaler has
+    float scale = fminf((float)size.w / FRAMEBUFFER_MAX_W, (float)size.h / FRAMEBUFFER_MAX_H);
+    scale       = floorf(fminf(scale, 1.0f) * 16.0f) / 16.0f;
+    if (pixel_format == BADGEVMS_PIXELFORMAT_YUV420_ESP) {
+        // The PPA writes YUV420 in 2x2 pixel blocks, so the scaled size has to be even
+        scale = floorf(scale * 8.0f) / 8.0f;
+    }
+    if (scale <= 0.0f) {
+        return false;
+    }
+
+    xSemaphoreTake(capture_mutex, portMAX_DELAY);
+    if (capture) {
+        xSemaphoreGive(capture_mutex);
+        return false;
+    }
+
+    capture_t *new_capture = calloc(1, sizeof(capture_t));
+    if (!new_capture) {
+        xSemaphoreGive(capture_mutex);
+        return false;
+    }
+
+    new_capture->scaled.w = (int)(FRAMEBUFFER_MAX_W * scale);
+    new_capture->scaled.h = (int)(FRAMEBUFFER_MAX_H * scale);
+    new_capture->size     = new_capture->scaled;
+    if (pixel_format == BADGEVMS_PIXELFORMAT_YUV420_ESP) {
+        // Video encoders want whole 16x16 macroblocks
+        new_capture->size.w = (new_capture->scaled.w + 15) & ~15;
+        new_capture->size.h = (new_capture->scaled.h + 15) & ~15;
+    }
+    new_capture->format      = pixel_format;
+    new_capture->scale       = scale;
+    new_capture->frame_bytes = framebuffer_format_size(pixel_format, new_capture->size.w, new_capture->size.h);
+
+    for (int i = 0; i < CAPTURE_BUFFERS; ++i) {
+        new_capture->buffers[i] = ppa_buffer_alloc(new_capture->frame_bytes);
+        if (!new_capture->buffers[i]) {
+            ESP_LOGW(TAG, "Unable to allocate %zu byte capture buffer", new_capture->frame_bytes);
+            for (int j = 0; j < i; ++j) {
+                heap_caps_free(new_capture->buffers[j]);
+            }
+            free(new_capture);
+            xSemaphoreGive(capture_mutex);
+            return false;
+        }
+        if (pixel_format == BADGEVMS_PIXELFORMAT_YUV420_ESP) {
+            capture_padding_fill(new_capture, new_capture->buffers[i]);
+        }
     }
 
     compositor_message_t message = {
-        .command = WINDOW_RESIZE,
-        .size    = size,
-        .window  = window,
+        .command = CAPTURE_SET,
+        .capture = new_capture,
         .caller  = xTaskGetCurrentTaskHandle(),
     };
 
     xQueueSend(compositor_queue, &message, portMAX_DELAY);
     ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
 
-    return window_size_get(window);
+    ESP_LOGI(TAG, "Screen capture started, %i x %i", new_capture->size.w, new_capture->size.h);
+    xSemaphoreGive(capture_mutex);
+    return true;
 }
 
-window_flag_t window_flags_get(window_t *window) {
-    return window->flags;
-}
+void compositor_capture_stop(void) {
+    xSemaphoreTake(capture_mutex, portMAX_DELAY);
+    capture_t *old_capture = capture;
+    if (!old_capture) {
+        xSemaphoreGive(capture_mutex);
+        return;
+    }
 
-window_flag_t window_flags_set(window_t *window, window_flag_t flags) {
     compositor_message_t message = {
-        .command = WINDOW_FLAGS,
-        .window  = window,
-        .flags   = flags,
+        .command = CAPTURE_SET,
+        .capture = NULL,
         .caller  = xTaskGetCurrentTaskHandle(),
     };
 
     xQueueSend(compositor_queue, &message, portMAX_DELAY);
     ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
-    return flags;
-}
 
-framebuffer_t *window_framebuffer_get(window_handle_t window) {
-    if (!window) {
-        return NULL;
+    for (int i = 0; i < CAPTURE_BUFFERS; ++i) {
+        heap_caps_free(old_capture->buffers[i]);
     }
+    free(old_capture);
 
-    return (framebuffer_t *)window->framebuffers[window->back_fb];
+    ESP_LOGI(TAG, "Screen capture stopped");
+    xSemaphoreGive(capture_mutex);
+    // Wake up a reader waiting for a frame
+    xSemaphoreGive(capture_frame);
 }
 
-window_size_t window_framebuffer_size_get(window_handle_t window) {
-    if (!(window && window->framebuffers[0])) {
-        return (window_size_t){0, 0};
+bool compositor_capture_info(window_size_t *size, pixel_format_t *pixel_format, size_t *frame_bytes) {
+    xSemaphoreTake(capture_mutex, portMAX_DELAY);
+    if (!capture) {
+        xSemaphoreGive(capture_mutex);
+        return false;
     }
 
-    return (window_size_t){window->framebuffers[0]->w, window->framebuffers[0]->h};
-}
-
-window_size_t window_framebuffer_size_set(window_handle_t window, window_size_t size) {
-    return window_framebuffer_size_get(window);
-}
-
-pixel_format_t window_framebuffer_format_get(window_handle_t window) {
-    if (!(window && window->framebuffers[0])) {
-        return 0;
+    if (size) {
+        *size = capture->size;
     }
-
-    return window->framebuffers[0]->format;
-}
-
-#if 0
-static inline void copy_framebuffer_rect(managed_framebuffer_t *dst, managed_framebuffer_t *src, window_rect_t rect) {
-    if (rect.x == 0 && rect.y == 0 && rect.w == dst->w && rect.h == dst->h) {
-        // Full rect damage
-        memcpy(dst->framebuffer.pixels, src->framebuffer.pixels, dst->num_pages * SOC_MMU_PAGE_SIZE);
-        return;
+    if (pixel_format) {
+        *pixel_format = capture->format;
     }
-
-    int max_x = MIN(dst->w, src->w);
-    int max_y = MIN(dst->h, src->h);
-
-    rect.x = MAX(0, MIN(rect.x, max_x));
-    rect.y = MAX(0, MIN(rect.y, max_y));
-    rect.w = MIN(rect.w, max_x - rect.x);
-    rect.h = MIN(rect.h, max_y - rect.y);
-
-    if (rect.w <= 0 || rect.h <= 0) {
-        return;
+    if (frame_bytes) {
+        *frame_bytes = capture->frame_bytes;
     }
 
-    int      bytes_per_pixel = BADGEVMS_BYTESPERPIXEL(dst->format);
-    uint8_t *dst_pixels      = (uint8_t *)dst->framebuffer.pixels;
-    uint8_t *src_pixels      = (uint8_t *)src->framebuffer.pixels;
-
-    int dst_stride = dst->w * bytes_per_pixel;
-    int src_stride = src->w * bytes_per_pixel;
-    int copy_width = rect.w * bytes_per_pixel;
-
-    for (int y = 0; y < rect.h; y++) {
-        uint8_t *dst_row = dst_pixels + ((rect.y + y) * dst_stride) + (rect.x * bytes_per_pixel);
-        uint8_t *src_row = src_pixels + ((rect.y + y) * src_stride) + (rect.x * bytes_per_pixel);
-        memcpy(dst_row, src_row, copy_width);
-    }
+    xSemaphoreGive(capture_mutex);
+    return true;
 }
-#endif
-
-void window_present(window_t *window, bool block, window_rect_t *rects, int num_rects) {
-    if (!window || !window->framebuffers[0]) {
-        return;
-    }
-
-    managed_framebuffer_t *front_buffer = NULL;
-    managed_framebuffer_t *back_buffer  = NULL;
 
-    if (window->flags & WINDOW_FLAG_DOUBLE_BUFFERED && window->framebuffers[1]) {
-        front_buffer = window->framebuffers[window->front_fb];
-        back_buffer  = window->framebuffers[window->back_fb];
+ssize_t compositor_capture_read(void *buffer, size_t size, uint32_t *sequence, uint32_t timeout_msec) {
+    TickType_t start   = xTaskGetTickCount();
+    TickType_t timeout = timeout_msec == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_msec);
 
-        if (!front_buffer || !back_buffer) {
-            abort();
+    int      index = -1;
+    uint32_t frame = 0;
+    while (1) {
+        // Not held while waiting, so the capture can be stopped meanwhile
+        xSemaphoreTake(capture_mutex, portMAX_DELAY);
+        if (!capture) {
+            xSemaphoreGive(capture_mutex);
+            return -1;
         }
 
-        compositor_message_t message = {
-            .command = FRAMEBUFFER_SWAP,
-            .fb_a    = front_buffer,
-            .fb_b    = back_buffer,
-            .caller  = xTaskGetCurrentTaskHandle(),
-        };
-
-        xQueueSend(compositor_queue, &message, portMAX_DELAY);
-        ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+        taskENTER_CRITICAL(&capture_lock);
+        if (capture_latest >= 0 && capture_sequence != *sequence) {
+            index           = capture_latest;
+            frame           = capture_sequence;
+            capture_reading = index;
+        }
+        taskEXIT_CRITICAL(&capture_lock);
 
-        // We've waited long enough
-        block = false;
-    } else {
-        front_buffer = window->framebuffers[window->front_fb];
-    }
+        if (index >= 0) {
+            break;
+        }
+        xSemaphoreGive(capture_mutex);
 
-    atomic_flag_clear(&front_buffer->clean);
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout) {
+            return 0;
+        }
 
-    if (block) {
-        ulTaskNotifyTakeIndexed(1, pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(capture_frame, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - elapsed);
     }
-}
 
-event_t window_event_poll(window_t *window, bool block, uint32_t timeout_msec) {
-    event_t    e;
-    TickType_t wait = block ? portMAX_DELAY : timeout_msec / portTICK_PERIOD_MS;
+    // Our cache may still hold what we read from this buffer last time
+    size = MIN(size, capture->frame_bytes);
+    esp_cache_msync(capture->buffers[index], ppa_buffer_size(capture->frame_bytes), ESP_CACHE_MSYNC_FLAG_DIR_M2C);
+    memcpy(buffer, capture->buffers[index], size);
 
-    if (xQueueReceive(window->event_queue, &e, wait) != pdTRUE) {
-        e.type = EVENT_NONE;
-    }
+    taskENTER_CRITICAL(&capture_lock);
+    capture_reading = -1;
+    taskEXIT_CRITICAL(&capture_lock);
 
-    return e;
+    *sequence = frame;
+    xSemaphoreGive(capture_mutex);
+    return size;
 }
 
 bool compositor_init(char const *lcd_device_name, char const *keyboard_device_name) {
@@ -1182,19 +3993,54 @@ bool compositor_init(char const *lcd_device_name, char const *keyboard_device_na
         return false;
     }
 
-    for (int i = 0; i < DISPLAY_FRAMEBUFFERS; ++i) {
+    if (!text_init()) {
+        return false;
+    }
+
+    if (lcd_device->framebuffers >= DISPLAY_FRAMEBUFFERS_MIN && lcd_device->framebuffers <= DISPLAY_FRAMEBUFFERS) {
+        display_fb_count = lcd_device->framebuffers;
+    }
+    mark_scene_damaged();
+    ESP_LOGI(TAG, "Composing into %d display framebuffers", display_fb_count);
+
+    direct_scanout_available = num_display_framebuffers == display_fb_count;
+    for (int i = 0; i < display_fb_count; ++i) {
         lcd_device->_getfb(lcd_device, i, (void *)&framebuffers[i]);
+        if (!display_framebuffers[i] || display_framebuffers[i]->framebuffer.pixels != framebuffers[i]) {
+            direct_scanout_available = false;
+        }
         memset(framebuffers[i], 0xaa, FRAMEBUFFER_BYTES);
         esp_cache_msync(framebuffers[i], FRAMEBUFFER_BYTES, ESP_CACHE_MSYNC_FLAG_DIR_C2M);
         ESP_LOGW(TAG, "Got framebuffer[%i]: %p", i, framebuffers[i]);
     }
 
-    cur_fb = (cur_fb + 1) % DISPLAY_FRAMEBUFFERS;
+    cur_fb = (cur_fb + 1) % display_fb_count;
 
     lcd_device->_set_refresh_cb(lcd_device, NULL, on_refresh);
 
-    compositor_queue = xQueueCreate(10, sizeof(compositor_message_t));
+    ppa_client_config_t ppa_draw_configs[] = {
+        {.oper_type = PPA_OPERATION_SRM, .max_pending_trans_num = 1},
+        {.oper_type = PPA_OPERATION_FILL, .max_pending_trans_num = 1},
+        {.oper_type = PPA_OPERATION_BLEND, .max_pending_trans_num = 1},
+    };
+    ppa_client_handle_t *ppa_draw_handles[] = {&ppa_draw_srm_handle, &ppa_draw_fill_handle, &ppa_draw_blend_handle};
+    bool                 ppa_draw_ok        = true;
+    for (size_t i = 0; i < sizeof(ppa_draw_configs) / sizeof(ppa_draw_configs[0]); ++i) {
+        ppa_draw_ok = ppa_draw_ok && ppa_register_client(&ppa_draw_configs[i], ppa_draw_handles[i]) == ESP_OK;
+    }
+    // Without them applications draw everything themselves
+    if (ppa_draw_ok) {
+        ppa_draw_lock = xSemaphoreCreateMutex();
+    } else {
+        ESP_LOGE(TAG, "Unable to register the PPA clients for applications");
+    }
+
+    compositor_queue  = xQueueCreate(COMPOSITOR_QUEUE_LENGTH, sizeof(compositor_message_t));
+    window_stack_lock = xSemaphoreCreateMutex();
+    capture_mutex     = xSemaphoreCreateMutex();
+    capture_frame     = xSemaphoreCreateBinary();
     create_kernel_task(compositor, "Compositor", 8192, NULL, 20, &compositor_handle, 0);
+    create_kernel_task(input_task, "Input", 4096, NULL, 21, &input_handle, 0);
 
     return true;
 }
@@ -17,9 +17,13 @@
 #pragma once
 
 #include "badgevms/compositor.h"
+#include "badgevms/device.h"
 #include "badgevms/framebuffer.h"
 #include "badgevms_config.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "memory.h"
+#include "region.h"
 #include "task.h"
 
 #include <stdatomic.h>
@@ -27,17 +31,29 @@
 #define TOP_BAR_PX  50
 #define SIDE_BAR_PX 0
 
-#define MAX_VISIBLE_RECTS 64
+#define PALETTE_SIZE 256
+
+#define MAX_DAMAGE_RECTS 16
 
 typedef struct {
-    window_rect_t rects[MAX_VISIBLE_RECTS];
+    window_rect_t rects[MAX_DAMAGE_RECTS];
     int           count;
-} rect_array_t;
+} damage_rect_array_t;
+
+#define MAX_OCCLUDER_RECTS (MAX_WINDOWS * 4)
 
+// Everything a window's visible regions are computed from
 typedef struct {
-    window_rect_t rects[4];
-    int           count;
-} small_rect_array_t;
+    window_rect_t  rect;
+    window_flag_t  flags;
+    uint8_t        opacity;
+    float          scale;
+    window_size_t  fb_size;
+    pixel_format_t fb_format;
+    // Parts of the windows above us, clipped to our outer rect
+    int            num_occluders;
+    window_rect_t  occluders[MAX_OCCLUDER_RECTS];
+} occlusion_key_t;
 
 typedef struct managed_framebuffer {
     framebuffer_t       framebuffer;
@@ -50,24 +66,151 @@ typedef struct managed_framebuffer {
     atomic_flag         clean;
 } managed_framebuffer_t;
 
+typedef struct decoration_cache decoration_cache_t;
+
 typedef struct window {
     managed_framebuffer_t *framebuffers[2];
     uint8_t                front_fb;
     uint8_t                back_fb;
+    // Triple buffered windows hand the presented frame to the spare and go on
+    // drawing, the compositor swaps it in front on its next refresh
+    managed_framebuffer_t *spare_fb;
+    SemaphoreHandle_t      swap_done;
+    bool                   swap_pending;
     window_flag_t          flags;
     char                  *title;
+    // Display framebuffers that need a full content redraw
     int                    fb_dirty;
+    // Display framebuffers where the bars around scaled content need painting
+    int                    letterbox_dirty;
+    // Partial damage per display framebuffer, in window framebuffer coordinates
+    damage_rect_array_t    fb_damage[DISPLAY_FRAMEBUFFERS];
+
+    // Damage passed to window_present(), not yet picked up by the compositor
+    portMUX_TYPE        present_damage_lock;
+    damage_rect_array_t present_damage;
+    bool                present_damage_full;
 
     window_rect_t    rect;
     // Store the previous rect if we go fullscreen/maximized
     window_rect_t    rect_orig;
+    // Banded regions, see window_update_visible_regions()
     rect_array_t     visible;
+    rect_array_t     decoration_visible;
+    occlusion_key_t  occlusion;
     atomic_uintptr_t task_info;
-    QueueHandle_t    event_queue;
+    task_resource_t  resource;
+
+    // WINDOW_MAX_EVENTS events for the application, see window_event_push()
+    portMUX_TYPE      event_lock;
+    event_t          *events;
+    int               event_head;
+    int               event_count;
+    atomic_uint       events_dropped;
+    // Given for every event queued, for window_event_poll() to block on
+    SemaphoreHandle_t event_signal;
+    // A thread in wait_any() on this window
+    atomic_uintptr_t  event_waiter;
+
+    // Refreshes per frame requested by the app and refreshes left until the next one
+    atomic_int       frame_interval;
+    int              frame_countdown;
+    atomic_uintptr_t vsync_waiter;
+    atomic_bool      frame_event_requested;
+    // Windows that are not in front only get a present consumed once per frame interval
+    bool             present_due;
+    // Thousandths of the content on screen, and whether the last visibility event said it was none
+    atomic_int       visible_permille;
+    bool             occluded;
+    // What we last set the task priority to, 0 if we never did
+    UBaseType_t      priority;
+    // Taken out of the window stack while the process is suspended
+    bool             parked;
+
+    // Pre-rendered, pre-rotated title bar and borders, owned by window_decorations.c
+    decoration_cache_t *decoration;
+
+    // 255 is opaque
+    uint8_t       opacity;
+    // Translucent windows get their content rotated and scaled into this ARGB8888
+    // buffer first, the PPA blender can't do either. blend_rect is its panel position.
+    uint32_t     *blend_buffer;
+    size_t        blend_buffer_size;
+    window_rect_t blend_rect;
+    bool          blend_valid;
+    // YUV framebuffers are converted to RGB565 in here once per present, so
+    // the blits don't have to stick to whole YUV420 blocks. INDEX8 ones are
+    // looked up in the palette into it.
+    uint16_t     *convert_buffer;
+    size_t        convert_buffer_size;
+    bool          convert_valid;
+    // RGB565, PALETTE_SIZE entries each. window_palette_set() writes the pending
+    // one under present_damage_lock, the compositor takes it on the next present.
+    uint16_t     *palette;
+    uint16_t     *palette_pending;
+    bool          palette_changed;
+
+    // Telemetry for compositor_stats_get(). present_time is when the oldest
+    // frame we haven't consumed yet was presented, 0 if there is none.
+    atomic_uint present_time;
+    uint32_t    presents;
+    uint32_t    present_latency_us;
+    uint32_t    present_latency_max_us;
+
+    // Read time of the oldest key the application took and didn't answer with a
+    // present yet, then of the one answered by the frame on its way to the
+    // screen, see input_latency_refresh(). Like present_time, 0 is none.
+    atomic_uint input_taken;
+    atomic_uint input_presented;
+    uint32_t    input_composed;
+    uint32_t    input_flipped;
+    uint32_t    input_scanning;
+    uint32_t    input_latency_us;
+    uint16_t    input_latency[COMPOSITOR_INPUT_LATENCY_BUCKETS];
 
     struct window *next;
     struct window *prev;
 } window_t;
 
-bool compositor_init(char const *lcd_device_name, char const *keyboard_device_name);
-void window_destroy_task(window_handle_t window);
+// Small surfaces blended on top of everything, see overlay_create()
+typedef struct overlay {
+    managed_framebuffer_t *framebuffer;
+    // Screen position, only touched by the compositor task
+    window_rect_t          rect;
+
+    // The content rotated to panel orientation, the blender can't rotate
+    uint32_t *blend_buffer;
+    size_t    blend_buffer_size;
+    bool      blend_valid;
+
+    // Overlays are blended in place. To take one off a display framebuffer
+    // again, we keep what was below it there, RGB565 in panel orientation.
+    uint16_t     *under[DISPLAY_FRAMEBUFFERS];
+    size_t        under_size;
+    window_rect_t under_rect[DISPLAY_FRAMEBUFFERS];
+    // Display framebuffers we are blended into, and the ones we need drawing on
+    int           drawn;
+    int           dirty;
+
+    task_resource_t resource;
+} overlay_t;
+
+bool      compositor_init(char const *lcd_device_name, char const *keyboard_device_name);
+// What display_framebuffers_set() chose, for the panel driver to allocate at boot
+int       display_framebuffers_configured(void);
+device_t *compositor_device_create(void);
+device_t *capture_device_create(void);
+void      window_destroy_task(window_handle_t window);
+void      overlay_destroy_task(overlay_handle_t overlay);
+// Take the window of a suspended process off the screen, or put it back in front
+void      window_park_task(window_handle_t window, bool parked);
+// Whether events are queued for window, from another task this is only a hint
+bool      window_events_pending(window_handle_t window);
+// Queue event for every window, windows with a full queue miss it
+void      compositor_broadcast_event(event_t const *event);
+// Queue event for the windows of the process running in thread only
+void      compositor_send_process_event(task_thread_t const *thread, event_t const *event);
+// Block until the compositor finished its next frame or timeout_ms passed, so
+// that work which stalls both cores, like writing to flash, starts with a whole
+// refresh ahead of it. For one kernel task at a time.
+void      compositor_frame_wait(uint32_t timeout_ms);
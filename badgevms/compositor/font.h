@@ -19,7 +19,7 @@
 #define FONT_WIDTH  5
 #define FONT_HEIGHT 7
 
-// Bitmap font data (A-Z, 0-9, space)
+// Bitmap font data (A-Z, 0-9, space, punctuation)
 static unsigned char const font_data[][7] = {
     // Space (32)
     {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
@@ -94,5 +94,29 @@ static unsigned char const font_data[][7] = {
     // 8
     {0x70, 0x88, 0x88, 0x70, 0x88, 0x88, 0x70},
     // 9
-    {0x70, 0x88, 0x88, 0x78, 0x08, 0x10, 0x60}
+    {0x70, 0x88, 0x88, 0x78, 0x08, 0x10, 0x60},
+    // - (45) - index 37
+    {0x00, 0x00, 0x00, 0xF8, 0x00, 0x00, 0x00},
+    // .
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x60},
+    // ,
+    {0x00, 0x00, 0x00, 0x00, 0x60, 0x20, 0x40},
+    // :
+    {0x00, 0x60, 0x60, 0x00, 0x60, 0x60, 0x00},
+    // _
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF8},
+    // /
+    {0x08, 0x08, 0x10, 0x20, 0x40, 0x80, 0x80},
+    // (
+    {0x10, 0x20, 0x40, 0x40, 0x40, 0x20, 0x10},
+    // )
+    {0x40, 0x20, 0x10, 0x10, 0x10, 0x20, 0x40},
+    // !
+    {0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x20},
+    // ?
+    {0x70, 0x88, 0x08, 0x10, 0x20, 0x00, 0x20},
+    // '
+    {0x20, 0x20, 0x40, 0x00, 0x00, 0x00, 0x00},
+    // +
+    {0x00, 0x20, 0x20, 0xF8, 0x20, 0x20, 0x00}
 };
@@ -1,13 +1,31 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
 #include <stdint.h>
 
-#define FONT_WIDTH      12
-#define FONT_HEIGHT     24
-#define FONT_FIRST_CHAR 32
-#define FONT_LAST_CHAR  126
-#define FONT_NUM_CHARS  (FONT_LAST_CHAR - FONT_FIRST_CHAR + 1)
+#define FONT_LARGE_WIDTH      12
+#define FONT_LARGE_HEIGHT     24
+#define FONT_LARGE_FIRST_CHAR 32
+#define FONT_LARGE_LAST_CHAR  126
+#define FONT_LARGE_NUM_CHARS  (FONT_LARGE_LAST_CHAR - FONT_LARGE_FIRST_CHAR + 1)
 
 // 12x24 pixel font data - Each character is 24 uint16_t values (12 bits used per row)
-static uint16_t const pixel_font[FONT_NUM_CHARS][FONT_HEIGHT] = {
+static uint16_t const font_large_data[FONT_LARGE_NUM_CHARS][FONT_LARGE_HEIGHT] = {
     // Space (32)
     {0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000,
      0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000},
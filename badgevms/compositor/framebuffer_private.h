@@ -18,4 +18,6 @@
 
 #include "badgevms/framebuffer.h"
 
-framebuffer_t *framebuffer_allocate(uint32_t w, uint32_t h);
+// Allocate one of the LCD panel's scanout buffers. The compositor keeps track
+// of these so it can hand their pages to a fullscreen window.
+framebuffer_t *display_framebuffer_allocate(uint32_t w, uint32_t h);
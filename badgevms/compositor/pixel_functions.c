@@ -17,8 +17,12 @@
 #include "pixel_functions.h"
 
 #include "esp_attr.h"
+#include "esp_cache.h"
 #include "esp_log.h"
-#include "font.h"
+#include "hal/cache_hal.h"
+#include "hal/cache_ll.h"
+
+#include <sys/param.h>
 
 #define TAG "pixel_functions"
 
@@ -83,143 +87,42 @@ IRAM_ATTR void draw_rect_rotated(uint16_t *fb, int x, int y, int width, int heig
     }
 }
 
-IRAM_ATTR int char_to_font_index(char c) {
-    if (c == ' ')
-        return 0;
-    if (c >= 'A' && c <= 'Z')
-        return 1 + (c - 'A');
-    if (c >= 'a' && c <= 'z')
-        return 1 + (c - 'a'); // Map lowercase to uppercase
-    if (c >= '0' && c <= '9')
-        return 27 + (c - '0');
-    return 0; // Default to space
-}
-
-IRAM_ATTR void draw_char_rotated(uint16_t *fb, char c, int x, int y, uint16_t color) {
-    int font_idx = char_to_font_index(c);
-
-    for (int row = 0; row < FONT_HEIGHT; row++) {
-        unsigned char line = font_data[font_idx][row];
-        for (int col = 0; col < FONT_WIDTH; col++) {
-            if (line & (0x80 >> col)) {
-                draw_pixel_rotated(fb, x + col, y + row, color);
-            }
-        }
+// Sync only the cache lines covering rect, which is in framebuffer (rotated) coordinates
+IRAM_ATTR void framebuffer_msync_rect(uint16_t *fb, window_rect_t rect, int flags) {
+    static uintptr_t line_size;
+    if (!line_size) {
+        line_size = cache_hal_get_cache_line_size(CACHE_LL_LEVEL_EXT_MEM, CACHE_TYPE_DATA);
     }
-}
 
-IRAM_ATTR void draw_text_rotated(uint16_t *fb, char const *text, int x, int y, uint16_t color) {
-    int len = strlen(text);
-    for (int i = 0; i < len; i++) {
-        draw_char_rotated(fb, text[i], x + i * (FONT_WIDTH + 1), y, color);
+    rect = rect_intersection(rect, (window_rect_t){0, 0, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H});
+    if (!rect.w || !rect.h) {
+        return;
     }
-}
 
-void merge_rectangles(rect_array_t *arr) {
-    bool merged_any;
-
-    do {
-        merged_any = false;
-
-        // Try horizontal merging
-        for (int i = 0; i < arr->count && !merged_any; i++) {
-            for (int j = i + 1; j < arr->count; j++) {
-                window_rect_t *a = &arr->rects[i];
-                window_rect_t *b = &arr->rects[j];
-
-                // Can merge horizontally?
-                if (a->y == b->y && a->h == b->h) {
-                    if (a->x + a->w == b->x) {
-                        a->w += b->w;
-                        memmove(&arr->rects[j], &arr->rects[j + 1], (arr->count - j - 1) * sizeof(window_rect_t));
-                        arr->count--;
-                        merged_any = true;
-                        break;
-                    } else if (b->x + b->w == a->x) {
-                        b->w += a->w;
-                        b->x  = b->x;
-                        memmove(&arr->rects[i], &arr->rects[i + 1], (arr->count - i - 1) * sizeof(window_rect_t));
-                        arr->count--;
-                        merged_any = true;
-                        break;
-                    }
-                }
-            }
+    // Rows of wide rects end up touching the same or adjacent lines, so merge them into one range
+    uintptr_t range_start = 0;
+    uintptr_t range_end   = 0;
+    for (int row = rect.y; row < rect.y + rect.h; ++row) {
+        uintptr_t start = (uintptr_t)(fb + row * FRAMEBUFFER_MAX_W + rect.x);
+        uintptr_t end   = start + rect.w * sizeof(uint16_t);
+        start           = start & ~(line_size - 1);
+        end             = (end + line_size - 1) & ~(line_size - 1);
+
+        if (range_end && start <= range_end) {
+            range_end = end;
+            continue;
         }
 
-        // Try vertical merging
-        if (!merged_any) {
-            for (int i = 0; i < arr->count && !merged_any; i++) {
-                for (int j = i + 1; j < arr->count; j++) {
-                    window_rect_t *a = &arr->rects[i];
-                    window_rect_t *b = &arr->rects[j];
-
-                    // Can merge vertically?
-                    if (a->x == b->x && a->w == b->w) {
-                        if (a->y + a->h == b->y) {
-                            a->h += b->h;
-                            memmove(&arr->rects[j], &arr->rects[j + 1], (arr->count - j - 1) * sizeof(window_rect_t));
-                            arr->count--;
-                            merged_any = true;
-                            break;
-                        } else if (b->y + b->h == a->y) {
-                            b->h += a->h;
-                            memmove(&arr->rects[i], &arr->rects[i + 1], (arr->count - i - 1) * sizeof(window_rect_t));
-                            arr->count--;
-                            merged_any = true;
-                            break;
-                        }
-                    }
-                }
-            }
+        if (range_end) {
+            esp_cache_msync((void *)range_start, range_end - range_start, flags);
         }
-    } while (merged_any);
-}
-
-small_rect_array_t rect_subtract(window_rect_t a, window_rect_t b) {
-    small_rect_array_t result = {0};
-
-    // No overlap
-    if (!rect_intersects(a, b)) {
-        result.rects[0] = a;
-        result.count    = 1;
-        return result;
-    }
-
-    window_rect_t overlap = rect_intersection(a, b);
-
-    // Completely covered
-    if (overlap.x == a.x && overlap.y == a.y && overlap.w == a.w && overlap.h == a.h) {
-        return result;
-    }
-
-    // The "degenerate" case is one window in the middle of another
-    // this creates a "border" from this window, with a maximum of 4
-    // pieces.
-
-    // Left
-    if (overlap.x > a.x) {
-        result.rects[result.count++] = (window_rect_t){.x = a.x, .y = a.y, .w = overlap.x - a.x, .h = a.h};
+        range_start = start;
+        range_end   = end;
     }
 
-    // Right
-    if (overlap.x + overlap.w < a.x + a.w) {
-        result.rects[result.count++] =
-            (window_rect_t){.x = overlap.x + overlap.w, .y = a.y, .w = (a.x + a.w) - (overlap.x + overlap.w), .h = a.h};
-    }
-
-    // Top
-    if (overlap.y > a.y) {
-        result.rects[result.count++] = (window_rect_t){.x = overlap.x, .y = a.y, .w = overlap.w, .h = overlap.y - a.y};
-    }
-
-    // Bottom
-    if (overlap.y + overlap.h < a.y + a.h) {
-        result.rects[result.count++] = (window_rect_t){.x = overlap.x,
-                                                       .y = overlap.y + overlap.h,
-                                                       .w = overlap.w,
-                                                       .h = (a.y + a.h) - (overlap.y + overlap.h)};
-    }
+    esp_cache_msync((void *)range_start, range_end - range_start, flags);
+}
 
-    return result;
+IRAM_ATTR void draw_text_rotated(uint16_t *fb, char const *text, int x, int y, uint16_t color) {
+    text_draw_pixels(fb, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H, true, TEXT_FONT_SMALL, x, y, text, color);
 }
@@ -16,71 +16,21 @@
 
 #pragma once
 
+#include "badgevms/orientation.h"
+#include "badgevms/text.h"
 #include "badgevms_config.h"
 #include "compositor_private.h"
 
 #include <stdint.h>
 
-typedef enum {
-    ROTATION_ANGLE_0,
-    ROTATION_ANGLE_90,
-    ROTATION_ANGLE_180,
-    ROTATION_ANGLE_270,
-} rotation_angle_t;
-
+// Rotations between screen and panel coordinates of the whole display
 __attribute__((always_inline)) inline static void
     rotate_coordinates(int x, int y, rotation_angle_t rotation, int *fb_x, int *fb_y) {
-    switch (rotation) {
-        case ROTATION_ANGLE_0:
-            *fb_x = x;
-            *fb_y = y;
-            break;
-
-        case ROTATION_ANGLE_90:
-            *fb_x = (FRAMEBUFFER_MAX_H - 1) - y;
-            *fb_y = x;
-            break;
-
-        case ROTATION_ANGLE_180:
-            *fb_x = (FRAMEBUFFER_MAX_W - 1) - x;
-            *fb_y = (FRAMEBUFFER_MAX_H - 1) - y;
-            break;
-
-        case ROTATION_ANGLE_270:
-            *fb_x = y;
-            *fb_y = (FRAMEBUFFER_MAX_W - 1) - x;
-            break;
-    }
+    orientation_rotate_coordinates(FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H, rotation, x, y, fb_x, fb_y);
 }
 
 __attribute__((always_inline)) inline static window_rect_t rotate_rect(window_rect_t rect, rotation_angle_t rotation) {
-    window_rect_t ret;
-    switch (rotation) {
-        case ROTATION_ANGLE_0: ret = rect; break;
-
-        case ROTATION_ANGLE_90:
-            ret.w = rect.h;
-            ret.h = rect.w;
-            ret.x = (FRAMEBUFFER_MAX_H - 1) - (rect.y + rect.h - 1);
-            ret.y = rect.x;
-            break;
-
-        case ROTATION_ANGLE_180:
-            ret.w = rect.w;
-            ret.h = rect.h;
-            ret.x = (FRAMEBUFFER_MAX_W - 1) - (rect.x + rect.w - 1);
-            ret.y = (FRAMEBUFFER_MAX_H - 1) - (rect.y + rect.h - 1);
-            break;
-
-        case ROTATION_ANGLE_270:
-            ret.w = rect.h;
-            ret.h = rect.w;
-            ret.x = rect.y;
-            ret.y = (FRAMEBUFFER_MAX_W - 1) - (rect.x + rect.w - 1);
-            break;
-    }
-
-    return ret;
+    return orientation_rotate_rect(FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H, rotation, rect);
 }
 
 __attribute__((always_inline)) inline static bool rect_intersects(window_rect_t a, window_rect_t b) {
@@ -98,12 +48,26 @@ __attribute__((always_inline)) inline static window_rect_t rect_intersection(win
     ){.x = left, .y = top, .w = (right > left) ? (right - left) : 0, .h = (bottom > top) ? (bottom - top) : 0};
 }
 
-small_rect_array_t rect_subtract(window_rect_t a, window_rect_t b);
-void               merge_rectangles(rect_array_t *arr);
+// Bounding box of both rects
+__attribute__((always_inline)) inline static window_rect_t rect_union(window_rect_t a, window_rect_t b) {
+    int left   = (a.x < b.x) ? a.x : b.x;
+    int top    = (a.y < b.y) ? a.y : b.y;
+    int right  = ((a.x + a.w) > (b.x + b.w)) ? (a.x + a.w) : (b.x + b.w);
+    int bottom = ((a.y + a.h) > (b.y + b.h)) ? (a.y + a.h) : (b.y + b.h);
+
+    return (window_rect_t){.x = left, .y = top, .w = right - left, .h = bottom - top};
+}
+
+void framebuffer_msync_rect(uint16_t *fb, window_rect_t rect, int flags);
 
 void draw_pixel_rotated(uint16_t *fb, int x, int y, uint16_t color);
 void draw_filled_rect_rotated(uint16_t *fb, int x, int y, int width, int height, uint16_t color);
 void draw_rect_rotated(uint16_t *fb, int x, int y, int width, int height, uint16_t color);
-int  char_to_font_index(char c);
-void draw_char_rotated(uint16_t *fb, char c, int x, int y, uint16_t color);
 void draw_text_rotated(uint16_t *fb, char const *text, int x, int y, uint16_t color);
+
+// Glyph blitter behind the text API, see text.c. pixels is a w by h picture,
+// laid out like the panel if native is set.
+bool text_init(void);
+void text_draw_pixels(
+    uint16_t *pixels, int w, int h, bool native, text_font_t font, int x, int y, char const *text, uint16_t color
+);
@@ -0,0 +1,216 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "region.h"
+
+#include <limits.h>
+#include <string.h>
+#include <sys/param.h>
+
+// Regions are rect arrays in y-x banded order: rects are sorted by y, then x.
+// All rects in a band share y and h, rects within a band never touch, and
+// vertically adjacent bands with identical spans are merged into one.
+// That lets every operation run as a single sweep over both inputs.
+
+typedef enum {
+    REGION_OP_UNION,
+    REGION_OP_SUBTRACT,
+} region_op_t;
+
+typedef struct {
+    int x1;
+    int x2;
+} span_t;
+
+__attribute__((always_inline)) inline static int band_end(window_rect_t const *rects, int count, int start) {
+    int end = start;
+    while (end < count && rects[end].y == rects[start].y) {
+        end++;
+    }
+    return end;
+}
+
+// Combine the spans of one band of each input, either side may be empty
+static int span_op(
+    window_rect_t const *a, int num_a, window_rect_t const *b, int num_b, region_op_t op, span_t *out, int max_out
+) {
+    int count = 0;
+
+#define EMIT_SPAN(start, end)                                                                                          \
+    do {                                                                                                               \
+        if ((end) > (start)) {                                                                                         \
+            if (count && out[count - 1].x2 >= (start)) {                                                               \
+                out[count - 1].x2 = MAX(out[count - 1].x2, (end));                                                     \
+            } else if (count < max_out) {                                                                              \
+                out[count++] = (span_t){(start), (end)};                                                               \
+            } else {                                                                                                   \
+                return -1;                                                                                             \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+    int i = 0, j = 0;
+    if (op == REGION_OP_UNION) {
+        while (i < num_a || j < num_b) {
+            window_rect_t const *next;
+            if (j >= num_b || (i < num_a && a[i].x < b[j].x)) {
+                next = &a[i++];
+            } else {
+                next = &b[j++];
+            }
+            EMIT_SPAN(next->x, next->x + next->w);
+        }
+    } else {
+        for (; i < num_a; i++) {
+            int x1 = a[i].x;
+            int x2 = a[i].x + a[i].w;
+
+            // Skip everything that ends before us, it can't affect later spans either
+            while (j < num_b && b[j].x + b[j].w <= x1) {
+                j++;
+            }
+
+            for (int k = j; k < num_b && b[k].x < x2; k++) {
+                EMIT_SPAN(x1, b[k].x);
+                x1 = MAX(x1, b[k].x + b[k].w);
+            }
+            EMIT_SPAN(x1, x2);
+        }
+    }
+
+#undef EMIT_SPAN
+
+    return count;
+}
+
+// Add a band to the output, merging it with the band above if that one has the same spans
+static bool region_append_band(rect_array_t *out, int *prev_start, int y1, int y2, span_t const *spans, int num) {
+    if (!num) {
+        return true;
+    }
+
+    int prev = *prev_start;
+    if (prev >= 0 && out->count - prev == num && out->rects[prev].y + out->rects[prev].h == y1) {
+        bool same = true;
+        for (int i = 0; i < num && same; i++) {
+            window_rect_t const *rect = &out->rects[prev + i];
+            same                      = rect->x == spans[i].x1 && rect->x + rect->w == spans[i].x2;
+        }
+        if (same) {
+            for (int i = 0; i < num; i++) {
+                out->rects[prev + i].h += y2 - y1;
+            }
+            return true;
+        }
+    }
+
+    if (out->count + num > MAX_VISIBLE_RECTS) {
+        return false;
+    }
+
+    *prev_start = out->count;
+    for (int i = 0; i < num; i++) {
+        out->rects[out->count++] =
+            (window_rect_t){.x = spans[i].x1, .y = y1, .w = spans[i].x2 - spans[i].x1, .h = y2 - y1};
+    }
+    return true;
+}
+
+// The inputs are plain rect lists so a single rect can be passed without building a region around it
+static bool region_op(
+    rect_array_t *dst, window_rect_t const *a, int num_a, window_rect_t const *b, int num_b, region_op_t op
+) {
+    rect_array_t out        = {0};
+    span_t       spans[MAX_VISIBLE_RECTS];
+    int          prev_start = -1;
+    int          ia         = 0;
+    int          ib         = 0;
+    int          y          = INT_MIN;
+    bool         ok         = true;
+
+    while (ia < num_a || ib < num_b) {
+        // Drop bands we are completely past
+        while (ia < num_a && a[ia].y + a[ia].h <= y) {
+            ia = band_end(a, num_a, ia);
+        }
+        while (ib < num_b && b[ib].y + b[ib].h <= y) {
+            ib = band_end(b, num_b, ib);
+        }
+
+        bool a_left = ia < num_a;
+        bool b_left = ib < num_b;
+        if (!a_left && !b_left) {
+            break;
+        }
+        if (!a_left && op == REGION_OP_SUBTRACT) {
+            break;
+        }
+
+        bool a_active = a_left && a[ia].y <= y;
+        bool b_active = b_left && b[ib].y <= y;
+
+        // Both inputs are constant until the next band edge
+        int next = INT_MAX;
+        if (a_left) {
+            next = MIN(next, a_active ? a[ia].y + a[ia].h : a[ia].y);
+        }
+        if (b_left) {
+            next = MIN(next, b_active ? b[ib].y + b[ib].h : b[ib].y);
+        }
+
+        if (a_active || b_active) {
+            int band_a = a_active ? band_end(a, num_a, ia) - ia : 0;
+            int band_b = b_active ? band_end(b, num_b, ib) - ib : 0;
+            int num    = span_op(&a[ia], band_a, &b[ib], band_b, op, spans, MAX_VISIBLE_RECTS);
+
+            if (num < 0 || !region_append_band(&out, &prev_start, y, next, spans, num)) {
+                ok = false;
+                break;
+            }
+        }
+
+        y = next;
+    }
+
+    *dst = out;
+    return ok;
+}
+
+void region_init(rect_array_t *region, window_rect_t rect) {
+    region->count = 0;
+    if (rect.w > 0 && rect.h > 0) {
+        region->rects[region->count++] = rect;
+    }
+}
+
+bool region_union(rect_array_t *dst, rect_array_t const *a, rect_array_t const *b) {
+    return region_op(dst, a->rects, a->count, b->rects, b->count, REGION_OP_UNION);
+}
+
+bool region_subtract(rect_array_t *dst, rect_array_t const *a, rect_array_t const *b) {
+    return region_op(dst, a->rects, a->count, b->rects, b->count, REGION_OP_SUBTRACT);
+}
+
+bool region_subtract_rect(rect_array_t *region, window_rect_t rect) {
+    if (rect.w <= 0 || rect.h <= 0) {
+        return true;
+    }
+    return region_op(region, region->rects, region->count, &rect, 1, REGION_OP_SUBTRACT);
+}
+
+bool region_equal(rect_array_t const *a, rect_array_t const *b) {
+    return a->count == b->count && !memcmp(a->rects, b->rects, a->count * sizeof(window_rect_t));
+}
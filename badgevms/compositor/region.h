@@ -0,0 +1,37 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/compositor.h"
+
+#include <stdbool.h>
+
+#define MAX_VISIBLE_RECTS 64
+
+// Also used as a region, see region_init() and friends below
+typedef struct {
+    window_rect_t rects[MAX_VISIBLE_RECTS];
+    int           count;
+} rect_array_t;
+
+// Banded region operations, dst may be one of the inputs. These return false
+// when the result doesn't fit in MAX_VISIBLE_RECTS, dst is then incomplete.
+void region_init(rect_array_t *region, window_rect_t rect);
+bool region_union(rect_array_t *dst, rect_array_t const *a, rect_array_t const *b);
+bool region_subtract(rect_array_t *dst, rect_array_t const *a, rect_array_t const *b);
+bool region_subtract_rect(rect_array_t *region, window_rect_t rect);
+bool region_equal(rect_array_t const *a, rect_array_t const *b);
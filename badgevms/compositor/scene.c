@@ -0,0 +1,436 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scene.h"
+
+#include "esp_log.h"
+#include "pixel_functions.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "compositor"
+
+window_t         *window_stack = NULL;
+SemaphoreHandle_t window_stack_lock;
+atomic_int        cur_num_windows;
+
+int  display_fb_count      = DISPLAY_FRAMEBUFFERS;
+int  background_damaged    = (1 << DISPLAY_FRAMEBUFFERS) - 1;
+int  decoration_damaged    = (1 << DISPLAY_FRAMEBUFFERS) - 1;
+bool visible_regions_valid = false;
+
+// Full content redraw of every window on the given display framebuffers
+void mark_windows_dirty(int fb_mask) {
+    if (!window_stack) {
+        return;
+    }
+
+    window_t *window = window_stack;
+    do {
+        window->fb_dirty |= fb_mask;
+        window            = window->next;
+    } while (window != window_stack);
+}
+
+
+// The part of the screen the scaled framebuffer covers. It is centered in the
+// window, the window paints the bars around it itself.
+window_rect_t window_content_rect(window_t *window, managed_framebuffer_t *framebuffer) {
+    float         scale   = window_scale(window, framebuffer);
+    window_rect_t content = {
+        .w = (int)floorf(framebuffer->w * scale),
+        .h = (int)floorf(framebuffer->h * scale),
+    };
+
+    content.x = window->rect.x + (window->rect.w - content.w) / 2;
+    content.y = window->rect.y + (window->rect.h - content.h) / 2;
+
+    if (!(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+        content.x += BORDER_PX;
+        content.y += BORDER_TOP_PX;
+    }
+
+    return content;
+}
+
+void push_window(window_t *window) {
+    xSemaphoreTake(window_stack_lock, portMAX_DELAY);
+    window_t *head = window_stack;
+
+    if (head) {
+        window_t *tail = head->prev;
+
+        window->next = head;
+        window->prev = tail;
+        head->prev   = window;
+        tail->next   = window;
+    } else {
+        window->prev = window;
+        window->next = window;
+    }
+
+    window_stack = window;
+    atomic_fetch_add(&cur_num_windows, 1);
+    xSemaphoreGive(window_stack_lock);
+}
+
+void remove_window(window_t *window) {
+    // If we were forcibly removed we won't be in the list
+    if (!window->prev || !window->next) {
+        return;
+    }
+
+    xSemaphoreTake(window_stack_lock, portMAX_DELAY);
+
+    // We are the only window
+    if (window->prev == window) {
+        window_stack = NULL;
+        goto out;
+    }
+    window_t *prev = window->prev;
+    window_t *next = window->next;
+
+    // Only one window left
+    if (prev == next) {
+        prev->next   = prev;
+        prev->prev   = prev;
+        window_stack = prev;
+        goto out;
+    }
+
+    next->prev   = prev;
+    prev->next   = next;
+    window_stack = next;
+out:
+    atomic_fetch_sub(&cur_num_windows, 1);
+    xSemaphoreGive(window_stack_lock);
+}
+
+
+window_rect_t content_to_framebuffer_rect(window_rect_t content_rect, window_t *window, float scale) {
+    managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+    window_rect_t          content     = window_content_rect(window, framebuffer);
+
+    content_rect.x -= content.x;
+    content_rect.y -= content.y;
+
+    int start_x = (int)(content_rect.x / scale);
+    int start_y = (int)(content_rect.y / scale);
+    int end_x   = (int)((content_rect.x + content_rect.w) / scale);
+    int end_y   = (int)((content_rect.y + content_rect.h) / scale);
+
+    start_x = MAX(0, MIN(start_x, (int)framebuffer->w - 1));
+    start_y = MAX(0, MIN(start_y, (int)framebuffer->h - 1));
+    end_x   = MAX(start_x, MIN(end_x, (int)framebuffer->w));
+    end_y   = MAX(start_y, MIN(end_y, (int)framebuffer->h));
+
+    window_rect_t fb_rect = {.x = start_x, .y = start_y, .w = end_x - start_x, .h = end_y - start_y};
+
+    return fb_rect;
+}
+
+// Inverse of content_to_framebuffer_rect, rounds outwards so partially covered pixels are included
+window_rect_t framebuffer_to_content_rect(window_rect_t fb_rect, window_t *window, float scale) {
+    int start_x = (int)floorf(fb_rect.x * scale);
+    int start_y = (int)floorf(fb_rect.y * scale);
+    int end_x   = (int)ceilf((fb_rect.x + fb_rect.w) * scale);
+    int end_y   = (int)ceilf((fb_rect.y + fb_rect.h) * scale);
+
+    window_rect_t content      = window_content_rect(window, window->framebuffers[window->front_fb]);
+    window_rect_t content_rect = {
+        .x = content.x + start_x,
+        .y = content.y + start_y,
+        .w = end_x - start_x,
+        .h = end_y - start_y,
+    };
+
+    return content_rect;
+}
+
+void damage_add(damage_rect_array_t *damage, window_rect_t rect) {
+    if (rect.w <= 0 || rect.h <= 0) {
+        return;
+    }
+
+    for (int i = 0; i < damage->count; ++i) {
+        window_rect_t overlap = rect_intersection(damage->rects[i], rect);
+        if (overlap.w == rect.w && overlap.h == rect.h) {
+            // Already covered
+            return;
+        }
+    }
+
+    if (damage->count < MAX_DAMAGE_RECTS) {
+        damage->rects[damage->count++] = rect;
+        return;
+    }
+
+    // Out of slots, grow the last rect so we never lose damage
+    damage->rects[damage->count - 1] = rect_union(damage->rects[damage->count - 1], rect);
+}
+
+// Queue a framebuffer rect for redraw on every display framebuffer that isn't getting a full one anyway.
+// Each collects what changed since it was drawn last, however many there are.
+static void window_damage_add(window_t *window, window_rect_t fb_rect) {
+    for (int fb = 0; fb < display_fb_count; ++fb) {
+        if (!(window->fb_dirty & (1 << fb))) {
+            damage_add(&window->fb_damage[fb], fb_rect);
+        }
+    }
+}
+
+// Pick up whatever the application reported through window_present() and
+// queue it for every display framebuffer
+void window_collect_present_damage(window_t *window) {
+    damage_rect_array_t damage;
+    bool                full;
+
+    taskENTER_CRITICAL(&window->present_damage_lock);
+    damage                         = window->present_damage;
+    full                           = window->present_damage_full;
+    window->present_damage.count   = 0;
+    window->present_damage_full    = false;
+    taskEXIT_CRITICAL(&window->present_damage_lock);
+
+    if (full) {
+        window->fb_dirty = ALL_DISPLAY_FB_MASK;
+        return;
+    }
+
+    for (int i = 0; i < damage.count; ++i) {
+        window_damage_add(window, damage.rects[i]);
+    }
+}
+
+// The parts of a window that hide whatever is below it
+static int window_occluder_rects(window_t *occluder, window_rect_t rects[4]) {
+    window_rect_t outer     = occluder->rect;
+    bool          decorated = !(occluder->flags & WINDOW_FLAG_FULLSCREEN);
+    int           count     = 0;
+
+    if (decorated) {
+        // Window decorations occlude too
+        outer.w += (BORDER_PX * 2);
+        outer.h += BORDER_TOP_PX + BORDER_PX;
+    }
+
+    if (!window_is_translucent(occluder)) {
+        rects[count++] = outer;
+    } else if (decorated) {
+        // Translucent content shows what's below, only the frame around it is in the way
+        int content_w = occluder->rect.w;
+        int content_h = occluder->rect.h;
+
+        rects[count++] = (window_rect_t){outer.x, outer.y, outer.w, BORDER_TOP_PX};
+        rects[count++] = (window_rect_t){outer.x, outer.y + BORDER_TOP_PX, BORDER_PX, content_h};
+        rects[count++] =
+            (window_rect_t){outer.x + BORDER_PX + content_w, outer.y + BORDER_TOP_PX, BORDER_PX, content_h};
+        rects[count++] = (window_rect_t){outer.x, outer.y + BORDER_TOP_PX + content_h, outer.w, BORDER_PX};
+    }
+
+    return count;
+}
+
+// Our content area on screen, and the area draw_window_box() paints around it
+window_rect_t window_visible_content(window_t *window) {
+    window_rect_t content = window->rect;
+    if (!(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+        content.x += BORDER_PX;
+        content.y += BORDER_TOP_PX;
+    }
+    return content;
+}
+
+window_rect_t window_outer_rect(window_t *window) {
+    window_rect_t outer = window->rect;
+    if (!(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+        outer.w += BORDER_PX * 2;
+        outer.h += BORDER_TOP_PX + 1;
+    }
+    return outer;
+}
+
+static void
+    window_occlusion_key(window_t *window, managed_framebuffer_t *framebuffer, float scale, occlusion_key_t *key) {
+    memset(key, 0, sizeof(occlusion_key_t));
+    key->rect    = window->rect;
+    key->flags   = window->flags;
+    key->opacity = window->opacity;
+    key->scale   = scale;
+    if (framebuffer) {
+        key->fb_size   = (window_size_t){framebuffer->w, framebuffer->h};
+        key->fb_format = framebuffer->format;
+    }
+
+    // Only the parts of the windows above that actually overlap us matter
+    window_rect_t outer = window_outer_rect(window);
+    for (window_t *occluder = window_stack; occluder && occluder != window; occluder = occluder->next) {
+        window_rect_t rects[4];
+        int           count = window_occluder_rects(occluder, rects);
+        for (int i = 0; i < count && key->num_occluders < MAX_OCCLUDER_RECTS; i++) {
+            window_rect_t overlap = rect_intersection(rects[i], outer);
+            if (overlap.w && overlap.h) {
+                key->occluders[key->num_occluders++] = overlap;
+            }
+        }
+    }
+}
+
+static void window_calculate_visible_regions(window_t *window) {
+    bool ok = true;
+
+    region_init(&window->visible, window_visible_content(window));
+    window->decoration_visible.count = 0;
+    if (!(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+        region_init(&window->decoration_visible, window_outer_rect(window));
+        ok = region_subtract_rect(&window->decoration_visible, window_visible_content(window));
+    }
+
+    for (int i = 0; i < window->occlusion.num_occluders; i++) {
+        ok = region_subtract_rect(&window->visible, window->occlusion.occluders[i]) && ok;
+        ok = region_subtract_rect(&window->decoration_visible, window->occlusion.occluders[i]) && ok;
+    }
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Visible region of window %p too fragmented, parts will not be drawn", window);
+    }
+}
+
+// Screen rect to window framebuffer coordinates, rounding outwards
+static window_rect_t content_to_framebuffer_damage(
+    window_rect_t content_rect, window_t *window, managed_framebuffer_t *framebuffer, float scale
+) {
+    window_rect_t content = window_content_rect(window, framebuffer);
+
+    int start_x = (int)floorf((content_rect.x - content.x) / scale);
+    int start_y = (int)floorf((content_rect.y - content.y) / scale);
+    int end_x   = (int)ceilf((content_rect.x + content_rect.w - content.x) / scale);
+    int end_y   = (int)ceilf((content_rect.y + content_rect.h - content.y) / scale);
+
+    start_x = MAX(0, MIN(start_x, (int)framebuffer->w));
+    start_y = MAX(0, MIN(start_y, (int)framebuffer->h));
+    end_x   = MAX(start_x, MIN(end_x, (int)framebuffer->w));
+    end_y   = MAX(start_y, MIN(end_y, (int)framebuffer->h));
+
+    return (window_rect_t){.x = start_x, .y = start_y, .w = end_x - start_x, .h = end_y - start_y};
+}
+
+// Recompute the visible regions, but only if anything they depend on changed.
+// Parts that became visible get redrawn, parts that got covered are left to
+// whatever is on top of them now.
+void window_update_visible_regions(window_t *window, managed_framebuffer_t *framebuffer, float scale) {
+    occlusion_key_t key;
+    window_occlusion_key(window, framebuffer, scale, &key);
+
+    if (!memcmp(&key, &window->occlusion, sizeof(occlusion_key_t))) {
+        return;
+    }
+
+    // Everything but the occluders, if any of that changed our content moved or looks different
+    bool content_changed = memcmp(&key, &window->occlusion, offsetof(occlusion_key_t, num_occluders)) != 0;
+
+    rect_array_t old_visible = window->visible;
+    window->occlusion        = key;
+    window_calculate_visible_regions(window);
+
+    if (!framebuffer) {
+        return;
+    }
+
+    if (content_changed) {
+        window->fb_dirty = ALL_DISPLAY_FB_MASK;
+        return;
+    }
+
+    rect_array_t exposed;
+    if (!region_subtract(&exposed, &window->visible, &old_visible)) {
+        window->fb_dirty = ALL_DISPLAY_FB_MASK;
+        return;
+    }
+
+    window_rect_t content = window_content_rect(window, framebuffer);
+    for (int i = 0; i < exposed.count; i++) {
+        window_rect_t in_content = rect_intersection(exposed.rects[i], content);
+        if (in_content.w != exposed.rects[i].w || in_content.h != exposed.rects[i].h) {
+            window->letterbox_dirty = ALL_DISPLAY_FB_MASK;
+        }
+        window_damage_add(window, content_to_framebuffer_damage(exposed.rects[i], window, framebuffer, scale));
+    }
+}
+
+// Check the clean flag without consuming it. Only applications clear it, so
+// putting it back can't lose a present.
+bool framebuffer_peek_clean(managed_framebuffer_t *framebuffer) {
+    bool clean = atomic_flag_test_and_set(&framebuffer->clean);
+    if (!clean) {
+        atomic_flag_clear(&framebuffer->clean);
+    }
+    return clean;
+}
+
+// Blending needs everything below a translucent window to be freshly drawn.
+// If the window itself or anything under it changed, composite the whole
+// display framebuffer again.
+void translucent_damage_check(int fb) {
+    if (!window_stack) {
+        return;
+    }
+
+    window_rect_t translucent[MAX_WINDOWS];
+    int           num_translucent = 0;
+    bool          recompose       = false;
+    window_t     *window          = window_stack;
+
+    do {
+        managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+        if (!framebuffer) {
+            window = window->next;
+            continue;
+        }
+
+        window_rect_t content        = window_content_rect(window, framebuffer);
+        bool          is_translucent = window_is_translucent(window);
+        bool          changed        = (background_damaged & (1 << fb)) || !framebuffer_peek_clean(framebuffer) ||
+                              (window->fb_dirty & (1 << fb)) || window->fb_damage[fb].count;
+
+        if (changed) {
+            recompose = is_translucent;
+            for (int i = 0; i < num_translucent && !recompose; ++i) {
+                recompose = rect_intersects(content, translucent[i]);
+            }
+        }
+
+        if (recompose) {
+            break;
+        }
+
+        if (is_translucent && num_translucent < MAX_WINDOWS) {
+            translucent[num_translucent++] = content;
+        }
+
+        window = window->next;
+    } while (window != window_stack);
+
+    if (!recompose) {
+        return;
+    }
+
+    background_damaged |= (1 << fb);
+    decoration_damaged |= (1 << fb);
+    mark_windows_dirty(1 << fb);
+}
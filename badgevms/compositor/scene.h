@@ -0,0 +1,140 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "compositor_private.h"
+#include "window_decorations.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <math.h>
+
+// The window stack and the geometry derived from it, what of every window is
+// visible and which parts of it need drawing. Nothing in here touches the PPA,
+// the panel or other tasks, so it also builds in host_tests/compositor_sim.
+
+#define WINDOW_MAX_W (FRAMEBUFFER_MAX_W - (2 * BORDER_PX) - SIDE_BAR_PX)
+#define WINDOW_MAX_H (FRAMEBUFFER_MAX_H - BORDER_TOP_PX - TOP_BAR_PX)
+
+#define ALL_DISPLAY_FB_MASK ((1 << display_fb_count) - 1)
+
+// Front to back, circular. Only the compositor task changes it.
+extern window_t         *window_stack;
+// Held while window_stack changes, the input task reads the focused window under it
+extern SemaphoreHandle_t window_stack_lock;
+extern atomic_int        cur_num_windows;
+
+// Display framebuffers the panel has, DISPLAY_FRAMEBUFFERS_MIN up to DISPLAY_FRAMEBUFFERS
+extern int  display_fb_count;
+// Display framebuffers that need the background or decorations drawn again
+extern int  background_damaged;
+extern int  decoration_damaged;
+extern bool visible_regions_valid;
+
+static inline void mark_scene_damaged(void) {
+    visible_regions_valid = false;
+    decoration_damaged    = ALL_DISPLAY_FB_MASK;
+    background_damaged    = ALL_DISPLAY_FB_MASK;
+}
+
+
+__attribute__((always_inline)) static inline bool window_has_alpha(managed_framebuffer_t *framebuffer) {
+    return framebuffer && BADGEVMS_BYTESPERPIXEL(framebuffer->format) == 4;
+}
+
+// Translucent windows are blended with whatever is below and don't occlude it
+__attribute__((always_inline)) static inline bool window_is_translucent(window_t *window) {
+    if (window->opacity != 255) {
+        return true;
+    }
+
+    return (window->flags & WINDOW_FLAG_ALPHA_BLEND) && window_has_alpha(window->framebuffers[window->front_fb]);
+}
+
+
+__attribute__((always_inline)) static inline window_size_t window_clamp_size(window_t *window, window_size_t size) {
+    window_size_t ret;
+
+    size.w = size.w < 0 ? 0 : size.w;
+    size.h = size.h < 0 ? 0 : size.h;
+
+    if (window->flags & WINDOW_FLAG_FULLSCREEN) {
+        ret.w = size.w > FRAMEBUFFER_MAX_W ? FRAMEBUFFER_MAX_W : size.w;
+        ret.h = size.h > FRAMEBUFFER_MAX_H ? FRAMEBUFFER_MAX_H : size.h;
+    } else {
+        ret.w = size.w > WINDOW_MAX_W ? WINDOW_MAX_W : size.w;
+        ret.h = size.h > WINDOW_MAX_H ? WINDOW_MAX_H : size.h;
+    }
+
+    return ret;
+}
+
+__attribute__((always_inline)) static inline float window_scale(window_t *window, managed_framebuffer_t *framebuffer) {
+    float scale_x = ((float)window->rect.w / (float)framebuffer->w);
+    float scale_y = ((float)window->rect.h / (float)framebuffer->h);
+    return fminf(scale_x, scale_y);
+}
+
+__attribute__((always_inline)) static inline window_coords_t
+    window_clamp_position(window_t *window, window_coords_t position) {
+    window_coords_t ret;
+
+    position.x = position.x < 0 ? 0 : position.x;
+    position.y = position.y < 0 ? 0 : position.y;
+
+    if (window->flags & WINDOW_FLAG_FULLSCREEN) {
+        ret.x = 0;
+        ret.y = 0;
+    } else {
+        int max_x = FRAMEBUFFER_MAX_W - (window->rect.w + (2 * BORDER_PX)) - 1;
+        int max_y = FRAMEBUFFER_MAX_H - (window->rect.h + (BORDER_TOP_PX + BORDER_PX)) - 1;
+        ret.x     = position.x > max_x ? max_x : position.x;
+        ret.y     = position.y > max_y ? max_y : position.y;
+    }
+
+    return ret;
+}
+
+// Full content redraw of every window on the given display framebuffers
+void mark_windows_dirty(int fb_mask);
+
+void push_window(window_t *window);
+void remove_window(window_t *window);
+
+window_rect_t window_content_rect(window_t *window, managed_framebuffer_t *framebuffer);
+// Our content area on screen, and the area draw_window_box() paints around it
+window_rect_t window_visible_content(window_t *window);
+window_rect_t window_outer_rect(window_t *window);
+
+window_rect_t content_to_framebuffer_rect(window_rect_t content_rect, window_t *window, float scale);
+// Inverse of content_to_framebuffer_rect, rounds outwards so partially covered pixels are included
+window_rect_t framebuffer_to_content_rect(window_rect_t fb_rect, window_t *window, float scale);
+
+void damage_add(damage_rect_array_t *damage, window_rect_t rect);
+// Pick up whatever the application reported through window_present() and
+// queue it for every display framebuffer
+void window_collect_present_damage(window_t *window);
+// Recompute the visible regions, but only if anything they depend on changed
+void window_update_visible_regions(window_t *window, managed_framebuffer_t *framebuffer, float scale);
+
+// Whether the application presented since the compositor last took the frame, without taking it
+bool framebuffer_peek_clean(managed_framebuffer_t *framebuffer);
+// Blending needs everything below a translucent window to be freshly drawn.
+// If the window itself or anything under it changed, mark all of display
+// framebuffer fb for drawing again.
+void translucent_damage_check(int fb);
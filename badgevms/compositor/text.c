@@ -0,0 +1,193 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms/text.h"
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "font.h"
+#include "font_large.h"
+#include "pixel_functions.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "text"
+
+#define TEXT_FIRST_CHAR 32
+#define TEXT_LAST_CHAR  126
+#define TEXT_NUM_CHARS  (TEXT_LAST_CHAR - TEXT_FIRST_CHAR + 1)
+
+#define NATIVE_TRANSPOSED                                                                                              \
+    (BADGEVMS_PANEL_ROTATION == ROTATION_ANGLE_90 || BADGEVMS_PANEL_ROTATION == ROTATION_ANGLE_270)
+
+// Every glyph is kept as a bit mask per row, bit 0 being the leftmost pixel.
+// There is an upright copy and one rotated like the panel, whose rows are the
+// runs that end up on a line of a native framebuffer. Drawing then only walks
+// the lit bits of each row, nothing gets rotated or bounds checked per pixel.
+typedef struct {
+    int       width; // Of the upright bitmap
+    int       height;
+    int       advance;
+    uint32_t *glyphs[2]; // TEXT_NUM_CHARS glyphs, upright and native
+} text_font_data_t;
+
+static text_font_data_t fonts[] = {
+    [TEXT_FONT_SMALL] = {.width = FONT_WIDTH, .height = FONT_HEIGHT, .advance = TEXT_FONT_SMALL_WIDTH},
+    [TEXT_FONT_LARGE] = {.width = FONT_LARGE_WIDTH, .height = FONT_LARGE_HEIGHT, .advance = TEXT_FONT_LARGE_WIDTH},
+};
+
+__attribute__((always_inline)) inline static int glyph_rows(text_font_data_t const *font, bool native) {
+    return (native && NATIVE_TRANSPOSED) ? font->width : font->height;
+}
+
+static int small_font_index(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return 1 + (c - 'A');
+    if (c >= 'a' && c <= 'z')
+        return 1 + (c - 'a'); // Map lowercase to uppercase
+    if (c >= '0' && c <= '9')
+        return 27 + (c - '0');
+
+    char const *punctuation = "-.,:_/()!?'+";
+    char const *found       = strchr(punctuation, c);
+    if (c && found)
+        return 37 + (found - punctuation);
+    return 0; // Default to space
+}
+
+static bool font_pixel(text_font_t font, char c, int x, int y) {
+    if (font == TEXT_FONT_SMALL) {
+        return font_data[small_font_index(c)][y] & (0x80 >> x);
+    }
+    return font_large_data[c - FONT_LARGE_FIRST_CHAR][y] & (0x800 >> x);
+}
+
+bool text_init(void) {
+    for (int f = 0; f < sizeof(fonts) / sizeof(fonts[0]); ++f) {
+        text_font_data_t *font = &fonts[f];
+        for (int native = 0; native < 2; ++native) {
+            rotation_angle_t glyph_rotation = native ? BADGEVMS_PANEL_ROTATION : ROTATION_ANGLE_0;
+            int              rows           = glyph_rows(font, native);
+
+            font->glyphs[native] = heap_caps_calloc(TEXT_NUM_CHARS * rows, sizeof(uint32_t), MALLOC_CAP_SPIRAM);
+            if (!font->glyphs[native]) {
+                ESP_LOGE(TAG, "Unable to allocate the glyphs");
+                return false;
+            }
+
+            for (int c = TEXT_FIRST_CHAR; c <= TEXT_LAST_CHAR; ++c) {
+                uint32_t *glyph = font->glyphs[native] + (c - TEXT_FIRST_CHAR) * rows;
+                for (int y = 0; y < font->height; ++y) {
+                    for (int x = 0; x < font->width; ++x) {
+                        if (!font_pixel(f, c, x, y)) {
+                            continue;
+                        }
+
+                        int gx, gy;
+                        orientation_rotate_coordinates(font->width, font->height, glyph_rotation, x, y, &gx, &gy);
+                        glyph[gy] |= 1u << gx;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+IRAM_ATTR static void glyph_draw(
+    uint16_t               *pixels,
+    int                     w,
+    int                     h,
+    bool                    native,
+    text_font_data_t const *font,
+    uint32_t const         *glyph,
+    int                     x,
+    int                     y,
+    uint16_t                color
+) {
+    window_rect_t rect  = {x, y, font->width, font->height};
+    int           pitch = w;
+    int           lines = h;
+    if (native) {
+        rect = orientation_rotate_rect(w, h, BADGEVMS_PANEL_ROTATION, rect);
+        if (NATIVE_TRANSPOSED) {
+            pitch = h;
+            lines = w;
+        }
+    }
+
+    int first_row = MAX(0, -rect.y);
+    int last_row  = MIN(rect.h, lines - rect.y);
+    int first_col = MAX(0, -rect.x);
+    int last_col  = MIN(rect.w, pitch - rect.x);
+    if (first_row >= last_row || first_col >= last_col) {
+        return;
+    }
+
+    uint32_t  clip = (UINT32_MAX >> (32 - last_col)) & (UINT32_MAX << first_col);
+    uint16_t *line = pixels + (rect.y + first_row) * pitch;
+    for (int row = first_row; row < last_row; ++row, line += pitch) {
+        uint32_t bits = glyph[row] & clip;
+        while (bits) {
+            line[rect.x + __builtin_ctz(bits)]  = color;
+            bits                               &= bits - 1;
+        }
+    }
+}
+
+IRAM_ATTR void text_draw_pixels(
+    uint16_t *pixels, int w, int h, bool native, text_font_t font, int x, int y, char const *text, uint16_t color
+) {
+    text_font_data_t const *data = &fonts[font];
+    int                     rows = glyph_rows(data, native);
+
+    if (y >= h || y + data->height <= 0) {
+        return;
+    }
+
+    for (; *text && x < w; ++text, x += data->advance) {
+        unsigned char c = *text;
+        if (c < TEXT_FIRST_CHAR || c > TEXT_LAST_CHAR || x + data->width <= 0) {
+            continue;
+        }
+        glyph_draw(pixels, w, h, native, data, data->glyphs[native] + (c - TEXT_FIRST_CHAR) * rows, x, y, color);
+    }
+}
+
+int text_width(text_font_t font, char const *text) {
+    if (!text || font < TEXT_FONT_SMALL || font > TEXT_FONT_LARGE) {
+        return 0;
+    }
+    return strlen(text) * fonts[font].advance;
+}
+
+void text_draw(
+    framebuffer_t *framebuffer, text_font_t font, int x, int y, char const *text, uint16_t color, bool native
+) {
+    if (!framebuffer || !text || font < TEXT_FONT_SMALL || font > TEXT_FONT_LARGE) {
+        return;
+    }
+
+    if (framebuffer->format != BADGEVMS_PIXELFORMAT_RGB565 && framebuffer->format != BADGEVMS_PIXELFORMAT_BGR565) {
+        ESP_LOGW(TAG, "Text can only be drawn on 16 bit framebuffers");
+        return;
+    }
+
+    text_draw_pixels(framebuffer->pixels, framebuffer->w, framebuffer->h, native, font, x, y, text, color);
+}
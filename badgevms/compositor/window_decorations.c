@@ -19,8 +19,16 @@
 #include "font.h"
 #include "pixel_functions.h"
 
+#include "esp_cache.h"
+#include "esp_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
 #define TAG "window_decorations"
 
+extern rotation_angle_t rotation;
+
 #define RGB565(r, g, b) ((uint16_t)(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)))
 
 // Default color scheme
@@ -50,38 +58,127 @@ IRAM_ATTR static window_colors_t window_colors = {
     .bg_window_outer_border      = RGB565(200, 200, 200), // Light gray
 };
 
-IRAM_ATTR void draw_window_box(uint16_t *fb, window_t *window, bool foreground) {
-    int x      = window->rect.x;
-    int y      = window->rect.y;
-    int width  = window->rect.w;
-    int height = window->rect.h;
+// The decoration is the window's outer rect minus its content area, kept as four strips
+typedef enum {
+    DECORATION_STRIP_TOP,
+    DECORATION_STRIP_LEFT,
+    DECORATION_STRIP_RIGHT,
+    DECORATION_STRIP_BOTTOM,
+    DECORATION_STRIPS,
+} decoration_strip_index_t;
+
+typedef struct {
+    // Relative to the window's outer top left corner, unrotated
+    window_rect_t rect;
+    // Already rotated to panel orientation, rect rotated via rotate_rect() gives the stride
+    uint16_t     *pixels;
+} decoration_strip_t;
+
+struct decoration_cache {
+    window_size_t      size;
+    bool               foreground;
+    char               title[21];
+    decoration_strip_t strips[DECORATION_STRIPS];
+    size_t             num_pixels;
+    uint16_t          *pixels;
+};
+
+// Same mapping as rotate_coordinates(), but within a strip of the given size
+__attribute__((always_inline)) inline static int
+    strip_offset(decoration_strip_t const *strip, int x, int y, rotation_angle_t rotation) {
+    int w = strip->rect.w;
+    int h = strip->rect.h;
+
+    switch (rotation) {
+        case ROTATION_ANGLE_90: return x * h + (h - 1 - y);
+        case ROTATION_ANGLE_180: return (h - 1 - y) * w + (w - 1 - x);
+        case ROTATION_ANGLE_270: return (w - 1 - x) * h + y;
+        case ROTATION_ANGLE_0:
+        default: return y * w + x;
+    }
+}
+
+static void deco_pixel(decoration_cache_t *cache, int x, int y, uint16_t color) {
+    for (int i = 0; i < DECORATION_STRIPS; ++i) {
+        decoration_strip_t *strip = &cache->strips[i];
+        int                 sx    = x - strip->rect.x;
+        int                 sy    = y - strip->rect.y;
+        if (sx >= 0 && sx < strip->rect.w && sy >= 0 && sy < strip->rect.h) {
+            strip->pixels[strip_offset(strip, sx, sy, rotation)] = color;
+            return;
+        }
+    }
+
+    // Falls inside the content area or outside the window, the app's pixels win either way
+}
+
+static void deco_filled_rect(decoration_cache_t *cache, int x, int y, int width, int height, uint16_t color) {
+    for (int py = y; py < y + height; py++) {
+        for (int px = x; px < x + width; px++) {
+            deco_pixel(cache, px, py, color);
+        }
+    }
+}
+
+static void deco_rect(decoration_cache_t *cache, int x, int y, int width, int height, uint16_t color) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    deco_filled_rect(cache, x, y, width, 1, color);
+    deco_filled_rect(cache, x, y + height - 1, width, 1, color);
+    deco_filled_rect(cache, x, y + 1, 1, height - 2, color);
+    deco_filled_rect(cache, x + width - 1, y + 1, 1, height - 2, color);
+}
+
+static void deco_text(decoration_cache_t *cache, char const *text, int x, int y, uint16_t color) {
+    for (int i = 0; i < DECORATION_STRIPS; ++i) {
+        decoration_strip_t *strip = &cache->strips[i];
+        text_draw_pixels(
+            strip->pixels,
+            strip->rect.w,
+            strip->rect.h,
+            true,
+            TEXT_FONT_SMALL,
+            x - strip->rect.x,
+            y - strip->rect.y,
+            text,
+            color
+        );
+    }
+}
+
+static void decoration_render(decoration_cache_t *cache, char const *window_title, bool foreground) {
+    int x      = 0;
+    int y      = 0;
+    int width  = cache->size.w;
+    int height = cache->size.h;
 
     int total_width  = width + 2 * BORDER_PX;
     int total_height = height + BORDER_TOP_PX;
 
-    draw_rect_rotated(fb, x, y, total_width, total_height, window_colors.window_outer_border);
+    deco_rect(cache, x, y, total_width, total_height, window_colors.window_outer_border);
 
     // Draw inner border
     uint16_t inner_border_color =
         foreground ? window_colors.fg_window_outer_border : window_colors.bg_window_outer_border;
-    draw_rect_rotated(fb, x + 1, y + 1, total_width - 2, total_height - 2, inner_border_color);
+    deco_rect(cache, x + 1, y + 1, total_width - 2, total_height - 2, inner_border_color);
 
     // Draw title bar background
     if (foreground) {
         // Foreground window: black title bar
-        draw_filled_rect_rotated(fb, x + 1, y + 1, total_width, BORDER_TOP_PX, window_colors.fg_titlebar_background);
+        deco_filled_rect(cache, x + 1, y + 1, total_width, BORDER_TOP_PX, window_colors.fg_titlebar_background);
 
         // Top-left corner - simple L-shaped accent
-        draw_filled_rect_rotated(fb, x + 3, y + 3, 3, 1, window_colors.fg_titlebar_corner_accents);
-        draw_filled_rect_rotated(fb, x + 3, y + 3, 1, 3, window_colors.fg_titlebar_corner_accents);
+        deco_filled_rect(cache, x + 3, y + 3, 3, 1, window_colors.fg_titlebar_corner_accents);
+        deco_filled_rect(cache, x + 3, y + 3, 1, 3, window_colors.fg_titlebar_corner_accents);
         // Top-right corner - simple L-shaped accent
-        draw_filled_rect_rotated(fb, x + total_width - 6, y + 3, 3, 1, window_colors.fg_titlebar_corner_accents);
-        draw_filled_rect_rotated(fb, x + total_width - 4, y + 3, 1, 3, window_colors.fg_titlebar_corner_accents);
+        deco_filled_rect(cache, x + total_width - 6, y + 3, 3, 1, window_colors.fg_titlebar_corner_accents);
+        deco_filled_rect(cache, x + total_width - 4, y + 3, 1, 3, window_colors.fg_titlebar_corner_accents);
 
         // Horizontal accent lines in title bar
-        draw_filled_rect_rotated(fb, x + 7, y + 6, total_width - 14, 1, window_colors.fg_titlebar_horizontal_lines);
-        draw_filled_rect_rotated(
-            fb,
+        deco_filled_rect(cache, x + 7, y + 6, total_width - 14, 1, window_colors.fg_titlebar_horizontal_lines);
+        deco_filled_rect(
+            cache,
             x + 7,
             y + BORDER_TOP_PX - 7,
             total_width - 14,
@@ -91,8 +188,8 @@ IRAM_ATTR void draw_window_box(uint16_t *fb, window_t *window, bool foreground)
 
     } else {
         // Background window: dithered/stippled title bar
-        draw_filled_rect_rotated(
-            fb,
+        deco_filled_rect(
+            cache,
             x + 2,
             y + 2,
             total_width - 4,
@@ -104,29 +201,25 @@ IRAM_ATTR void draw_window_box(uint16_t *fb, window_t *window, bool foreground)
         for (int dither_y = y + 2; dither_y < y + BORDER_TOP_PX - 1; dither_y++) {
             for (int dither_x = x + 2; dither_x < x + total_width - 2; dither_x++) {
                 if ((dither_x + dither_y) % 3 == 0) { // Sparse dither pattern
-                    draw_pixel_rotated(fb, dither_x, dither_y, window_colors.bg_titlebar_dither_pattern);
+                    deco_pixel(cache, dither_x, dither_y, window_colors.bg_titlebar_dither_pattern);
                 }
             }
         }
 
         // Stippled border accent for inactive windows
         for (int dot_x = x; dot_x < x + total_width; dot_x += 4) {
-            draw_pixel_rotated(fb, dot_x, y, window_colors.bg_titlebar_stippled_border);
-            draw_pixel_rotated(fb, dot_x, y + total_height - 1, window_colors.bg_titlebar_stippled_border);
+            deco_pixel(cache, dot_x, y, window_colors.bg_titlebar_stippled_border);
+            deco_pixel(cache, dot_x, y + total_height - 1, window_colors.bg_titlebar_stippled_border);
         }
         for (int dot_y = y; dot_y < y + total_height; dot_y += 4) {
-            draw_pixel_rotated(fb, x, dot_y, window_colors.bg_titlebar_stippled_border);
-            draw_pixel_rotated(fb, x + total_width - 1, dot_y, window_colors.bg_titlebar_stippled_border);
+            deco_pixel(cache, x, dot_y, window_colors.bg_titlebar_stippled_border);
+            deco_pixel(cache, x + total_width - 1, dot_y, window_colors.bg_titlebar_stippled_border);
         }
     }
 
     // Title text
-    char title[21];
-    if (window->title) {
-        strncpy(title, window->title, 20);
-    } else {
-        strncpy(title, foreground ? "FOREGROUND" : "BACKGROUND", 20);
-    }
+    char title[21] = {0};
+    strncpy(title, window_title, 20);
     int max_text = strlen(title);
     int text_width;
     int title_bar_width = total_width - 4; // Account for borders
@@ -141,15 +234,139 @@ IRAM_ATTR void draw_window_box(uint16_t *fb, window_t *window, bool foreground)
 
     if (foreground) {
         // Subtle drop shadow effect
-        draw_text_rotated(fb, title, text_x + 1, text_y + 1, window_colors.fg_titlebar_text_shadow);
-        draw_text_rotated(fb, title, text_x, text_y, window_colors.fg_titlebar_text);
+        deco_text(cache, title, text_x + 1, text_y + 1, window_colors.fg_titlebar_text_shadow);
+        deco_text(cache, title, text_x, text_y, window_colors.fg_titlebar_text);
     } else {
-        draw_text_rotated(fb, title, text_x, text_y, window_colors.bg_titlebar_text);
+        deco_text(cache, title, text_x, text_y, window_colors.bg_titlebar_text);
     }
 
     // Inner content border
     uint16_t border_color = foreground ? window_colors.fg_window_inner_border : window_colors.bg_window_inner_border;
     int      content_x    = x + BORDER_PX;
     int      content_y    = y + BORDER_TOP_PX;
-    draw_rect_rotated(fb, content_x - 1, content_y - 1, width + 2, height + 2, border_color);
+    deco_rect(cache, content_x - 1, content_y - 1, width + 2, height + 2, border_color);
+}
+
+static bool decoration_layout(decoration_cache_t *cache, window_size_t size) {
+    int total_width = size.w + 2 * BORDER_PX;
+
+    cache->strips[DECORATION_STRIP_TOP]    = (decoration_strip_t){.rect = {0, 0, total_width, BORDER_TOP_PX}};
+    cache->strips[DECORATION_STRIP_LEFT]   = (decoration_strip_t){.rect = {0, BORDER_TOP_PX, BORDER_PX, size.h}};
+    cache->strips[DECORATION_STRIP_RIGHT]  = (decoration_strip_t
+    ){.rect = {BORDER_PX + size.w, BORDER_TOP_PX, BORDER_PX, size.h}};
+    cache->strips[DECORATION_STRIP_BOTTOM] = (decoration_strip_t
+    ){.rect = {0, BORDER_TOP_PX + size.h, total_width, 1}};
+
+    size_t num_pixels = 0;
+    for (int i = 0; i < DECORATION_STRIPS; ++i) {
+        num_pixels += cache->strips[i].rect.w * cache->strips[i].rect.h;
+    }
+
+    if (num_pixels != cache->num_pixels) {
+        uint16_t *pixels = realloc(cache->pixels, num_pixels * sizeof(uint16_t));
+        if (!pixels) {
+            ESP_LOGE(TAG, "Unable to allocate %zu decoration pixels", num_pixels);
+            return false;
+        }
+        cache->pixels     = pixels;
+        cache->num_pixels = num_pixels;
+    }
+
+    uint16_t *pixels = cache->pixels;
+    for (int i = 0; i < DECORATION_STRIPS; ++i) {
+        cache->strips[i].pixels  = pixels;
+        pixels                  += cache->strips[i].rect.w * cache->strips[i].rect.h;
+    }
+
+    cache->size = size;
+    return true;
+}
+
+// Only re-render when something that shows up in the decoration changed
+static decoration_cache_t *decoration_get(window_t *window, bool foreground) {
+    decoration_cache_t *cache     = window->decoration;
+    window_size_t       size      = {window->rect.w, window->rect.h};
+    char                title[21] = {0};
+
+    if (window->title) {
+        strncpy(title, window->title, 20);
+    } else {
+        strncpy(title, foreground ? "FOREGROUND" : "BACKGROUND", 20);
+    }
+
+    if (!cache) {
+        cache = calloc(1, sizeof(decoration_cache_t));
+        if (!cache) {
+            ESP_LOGE(TAG, "Unable to allocate decoration cache for window %p", window);
+            return NULL;
+        }
+        window->decoration = cache;
+    } else if (cache->pixels && cache->size.w == size.w && cache->size.h == size.h &&
+               cache->foreground == foreground && strcmp(cache->title, title) == 0) {
+        return cache;
+    }
+
+    if (!decoration_layout(cache, size)) {
+        return NULL;
+    }
+
+    // Anything the drawing below doesn't touch is outer border
+    for (size_t i = 0; i < cache->num_pixels; ++i) {
+        cache->pixels[i] = window_colors.window_outer_border;
+    }
+
+    cache->foreground = foreground;
+    memcpy(cache->title, title, sizeof(title));
+    decoration_render(cache, title, foreground);
+
+    return cache;
+}
+
+IRAM_ATTR void draw_window_box(uint16_t *fb, window_t *window, bool foreground, rect_array_t const *clip) {
+    decoration_cache_t *cache = decoration_get(window, foreground);
+    if (!cache) {
+        return;
+    }
+
+    window_rect_t screen = {0, 0, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H};
+
+    for (int i = 0; i < DECORATION_STRIPS; ++i) {
+        decoration_strip_t *strip  = &cache->strips[i];
+        window_rect_t       target = strip->rect;
+        target.x                  += window->rect.x;
+        target.y                  += window->rect.y;
+
+        window_rect_t dest = rotate_rect(target, rotation);
+
+        for (int j = 0; j < clip->count; ++j) {
+            window_rect_t part = rect_intersection(target, clip->rects[j]);
+            if (!part.w || !part.h) {
+                continue;
+            }
+
+            window_rect_t part_dest = rect_intersection(rotate_rect(part, rotation), screen);
+            if (!part_dest.w || !part_dest.h) {
+                continue;
+            }
+
+            // Other lines in this framebuffer may have been written by the PPA, leave them alone
+            framebuffer_msync_rect(fb, part_dest, ESP_CACHE_MSYNC_FLAG_DIR_M2C);
+            for (int row = part_dest.y; row < part_dest.y + part_dest.h; ++row) {
+                memcpy(
+                    fb + row * FRAMEBUFFER_MAX_W + part_dest.x,
+                    strip->pixels + (row - dest.y) * dest.w + (part_dest.x - dest.x),
+                    part_dest.w * sizeof(uint16_t)
+                );
+            }
+            framebuffer_msync_rect(fb, part_dest, ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE);
+        }
+    }
+}
+
+void window_decoration_free(window_t *window) {
+    if (window->decoration) {
+        free(window->decoration->pixels);
+        free(window->decoration);
+        window->decoration = NULL;
+    }
 }
@@ -47,4 +47,7 @@ typedef struct {
     uint16_t bg_window_outer_border;      // Window frame border (light gray)
 } window_colors_t;
 
-void draw_window_box(uint16_t *fb, window_t *window, bool foreground);
+// Copies the window's cached decoration into fb, re-rendering it first if needed.
+// Only the parts inside the clip rects are touched.
+void draw_window_box(uint16_t *fb, window_t *window, bool foreground, rect_array_t const *clip);
+void window_decoration_free(window_t *window);
@@ -0,0 +1,259 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compressed_file.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "why_io.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "compressed_file"
+
+// Keep in sync with misc/compress_elf.py
+#define COMPRESSED_MAGIC     0x345a5642 // "BVZ4"
+#define COMPRESSED_BLOCK_MAX (64 * 1024)
+
+#define LZ4_MIN_MATCH 4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size; // Of the contents
+    uint32_t block_size;
+    uint32_t num_blocks;
+    // Followed by num_blocks + 1 file offsets, the last one is the end of the last block
+} compressed_header_t;
+
+struct compressed_file {
+    int       fd;
+    uint32_t  size;
+    uint32_t  block_size;
+    uint32_t  num_blocks;
+    uint32_t *offsets; // NULL if the file is stored as it is
+    uint8_t  *packed;  // What is stored of a block
+    uint8_t  *block;   // Block cached, its contents
+    uint32_t  cached;  // num_blocks if there is none
+};
+
+// Add the bytes that extend a literal or match length of 15
+static bool lz4_length(uint8_t const **src, uint8_t const *src_end, size_t *length) {
+    uint8_t byte;
+
+    do {
+        if (*src == src_end) {
+            return false;
+        }
+        byte     = *(*src)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz4_decompress(uint8_t const *src, size_t src_size, uint8_t *dst, size_t dst_size) {
+    uint8_t const *src_end = src + src_size;
+    uint8_t       *out     = dst;
+    uint8_t       *dst_end = dst + dst_size;
+
+    while (src < src_end) {
+        uint8_t token    = *src++;
+        size_t  literals = token >> 4;
+        if (literals == 15 && !lz4_length(&src, src_end, &literals)) {
+            return false;
+        }
+        if (literals > src_end - src || literals > dst_end - out) {
+            return false;
+        }
+        memcpy(out, src, literals);
+        src += literals;
+        out += literals;
+
+        // The last sequence has no match
+        if (src == src_end) {
+            break;
+        }
+
+        if (src_end - src < 2) {
+            return false;
+        }
+        size_t offset  = src[0] | (src[1] << 8);
+        src           += 2;
+        if (!offset || offset > out - dst) {
+            return false;
+        }
+
+        size_t length = token & 15;
+        if (length == 15 && !lz4_length(&src, src_end, &length)) {
+            return false;
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > dst_end - out) {
+            return false;
+        }
+
+        uint8_t const *match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+            out += length;
+        } else {
+            // Overlapping, it repeats the last offset bytes
+            while (length--) {
+                *out++ = *match++;
+            }
+        }
+    }
+    return out == dst_end;
+}
+
+static uint32_t compressed_file_block_size(compressed_file_t const *file, uint32_t index) {
+    return MIN(file->block_size, file->size - index * file->block_size);
+}
+
+// Read the contents of block index to dst, which has room for all of it
+static bool compressed_file_block_read(compressed_file_t *file, uint32_t index, uint8_t *dst) {
+    uint32_t offset = file->offsets[index];
+    uint32_t packed = file->offsets[index + 1] - offset;
+    uint32_t size   = compressed_file_block_size(file, index);
+
+    // Blocks that don't get smaller are stored as they are
+    if (packed > size || why_lseek(file->fd, offset, SEEK_SET) != offset) {
+        return false;
+    }
+    if (packed == size) {
+        return why_read(file->fd, dst, size) == size;
+    }
+    return why_read(file->fd, file->packed, packed) == packed && lz4_decompress(file->packed, packed, dst, size);
+}
+
+compressed_file_t *compressed_file_open(char const *path) {
+    // Runs in the user task before its heap exists, or while it belongs to the image
+    compressed_file_t *file = heap_caps_calloc(1, sizeof(compressed_file_t), MALLOC_CAP_SPIRAM);
+    if (!file) {
+        return NULL;
+    }
+
+    file->fd = why_open(path, O_RDONLY, 0);
+    if (file->fd == -1) {
+        heap_caps_free(file);
+        return NULL;
+    }
+
+    compressed_header_t header;
+    if (why_read(file->fd, &header, sizeof(header)) != sizeof(header) || header.magic != COMPRESSED_MAGIC) {
+        off_t size = why_lseek(file->fd, 0, SEEK_END);
+        if (size == -1) {
+            goto fail;
+        }
+        file->size = size;
+        return file;
+    }
+
+    if (!header.block_size || header.block_size > COMPRESSED_BLOCK_MAX ||
+        header.num_blocks != (header.size + header.block_size - 1) / header.block_size) {
+        ESP_LOGE(TAG, "Invalid header in %s", path);
+        goto fail;
+    }
+
+    file->size       = header.size;
+    file->block_size = header.block_size;
+    file->num_blocks = header.num_blocks;
+    file->cached     = header.num_blocks;
+
+    size_t offsets_size = (header.num_blocks + 1) * sizeof(uint32_t);
+    file->offsets       = heap_caps_malloc(offsets_size, MALLOC_CAP_SPIRAM);
+    file->packed        = heap_caps_malloc(header.block_size, MALLOC_CAP_SPIRAM);
+    file->block         = heap_caps_malloc(header.block_size, MALLOC_CAP_SPIRAM);
+    if (!file->offsets || !file->packed || !file->block) {
+        ESP_LOGE(TAG, "Out of memory opening %s", path);
+        goto fail;
+    }
+
+    if (why_read(file->fd, file->offsets, offsets_size) != offsets_size) {
+        ESP_LOGE(TAG, "Unable to read the block table of %s", path);
+        goto fail;
+    }
+    for (uint32_t i = 0; i < header.num_blocks; ++i) {
+        if (file->offsets[i] > file->offsets[i + 1]) {
+            ESP_LOGE(TAG, "Invalid block table in %s", path);
+            goto fail;
+        }
+    }
+    return file;
+
+fail:
+    compressed_file_close(file);
+    return NULL;
+}
+
+void compressed_file_close(compressed_file_t *file) {
+    if (!file) {
+        return;
+    }
+
+    why_close(file->fd);
+    heap_caps_free(file->offsets);
+    heap_caps_free(file->packed);
+    heap_caps_free(file->block);
+    heap_caps_free(file);
+}
+
+uint32_t compressed_file_size(compressed_file_t const *file) {
+    return file->size;
+}
+
+int compressed_file_fd(compressed_file_t const *file) {
+    return file->fd;
+}
+
+bool compressed_file_pread(compressed_file_t *file, uint32_t offset, void *buf, size_t size) {
+    if (!file->offsets) {
+        return why_lseek(file->fd, offset, SEEK_SET) == offset && why_read(file->fd, buf, size) == size;
+    }
+
+    if (offset > file->size || size > file->size - offset) {
+        return false;
+    }
+
+    uint8_t *out = buf;
+    while (size) {
+        uint32_t index      = offset / file->block_size;
+        uint32_t start      = offset % file->block_size;
+        uint32_t block_size = compressed_file_block_size(file, index);
+        size_t   bytes      = MIN(size, block_size - start);
+
+        if (index == file->cached) {
+            memcpy(out, file->block + start, bytes);
+        } else if (bytes == block_size) {
+            if (!compressed_file_block_read(file, index, out)) {
+                return false;
+            }
+        } else {
+            if (!compressed_file_block_read(file, index, file->block)) {
+                file->cached = file->num_blocks;
+                return false;
+            }
+            file->cached = index;
+            memcpy(out, file->block + start, bytes);
+        }
+
+        out    += bytes;
+        offset += bytes;
+        size   -= bytes;
+    }
+    return true;
+}
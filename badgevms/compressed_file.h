@@ -0,0 +1,46 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Files stored as they are or compressed by misc/compress_elf.py, read at any
+// offset as if they were stored as they are. Compressed files are LZ4 blocks of
+// a fixed size behind a table of where each block starts, so a read only
+// decompresses the blocks it covers and reads of whole blocks decompress
+// straight into the destination. The last block read is kept around for reads
+// of parts of it, like the ELF loader does for headers and tables.
+typedef struct compressed_file compressed_file_t;
+
+// NULL if the file can't be opened or is compressed but damaged
+compressed_file_t *compressed_file_open(char const *path);
+// Accepts NULL
+void               compressed_file_close(compressed_file_t *file);
+
+// Of the contents, not of what is stored
+uint32_t compressed_file_size(compressed_file_t const *file);
+// The file as stored, to hash it
+int      compressed_file_fd(compressed_file_t const *file);
+
+// False if the contents don't have size bytes at offset, or they can't be read
+bool compressed_file_pread(compressed_file_t *file, uint32_t offset, void *buf, size_t size);
+
+// Decompress the LZ4 block of src_size bytes at src, false unless it is valid
+// and decompresses to exactly dst_size bytes. OTA deltas are packed the same way.
+bool lz4_decompress(uint8_t const *src, size_t src_size, uint8_t *dst, size_t dst_size);
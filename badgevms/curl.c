@@ -14,24 +14,47 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "curl/curl.h"
+#include "curl_private.h"
 
+#include "badgevms/io_ring.h"
 #include "esp_crt_bundle.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
 #include "task.h"
-#include "thirdparty/dlmalloc.h"
 #include "why_io.h"
 
+#include <ctype.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <time.h>
 
 static char const *TAG = "ESP_CURL";
 
+// Servers drop idle connections after a while, older ones aren't worth trying
+#define CURL_POOL_IDLE_US        (30 * 1000 * 1000)
+// Parsed CA chains kept around while nobody uses them
+#define CURL_CA_CHAINS           4
+// Of a response written to a file by CURLOPT_DOWNLOAD_TO_PATH, one block is
+// filled while the other is written
+#define CURL_DOWNLOAD_BLOCK_SIZE (32 * 1024)
+// Bounds of CURLOPT_BUFFERSIZE, like libcurl
+#define CURL_BUFFERSIZE_MIN      1024
+#define CURL_BUFFERSIZE_MAX      (512 * 1024)
+// Cookies of a process by domain
+#define CURL_COOKIE_BUCKETS      16
+// A changed cookie jar is written at most this often while transfers go on,
+// and always by curl_easy_cleanup()
+#define CURL_COOKIE_FLUSH_US     (30 * 1000 * 1000)
+
 typedef enum { CURL_SAMESITE_NONE = 0, CURL_SAMESITE_LAX, CURL_SAMESITE_STRICT } curl_samesite;
 
 typedef struct cookie_entry {
@@ -42,13 +65,54 @@ typedef struct cookie_entry {
     time_t               expires;
     bool                 secure;
     bool                 http_only;
+    bool                 host_only; // Not for subdomains of domain, it had no Domain attribute
     curl_samesite        samesite;
     struct cookie_entry *next;
 } cookie_entry_t;
 
+// The cookies of a process, shared by all of its handles and hashed by
+// domain. Changes are written behind to the last CURLOPT_COOKIEJAR set.
+typedef struct curl_cookie_jar {
+    atomic_int      lock; // See cookie_jar_lock()
+    cookie_entry_t *buckets[CURL_COOKIE_BUCKETS];
+    char           *path;
+    char           *loaded; // Files read already, each terminated, then an empty one
+    size_t          loaded_size;
+    bool            dirty;
+    int64_t         saved_at;
+} curl_cookie_jar_t;
+
+// An esp_http_client and what it was set up with. It stays connected after a
+// transfer, for the next one by its handle or, through the pool of the
+// process, by another handle to the same origin. Like the client it lives on
+// the heap of the process, its TLS connection is a resource of the process.
+typedef struct curl_connection {
+    esp_http_client_handle_t client;
+    char                    *key;     // See curl_connection_key()
+    char                    *headers; // Names of the headers set on client, each terminated, then an empty one
+    size_t                   headers_size;
+    int64_t                  idle_since;
+} curl_connection_t;
+
+// A response going to a file. Full blocks are written by the thread of an
+// io ring, the file system sees few large writes instead of one per piece
+// the client hands us.
+typedef struct curl_download {
+    io_ring_t *ring;
+    int        fd;     // -1 until a response worth keeping arrives
+    off_t      offset; // Where the next block goes
+    char      *blocks[2];
+    size_t     sizes[2]; // Of the blocks being written
+    bool       writing[2];
+    int        current; // The block being filled
+    size_t     fill;
+    bool       failed;
+} curl_download_t;
+
 struct curl_handle {
     esp_http_client_handle_t esp_client;
     esp_http_client_config_t config;
+    curl_connection_t       *connection;
 
     curl_write_callback  write_function;
     void                *write_data;
@@ -59,7 +123,12 @@ struct curl_handle {
     size_t             post_data_size;
     struct curl_slist *headers;
 
-    cookie_entry_t *cookies;
+    char  *header_buf; // "Key: Value" for the header callback, kept for the next one
+    size_t header_buf_size;
+    char  *write_buf; // Response data collected for the write callback, see curl_write()
+    size_t write_buf_size;
+    size_t write_fill;
+
     char           *cookie_file;
     char           *cookie_jar;
     char           *manual_cookies;
@@ -75,7 +144,17 @@ struct curl_handle {
     char   *content_type;
     char   *effective_url;
 
+    curl_transfer_t *transfer; // Run by a multi handle, see curl_multi.c
+
+    char            *range;
+    long             resume_from; // -1 to continue a download where the file ends
+    off_t            resume_offset;
+    char            *download_path;
+    curl_download_t *download;
+    int64_t          size_download;
+
     bool configured;
+    bool delivered; // Something of the response went to the callbacks
     bool verbose;
     bool ssl_verify_peer;
     long http_auth;
@@ -97,19 +176,11 @@ static void free_cookie(cookie_entry_t *cookie) {
     if (!cookie)
         return;
 
-    dlfree(cookie->name);
-    dlfree(cookie->value);
-    dlfree(cookie->domain);
-    dlfree(cookie->path);
-    dlfree(cookie);
-}
-
-static void free_all_cookies(cookie_entry_t *cookies) {
-    while (cookies) {
-        cookie_entry_t *next = cookies->next;
-        free_cookie(cookies);
-        cookies = next;
-    }
+    why_free(cookie->name);
+    why_free(cookie->value);
+    why_free(cookie->domain);
+    why_free(cookie->path);
+    why_free(cookie);
 }
 
 static cookie_entry_t *parse_set_cookie(char const *set_cookie_header) {
@@ -120,15 +191,15 @@ static cookie_entry_t *parse_set_cookie(char const *set_cookie_header) {
 
     ESP_LOGW(TAG, "Parsing header '%s'", set_cookie_header);
 
-    cookie_entry_t *cookie = dlcalloc(1, sizeof(cookie_entry_t));
+    cookie_entry_t *cookie = why_calloc(1, sizeof(cookie_entry_t));
     if (!cookie) {
-        ESP_LOGW(TAG, "Cookie dlmalloc failed (cookie)");
+        ESP_LOGW(TAG, "Cookie malloc failed (cookie)");
         return NULL;
     }
 
     char *header_copy = why_strdup(set_cookie_header);
     if (!header_copy) {
-        ESP_LOGW(TAG, "Cookie dlmalloc failed (header_copy)");
+        ESP_LOGW(TAG, "Cookie malloc failed (header_copy)");
         free_cookie(cookie);
         return NULL;
     }
@@ -166,27 +237,27 @@ static cookie_entry_t *parse_set_cookie(char const *set_cookie_header) {
 
         if (!cookie->name || !cookie->value) {
             ESP_LOGW(TAG, "No name or no value for '%s'", header_copy);
-            dlfree(header_copy);
+            why_free(header_copy);
             free_cookie(cookie);
             return NULL;
         }
     } else {
         ESP_LOGW(TAG, "No = for '%s'", header_copy);
-        dlfree(header_copy);
+        why_free(header_copy);
         free_cookie(cookie);
         return NULL;
     }
 
-    cookie->domain    = why_strdup("example.com");
+    cookie->domain    = NULL; // The host of the request, see curl_store_cookie()
     cookie->path      = why_strdup("/");
     cookie->expires   = 0;
     cookie->secure    = false;
     cookie->http_only = false;
     cookie->samesite  = CURL_SAMESITE_NONE; // Default per RFC
 
-    if (!cookie->domain || !cookie->path) {
-        ESP_LOGW(TAG, "No domain or cookie path for '%s'", header_copy);
-        dlfree(header_copy);
+    if (!cookie->path) {
+        ESP_LOGW(TAG, "No cookie path for '%s'", header_copy);
+        why_free(header_copy);
         free_cookie(cookie);
         return NULL;
     }
@@ -230,20 +301,20 @@ static cookie_entry_t *parse_set_cookie(char const *set_cookie_header) {
                 }
 
                 if (strcasecmp(attr_name, "domain") == 0) {
-                    dlfree(cookie->domain);
+                    why_free(cookie->domain);
                     cookie->domain = why_strdup(attr_value);
                     if (!cookie->domain) {
                         ESP_LOGW(TAG, "No domain for '%s'", header_copy);
-                        dlfree(header_copy);
+                        why_free(header_copy);
                         free_cookie(cookie);
                         return NULL;
                     }
                 } else if (strcasecmp(attr_name, "path") == 0) {
-                    dlfree(cookie->path);
+                    why_free(cookie->path);
                     cookie->path = why_strdup(attr_value);
                     if (!cookie->path) {
                         ESP_LOGW(TAG, "No path for '%s'", header_copy);
-                        dlfree(header_copy);
+                        why_free(header_copy);
                         free_cookie(cookie);
                         return NULL;
                     }
@@ -301,86 +372,285 @@ static cookie_entry_t *parse_set_cookie(char const *set_cookie_header) {
         }
     }
 
-    dlfree(header_copy);
+    why_free(header_copy);
     return cookie;
 }
 
-static void add_cookie(curl_handle_t *curl, cookie_entry_t *new_cookie) {
-    if (!curl || !new_cookie)
+// The host of url, lowercased, without user info or port. False if it doesn't fit.
+static bool curl_url_host(char const *url, char *host, size_t size) {
+    char const *start = url ? strstr(url, "://") : NULL;
+    if (!start) {
+        return false;
+    }
+    start      += 3;
+    size_t len  = strcspn(start, "/?#");
+
+    char const *at = memchr(start, '@', len);
+    if (at) {
+        len   -= at + 1 - start;
+        start  = at + 1;
+    }
+
+    char const *colon = memchr(start, ':', len);
+    if (colon) {
+        len = colon - start;
+    }
+
+    if (!len || len >= size) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        host[i] = (char)tolower((unsigned char)start[i]);
+    }
+    host[len] = '\0';
+    return true;
+}
+
+// Where the path of url starts, its length goes to len. An empty path is "/".
+static char const *curl_url_path(char const *url, size_t *len) {
+    char const *host = url ? strstr(url, "://") : NULL;
+    char const *path = host ? host + 3 + strcspn(host + 3, "/?#") : "";
+    if (*path != '/') {
+        *len = 1;
+        return "/";
+    }
+    *len = strcspn(path, "?#");
+    return path;
+}
+
+static uint32_t cookie_domain_hash(char const *domain) {
+    uint32_t hash = 2166136261u;
+    for (char const *c = domain; *c; ++c) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*c)) * 16777619u;
+    }
+    return hash % CURL_COOKIE_BUCKETS;
+}
+
+// Handles of a process and the workers of its multi handles get at the jar
+// at the same time. Held only for walking a bucket or writing the file, so
+// a futex with 0 free, 1 taken and 2 taken with waiters will do.
+static void cookie_jar_lock(curl_cookie_jar_t *jar) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&jar->lock, &expected, 1)) {
         return;
+    }
+    while (atomic_exchange(&jar->lock, 2)) {
+        futex_wait((int *)&jar->lock, 2, 0);
+    }
+}
+
+static void cookie_jar_unlock(curl_cookie_jar_t *jar) {
+    if (atomic_exchange(&jar->lock, 0) == 2) {
+        futex_wake((int *)&jar->lock, 1);
+    }
+}
+
+// The jar of the calling process, created on first use
+static curl_cookie_jar_t *cookie_jar_get(void) {
+    task_thread_t     *thread = get_task_info()->thread;
+    curl_cookie_jar_t *jar    = (curl_cookie_jar_t *)atomic_load(&thread->curl_cookie_jar);
+    if (jar) {
+        return jar;
+    }
+
+    jar = why_calloc(1, sizeof(curl_cookie_jar_t));
+    if (!jar) {
+        return NULL;
+    }
+
+    uintptr_t expected = 0;
+    if (!atomic_compare_exchange_strong(&thread->curl_cookie_jar, &expected, (uintptr_t)jar)) {
+        why_free(jar);
+        jar = (curl_cookie_jar_t *)expected;
+    }
+    return jar;
+}
+
+static bool cookie_expired(cookie_entry_t *cookie, time_t now) {
+    return cookie->expires > 0 && cookie->expires < now;
+}
+
+// Does host fall under the domain of a cookie, the domain itself or a
+// subdomain of it
+static bool cookie_domain_match(char const *domain, char const *host) {
+    size_t domain_len = strlen(domain);
+    size_t host_len   = strlen(host);
+
+    if (host_len == domain_len) {
+        return strcasecmp(host, domain) == 0;
+    }
+    return host_len > domain_len && host[host_len - domain_len - 1] == '.' &&
+           strcasecmp(host + host_len - domain_len, domain) == 0;
+}
+
+static bool cookie_path_match(char const *cookie_path, char const *path, size_t path_len) {
+    size_t len = strlen(cookie_path);
+    if (len > path_len || strncmp(cookie_path, path, len)) {
+        return false;
+    }
+    return len == path_len || cookie_path[len - 1] == '/' || path[len] == '/';
+}
+
+// Takes over new_cookie. One with the same name, domain and path is replaced,
+// an expired one only removes it.
+static void add_cookie(curl_cookie_jar_t *jar, cookie_entry_t *new_cookie) {
+    time_t           now     = time(NULL);
+    cookie_entry_t **bucket  = &jar->buckets[cookie_domain_hash(new_cookie->domain)];
+    cookie_entry_t **current = bucket;
 
-    cookie_entry_t **current = &curl->cookies;
+    cookie_jar_lock(jar);
     while (*current) {
-        if (strcmp((*current)->name, new_cookie->name) == 0) {
-            cookie_entry_t *to_remove = *current;
-            *current                  = (*current)->next;
-            free_cookie(to_remove);
-            break;
+        cookie_entry_t *cookie = *current;
+        if (cookie_expired(cookie, now) ||
+            (strcmp(cookie->name, new_cookie->name) == 0 && strcasecmp(cookie->domain, new_cookie->domain) == 0 &&
+             strcmp(cookie->path, new_cookie->path) == 0)) {
+            *current = cookie->next;
+            free_cookie(cookie);
+            continue;
         }
-        current = &(*current)->next;
+        current = &cookie->next;
     }
 
-    new_cookie->next = curl->cookies;
-    curl->cookies    = new_cookie;
+    if (cookie_expired(new_cookie, now)) {
+        free_cookie(new_cookie);
+    } else {
+        new_cookie->next = *bucket;
+        *bucket          = new_cookie;
+    }
+    jar->dirty = true;
+    cookie_jar_unlock(jar);
 }
 
-static char *build_cookie_header(curl_handle_t *curl) {
-    if (!curl->cookies && !curl->manual_cookies)
-        return NULL;
+// Append the cookies of one bucket that go to host and path. Only the bucket
+// of a domain host falls under is looked at, expired cookies are dropped on
+// the way.
+static size_t cookie_bucket_append(
+    curl_cookie_jar_t *jar,
+    char const        *domain,
+    char const        *host,
+    char const        *path,
+    size_t             path_len,
+    bool               secure,
+    char              *result,
+    size_t             len,
+    time_t             now
+) {
+    cookie_entry_t **current = &jar->buckets[cookie_domain_hash(domain)];
+    while (*current) {
+        cookie_entry_t *cookie = *current;
+        if (cookie_expired(cookie, now)) {
+            *current   = cookie->next;
+            jar->dirty = true;
+            free_cookie(cookie);
+            continue;
+        }
+        current = &cookie->next;
 
-    size_t total_len = 0;
-    char  *result    = NULL;
+        if (strcasecmp(cookie->domain, domain) || (cookie->host_only && strcasecmp(domain, host)) ||
+            (cookie->secure && !secure) || !cookie_path_match(cookie->path, path, path_len)) {
+            continue;
+        }
 
-    if (curl->manual_cookies) {
-        total_len += strlen(curl->manual_cookies);
+        size_t name_len  = strlen(cookie->name);
+        size_t value_len = strlen(cookie->value);
+        if (result) {
+            if (len) {
+                memcpy(result + len, "; ", 2);
+            }
+            memcpy(result + len + (len ? 2 : 0), cookie->name, name_len);
+            result[len + (len ? 2 : 0) + name_len] = '=';
+            memcpy(result + len + (len ? 2 : 0) + name_len + 1, cookie->value, value_len);
+        }
+        len += (len ? 2 : 0) + name_len + 1 + value_len;
     }
+    return len;
+}
 
-    cookie_entry_t *cookie = curl->cookies;
-    while (cookie) {
-        if (total_len > 0)
-            total_len += 2;                                            // "; "
-        total_len += strlen(cookie->name) + 1 + strlen(cookie->value); // name=value
-        cookie     = cookie->next;
+// Walk host and every parent domain of it, sizing the header when result is NULL
+static size_t cookie_jar_append(
+    curl_cookie_jar_t *jar, char const *host, char const *path, size_t path_len, bool secure, char *result, size_t len
+) {
+    time_t now = time(NULL);
+    for (char const *domain = host; domain; domain = strchr(domain, '.')) {
+        if (*domain == '.') {
+            ++domain;
+        }
+        len = cookie_bucket_append(jar, domain, host, path, path_len, secure, result, len, now);
     }
+    return len;
+}
 
-    if (total_len == 0)
-        return NULL;
-
-    result = dlmalloc(total_len + 1);
-    if (!result)
-        return NULL;
+static char *build_cookie_header(curl_handle_t *curl) {
+    char               host[256];
+    size_t             path_len = 0;
+    char const        *path     = curl_url_path(curl->config.url, &path_len);
+    bool               secure   = curl->config.url && strncasecmp(curl->config.url, "https:", 6) == 0;
+    curl_cookie_jar_t *jar      = NULL;
+
+    if (curl_url_host(curl->config.url, host, sizeof(host))) {
+        jar = (curl_cookie_jar_t *)atomic_load(&get_task_info()->thread->curl_cookie_jar);
+    }
 
-    result[0] = '\0';
+    size_t manual_len = curl->manual_cookies ? strlen(curl->manual_cookies) : 0;
+    char  *result     = NULL;
 
-    if (curl->manual_cookies) {
-        strcat(result, curl->manual_cookies);
+    if (jar) {
+        cookie_jar_lock(jar);
     }
 
-    cookie = curl->cookies;
-    while (cookie) {
-        if (strlen(result) > 0)
-            strcat(result, "; ");
-        strcat(result, cookie->name);
-        strcat(result, "=");
-        strcat(result, cookie->value);
-        cookie = cookie->next;
+    size_t total_len = jar ? cookie_jar_append(jar, host, path, path_len, secure, NULL, manual_len) : manual_len;
+    if (total_len) {
+        result = why_malloc(total_len + 1);
+    }
+    if (result) {
+        if (manual_len) {
+            memcpy(result, curl->manual_cookies, manual_len);
+        }
+        if (jar) {
+            cookie_jar_append(jar, host, path, path_len, secure, result, manual_len);
+        }
+        result[total_len] = '\0';
     }
 
+    if (jar) {
+        cookie_jar_unlock(jar);
+    }
     return result;
 }
 
-static int load_cookies_from_file(curl_handle_t *curl, char const *filename) {
-    if (!curl || !filename)
+// Each file is read once per process, later handles pointed at it share
+// what is in the jar already
+static int load_cookies_from_file(curl_cookie_jar_t *jar, char const *filename) {
+    if (!jar || !filename)
         return -1;
 
+    cookie_jar_lock(jar);
+    for (char const *loaded = jar->loaded; loaded && *loaded; loaded += strlen(loaded) + 1) {
+        if (strcmp(loaded, filename) == 0) {
+            cookie_jar_unlock(jar);
+            return 0;
+        }
+    }
+
+    size_t filename_size = strlen(filename) + 1;
+    char  *loaded        = why_realloc(jar->loaded, jar->loaded_size + filename_size + 1);
+    if (loaded) {
+        memcpy(loaded + jar->loaded_size, filename, filename_size);
+        jar->loaded_size         += filename_size;
+        loaded[jar->loaded_size]  = '\0';
+        jar->loaded               = loaded;
+    }
+    cookie_jar_unlock(jar);
+
     FILE *file = why_fopen(filename, "r");
     if (!file) {
         ESP_LOGW(TAG, "Cookie file not found or can't be opened: %s", filename);
         return 0;
     }
 
-    char line[512];
-    int  cookies_loaded = 0;
+    char   line[512];
+    int    cookies_loaded = 0;
+    time_t current_time   = time(NULL);
 
     while (why_fgets(line, sizeof(line), file)) {
         if (line[0] == '\n' || line[0] == '#' || line[0] == '\0') {
@@ -406,41 +676,45 @@ static int load_cookies_from_file(curl_handle_t *curl, char const *filename) {
             continue;
         }
 
-        cookie_entry_t *cookie = dlcalloc(1, sizeof(cookie_entry_t));
+        time_t expires = (time_t)atol(expires_str);
+        if (expires > 0 && expires < current_time) {
+            ESP_LOGW(TAG, "Skipping expired cookie: %s", name);
+            continue;
+        }
+
+        cookie_entry_t *cookie = why_calloc(1, sizeof(cookie_entry_t));
         if (!cookie) {
             ESP_LOGE(TAG, "Failed to allocate memory for cookie");
             continue;
         }
 
+        // A leading dot marks a cookie for subdomains too
+        cookie->host_only = domain[0] != '.';
         cookie->name      = why_strdup(name);
         cookie->value     = why_strdup(value);
-        cookie->domain    = why_strdup(domain);
+        cookie->domain    = why_strdup(cookie->host_only ? domain : domain + 1);
         cookie->path      = why_strdup(path);
-        cookie->expires   = (time_t)atol(expires_str);
+        cookie->expires   = expires;
         cookie->secure    = (atoi(secure_str) != 0);
         cookie->http_only = (atoi(http_only_str) != 0);
-        cookie->samesite  = (atoi(samesite_str) != 0);
+        cookie->samesite  = (curl_samesite)atoi(samesite_str);
 
-        time_t current_time = time(NULL);
-        if (cookie->expires > 0 && cookie->expires < current_time) {
-            ESP_LOGW(TAG, "Skipping expired cookie: %s", cookie->name);
+        if (!cookie->name || !cookie->value || !cookie->domain || !cookie->path) {
             free_cookie(cookie);
             continue;
         }
 
-        add_cookie(curl, cookie);
+        add_cookie(jar, cookie);
         cookies_loaded++;
     }
 
     why_fclose(file);
-    ESP_LOGW(TAG, "Loaded %d cookies from file: %s", cookies_loaded, filename);
+    ESP_LOGI(TAG, "Loaded %d cookies from file: %s", cookies_loaded, filename);
     return cookies_loaded;
 }
 
-static int save_cookies_to_file(curl_handle_t *curl, char const *filename) {
-    if (!curl || !filename)
-        return -1;
-
+// Called with the jar locked
+static int save_cookies_to_file(curl_cookie_jar_t *jar, char const *filename) {
     FILE *file = why_fopen(filename, "w");
     if (!file) {
         ESP_LOGE(TAG, "Failed to open cookie file for writing: %s", filename);
@@ -453,41 +727,304 @@ static int save_cookies_to_file(curl_handle_t *curl, char const *filename) {
     int    cookies_saved = 0;
     time_t current_time  = time(NULL);
 
-    cookie_entry_t *cookie = curl->cookies;
-    while (cookie) {
-        if (cookie->expires > 0 && cookie->expires < current_time) {
-            ESP_LOGW(TAG, "Skipping expired cookie when saving: %s", cookie->name);
-            cookie = cookie->next;
-            continue;
-        }
-        ESP_LOGW(TAG, "Saving cookie: %s", cookie->name);
-
-        why_fprintf(
-            file,
-            "%s\t%s\t%s\t%s\t%ld\t%d\t%d\t%d\t\n",
-            cookie->name ? cookie->name : "",
-            cookie->value ? cookie->value : "",
-            cookie->domain ? cookie->domain : "",
-            cookie->path ? cookie->path : "",
-            (long)cookie->expires,
-            cookie->secure ? 1 : 0,
-            cookie->http_only ? 1 : 0,
-            cookie->samesite ? 1 : 0
-        );
+    for (int i = 0; i < CURL_COOKIE_BUCKETS; ++i) {
+        cookie_entry_t **current = &jar->buckets[i];
+        while (*current) {
+            cookie_entry_t *cookie = *current;
+            if (cookie_expired(cookie, current_time)) {
+                *current = cookie->next;
+                free_cookie(cookie);
+                continue;
+            }
 
-        cookies_saved++;
-        cookie = cookie->next;
+            why_fprintf(
+                file,
+                "%s\t%s\t%s%s\t%s\t%ld\t%d\t%d\t%d\t\n",
+                cookie->name,
+                cookie->value,
+                cookie->host_only ? "" : ".",
+                cookie->domain,
+                cookie->path,
+                (long)cookie->expires,
+                cookie->secure ? 1 : 0,
+                cookie->http_only ? 1 : 0,
+                (int)cookie->samesite
+            );
+
+            cookies_saved++;
+            current = &cookie->next;
+        }
     }
 
-    ESP_LOGW(TAG, "Closing jar");
     why_fclose(file);
-    ESP_LOGW(TAG, "Saved %d cookies to file: %s", cookies_saved, filename);
+    ESP_LOGI(TAG, "Saved %d cookies to file: %s", cookies_saved, filename);
     return cookies_saved;
 }
 
+static void cookie_jar_set_path(curl_cookie_jar_t *jar, char const *filename) {
+    char *path = filename ? why_strdup(filename) : NULL;
+    if (!jar || !path) {
+        why_free(path);
+        return;
+    }
+
+    cookie_jar_lock(jar);
+    why_free(jar->path);
+    jar->path  = path;
+    jar->dirty = true;
+    cookie_jar_unlock(jar);
+}
+
+// Write the jar out if anything changed, unless that was done less than
+// CURL_COOKIE_FLUSH_US ago and force isn't set
+static void cookie_jar_flush(curl_cookie_jar_t *jar, bool force) {
+    if (!jar) {
+        return;
+    }
+
+    cookie_jar_lock(jar);
+    int64_t now = esp_timer_get_time();
+    if (jar->dirty && jar->path && (force || now - jar->saved_at >= CURL_COOKIE_FLUSH_US)) {
+        if (save_cookies_to_file(jar, jar->path) >= 0) {
+            jar->dirty    = false;
+            jar->saved_at = now;
+        }
+    }
+    cookie_jar_unlock(jar);
+}
+
+// Without a Domain attribute a cookie goes back to the host that set it only.
+// With one it must be a domain the host falls under.
+static void curl_store_cookie(curl_handle_t *curl, cookie_entry_t *cookie) {
+    char               host[256];
+    curl_cookie_jar_t *jar = cookie_jar_get();
+
+    if (!jar || !curl_url_host(curl->config.url, host, sizeof(host))) {
+        free_cookie(cookie);
+        return;
+    }
+
+    if (cookie->domain && cookie->domain[0] == '.') {
+        memmove(cookie->domain, cookie->domain + 1, strlen(cookie->domain));
+    }
+
+    if (!cookie->domain || !cookie->domain[0]) {
+        why_free(cookie->domain);
+        cookie->domain    = why_strdup(host);
+        cookie->host_only = true;
+        if (!cookie->domain) {
+            free_cookie(cookie);
+            return;
+        }
+    } else if (!cookie_domain_match(cookie->domain, host)) {
+        ESP_LOGW(TAG, "Ignoring cookie %s for %s from %s", cookie->name, cookie->domain, host);
+        free_cookie(cookie);
+        return;
+    }
+
+    add_cookie(jar, cookie);
+}
+
+void curl_easy_deliver(CURL *curl_handle, bool header, void *data, size_t size) {
+    curl_handle_t *curl = (curl_handle_t *)curl_handle;
+
+    if (header && curl->header_function) {
+        curl->header_function(data, 1, size, curl->header_data);
+    } else if (!header && curl->write_function) {
+        curl->write_function(data, 1, size, curl->write_data);
+    }
+}
+
+void curl_easy_set_transfer(CURL *curl_handle, curl_transfer_t *transfer) {
+    ((curl_handle_t *)curl_handle)->transfer = transfer;
+}
+
+// Part of the response, for the callbacks or for the multi handle running the transfer
+static void curl_deliver(curl_handle_t *curl, bool header, void *data, size_t size) {
+    if (curl->transfer) {
+        curl_transfer_write(curl->transfer, header, data, size);
+    } else {
+        curl_easy_deliver(curl, header, data, size);
+    }
+}
+
+// With CURLOPT_BUFFERSIZE set the write callback gets the response in pieces
+// of that size, however small the ones the client reads are. Without it every
+// piece goes through as soon as it arrives.
+static void curl_write(curl_handle_t *curl, char const *data, size_t size) {
+    if (curl->write_buf_size && !curl->write_buf) {
+        curl->write_buf = why_malloc(curl->write_buf_size);
+    }
+    if (!curl->write_buf) {
+        curl_deliver(curl, false, (void *)data, size);
+        return;
+    }
+
+    while (size) {
+        // Nothing to add it to, no point in copying
+        if (!curl->write_fill && size >= curl->write_buf_size) {
+            curl_deliver(curl, false, (void *)data, size);
+            return;
+        }
+
+        size_t room = MIN(size, curl->write_buf_size - curl->write_fill);
+        memcpy(curl->write_buf + curl->write_fill, data, room);
+        curl->write_fill += room;
+        data             += room;
+        size             -= room;
+
+        if (curl->write_fill == curl->write_buf_size) {
+            curl_deliver(curl, false, curl->write_buf, curl->write_fill);
+            curl->write_fill = 0;
+        }
+    }
+}
+
+// Whatever curl_write() is holding on to, at the end of a response
+static void curl_write_flush(curl_handle_t *curl) {
+    if (curl->write_fill) {
+        curl_deliver(curl, false, curl->write_buf, curl->write_fill);
+        curl->write_fill = 0;
+    }
+}
+
+static curl_download_t *curl_download_start(void) {
+    curl_download_t *download = why_calloc(1, sizeof(curl_download_t));
+    if (!download) {
+        return NULL;
+    }
+
+    download->fd        = -1;
+    download->ring      = io_ring_create(2);
+    download->blocks[0] = why_malloc(CURL_DOWNLOAD_BLOCK_SIZE);
+    download->blocks[1] = why_malloc(CURL_DOWNLOAD_BLOCK_SIZE);
+    if (!download->ring || !download->blocks[0] || !download->blocks[1]) {
+        io_ring_destroy(download->ring);
+        why_free(download->blocks[0]);
+        why_free(download->blocks[1]);
+        why_free(download);
+        return NULL;
+    }
+
+    return download;
+}
+
+// Wait for the oldest block being written
+static void curl_download_reap(curl_download_t *download) {
+    io_completion_t completion;
+    io_ring_complete(download->ring, &completion, UINT32_MAX);
+
+    int block                = completion.user_data;
+    download->writing[block] = false;
+    if (completion.result != (ssize_t)download->sizes[block]) {
+        ESP_LOGE(TAG, "Unable to write a download: %s", strerror(completion.error));
+        download->failed = true;
+    }
+}
+
+// Hand the current block to the ring, and wait until the other one is free
+static void curl_download_flush(curl_download_t *download) {
+    if (!download->fill || download->failed) {
+        return;
+    }
+
+    int          block   = download->current;
+    io_request_t request = {
+        .op        = IO_OP_WRITE,
+        .fd        = download->fd,
+        .buf       = download->blocks[block],
+        .count     = download->fill,
+        .offset    = download->offset,
+        .user_data = block,
+    };
+    if (!io_ring_submit(download->ring, &request)) {
+        download->failed = true;
+        return;
+    }
+
+    download->sizes[block]    = download->fill;
+    download->writing[block]  = true;
+    download->offset         += download->fill;
+    download->fill            = 0;
+    download->current         = !block;
+
+    while (download->writing[download->current]) {
+        curl_download_reap(download);
+    }
+}
+
+static void curl_download_write(curl_handle_t *curl, char const *data, size_t size) {
+    curl_download_t *download = curl->download;
+    if (download->failed) {
+        return;
+    }
+
+    // Error pages and redirects don't replace the file. A partial response
+    // continues it, anything else starts it over.
+    if (download->fd == -1) {
+        int status = esp_http_client_get_status_code(curl->esp_client);
+        if (status < 200 || status > 299) {
+            return;
+        }
+
+        bool resumed     = status == 206 && curl->resume_offset;
+        download->offset = resumed ? curl->resume_offset : 0;
+        download->fd     = why_open(curl->download_path, O_WRONLY | O_CREAT | (resumed ? 0 : O_TRUNC), 0644);
+        if (download->fd == -1) {
+            ESP_LOGE(TAG, "Unable to open %s", curl->download_path);
+            download->failed = true;
+            return;
+        }
+    }
+
+    while (size) {
+        size_t room = MIN(size, CURL_DOWNLOAD_BLOCK_SIZE - download->fill);
+        memcpy(download->blocks[download->current] + download->fill, data, room);
+        download->fill += room;
+        data           += room;
+        size           -= room;
+
+        if (download->fill == CURL_DOWNLOAD_BLOCK_SIZE) {
+            curl_download_flush(download);
+        }
+    }
+}
+
+// Write what is left and close the file. Returns false if any of it failed.
+static bool curl_download_finish(curl_handle_t *curl, bool complete) {
+    curl_download_t *download = curl->download;
+    curl->download            = NULL;
+
+    // An empty response creates an empty file
+    if (complete && download->fd == -1 && !download->failed) {
+        curl_download_write(curl, NULL, 0);
+    }
+
+    curl_download_flush(download);
+    while (download->writing[0] || download->writing[1]) {
+        curl_download_reap(download);
+    }
+
+    if (download->fd != -1 && why_close(download->fd)) {
+        download->failed = true;
+    }
+
+    bool ok = !download->failed;
+    io_ring_destroy(download->ring);
+    why_free(download->blocks[0]);
+    why_free(download->blocks[1]);
+    why_free(download);
+    return ok;
+}
+
 static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     curl_handle_t *curl = (curl_handle_t *)evt->user_data;
 
+    // An idle connection
+    if (!curl) {
+        return ESP_OK;
+    }
+
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR:
             if (curl->verbose) {
@@ -508,12 +1045,15 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
             break;
 
         case HTTP_EVENT_ON_HEADER:
+            // Known from here on, for callbacks that look before the end
+            curl->delivered     = true;
+            curl->response_code = esp_http_client_get_status_code(curl->esp_client);
             if (evt->header_key) {
                 if (strncasecmp(evt->header_key, "Set-Cookie", 10) == 0) {
                     if (evt->header_value) {
                         cookie_entry_t *cookie = parse_set_cookie(evt->header_value);
                         if (cookie) {
-                            add_cookie(curl, cookie);
+                            curl_store_cookie(curl, cookie);
                         }
                     }
                 }
@@ -522,21 +1062,33 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
             if (curl->header_function) {
                 size_t key_len = strlen(evt->header_key);
                 size_t val_len = strlen(evt->header_value);
+                size_t size    = key_len + val_len + 2;
+
+                if (size > curl->header_buf_size) {
+                    char *header_buf = why_realloc(curl->header_buf, size);
+                    if (!header_buf) {
+                        break;
+                    }
+                    curl->header_buf      = header_buf;
+                    curl->header_buf_size = size;
+                }
 
-                char *tmp_header = dlmalloc(key_len + val_len + 2);
-                memcpy(tmp_header, evt->header_key, key_len);
-                tmp_header[key_len]     = ':';
-                tmp_header[key_len + 1] = ' ';
-                memcpy(&tmp_header[key_len + 2], evt->header_value, val_len);
+                memcpy(curl->header_buf, evt->header_key, key_len);
+                curl->header_buf[key_len]     = ':';
+                curl->header_buf[key_len + 1] = ' ';
+                memcpy(&curl->header_buf[key_len + 2], evt->header_value, val_len);
 
-                curl->header_function(tmp_header, 1, key_len + val_len + 2, curl->header_data);
-                dlfree(tmp_header);
+                curl_deliver(curl, true, curl->header_buf, size);
             }
             break;
 
         case HTTP_EVENT_ON_DATA:
-            if (curl->write_function) {
-                curl->write_function(evt->data, 1, evt->data_len, curl->write_data);
+            curl->delivered      = true;
+            curl->size_download += evt->data_len;
+            if (curl->download) {
+                curl_download_write(curl, evt->data, evt->data_len);
+            } else if (curl->write_function) {
+                curl_write(curl, evt->data, evt->data_len);
             }
             break;
 
@@ -568,8 +1120,333 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
+// What a connection to url with the settings of curl has to match to be used
+// again: the origin and everything esp_http_client only takes at init
+static char *curl_connection_key(curl_handle_t *curl, char const *url) {
+    char const *host   = strstr(url, "://");
+    size_t      origin = host ? strcspn(host + 3, "/?#") + (host + 3 - url) : strlen(url);
+
+    // The CA certificate by hash, it can be large
+    uint32_t cert_hash = 2166136261u;
+    for (char const *c = curl->config.cert_pem; c && *c; ++c) {
+        cert_hash = (cert_hash ^ (uint8_t)*c) * 16777619u;
+    }
+
+    char *key = NULL;
+    why_asprintf(
+        &key,
+        "%.*s %p %08lx %d %d %d %s:%s %s",
+        (int)origin,
+        url,
+        curl->config.crt_bundle_attach,
+        (unsigned long)cert_hash,
+        curl->config.skip_cert_common_name_check,
+        curl->config.buffer_size,
+        curl->config.max_redirection_count,
+        curl->config.username ? curl->config.username : "",
+        curl->config.password ? curl->config.password : "",
+        curl->config.user_agent ? curl->config.user_agent : ""
+    );
+    return key;
+}
+
+static void curl_connection_destroy(curl_connection_t *connection) {
+    esp_http_client_cleanup(connection->client);
+    why_free(connection->key);
+    why_free(connection->headers);
+    why_free(connection);
+}
+
+// Takes key
+static curl_connection_t *curl_connection_create(curl_handle_t *curl, char *key) {
+    curl_connection_t *connection = why_calloc(1, sizeof(curl_connection_t));
+    if (!connection) {
+        why_free(key);
+        return NULL;
+    }
+
+    connection->key    = key;
+    connection->client = esp_http_client_init(&curl->config);
+    if (!connection->client) {
+        why_free(key);
+        why_free(connection);
+        return NULL;
+    }
+
+    return connection;
+}
+
+static void curl_connection_set_header(curl_connection_t *connection, char const *name, char const *value) {
+    size_t len     = strlen(name) + 1;
+    char  *headers = why_realloc(connection->headers, connection->headers_size + len + 1);
+    if (!headers) {
+        return;
+    }
+
+    memcpy(headers + connection->headers_size, name, len);
+    connection->headers                = headers;
+    connection->headers_size          += len;
+    headers[connection->headers_size]  = '\0';
+    esp_http_client_set_header(connection->client, name, value);
+}
+
+// Make a connection of another transfer ready for one of curl
+static void curl_connection_reset(curl_connection_t *connection, curl_handle_t *curl) {
+    esp_http_client_handle_t client = connection->client;
+
+    for (char const *name = connection->headers; name && *name; name += strlen(name) + 1) {
+        esp_http_client_delete_header(client, name);
+    }
+    connection->headers_size = 0;
+
+    esp_http_client_set_user_data(client, curl);
+    esp_http_client_set_url(client, curl->config.url);
+    esp_http_client_set_method(client, curl->config.method);
+    esp_http_client_set_timeout_ms(client, curl->config.timeout_ms);
+    esp_http_client_set_post_field(client, NULL, 0);
+}
+
+// Leave connection for others of this process. A full pool loses the one in
+// the first slot.
+static void curl_pool_put(curl_connection_t *connection) {
+    task_info_t *task_info = get_task_info();
+    if (!task_info->pid) {
+        curl_connection_destroy(connection);
+        return;
+    }
+
+    // Nobody to tell about a disconnect while it waits
+    esp_http_client_set_user_data(connection->client, NULL);
+    connection->idle_since = esp_timer_get_time();
+    for (int i = 0; i < CURL_POOL_SIZE; ++i) {
+        uintptr_t expected = 0;
+        if (atomic_compare_exchange_strong(&task_info->thread->curl_pool[i], &expected, (uintptr_t)connection)) {
+            return;
+        }
+    }
+
+    uintptr_t          slot    = atomic_exchange(&task_info->thread->curl_pool[0], (uintptr_t)connection);
+    curl_connection_t *evicted = (curl_connection_t *)slot;
+    if (evicted) {
+        curl_connection_destroy(evicted);
+    }
+}
+
+// An idle connection with key, taken out of the pool first so that no other
+// thread of the process frees it while we look
+static curl_connection_t *curl_pool_take(char const *key) {
+    task_info_t *task_info = get_task_info();
+    if (!task_info->pid) {
+        return NULL;
+    }
+
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < CURL_POOL_SIZE; ++i) {
+        curl_connection_t *connection = (curl_connection_t *)atomic_exchange(&task_info->thread->curl_pool[i], 0);
+        if (!connection) {
+            continue;
+        }
+        if (now - connection->idle_since > CURL_POOL_IDLE_US) {
+            curl_connection_destroy(connection);
+        } else if (!strcmp(connection->key, key)) {
+            return connection;
+        } else {
+            curl_pool_put(connection);
+        }
+    }
+    return NULL;
+}
+
+// A TLS session esp-tls saved, in the heap of the process. It is never
+// changed, a newer one replaces it.
+typedef struct curl_session {
+    size_t         session_len;
+    unsigned char *session; // Behind key
+    char           key[];
+} curl_session_t;
+
+// Put session back in slot after a look, unless another one took its place
+static void curl_session_return(task_thread_t *thread, int slot, curl_session_t *session) {
+    uintptr_t expected = 0;
+    if (!atomic_compare_exchange_strong(&thread->curl_sessions[slot], &expected, (uintptr_t)session)) {
+        why_free(session);
+    }
+}
+
+static unsigned char *curl_session_get(char const *key, size_t *session_len) {
+    task_info_t *task_info = get_task_info();
+    if (!task_info->pid) {
+        return NULL;
+    }
+
+    for (int i = 0; i < CURL_SESSIONS; ++i) {
+        curl_session_t *session = (curl_session_t *)atomic_exchange(&task_info->thread->curl_sessions[i], 0);
+        if (!session) {
+            continue;
+        }
+
+        unsigned char *copy = NULL;
+        if (!strcmp(session->key, key)) {
+            copy = why_malloc(session->session_len);
+            if (copy) {
+                memcpy(copy, session->session, session->session_len);
+                *session_len = session->session_len;
+            }
+        }
+        curl_session_return(task_info->thread, i, session);
+        if (copy) {
+            return copy;
+        }
+    }
+    return NULL;
+}
+
+// A full cache loses the session in the first slot
+static void curl_session_put(char const *key, unsigned char const *data, size_t session_len) {
+    task_info_t *task_info = get_task_info();
+    if (!task_info->pid) {
+        return;
+    }
+
+    for (int i = 0; i < CURL_SESSIONS; ++i) {
+        curl_session_t *session = (curl_session_t *)atomic_exchange(&task_info->thread->curl_sessions[i], 0);
+        if (session && !strcmp(session->key, key)) {
+            why_free(session);
+        } else if (session) {
+            curl_session_return(task_info->thread, i, session);
+        }
+    }
+    if (!data) {
+        return;
+    }
+
+    size_t          key_size = strlen(key) + 1;
+    curl_session_t *session  = why_malloc(sizeof(curl_session_t) + key_size + session_len);
+    if (!session) {
+        return;
+    }
+    session->session_len = session_len;
+    session->session     = (unsigned char *)session->key + key_size;
+    memcpy(session->key, key, key_size);
+    memcpy(session->session, data, session_len);
+
+    for (int i = 0; i < CURL_SESSIONS; ++i) {
+        uintptr_t expected = 0;
+        if (atomic_compare_exchange_strong(&task_info->thread->curl_sessions[i], &expected, (uintptr_t)session)) {
+            return;
+        }
+    }
+    why_free((curl_session_t *)atomic_exchange(&task_info->thread->curl_sessions[0], (uintptr_t)session));
+}
+
+// A CA chain parsed for CURLOPT_CAINFO, shared by the connections of every
+// process that trusts the same one. Like the rest of mbedtls it lives in the
+// kernel heap.
+typedef struct curl_ca_chain {
+    mbedtls_x509_crt      chain; // First, esp-tls hands us back a pointer to it
+    uint32_t              hash;
+    size_t                size;
+    unsigned char        *pem;
+    int                   refcount; // Connections using it
+    struct curl_ca_chain *next;
+} curl_ca_chain_t;
+
+static portMUX_TYPE     ca_chains_lock = portMUX_INITIALIZER_UNLOCKED;
+static curl_ca_chain_t *ca_chains;
+
+static void curl_ca_chain_free(curl_ca_chain_t *ca_chain) {
+    mbedtls_x509_crt_free(&ca_chain->chain);
+    free(ca_chain->pem);
+    free(ca_chain);
+}
+
+static void curl_ca_chain_put(mbedtls_x509_crt *chain) {
+    curl_ca_chain_t *ca_chain = (curl_ca_chain_t *)chain;
+
+    portENTER_CRITICAL(&ca_chains_lock);
+    --ca_chain->refcount;
+    portEXIT_CRITICAL(&ca_chains_lock);
+}
+
+// Returns NULL to have esp-tls parse it by itself, which also reports any errors
+static mbedtls_x509_crt *curl_ca_chain_get(unsigned char const *pem, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ pem[i]) * 16777619u;
+    }
+
+    curl_ca_chain_t *ca_chain = NULL;
+    portENTER_CRITICAL(&ca_chains_lock);
+    for (curl_ca_chain_t *c = ca_chains; c; c = c->next) {
+        if (c->hash == hash && c->size == size) {
+            ca_chain = c;
+            ++ca_chain->refcount;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&ca_chains_lock);
+
+    // Compared outside the lock, it can be large
+    if (ca_chain) {
+        if (!memcmp(ca_chain->pem, pem, size)) {
+            return &ca_chain->chain;
+        }
+        curl_ca_chain_put(&ca_chain->chain);
+        return NULL;
+    }
+
+    ca_chain = calloc(1, sizeof(curl_ca_chain_t));
+    if (!ca_chain) {
+        return NULL;
+    }
+    ca_chain->hash     = hash;
+    ca_chain->size     = size;
+    ca_chain->pem      = malloc(size);
+    ca_chain->refcount = 1;
+    mbedtls_x509_crt_init(&ca_chain->chain);
+    if (!ca_chain->pem || mbedtls_x509_crt_parse(&ca_chain->chain, pem, size) < 0) {
+        curl_ca_chain_free(ca_chain);
+        return NULL;
+    }
+    memcpy(ca_chain->pem, pem, size);
+
+    // Make room by dropping the unused one parsed longest ago
+    curl_ca_chain_t  *evicted = NULL;
+    curl_ca_chain_t **unused  = NULL;
+    int               count   = 0;
+    portENTER_CRITICAL(&ca_chains_lock);
+    ca_chain->next = ca_chains;
+    ca_chains      = ca_chain;
+    for (curl_ca_chain_t **c = &ca_chains; *c; c = &(*c)->next) {
+        if (!(*c)->refcount) {
+            unused = c;
+        }
+        ++count;
+    }
+    if (count > CURL_CA_CHAINS && unused) {
+        evicted = *unused;
+        *unused = evicted->next;
+    }
+    portEXIT_CRITICAL(&ca_chains_lock);
+
+    if (evicted) {
+        curl_ca_chain_free(evicted);
+    }
+    return &ca_chain->chain;
+}
+
+static esp_tls_client_cache_t const curl_tls_cache = {
+    .session_get  = curl_session_get,
+    .session_put  = curl_session_put,
+    .ca_chain_get = curl_ca_chain_get,
+    .ca_chain_put = curl_ca_chain_put,
+};
+
 CURL *curl_easy_init(void) {
-    curl_handle_t *curl = dlcalloc(1, sizeof(curl_handle_t));
+    // Let every connection of a process resume TLS sessions of earlier ones
+    esp_tls_set_client_cache(&curl_tls_cache);
+
+    curl_handle_t *curl = why_calloc(1, sizeof(curl_handle_t));
     if (!curl) {
         return NULL;
     }
@@ -606,14 +1483,14 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
     switch (option) {
         case CURLOPT_URL: {
             char const *url = va_arg(args, char const *);
-            dlfree((void *)curl->config.url);
+            why_free((void *)curl->config.url);
             curl->config.url = why_strdup(url);
             break;
         }
 
         case CURLOPT_USERAGENT: {
             char const *agent = va_arg(args, char const *);
-            dlfree((void *)curl->config.user_agent);
+            why_free((void *)curl->config.user_agent);
             curl->config.user_agent = why_strdup(agent);
             break;
         }
@@ -656,7 +1533,7 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
         case CURLOPT_CAINFO: {
             char const *ca_file = va_arg(args, char const *);
             // In ESP-IDF, this should be the actual certificate content, not a file path
-            dlfree((void *)curl->config.cert_pem);
+            why_free((void *)curl->config.cert_pem);
             curl->config.cert_pem          = why_strdup(ca_file);
             curl->config.crt_bundle_attach = NULL;
             break;
@@ -668,18 +1545,18 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
             char       *colon        = strchr(userpwd_copy, ':');
             if (colon) {
                 *colon = '\0';
-                dlfree((void *)curl->config.username);
-                dlfree((void *)curl->config.password);
+                why_free((void *)curl->config.username);
+                why_free((void *)curl->config.password);
                 curl->config.username = why_strdup(userpwd_copy);
                 curl->config.password = why_strdup(colon + 1);
             }
-            dlfree(userpwd_copy);
+            why_free(userpwd_copy);
             break;
         }
 
         case CURLOPT_POSTFIELDS: {
             char const *data = va_arg(args, char const *);
-            dlfree(curl->post_data);
+            why_free(curl->post_data);
             curl->post_data      = why_strdup(data);
             curl->post_data_size = strlen(data);
             break;
@@ -791,29 +1668,33 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
 
         case CURLOPT_COOKIE: {
             char const *cookies = va_arg(args, char const *);
-            dlfree(curl->manual_cookies);
+            why_free(curl->manual_cookies);
             curl->manual_cookies = why_strdup(cookies);
             break;
         }
 
         case CURLOPT_COOKIEFILE: {
             char const *filename = va_arg(args, char const *);
-            dlfree(curl->cookie_file);
+            why_free(curl->cookie_file);
             curl->cookie_file = why_strdup(filename);
-            load_cookies_from_file(curl, filename);
+            load_cookies_from_file(cookie_jar_get(), filename);
             break;
         }
 
         case CURLOPT_COOKIEJAR: {
             char const *filename = va_arg(args, char const *);
-            dlfree(curl->cookie_jar);
+            why_free(curl->cookie_jar);
             curl->cookie_jar = why_strdup(filename);
+            cookie_jar_set_path(cookie_jar_get(), filename);
             break;
         }
 
         case CURLOPT_BUFFERSIZE: {
             long size                = va_arg(args, long);
             curl->config.buffer_size = size;
+            curl->write_buf_size     = MIN(MAX(size, CURL_BUFFERSIZE_MIN), CURL_BUFFERSIZE_MAX);
+            why_free(curl->write_buf);
+            curl->write_buf = NULL;
             va_end(args);
             break;
         }
@@ -821,7 +1702,7 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
         // Proxy options (stubs - not implemented in esp_http_client)
         case CURLOPT_PROXY: {
             char const *proxy = va_arg(args, char const *);
-            dlfree(curl->proxy_url);
+            why_free(curl->proxy_url);
             curl->proxy_url = why_strdup(proxy);
             ESP_LOGW(TAG, "Proxy support not implemented in BadgeVMS HTTP client: %s", proxy);
             va_end(args);
@@ -830,7 +1711,7 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
 
         case CURLOPT_PROXYUSERPWD: {
             char const *userpwd = va_arg(args, char const *);
-            dlfree(curl->proxy_userpwd);
+            why_free(curl->proxy_userpwd);
             curl->proxy_userpwd = why_strdup(userpwd);
             ESP_LOGW(TAG, "Proxy authentication not implemented in BadgeVMS HTTP client");
             va_end(args);
@@ -870,9 +1751,22 @@ CURLcode curl_easy_setopt(CURL *curl_handle, CURLoption option, ...) {
 
         case CURLOPT_RANGE: {
             char const *range = va_arg(args, char const *);
-            ESP_LOGW(TAG, "CURLOPT_RANGE not implemented: %s", range);
-            va_end(args);
-            return CURLE_UNSUPPORTED_PROTOCOL;
+            why_free(curl->range);
+            curl->range = range ? why_strdup(range) : NULL;
+            break;
+        }
+
+        case CURLOPT_RESUME_FROM: {
+            long offset       = va_arg(args, long);
+            curl->resume_from = offset;
+            break;
+        }
+
+        case CURLOPT_DOWNLOAD_TO_PATH: {
+            char const *path = va_arg(args, char const *);
+            why_free(curl->download_path);
+            curl->download_path = path ? why_strdup(path) : NULL;
+            break;
         }
 
         case CURLOPT_REFERER: {
@@ -898,12 +1792,37 @@ CURLcode curl_easy_perform(CURL *curl_handle) {
     }
 
     curl_handle_t *curl = (curl_handle_t *)curl_handle;
+    if (!curl->config.url) {
+        return CURLE_URL_MALFORMAT;
+    }
 
-    curl->esp_client = esp_http_client_init(&curl->config);
-    if (!curl->esp_client) {
-        return CURLE_FAILED_INIT;
+    char *key = curl_connection_key(curl, curl->config.url);
+    if (!key) {
+        return CURLE_OUT_OF_MEMORY;
     }
 
+    // Keep the connection of the last transfer if it fits, otherwise look in
+    // the pool before opening a new one
+    if (curl->connection && strcmp(curl->connection->key, key)) {
+        curl_pool_put(curl->connection);
+        curl->connection = NULL;
+    }
+    if (!curl->connection) {
+        curl->connection = curl_pool_take(key);
+    }
+
+    bool reused = curl->connection != NULL;
+    if (reused) {
+        why_free(key);
+        curl_connection_reset(curl->connection, curl);
+    } else {
+        curl->connection = curl_connection_create(curl, key);
+        if (!curl->connection) {
+            return CURLE_FAILED_INIT;
+        }
+    }
+    curl->esp_client = curl->connection->client;
+
     if (curl->headers) {
         struct curl_slist *header = curl->headers;
         while (header) {
@@ -918,8 +1837,8 @@ CURLcode curl_easy_perform(CURL *curl_handle) {
                     value++;
                 }
 
-                esp_http_client_set_header(curl->esp_client, header_copy, value);
-                dlfree(header_copy);
+                curl_connection_set_header(curl->connection, header_copy, value);
+                why_free(header_copy);
             }
             header = header->next;
         }
@@ -927,25 +1846,68 @@ CURLcode curl_easy_perform(CURL *curl_handle) {
 
     char *cookie_header = build_cookie_header(curl);
     if (cookie_header) {
-        esp_http_client_set_header(curl->esp_client, "Cookie", cookie_header);
-        dlfree(cookie_header);
+        curl_connection_set_header(curl->connection, "Cookie", cookie_header);
+        why_free(cookie_header);
     }
 
     if (curl->post_data && curl->config.method == HTTP_METHOD_POST) {
         esp_http_client_set_post_field(curl->esp_client, curl->post_data, curl->post_data_size);
     }
 
-    esp_err_t err = esp_http_client_perform(curl->esp_client);
+    // Continue a download where the file ends, if the server can
+    curl->resume_offset = curl->resume_from > 0 ? curl->resume_from : 0;
+    if (curl->resume_from == -1 && curl->download_path) {
+        struct stat st;
+        if (why_stat(curl->download_path, &st) == 0) {
+            curl->resume_offset = st.st_size;
+        }
+    }
+
+    char *range = NULL;
+    if (curl->range) {
+        why_asprintf(&range, "bytes=%s", curl->range);
+    } else if (curl->resume_offset) {
+        why_asprintf(&range, "bytes=%lld-", (long long)curl->resume_offset);
+    }
+    if (range) {
+        curl_connection_set_header(curl->connection, "Range", range);
+        why_free(range);
+    }
+
+    if (curl->download_path) {
+        curl->download = curl_download_start();
+        if (!curl->download) {
+            curl->esp_client = NULL;
+            return CURLE_OUT_OF_MEMORY;
+        }
+    }
+
+    curl->delivered     = false;
+    curl->size_download = 0;
+    esp_err_t err       = esp_http_client_perform(curl->esp_client);
+
+    // The server may have closed a kept connection in the meantime, which
+    // shows before anything of the response arrived. Once more on a new one.
+    if (err != ESP_OK && reused && !curl->delivered) {
+        esp_http_client_close(curl->esp_client);
+        err = esp_http_client_perform(curl->esp_client);
+    }
+
+    curl_write_flush(curl);
+    bool written = !curl->download || curl_download_finish(curl, err == ESP_OK);
 
     if (curl->cookie_jar) {
-        save_cookies_to_file(curl, curl->cookie_jar);
+        cookie_jar_flush(cookie_jar_get(), false);
     }
 
-    esp_http_client_cleanup(curl->esp_client);
+    if (err != ESP_OK) {
+        curl_connection_destroy(curl->connection);
+        curl->connection = NULL;
+    }
     curl->esp_client = NULL;
 
     if (err == ESP_OK) {
-        return CURLE_OK;
+        return written ? CURLE_OK : CURLE_WRITE_ERROR;
     } else if (err == ESP_ERR_TIMEOUT) {
         return CURLE_OPERATION_TIMEDOUT;
     } else if (err == ESP_ERR_HTTP_CONNECT) {
@@ -962,28 +1924,34 @@ void curl_easy_cleanup(CURL *curl_handle) {
 
     curl_handle_t *curl = (curl_handle_t *)curl_handle;
 
-    dlfree((void *)curl->config.url);
-    dlfree((void *)curl->config.user_agent);
-    dlfree((void *)curl->config.username);
-    dlfree((void *)curl->config.password);
-    dlfree((void *)curl->config.cert_pem);
-    dlfree(curl->post_data);
-    dlfree(curl->content_type);
-    dlfree(curl->effective_url);
+    why_free((void *)curl->config.url);
+    why_free((void *)curl->config.user_agent);
+    why_free((void *)curl->config.username);
+    why_free((void *)curl->config.password);
+    why_free((void *)curl->config.cert_pem);
+    why_free(curl->post_data);
+    why_free(curl->content_type);
+    why_free(curl->effective_url);
+    why_free(curl->range);
+    why_free(curl->download_path);
+    why_free(curl->header_buf);
+    why_free(curl->write_buf);
 
-    free_all_cookies(curl->cookies);
-    dlfree(curl->cookie_file);
-    dlfree(curl->cookie_jar);
-    dlfree(curl->manual_cookies);
+    if (curl->cookie_jar) {
+        cookie_jar_flush(cookie_jar_get(), true);
+    }
+    why_free(curl->cookie_file);
+    why_free(curl->cookie_jar);
+    why_free(curl->manual_cookies);
 
-    dlfree(curl->proxy_url);
-    dlfree(curl->proxy_userpwd);
+    why_free(curl->proxy_url);
+    why_free(curl->proxy_userpwd);
 
-    if (curl->esp_client) {
-        esp_http_client_cleanup(curl->esp_client);
+    if (curl->connection) {
+        curl_pool_put(curl->connection);
     }
 
-    dlfree(curl);
+    why_free(curl);
 }
 
 CURLcode curl_easy_getinfo(CURL *curl_handle, curl_easy_info_t info, ...) {
@@ -1014,6 +1982,12 @@ CURLcode curl_easy_getinfo(CURL *curl_handle, curl_easy_info_t info, ...) {
             break;
         }
 
+        case CURLINFO_SIZE_DOWNLOAD: {
+            double *size = va_arg(args, double *);
+            *size        = (double)curl->size_download;
+            break;
+        }
+
         case CURLINFO_EFFECTIVE_URL: {
             char **url = va_arg(args, char **);
             *url       = curl->effective_url ? curl->effective_url : (char *)curl->config.url;
@@ -1043,7 +2017,7 @@ char const *curl_easy_strerror(CURLcode error) {
 }
 
 struct curl_slist *curl_slist_append(struct curl_slist *list, char const *string) {
-    struct curl_slist *new_node = dlmalloc(sizeof(struct curl_slist));
+    struct curl_slist *new_node = why_malloc(sizeof(struct curl_slist));
     if (!new_node) {
         return list;
     }
@@ -1067,8 +2041,8 @@ struct curl_slist *curl_slist_append(struct curl_slist *list, char const *string
 void curl_slist_free_all(struct curl_slist *list) {
     while (list) {
         struct curl_slist *next = list->next;
-        dlfree(list->data);
-        dlfree(list);
+        why_free(list->data);
+        why_free(list);
         list = next;
     }
 }
@@ -1077,5 +2051,18 @@ CURLcode curl_global_init(long flags) {
     return CURLE_OK;
 }
 
+// Close the idle connections of the process
 void curl_global_cleanup(void) {
+    task_info_t *task_info = get_task_info();
+    cookie_jar_flush((curl_cookie_jar_t *)atomic_load(&task_info->thread->curl_cookie_jar), true);
+    if (!task_info->pid) {
+        return;
+    }
+
+    for (int i = 0; i < CURL_POOL_SIZE; ++i) {
+        curl_connection_t *connection = (curl_connection_t *)atomic_exchange(&task_info->thread->curl_pool[i], 0);
+        if (connection) {
+            curl_connection_destroy(connection);
+        }
+    }
 }
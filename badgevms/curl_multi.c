@@ -0,0 +1,513 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "curl_private.h"
+
+#include "badgevms/process.h"
+#include "badgevms/wait.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "task.h"
+#include "wait_private.h"
+#include "why_io.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define TAG "curl_multi"
+
+// Transfers run at once, each by a thread of the process
+#define CURL_MULTI_WORKERS     4
+// Room for a TLS handshake
+#define CURL_MULTI_STACK_SIZE  16384
+// Of the response kept for curl_multi_perform(), a transfer waits when there is more
+#define CURL_MULTI_BUFFER_SIZE (32 * 1024)
+
+typedef enum {
+    TRANSFER_QUEUED,
+    TRANSFER_RUNNING,
+    TRANSFER_DONE,
+} transfer_state_t;
+
+// A part of the response, for the header or the write callback
+typedef struct curl_chunk {
+    struct curl_chunk *next;
+    bool               header;
+    size_t             size;
+    char               data[];
+} curl_chunk_t;
+
+typedef struct curl_multi curl_multi_t;
+
+// Everything but easy, multi and next is shared with the worker, under curl_multi_lock
+struct curl_transfer {
+    CURL            *easy;
+    curl_multi_t    *multi;
+    curl_transfer_t *next;
+    transfer_state_t state;
+    CURLcode         result;
+    pid_t            worker;
+    bool             removed; // Nobody wants the rest of the response
+    bool             lost;    // Out of memory for a part of it
+    bool             finished; // Done and delivered, for curl_multi_info_read()
+    bool             reported;
+    curl_chunk_t    *chunks;
+    curl_chunk_t   **chunks_tail;
+    size_t           buffered;
+    atomic_int       drained; // Futex word, counts the chunks being taken
+};
+
+// Lives in the memory of the process. Only the owner changes the list of
+// transfers, the workers look at it under curl_multi_lock.
+struct curl_multi {
+    curl_transfer_t *transfers;
+    pid_t            workers[CURL_MULTI_WORKERS];
+    int              num_workers;
+    atomic_int       work; // Futex word, counts transfers queued
+    atomic_int       done; // Futex word, counts transfers done
+    atomic_bool      stop;
+    atomic_bool      news;   // Something for curl_multi_perform()
+    atomic_bool      woken;  // By curl_multi_wakeup()
+    atomic_uintptr_t waiter; // In wait_any() on news
+    CURLMsg          msg;    // Handed out by curl_multi_info_read()
+};
+
+// Held shortly, by the threads of every process with a multi handle
+static portMUX_TYPE curl_multi_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void curl_multi_news(curl_multi_t *multi) {
+    atomic_store(&multi->news, true);
+    wait_wake_thread(&multi->waiter);
+}
+
+static void curl_multi_worker(void *user_data) {
+    curl_multi_t *multi = user_data;
+    pid_t         self  = get_task_info()->pid;
+
+    get_task_info()->detached = true;
+
+    while (!atomic_load(&multi->stop)) {
+        int              work     = atomic_load(&multi->work);
+        curl_transfer_t *transfer = NULL;
+
+        portENTER_CRITICAL(&curl_multi_lock);
+        for (curl_transfer_t *t = multi->transfers; t; t = t->next) {
+            if (t->state == TRANSFER_QUEUED) {
+                transfer         = t;
+                transfer->state  = TRANSFER_RUNNING;
+                transfer->worker = self;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&curl_multi_lock);
+
+        if (!transfer) {
+            futex_wait((int *)&multi->work, work, UINT32_MAX);
+            continue;
+        }
+
+        CURLcode result = curl_easy_perform(transfer->easy);
+
+        // The owner may free it as soon as it is done
+        portENTER_CRITICAL(&curl_multi_lock);
+        transfer->result = result == CURLE_OK && transfer->lost ? CURLE_OUT_OF_MEMORY : result;
+        transfer->state  = TRANSFER_DONE;
+        portEXIT_CRITICAL(&curl_multi_lock);
+
+        atomic_fetch_add(&multi->done, 1);
+        futex_wake((int *)&multi->done, INT_MAX);
+        curl_multi_news(multi);
+    }
+}
+
+void curl_transfer_write(curl_transfer_t *transfer, bool header, void const *data, size_t size) {
+    bool removed;
+    bool full;
+
+    // Wait for curl_multi_perform() to take what is kept
+    while (1) {
+        int drained = atomic_load(&transfer->drained);
+
+        portENTER_CRITICAL(&curl_multi_lock);
+        removed = transfer->removed;
+        full    = transfer->buffered >= CURL_MULTI_BUFFER_SIZE;
+        portEXIT_CRITICAL(&curl_multi_lock);
+
+        if (removed) {
+            return;
+        }
+        if (!full) {
+            break;
+        }
+        futex_wait((int *)&transfer->drained, drained, UINT32_MAX);
+    }
+
+    curl_chunk_t *chunk = why_malloc(sizeof(curl_chunk_t) + size);
+    if (!chunk) {
+        ESP_LOGW(TAG, "Out of memory, dropping %zu bytes of a response", size);
+        portENTER_CRITICAL(&curl_multi_lock);
+        transfer->lost = true;
+        portEXIT_CRITICAL(&curl_multi_lock);
+        return;
+    }
+    chunk->next   = NULL;
+    chunk->header = header;
+    chunk->size   = size;
+    memcpy(chunk->data, data, size);
+
+    portENTER_CRITICAL(&curl_multi_lock);
+    *transfer->chunks_tail  = chunk;
+    transfer->chunks_tail   = &chunk->next;
+    transfer->buffered     += size;
+    portEXIT_CRITICAL(&curl_multi_lock);
+
+    curl_multi_news(transfer->multi);
+}
+
+// Take the chunks of transfer, and let its worker go on if it waits for room
+static curl_chunk_t *curl_transfer_take(curl_transfer_t *transfer, bool *done) {
+    portENTER_CRITICAL(&curl_multi_lock);
+    curl_chunk_t *chunks  = transfer->chunks;
+    *done                 = transfer->state == TRANSFER_DONE;
+    transfer->chunks      = NULL;
+    transfer->chunks_tail = &transfer->chunks;
+    transfer->buffered    = 0;
+    portEXIT_CRITICAL(&curl_multi_lock);
+
+    atomic_fetch_add(&transfer->drained, 1);
+    futex_wake((int *)&transfer->drained, 1);
+    return chunks;
+}
+
+static void curl_chunks_free(curl_chunk_t *chunks) {
+    while (chunks) {
+        curl_chunk_t *next = chunks->next;
+        why_free(chunks);
+        chunks = next;
+    }
+}
+
+CURLM *curl_multi_init(void) {
+    curl_multi_t *multi = why_calloc(1, sizeof(curl_multi_t));
+    if (!multi) {
+        return NULL;
+    }
+
+    atomic_init(&multi->work, 0);
+    atomic_init(&multi->done, 0);
+    atomic_init(&multi->stop, false);
+    atomic_init(&multi->news, false);
+    atomic_init(&multi->woken, false);
+    atomic_init(&multi->waiter, (uintptr_t)NULL);
+    return (CURLM *)multi;
+}
+
+CURLMcode curl_multi_add_handle(CURLM *multi_handle, CURL *curl) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    if (!multi) {
+        return CURLM_BAD_HANDLE;
+    }
+    if (!curl) {
+        return CURLM_BAD_EASY_HANDLE;
+    }
+
+    int              unfinished = 1;
+    curl_transfer_t **tail      = &multi->transfers;
+    for (; *tail; tail = &(*tail)->next) {
+        if ((*tail)->easy == curl) {
+            return CURLM_ADDED_ALREADY;
+        }
+        unfinished += !(*tail)->finished;
+    }
+
+    curl_transfer_t *transfer = why_calloc(1, sizeof(curl_transfer_t));
+    if (!transfer) {
+        return CURLM_OUT_OF_MEMORY;
+    }
+    transfer->easy        = curl;
+    transfer->multi       = multi;
+    transfer->state       = TRANSFER_QUEUED;
+    transfer->chunks_tail = &transfer->chunks;
+    atomic_init(&transfer->drained, 0);
+    curl_easy_set_transfer(curl, transfer);
+
+    // A worker for every transfer up to the limit, they stay for later ones
+    if (multi->num_workers < CURL_MULTI_WORKERS && multi->num_workers < unfinished) {
+        thread_attr_t attr = {
+            .stack_size = CURL_MULTI_STACK_SIZE,
+            .priority   = THREAD_PRIORITY_NORMAL,
+            .core       = THREAD_CORE_ANY,
+        };
+        pid_t worker = thread_create_attr(curl_multi_worker, multi, &attr);
+        if (worker != -1) {
+            multi->workers[multi->num_workers++] = worker;
+        } else if (!multi->num_workers) {
+            ESP_LOGW(TAG, "Unable to start a worker");
+            curl_easy_set_transfer(curl, NULL);
+            why_free(transfer);
+            return CURLM_OUT_OF_MEMORY;
+        }
+    }
+
+    portENTER_CRITICAL(&curl_multi_lock);
+    *tail = transfer;
+    portEXIT_CRITICAL(&curl_multi_lock);
+
+    atomic_fetch_add(&multi->work, 1);
+    futex_wake((int *)&multi->work, 1);
+    return CURLM_OK;
+}
+
+CURLMcode curl_multi_remove_handle(CURLM *multi_handle, CURL *curl) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    if (!multi) {
+        return CURLM_BAD_HANDLE;
+    }
+
+    curl_transfer_t **link = &multi->transfers;
+    while (*link && (*link)->easy != curl) {
+        link = &(*link)->next;
+    }
+    curl_transfer_t *transfer = *link;
+    if (!transfer) {
+        return CURLM_BAD_EASY_HANDLE;
+    }
+
+    // A queued one is taken from the workers, a running one can only be waited for
+    portENTER_CRITICAL(&curl_multi_lock);
+    transfer->removed = true;
+    if (transfer->state == TRANSFER_QUEUED) {
+        transfer->state = TRANSFER_DONE;
+    }
+    portEXIT_CRITICAL(&curl_multi_lock);
+
+    atomic_fetch_add(&transfer->drained, 1);
+    futex_wake((int *)&transfer->drained, 1);
+
+    while (1) {
+        int done = atomic_load(&multi->done);
+
+        portENTER_CRITICAL(&curl_multi_lock);
+        bool running = transfer->state == TRANSFER_RUNNING;
+        portEXIT_CRITICAL(&curl_multi_lock);
+
+        // futex_wait() also returns when a worker dies
+        if (!running || !thread_alive(transfer->worker)) {
+            break;
+        }
+        futex_wait((int *)&multi->done, done, UINT32_MAX);
+    }
+
+    portENTER_CRITICAL(&curl_multi_lock);
+    *link = transfer->next;
+    portEXIT_CRITICAL(&curl_multi_lock);
+
+    if (multi->msg.easy_handle == curl) {
+        multi->msg.easy_handle = NULL;
+    }
+    curl_easy_set_transfer(curl, NULL);
+    curl_chunks_free(transfer->chunks);
+    why_free(transfer);
+    return CURLM_OK;
+}
+
+CURLMcode curl_multi_perform(CURLM *multi_handle, int *running_handles) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    if (!multi) {
+        return CURLM_BAD_HANDLE;
+    }
+
+    // Cleared first, so news while we deliver isn't missed
+    atomic_store(&multi->news, false);
+
+    int running = 0;
+    for (curl_transfer_t *transfer = multi->transfers; transfer; transfer = transfer->next) {
+        if (transfer->finished) {
+            continue;
+        }
+
+        // Taken together with the state, a transfer that is done has written everything
+        bool          done;
+        curl_chunk_t *chunks = curl_transfer_take(transfer, &done);
+        for (curl_chunk_t *chunk = chunks; chunk; chunk = chunk->next) {
+            curl_easy_deliver(transfer->easy, chunk->header, chunk->data, chunk->size);
+        }
+        curl_chunks_free(chunks);
+
+        transfer->finished  = done;
+        running            += !done;
+    }
+
+    if (running_handles) {
+        *running_handles = running;
+    }
+    return CURLM_OK;
+}
+
+static CURLMcode curl_multi_wait_for(
+    curl_multi_t *multi, struct curl_waitfd extra_fds[], unsigned int extra_nfds, int timeout_ms, int *numfds
+) {
+    if (!multi) {
+        return CURLM_BAD_HANDLE;
+    }
+    if (extra_nfds && !extra_fds) {
+        return CURLM_BAD_SOCKET;
+    }
+
+    wait_source_t *sources = why_calloc(extra_nfds + 1, sizeof(wait_source_t));
+    if (!sources) {
+        return CURLM_OUT_OF_MEMORY;
+    }
+
+    sources[0].type       = WAIT_SOURCE_CURL;
+    sources[0].curl_multi = multi;
+    for (unsigned int i = 0; i < extra_nfds; ++i) {
+        sources[i + 1].type = WAIT_SOURCE_FD;
+        sources[i + 1].fd   = extra_fds[i].fd;
+        if (extra_fds[i].events & (CURL_WAIT_POLLIN | CURL_WAIT_POLLPRI)) {
+            sources[i + 1].events |= WAIT_READABLE;
+        }
+        if (extra_fds[i].events & CURL_WAIT_POLLOUT) {
+            sources[i + 1].events |= WAIT_WRITABLE;
+        }
+    }
+
+    int ready = wait_any(sources, extra_nfds + 1, timeout_ms < 0 ? UINT32_MAX : (uint32_t)timeout_ms);
+    atomic_store(&multi->woken, false);
+
+    int ready_fds = 0;
+    for (unsigned int i = 0; i < extra_nfds; ++i) {
+        uint16_t revents     = sources[i + 1].revents;
+        extra_fds[i].revents = 0;
+        if (revents & WAIT_READABLE) {
+            extra_fds[i].revents |= extra_fds[i].events & (CURL_WAIT_POLLIN | CURL_WAIT_POLLPRI);
+        }
+        if (revents & WAIT_WRITABLE) {
+            extra_fds[i].revents |= CURL_WAIT_POLLOUT;
+        }
+        ready_fds += extra_fds[i].revents != 0;
+    }
+    why_free(sources);
+
+    if (ready < 0) {
+        return CURLM_INTERNAL_ERROR;
+    }
+    if (numfds) {
+        *numfds = ready_fds;
+    }
+    return CURLM_OK;
+}
+
+CURLMcode curl_multi_wait(
+    CURLM *multi, struct curl_waitfd extra_fds[], unsigned int extra_nfds, int timeout_ms, int *numfds
+) {
+    return curl_multi_wait_for((curl_multi_t *)multi, extra_fds, extra_nfds, timeout_ms, numfds);
+}
+
+CURLMcode curl_multi_poll(
+    CURLM *multi, struct curl_waitfd extra_fds[], unsigned int extra_nfds, int timeout_ms, int *numfds
+) {
+    return curl_multi_wait_for((curl_multi_t *)multi, extra_fds, extra_nfds, timeout_ms, numfds);
+}
+
+CURLMcode curl_multi_wakeup(CURLM *multi_handle) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    if (!multi) {
+        return CURLM_BAD_HANDLE;
+    }
+
+    atomic_store(&multi->woken, true);
+    wait_wake_thread(&multi->waiter);
+    return CURLM_OK;
+}
+
+CURLMsg *curl_multi_info_read(CURLM *multi_handle, int *msgs_in_queue) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    CURLMsg      *msg   = NULL;
+    int           left  = 0;
+
+    if (multi) {
+        for (curl_transfer_t *transfer = multi->transfers; transfer; transfer = transfer->next) {
+            if (!transfer->finished || transfer->reported) {
+                continue;
+            }
+            if (msg) {
+                ++left;
+                continue;
+            }
+
+            transfer->reported          = true;
+            multi->msg.msg              = CURLMSG_DONE;
+            multi->msg.easy_handle      = transfer->easy;
+            multi->msg.data.result      = transfer->result;
+            msg                         = &multi->msg;
+        }
+    }
+
+    if (msgs_in_queue) {
+        *msgs_in_queue = left;
+    }
+    return msg;
+}
+
+CURLMcode curl_multi_cleanup(CURLM *multi_handle) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    if (!multi) {
+        return CURLM_BAD_HANDLE;
+    }
+
+    while (multi->transfers) {
+        curl_multi_remove_handle(multi, multi->transfers->easy);
+    }
+
+    atomic_store(&multi->stop, true);
+    atomic_fetch_add(&multi->work, 1);
+    futex_wake((int *)&multi->work, INT_MAX);
+
+    // Nothing reports their exit, futex_wait() returns when a thread of the process dies
+    for (int i = 0; i < multi->num_workers; ++i) {
+        while (thread_alive(multi->workers[i])) {
+            futex_wait((int *)&multi->work, atomic_load(&multi->work), UINT32_MAX);
+        }
+    }
+
+    why_free(multi);
+    return CURLM_OK;
+}
+
+char const *curl_multi_strerror(CURLMcode error) {
+    switch (error) {
+        case CURLM_CALL_MULTI_PERFORM: return "Please call curl_multi_perform() soon";
+        case CURLM_OK: return "No error";
+        case CURLM_BAD_HANDLE: return "Invalid multi handle";
+        case CURLM_BAD_EASY_HANDLE: return "Invalid easy handle";
+        case CURLM_OUT_OF_MEMORY: return "Out of memory";
+        case CURLM_INTERNAL_ERROR: return "Internal error";
+        case CURLM_BAD_SOCKET: return "Invalid socket argument";
+        case CURLM_UNKNOWN_OPTION: return "Unknown option";
+        case CURLM_ADDED_ALREADY: return "The easy handle is already added to a multi handle";
+        default: return "Unknown error";
+    }
+}
+
+atomic_uintptr_t *curl_multi_waiter(CURLM *multi) {
+    return &((curl_multi_t *)multi)->waiter;
+}
+
+bool curl_multi_ready(CURLM *multi_handle) {
+    curl_multi_t *multi = (curl_multi_t *)multi_handle;
+    return atomic_load(&multi->news) || atomic_load(&multi->woken);
+}
@@ -0,0 +1,40 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "curl/curl.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A transfer of an easy handle added to a multi handle, see curl_multi.c
+typedef struct curl_transfer curl_transfer_t;
+
+// Run the transfers of curl for transfer: the parts of the response go to
+// curl_transfer_write() instead of the callbacks. NULL to stop.
+void curl_easy_set_transfer(CURL *curl, curl_transfer_t *transfer);
+// Hand a part of the response to the header or write callback of curl
+void curl_easy_deliver(CURL *curl, bool header, void *data, size_t size);
+
+// From the worker running the transfer. Keeps the part for
+// curl_multi_perform(), waits while too much is kept already.
+void curl_transfer_write(curl_transfer_t *transfer, bool header, void const *data, size_t size);
+
+// For WAIT_SOURCE_CURL, see wait.c
+atomic_uintptr_t *curl_multi_waiter(CURLM *multi);
+bool              curl_multi_ready(CURLM *multi);
@@ -16,55 +16,171 @@
 
 #include "badgevms/device.h"
 
+#include "boot_profile_private.h"
+#include "device_private.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "hash_helper.h"
-#include "thirdparty/khash.h"
 
-KHASH_MAP_INIT_STR(devtable, void *);
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A device, or the means to create it the first time it is used
+typedef struct {
+    char const         *name;
+    _Atomic(device_t *) device;
+    // Cleared once it has run, whether it worked or not
+    device_create_fn    create;
+} device_entry_t;
+
+// Sorted by name and never changed once published. Registering a device
+// publishes a new table with it added, so device_get() takes no lock.
+typedef struct {
+    size_t          count;
+    device_entry_t *entries[];
+} device_table_t;
 
 static char const *TAG = "device";
 
-static khash_t(devtable) * device_table;
-static SemaphoreHandle_t device_table_lock = NULL;
+static device_table_t const empty_table;
+
+static _Atomic(device_table_t const *) device_table = &empty_table;
+
+// Serializes registering, lookups don't take it
+static SemaphoreHandle_t device_table_lock  = NULL;
+// Held while creating a device on first use, recursive as one driver may use another
+static SemaphoreHandle_t device_create_lock = NULL;
+
+// Where name is or would go in table
+static size_t device_table_find(device_table_t const *table, char const *name, bool *found) {
+    size_t lo = 0;
+    size_t hi = table->count;
+
+    *found = false;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int    cmp = strcmp(name, table->entries[mid]->name);
+        if (!cmp) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
 
-bool device_register(char const *name, device_t *device) {
-    if (!device) {
+static bool device_insert(char const *name, device_t *device, device_create_fn create) {
+    device_entry_t *entry = malloc(sizeof(device_entry_t));
+    if (!entry) {
+        ESP_LOGE(TAG, "Unable to allocate entry for %s", name);
         return false;
     }
+    entry->name = name;
+    atomic_init(&entry->device, device);
+    entry->create = create;
 
     if (xSemaphoreTake(device_table_lock, portMAX_DELAY) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to get device table mutex");
         abort();
     }
 
-    khash_insert_unique_str(devtable, device_table, name, device, "The device already exists");
+    device_table_t const *old = atomic_load(&device_table);
+    bool                  found;
+    size_t                pos = device_table_find(old, name, &found);
+    if (found) {
+        ESP_LOGE(TAG, "The device already exists: %s", name);
+        xSemaphoreGive(device_table_lock);
+        free(entry);
+        return true;
+    }
+
+    device_table_t *table = malloc(sizeof(device_table_t) + (old->count + 1) * sizeof(device_entry_t *));
+    if (!table) {
+        ESP_LOGE(TAG, "Unable to create %s", name);
+        abort();
+    }
+    table->count = old->count + 1;
+    memcpy(table->entries, old->entries, pos * sizeof(device_entry_t *));
+    table->entries[pos] = entry;
+    memcpy(table->entries + pos + 1, old->entries + pos, (old->count - pos) * sizeof(device_entry_t *));
+
+    // The old table is kept, a lookup may still be going through it. Devices
+    // are registered while booting, so that's a few hundred bytes.
+    atomic_store(&device_table, table);
 
     xSemaphoreGive(device_table_lock);
 
     return true;
 }
 
-device_t *device_get(char const *name) {
-    if (xSemaphoreTake(device_table_lock, portMAX_DELAY) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to get device table mutex");
-        abort();
+bool device_register(char const *name, device_t *device) {
+    if (!device) {
+        return false;
     }
 
-    khash_get_str(device_t *, device, devtable, device_table, name, "The device does not exist");
+    return device_insert(name, device, NULL);
+}
 
-    xSemaphoreGive(device_table_lock);
+bool device_register_lazy(char const *name, device_create_fn create) {
+    if (!create) {
+        return false;
+    }
+
+    return device_insert(name, NULL, create);
+}
 
+static device_t *device_create(char const *name, device_entry_t *entry) {
+    xSemaphoreTakeRecursive(device_create_lock, portMAX_DELAY);
+
+    // Someone else may have just done it, or found it doesn't work
+    device_t *device = atomic_load(&entry->device);
+    if (entry->create) {
+        int64_t start = esp_timer_get_time();
+        device        = entry->create();
+        entry->create = NULL;
+        atomic_store(&entry->device, device);
+
+        if (device) {
+            boot_profile_stage(name, start);
+            ESP_LOGI(TAG, "Created %s on first use in %lld ms", name, (esp_timer_get_time() - start) / 1000);
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize %s driver", name);
+        }
+    }
+
+    xSemaphoreGiveRecursive(device_create_lock);
     return device;
 }
 
+device_t *device_get(char const *name) {
+    device_table_t const *table = atomic_load(&device_table);
+    bool                  found;
+    size_t                pos = device_table_find(table, name, &found);
+    if (!found) {
+        ESP_LOGE(TAG, "The device does not exist %s", name);
+        return NULL;
+    }
+
+    device_entry_t *entry  = table->entries[pos];
+    device_t       *device = atomic_load(&entry->device);
+    if (device) {
+        return device;
+    }
+    return device_create(name, entry);
+}
+
 bool device_init() {
     ESP_LOGI(TAG, "Initializing");
 
-    device_table      = kh_init(devtable);
-    device_table_lock = xSemaphoreCreateMutex();
-    if (!device_table_lock) {
-        ESP_LOGE(TAG, "Failed to create device_table_lock");
+    device_table_lock  = xSemaphoreCreateMutex();
+    device_create_lock = xSemaphoreCreateRecursiveMutex();
+    if (!device_table_lock || !device_create_lock) {
+        ESP_LOGE(TAG, "Failed to create device table locks");
         return false;
     }
 
@@ -18,5 +18,11 @@
 
 #include "badgevms/device.h"
 
+typedef device_t *(*device_create_fn)(void);
+
 bool device_register(char const *name, device_t *device);
+// The driver is created the first time device_get() or an open asks for it,
+// for hardware most programs never touch. A driver that fails to come up is
+// not tried again.
+bool device_register_lazy(char const *name, device_create_fn create);
 bool device_init();
@@ -0,0 +1,268 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "dma_mem.h"
+
+#include "driver/ppa.h"
+#include "esp_async_memcpy.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "fast_mem.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "hal/cache_hal.h"
+#include "hal/cache_ll.h"
+#include "memory.h"
+
+#include <stdatomic.h>
+#include <sys/param.h>
+
+#define TAG "dma_mem"
+
+// Below this the CPU is done before the DMA is set up
+#define DMA_MEM_MIN_SIZE (16 * 1024)
+// Copies and fills in flight
+#define DMA_MEM_BACKLOG  8
+
+// A fill is an ARGB8888 picture with rows this long, in one PPA transaction.
+// Up to 4 MB, so the compositor's own fills and blends don't wait long for it.
+#define DMA_MEM_FILL_ROW_PIXELS 1024
+#define DMA_MEM_FILL_ROW_BYTES  (DMA_MEM_FILL_ROW_PIXELS * 4)
+#define DMA_MEM_FILL_MAX_ROWS   1024
+
+typedef struct {
+    dma_mem_done_t done;
+    void          *arg;
+    atomic_flag    busy;
+} dma_mem_request_t;
+
+typedef struct {
+    SemaphoreHandle_t done;
+    StaticSemaphore_t storage;
+} dma_mem_wait_t;
+
+static async_memcpy_handle_t copier;
+static ppa_client_handle_t   filler;
+static dma_mem_request_t     requests[DMA_MEM_BACKLOG];
+
+static dma_mem_request_t *dma_mem_request_take(dma_mem_done_t done, void *arg) {
+    for (int i = 0; i < DMA_MEM_BACKLOG; ++i) {
+        if (!atomic_flag_test_and_set(&requests[i].busy)) {
+            requests[i].done = done;
+            requests[i].arg  = arg;
+            return &requests[i];
+        }
+    }
+    return NULL;
+}
+
+static IRAM_ATTR bool dma_mem_request_done(dma_mem_request_t *request) {
+    dma_mem_done_t done = request->done;
+    void          *arg  = request->arg;
+    atomic_flag_clear(&request->busy);
+    return done(arg);
+}
+
+static IRAM_ATTR bool dma_mem_copied(async_memcpy_handle_t handle, async_memcpy_event_t *event, void *request) {
+    return dma_mem_request_done(request);
+}
+
+static IRAM_ATTR bool dma_mem_filled(ppa_client_handle_t handle, ppa_event_data_t *event, void *request) {
+    return dma_mem_request_done(request);
+}
+
+static IRAM_ATTR bool dma_mem_wake(void *arg) {
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(((dma_mem_wait_t *)arg)->done, &woken);
+    return woken == pdTRUE;
+}
+
+static size_t dma_mem_line_size(void) {
+    return cache_hal_get_cache_line_size(CACHE_LL_LEVEL_EXT_MEM, CACHE_TYPE_DATA);
+}
+
+// The heap of a task is only mapped while it runs, the DMA goes on meanwhile
+__attribute__((always_inline)) static inline bool dma_mem_shared(void const *ptr, size_t n) {
+    return !in_task_heap(ptr) && !in_task_heap((uint8_t const *)ptr + n - 1);
+}
+
+bool dma_mem_copy_start(void *dst, void const *src, size_t n, dma_mem_done_t done, void *arg) {
+    size_t line_size = dma_mem_line_size();
+    size_t head      = -(uintptr_t)dst & (line_size - 1);
+    size_t body      = n > head ? (n - head) & ~(line_size - 1) : 0;
+
+    if (!copier || n < DMA_MEM_MIN_SIZE || !body || (((uintptr_t)dst - (uintptr_t)src) & (line_size - 1)) ||
+        !dma_mem_shared(dst, n) || !dma_mem_shared(src, n)) {
+        return false;
+    }
+
+    dma_mem_request_t *request = dma_mem_request_take(done, arg);
+    if (!request) {
+        return false;
+    }
+
+    // The ends share cache lines with whatever is next to them
+    uint8_t       *d = dst;
+    uint8_t const *s = src;
+    why_memcpy(d, s, head);
+    why_memcpy(d + head + body, s + head + body, n - head - body);
+
+    if (esp_async_memcpy(copier, d + head, (void *)(s + head), body, dma_mem_copied, request) != ESP_OK) {
+        atomic_flag_clear(&request->busy);
+        return false;
+    }
+    return true;
+}
+
+bool dma_mem_fill_start(void *dst, uint8_t c, size_t n, dma_mem_done_t done, void *arg) {
+    size_t head = -(uintptr_t)dst & (dma_mem_line_size() - 1);
+    size_t rows = n > head ? (n - head) / DMA_MEM_FILL_ROW_BYTES : 0;
+
+    if (!filler || n < DMA_MEM_MIN_SIZE || !rows || rows > DMA_MEM_FILL_MAX_ROWS || !dma_mem_shared(dst, n)) {
+        return false;
+    }
+
+    dma_mem_request_t *request = dma_mem_request_take(done, arg);
+    if (!request) {
+        return false;
+    }
+
+    uint8_t *d    = dst;
+    size_t   body = rows * DMA_MEM_FILL_ROW_BYTES;
+    why_memset(d, c, head);
+    why_memset(d + head + body, c, n - head - body);
+
+    ppa_fill_oper_config_t oper_config = {
+        .out.buffer         = d + head,
+        .out.buffer_size    = body,
+        .out.pic_w          = DMA_MEM_FILL_ROW_PIXELS,
+        .out.pic_h          = rows,
+        .out.block_offset_x = 0,
+        .out.block_offset_y = 0,
+        .out.fill_cm        = PPA_FILL_COLOR_MODE_ARGB8888,
+
+        .fill_block_w    = DMA_MEM_FILL_ROW_PIXELS,
+        .fill_block_h    = rows,
+        .fill_argb_color = {.val = c * 0x01010101u},
+        .mode            = PPA_TRANS_MODE_NON_BLOCKING,
+        .user_data       = request,
+    };
+
+    if (ppa_do_fill(filler, &oper_config) != ESP_OK) {
+        atomic_flag_clear(&request->busy);
+        return false;
+    }
+    return true;
+}
+
+// Where the DMA finds n bytes at ptr, aliased if they are in the heap of the
+// calling task. NULL if they can't be aliased.
+static void *dma_mem_visible(void const *ptr, size_t n, bool *aliased) {
+    *aliased = !dma_mem_shared(ptr, n);
+    return *aliased ? memory_alias_map(ptr, n) : (void *)ptr;
+}
+
+void dma_mem_copy(void *dst, void const *src, size_t n) {
+    bool  dst_aliased = false;
+    bool  src_aliased = false;
+    void *d           = NULL;
+    void *s           = NULL;
+    bool  started     = false;
+
+    if (n >= DMA_MEM_MIN_SIZE && copier) {
+        d = dma_mem_visible(dst, n, &dst_aliased);
+        s = d ? dma_mem_visible(src, n, &src_aliased) : NULL;
+    }
+
+    if (s) {
+        dma_mem_wait_t wait;
+        wait.done = xSemaphoreCreateBinaryStatic(&wait.storage);
+        started   = dma_mem_copy_start(d, s, n, dma_mem_wake, &wait);
+        if (started) {
+            xSemaphoreTake(wait.done, portMAX_DELAY);
+        }
+    }
+
+    if (dst_aliased) {
+        memory_alias_release(d, dst, n);
+    }
+    if (src_aliased) {
+        memory_alias_release(s, src, n);
+    }
+
+    // Only once the aliases are gone, releasing them drops the lines of the
+    // task's vaddrs from the caches
+    if (!started) {
+        why_memcpy(dst, src, n);
+    }
+}
+
+void dma_mem_fill(void *dst, uint8_t c, size_t n) {
+    // Larger fills take several turns
+    size_t dma_size = MIN(n, DMA_MEM_FILL_MAX_ROWS * DMA_MEM_FILL_ROW_BYTES);
+    bool   aliased  = false;
+    void  *d        = NULL;
+    bool   started  = false;
+
+    if (n >= DMA_MEM_MIN_SIZE && filler) {
+        d = dma_mem_visible(dst, dma_size, &aliased);
+    }
+
+    if (d) {
+        dma_mem_wait_t wait;
+        wait.done = xSemaphoreCreateBinaryStatic(&wait.storage);
+        started   = dma_mem_fill_start(d, c, dma_size, dma_mem_wake, &wait);
+        if (started) {
+            xSemaphoreTake(wait.done, portMAX_DELAY);
+        }
+    }
+
+    if (aliased) {
+        memory_alias_release(d, dst, dma_size);
+    }
+
+    if (!started) {
+        why_memset(dst, c, n);
+    } else if (dma_size < n) {
+        dma_mem_fill((uint8_t *)dst + dma_size, c, n - dma_size);
+    }
+}
+
+bool dma_mem_init(void) {
+    async_memcpy_config_t copier_config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+    copier_config.backlog               = DMA_MEM_BACKLOG;
+    copier_config.dma_burst_size        = 64;
+
+    if (esp_async_memcpy_install_gdma_axi(&copier_config, &copier) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to install the DMA copier");
+        copier = NULL;
+    }
+
+    ppa_client_config_t filler_config = {
+        .oper_type             = PPA_OPERATION_FILL,
+        .max_pending_trans_num = DMA_MEM_BACKLOG,
+    };
+    ppa_event_callbacks_t filler_events = {.on_trans_done = dma_mem_filled};
+
+    if (ppa_register_client(&filler_config, &filler) != ESP_OK ||
+        ppa_client_register_event_callbacks(filler, &filler_events) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to register the DMA filler");
+        filler = NULL;
+    }
+
+    return copier && filler;
+}
@@ -0,0 +1,46 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Large copies and fills by DMA, so the CPU can get on with something else
+// while megabytes move. Copies go through the AXI GDMA, fills through the
+// 2D-DMA of the PPA. Both take care of the caches. Whatever isn't on a cache
+// line at either end is done by the CPU.
+
+// Called from the DMA interrupt once everything is in memory, returns whether
+// a higher priority task was woken
+typedef bool (*dma_mem_done_t)(void *arg);
+
+// Allowed to fail, everything is then done by the CPU
+bool dma_mem_init(void);
+
+// Start copying or filling, false if the DMA can't take it and nothing was
+// done, for small sizes, when src and dst aren't equally far from a cache
+// line, or memory that isn't mapped for every task. Otherwise done is called
+// once it is all there. dst and src must stay valid until then.
+bool dma_mem_copy_start(void *dst, void const *src, size_t n, dma_mem_done_t done, void *arg);
+bool dma_mem_fill_start(void *dst, uint8_t c, size_t n, dma_mem_done_t done, void *arg);
+
+// Return once it is done, by DMA where it can be. The heap of the calling task
+// is aliased for the DMA meanwhile, see memory_alias_map().
+void dma_mem_copy(void *dst, void const *src, size_t n);
+void dma_mem_fill(void *dst, uint8_t c, size_t n);
@@ -0,0 +1,262 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dns_cache.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/def.h"
+#include "lwip/ip_addr.h"
+#include "lwip/memp.h"
+#include "lwip/netdb.h"
+#include "task.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+
+#define TAG "dns_cache"
+
+#define DNS_CACHE_ENTRIES      16
+// Longer names are left to lwIP
+#define DNS_CACHE_NAME_MAX     64
+// lwIP doesn't hand out the TTL of a record, it honours it in its own small
+// table. A name is asked of lwIP again after this at the latest.
+#define DNS_CACHE_TTL          (300 * 1000000LL)
+#define DNS_CACHE_NEGATIVE_TTL (10 * 1000000LL)
+// Names used this recently are looked up again when they are about to expire
+#define DNS_CACHE_RECENT       (120 * 1000000LL)
+#define DNS_CACHE_PREFETCH     (30 * 1000000LL)
+#define PHEME_INTERVAL_MS      10000
+#define PHEME_CORE             0
+
+typedef struct {
+    char                    name[DNS_CACHE_NAME_MAX]; // Empty if the entry is free
+    int                     family;                   // Asked for, AF_UNSPEC for either
+    int                     error;                    // Of a name that didn't resolve
+    struct sockaddr_storage addr;                     // With port 0
+    int64_t                 expires;
+    int64_t                 used;
+} dns_entry_t;
+
+extern int __real_lwip_getaddrinfo(
+    char const *nodename, char const *servname, struct addrinfo const *hints, struct addrinfo **res
+);
+
+static SemaphoreHandle_t dns_lock;
+static TaskHandle_t      pheme_handle;
+static dns_entry_t       dns_table[DNS_CACHE_ENTRIES];
+
+static dns_entry_t *dns_find(char const *name, int family) {
+    for (int i = 0; i < DNS_CACHE_ENTRIES; ++i) {
+        if (dns_table[i].name[0] && dns_table[i].family == family && !strcasecmp(dns_table[i].name, name)) {
+            return &dns_table[i];
+        }
+    }
+    return NULL;
+}
+
+// Look name up with lwIP, without a port
+static int dns_resolve(char const *name, int family, struct sockaddr_storage *addr) {
+    struct addrinfo  hints = {.ai_family = family};
+    struct addrinfo *res   = NULL;
+
+    int error = __real_lwip_getaddrinfo(name, NULL, &hints, &res);
+    if (!error) {
+        memset(addr, 0, sizeof(struct sockaddr_storage));
+        memcpy(addr, res->ai_addr, MIN(res->ai_addrlen, sizeof(struct sockaddr_storage)));
+        lwip_freeaddrinfo(res);
+    }
+    return error;
+}
+
+static void dns_store(char const *name, int family, int error, struct sockaddr_storage const *addr) {
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(dns_lock, portMAX_DELAY);
+    dns_entry_t *entry = dns_find(name, family);
+    if (!entry) {
+        // Free entries were never used
+        entry = &dns_table[0];
+        for (int i = 1; i < DNS_CACHE_ENTRIES; ++i) {
+            if (dns_table[i].used < entry->used) {
+                entry = &dns_table[i];
+            }
+        }
+        strlcpy(entry->name, name, sizeof(entry->name));
+        entry->family = family;
+    }
+
+    entry->error   = error;
+    entry->expires = now + (error ? DNS_CACHE_NEGATIVE_TTL : DNS_CACHE_TTL);
+    entry->used    = now;
+    if (!error) {
+        entry->addr = *addr;
+    }
+    xSemaphoreGive(dns_lock);
+}
+
+// Laid out the way lwIP does it, so that lwip_freeaddrinfo() frees it
+static int dns_result(
+    char const                    *nodename,
+    struct sockaddr_storage const *addr,
+    int                            port,
+    struct addrinfo const         *hints,
+    struct addrinfo              **res
+) {
+    struct addrinfo *ai = memp_malloc(MEMP_NETDB);
+    if (!ai) {
+        return EAI_MEMORY;
+    }
+
+    struct sockaddr_storage *sa = (struct sockaddr_storage *)((uint8_t *)ai + sizeof(struct addrinfo));
+    memset(ai, 0, sizeof(struct addrinfo));
+    *sa = *addr;
+#if LWIP_IPV6
+    if (sa->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)sa)->sin6_port = lwip_htons(port);
+    } else
+#endif
+    {
+        ((struct sockaddr_in *)sa)->sin_port = lwip_htons(port);
+    }
+
+    ai->ai_family = sa->ss_family;
+    if (hints) {
+        ai->ai_socktype = hints->ai_socktype;
+        ai->ai_protocol = hints->ai_protocol;
+    }
+    ai->ai_canonname = (char *)sa + sizeof(struct sockaddr_storage);
+    strcpy(ai->ai_canonname, nodename);
+    ai->ai_addrlen = sizeof(struct sockaddr_storage);
+    ai->ai_addr    = (struct sockaddr *)sa;
+
+    *res = ai;
+    return 0;
+}
+
+int __wrap_lwip_getaddrinfo(
+    char const *nodename, char const *servname, struct addrinfo const *hints, struct addrinfo **res
+) {
+    int       family = hints ? hints->ai_family : AF_UNSPEC;
+    ip_addr_t numeric;
+
+    // Numeric addresses don't need a server, whatever else is odd lwIP deals with
+    if (!dns_lock || !nodename || !res || strlen(nodename) >= DNS_CACHE_NAME_MAX ||
+        (hints && (hints->ai_flags & AI_NUMERICHOST)) || ipaddr_aton(nodename, &numeric) ||
+        (family != AF_UNSPEC && family != AF_INET && family != AF_INET6)) {
+        return __real_lwip_getaddrinfo(nodename, servname, hints, res);
+    }
+
+    // Only port numbers, like lwIP
+    int port = 0;
+    if (servname) {
+        port = atoi(servname);
+        if ((port == 0 && servname[0] != '0') || port < 0 || port > 0xffff) {
+            return EAI_SERVICE;
+        }
+    }
+
+    struct sockaddr_storage addr;
+    int                     error;
+
+    xSemaphoreTake(dns_lock, portMAX_DELAY);
+    int64_t      now   = esp_timer_get_time();
+    dns_entry_t *entry = dns_find(nodename, family);
+    if (entry && entry->expires > now) {
+        entry->used = now;
+        error       = entry->error;
+        addr        = entry->addr;
+        xSemaphoreGive(dns_lock);
+
+        ESP_LOGD(TAG, "%s from the cache%s", nodename, error ? ", doesn't resolve" : "");
+        return error ? error : dns_result(nodename, &addr, port, hints, res);
+    }
+    xSemaphoreGive(dns_lock);
+
+    error = dns_resolve(nodename, family, &addr);
+    // Running out of memory says nothing about the name
+    if (!error || error == EAI_FAIL || error == EAI_NONAME) {
+        dns_store(nodename, family, error, &addr);
+    }
+    return error ? error : dns_result(nodename, &addr, port, hints, res);
+}
+
+// Look up the names that are still in use before they expire, one at a time
+// as the lock isn't held while lwIP is at it
+static void pheme(void *ignored) {
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(PHEME_INTERVAL_MS));
+
+        for (int i = 0; i < DNS_CACHE_ENTRIES; ++i) {
+            dns_entry_t *entry = &dns_table[i];
+            char         name[DNS_CACHE_NAME_MAX];
+            int          family;
+
+            xSemaphoreTake(dns_lock, portMAX_DELAY);
+            int64_t now = esp_timer_get_time();
+            bool    due = entry->name[0] && !entry->error && now - entry->used < DNS_CACHE_RECENT;
+            due         = due && entry->expires - now < DNS_CACHE_PREFETCH;
+            if (due) {
+                strcpy(name, entry->name);
+                family = entry->family;
+            }
+            xSemaphoreGive(dns_lock);
+
+            struct sockaddr_storage addr;
+            // A name that doesn't resolve now keeps its address until it expires
+            if (!due || dns_resolve(name, family, &addr)) {
+                continue;
+            }
+
+            xSemaphoreTake(dns_lock, portMAX_DELAY);
+            // Unless it was replaced in the meantime
+            if (entry->family == family && !strcmp(entry->name, name)) {
+                entry->addr    = addr;
+                entry->expires = esp_timer_get_time() + DNS_CACHE_TTL;
+                ESP_LOGD(TAG, "Looked up %s again", name);
+            }
+            xSemaphoreGive(dns_lock);
+        }
+    }
+}
+
+bool dns_cache_init() {
+    dns_lock = xSemaphoreCreateMutex();
+    if (!dns_lock) {
+        ESP_LOGE(TAG, "Unable to create the lock");
+        return false;
+    }
+
+    // Without Pheme names are only looked up again once they expired
+    if (create_kernel_task(pheme, "Pheme", 3072, NULL, TASK_PRIORITY_LOW, &pheme_handle, PHEME_CORE) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create PHEME task");
+    }
+    return true;
+}
+
+void dns_cache_flush() {
+    if (!dns_lock) {
+        return;
+    }
+
+    xSemaphoreTake(dns_lock, portMAX_DELAY);
+    memset(dns_table, 0, sizeof(dns_table));
+    xSemaphoreGive(dns_lock);
+}
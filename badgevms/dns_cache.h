@@ -0,0 +1,32 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Every getaddrinfo() in the system, curl through esp-tls as well as programs,
+// goes through lwip_getaddrinfo(), which is wrapped at link time to look the
+// name up here first. Names that failed to resolve are remembered for a short
+// while too. Pheme looks up names that were used recently again before they
+// expire, so that programs that keep talking to the same hosts don't wait for
+// the wifi link.
+
+// Allowed to fail, every name is then looked up by lwIP
+bool dns_cache_init();
+
+// Forget every name, for when the network changes
+void dns_cache_flush();
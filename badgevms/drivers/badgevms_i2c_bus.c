@@ -18,11 +18,18 @@
 
 #include "badgevms_config.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "i2c_bus.h"
 #include "task.h"
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <sys/param.h>
 
 #define SDA_PIN 18
 #define SCL_PIN 20
@@ -33,6 +40,10 @@
 #define I2C_MASTER_FREQ_HZ I2C0_MASTER_FREQ_HZ
 #define I2C_MASTER_TIMEOUT 100
 
+// Transfers waiting for Charon, per bus
+#define CHARON_QUEUE_LENGTH 16
+#define CHARON_CORE         0
+
 #define TAG "badgevms_i2c_bus"
 
 static i2c_config_t why_config = {
@@ -50,6 +61,8 @@ typedef struct {
     i2c_config_t     config;
     bool             devices[255];
     char const      *name;
+    QueueHandle_t    queue; // Of i2c_transfer_t, for Charon
+    TaskHandle_t     charon;
 } badgevms_i2c_bus_device_t;
 
 typedef struct {
@@ -60,6 +73,21 @@ typedef struct {
     uint32_t                   clk_speed;
 } badgevms_i2c_device_t;
 
+// A transfer somebody waits for. Charon can't reach the memory of programs, so
+// read() and write() copy through data, in the kernel heap, in the context of
+// the caller. Charon frees the call if the caller was killed while it waited.
+typedef struct {
+    TaskHandle_t      caller;
+    StaticSemaphore_t done_buffer;
+    SemaphoreHandle_t done;
+    esp_err_t         err;
+    uint8_t           data[];
+} i2c_call_t;
+
+// A transfer with a NULL done callback frees the device after everything
+// queued before it
+#define I2C_TRANSFER_DESTROY(dev) ((i2c_transfer_t){.device = (i2c_device_t *)(dev)})
+
 i2c_device_t *badgevms_i2c_device_create(badgevms_i2c_bus_device_t *bus, uint8_t address, uint32_t clk_speed);
 
 static int i2c_bus_open(void *dev, path_t *path, int flags, mode_t mode) {
@@ -99,7 +127,11 @@ static i2c_device_t *_i2c_device_create(void *dev, uint8_t address, uint32_t clk
         return NULL;
     }
 
-    return badgevms_i2c_device_create(device, address, clk_speed);
+    i2c_device_t *i2c_dev = badgevms_i2c_device_create(device, address, clk_speed);
+    if (i2c_dev) {
+        task_record_resource_alloc(RES_DEVICE, i2c_dev);
+    }
+    return i2c_dev;
 }
 
 static int i2c_device_open(void *dev, path_t *path, int flags, mode_t mode) {
@@ -114,46 +146,72 @@ static int i2c_device_close(void *dev, int fd) {
     return -1;
 }
 
-static ssize_t i2c_device_write(void *dev, int fd, void const *buf, size_t count) {
-    badgevms_i2c_device_t *device = dev;
-    esp_err_t              err;
-
-    if (count == 1) {
-        err = i2c_bus_write_byte(device->handle, fd, *((uint8_t *)buf));
-        if (err == ESP_OK) {
-            return 1;
-        }
+static void i2c_call_done(void *arg, esp_err_t err) {
+    i2c_call_t *call = arg;
 
-        return 0;
+    call->err = err;
+    if (eTaskGetState(call->caller) == eDeleted) {
+        free(call);
+        return;
     }
+    xSemaphoreGive(call->done);
+}
 
-    err = i2c_bus_write_bytes(device->handle, fd, count, (uint8_t *)buf);
-    if (err == ESP_OK) {
-        return count;
+// Queue a transfer that finishes call and wait for it
+static esp_err_t i2c_call_wait(
+    i2c_call_t *call, i2c_device_t *device, uint8_t reg, bool read, uint8_t *data, uint16_t len
+) {
+    call->caller = xTaskGetCurrentTaskHandle();
+    call->done   = xSemaphoreCreateBinaryStatic(&call->done_buffer);
+    call->err    = ESP_OK;
+
+    i2c_transfer_t transfer = {
+        .device = device,
+        .reg    = reg,
+        .read   = read,
+        .data   = data,
+        .len    = len,
+        .done   = i2c_call_done,
+        .arg    = call,
+    };
+    if (!badgevms_i2c_submit(&transfer, portMAX_DELAY)) {
+        return ESP_ERR_TIMEOUT;
     }
-
-    return 0;
+    xSemaphoreTake(call->done, portMAX_DELAY);
+    return call->err;
 }
 
-static ssize_t i2c_device_read(void *dev, int fd, void *buf, size_t count) {
-    badgevms_i2c_device_t *device = dev;
-    esp_err_t              err;
-
-    if (count == 1) {
-        err = i2c_bus_read_byte(device->handle, fd, ((uint8_t *)buf));
-        if (err == ESP_OK) {
-            return 1;
-        }
+// fd is the register, as with the i2c_bus functions. Threads of a process may
+// share the device, their transfers queue up behind each other.
+static ssize_t i2c_device_transfer(badgevms_i2c_device_t *device, int fd, bool read, void *buf, size_t count) {
+    if (count > UINT16_MAX) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
 
-        return 0;
+    i2c_call_t *call = malloc(sizeof(i2c_call_t) + count);
+    if (!call) {
+        get_task_info()->_errno = ENOMEM;
+        return -1;
+    }
+    if (!read) {
+        memcpy(call->data, buf, count);
     }
 
-    err = i2c_bus_read_bytes(device->handle, fd, count, (uint8_t *)buf);
-    if (err == ESP_OK) {
-        return count;
+    esp_err_t err = i2c_call_wait(call, (i2c_device_t *)device, fd, read, call->data, count);
+    if (err == ESP_OK && read) {
+        memcpy(buf, call->data, count);
     }
+    free(call);
+    return err == ESP_OK ? count : 0;
+}
 
-    return 0;
+static ssize_t i2c_device_write(void *dev, int fd, void const *buf, size_t count) {
+    return i2c_device_transfer(dev, fd, false, (void *)buf, count);
+}
+
+static ssize_t i2c_device_read(void *dev, int fd, void *buf, size_t count) {
+    return i2c_device_transfer(dev, fd, true, buf, count);
 }
 
 static ssize_t i2c_device_lseek(void *dev, int fd, off_t offset, int whence) {
@@ -168,9 +226,53 @@ static uint8_t i2c_device_get_address(void *dev) {
 static void i2c_device_destroy(void *dev) {
     badgevms_i2c_device_t *device = dev;
     task_record_resource_free(RES_DEVICE, dev);
-    i2c_bus_device_delete(device->handle);
     device->bus->devices[device->address] = false;
-    free(dev);
+
+    // A killed thread may have left a transfer in the queue
+    i2c_transfer_t transfer = I2C_TRANSFER_DESTROY(dev);
+    badgevms_i2c_submit(&transfer, portMAX_DELAY);
+}
+
+bool badgevms_i2c_submit(i2c_transfer_t const *transfer, uint32_t timeout_ticks) {
+    badgevms_i2c_device_t *device = (badgevms_i2c_device_t *)transfer->device;
+    return xQueueSend(device->bus->queue, transfer, timeout_ticks) == pdTRUE;
+}
+
+esp_err_t badgevms_i2c_transfer(i2c_device_t *device, uint8_t reg, bool read, uint8_t *data, uint16_t len) {
+    // Kernel tasks aren't killed, the call can live on the stack
+    i2c_call_t call;
+    return i2c_call_wait(&call, device, reg, read, data, len);
+}
+
+// Owns the bus, does the transfers of every device on it in the order they
+// were queued
+static void charon(void *arg) {
+    badgevms_i2c_bus_device_t *bus = arg;
+    i2c_transfer_t             transfer;
+
+    while (1) {
+        xQueueReceive(bus->queue, &transfer, portMAX_DELAY);
+        badgevms_i2c_device_t *device = (badgevms_i2c_device_t *)transfer.device;
+
+        if (!transfer.done) {
+            i2c_bus_device_delete(&device->handle);
+            free(device);
+            continue;
+        }
+
+        esp_err_t err;
+        if (transfer.read) {
+            err = i2c_bus_read_bytes(device->handle, transfer.reg, transfer.len, transfer.data);
+        } else {
+            err = i2c_bus_write_bytes(device->handle, transfer.reg, transfer.len, transfer.data);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGD(
+                TAG, "%s: transfer with device 0x%02x failed: %s", bus->name, device->address, esp_err_to_name(err)
+            );
+        }
+        transfer.done(transfer.arg, err);
+    }
 }
 
 i2c_device_t *badgevms_i2c_device_create(badgevms_i2c_bus_device_t *bus, uint8_t address, uint32_t clk_speed) {
@@ -196,20 +298,31 @@ i2c_device_t *badgevms_i2c_device_create(badgevms_i2c_bus_device_t *bus, uint8_t
     }
 
     dev->bus       = bus;
-    dev->clk_speed = clk_speed;
+    dev->clk_speed = MIN(clk_speed, I2C_MAX_FREQ_HZ);
     dev->address   = address;
-    dev->handle    = i2c_bus_device_create(bus->handle, address, clk_speed);
+
+    // At its own clock, 0 is that of the bus
+    dev->handle = i2c_bus_device_create(bus->handle, address, dev->clk_speed);
     if (!dev->handle) {
         ESP_LOGE(TAG, "Failed to allocate i2c device");
         free(dev);
         return NULL;
     }
 
-    task_record_resource_alloc(RES_DEVICE, dev);
     dev->bus->devices[address] = true;
     return i2c_dev;
 }
 
+i2c_device_t *badgevms_i2c_kernel_device_create(device_t *bus, uint8_t address, uint32_t clk_speed) {
+    badgevms_i2c_bus_device_t *device = (badgevms_i2c_bus_device_t *)bus;
+    if (device->devices[address]) {
+        ESP_LOGW(TAG, "%s: Device %i already opened", device->name, address);
+        return NULL;
+    }
+
+    return badgevms_i2c_device_create(device, address, clk_speed);
+}
+
 device_t *badgevms_i2c_bus_create(char const *name, uint8_t port, uint32_t clk_speed) {
     ESP_LOGI(TAG, "Initializing");
     badgevms_i2c_bus_device_t *dev      = calloc(1, sizeof(badgevms_i2c_bus_device_t));
@@ -245,5 +358,21 @@ device_t *badgevms_i2c_bus_create(char const *name, uint8_t port, uint32_t clk_s
         return NULL;
     }
 
+    dev->queue = xQueueCreate(CHARON_QUEUE_LENGTH, sizeof(i2c_transfer_t));
+    if (!dev->queue) {
+        ESP_LOGE(TAG, "Failed to create the transfer queue");
+        i2c_bus_delete(&dev->handle);
+        free(dev);
+        return NULL;
+    }
+
+    if (create_kernel_task(charon, "Charon", 3072, dev, TASK_PRIORITY, &dev->charon, CHARON_CORE) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create CHARON task");
+        vQueueDelete(dev->queue);
+        i2c_bus_delete(&dev->handle);
+        free(dev);
+        return NULL;
+    }
+
     return (device_t *)dev;
 }
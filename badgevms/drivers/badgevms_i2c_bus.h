@@ -17,5 +17,30 @@
 #pragma once
 
 #include "badgevms/device.h"
+#include "esp_err.h"
 
-device_t *badgevms_i2c_bus_create(char const *name, uint8_t port, uint32_t clk_speed);
+#include <stdbool.h>
+#include <stdint.h>
+
+// A transfer for Charon, the task that owns the bus. Charon does the transfers
+// of every device on a bus one after the other, in the order they were
+// submitted, and calls done from its own context, so it shouldn't block.
+typedef struct {
+    i2c_device_t *device; // Of the bus, see i2c_bus_device_t
+    uint8_t       reg;    // NULL_I2C_MEM_ADDR for none
+    bool          read;
+    uint8_t      *data; // Until done is called
+    uint16_t      len;
+    void (*done)(void *arg, esp_err_t err);
+    void *arg;
+} i2c_transfer_t;
+
+device_t     *badgevms_i2c_bus_create(char const *name, uint8_t port, uint32_t clk_speed);
+// A device for a kernel driver, not owned by any process. Programs can't open
+// its address anymore.
+i2c_device_t *badgevms_i2c_kernel_device_create(device_t *bus, uint8_t address, uint32_t clk_speed);
+// Queue transfer without waiting for it, false if the queue stayed full for
+// timeout_ticks. read() and write() on a device go through here as well.
+bool          badgevms_i2c_submit(i2c_transfer_t const *transfer, uint32_t timeout_ticks);
+// Queue a transfer and wait for it, data must be in kernel memory
+esp_err_t     badgevms_i2c_transfer(i2c_device_t *device, uint8_t reg, bool read, uint8_t *data, uint16_t len);
@@ -17,12 +17,26 @@
 #include "bosch_bmi270.h"
 
 #include "badgevms_config.h"
+#include "badgevms_i2c_bus.h"
+#include "badgevms/event.h"
+#include "badgevms/motion.h"
 #include "bmi270.h"
+#include "compositor/compositor_private.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "task.h"
+#include "wait_private.h"
 
 #include <stdatomic.h>
 
+#include <errno.h>
 #include <math.h>
+#include <string.h>
+#include <sys/param.h>
 
 #define BMI270_I2C_ADDR 0x69
 
@@ -37,6 +51,22 @@
 
 #define GRAVITY_EARTH (9.80665f)
 
+// Atlas drains the FIFO this often while the orientation is being read or the
+// device is open, and slower when nobody asked for it in a while. The FIFO
+// holds about 1.5 seconds at 100 Hz.
+#define ATLAS_INTERVAL_MS  20
+#define ATLAS_IDLE_MS      500
+#define ATLAS_IDLE_AFTER   2000
+#define ATLAS_CORE         0
+// Header byte plus accel and gyro
+#define FIFO_FRAME_SIZE    (1 + BMI2_FIFO_ACC_GYR_LENGTH)
+#define FIFO_FRAMES        64
+// How much of the angle the gyro decides every sample, gravity pulls the
+// rest back so it doesn't drift
+#define FUSION_GYRO_WEIGHT 0.98f
+// Opens of the device at the same time
+#define MOTION_READERS     4
+
 /*! Macros to select the sensors                   */
 #define ACCEL UINT8_C(0x00)
 #define GYRO  UINT8_C(0x01)
@@ -46,14 +76,38 @@
 
 static i2c_bus_handle_t i2c_bus;
 
+typedef struct {
+    task_thread_t   *thread;   // Of the process that opened it, NULL if free
+    motion_sample_t *queue;    // MOTION_QUEUE_SAMPLES
+    uint32_t         head;     // Samples queued since the open
+    uint32_t         tail;     // Samples read or dropped since the open
+    uint16_t         batch;
+    bool             notified; // Sent EVENT_MOTION, nothing was read since
+    wait_list_t      waiters;  // Of poll(), woken when samples come in
+} motion_reader_t;
+
 typedef struct {
     orientation_device_t device;
     bmi270_handle_t      sensor;
-    atomic_flag          open;
-    float                degrees;
+    TaskHandle_t         atlas;
+    _Atomic float        degrees;      // Fused, [0, 360)
+    atomic_uint          last_read_ms; // Of the last orientation query
+    bool                 fused;        // Whether degrees holds anything yet
+    motion_config_t      active;       // What the sensor runs at, only Atlas touches it
+    SemaphoreHandle_t    lock;         // Of everything below
+    motion_config_t      config;       // Of the last write, batch unused
+    bool                 reconfigure;  // config isn't active yet
+    atomic_int           num_readers;
+    motion_reader_t      readers[MOTION_READERS];
 } bosch_bmi270_device_t;
 
-static int8_t set_accel_gyro_config(struct bmi2_dev *bmi);
+static motion_config_t const motion_config_default = {
+    .rate_hz        = 100,
+    .accel_range_g  = 2,
+    .gyro_range_dps = 2000,
+};
+
+static int8_t set_accel_gyro_config(struct bmi2_dev *bmi, motion_config_t const *motion);
 static float  lsb_to_mps2(int16_t val, float g_range, uint8_t bit_width);
 static float  lsb_to_dps(int16_t val, float dps, uint8_t bit_width);
 void          why_bmi2_error_codes_print_result(int8_t rslt);
@@ -326,85 +380,376 @@ void why_bmi2_error_codes_print_result(int8_t rslt) {
     }
 }
 
+// The sensor register values for config, false if the sensor can't do it.
+// Accel and gyro take the same rate values.
+static bool motion_config_regs(motion_config_t const *config, uint8_t *odr, uint8_t *acc_range, uint8_t *gyr_range) {
+    switch (config->rate_hz) {
+        case 25: *odr = BMI2_ACC_ODR_25HZ; break;
+        case 50: *odr = BMI2_ACC_ODR_50HZ; break;
+        case 100: *odr = BMI2_ACC_ODR_100HZ; break;
+        case 200: *odr = BMI2_ACC_ODR_200HZ; break;
+        case 400: *odr = BMI2_ACC_ODR_400HZ; break;
+        default: return false;
+    }
+    switch (config->accel_range_g) {
+        case 2: *acc_range = BMI2_ACC_RANGE_2G; break;
+        case 4: *acc_range = BMI2_ACC_RANGE_4G; break;
+        case 8: *acc_range = BMI2_ACC_RANGE_8G; break;
+        case 16: *acc_range = BMI2_ACC_RANGE_16G; break;
+        default: return false;
+    }
+    switch (config->gyro_range_dps) {
+        case 125: *gyr_range = BMI2_GYR_RANGE_125; break;
+        case 250: *gyr_range = BMI2_GYR_RANGE_250; break;
+        case 500: *gyr_range = BMI2_GYR_RANGE_500; break;
+        case 1000: *gyr_range = BMI2_GYR_RANGE_1000; break;
+        case 2000: *gyr_range = BMI2_GYR_RANGE_2000; break;
+        default: return false;
+    }
+    return true;
+}
+
+static motion_reader_t *motion_reader(bosch_bmi270_device_t *device, int fd) {
+    if (fd < 0 || fd >= MOTION_READERS || !device->readers[fd].thread) {
+        get_task_info()->_errno = EBADF;
+        return NULL;
+    }
+    return &device->readers[fd];
+}
+
 static int bmi270_open(void *dev, path_t *path, int flags, mode_t mode) {
-    return 0;
+    bosch_bmi270_device_t *device = dev;
+
+    motion_sample_t *queue = heap_caps_malloc(MOTION_QUEUE_SAMPLES * sizeof(motion_sample_t), MALLOC_CAP_SPIRAM);
+    if (!queue) {
+        get_task_info()->_errno = ENOMEM;
+        return -1;
+    }
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    for (int fd = 0; fd < MOTION_READERS; ++fd) {
+        if (!device->readers[fd].thread) {
+            device->readers[fd] = (motion_reader_t){.thread = get_task_info()->thread, .queue = queue};
+            atomic_fetch_add(&device->num_readers, 1);
+            xSemaphoreGive(device->lock);
+
+            // Out of its idle sleep
+            xTaskNotifyGive(device->atlas);
+            return fd;
+        }
+    }
+    xSemaphoreGive(device->lock);
+
+    heap_caps_free(queue);
+    get_task_info()->_errno = EBUSY;
+    return -1;
 }
 
 static int bmi270_close(void *dev, int fd) {
-    if (fd)
+    bosch_bmi270_device_t *device = dev;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    motion_reader_t *reader = motion_reader(device, fd);
+    if (!reader) {
+        xSemaphoreGive(device->lock);
         return -1;
+    }
+
+    // They find the file closed
+    wait_list_wake(&reader->waiters);
+
+    motion_sample_t *queue = reader->queue;
+    *reader                = (motion_reader_t){0};
+    bool reset = atomic_fetch_sub(&device->num_readers, 1) == 1 &&
+                 memcmp(&device->config, &motion_config_default, sizeof(motion_config_t));
+    if (reset) {
+        device->config      = motion_config_default;
+        device->reconfigure = true;
+    }
+    xSemaphoreGive(device->lock);
+
+    heap_caps_free(queue);
+    if (reset) {
+        xTaskNotifyGive(device->atlas);
+    }
     return 0;
 }
 
 static ssize_t bmi270_read(void *dev, int fd, void *buf, size_t count) {
-    if (fd)
+    bosch_bmi270_device_t *device  = dev;
+    motion_sample_t       *samples = buf;
+
+    if (count < sizeof(motion_sample_t)) {
+        get_task_info()->_errno = EINVAL;
         return -1;
-    return 0;
+    }
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    motion_reader_t *reader = motion_reader(device, fd);
+    if (!reader) {
+        xSemaphoreGive(device->lock);
+        return -1;
+    }
+
+    uint32_t num = MIN(count / sizeof(motion_sample_t), reader->head - reader->tail);
+    for (uint32_t i = 0; i < num; ++i) {
+        samples[i] = reader->queue[reader->tail++ % MOTION_QUEUE_SAMPLES];
+    }
+    reader->notified = false;
+    xSemaphoreGive(device->lock);
+
+    if (!num) {
+        get_task_info()->_errno = EAGAIN;
+        return -1;
+    }
+    return num * sizeof(motion_sample_t);
 }
 
 static ssize_t bmi270_write(void *dev, int fd, void const *buf, size_t count) {
-    return -1;
+    bosch_bmi270_device_t *device = dev;
+    motion_config_t        config;
+    uint8_t                odr, acc_range, gyr_range;
+
+    if (count != sizeof(motion_config_t)) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+    memcpy(&config, buf, sizeof(motion_config_t));
+    if (!motion_config_regs(&config, &odr, &acc_range, &gyr_range)) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    motion_reader_t *reader = motion_reader(device, fd);
+    if (!reader) {
+        xSemaphoreGive(device->lock);
+        return -1;
+    }
+
+    reader->batch = MIN(config.batch, MOTION_QUEUE_SAMPLES);
+    config.batch  = 0;
+    bool changed  = memcmp(&device->config, &config, sizeof(motion_config_t));
+    if (changed) {
+        device->config      = config;
+        device->reconfigure = true;
+    }
+    xSemaphoreGive(device->lock);
+
+    // The sensor is Atlas's, it applies the settings between two drains
+    if (changed) {
+        xTaskNotifyGive(device->atlas);
+    }
+    return count;
+}
+
+// Readable with samples queued, or once the file is closed so read() says so
+static int bmi270_ready(void *dev, int fd, int events) {
+    bosch_bmi270_device_t *device = dev;
+    motion_reader_t       *reader = &device->readers[fd];
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    int ready = WAIT_WRITABLE;
+    if (!reader->thread || reader->head != reader->tail) {
+        ready |= WAIT_READABLE;
+    }
+    xSemaphoreGive(device->lock);
+    return ready & events;
+}
+
+static wait_list_t *bmi270_waiters(void *dev, int fd) {
+    bosch_bmi270_device_t *device = dev;
+    return &device->readers[fd].waiters;
 }
 
 static ssize_t bmi270_lseek(void *dev, int fd, off_t offset, int whence) {
     return -1;
 }
 
-static int get_orientation_degrees(void *dev) {
-    bosch_bmi270_device_t *device = dev;
+static float wrap_degrees(float degrees) {
+    degrees = fmodf(degrees, 360.0f);
+    return degrees < 0 ? degrees + 360.0f : degrees;
+}
 
-    int8_t rslt;
+// Complementary filter over one sample of both sensors, around the axis
+// perpendicular to the screen
+static void fuse_sample(bosch_bmi270_device_t *device, motion_sample_t const *sample) {
+    float tilt    = tilt_angle_deg(sample->accel[0], sample->accel[1]);
+    float degrees = atomic_load(&device->degrees);
 
-    /* Assign accel and gyro sensor to variable. */
-    uint8_t sensor_list[2] = {BMI2_ACCEL, BMI2_GYRO};
+    if (!device->fused) {
+        if (isnan(tilt)) {
+            return;
+        }
+        device->fused = true;
+        atomic_store(&device->degrees, tilt);
+        return;
+    }
 
-    /* Structure to define type of sensor and their respective data. */
-    struct bmi2_sens_data sensor_data;
+    degrees += sample->gyro[2] / device->active.rate_hz;
+    // Lying flat there is no gravity to go by
+    if (!isnan(tilt)) {
+        float error  = wrap_degrees(tilt - degrees + 180.0f) - 180.0f;
+        degrees     += (1.0f - FUSION_GYRO_WEIGHT) * error;
+    }
+    atomic_store(&device->degrees, wrap_degrees(degrees));
+}
 
-    float                   acc_x = 0, acc_y = 0, acc_z = 0;
-    struct bmi2_sens_config config;
+// Append samples to the queue of every reader, and tell the processes whose
+// batch is complete
+static void motion_queue(bosch_bmi270_device_t *device, motion_sample_t const *samples, int num) {
+    task_thread_t *notify[MOTION_READERS];
+    uint32_t       queued[MOTION_READERS];
+    int            num_notify = 0;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    for (int fd = 0; fd < MOTION_READERS; ++fd) {
+        motion_reader_t *reader = &device->readers[fd];
+        if (!reader->thread) {
+            continue;
+        }
 
-    if (atomic_flag_test_and_set(&device->open)) {
-        // Return cached result
-        return (int)device->degrees;
+        for (int i = 0; i < num; ++i) {
+            reader->queue[reader->head++ % MOTION_QUEUE_SAMPLES] = samples[i];
+        }
+        // Drop the oldest
+        if (reader->head - reader->tail > MOTION_QUEUE_SAMPLES) {
+            reader->tail = reader->head - MOTION_QUEUE_SAMPLES;
+        }
+        wait_list_wake(&reader->waiters);
+
+        uint32_t count = reader->head - reader->tail;
+        if (reader->batch && !reader->notified && count >= reader->batch) {
+            reader->notified     = true;
+            notify[num_notify]   = reader->thread;
+            queued[num_notify++] = count;
+        }
     }
+    xSemaphoreGive(device->lock);
 
-    /* Accel and gyro configuration settings. */
-    rslt = set_accel_gyro_config(device->sensor);
-    why_bmi2_error_codes_print_result(rslt);
+    // Not under the lock, so readers don't wait for the window stack
+    for (int i = 0; i < num_notify; ++i) {
+        event_t event = {.type = EVENT_MOTION, .motion.samples = queued[i]};
+        compositor_send_process_event(notify[i], &event);
+    }
+}
 
-    if (rslt == BMI2_OK) {
-        /* NOTE:
-         * Accel and Gyro enable must be done after setting configurations
-         */
-        rslt = bmi2_sensor_enable(sensor_list, 2, device->sensor);
+// Atlas shares the bus with everybody else through Charon
+static BMI2_INTF_RETURN_TYPE atlas_i2c_read(uint8_t reg, uint8_t *data, uint32_t len, void *intf_ptr) {
+    esp_err_t err = badgevms_i2c_transfer(intf_ptr, reg, true, data, len);
+    return err == ESP_OK ? BMI2_INTF_RET_SUCCESS : BMI2_E_COM_FAIL;
+}
+
+static BMI2_INTF_RETURN_TYPE atlas_i2c_write(uint8_t reg, uint8_t const *data, uint32_t len, void *intf_ptr) {
+    esp_err_t err = badgevms_i2c_transfer(intf_ptr, reg, false, (uint8_t *)data, len);
+    return err == ESP_OK ? BMI2_INTF_RET_SUCCESS : BMI2_E_COM_FAIL;
+}
+
+static void atlas_drain(bosch_bmi270_device_t *device) {
+    static uint8_t                    fifo_data[FIFO_FRAMES * FIFO_FRAME_SIZE];
+    static struct bmi2_sens_axes_data acc[FIFO_FRAMES];
+    static struct bmi2_sens_axes_data gyr[FIFO_FRAMES];
+    static motion_sample_t            samples[FIFO_FRAMES];
+
+    uint16_t fifo_length = 0;
+    int8_t   rslt        = bmi2_get_fifo_length(&fifo_length, device->sensor);
+    if (rslt != BMI2_OK || !fifo_length) {
         why_bmi2_error_codes_print_result(rslt);
+        return;
+    }
 
-        if (rslt == BMI2_OK) {
-            config.type = BMI2_ACCEL;
-
-            /* Get the accel configurations. */
-            rslt = bmi2_get_sensor_config(&config, 1, device->sensor);
-            why_bmi2_error_codes_print_result(rslt);
-
-            while (true) { // sensor takes a while to answer
-                rslt = bmi2_get_sensor_data(&sensor_data, device->sensor);
-                why_bmi2_error_codes_print_result(rslt);
-
-                if ((rslt == BMI2_OK) && (sensor_data.status & BMI2_DRDY_ACC) && (sensor_data.status & BMI2_DRDY_GYR)) {
-                    /* Converting lsb to meter per second squared for 16 bit accelerometer at 2G range. */
-                    acc_x           = lsb_to_mps2(sensor_data.acc.x, (float)2, device->sensor->resolution);
-                    acc_y           = lsb_to_mps2(sensor_data.acc.y, (float)2, device->sensor->resolution);
-                    acc_z           = lsb_to_mps2(sensor_data.acc.z, (float)2, device->sensor->resolution);
-                    device->degrees = tilt_angle_deg(acc_x, acc_y);
-                    break;
-                }
-            }
-        }
+    // Whatever doesn't fit is left for the next round
+    struct bmi2_fifo_frame fifo = {
+        .data   = fifo_data,
+        .length = MIN(fifo_length + device->sensor->dummy_byte, sizeof(fifo_data)),
+    };
+    rslt = bmi2_read_fifo_data(&fifo, device->sensor);
+    if (rslt != BMI2_OK) {
+        why_bmi2_error_codes_print_result(rslt);
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    uint16_t num_acc = FIFO_FRAMES;
+    uint16_t num_gyr = FIFO_FRAMES;
+    bmi2_extract_accel(acc, &num_acc, &fifo, device->sensor);
+    bmi2_extract_gyro(gyr, &num_gyr, &fifo, device->sensor);
+
+    // The FIFO has no time in it, the last frame is taken to be from now
+    int     num        = MIN(num_acc, num_gyr);
+    int64_t period_us  = 1000000 / device->active.rate_hz;
+    float   acc_range  = device->active.accel_range_g;
+    float   gyr_range  = device->active.gyro_range_dps;
+    uint8_t resolution = device->sensor->resolution;
+    for (int i = 0; i < num; ++i) {
+        motion_sample_t *sample = &samples[i];
+
+        sample->timestamp_us = now - (num - 1 - i) * period_us;
+        sample->accel[0]     = lsb_to_mps2(acc[i].x, acc_range, resolution);
+        sample->accel[1]     = lsb_to_mps2(acc[i].y, acc_range, resolution);
+        sample->accel[2]     = lsb_to_mps2(acc[i].z, acc_range, resolution);
+        sample->gyro[0]      = lsb_to_dps(gyr[i].x, gyr_range, resolution);
+        sample->gyro[1]      = lsb_to_dps(gyr[i].y, gyr_range, resolution);
+        sample->gyro[2]      = lsb_to_dps(gyr[i].z, gyr_range, resolution);
+        fuse_sample(device, sample);
+    }
+
+    if (num && atomic_load(&device->num_readers)) {
+        motion_queue(device, samples, num);
+    }
+}
+
+// Apply the settings of the last write(), after the samples taken with the
+// old ones were drained
+static void atlas_configure(bosch_bmi270_device_t *device) {
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    bool            reconfigure = device->reconfigure;
+    motion_config_t config      = device->config;
+    device->reconfigure         = false;
+    xSemaphoreGive(device->lock);
+
+    if (!reconfigure) {
+        return;
+    }
+
+    int8_t rslt = set_accel_gyro_config(device->sensor, &config);
+    if (rslt == BMI2_OK) {
+        // Anything that came in meanwhile is in the old units
+        rslt = bmi2_set_command_register(BMI2_FIFO_FLUSH_CMD, device->sensor);
+    }
+    if (rslt != BMI2_OK) {
+        ESP_LOGW(TAG, "Unable to change the sensor settings");
+        return;
+    }
+    device->active = config;
+}
+
+// Keeps the orientation up to date from the sensor FIFO, so that asking for
+// it costs nothing, and the queues of the readers of the device filled
+static void atlas(void *arg) {
+    bosch_bmi270_device_t *device = arg;
+
+    while (1) {
+        atlas_drain(device);
+        atlas_configure(device);
+
+        uint32_t idle  = (uint32_t)(esp_timer_get_time() / 1000) - atomic_load(&device->last_read_ms);
+        bool     busy  = atomic_load(&device->num_readers) || idle <= ATLAS_IDLE_AFTER;
+        uint32_t sleep = busy ? ATLAS_INTERVAL_MS : ATLAS_IDLE_MS;
+        // A query after a quiet spell, an open or a write wakes us up early
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep));
     }
-    bmi270_sensor_disable(sensor_list, 2, device->sensor);
-    atomic_flag_clear(&device->open);
-    return (int)device->degrees;
+}
+
+static int get_orientation_degrees(void *dev) {
+    bosch_bmi270_device_t *device = dev;
+
+    uint32_t now  = esp_timer_get_time() / 1000;
+    uint32_t idle = now - atomic_exchange(&device->last_read_ms, now);
+    if (idle > ATLAS_IDLE_AFTER) {
+        xTaskNotifyGive(device->atlas);
+    }
+    return (int)atomic_load(&device->degrees);
 }
 
 static orientation_t get_orientation(void *dev) {
@@ -424,12 +769,14 @@ device_t *bosch_bmi270_sensor_create() {
     orientation_device_t  *orientation_dev = (orientation_device_t *)dev;
     device_t              *base_dev        = (device_t *)dev;
 
-    base_dev->type   = DEVICE_TYPE_ORIENTATION;
-    base_dev->_open  = bmi270_open;
-    base_dev->_close = bmi270_close;
-    base_dev->_write = bmi270_write;
-    base_dev->_read  = bmi270_read;
-    base_dev->_lseek = bmi270_lseek;
+    base_dev->type     = DEVICE_TYPE_ORIENTATION;
+    base_dev->_open    = bmi270_open;
+    base_dev->_close   = bmi270_close;
+    base_dev->_write   = bmi270_write;
+    base_dev->_read    = bmi270_read;
+    base_dev->_lseek   = bmi270_lseek;
+    base_dev->_ready   = bmi270_ready;
+    base_dev->_waiters = bmi270_waiters;
 
     orientation_dev->_get_orientation         = get_orientation;
     orientation_dev->_get_orientation_degrees = get_orientation_degrees;
@@ -464,6 +811,63 @@ device_t *bosch_bmi270_sensor_create() {
         return NULL;
     }
 
+    // The library set the chip up on its own, from here on its transfers
+    // queue up with the rest
+    device_t     *bus = device_get("I2CBUS0");
+    i2c_device_t *i2c = NULL;
+    if (bus) {
+        i2c = badgevms_i2c_kernel_device_create(bus, BMI270_I2C_ADDR, BMI270_I2C_FREQ_HZ);
+    }
+    if (i2c) {
+        dev->sensor->intf_ptr = i2c;
+        dev->sensor->read     = atlas_i2c_read;
+        dev->sensor->write    = atlas_i2c_write;
+    } else {
+        ESP_LOGW(TAG, "Reading the sensor without I2CBUS0");
+    }
+
+    dev->lock = xSemaphoreCreateMutex();
+    if (!dev->lock) {
+        ESP_LOGE(TAG, "Unable to create the lock");
+        free(dev);
+        return NULL;
+    }
+    dev->config = motion_config_default;
+    dev->active = motion_config_default;
+
+    // Left running, Atlas reads what piles up in the FIFO
+    uint8_t sensor_list[2] = {BMI2_ACCEL, BMI2_GYRO};
+    int8_t  rslt           = set_accel_gyro_config(dev->sensor, &dev->active);
+    if (rslt == BMI2_OK) {
+        rslt = bmi2_sensor_enable(sensor_list, 2, dev->sensor);
+    }
+    if (rslt == BMI2_OK) {
+        // The FIFO needs the sensor out of advanced power save
+        rslt = bmi2_set_adv_power_save(BMI2_DISABLE, dev->sensor);
+    }
+    if (rslt == BMI2_OK) {
+        rslt = bmi2_set_fifo_config(BMI2_FIFO_ALL_EN | BMI2_FIFO_TIME_EN, BMI2_DISABLE, dev->sensor);
+    }
+    if (rslt == BMI2_OK) {
+        uint16_t fifo_config = BMI2_FIFO_ACC_EN | BMI2_FIFO_GYR_EN | BMI2_FIFO_HEADER_EN;
+        rslt                 = bmi2_set_fifo_config(fifo_config, BMI2_ENABLE, dev->sensor);
+    }
+    if (rslt != BMI2_OK) {
+        why_bmi2_error_codes_print_result(rslt);
+        ESP_LOGE(TAG, "Failed starting bosch bmi270 sensor");
+        vSemaphoreDelete(dev->lock);
+        free(dev);
+        return NULL;
+    }
+
+    atomic_store(&dev->last_read_ms, (uint32_t)(esp_timer_get_time() / 1000) - ATLAS_IDLE_AFTER);
+    if (create_kernel_task(atlas, "Atlas", 3072, dev, TASK_PRIORITY_LOW, &dev->atlas, ATLAS_CORE) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create ATLAS task");
+        vSemaphoreDelete(dev->lock);
+        free(dev);
+        return NULL;
+    }
+
     ESP_LOGW(TAG, "BMI270 initialized");
 
     return (device_t *)dev;
@@ -472,10 +876,15 @@ device_t *bosch_bmi270_sensor_create() {
 /*!
  * @brief This internal API is used to set configurations for accel and gyro.
  */
-static int8_t set_accel_gyro_config(struct bmi2_dev *bmi) {
+static int8_t set_accel_gyro_config(struct bmi2_dev *bmi, motion_config_t const *motion) {
     /* Status of api are returned to this variable. */
     int8_t rslt;
 
+    uint8_t odr, acc_range, gyr_range;
+    if (!motion_config_regs(motion, &odr, &acc_range, &gyr_range)) {
+        return BMI2_E_OUT_OF_RANGE;
+    }
+
     /* Structure to define accelerometer and gyro configuration. */
     struct bmi2_sens_config config[2];
 
@@ -494,10 +903,10 @@ static int8_t set_accel_gyro_config(struct bmi2_dev *bmi) {
     if (rslt == BMI2_OK) {
         /* NOTE: The user can change the following configuration parameters according to their requirement. */
         /* Set Output Data Rate */
-        config[ACCEL].cfg.acc.odr = BMI2_ACC_ODR_200HZ;
+        config[ACCEL].cfg.acc.odr = odr;
 
         /* Gravity range of the sensor (+/- 2G, 4G, 8G, 16G). */
-        config[ACCEL].cfg.acc.range = BMI2_ACC_RANGE_2G;
+        config[ACCEL].cfg.acc.range = acc_range;
 
         /* The bandwidth parameter is used to configure the number of sensor samples that are averaged
          * if it is set to 2, then 2^(bandwidth parameter) samples
@@ -519,10 +928,10 @@ static int8_t set_accel_gyro_config(struct bmi2_dev *bmi) {
 
         /* The user can change the following configuration parameters according to their requirement. */
         /* Set Output Data Rate */
-        config[GYRO].cfg.gyr.odr = BMI2_GYR_ODR_200HZ;
+        config[GYRO].cfg.gyr.odr = odr;
 
         /* Gyroscope Angular Rate Measurement Range.By default the range is 2000dps. */
-        config[GYRO].cfg.gyr.range = BMI2_GYR_RANGE_2000;
+        config[GYRO].cfg.gyr.range = gyr_range;
 
         /* Gyroscope bandwidth parameters. By default the gyro bandwidth is in normal mode. */
         config[GYRO].cfg.gyr.bwp = BMI2_GYR_NORMAL_MODE;
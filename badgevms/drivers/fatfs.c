@@ -16,20 +16,30 @@
 
 #include "fatfs.h"
 
+#include "compositor/compositor_private.h"
 #include "driver/sdmmc_host.h"
+#include "esp_heap_caps.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
 #include "pathfuncs_private.h"
 #include "sd_test_io.h"
 #include "sdkconfig.h"
 #include "sdmmc_cmd.h"
+#include "task.h"
+#include "trace.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -54,11 +64,52 @@
 #define SDCARD_PWR_CTRL_LDO_IO_ID       4
 #define SDCARD_PWR_CTRL_LDO_INTERNAL_IO 1
 
-#undef SDCARD_SDMMC_SPEED_HS
-#undef SDCARD_SDMMC_SPEED_UHS_I_SDR50
-#undef SDCARD_SDMMC_SPEED_UHS_I_DDR50
+#define SD_SPEED_NVS_NAMESPACE "badgevms_sd"
 
-#define IS_UHS1 (SDCARD_SDMMC_SPEED_UHS_I_SDR50 || SDCARD_SDMMC_SPEED_UHS_I_DDR50)
+// Sectors read twice by the test after switching modes, at the start, middle
+// and end of the card
+#define SD_TEST_SECTORS 32
+
+// Fastest first, the card falls back down the list
+typedef enum {
+    SD_SPEED_SDR50,
+    SD_SPEED_DDR50,
+    SD_SPEED_HS,
+    SD_SPEED_DEFAULT,
+    SD_SPEED_NUM,
+} sd_speed_t;
+
+typedef struct {
+    char const *name;
+    int         freq_khz;
+    bool        uhs1; // 1.8 V signalling
+    bool        ddr;
+} sd_speed_mode_t;
+
+static sd_speed_mode_t const sd_speed_modes[SD_SPEED_NUM] = {
+    [SD_SPEED_SDR50]   = {"UHS-I SDR50", SDMMC_FREQ_SDR50, true, false},
+    [SD_SPEED_DDR50]   = {"UHS-I DDR50", SDMMC_FREQ_DDR50, true, true},
+    [SD_SPEED_HS]      = {"high speed", SDMMC_FREQ_HIGHSPEED, false, false},
+    [SD_SPEED_DEFAULT] = {"default speed", SDMMC_FREQ_DEFAULT, false, false},
+};
+
+#if CONFIG_BADGEVMS_SD_SPEED_MAX_SDR50
+#define SD_SPEED_FIRST SD_SPEED_SDR50
+#elif CONFIG_BADGEVMS_SD_SPEED_MAX_DDR50
+#define SD_SPEED_FIRST SD_SPEED_DDR50
+#elif CONFIG_BADGEVMS_SD_SPEED_MAX_HS
+#define SD_SPEED_FIRST SD_SPEED_HS
+#else
+#define SD_SPEED_FIRST SD_SPEED_DEFAULT
+#endif
+
+// The mode that worked for the last card, tried first next boot
+typedef struct {
+    uint8_t  mfg_id;
+    uint8_t  speed;
+    uint16_t oem_id;
+    uint32_t serial;
+} sd_speed_record_t;
 
 typedef struct {
     filesystem_device_t  filesystem;
@@ -92,6 +143,14 @@ static ssize_t fatfs_lseek(void *dev, int fd, off_t offset, int whence) {
     return lseek(fd, offset, whence);
 }
 
+static ssize_t fatfs_pread(void *dev, int fd, void *buf, size_t count, off_t offset) {
+    return pread(fd, buf, count, offset);
+}
+
+static ssize_t fatfs_pwrite(void *dev, int fd, void const *buf, size_t count, off_t offset) {
+    return pwrite(fd, buf, count, offset);
+}
+
 static int fatfs_stat(void *dev, path_t *path, struct stat *restrict statbuf) {
     fatfs_device_t *device   = dev;
     char           *unixpath = path_to_unix(path);
@@ -143,6 +202,630 @@ static int fatfs_closedir(void *dev, DIR *dirp) {
     return closedir(dirp);
 }
 
+// Hephaestus does all work on the flash file system. Writing flash stalls both
+// cores, so small writes are gathered into a sector and written when the
+// compositor just finished a frame, and no application is left holding the
+// locks of FatFS or wear levelling when it is killed. Applications can't be
+// reached from the kernel core, everything goes through the call, which lives
+// in the kernel heap. Writes return as soon as they are queued, an error
+// writing them comes back from close(). The kernel can hand it work of its own
+// that writes files, see flash_work_run().
+
+#define HEPHAESTUS_QUEUE_LENGTH 16
+#define HEPHAESTUS_STAGES       4
+#define HEPHAESTUS_CALL_MAX     (16 * 1024) // Data that goes along with a call
+#define HEPHAESTUS_IDLE_MS      50          // Staged writes are written when no call came in for this long
+#define HEPHAESTUS_FRAME_MS     20          // Longest wait for the compositor to finish a frame
+
+typedef enum {
+    FLASH_OPEN,
+    FLASH_CLOSE,
+    FLASH_READ,
+    FLASH_WRITE,
+    FLASH_LSEEK,
+    FLASH_STAT,
+    FLASH_FSTAT,
+    FLASH_UNLINK,
+    FLASH_RENAME,
+    FLASH_MKDIR,
+    FLASH_RMDIR,
+    FLASH_OPENDIR,
+    FLASH_READDIR,
+    FLASH_CLOSEDIR,
+    FLASH_WORK,
+} flash_op_t;
+
+typedef struct {
+    flash_op_t   op;
+    TaskHandle_t caller; // NULL if nobody waits for the result, Hephaestus frees the call
+    int          fd;
+    int          flags;
+    mode_t       mode;
+    off_t        offset;
+    int          whence;
+    size_t       count;
+    DIR         *dir;
+    ssize_t      result;
+    void        *result_ptr;
+    int          error; // errno if result is -1 or result_ptr NULL
+    struct stat  st;
+    flash_work_t work;
+    void        *work_arg;
+    char         path[PATH_MAX_LEN + 3];
+    char         new_path[PATH_MAX_LEN + 3];
+    uint8_t      data[];
+} flash_call_t;
+
+// Writes of one file that wait to be gathered into a sector
+typedef struct {
+    int      fd; // -1 if unused
+    size_t   len;
+    int      error;
+    uint32_t last_used;
+    uint8_t *buf;
+} flash_stage_t;
+
+static QueueHandle_t     hephaestus_queue;
+static TaskHandle_t      hephaestus_handle;
+static flash_stage_t     stages[HEPHAESTUS_STAGES];
+static uint32_t          stage_counter;
+static flash_call_t     *work_call; // Of flash_work_run(), one at a time
+static SemaphoreHandle_t work_lock;
+static flash_deferred_t *deferred_list;
+static portMUX_TYPE      deferred_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void hephaestus_call(flash_call_t *call);
+
+static flash_call_t *flash_call_alloc(flash_op_t op, size_t data_size) {
+    flash_call_t *call = heap_caps_malloc(sizeof(flash_call_t) + data_size, MALLOC_CAP_SPIRAM);
+    if (call) {
+        call->op         = op;
+        call->caller     = xTaskGetCurrentTaskHandle();
+        call->result     = -1;
+        call->result_ptr = NULL;
+        call->error      = 0;
+    }
+    return call;
+}
+
+// Work handed to Hephaestus uses the file system too, it can't wait for itself
+static bool on_hephaestus(void) {
+    return xTaskGetCurrentTaskHandle() == hephaestus_handle;
+}
+
+// Hand call to Hephaestus and wait for it, the caller frees it after
+static void flash_call(flash_call_t *call) {
+    if (on_hephaestus()) {
+        hephaestus_call(call);
+    } else {
+        xQueueSend(hephaestus_queue, &call, portMAX_DELAY);
+        ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+    }
+    if (call->error) {
+        get_task_info()->_errno = call->error;
+    }
+}
+
+static void flash_stage_flush(flash_stage_t *stage) {
+    uint8_t *buf = stage->buf;
+    size_t   len = stage->len;
+
+    if (!len) {
+        return;
+    }
+
+    compositor_frame_wait(HEPHAESTUS_FRAME_MS);
+    trace_event(TRACE_HEPHAESTUS_WRITE, len, 0);
+    while (len) {
+        ssize_t written = write(stage->fd, buf, len);
+        if (written <= 0) {
+            ESP_LOGE("hephaestus", "Lost %zu bytes written to fd %d", len, stage->fd);
+            stage->error = written ? errno : EIO;
+            break;
+        }
+        buf += written;
+        len -= written;
+    }
+    stage->len = 0;
+}
+
+static void flash_stages_flush(void) {
+    for (int i = 0; i < HEPHAESTUS_STAGES; ++i) {
+        if (stages[i].fd != -1) {
+            flash_stage_flush(&stages[i]);
+        }
+    }
+}
+
+static flash_stage_t *flash_stage_find(int fd) {
+    for (int i = 0; i < HEPHAESTUS_STAGES; ++i) {
+        if (stages[i].fd == fd) {
+            return &stages[i];
+        }
+    }
+    return NULL;
+}
+
+// Write what is staged for fd, returns the error of an earlier write and forgets it
+static int flash_stage_sync(int fd) {
+    flash_stage_t *stage = flash_stage_find(fd);
+    if (!stage) {
+        return 0;
+    }
+
+    flash_stage_flush(stage);
+    int error    = stage->error;
+    stage->error = 0;
+    return error;
+}
+
+// The stage of fd, taking the least recently used one if it has none
+static flash_stage_t *flash_stage_get(int fd) {
+    flash_stage_t *stage = flash_stage_find(fd);
+    if (!stage) {
+        stage = &stages[0];
+        for (int i = 0; i < HEPHAESTUS_STAGES; ++i) {
+            if (stages[i].fd == -1) {
+                stage = &stages[i];
+                break;
+            }
+            if (stages[i].last_used < stage->last_used) {
+                stage = &stages[i];
+            }
+        }
+        if (stage->fd != -1) {
+            flash_stage_flush(stage);
+            if (stage->error) {
+                ESP_LOGE("hephaestus", "Dropping the write error of fd %d", stage->fd);
+            }
+        }
+        stage->fd    = fd;
+        stage->error = 0;
+    }
+    stage->last_used = ++stage_counter;
+    return stage;
+}
+
+static void hephaestus_write(flash_call_t *call) {
+    flash_stage_t *stage = flash_stage_get(call->fd);
+
+    if (stage->len + call->count > CONFIG_WL_SECTOR_SIZE) {
+        flash_stage_flush(stage);
+    }
+    if (call->count < CONFIG_WL_SECTOR_SIZE) {
+        memcpy(stage->buf + stage->len, call->data, call->count);
+        stage->len += call->count;
+        return;
+    }
+
+    compositor_frame_wait(HEPHAESTUS_FRAME_MS);
+    trace_event(TRACE_HEPHAESTUS_WRITE, call->count, 0);
+    if (write(call->fd, call->data, call->count) != (ssize_t)call->count && !stage->error) {
+        stage->error = errno ? errno : EIO;
+    }
+}
+
+static void hephaestus_close(flash_call_t *call) {
+    int            error = flash_stage_sync(call->fd);
+    flash_stage_t *stage = flash_stage_find(call->fd);
+    if (stage) {
+        stage->fd = -1;
+    }
+
+    call->result = close(call->fd);
+    if (error) {
+        call->result = -1;
+        errno        = error;
+    }
+}
+
+// Run the deferred work that is due, returns how long until the next is
+static TickType_t hephaestus_deferred_run(void) {
+    while (1) {
+        flash_deferred_t *due  = NULL;
+        TickType_t        next = portMAX_DELAY;
+        TickType_t        now  = xTaskGetTickCount();
+
+        taskENTER_CRITICAL(&deferred_lock);
+        for (flash_deferred_t **link = &deferred_list; *link; link = &(*link)->next) {
+            TickType_t left = (*link)->due - now;
+            if ((int32_t)left <= 0) {
+                due         = *link;
+                *link       = due->next;
+                due->queued = false;
+                break;
+            }
+            next = MIN(next, left);
+        }
+        taskEXIT_CRITICAL(&deferred_lock);
+
+        if (!due) {
+            return next;
+        }
+        due->work(due->arg);
+    }
+}
+
+static void hephaestus_call(flash_call_t *call) {
+    errno = 0;
+
+    if (call->op == FLASH_WORK) {
+        call->work(call->work_arg);
+        call->result = 0;
+        call->error  = 0;
+        return;
+    }
+
+    // Calls on an open file only need its own writes, the rest can see any file
+    switch (call->op) {
+        case FLASH_WRITE:
+        case FLASH_CLOSE: break;
+        case FLASH_READ:
+        case FLASH_LSEEK:
+        case FLASH_FSTAT: flash_stage_sync(call->fd); break;
+        default: flash_stages_flush();
+    }
+
+    switch (call->op) {
+        case FLASH_OPEN: call->result = open(call->path, call->flags, call->mode); break;
+        case FLASH_CLOSE: hephaestus_close(call); break;
+        case FLASH_READ: call->result = read(call->fd, call->data, call->count); break;
+        case FLASH_WRITE: hephaestus_write(call); break;
+        case FLASH_LSEEK: call->result = lseek(call->fd, call->offset, call->whence); break;
+        case FLASH_STAT: call->result = stat(call->path, &call->st); break;
+        case FLASH_FSTAT: call->result = fstat(call->fd, &call->st); break;
+        case FLASH_UNLINK: call->result = unlink(call->path); break;
+        case FLASH_RENAME: call->result = rename(call->path, call->new_path); break;
+        case FLASH_MKDIR: call->result = mkdir(call->path, call->mode); break;
+        case FLASH_RMDIR: call->result = rmdir(call->path); break;
+        case FLASH_OPENDIR: call->result_ptr = opendir(call->path); break;
+        case FLASH_READDIR: call->result_ptr = readdir(call->dir); break;
+        case FLASH_CLOSEDIR: call->result = closedir(call->dir); break;
+    }
+
+    bool failed = call->op == FLASH_OPENDIR || call->op == FLASH_READDIR ? !call->result_ptr : call->result < 0;
+    call->error = failed ? errno : 0;
+}
+
+static void hephaestus(void *ignored) {
+    ESP_LOGW("HEPHAESTUS", "Starting");
+    while (1) {
+        // Deferred work may stage writes too
+        TickType_t timeout = hephaestus_deferred_run();
+        bool       staged  = false;
+        for (int i = 0; i < HEPHAESTUS_STAGES; ++i) {
+            staged |= stages[i].len != 0;
+        }
+
+        flash_call_t *call;
+        if (staged) {
+            timeout = MIN(timeout, pdMS_TO_TICKS(HEPHAESTUS_IDLE_MS));
+        }
+        if (xQueueReceive(hephaestus_queue, &call, timeout) != pdTRUE) {
+            flash_stages_flush();
+            continue;
+        }
+        if (!call) {
+            // Woken up for deferred work
+            continue;
+        }
+
+        hephaestus_call(call);
+        if (!call->caller) {
+            heap_caps_free(call);
+        } else if (eTaskGetState(call->caller) != eDeleted) {
+            xTaskNotifyGiveIndexed(call->caller, 0);
+        }
+    }
+}
+
+// Once for all file systems on the flash
+static bool hephaestus_init(void) {
+    if (hephaestus_handle) {
+        return true;
+    }
+
+    for (int i = 0; i < HEPHAESTUS_STAGES; ++i) {
+        stages[i].fd  = -1;
+        stages[i].buf = heap_caps_malloc(CONFIG_WL_SECTOR_SIZE, MALLOC_CAP_SPIRAM);
+        if (!stages[i].buf) {
+            return false;
+        }
+    }
+
+    hephaestus_queue = xQueueCreate(HEPHAESTUS_QUEUE_LENGTH, sizeof(flash_call_t *));
+    work_call        = flash_call_alloc(FLASH_WORK, 0);
+    work_lock        = xSemaphoreCreateMutex();
+    if (!hephaestus_queue || !work_call || !work_lock) {
+        return false;
+    }
+    // Work handed over goes through the devices and back into the file system
+    if (create_kernel_task(hephaestus, "Hephaestus", 6144, NULL, 5, &hephaestus_handle, 0) != pdPASS) {
+        hephaestus_handle = NULL;
+        return false;
+    }
+    return true;
+}
+
+static flash_call_t *flash_path_call(flash_op_t op, path_t *path) {
+    flash_call_t *call = flash_call_alloc(op, 0);
+    if (call) {
+        strcpy(call->path, path_to_unix(path));
+    }
+    return call;
+}
+
+// Returns result and frees call, -1 with ENOMEM if there is none
+static ssize_t flash_call_result(flash_call_t *call) {
+    if (!call) {
+        get_task_info()->_errno = ENOMEM;
+        return -1;
+    }
+
+    flash_call(call);
+    ssize_t result = call->result;
+    heap_caps_free(call);
+    return result;
+}
+
+static int flash_open(void *dev, path_t *path, int flags, mode_t mode) {
+    flash_call_t *call = flash_path_call(FLASH_OPEN, path);
+    if (call) {
+        call->flags = flags;
+        call->mode  = mode;
+    }
+    return flash_call_result(call);
+}
+
+static int flash_close(void *dev, int fd) {
+    flash_call_t *call = flash_call_alloc(FLASH_CLOSE, 0);
+    if (call) {
+        call->fd = fd;
+    }
+    return flash_call_result(call);
+}
+
+static ssize_t flash_write(void *dev, int fd, void const *buf, size_t count) {
+    for (size_t done = 0; done < count;) {
+        size_t        chunk = MIN(count - done, HEPHAESTUS_CALL_MAX);
+        flash_call_t *call  = flash_call_alloc(FLASH_WRITE, chunk);
+        if (!call) {
+            get_task_info()->_errno = ENOMEM;
+            return done ? done : -1;
+        }
+
+        call->caller = NULL;
+        call->fd     = fd;
+        call->count  = chunk;
+        memcpy(call->data, (uint8_t const *)buf + done, chunk);
+        if (on_hephaestus()) {
+            hephaestus_call(call);
+            heap_caps_free(call);
+        } else {
+            xQueueSend(hephaestus_queue, &call, portMAX_DELAY);
+        }
+        done += chunk;
+    }
+    return count;
+}
+
+static ssize_t flash_read(void *dev, int fd, void *buf, size_t count) {
+    if (!count) {
+        return 0;
+    }
+
+    size_t        done = 0;
+    flash_call_t *call = flash_call_alloc(FLASH_READ, MIN(count, HEPHAESTUS_CALL_MAX));
+    if (!call) {
+        get_task_info()->_errno = ENOMEM;
+        return -1;
+    }
+
+    while (done < count) {
+        call->fd    = fd;
+        call->count = MIN(count - done, HEPHAESTUS_CALL_MAX);
+        flash_call(call);
+        if (call->result <= 0) {
+            break;
+        }
+        memcpy((uint8_t *)buf + done, call->data, call->result);
+        done += call->result;
+        if ((size_t)call->result < call->count) {
+            break;
+        }
+    }
+
+    ssize_t result = done || !call->result ? (ssize_t)done : -1;
+    heap_caps_free(call);
+    return result;
+}
+
+static ssize_t flash_lseek(void *dev, int fd, off_t offset, int whence) {
+    flash_call_t *call = flash_call_alloc(FLASH_LSEEK, 0);
+    if (call) {
+        call->fd     = fd;
+        call->offset = offset;
+        call->whence = whence;
+    }
+    return flash_call_result(call);
+}
+
+static int flash_stat_call(flash_call_t *call, struct stat *restrict statbuf) {
+    if (!call) {
+        get_task_info()->_errno = ENOMEM;
+        return -1;
+    }
+
+    flash_call(call);
+    int result = call->result;
+    if (result == 0) {
+        *statbuf = call->st;
+    }
+    heap_caps_free(call);
+    return result;
+}
+
+static int flash_stat(void *dev, path_t *path, struct stat *restrict statbuf) {
+    return flash_stat_call(flash_path_call(FLASH_STAT, path), statbuf);
+}
+
+static int flash_fstat(void *dev, int fd, struct stat *restrict statbuf) {
+    flash_call_t *call = flash_call_alloc(FLASH_FSTAT, 0);
+    if (call) {
+        call->fd = fd;
+    }
+    return flash_stat_call(call, statbuf);
+}
+
+static int flash_unlink(void *dev, path_t *path) {
+    return flash_call_result(flash_path_call(FLASH_UNLINK, path));
+}
+
+static int flash_rename(void *dev, path_t *oldpath, path_t *newpath) {
+    flash_call_t *call = flash_path_call(FLASH_RENAME, oldpath);
+    if (call) {
+        strcpy(call->new_path, path_to_unix(newpath));
+    }
+    return flash_call_result(call);
+}
+
+static int flash_mkdir(void *dev, path_t *path, mode_t mode) {
+    flash_call_t *call = flash_path_call(FLASH_MKDIR, path);
+    if (call) {
+        call->mode = mode;
+    }
+    return flash_call_result(call);
+}
+
+static int flash_rmdir(void *dev, path_t *path) {
+    return flash_call_result(flash_path_call(FLASH_RMDIR, path));
+}
+
+static void *flash_call_result_ptr(flash_call_t *call) {
+    if (!call) {
+        get_task_info()->_errno = ENOMEM;
+        return NULL;
+    }
+
+    flash_call(call);
+    void *result = call->result_ptr;
+    heap_caps_free(call);
+    return result;
+}
+
+static DIR *flash_opendir(void *dev, path_t *path) {
+    return flash_call_result_ptr(flash_path_call(FLASH_OPENDIR, path));
+}
+
+// The entry lives in dirp, which is in the kernel heap
+static struct dirent *flash_readdir(void *dev, DIR *dirp) {
+    flash_call_t *call = flash_call_alloc(FLASH_READDIR, 0);
+    if (call) {
+        call->dir = dirp;
+    }
+    return flash_call_result_ptr(call);
+}
+
+static int flash_closedir(void *dev, DIR *dirp) {
+    flash_call_t *call = flash_call_alloc(FLASH_CLOSEDIR, 0);
+    if (call) {
+        call->dir = dirp;
+    }
+    return flash_call_result(call);
+}
+
+// Calls straight on the VFS, with the locks of the file system taken by the caller
+static void fatfs_ops_init(filesystem_device_t *fs_dev) {
+    device_t *base_dev = &fs_dev->device;
+    base_dev->type     = DEVICE_TYPE_FILESYSTEM;
+    base_dev->_open    = fatfs_open;
+    base_dev->_close   = fatfs_close;
+    base_dev->_write   = fatfs_write;
+    base_dev->_read    = fatfs_read;
+    base_dev->_lseek   = fatfs_lseek;
+    fs_dev->_stat      = fatfs_stat;
+    fs_dev->_fstat     = fatfs_fstat;
+    fs_dev->_unlink    = fatfs_unlink;
+    fs_dev->_rename    = fatfs_rename;
+    fs_dev->_mkdir     = fatfs_mkdir;
+    fs_dev->_rmdir     = fatfs_rmdir;
+    fs_dev->_opendir   = fatfs_opendir;
+    fs_dev->_readdir   = fatfs_readdir;
+    fs_dev->_closedir  = fatfs_closedir;
+    fs_dev->_pread     = fatfs_pread;
+    fs_dev->_pwrite    = fatfs_pwrite;
+}
+
+bool flash_work_run(flash_work_t work, void *arg) {
+    if (!hephaestus_handle) {
+        return false;
+    }
+    if (on_hephaestus()) {
+        work(arg);
+        return true;
+    }
+
+    xSemaphoreTake(work_lock, portMAX_DELAY);
+    work_call->caller   = xTaskGetCurrentTaskHandle();
+    work_call->work     = work;
+    work_call->work_arg = arg;
+    flash_call(work_call);
+    xSemaphoreGive(work_lock);
+    return true;
+}
+
+bool flash_work_defer(flash_deferred_t *deferred, uint32_t delay_ms) {
+    if (!hephaestus_handle) {
+        return false;
+    }
+
+    bool queued;
+    taskENTER_CRITICAL(&deferred_lock);
+    queued = deferred->queued;
+    if (!queued) {
+        deferred->due    = xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms);
+        deferred->queued = true;
+        deferred->next   = deferred_list;
+        deferred_list    = deferred;
+    }
+    taskEXIT_CRITICAL(&deferred_lock);
+
+    // Hephaestus looks at the time again once it is woken up
+    if (!queued && !on_hephaestus()) {
+        flash_call_t *wake = NULL;
+        xQueueSend(hephaestus_queue, &wake, portMAX_DELAY);
+    }
+    return true;
+}
+
+void flash_fs_ops_init(filesystem_device_t *fs_dev) {
+    fatfs_ops_init(fs_dev);
+
+    // Without Hephaestus applications work on the flash themselves
+    if (!hephaestus_init()) {
+        ESP_LOGE("fatfs-spi", "Failed to start Hephaestus");
+        return;
+    }
+
+    device_t *base_dev = &fs_dev->device;
+    base_dev->_open    = flash_open;
+    base_dev->_close   = flash_close;
+    base_dev->_write   = flash_write;
+    base_dev->_read    = flash_read;
+    base_dev->_lseek   = flash_lseek;
+    fs_dev->_stat      = flash_stat;
+    fs_dev->_fstat     = flash_fstat;
+    fs_dev->_unlink    = flash_unlink;
+    fs_dev->_rename    = flash_rename;
+    fs_dev->_mkdir     = flash_mkdir;
+    fs_dev->_rmdir     = flash_rmdir;
+    fs_dev->_opendir   = flash_opendir;
+    fs_dev->_readdir   = flash_readdir;
+    fs_dev->_closedir  = flash_closedir;
+    fs_dev->_pread     = NULL;
+    fs_dev->_pwrite    = NULL;
+}
+
 device_t *fatfs_create_spi(char const *devname, char const *partname, bool rw) {
     esp_vfs_fat_mount_config_t const mount_config = {
         .max_files              = 256,
@@ -151,7 +834,7 @@ device_t *fatfs_create_spi(char const *devname, char const *partname, bool rw) {
         .use_one_fat            = false,
     };
 
-    fatfs_device_t *dev = malloc(sizeof(fatfs_device_t));
+    fatfs_device_t *dev = calloc(1, sizeof(fatfs_device_t));
     dev->base_path      = malloc(strlen(devname) + 2);
     dev->base_path[0]   = '/';
     strcpy(dev->base_path + 1, devname);
@@ -162,27 +845,7 @@ device_t *fatfs_create_spi(char const *devname, char const *partname, bool rw) {
         goto error;
     }
 
-    // Initialize base device
-    device_t *base_dev = &dev->filesystem.device;
-    base_dev->type     = DEVICE_TYPE_FILESYSTEM;
-    base_dev->_open    = fatfs_open;
-    base_dev->_close   = fatfs_close;
-    base_dev->_write   = fatfs_write;
-    base_dev->_read    = fatfs_read;
-    base_dev->_lseek   = fatfs_lseek;
-
-    // Initialize filesystem-specific functions
-    filesystem_device_t *fs_dev = &dev->filesystem;
-    fs_dev->_stat               = fatfs_stat;
-    fs_dev->_fstat              = fatfs_fstat;
-    fs_dev->_unlink             = fatfs_unlink;
-    fs_dev->_rename             = fatfs_rename;
-    fs_dev->_mkdir              = fatfs_mkdir;
-    fs_dev->_rmdir              = fatfs_rmdir;
-    fs_dev->_opendir            = fatfs_opendir;
-    fs_dev->_readdir            = fatfs_readdir;
-    fs_dev->_closedir           = fatfs_closedir;
-
+    flash_fs_ops_init(&dev->filesystem);
     return (device_t *)dev;
 
 error:
@@ -191,6 +854,104 @@ error:
     return NULL;
 }
 
+static bool sd_speed_record_load(sd_speed_record_t *record) {
+    size_t       length = sizeof(*record);
+    nvs_handle_t handle;
+
+    if (nvs_open(SD_SPEED_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(handle, "speed", record, &length);
+    nvs_close(handle);
+
+    return err == ESP_OK && length == sizeof(*record) && record->speed < SD_SPEED_NUM;
+}
+
+static void sd_speed_record_save(sd_speed_record_t const *record) {
+    nvs_handle_t handle;
+    if (nvs_open(SD_SPEED_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW("fatfs-sd", "Unable to open NVS, the SD card modes will be tried again next boot");
+        return;
+    }
+    if (nvs_set_blob(handle, "speed", record, sizeof(*record)) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+        ESP_LOGW("fatfs-sd", "Unable to store the SD card mode");
+    }
+    nvs_close(handle);
+}
+
+static bool sd_speed_record_matches(sd_speed_record_t const *record, sdmmc_card_t const *card) {
+    return record->mfg_id == card->cid.mfg_id && record->oem_id == card->cid.oem_id &&
+           record->serial == (uint32_t)card->cid.serial;
+}
+
+// A mode the card accepted can still garble data on this board. Any CRC error
+// or timeout fails the read, and both reads must agree.
+static bool sd_read_test(sdmmc_card_t *card) {
+    size_t   size = SD_TEST_SECTORS * card->csd.sector_size;
+    uint8_t *buf  = heap_caps_aligned_alloc(64, 2 * size, MALLOC_CAP_DMA);
+    if (!buf) {
+        ESP_LOGW("fatfs-sd", "No memory for the read test, trusting the card");
+        return true;
+    }
+
+    size_t sectors  = card->csd.capacity;
+    size_t starts[] = {0, sectors / 2, sectors - SD_TEST_SECTORS};
+    bool   ok       = sectors >= SD_TEST_SECTORS;
+    for (size_t i = 0; ok && i < sizeof(starts) / sizeof(starts[0]); ++i) {
+        ok = sdmmc_read_sectors(card, buf, starts[i], SD_TEST_SECTORS) == ESP_OK &&
+             sdmmc_read_sectors(card, buf + size, starts[i], SD_TEST_SECTORS) == ESP_OK &&
+             !memcmp(buf, buf + size, size);
+    }
+
+    heap_caps_free(buf);
+    return ok;
+}
+
+static esp_err_t sd_mount(fatfs_device_t *dev, sd_speed_t speed, esp_vfs_fat_mount_config_t const *mount_config) {
+    sd_speed_mode_t const *mode = &sd_speed_modes[speed];
+
+    sdmmc_host_t host    = SDMMC_HOST_DEFAULT();
+    host.slot            = SDMMC_HOST_SLOT_0;
+    host.max_freq_khz    = mode->freq_khz;
+    host.pwr_ctrl_handle = dev->pwr_ctrl_handle;
+    if (!mode->ddr) {
+        host.flags &= ~SDMMC_HOST_FLAG_DDR;
+    }
+
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    if (mode->uhs1) {
+        slot_config.flags |= SDMMC_SLOT_FLAG_UHS1;
+    }
+    slot_config.gpio_cd = SDMMC_SLOT_NO_CD;
+    slot_config.gpio_wp = SDMMC_SLOT_NO_WP;
+
+    // Set bus width to use:
+    slot_config.width = 4;
+#ifdef CONFIG_SOC_SDMMC_USE_GPIO_MATRIX
+    slot_config.clk = SDCARD_PIN_CLK;
+    slot_config.cmd = SDCARD_PIN_CMD;
+    slot_config.d0  = SDCARD_PIN_D0;
+    slot_config.d1  = SDCARD_PIN_D1;
+    slot_config.d2  = SDCARD_PIN_D2;
+    slot_config.d3  = SDCARD_PIN_D3;
+#endif
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    esp_err_t err = esp_vfs_fat_sdmmc_mount(dev->base_path, &host, &slot_config, mount_config, &dev->sdmmc_handle);
+    if (err != ESP_OK) {
+        ESP_LOGW("fatfs-sd", "SD card doesn't work in %s mode: %s", mode->name, esp_err_to_name(err));
+        return err;
+    }
+
+    if (!sd_read_test(dev->sdmmc_handle)) {
+        ESP_LOGW("fatfs-sd", "SD card fails the read test in %s mode", mode->name);
+        esp_vfs_fat_sdcard_unmount(dev->base_path, dev->sdmmc_handle);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    return ESP_OK;
+}
+
 device_t *fatfs_create_sd(char const *devname, bool rw) {
     esp_vfs_fat_mount_config_t const mount_config = {
         .max_files              = 256,
@@ -199,7 +960,7 @@ device_t *fatfs_create_sd(char const *devname, bool rw) {
         .use_one_fat            = false,
     };
 
-    fatfs_device_t *dev = malloc(sizeof(fatfs_device_t));
+    fatfs_device_t *dev = calloc(1, sizeof(fatfs_device_t));
     dev->base_path      = malloc(strlen(devname) + 2);
     dev->base_path[0]   = '/';
     strcpy(dev->base_path + 1, devname);
@@ -213,17 +974,8 @@ device_t *fatfs_create_sd(char const *devname, bool rw) {
     base_dev->_read    = fatfs_read;
     base_dev->_lseek   = fatfs_lseek;
 
-    esp_err_t    err;
-    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
-    host.slot         = SDMMC_HOST_SLOT_0;
-#if SDCARD_SDMMC_SPEED_HS
-    host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
-#elif SDCARD_SDMMC_SPEED_UHS_I_SDR50
-    host.max_freq_khz  = SDMMC_FREQ_SDR50;
-    host.flags        &= ~SDMMC_HOST_FLAG_DDR;
-#elif SDCARD_SDMMC_SPEED_UHS_I_DDR50
-    host.max_freq_khz = SDMMC_FREQ_DDR50;
-#endif
+    esp_err_t err;
+    dev->pwr_ctrl_handle = NULL;
 
 #if SDCARD_PWR_CTRL_LDO_INTERNAL_IO
     sd_pwr_ctrl_ldo_config_t ldo_config = {
@@ -234,34 +986,38 @@ device_t *fatfs_create_sd(char const *devname, bool rw) {
         ESP_LOGE("fatfs-sd", "Failed to create LDO power control driver");
         goto error;
     }
-
-    host.pwr_ctrl_handle = dev->pwr_ctrl_handle;
 #endif
 
-    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
-#if IS_UHS1
-    slot_config.flags |= SDMMC_SLOT_FLAG_UHS1;
-#endif
-    slot_config.gpio_cd = SDMMC_SLOT_NO_CD;
-    slot_config.gpio_wp = SDMMC_SLOT_NO_WP;
+    // Start with the mode that worked for this card last time, a different
+    // card tries the faster ones again. Timeouts outside of the 1.8 V modes
+    // mean there is no card.
+    sd_speed_record_t record = {0};
+    sd_speed_t        first  = SD_SPEED_FIRST;
+    if (sd_speed_record_load(&record)) {
+        first = MAX(first, (sd_speed_t)record.speed);
+    }
 
-    // Set bus width to use:
-    slot_config.width = 4;
-#ifdef CONFIG_SOC_SDMMC_USE_GPIO_MATRIX
-    slot_config.clk = SDCARD_PIN_CLK;
-    slot_config.cmd = SDCARD_PIN_CMD;
-    slot_config.d0  = SDCARD_PIN_D0;
-    slot_config.d1  = SDCARD_PIN_D1;
-    slot_config.d2  = SDCARD_PIN_D2;
-    slot_config.d3  = SDCARD_PIN_D3;
-#endif
-    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+    sd_speed_t speed = first;
+    while (1) {
+        err = sd_mount(dev, speed, &mount_config);
+        if (err == ESP_OK) {
+            if (first == SD_SPEED_FIRST || sd_speed_record_matches(&record, dev->sdmmc_handle)) {
+                break;
+            }
+            ESP_LOGW("fatfs-sd", "New SD card, trying the faster modes");
+            esp_vfs_fat_sdcard_unmount(dev->base_path, dev->sdmmc_handle);
+            first = speed = SD_SPEED_FIRST;
+            continue;
+        }
+        if ((err == ESP_ERR_TIMEOUT && !sd_speed_modes[speed].uhs1) || ++speed == SD_SPEED_NUM) {
+            break;
+        }
+    }
 
-    err = esp_vfs_fat_sdmmc_mount(dev->base_path, &host, &slot_config, &mount_config, &dev->sdmmc_handle);
     if (err != ESP_OK) {
 #if SDCARD_PWR_CTRL_LDO_INTERNAL_IO
         // Deinitialize the power control driver if it was used
-        err = sd_pwr_ctrl_del_on_chip_ldo(host.pwr_ctrl_handle);
+        err = sd_pwr_ctrl_del_on_chip_ldo(dev->pwr_ctrl_handle);
         if (err != ESP_OK) {
             ESP_LOGW("fatfs-sd", "Failed to delete the on-chip LDO power control driver");
             goto error;
@@ -282,8 +1038,22 @@ device_t *fatfs_create_sd(char const *devname, bool rw) {
     fs_dev->_opendir            = fatfs_opendir;
     fs_dev->_readdir            = fatfs_readdir;
     fs_dev->_closedir           = fatfs_closedir;
+    fs_dev->_pread              = fatfs_pread;
+    fs_dev->_pwrite             = fatfs_pwrite;
 
     sdmmc_card_print_info(stdout, dev->sdmmc_handle);
+    ESP_LOGW("fatfs-sd", "SD card running in %s mode", sd_speed_modes[speed].name);
+
+    sdmmc_card_t const *card = dev->sdmmc_handle;
+    if (!sd_speed_record_matches(&record, card) || record.speed != speed) {
+        record = (sd_speed_record_t){
+            .mfg_id = card->cid.mfg_id,
+            .speed  = speed,
+            .oem_id = card->cid.oem_id,
+            .serial = card->cid.serial,
+        };
+        sd_speed_record_save(&record);
+    }
 
     return (device_t *)dev;
 error:
@@ -17,6 +17,36 @@
 #pragma once
 
 #include "badgevms/device.h"
+#include "freertos/FreeRTOS.h"
 
 device_t *fatfs_create_spi(char const *devname, char const *partname, bool rw);
 device_t *fatfs_create_sd(char const *devname, bool rw);
+
+// For any file system on the internal flash that is mounted in the VFS under
+// its path_to_unix() name, like LittleFS. Its calls go through Hephaestus with
+// those of FLASH0:, see fatfs.c, or straight to the VFS if it isn't running.
+void flash_fs_ops_init(filesystem_device_t *fs_dev);
+
+typedef void (*flash_work_t)(void *arg);
+
+// Work to run on Hephaestus later, it belongs to whoever hands it over and
+// lives in the kernel heap
+typedef struct flash_deferred {
+    struct flash_deferred *next;
+    flash_work_t           work;
+    void                  *arg;
+    TickType_t             due;
+    bool                   queued;
+} flash_deferred_t;
+
+// Run work on Hephaestus and wait for it. It comes after the calls queued
+// before it, and its own calls on the flash file system are done right away.
+// Anything the kernel writes in the background goes through here, so it is
+// gathered and timed like the writes of applications. arg has to be in the
+// kernel heap. False if Hephaestus isn't running, the caller then does the
+// work itself.
+bool flash_work_run(flash_work_t work, void *arg);
+// Run deferred->work on Hephaestus delay_ms from now, without waiting for it.
+// Handing it over again before it ran doesn't run it twice. False if
+// Hephaestus isn't running.
+bool flash_work_defer(flash_deferred_t *deferred, uint32_t delay_ms);
@@ -0,0 +1,67 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "littlefs.h"
+
+#include "esp_littlefs.h"
+#include "esp_log.h"
+#include "fatfs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    filesystem_device_t filesystem;
+    char               *base_path;
+} littlefs_device_t;
+
+device_t *littlefs_create_spi(char const *devname, char const *partname, bool rw) {
+    littlefs_device_t *dev = calloc(1, sizeof(littlefs_device_t));
+    if (!dev) {
+        return NULL;
+    }
+    dev->base_path = malloc(strlen(devname) + 2);
+    if (!dev->base_path) {
+        free(dev);
+        return NULL;
+    }
+    dev->base_path[0] = '/';
+    strcpy(dev->base_path + 1, devname);
+
+    esp_vfs_littlefs_conf_t const conf = {
+        .base_path              = dev->base_path,
+        .partition_label        = partname,
+        .format_if_mount_failed = true,
+        .read_only              = !rw,
+    };
+
+    esp_err_t err = esp_vfs_littlefs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGE("littlefs-spi", "Failed to mount partition %s: %s", partname, esp_err_to_name(err));
+        free(dev->base_path);
+        free(dev);
+        return NULL;
+    }
+
+    size_t total = 0;
+    size_t used  = 0;
+    esp_littlefs_info(partname, &total, &used);
+    ESP_LOGI("littlefs-spi", "Mounted %s as %s, %zu of %zu bytes used", partname, devname, used, total);
+
+    flash_fs_ops_init(&dev->filesystem);
+    return (device_t *)dev;
+}
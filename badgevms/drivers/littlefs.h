@@ -0,0 +1,26 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "badgevms/device.h"
+
+// LittleFS on a data partition of the internal flash. Its metadata is copy on
+// write, so the small files applications save often cost a block or two
+// instead of rewriting FAT sectors through wear levelling, and survive power
+// loss. Formatted when it doesn't mount, like on first boot.
+device_t *littlefs_create_spi(char const *devname, char const *partname, bool rw);
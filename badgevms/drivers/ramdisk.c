@@ -0,0 +1,799 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ramdisk.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "memory.h"
+#include "pathfuncs_private.h"
+#include "sdkconfig.h"
+#include "task.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define TAG "ramdisk"
+
+#define RAMDISK_MAX_PAGES ((CONFIG_BADGEVMS_TMP_SIZE_KB * 1024 + SOC_MMU_PAGE_SIZE - 1) / SOC_MMU_PAGE_SIZE)
+#define RAMDISK_MAX_FDS   64
+
+typedef struct ramdisk_node {
+    char                *path; // DIR/SUB/FILE, the root is ""
+    ino_t                ino;
+    bool                 directory;
+    bool                 unlinked; // Out of the tree, freed with the last descriptor
+    int                  open;     // Descriptors on it
+    task_thread_t       *owner;    // Removed with this process
+    time_t               mtime;
+    size_t               size;
+    size_t               num_pages;
+    uintptr_t           *pages; // Physical, SOC_MMU_PAGE_SIZE each
+    struct ramdisk_node *next;
+} ramdisk_node_t;
+
+typedef struct {
+    ramdisk_node_t *node;
+    off_t           offset;
+    int             flags;
+} ramdisk_fd_t;
+
+typedef struct {
+    char         *path;
+    size_t        index; // Entries handed out so far
+    struct dirent entry;
+} ramdisk_dir_t;
+
+typedef enum {
+    COPY_READ,
+    COPY_WRITE,
+    COPY_ZERO,
+} copy_op_t;
+
+typedef struct {
+    filesystem_device_t filesystem;
+    SemaphoreHandle_t   lock;
+    ramdisk_node_t      root;
+    ramdisk_node_t     *nodes; // Everything but the root
+    ino_t               last_ino;
+    size_t              used_pages;
+    ramdisk_fd_t        fds[RAMDISK_MAX_FDS];
+    // The pages mapped in the RAM disk window and when they were last used,
+    // 0 for a free slot
+    uintptr_t           window[RAMDISK_WINDOW_PAGES];
+    uint32_t            window_used[RAMDISK_WINDOW_PAGES];
+    uint32_t            window_clock;
+} ramdisk_device_t;
+
+static ramdisk_device_t *ramdisk;
+
+// Where paddr is in the window, mapped over the least recently used slot if it isn't
+static uint8_t *window_get(ramdisk_device_t *device, uintptr_t paddr) {
+    size_t victim = 0;
+
+    for (size_t i = 0; i < RAMDISK_WINDOW_PAGES; ++i) {
+        if (device->window[i] == paddr) {
+            device->window_used[i] = ++device->window_clock;
+            return (uint8_t *)(RAMDISK_WINDOW_START + i * SOC_MMU_PAGE_SIZE);
+        }
+        if (device->window_used[i] < device->window_used[victim]) {
+            victim = i;
+        }
+    }
+
+    if (device->window[victim]) {
+        ramdisk_window_unmap(victim);
+    }
+    device->window[victim]      = paddr;
+    device->window_used[victim] = ++device->window_clock;
+    return ramdisk_window_map(victim, paddr);
+}
+
+static void window_drop(ramdisk_device_t *device, uintptr_t paddr) {
+    for (size_t i = 0; i < RAMDISK_WINDOW_PAGES; ++i) {
+        if (device->window[i] == paddr) {
+            ramdisk_window_unmap(i);
+            device->window[i]      = 0;
+            device->window_used[i] = 0;
+        }
+    }
+}
+
+// Grow or shrink the pages of node to hold size bytes, what it already holds stays
+static bool node_resize(ramdisk_device_t *device, ramdisk_node_t *node, size_t size) {
+    size_t need = (size + SOC_MMU_PAGE_SIZE - 1) / SOC_MMU_PAGE_SIZE;
+
+    while (node->num_pages > need) {
+        uintptr_t paddr = node->pages[--node->num_pages];
+        window_drop(device, paddr);
+        page_deallocate(paddr);
+        --device->used_pages;
+    }
+
+    if (need <= node->num_pages) {
+        return true;
+    }
+
+    if (device->used_pages + need - node->num_pages > RAMDISK_MAX_PAGES) {
+        get_task_info()->_errno = ENOSPC;
+        return false;
+    }
+
+    uintptr_t *pages = realloc(node->pages, need * sizeof(uintptr_t));
+    if (!pages) {
+        get_task_info()->_errno = ENOMEM;
+        return false;
+    }
+    node->pages = pages;
+
+    while (node->num_pages < need) {
+        uintptr_t paddr = page_allocate(SOC_MMU_PAGE_SIZE);
+        if (!paddr) {
+            get_task_info()->_errno = ENOSPC;
+            return false;
+        }
+        node->pages[node->num_pages++] = paddr;
+        ++device->used_pages;
+    }
+    return true;
+}
+
+// Between buf and count bytes of node at offset, which it has the pages for
+static void
+    node_copy(ramdisk_device_t *device, ramdisk_node_t *node, off_t offset, void *buf, size_t count, copy_op_t op) {
+    uint8_t *p = buf;
+
+    while (count) {
+        size_t   in_page = offset % SOC_MMU_PAGE_SIZE;
+        size_t   chunk   = MIN(count, SOC_MMU_PAGE_SIZE - in_page);
+        uint8_t *page    = window_get(device, node->pages[offset / SOC_MMU_PAGE_SIZE]) + in_page;
+
+        switch (op) {
+            case COPY_READ: memcpy(p, page, chunk); break;
+            case COPY_WRITE: memcpy(page, p, chunk); break;
+            case COPY_ZERO: memset(page, 0, chunk); break;
+        }
+
+        p      += chunk;
+        offset += chunk;
+        count  -= chunk;
+    }
+}
+
+static void node_free(ramdisk_device_t *device, ramdisk_node_t *node) {
+    node_resize(device, node, 0);
+    free(node->pages);
+    free(node->path);
+    free(node);
+}
+
+// Take node out of the tree, it goes away once nothing has it open
+static void node_unlink(ramdisk_device_t *device, ramdisk_node_t *node) {
+    for (ramdisk_node_t **n = &device->nodes; *n; n = &(*n)->next) {
+        if (*n == node) {
+            *n = node->next;
+            break;
+        }
+    }
+
+    if (node->open) {
+        node->unlinked = true;
+    } else {
+        node_free(device, node);
+    }
+}
+
+static ramdisk_node_t *node_find(ramdisk_device_t *device, char const *path) {
+    if (!*path) {
+        return &device->root;
+    }
+
+    for (ramdisk_node_t *node = device->nodes; node; node = node->next) {
+        if (!strcmp(node->path, path)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// Whether path is below the directory dir, anywhere or right in it
+static bool node_below(char const *path, char const *dir, bool directly) {
+    size_t len = strlen(dir);
+
+    if (len) {
+        if (strncmp(path, dir, len) || path[len] != '/') {
+            return false;
+        }
+        path += len + 1;
+    }
+    return *path && (!directly || !strchr(path, '/'));
+}
+
+static bool node_has_children(ramdisk_device_t *device, char const *dir) {
+    for (ramdisk_node_t *node = device->nodes; node; node = node->next) {
+        if (node_below(node->path, dir, true)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The directory path is in, ENOENT or ENOTDIR if it isn't one
+static bool parent_exists(ramdisk_device_t *device, char const *path) {
+    char const *slash = strrchr(path, '/');
+    if (!slash) {
+        return true;
+    }
+
+    for (ramdisk_node_t *node = device->nodes; node; node = node->next) {
+        if (strlen(node->path) == slash - path && !strncmp(node->path, path, slash - path)) {
+            if (!node->directory) {
+                get_task_info()->_errno = ENOTDIR;
+                return false;
+            }
+            return true;
+        }
+    }
+
+    get_task_info()->_errno = ENOENT;
+    return false;
+}
+
+static ramdisk_node_t *node_create(ramdisk_device_t *device, char const *path, bool directory) {
+    ramdisk_node_t *node = calloc(1, sizeof(ramdisk_node_t));
+    if (node) {
+        node->path = strdup(path);
+    }
+    if (!node || !node->path) {
+        free(node);
+        get_task_info()->_errno = ENOMEM;
+        return NULL;
+    }
+
+    node->ino       = ++device->last_ino;
+    node->directory = directory;
+    node->owner     = get_task_info()->thread;
+    node->mtime     = time(NULL);
+    node->next      = device->nodes;
+    device->nodes   = node;
+    return node;
+}
+
+static void node_stat(ramdisk_node_t const *node, struct stat *restrict statbuf) {
+    memset(statbuf, 0, sizeof(struct stat));
+    statbuf->st_ino     = node->ino;
+    statbuf->st_mode    = node->directory ? (S_IFDIR | 0777) : (S_IFREG | 0666);
+    statbuf->st_nlink   = 1;
+    statbuf->st_size    = node->size;
+    statbuf->st_blksize = SOC_MMU_PAGE_SIZE;
+    statbuf->st_blocks  = node->num_pages * (SOC_MMU_PAGE_SIZE / 512);
+    statbuf->st_atime   = node->mtime;
+    statbuf->st_mtime   = node->mtime;
+    statbuf->st_ctime   = node->mtime;
+}
+
+// /TMP0/DIR/SUB/FILE to DIR/SUB/FILE, directories lose their trailing slash
+static char *node_path(path_t *path) {
+    char *unixpath = path_to_unix(path);
+    char *rel      = strchr(unixpath + 1, '/');
+
+    rel        = rel ? rel + 1 : unixpath + strlen(unixpath);
+    size_t len = strlen(rel);
+    if (len && rel[len - 1] == '/') {
+        rel[len - 1] = '\0';
+    }
+    return rel;
+}
+
+static ramdisk_fd_t *fd_get(ramdisk_device_t *device, int fd) {
+    if (fd < 0 || fd >= RAMDISK_MAX_FDS || !device->fds[fd].node) {
+        get_task_info()->_errno = EBADF;
+        return NULL;
+    }
+    return &device->fds[fd];
+}
+
+static int ramdisk_open(void *dev, path_t *path, int flags, mode_t mode) {
+    ramdisk_device_t *device = dev;
+    char const       *name   = node_path(path);
+    int               fd     = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_node_t *node = node_find(device, name);
+    if (node && (flags & O_CREAT) && (flags & O_EXCL)) {
+        get_task_info()->_errno = EEXIST;
+        goto out;
+    }
+    if (node && node->directory) {
+        get_task_info()->_errno = EISDIR;
+        goto out;
+    }
+    if (!node && !(flags & O_CREAT)) {
+        get_task_info()->_errno = ENOENT;
+        goto out;
+    }
+
+    for (int i = 0; i < RAMDISK_MAX_FDS; ++i) {
+        if (!device->fds[i].node) {
+            fd = i;
+            break;
+        }
+    }
+    if (fd < 0) {
+        get_task_info()->_errno = EMFILE;
+        goto out;
+    }
+
+    if (!node && (!parent_exists(device, name) || !(node = node_create(device, name, false)))) {
+        fd = -1;
+        goto out;
+    }
+
+    if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+        node_resize(device, node, 0);
+        node->size  = 0;
+        node->mtime = time(NULL);
+    }
+
+    device->fds[fd] = (ramdisk_fd_t){.node = node, .offset = 0, .flags = flags};
+    ++node->open;
+
+out:
+    xSemaphoreGive(device->lock);
+    return fd;
+}
+
+static int ramdisk_close(void *dev, int fd) {
+    ramdisk_device_t *device = dev;
+    int               ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (handle) {
+        ramdisk_node_t *node = handle->node;
+        handle->node         = NULL;
+        if (!--node->open && node->unlinked) {
+            node_free(device, node);
+        }
+        ret = 0;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static ssize_t fd_read(ramdisk_device_t *device, ramdisk_fd_t *handle, void *buf, size_t count, off_t offset) {
+    if ((handle->flags & O_ACCMODE) == O_WRONLY) {
+        get_task_info()->_errno = EBADF;
+        return -1;
+    }
+    if (offset < 0) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+
+    ramdisk_node_t *node = handle->node;
+    size_t          ret  = offset < node->size ? MIN(count, node->size - offset) : 0;
+    node_copy(device, node, offset, buf, ret, COPY_READ);
+    return ret;
+}
+
+static ssize_t fd_write(ramdisk_device_t *device, ramdisk_fd_t *handle, void const *buf, size_t count, off_t offset) {
+    if ((handle->flags & O_ACCMODE) == O_RDONLY) {
+        get_task_info()->_errno = EBADF;
+        return -1;
+    }
+    if (offset < 0) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+
+    ramdisk_node_t *node = handle->node;
+    if (offset + count > node->size) {
+        if (!node_resize(device, node, offset + count)) {
+            return -1;
+        }
+        // Writing past the end leaves a hole, which reads as zero
+        if (offset > node->size) {
+            node_copy(device, node, node->size, NULL, offset - node->size, COPY_ZERO);
+        }
+        node->size = offset + count;
+    }
+
+    node_copy(device, node, offset, (void *)buf, count, COPY_WRITE);
+    node->mtime = time(NULL);
+    return count;
+}
+
+static ssize_t ramdisk_read(void *dev, int fd, void *buf, size_t count) {
+    ramdisk_device_t *device = dev;
+    ssize_t           ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (handle && (ret = fd_read(device, handle, buf, count, handle->offset)) > 0) {
+        handle->offset += ret;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static ssize_t ramdisk_write(void *dev, int fd, void const *buf, size_t count) {
+    ramdisk_device_t *device = dev;
+    ssize_t           ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (handle) {
+        if (handle->flags & O_APPEND) {
+            handle->offset = handle->node->size;
+        }
+        if ((ret = fd_write(device, handle, buf, count, handle->offset)) > 0) {
+            handle->offset += ret;
+        }
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static ssize_t ramdisk_pread(void *dev, int fd, void *buf, size_t count, off_t offset) {
+    ramdisk_device_t *device = dev;
+    ssize_t           ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (handle) {
+        ret = fd_read(device, handle, buf, count, offset);
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static ssize_t ramdisk_pwrite(void *dev, int fd, void const *buf, size_t count, off_t offset) {
+    ramdisk_device_t *device = dev;
+    ssize_t           ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (handle) {
+        ret = fd_write(device, handle, buf, count, offset);
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static ssize_t ramdisk_lseek(void *dev, int fd, off_t offset, int whence) {
+    ramdisk_device_t *device = dev;
+    ssize_t           ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (!handle) {
+        goto out;
+    }
+
+    switch (whence) {
+        case SEEK_SET: break;
+        case SEEK_CUR: offset += handle->offset; break;
+        case SEEK_END: offset += handle->node->size; break;
+        default: offset = -1;
+    }
+
+    if (offset < 0) {
+        get_task_info()->_errno = EINVAL;
+        goto out;
+    }
+
+    handle->offset = offset;
+    ret            = offset;
+
+out:
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_stat(void *dev, path_t *path, struct stat *restrict statbuf) {
+    ramdisk_device_t *device = dev;
+    int               ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_node_t *node = node_find(device, node_path(path));
+    if (node) {
+        node_stat(node, statbuf);
+        ret = 0;
+    } else {
+        get_task_info()->_errno = ENOENT;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_fstat(void *dev, int fd, struct stat *restrict statbuf) {
+    ramdisk_device_t *device = dev;
+    int               ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_fd_t *handle = fd_get(device, fd);
+    if (handle) {
+        node_stat(handle->node, statbuf);
+        ret = 0;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_unlink(void *dev, path_t *path) {
+    ramdisk_device_t *device = dev;
+    int               ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_node_t *node = node_find(device, node_path(path));
+    if (!node) {
+        get_task_info()->_errno = ENOENT;
+    } else if (node->directory) {
+        get_task_info()->_errno = EISDIR;
+    } else {
+        node_unlink(device, node);
+        ret = 0;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_rename(void *dev, path_t *oldpath, path_t *newpath) {
+    ramdisk_device_t *device   = dev;
+    char const       *old_name = node_path(oldpath);
+    char const       *new_name = node_path(newpath);
+    size_t            old_len  = strlen(old_name);
+    int               ret      = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_node_t *node   = node_find(device, old_name);
+    ramdisk_node_t *target = node_find(device, new_name);
+    if (!node) {
+        get_task_info()->_errno = ENOENT;
+        goto out;
+    }
+    if (node == &device->root || target == &device->root) {
+        get_task_info()->_errno = EBUSY;
+        goto out;
+    }
+    if (node == target) {
+        ret = 0;
+        goto out;
+    }
+    if (node_below(new_name, old_name, false)) {
+        get_task_info()->_errno = EINVAL;
+        goto out;
+    }
+    if (target && (target->directory || node->directory)) {
+        get_task_info()->_errno = target->directory ? EISDIR : ENOTDIR;
+        goto out;
+    }
+    if (!parent_exists(device, new_name)) {
+        goto out;
+    }
+
+    // A directory takes everything in it along, all new paths are made before any changes
+    size_t moving = 1;
+    for (ramdisk_node_t *n = device->nodes; n; n = n->next) {
+        moving += node_below(n->path, old_name, false);
+    }
+
+    char **paths = calloc(moving, sizeof(char *));
+    size_t made  = 0;
+    for (ramdisk_node_t *n = device->nodes; paths && n; n = n->next) {
+        if (n == node || node_below(n->path, old_name, false)) {
+            if (!(paths[made] = malloc(strlen(new_name) + strlen(n->path) - old_len + 1))) {
+                break;
+            }
+            strcpy(paths[made], new_name);
+            strcat(paths[made++], n->path + old_len);
+        }
+    }
+
+    if (made == moving) {
+        made = 0;
+        for (ramdisk_node_t *n = device->nodes; n; n = n->next) {
+            if (n == node || node_below(n->path, old_name, false)) {
+                free(n->path);
+                n->path = paths[made++];
+            }
+        }
+        if (target) {
+            node_unlink(device, target);
+        }
+        node->mtime = time(NULL);
+        ret         = 0;
+    } else {
+        while (made) {
+            free(paths[--made]);
+        }
+        get_task_info()->_errno = ENOMEM;
+    }
+    free(paths);
+
+out:
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_mkdir(void *dev, path_t *path, mode_t mode) {
+    ramdisk_device_t *device = dev;
+    char const       *name   = node_path(path);
+    int               ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    if (node_find(device, name)) {
+        get_task_info()->_errno = EEXIST;
+    } else if (parent_exists(device, name) && node_create(device, name, true)) {
+        ret = 0;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_rmdir(void *dev, path_t *path) {
+    ramdisk_device_t *device = dev;
+    int               ret    = -1;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_node_t *node = node_find(device, node_path(path));
+    if (!node) {
+        get_task_info()->_errno = ENOENT;
+    } else if (!node->directory) {
+        get_task_info()->_errno = ENOTDIR;
+    } else if (node == &device->root) {
+        get_task_info()->_errno = EBUSY;
+    } else if (node_has_children(device, node->path)) {
+        get_task_info()->_errno = ENOTEMPTY;
+    } else {
+        node_unlink(device, node);
+        ret = 0;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static DIR *ramdisk_opendir(void *dev, path_t *path) {
+    ramdisk_device_t *device = dev;
+    ramdisk_dir_t    *dir    = NULL;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    ramdisk_node_t *node = node_find(device, node_path(path));
+    if (!node) {
+        get_task_info()->_errno = ENOENT;
+    } else if (!node->directory) {
+        get_task_info()->_errno = ENOTDIR;
+    } else {
+        dir = calloc(1, sizeof(ramdisk_dir_t));
+        if (dir && !(dir->path = strdup(node->path))) {
+            free(dir);
+            dir = NULL;
+        }
+        if (!dir) {
+            get_task_info()->_errno = ENOMEM;
+        }
+    }
+    xSemaphoreGive(device->lock);
+    return (DIR *)dir;
+}
+
+// Walks the tree for every entry, there are never many
+static struct dirent *ramdisk_readdir(void *dev, DIR *dirp) {
+    ramdisk_device_t *device = dev;
+    ramdisk_dir_t    *dir    = (ramdisk_dir_t *)dirp;
+    struct dirent    *ret    = NULL;
+    size_t            index  = 0;
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    for (ramdisk_node_t *node = device->nodes; node; node = node->next) {
+        if (!node_below(node->path, dir->path, true) || index++ != dir->index) {
+            continue;
+        }
+
+        char const *name = strrchr(node->path, '/');
+        name             = name ? name + 1 : node->path;
+
+        dir->entry.d_ino  = node->ino;
+        dir->entry.d_type = node->directory ? DT_DIR : DT_REG;
+        strlcpy(dir->entry.d_name, name, sizeof(dir->entry.d_name));
+        ++dir->index;
+        ret = &dir->entry;
+        break;
+    }
+    xSemaphoreGive(device->lock);
+    return ret;
+}
+
+static int ramdisk_closedir(void *dev, DIR *dirp) {
+    ramdisk_dir_t *dir = (ramdisk_dir_t *)dirp;
+    free(dir->path);
+    free(dir);
+    return 0;
+}
+
+void ramdisk_release(task_thread_t *thread) {
+    ramdisk_device_t *device = ramdisk;
+    if (!device) {
+        return;
+    }
+
+    xSemaphoreTake(device->lock, portMAX_DELAY);
+    // Directories once they are empty, which the ones in them have to be first
+    for (bool removed = true; removed;) {
+        removed = false;
+        for (ramdisk_node_t *node = device->nodes, *next; node; node = next) {
+            next = node->next;
+            if (node->owner == thread && (!node->directory || !node_has_children(device, node->path))) {
+                node_unlink(device, node);
+                removed = true;
+            }
+        }
+    }
+    xSemaphoreGive(device->lock);
+}
+
+device_t *ramdisk_create() {
+    ramdisk_device_t *dev = calloc(1, sizeof(ramdisk_device_t));
+    if (!dev) {
+        return NULL;
+    }
+
+    dev->lock = xSemaphoreCreateMutex();
+    if (!dev->lock) {
+        free(dev);
+        return NULL;
+    }
+
+    dev->root.path      = "";
+    dev->root.directory = true;
+    dev->root.mtime     = time(NULL);
+
+    device_t            *base_dev = (device_t *)dev;
+    filesystem_device_t *fs_dev   = (filesystem_device_t *)dev;
+
+    base_dev->type     = DEVICE_TYPE_FILESYSTEM;
+    base_dev->_open    = ramdisk_open;
+    base_dev->_close   = ramdisk_close;
+    base_dev->_write   = ramdisk_write;
+    base_dev->_read    = ramdisk_read;
+    base_dev->_lseek   = ramdisk_lseek;
+    fs_dev->_stat      = ramdisk_stat;
+    fs_dev->_fstat     = ramdisk_fstat;
+    fs_dev->_unlink    = ramdisk_unlink;
+    fs_dev->_rename    = ramdisk_rename;
+    fs_dev->_mkdir     = ramdisk_mkdir;
+    fs_dev->_rmdir     = ramdisk_rmdir;
+    fs_dev->_opendir   = ramdisk_opendir;
+    fs_dev->_readdir   = ramdisk_readdir;
+    fs_dev->_closedir  = ramdisk_closedir;
+    fs_dev->_pread     = ramdisk_pread;
+    fs_dev->_pwrite    = ramdisk_pwrite;
+
+    ESP_LOGI(TAG, "RAM disk of up to %d pages", RAMDISK_MAX_PAGES);
+    ramdisk = dev;
+    return base_dev;
+}
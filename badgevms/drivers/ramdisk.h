@@ -0,0 +1,27 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "badgevms/device.h"
+#include "task.h"
+
+// A file system in PSRAM pages for temporary files, TMP: points at it. It holds
+// up to CONFIG_BADGEVMS_TMP_SIZE_KB, each file takes whole MMU pages.
+device_t *ramdisk_create();
+// Remove the files and directories a process created, once it is gone
+void      ramdisk_release(task_thread_t *thread);
@@ -17,10 +17,17 @@
 
 #include "socket.h"
 
+#include "badgevms/socket_view.h"
+#include "drivers/wifi.h"
 #include "esp_log.h"
+#include "lwip/api.h"
+#include "lwip/inet.h"
+#include "lwip/priv/sockets_priv.h"
+#include "lwip/sockets.h"
 #include "task.h"
 
-#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 #define TAG "socket"
 
@@ -30,16 +37,17 @@ static int socket_open(void *dev, path_t *path, int flags, mode_t mode) {
     return 0;
 }
 
+// Straight to lwIP, not back through the VFS the descriptors also live in
 static int socket_close(void *dev, int fd) {
-    return close(fd);
+    return lwip_close(fd);
 }
 
 static ssize_t socket_write(void *dev, int fd, void const *buf, size_t count) {
-    return write(fd, buf, count);
+    return lwip_write(fd, buf, count);
 }
 
 static ssize_t socket_read(void *dev, int fd, void *buf, size_t count) {
-    return read(fd, buf, count);
+    return lwip_read(fd, buf, count);
 }
 
 static ssize_t socket_lseek(void *dev, int fd, off_t offset, int whence) {
@@ -47,7 +55,7 @@ static ssize_t socket_lseek(void *dev, int fd, off_t offset, int whence) {
 }
 
 device_t *socket_create() {
-    socket_device_t *dev = (socket_device_t *)malloc(sizeof(socket_device_t));
+    socket_device_t *dev = (socket_device_t *)calloc(1, sizeof(socket_device_t));
     if (!dev) {
         ESP_LOGE(TAG, "Failed to allocate memory for socket device");
         return NULL;
@@ -62,5 +70,153 @@ device_t *socket_create() {
     base_dev->_read  = socket_read;
     base_dev->_lseek = socket_lseek;
 
+    // Created for the first socket, which is no use without the network
+    wifi_start();
     return (device_t *)dev;
-}
\ No newline at end of file
+}
+
+// The lwIP socket behind fd of the calling process, -1 with errno if there is none
+static int socket_lookup(task_info_t *task_info, int fd) {
+    if (fd < 0 || fd >= MAXFD || !task_info->thread->file_handles[fd].is_open) {
+        task_info->_errno = EBADF;
+        return -1;
+    }
+
+    file_handle_t *handle = &task_info->thread->file_handles[fd];
+    if (handle->device->type != DEVICE_TYPE_SOCKET) {
+        task_info->_errno = ENOTSOCK;
+        return -1;
+    }
+    return handle->dev_fd;
+}
+
+// Cut chain p after the pbufs that fit in a view and return the rest
+static struct pbuf *socket_view_split(struct pbuf *p) {
+    struct pbuf *last = p;
+    for (int i = 1; i < SOCKET_VIEW_IOV_MAX && last->next; ++i) {
+        last = last->next;
+    }
+
+    struct pbuf *rest = last->next;
+    if (!rest) {
+        return NULL;
+    }
+
+    // The reference last held on rest is now ours
+    last->next = NULL;
+    for (struct pbuf *q = p; q; q = q->next) {
+        q->tot_len -= rest->tot_len;
+    }
+    return rest;
+}
+
+static void socket_view_from(socket_view_t *view, struct netbuf *buf) {
+    ip_addr_t const *addr = netbuf_fromaddr(buf);
+    u16_t            port = netbuf_fromport(buf);
+
+#if LWIP_IPV6
+    if (IP_IS_V6(addr)) {
+        struct sockaddr_in6 *from = (struct sockaddr_in6 *)&view->from;
+        from->sin6_len            = sizeof(struct sockaddr_in6);
+        from->sin6_family         = AF_INET6;
+        from->sin6_port           = lwip_htons(port);
+        inet6_addr_from_ip6addr(&from->sin6_addr, ip_2_ip6(addr));
+        return;
+    }
+#endif
+
+    struct sockaddr_in *from = (struct sockaddr_in *)&view->from;
+    from->sin_len            = sizeof(struct sockaddr_in);
+    from->sin_family         = AF_INET;
+    from->sin_port           = lwip_htons(port);
+    inet_addr_from_ip4addr(&from->sin_addr, ip_2_ip4(addr));
+}
+
+// Takes the pbufs from the netconn the way lwip_recv() does, including what
+// an earlier recv() left behind, but hands them out instead of copying
+ssize_t socket_recv_view(int fd, socket_view_t *view, int flags) {
+    task_info_t *task_info = get_task_info();
+    if (!view) {
+        task_info->_errno = EFAULT;
+        return -1;
+    }
+
+    // Holds nothing, whatever happens below
+    memset(view, 0, sizeof(socket_view_t));
+
+    int s = socket_lookup(task_info, fd);
+    if (s < 0) {
+        return -1;
+    }
+
+    struct lwip_sock *sock = lwip_socket_dbg_get_socket(s);
+    if (!sock || !sock->conn) {
+        task_info->_errno = EBADF;
+        return -1;
+    }
+
+    struct netconn *conn     = sock->conn;
+    u8_t            apiflags = (flags & MSG_DONTWAIT) || netconn_is_nonblocking(conn) ? NETCONN_DONTBLOCK : 0;
+    struct pbuf    *p        = NULL;
+    err_t           err;
+
+    if (NETCONNTYPE_GROUP(netconn_type(conn)) == NETCONN_TCP) {
+        p                   = sock->lastdata.pbuf;
+        sock->lastdata.pbuf = NULL;
+        err                 = p ? ERR_OK : netconn_recv_tcp_pbuf_flags(conn, &p, apiflags);
+        if (err == ERR_OK) {
+            // For the next call, or recv()
+            sock->lastdata.pbuf = socket_view_split(p);
+        }
+    } else {
+        struct netbuf *buf    = sock->lastdata.netbuf;
+        sock->lastdata.netbuf = NULL;
+        err                   = buf ? ERR_OK : netconn_recv_udp_raw_netbuf_flags(conn, &buf, apiflags);
+        if (err == ERR_OK) {
+            socket_view_from(view, buf);
+            p      = buf->p;
+            buf->p = NULL;
+            netbuf_delete(buf);
+        }
+    }
+
+    if (err != ERR_OK) {
+        // The end of a stream
+        if (err == ERR_CLSD) {
+            return 0;
+        }
+        task_info->_errno = err_to_errno(err);
+        return -1;
+    }
+
+    for (struct pbuf *q = p; q && view->iovcnt < SOCKET_VIEW_IOV_MAX; q = q->next) {
+        view->iov[view->iovcnt++]  = (struct iovec){.iov_base = q->payload, .iov_len = q->len};
+        view->len                 += q->len;
+    }
+    if (view->len < p->tot_len) {
+        view->flags |= MSG_TRUNC;
+    }
+
+    view->handle = p;
+    task_record_resource_alloc(RES_SOCKET_VIEW, p);
+    return view->len;
+}
+
+void socket_view_release(socket_view_t *view) {
+    if (!view || !view->handle) {
+        return;
+    }
+
+    if (!task_record_resource_owned(RES_SOCKET_VIEW, view->handle)) {
+        ESP_LOGE(TAG, "Release of a view %p that isn't ours", view->handle);
+        return;
+    }
+
+    task_record_resource_free(RES_SOCKET_VIEW, view->handle);
+    pbuf_free(view->handle);
+    view->handle = NULL;
+}
+
+void socket_view_release_task(void *handle) {
+    pbuf_free(handle);
+}
@@ -19,3 +19,6 @@
 #include "badgevms/device.h"
 
 device_t *socket_create();
+
+// From thread_delete(), for the views a process didn't release
+void socket_view_release_task(void *handle);
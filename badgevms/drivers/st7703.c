@@ -46,6 +46,8 @@ static void (*refresh_cb)(void *user_data);
 typedef struct {
     lcd_device_t           device;
     esp_lcd_panel_handle_t disp_panel;
+    int                    num_fbs;
+    uint32_t               vsync_front_porch;
 } st7703_device_t;
 
 IRAM_ATTR static bool
@@ -102,6 +104,8 @@ static void panel_init(st7703_device_t *device) {
 
     ESP_LOGI(TAG, "Install ST7703 LCD control panel");
     esp_lcd_dpi_panel_config_t dpi_config = ST7703_720_720_PANEL_60HZ_DPI_CONFIG();
+    dpi_config.num_fbs                    = device->num_fbs;
+    device->vsync_front_porch             = dpi_config.video_timing.vsync_front_porch;
 
     st7703_vendor_config_t vendor_config = {
         .mipi_config =
@@ -152,32 +156,13 @@ void draw(void *dev, int x, int y, int w, int h, void *pixels) {
 }
 
 void get_framebuffer(void *dev, int num, void **pixels) {
-    void *fb0;
-#if DISPLAY_FRAMEBUFFERS > 1
-    void *fb1;
-#endif
-#if DISPLAY_FRAMEBUFFERS > 2
-    void *fb2;
-#endif
-    st7703_device_t *device = dev;
-#if DISPLAY_FRAMEBUFFERS == 1
-    esp_lcd_dpi_panel_get_frame_buffer(device->disp_panel, DISPLAY_FRAMEBUFFERS, &fb0);
-#elif DISPLAY_FRAMEBUFFERS == 2
-    esp_lcd_dpi_panel_get_frame_buffer(device->disp_panel, DISPLAY_FRAMEBUFFERS, &fb0, &fb1);
-#elif DISPLAY_FRAMEBUFFERS == 3
-    esp_lcd_dpi_panel_get_frame_buffer(device->disp_panel, DISPLAY_FRAMEBUFFERS, &fb0, &fb1, &fb2);
-#endif
+    _Static_assert(DISPLAY_FRAMEBUFFERS == 3, "Only up to three framebuffers are asked for");
+    st7703_device_t *device                    = dev;
+    void            *fbs[DISPLAY_FRAMEBUFFERS] = {NULL};
 
-    if (num == 0)
-        *pixels = fb0;
-#if DISPLAY_FRAMEBUFFERS > 1
-    if (num == 1)
-        *pixels = fb1;
-#endif
-#if DISPLAY_FRAMEBUFFERS > 2
-    if (num == 2)
-        *pixels = fb2;
-#endif
+    // Only the first num_fbs are filled in
+    esp_lcd_dpi_panel_get_frame_buffer(device->disp_panel, device->num_fbs, &fbs[0], &fbs[1], &fbs[2]);
+    *pixels = num >= 0 && num < device->num_fbs ? fbs[num] : NULL;
 }
 
 void set_refresh_cb(void *dev, void *user_data, void (*callback)(void *user_data)) {
@@ -192,15 +177,27 @@ void set_refresh_cb(void *dev, void *user_data, void (*callback)(void *user_data
     esp_lcd_dpi_panel_register_event_callbacks(device->disp_panel, &cbs, user_data);
 }
 
-device_t *st7703_create() {
-    ESP_LOGI(TAG, "Initializing");
+// Scanning out a static picture only costs PSRAM bandwidth, stretch the
+// blanking after it while idle
+static void set_idle(void *dev, bool idle) {
+    st7703_device_t *device            = dev;
+    uint32_t         vsync_front_porch = idle ? ST7703_IDLE_VSYNC_FRONT_PORCH : device->vsync_front_porch;
+    esp_lcd_dpi_panel_set_vertical_front_porch(device->disp_panel, vsync_front_porch);
+}
+
+device_t *st7703_create(int num_framebuffers) {
+    ESP_LOGI(TAG, "Initializing with %d framebuffers", num_framebuffers);
     st7703_device_t *dev      = calloc(1, sizeof(st7703_device_t));
     device_t        *base_dev = (device_t *)dev;
     lcd_device_t    *lcd_dev  = (lcd_device_t *)dev;
 
+    dev->num_fbs = num_framebuffers;
+
     lcd_dev->_draw           = draw;
     lcd_dev->_getfb          = get_framebuffer;
+    lcd_dev->framebuffers    = num_framebuffers;
     lcd_dev->_set_refresh_cb = set_refresh_cb;
+    lcd_dev->_set_idle       = set_idle;
 
     base_dev->type   = DEVICE_TYPE_LCD;
     base_dev->_open  = NULL;
@@ -186,7 +186,12 @@ extern "C" {
 
 #endif
 
-device_t *st7703_create();
+// Vertical front porch while the picture doesn't change, the longest the DSI
+// host takes. The panel then refreshes at about 26 Hz instead of 60.
+#define ST7703_IDLE_VSYNC_FRONT_PORCH 1023
+
+// num_framebuffers of DISPLAY_FRAMEBUFFERS at most
+device_t *st7703_create(int num_framebuffers);
 
 #ifdef __cplusplus
 }
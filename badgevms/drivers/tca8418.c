@@ -17,10 +17,23 @@
 #include "tca8418.h"
 
 #include "badgevms/event.h"
+#include "badgevms_config.h"
+#include "badgevms_i2c_bus.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_tca8418.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "task.h"
 
+#include <stdatomic.h>
+
+#include <string.h>
+#include <sys/param.h>
 #include <sys/time.h>
 
 #define SDA_PIN           18
@@ -30,10 +43,27 @@
 
 #define TAG "TCA8418"
 
+// Events Argus read from the controller and tca8418_read() didn't take yet. A
+// power of two, the controller itself only holds 10.
+#define KEYBOARD_RING_SIZE 64
+// Without the interrupt line Argus polls the controller this often. With it
+// Argus looks every so often anyway, in case an edge went missing.
+#define ARGUS_POLL_MS      10
+#define ARGUS_CHECK_MS     1000
+// Just under the compositor input task it feeds
+#define ARGUS_PRIORITY     20
+#define ARGUS_CORE         0
+
 typedef struct {
-    device_t       device;
-    key_mod_t      mod_state;
-    tca8418_dev_t *keyboard;
+    keyboard_device_t device;
+    key_mod_t         mod_state; // Argus only
+    tca8418_dev_t    *keyboard;
+    TaskHandle_t      argus;
+    SemaphoreHandle_t ready; // Given when Argus queued events
+    // Argus fills the ring, the one reader of the device empties it
+    event_t           ring[KEYBOARD_RING_SIZE];
+    atomic_uint       head;
+    atomic_uint       tail;
 } tca8418_device_t;
 
 static keyboard_scancode_t const keymap[80] = {
@@ -164,6 +194,7 @@ event_t scancode_to_event(tca8418_device_t *device, uint8_t scancode) {
         event.type = EVENT_KEY_UP;
     }
 
+    event.timestamp          = (uint64_t)esp_timer_get_time() * 1000ULL;
     event.keyboard.timestamp = (int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec;
     event.keyboard.scancode  = s;
     event.keyboard.key       = BADGEVMS_SCANCODE_TO_KEYCODE(s);
@@ -188,17 +219,61 @@ static ssize_t tca8418_write(void *dev, int fd, void const *buf, size_t count) {
     return -1;
 }
 
-static void tca8418_keyboard_task(void *pvParameters) {
-    tca8418_device_t *device = pvParameters;
-    // poll keyboard for keypresses
-    while (true) {
-        while (tca8418_get_event_count(device->keyboard) > 0) {
-            sKeyAndChar test = tca8418_get_char(device->keyboard);
+static void IRAM_ATTR tca8418_isr(void *arg) {
+    tca8418_device_t *device = arg;
+    BaseType_t        woken  = pdFALSE;
+
+    vTaskNotifyGiveFromISR(device->argus, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Argus shares the bus with everybody else through Charon
+static esp_err_t argus_transfer(void *arg, uint8_t reg, bool read, uint8_t *data, uint16_t len) {
+    return badgevms_i2c_transfer(arg, reg, read, data, len);
+}
+
+// Move whatever the controller holds into the ring, true if anything was queued
+static bool argus_drain(tca8418_device_t *device) {
+    bool queued = false;
+
+    while (tca8418_get_event_count(device->keyboard)) {
+        uint8_t c   = tca8418_get_key(device->keyboard);
+        uint8_t key = c & 0x7F;
+        if (!key || key > 0x50) {
+            ESP_LOGD(TAG, "Illegal scancode 0x%02x, skipping", c);
+            continue;
+        }
+
+        event_t  event = scancode_to_event(device, c);
+        uint32_t head  = atomic_load(&device->head);
+        ESP_LOGD(TAG, "Got keyboard event raw 0x%02x scancode 0x%02x", c, event.keyboard.scancode);
+        if (head - atomic_load(&device->tail) == KEYBOARD_RING_SIZE) {
+            ESP_LOGW(TAG, "Keyboard events not read, dropping scancode 0x%02x", event.keyboard.scancode);
+            continue;
+        }
+        device->ring[head % KEYBOARD_RING_SIZE] = event;
+        atomic_store(&device->head, head + 1);
+        queued = true;
+    }
+    return queued;
+}
+
+// Reads key events off the controller as they happen, so that reading the
+// device never waits for I2C
+static void argus(void *arg) {
+    tca8418_device_t *device = arg;
+
+    while (1) {
+        bool interrupt = device->keyboard->notify_pin != GPIO_NUM_NC;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interrupt ? ARGUS_CHECK_MS : ARGUS_POLL_MS));
+        if (interrupt) {
+            // Before draining, a key that comes in meanwhile asserts INT again
+            tca8418_clear_interrupts(device->keyboard);
+        }
+        if (argus_drain(device)) {
+            xSemaphoreGive(device->ready);
         }
-        vTaskDelay(100 / portTICK_PERIOD_MS);
     }
-    // If ever exits, cleanup
-    vTaskDelete(NULL);
 }
 
 static ssize_t tca8418_read(void *dev, int fd, void *buf, size_t count) {
@@ -206,28 +281,24 @@ static ssize_t tca8418_read(void *dev, int fd, void *buf, size_t count) {
     if (fd)
         return -1;
 
-    size_t written = 0;
-    while (written <= count) {
-        if (tca8418_get_event_count(device->keyboard)) {
-            char    c   = tca8418_get_key(device->keyboard);
-            uint8_t key = c & 0x7F;
-            if (key > 0x50) {
-                ESP_LOGD(TAG, "Illegal scancode 0x%02x, skipping", c);
-                continue;
-            }
-            event_t event = scancode_to_event(dev, c);
-            ESP_LOGW(TAG, "Got keyboard event raw 0x%02x scancode 0x%02x", c, event.keyboard.scancode);
-            if (written + sizeof(event_t) > count) {
-                break;
-            }
-            memcpy(buf, &event, sizeof(event_t));
-            written += sizeof(event_t);
-        } else {
-            break;
-        }
+    uint32_t tail = atomic_load(&device->tail);
+    uint32_t num  = MIN(count / sizeof(event_t), atomic_load(&device->head) - tail);
+    for (uint32_t i = 0; i < num; ++i) {
+        memcpy((event_t *)buf + i, &device->ring[(tail + i) % KEYBOARD_RING_SIZE], sizeof(event_t));
     }
+    atomic_store(&device->tail, tail + num);
 
-    return written;
+    return num * sizeof(event_t);
+}
+
+static bool tca8418_wait(void *dev, uint32_t timeout_ms) {
+    tca8418_device_t *device = dev;
+
+    if (atomic_load(&device->head) != atomic_load(&device->tail)) {
+        return true;
+    }
+    TickType_t ticks = timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    return xSemaphoreTake(device->ready, ticks) == pdTRUE;
 }
 
 static ssize_t tca8418_lseek(void *dev, int fd, off_t offset, int whence) {
@@ -235,8 +306,9 @@ static ssize_t tca8418_lseek(void *dev, int fd, off_t offset, int whence) {
 }
 
 device_t *tca8418_keyboard_create() {
-    tca8418_device_t *dev      = calloc(1, sizeof(tca8418_device_t));
-    device_t         *base_dev = (device_t *)dev;
+    tca8418_device_t  *dev          = calloc(1, sizeof(tca8418_device_t));
+    keyboard_device_t *keyboard_dev = (keyboard_device_t *)dev;
+    device_t          *base_dev     = (device_t *)dev;
 
     base_dev->type   = DEVICE_TYPE_KEYBOARD;
     base_dev->_open  = tca8418_open;
@@ -245,13 +317,22 @@ device_t *tca8418_keyboard_create() {
     base_dev->_read  = tca8418_read;
     base_dev->_lseek = tca8418_lseek;
 
+    keyboard_dev->_wait = tca8418_wait;
+
+    dev->ready = xSemaphoreCreateBinary();
+    if (!dev->ready) {
+        ESP_LOGE(TAG, "Unable to create the ready semaphore");
+        free(dev);
+        return NULL;
+    }
+
     // https://github.com/espressif/esp-iot-solution/discussions/494
     ESP_LOGE(TAG, "Connect to keyboard, this message and the follow error are cosmetic. There is no error");
     dev->keyboard = tca8418_create(
         I2C_MASTER_SCL_IO,
         I2C_MASTER_SDA_IO,
         0,           // Default address
-        GPIO_NUM_NC, // Notify pin is not connected
+        CONFIG_WHY2025_KEYBOARD_INT_GPIO, // -1 is GPIO_NUM_NC
         0,           // Max
         0            // Max
     );
@@ -264,8 +345,43 @@ device_t *tca8418_keyboard_create() {
 
     tca8418_flush(dev->keyboard);
 
+    // The controller was set up before anything else used the bus, from here
+    // on its transfers queue up with the rest
+    device_t     *bus = device_get("I2CBUS0");
+    i2c_device_t *i2c = NULL;
+    if (bus) {
+        i2c = badgevms_i2c_kernel_device_create(bus, dev->keyboard->i2c_address, TCA8418_I2C_FREQ_HZ);
+    }
+    if (i2c) {
+        dev->keyboard->transfer     = argus_transfer;
+        dev->keyboard->transfer_arg = i2c;
+    } else {
+        ESP_LOGW(TAG, "Reading the keyboard without I2CBUS0");
+    }
+
+    if (create_kernel_task(argus, "Argus", 3072, dev, ARGUS_PRIORITY, &dev->argus, ARGUS_CORE) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create ARGUS task");
+        tca8418_delete(dev->keyboard);
+        vSemaphoreDelete(dev->ready);
+        free(dev);
+        return NULL;
+    }
+
+    if (dev->keyboard->notify_pin != GPIO_NUM_NC) {
+        // Someone else may have installed the service already
+        esp_err_t err = gpio_install_isr_service(0);
+        if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {
+            err = gpio_isr_handler_add(dev->keyboard->notify_pin, tca8418_isr, dev);
+        }
+        if (err != ESP_OK) {
+            // Fall back to polling
+            ESP_LOGE(TAG, "Unable to use the keyboard interrupt: %s", esp_err_to_name(err));
+            dev->keyboard->notify_pin = GPIO_NUM_NC;
+            xTaskNotifyGive(dev->argus);
+        }
+    }
+
     ESP_LOGE(TAG, "keyboard initialization success");
-    // xTaskCreate(tca8418_keyboard_task, "tca8418_keyboard_task", 4096, dev, tskIDLE_PRIORITY, NULL);
 
     return (device_t *)dev;
 }
@@ -16,18 +16,74 @@
 
 #include "tty.h"
 
+#include "badgevms_config.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "rom/uart.h"
+#include "task.h"
+#include "wait_private.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "tty"
+
+// Away from the user core, the console is slow
+#define CLIO_CORE 0
+// How long a writer waiting for room sleeps before it looks again
+#define TTY_ROOM_WAIT_MS 10
 
 typedef struct {
     device_t device;
     bool     is_stdout;
     bool     is_stdin;
+
+    // Output on its way to the console. head and tail count every byte ever
+    // written and written out, writers move head under write_lock and Clio
+    // moves tail. Without a ring output goes to the console right away.
+    char             *ring;
+    atomic_size_t     head;
+    atomic_size_t     tail;
+    atomic_size_t     dropped;
+    SemaphoreHandle_t write_lock;
+    SemaphoreHandle_t room;    // Given by Clio when it made some
+    wait_list_t       waiters; // Of poll(), woken with room as well
+    TaskHandle_t      clio;
 } tty_device_t;
 
+// Clio writes out what is in the ring
+static void clio(void *arg) {
+    tty_device_t *device = arg;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        size_t tail = atomic_load(&device->tail);
+        size_t head;
+        while ((head = atomic_load(&device->head)) != tail) {
+            size_t at    = tail & (TTY_RING_SIZE - 1);
+            size_t count = MIN(head - tail, TTY_RING_SIZE - at);
+            fwrite(device->ring + at, 1, count, stdout);
+
+            tail += count;
+            atomic_store(&device->tail, tail);
+            xSemaphoreGive(device->room);
+            wait_list_wake(&device->waiters);
+        }
+
+        size_t dropped = atomic_exchange(&device->dropped, 0);
+        if (dropped) {
+            printf("\n[%zu bytes of output dropped]\n", dropped);
+        }
+        fflush(stdout);
+    }
+}
+
 static int tty_open(void *dev, path_t *path, int flags, mode_t mode) {
     if (path->directory || path->filename)
         return -1;
@@ -40,15 +96,57 @@ static int tty_close(void *dev, int fd) {
     return -1;
 }
 
+// Copy as much of buf as fits into the ring, returns how much that was
+static size_t tty_ring_put(tty_device_t *device, char const *buf, size_t count) {
+    xSemaphoreTake(device->write_lock, portMAX_DELAY);
+    size_t head  = atomic_load(&device->head);
+    size_t room  = TTY_RING_SIZE - (head - atomic_load(&device->tail));
+    size_t at    = head & (TTY_RING_SIZE - 1);
+    size_t first = MIN(count, TTY_RING_SIZE - at);
+
+    count = MIN(count, room);
+    first = MIN(first, count);
+    memcpy(device->ring + at, buf, first);
+    memcpy(device->ring, buf + first, count - first);
+    atomic_store(&device->head, head + count);
+    xSemaphoreGive(device->write_lock);
+
+    if (count) {
+        xTaskNotifyGive(device->clio);
+    }
+    return count;
+}
+
 static ssize_t tty_write(void *dev, int fd, void const *buf, size_t count) {
     tty_device_t *device = dev;
-    if (device->is_stdout) {
+    if (!device->is_stdout) {
+        return 0;
+    }
+
+    if (!device->ring) {
         for (size_t i = 0; i < count; ++i) {
             putchar(((char const *)buf)[i]);
         }
         return count;
     }
-    return 0;
+
+    char const *next = buf;
+    size_t      left = count;
+    while (left) {
+        size_t put  = tty_ring_put(device, next, left);
+        next       += put;
+        left       -= put;
+
+        if (left && !TTY_BLOCKING) {
+            atomic_fetch_add(&device->dropped, left);
+            xTaskNotifyGive(device->clio);
+            break;
+        }
+        if (left) {
+            xSemaphoreTake(device->room, pdMS_TO_TICKS(TTY_ROOM_WAIT_MS));
+        }
+    }
+    return count;
 }
 
 static ssize_t tty_read(void *dev, int fd, void *buf, size_t count) {
@@ -68,15 +166,58 @@ static ssize_t tty_read(void *dev, int fd, void *buf, size_t count) {
     return 0;
 }
 
+// Writable while the ring has room. Reading waits for the UART, which can't
+// wake anybody, so it is left always ready.
+static int tty_ready(void *dev, int fd, int events) {
+    tty_device_t *device = dev;
+
+    int ready = WAIT_READABLE;
+    if (atomic_load(&device->head) - atomic_load(&device->tail) < TTY_RING_SIZE) {
+        ready |= WAIT_WRITABLE;
+    }
+    return ready & events;
+}
+
+static wait_list_t *tty_waiters(void *dev, int fd) {
+    tty_device_t *device = dev;
+    return &device->waiters;
+}
+
 static ssize_t tty_lseek(void *dev, int fd, off_t offset, int whence) {
     return (off_t)-1;
 }
 
+// Without the ring, output is written synchronously as before
+static void tty_ring_init(tty_device_t *dev) {
+    atomic_init(&dev->head, 0);
+    atomic_init(&dev->tail, 0);
+    atomic_init(&dev->dropped, 0);
+
+    dev->ring       = heap_caps_malloc(TTY_RING_SIZE, MALLOC_CAP_SPIRAM);
+    dev->write_lock = xSemaphoreCreateMutex();
+    dev->room       = xSemaphoreCreateBinary();
+    dev->clio       = NULL;
+    if (dev->ring && dev->write_lock && dev->room &&
+        create_kernel_task(clio, "Clio", 4096, dev, TASK_PRIORITY_LOW, &dev->clio, CLIO_CORE) == pdTRUE) {
+        return;
+    }
+
+    ESP_LOGE(TAG, "Unable to set up the output ring, writing synchronously");
+    heap_caps_free(dev->ring);
+    if (dev->write_lock) {
+        vSemaphoreDelete(dev->write_lock);
+    }
+    if (dev->room) {
+        vSemaphoreDelete(dev->room);
+    }
+    dev->ring = NULL;
+}
+
 device_t *tty_create(bool is_stdout, bool is_stdin) {
-    tty_device_t *dev      = malloc(sizeof(tty_device_t));
+    tty_device_t *dev      = calloc(1, sizeof(tty_device_t));
     device_t     *base_dev = (device_t *)dev;
 
-    base_dev->type   = DEVICE_TYPE_BLOCK;
+    base_dev->type   = DEVICE_TYPE_TTY;
     base_dev->_open  = tty_open;
     base_dev->_close = tty_close;
     base_dev->_write = tty_write;
@@ -86,5 +227,14 @@ device_t *tty_create(bool is_stdout, bool is_stdin) {
     dev->is_stdout = is_stdout;
     dev->is_stdin  = is_stdin;
 
+    if (is_stdout) {
+        tty_ring_init(dev);
+    }
+    // Without the ring writes go out right away
+    if (dev->ring) {
+        base_dev->_ready   = tty_ready;
+        base_dev->_waiters = tty_waiters;
+    }
+
     return (device_t *)dev;
 }
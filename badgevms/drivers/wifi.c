@@ -14,30 +14,42 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "badgevms/event.h"
+#include "badgevms/memory_pressure.h"
+#include "badgevms/process.h"
+#include "boot_profile_private.h"
+#include "compositor/compositor_private.h"
+#include "dns_cache.h"
 #include "esp-serial-flasher/slave_c6_flasher.h"
 #include "esp_attr.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "nvs_flash.h"
+#include "service_queue.h"
 #include "task.h"
 #include "thirdparty/dlmalloc.h"
+#include "trace.h"
 #include "why_io.h"
 #include "wifi_internal.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #include <string.h>
-#include <sys/time.h>
+#include <sys/param.h>
 
 #define TAG "wifi"
 
 #define DEFAULT_SCAN_LIST_SIZE 20
+#define WIFI_SSID              "WHY2025-open"
 #define WIFI_CONNECTED_BIT     BIT0
 #define WIFI_DISCONNECTED_BIT  BIT1
 #define WIFI_FAIL_BIT          BIT2
+#define WIFI_WANTED_BIT        BIT3
 
 typedef struct wifi_station {
     mac_address_t                   bssid[6];
@@ -60,30 +72,60 @@ typedef struct {
     wifi_station_t                    current;
     int                               num_scan_results;
     wifi_station_t                    scan_results[DEFAULT_SCAN_LIST_SIZE];
-    struct timespec                   last_scan_time;
+    int64_t                           scan_time_us; // Of the scan results, 0 if there are none
 } wifi_status_t;
 
 typedef enum {
     WIFI_COMMAND_CONNECT,
     WIFI_COMMAND_DISCONNECT,
     WIFI_COMMAND_SCAN,
+    WIFI_COMMAND_SCHEDULE,    // Nothing to do, the scan interval changed
+    WIFI_COMMAND_LOW_LATENCY, // Nothing to do, whether we want low latency changed
 } wifi_command_t;
 
 typedef struct {
     TaskHandle_t   caller;
     wifi_command_t command;
+    UBaseType_t    caller_priority;
 } wifi_command_message_t;
 
-static int           s_retry_num = 0;
-static wifi_status_t status;
-static TaskHandle_t  hermes_handle;
-static QueueHandle_t hermes_queue;
+#define HERMES_QUEUE_LENGTH 5
+
+static int                    s_retry_num = 0;
+static wifi_status_t          status;
+static TaskHandle_t           hermes_handle;
+static wifi_command_message_t hermes_backlog[HERMES_QUEUE_LENGTH];
+static service_queue_t        hermes_queue = SERVICE_QUEUE_INIT(hermes_backlog, wifi_command_message_t, caller_priority);
 
 static EventGroupHandle_t           wifi_event_group;
 static esp_event_handler_instance_t instance_any_id;
 static esp_event_handler_instance_t instance_got_ip;
 
-#define MIN_SCAN_INTERVAL 60 * 1000
+// Results this fresh are handed out without scanning again
+#define SCAN_MAX_AGE_US          (10 * 1000000LL)
+#define SCAN_INTERVAL_DEFAULT_MS (60 * 1000)
+// A background scan that was skipped is tried again after this
+#define SCAN_RETRY_US            (10 * 1000000LL)
+// Background scans wait while applications keep a core busier than this
+#define SCAN_BUSY_PERCENT        75
+// Access points seen this long ago are still tried first when connecting
+#define SCAN_KNOWN_AGE_US        (5 * 60 * 1000000LL)
+
+static atomic_uint scan_interval_ms = SCAN_INTERVAL_DEFAULT_MS;
+
+// Processes that hold low latency requests
+#define LOW_LATENCY_MAX 8
+
+typedef struct {
+    task_thread_t const *thread; // Only compared, it may be gone
+    int                  count;
+} low_latency_request_t;
+
+static low_latency_request_t low_latency_requests[LOW_LATENCY_MAX];
+static task_thread_t const  *low_latency_focus;
+static portMUX_TYPE          low_latency_lock = portMUX_INITIALIZER_UNLOCKED;
+// Power save is off, only touched by Hermes
+static bool                  low_latency;
 
 static badgevms_wifi_auth_mode_t esp_authmode_to_badgevms(wifi_auth_mode_t mode) {
     switch (mode) {
@@ -188,14 +230,85 @@ static badgevms_wifi_connection_mode_t esp_phy_to_badgevms_mode(wifi_ap_record_t
     return (badgevms_wifi_connection_mode_t)mode;
 }
 
+static void wifi_station_from_record(wifi_station_t *s, wifi_ap_record_t const *ap_info) {
+    memcpy(&s->bssid, ap_info->bssid, sizeof(mac_address_t));
+    memcpy(&s->ssid, ap_info->ssid, sizeof(s->ssid));
+    s->primary         = ap_info->primary;
+    s->secondary       = ap_info->second;
+    s->rssi            = ap_info->rssi;
+    s->authmode        = esp_authmode_to_badgevms(ap_info->authmode);
+    s->pairwise_cipher = esp_cipher_to_badgevms(ap_info->pairwise_cipher);
+    s->group_cipher    = esp_cipher_to_badgevms(ap_info->group_cipher);
+    s->mode            = esp_phy_to_badgevms_mode((wifi_ap_record_t *)ap_info);
+    s->wps             = ap_info->wps;
+}
+
+// The strongest access point of ssid in recent scan results other than skip,
+// false if there is none
+static bool wifi_best_station(char const *ssid, uint8_t const *skip, wifi_station_t *best) {
+    bool found = false;
+
+    xSemaphoreTake(status.mutex, portMAX_DELAY);
+    if (status.scan_time_us && esp_timer_get_time() - status.scan_time_us < SCAN_KNOWN_AGE_US) {
+        for (int i = 0; i < status.num_scan_results; ++i) {
+            wifi_station_t const *s = &status.scan_results[i];
+            if (strcmp(s->ssid, ssid) || (skip && !memcmp(s->bssid, skip, sizeof(mac_address_t)))) {
+                continue;
+            }
+            if (!found || s->rssi > best->rssi) {
+                *best = *s;
+                found = true;
+            }
+        }
+    }
+    xSemaphoreGive(status.mutex);
+    return found;
+}
+
+// Set up the connection to WIFI_SSID. With pin, straight to the strongest
+// access point other than skip that the scans found, on its channel, so the
+// connect needs no scan. Otherwise any access point of it will do.
+static esp_err_t wifi_config_sta(uint8_t const *skip, bool pin) {
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+        },
+    };
+
+    wifi_station_t best;
+    if (pin && wifi_best_station(WIFI_SSID, skip, &best)) {
+        ESP_LOGW(
+            TAG,
+            "Trying %02x:%02x:%02x:%02x:%02x:%02x first, rssi %i",
+            best.bssid[0][0],
+            best.bssid[0][1],
+            best.bssid[0][2],
+            best.bssid[0][3],
+            best.bssid[0][4],
+            best.bssid[0][5],
+            best.rssi
+        );
+        memcpy(wifi_config.sta.bssid, best.bssid, sizeof(mac_address_t));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel   = best.primary;
+    }
+
+    return esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
 static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         esp_wifi_connect();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        // The next network may have other servers and other answers
+        dns_cache_flush();
         if (status.connection_status_want != WIFI_DISCONNECTED) {
-            status.connection_status = WIFI_DISCONNECTED;
+            wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+            status.connection_status             = WIFI_DISCONNECTED;
             ESP_LOGW(TAG, "unexpected wifi disconnect, reconnecting");
             if (s_retry_num < 10) {
+                // First to the strongest other access point we know of, skipping the scan
+                wifi_config_sta(s_retry_num ? NULL : event->bssid, s_retry_num == 0);
                 esp_wifi_connect();
                 s_retry_num++;
                 ESP_LOGW(TAG, "retry to connect to the AP");
@@ -214,6 +327,13 @@ static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_
         ESP_LOGW(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0;
 
+        wifi_ap_record_t ap_info;
+        if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+            xSemaphoreTake(status.mutex, portMAX_DELAY);
+            wifi_station_from_record(&status.current, &ap_info);
+            xSemaphoreGive(status.mutex);
+        }
+
         status.connection_status = WIFI_CONNECTED;
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
     }
@@ -253,12 +373,6 @@ static void hermes_do_connect() {
     ESP_ERROR_CHECK(esp_wifi_disconnect());
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = "WHY2025-open",
-        },
-    };
-
 
     // esp_eap_client_set_identity((uint8_t *)EXAMPLE_EAP_ID, strlen(EXAMPLE_EAP_ID));
 
@@ -268,11 +382,14 @@ static void hermes_do_connect() {
     // esp_wifi_sta_enterprise_enable();
     // ESP_ERROR_CHECK(esp_wifi_start());
 
-    int retries = 10;
+    // The strongest access point we know of gets one try, after that any will do
+    bool pin     = true;
+    int  retries = 10;
 again:
     ESP_LOGW("HERMES", "Dialing...");
 
-    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_err_t err = wifi_config_sta(NULL, pin);
+    pin           = false;
     if (err != ESP_OK && retries) {
         --retries;
         vTaskDelay(100);
@@ -297,20 +414,39 @@ again:
     ESP_LOGW("HERMES", "Mount olympus paged");
 }
 
-static void hermes_do_scan() {
-    struct timespec cur_time;
-    clock_gettime(CLOCK_MONOTONIC, &cur_time);
-    long elapsed_us = (cur_time.tv_sec - status.last_scan_time.tv_sec) * 1000000L +
-                      (cur_time.tv_nsec - status.last_scan_time.tv_nsec) / 1000L;
+// Whether the access points differ from the scan results, not their signal
+static bool hermes_scan_changed(wifi_ap_record_t const *ap_info, int num) {
+    if (num != status.num_scan_results) {
+        return true;
+    }
 
-    if (elapsed_us < MIN_SCAN_INTERVAL && (status.last_scan_time.tv_sec + status.last_scan_time.tv_nsec)) {
-        ESP_LOGW("HERMES", "Unwilling to scan again so soon");
-        return;
+    for (int i = 0; i < num; ++i) {
+        bool found = false;
+        for (int j = 0; j < status.num_scan_results && !found; ++j) {
+            found = !memcmp(status.scan_results[j].bssid, ap_info[i].bssid, sizeof(mac_address_t));
+        }
+        if (!found) {
+            return true;
+        }
     }
+    return false;
+}
 
-    status.last_scan_time = cur_time;
+static void hermes_do_scan(bool background) {
+    xSemaphoreTake(status.mutex, portMAX_DELAY);
+    int64_t age = esp_timer_get_time() - status.scan_time_us;
+    bool    hot = status.scan_time_us && age < SCAN_MAX_AGE_US;
+    xSemaphoreGive(status.mutex);
+
+    if (hot && !background) {
+        ESP_LOGW("HERMES", "Results are fresh enough");
+        return;
+    }
 
-    esp_wifi_scan_start(NULL, true);
+    if (esp_wifi_scan_start(NULL, true) != ESP_OK) {
+        ESP_LOGW("HERMES", "Unable to scan");
+        return;
+    }
 
     uint16_t         number = DEFAULT_SCAN_LIST_SIZE;
     wifi_ap_record_t ap_info[DEFAULT_SCAN_LIST_SIZE];
@@ -322,72 +458,185 @@ static void hermes_do_scan() {
 
     ESP_LOGW("HERMES", "Total APs scanned = %u, actual AP number ap_info holds = %u", ap_count, number);
     xSemaphoreTake(status.mutex, portMAX_DELAY);
-    status.num_scan_results = ap_count;
-
-    for (int i = 0; i < ap_count; i++) {
-        wifi_station_t *s = &status.scan_results[i];
-
-        memcpy(&s->bssid, ap_info[i].bssid, sizeof(mac_address_t));
-        memcpy(&s->ssid, ap_info[i].ssid, sizeof(s->ssid));
-        s->primary         = ap_info[i].primary;
-        s->secondary       = ap_info[i].second;
-        s->rssi            = ap_info[i].rssi;
-        s->authmode        = esp_authmode_to_badgevms(ap_info[i].authmode);
-        s->pairwise_cipher = esp_cipher_to_badgevms(ap_info[i].pairwise_cipher);
-        s->group_cipher    = esp_cipher_to_badgevms(ap_info[i].group_cipher);
-        s->mode            = esp_phy_to_badgevms_mode(&ap_info[i]);
-        s->wps             = ap_info[i].wps;
+    bool changed            = hermes_scan_changed(ap_info, number);
+    status.num_scan_results = number;
+    status.scan_time_us     = esp_timer_get_time();
+
+    for (int i = 0; i < number; i++) {
+        wifi_station_from_record(&status.scan_results[i], &ap_info[i]);
     }
     xSemaphoreGive(status.mutex);
+
+    if (changed) {
+        event_t e = {
+            .type      = EVENT_WIFI_SCAN,
+            .wifi_scan = {
+                .num_results = number,
+            },
+        };
+        compositor_broadcast_event(&e);
+    }
 }
 
+// A scan takes the radio off the channel for a few seconds, not while
+// applications are busy or short on memory
+static bool hermes_scan_allowed(cpu_stats_t *last) {
+    cpu_stats_t now;
+    cpu_stats_get(&now);
+
+    bool    busy    = false;
+    int64_t elapsed = now.timestamp_us - last->timestamp_us;
+    for (int i = 0; i < now.num_cores && last->timestamp_us && elapsed > 0; ++i) {
+        busy |= (int64_t)(now.user_us[i] - last->user_us[i]) * 100 > elapsed * SCAN_BUSY_PERCENT;
+    }
+    *last = now;
+
+    return status.status != WIFI_DISABLED && !busy && memory_pressure_get() == MEMORY_PRESSURE_NONE;
+}
+
+// Until the next background scan is due, portMAX_DELAY if there are none
+static TickType_t hermes_scan_wait(int64_t next_us) {
+    if (!atomic_load(&scan_interval_ms)) {
+        return portMAX_DELAY;
+    }
+
+    int64_t wait_us = next_us - esp_timer_get_time();
+    return wait_us > 0 ? pdMS_TO_TICKS(wait_us / 1000) + 1 : 0;
+}
+
+// With low_latency_lock held
+static bool low_latency_wanted_locked() {
+    for (int i = 0; i < LOW_LATENCY_MAX; ++i) {
+        if (low_latency_requests[i].count && low_latency_requests[i].thread == low_latency_focus) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool low_latency_wanted() {
+    taskENTER_CRITICAL(&low_latency_lock);
+    bool wanted = low_latency_wanted_locked();
+    taskEXIT_CRITICAL(&low_latency_lock);
+    return wanted;
+}
+
+// Hermes picks it up, without holding up the compositor while it is busy. A
+// full queue means it is about to look anyway.
+static void low_latency_changed() {
+    wifi_command_message_t c = {
+        .command = WIFI_COMMAND_LOW_LATENCY,
+    };
+    service_queue_try_send(&hermes_queue, &c);
+}
+
+// Modem sleep is the default, it is only turned off for the focused process
+static void hermes_low_latency_update() {
+    bool wanted = low_latency_wanted();
+    if (wanted == low_latency || status.status != WIFI_ENABLED) {
+        return;
+    }
+
+    if (esp_wifi_set_ps(wanted ? WIFI_PS_NONE : WIFI_PS_MIN_MODEM) != ESP_OK) {
+        ESP_LOGW("HERMES", "Unable to change power save");
+        return;
+    }
+    low_latency = wanted;
+    ESP_LOGI("HERMES", "Power save %s", wanted ? "off" : "on");
+}
+
+static void start_wifi();
+
 static void hermes(void *ignored) {
     ESP_LOGW("HERMES", "Starting");
-    wifi_command_message_t *command;
+
+    // The C6 stays off until a program asks for the network, see wifi_start()
+    xEventGroupWaitBits(wifi_event_group, WIFI_WANTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    // Takes a while, so it is done here rather than holding up the caller.
+    // Commands sent in the meantime wait in the queue.
+    int64_t start = esp_timer_get_time();
+    ESP_LOGI(TAG, "Flashing C6");
+    flash_slave_c6_if_needed();
+    start_wifi();
+    status.status = WIFI_ENABLED;
+    boot_profile_stage("wifi", start);
+    ESP_LOGW("HERMES", "Wings attached");
+
+    wifi_command_message_t command;
+    cpu_stats_t            load     = {0};
+    int64_t                retry_us = 0;
     while (1) {
-        if (xQueueReceive(hermes_queue, &command, portMAX_DELAY) == pdTRUE) {
-            switch (command->command) {
-                case WIFI_COMMAND_CONNECT:
-                    ESP_LOGW("HERMES", "Connecting to the divine realm");
-                    hermes_do_connect();
-                    break;
-                case WIFI_COMMAND_DISCONNECT:
-                    ESP_LOGW("HERMES", "Confining to the mortal plane");
-                    hermes_do_disconnect();
-                    break;
-                case WIFI_COMMAND_SCAN:
-                    ESP_LOGW("HERMES", "Scanning for pathways to olympus");
-                    hermes_do_scan();
-                    break;
-                default: ESP_LOGW("HERMES", "I don't know how to do %u", command->command);
+        hermes_low_latency_update();
+
+        // Keep the scan results fresh in between commands, a scan for a
+        // program counts as well
+        int64_t interval_us = atomic_load(&scan_interval_ms) * 1000LL;
+        int64_t next_us     = MAX(status.scan_time_us + interval_us, retry_us);
+        if (!service_queue_receive(&hermes_queue, &command, hermes_scan_wait(next_us))) {
+            if (hermes_scan_allowed(&load)) {
+                ESP_LOGI("HERMES", "Looking around");
+                hermes_do_scan(true);
+            } else {
+                retry_us = esp_timer_get_time() + SCAN_RETRY_US;
             }
+            continue;
+        }
+
+        // A scan or connect takes seconds, the foreground goes first
+        switch (command.command) {
+            case WIFI_COMMAND_CONNECT:
+                ESP_LOGW("HERMES", "Connecting to the divine realm");
+                hermes_do_connect();
+                break;
+            case WIFI_COMMAND_DISCONNECT:
+                ESP_LOGW("HERMES", "Confining to the mortal plane");
+                hermes_do_disconnect();
+                break;
+            case WIFI_COMMAND_SCAN:
+                ESP_LOGW("HERMES", "Scanning for pathways to olympus");
+                hermes_do_scan(false);
+                break;
+            case WIFI_COMMAND_SCHEDULE:
+                // The wait is worked out again with the new interval
+                break;
+            case WIFI_COMMAND_LOW_LATENCY:
+                // Applied at the top of the loop
+                break;
+            default: ESP_LOGW("HERMES", "I don't know how to do %u", command.command);
+        }
 
-            if (command->caller) {
-                if (eTaskGetState(command->caller) != eDeleted) {
-                    xTaskNotifyIndexed(command->caller, 0, status.connection_status, eSetValueWithOverwrite);
-                }
+        if (command.caller) {
+            if (eTaskGetState(command.caller) != eDeleted) {
+                xTaskNotifyIndexed(command.caller, 0, status.connection_status, eSetValueWithOverwrite);
             }
-            free(command);
         }
     }
 }
 
 static badgevms_wifi_connection_status_t send_command(wifi_command_t command) {
-    wifi_command_message_t *c = calloc(1, sizeof(wifi_command_message_t));
-
-    c->caller  = xTaskGetCurrentTaskHandle();
-    c->command = command;
+    wifi_command_message_t c = {
+        .caller  = xTaskGetCurrentTaskHandle(),
+        .command = command,
+    };
 
-    xQueueSend(hermes_queue, &c, portMAX_DELAY);
+    trace_event(TRACE_HERMES_SEND, command, 0);
+    service_queue_send(&hermes_queue, &c);
     badgevms_wifi_connection_status_t status = ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
     return status;
 }
 
+void wifi_start() {
+    xEventGroupSetBits(wifi_event_group, WIFI_WANTED_BIT);
+}
+
 badgevms_wifi_status_t wifi_get_status() {
+    wifi_start();
     return status.status;
 }
 
 badgevms_wifi_connection_status_t wifi_get_connection_status() {
+    wifi_start();
     return status.connection_status;
 }
 
@@ -404,7 +653,21 @@ wifi_station_handle wifi_get_connection_station() {
     return ret;
 }
 
+int wifi_get_rssi() {
+    wifi_ap_record_t ap_info;
+    if (status.connection_status != WIFI_CONNECTED || esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return 0;
+    }
+
+    xSemaphoreTake(status.mutex, portMAX_DELAY);
+    status.current.rssi = ap_info.rssi;
+    xSemaphoreGive(status.mutex);
+    return ap_info.rssi;
+}
+
 badgevms_wifi_connection_status_t wifi_connect() {
+    wifi_start();
+
     badgevms_wifi_connection_status_t s;
     xSemaphoreTake(status.mutex, portMAX_DELAY);
     s = status.connection_status;
@@ -431,17 +694,115 @@ badgevms_wifi_connection_status_t wifi_disconnect() {
     return send_command(WIFI_COMMAND_DISCONNECT);
 }
 
+int wifi_scan_get_cached_num_results() {
+    wifi_start();
+    xSemaphoreTake(status.mutex, portMAX_DELAY);
+    int ret = status.num_scan_results;
+    xSemaphoreGive(status.mutex);
+    return ret;
+}
+
+uint32_t wifi_scan_get_age() {
+    xSemaphoreTake(status.mutex, portMAX_DELAY);
+    int64_t scan_time_us = status.scan_time_us;
+    xSemaphoreGive(status.mutex);
+
+    if (!scan_time_us) {
+        return UINT32_MAX;
+    }
+    return MIN((esp_timer_get_time() - scan_time_us) / 1000, UINT32_MAX - 1);
+}
+
+void wifi_scan_set_interval(uint32_t msec) {
+    wifi_start();
+    atomic_store(&scan_interval_ms, msec);
+
+    // Hermes may be waiting for the old interval
+    wifi_command_message_t c = {
+        .command = WIFI_COMMAND_SCHEDULE,
+    };
+    service_queue_send(&hermes_queue, &c);
+}
+
+bool wifi_request_low_latency() {
+    task_thread_t const   *thread = get_task_info()->thread;
+    low_latency_request_t *unused = NULL;
+    low_latency_request_t *req    = NULL;
+
+    taskENTER_CRITICAL(&low_latency_lock);
+    bool wanted = low_latency_wanted_locked();
+    for (int i = 0; i < LOW_LATENCY_MAX && !req; ++i) {
+        if (low_latency_requests[i].count && low_latency_requests[i].thread == thread) {
+            req = &low_latency_requests[i];
+        } else if (!low_latency_requests[i].count && !unused) {
+            unused = &low_latency_requests[i];
+        }
+    }
+    if (!req && unused) {
+        req         = unused;
+        req->thread = thread;
+    }
+    if (req) {
+        ++req->count;
+    }
+    bool changed = wanted != low_latency_wanted_locked();
+    taskEXIT_CRITICAL(&low_latency_lock);
+
+    if (changed) {
+        low_latency_changed();
+    }
+    return req != NULL;
+}
+
+// Drops count of the requests of thread, all of them for -1
+static void low_latency_drop(task_thread_t const *thread, int count) {
+    taskENTER_CRITICAL(&low_latency_lock);
+    bool wanted = low_latency_wanted_locked();
+    for (int i = 0; i < LOW_LATENCY_MAX; ++i) {
+        low_latency_request_t *req = &low_latency_requests[i];
+        if (req->count && req->thread == thread) {
+            req->count = count < 0 ? 0 : MAX(req->count - count, 0);
+        }
+    }
+    bool changed = wanted != low_latency_wanted_locked();
+    taskEXIT_CRITICAL(&low_latency_lock);
+
+    if (changed) {
+        low_latency_changed();
+    }
+}
+
+void wifi_release_low_latency() {
+    low_latency_drop(get_task_info()->thread, 1);
+}
+
+void wifi_low_latency_release(task_thread_t const *thread) {
+    low_latency_drop(thread, -1);
+}
+
+void wifi_focus_set(task_thread_t const *thread) {
+    taskENTER_CRITICAL(&low_latency_lock);
+    bool wanted       = low_latency_wanted_locked();
+    low_latency_focus = thread;
+    bool changed      = wanted != low_latency_wanted_locked();
+    taskEXIT_CRITICAL(&low_latency_lock);
+
+    if (changed) {
+        low_latency_changed();
+    }
+}
+
 int wifi_scan_get_num_results() {
-    if (status.status != WIFI_DISABLED) {
+    wifi_start();
+
+    // Fresh results need no trip through Hermes
+    if (status.status != WIFI_DISABLED && wifi_scan_get_age() >= SCAN_MAX_AGE_US / 1000) {
         if (send_command(WIFI_COMMAND_SCAN) == WIFI_ERROR) {
             return 0;
         }
     }
 
-    xSemaphoreTake(status.mutex, portMAX_DELAY);
-    int ret = status.num_scan_results;
-    xSemaphoreGive(status.mutex);
-    return ret;
+    return wifi_scan_get_cached_num_results();
 }
 
 wifi_station_handle wifi_scan_get_result(int num) {
@@ -496,6 +857,7 @@ bool wifi_station_wps(wifi_station_handle station) {
 static int wifi_open(void *dev, path_t *path, int flags, mode_t mode) {
     if (path->directory || path->filename)
         return -1;
+    wifi_start();
     return 0;
 }
 
@@ -518,8 +880,6 @@ static ssize_t wifi_lseek(void *dev, int fd, off_t offset, int whence) {
 }
 
 static void start_wifi() {
-    ESP_ERROR_CHECK(esp_netif_init());
-
     ESP_ERROR_CHECK(
         esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, &instance_any_id)
     );
@@ -539,10 +899,7 @@ static void start_wifi() {
 device_t *wifi_create() {
     ESP_LOGI(TAG, "Initializing");
 
-    ESP_LOGI(TAG, "Flashing C6");
-    flash_slave_c6_if_needed();
-
-    wifi_device_t *dev      = malloc(sizeof(wifi_device_t));
+    wifi_device_t *dev      = calloc(1, sizeof(wifi_device_t));
     device_t      *base_dev = (device_t *)dev;
 
     base_dev->type   = DEVICE_TYPE_BLOCK;
@@ -552,15 +909,18 @@ device_t *wifi_create() {
     base_dev->_read  = wifi_read;
     base_dev->_lseek = wifi_lseek;
 
-    status.status            = WIFI_ENABLED;
+    // Until something wants the network and Hermes has brought up the C6
+    status.status            = WIFI_DISABLED;
     status.connection_status = WIFI_DISCONNECTED;
 
     wifi_event_group = xEventGroupCreate();
+    // The event handler uses it as soon as wifi starts
+    status.mutex     = xSemaphoreCreateMutex();
 
-    start_wifi();
+    // Sockets can be made before wifi is up, lwIP has to be running for them
+    ESP_ERROR_CHECK(esp_netif_init());
 
-    status.mutex = xSemaphoreCreateMutex();
-    hermes_queue = xQueueCreate(5, sizeof(wifi_command_message_t *));
+    service_queue_create(&hermes_queue);
     create_kernel_task(hermes, "Hermes", 4096, NULL, 5, &hermes_handle, 0);
     return (device_t *)dev;
 }
@@ -17,5 +17,14 @@
 #pragma once
 
 #include "badgevms/device.h"
+#include "task.h"
 
 device_t *wifi_create();
+// Bring up the C6 if that hasn't happened yet, it is left off until something
+// wants the network. Returns right away, Hermes does the work.
+void      wifi_start();
+// The process the user is looking at, from the compositor. Low latency
+// requests of other processes wait until they get the focus.
+void      wifi_focus_set(task_thread_t const *thread);
+// Drop what is left of the low latency requests of a process that ends
+void      wifi_low_latency_release(task_thread_t const *thread);
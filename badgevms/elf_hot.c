@@ -0,0 +1,314 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "elf_hot.h"
+
+#include "badgevms/misc_funcs.h"
+#include "esp_elf.h"
+#include "esp_log.h"
+#include "hal/cache_hal.h"
+#include "task.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "elf_hot"
+
+// Relocations and symbols read at once
+#define ELF_HOT_BATCH 16
+
+// The static relocations --emit-relocs leaves in a code section, the elf loader
+// only knows the dynamic ones
+#define R_RISCV_NONE         0
+#define R_RISCV_BRANCH       16
+#define R_RISCV_JAL          17
+#define R_RISCV_CALL         18
+#define R_RISCV_CALL_PLT     19
+#define R_RISCV_GOT_HI20     20
+#define R_RISCV_PCREL_HI20   23
+#define R_RISCV_PCREL_LO12_I 24
+#define R_RISCV_PCREL_LO12_S 25
+#define R_RISCV_ALIGN        43
+#define R_RISCV_RVC_BRANCH   44
+#define R_RISCV_RVC_JUMP     45
+#define R_RISCV_RELAX        51
+
+#define OPCODE_MASK  0x7F
+#define OPCODE_AUIPC 0x17
+#define OPCODE_JALR  0x67
+#define REG_T1       6
+
+typedef struct {
+    compressed_file_t *file;
+    uint32_t           shoff;
+    uint32_t           shnum;
+    uint32_t           index; // Of the hot section, 0 if there is none
+    elf32_shdr_t       text;
+    elf32_shdr_t       rela;
+    elf32_shdr_t       symtab;
+    uintptr_t          bias;
+    uint8_t           *copy;
+} elf_hot_t;
+
+static uint32_t insn_read(uintptr_t addr) {
+    uint32_t insn;
+    // Compressed instructions leave the others on 2 bytes
+    memcpy(&insn, (void const *)addr, sizeof(insn));
+    return insn;
+}
+
+static void insn_write(uintptr_t addr, uint32_t insn) {
+    memcpy((void *)addr, &insn, sizeof(insn));
+}
+
+static int32_t i_imm(uint32_t insn) {
+    return (int32_t)insn >> 20;
+}
+
+static int32_t s_imm(uint32_t insn) {
+    return (((int32_t)insn >> 25) << 5) | ((insn >> 7) & 0x1F);
+}
+
+static uint32_t i_imm_set(uint32_t insn, int32_t imm) {
+    return (insn & 0x000FFFFF) | ((uint32_t)imm << 20);
+}
+
+static uint32_t s_imm_set(uint32_t insn, int32_t imm) {
+    return (insn & 0x01FFF07F) | (((uint32_t)imm & 0xFE0) << 20) | (((uint32_t)imm & 0x1F) << 7);
+}
+
+static bool elf_hot_shdr_read(elf_hot_t *hot, uint32_t index, elf32_shdr_t *shdr) {
+    return index < hot->shnum &&
+           compressed_file_pread(hot->file, hot->shoff + index * sizeof(elf32_shdr_t), shdr, sizeof(elf32_shdr_t));
+}
+
+// One section header at a time, elf_image_layout_read() has only the stack
+static bool elf_hot_find(elf_hot_t *hot) {
+    elf32_hdr_t  ehdr;
+    elf32_shdr_t shstrtab;
+    elf32_shdr_t shdr;
+    char         name[sizeof(ELF_HOT_SECTION)];
+
+    if (!compressed_file_pread(hot->file, 0, &ehdr, sizeof(ehdr)) || ehdr.shentsize != sizeof(elf32_shdr_t)) {
+        return false;
+    }
+    hot->shoff = ehdr.shoff;
+    hot->shnum = ehdr.shnum;
+    if (!elf_hot_shdr_read(hot, ehdr.shstrndx, &shstrtab)) {
+        return false;
+    }
+
+    for (uint32_t i = 1; i < hot->shnum; ++i) {
+        if (!elf_hot_shdr_read(hot, i, &shdr)) {
+            return false;
+        }
+        if (shdr.type != SHT_PROGBITS || !(shdr.flags & SHF_EXECINSTR) || !shdr.size ||
+            shdr.name + sizeof(name) > shstrtab.size) {
+            continue;
+        }
+        if (compressed_file_pread(hot->file, shstrtab.offset + shdr.name, name, sizeof(name)) &&
+            !memcmp(name, ELF_HOT_SECTION, sizeof(name))) {
+            hot->index = i;
+            hot->text  = shdr;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The relocations of the hot section and the symbols they refer to
+static bool elf_hot_relocations_find(elf_hot_t *hot) {
+    for (uint32_t i = 1; i < hot->shnum; ++i) {
+        if (!elf_hot_shdr_read(hot, i, &hot->rela)) {
+            return false;
+        }
+        if (hot->rela.type == SHT_RELA && hot->rela.info == hot->index) {
+            return elf_hot_shdr_read(hot, hot->rela.link, &hot->symtab) && hot->symtab.type == SHT_SYMTAB;
+        }
+    }
+    return false;
+}
+
+static bool elf_hot_sym_read(elf_hot_t *hot, uint32_t index, elf32_sym_t *sym) {
+    return (index + 1) * sizeof(elf32_sym_t) <= hot->symtab.size &&
+           compressed_file_pread(hot->file, hot->symtab.offset + index * sizeof(elf32_sym_t), sym, sizeof(elf32_sym_t));
+}
+
+static bool elf_hot_contains(elf_hot_t const *hot, uint32_t vaddr, uint32_t size) {
+    return vaddr - hot->text.addr < hot->text.size && hot->text.addr + hot->text.size - vaddr >= size;
+}
+
+// Where what is at vaddr in the file runs from
+static uintptr_t elf_hot_map(elf_hot_t const *hot, uint32_t vaddr) {
+    if (elf_hot_contains(hot, vaddr, 1)) {
+        return (uintptr_t)hot->copy + vaddr - hot->text.addr;
+    }
+    return hot->bias + vaddr;
+}
+
+// Point an auipc and the instruction that adds the low 12 bits to it, in the
+// copy, at what they pointed at before. Read from the image, which still has
+// them as relocation left them.
+static bool elf_hot_pair_patch(elf_hot_t *hot, uint32_t hi_vaddr, uint32_t lo_vaddr, bool store) {
+    if (!elf_hot_contains(hot, hi_vaddr, 4) || !elf_hot_contains(hot, lo_vaddr, 4)) {
+        return false;
+    }
+
+    uint32_t hi = insn_read(hot->bias + hi_vaddr);
+    uint32_t lo = insn_read(hot->bias + lo_vaddr);
+    if ((hi & OPCODE_MASK) != OPCODE_AUIPC) {
+        return false;
+    }
+
+    uint32_t target = hi_vaddr + (hi & 0xFFFFF000) + (store ? s_imm(lo) : i_imm(lo));
+    uint32_t delta  = elf_hot_map(hot, target) - elf_hot_map(hot, hi_vaddr);
+    uint32_t new_hi = (delta + 0x800) & 0xFFFFF000;
+    int32_t  new_lo = (int32_t)(delta - new_hi);
+
+    insn_write(elf_hot_map(hot, hi_vaddr), (hi & 0xFFF) | new_hi);
+    insn_write(elf_hot_map(hot, lo_vaddr), store ? s_imm_set(lo, new_lo) : i_imm_set(lo, new_lo));
+    return true;
+}
+
+static bool elf_hot_relocate_one(elf_hot_t *hot, elf32_rela_t const *rela) {
+    elf32_sym_t sym;
+    uint32_t    type = ELF_R_TYPE(rela->info);
+
+    switch (type) {
+        case R_RISCV_NONE:
+        case R_RISCV_ALIGN:
+        case R_RISCV_RELAX:
+        // Patched with the instruction whose R_RISCV_PCREL_LO12_* points at them
+        case R_RISCV_GOT_HI20:
+        case R_RISCV_PCREL_HI20: return true;
+        case R_RISCV_CALL:
+        case R_RISCV_CALL_PLT: return elf_hot_pair_patch(hot, rela->offset, rela->offset + 4, false);
+        case R_RISCV_PCREL_LO12_I:
+        case R_RISCV_PCREL_LO12_S:
+            // The symbol is the auipc
+            return elf_hot_sym_read(hot, ELF_R_SYM(rela->info), &sym) &&
+                   elf_hot_pair_patch(hot, sym.value + rela->addend, rela->offset, type == R_RISCV_PCREL_LO12_S);
+        case R_RISCV_BRANCH:
+        case R_RISCV_JAL:
+        case R_RISCV_RVC_BRANCH:
+        case R_RISCV_RVC_JUMP:
+            // Can't reach from internal SRAM to PSRAM, only fine if they stay inside
+            return elf_hot_sym_read(hot, ELF_R_SYM(rela->info), &sym) &&
+                   elf_hot_contains(hot, sym.value + rela->addend, 2);
+        default: return false;
+    }
+}
+
+static bool elf_hot_relocate(elf_hot_t *hot) {
+    elf32_rela_t rela[ELF_HOT_BATCH];
+    size_t       count = hot->rela.size / sizeof(elf32_rela_t);
+
+    for (size_t i = 0; i < count; i += ELF_HOT_BATCH) {
+        size_t n = MIN(ELF_HOT_BATCH, count - i);
+        if (!compressed_file_pread(hot->file, hot->rela.offset + i * sizeof(elf32_rela_t), rela, n * sizeof(rela[0]))) {
+            return false;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            if (!elf_hot_relocate_one(hot, &rela[j])) {
+                ESP_LOGW(
+                    TAG,
+                    "Unable to move relocation type %u at 0x%08lx",
+                    (unsigned)ELF_R_TYPE(rela[j].info),
+                    (unsigned long)rela[j].offset
+                );
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Start each function in the image with a jump to its copy, it is all that
+// ever runs of the original. Functions smaller than the jump stay where they are.
+static int elf_hot_redirect(elf_hot_t *hot) {
+    elf32_sym_t sym[ELF_HOT_BATCH];
+    size_t      count     = hot->symtab.size / sizeof(elf32_sym_t);
+    int         functions = 0;
+
+    for (size_t i = 0; i < count; i += ELF_HOT_BATCH) {
+        size_t n = MIN(ELF_HOT_BATCH, count - i);
+        if (!compressed_file_pread(hot->file, hot->symtab.offset + i * sizeof(elf32_sym_t), sym, n * sizeof(sym[0]))) {
+            break;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            if (ELF_ST_TYPE(sym[j].info) != STT_FUNC || sym[j].shndx != hot->index || sym[j].size < 8 ||
+                !elf_hot_contains(hot, sym[j].value, 8)) {
+                continue;
+            }
+
+            // auipc t1, hi; jalr zero, lo(t1)
+            uintptr_t entry = hot->bias + sym[j].value;
+            uint32_t  delta = elf_hot_map(hot, sym[j].value) - entry;
+            uint32_t  hi    = (delta + 0x800) & 0xFFFFF000;
+            insn_write(entry, hi | (REG_T1 << 7) | OPCODE_AUIPC);
+            insn_write(entry + 4, i_imm_set((REG_T1 << 15) | OPCODE_JALR, (int32_t)(delta - hi)));
+            ++functions;
+        }
+    }
+    return functions;
+}
+
+bool elf_hot_present(compressed_file_t *file) {
+    elf_hot_t hot = {.file = file};
+    return elf_hot_find(&hot);
+}
+
+void elf_hot_load(compressed_file_t *file, uintptr_t bias) {
+    elf_hot_t hot = {.file = file, .bias = bias};
+    if (!elf_hot_find(&hot)) {
+        return;
+    }
+
+    if (!elf_hot_relocations_find(&hot)) {
+        ESP_LOGW(TAG, "No relocations for " ELF_HOT_SECTION ", link with --emit-relocs, hot code stays in PSRAM");
+        return;
+    }
+
+    // Internal SRAM is executable as a whole, nothing to map
+    hot.copy = malloc_fast(hot.text.size);
+    if (!hot.copy) {
+        ESP_LOGW(TAG, "No fast memory for %lu bytes of hot code, it stays in PSRAM", (unsigned long)hot.text.size);
+        return;
+    }
+    memcpy(hot.copy, (void const *)(bias + hot.text.addr), hot.text.size);
+
+    if (!elf_hot_relocate(&hot)) {
+        ESP_LOGW(TAG, "Hot code stays in PSRAM");
+        free_fast(hot.copy);
+        return;
+    }
+
+    // The copy is complete, each function that gets redirected from here on runs from it
+    int functions = elf_hot_redirect(&hot);
+
+    cache_hal_writeback_addr((uint32_t)hot.copy, hot.text.size);
+    cache_hal_invalidate_addr((uint32_t)hot.copy, hot.text.size);
+    cache_hal_writeback_addr(bias + hot.text.addr, hot.text.size);
+    cache_hal_invalidate_addr(bias + hot.text.addr, hot.text.size);
+
+    task_thread_t *thread = get_task_info()->thread;
+    thread->hot_start     = (uintptr_t)hot.copy;
+    thread->hot_end       = (uintptr_t)hot.copy + hot.text.size;
+    thread->hot_bias      = (uintptr_t)hot.copy - hot.text.addr;
+
+    ESP_LOGI(TAG, "%d functions in %lu bytes of hot code at %p", functions, (unsigned long)hot.text.size, hot.copy);
+}
@@ -0,0 +1,38 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "compressed_file.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Functions an application marks with APP_IRAM, see badgevms/misc_funcs.h, end
+// up in a section of their own. After relocation the loader copies it to
+// internal SRAM from the process' malloc_fast() quota and puts a jump to the
+// copy at the start of each function, so calls from anywhere else, function
+// pointers included, get there too. Patching the copy needs the static
+// relocations of the section, the application is linked with --emit-relocs.
+#define ELF_HOT_SECTION ".app_iram"
+
+// Whether the file has hot code. Its image differs per process then, so it is
+// neither cached nor prelinked. Only uses the stack.
+bool elf_hot_present(compressed_file_t *file);
+// Copy the hot code of the image relocated with bias to internal SRAM. If that
+// isn't possible it runs from where it is, it is only slower there.
+void elf_hot_load(compressed_file_t *file, uintptr_t bias);
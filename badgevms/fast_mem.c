@@ -0,0 +1,147 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fast_mem.h"
+
+#include "badgevms_config.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "soc/soc_caps.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// One line of the L1 data cache, the loops below move a whole line per pass
+#define FAST_MEM_LINE 64
+
+#if SOC_CPU_HAS_PIE
+
+// The PIE is a coprocessor FreeRTOS saves lazily on first use in a task, which
+// it can't do for an interrupt or before the scheduler runs.
+__attribute__((always_inline)) static inline bool pie_usable(size_t n) {
+    return n >= FAST_MEM_MIN_SIZE && !xPortInIsrContext() && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING;
+}
+
+// Bytes to copy before dst is at the start of a cache line
+__attribute__((always_inline)) static inline size_t line_head(void const *dst) {
+    return -(uintptr_t)dst & (FAST_MEM_LINE - 1);
+}
+
+// q3 is left alone, the port doesn't save it when switching tasks
+static void pie_copy_lines(uint8_t *dst, uint8_t const *src, size_t n) {
+    if (!n) {
+        return;
+    }
+
+    uint8_t *end = dst + n;
+    asm volatile("1:\n"
+                 "esp.vld.128.ip q0, %[src], 16\n"
+                 "esp.vld.128.ip q1, %[src], 16\n"
+                 "esp.vld.128.ip q2, %[src], 16\n"
+                 "esp.vld.128.ip q4, %[src], 16\n"
+                 "esp.vst.128.ip q0, %[dst], 16\n"
+                 "esp.vst.128.ip q1, %[dst], 16\n"
+                 "esp.vst.128.ip q2, %[dst], 16\n"
+                 "esp.vst.128.ip q4, %[dst], 16\n"
+                 "bltu %[dst], %[end], 1b\n"
+                 : [dst] "+r"(dst), [src] "+r"(src)
+                 : [end] "r"(end)
+                 : "memory");
+}
+
+static void pie_set_lines(uint8_t *dst, uint8_t c, size_t n) {
+    if (!n) {
+        return;
+    }
+
+    uint8_t *end = dst + n;
+    asm volatile("esp.vldbc.8.ip q0, %[c], 0\n"
+                 "1:\n"
+                 "esp.vst.128.ip q0, %[dst], 16\n"
+                 "esp.vst.128.ip q0, %[dst], 16\n"
+                 "esp.vst.128.ip q0, %[dst], 16\n"
+                 "esp.vst.128.ip q0, %[dst], 16\n"
+                 "bltu %[dst], %[end], 1b\n"
+                 : [dst] "+r"(dst)
+                 : [c] "r"(&c), [end] "r"(end)
+                 : "memory");
+}
+
+void *why_memcpy(void *restrict dst, void const *restrict src, size_t n) {
+    // The PIE only loads and stores 16 byte aligned, so both have to line up
+    if (!pie_usable(n) || (((uintptr_t)dst ^ (uintptr_t)src) & 15)) {
+        return memcpy(dst, src, n);
+    }
+
+    uint8_t       *d    = dst;
+    uint8_t const *s    = src;
+    size_t         head = line_head(d);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t lines = n & ~(FAST_MEM_LINE - 1);
+    pie_copy_lines(d, s, lines);
+    memcpy(d + lines, s + lines, n - lines);
+    return dst;
+}
+
+void *why_memset(void *dst, int c, size_t n) {
+    if (!pie_usable(n)) {
+        return memset(dst, c, n);
+    }
+
+    uint8_t *d    = dst;
+    size_t   head = line_head(d);
+    memset(d, c, head);
+    d += head;
+    n -= head;
+
+    size_t lines = n & ~(FAST_MEM_LINE - 1);
+    pie_set_lines(d, c, lines);
+    memset(d + lines, c, n - lines);
+    return dst;
+}
+
+void *why_memmove(void *dst, void const *src, size_t n) {
+    // Every pass loads a line before storing it, so copying forward is safe
+    // when dst is below src
+    if ((uintptr_t)dst <= (uintptr_t)src || (uintptr_t)dst >= (uintptr_t)src + n) {
+        if (pie_usable(n) && !(((uintptr_t)dst ^ (uintptr_t)src) & 15) &&
+            (uintptr_t)src - (uintptr_t)dst >= FAST_MEM_LINE) {
+            return why_memcpy(dst, src, n);
+        }
+    }
+    return memmove(dst, src, n);
+}
+
+#else
+
+void *why_memcpy(void *restrict dst, void const *restrict src, size_t n) {
+    return memcpy(dst, src, n);
+}
+
+void *why_memset(void *dst, int c, size_t n) {
+    return memset(dst, c, n);
+}
+
+void *why_memmove(void *dst, void const *src, size_t n) {
+    return memmove(dst, src, n);
+}
+
+#endif
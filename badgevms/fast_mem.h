@@ -0,0 +1,27 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// memcpy(), memset() and memmove() that move large blocks through the PIE's
+// 128 bit registers a cache line at a time. Small or oddly aligned blocks, and
+// calls from interrupts or before the scheduler runs, use the libc versions.
+// Applications get these as memcpy(), memset() and memmove().
+void *why_memcpy(void *restrict dst, void const *restrict src, size_t n);
+void *why_memset(void *dst, int c, size_t n);
+void *why_memmove(void *dst, void const *src, size_t n);
@@ -0,0 +1,275 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_map.h"
+
+#include "badgevms/misc_funcs.h"
+#include "esp_log.h"
+#include "fast_mem.h"
+#include "freertos/FreeRTOS.h"
+#include "memory.h"
+#include "slab.h"
+#include "why_io.h"
+
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#define TAG "file_map"
+
+// Read at most this much at a time, so others get a turn on the file system
+#define FILE_MAP_READ_SIZE (64 * 1024)
+
+typedef struct file_map_user file_map_user_t;
+
+typedef struct mapped_file {
+    char               *path;
+    off_t               size;
+    time_t              mtime;
+    uintptr_t           vaddr_start;
+    size_t              num_pages; // With a guard page behind it, like a framebuffer
+    allocation_range_t *head_pages;
+    allocation_range_t *tail_pages;
+    file_map_user_t    *users;
+    struct mapped_file *next;
+} mapped_file_t;
+
+// A process that has the file mapped count times
+struct file_map_user {
+    task_thread_t   *thread;
+    int              count;
+    file_map_user_t *next;
+};
+
+static slab_cache_t mapped_file_cache =
+    SLAB_CACHE_INIT("mapped_file", sizeof(mapped_file_t), 8, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+static slab_cache_t file_map_user_cache =
+    SLAB_CACHE_INIT("file_map_user", sizeof(file_map_user_t), 16, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+static portMUX_TYPE   mapped_files_lock = portMUX_INITIALIZER_UNLOCKED;
+static mapped_file_t *mapped_files;
+
+static void mapped_file_free(mapped_file_t *file) {
+    if (file->head_pages) {
+        framebuffer_unmap_pages(file->head_pages);
+        pages_deallocate(file->head_pages);
+    }
+    framebuffer_vaddr_deallocate(file->vaddr_start, file->num_pages);
+    free(file->path);
+    slab_free(&mapped_file_cache, file);
+}
+
+static mapped_file_t *mapped_file_find_locked(char const *path, struct stat const *st) {
+    for (mapped_file_t *file = mapped_files; file; file = file->next) {
+        if (file->size == st->st_size && file->mtime == st->st_mtime && !strcmp(file->path, path)) {
+            return file;
+        }
+    }
+    return NULL;
+}
+
+// Count another mapping by thread, taking *user if it is the first one.
+// Returns whether it was.
+static bool mapped_file_use_locked(mapped_file_t *file, task_thread_t *thread, file_map_user_t **user) {
+    for (file_map_user_t *u = file->users; u; u = u->next) {
+        if (u->thread == thread) {
+            ++u->count;
+            return false;
+        }
+    }
+
+    (*user)->thread = thread;
+    (*user)->count  = 1;
+    (*user)->next   = file->users;
+    file->users     = *user;
+    *user           = NULL;
+    return true;
+}
+
+// Read the file open at fd into pages of its own
+static mapped_file_t *mapped_file_load(int fd, char const *path, struct stat const *st) {
+    mapped_file_t *file = slab_alloc(&mapped_file_cache);
+    if (!file) {
+        return NULL;
+    }
+
+    file->path        = strdup(path);
+    file->size        = st->st_size;
+    file->mtime       = st->st_mtime;
+    file->vaddr_start = framebuffer_vaddr_allocate(st->st_size + SOC_MMU_PAGE_SIZE, &file->num_pages);
+    if (!file->path || !file->vaddr_start) {
+        ESP_LOGE(TAG, "No room to map %s", path);
+        goto fail;
+    }
+
+    if (!pages_allocate(file->vaddr_start, file->num_pages - 1, &file->head_pages, &file->tail_pages)) {
+        ESP_LOGE(TAG, "No physical memory pages to map %s", path);
+        goto fail;
+    }
+    framebuffer_map_pages(file->head_pages, file->tail_pages);
+
+    uint8_t *dst  = (uint8_t *)file->vaddr_start;
+    size_t   left = st->st_size;
+    while (left) {
+        ssize_t bytes = why_read(fd, dst, MIN(left, FILE_MAP_READ_SIZE));
+        if (bytes <= 0) {
+            ESP_LOGE(TAG, "Unable to read %s", path);
+            goto fail;
+        }
+        dst  += bytes;
+        left -= bytes;
+    }
+
+    // Pages that didn't come from the page zeroer may hold someone else's data
+    why_memset(dst, 0, (file->num_pages - 1) * SOC_MMU_PAGE_SIZE - st->st_size);
+    return file;
+
+fail:
+    mapped_file_free(file);
+    return NULL;
+}
+
+// Drop one or all mappings thread has of the file at ptr. Returns the pages
+// that were freed, and whether thread no longer has it mapped in unmapped.
+static size_t mapped_file_drop(task_thread_t *thread, void const *ptr, bool all, bool *unmapped) {
+    mapped_file_t   *file = NULL;
+    file_map_user_t *user = NULL;
+
+    *unmapped = false;
+
+    portENTER_CRITICAL(&mapped_files_lock);
+    for (mapped_file_t **f = &mapped_files; *f; f = &(*f)->next) {
+        if ((*f)->vaddr_start != (uintptr_t)ptr) {
+            continue;
+        }
+
+        for (file_map_user_t **u = &(*f)->users; *u; u = &(*u)->next) {
+            if ((*u)->thread == thread) {
+                if (all || !--(*u)->count) {
+                    user = *u;
+                    *u   = user->next;
+                }
+                *unmapped = user != NULL;
+                break;
+            }
+        }
+
+        if (!(*f)->users) {
+            file = *f;
+            *f   = file->next;
+        }
+        break;
+    }
+    portEXIT_CRITICAL(&mapped_files_lock);
+
+    if (user) {
+        slab_free(&file_map_user_cache, user);
+    }
+    if (!file) {
+        return 0;
+    }
+
+    size_t pages = file->num_pages - 1;
+    mapped_file_free(file);
+    return pages;
+}
+
+void const *file_map(char const *path, size_t *size) {
+    task_info_t *task_info = get_task_info();
+
+    int fd = why_open(path, O_RDONLY, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (why_fstat(fd, &st) != 0 || st.st_size <= 0) {
+        why_close(fd);
+        return NULL;
+    }
+
+    file_map_user_t *user = slab_alloc(&file_map_user_cache);
+    if (!user) {
+        why_close(fd);
+        return NULL;
+    }
+
+    bool first = false;
+    portENTER_CRITICAL(&mapped_files_lock);
+    mapped_file_t *file = mapped_file_find_locked(path, &st);
+    if (file) {
+        first = mapped_file_use_locked(file, task_info->thread, &user);
+    }
+    portEXIT_CRITICAL(&mapped_files_lock);
+
+    if (!file) {
+        mapped_file_t *loaded = mapped_file_load(fd, path, &st);
+        if (!loaded) {
+            slab_free(&file_map_user_cache, user);
+            why_close(fd);
+            return NULL;
+        }
+
+        // Someone else may have loaded it meanwhile
+        portENTER_CRITICAL(&mapped_files_lock);
+        file = mapped_file_find_locked(path, &st);
+        if (!file) {
+            file         = loaded;
+            file->next   = mapped_files;
+            mapped_files = file;
+            loaded       = NULL;
+        }
+        first = mapped_file_use_locked(file, task_info->thread, &user);
+        portEXIT_CRITICAL(&mapped_files_lock);
+
+        if (loaded) {
+            mapped_file_free(loaded);
+        }
+    }
+
+    why_close(fd);
+    if (user) {
+        slab_free(&file_map_user_cache, user);
+    }
+    if (first) {
+        task_record_resource_alloc(RES_FILE_MAP, (void *)file->vaddr_start);
+    }
+
+    if (size) {
+        *size = st.st_size;
+    }
+    return (void const *)file->vaddr_start;
+}
+
+void file_unmap(void const *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    bool unmapped;
+    mapped_file_drop(get_task_info()->thread, ptr, false, &unmapped);
+    if (unmapped) {
+        task_record_resource_free(RES_FILE_MAP, (void *)ptr);
+    }
+}
+
+size_t file_map_release(task_thread_t *thread, void const *ptr) {
+    bool unmapped;
+    return mapped_file_drop(thread, ptr, true, &unmapped);
+}
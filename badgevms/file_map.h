@@ -0,0 +1,27 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "task.h"
+
+// Files mapped with file_map(). A file is read into pages in the framebuffer
+// vaddr space once, every process that maps it while it is unchanged gets the
+// same pages. They are freed when the last process unmaps it.
+
+// Drop every mapping thread has of ptr, for a process that exits. Returns the
+// pages that were freed, 0 if others still have the file mapped.
+size_t file_map_release(task_thread_t *thread, void const *ptr);
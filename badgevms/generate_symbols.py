@@ -29,6 +29,7 @@ TEMPLATE = """
 struct esp_elfsym {{
     const char  *name;
     const void  *sym;
+    uint32_t     hash;
 }};
 
 #pragma GCC diagnostic push
@@ -42,33 +43,69 @@ struct esp_elfsym why2025_elfsyms[] = {{
 
 #define NUM_SYMBOLS {num_symbols}
 
-int symbol_compare(const void *a, const void *b) {{
-    const struct esp_elfsym *sym_a = (const struct esp_elfsym *)a;
-    const struct esp_elfsym *sym_b = (const struct esp_elfsym *)b;
-    return strcmp(sym_a->name, sym_b->name);
+// Open addressing over the hashes, most symbols are found in the first slot
+#define SYMBOL_TABLE_MASK  {table_mask}
+#define SYMBOL_TABLE_EMPTY 0xFFFF
+
+static const uint16_t symbol_table[SYMBOL_TABLE_MASK + 1] = {{
+{table}
+}};
+
+// FNV-1a, generate_symbols.py computes the same
+static inline uint32_t symbol_hash(const char *name) {{
+    uint32_t hash = 2166136261u;
+    while (*name) {{
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }}
+    return hash;
 }}
 
 __attribute__((used))
 uintptr_t elf_find_sym(const char *sym_name) {{
-    struct esp_elfsym key = {{ .name = sym_name }};
-    const struct esp_elfsym *res;
-
-    res = (const struct esp_elfsym *)bsearch(
-        &key,
-        why2025_elfsyms,
-        NUM_SYMBOLS,
-        sizeof(struct esp_elfsym),
-        symbol_compare
-    );
-
-    if (res) {{
-        return (uintptr_t)res->sym;
+    uint32_t hash = symbol_hash(sym_name);
+
+    for (uint32_t i = hash & SYMBOL_TABLE_MASK;; i = (i + 1) & SYMBOL_TABLE_MASK) {{
+        uint16_t index = symbol_table[i];
+        if (index == SYMBOL_TABLE_EMPTY) {{
+            return (uintptr_t)NULL;
+        }}
+        if (why2025_elfsyms[index].hash == hash && !strcmp(why2025_elfsyms[index].name, sym_name)) {{
+            return (uintptr_t)why2025_elfsyms[index].sym;
+        }}
     }}
-
-    return (uintptr_t)NULL;
 }}
 """
 
+def symbol_hash(name):
+    hash = 2166136261
+    for c in name.encode():
+        hash = ((hash ^ c) * 16777619) & 0xFFFFFFFF
+    return hash
+
+# At most half full, so a lookup that misses ends soon too
+def symbol_table(names):
+    size = 1
+    while size < 2 * len(names):
+        size *= 2
+
+    if len(names) >= 0xFFFF:
+        print("Too many symbols for the symbol table")
+        exit(1)
+
+    table = [0xFFFF] * size
+    longest = 0
+    for index, name in enumerate(names):
+        slot = symbol_hash(name) & (size - 1)
+        probes = 1
+        while table[slot] != 0xFFFF:
+            slot = (slot + 1) & (size - 1)
+            probes += 1
+        table[slot] = index
+        longest = max(longest, probes)
+
+    print(f"Symbol table of {size} slots, longest probe {longest}")
+    return size - 1, table
+
 symbols = []
 seen_symbols = []
 def add_sym(sym, wrap):
@@ -77,11 +114,7 @@ def add_sym(sym, wrap):
         exit(1)
 
     seen_symbols.append(sym)
-
-    if wrap:
-        symbols.append(f'{{"{sym}", &why_{sym}}}')
-    else:
-        symbols.append(f'{{"{sym}", &{sym}}}')
+    symbols.append((sym, f"why_{sym}" if wrap else sym))
 
 if __name__ == '__main__':
     if len(sys.argv) != 3:
@@ -134,12 +167,15 @@ if __name__ == '__main__':
             add_sym(sym, True)
 
     symbols.sort()
+    table_mask, table = symbol_table([name for name, _ in symbols])
     with open(sys.argv[2], 'w') as file:
         file.write(TEMPLATE.format(
             num_symbols = num_symbols,
             includes = "\n".join(include),
             definitions = "\n".join(symbol_definitions),
-            symbols = ",\n".join(symbols))
+            symbols = ",\n".join(f'{{"{name}", &{target}, 0x{symbol_hash(name):08x}u}}' for name, target in symbols),
+            table_mask = f"0x{table_mask:x}",
+            table = ",\n".join(", ".join(str(i) for i in table[row:row + 16]) for row in range(0, len(table), 16)))
         )
 
     print(f"Generated list of {len(seen_symbols)} symbols")
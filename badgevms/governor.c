@@ -0,0 +1,166 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "governor.h"
+
+#include "badgevms/application.h"
+#include "badgevms_config.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_freertos_hooks.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "task.h"
+
+#include <stdatomic.h>
+
+#define TAG "governor"
+
+#if CONFIG_BADGEVMS_GOVERNOR
+
+// What the tick hook found each core doing since the last sample
+typedef struct {
+    atomic_uint  ticks;
+    atomic_uint  busy;
+    TaskHandle_t idle;
+} governor_core_t;
+
+static DRAM_ATTR governor_core_t cores[portNUM_PROCESSORS];
+static esp_pm_lock_handle_t      busy_lock;
+static esp_pm_lock_handle_t      performance_lock;
+static esp_timer_handle_t        sample_timer;
+static atomic_bool               busy_held;
+static atomic_uint               last_boost_ms;
+
+static void IRAM_ATTR governor_tick(void) {
+    governor_core_t *core = &cores[esp_cpu_get_core_id()];
+    atomic_fetch_add(&core->ticks, 1);
+
+    if (xTaskGetCurrentTaskHandle() == core->idle) {
+        return;
+    }
+    task_info_t *task_info = get_task_info_tcb();
+    if (task_info->pid && task_info->thread && task_info->thread->cpu_class == APPLICATION_CPU_BATCH) {
+        return;
+    }
+    atomic_fetch_add(&core->busy, 1);
+}
+
+// A core that was busy for most of the last sample has more work than the
+// low clock gets done. The busy lock goes once nothing boosted for a while.
+static void governor_sample(void *arg) {
+    for (int i = 0; i < portNUM_PROCESSORS; ++i) {
+        unsigned ticks = atomic_exchange(&cores[i].ticks, 0);
+        unsigned busy  = atomic_exchange(&cores[i].busy, 0);
+        if (ticks && busy * 100 >= ticks * GOVERNOR_BUSY_PERCENT) {
+            governor_boost();
+        }
+    }
+
+    uint32_t now = esp_timer_get_time() / 1000;
+    if (now - atomic_load(&last_boost_ms) < GOVERNOR_IDLE_MS) {
+        return;
+    }
+    // A boost coming in right now may find the lock still held and be lost,
+    // the next one, at the latest a frame later, takes it again
+    if (atomic_exchange(&busy_held, false)) {
+        esp_pm_lock_release(busy_lock);
+    }
+}
+
+void governor_boost() {
+    if (!busy_lock) {
+        return;
+    }
+
+    atomic_store(&last_boost_ms, esp_timer_get_time() / 1000);
+    if (!atomic_exchange(&busy_held, true)) {
+        esp_pm_lock_acquire(busy_lock);
+    }
+}
+
+void governor_performance_set(bool performance) {
+    if (!performance_lock) {
+        return;
+    }
+
+    if (performance) {
+        esp_pm_lock_acquire(performance_lock);
+    } else {
+        esp_pm_lock_release(performance_lock);
+    }
+}
+
+bool governor_init() {
+    // Held from the start, until the boot settled
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "busy", &busy_lock) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "performance", &performance_lock) != ESP_OK) {
+        ESP_LOGW(TAG, "Power management is not available, the CPU stays at full speed");
+        busy_lock        = NULL;
+        performance_lock = NULL;
+        return false;
+    }
+    governor_boost();
+
+    esp_pm_config_t config = {
+        .max_freq_mhz       = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz       = GOVERNOR_MIN_FREQ_MHZ,
+        .light_sleep_enable = false,
+    };
+    if (esp_pm_configure(&config) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to scale between %d and %d MHz", GOVERNOR_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+        return false;
+    }
+
+    for (int i = 0; i < portNUM_PROCESSORS; ++i) {
+        cores[i].idle = xTaskGetIdleTaskHandleForCore(i);
+        if (esp_register_freertos_tick_hook_for_cpu(governor_tick, i) != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to register the tick hook on core %d", i);
+            return false;
+        }
+    }
+
+    esp_timer_create_args_t args = {
+        .callback        = governor_sample,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name            = "governor",
+    };
+    if (esp_timer_create(&args, &sample_timer) != ESP_OK ||
+        esp_timer_start_periodic(sample_timer, GOVERNOR_SAMPLE_MS * 1000) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start the sample timer");
+        return false;
+    }
+    return true;
+}
+
+#else
+
+// The CPU stays at full speed
+bool governor_init() {
+    return false;
+}
+
+void governor_boost() {
+}
+
+void governor_performance_set(bool performance) {
+}
+
+#endif
@@ -0,0 +1,36 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+
+// CPU frequency scaling with ESP-IDF power management. The CPU runs at
+// GOVERNOR_MIN_FREQ_MHZ unless one of two PM locks holds it at full speed:
+// - performance, while an interactive application is full screen in front
+// - busy, from the first sign of work until GOVERNOR_IDLE_MS after the last
+// Work is the compositor putting up frames, a key press, a process starting
+// or a core that is rarely idle. Time spent in batch applications doesn't
+// count, they get what the CPU has at its low clock. Off unless
+// CONFIG_BADGEVMS_GOVERNOR, the CPU then stays at full speed.
+
+// Allowed to fail, the CPU then stays at full speed
+bool governor_init();
+// Something needs the CPU right now, from any task
+void governor_boost();
+// By the compositor, whether the application in front gets the full clock
+void governor_performance_set(bool performance);
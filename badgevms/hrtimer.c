@@ -0,0 +1,301 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hrtimer_private.h"
+
+#include "badgevms_config.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "task.h"
+#include "wait_private.h"
+
+#include <stdatomic.h>
+
+#define TAG "hrtimer"
+
+// Timers are slots that are never freed, a callback that races with
+// hrtimer_destroy() only counts if the slot still has the generation it was
+// created with.
+struct hrtimer {
+    esp_timer_handle_t handle;
+    task_thread_t     *thread;      // Owning process, NULL if the slot is free
+    TaskHandle_t       waiter;      // In hrtimer_wait() or wait_any()
+    uint32_t           expirations; // Since the last wait
+    uint16_t           generation;
+    bool               sleep;       // A sleep timer of task_info, not for the application
+    task_resource_t    resource;
+};
+
+static hrtimer_t    hrtimers[MAX_HRTIMERS];
+static portMUX_TYPE hrtimer_lock = portMUX_INITIALIZER_UNLOCKED;
+// Callbacks between taking the waiter and notifying it, see hrtimer_task_died()
+static atomic_int   hrtimer_notifying;
+
+// Runs in the esp_timer task
+static void hrtimer_callback(void *arg) {
+    hrtimer_t   *timer      = &hrtimers[(uintptr_t)arg & 0xffff];
+    uint16_t     generation = (uintptr_t)arg >> 16;
+    TaskHandle_t waiter     = NULL;
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    if (timer->thread && timer->generation == generation) {
+        ++timer->expirations;
+        waiter = timer->waiter;
+        if (waiter) {
+            atomic_fetch_add(&hrtimer_notifying, 1);
+        }
+    }
+    portEXIT_CRITICAL(&hrtimer_lock);
+
+    if (waiter) {
+        wait_notify(waiter);
+        atomic_fetch_sub(&hrtimer_notifying, 1);
+    }
+}
+
+static hrtimer_t *hrtimer_alloc(task_thread_t *thread, bool sleep) {
+    hrtimer_t *timer = NULL;
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    for (int i = 0; i < MAX_HRTIMERS; ++i) {
+        if (!hrtimers[i].thread) {
+            timer              = &hrtimers[i];
+            timer->thread      = thread;
+            timer->waiter      = NULL;
+            timer->expirations = 0;
+            timer->sleep       = sleep;
+            ++timer->generation;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&hrtimer_lock);
+
+    if (!timer) {
+        ESP_LOGW(TAG, "Out of timers");
+        return NULL;
+    }
+
+    esp_timer_create_args_t args = {
+        .callback        = hrtimer_callback,
+        .arg             = (void *)(((uintptr_t)timer->generation << 16) | (timer - hrtimers)),
+        .dispatch_method = ESP_TIMER_TASK,
+        .name            = "hrtimer",
+    };
+
+    if (esp_timer_create(&args, &timer->handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to create esp_timer");
+        portENTER_CRITICAL(&hrtimer_lock);
+        timer->thread = NULL;
+        portEXIT_CRITICAL(&hrtimer_lock);
+        return NULL;
+    }
+
+    return timer;
+}
+
+static void hrtimer_free(hrtimer_t *timer) {
+    esp_timer_stop(timer->handle);
+    esp_timer_delete(timer->handle);
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    timer->handle = NULL;
+    timer->thread = NULL;
+    timer->waiter = NULL;
+    portEXIT_CRITICAL(&hrtimer_lock);
+}
+
+// timer if it is a timer of the calling process
+static hrtimer_t *hrtimer_get(hrtimer_t *timer) {
+    uintptr_t offset = (uintptr_t)timer - (uintptr_t)hrtimers;
+    if (offset >= sizeof(hrtimers) || offset % sizeof(hrtimer_t)) {
+        return NULL;
+    }
+
+    if (timer->thread != get_task_info()->thread || timer->sleep) {
+        return NULL;
+    }
+
+    return timer;
+}
+
+static bool hrtimer_start(hrtimer_t *timer, uint64_t us, bool periodic) {
+    esp_timer_stop(timer->handle);
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    timer->expirations = 0;
+    portEXIT_CRITICAL(&hrtimer_lock);
+
+    esp_err_t ret = periodic ? esp_timer_start_periodic(timer->handle, us) : esp_timer_start_once(timer->handle, us);
+    return ret == ESP_OK;
+}
+
+static uint32_t hrtimer_wait_timer(hrtimer_t *timer, uint32_t timeout_msec) {
+    TaskHandle_t self        = xTaskGetCurrentTaskHandle();
+    uint16_t     generation  = timer->generation;
+    uint32_t     expirations = 0;
+
+    TickType_t timeout = timeout_msec == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_msec);
+    TickType_t start   = xTaskGetTickCount();
+
+    while (1) {
+        portENTER_CRITICAL(&hrtimer_lock);
+        // Destroyed by another thread
+        bool gone = !timer->thread || timer->generation != generation;
+        if (!gone) {
+            expirations        = timer->expirations;
+            timer->expirations = 0;
+            timer->waiter      = expirations ? NULL : self;
+        }
+        portEXIT_CRITICAL(&hrtimer_lock);
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (gone || expirations || (timeout != portMAX_DELAY && elapsed >= timeout)) {
+            break;
+        }
+
+        // A late wake up from an earlier wait can end this one early, hence the loop
+        ulTaskNotifyTakeIndexed(
+            TASK_NOTIFY_INDEX_WAIT,
+            pdTRUE,
+            timeout == portMAX_DELAY ? portMAX_DELAY : timeout - elapsed
+        );
+    }
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    if (timer->waiter == self) {
+        timer->waiter = NULL;
+    }
+    portEXIT_CRITICAL(&hrtimer_lock);
+
+    return expirations;
+}
+
+hrtimer_t *hrtimer_create(void) {
+    hrtimer_t *timer = hrtimer_alloc(get_task_info()->thread, false);
+    if (timer) {
+        task_resource_link(&timer->resource, RES_HRTIMER, timer);
+    }
+    return timer;
+}
+
+void hrtimer_destroy(hrtimer_t *timer) {
+    timer = hrtimer_get(timer);
+    if (!timer) {
+        return;
+    }
+
+    task_resource_unlink(&timer->resource);
+    hrtimer_free(timer);
+}
+
+void hrtimer_destroy_task(hrtimer_t *timer) {
+    if (timer) {
+        hrtimer_free(timer);
+    }
+}
+
+bool hrtimer_start_once(hrtimer_t *timer, uint64_t delay_us) {
+    timer = hrtimer_get(timer);
+    return timer && hrtimer_start(timer, delay_us, false);
+}
+
+bool hrtimer_start_periodic(hrtimer_t *timer, uint64_t period_us) {
+    timer = hrtimer_get(timer);
+    return timer && hrtimer_start(timer, period_us, true);
+}
+
+void hrtimer_stop(hrtimer_t *timer) {
+    timer = hrtimer_get(timer);
+    if (timer) {
+        esp_timer_stop(timer->handle);
+    }
+}
+
+uint32_t hrtimer_wait(hrtimer_t *timer, uint32_t timeout_msec) {
+    timer = hrtimer_get(timer);
+    return timer ? hrtimer_wait_timer(timer, timeout_msec) : 0;
+}
+
+int hrtimer_watch(hrtimer_t *timer, TaskHandle_t waiter) {
+    timer = hrtimer_get(timer);
+    if (!timer) {
+        return -1;
+    }
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    bool fired = timer->expirations;
+    if (!fired) {
+        timer->waiter = waiter;
+    }
+    portEXIT_CRITICAL(&hrtimer_lock);
+
+    return fired;
+}
+
+void hrtimer_unwatch(hrtimer_t *timer, TaskHandle_t waiter) {
+    timer = hrtimer_get(timer);
+    if (!timer) {
+        return;
+    }
+
+    portENTER_CRITICAL(&hrtimer_lock);
+    if (timer->waiter == waiter) {
+        timer->waiter = NULL;
+    }
+    portEXIT_CRITICAL(&hrtimer_lock);
+}
+
+void hrtimer_task_died(task_info_t *task_info) {
+    // wait_any() may wait on any number of them
+    portENTER_CRITICAL(&hrtimer_lock);
+    for (int i = 0; i < MAX_HRTIMERS; ++i) {
+        if (hrtimers[i].waiter == task_info->handle) {
+            hrtimers[i].waiter = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&hrtimer_lock);
+
+    // A callback may have taken the waiter just before. The esp_timer task runs
+    // on core 0 above anything that deletes tasks, so if we are on core 0 it is
+    // done already and otherwise it finishes soon.
+    while (atomic_load(&hrtimer_notifying)) {
+    }
+}
+
+void hrtimer_sleep_us(uint64_t us) {
+    task_info_t *task_info = get_task_info();
+
+    if (us < SLEEP_SPIN_US) {
+        esp_rom_delay_us(us);
+        return;
+    }
+
+    // Kernel tasks share kernel_task, so they get no sleep timer
+    if (task_info->pid && !task_info->sleep_timer) {
+        task_info->sleep_timer = hrtimer_alloc(task_info->thread, true);
+    }
+
+    if (!task_info->sleep_timer || !hrtimer_start(task_info->sleep_timer, us, false)) {
+        // Out of timers, round up to the tick
+        vTaskDelay((us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+        return;
+    }
+
+    hrtimer_wait_timer(task_info->sleep_timer, UINT32_MAX);
+}
@@ -0,0 +1,37 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/hrtimer.h"
+#include "task.h"
+
+#include <stdint.h>
+
+// Clean up after a process, from Hades
+void hrtimer_destroy_task(hrtimer_t *timer);
+
+// For wait_any(): 1 if timer fired since the last wait and otherwise 0, waiter
+// is then woken when it does. -1 if timer is not a timer of this process.
+int  hrtimer_watch(hrtimer_t *timer, TaskHandle_t waiter);
+void hrtimer_unwatch(hrtimer_t *timer, TaskHandle_t waiter);
+
+// From the pre-deletion hook, while the task can still be notified. A timer
+// it waits on must not wake it up anymore.
+void hrtimer_task_died(task_info_t *task_info);
+
+// Sleep for at least us, see SLEEP_SPIN_US
+void hrtimer_sleep_us(uint64_t us);
@@ -0,0 +1,337 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image_cache.h"
+
+#include "badgevms_config.h"
+#include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "fast_mem.h"
+#include "freertos/FreeRTOS.h"
+#include "slab.h"
+#include "task.h"
+#include "why_io.h"
+
+#include <fcntl.h>
+#include <string.h>
+
+#define TAG "image_cache"
+
+#define PRELINK_MAGIC 0x4b4e4c50 // "PLNK"
+
+typedef struct {
+    uint32_t  magic;
+    uint8_t   hash[IMAGE_HASH_SIZE];     // Of the ELF file
+    uint8_t   firmware[IMAGE_HASH_SIZE]; // Of the firmware, its symbols were linked against
+    uintptr_t base;
+    uint32_t  size;
+    uint32_t  shared_size;
+    uint32_t  data_end; // The file holds the image up to here, the rest is zero
+    uintptr_t entry;
+} prelink_header_t;
+
+struct image {
+    uint8_t             hash[IMAGE_HASH_SIZE];
+    uintptr_t           base;
+    size_t              size;         // Mapped from base on
+    size_t              shared_size;  // Mapped from shared_pages, the rest is private
+    allocation_range_t *shared_pages; // Owned by the cache
+    void               *data;         // The writable part as it was after relocation
+    size_t              data_size;
+    void               *entry;
+    int                 refcount;     // Processes that have the image mapped
+    bool                pinned;       // Only dropped when memory runs low
+    uint32_t            last_used;
+    image_t            *next;
+};
+
+static slab_cache_t image_cache = SLAB_CACHE_INIT("image", sizeof(image_t), 8, MALLOC_CAP_SPIRAM);
+
+static portMUX_TYPE images_lock = portMUX_INITIALIZER_UNLOCKED;
+static image_t     *image_list;
+static size_t       num_images;
+static size_t       cached_pages;
+static uint32_t     use_counter;
+
+static void image_free(image_t *image) {
+    pages_deallocate(image->shared_pages);
+    heap_caps_free(image->data);
+    slab_free(&image_cache, image);
+}
+
+static image_t *image_find_locked(uint8_t const hash[IMAGE_HASH_SIZE], uintptr_t base) {
+    for (image_t *image = image_list; image; image = image->next) {
+        if (image->base == base && !memcmp(image->hash, hash, IMAGE_HASH_SIZE)) {
+            return image;
+        }
+    }
+    return NULL;
+}
+
+void image_cache_shrink(size_t max_pages) {
+    while (1) {
+        image_t *victim = NULL;
+
+        portENTER_CRITICAL(&images_lock);
+        if (cached_pages > max_pages) {
+            image_t **victim_link = NULL;
+            for (image_t **link = &image_list; *link; link = &(*link)->next) {
+                image_t *image = *link;
+                if (image->refcount || (image->pinned && max_pages)) {
+                    continue;
+                }
+                if (!victim_link || image->last_used < (*victim_link)->last_used) {
+                    victim_link = link;
+                }
+            }
+
+            if (victim_link) {
+                victim        = *victim_link;
+                *victim_link  = victim->next;
+                cached_pages -= victim->shared_size / SOC_MMU_PAGE_SIZE;
+                --num_images;
+            }
+        }
+        portEXIT_CRITICAL(&images_lock);
+
+        if (!victim) {
+            return;
+        }
+
+        ESP_LOGI(TAG, "Evicting image at %p, %zu shared bytes", (void *)victim->base, victim->shared_size);
+        image_free(victim);
+    }
+}
+
+image_t *image_cache_get(uint8_t const hash[IMAGE_HASH_SIZE], uintptr_t base) {
+    portENTER_CRITICAL(&images_lock);
+    image_t *image = image_find_locked(hash, base);
+    if (image) {
+        ++image->refcount;
+        image->last_used = ++use_counter;
+    }
+    portEXIT_CRITICAL(&images_lock);
+
+    return image;
+}
+
+void image_cache_put(image_t *image) {
+    if (!image) {
+        return;
+    }
+
+    portENTER_CRITICAL(&images_lock);
+    --image->refcount;
+    portEXIT_CRITICAL(&images_lock);
+
+    image_cache_shrink(IMAGE_CACHE_MAX_PAGES);
+}
+
+image_t *image_cache_add(
+    task_info_t  *task_info,
+    uint8_t const hash[IMAGE_HASH_SIZE],
+    size_t        size,
+    size_t        shared_size,
+    size_t        data_size,
+    void         *entry
+) {
+    uintptr_t base = task_info->thread->start;
+
+    if (!shared_size || shared_size / SOC_MMU_PAGE_SIZE > IMAGE_CACHE_MAX_PAGES) {
+        return NULL;
+    }
+
+    // Another instance may have beaten us to it, that one is as good as ours
+    portENTER_CRITICAL(&images_lock);
+    bool cached = image_find_locked(hash, base) != NULL;
+    portEXIT_CRITICAL(&images_lock);
+    if (cached) {
+        return NULL;
+    }
+
+    image_t *image = slab_alloc(&image_cache);
+    if (!image) {
+        return NULL;
+    }
+
+    if (data_size) {
+        image->data = heap_caps_malloc(data_size, MALLOC_CAP_SPIRAM);
+        if (!image->data) {
+            slab_free(&image_cache, image);
+            return NULL;
+        }
+        why_memcpy(image->data, (void *)(base + shared_size), data_size);
+    }
+
+    // Last, the pages belong to the cache from here on
+    image->shared_pages = heap_share_image(task_info, base, shared_size);
+    if (!image->shared_pages) {
+        heap_caps_free(image->data);
+        slab_free(&image_cache, image);
+        return NULL;
+    }
+
+    memcpy(image->hash, hash, IMAGE_HASH_SIZE);
+    image->base        = base;
+    image->size        = size;
+    image->shared_size = shared_size;
+    image->data_size   = data_size;
+    image->entry       = entry;
+    image->refcount    = 1;
+    image->pinned      = false;
+
+    portENTER_CRITICAL(&images_lock);
+    image->last_used  = ++use_counter;
+    image->next       = image_list;
+    image_list        = image;
+    cached_pages     += shared_size / SOC_MMU_PAGE_SIZE;
+    ++num_images;
+    portEXIT_CRITICAL(&images_lock);
+
+    ESP_LOGI(TAG, "Cached image at %p, %zu of %zu bytes shared", (void *)base, shared_size, size);
+    image_cache_shrink(IMAGE_CACHE_MAX_PAGES);
+    return image;
+}
+
+void *image_cache_map(task_info_t *task_info, image_t const *image) {
+    if (task_info->thread->start != image->base ||
+        !heap_map_image(task_info, image->shared_pages, image->shared_size, image->size)) {
+        return NULL;
+    }
+
+    why_memcpy((void *)(image->base + image->shared_size), image->data, image->data_size);
+    memory_mark_executable((void *)image->base, image->size);
+    return image->entry;
+}
+
+void image_cache_pin(image_t *image) {
+    if (!image) {
+        return;
+    }
+
+    portENTER_CRITICAL(&images_lock);
+    image->pinned = true;
+    portEXIT_CRITICAL(&images_lock);
+}
+
+void image_cache_info(size_t *images, size_t *pages) {
+    portENTER_CRITICAL(&images_lock);
+    *images = num_images;
+    *pages  = cached_pages;
+    portEXIT_CRITICAL(&images_lock);
+}
+
+static char *prelink_path(char const *path) {
+    // Not malloc(), this runs in the program whose heap is the image
+    char *ret = heap_caps_malloc(strlen(path) + sizeof(PRELINK_SUFFIX), MALLOC_CAP_SPIRAM);
+    if (ret) {
+        strcpy(ret, path);
+        strcat(ret, PRELINK_SUFFIX);
+    }
+    return ret;
+}
+
+void image_prelink_write(
+    task_info_t  *task_info,
+    char const   *path,
+    uint8_t const hash[IMAGE_HASH_SIZE],
+    size_t        size,
+    size_t        shared_size,
+    size_t        data_end,
+    void         *entry
+) {
+    prelink_header_t header = {
+        .magic       = PRELINK_MAGIC,
+        .base        = task_info->thread->start,
+        .size        = size,
+        .shared_size = shared_size,
+        .data_end    = data_end,
+        .entry       = (uintptr_t)entry,
+    };
+    memcpy(header.hash, hash, IMAGE_HASH_SIZE);
+    memcpy(header.firmware, esp_app_get_description()->app_elf_sha256, IMAGE_HASH_SIZE);
+
+    char *file = prelink_path(path);
+    if (!file) {
+        return;
+    }
+
+    int fd = why_open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        // Read-only or full, the program just gets relocated every time
+        heap_caps_free(file);
+        return;
+    }
+
+    // The header goes last, a file cut short never looks valid
+    bool ok = why_lseek(fd, sizeof(header), SEEK_SET) == sizeof(header) &&
+              why_write(fd, (void const *)header.base, data_end) == data_end && why_lseek(fd, 0, SEEK_SET) == 0 &&
+              why_write(fd, &header, sizeof(header)) == sizeof(header);
+    why_close(fd);
+
+    if (ok) {
+        ESP_LOGI(TAG, "Prelinked %s, %zu bytes", path, data_end);
+    } else {
+        ESP_LOGW(TAG, "Unable to write %s", file);
+        why_unlink(file);
+    }
+    heap_caps_free(file);
+}
+
+void *image_prelink_read(
+    task_info_t  *task_info,
+    char const   *path,
+    uint8_t const hash[IMAGE_HASH_SIZE],
+    size_t        size,
+    size_t       *shared_size,
+    size_t       *data_end
+) {
+    prelink_header_t header;
+
+    char *file = prelink_path(path);
+    if (!file) {
+        return NULL;
+    }
+
+    int fd = why_open(file, O_RDONLY, 0);
+    heap_caps_free(file);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    bool ok = why_read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == PRELINK_MAGIC &&
+              header.base == task_info->thread->start && header.size == size && header.shared_size <= size &&
+              header.data_end <= size && !memcmp(header.hash, hash, IMAGE_HASH_SIZE) &&
+              !memcmp(header.firmware, esp_app_get_description()->app_elf_sha256, IMAGE_HASH_SIZE);
+
+    // Straight into place, the heap was mapped for exactly this image
+    if (ok && why_read(fd, (void *)header.base, header.data_end) != header.data_end) {
+        // Relocating expects the heap as it was
+        why_memset((void *)header.base, 0, header.data_end);
+        ok = false;
+    }
+    why_close(fd);
+
+    if (!ok) {
+        return NULL;
+    }
+
+    memory_mark_executable((void *)header.base, size);
+    *shared_size = header.shared_size;
+    *data_end    = header.data_end;
+    return (void *)header.entry;
+}
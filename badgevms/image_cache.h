@@ -0,0 +1,86 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "memory.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define IMAGE_HASH_SIZE 32 // SHA-256 of the ELF file
+
+// Relocated program images. The first instance of a program hands its image to
+// the cache right after loading, later instances map its read-only pages and
+// only get a private copy of the writable part. Images are keyed by the hash
+// of their file and the address they were relocated for, which is the start
+// of the process heap.
+typedef struct image image_t;
+
+// A referenced image, or NULL if there is none
+image_t *image_cache_get(uint8_t const hash[IMAGE_HASH_SIZE], uintptr_t base);
+void     image_cache_put(image_t *image);
+
+// Take over the first shared_size bytes of the image just relocated at the start
+// of the heap of task_info, and keep a copy of the data_size bytes after them.
+// Returns a referenced image, NULL if it couldn't be cached.
+image_t *image_cache_add(
+    task_info_t  *task_info,
+    uint8_t const hash[IMAGE_HASH_SIZE],
+    size_t        size,
+    size_t        shared_size,
+    size_t        data_size,
+    void         *entry
+);
+
+// Map image at the start of the empty heap of task_info, returns its entry point
+void *image_cache_map(task_info_t *task_info, image_t const *image);
+
+// Keep image cached while no process has it mapped, until memory runs low. For
+// interpreters, so every script starts from a mapped image.
+void image_cache_pin(image_t *image);
+
+// Prelinked images. Relocation only depends on the ELF file, the address it is
+// relocated for and the symbols of the firmware, so the image just relocated at
+// the start of the heap of task_info is written next to the ELF file at path.
+void  image_prelink_write(
+    task_info_t  *task_info,
+    char const   *path,
+    uint8_t const hash[IMAGE_HASH_SIZE],
+    size_t        size,
+    size_t        shared_size,
+    size_t        data_end,
+    void         *entry
+);
+// Read the prelinked image of the ELF file at path into the mapped, zeroed heap
+// of task_info. Returns its entry point and where its parts end, NULL if there
+// is none for this ELF file, address and firmware.
+void *image_prelink_read(
+    task_info_t  *task_info,
+    char const   *path,
+    uint8_t const hash[IMAGE_HASH_SIZE],
+    size_t        size,
+    size_t       *shared_size,
+    size_t       *data_end
+);
+
+// Drop the least recently used images nobody has mapped until the cache holds
+// at most max_pages. Pinned images only go for a max_pages of 0.
+void image_cache_shrink(size_t max_pages);
+
+// Stats for the memory report
+void image_cache_info(size_t *images, size_t *pages);
@@ -19,6 +19,7 @@
 #include "badgevms/pathfuncs.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include <sys/types.h>
@@ -29,23 +30,58 @@ typedef enum {
     APPLICATION_SOURCE_MAX,
 } application_source_t;
 
+// How an application shares the CPU with the one in front
+typedef enum {
+    APPLICATION_CPU_INTERACTIVE, // Boosted while it is in front, the default
+    APPLICATION_CPU_BACKGROUND,  // Never boosted, and runs below everything else when not in front
+    APPLICATION_CPU_BATCH,       // Always runs below everything else
+    APPLICATION_CPU_MAX,
+} application_cpu_class_t;
+
 typedef struct {
-    char const                *unique_identifier; // Unique identifier
-    char const                *name;              // Human friendly
-    char const                *author;            // Author (if known)
-    char const                *version;           // Installed version
-    char const                *interpreter;       // Interpreter if needed
-    char const                *metadata_file;     // Metadata file (if any) relative to install path
-    char const                *installed_path;    // Physical install location
-    char const                *binary_path;       // Physical main binary location
-    application_source_t const source;            // Where did this application come from
+    char const                *unique_identifier;     // Unique identifier
+    char const                *name;                  // Human friendly
+    char const                *author;                // Author (if known)
+    char const                *version;               // Installed version
+    char const                *interpreter;           // Interpreter if needed, see application_launch()
+    char const                *metadata_file;         // Metadata file (if any) relative to install path
+    char const                *installed_path;        // Physical install location
+    char const                *binary_path;           // Physical main binary location
+    char const                *icon_path;             // Icon thumbnail (if any), see application_set_icon()
+    application_source_t const source;                // Where did this application come from
+    size_t                     heap_grow_size;        // Heap mapping step in bytes, 0 for the default
+    size_t                     heap_trim_size;        // Unused heap kept before it shrinks in bytes, 0 for the default
+    bool                       keep_warm;             // Parked instead of exiting, see application_park()
+    size_t                     max_heap_pages;        // Heap budget in MMU pages, 0 for no limit
+    size_t                     max_framebuffer_pages; // Framebuffer budget in MMU pages, 0 for no limit
+    application_cpu_class_t    cpu_class;             // See application_cpu_class_t
+    int                        frame_rate;            // Highest frame rate of its windows, 0 for no limit
 } application_t;
 
-typedef struct application_list *application_list_handle;
+typedef struct application_list   *application_list_handle;
+typedef struct application_bundle *application_bundle_handle;
+
+// Icons are thumbnails of this size, sprites (see badgevms/sprite.h) with alpha, ready to draw.
+// application_set_icon() writes them to APPLICATION_ICON_THUMBNAIL.
+#define APPLICATION_ICON_SIZE      48
+#define APPLICATION_ICON_THUMBNAIL "icon_thumbnail.spr"
 
 // Launch an application by name, returns the pid of the application or -1 on failure.
+// A keep_warm application runs once, launching it again resumes the running one.
+//
+// An application with an interpreter, an installed application or the path of an ELF file, is started as the
+// interpreter with the script at binary_path as argv[1]. argv[2], if there is one, is where the compiled script is
+// kept: load it if it exists, otherwise compile the script and write it there, under another name first and renamed
+// once complete. It is named after the SHA-256 of the script and goes away when the script changes. The image of the
+// interpreter stays cached between launches, so only its writable part is copied for the next script.
 pid_t application_launch(char const *unique_identifier);
 
+// For a keep_warm application that would otherwise exit, from its main thread.
+// The application is suspended with its windows off screen until the next
+// application_launch() of it, which is then instant, and true is returned.
+// False right away if the application is not keep_warm, it should just exit.
+bool application_park(void);
+
 // Create a new application. You will get an application_t* back if it succeeded or NULL if it failed.
 // This creates the application directory and metadata file
 application_t *application_create(
@@ -65,6 +101,10 @@ bool application_set_metadata(application_t *application, char const *metadata_f
 // application_create_file() for an explanation.
 bool application_set_binary_path(application_t *application, char const *binary_path);
 
+// Set the icon of the application from a sprite of any size, relative to the APP: path. The sprite is
+// scaled down once, here, to a APPLICATION_ICON_SIZE square thumbnail which icon_path names. NULL removes it.
+bool application_set_icon(application_t *application, char const *icon_file);
+
 // Change the version of an application_t instance
 bool application_set_version(application_t *application, char const *version);
 
@@ -93,10 +133,33 @@ FILE *application_create_file(application_t *application, char const *file_path)
 // The caller should free() the string.
 char *application_create_file_string(application_t *application, char const *file_path);
 
+// Install from a bundle made by misc/make_bundle.py: manifest.json and the files of the application
+// in one stream, extracted as it arrives. Feed it the download, from a curl write callback for example.
+// Nothing changes in APPS: until application_bundle_commit() checked the bundle and swapped the new
+// files in at once. NULL if out of memory.
+application_bundle_handle application_bundle_open(void);
+// Extract the next size bytes. False if the bundle is damaged or can't be written, after that it
+// takes nothing.
+bool application_bundle_write(application_bundle_handle bundle, void const *data, size_t size);
+// Install it if the whole bundle arrived and its SHA-256 is sha256, NULL skips that check. Returns
+// the installed application, or NULL. Closes the bundle either way.
+application_t *application_bundle_commit(application_bundle_handle bundle, uint8_t const sha256[32]);
+// Throw away the bundle and everything extracted of it
+void application_bundle_abort(application_bundle_handle bundle);
+// All of the above for the bundle at url, in a single download
+application_t *application_bundle_install(char const *url, uint8_t const sha256[32]);
+
 // Query the list of installed applications, giving a list and the first application in the list.
 // out can be NULL.
 application_list_handle application_list(application_t **out);
 
+// Like application_list(), but at most count applications from offset on, in the order of the
+// index (sorted by unique ID). Only the application index is read, so this is cheap enough to
+// fill a screen with before the full list. total, which can be NULL, is set to the number of
+// installed applications. Applications copied into APPS: by hand only show up here after the
+// next application_list().
+application_list_handle application_list_range(size_t offset, size_t count, application_t **out, size_t *total);
+
 // Get the next application_t* in the list, application*'s do not need to be separately
 // application_free()'d they will be freed by application_list_close()
 application_t *application_list_get_next(application_list_handle list);
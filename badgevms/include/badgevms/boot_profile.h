@@ -0,0 +1,44 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Where the time went while booting. The kernel times every stage of bringing
+// up memory, drivers, the compositor, wifi and init, and notes the first
+// application launch and the first frames on the panel. The profiles of the
+// last BOOT_PROFILE_HISTORY boots are kept in NVS.
+#define BOOT_PROFILE_HISTORY    4
+#define BOOT_PROFILE_MAX_STAGES 32
+#define BOOT_PROFILE_NAME_MAX   16
+
+typedef struct {
+    char     name[BOOT_PROFILE_NAME_MAX];
+    uint32_t start_us;    // Since the CPU started
+    uint32_t duration_us; // 0 for something that happened at start_us
+} boot_stage_t;
+
+typedef struct {
+    uint32_t     boot;       // Counts the profiled boots, 0 until this one is stored
+    uint32_t     num_stages; // In the order they ended
+    boot_stage_t stages[BOOT_PROFILE_MAX_STAGES];
+} boot_profile_t;
+
+// 0 is this boot, which is stored a while after init started, 1 the one
+// before and so on. False if there is no such profile.
+bool boot_profile_get(int ago, boot_profile_t *profile);
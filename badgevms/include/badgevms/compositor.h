@@ -21,19 +21,26 @@
 #include "pixel_formats.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
 
 typedef enum {
-    WINDOW_FLAG_NONE            = 0,
-    WINDOW_FLAG_FULLSCREEN      = (1 << 0), // Only one fullscreen application can run at a tim
-    WINDOW_FLAG_ALWAYS_ON_TOP   = (1 << 1), // Does not apply to fullscreen apps
-    WINDOW_FLAG_UNDECORATED     = (1 << 2), // Create a floating window
-    WINDOW_FLAG_MAXIMIZED       = (1 << 3), // Create an application window of the maximum size
-    WINDOW_FLAG_MAXIMIZED_LEFT  = (1 << 4), // Create a window and have it cover the whole left of the screen
-    WINDOW_FLAG_MAXIMIZED_RIGHT = (1 << 5), // Create a window and have it cover the whole right of the screen
-    WINDOW_FLAG_DOUBLE_BUFFERED = (1 << 6), // Create a double buffered window
-    WINDOW_FLAG_LOW_PRIORITY    = (1 << 7), // Don't elevate my priority, even if I'm fullscreen
-    WINDOW_FLAG_FLIP_HORIZONTAL = (1 << 8), // Flip my window horizontally
-    WINDOW_FLAG_FLIP_VERTICAL   = (1 << 9), // Flip my window vertically
+    WINDOW_FLAG_NONE               = 0,
+    WINDOW_FLAG_FULLSCREEN         = (1 << 0),  // Only one fullscreen application can run at a tim
+    WINDOW_FLAG_ALWAYS_ON_TOP      = (1 << 1),  // Does not apply to fullscreen apps
+    WINDOW_FLAG_UNDECORATED        = (1 << 2),  // Create a floating window
+    WINDOW_FLAG_MAXIMIZED          = (1 << 3),  // Create an application window of the maximum size
+    WINDOW_FLAG_MAXIMIZED_LEFT     = (1 << 4),  // Create a window and have it cover the whole left of the screen
+    WINDOW_FLAG_MAXIMIZED_RIGHT    = (1 << 5),  // Create a window and have it cover the whole right of the screen
+    WINDOW_FLAG_DOUBLE_BUFFERED    = (1 << 6),  // Create a double buffered window
+    WINDOW_FLAG_LOW_PRIORITY       = (1 << 7),  // Don't elevate my priority, even if I'm fullscreen
+    WINDOW_FLAG_FLIP_HORIZONTAL    = (1 << 8),  // Flip my window horizontally
+    WINDOW_FLAG_FLIP_VERTICAL      = (1 << 9),  // Flip my window vertically
+    WINDOW_FLAG_NATIVE_ORIENTATION = (1 << 10), // My framebuffer is laid out like the panel, see orientation.h
+    WINDOW_FLAG_ALPHA_BLEND        = (1 << 11), // Blend my 32 bit framebuffer with what's below using its alpha channel
+    WINDOW_FLAG_TRIPLE_BUFFERED    = (1 << 12), // Double buffered with a spare, window_present() never waits
 } window_flag_t;
 
 typedef struct {
@@ -70,6 +77,10 @@ window_size_t window_size_set(window_handle_t window, window_size_t size);
 window_flag_t window_flags_get(window_handle_t window);
 window_flag_t window_flags_set(window_handle_t window, window_flag_t flags);
 
+// 255 (the default) is opaque and 0 invisible, anything else is blended with what's below
+uint8_t window_opacity_get(window_handle_t window);
+void    window_opacity_set(window_handle_t window, uint8_t opacity);
+
 window_size_t  window_framebuffer_size_get(window_handle_t window);
 window_size_t  window_framebuffer_size_set(window_handle_t window, window_size_t size);
 pixel_format_t window_framebuffer_format_get(window_handle_t window);
@@ -77,6 +88,130 @@ pixel_format_t window_framebuffer_format_get(window_handle_t window);
 framebuffer_t *window_framebuffer_get(window_handle_t window);
 void           window_present(window_handle_t window, bool block, window_rect_t *rects, int num_rects);
 
+// For a BADGEVMS_PIXELFORMAT_INDEX8 framebuffer, one byte per pixel that the
+// compositor looks up in this palette. Sets num colors, 0xRRGGBB, from first
+// on. They show with the next window_present(), which then redraws everything.
+void window_palette_set(window_handle_t window, uint32_t const *colors, int first, int num);
+
+// Draw into the back buffer of a window with the PPA, for toolkits. Both
+// return once the PPA is done, so they mix with drawing by the CPU, and false
+// for whatever the PPA can't do, which the caller then draws itself.
+//
+// src is w * h pixels without padding between rows. src_rect is copied to
+// dst_rect, scaled by a multiple of 1/16. With blend it is blended over what
+// is there by its alpha channel times alpha instead, at its own size.
+bool window_framebuffer_blit(
+    window_handle_t      window,
+    framebuffer_t const *src,
+    window_rect_t        src_rect,
+    window_rect_t        dst_rect,
+    uint8_t              alpha,
+    bool                 blend
+);
+// color is ARGB8888, the alpha is only stored in framebuffers that have it
+bool window_framebuffer_fill(window_handle_t window, window_rect_t rect, uint32_t color);
+
 event_t window_event_poll(window_handle_t window, bool block, uint32_t timeout_msec);
+// Take up to max queued events at once without blocking, oldest first.
+// Returns how many were written to events.
+size_t  window_events_drain(window_handle_t window, event_t *events, size_t max);
+
+// Frame pacing. The rate is rounded to a divisor of the panel refresh rate,
+// 0 means every refresh. Windows that are not in front are throttled further.
+// Never faster than the frame_rate from the manifest of the application.
+void window_frame_rate_set(window_handle_t window, int fps);
+int  window_frame_rate_get(window_handle_t window);
+// Block until the next panel refresh this window is due for
+void window_wait_vsync(window_handle_t window);
+// Queue a single EVENT_WINDOW_FRAME on the next panel refresh this window is due for
+void window_frame_callback_request(window_handle_t window);
+
+// How much of the window's content is on screen, from 0 when it is covered
+// completely to 1. EVENT_WINDOW_OCCLUDED and EVENT_WINDOW_VISIBLE are sent when
+// it drops to 0 and when it leaves 0 again.
+float window_visible_fraction(window_handle_t window);
 
 void get_screen_info(int *width, int *height, pixel_format_t *format, float *refresh_rate);
+
+// The panel has two or three framebuffers of a megabyte each. With three the
+// compositor draws the next frame while the previous one waits to be shown,
+// two leave a megabyte more to applications. Takes effect at the next boot.
+bool display_framebuffers_set(int count);
+int  display_framebuffers_get(void);
+
+// Overlays are small surfaces like a clock or a HUD. They have no decorations,
+// are always drawn on top of all windows with their alpha channel, if any, and
+// presenting them doesn't make the compositor redraw what's below.
+typedef struct overlay *overlay_handle_t;
+
+overlay_handle_t overlay_create(window_size_t size, pixel_format_t pixel_format);
+void             overlay_destroy(overlay_handle_t overlay);
+
+framebuffer_t *overlay_framebuffer_get(overlay_handle_t overlay);
+void           overlay_present(overlay_handle_t overlay);
+
+// In screen coordinates, overlays are kept on the screen
+window_coords_t overlay_position_get(overlay_handle_t overlay);
+window_coords_t overlay_position_set(overlay_handle_t overlay, window_coords_t coords);
+
+#define COMPOSITOR_STATS_MAX_WINDOWS 10
+// See compositor_input_latency_enable()
+#define COMPOSITOR_INPUT_LATENCY_BUCKETS   12
+#define COMPOSITOR_INPUT_LATENCY_BUCKET_US 8000
+
+// Timings are in microseconds and cover the last composited frame
+typedef struct {
+    uint32_t queue_us;      // Processing window commands
+    uint32_t input_us;      // Reading the keyboard, accumulated since the previous frame
+    uint32_t decoration_us; // Drawing window decorations, including their cache syncs
+    uint32_t cache_sync_us; // Cache syncs outside of decoration drawing
+    uint32_t compose_us;    // From the panel refresh until the last PPA operation was queued
+    uint32_t ppa_busy_us;   // PPA running, accumulated since the previous frame
+    uint32_t ppa_ops;       // Fills, blits and blends queued
+    uint32_t ppa_pixels;    // Pixels written by the PPA
+} compositor_frame_stats_t;
+
+typedef struct {
+    pid_t    pid;
+    uint32_t presents;       // Frames consumed since the window was created
+    uint32_t latency_us;     // From window_present() until the frame was drawn, for the last frame
+    uint32_t latency_max_us; // Worst latency since the window was created
+    uint32_t events_dropped; // Events lost to a full event queue since the window was created
+    // From reading a key until the frame answering it was on screen, for the
+    // last one, and how often each latency came up since measuring started
+    uint32_t input_latency_us;
+    uint16_t input_latency[COMPOSITOR_INPUT_LATENCY_BUCKETS];
+} compositor_window_stats_t;
+
+typedef struct {
+    uint32_t                  refreshes;
+    uint32_t                  frames; // Refreshes that composited something
+    compositor_frame_stats_t  frame;
+    int                       num_windows;
+    compositor_window_stats_t windows[COMPOSITOR_STATS_MAX_WINDOWS];
+} compositor_stats_t;
+
+// A snapshot of the compositor counters, also readable from the COMPOSITOR0 device
+void compositor_stats_get(compositor_stats_t *stats);
+// Input-to-photon latency measurement, off by default. While it is on, every
+// key event an application takes is followed from the keyboard read through
+// its next window_present() and the compositor, until the panel finished
+// showing that frame. The histograms have COMPOSITOR_INPUT_LATENCY_BUCKET_US
+// wide buckets, the last one takes everything longer. Turning it on starts
+// them over.
+void compositor_input_latency_enable(bool enable);
+
+// Screen capture. Every frame the compositor shows is rotated back to screen
+// orientation, scaled down to fit size and converted by the PPA, without
+// involving the applications. Only one capture runs at a time. Supported
+// formats are RGB565, BGR565, RGB24, BGR24, ARGB8888, ABGR8888 and
+// YUV420_ESP. YUV420 frames are padded with black to multiples of 16 pixels,
+// for video encoders.
+bool    compositor_capture_start(window_size_t size, pixel_format_t pixel_format);
+void    compositor_capture_stop(void);
+// The size frames actually have, false if no capture is running
+bool    compositor_capture_info(window_size_t *size, pixel_format_t *pixel_format, size_t *frame_bytes);
+// Wait for a frame newer than *sequence, 0 to start, and copy it to buffer.
+// Returns the bytes copied, 0 on timeout and -1 if no capture is running.
+// The CAPTURE0 device does the same for each read().
+ssize_t compositor_capture_read(void *buffer, size_t size, uint32_t *sequence, uint32_t timeout_msec);
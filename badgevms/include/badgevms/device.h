@@ -35,6 +35,7 @@ typedef enum {
     DEVICE_TYPE_ORIENTATION,
     DEVICE_TYPE_SOCKET,
     DEVICE_TYPE_FILESYSTEM,
+    DEVICE_TYPE_TTY,
 } device_type_t;
 
 typedef enum { ORIENTATION_0, ORIENTATION_90, ORIENTATION_180, ORIENTATION_270 } orientation_t;
@@ -47,6 +48,11 @@ typedef struct device {
     ssize_t (*_read)(void *dev, int fd, void *buf, size_t count);
     ssize_t (*_lseek)(void *dev, int fd, off_t offset, int whence);
     void (*_destroy)(void *dev);
+    // Optional, for poll(), select() and wait_any(), without them fd is always
+    // ready. Which of events, WAIT_READABLE and WAIT_WRITABLE, fd is ready for,
+    // and who to wake with wait_list_wake() when that may have changed.
+    int (*_ready)(void *dev, int fd, int events);
+    struct wait_list *(*_waiters)(void *dev, int fd);
 } device_t;
 
 typedef struct filesystem {
@@ -60,17 +66,26 @@ typedef struct filesystem {
     DIR *(*_opendir)(void *dev, path_t *path);
     struct dirent *(*_readdir)(void *dev, DIR *dirp);
     int (*_closedir)(void *dev, DIR *dirp);
+    // Optional, without them pread() and pwrite() seek around a read or write
+    ssize_t (*_pread)(void *dev, int fd, void *buf, size_t count, off_t offset);
+    ssize_t (*_pwrite)(void *dev, int fd, void const *buf, size_t count, off_t offset);
 } filesystem_device_t;
 
 typedef struct lcd_device {
     device_t device;
     void (*_draw)(void *dev, int x, int y, int w, int h, void *pixels);
     void (*_getfb)(void *dev, int num, void **pixels);
+    int framebuffers; // How many _getfb() hands out
     void (*_set_refresh_cb)(void *dev, void *user_data, void (*callback)(void *user_data));
+    // Optional, refresh at a lower rate while idle because the picture doesn't change
+    void (*_set_idle)(void *dev, bool idle);
 } lcd_device_t;
 
 typedef struct keyboard_device {
     device_t device;
+    // Block until there are events to read or timeout_ms passed, UINT32_MAX waits
+    // forever. False on a timeout.
+    bool (*_wait)(void *dev, uint32_t timeout_ms);
 } keyboard_device_t;
 
 typedef struct {
@@ -94,6 +109,9 @@ typedef struct {
 
 typedef struct {
     device_t device;
+    // Optional, true if reading fd won't block on data that arrived already but
+    // isn't in the socket anymore, like the rest of a TLS record
+    bool (*_pending)(void *dev, int fd);
 } socket_device_t;
 
 typedef struct {
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "keyboard.h"
+#include "memory_pressure.h"
 
 #include <stdint.h>
 
@@ -26,6 +27,12 @@ typedef enum event_type {
     EVENT_KEY_DOWN,
     EVENT_KEY_UP,
     EVENT_WINDOW_RESIZE,
+    EVENT_WINDOW_FRAME,
+    EVENT_MEMORY_PRESSURE,
+    EVENT_WIFI_SCAN,
+    EVENT_MOTION,
+    EVENT_WINDOW_OCCLUDED,
+    EVENT_WINDOW_VISIBLE,
 } event_type_t;
 
 // From SDL3
@@ -39,9 +46,46 @@ typedef struct {
     bool                repeat;    /**< true if this is a key repeat */
 } keyboard_event_t;
 
+// Sent after window_frame_callback_request()
+typedef struct {
+    uint64_t timestamp; /**< Time of the panel refresh in nanoseconds, populated using gettimeofday */
+    uint32_t frame;     /**< Number of panel refreshes since boot */
+} window_frame_event_t;
+
+// Sent to all windows when the memory pressure level changes
+typedef struct {
+    memory_pressure_t level;
+    uint32_t          free_pages;  /**< Free PSRAM pages at the time of the change */
+    uint32_t          total_pages;
+} memory_pressure_event_t;
+
+// Sent to all windows when a scan finds other access points than the last one
+typedef struct {
+    uint32_t num_results; /**< As wifi_scan_get_cached_num_results() returns now */
+} wifi_scan_event_t;
+
+// Sent to the windows of a process once a motion_config_t batch of samples is
+// queued, and again only after it read some
+typedef struct {
+    uint32_t samples; /**< Queued at the time of sending */
+} motion_event_t;
+
+// Sent when nothing of a window is on screen any more, because other windows
+// cover it or one is shown fullscreen, and once some of it is again. Until
+// then nobody sees what it draws.
+typedef struct {
+    float visible; /**< Fraction of the content on screen, see window_visible_fraction() */
+} window_visibility_event_t;
+
 typedef struct {
     event_type_t type;
+    uint64_t     timestamp; /**< When the event was queued, in nanoseconds since boot */
     union {
-        keyboard_event_t keyboard;
+        keyboard_event_t          keyboard;
+        window_frame_event_t      frame;
+        memory_pressure_event_t   memory_pressure;
+        wifi_scan_event_t         wifi_scan;
+        motion_event_t            motion;
+        window_visibility_event_t visibility;
     };
 } event_t;
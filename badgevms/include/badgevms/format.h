@@ -0,0 +1,124 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// snprintf() for a single number, for text that is rebuilt every frame. When
+// fmt is one of the string literals "%d", "%u", "%x", "%.1f", "%.2f" or "%.3f"
+// the conversion is chosen at compile time and inlined, anything else is passed
+// on to snprintf(). Returns what snprintf() would.
+//
+//   format_number(score_text, sizeof(score_text), "%d", score);
+#define format_number(str, size, fmt, value)                                                                           \
+    (__builtin_constant_p(fmt) && !__builtin_strcmp((fmt), "%d")     ? format_int((str), (size), (int)(value))         \
+     : __builtin_constant_p(fmt) && !__builtin_strcmp((fmt), "%u")   ? format_uint((str), (size), (unsigned)(value))   \
+     : __builtin_constant_p(fmt) && !__builtin_strcmp((fmt), "%x")   ? format_hex((str), (size), (unsigned)(value))    \
+     : __builtin_constant_p(fmt) && !__builtin_strcmp((fmt), "%.1f") ? format_fixed((str), (size), (value), 1)         \
+     : __builtin_constant_p(fmt) && !__builtin_strcmp((fmt), "%.2f") ? format_fixed((str), (size), (value), 2)         \
+     : __builtin_constant_p(fmt) && !__builtin_strcmp((fmt), "%.3f") ? format_fixed((str), (size), (value), 3)         \
+                                                                     : snprintf((str), (size), (fmt), (value)))
+
+// Enough for any of the conversions above that doesn't fall back to snprintf()
+#define FORMAT_NUMBER_MAX 24
+
+// Copies the len characters before end to str like snprintf() would
+__attribute__((always_inline)) inline static int format_copy(char *str, size_t size, char const *end, int len) {
+    if (size) {
+        size_t n = (size_t)len < size ? (size_t)len : size - 1;
+        memcpy(str, end - len, n);
+        str[n] = '\0';
+    }
+    return len;
+}
+
+__attribute__((always_inline)) inline static char *format_digits(uint32_t value, char *end) {
+    do {
+        *--end  = '0' + value % 10;
+        value  /= 10;
+    } while (value);
+    return end;
+}
+
+__attribute__((always_inline)) inline static int format_uint(char *str, size_t size, unsigned value) {
+    char  buf[FORMAT_NUMBER_MAX];
+    char *end = buf + sizeof(buf);
+    return format_copy(str, size, end, end - format_digits(value, end));
+}
+
+__attribute__((always_inline)) inline static int format_int(char *str, size_t size, int value) {
+    char  buf[FORMAT_NUMBER_MAX];
+    char *end   = buf + sizeof(buf);
+    char *start = format_digits(value < 0 ? -(unsigned)value : (unsigned)value, end);
+    if (value < 0) {
+        *--start = '-';
+    }
+    return format_copy(str, size, end, end - start);
+}
+
+__attribute__((always_inline)) inline static int format_hex(char *str, size_t size, unsigned value) {
+    char  buf[FORMAT_NUMBER_MAX];
+    char *end   = buf + sizeof(buf);
+    char *start = end;
+    do {
+        *--start   = "0123456789abcdef"[value & 15];
+        value    >>= 4;
+    } while (value);
+    return format_copy(str, size, end, end - start);
+}
+
+// Rounds value * 10^prec to an integer. Values so close to a tie that the
+// multiply could round either way, too large ones, inf and nan are left to
+// snprintf(), which prints the exact decimal expansion.
+__attribute__((always_inline)) inline static int format_fixed(char *str, size_t size, double value, int prec) {
+    static uint32_t const scale[] = {1, 10, 100, 1000};
+
+    bool   neg    = __builtin_signbit(value);
+    double scaled = (neg ? -value : value) * scale[prec];
+    if (!(scaled < 0x1p51 && scaled < UINT32_MAX * (double)scale[prec])) {
+        return snprintf(str, size, "%.*f", prec, value);
+    }
+
+    uint64_t whole = (uint64_t)scaled;
+    double   tie   = scaled - (double)whole - 0.5;
+    if ((tie < 0 ? -tie : tie) <= scaled * 0x1p-52) {
+        return snprintf(str, size, "%.*f", prec, value);
+    }
+    if (tie > 0) {
+        ++whole;
+    }
+
+    char     buf[FORMAT_NUMBER_MAX];
+    char    *end   = buf + sizeof(buf);
+    char    *start = end;
+    uint32_t ipart = (uint32_t)(whole / scale[prec]);
+    uint32_t fpart = (uint32_t)(whole - (uint64_t)ipart * scale[prec]);
+    for (int i = 0; i < prec; ++i) {
+        *--start  = '0' + fpart % 10;
+        fpart    /= 10;
+    }
+    *--start = '.';
+    start    = format_digits(ipart, start);
+    if (neg) {
+        *--start = '-';
+    }
+    return format_copy(str, size, end, end - start);
+}
@@ -0,0 +1,42 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timers with microsecond resolution, not rounded to the scheduler tick. A
+// thread blocks in hrtimer_wait() and is woken directly when the timer fires,
+// so frame pacing and audio don't have to spin on clock_gettime(). usleep()
+// and nanosleep() sleep the same way.
+typedef struct hrtimer hrtimer_t;
+
+// NULL if all timers are in use
+hrtimer_t *hrtimer_create(void);
+// Nobody may be waiting on timer
+void       hrtimer_destroy(hrtimer_t *timer);
+
+// Fire once after delay_us, or every period_us from now on. Starting a timer
+// that is running restarts it and forgets how often it fired.
+bool hrtimer_start_once(hrtimer_t *timer, uint64_t delay_us);
+bool hrtimer_start_periodic(hrtimer_t *timer, uint64_t period_us);
+void hrtimer_stop(hrtimer_t *timer);
+
+// Block until timer fired, returns how often it fired since the last wait. 0
+// if timeout_msec passed first, UINT32_MAX waits forever. A periodic timer
+// that fires while nobody waits is counted once per period it was missed by.
+uint32_t hrtimer_wait(hrtimer_t *timer, uint32_t timeout_msec);
@@ -0,0 +1,85 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "framebuffer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+// File I/O that doesn't block the caller. Requests go into the submission
+// ring of an io_ring_t and are served in order by a thread of the process
+// that belongs to the ring, their results come back in the completion ring.
+// A render thread can stream assets this way, and wait for completions
+// together with its window with WAIT_SOURCE_IO, see wait.h.
+//
+// A ring is used by one thread at a time. Its thread is a child of the one
+// that created the ring and dies with it, it isn't reported by wait().
+typedef struct io_ring io_ring_t;
+
+typedef enum {
+    IO_OP_OPEN,  // path, flags and mode, the result is the file descriptor
+    IO_OP_CLOSE, // fd
+    IO_OP_READ,  // fd, buf, count and offset, the result is the bytes read
+    IO_OP_WRITE, // fd, buf, count and offset, the result is the bytes written
+    IO_OP_STAT,  // path or fd if path is NULL, into the struct stat at buf
+    // The JPEG of count bytes at buf into framebuffer as format, see
+    // jpeg_decode(). The result is 0.
+    IO_OP_JPEG_DECODE,
+    // count bytes from src to buf, by DMA where it can be. The result is count.
+    IO_OP_COPY,
+    // count bytes at buf set to flags, by DMA where it can be. The result is
+    // count.
+    IO_OP_FILL,
+} io_op_t;
+
+typedef struct {
+    io_op_t        op;
+    int            fd;
+    int            flags;
+    mode_t         mode;
+    char const    *path; // Must stay valid until the request completed, like buf
+    void          *buf;
+    void const    *src; // Like buf
+    size_t         count;
+    off_t          offset; // -1 for the current position of fd
+    pixel_format_t format;
+    framebuffer_t *framebuffer; // Like buf
+    uintptr_t      user_data;   // Handed back in the completion
+} io_request_t;
+
+typedef struct {
+    uintptr_t user_data;
+    ssize_t   result; // What the call returned, -1 on failure
+    int       error;  // errno of the call if it failed
+} io_completion_t;
+
+// Room for entries requests in flight, rounded up to a power of two. NULL if
+// out of memory or the thread can't be started.
+io_ring_t *io_ring_create(unsigned int entries);
+// Waits for the request being served, the rest are dropped
+void       io_ring_destroy(io_ring_t *ring);
+
+// Queue request, false if entries requests are in flight already, then reap
+// completions first
+bool io_ring_submit(io_ring_t *ring, io_request_t const *request);
+// Take the oldest completion, false if timeout_msec passed first. UINT32_MAX
+// waits forever, 0 only checks.
+bool io_ring_complete(io_ring_t *ring, io_completion_t *completion, uint32_t timeout_msec);
@@ -0,0 +1,45 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "compositor.h"
+#include "framebuffer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Baseline JPEGs through the hardware decoder, which is a lot quicker than
+// decoding them on the CPU. Progressive JPEGs are not supported, decode those
+// with the image library. The JPEG can be anywhere, the pixels go where
+// ppa_blit() writes, see ppa.h. To decode without waiting queue
+// IO_OP_JPEG_DECODE on an io_ring_t, see io_ring.h.
+
+// The size of the picture in the JPEG of len bytes at buffer, false if it
+// isn't one the decoder reads
+bool jpeg_size_get(void const *buffer, size_t len, window_size_t *size);
+
+// Decode the JPEG of len bytes at buffer into the w by h pixels of out_fb as
+// out_format, any format ppa_blit() writes, out_fb->format is not looked at.
+// The picture lands in the top left corner, cut off at w by h. It is decoded
+// straight into out_fb when out_format is RGB565, BGR565, RGB24 or BGR24, w
+// is the width of the picture and the sides of the picture are multiples of
+// 16, else it goes through a buffer of the kernel first.
+//
+// Returns once the picture is there, false with errno set if it couldn't be
+// decoded.
+bool jpeg_decode(void const *buffer, size_t len, framebuffer_t *out_fb, pixel_format_t out_format);
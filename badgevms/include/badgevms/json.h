@@ -0,0 +1,85 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A JSON parser that doesn't allocate. json_parse() splits the text into
+// tokens in an array the caller provides, values are read from the text as
+// they are asked for. The text must stay around as long as the tokens do.
+//
+// Tokens are in document order. The first child of a container is the token
+// after it and the next sibling of a token is at its next, so
+//
+//     for (int key = object + 1; key < json.tokens[object].next; key = json.tokens[key].next)
+//
+// walks the members of an object. The value of a member is the token after
+// its key.
+
+// Containers deeper than this are refused
+#define JSON_MAX_DEPTH 32
+
+typedef enum {
+    JSON_ERROR_NOMEM   = -1, // More tokens than num_tokens
+    JSON_ERROR_INVALID = -2,
+    JSON_ERROR_PARTIAL = -3, // The text ends before the document does
+    JSON_ERROR_DEPTH   = -4,
+} json_error_t;
+
+typedef enum {
+    JSON_OBJECT,
+    JSON_ARRAY,
+    JSON_STRING, // Object keys too
+    JSON_NUMBER,
+    JSON_BOOL,
+    JSON_NULL,
+} json_type_t;
+
+typedef struct {
+    json_type_t type;
+    int         start; // Offsets into the text, strings without their quotes
+    int         end;
+    int         size;   // Members of an object, elements of an array, 1 for a key
+    int         next;   // The token after this one and everything in it
+    int         parent; // -1 for the document
+} json_token_t;
+
+typedef struct {
+    char const   *text;
+    json_token_t *tokens;
+    int           count;
+} json_t;
+
+// Parse len bytes of text, or up to a NUL. Returns the number of tokens or a
+// json_error_t. Without tokens only counts how many the text needs.
+int json_parse(json_t *json, char const *text, size_t len, json_token_t *tokens, int num_tokens);
+
+// The value of key in the object at token, -1 if it has none or isn't one
+int json_object_get(json_t const *json, int object, char const *key);
+// Element index of the array at token, -1 if there is no such element
+int json_array_get(json_t const *json, int array, int index);
+
+// Does the string at token decode to str
+bool json_string_equals(json_t const *json, int token, char const *str);
+// Decode the string at token into buf, always terminated if size isn't 0.
+// Returns its full decoded length like snprintf(), -1 if it isn't a string.
+int  json_string_get(json_t const *json, int token, char *buf, size_t size);
+bool json_number_get(json_t const *json, int token, double *value);
+// Numbers with a fraction or exponent are truncated
+bool json_int_get(json_t const *json, int token, long long *value);
+bool json_bool_get(json_t const *json, int token, bool *value);
@@ -0,0 +1,37 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// How short the system is on PSRAM pages. Every change of level is sent to all
+// windows as an EVENT_MEMORY_PRESSURE. Applications that keep caches, decoded
+// images, downloaded data and the like, should shed them on MEMORY_PRESSURE_LOW
+// and keep only what they need to run on MEMORY_PRESSURE_CRITICAL, then call
+// memory_release(). An allocation that runs out of pages waits a little for
+// others to do so before it fails.
+typedef enum {
+    MEMORY_PRESSURE_NONE,
+    MEMORY_PRESSURE_LOW,
+    MEMORY_PRESSURE_CRITICAL,
+} memory_pressure_t;
+
+memory_pressure_t memory_pressure_get(void);
+
+// Hand the heap memory freed so far back to the system right away, instead of
+// keeping some for later allocations. Returns the number of pages released.
+size_t memory_release(void);
@@ -16,8 +16,37 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 void        die(char const *reason);
 uint32_t    vaddr_to_paddr(uint32_t vaddr);
 char const *get_mac_address();
+
+// Zeroed memory for buffers devices access directly, freed when the process
+// exits. It is physically contiguous if the page allocator has a large enough
+// run, contiguous says whether it is, and scattered pages otherwise. Use
+// vaddr_to_paddr() for the physical address of each page.
+void *dma_buffer_alloc(size_t size, bool *contiguous);
+void  dma_buffer_free(void *buffer);
+
+// Memory in internal SRAM for data that is hot enough that PSRAM cache misses
+// hurt, like lookup tables and DSP buffers. Every process can hold a small
+// quota of it, see process_info_t, freed when the process exits. NULL with
+// errno ENOMEM once the quota or the SRAM runs out, use malloc() then.
+void *malloc_fast(size_t size);
+void  free_fast(void *ptr);
+
+// Functions marked with this run from internal SRAM, for inner loops that
+// PSRAM instruction fetches slow down. Their code is taken from the same
+// quota as malloc_fast() and they run from PSRAM when it runs out. Needs the
+// HOT_CODE option of build_app(). Calls out of them have to go through the
+// PLT or a function pointer, a direct jump can't reach PSRAM from there.
+#define APP_IRAM __attribute__((section(".app_iram"), noinline))
+
+// Map the file at path read-only, size is set to its size. Processes that map a
+// file while it is unchanged share one copy of it, which must not be written.
+// Unmapped when the process exits. NULL if it can't be read or is empty.
+void const *file_map(char const *path, size_t *size);
+void        file_unmap(void const *ptr);
@@ -0,0 +1,43 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Raw motion samples. open() ORIENTATION0: and read() whole motion_sample_t,
+// oldest first. read() doesn't wait, it returns -1 with errno EAGAIN until
+// there is something to read; set a batch to get an EVENT_MOTION instead of
+// polling. Each open has its own queue of the last MOTION_QUEUE_SAMPLES
+// samples, older ones are dropped when it isn't read in time.
+//
+// write() a motion_config_t to change the sensor settings. There is only the
+// one sensor, so the last write wins for everybody, and the defaults come back
+// when the last reader closes.
+#define MOTION_QUEUE_SAMPLES 256
+
+typedef struct {
+    uint64_t timestamp_us; // Since boot, as esp_timer counts
+    float    accel[3];     // In m/s², x y z
+    float    gyro[3];      // In degrees per second, x y z
+} motion_sample_t;
+
+typedef struct {
+    uint16_t rate_hz;        // 25, 50, 100, 200 or 400, both sensors. Default 100.
+    uint16_t accel_range_g;  // 2, 4, 8 or 16. Default 2.
+    uint16_t gyro_range_dps; // 125, 250, 500, 1000 or 2000. Default 2000.
+    uint16_t batch;          // Samples queued before EVENT_MOTION, 0 for none. Only for this open.
+} motion_config_t;
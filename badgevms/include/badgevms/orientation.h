@@ -0,0 +1,110 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "compositor.h"
+#include "framebuffer.h"
+
+#include <stdint.h>
+
+typedef enum {
+    ROTATION_ANGLE_0,
+    ROTATION_ANGLE_90,
+    ROTATION_ANGLE_180,
+    ROTATION_ANGLE_270,
+} rotation_angle_t;
+
+// How the panel is mounted. Screen coordinates are turned into panel
+// coordinates with this rotation.
+#define BADGEVMS_PANEL_ROTATION ROTATION_ANGLE_270
+
+// Rotate coordinates inside a w by h picture
+__attribute__((always_inline)) inline static void
+    orientation_rotate_coordinates(int w, int h, rotation_angle_t rotation, int x, int y, int *out_x, int *out_y) {
+    switch (rotation) {
+        case ROTATION_ANGLE_0:
+            *out_x = x;
+            *out_y = y;
+            break;
+
+        case ROTATION_ANGLE_90:
+            *out_x = (h - 1) - y;
+            *out_y = x;
+            break;
+
+        case ROTATION_ANGLE_180:
+            *out_x = (w - 1) - x;
+            *out_y = (h - 1) - y;
+            break;
+
+        case ROTATION_ANGLE_270:
+            *out_x = y;
+            *out_y = (w - 1) - x;
+            break;
+    }
+}
+
+__attribute__((always_inline)) inline static window_rect_t
+    orientation_rotate_rect(int w, int h, rotation_angle_t rotation, window_rect_t rect) {
+    window_rect_t ret;
+    switch (rotation) {
+        case ROTATION_ANGLE_0: ret = rect; break;
+
+        case ROTATION_ANGLE_90:
+            ret.w = rect.h;
+            ret.h = rect.w;
+            ret.x = (h - 1) - (rect.y + rect.h - 1);
+            ret.y = rect.x;
+            break;
+
+        case ROTATION_ANGLE_180:
+            ret.w = rect.w;
+            ret.h = rect.h;
+            ret.x = (w - 1) - (rect.x + rect.w - 1);
+            ret.y = (h - 1) - (rect.y + rect.h - 1);
+            break;
+
+        case ROTATION_ANGLE_270:
+            ret.w = rect.h;
+            ret.h = rect.w;
+            ret.x = rect.y;
+            ret.y = (w - 1) - (rect.x + rect.w - 1);
+            break;
+    }
+
+    return ret;
+}
+
+// A window with WINDOW_FLAG_NATIVE_ORIENTATION keeps the framebuffer size it
+// asked for, but lays out the pixels the way the panel does. For the default
+// rotation a w by h framebuffer is stored as fb->w rows of fb->h pixels.
+__attribute__((always_inline)) inline static int native_pitch(framebuffer_t const *fb) {
+    return (BADGEVMS_PANEL_ROTATION == ROTATION_ANGLE_90 || BADGEVMS_PANEL_ROTATION == ROTATION_ANGLE_270) ? fb->h
+                                                                                                          : fb->w;
+}
+
+// Index into fb->pixels for the pixel at x, y in screen orientation
+__attribute__((always_inline)) inline static int native_pixel_index(framebuffer_t const *fb, int x, int y) {
+    int native_x, native_y;
+    orientation_rotate_coordinates(fb->w, fb->h, BADGEVMS_PANEL_ROTATION, x, y, &native_x, &native_y);
+    return native_y * native_pitch(fb) + native_x;
+}
+
+// A rect in screen orientation, like a window_present() damage rect, in the native layout
+__attribute__((always_inline)) inline static window_rect_t native_rect(framebuffer_t const *fb, window_rect_t rect) {
+    return orientation_rotate_rect(fb->w, fb->h, BADGEVMS_PANEL_ROTATION, rect);
+}
@@ -1,12 +1,28 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct ota_session_t ota_session_t;
 typedef ota_session_t       *ota_handle_t;
 
 ota_handle_t ota_session_open();
+// Takes a copy of buffer, it is hashed and written to flash in the background
+// while the caller receives the next part. Returns false if an earlier write
+// failed, which aborted the session.
+//
+// Instead of a firmware image, a session takes a patch made by
+// misc/make_delta.py against the running firmware, see
+// ota_get_running_version(). It is told apart by its first byte, and applied
+// as it arrives.
 bool         ota_write(ota_handle_t session, void *buffer, int block_size);
+// The bytes taken by ota_write() so far. After a dropped connection, ask for
+// the rest of the image or patch from here and carry on with the same session.
+size_t       ota_session_offset(ota_handle_t session);
+// The SHA-256 of the image written so far, to check against the published
+// one before committing
+bool         ota_session_sha256(ota_handle_t session, uint8_t digest[32]);
 bool         ota_session_commit(ota_handle_t session);
 bool         ota_session_abort(ota_handle_t session);
 
@@ -20,13 +20,18 @@
 
 #include <string.h>
 
+// Longest path parse_path() takes, without the terminating 0
+#define PATH_MAX_LEN 255
+
+// The parts point into buffer, nothing is allocated
 typedef struct {
-    char  *buffer;
     char  *device;
     char  *directory;
     char  *filename;
     char  *unixpath;
     size_t len;
+    // Room for the unix form of the path, which is up to 2 bytes longer
+    char   buffer[PATH_MAX_LEN + 3];
 } path_t;
 
 typedef enum {
@@ -37,10 +42,12 @@ typedef enum {
     PATH_PARSE_INVALID_DEVICE_CHAR = -4,
     PATH_PARSE_INVALID_DIR_CHAR    = -5,
     PATH_PARSE_INVALID_FILE_CHAR   = -6,
-    PATH_PARSE_EMPTY_PATH          = -7
+    PATH_PARSE_EMPTY_PATH          = -7,
+    PATH_PARSE_TOO_LONG            = -8
 } path_parse_result_t;
 
 path_parse_result_t parse_path(char const *path, path_t *result);
+// There is nothing to free anymore, kept for callers that still do
 void                path_free(path_t *path);
 bool                mkdir_p(char const *path);
 bool                rm_rf(char const *path);
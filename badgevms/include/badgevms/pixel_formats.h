@@ -86,4 +86,8 @@ typedef enum {
     BADGEVMS_PIXELFORMAT_P010         = 0x30313050u, /**< Planar mode: Y + U/V interleaved  (2 planes) */
     BADGEVMS_PIXELFORMAT_EXTERNAL_OES = 0x2053454fu, /**< Android video texture format */
     BADGEVMS_PIXELFORMAT_MJPG         = 0x47504a4du, /**< Motion JPEG */
+
+    // Not from SDL3, the packed 12 bit YUV420 of the ESP32-P4 camera, JPEG decoder and PPA.
+    // Framebuffers in this format have an even width and height.
+    BADGEVMS_PIXELFORMAT_YUV420_ESP = 0x30323445u,
 } pixel_format_t;
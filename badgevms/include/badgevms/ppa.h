@@ -0,0 +1,57 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "compositor.h"
+#include "framebuffer.h"
+#include "orientation.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The pixel processing accelerator between buffers of your own, shared with
+// the compositor. Buffers are w * h pixels without padding between rows, from
+// malloc(), dma_buffer_alloc() or a window framebuffer, in any format
+// window_framebuffer_blit() takes. What is written to must start on a cache
+// line of 128 bytes. Framebuffers and DMA buffers do, from malloc() take 127
+// bytes more and round the pointer up.
+//
+// Every call returns once the PPA is done, so the buffers can be used right
+// away, and false for whatever the PPA can't do, which the caller then draws
+// itself. For a few small rectangles the CPU is quicker, see pixel/pixel.h.
+
+#define PPA_MIRROR_X (1 << 0)
+#define PPA_MIRROR_Y (1 << 1)
+
+// Copy src_rect to dst_rect, converting the format. It is scaled by a multiple
+// of 1/16 along each side, then rotated clockwise and mirrored as in mirror.
+// With ROTATION_ANGLE_90 or ROTATION_ANGLE_270 dst_rect lies on its side.
+bool ppa_blit(
+    framebuffer_t       *dst,
+    window_rect_t        dst_rect,
+    framebuffer_t const *src,
+    window_rect_t        src_rect,
+    rotation_angle_t     rotation,
+    int                  mirror
+);
+// Blend src_rect over dst at dst_pos by its alpha channel times alpha, at its own size
+bool ppa_blend(
+    framebuffer_t *dst, window_coords_t dst_pos, framebuffer_t const *src, window_rect_t src_rect, uint8_t alpha
+);
+// color is ARGB8888, the alpha is only stored in framebuffers that have it
+bool ppa_fill(framebuffer_t *dst, window_rect_t rect, uint32_t color);
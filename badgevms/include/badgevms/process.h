@@ -28,10 +28,59 @@ pid_t process_create(char const *path, size_t stack_size, int argc, char **argv)
 // Create a thread with from thead_entry(void* user_data), the user_data to send, and the stack size for the new thread.
 pid_t thread_create(void (*thread_entry)(void *user_data), void *user_data, uint16_t stack_size);
 
+typedef enum {
+    THREAD_PRIORITY_LOW    = -1, // Background work, runs when the rest of the application has nothing to do
+    THREAD_PRIORITY_NORMAL = 0,  // Same as the main thread
+    THREAD_PRIORITY_HIGH   = 1,  // Same as a foreground fullscreen application
+} thread_priority_t;
+
+#define THREAD_CORE_ANY -1
+
+typedef struct {
+    uint16_t          stack_size;
+    thread_priority_t priority;
+    // THREAD_CORE_ANY or a core number. Applications share core 1, both cores
+    // use the same MMU and it can only hold one address space at a time, so
+    // asking for core 0 fails.
+    int               core;
+} thread_attr_t;
+
+// Like thread_create(), with a priority and core affinity. Returns -1 if the attributes can't be honoured.
+pid_t thread_create_attr(void (*thread_entry)(void *user_data), void *user_data, thread_attr_t const *attr);
+
+// Logical names of this process and its threads, looked up before the system
+// wide ones like DEFINE/PROCESS on VMS. Not passed on to child processes.
+// target can be a search list, like "SD0:[DATA], FLASH0:[DATA]". Return 0, or
+// -1 if the name couldn't be set or didn't exist.
+int process_logical_name_set(char const *logical_name, char const *target);
+int process_logical_name_del(char const *logical_name);
+
 // Wait for a child process or thread to terminate. The return value of wait is either -1 if the timeout passed, and
 // blocking was requested, or the pid of the child process that terminated.
 pid_t wait(bool block, uint32_t timeout_msec);
 
+// Wake a thread of this process from thread_notify_wait(). A notification sent
+// while it isn't waiting is kept for its next wait. False if pid is not a
+// thread of this process.
+bool thread_notify(pid_t pid);
+// Block until thread_notify() was called for me, false if timeout_msec passed
+// first. UINT32_MAX waits forever.
+bool thread_notify_wait(uint32_t timeout_msec);
+
+// False if pid is not a running thread of this process
+bool thread_alive(pid_t pid);
+
+// Sleep while *address holds expected, until futex_wake() for address or
+// timeout_msec, UINT32_MAX waits forever. The check and going to sleep are
+// atomic. Also returns when a thread of the process dies, so that its locks
+// can be recovered, and callers must check the word again. Returns 0 when woken
+// and -1 with errno EAGAIN if *address didn't hold expected, ETIMEDOUT or
+// EINVAL for an address outside the process. See sync/sync.h for locks built
+// on these.
+int futex_wait(int *address, int expected, uint32_t timeout_msec);
+// Wake up to count threads sleeping on address, returns how many
+int futex_wake(int *address, int count);
+
 // Lower my priority
 void task_priority_lower();
 
@@ -40,3 +89,160 @@ void task_priority_restore();
 
 // Get the total number of running tasks.
 uint32_t get_num_tasks();
+
+#define PROCESS_NAME_MAX 32
+
+// Memory charged to a process. Threads of a process share its address space
+// and report the same memory, with their own stack.
+typedef struct {
+    pid_t  pid;
+    pid_t  parent;
+    bool   is_thread;
+    char   name[PROCESS_NAME_MAX]; // File name of the program, empty for threads
+    size_t stack_size;
+    size_t heap_pages;             // Mapped for the heap and the program image
+    size_t heap_peak_pages;        // Most heap pages mapped at once
+    size_t shared_pages;           // Part of heap_pages that is shared with other instances of the program
+    size_t heap_used;              // Bytes up to the break, what malloc() has taken from the heap
+    size_t heap_used_peak;
+    size_t framebuffer_pages;      // Of windows and overlays
+    size_t dma_pages;              // Of dma_buffer_alloc()
+    size_t fast_bytes;             // Internal SRAM of malloc_fast()
+    size_t open_files;
+    size_t kernel_objects;         // Everything in the resource table, open files included
+    bool   suspended;              // By process_suspend()
+    size_t hibernated_pages;       // Part of heap_pages that is on the SD card
+} process_info_t;
+
+// Fill info for a running process or thread, false if there is none with that pid
+bool   process_info_get(pid_t pid, process_info_t *info);
+// Fill up to max pids of running processes and threads, returns how many there are
+size_t process_list(pid_t *pids, size_t max);
+
+// Accesses counted by the caches. Instruction fetches and data accesses of a
+// core go through its L1 caches, misses there are read from internal SRAM or
+// the shared L2 cache, and misses in L2 from PSRAM or flash. Many L2 misses
+// per instruction fetch mean the program waits on PSRAM rather than
+// computing, compare two snapshots around the code in question.
+typedef struct {
+    uint64_t l1i_hits;
+    uint64_t l1i_misses;
+    uint64_t l1d_hits;
+    uint64_t l1d_misses;
+    uint64_t l2_hits;
+    uint64_t l2_misses;
+} cache_counters_t;
+
+// Where a process or thread spent its CPU time, counted from the scheduler
+typedef struct {
+    pid_t            pid;
+    uint64_t         run_us;
+    uint64_t         remap_cycles;         // Spent switching the MMU to its address space, not part of run_us
+    uint32_t         remaps;               // Times it was switched in and its address space wasn't mapped
+    uint32_t         switches_voluntary;   // Blocked, slept or exited
+    uint32_t         switches_involuntary; // Preempted
+    cache_counters_t cache;                // While it ran, the switch to it included
+} process_stats_t;
+
+bool process_stats_get(pid_t pid, process_stats_t *stats);
+
+// How long system calls took, per process, grouped by what they wait on.
+// Timing every call costs a little, so it is off until
+// process_syscall_stats_enable(). Calls made meanwhile keep their counts when
+// it is switched off again, compare two snapshots.
+typedef enum {
+    SYSCALL_OPEN,    // open(), opendir()
+    SYSCALL_CLOSE,   // close(), closedir()
+    SYSCALL_READ,    // read(), readv(), pread()
+    SYSCALL_WRITE,   // write(), writev(), pwrite()
+    SYSCALL_STAT,    // stat(), fstat()
+    SYSCALL_READDIR,
+    SYSCALL_MALLOC,  // malloc(), calloc(), realloc()
+    SYSCALL_FREE,
+    SYSCALL_SOCKET,  // socket(), bind(), listen(), connect(), accept()
+    SYSCALL_SEND,    // send(), sendto(), sendmsg(), sendmmsg(), sendfile()
+    SYSCALL_RECV,    // recv(), recvfrom(), recvmsg(), recvmmsg()
+    SYSCALL_POLL,    // poll(), select()
+    SYSCALL_MAX,
+} syscall_t;
+
+// buckets[0] counts calls under 1 us, buckets[i] those from 2^(i-1) up to 2^i
+// us, the last one everything longer
+#define SYSCALL_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    uint32_t calls;
+    uint64_t total_us;
+    uint32_t buckets[SYSCALL_HISTOGRAM_BUCKETS];
+} syscall_histogram_t;
+
+typedef struct {
+    pid_t               pid;
+    syscall_histogram_t syscalls[SYSCALL_MAX];
+} syscall_stats_t;
+
+// For every process at once
+void process_syscall_stats_enable(bool enable);
+// All zero for a process without timed calls. False if pid is not running.
+bool process_syscall_stats_get(pid_t pid, syscall_stats_t *stats);
+
+typedef enum {
+    PROCESS_IMAGE_LOADED,    // Read and relocated
+    PROCESS_IMAGE_CACHED,    // Mapped from another instance of the program
+    PROCESS_IMAGE_PRELINKED, // Read as an earlier launch relocated it
+} process_image_t;
+
+// Where the time went starting a process, in microseconds. Stages a launch
+// skipped, like relocation of a cached image, take 0. Also written to the
+// console when main() is called.
+typedef struct {
+    pid_t           pid;
+    process_image_t image;
+    uint32_t        spawn_us;         // Until it runs, from process_create()
+    uint32_t        open_us;          // Opening its file, reading the layout and hashing it
+    uint32_t        map_us;           // Mapping its image and shared libraries
+    uint32_t        read_us;          // Reading and decompressing segments, symbols and relocations
+    uint32_t        relocate_us;      // Relocating, without the reading
+    uint32_t        relocations;
+    uint32_t        cache_us;         // Writing the prelinked image and handing it to the image cache
+    uint32_t        writeback_us;     // Writing back and invalidating the caches before main()
+    uint32_t        total_us;         // From process_create() until main()
+    uint32_t        first_present_us; // From process_create() until it first presented a window, 0 until then
+} process_launch_t;
+
+// False if pid is not running
+bool process_launch_get(pid_t pid, process_launch_t *launch);
+
+// Stop every thread of the process pid belongs to until process_resume(), so
+// an application can stay open in the background without taking CPU time. Its
+// windows leave the screen meanwhile. With hibernate its private memory is also
+// written to the SD card and freed, resuming reads it back. That is skipped,
+// and the process stays in memory, without a card or if it is not possible
+// right now. A process that suspends itself is never hibernated and returns
+// once it is resumed. False if pid is not running or already suspended. A
+// thread that is suspended in the middle of a system call keeps the kernel
+// locks it holds, like one that is killed.
+bool process_suspend(pid_t pid, bool hibernate);
+// False if pid is not suspended or there is not enough memory to bring it back
+bool process_resume(pid_t pid);
+
+// End a child process of mine and its threads. Its memory, files and windows are
+// freed and wait() returns it, as if it returned from main(). Threads in the
+// middle of a system call keep the kernel locks they hold, so this is for
+// programs that are known to be idle, like in a benchmark. False if pid is not a
+// child process of mine.
+bool process_kill(pid_t pid);
+
+#define CPU_STATS_MAX_CORES 2
+
+// Compare two snapshots for the load, user_us grows by the time spent in
+// applications on each core.
+typedef struct {
+    int64_t          timestamp_us; // Since boot
+    uint32_t         cpu_hz;       // For remap_cycles
+    int              num_cores;
+    uint64_t         user_us[CPU_STATS_MAX_CORES];
+    cache_counters_t cache[CPU_STATS_MAX_CORES]; // Everything on each core, the kernel included
+} cpu_stats_t;
+
+void cpu_stats_get(cpu_stats_t *stats);
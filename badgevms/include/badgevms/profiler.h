@@ -0,0 +1,46 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+// A sampling profiler. Every scheduler tick on the application core the
+// program counter of the running task is recorded if it belongs to the
+// profiled process, one of its threads included. One profile runs at a time.
+typedef struct {
+    uint32_t vaddr; // In the ELF file of the program, feed it to addr2line with the unstripped binary
+    uint32_t count;
+} profiler_sample_t;
+
+typedef struct {
+    uint32_t samples; // Ticks the process was running
+    uint32_t kernel;  // Part of samples that was outside the program, in a system call or the C library
+    uint32_t dropped; // Part of samples that didn't fit in the histogram
+    uint32_t num_pcs; // Distinct program counters in the histogram
+} profiler_summary_t;
+
+// False if pid is not a running program or another profile is running. A
+// program that was just created may still be loading, try again a bit later.
+bool   profiler_start(pid_t pid);
+// The histogram stays around until the next profiler_start()
+void   profiler_stop(profiler_summary_t *summary);
+// Copy up to max entries of the histogram, returns how many were copied
+size_t profiler_histogram(profiler_sample_t *samples, size_t max);
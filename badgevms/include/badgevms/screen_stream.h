@@ -0,0 +1,62 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What the compositor shows, encoded to H.264 by the hardware encoder, for
+// demos and performance lab runs. Frames come from a YUV420 screen capture,
+// so nothing else can capture the screen while a stream runs. The stream is
+// sent as RTP over UDP, or written to a file as an Annex B elementary stream
+// that ffmpeg and VLC play as .h264.
+//
+// For RTP the payload type is 96 and the clock 90 kHz, a receiver needs an
+// SDP like:
+//
+//   v=0
+//   c=IN IP4 0.0.0.0
+//   m=video <port> RTP/AVP 96
+//   a=rtpmap:96 H264/90000
+//
+// With timing on, every frame is preceded by a user data SEI message with
+// SCREEN_STREAM_TIMING_UUID and a screen_stream_timing_t, little endian.
+#define SCREEN_STREAM_TIMING_UUID "BadgeVMS-timing1"
+
+typedef struct {
+    int64_t  captured_us; // Since boot, when the frame was picked up
+    uint32_t sequence;    // Of the captured frame, gaps are frames the stream skipped
+    uint32_t interval_us; // Since the previous frame of the stream
+    uint32_t encode_us;   // The encoder took for it
+} __attribute__((packed)) screen_stream_timing_t;
+
+typedef struct {
+    uint16_t size;    // Frames are scaled down in 1/8 steps to fit size x size, 0 for the whole screen
+    uint16_t fps;     // At most the panel refresh rate, 0 for 30
+    uint32_t bitrate; // Target in bits per second, 0 for 1 Mbit/s
+    uint16_t gop;     // Frames from one key frame to the next, 0 for fps
+    bool     timing;  // Add frame timing SEI messages
+} screen_stream_config_t;
+
+// Send the stream to host:port, config may be NULL. Only one stream runs at a
+// time, returns false if one is running or anything could not be set up.
+bool screen_stream_start_rtp(char const *host, uint16_t port, screen_stream_config_t const *config);
+// Write the stream to path, for example on SD0:, replacing what was there
+bool screen_stream_start_file(char const *path, screen_stream_config_t const *config);
+// Stop the stream and close the file or socket, nothing happens without one
+void screen_stream_stop(void);
@@ -0,0 +1,54 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+// Small values an application keeps between runs, like settings and high
+// scores. Every application has a store of its own, which survives updates of
+// the application and goes when it is removed. Values are kept in memory,
+// setting one is a copy. Changes are written in the background a little
+// later, together, by appending them to a log that is rewritten once it grew
+// well past what is still set.
+//
+// Only for processes launched as an application, see application_launch().
+#define SETTINGS_KEY_MAX   32   // Including the terminating 0
+#define SETTINGS_VALUE_MAX 1024 // In bytes
+
+// False if the key or value is too long, the application has too many settings
+// already, or out of memory
+bool    settings_set(char const *key, void const *value, size_t size);
+// The size of the value, up to size bytes of it are copied to value. -1 if the
+// key isn't set.
+ssize_t settings_get(char const *key, void *value, size_t size);
+// False if the key wasn't set
+bool    settings_remove(char const *key);
+
+bool    settings_set_int(char const *key, int64_t value);
+// fallback if the key isn't set or isn't an integer
+int64_t settings_get_int(char const *key, int64_t fallback);
+bool    settings_set_string(char const *key, char const *value);
+// Cut short to fit size, always terminated. False if the key isn't set.
+bool    settings_get_string(char const *key, char *value, size_t size);
+
+// Write what changed now and wait for it, before the power may go away
+bool settings_flush(void);
@@ -0,0 +1,48 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Receiving without a copy. The bytes are left in the buffers the network
+// stack received them into, and the view points at them until it is released.
+// Those buffers come out of the memory the network stack receives everything
+// into, so views should be released soon. Views a process still holds when it
+// exits are released then.
+#define SOCKET_VIEW_IOV_MAX 8
+
+typedef struct {
+    struct iovec            iov[SOCKET_VIEW_IOV_MAX]; // Read only
+    int                     iovcnt;
+    size_t                  len;   // Of all of iov
+    int                     flags; // MSG_TRUNC if a datagram didn't fit in iov, the rest is lost
+    struct sockaddr_storage from;  // Sender of a datagram, ss_family is AF_UNSPEC on a stream
+    void                   *handle;
+} socket_view_t;
+
+// What recv() would return next on the socket, without the copy. On a stream
+// the rest of a long read is left for the next call. Returns view->len, which
+// is 0 at the end of a stream, or -1 with errno. Only MSG_DONTWAIT is taken
+// from flags.
+ssize_t socket_recv_view(int fd, socket_view_t *view, int flags);
+// Hand the buffers of view back to the network stack. Also for a view that
+// holds nothing after the end of a stream or an error.
+void    socket_view_release(socket_view_t *view);
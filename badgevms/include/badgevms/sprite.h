@@ -0,0 +1,52 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Images converted when the application is built, see ASSETS in build_app()
+// and misc/convert_sprite.py. A sprite_header_t, then width * height
+// BADGEVMS_PIXELFORMAT_RGB565 pixels, then with SPRITE_FLAG_ALPHA width *
+// height bytes of alpha. Rows have no padding, everything is little endian.
+#define SPRITE_MAGIC      0x52505342 // "BSPR"
+#define SPRITE_FLAG_ALPHA (1 << 0)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t width;
+    uint16_t height;
+    uint16_t flags;
+    uint16_t reserved[3];
+} sprite_header_t;
+
+__attribute__((always_inline)) inline static uint16_t const *sprite_pixels(sprite_header_t const *sprite) {
+    return (uint16_t const *)(sprite + 1);
+}
+
+// NULL for an opaque sprite
+__attribute__((always_inline)) inline static uint8_t const *sprite_alpha(sprite_header_t const *sprite) {
+    if (!(sprite->flags & SPRITE_FLAG_ALPHA)) {
+        return NULL;
+    }
+    return (uint8_t const *)(sprite_pixels(sprite) + (size_t)sprite->width * sprite->height);
+}
+
+__attribute__((always_inline)) inline static size_t sprite_size(sprite_header_t const *sprite) {
+    size_t pixels = (size_t)sprite->width * sprite->height;
+    return sizeof(sprite_header_t) + pixels * 2 + ((sprite->flags & SPRITE_FLAG_ALPHA) ? pixels : 0);
+}
@@ -0,0 +1,43 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "framebuffer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    TEXT_FONT_SMALL, // 5x7, the window title font. Upper case, digits and some punctuation
+    TEXT_FONT_LARGE, // 12x24, printable ASCII
+} text_font_t;
+
+// Character cells, text advances by the cell width
+#define TEXT_FONT_SMALL_WIDTH  6
+#define TEXT_FONT_SMALL_HEIGHT 7
+#define TEXT_FONT_LARGE_WIDTH  12
+#define TEXT_FONT_LARGE_HEIGHT 24
+
+int text_width(text_font_t font, char const *text);
+
+// Draw text with its top left corner at x, y in screen orientation, clipped to
+// the framebuffer. Only lit pixels are written, in color, so the framebuffer
+// must be RGB565 or BGR565. Set native for the framebuffer of a window created
+// with WINDOW_FLAG_NATIVE_ORIENTATION.
+void text_draw(
+    framebuffer_t *framebuffer, text_font_t font, int x, int y, char const *text, uint16_t color, bool native
+);
@@ -0,0 +1,65 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "compositor.h"
+#include "hrtimer.h"
+#include "io_ring.h"
+
+#include <stdint.h>
+
+// Wait for whichever of a set of sources becomes ready first, so one thread
+// can serve sockets and its windows without polling each with a timeout.
+// Readiness is only reported, nothing is consumed: read the socket, take the
+// events with window_event_poll(), the expirations with hrtimer_wait(timer, 0),
+// the child with wait(), the completions with io_ring_complete() and the
+// transfers with curl_multi_perform(). poll() and select() work the same way on
+// file descriptors.
+typedef enum {
+    WAIT_SOURCE_NONE, // Skipped
+    WAIT_SOURCE_FD,
+    WAIT_SOURCE_WINDOW,
+    WAIT_SOURCE_TIMER,
+    WAIT_SOURCE_CHILD, // Any child of the calling thread exited
+    WAIT_SOURCE_IO,    // Completions in the ring
+    WAIT_SOURCE_CURL,  // curl_multi_perform() has something to do
+} wait_source_type_t;
+
+// Events of WAIT_SOURCE_FD, the other sources are readable or not
+#define WAIT_READABLE 0x1
+#define WAIT_WRITABLE 0x2
+// Only in revents
+#define WAIT_ERROR    0x4
+#define WAIT_INVALID  0x8 // A file descriptor that is not open, a NULL window, ring or multi handle, or a timer of another process
+
+typedef struct wait_source {
+    wait_source_type_t type;
+    union {
+        int             fd;
+        window_handle_t window;
+        hrtimer_t      *timer;
+        io_ring_t      *ring;
+        void           *curl_multi; // A CURLM
+    };
+    uint16_t events;
+    uint16_t revents; // Set by wait_any()
+} wait_source_t;
+
+// Returns how many sources are ready, 0 if timeout_msec passed first and -1
+// with errno set on failure. UINT32_MAX waits forever, 0 only checks. Files,
+// and devices that can't say when they are, are always ready.
+int wait_any(wait_source_t *sources, int num_sources, uint32_t timeout_msec);
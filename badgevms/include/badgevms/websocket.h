@@ -0,0 +1,62 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+// WebSocket client connections, to ws:// and wss:// URLs. A connection is a
+// file descriptor, wait for it with wait_any() or poll() like a socket and
+// close() it when done, which says goodbye to the server first. Pings from the
+// server are answered while receiving. write() sends a binary message and
+// read() returns the payload of whatever messages come in, for message
+// boundaries and text use websocket_send() and websocket_recv().
+//
+// One thread at a time sends or receives on a connection, a receive that
+// blocks holds up sends meanwhile. Wait until the connection is readable
+// first to keep it short.
+typedef enum {
+    WEBSOCKET_CONTINUATION = 0x0,
+    WEBSOCKET_TEXT         = 0x1,
+    WEBSOCKET_BINARY       = 0x2,
+    WEBSOCKET_CLOSE        = 0x8,
+    WEBSOCKET_PING         = 0x9,
+    WEBSOCKET_PONG         = 0xA,
+} websocket_opcode_t;
+
+typedef struct {
+    char const *subprotocol; // Asked for with Sec-WebSocket-Protocol, NULL for none
+    char const *headers;     // More request headers, each ending in \r\n, NULL for none
+    uint32_t    timeout_ms;  // For connecting and for each send, 0 for 10 seconds
+} websocket_config_t;
+
+// Connect to url, config may be NULL. Returns a file descriptor, or -1 with
+// errno set.
+int     websocket_connect(char const *url, websocket_config_t const *config);
+// Send len bytes of data as one WEBSOCKET_TEXT or WEBSOCKET_BINARY message, or
+// as a WEBSOCKET_PING of up to 125 bytes. Returns len, or -1 with errno set.
+ssize_t websocket_send(int fd, websocket_opcode_t opcode, void const *data, size_t len);
+// Receive the next part of a message straight into buf, up to len bytes.
+// *opcode is set to the type of the message, WEBSOCKET_TEXT or WEBSOCKET_BINARY,
+// and *end to whether this part is the last of it. Returns the size of the
+// part, 0 with *opcode set to WEBSOCKET_CLOSE once the server closed the
+// connection, or -1 with errno set. Blocks until something arrives.
+ssize_t websocket_recv(int fd, void *buf, size_t len, websocket_opcode_t *opcode, bool *end);
@@ -88,12 +88,36 @@ wifi_connection_status_t wifi_get_connection_status();
 wifi_station_handle      wifi_get_connection_station();
 wifi_connection_status_t wifi_connect();
 wifi_connection_status_t wifi_disconnect();
+// Of the access point we are connected to, 0 if there is none. Asked of the
+// wifi co-processor every time, which makes it a measure of how long a
+// request to it takes as well.
+int                      wifi_get_rssi();
 
 void wifi_scan_free_station(wifi_station_handle station);
 
+// Scans unless the results are a few seconds old
 int                 wifi_scan_get_num_results();
 wifi_station_handle wifi_scan_get_result(int num);
 
+// The wifi driver scans in the background every minute by default, unless
+// applications keep the CPU busy or memory is short. A scan that finds other
+// access points is sent to all windows as EVENT_WIFI_SCAN.
+
+// The results of the last scan, without scanning
+int      wifi_scan_get_cached_num_results();
+// Of the last scan in milliseconds, UINT32_MAX if there was none
+uint32_t wifi_scan_get_age();
+// Every msec milliseconds, 0 for no background scans
+void     wifi_scan_set_interval(uint32_t msec);
+
+// The wifi co-processor sleeps in between beacons to save power, which adds
+// tens to hundreds of milliseconds to a round trip. While the process holds a
+// request and has the focus it stays awake. Requests are counted, each one is
+// undone by a wifi_release_low_latency() and all of them when the process
+// exits. False if too many processes hold one already.
+bool wifi_request_low_latency();
+void wifi_release_low_latency();
+
 char const      *wifi_station_get_ssid(wifi_station_handle station);
 mac_address_t   *wifi_station_get_bssid(wifi_station_handle station);
 int              wifi_station_get_primary_channel(wifi_station_handle station);
@@ -25,7 +25,9 @@ extern "C" {
 #include <stdint.h>
 
 typedef void CURL;
+typedef void CURLM;
 typedef int  CURLcode;
+typedef int  CURLMcode;
 typedef int  CURLoption;
 
 typedef enum {
@@ -97,12 +99,18 @@ typedef enum {
     CURLOPT_PROXYPORT         = 59,
     CURLOPT_HTTPAUTH          = 107,
     CURLOPT_PROXYAUTH         = 111,
-    CURLOPT_BUFFERSIZE        = 98,
+    CURLOPT_BUFFERSIZE        = 98, // Receive buffer, and the write callback gets the response in pieces this large
+    CURLOPT_RESUME_FROM       = 21, // Ask for the rest from this offset, -1 for the size of CURLOPT_DOWNLOAD_TO_PATH
+    // BadgeVMS extension. Write the response to the file at this path in large
+    // blocks instead of calling the write callback. Error responses leave the
+    // file alone, a 206 to CURLOPT_RESUME_FROM continues it, others replace it.
+    CURLOPT_DOWNLOAD_TO_PATH  = 19001,
 } curl_easy_option_t;
 
 typedef enum {
     CURLINFO_RESPONSE_CODE           = 0x200002,
     CURLINFO_CONTENT_LENGTH_DOWNLOAD = 0x300003,
+    CURLINFO_SIZE_DOWNLOAD           = 0x300008,
     CURLINFO_CONTENT_TYPE            = 0x100012,
     CURLINFO_EFFECTIVE_URL           = 0x100001
 } curl_easy_info_t;
@@ -152,6 +160,76 @@ void               curl_slist_free_all(struct curl_slist *list);
 CURLcode curl_global_init(long flags);
 void     curl_global_cleanup(void);
 
+// The multi interface runs the transfers of several easy handles at once, in
+// worker threads of the process. Their callbacks are still only called from
+// curl_multi_perform(), by the thread that calls it. Wait for news with
+// curl_multi_wait() or curl_multi_poll(), or together with windows and timers
+// with WAIT_SOURCE_CURL, see badgevms/wait.h.
+typedef enum {
+    CURLM_CALL_MULTI_PERFORM = -1,
+    CURLM_OK                 = 0,
+    CURLM_BAD_HANDLE,
+    CURLM_BAD_EASY_HANDLE,
+    CURLM_OUT_OF_MEMORY,
+    CURLM_INTERNAL_ERROR,
+    CURLM_BAD_SOCKET,
+    CURLM_UNKNOWN_OPTION,
+    CURLM_ADDED_ALREADY,
+} curl_multi_error_t;
+
+typedef enum {
+    CURLMSG_NONE,
+    CURLMSG_DONE, // A transfer finished, result is its CURLcode
+    CURLMSG_LAST
+} CURLMSG;
+
+typedef struct CURLMsg {
+    CURLMSG msg;
+    CURL   *easy_handle;
+    union {
+        void    *whatever;
+        CURLcode result;
+    } data;
+} CURLMsg;
+
+// For the extra file descriptors of curl_multi_wait()
+#define CURL_WAIT_POLLIN  0x0001
+#define CURL_WAIT_POLLPRI 0x0002
+#define CURL_WAIT_POLLOUT 0x0004
+
+struct curl_waitfd {
+    int   fd;
+    short events;
+    short revents;
+};
+
+CURLM      *curl_multi_init(void);
+// Start the transfer of curl. Remove it before changing its options, even
+// after it finished.
+CURLMcode   curl_multi_add_handle(CURLM *multi, CURL *curl);
+// Waits for the transfer of curl if it is running
+CURLMcode   curl_multi_remove_handle(CURLM *multi, CURL *curl);
+// Hand what arrived to the callbacks. running_handles is set to the transfers
+// not finished yet.
+CURLMcode   curl_multi_perform(CURLM *multi, int *running_handles);
+// Wait until curl_multi_perform() has something to do, an extra file
+// descriptor is ready, curl_multi_wakeup() is called or timeout_ms passed.
+// numfds is set to how many of the extra file descriptors are ready.
+CURLMcode   curl_multi_wait(
+    CURLM *multi, struct curl_waitfd extra_fds[], unsigned int extra_nfds, int timeout_ms, int *numfds
+);
+// The same as curl_multi_wait()
+CURLMcode   curl_multi_poll(
+    CURLM *multi, struct curl_waitfd extra_fds[], unsigned int extra_nfds, int timeout_ms, int *numfds
+);
+CURLMcode   curl_multi_wakeup(CURLM *multi);
+// The next finished transfer, NULL if there is none. msgs_in_queue is set to
+// how many are left.
+CURLMsg    *curl_multi_info_read(CURLM *multi, int *msgs_in_queue);
+// Removes the easy handles still added
+CURLMcode   curl_multi_cleanup(CURLM *multi);
+char const *curl_multi_strerror(CURLMcode error);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,9 +16,13 @@
 
 
 #include "badgevms/process.h"
+#include "boot_profile_private.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "image_cache.h"
 #include "memory.h"
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -32,6 +36,8 @@
 #include <stdlib.h>
 
 #include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <time.h>
 
 extern uint8_t init_toml_start[] asm("_binary_init_toml_start");
@@ -39,6 +45,11 @@ extern size_t  init_toml_size asm("init_toml_length");
 
 #define TAG "init"
 
+// The parsed init configuration is kept here, see init_cache_load()
+#define INIT_CACHE_NVS_NAMESPACE "badgevms_initc"
+#define INIT_CACHE_NVS_KEY       "config"
+#define INIT_CACHE_VERSION       1
+
 typedef struct {
     char    *name;
     char    *path;
@@ -62,12 +73,55 @@ typedef struct {
     size_t         count;
 } startup_config_t;
 
+// What the cached configuration was parsed from
+typedef struct {
+    uint32_t version;
+    uint32_t flash_crc; // Of the init.toml built in, which FLASH0: is kept at
+    uint32_t sd_crc;
+    uint32_t sd_size; // UINT32_MAX without SD0:init.toml
+    int64_t  sd_mtime;
+} init_cache_key_t;
+
+// Followed by the log levels, a level byte and a string each, then the apps
+typedef struct {
+    init_cache_key_t key;
+    uint16_t         num_log_levels;
+    uint16_t         num_apps;
+} init_cache_header_t;
+
+typedef struct {
+    uint32_t stack_size;
+    uint32_t start_every;
+    uint32_t start_delay;
+    uint8_t  restart_on_failure;
+    uint8_t  run_once;
+    uint16_t argc;
+    // Followed by name, path, application and argv as strings
+} init_cache_app_t;
+
+// A growing blob to store, once something fails to fit it is not stored
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   capacity;
+    size_t   count; // Of the entries, for the caller to keep
+    bool     failed;
+} init_cache_writer_t;
+
+typedef struct {
+    uint8_t const *data;
+    size_t         size;
+    size_t         pos;
+    bool           failed;
+} init_cache_reader_t;
+
 void free_app(startup_app_t *app) {
     if (!app)
         return;
 
     free(app->name);
     free(app->path);
+    free(app->application);
 
     if (app->argv) {
         for (int i = 0; i < app->argc; i++) {
@@ -162,7 +216,101 @@ int parse_app(toml_datum_t app_table, startup_app_t *app) {
     return 0;
 }
 
-int load_config(char const *filename, startup_config_t *config) {
+static void cache_put(init_cache_writer_t *w, void const *data, size_t size) {
+    if (w->failed || !size) {
+        return;
+    }
+
+    if (w->size + size > w->capacity) {
+        size_t   capacity = MAX(w->capacity * 2, w->size + size + 256);
+        uint8_t *grown    = realloc(w->data, capacity);
+        if (!grown) {
+            w->failed = true;
+            return;
+        }
+        w->data     = grown;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->size, data, size);
+    w->size += size;
+}
+
+// Strings are a 16 bit length plus one, 0 for NULL, then the characters
+static void cache_put_string(init_cache_writer_t *w, char const *str) {
+    size_t   length = str ? strlen(str) : 0;
+    uint16_t tag    = str ? length + 1 : 0;
+    if (length >= UINT16_MAX) {
+        w->failed = true;
+        return;
+    }
+    cache_put(w, &tag, sizeof(tag));
+    cache_put(w, str, length);
+}
+
+static bool cache_get(init_cache_reader_t *r, void *out, size_t size) {
+    if (r->failed || r->size - r->pos < size) {
+        r->failed = true;
+        return false;
+    }
+    memcpy(out, r->data + r->pos, size);
+    r->pos += size;
+    return true;
+}
+
+// False when the blob ends early, *out is NULL for a NULL string
+static bool cache_get_string(init_cache_reader_t *r, char **out) {
+    uint16_t tag;
+
+    *out = NULL;
+    if (!cache_get(r, &tag, sizeof(tag))) {
+        return false;
+    }
+    if (!tag) {
+        return true;
+    }
+    if (r->size - r->pos < tag - 1) {
+        r->failed = true;
+        return false;
+    }
+    *out = strndup((char const *)r->data + r->pos, tag - 1);
+    r->pos += tag - 1;
+    return true;
+}
+
+// The [log] table sets the run time level of log tags, like why_open = "verbose".
+// Only what the build compiled in can be shown, see the BadgeVMS logging menu.
+// Whatever was set is also added to cache.
+static void parse_log_levels(toml_datum_t log_table, init_cache_writer_t *cache) {
+    static char const *const levels[] = {"none", "error", "warn", "info", "debug", "verbose"};
+
+    for (int i = 0; i < log_table.u.tab.size; i++) {
+        char const  *tag   = log_table.u.tab.key[i];
+        toml_datum_t value = log_table.u.tab.value[i];
+
+        int level = -1;
+        if (value.type == TOML_STRING) {
+            for (int j = 0; j < sizeof(levels) / sizeof(levels[0]); j++) {
+                if (strcmp(value.u.s, levels[j]) == 0) {
+                    level = j;
+                }
+            }
+        }
+
+        if (level < 0) {
+            ESP_LOGW(TAG, "Unknown log level for %s", tag);
+            continue;
+        }
+        esp_log_level_set(tag, level);
+
+        uint8_t stored = level;
+        cache_put(cache, &stored, sizeof(stored));
+        cache_put_string(cache, tag);
+        ++cache->count;
+    }
+}
+
+// Log levels that were set are added to cache
+int load_config(char const *filename, startup_config_t *config, init_cache_writer_t *cache) {
     FILE *fp = why_fopen(filename, "r");
     if (!fp) {
         ESP_LOGW(TAG, "Cannot open %s", filename);
@@ -177,6 +325,11 @@ int load_config(char const *filename, startup_config_t *config) {
         return -1;
     }
 
+    toml_datum_t log_table = toml_get(result.toptab, "log");
+    if (log_table.type == TOML_TABLE) {
+        parse_log_levels(log_table, cache);
+    }
+
     toml_datum_t apps_array = toml_get(result.toptab, "apps");
     if (apps_array.type != TOML_ARRAY) {
         toml_free(result);
@@ -249,6 +402,11 @@ pid_t start_app(startup_app_t *app) {
     }
 
     printf("Started %s (%s) pid %u\n", app->name, app->path, pid);
+    static bool launched;
+    if (!launched) {
+        boot_profile_mark("first_launch");
+        launched = true;
+    }
     if (app->application) {
         task_set_application_uid(pid, app->application);
     }
@@ -353,6 +511,197 @@ bool update_flash0_init() {
     return true;
 }
 
+static bool read_file(char const *filename, size_t size, uint8_t **out) {
+    FILE *fp = why_fopen(filename, "r");
+    if (!fp) {
+        return false;
+    }
+
+    *out = malloc(MAX(size, 1));
+    if (!*out || why_fread(*out, 1, size, fp) != size) {
+        free(*out);
+        *out = NULL;
+        why_fclose(fp);
+        return false;
+    }
+    why_fclose(fp);
+    return true;
+}
+
+// FLASH0:init.toml is the one built in, it is only written again when it is
+// not. Returns the key of the files the configuration comes from.
+static init_cache_key_t init_config_files(void) {
+    init_cache_key_t key = {
+        .version   = INIT_CACHE_VERSION,
+        .flash_crc = esp_rom_crc32_le(0, init_toml_start, init_toml_size),
+        .sd_size   = UINT32_MAX,
+    };
+
+    struct stat st;
+    uint8_t    *data    = NULL;
+    bool        loaded  = why_stat("FLASH0:init.toml", &st) == 0 && st.st_size == init_toml_size &&
+                   read_file("FLASH0:init.toml", init_toml_size, &data);
+    if (!loaded || memcmp(data, init_toml_start, init_toml_size)) {
+        update_flash0_init();
+    }
+    free(data);
+
+    // The time alone can't be trusted, files written before the clock is set
+    // all get the same one
+    data = NULL;
+    if (why_stat("SD0:init.toml", &st) == 0 && st.st_size < UINT32_MAX &&
+        read_file("SD0:init.toml", st.st_size, &data)) {
+        key.sd_size  = st.st_size;
+        key.sd_mtime = st.st_mtime;
+        key.sd_crc   = esp_rom_crc32_le(0, data, st.st_size);
+    }
+    free(data);
+    return key;
+}
+
+// A configuration parsed from the same files before, with its log levels set
+static bool init_cache_load(init_cache_key_t const *key, startup_config_t *config) {
+    nvs_handle_t handle;
+    size_t       size = 0;
+    uint8_t     *blob = NULL;
+
+    if (nvs_open(INIT_CACHE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    if (nvs_get_blob(handle, INIT_CACHE_NVS_KEY, NULL, &size) == ESP_OK && size >= sizeof(init_cache_header_t)) {
+        blob = malloc(size);
+        if (blob && nvs_get_blob(handle, INIT_CACHE_NVS_KEY, blob, &size) != ESP_OK) {
+            free(blob);
+            blob = NULL;
+        }
+    }
+    nvs_close(handle);
+
+    init_cache_reader_t r = {.data = blob, .size = size};
+    init_cache_header_t header;
+    if (!blob || !cache_get(&r, &header, sizeof(header)) || memcmp(&header.key, key, sizeof(*key))) {
+        free(blob);
+        return false;
+    }
+
+    for (int i = 0; i < header.num_log_levels; ++i) {
+        uint8_t level;
+        char   *tag;
+        if (!cache_get(&r, &level, sizeof(level)) || !cache_get_string(&r, &tag) || !tag) {
+            goto fail;
+        }
+        esp_log_level_set(tag, level);
+        free(tag);
+    }
+
+    config->apps = calloc(header.num_apps, sizeof(startup_app_t));
+    if (header.num_apps && !config->apps) {
+        goto fail;
+    }
+    for (int i = 0; i < header.num_apps; ++i) {
+        startup_app_t   *app = &config->apps[config->count++];
+        init_cache_app_t stored;
+        if (!cache_get(&r, &stored, sizeof(stored)) || !cache_get_string(&r, &app->name) ||
+            !cache_get_string(&r, &app->path) || !cache_get_string(&r, &app->application) || !app->name ||
+            !app->path) {
+            goto fail;
+        }
+
+        app->stack_size         = stored.stack_size;
+        app->start_every        = stored.start_every;
+        app->start_delay        = stored.start_delay;
+        app->restart_on_failure = stored.restart_on_failure;
+        app->run_once           = stored.run_once;
+        app->argc               = stored.argc;
+        app->argv               = calloc(app->argc + 1, sizeof(char *));
+        if (!app->argv) {
+            goto fail;
+        }
+        for (int j = 0; j < app->argc; ++j) {
+            if (!cache_get_string(&r, &app->argv[j])) {
+                goto fail;
+            }
+        }
+    }
+
+    free(blob);
+    return true;
+
+fail:
+    ESP_LOGW(TAG, "The cached configuration is damaged");
+    free_config(config);
+    free(blob);
+    return false;
+}
+
+static void init_cache_store(init_cache_key_t const *key, startup_config_t const *config, init_cache_writer_t *levels) {
+    init_cache_writer_t w      = {0};
+    init_cache_header_t header = {
+        .key            = *key,
+        .num_log_levels = levels->count,
+        .num_apps       = config->count,
+    };
+
+    cache_put(&w, &header, sizeof(header));
+    cache_put(&w, levels->data, levels->size);
+    for (size_t i = 0; i < config->count; ++i) {
+        startup_app_t const *app = &config->apps[i];
+
+        init_cache_app_t stored = {
+            .stack_size         = app->stack_size,
+            .start_every        = app->start_every,
+            .start_delay        = app->start_delay,
+            .restart_on_failure = app->restart_on_failure,
+            .run_once           = app->run_once,
+            .argc               = app->argc,
+        };
+        cache_put(&w, &stored, sizeof(stored));
+        cache_put_string(&w, app->name);
+        cache_put_string(&w, app->path);
+        cache_put_string(&w, app->application);
+        for (int j = 0; j < app->argc; ++j) {
+            cache_put_string(&w, app->argv[j]);
+        }
+    }
+
+    nvs_handle_t handle;
+    if (w.failed || levels->failed || nvs_open(INIT_CACHE_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to cache the configuration");
+        free(w.data);
+        return;
+    }
+    if (nvs_set_blob(handle, INIT_CACHE_NVS_KEY, w.data, w.size) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to cache the configuration");
+    }
+    nvs_close(handle);
+    free(w.data);
+}
+
+// Parsing the TOML files takes a while, so what came out of them is kept in
+// NVS until either of them changes
+static bool init_config_load(startup_config_t *config) {
+    init_cache_key_t key = init_config_files();
+    if (init_cache_load(&key, config)) {
+        ESP_LOGI(TAG, "Using the cached configuration");
+        return true;
+    }
+
+    init_cache_writer_t levels = {0};
+    printf("Loading %s\n", "FLASH0:init.toml");
+    if (load_config("FLASH0:init.toml", config, &levels) != 0) {
+        printf("FATAL: Failed to load FLASH0:init.toml\n");
+        free(levels.data);
+        return false;
+    }
+    if (key.sd_size != UINT32_MAX && load_config("SD0:init.toml", config, &levels) != 0) {
+        printf("Failed to load SD0:init.toml\n");
+    }
+
+    init_cache_store(&key, config, &levels);
+    free(levels.data);
+    return true;
+}
+
 void run_init(void) {
     nvs_handle_t nvs_handle;
     esp_err_t    err = nvs_open("badgevms_init", NVS_READWRITE, &nvs_handle);
@@ -361,19 +710,14 @@ void run_init(void) {
         return;
     }
 
-    update_flash0_init();
-
+    int64_t          start     = esp_timer_get_time();
     startup_config_t config    = {0};
     time_t           boot_time = time(NULL);
 
-    printf("Loading %s\n", "FLASH0:init.toml");
-    if (load_config("FLASH0:init.toml", &config) != 0) {
-        printf("FATAL: Failed to load FLASH0:init.toml\n");
+    if (!init_config_load(&config)) {
         return;
     }
-    if (load_config("SD0:init.toml", &config) != 0) {
-        printf("Failed to load SD0:init.toml\n");
-    }
+    boot_profile_stage("init_config", start);
 
     print_config(&config);
     printf("Initial startup phase...\n");
@@ -408,14 +752,19 @@ void run_init(void) {
 
         if (current_time - last_printed > 5) {
             size_t free_ram = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+            size_t images, image_pages;
+            image_cache_info(&images, &image_pages);
             printf(
-                "Init: Free main memory: %zi, free PSRAM pages: %zi/%zi, free framebuffer pages: %zi/%zi running "
-                "processes %lu\n",
+                "Init: Free main memory: %zi, free PSRAM pages: %zi/%zi, free framebuffer pages: %zi/%zi (largest "
+                "run %zi) cached images: %zi (%zi pages) running processes %lu\n",
                 free_ram,
                 get_free_psram_pages(),
                 get_total_psram_pages(),
                 get_free_framebuffer_pages(),
                 get_total_framebuffer_pages(),
+                get_largest_free_framebuffer_pages(),
+                images,
+                image_pages,
                 get_num_tasks()
             );
             last_printed = current_time;
@@ -0,0 +1,199 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "io_ring_private.h"
+
+#include "badgevms/jpeg.h"
+#include "badgevms/process.h"
+#include "badgevms/wait.h"
+#include "dma_mem.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "task.h"
+#include "wait_private.h"
+#include "why_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TAG "io_ring"
+
+#define IO_RING_MAX_ENTRIES 256
+#define IO_RING_STACK_SIZE  4096
+
+static void io_ring_serve(io_request_t const *request, io_completion_t *completion) {
+    task_info_t *task_info = get_task_info();
+    ssize_t      result    = -1;
+
+    switch (request->op) {
+        case IO_OP_OPEN: result = why_open(request->path, request->flags, request->mode); break;
+        case IO_OP_CLOSE: result = why_close(request->fd); break;
+        case IO_OP_READ:
+        case IO_OP_WRITE:
+            if (request->offset >= 0 && why_lseek(request->fd, request->offset, SEEK_SET) < 0) {
+                break;
+            }
+            if (request->op == IO_OP_READ) {
+                result = why_read(request->fd, request->buf, request->count);
+            } else {
+                result = why_write(request->fd, request->buf, request->count);
+            }
+            break;
+        case IO_OP_STAT:
+            if (!request->buf) {
+                task_info->_errno = EFAULT;
+            } else if (request->path) {
+                result = why_stat(request->path, request->buf);
+            } else {
+                result = why_fstat(request->fd, request->buf);
+            }
+            break;
+        case IO_OP_JPEG_DECODE:
+            result = jpeg_decode(request->buf, request->count, request->framebuffer, request->format) ? 0 : -1;
+            break;
+        case IO_OP_COPY:
+            dma_mem_copy(request->buf, request->src, request->count);
+            result = request->count;
+            break;
+        case IO_OP_FILL:
+            dma_mem_fill(request->buf, request->flags, request->count);
+            result = request->count;
+            break;
+        default: task_info->_errno = EINVAL;
+    }
+
+    completion->user_data = request->user_data;
+    completion->result    = result;
+    completion->error     = result < 0 ? task_info->_errno : 0;
+}
+
+// The ring's thread, it shares the file descriptors and memory of the process
+// so it can work on them directly
+static void io_ring_thread(void *user_data) {
+    io_ring_t *ring = user_data;
+
+    get_task_info()->detached = true;
+
+    while (!atomic_load(&ring->stop)) {
+        unsigned int head = atomic_load(&ring->sq_head);
+        if (head == atomic_load(&ring->sq_tail)) {
+            ulTaskNotifyTakeIndexed(TASK_NOTIFY_INDEX_USER, pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // io_ring_submit() keeps a completion free for every request
+        unsigned int tail = atomic_load(&ring->cq_tail);
+        io_ring_serve(&ring->sq[head & ring->mask], &ring->cq[tail & ring->mask]);
+        atomic_store(&ring->sq_head, head + 1);
+        atomic_store(&ring->cq_tail, tail + 1);
+        wait_wake_thread(&ring->waiter);
+    }
+
+    atomic_store(&ring->stopped, 1);
+    futex_wake((int *)&ring->stopped, 1);
+}
+
+io_ring_t *io_ring_create(unsigned int entries) {
+    task_info_t *task_info = get_task_info();
+
+    if (!entries || entries > IO_RING_MAX_ENTRIES) {
+        task_info->_errno = EINVAL;
+        return NULL;
+    }
+
+    unsigned int size = 1;
+    while (size < entries) {
+        size <<= 1;
+    }
+
+    io_ring_t *ring = why_malloc(sizeof(io_ring_t) + size * (sizeof(io_request_t) + sizeof(io_completion_t)));
+    if (!ring) {
+        task_info->_errno = ENOMEM;
+        return NULL;
+    }
+
+    atomic_init(&ring->sq_head, 0);
+    atomic_init(&ring->sq_tail, 0);
+    atomic_init(&ring->cq_head, 0);
+    atomic_init(&ring->cq_tail, 0);
+    atomic_init(&ring->stop, false);
+    atomic_init(&ring->stopped, 0);
+    atomic_init(&ring->waiter, (uintptr_t)NULL);
+    ring->mask = size - 1;
+    ring->cq   = (io_completion_t *)&ring->sq[size];
+
+    thread_attr_t attr = {
+        .stack_size = IO_RING_STACK_SIZE,
+        .priority   = THREAD_PRIORITY_NORMAL,
+        .core       = THREAD_CORE_ANY,
+    };
+    ring->thread = thread_create_attr(io_ring_thread, ring, &attr);
+    if (ring->thread == -1) {
+        ESP_LOGW(TAG, "Unable to start the ring's thread");
+        why_free(ring);
+        task_info->_errno = EAGAIN;
+        return NULL;
+    }
+
+    return ring;
+}
+
+void io_ring_destroy(io_ring_t *ring) {
+    if (!ring) {
+        return;
+    }
+
+    atomic_store(&ring->stop, true);
+    thread_notify(ring->thread);
+
+    // Nothing reports its exit, and it is already gone if its creator died.
+    // futex_wait() also returns when a thread of the process dies.
+    while (!atomic_load(&ring->stopped) && thread_alive(ring->thread)) {
+        futex_wait((int *)&ring->stopped, 0, UINT32_MAX);
+    }
+
+    why_free(ring);
+}
+
+bool io_ring_submit(io_ring_t *ring, io_request_t const *request) {
+    unsigned int tail = atomic_load(&ring->sq_tail);
+
+    // Counted up to the completions not yet reaped, so those can't overflow
+    if (tail - atomic_load(&ring->cq_head) > ring->mask) {
+        return false;
+    }
+
+    ring->sq[tail & ring->mask] = *request;
+    atomic_store(&ring->sq_tail, tail + 1);
+    thread_notify(ring->thread);
+    return true;
+}
+
+bool io_ring_complete(io_ring_t *ring, io_completion_t *completion, uint32_t timeout_msec) {
+    wait_source_t source = {.type = WAIT_SOURCE_IO, .ring = ring};
+
+    while (!io_ring_has_completions(ring)) {
+        if (wait_any(&source, 1, timeout_msec) <= 0) {
+            return false;
+        }
+    }
+
+    unsigned int head = atomic_load(&ring->cq_head);
+    *completion       = ring->cq[head & ring->mask];
+    atomic_store(&ring->cq_head, head + 1);
+    return true;
+}
@@ -0,0 +1,43 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/io_ring.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Lives in the memory of the process, the completions follow the requests.
+// The owner submits and reaps, the ring's thread serves, so every index has
+// one writer.
+struct io_ring {
+    atomic_uint      sq_head; // Next request for the thread to serve
+    atomic_uint      sq_tail; // Next free request
+    atomic_uint      cq_head; // Next completion to reap
+    atomic_uint      cq_tail; // Next free completion
+    atomic_bool      stop;
+    atomic_int       stopped; // Futex word, set when the thread is done with the ring
+    atomic_uintptr_t waiter;  // In wait_any() on completions
+    pid_t            thread;
+    unsigned int     mask;
+    io_completion_t *cq;
+    io_request_t     sq[];
+};
+
+static inline bool io_ring_has_completions(io_ring_t *ring) {
+    return atomic_load(&ring->cq_head) != atomic_load(&ring->cq_tail);
+}
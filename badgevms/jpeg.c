@@ -0,0 +1,218 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "jpeg_private.h"
+
+#include "badgevms/misc_funcs.h"
+#include "badgevms/ppa.h"
+#include "driver/jpeg_decode.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "hal/cache_hal.h"
+#include "hal/cache_ll.h"
+#include "memory.h"
+#include "task.h"
+
+#include <errno.h>
+#include <sys/param.h>
+
+#define TAG "jpeg"
+
+// A 4K picture takes well under this
+#define JPEG_DECODE_TIMEOUT_MS 1000
+
+static jpeg_decoder_handle_t decoder;
+static SemaphoreHandle_t     decoder_lock;
+
+// The decoder writes whole blocks of pixels, rows are as long as the picture
+// rounded up to a block
+static void jpeg_block_size(jpeg_down_sampling_type_t sampling, int *w, int *h) {
+    switch (sampling) {
+        case JPEG_DOWN_SAMPLING_YUV420:
+            *w = 16;
+            *h = 16;
+            break;
+        case JPEG_DOWN_SAMPLING_YUV422:
+            *w = 16;
+            *h = 8;
+            break;
+        default:
+            *w = 8;
+            *h = 8;
+    }
+}
+
+// How the decoder writes format, the same way around the PPA reads it, false
+// if it can't
+static bool jpeg_output_format(pixel_format_t format, jpeg_decode_cfg_t *config) {
+    config->conv_std = JPEG_YUV_RGB_CONV_STD_BT601;
+
+    switch (format) {
+        case BADGEVMS_PIXELFORMAT_RGB565:
+            config->output_format = JPEG_DECODE_OUT_FORMAT_RGB565;
+            config->rgb_order     = JPEG_DEC_RGB_ELEMENT_ORDER_BGR;
+            return true;
+        case BADGEVMS_PIXELFORMAT_BGR565:
+            config->output_format = JPEG_DECODE_OUT_FORMAT_RGB565;
+            config->rgb_order     = JPEG_DEC_RGB_ELEMENT_ORDER_RGB;
+            return true;
+        case BADGEVMS_PIXELFORMAT_BGR24:
+            config->output_format = JPEG_DECODE_OUT_FORMAT_RGB888;
+            config->rgb_order     = JPEG_DEC_RGB_ELEMENT_ORDER_BGR;
+            return true;
+        case BADGEVMS_PIXELFORMAT_RGB24:
+            config->output_format = JPEG_DECODE_OUT_FORMAT_RGB888;
+            config->rgb_order     = JPEG_DEC_RGB_ELEMENT_ORDER_RGB;
+            return true;
+        default: return false;
+    }
+}
+
+// The hardware reads and writes on while the caller is switched out, like the
+// PPA. Whatever is in the task heap is aliased for it meanwhile.
+static esp_err_t jpeg_decode_into(
+    void const *buffer, size_t len, framebuffer_t const *out, jpeg_decode_cfg_t const *config, size_t out_size
+) {
+    void const *in_alias  = NULL;
+    void       *out_alias = NULL;
+    void const *in        = buffer;
+    void       *pixels    = out->pixels;
+
+    if (in_task_heap(buffer)) {
+        in = in_alias = memory_alias_map(buffer, len);
+        if (!in_alias) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (in_task_heap(pixels)) {
+        pixels = out_alias = memory_alias_map(out->pixels, out_size);
+        if (!out_alias) {
+            memory_alias_release((void *)in_alias, buffer, len);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    uint32_t decoded;
+    xSemaphoreTake(decoder_lock, portMAX_DELAY);
+    esp_err_t result = jpeg_decoder_process(decoder, config, in, len, pixels, out_size, &decoded);
+    xSemaphoreGive(decoder_lock);
+
+    memory_alias_release(out_alias, out->pixels, out_size);
+    memory_alias_release((void *)in_alias, buffer, len);
+    return result;
+}
+
+bool jpeg_size_get(void const *buffer, size_t len, window_size_t *size) {
+    jpeg_decode_picture_info_t info;
+    if (!buffer || !size || jpeg_decoder_get_info(buffer, len, &info) != ESP_OK) {
+        return false;
+    }
+
+    size->w = info.width;
+    size->h = info.height;
+    return true;
+}
+
+bool jpeg_decode(void const *buffer, size_t len, framebuffer_t *out_fb, pixel_format_t out_format) {
+    task_info_t *task_info = get_task_info();
+
+    if (!decoder) {
+        task_info->_errno = ENODEV;
+        return false;
+    }
+
+    jpeg_decode_picture_info_t info;
+    if (!buffer || !out_fb || !out_fb->pixels || !out_fb->w || !out_fb->h ||
+        jpeg_decoder_get_info(buffer, len, &info) != ESP_OK || !info.width || !info.height) {
+        task_info->_errno = EINVAL;
+        return false;
+    }
+
+    size_t            line_size = cache_hal_get_cache_line_size(CACHE_LL_LEVEL_EXT_MEM, CACHE_TYPE_DATA);
+    jpeg_decode_cfg_t config;
+    esp_err_t         result;
+
+    bool direct = jpeg_output_format(out_format, &config) && info.width % 16 == 0 && info.height % 16 == 0 &&
+                  out_fb->w == info.width && out_fb->h >= info.height && !((uintptr_t)out_fb->pixels & (line_size - 1));
+
+    if (direct) {
+        // Whole blocks of whole cache lines
+        size_t out_size = (size_t)info.width * info.height * BADGEVMS_BYTESPERPIXEL(out_format);
+        result          = jpeg_decode_into(buffer, len, out_fb, &config, out_size);
+    } else {
+        // Decoded whole in a format the decoder writes, then cut and
+        // converted by the PPA
+        pixel_format_t scratch_format = out_format;
+        if (!jpeg_output_format(scratch_format, &config)) {
+            scratch_format = BADGEVMS_PIXELFORMAT_RGB24;
+            jpeg_output_format(scratch_format, &config);
+        }
+
+        int block_w;
+        int block_h;
+        jpeg_block_size(info.sample_method, &block_w, &block_h);
+
+        framebuffer_t scratch = {
+            .w      = (info.width + block_w - 1) & ~(block_w - 1),
+            .h      = (info.height + block_h - 1) & ~(block_h - 1),
+            .format = scratch_format,
+        };
+        size_t scratch_size = (size_t)scratch.w * scratch.h * BADGEVMS_BYTESPERPIXEL(scratch_format);
+
+        scratch.pixels = dma_buffer_alloc(scratch_size, NULL);
+        if (!scratch.pixels) {
+            task_info->_errno = ENOMEM;
+            return false;
+        }
+
+        result = jpeg_decode_into(buffer, len, &scratch, &config, scratch_size);
+        if (result == ESP_OK) {
+            framebuffer_t out  = *out_fb;
+            window_rect_t rect = {0, 0, MIN(info.width, out_fb->w), MIN(info.height, out_fb->h)};
+            out.format         = out_format;
+            if (!ppa_blit(&out, rect, &scratch, rect, ROTATION_ANGLE_0, 0)) {
+                result = ESP_ERR_NOT_SUPPORTED;
+            }
+        }
+
+        dma_buffer_free(scratch.pixels);
+    }
+
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to decode %zu bytes at %p: %s", len, buffer, esp_err_to_name(result));
+        task_info->_errno = result == ESP_ERR_NO_MEM ? ENOMEM : result == ESP_ERR_NOT_SUPPORTED ? ENOTSUP : EIO;
+        return false;
+    }
+    return true;
+}
+
+bool jpeg_init(void) {
+    jpeg_decode_engine_cfg_t config = {
+        .intr_priority = 0,
+        .timeout_ms    = JPEG_DECODE_TIMEOUT_MS,
+    };
+
+    decoder_lock = xSemaphoreCreateMutex();
+    if (!decoder_lock || jpeg_new_decoder_engine(&config, &decoder) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to take the JPEG decoder");
+        decoder = NULL;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,445 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "badgevms/json.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    EXPECT_VALUE,
+    EXPECT_KEY,
+    EXPECT_COLON,
+    EXPECT_NEXT, // A comma or the end of the container
+    EXPECT_NOTHING,
+} json_expect_t;
+
+typedef enum {
+    NEST_OBJECT,
+    NEST_ARRAY,
+    NEST_KEY, // Waiting for its value
+} json_nest_t;
+
+static bool json_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool json_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int json_hex(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool json_number_valid(char const *s, size_t len) {
+    size_t i = 0;
+
+    if (i < len && s[i] == '-')
+        ++i;
+    if (i < len && s[i] == '0') {
+        ++i;
+    } else if (i < len && json_is_digit(s[i])) {
+        while (i < len && json_is_digit(s[i])) ++i;
+    } else {
+        return false;
+    }
+
+    if (i < len && s[i] == '.') {
+        if (++i == len || !json_is_digit(s[i]))
+            return false;
+        while (i < len && json_is_digit(s[i])) ++i;
+    }
+
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        ++i;
+        if (i < len && (s[i] == '+' || s[i] == '-'))
+            ++i;
+        if (i == len || !json_is_digit(s[i]))
+            return false;
+        while (i < len && json_is_digit(s[i])) ++i;
+    }
+
+    return i == len;
+}
+
+// Where the string starting after the quote at text[pos] ends, the offset of
+// its closing quote or a json_error_t
+static int json_scan_string(char const *text, size_t len, size_t pos) {
+    for (size_t i = pos + 1; i < len && text[i]; ++i) {
+        unsigned char c = text[i];
+        if (c == '"') {
+            return (int)i;
+        }
+        if (c < 0x20) {
+            return JSON_ERROR_INVALID;
+        }
+        if (c != '\\') {
+            continue;
+        }
+
+        if (++i == len || !text[i]) {
+            break;
+        }
+        switch (text[i]) {
+            case '"':
+            case '\\':
+            case '/':
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't': break;
+            case 'u':
+                for (int h = 0; h < 4; ++h) {
+                    if (++i == len || !text[i]) {
+                        return JSON_ERROR_PARTIAL;
+                    }
+                    if (json_hex(text[i]) < 0) {
+                        return JSON_ERROR_INVALID;
+                    }
+                }
+                break;
+            default: return JSON_ERROR_INVALID;
+        }
+    }
+    return JSON_ERROR_PARTIAL;
+}
+
+int json_parse(json_t *json, char const *text, size_t len, json_token_t *tokens, int num_tokens) {
+    int           stack[JSON_MAX_DEPTH];
+    json_nest_t   nest[JSON_MAX_DEPTH];
+    int           depth  = 0;
+    int           count  = 0;
+    bool          opened = false; // Nothing in the innermost container yet
+    json_expect_t expect = EXPECT_VALUE;
+
+    json->text   = text;
+    json->tokens = tokens;
+    json->count  = 0;
+
+    for (size_t i = 0; i < len && text[i]; ++i) {
+        char c = text[i];
+        if (json_is_space(c)) {
+            continue;
+        }
+
+        bool close_object = c == '}' && (expect == EXPECT_NEXT || (opened && expect == EXPECT_KEY));
+        bool close_array  = c == ']' && (expect == EXPECT_NEXT || (opened && expect == EXPECT_VALUE));
+        if (close_object || close_array) {
+            if (!depth || nest[depth - 1] != (close_object ? NEST_OBJECT : NEST_ARRAY)) {
+                return JSON_ERROR_INVALID;
+            }
+            int container = stack[--depth];
+            if (tokens) {
+                tokens[container].end  = (int)i + 1;
+                tokens[container].next = count;
+            }
+        } else if (expect == EXPECT_COLON || expect == EXPECT_NEXT) {
+            if (c != (expect == EXPECT_COLON ? ':' : ',')) {
+                return JSON_ERROR_INVALID;
+            }
+            expect = expect == EXPECT_COLON || nest[depth - 1] == NEST_ARRAY ? EXPECT_VALUE : EXPECT_KEY;
+            opened = false;
+            continue;
+        } else if (expect == EXPECT_NOTHING || (expect == EXPECT_KEY && c != '"')) {
+            return JSON_ERROR_INVALID;
+        } else {
+            json_type_t type;
+            size_t      start = i;
+            size_t      end;
+            size_t      last; // Of the text the token takes
+
+            if (c == '{' || c == '[') {
+                type = c == '{' ? JSON_OBJECT : JSON_ARRAY;
+                end  = i + 1;
+                last = i;
+            } else if (c == '"') {
+                int quote = json_scan_string(text, len, i);
+                if (quote < 0) {
+                    return quote;
+                }
+                type  = JSON_STRING;
+                start = i + 1;
+                end   = quote;
+                last  = quote;
+            } else {
+                end = i;
+                while (end < len && text[end] && !json_is_space(text[end]) && text[end] != ',' && text[end] != ']' &&
+                       text[end] != '}' && text[end] != ':') {
+                    ++end;
+                }
+                // A number may go on in more text that isn't here
+                if (end == len && depth) {
+                    return JSON_ERROR_PARTIAL;
+                }
+
+                size_t n = end - i;
+                if ((n == 4 && !memcmp(text + i, "true", 4)) || (n == 5 && !memcmp(text + i, "false", 5))) {
+                    type = JSON_BOOL;
+                } else if (n == 4 && !memcmp(text + i, "null", 4)) {
+                    type = JSON_NULL;
+                } else if (json_number_valid(text + i, n)) {
+                    type = JSON_NUMBER;
+                } else {
+                    return JSON_ERROR_INVALID;
+                }
+                last = end - 1;
+            }
+
+            if (tokens && count == num_tokens) {
+                return JSON_ERROR_NOMEM;
+            }
+
+            int parent = depth ? stack[depth - 1] : -1;
+            int token  = count++;
+            i          = last;
+            if (tokens) {
+                tokens[token] = (json_token_t){
+                    .type   = type,
+                    .start  = (int)start,
+                    .end    = (int)end,
+                    .next   = count,
+                    .parent = parent,
+                };
+                if (parent >= 0) {
+                    tokens[parent].size++;
+                }
+            }
+
+            if (type == JSON_OBJECT || type == JSON_ARRAY || expect == EXPECT_KEY) {
+                if (depth == JSON_MAX_DEPTH) {
+                    return JSON_ERROR_DEPTH;
+                }
+                stack[depth] = token;
+                nest[depth]  = type == JSON_OBJECT ? NEST_OBJECT : type == JSON_ARRAY ? NEST_ARRAY : NEST_KEY;
+                depth++;
+            }
+
+            if (type == JSON_OBJECT || type == JSON_ARRAY) {
+                expect = type == JSON_OBJECT ? EXPECT_KEY : EXPECT_VALUE;
+                opened = true;
+                continue;
+            }
+            if (expect == EXPECT_KEY) {
+                expect = EXPECT_COLON;
+                continue;
+            }
+        }
+
+        // A value is complete, and so is the member it is the value of
+        if (depth && nest[depth - 1] == NEST_KEY) {
+            int key = stack[--depth];
+            if (tokens) {
+                tokens[key].next = count;
+            }
+        }
+        expect = depth ? EXPECT_NEXT : EXPECT_NOTHING;
+        opened = false;
+    }
+
+    if (expect != EXPECT_NOTHING) {
+        return JSON_ERROR_PARTIAL;
+    }
+
+    json->count = count;
+    return count;
+}
+
+int json_object_get(json_t const *json, int object, char const *key) {
+    if (object < 0 || object >= json->count || json->tokens[object].type != JSON_OBJECT) {
+        return -1;
+    }
+
+    for (int member = object + 1; member < json->tokens[object].next; member = json->tokens[member].next) {
+        if (json_string_equals(json, member, key)) {
+            return member + 1;
+        }
+    }
+    return -1;
+}
+
+int json_array_get(json_t const *json, int array, int index) {
+    if (array < 0 || array >= json->count || json->tokens[array].type != JSON_ARRAY || index < 0 ||
+        index >= json->tokens[array].size) {
+        return -1;
+    }
+
+    int element = array + 1;
+    while (index--) {
+        element = json->tokens[element].next;
+    }
+    return element;
+}
+
+// Decode the character of a string at *pos to UTF-8 in out, returns its length
+static int json_decode_char(char const *text, int *pos, char out[4]) {
+    char c = text[(*pos)++];
+    if (c != '\\') {
+        out[0] = c;
+        return 1;
+    }
+
+    c = text[(*pos)++];
+    switch (c) {
+        case 'b': out[0] = '\b'; return 1;
+        case 'f': out[0] = '\f'; return 1;
+        case 'n': out[0] = '\n'; return 1;
+        case 'r': out[0] = '\r'; return 1;
+        case 't': out[0] = '\t'; return 1;
+        case 'u': break;
+        default: out[0] = c; return 1;
+    }
+
+    uint32_t code = 0;
+    for (int h = 0; h < 4; ++h) {
+        code = code << 4 | json_hex(text[(*pos)++]);
+    }
+
+    // A surrogate pair, if the low half follows
+    if (code >= 0xD800 && code < 0xDC00 && text[*pos] == '\\' && text[*pos + 1] == 'u') {
+        uint32_t low = 0;
+        for (int h = 0; h < 4; ++h) {
+            int digit = json_hex(text[*pos + 2 + h]);
+            low       = low << 4 | (digit < 0 ? 0 : digit);
+        }
+        if (low >= 0xDC00 && low < 0xE000) {
+            code  = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            *pos += 6;
+        }
+    }
+
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | code >> 6);
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | code >> 12);
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | code >> 18);
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+bool json_string_equals(json_t const *json, int token, char const *str) {
+    if (token < 0 || token >= json->count || json->tokens[token].type != JSON_STRING) {
+        return false;
+    }
+
+    json_token_t const *t   = &json->tokens[token];
+    int                 pos = t->start;
+
+    // Most keys have no escapes
+    if (!memchr(json->text + t->start, '\\', t->end - t->start)) {
+        size_t len = t->end - t->start;
+        return strlen(str) == len && !memcmp(json->text + t->start, str, len);
+    }
+
+    while (pos < t->end) {
+        char decoded[4];
+        int  n = json_decode_char(json->text, &pos, decoded);
+        if (strncmp(str, decoded, n)) {
+            return false;
+        }
+        str += n;
+    }
+    return !*str;
+}
+
+int json_string_get(json_t const *json, int token, char *buf, size_t size) {
+    if (token < 0 || token >= json->count || json->tokens[token].type != JSON_STRING) {
+        return -1;
+    }
+
+    json_token_t const *t   = &json->tokens[token];
+    int                 pos = t->start;
+    size_t              len = 0;
+
+    while (pos < t->end) {
+        char decoded[4];
+        int  n = json_decode_char(json->text, &pos, decoded);
+        for (int i = 0; i < n; ++i, ++len) {
+            if (len + 1 < size) {
+                buf[len] = decoded[i];
+            }
+        }
+    }
+
+    if (size) {
+        buf[len < size ? len : size - 1] = '\0';
+    }
+    return (int)len;
+}
+
+// A primitive copied out of the text, which needn't be terminated after it
+static bool json_primitive_copy(json_t const *json, int token, json_type_t type, char *buf, size_t size) {
+    if (token < 0 || token >= json->count || json->tokens[token].type != type) {
+        return false;
+    }
+
+    json_token_t const *t   = &json->tokens[token];
+    size_t              len = t->end - t->start;
+    if (len >= size) {
+        return false;
+    }
+    memcpy(buf, json->text + t->start, len);
+    buf[len] = '\0';
+    return true;
+}
+
+bool json_number_get(json_t const *json, int token, double *value) {
+    char number[40];
+    if (!json_primitive_copy(json, token, JSON_NUMBER, number, sizeof(number))) {
+        return false;
+    }
+    *value = strtod(number, NULL);
+    return true;
+}
+
+bool json_int_get(json_t const *json, int token, long long *value) {
+    char number[40];
+    if (!json_primitive_copy(json, token, JSON_NUMBER, number, sizeof(number))) {
+        return false;
+    }
+    *value = strpbrk(number, ".eE") ? (long long)strtod(number, NULL) : strtoll(number, NULL, 10);
+    return true;
+}
+
+bool json_bool_get(json_t const *json, int token, bool *value) {
+    if (token < 0 || token >= json->count || json->tokens[token].type != JSON_BOOL) {
+        return false;
+    }
+    *value = json->text[json->tokens[token].start] == 't';
+    return true;
+}
@@ -0,0 +1,477 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "library.h"
+
+#include "badgevms_config.h"
+#include "elf_symbols.h"
+#include "esp_elf.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "fast_mem.h"
+#include "freertos/FreeRTOS.h"
+#include "memory.h"
+#include "why_io.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "library"
+
+#define LIBRARY_MAX_PHDRS  16
+#define LIBRARY_RELA_CHUNK 32
+
+#define STB_GLOBAL 1
+#define STB_WEAK   2
+
+#define R_RISCV_NONE      0
+#define R_RISCV_32        1
+#define R_RISCV_RELATIVE  3
+#define R_RISCV_JUMP_SLOT 5
+
+// Resolved once, applying it is a store of value, plus the base if relative
+typedef struct {
+    uint32_t offset;
+    uint32_t value;
+    bool     relative;
+} library_reloc_t;
+
+typedef struct {
+    char const *name;
+    uint32_t    value; // From the start of the library
+} library_sym_t;
+
+struct library {
+    char                name[LIBRARY_NAME_MAX];
+    // Tell a library replaced on disk apart
+    off_t               file_size;
+    time_t              file_mtime;
+    size_t              size;         // Mapped from the base on
+    size_t              shared_size;  // Mapped from shared_pages, the rest is private
+    allocation_range_t *shared_pages; // From vaddr 0 on, owned by the library
+    void               *data;         // The writable part as it is in the file
+    size_t              data_size;
+    library_reloc_t    *relocs;
+    size_t              num_relocs;
+    char               *strtab;
+    library_sym_t      *syms; // Sorted by name
+    size_t              num_syms;
+    int                 refcount; // Threads that have it mapped
+    bool                cached;   // In library_list, otherwise it goes with its last thread
+    library_t          *next;
+};
+
+static portMUX_TYPE library_lock = portMUX_INITIALIZER_UNLOCKED;
+static library_t   *library_list;
+
+static void library_free(library_t *library) {
+    pages_deallocate(library->shared_pages);
+    heap_caps_free(library->data);
+    heap_caps_free(library->relocs);
+    heap_caps_free(library->strtab);
+    heap_caps_free(library->syms);
+    heap_caps_free(library);
+}
+
+static library_t *library_find_locked(char const *name, struct stat const *st) {
+    for (library_t *library = library_list; library; library = library->next) {
+        if (library->file_size == st->st_size && library->file_mtime == st->st_mtime &&
+            !strcmp(library->name, name)) {
+            return library;
+        }
+    }
+    return NULL;
+}
+
+static void library_put(library_t *library) {
+    portENTER_CRITICAL(&library_lock);
+    bool gone = !--library->refcount && !library->cached;
+    portEXIT_CRITICAL(&library_lock);
+
+    if (gone) {
+        library_free(library);
+    }
+}
+
+// Not malloc(), this runs in the program that needs the library and the heap
+// has to stay untouched until all of its libraries are mapped
+static void *library_read_alloc(int fd, uint32_t offset, size_t size) {
+    uint8_t *buf = heap_caps_malloc(size + 1, MALLOC_CAP_SPIRAM);
+    if (!buf) {
+        return NULL;
+    }
+
+    if (why_lseek(fd, offset, SEEK_SET) != offset || why_read(fd, buf, size) != size) {
+        heap_caps_free(buf);
+        return NULL;
+    }
+    buf[size] = 0;
+    return buf;
+}
+
+static int library_sym_compare(void const *a, void const *b) {
+    return strcmp(((library_sym_t const *)a)->name, ((library_sym_t const *)b)->name);
+}
+
+static void library_relocate(library_t const *library, uintptr_t base) {
+    why_memcpy((void *)(base + library->shared_size), library->data, library->data_size);
+    for (size_t i = 0; i < library->num_relocs; ++i) {
+        library_reloc_t const *reloc = &library->relocs[i];
+        *(uint32_t *)(base + reloc->offset) = reloc->value + (reloc->relative ? base : 0);
+    }
+    memory_mark_executable((void *)base, library->size);
+}
+
+// The exported symbols of the dynamic symbol table
+static bool library_read_syms(library_t *library, elf32_sym_t const *dynsym, size_t num) {
+    library->syms = heap_caps_malloc(num * sizeof(library_sym_t), MALLOC_CAP_SPIRAM);
+    if (!library->syms) {
+        return false;
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+        int bind = ELF_ST_BIND(dynsym[i].info);
+        if (dynsym[i].shndx && dynsym[i].name && (bind == STB_GLOBAL || bind == STB_WEAK)) {
+            library->syms[library->num_syms].name  = library->strtab + dynsym[i].name;
+            library->syms[library->num_syms].value = dynsym[i].value;
+            ++library->num_syms;
+        }
+    }
+
+    qsort(library->syms, library->num_syms, sizeof(library_sym_t), library_sym_compare);
+    return true;
+}
+
+// Resolve the relocations of library against itself and the firmware, they may only touch its writable part
+static bool library_read_relocs(
+    library_t *library, int fd, elf32_shdr_t const *shdr, int shnum, int dynsym_shndx, elf32_sym_t const *dynsym
+) {
+    size_t num_relocs = 0;
+    for (int i = 0; i < shnum; ++i) {
+        if (shdr[i].type == SHT_RELA && shdr[i].link == dynsym_shndx) {
+            num_relocs += shdr[i].size / sizeof(elf32_rela_t);
+        }
+    }
+
+    library->relocs = heap_caps_malloc(MAX(num_relocs, 1) * sizeof(library_reloc_t), MALLOC_CAP_SPIRAM);
+    if (!library->relocs) {
+        return false;
+    }
+
+    size_t       num_sym = shdr[dynsym_shndx].size / sizeof(elf32_sym_t);
+    elf32_rela_t rela[LIBRARY_RELA_CHUNK];
+    for (int i = 0; i < shnum; ++i) {
+        if (shdr[i].type != SHT_RELA || shdr[i].link != dynsym_shndx) {
+            continue;
+        }
+
+        size_t nr_reloc = shdr[i].size / sizeof(elf32_rela_t);
+        size_t n;
+        for (size_t done = 0; done < nr_reloc; done += n) {
+            n = MIN(LIBRARY_RELA_CHUNK, nr_reloc - done);
+
+            ssize_t bytes = n * sizeof(elf32_rela_t);
+            off_t   pos   = shdr[i].offset + done * sizeof(elf32_rela_t);
+            if (why_lseek(fd, pos, SEEK_SET) != pos || why_read(fd, rela, bytes) != bytes) {
+                return false;
+            }
+
+            for (size_t j = 0; j < n; ++j) {
+                int      type  = ELF_R_TYPE(rela[j].info);
+                uint32_t index = ELF_R_SYM(rela[j].info);
+                if (type == R_RISCV_NONE) {
+                    continue;
+                }
+                if (index >= num_sym || rela[j].offset < library->shared_size ||
+                    rela[j].offset + sizeof(uint32_t) > library->shared_size + library->data_size) {
+                    ESP_LOGE(TAG, "%s: relocation at %#x is outside of its data", library->name, rela[j].offset);
+                    return false;
+                }
+
+                library_reloc_t *reloc = &library->relocs[library->num_relocs++];
+                reloc->offset          = rela[j].offset;
+                if (type == R_RISCV_RELATIVE) {
+                    reloc->value    = rela[j].addend;
+                    reloc->relative = true;
+                    continue;
+                }
+                if (type != R_RISCV_32 && type != R_RISCV_JUMP_SLOT) {
+                    ESP_LOGE(TAG, "%s: relocation type %d is not supported", library->name, type);
+                    return false;
+                }
+
+                elf32_sym_t const *sym    = &dynsym[index];
+                int32_t            addend = type == R_RISCV_32 ? rela[j].addend : 0;
+                if (sym->shndx) {
+                    reloc->value    = sym->value + addend;
+                    reloc->relative = true;
+                } else {
+                    uintptr_t addr = elf_find_sym(library->strtab + sym->name);
+                    if (!addr) {
+                        ESP_LOGE(TAG, "%s: can't find symbol %s", library->name, library->strtab + sym->name);
+                        return false;
+                    }
+                    reloc->value    = addr + addend;
+                    reloc->relative = false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Read the library at path into pages of its own behind the image of task_info
+// and resolve its symbols. Returns a referenced library that isn't cached yet.
+static library_t *library_load(
+    task_info_t *task_info, char const *name, char const *path, struct stat const *st, uintptr_t *base_out
+) {
+    elf32_hdr_t   ehdr;
+    elf32_phdr_t  phdr[LIBRARY_MAX_PHDRS];
+    elf32_shdr_t *shdr   = NULL;
+    elf32_sym_t  *dynsym = NULL;
+    library_t    *ret    = NULL;
+
+    library_t *library = heap_caps_calloc(1, sizeof(library_t), MALLOC_CAP_SPIRAM);
+    if (!library) {
+        return NULL;
+    }
+    snprintf(library->name, sizeof(library->name), "%s", name);
+    library->file_size  = st->st_size;
+    library->file_mtime = st->st_mtime;
+    library->refcount   = 1;
+
+    int fd = why_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        goto out;
+    }
+
+    ssize_t phdr_bytes = 0;
+    if (why_read(fd, &ehdr, sizeof(ehdr)) != sizeof(ehdr) || ehdr.phentsize != sizeof(elf32_phdr_t) ||
+        ehdr.shentsize != sizeof(elf32_shdr_t) || !ehdr.phnum || ehdr.phnum > LIBRARY_MAX_PHDRS) {
+        ESP_LOGE(TAG, "%s: not a library we can load", name);
+        goto out;
+    }
+
+    phdr_bytes = ehdr.phnum * sizeof(elf32_phdr_t);
+    if (why_lseek(fd, ehdr.phoff, SEEK_SET) != ehdr.phoff || why_read(fd, phdr, phdr_bytes) != phdr_bytes) {
+        goto out;
+    }
+
+    // Laid out from vaddr 0 like a program image, always where it is mapped
+    size_t size        = 0;
+    size_t shared_size = SIZE_MAX;
+    size_t data_end    = 0;
+    for (int i = 0; i < ehdr.phnum; ++i) {
+        if (phdr[i].type != PT_LOAD) {
+            continue;
+        }
+        if (phdr[i].flags & PF_W) {
+            shared_size = MIN(shared_size, (phdr[i].vaddr & ~(SOC_MMU_PAGE_SIZE - 1)));
+        }
+        size     = MAX(size, phdr[i].vaddr + phdr[i].memsz);
+        data_end = MAX(data_end, phdr[i].vaddr + phdr[i].filesz);
+    }
+    library->size        = (size + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1);
+    library->shared_size = MIN(shared_size, library->size);
+    library->data_size   = data_end > library->shared_size ? data_end - library->shared_size : 0;
+
+    uintptr_t base = heap_map_library(task_info, NULL, library->shared_size, library->size);
+    if (!base) {
+        ESP_LOGE(TAG, "%s: unable to map %zu bytes", name, library->size);
+        goto out;
+    }
+
+    for (int i = 0; i < ehdr.phnum; ++i) {
+        ssize_t filesz = phdr[i].filesz;
+        if (phdr[i].type != PT_LOAD || !filesz) {
+            continue;
+        }
+        if (why_lseek(fd, phdr[i].offset, SEEK_SET) != phdr[i].offset ||
+            why_read(fd, (void *)(base + phdr[i].vaddr), filesz) != filesz) {
+            ESP_LOGE(TAG, "%s: unable to read segment %d", name, i);
+            goto out;
+        }
+    }
+
+    // Kept as it is in the file, every mapping relocates a copy
+    if (library->data_size) {
+        library->data = heap_caps_malloc(library->data_size, MALLOC_CAP_SPIRAM);
+        if (!library->data) {
+            goto out;
+        }
+        why_memcpy(library->data, (void *)(base + library->shared_size), library->data_size);
+    }
+
+    shdr = library_read_alloc(fd, ehdr.shoff, ehdr.shnum * sizeof(elf32_shdr_t));
+    if (!shdr) {
+        goto out;
+    }
+
+    int dynsym_shndx = -1;
+    for (int i = 0; i < ehdr.shnum; ++i) {
+        if (shdr[i].type == SHT_SYNSYM && shdr[i].link < ehdr.shnum) {
+            dynsym_shndx = i;
+            break;
+        }
+    }
+    if (dynsym_shndx < 0) {
+        ESP_LOGE(TAG, "%s: no dynamic symbols", name);
+        goto out;
+    }
+
+    elf32_shdr_t const *strtab_shdr = &shdr[shdr[dynsym_shndx].link];
+
+    dynsym          = library_read_alloc(fd, shdr[dynsym_shndx].offset, shdr[dynsym_shndx].size);
+    library->strtab = library_read_alloc(fd, strtab_shdr->offset, strtab_shdr->size);
+    if (!dynsym || !library->strtab ||
+        !library_read_syms(library, dynsym, shdr[dynsym_shndx].size / sizeof(elf32_sym_t)) ||
+        !library_read_relocs(library, fd, shdr, ehdr.shnum, dynsym_shndx, dynsym)) {
+        goto out;
+    }
+
+    library_relocate(library, base);
+    *base_out = base;
+    ret       = library;
+    ESP_LOGI(
+        TAG,
+        "Loaded %s, %zu of %zu bytes shared, %zu symbols",
+        name,
+        library->shared_size,
+        library->size,
+        library->num_syms
+    );
+
+out:
+    if (fd >= 0) {
+        why_close(fd);
+    }
+    heap_caps_free(dynsym);
+    heap_caps_free(shdr);
+    if (!ret) {
+        library_free(library);
+    }
+    return ret;
+}
+
+bool library_stat(char const *name, struct stat *st) {
+    char path[sizeof(LIBRARY_PATH) + LIBRARY_NAME_MAX];
+
+    snprintf(path, sizeof(path), LIBRARY_PATH "%s", name);
+    return why_stat(path, st) == 0;
+}
+
+bool library_map(task_info_t *task_info, char const *name) {
+    task_thread_t *thread = task_info->thread;
+    char           path[sizeof(LIBRARY_PATH) + LIBRARY_NAME_MAX];
+    struct stat    st;
+    uintptr_t      base = 0;
+
+    snprintf(path, sizeof(path), LIBRARY_PATH "%s", name);
+    if (thread->num_libraries == LIBRARY_MAX_NEEDED || why_stat(path, &st) != 0) {
+        ESP_LOGE(TAG, "Unable to find library %s", name);
+        return false;
+    }
+
+    portENTER_CRITICAL(&library_lock);
+    library_t *library = library_find_locked(name, &st);
+    if (library) {
+        ++library->refcount;
+    }
+    portEXIT_CRITICAL(&library_lock);
+
+    if (library) {
+        base = heap_map_library(task_info, library->shared_pages, library->shared_size, library->size);
+        if (!base) {
+            ESP_LOGE(TAG, "%s: unable to map %zu bytes", name, library->size);
+            library_put(library);
+            return false;
+        }
+        library_relocate(library, base);
+    } else {
+        library = library_load(task_info, name, path, &st, &base);
+        if (!library) {
+            return false;
+        }
+
+        // Last, the read-only pages belong to the library from here on
+        library->shared_pages = library->shared_size ? heap_share_image(task_info, base, library->shared_size) : NULL;
+        if (library->shared_pages || !library->shared_size) {
+            for (allocation_range_t *r = library->shared_pages; r; r = r->next) {
+                r->vaddr_start -= base;
+            }
+
+            portENTER_CRITICAL(&library_lock);
+            library->cached = true;
+            library->next   = library_list;
+            library_list    = library;
+            portEXIT_CRITICAL(&library_lock);
+        }
+    }
+
+    thread->libraries[thread->num_libraries]     = library;
+    thread->library_bases[thread->num_libraries] = base;
+    ++thread->num_libraries;
+    return true;
+}
+
+void library_put_all(task_thread_t *thread) {
+    for (size_t i = 0; i < thread->num_libraries; ++i) {
+        library_put(thread->libraries[i]);
+    }
+    thread->num_libraries = 0;
+}
+
+uintptr_t library_find_sym(task_thread_t const *thread, char const *name) {
+    library_sym_t key = {.name = name};
+
+    for (size_t i = 0; i < thread->num_libraries; ++i) {
+        library_t const     *library = thread->libraries[i];
+        library_sym_t const *sym =
+            bsearch(&key, library->syms, library->num_syms, sizeof(library_sym_t), library_sym_compare);
+        if (sym) {
+            return thread->library_bases[i] + sym->value;
+        }
+    }
+    return 0;
+}
+
+void library_shrink(void) {
+    while (1) {
+        library_t *victim = NULL;
+
+        portENTER_CRITICAL(&library_lock);
+        for (library_t **link = &library_list; *link; link = &(*link)->next) {
+            if (!(*link)->refcount) {
+                victim         = *link;
+                *link          = victim->next;
+                victim->cached = false;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&library_lock);
+
+        if (!victim) {
+            return;
+        }
+
+        ESP_LOGI(TAG, "Dropping %s, %zu shared bytes", victim->name, victim->shared_size);
+        library_free(victim);
+    }
+}
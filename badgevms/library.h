@@ -0,0 +1,46 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "task.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Shared libraries, the DT_NEEDED entries of a program, found in LIBRARY_PATH.
+// A library is read, and its symbols resolved, the first time a program needs
+// it. After that its read-only pages are shared by every program that maps it
+// and only its writable part is copied and relocated for where it ends up.
+// Libraries only link against the firmware, not against each other, and must
+// not need text relocations.
+typedef struct library library_t;
+
+// What the library called name is on disk, it's cached for as long as this stays the same
+bool library_stat(char const *name, struct stat *st);
+
+// Map the library called name at the break of the heap of task_info, right
+// behind its image and before anything was allocated. False if the library
+// can't be found or used.
+bool      library_map(task_info_t *task_info, char const *name);
+// Drop the libraries thread mapped, when it goes away
+void      library_put_all(task_thread_t *thread);
+// Where the exported symbol called name is in the libraries of thread, 0 if none has it
+uintptr_t library_find_sym(task_thread_t const *thread, char const *name);
+
+// Drop the libraries nobody has mapped
+void library_shrink(void);
@@ -39,12 +39,35 @@
 #include "logical_names.h"
 #include "thirdparty/khash.h"
 
+#include <stdatomic.h>
 #include <stdio.h>
 
 #include <ctype.h>
 
+#ifndef RUN_TEST
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static SemaphoreHandle_t cache_lock;
+static SemaphoreHandle_t table_lock;
+#define CACHE_LOCK()   xSemaphoreTake(cache_lock, portMAX_DELAY)
+#define CACHE_UNLOCK() xSemaphoreGive(cache_lock)
+#define TABLE_LOCK()   xSemaphoreTake(table_lock, portMAX_DELAY)
+#define TABLE_UNLOCK() xSemaphoreGive(table_lock)
+#define TABLE_WAIT()   vTaskDelay(1)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#define TABLE_LOCK()
+#define TABLE_UNLOCK()
+#define TABLE_WAIT()
+#endif
+
 #define MAX_DIR_DEPTH     25
 #define RESOLVE_MAX_DEPTH 15
+// Paths whose resolution is kept, the cache starts over once it is full
+#define CACHE_MAX_ENTRIES 64
 
 typedef struct {
     char  *pointer;
@@ -77,8 +100,203 @@ static parsed_components_t const parsed_components_null = {
     .count          = 0
 };
 
-KHASH_MAP_INIT_STR(lnametable, logical_name_target_t);
-static khash_t(lnametable) * logical_name_table;
+typedef struct {
+    char                 *name;
+    logical_name_target_t target;
+} lname_entry_t;
+
+// Sorted by name and never changed once published, logical_name_set() and
+// logical_name_del() publish a copy with the change. Readers take no lock,
+// they announce themselves in lname_readers instead and a writer waits for
+// the ones that may still see the old table before freeing it.
+struct logical_name_table {
+    size_t         count;
+    lname_entry_t *entries[];
+};
+
+// The system wide names and those of the calling process, which come first
+typedef struct {
+    logical_name_table_t const *process;
+    logical_name_table_t const *system;
+} lname_view_t;
+
+static logical_name_table_t *_Atomic system_table;
+
+// Readers count themselves in the half of the current epoch
+static atomic_uint lname_epoch;
+static atomic_uint lname_readers[2];
+
+// Every result of a path, for each index of the search list it resolves through
+typedef struct {
+    char   **results;
+    size_t   result_count;
+    uint32_t generation;
+} cache_entry_t;
+
+KHASH_MAP_INIT_STR(lnamecache, cache_entry_t *);
+static khash_t(lnamecache) * logical_name_cache;
+// Bumped when a logical name changes, entries of an older generation are resolved again
+static atomic_uint cache_generation;
+
+#ifdef RUN_TEST
+static logical_name_table_t *_Atomic test_process_table;
+
+logical_name_table_t *_Atomic *logical_name_process_table(void) {
+    return &test_process_table;
+}
+#endif
+
+static unsigned lname_read_begin(void) {
+    while (1) {
+        unsigned epoch = atomic_load(&lname_epoch) & 1;
+        atomic_fetch_add(&lname_readers[epoch], 1);
+        // A writer that flipped the epoch meanwhile may not have seen us
+        if ((atomic_load(&lname_epoch) & 1) == epoch) {
+            return epoch;
+        }
+        atomic_fetch_sub(&lname_readers[epoch], 1);
+    }
+}
+
+static void lname_read_end(unsigned epoch) {
+    atomic_fetch_sub(&lname_readers[epoch], 1);
+}
+
+static lname_view_t lname_view(void) {
+    logical_name_table_t *_Atomic *process = logical_name_process_table();
+
+    lname_view_t view = {
+        .process = process ? atomic_load(process) : NULL,
+        .system  = atomic_load(&system_table),
+    };
+    return view;
+}
+
+// With table_lock held, after publishing a new table. Everyone who could
+// still be reading the one it replaced is done when this returns.
+static void lname_synchronize(void) {
+    unsigned epoch = atomic_fetch_xor(&lname_epoch, 1) & 1;
+    while (atomic_load(&lname_readers[epoch])) {
+        TABLE_WAIT();
+    }
+}
+
+// Where name is or would go in table, which may be NULL
+static size_t table_find(logical_name_table_t const *table, char const *name, size_t len, bool *found) {
+    size_t lo = 0;
+    size_t hi = table ? table->count : 0;
+
+    *found = false;
+    while (lo < hi) {
+        size_t      mid   = lo + (hi - lo) / 2;
+        char const *entry = table->entries[mid]->name;
+        int         cmp   = strncmp(name, entry, len);
+        if (!cmp && entry[len]) {
+            // name is a prefix of entry
+            cmp = -1;
+        }
+        if (!cmp) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static logical_name_target_t const *view_get(lname_view_t const *view, char const *name, size_t len) {
+    bool   found;
+    size_t pos = table_find(view->process, name, len, &found);
+    if (found) {
+        return &view->process->entries[pos]->target;
+    }
+    pos = table_find(view->system, name, len, &found);
+    if (found) {
+        return &view->system->entries[pos]->target;
+    }
+    return NULL;
+}
+
+static void lname_entry_free(lname_entry_t *entry) {
+    if (!entry) {
+        return;
+    }
+    for (size_t i = 0; i < entry->target.target_count; ++i) {
+        free(entry->target.target[i]);
+    }
+    free(entry->target.target);
+    free(entry->name);
+    free(entry);
+}
+
+// Publish table with name set to target, or removed for a NULL target. Takes
+// target. Returns 1 if there was nothing to remove.
+static int table_update(logical_name_table_t *_Atomic *slot, char const *name, logical_name_target_t const *target) {
+    lname_entry_t *entry = NULL;
+    if (target) {
+        entry = malloc(sizeof(lname_entry_t));
+        if (entry) {
+            entry->name   = strdup(name);
+            entry->target = *target;
+        }
+        if (!entry || !entry->name) {
+            ESP_LOGE(TAG, "Unable to create %s", name);
+            abort();
+        }
+    }
+
+    TABLE_LOCK();
+    logical_name_table_t *old = atomic_load(slot);
+    bool                  found;
+    size_t                pos   = table_find(old, name, strlen(name), &found);
+    size_t                count = old ? old->count : 0;
+    if (!entry && !found) {
+        TABLE_UNLOCK();
+        return 1;
+    }
+
+    size_t                new_count = count + (entry ? 1 : 0) - (found ? 1 : 0);
+    logical_name_table_t *table     = malloc(sizeof(logical_name_table_t) + new_count * sizeof(lname_entry_t *));
+    if (!table) {
+        ESP_LOGE(TAG, "Unable to create %s", name);
+        abort();
+    }
+    table->count = new_count;
+    if (pos) {
+        memcpy(table->entries, old->entries, pos * sizeof(lname_entry_t *));
+    }
+    size_t after = pos;
+    if (entry) {
+        table->entries[after++] = entry;
+    }
+    size_t rest = found ? pos + 1 : pos;
+    if (rest < count) {
+        memcpy(table->entries + after, old->entries + rest, (count - rest) * sizeof(lname_entry_t *));
+    }
+
+    atomic_store(slot, table);
+    lname_synchronize();
+    if (found) {
+        lname_entry_free(old->entries[pos]);
+    }
+    free(old);
+    TABLE_UNLOCK();
+    return 0;
+}
+
+void logical_name_table_free(logical_name_table_t *table) {
+    if (!table) {
+        return;
+    }
+    for (size_t i = 0; i < table->count; ++i) {
+        lname_entry_free(table->entries[i]);
+    }
+    free(table);
+}
 
 static inline bool raw_cmp(raw_string_t *l, raw_string_t *r) {
     if (l->pointer != r->pointer)
@@ -113,7 +331,7 @@ static inline raw_string_t raw_from_ptr(char *pointer, int len, bool terminal) {
     return res;
 }
 
-#ifndef RUN_TEST
+#ifdef RUN_TEST
 static inline void raw_print(raw_string_t r) {
     if (r.len == 0 || r.pointer == NULL) {
         printf("len: %zi '(null)'", r.len);
@@ -318,7 +536,7 @@ static inline parsed_components_t parse_cstring(char *cstr) {
     return parse_string(str);
 }
 
-static raw_string_t resolve_string(raw_string_t string, size_t idx, int depth) {
+static raw_string_t resolve_string(lname_view_t const *view, raw_string_t string, size_t idx, int depth) {
     if (string.terminal)
         return string;
 
@@ -326,19 +544,10 @@ static raw_string_t resolve_string(raw_string_t string, size_t idx, int depth) {
         return raw_null;
     }
 
-    // This is safe because we are always pointing into a cstr
-    // the next character is, at worst, already a '\0'
-    char char_bak              = string.pointer[string.len];
-    string.pointer[string.len] = '\0';
-
-    logical_name_target_t *name;
-    khint_t                k = kh_get(lnametable, logical_name_table, string.pointer);
-    if (k == kh_end(logical_name_table)) {
-        string.pointer[string.len] = char_bak; // Restore character
+    logical_name_target_t const *name = view_get(view, string.pointer, string.len);
+    if (!name) {
         return string;
     } else {
-        string.pointer[string.len] = char_bak; // Restore character
-        name                       = &kh_val(logical_name_table, k);
         raw_string_t new_string;
         if (name->target_count > 1) {
             // If we see an invalid index just get the first one
@@ -349,11 +558,11 @@ static raw_string_t resolve_string(raw_string_t string, size_t idx, int depth) {
         } else {
             new_string = raw_from_cstr((char *)name->target[0], name->terminal);
         }
-        return resolve_string(new_string, idx, ++depth);
+        return resolve_string(view, new_string, idx, ++depth);
     }
 }
 
-static raw_string_t resolve_device_string(raw_string_t string, size_t idx, int depth) {
+static raw_string_t resolve_device_string(lname_view_t const *view, raw_string_t string, size_t idx, int depth) {
     if (string.terminal)
         return string;
 
@@ -363,21 +572,33 @@ static raw_string_t resolve_device_string(raw_string_t string, size_t idx, int d
 
     // Special case for devices. Once we have a valid device path we don't
     // actually know whether the logical name is for DEVICE or DEVICE:
-    // so we need to try both. We can rely on the fact that the input string
-    // must have contained a ':' at some point, so there is definitely enough
-    // space.
-
-    char char_bak               = string.pointer[string.len];
-    string.pointer[string.len]  = ':';
-    string.len                 += 1;
+    // so we need to try both. A device from a path is still followed by its
+    // ':', one that a logical name expanded to is copied to add it, the
+    // tables are shared with other readers and stay as they are.
+    raw_string_t with_colon = string;
+    char         buf[64];
+    char        *copy = NULL;
+    if (string.pointer[string.len] != ':') {
+        copy = string.len + 1 < sizeof(buf) ? buf : malloc(string.len + 2);
+        if (!copy) {
+            return resolve_string(view, string, idx, depth);
+        }
+        memcpy(copy, string.pointer, string.len);
+        copy[string.len]     = ':';
+        copy[string.len + 1] = '\0';
+        with_colon.pointer   = copy;
+    }
+    with_colon.len += 1;
 
-    raw_string_t new_string = resolve_string(string, idx, depth);
+    raw_string_t new_string = resolve_string(view, with_colon, idx, depth);
+    bool         unchanged  = raw_cmp(&with_colon, &new_string);
+    if (copy && copy != buf) {
+        free(copy);
+    }
 
-    if (raw_cmp(&string, &new_string)) {
+    if (unchanged) {
         // This didn't work. Try without the ':'
-        string.len                 -= 1;
-        string.pointer[string.len]  = char_bak;
-        return resolve_string(string, idx, depth);
+        return resolve_string(view, string, idx, depth);
     }
 
     // Don't strip any trailing ':', this avoids trouble if both DEVICE
@@ -385,19 +606,20 @@ static raw_string_t resolve_device_string(raw_string_t string, size_t idx, int d
     return new_string;
 }
 
-static parsed_components_t _logical_name_resolve(parsed_components_t path, size_t list_idx, int depth) {
+static parsed_components_t
+    _logical_name_resolve(lname_view_t const *view, parsed_components_t path, size_t list_idx, int depth) {
     if (depth > RESOLVE_MAX_DEPTH) {
         return parsed_components_null;
     }
 
     if (path.unparsable.len) {
         // Just a string
-        raw_string_t res = resolve_string(path.unparsable, 0, depth + 1);
+        raw_string_t res = resolve_string(view, path.unparsable, 0, depth + 1);
         if (res.count > 1) {
             if (path.count == 1) {
                 // Set the result count to our first list
                 path.count = res.count;
-                res        = resolve_string(path.unparsable, list_idx, depth + 1);
+                res        = resolve_string(view, path.unparsable, list_idx, depth + 1);
             }
         }
 
@@ -410,19 +632,19 @@ static parsed_components_t _logical_name_resolve(parsed_components_t path, size_
         parsed_components_t new_path = parse_string(res);
         // Make sure we don't lose our result count
         new_path.count               = path.count;
-        return (_logical_name_resolve(new_path, 0, depth + 1));
+        return (_logical_name_resolve(view, new_path, 0, depth + 1));
     }
 
     parsed_components_t orig_path = path;
 
     // Actual path of some kind
-    raw_string_t new_device = resolve_device_string(path.device, 0, depth + 1);
+    raw_string_t new_device = resolve_device_string(view, path.device, 0, depth + 1);
     if (new_device.count > 1) {
         if (path.count == 1) {
             // Set the result count to our first list
             path.count = new_device.count;
             // Re-resolve using the first list, only the first time
-            new_device = resolve_device_string(path.device, list_idx, depth + 1);
+            new_device = resolve_device_string(view, path.device, list_idx, depth + 1);
         }
     }
 
@@ -460,25 +682,91 @@ static parsed_components_t _logical_name_resolve(parsed_components_t path, size_
         }
     }
 
-    path.filename = resolve_string(path.filename, 0, depth + 1);
+    path.filename = resolve_string(view, path.filename, 0, depth + 1);
     for (int i = 0; i < path.dir_count; ++i) {
-        path.dir_components[i] = resolve_string(path.dir_components[i], 0, depth + 1);
+        path.dir_components[i] = resolve_string(view, path.dir_components[i], 0, depth + 1);
     }
 
     if (path_cmp(&orig_path, &path)) {
         return path;
     }
 
-    return _logical_name_resolve(path, list_idx, depth + 1);
+    return _logical_name_resolve(view, path, list_idx, depth + 1);
+}
+
+static void cache_entry_free(cache_entry_t *entry) {
+    for (size_t i = 0; i < entry->result_count; ++i) {
+        free(entry->results[i]);
+    }
+    free(entry->results);
+    free(entry);
+}
+
+// With the cache locked
+static void cache_flush() {
+    char const    *path;
+    cache_entry_t *entry;
+    kh_foreach(logical_name_cache, path, entry, {
+        free((void *)path);
+        cache_entry_free(entry);
+    });
+    kh_clear(lnamecache, logical_name_cache);
+}
+
+// Resolve logical_name for every index of its search list
+static cache_entry_t *cache_entry_resolve(char const *logical_name) {
+    cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+    if (!entry) {
+        return NULL;
+    }
+    entry->generation = atomic_load(&cache_generation);
+
+    char *tmp = strdup(logical_name);
+    if (!tmp) {
+        free(entry);
+        return NULL;
+    }
+    logical_name_result_t result = logical_name_resolve(tmp, 0);
+    free(tmp);
+    if (!result.result_count) {
+        return entry;
+    }
+
+    entry->results = calloc(result.result_count, sizeof(char *));
+    if (!entry->results) {
+        logical_name_result_free(result);
+        free(entry);
+        return NULL;
+    }
+    entry->result_count = result.result_count;
+    entry->results[0]   = result.result;
+
+    for (size_t i = 1; i < entry->result_count; ++i) {
+        tmp    = strdup(logical_name);
+        result = logical_name_resolve(tmp, i);
+        free(tmp);
+        entry->results[i] = result.result;
+    }
+
+    return entry;
 }
 
 bool logical_names_system_init() {
     ESP_LOGI(TAG, "Initializing");
-    logical_name_table = kh_init(lnametable);
+    logical_name_cache = kh_init(lnamecache);
+#ifndef RUN_TEST
+    cache_lock = xSemaphoreCreateMutex();
+    table_lock = xSemaphoreCreateMutex();
+    if (!cache_lock || !table_lock) {
+        ESP_LOGE(TAG, "Unable to create the logical name locks");
+        return false;
+    }
+#endif
     return true;
 }
 
-int logical_name_set(char const *logical_name, char const *target, bool is_terminal) {
+// Split target into a search list
+static bool target_parse(char const *target, bool is_terminal, logical_name_target_t *out) {
     logical_name_target_t name;
     name.target_count  = 0;
     size_t name_size   = strlen(target);
@@ -533,26 +821,63 @@ int logical_name_set(char const *logical_name, char const *target, bool is_termi
     name.terminal = is_terminal;
 
     if (name.target_count) {
-        khash_insert_str(lnametable, logical_name_table, logical_name, name, char const *);
-        return 0;
+        *out = name;
+        return true;
     }
 
     free(name.target);
-    return 1;
+    return false;
+}
+
+int logical_name_set(char const *logical_name, char const *target, bool is_terminal) {
+    logical_name_target_t name;
+    if (!target_parse(target, is_terminal, &name)) {
+        return 1;
+    }
+
+    table_update(&system_table, logical_name, &name);
+    atomic_fetch_add(&cache_generation, 1);
+    return 0;
 }
 
 logical_name_target_t logical_name_get(char const *logical_name) {
-    khint_t k = kh_get(lnametable, logical_name_table, logical_name);
-    if (k == kh_end(logical_name_table)) {
-        logical_name_target_t res = {NULL, 0, false};
-        return res;
-    } else {
-        return kh_val(logical_name_table, k);
+    logical_name_target_t res   = {NULL, 0, false};
+    unsigned              epoch = lname_read_begin();
+
+    bool   found;
+    size_t pos = table_find(atomic_load(&system_table), logical_name, strlen(logical_name), &found);
+    if (found) {
+        res = atomic_load(&system_table)->entries[pos]->target;
     }
+
+    lname_read_end(epoch);
+    return res;
 }
 
 void logical_name_del(char const *logical_name) {
-    khash_del_str(lnametable, logical_name_table, logical_name, "Logical name did not exist");
+    if (table_update(&system_table, logical_name, NULL)) {
+        ESP_LOGE(TAG, "Logical name did not exist: %s", logical_name);
+    }
+    atomic_fetch_add(&cache_generation, 1);
+}
+
+int logical_name_process_set(char const *logical_name, char const *target, bool is_terminal) {
+    logical_name_table_t *_Atomic *slot = logical_name_process_table();
+    logical_name_target_t          name;
+    if (!slot || !target_parse(target, is_terminal, &name)) {
+        return 1;
+    }
+
+    table_update(slot, logical_name, &name);
+    return 0;
+}
+
+int logical_name_process_del(char const *logical_name) {
+    logical_name_table_t *_Atomic *slot = logical_name_process_table();
+    if (!slot) {
+        return 1;
+    }
+    return table_update(slot, logical_name, NULL);
 }
 
 logical_name_result_t logical_name_resolve(char *logical_name, size_t idx) {
@@ -563,25 +888,182 @@ logical_name_result_t logical_name_resolve(char *logical_name, size_t idx) {
         result.result       = NULL;
         goto out;
     }
-    parsed_components_t parsed = _logical_name_resolve(parse_cstring(logical_name), idx, 0);
+    // The results point into the tables until they are serialized
+    unsigned            epoch  = lname_read_begin();
+    lname_view_t        view   = lname_view();
+    parsed_components_t parsed = _logical_name_resolve(&view, parse_cstring(logical_name), idx, 0);
     result.result              = parsed_components_serialize(parsed);
     result.result_count        = parsed.count;
+    lname_read_end(epoch);
 
 out:
     return result;
 }
 
+// With the cache locked. NULL if path is not cached or a logical name changed since.
+static cache_entry_t *cache_get(char const *path) {
+    khint_t k = kh_get(lnamecache, logical_name_cache, path);
+    if (k == kh_end(logical_name_cache)) {
+        return NULL;
+    }
+
+    cache_entry_t *entry = kh_val(logical_name_cache, k);
+    if (entry->generation == atomic_load(&cache_generation)) {
+        return entry;
+    }
+
+    free((void *)kh_key(logical_name_cache, k));
+    kh_del(lnamecache, logical_name_cache, k);
+    cache_entry_free(entry);
+    return NULL;
+}
+
+// With the cache locked. False if entry was not taken, the caller frees it then.
+static bool cache_put(char const *path, cache_entry_t *entry) {
+    if (kh_size(logical_name_cache) >= CACHE_MAX_ENTRIES) {
+        cache_flush();
+    }
+
+    char *key = strdup(path);
+    if (!key) {
+        return false;
+    }
+
+    int     r;
+    khint_t k = kh_put(lnamecache, logical_name_cache, key, &r);
+    if (r <= 0) {
+        // Another task was quicker, or there is no memory
+        free(key);
+        return false;
+    }
+
+    kh_val(logical_name_cache, k) = entry;
+    return true;
+}
+
+static logical_name_result_t cache_entry_result(cache_entry_t const *entry, size_t idx) {
+    logical_name_result_t result = {NULL, entry->result_count};
+    if (entry->result_count) {
+        // An index out of range gets the first one, like a search list does
+        char const *path = entry->results[idx < entry->result_count ? idx : 0];
+        result.result    = path ? strdup(path) : NULL;
+    }
+    return result;
+}
+
+// True if the calling process has logical names of its own, what paths resolve
+// to is then not the same for everyone
+static bool process_names_in_use(void) {
+    unsigned     epoch = lname_read_begin();
+    lname_view_t view  = lname_view();
+    bool         used  = view.process && view.process->count;
+    lname_read_end(epoch);
+    return used;
+}
+
+// Lock the cache and get the entry of logical_name, resolved now if it isn't
+// cached. NULL without memory, the cache isn't locked then. If *owned the
+// entry is not in the cache, which isn't locked, and cache_release() frees it.
+static cache_entry_t *cache_acquire(char const *logical_name, bool *owned) {
+    *owned = false;
+
+    if (process_names_in_use()) {
+        *owned = true;
+        return cache_entry_resolve(logical_name);
+    }
+
+    CACHE_LOCK();
+    cache_entry_t *entry = cache_get(logical_name);
+    if (entry) {
+        return entry;
+    }
+    CACHE_UNLOCK();
+
+    // Other paths can be looked up meanwhile
+    entry = cache_entry_resolve(logical_name);
+    if (!entry) {
+        return NULL;
+    }
+
+    CACHE_LOCK();
+    if (!cache_put(logical_name, entry)) {
+        CACHE_UNLOCK();
+        *owned = true;
+    }
+    return entry;
+}
+
+static void cache_release(cache_entry_t *entry, bool owned) {
+    if (owned) {
+        cache_entry_free(entry);
+    } else {
+        CACHE_UNLOCK();
+    }
+}
+
+// Resolved once for every index of its search list, until a logical name changes
 logical_name_result_t logical_name_resolve_const(char const *logical_name, size_t idx) {
-    char                 *tmp    = strdup(logical_name);
-    logical_name_result_t result = logical_name_resolve(tmp, idx);
-    free(tmp);
+    logical_name_result_t result = {NULL, 0};
+    if (!logical_name || !strlen(logical_name)) {
+        return result;
+    }
+
+    bool           owned;
+    cache_entry_t *entry = cache_acquire(logical_name, &owned);
+    if (!entry) {
+        char *tmp = strdup(logical_name);
+        result    = logical_name_resolve(tmp, idx);
+        free(tmp);
+        return result;
+    }
+
+    result = cache_entry_result(entry, idx);
+    cache_release(entry, owned);
     return result;
 }
 
+logical_name_list_t *logical_name_resolve_all(char const *logical_name) {
+    if (!logical_name) {
+        return NULL;
+    }
+
+    bool           owned;
+    cache_entry_t *entry = cache_acquire(logical_name, &owned);
+    if (!entry) {
+        return NULL;
+    }
+
+    size_t size = sizeof(logical_name_list_t) + entry->result_count * sizeof(char *);
+    for (size_t i = 0; i < entry->result_count; ++i) {
+        size += entry->results[i] ? strlen(entry->results[i]) + 1 : 0;
+    }
+
+    logical_name_list_t *list = malloc(size);
+    if (list) {
+        char *strings      = (char *)&list->results[entry->result_count];
+        list->result_count = entry->result_count;
+        for (size_t i = 0; i < entry->result_count; ++i) {
+            list->results[i] = NULL;
+            if (entry->results[i]) {
+                size_t len       = strlen(entry->results[i]) + 1;
+                list->results[i] = memcpy(strings, entry->results[i], len);
+                strings         += len;
+            }
+        }
+    }
+
+    cache_release(entry, owned);
+    return list;
+}
+
 void logical_name_result_free(logical_name_result_t result) {
     free(result.result);
 }
 
+void logical_name_list_free(logical_name_list_t *list) {
+    free(list);
+}
+
 #ifdef RUN_TEST
 
 typedef struct {
@@ -721,50 +1203,108 @@ int main() {
 
     logical_name_result_t res;
 
-    test_t *test = tests;
-    while (test->in) {
-        printf("=== Running test for '%s' ('%s') === \n", test->in, test->expect);
-        res       = logical_name_resolve_const(test->in, test->idx);
-        bool fail = false;
-
-        if (res.result_count != test->expect_count)
-            fail = true;
-        if (res.result_count && test->expect && strcmp(test->expect, res.result) != 0)
-            fail = true;
-        if (res.result_count && !test->expect)
-            fail = true;
-        if (!res.result_count && test->expect)
-            fail = true;
-
-        if (fail) {
+    // The second pass is answered from the cache
+    for (int pass = 0; pass < 2; ++pass) {
+        test_t *test = tests;
+        while (test->in) {
+            printf("=== Running test for '%s' ('%s') === \n", test->in, test->expect);
+            res       = logical_name_resolve_const(test->in, test->idx);
+            bool fail = false;
+
+            if (res.result_count != test->expect_count)
+                fail = true;
+            if (res.result_count && test->expect && strcmp(test->expect, res.result) != 0)
+                fail = true;
+            if (res.result_count && !test->expect)
+                fail = true;
+            if (!res.result_count && test->expect)
+                fail = true;
+
+            if (fail) {
+                printf(
+                    "\033[31mTestcase '%s' failed.\n\tExpected: '%s'\n\tActual:   '%s'\n\tCount:    %zi\n\tActual:   "
+                    "%zi\033[0m\n",
+                    test->in,
+                    test->expect,
+                    res.result,
+                    test->expect_count,
+                    res.result_count
+                );
+                // raw_print() terminates the components in place, so not on the literal
+                char *in = strdup(test->in);
+                parsed_components_dump(parse_cstring(in));
+                free(in);
+                error = true;
+            }
+            printf("=== End     test for %s === \n\n", test->in);
+            free(res.result);
+            ++test;
+        }
+    }
+
+    // All of a search list at once
+    logical_name_list_t *list = logical_name_resolve_all("SEARCH:");
+    if (!list || list->result_count != 2 || strcmp(list->results[0], "DRIVE0:[SUBDIR]") != 0 ||
+        strcmp(list->results[1], "DRIVE0:[SUBDIR.ANOTHER]") != 0) {
+        printf("\033[31mlogical_name_resolve_all(\"SEARCH:\") returned the wrong list\033[0m\n");
+        error = true;
+    }
+    logical_name_list_free(list);
+
+    // Cached results follow changes to the logical names they went through
+    char const *cache_expect[] = {"CACHED:file.txt", "DRIVE0:[dira]file.txt", "CACHED:file.txt"};
+    for (int i = 0; i < 3; ++i) {
+        if (i == 1) {
+            logical_name_set("CACHED", "DRIVE0:[dira]", false);
+        } else if (i == 2) {
+            logical_name_del("CACHED");
+        }
+
+        res = logical_name_resolve_const("CACHED:file.txt", 0);
+        if (res.result_count != 1 || strcmp(res.result, cache_expect[i]) != 0) {
+            printf("\033[31mCached 'CACHED:file.txt' is '%s', expected '%s'\033[0m\n", res.result, cache_expect[i]);
+            error = true;
+        }
+        free(res.result);
+    }
+
+    // Names of the process come first, and its paths are not cached
+    char const *process_expect[] = {"STRING", "PROCESS", "MYFLASH:[dira.PROCESS]FILE", "STRING"};
+    char const *process_in[]     = {"SIMPLE", "SIMPLE", "USER:[DIR1]FILE", "SIMPLE"};
+    for (int i = 0; i < 4; ++i) {
+        if (i == 1) {
+            logical_name_process_set("SIMPLE", "PROCESS", false);
+            logical_name_process_set("DIR1", "PROCESS", false);
+        } else if (i == 3) {
+            logical_name_process_del("SIMPLE");
+            logical_name_process_del("DIR1");
+        }
+
+        res = logical_name_resolve_const(process_in[i], 0);
+        if (res.result_count != 1 || strcmp(res.result, process_expect[i]) != 0) {
             printf(
-                "\033[31mTestcase '%s' failed.\n\tExpected: '%s'\n\tActual:   '%s'\n\tCount:    %zi\n\tActual:   "
-                "%zi\033[0m\n",
-                test->in,
-                test->expect,
+                "\033[31mProcess '%s' is '%s', expected '%s'\033[0m\n",
+                process_in[i],
                 res.result,
-                test->expect_count,
-                res.result_count
+                process_expect[i]
             );
             error = true;
         }
-        printf("=== End     test for %s === \n\n", test->in);
         free(res.result);
-        ++test;
+    }
+    if (logical_name_process_del("SIMPLE") != 1) {
+        printf("\033[31mDeleted a process logical name twice\033[0m\n");
+        error = true;
     }
 
     if (!error) {
         printf("\033[32mAll tests passed\033[0m\n");
     }
 
-    logical_name_target_t x;
-    kh_foreach_value(logical_name_table, x, {
-        for (size_t i = 0; i < x.target_count; ++i) {
-            free((void *)x.target[i]);
-        }
-        free((void *)x.target);
-    });
-    kh_destroy(lnametable, logical_name_table);
+    logical_name_table_free(atomic_load(&test_process_table));
+    logical_name_table_free(atomic_load(&system_table));
+    cache_flush();
+    kh_destroy(lnamecache, logical_name_cache);
 
     if (error)
         return 1;
@@ -25,12 +25,21 @@ typedef struct {
     size_t result_count;
 } logical_name_result_t;
 
+// Every path a search list expands to, in one allocation
+typedef struct {
+    size_t result_count;
+    char  *results[]; // Followed by the strings
+} logical_name_list_t;
+
 typedef struct {
     char **target;
     size_t target_count;
     bool   terminal;
 } logical_name_target_t;
 
+// A set of logical names, the system wide one and one per process
+typedef struct logical_name_table logical_name_table_t;
+
 bool                  logical_names_system_init();
 int                   logical_name_set(char const *logical_name, char const *target, bool is_terminal);
 logical_name_target_t logical_name_get(char const *logical_name);
@@ -38,3 +47,17 @@ void                  logical_name_del(char const *logical_name);
 void                  logical_name_result_free(logical_name_result_t result);
 logical_name_result_t logical_name_resolve(char *logical_name, size_t idx);
 logical_name_result_t logical_name_resolve_const(char const *logical_name, size_t idx);
+// NULL if logical_name is NULL or there is no memory
+logical_name_list_t  *logical_name_resolve_all(char const *logical_name);
+// Accepts NULL
+void                  logical_name_list_free(logical_name_list_t *list);
+
+// Names of the calling process, looked up before the system wide ones like
+// DEFINE/PROCESS on VMS. Paths are not cached for a process that has any.
+int                   logical_name_process_set(char const *logical_name, char const *target, bool is_terminal);
+// 1 if it didn't exist
+int                   logical_name_process_del(char const *logical_name);
+// Where the calling process keeps its table, NULL if it can't have one
+logical_name_table_t *_Atomic *logical_name_process_table(void);
+// Once nothing can look at it anymore, like a process that exited
+void                  logical_name_table_free(logical_name_table_t *table);
@@ -0,0 +1,173 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "malloc_cache.h"
+
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "memory.h"
+#include "task.h"
+#include "thirdparty/dlmalloc.h"
+
+#define MALLOC_CACHE_CLASSES 10
+#define MALLOC_CACHE_MAX     512
+// Chunks kept per class and core, and how many move to or from the arena at once
+#define MALLOC_CACHE_DEPTH   16
+#define MALLOC_CACHE_BATCH   4
+
+typedef struct {
+    portMUX_TYPE lock;
+    void        *free[MALLOC_CACHE_CLASSES]; // Linked through their first word
+    uint8_t      count[MALLOC_CACHE_CLASSES];
+} malloc_cache_t;
+
+static size_t const class_size[MALLOC_CACHE_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+
+static DRAM_ATTR malloc_cache_t caches[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = {.lock = portMUX_INITIALIZER_UNLOCKED},
+};
+
+// A task may move to the other core right after looking up its cache, that is
+// fine, the cache is locked and every chunk in it is as good as any other
+__attribute__((always_inline)) static inline malloc_cache_t *this_cache(void) {
+    return &caches[xPortGetCoreID()];
+}
+
+static IRAM_ATTR void arena_free_list(void *ptr) {
+    malloc_arena_t *arena = kernel_task.malloc_arena;
+
+    xSemaphoreTake(arena->lock, portMAX_DELAY);
+    while (ptr) {
+        void *next = *(void **)ptr;
+        mspace_free(&arena->state, ptr);
+        ptr = next;
+    }
+    xSemaphoreGive(arena->lock);
+}
+
+// Take a batch from the arena, return one and cache the rest
+static IRAM_ATTR void *refill(malloc_cache_t *cache, int cls) {
+    malloc_arena_t *arena = kernel_task.malloc_arena;
+    void           *batch = NULL;
+    void           *ptr;
+
+    xSemaphoreTake(arena->lock, portMAX_DELAY);
+    malloc_arena_drain(arena);
+    ptr = mspace_malloc(&arena->state, class_size[cls]);
+    for (int i = 1; ptr && i < MALLOC_CACHE_BATCH; ++i) {
+        void *extra = mspace_malloc(&arena->state, class_size[cls]);
+        if (!extra) {
+            break;
+        }
+        *(void **)extra = batch;
+        batch           = extra;
+    }
+    xSemaphoreGive(arena->lock);
+
+    portENTER_CRITICAL(&cache->lock);
+    while (batch && cache->count[cls] < MALLOC_CACHE_DEPTH) {
+        void *next       = *(void **)batch;
+        *(void **)batch  = cache->free[cls];
+        cache->free[cls] = batch;
+        batch            = next;
+        ++cache->count[cls];
+    }
+    portEXIT_CRITICAL(&cache->lock);
+
+    // The other core filled the cache meanwhile
+    if (batch) {
+        arena_free_list(batch);
+    }
+    return ptr;
+}
+
+void IRAM_ATTR *malloc_cache_alloc(size_t size) {
+    if (size > MALLOC_CACHE_MAX) {
+        return NULL;
+    }
+
+    int cls = 0;
+    while (class_size[cls] < size) {
+        ++cls;
+    }
+
+    malloc_cache_t *cache = this_cache();
+    portENTER_CRITICAL(&cache->lock);
+    void *ptr = cache->free[cls];
+    if (ptr) {
+        cache->free[cls] = *(void **)ptr;
+        --cache->count[cls];
+    }
+    portEXIT_CRITICAL(&cache->lock);
+
+    return ptr ? ptr : refill(cache, cls);
+}
+
+bool IRAM_ATTR malloc_cache_free(void *ptr) {
+    if (!in_kernel_heap(ptr)) {
+        return false;
+    }
+
+    // The header of a chunk in use is only touched by whoever owns it, so no lock
+    size_t usable = mspace_usable_size(ptr);
+    if (usable < class_size[0] || usable >= class_size[MALLOC_CACHE_CLASSES - 1] + 2 * sizeof(size_t)) {
+        return false;
+    }
+
+    int cls = MALLOC_CACHE_CLASSES - 1;
+    while (class_size[cls] > usable) {
+        --cls;
+    }
+
+    malloc_cache_t *cache    = this_cache();
+    void           *overflow = NULL;
+    portENTER_CRITICAL(&cache->lock);
+    *(void **)ptr    = cache->free[cls];
+    cache->free[cls] = ptr;
+    if (++cache->count[cls] > MALLOC_CACHE_DEPTH) {
+        // Cut a batch off the head, that needs no walk to the end of the list
+        void **tail = &cache->free[cls];
+        for (int i = 0; i < MALLOC_CACHE_BATCH; ++i) {
+            tail = (void **)*tail;
+        }
+        overflow           = cache->free[cls];
+        cache->free[cls]   = *tail;
+        *tail              = NULL;
+        cache->count[cls] -= MALLOC_CACHE_BATCH;
+    }
+    portEXIT_CRITICAL(&cache->lock);
+
+    if (overflow) {
+        arena_free_list(overflow);
+    }
+    return true;
+}
+
+void malloc_cache_flush(void) {
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        malloc_cache_t *cache = &caches[core];
+        for (int cls = 0; cls < MALLOC_CACHE_CLASSES; ++cls) {
+            portENTER_CRITICAL(&cache->lock);
+            void *list        = cache->free[cls];
+            cache->free[cls]  = NULL;
+            cache->count[cls] = 0;
+            portEXIT_CRITICAL(&cache->lock);
+
+            arena_free_list(list);
+        }
+    }
+}
@@ -0,0 +1,31 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Per-core caches of small chunks in front of the kernel arena. Kernel tasks
+// take and give back small allocations without its lock, the lock is only
+// taken to refill or drain a size class a batch at a time.
+
+// NULL if size is too large for the cache or the kernel arena is out of memory
+void *malloc_cache_alloc(size_t size);
+// False if ptr isn't a kernel arena chunk the cache takes, free it as usual then
+bool  malloc_cache_free(void *ptr);
+// Give everything cached back to the kernel arena
+void  malloc_cache_flush(void);
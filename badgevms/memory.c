@@ -16,10 +16,21 @@
 
 #include "memory.h"
 
+#include "badgevms/event.h"
+#include "badgevms_config.h"
+#include "boot_profile_private.h"
+#include "compositor/compositor_private.h"
+#include "dma_mem.h"
 #include "esp_cache.h"
+#include "esp_heap_caps.h"
+#include "esp_ipc.h"
 #include "esp_log.h"
+#include "esp_mac.h"
 #include "esp_mmu_map.h"
 #include "esp_psram.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "fast_mem.h"
 #include "freertos/portmacro.h"
 #include "hal/cache_hal.h"
 #include "hal/cache_ll.h"
@@ -27,17 +38,26 @@
 #include "hal/mmu_hal.h"
 #include "hal/mmu_ll.h"
 #include "hal/mmu_types.h"
+#include "image_cache.h"
+#include "library.h"
+#include "malloc_cache.h"
+#include "nvs.h"
+#include "slab.h"
 #include "soc/ext_mem_defs.h"
 #include "soc/soc.h"
 #include "task.h"
 #include "thirdparty/dlmalloc.h"
+#include "trace.h"
+#include "why_io.h"
 #include "wrapped_funcs.h"
 
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <errno.h>
+#include <sys/param.h>
 
 typedef struct {
     uint32_t         start;   // laddr start
@@ -53,11 +73,51 @@ extern mmu_mem_region_t const g_mmu_mem_regions[SOC_MMU_LINEAR_ADDRESS_REGION_NU
 extern void spi_flash_enable_interrupts_caches_and_other_cpu(void);
 extern void spi_flash_disable_interrupts_caches_and_other_cpu(void);
 
-extern void                     init_memory_heap_caps();
-static char const              *TAG                 = "memory";
-IRAM_ATTR static volatile pid_t current_mapped_task = 0;
-static allocator_t              page_allocator;
-static allocator_t              framebuffer_allocator;
+static char const *TAG = "memory";
+static allocator_t  page_allocator;
+static allocator_t  framebuffer_allocator;
+static TaskHandle_t page_zeroer_handle;
+static TaskHandle_t memory_pressure_handle;
+static atomic_int   memory_pressure_level;
+
+static slab_cache_t range_cache =
+    SLAB_CACHE_INIT("allocation_range", sizeof(allocation_range_t), 32, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+// Buffers from dma_buffer_alloc(), mapped in the framebuffer vaddr space so
+// every task and the kernel see them at the same address
+typedef struct dma_buffer_s {
+    uintptr_t            vaddr_start;
+    size_t               num_pages;
+    allocation_range_t  *head_pages;
+    allocation_range_t  *tail_pages;
+    struct dma_buffer_s *next;
+} dma_buffer_t;
+
+static slab_cache_t dma_buffer_cache =
+    SLAB_CACHE_INIT("dma_buffer", sizeof(dma_buffer_t), 8, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+static dma_buffer_t *dma_buffers;
+static portMUX_TYPE  dma_buffers_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Most single page allocations and frees are served from a cache on the
+// current core, without taking the lock of the page allocator
+typedef struct {
+    portMUX_TYPE lock;
+    size_t       count;
+    struct {
+        uintptr_t paddr;
+        bool      zeroed;
+    } pages[PAGE_MAGAZINE_SIZE];
+} page_magazine_t;
+
+static page_magazine_t page_magazines[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = {.lock = portMUX_INITIALIZER_UNLOCKED},
+};
+
+// The address space in the MMU. A task that is switched out leaves it mapped
+// until the next task on its core turns out to be from another address space,
+// so threads of one application switch between each other without remapping.
+IRAM_ATTR static task_thread_t *volatile current_mapped_thread = NULL;
+IRAM_ATTR static task_thread_t *volatile lazy_unmap_thread[portNUM_PROCESSORS];
 
 IRAM_ATTR static portMUX_TYPE cache_mmu_mutex = portMUX_INITIALIZER_UNLOCKED;
 
@@ -192,6 +252,14 @@ __attribute__((always_inline)) static inline void writeback_caches(uintptr_t vad
     esp_cache_msync((void *)vaddr_start, len, ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_TYPE_DATA);
 }
 
+__attribute__((always_inline)) static inline void writeback_invalidate_caches(uintptr_t vaddr_start, uint32_t len) {
+    esp_cache_msync(
+        (void *)vaddr_start,
+        len,
+        ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE | ESP_CACHE_MSYNC_FLAG_TYPE_DATA
+    );
+}
+
 __attribute__((always_inline)) static inline void
     why_mmu_hal_unmap_region(uint32_t mmu_id, uint32_t vaddr, uint32_t len) {
     uint32_t page_size_in_bytes = why_mmu_hal_pages_to_bytes(mmu_id, 1); // Already inline
@@ -243,62 +311,144 @@ __attribute__((always_inline)) static inline void
     invalidate_caches(start, total_size);
 }
 
-IRAM_ATTR void remap_task(task_info_t *task_info) {
-    if (current_mapped_task) {
-        ESP_DRAM_LOGE(DRAM_STR("map_task"), "Expected task %u but actual current task is %u", 0, current_mapped_task);
-        esp_system_abort("Task info does not match");
+__attribute__((always_inline)) static inline void
+    verify_entry(uint32_t mmu_id, uint32_t entry_id, bool want_mapped, char const *function) {
+#if MMU_VERIFY_SWITCHES
+    uint32_t entry = mmu_ll_read_entry(mmu_id, entry_id);
+    if ((entry != 0) != want_mapped) {
+        esp_rom_printf("%s: entry %u is %s\n", function, entry_id, entry ? "already mapped" : "not mapped");
+        esp_system_abort("Unexpected mmu state");
     }
+#endif
+}
 
-    uint32_t mmu_id = mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+__attribute__((always_inline)) static inline void map_thread(task_thread_t *thread) {
+    if (current_mapped_thread) {
+        ESP_DRAM_LOGE(
+            DRAM_STR("map_thread"),
+            "Expected no address space but %p is still mapped, wanted %p",
+            current_mapped_thread,
+            thread
+        );
+        esp_system_abort("Address space does not match");
+    }
+
+    uint32_t mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    uint32_t first  = mmu_ll_get_entry_id(mmu_id, thread->start);
 
     critical_enter();
-    allocation_range_t *r = task_info->thread->pages;
-    while (r) {
-        why_mmu_hal_map_region(mmu_id, MMU_TARGET_PSRAM0, r->vaddr_start, r->paddr_start, r->size);
-        r = r->next;
+    for (size_t i = 0; i < thread->mmu_num_entries; ++i) {
+        verify_entry(mmu_id, first + i, false, "map_thread");
+        mmu_ll_write_entry(mmu_id, first + i, thread->mmu_entries[i], MMU_TARGET_PSRAM0);
     }
 
-    // Invalidate all caches at once
-    invalidate_caches(task_info->thread->start, task_info->thread->size);
-    current_mapped_task = task_info->pid;
+    // Nothing to invalidate, unmap_thread() left no lines of these vaddrs in the caches
+    current_mapped_thread = thread;
     critical_exit();
 }
 
-void IRAM_ATTR unmap_task(task_info_t *task_info) {
-    if (current_mapped_task != task_info->pid) {
+__attribute__((always_inline)) static inline void unmap_thread(task_thread_t *thread) {
+    if (current_mapped_thread != thread) {
         ESP_DRAM_LOGE(
-            DRAM_STR("unmap_task"),
-            "Expected task %u but actual current task is %u",
-            task_info->pid,
-            current_mapped_task
+            DRAM_STR("unmap_thread"),
+            "Expected address space %p but %p is mapped",
+            thread,
+            current_mapped_thread
         );
-        esp_system_abort("Task info does not match");
+        esp_system_abort("Address space does not match");
     }
 
-    // esp_rom_printf("Unmappingg %u\n", task_info->pid);
-    allocation_range_t *r = task_info->thread->pages;
-    if (!r) {
+    if (!thread->mmu_num_entries) {
         // Nothing to do, whatever is in ram is still in ram
         goto out;
     }
 
     uint32_t mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    uint32_t first  = mmu_ll_get_entry_id(mmu_id, thread->start);
 
+    // All address spaces share the same vaddrs, so the caches must not keep
+    // anything of this one around. Only the code can be in the instruction cache.
     critical_enter();
-    writeback_caches(task_info->thread->start, task_info->thread->size);
+    writeback_invalidate_caches(thread->start, thread->size);
+    if (thread->text_end > thread->text_start) {
+        esp_cache_msync(
+            (void *)thread->text_start,
+            thread->text_end - thread->text_start,
+            ESP_CACHE_MSYNC_FLAG_DIR_M2C | ESP_CACHE_MSYNC_FLAG_TYPE_INST
+        );
+    }
 
-    while (r) {
-        why_mmu_hal_unmap_region(mmu_id, r->vaddr_start, r->size);
-        r = r->next;
+    for (size_t i = 0; i < thread->mmu_num_entries; ++i) {
+        verify_entry(mmu_id, first + i, true, "unmap_thread");
+        mmu_ll_set_entry_invalid(mmu_id, first + i);
     }
     critical_exit();
 out:
-    current_mapped_task = 0;
+    current_mapped_thread = NULL;
+}
+
+// Record the MMU values of freshly allocated ranges of thread
+__attribute__((always_inline)) static inline void
+    snapshot_regions(task_thread_t *thread, allocation_range_t *head_range) {
+    uint32_t mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+
+    for (allocation_range_t *r = head_range; r; r = r->next) {
+        uint32_t index   = (r->vaddr_start - thread->start) / SOC_MMU_PAGE_SIZE;
+        uint32_t pages   = (r->size + SOC_MMU_PAGE_SIZE - 1) / SOC_MMU_PAGE_SIZE;
+        uint32_t mmu_val = mmu_ll_format_paddr(mmu_id, r->paddr_start, MMU_TARGET_PSRAM0);
+        for (uint32_t i = 0; i < pages; ++i) {
+            thread->mmu_entries[index + i] = mmu_val + i;
+        }
+    }
+}
+
+// Called when a task is switched in, task_info is NULL for kernel tasks. Those
+// never see an application's memory, so the pending unmap happens for them too.
+// Returns whether the MMU had to be touched.
+IRAM_ATTR bool remap_task(task_info_t *task_info) {
+    int            core    = xPortGetCoreID();
+    task_thread_t *thread  = task_info ? task_info->thread : NULL;
+    task_thread_t *pending = lazy_unmap_thread[core];
+
+    lazy_unmap_thread[core] = NULL;
+    if (pending && pending == thread) {
+        // Same address space, still mapped
+        return false;
+    }
+
+    if (pending) {
+        unmap_thread(pending);
+    }
+
+    if (thread) {
+        map_thread(thread);
+    }
+
+    return pending || thread;
+}
+
+IRAM_ATTR void unmap_task(task_info_t *task_info) {
+    if (current_mapped_thread != task_info->thread) {
+        ESP_DRAM_LOGE(
+            DRAM_STR("unmap_task"),
+            "Expected the address space of task %u but %p is mapped",
+            task_info->pid,
+            current_mapped_thread
+        );
+        esp_system_abort("Task info does not match");
+    }
+
+    lazy_unmap_thread[xPortGetCoreID()] = task_info->thread;
 }
 
 IRAM_ATTR void pages_deallocate(allocation_range_t *head_range) {
-    allocation_range_t *r = head_range;
-    while (r) {
+    pages_deallocate_some(head_range, SIZE_MAX);
+}
+
+IRAM_ATTR allocation_range_t *pages_deallocate_some(allocation_range_t *head_range, size_t max_pages) {
+    allocation_range_t *r     = head_range;
+    size_t              freed = 0;
+    while (r && freed < max_pages) {
         ESP_LOGI(
             TAG,
             "Deallocating page. vaddr_start = %p, paddr_start = %p, size = %zi",
@@ -306,11 +456,259 @@ IRAM_ATTR void pages_deallocate(allocation_range_t *head_range) {
             (void *)r->paddr_start,
             r->size
         );
-        page_deallocate(r->paddr_start);
+        if (!r->shared && !r->hibernated) {
+            page_deallocate(r->paddr_start);
+            freed += r->size / SOC_MMU_PAGE_SIZE;
+        }
         allocation_range_t *n = r->next;
-        free(r);
+        slab_free(&range_cache, r);
         r = n;
     }
+    return r;
+}
+
+static void page_zeroer_wake() {
+    if (page_zeroer_handle && buddy_get_zeroed_pages(&page_allocator) < ZEROED_PAGES_TARGET) {
+        xTaskNotifyGive(page_zeroer_handle);
+    }
+}
+
+static memory_pressure_t memory_pressure_level_for(size_t free_pages) {
+    size_t total_pages = get_total_psram_pages();
+
+    if (free_pages * 100 < total_pages * MEMORY_PRESSURE_CRITICAL_PERCENT) {
+        return MEMORY_PRESSURE_CRITICAL;
+    }
+    if (free_pages * 100 < total_pages * MEMORY_PRESSURE_LOW_PERCENT) {
+        return MEMORY_PRESSURE_LOW;
+    }
+    return MEMORY_PRESSURE_NONE;
+}
+
+static void memory_pressure_set(memory_pressure_t level) {
+    if (atomic_exchange(&memory_pressure_level, level) != level && memory_pressure_handle) {
+        xTaskNotifyGive(memory_pressure_handle);
+    }
+}
+
+// Pages were taken or given back
+static void free_pages_changed() {
+    page_zeroer_wake();
+    memory_pressure_set(memory_pressure_level_for(get_free_psram_pages()));
+}
+
+__attribute__((always_inline)) static inline uintptr_t magazine_pop(page_magazine_t *magazine, bool *zeroed) {
+    uintptr_t paddr = 0;
+
+    portENTER_CRITICAL(&magazine->lock);
+    if (magazine->count) {
+        --magazine->count;
+        paddr   = magazine->pages[magazine->count].paddr;
+        *zeroed = magazine->pages[magazine->count].zeroed;
+    }
+    portEXIT_CRITICAL(&magazine->lock);
+
+    return paddr;
+}
+
+static void magazine_refill(page_magazine_t *magazine) {
+    void  *pages[PAGE_MAGAZINE_SIZE / 2];
+    bool   zeroed[PAGE_MAGAZINE_SIZE / 2];
+    size_t count = buddy_allocate_pages(&page_allocator, pages, PAGE_MAGAZINE_SIZE / 2, 0, BUDDY_FLAG_PREFER_ZEROED);
+    size_t i     = 0;
+
+    for (size_t k = 0; k < count; ++k) {
+        zeroed[k] = buddy_is_zeroed(&page_allocator, pages[k]);
+    }
+
+    portENTER_CRITICAL(&magazine->lock);
+    for (; i < count && magazine->count < PAGE_MAGAZINE_SIZE; ++i, ++magazine->count) {
+        magazine->pages[magazine->count].paddr  = ADDR_TO_PADDR((uintptr_t)pages[i]);
+        magazine->pages[magazine->count].zeroed = zeroed[i];
+    }
+    portEXIT_CRITICAL(&magazine->lock);
+
+    // Another task on this core filled it in the meantime
+    if (i < count) {
+        buddy_deallocate_pages(&page_allocator, pages + i, count - i);
+    }
+}
+
+// A single page from the magazine of this core. When the allocator is out of
+// single pages the other magazines are tried too.
+static uintptr_t magazine_take(bool *zeroed) {
+    page_magazine_t *magazine = &page_magazines[xPortGetCoreID()];
+    uintptr_t        paddr    = magazine_pop(magazine, zeroed);
+
+    if (!paddr) {
+        magazine_refill(magazine);
+        paddr = magazine_pop(magazine, zeroed);
+    }
+
+    for (int i = 0; !paddr && i < portNUM_PROCESSORS; ++i) {
+        paddr = magazine_pop(&page_magazines[i], zeroed);
+    }
+
+    return paddr;
+}
+
+// A full magazine gives back half of its pages with one allocator lock
+static void magazine_put(uintptr_t paddr) {
+    page_magazine_t *magazine = &page_magazines[xPortGetCoreID()];
+    void            *drained[PAGE_MAGAZINE_SIZE / 2];
+    size_t           count    = 0;
+
+    portENTER_CRITICAL(&magazine->lock);
+    if (magazine->count == PAGE_MAGAZINE_SIZE) {
+        for (; count < PAGE_MAGAZINE_SIZE / 2; ++count) {
+            drained[count] = (void *)PADDR_TO_ADDR(magazine->pages[--magazine->count].paddr);
+        }
+    }
+    magazine->pages[magazine->count].paddr  = paddr;
+    magazine->pages[magazine->count].zeroed = false;
+    ++magazine->count;
+    portEXIT_CRITICAL(&magazine->lock);
+
+    if (count) {
+        buddy_deallocate_pages(&page_allocator, drained, count);
+        free_pages_changed();
+    }
+}
+
+// Like page_allocate(), but takes pages the page zeroer cleared if there are any
+static uintptr_t page_allocate_zeroed(size_t size, bool *zeroed) {
+    if (size <= SOC_MMU_PAGE_SIZE) {
+        uintptr_t paddr = magazine_take(zeroed);
+        if (paddr) {
+            return paddr;
+        }
+    }
+
+    void *ret = buddy_allocate(&page_allocator, size, 0, BUDDY_FLAG_PREFER_ZEROED);
+    if (ret) {
+        *zeroed = buddy_is_zeroed(&page_allocator, ret);
+        return ADDR_TO_PADDR((uintptr_t)ret);
+    }
+    *zeroed = false;
+    return 0;
+}
+
+// Clear one block of free pages through the zeroing window. Nothing of the
+// window may stay in the caches, the next block is mapped at the same address.
+static void zero_pages(uintptr_t paddr_start, size_t size) {
+    uint32_t mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+
+    critical_enter();
+    why_mmu_hal_map_region(mmu_id, MMU_TARGET_PSRAM0, ZERO_WINDOW_START, paddr_start, size);
+    critical_exit();
+
+    // By DMA where possible, so even the idle core is free meanwhile
+    dma_mem_fill((void *)ZERO_WINDOW_START, 0, size);
+
+    critical_enter();
+    {
+        writeback_invalidate_caches(ZERO_WINDOW_START, size);
+        why_mmu_hal_unmap_region(mmu_id, ZERO_WINDOW_START, size);
+    }
+    critical_exit();
+}
+
+// Hestia keeps ZEROED_PAGES_TARGET free pages cleared, so heaps and framebuffers
+// mostly get memory that is zero already. She sleeps until pages are taken or
+// freed and runs at the lowest priority, only when the core has nothing else to do.
+static void hestia(void *ignored) {
+    while (1) {
+        void  *block = NULL;
+        size_t size  = 0;
+
+        if (buddy_get_zeroed_pages(&page_allocator) < ZEROED_PAGES_TARGET) {
+            block = buddy_allocate_dirty(&page_allocator, ZERO_WINDOW_SIZE, BLOCK_TYPE_PAGE, &size);
+        }
+
+        if (!block) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        zero_pages(ADDR_TO_PADDR((uintptr_t)block), size);
+        buddy_deallocate_zeroed(&page_allocator, block);
+    }
+}
+
+// Mnemosyne tells every window when the memory pressure level changes. Once it
+// is critical she first drops the cached program images and libraries nobody
+// is running.
+static void mnemosyne(void *ignored) {
+    memory_pressure_t reported = MEMORY_PRESSURE_NONE;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        memory_pressure_t level = atomic_load(&memory_pressure_level);
+        if (level == reported) {
+            continue;
+        }
+        reported = level;
+
+        if (level == MEMORY_PRESSURE_CRITICAL) {
+            image_cache_shrink(0);
+            library_shrink();
+        }
+
+        event_t e = {
+            .type            = EVENT_MEMORY_PRESSURE,
+            .memory_pressure = {
+                .level       = level,
+                .free_pages  = get_free_psram_pages(),
+                .total_pages = get_total_psram_pages(),
+            },
+        };
+        ESP_LOGW(
+            TAG,
+            "Memory pressure level %i, %lu of %lu pages free",
+            level,
+            e.memory_pressure.free_pages,
+            e.memory_pressure.total_pages
+        );
+        compositor_broadcast_event(&e);
+    }
+}
+
+bool memory_pressure_init() {
+    if (create_kernel_task(mnemosyne, "Mnemosyne", 3072, NULL, 9, &memory_pressure_handle, 1) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create MNEMOSYNE task");
+        return false;
+    }
+    return true;
+}
+
+// Applications get a chance to act on the memory pressure event before an
+// allocation of theirs fails, true if enough pages came free in time
+static bool memory_reclaim_wait(size_t pages) {
+    memory_pressure_set(MEMORY_PRESSURE_CRITICAL);
+
+    for (int waited = 0; waited < MEMORY_RECLAIM_WAIT_MS; waited += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        if (get_free_psram_pages() >= pages) {
+            return true;
+        }
+    }
+
+    // Back to what the free pages say, so the next shortage is reported again
+    memory_pressure_set(memory_pressure_level_for(get_free_psram_pages()));
+    return false;
+}
+
+memory_pressure_t memory_pressure_get(void) {
+    return atomic_load(&memory_pressure_level);
+}
+
+bool page_zeroer_init() {
+    if (create_kernel_task(hestia, "Hestia", 3072, NULL, 1, &page_zeroer_handle, 0) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create HESTIA task");
+        return false;
+    }
+    return true;
 }
 
 IRAM_ATTR bool pages_allocate(
@@ -319,7 +717,7 @@ IRAM_ATTR bool pages_allocate(
     *head_range = NULL;
     *tail_range = NULL;
 
-    if (pages > buddy_get_free_pages(&page_allocator)) {
+    if (pages > get_free_psram_pages()) {
         return false;
     }
 
@@ -335,11 +733,11 @@ IRAM_ATTR bool pages_allocate(
     while (to_allocate) {
         uintptr_t new_page = 0;
         allocate_size      = allocate_size > to_allocate ? to_allocate : allocate_size;
-        ESP_LOGI(TAG, "Attempting allocation of size %li pages\n", allocate_size);
+        ESP_LOGV(TAG, "Attempting allocation of size %li pages\n", allocate_size);
 
-        allocation_range_t *new_range = malloc(sizeof(allocation_range_t));
+        allocation_range_t *new_range = slab_alloc(&range_cache);
         if (new_range) {
-            new_page = page_allocate(allocate_size * SOC_MMU_PAGE_SIZE);
+            new_page = page_allocate_zeroed(allocate_size * SOC_MMU_PAGE_SIZE, &new_range->zeroed);
         } else {
             // bail
             ESP_LOGE(TAG, "Failed to allocate range structure");
@@ -347,7 +745,7 @@ IRAM_ATTR bool pages_allocate(
         }
 
         if (!new_page) {
-            free(new_range);
+            slab_free(&range_cache, new_range);
 
             if (allocate_size == 1) {
                 // No more memory
@@ -355,7 +753,7 @@ IRAM_ATTR bool pages_allocate(
                 while (r) {
                     allocation_range_t *n = r->next;
                     page_deallocate(r->paddr_start);
-                    free(r);
+                    slab_free(&range_cache, r);
                     r = n;
                 }
                 *head_range = NULL;
@@ -367,7 +765,7 @@ IRAM_ATTR bool pages_allocate(
             continue;
         }
 
-        ESP_LOGI(TAG, "Got new page at address %p", (void *)new_page);
+        ESP_LOGV(TAG, "Got new page at address %p", (void *)new_page);
         // We are the first allocation
         if (!*tail_range) {
             *tail_range = new_range;
@@ -384,7 +782,7 @@ IRAM_ATTR bool pages_allocate(
         vaddr_start += allocate_size * SOC_MMU_PAGE_SIZE;
         to_allocate -= allocate_size;
 
-        ESP_LOGI(
+        ESP_LOGV(
             TAG,
             "New range: vaddr_start = %p, paddr_start = %p, size = %zi",
             (void *)new_range->vaddr_start,
@@ -393,12 +791,92 @@ IRAM_ATTR bool pages_allocate(
         );
     }
 
+    free_pages_changed();
+    return true;
+}
+
+// A single run from buddy_allocate_contiguous(), one range per block of the run
+// since ranges are only ever released whole
+static bool pages_allocate_run(
+    uintptr_t vaddr_start, uintptr_t pages, allocation_range_t **head_range, allocation_range_t **tail_range
+) {
+    allocation_range_t *ranges[BUDDY_MAX_ORDER + 1] = {NULL};
+    size_t              num_ranges                  = __builtin_popcount(pages);
+
+    if (pages >= (1 << (BUDDY_MAX_ORDER + 1))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < num_ranges; ++i) {
+        ranges[i] = slab_alloc(&range_cache);
+        if (!ranges[i]) {
+            goto out;
+        }
+    }
+
+    void *run = buddy_allocate_contiguous(&page_allocator, pages * SOC_MMU_PAGE_SIZE, 0, BUDDY_FLAG_PREFER_ZEROED);
+    if (!run) {
+        goto out;
+    }
+
+    uintptr_t paddr = ADDR_TO_PADDR((uintptr_t)run);
+    for (size_t i = 0; i < num_ranges; ++i) {
+        allocation_range_t *r = ranges[i];
+        r->vaddr_start        = vaddr_start;
+        r->paddr_start        = paddr;
+        r->size               = buddy_get_size(&page_allocator, (void *)PADDR_TO_ADDR(paddr));
+        r->zeroed             = buddy_is_zeroed(&page_allocator, (void *)PADDR_TO_ADDR(paddr));
+        r->next               = *head_range;
+        *head_range           = r;
+
+        vaddr_start += r->size;
+        paddr       += r->size;
+    }
+    *tail_range = ranges[0];
+
+    free_pages_changed();
     return true;
+out:
+    for (size_t i = 0; i < num_ranges; ++i) {
+        slab_free(&range_cache, ranges[i]);
+    }
+    return false;
 }
 
+IRAM_ATTR bool pages_allocate_contiguous(
+    uintptr_t            vaddr_start,
+    uintptr_t            pages,
+    allocation_range_t **head_range,
+    allocation_range_t **tail_range,
+    bool                *contiguous
+) {
+    *head_range = NULL;
+    *tail_range = NULL;
+
+    bool run = pages_allocate_run(vaddr_start, pages, head_range, tail_range);
+    if (contiguous) {
+        *contiguous = run;
+    }
+
+    return run || pages_allocate(vaddr_start, pages, head_range, tail_range);
+}
+
+void pages_clear(allocation_range_t *head_range, allocation_range_t *tail_range) {
+    for (allocation_range_t *r = head_range; r; r = r == tail_range ? NULL : r->next) {
+        if (!r->zeroed) {
+            why_memset((void *)r->vaddr_start, 0, r->size);
+            writeback_caches(r->vaddr_start, r->size);
+            r->zeroed = true;
+        }
+    }
+}
+
+// Framebuffers get exactly the vaddr pages they need. Rounding up to a buddy
+// block would leave odd sized windows, with their guard page, holding up to
+// twice their size, and the vaddr space too fragmented for large windows.
 uintptr_t IRAM_ATTR framebuffer_vaddr_allocate(size_t size, size_t *out_pages) {
     size_t aligned_size = ((size + (SOC_MMU_PAGE_SIZE - 1)) & ~(SOC_MMU_PAGE_SIZE - 1));
-    void  *ret          = buddy_allocate(&framebuffer_allocator, aligned_size, 0, 0);
+    void  *ret          = buddy_allocate_contiguous(&framebuffer_allocator, aligned_size, 0, 0);
     if (ret) {
         *out_pages = aligned_size / SOC_MMU_PAGE_SIZE;
         return (uintptr_t)ret;
@@ -408,9 +886,9 @@ uintptr_t IRAM_ATTR framebuffer_vaddr_allocate(size_t size, size_t *out_pages) {
     return 0;
 }
 
-void IRAM_ATTR framebuffer_vaddr_deallocate(uintptr_t start_address) {
+void IRAM_ATTR framebuffer_vaddr_deallocate(uintptr_t start_address, size_t pages) {
     if (start_address) {
-        buddy_deallocate(&framebuffer_allocator, (void *)start_address);
+        buddy_deallocate_contiguous(&framebuffer_allocator, (void *)start_address, pages * SOC_MMU_PAGE_SIZE);
     }
 }
 
@@ -420,8 +898,7 @@ void IRAM_ATTR framebuffer_map_pages(allocation_range_t *head_range, allocation_
     critical_exit();
 }
 
-void IRAM_ATTR framebuffer_unmap_pages(allocation_range_t *head_range) {
-    critical_enter();
+__attribute__((always_inline)) static inline void unmap_regions(allocation_range_t *head_range) {
     allocation_range_t *r      = head_range;
     uint32_t            mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
 
@@ -429,155 +906,549 @@ void IRAM_ATTR framebuffer_unmap_pages(allocation_range_t *head_range) {
         why_mmu_hal_unmap_region(mmu_id, r->vaddr_start, r->size);
         r = r->next;
     }
+}
+
+void IRAM_ATTR framebuffer_unmap_pages(allocation_range_t *head_range) {
+    critical_enter();
+    unmap_regions(head_range);
     critical_exit();
 }
 
-void IRAM_ATTR NOINLINE_ATTR *why_sbrk(intptr_t increment) {
-    task_info_t *task_info = get_task_info();
-    uintptr_t    old       = task_info->thread->end;
-    ESP_LOGI("sbrk", "Calling sbrk(%zi) from task %d", increment, task_info->pid);
+// Both sets of ranges already carry each other's vaddrs. The framebuffers are
+// the same size, so unmapping one set's new vaddrs unmaps the other's old ones.
+// Caches are invalidated by map_regions(), dirty lines must be written back first.
+void IRAM_ATTR framebuffer_swap_pages(
+    allocation_range_t *head_a, allocation_range_t *tail_a, allocation_range_t *head_b, allocation_range_t *tail_b
+) {
+    critical_enter();
+    unmap_regions(head_a);
+    unmap_regions(head_b);
+    map_regions(head_a, tail_a);
+    map_regions(head_b, tail_b);
+    critical_exit();
+}
 
-    if (!increment)
-        goto out;
+// Map size more bytes at the top of the heap of thread
+static bool heap_grow(task_thread_t *thread, size_t size) {
+    uintptr_t vaddr_start = thread->start + thread->size;
+    uint32_t  pages       = size / SOC_MMU_PAGE_SIZE;
 
-    if (increment > 0) {
-        // Allocating new pages
-        uintptr_t vaddr_start = task_info->thread->end;
+    // Ranges are in reverse order, when we insert our new ranges into
+    // the task_info this range needs to be tied to the old head
+    allocation_range_t *head_range = NULL;
+    allocation_range_t *tail_range = NULL;
 
-        if (vaddr_start + increment > SOC_EXTRAM_HIGH) {
-            goto error;
-        }
+    if (!pages_allocate(vaddr_start, pages, &head_range, &tail_range)) {
+        return false;
+    }
 
-        uint32_t pages = increment / SOC_MMU_PAGE_SIZE;
+    ESP_LOGV(TAG, "New ranges for thread %p, head: %p, tail %p", thread, head_range, tail_range);
+    snapshot_regions(thread, head_range);
 
-        // Ranges are in reverse order, when we insert our new ranges into
-        // the task_info this range needs to be tied to the old head
-        allocation_range_t *head_range = NULL;
-        allocation_range_t *tail_range = NULL;
+    // Map our new page table entries in one atomic operation
+    critical_enter();
+    {
+        map_regions(head_range, tail_range);
 
-        if (!pages_allocate(vaddr_start, pages, &head_range, &tail_range)) {
-            goto error;
-        }
+        tail_range->next = thread->pages;
+        thread->pages    = head_range;
 
-        // Actually map our new memory
-        ESP_LOGI(
+        thread->size            += size;
+        thread->mmu_num_entries += pages;
+    }
+    critical_exit();
+    thread->peak_size   = MAX(thread->peak_size, thread->size);
+    thread->heap_pages += pages;
+
+    // Nothing of a previous owner may show up in the heap
+    pages_clear(head_range, tail_range);
+    return true;
+}
+
+// Give back the ranges at the top of the heap that lie entirely above keep_end.
+// Ranges are buddy blocks, so they are only ever released whole.
+static void heap_shrink(task_thread_t *thread, uintptr_t keep_end) {
+    uint32_t            mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    allocation_range_t *r      = thread->pages;
+
+    while (r && r->vaddr_start >= keep_end) {
+        ESP_LOGV(
             TAG,
-            "Allocating new ranges for pid %i, head: %p, tail %p, allocations %p",
-            task_info->pid,
-            head_range,
-            tail_range,
-            task_info->thread->pages
+            "Deallocating range. vaddr_start = %p, paddr_start = %p, size = %zi",
+            (void *)r->vaddr_start,
+            (void *)r->paddr_start,
+            r->size
         );
+        allocation_range_t *n = r->next;
 
-        // Map our new page table entries in one atomic operation
+        // Unmap and change the page table entries in one atomic operation, the
+        // next address space expects no lines of these vaddrs in the caches
         critical_enter();
         {
-            map_regions(head_range, tail_range);
-
-            tail_range->next         = task_info->thread->pages;
-            task_info->thread->pages = head_range;
-
-            task_info->thread->size += increment;
-            task_info->thread->end  += increment;
+            invalidate_caches(r->vaddr_start, r->size);
+            why_mmu_hal_unmap_region(mmu_id, r->vaddr_start, r->size);
+            thread->pages            = n;
+            thread->size            -= r->size;
+            thread->mmu_num_entries -= r->size / SOC_MMU_PAGE_SIZE;
         }
         critical_exit();
-    } else {
-        // increment is negative
-        int32_t  decrement_amount = task_info->thread->size + increment;
-        int32_t  to_decrement     = decrement_amount;
-        uint32_t mmu_id           = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
-
-        allocation_range_t *r = task_info->thread->pages;
-        while (r && to_decrement) {
-            // We always free from the end
-            if (r->size <= to_decrement) {
-                // Current block is smaller than we want to decrement
-                ESP_LOGI(
-                    TAG,
-                    "Deallocating whole page. vaddr_start = %p, paddr_start = %p, size = %zi",
-                    (void *)r->vaddr_start,
-                    (void *)r->paddr_start,
-                    r->size
-                );
-                // Don't try to deallocate a page with caches disabled
-                page_deallocate(r->paddr_start);
-                allocation_range_t *n = r->next;
-
-                // Unmap and change the page table entries in one atomic operation
-                critical_enter();
-                {
-                    why_mmu_hal_unmap_region(mmu_id, r->vaddr_start, r->size);
-                    task_info->thread->pages = n;
-                }
-                critical_exit();
-
-                to_decrement -= r->size;
-                free(r);
-                r = n;
-            } else {
-                // Current block is larger than we want to decrement
-                ESP_LOGI(
-                    TAG,
-                    "Deallocating partial. vaddr_start = %p, paddr_start = %p, size = %zi, removing %li",
-                    (void *)r->vaddr_start,
-                    (void *)r->paddr_start,
-                    r->size,
-                    to_decrement
-                );
+        // Pages of the image were never counted
+        thread->heap_pages -= MIN(thread->heap_pages, r->size / SOC_MMU_PAGE_SIZE);
 
-                // Write back, unmap, remap, and invalidate in one atomic operation
-                critical_enter();
-                {
-                    writeback_caches(r->vaddr_start, r->size - to_decrement);
-                    why_mmu_hal_unmap_region(mmu_id, r->vaddr_start, r->size);
-                    r->size -= to_decrement;
-                    why_mmu_hal_map_region(mmu_id, MMU_TARGET_PSRAM0, r->vaddr_start, r->paddr_start, r->size);
-                    invalidate_caches(r->vaddr_start, r->size);
-                }
-                critical_exit();
+        // Don't try to deallocate a page with caches disabled
+        page_deallocate(r->paddr_start);
+        slab_free(&range_cache, r);
+        r = n;
+    }
+}
 
-                page_deallocate(r->paddr_start + to_decrement);
-                to_decrement = 0;
+// Copies of ranges, in the same order. NULL if out of memory.
+// Copies of the ranges from head on, up to the first one below low, moved by delta
+static allocation_range_t *
+    ranges_copy(allocation_range_t const *head, uintptr_t low, intptr_t delta, allocation_range_t **tail) {
+    allocation_range_t *copy = NULL;
+
+    *tail = NULL;
+    for (allocation_range_t const *r = head; r && r->vaddr_start >= low; r = r->next) {
+        allocation_range_t *c = slab_alloc(&range_cache);
+        if (!c) {
+            while (copy) {
+                allocation_range_t *n = copy->next;
+                slab_free(&range_cache, copy);
+                copy = n;
             }
+            return NULL;
         }
-        task_info->thread->size -= decrement_amount;
-        task_info->thread->end  -= decrement_amount;
-    }
 
-out:
-    ESP_LOGI(
-        "sbrk",
-        "Calling sbrk(%zi) from task %d, returning %p, thread->size=%zi, thread->end=%p",
-        increment,
-        task_info->pid,
-        (void *)old,
-        task_info->thread->size,
-        (void *)task_info->thread->end
-    );
-    return (void *)old;
+        *c              = *r;
+        c->vaddr_start += delta;
+        c->next         = NULL;
+        if (*tail) {
+            (*tail)->next = c;
+        } else {
+            copy = c;
+        }
+        *tail = c;
+    }
 
-error:
-    ESP_LOGW(TAG, "Out of memory for task %i", task_info->pid);
-    task_info->_errno = ENOMEM;
-    return (void *)-1;
+    return copy;
 }
 
-void page_deallocate(uintptr_t paddr_start) {
-    buddy_deallocate(&page_allocator, (void *)PADDR_TO_ADDR(paddr_start));
-}
+// Map an image at the break, which is at the end of the mapped heap. The shared
+// ranges start at shared_vaddr, their copies are moved to the break.
+static bool heap_map_at_break(
+    task_thread_t *thread, allocation_range_t const *shared, uintptr_t shared_vaddr, size_t shared_size, size_t size
+) {
+    uintptr_t base = thread->end;
 
-uintptr_t page_allocate(size_t size) {
-    void *ret = buddy_allocate(&page_allocator, size, 0, 0);
-    if (ret) {
-        return ADDR_TO_PADDR((uintptr_t)ret);
+    if (base != thread->start + thread->size || shared_size > size) {
+        return false;
     }
-    // This is fine because page 0 is always used by the allocator itself
-    return 0;
+
+    uint32_t shared_pages  = shared_size / SOC_MMU_PAGE_SIZE;
+    uint32_t private_pages = (size - shared_size) / SOC_MMU_PAGE_SIZE;
+
+    // Ranges run from the highest vaddr down, the writable part goes in front
+    allocation_range_t *low_head  = NULL;
+    allocation_range_t *low_tail  = NULL;
+    allocation_range_t *high_head = NULL;
+    allocation_range_t *high_tail = NULL;
+
+    if (shared) {
+        low_head = ranges_copy(shared, 0, base - shared_vaddr, &low_tail);
+        if (!low_head) {
+            return false;
+        }
+        for (allocation_range_t *r = low_head; r; r = r->next) {
+            r->shared = true;
+        }
+    } else if (shared_pages && !pages_allocate(base, shared_pages, &low_head, &low_tail)) {
+        return false;
+    }
+
+    if (private_pages && !pages_allocate(base + shared_size, private_pages, &high_head, &high_tail)) {
+        pages_deallocate(low_head);
+        return false;
+    }
+
+    allocation_range_t *head = high_head ? high_head : low_head;
+    allocation_range_t *tail = low_tail ? low_tail : high_tail;
+    if (high_tail) {
+        high_tail->next = low_head;
+    }
+    if (!head) {
+        return true;
+    }
+
+    snapshot_regions(thread, head);
+
+    critical_enter();
+    {
+        map_regions(head, tail);
+
+        tail->next    = thread->pages;
+        thread->pages = head;
+
+        thread->size            += size;
+        thread->mmu_num_entries += shared_pages + private_pages;
+        thread->end              = base + size;
+    }
+    critical_exit();
+    thread->peak_size = MAX(thread->peak_size, thread->size);
+    thread->peak_end  = MAX(thread->peak_end, thread->end);
+    if (shared) {
+        thread->shared_pages += shared_pages;
+    }
+
+    if (high_head) {
+        pages_clear(high_head, high_tail);
+    }
+    if (!shared && low_head) {
+        pages_clear(low_head, low_tail);
+    }
+    return true;
+}
+
+bool heap_map_image(task_info_t *task_info, allocation_range_t const *shared, size_t shared_size, size_t size) {
+    task_thread_t *thread = task_info->thread;
+
+    if (thread->size) {
+        return false;
+    }
+
+    return heap_map_at_break(thread, shared, thread->start, shared_size, size);
+}
+
+uintptr_t
+    heap_map_library(task_info_t *task_info, allocation_range_t const *shared, size_t shared_size, size_t size) {
+    task_thread_t *thread = task_info->thread;
+    uintptr_t      base   = thread->end;
+
+    return heap_map_at_break(thread, shared, 0, shared_size, size) ? base : 0;
+}
+
+allocation_range_t *heap_share_image(task_info_t *task_info, uintptr_t start, size_t shared_size) {
+    task_thread_t *thread = task_info->thread;
+    uintptr_t      end    = start + shared_size;
+
+    // Ranges run from the highest vaddr down, whatever was mapped after the image comes first
+    allocation_range_t *first = thread->pages;
+    while (first && first->vaddr_start + first->size > end) {
+        first = first->next;
+    }
+
+    allocation_range_t *tail;
+    allocation_range_t *copy = ranges_copy(first, start, 0, &tail);
+    if (!copy) {
+        return NULL;
+    }
+
+    for (allocation_range_t *r = first; r && r->vaddr_start >= start; r = r->next) {
+        r->shared = true;
+    }
+    thread->shared_pages += shared_size / SOC_MMU_PAGE_SIZE;
+    return copy;
+}
+
+void *ramdisk_window_map(size_t slot, uintptr_t paddr_start) {
+    uint32_t  mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    uintptr_t vaddr  = RAMDISK_WINDOW_START + slot * SOC_MMU_PAGE_SIZE;
+
+    critical_enter();
+    why_mmu_hal_map_region(mmu_id, MMU_TARGET_PSRAM0, vaddr, paddr_start, SOC_MMU_PAGE_SIZE);
+    critical_exit();
+
+    return (void *)vaddr;
+}
+
+// Nothing of the slot may stay in the caches, the next page is mapped at the same address
+void ramdisk_window_unmap(size_t slot) {
+    uint32_t  mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    uintptr_t vaddr  = RAMDISK_WINDOW_START + slot * SOC_MMU_PAGE_SIZE;
+
+    critical_enter();
+    {
+        writeback_invalidate_caches(vaddr, SOC_MMU_PAGE_SIZE);
+        why_mmu_hal_unmap_region(mmu_id, vaddr, SOC_MMU_PAGE_SIZE);
+    }
+    critical_exit();
+}
+
+// One hibernation at a time, they share the window
+static atomic_bool hibernating;
+
+// Copy the page at paddr_start to or from fd through the hibernation window
+static bool hibernate_page(uintptr_t paddr_start, int fd, bool write) {
+    uint32_t mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    void    *window = (void *)HIBERNATE_WINDOW_START;
+
+    critical_enter();
+    why_mmu_hal_map_region(mmu_id, MMU_TARGET_PSRAM0, HIBERNATE_WINDOW_START, paddr_start, SOC_MMU_PAGE_SIZE);
+    critical_exit();
+
+    ssize_t res = write ? why_write(fd, window, SOC_MMU_PAGE_SIZE) : why_read(fd, window, SOC_MMU_PAGE_SIZE);
+
+    critical_enter();
+    {
+        writeback_invalidate_caches(HIBERNATE_WINDOW_START, SOC_MMU_PAGE_SIZE);
+        why_mmu_hal_unmap_region(mmu_id, HIBERNATE_WINDOW_START, SOC_MMU_PAGE_SIZE);
+    }
+    critical_exit();
+
+    return res == SOC_MMU_PAGE_SIZE;
+}
+
+size_t heap_hibernate(task_thread_t *thread, int fd) {
+    size_t offset = 0;
+
+    // Suspended while still mapped on its core, that goes away with the next switch there
+    if (current_mapped_thread == thread || atomic_exchange(&hibernating, true)) {
+        return 0;
+    }
+
+    // Write everything first, a failure leaves the address space as it was
+    for (allocation_range_t *r = thread->pages; r; r = r->next) {
+        if (r->shared || r->hibernated) {
+            continue;
+        }
+        for (size_t page = 0; page < r->size; page += SOC_MMU_PAGE_SIZE) {
+            if (!hibernate_page(r->paddr_start + page, fd, true)) {
+                ESP_LOGW(TAG, "Unable to write the pages of address space %p", thread);
+                atomic_store(&hibernating, false);
+                return 0;
+            }
+        }
+    }
+
+    for (allocation_range_t *r = thread->pages; r; r = r->next) {
+        if (r->shared || r->hibernated) {
+            continue;
+        }
+        page_deallocate(r->paddr_start);
+        r->paddr_start  = offset;
+        r->hibernated   = true;
+        offset         += r->size;
+    }
+
+    atomic_store(&hibernating, false);
+    return offset / SOC_MMU_PAGE_SIZE;
+}
+
+bool heap_thaw(task_thread_t *thread, int fd) {
+    if (atomic_exchange(&hibernating, true)) {
+        return false;
+    }
+
+    // The pages most likely come back in other ranges, so each hibernated range
+    // is replaced by the ones we get
+    allocation_range_t **link = &thread->pages;
+    while (*link) {
+        allocation_range_t *r = *link;
+        if (!r->hibernated) {
+            link = &r->next;
+            continue;
+        }
+
+        allocation_range_t *head_range;
+        allocation_range_t *tail_range;
+        if (!pages_allocate(r->vaddr_start, r->size / SOC_MMU_PAGE_SIZE, &head_range, &tail_range)) {
+            ESP_LOGW(TAG, "Out of memory thawing address space %p", thread);
+            goto error;
+        }
+
+        for (allocation_range_t *n = head_range; n; n = n->next) {
+            n->zeroed = false;
+            for (size_t page = 0; page < n->size; page += SOC_MMU_PAGE_SIZE) {
+                off_t offset = r->paddr_start + (n->vaddr_start - r->vaddr_start) + page;
+                if (why_lseek(fd, offset, SEEK_SET) != offset || !hibernate_page(n->paddr_start + page, fd, false)) {
+                    ESP_LOGW(TAG, "Unable to read the pages of address space %p", thread);
+                    pages_deallocate(head_range);
+                    goto error;
+                }
+            }
+        }
+
+        snapshot_regions(thread, head_range);
+        tail_range->next = r->next;
+        *link            = head_range;
+        link             = &tail_range->next;
+        slab_free(&range_cache, r);
+    }
+
+    atomic_store(&hibernating, false);
+    return true;
+
+error:
+    // What was read back stays, a later try only reads the rest
+    atomic_store(&hibernating, false);
+    return false;
+}
+
+// The break (thread->end) moves freely within the mapped heap, which grows in
+// steps of heap_grow_size and only shrinks once heap_trim_size is unused, so a
+// program whose memory use moves up and down doesn't keep remapping pages.
+void IRAM_ATTR NOINLINE_ATTR *why_sbrk(intptr_t increment) {
+    task_info_t   *task_info  = get_task_info();
+    task_thread_t *thread     = task_info->thread;
+    uintptr_t      old        = thread->end;
+    uintptr_t      mapped_end = thread->start + thread->size;
+    ESP_LOGV("sbrk", "Calling sbrk(%zi) from task %d", increment, task_info->pid);
+
+    if (increment > 0) {
+        if (increment > SOC_EXTRAM_HIGH - thread->end) {
+            goto error;
+        }
+
+        uintptr_t new_end = thread->end + increment;
+        if (new_end > mapped_end) {
+            size_t needed = (new_end - mapped_end + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1);
+            size_t chunk  = (needed + thread->heap_grow_size - 1) / thread->heap_grow_size * thread->heap_grow_size;
+            chunk         = MIN(chunk, SOC_EXTRAM_HIGH - mapped_end);
+
+            // Stay within the budget from the manifest
+            if (thread->max_heap_pages) {
+                size_t left = (thread->max_heap_pages - MIN(thread->heap_pages, thread->max_heap_pages)) *
+                              SOC_MMU_PAGE_SIZE;
+                if (needed > left) {
+                    ESP_LOGW(TAG, "Task %i is at its heap budget of %zu pages", task_info->pid, thread->max_heap_pages);
+                    goto error;
+                }
+                chunk = MIN(chunk, left);
+            }
+
+            // Fall back to just what is needed when memory is tight, and in the
+            // end to what other applications release on memory pressure
+            if (!heap_grow(thread, chunk) && (chunk == needed || !heap_grow(thread, needed)) &&
+                (!task_info->pid || !memory_reclaim_wait(needed / SOC_MMU_PAGE_SIZE) || !heap_grow(thread, needed))) {
+                goto error;
+            }
+        }
+        thread->end      = new_end;
+        thread->peak_end = MAX(thread->peak_end, new_end);
+    } else if (increment < 0) {
+        if (-increment > thread->end - thread->start) {
+            goto error;
+        }
+
+        thread->end += increment;
+
+        uintptr_t keep_end = (thread->end + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1);
+        if (mapped_end - keep_end > thread->heap_trim_size) {
+            heap_shrink(thread, keep_end);
+        }
+    }
+
+    ESP_LOGV(
+        "sbrk",
+        "Calling sbrk(%zi) from task %d, returning %p, thread->size=%zi, thread->end=%p",
+        increment,
+        task_info->pid,
+        (void *)old,
+        thread->size,
+        (void *)thread->end
+    );
+    trace_event(TRACE_SBRK, increment, old);
+    return (void *)old;
+
+error:
+    ESP_LOGW(TAG, "Out of memory for task %i", task_info->pid);
+    trace_event(TRACE_SBRK, increment, -1);
+    task_info->_errno = ENOMEM;
+    return (void *)-1;
+}
+
+// dlmalloc holds this around its sbrk() calls. The kernel has no heap lock, the
+// kernel malloc lock already serializes all of it.
+void IRAM_ATTR heap_lock_take(void) {
+    task_thread_t *thread = get_task_info()->thread;
+    if (thread->heap_lock) {
+        xSemaphoreTake(thread->heap_lock, portMAX_DELAY);
+    }
+}
+
+void IRAM_ATTR heap_lock_give(void) {
+    task_thread_t *thread = get_task_info()->thread;
+    if (thread->heap_lock) {
+        xSemaphoreGive(thread->heap_lock);
+    }
+}
+
+// Unlike shrinking through sbrk() this doesn't keep heap_trim_size mapped. Only
+// the arena at the break can give memory back, the free space of the others is
+// kept for their threads.
+size_t memory_release(void) {
+    task_thread_t *thread = get_task_info()->thread;
+    size_t         size   = thread->size;
+
+    if (thread == kernel_task.thread) {
+        malloc_cache_flush();
+    }
+
+    for (malloc_arena_t *arena = &thread->malloc_arena; arena; arena = arena->next) {
+        xSemaphoreTake(arena->lock, portMAX_DELAY);
+        if (arena->state.top) {
+            mspace_trim(&arena->state, 0);
+        }
+        xSemaphoreGive(arena->lock);
+    }
+
+    heap_lock_take();
+    heap_shrink(thread, (thread->end + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1));
+    heap_lock_give();
+    return (size - thread->size) / SOC_MMU_PAGE_SIZE;
+}
+
+// Called by the ELF loader for memory it is going to put code in
+void memory_mark_executable(void *ptr, size_t size) {
+    task_thread_t *thread = get_task_info()->thread;
+    uintptr_t      start  = (uintptr_t)ptr & ~(SOC_MMU_PAGE_SIZE - 1);
+    uintptr_t      end    = ((uintptr_t)ptr + size + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1);
+
+    if (thread->text_end <= thread->text_start) {
+        thread->text_start = start;
+        thread->text_end   = end;
+        return;
+    }
+
+    thread->text_start = MIN(thread->text_start, start);
+    thread->text_end   = MAX(thread->text_end, end);
+}
+
+void page_deallocate(uintptr_t paddr_start) {
+    void *ptr = (void *)PADDR_TO_ADDR(paddr_start);
+
+    if (buddy_get_size(&page_allocator, ptr) == SOC_MMU_PAGE_SIZE) {
+        magazine_put(paddr_start);
+        return;
+    }
+
+    buddy_deallocate(&page_allocator, ptr);
+    free_pages_changed();
+}
+
+uintptr_t page_allocate(size_t size) {
+    bool zeroed;
+    return page_allocate_zeroed(size, &zeroed);
 }
 
 #define BAD_PAGES_MAX 10
-static uintptr_t bad_pages[BAD_PAGES_MAX];
-static int       bad_pages_num = 0;
+static uintptr_t    bad_pages[BAD_PAGES_MAX];
+static int          bad_pages_num      = 0;
+static bool         bad_pages_overflow = false;
+static portMUX_TYPE bad_pages_lock     = portMUX_INITIALIZER_UNLOCKED;
+
+#define PSRAM_TEST_NVS_NAMESPACE "badgevms_mem"
+
+// What the last full memory test found. Most boots trust it and only do a
+// quick test, the full one checks every 32 bytes of PSRAM.
+typedef struct {
+    uint8_t   chip_id[6]; // Base MAC
+    uint8_t   boots;      // Since the full test
+    uint8_t   retried;    // The full test failed and we rebooted to try again
+    uint32_t  psram_size;
+    uint32_t  bad_pages_num;
+    uintptr_t bad_pages[BAD_PAGES_MAX];
+} psram_test_record_t;
 
 void reserve_bad_pages(size_t psram_size) {
     size_t     total_pages = buddy_get_free_pages(&page_allocator);
@@ -610,75 +1481,183 @@ void reserve_bad_pages(size_t psram_size) {
     free(pages);
 }
 
-static IRAM_ATTR bool test_psram(intptr_t v_start, size_t size) {
-    int volatile *spiram = (int volatile *)v_start;
-    size_t        p;
-    int           errct       = 0;
-    int           initial_err = -1;
-
-    ESP_DRAM_LOGW(DRAM_STR("memory_test"), "Starting write");
-    for (p = 0; p < (size / sizeof(int)); p += 8) {
-        spiram[p] = p ^ 0xAAAAAAAA;
+static IRAM_ATTR void bad_page_add(uintptr_t page) {
+    portENTER_CRITICAL_SAFE(&bad_pages_lock);
+    bool found = false;
+    for (int k = 0; k < bad_pages_num; ++k) {
+        if (bad_pages[k] == page) {
+            found = true;
+            break;
+        }
     }
+    if (!found) {
+        if (bad_pages_num == BAD_PAGES_MAX) {
+            bad_pages_overflow = true;
+        } else {
+            bad_pages[bad_pages_num++] = page;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&bad_pages_lock);
+}
 
-    ESP_DRAM_LOGW(DRAM_STR("memory_test"), "Writing back pages");
-    writeback_caches(v_start, size);
-    ESP_DRAM_LOGW(DRAM_STR("memory_test"), "Invalidating pages");
-    invalidate_caches(v_start, size);
-
-    ESP_DRAM_LOGW(DRAM_STR("memory_test"), "Starting read");
-    for (p = 0; p < (size / sizeof(int)); p += 8) {
-        if (spiram[p] != (p ^ 0xAAAAAAAA)) {
-            uintptr_t address = VADDR_START + (p * 4);
-            uintptr_t page    = ((address - VADDR_START) & ~(SOC_MMU_PAGE_SIZE - 1));
-            bool      found   = false;
+typedef struct {
+    uintptr_t   start;
+    size_t      size;
+    size_t      stride; // In words
+    int         errors;
+    atomic_bool done;
+} psram_test_t;
+
+static IRAM_ATTR void test_psram_range(psram_test_t *test) {
+    uint32_t volatile *spiram = (uint32_t volatile *)test->start;
+    size_t             words  = test->size / sizeof(uint32_t);
+    // The pattern follows the address, so aliasing between the halves shows
+    uint32_t           first  = (test->start - VADDR_START) / sizeof(uint32_t);
+
+    for (size_t p = 0; p < words; p += test->stride) {
+        spiram[p] = (first + p) ^ 0xAAAAAAAA;
+    }
 
-            spi_flash_enable_interrupts_caches_and_other_cpu();
-            ESP_LOGE("memory_test", "Bad pages detected, rebooting");
-            esp_restart();
+    writeback_caches(test->start, test->size);
+    invalidate_caches(test->start, test->size);
 
-            for (int k = 0; k < 8; ++k) {
-                if (bad_pages[k] == page) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                if (bad_pages_num == BAD_PAGES_MAX) {
-                    ESP_DRAM_LOGE(DRAM_STR("memory_test"), "Too many bad pages");
-                    // esp_system_abort("Too many bad pages in memory test");
-                    spi_flash_enable_interrupts_caches_and_other_cpu();
-                    esp_restart();
-                }
+    for (size_t p = 0; p < words; p += test->stride) {
+        uint32_t value = spiram[p];
+        if (value != ((first + p) ^ 0xAAAAAAAA)) {
+            uintptr_t address = test->start + p * sizeof(uint32_t);
+            if (!test->errors++) {
                 ESP_DRAM_LOGE(
                     DRAM_STR("memory_test"),
-                    "Addres 0x%08lx page 0x%08lx failed, expected 0x%08lx, got 0x%08lx",
+                    "Address 0x%08lx failed, expected 0x%08lx, got 0x%08lx",
                     address,
-                    page,
-                    p ^ 0xAAAAAAAA,
-                    spiram[p]
+                    (first + p) ^ 0xAAAAAAAA,
+                    value
                 );
-                bad_pages[bad_pages_num++] = page;
-            }
-            errct++;
-            if (errct == 1) {
-                initial_err = p * 4;
             }
+            bad_page_add((address - VADDR_START) & ~(SOC_MMU_PAGE_SIZE - 1));
         }
     }
-    if (errct) {
-        ESP_DRAM_LOGE(
-            DRAM_STR("memory_test"),
-            "SPI SRAM memory test fail. %d/%d writes failed, first @ %X",
-            errct,
-            size / 32,
-            initial_err + v_start
-        );
+}
+
+static IRAM_ATTR void test_psram_ipc(void *arg) {
+    psram_test_t *test = arg;
+    test_psram_range(test);
+    atomic_store(&test->done, true);
+}
+
+// Tests every stride words, each core takes half of the range
+static bool test_psram(uintptr_t v_start, size_t size, size_t stride) {
+    size_t       half     = (size / 2) & ~(SOC_MMU_PAGE_SIZE - 1);
+    psram_test_t tests[2] = {
+        {.start = v_start, .size = half, .stride = stride},
+        {.start = v_start + half, .size = size - half, .stride = stride},
+    };
+
+    if (esp_ipc_call(!xPortGetCoreID(), test_psram_ipc, &tests[1]) != ESP_OK) {
+        ESP_LOGW("memory_test", "Unable to use the other core");
+        test_psram_ipc(&tests[1]);
+    }
+    test_psram_range(&tests[0]);
+    while (!atomic_load(&tests[1].done)) {
+        vTaskDelay(1);
+    }
+
+    int errors = tests[0].errors + tests[1].errors;
+    if (errors) {
+        ESP_LOGE("memory_test", "SPI SRAM memory test fail, %d of %zu words failed", errors, size / 4 / stride);
         return false;
-    } else {
-        ESP_DRAM_LOGI(DRAM_STR("memory_test"), "SPI SRAM memory test OK");
-        return true;
     }
+
+    ESP_LOGI("memory_test", "SPI SRAM memory test OK");
+    return true;
+}
+
+// Only valid for this chip and PSRAM, and not after a crash which could have
+// been bad memory
+static bool psram_test_record_load(psram_test_record_t *record, size_t psram_size) {
+    psram_test_record_t stored = {0};
+    size_t              length = sizeof(stored);
+    nvs_handle_t        handle;
+
+    *record = (psram_test_record_t){.psram_size = psram_size};
+    esp_read_mac(record->chip_id, ESP_MAC_BASE);
+
+    if (nvs_open(PSRAM_TEST_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(handle, "psram_test", &stored, &length);
+    nvs_close(handle);
+
+    if (err != ESP_OK || length != sizeof(stored) || stored.psram_size != psram_size ||
+        memcmp(stored.chip_id, record->chip_id, sizeof(stored.chip_id)) || stored.bad_pages_num > BAD_PAGES_MAX) {
+        return false;
+    }
+
+    record->retried = stored.retried;
+    if (stored.retried || stored.boots >= PSRAM_TEST_INTERVAL_BOOTS) {
+        return false;
+    }
+
+    switch (esp_reset_reason()) {
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT: ESP_LOGW("memory_test", "Crashed last time, running the full memory test"); return false;
+        default: break;
+    }
+
+    *record = stored;
+    return true;
+}
+
+static void psram_test_record_save(psram_test_record_t const *record) {
+    nvs_handle_t handle;
+    if (nvs_open(PSRAM_TEST_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW("memory_test", "Unable to open NVS, the memory test will run again next boot");
+        return;
+    }
+    if (nvs_set_blob(handle, "psram_test", record, sizeof(*record)) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+        ESP_LOGW("memory_test", "Unable to store the memory test result");
+    }
+    nvs_close(handle);
+}
+
+// Keeps the bad pages of the last full test out of use, a quick test that fails
+// or the cached result getting stale runs a full test
+static void run_psram_test(size_t psram_size, size_t test_size) {
+    psram_test_record_t record;
+
+    if (psram_test_record_load(&record, psram_size)) {
+        bad_pages_num = record.bad_pages_num;
+        memcpy(bad_pages, record.bad_pages, sizeof(bad_pages));
+
+        ESP_LOGI("memory_test", "Quick memory test, %u boots since the full test", record.boots);
+        if (test_psram(VADDR_START, test_size, PSRAM_QUICK_TEST_STRIDE / sizeof(uint32_t))) {
+            ++record.boots;
+            psram_test_record_save(&record);
+            return;
+        }
+    }
+
+    ESP_LOGI("memory_test", "Full memory test");
+    bad_pages_num = 0;
+    if (!test_psram(VADDR_START, test_size, 8)) {
+        // Mostly this is the PSRAM not coming up right and the next boot
+        // fixes it. Pages that fail twice in a row are kept out of use.
+        if (!record.retried || bad_pages_overflow) {
+            record.retried = 1;
+            psram_test_record_save(&record);
+            ESP_LOGE("memory_test", "Bad pages detected, rebooting");
+            esp_restart();
+        }
+        ESP_LOGW("memory_test", "Pages failed again, reserving %d of them", bad_pages_num);
+    }
+
+    record.boots         = 0;
+    record.retried       = 0;
+    record.bad_pages_num = bad_pages_num;
+    memcpy(record.bad_pages, bad_pages, sizeof(bad_pages));
+    psram_test_record_save(&record);
 }
 
 uint32_t vaddr_to_paddr(uint32_t vaddr) {
@@ -691,8 +1670,218 @@ uint32_t vaddr_to_paddr(uint32_t vaddr) {
     return paddr;
 }
 
+void *dma_buffer_alloc(size_t size, bool *contiguous) {
+    if (contiguous) {
+        *contiguous = false;
+    }
+    if (!size) {
+        return NULL;
+    }
+
+    // With a guard page behind it, like a framebuffer
+    size_t    num_pages   = 0;
+    uintptr_t vaddr_start = framebuffer_vaddr_allocate(size + SOC_MMU_PAGE_SIZE, &num_pages);
+    if (!vaddr_start) {
+        ESP_LOGE(TAG, "No vaddr space for DMA buffer");
+        return NULL;
+    }
+
+    dma_buffer_t *buffer = slab_alloc(&dma_buffer_cache);
+    if (!buffer) {
+        ESP_LOGE(TAG, "No kernel RAM for DMA buffer container");
+        framebuffer_vaddr_deallocate(vaddr_start, num_pages);
+        return NULL;
+    }
+
+    if (!pages_allocate_contiguous(vaddr_start, num_pages - 1, &buffer->head_pages, &buffer->tail_pages, contiguous)) {
+        ESP_LOGE(TAG, "No physical memory pages for DMA buffer");
+        framebuffer_vaddr_deallocate(vaddr_start, num_pages);
+        slab_free(&dma_buffer_cache, buffer);
+        return NULL;
+    }
+
+    framebuffer_map_pages(buffer->head_pages, buffer->tail_pages);
+    pages_clear(buffer->head_pages, buffer->tail_pages);
+    buffer->vaddr_start = vaddr_start;
+    buffer->num_pages   = num_pages;
+
+    portENTER_CRITICAL(&dma_buffers_lock);
+    buffer->next = dma_buffers;
+    dma_buffers  = buffer;
+    portEXIT_CRITICAL(&dma_buffers_lock);
+
+    atomic_fetch_add(&get_task_info()->thread->dma_pages, num_pages - 1);
+    task_record_resource_alloc(RES_DMA_BUFFER, (void *)vaddr_start);
+    return (void *)vaddr_start;
+}
+
+size_t dma_buffer_release(void *ptr) {
+    dma_buffer_t *buffer = NULL;
+
+    portENTER_CRITICAL(&dma_buffers_lock);
+    for (dma_buffer_t **b = &dma_buffers; *b; b = &(*b)->next) {
+        if ((*b)->vaddr_start == (uintptr_t)ptr) {
+            buffer = *b;
+            *b     = buffer->next;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&dma_buffers_lock);
+
+    if (!buffer) {
+        ESP_LOGW(TAG, "%p is not a DMA buffer", ptr);
+        return 0;
+    }
+
+    size_t pages = buffer->num_pages - 1;
+    framebuffer_unmap_pages(buffer->head_pages);
+    pages_deallocate(buffer->head_pages);
+    framebuffer_vaddr_deallocate(buffer->vaddr_start, buffer->num_pages);
+    slab_free(&dma_buffer_cache, buffer);
+    return pages;
+}
+
+void dma_buffer_free(void *ptr) {
+    size_t pages = ptr ? dma_buffer_release(ptr) : 0;
+    if (pages) {
+        atomic_fetch_sub(&get_task_info()->thread->dma_pages, pages);
+        task_record_resource_free(RES_DMA_BUFFER, ptr);
+    }
+}
+
+void *malloc_fast(size_t size) {
+    task_info_t   *task_info = get_task_info();
+    atomic_size_t *charged   = &task_info->thread->fast_bytes;
+
+    if (!size) {
+        return NULL;
+    }
+
+    // Reserve the quota first, so threads of one process can't overshoot it together
+    if (size > FAST_ALLOC_PROCESS_QUOTA || atomic_fetch_add(charged, size) + size > FAST_ALLOC_PROCESS_QUOTA ||
+        heap_caps_get_free_size(MALLOC_CAP_INTERNAL) < size + FAST_ALLOC_KERNEL_RESERVE) {
+        goto fail;
+    }
+
+    void *ptr = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!ptr) {
+        goto fail;
+    }
+
+    // Charge what the allocator actually took, free_fast() gives back the same
+    atomic_fetch_add(charged, heap_caps_get_allocated_size(ptr) - size);
+    task_record_resource_alloc(RES_FAST_ALLOC, ptr);
+    return ptr;
+
+fail:
+    if (size <= FAST_ALLOC_PROCESS_QUOTA) {
+        atomic_fetch_sub(charged, size);
+    }
+    task_info->_errno = ENOMEM;
+    return NULL;
+}
+
+void free_fast(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    if (!task_record_resource_owned(RES_FAST_ALLOC, ptr)) {
+        ESP_LOGW(TAG, "%p is not fast memory of this process", ptr);
+        return;
+    }
+
+    atomic_fetch_sub(&get_task_info()->thread->fast_bytes, heap_caps_get_allocated_size(ptr));
+    task_record_resource_free(RES_FAST_ALLOC, ptr);
+    heap_caps_free(ptr);
+}
+
+// The cache lines under size bytes at ptr
+static void cache_line_range(void const *ptr, size_t size, uintptr_t *start, uint32_t *len) {
+    uintptr_t line_size = cache_hal_get_cache_line_size(CACHE_LL_LEVEL_EXT_MEM, CACHE_TYPE_DATA);
+    *start              = (uintptr_t)ptr & ~(line_size - 1);
+    *len                = (((uintptr_t)ptr + size + line_size - 1) & ~(line_size - 1)) - *start;
+}
+
+void *memory_alias_map(void const *ptr, size_t size) {
+    uintptr_t start = (uintptr_t)ptr;
+    if (!size || !in_task_heap(ptr) || !in_task_heap((void const *)(start + size - 1))) {
+        return NULL;
+    }
+
+    uintptr_t first_page = start & ~(SOC_MMU_PAGE_SIZE - 1);
+    size_t    num_pages  = 0;
+    uintptr_t alias      = framebuffer_vaddr_allocate(start + size - first_page, &num_pages);
+    if (!alias) {
+        ESP_LOGW(TAG, "No vaddr space to alias %zu bytes at %p", size, ptr);
+        return NULL;
+    }
+
+    uint32_t mmu_id = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+    size_t   mapped = 0;
+    critical_enter();
+    for (; mapped < num_pages; ++mapped) {
+        uint32_t     paddr;
+        mmu_target_t target;
+        if (!mmu_hal_vaddr_to_paddr(mmu_id, first_page + mapped * SOC_MMU_PAGE_SIZE, &paddr, &target) ||
+            target != MMU_TARGET_PSRAM0) {
+            break;
+        }
+        why_mmu_hal_map_region(mmu_id, MMU_TARGET_PSRAM0, alias + mapped * SOC_MMU_PAGE_SIZE, paddr, SOC_MMU_PAGE_SIZE);
+    }
+    if (mapped == num_pages) {
+        invalidate_caches(alias, num_pages * SOC_MMU_PAGE_SIZE);
+    } else if (mapped) {
+        why_mmu_hal_unmap_region(mmu_id, alias, mapped * SOC_MMU_PAGE_SIZE);
+    }
+    critical_exit();
+
+    if (mapped != num_pages) {
+        ESP_LOGW(TAG, "%zu bytes at %p are not all mapped", size, ptr);
+        framebuffer_vaddr_deallocate(alias, num_pages);
+        return NULL;
+    }
+
+    // The caches know these lines by the task's vaddrs, whatever is dirty
+    // there has to be in memory before anything reads it through the alias
+    uintptr_t line_start;
+    uint32_t  line_len;
+    cache_line_range(ptr, size, &line_start, &line_len);
+    writeback_invalidate_caches(line_start, line_len);
+
+    return (void *)(alias + (start - first_page));
+}
+
+void memory_alias_release(void *alias, void const *ptr, size_t size) {
+    if (!alias) {
+        return;
+    }
+
+    uintptr_t alias_start = (uintptr_t)alias & ~(SOC_MMU_PAGE_SIZE - 1);
+    size_t    num_pages   = ((uintptr_t)alias + size - alias_start + SOC_MMU_PAGE_SIZE - 1) / SOC_MMU_PAGE_SIZE;
+    uint32_t  mmu_id      = why_mmu_hal_get_id_from_target(MMU_TARGET_PSRAM0);
+
+    // Whatever the CPU wrote through the alias goes to memory as well
+    critical_enter();
+    writeback_invalidate_caches(alias_start, num_pages * SOC_MMU_PAGE_SIZE);
+    why_mmu_hal_unmap_region(mmu_id, alias_start, num_pages * SOC_MMU_PAGE_SIZE);
+    critical_exit();
+    framebuffer_vaddr_deallocate(alias_start, num_pages);
+
+    // Whatever was written through the alias is in memory, not in the lines
+    // the task has of it
+    uintptr_t line_start;
+    uint32_t  line_len;
+    cache_line_range(ptr, size, &line_start, &line_len);
+    invalidate_caches(line_start, line_len);
+}
+
 size_t get_free_psram_pages() {
-    return buddy_get_free_pages(&page_allocator);
+    size_t pages = buddy_get_free_pages(&page_allocator);
+    for (int i = 0; i < portNUM_PROCESSORS; ++i) {
+        pages += page_magazines[i].count;
+    }
+    return pages;
 }
 
 size_t get_total_psram_pages() {
@@ -707,6 +1896,10 @@ size_t get_total_framebuffer_pages() {
     return buddy_get_total_pages(&framebuffer_allocator);
 }
 
+size_t get_largest_free_framebuffer_pages() {
+    return buddy_get_largest_free(&framebuffer_allocator);
+}
+
 void writeback_and_invalidate_task(task_info_t *task_info) {
     critical_enter();
     {
@@ -744,10 +1937,16 @@ void IRAM_ATTR memory_init() {
     ESP_DRAM_LOGW(DRAM_STR("memory_init"), "Invalidate all pages for memory test");
     invalidate_caches(VADDR_START, out_len);
 
-    ESP_DRAM_LOGW(DRAM_STR("memory_init"), "Running memory test");
-    if (!test_psram(VADDR_START, out_len)) {
-        ESP_DRAM_LOGW(DRAM_STR("memory_init"), "Found bad pages");
-    }
+    // Nothing else uses PSRAM yet, so the test runs with the other core and
+    // caches up to split it between the cores
+    ESP_DRAM_LOGW(DRAM_STR("memory_init"), "Re-enabling caches and interrupts");
+    spi_flash_enable_interrupts_caches_and_other_cpu();
+
+    ESP_LOGW("memory_init", "Running memory test");
+    run_psram_test(psram_size, out_len);
+
+    ESP_DRAM_LOGW(DRAM_STR("memory_init"), "Disabling caches and interrupts");
+    spi_flash_disable_interrupts_caches_and_other_cpu();
 
     ESP_DRAM_LOGW(DRAM_STR("memory_init"), "Unmapping all of our address space");
     mmu_ll_unmap_all(mmu_id);
@@ -765,7 +1964,9 @@ void IRAM_ATTR memory_init() {
     init_pool(&page_allocator, (void *)VADDR_START, (void *)VADDR_START + psram_size, 0);
 
     if (bad_pages_num) {
+        int64_t start = esp_timer_get_time();
         reserve_bad_pages(psram_size);
+        boot_profile_stage("bad_pages", start);
     }
 
     uintptr_t framebuffer_page = page_allocate(SOC_MMU_PAGE_SIZE);
@@ -797,7 +1998,6 @@ void IRAM_ATTR memory_init() {
         0
     );
 
-    init_memory_heap_caps();
     wrapped_functions_init();
     print_allocator(&page_allocator);
 }
@@ -30,6 +30,12 @@
  * SOC_EXTRAM_LOW + 5MB
  * ...                      Framebuffers
  * SOC_EXTRAM_LOW + 30MB
+ * ...                      Page zeroing window
+ * SOC_EXTRAM_LOW + 31MB
+ * ...                      Hibernation window, one page
+ * SOC_EXTRAM_LOW + 31MB + 1 page
+ * ...                      RAM disk window, 8 pages
+ * SOC_EXTRAM_LOW + 31MB + 9 pages
  * ...                      Unused
  * SOC_EXTRAM_LOW + 32MB - 1 page
  * ...                      Guard page
@@ -50,6 +56,20 @@
 #define FRAMEBUFFER_HEAP_START ((SOC_EXTRAM_LOW + (1024 * 1024 * 5)) & ~(SOC_MMU_PAGE_SIZE - 1))
 #define FRAMEBUFFERS_START     FRAMEBUFFFER_HEAP_START + SOC_MMU_PAGE_SIZE
 
+// The page zeroer maps the free pages it clears here
+#define ZERO_WINDOW_SIZE  (1024 * 1024)
+#define ZERO_WINDOW_START (FRAMEBUFFER_HEAP_START + FRAMEBUFFER_HEAP_SIZE)
+
+// heap_hibernate() and heap_thaw() map the page they copy here
+#define HIBERNATE_WINDOW_START (ZERO_WINDOW_START + ZERO_WINDOW_SIZE)
+
+// The RAM disk maps the pages of its files here, see ramdisk_window_map()
+#define RAMDISK_WINDOW_PAGES 8
+#define RAMDISK_WINDOW_START (HIBERNATE_WINDOW_START + SOC_MMU_PAGE_SIZE)
+
+// MMU entries covering the user application vaddr space
+#define TASK_MMU_ENTRIES ((SOC_EXTRAM_HIGH - VADDR_TASK_START) / SOC_MMU_PAGE_SIZE)
+
 #define ADDR_TO_PADDR(a) (a - VADDR_START)
 #define PADDR_TO_ADDR(a) (a + VADDR_START)
 
@@ -57,32 +77,116 @@
 #error "Kernel Heap overlaps with largest possible user program"
 #endif
 
+#if ((ZERO_WINDOW_START + ZERO_WINDOW_SIZE) > (VADDR_TASK_START - SOC_MMU_PAGE_SIZE))
+#error "Page zeroing window overlaps with the guard page"
+#endif
+
+#if ((HIBERNATE_WINDOW_START + SOC_MMU_PAGE_SIZE) > (VADDR_TASK_START - SOC_MMU_PAGE_SIZE))
+#error "Hibernation window overlaps with the guard page"
+#endif
+
+#if ((RAMDISK_WINDOW_START + RAMDISK_WINDOW_PAGES * SOC_MMU_PAGE_SIZE) > (VADDR_TASK_START - SOC_MMU_PAGE_SIZE))
+#error "RAM disk window overlaps with the guard page"
+#endif
+
+__attribute__((always_inline)) static inline bool in_kernel_heap(void const *ptr) {
+    return (uintptr_t)ptr >= KERNEL_HEAP_START && (uintptr_t)ptr < KERNEL_HEAP_START + KERNEL_HEAP_SIZE;
+}
+
+// The heap of whichever process is mapped right now
+__attribute__((always_inline)) static inline bool in_task_heap(void const *ptr) {
+    return (uintptr_t)ptr >= VADDR_TASK_START && (uintptr_t)ptr < SOC_EXTRAM_HIGH;
+}
+
 typedef struct allocation_range_s {
     uintptr_t                  vaddr_start;
     uintptr_t                  paddr_start;
     size_t                     size;
+    bool                       zeroed;     // The pages are known to be zero, see pages_clear()
+    bool                       shared;     // Owned by the image cache, mapped but not freed with a thread
+    bool                       hibernated; // In the file of heap_hibernate(), paddr_start is the offset in it
     struct allocation_range_s *next;
 } allocation_range_t;
 
-typedef struct task_info task_info_t;
+typedef struct task_info   task_info_t;
+typedef struct task_thread task_thread_t;
 
 void     *why_sbrk(intptr_t increment);
+void      memory_mark_executable(void *ptr, size_t size);
 void      page_deallocate(uintptr_t paddr_start);
 uintptr_t page_allocate(size_t size);
 
 bool pages_allocate(
     uintptr_t vaddr_start, uintptr_t pages, allocation_range_t **head_range, allocation_range_t **tail_range
 );
-void pages_deallocate(allocation_range_t *head_range);
+// Like pages_allocate(), but one physically contiguous run of pages if the page
+// allocator has one and scattered pages otherwise. contiguous, if not NULL, says
+// which it was.
+bool pages_allocate_contiguous(
+    uintptr_t            vaddr_start,
+    uintptr_t            pages,
+    allocation_range_t **head_range,
+    allocation_range_t **tail_range,
+    bool                *contiguous
+);
+void                pages_deallocate(allocation_range_t *head_range);
+// Free ranges from head_range until max_pages are freed, returns the ranges that are left
+allocation_range_t *pages_deallocate_some(allocation_range_t *head_range, size_t max_pages);
+// Zero the mapped ranges from head_range to tail_range that didn't come from
+// the page zeroer and write them back
+void pages_clear(allocation_range_t *head_range, allocation_range_t *tail_range);
+
+// Map a program image at the start of the still empty heap of the task, the
+// break moves past it. The first shared_size bytes are copies of the shared
+// ranges or, without those, pages of their own that heap_share_image() can
+// hand to the image cache later. The rest up to size is fresh zero pages.
+bool                heap_map_image(
+    task_info_t *task_info, allocation_range_t const *shared, size_t shared_size, size_t size
+);
+// Like heap_map_image(), but at the break right behind what is mapped already,
+// which nothing may have allocated from yet. The shared ranges run from vaddr 0
+// on. Returns where the library went, 0 if it couldn't be mapped.
+uintptr_t           heap_map_library(
+    task_info_t *task_info, allocation_range_t const *shared, size_t shared_size, size_t size
+);
+// Copies of the ranges in the shared_size bytes from start on of an image of the
+// task, for the image cache. The task keeps them mapped but no longer frees them.
+allocation_range_t *heap_share_image(task_info_t *task_info, uintptr_t start, size_t shared_size);
+// Write the private pages of thread to fd, which the caller opened, and free
+// them. None of its tasks may run until heap_thaw() read them back. Returns how
+// many pages were written, 0 if thread is mapped or writing failed.
+size_t              heap_hibernate(task_thread_t *thread, int fd);
+bool                heap_thaw(task_thread_t *thread, int fd);
+// Map the page at paddr_start in a free slot of the RAM disk window. After
+// unmapping, whatever was written through the slot is in memory.
+void               *ramdisk_window_map(size_t slot, uintptr_t paddr_start);
+void                ramdisk_window_unmap(size_t slot);
 
 uintptr_t framebuffer_vaddr_allocate(size_t size, size_t *out_pages);
-void      framebuffer_vaddr_deallocate(uintptr_t start_address);
+void      framebuffer_vaddr_deallocate(uintptr_t start_address, size_t pages);
 void      framebuffer_map_pages(allocation_range_t *head_range, allocation_range_t *tail_range);
 void      framebuffer_unmap_pages(allocation_range_t *head_range);
+void      framebuffer_swap_pages(
+    allocation_range_t *head_a, allocation_range_t *tail_a, allocation_range_t *head_b, allocation_range_t *tail_b
+);
+// Unmap and free a DMA buffer without touching the resource table of the caller,
+// returns the pages it had or 0 if ptr isn't one
+size_t    dma_buffer_release(void *ptr);
+// Map the pages under size bytes at ptr in the heap of the current task into
+// the framebuffer vaddr space as well, where they stay put while other tasks
+// are mapped. For the PPA, which goes on while its caller is switched out.
+// Returns where ptr is in the alias, NULL if it isn't all in the task heap.
+// The task must not free the memory before memory_alias_release().
+void     *memory_alias_map(void const *ptr, size_t size);
+void      memory_alias_release(void *alias, void const *ptr, size_t size);
 size_t    get_free_psram_pages();
 size_t    get_total_psram_pages();
 size_t    get_free_framebuffer_pages();
 size_t    get_total_framebuffer_pages();
+// The largest framebuffer, in pages including its guard page, that fits in the vaddr space
+size_t    get_largest_free_framebuffer_pages();
 
 void memory_init();
+bool page_zeroer_init();
+bool memory_pressure_init();
 void dump_mmu();
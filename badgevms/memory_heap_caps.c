@@ -20,7 +20,9 @@
 #include "hal/cache_hal.h"
 #include "hal/cache_ll.h"
 #include "memory.h"
+#include "task.h"
 #include "thirdparty/dlmalloc.h"
+#include "why_io.h"
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -28,9 +30,6 @@
 
 #include <string.h>
 
-// We need this because our version of dlmalloc is not thread safe
-static SemaphoreHandle_t heap_caps_lock = NULL;
-
 // There is no need to wrap the _prefer versions as they just call the base version
 extern void  *__real_heap_caps_malloc_base(size_t size, uint32_t caps);
 extern void  *__real_heap_caps_aligned_alloc_base(size_t alignment, size_t size, uint32_t caps);
@@ -65,15 +64,46 @@ static IRAM_ATTR esp_err_t esp_cache_get_alignment(uint32_t heap_caps, size_t *o
     return ESP_OK;
 }
 
-void init_memory_heap_caps() {
-    heap_caps_lock = xSemaphoreCreateMutex();
+// SPIRAM allocations always come from the kernel arena, whichever task asks.
+// The kernel heap is mapped for every task while the heap of a process is only
+// mapped while it runs, and LWIP allocates buffers in the context of one task and
+// frees them in another.
+#define kernel_arena (kernel_task.malloc_arena)
+
+// dlmalloc grows an arena through why_sbrk() of the current task, so an
+// application allocating from the kernel arena passes for a kernel task meanwhile
+static IRAM_ATTR task_info_t *kernel_arena_lock(void) {
+    task_info_t *self = current_task_info;
+
+    xSemaphoreTake(kernel_arena->lock, portMAX_DELAY);
+    current_task_info = &kernel_task;
+    malloc_arena_drain(kernel_arena);
+    return self;
+}
+
+static IRAM_ATTR void kernel_arena_unlock(task_info_t *self) {
+    current_task_info = self;
+    xSemaphoreGive(kernel_arena->lock);
+}
+
+// Applications don't wait for the kernel arena to free, their frees are picked
+// up by the next allocation from it
+static IRAM_ATTR void kernel_arena_free(void *ptr) {
+    if (get_task_info()->pid) {
+        malloc_arena_free_remote(kernel_arena, ptr);
+        return;
+    }
+
+    task_info_t *self = kernel_arena_lock();
+    mspace_free(&kernel_arena->state, ptr);
+    kernel_arena_unlock(self);
 }
 
 IRAM_ATTR void *__wrap_heap_caps_malloc_base(size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *ptr = dlmalloc(size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *ptr = mspace_malloc(&kernel_arena->state, size);
+        kernel_arena_unlock(self);
         return ptr;
     }
     return __real_heap_caps_malloc_base(size, caps);
@@ -81,9 +111,9 @@ IRAM_ATTR void *__wrap_heap_caps_malloc_base(size_t size, uint32_t caps) {
 
 IRAM_ATTR void *__wrap_heap_caps_aligned_alloc_base(size_t alignment, size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *ptr = dlmemalign(alignment, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *ptr = mspace_memalign(&kernel_arena->state, alignment, size);
+        kernel_arena_unlock(self);
         return ptr;
     }
     return __real_heap_caps_aligned_alloc_base(alignment, size, caps);
@@ -91,26 +121,30 @@ IRAM_ATTR void *__wrap_heap_caps_aligned_alloc_base(size_t alignment, size_t siz
 
 IRAM_ATTR void *__wrap_heap_caps_calloc_base(size_t n, size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *ptr = dlcalloc(n, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *ptr = mspace_calloc(&kernel_arena->state, n, size);
+        kernel_arena_unlock(self);
         return ptr;
     }
     return __real_heap_caps_calloc_base(n, size, caps);
 }
 
 IRAM_ATTR void *__wrap_heap_caps_realloc_base(void *ptr, size_t size, uint32_t caps) {
-    if ((uintptr_t)ptr >= KERNEL_HEAP_START && (uintptr_t)ptr < SOC_EXTRAM_HIGH) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *new_ptr = dlrealloc(ptr, size);
-        xSemaphoreGive(heap_caps_lock);
+    if (in_kernel_heap(ptr)) {
+        task_info_t *self = kernel_arena_lock();
+        void *new_ptr = mspace_realloc(&kernel_arena->state, ptr, size);
+        kernel_arena_unlock(self);
         return new_ptr;
     }
 
+    if (in_task_heap(ptr)) {
+        return why_realloc(ptr, size);
+    }
+
     if (!ptr && caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *new_ptr = dlrealloc(ptr, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *new_ptr = mspace_realloc(&kernel_arena->state, ptr, size);
+        kernel_arena_unlock(self);
         return new_ptr;
     }
 
@@ -119,9 +153,9 @@ IRAM_ATTR void *__wrap_heap_caps_realloc_base(void *ptr, size_t size, uint32_t c
 
 IRAM_ATTR void *__wrap_heap_caps_malloc(size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *ptr = dlmalloc(size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *ptr = mspace_malloc(&kernel_arena->state, size);
+        kernel_arena_unlock(self);
         return ptr;
     }
     return __real_heap_caps_malloc(size, caps);
@@ -136,27 +170,31 @@ IRAM_ATTR void *__wrap_heap_caps_realloc_default(void *ptr, size_t size) {
 }
 
 IRAM_ATTR void __wrap_heap_caps_free(void *ptr) {
-    if ((uintptr_t)ptr >= KERNEL_HEAP_START && (uintptr_t)ptr < SOC_EXTRAM_HIGH) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        dlfree(ptr);
-        xSemaphoreGive(heap_caps_lock);
+    if (in_kernel_heap(ptr)) {
+        kernel_arena_free(ptr);
+    } else if (in_task_heap(ptr)) {
+        why_free(ptr);
     } else {
         __real_heap_caps_free(ptr);
     }
 }
 
 IRAM_ATTR void *__wrap_heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
-    if ((uintptr_t)ptr >= KERNEL_HEAP_START && (uintptr_t)ptr < SOC_EXTRAM_HIGH) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *new_ptr = dlrealloc(ptr, size);
-        xSemaphoreGive(heap_caps_lock);
+    if (in_kernel_heap(ptr)) {
+        task_info_t *self = kernel_arena_lock();
+        void *new_ptr = mspace_realloc(&kernel_arena->state, ptr, size);
+        kernel_arena_unlock(self);
         return new_ptr;
     }
 
+    if (in_task_heap(ptr)) {
+        return why_realloc(ptr, size);
+    }
+
     if (!ptr && caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *new_ptr = dlrealloc(ptr, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *new_ptr = mspace_realloc(&kernel_arena->state, ptr, size);
+        kernel_arena_unlock(self);
         return new_ptr;
     }
 
@@ -165,9 +203,9 @@ IRAM_ATTR void *__wrap_heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
 
 IRAM_ATTR void *__wrap_heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *new_ptr = dlcalloc(n, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *new_ptr = mspace_calloc(&kernel_arena->state, n, size);
+        kernel_arena_unlock(self);
         return new_ptr;
     }
     return __real_heap_caps_calloc(n, size, caps);
@@ -175,19 +213,19 @@ IRAM_ATTR void *__wrap_heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
 
 IRAM_ATTR void *__wrap_heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *new_ptr = dlmemalign(alignment, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *new_ptr = mspace_memalign(&kernel_arena->state, alignment, size);
+        kernel_arena_unlock(self);
         return new_ptr;
     }
     return __real_heap_caps_aligned_alloc(alignment, size, caps);
 }
 
 IRAM_ATTR void __wrap_heap_caps_aligned_free(void *ptr) {
-    if ((uintptr_t)ptr >= KERNEL_HEAP_START && (uintptr_t)ptr < SOC_EXTRAM_HIGH) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        dlfree(ptr);
-        xSemaphoreGive(heap_caps_lock);
+    if (in_kernel_heap(ptr)) {
+        kernel_arena_free(ptr);
+    } else if (in_task_heap(ptr)) {
+        why_free(ptr);
     } else {
         __real_heap_caps_aligned_free(ptr);
     }
@@ -195,9 +233,9 @@ IRAM_ATTR void __wrap_heap_caps_aligned_free(void *ptr) {
 
 IRAM_ATTR void *__wrap_heap_caps_aligned_calloc(size_t alignment, size_t n, size_t size, uint32_t caps) {
     if (caps & MALLOC_CAP_SPIRAM) {
-        xSemaphoreTake(heap_caps_lock, portMAX_DELAY);
-        void *ptr = dlmemalign(alignment, size);
-        xSemaphoreGive(heap_caps_lock);
+        task_info_t *self = kernel_arena_lock();
+        void *ptr = mspace_memalign(&kernel_arena->state, alignment, size);
+        kernel_arena_unlock(self);
         if (ptr)
             memset(ptr, 0, n * size);
         return ptr;
@@ -16,14 +16,39 @@
 
 #include "badgevms/ota.h"
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "ota_delta.h"
+#include "spi_flash_mmap.h"
 #include "task.h"
 
 #include <stdatomic.h>
+#include <string.h>
+#include <sys/param.h>
 
 #define TAG "why_ota"
 
+// Filled by ota_write(), hashed and written by Talos. Enough of them to keep
+// receiving while Talos erases a block.
+#define OTA_BUFFERS      8
+#define OTA_BUFFER_SIZE  (16 * 1024)
+// Talos erases this far ahead of what it wrote while it waits for data, a
+// block at a time
+#define OTA_ERASE_AHEAD  (256 * 1024)
+#define OTA_ERASE_BLOCK  (64 * 1024)
+// The application receives on the user core
+#define TALOS_CORE       0
+
+typedef struct {
+    uint8_t *data;
+    size_t   size; // 0 tells Talos to stop
+} ota_buffer_t;
+
 struct ota_session_t {
     esp_partition_t const *configured;
     esp_partition_t const *running;
@@ -31,6 +56,24 @@ struct ota_session_t {
     esp_ota_handle_t       update_handle;
     atomic_flag            open;
     atomic_bool            error;
+
+    // Of ota_write()
+    ota_buffer_t *filling; // NULL if it has to take a free buffer first
+    size_t        handed;  // Buffers handed to Talos, they go round in order
+    size_t        offset;  // Bytes taken so far
+    ota_delta_t  *delta;   // If they are a patch against the running firmware
+
+    // Of Talos
+    bool                   writing; // Talos serves this session
+    uint32_t               written;
+    uint32_t               erased;
+    atomic_bool            failed;
+    mbedtls_sha256_context sha;
+
+    ota_buffer_t      buffers[OTA_BUFFERS];
+    SemaphoreHandle_t buffers_free;
+    SemaphoreHandle_t buffers_full;
+    SemaphoreHandle_t writer_done;
 };
 
 static ota_session_t session = {
@@ -42,12 +85,183 @@ static ota_session_t session = {
     .error            = ATOMIC_VAR_INIT(false),
 };
 
+// Erase the next sectors of the partition, up to a block boundary
+static bool ota_erase_step(void) {
+    uint32_t end = MIN((session.erased / OTA_ERASE_BLOCK + 1) * OTA_ERASE_BLOCK, session.update_partition->size);
+    if (session.erased >= end) {
+        return false;
+    }
+
+    esp_err_t err = esp_partition_erase_range(session.update_partition, session.erased, end - session.erased);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erasing at 0x%08" PRIx32 " failed (%s)", session.erased, esp_err_to_name(err));
+        atomic_store(&session.failed, true);
+        return false;
+    }
+
+    session.erased = end;
+    return true;
+}
+
+static bool ota_erase_ahead(void) {
+    if (atomic_load(&session.failed) || session.erased - session.written >= OTA_ERASE_AHEAD) {
+        return false;
+    }
+    return ota_erase_step();
+}
+
+static TaskHandle_t talos_handle;
+
+// Talos hashes and writes the buffers of a session in the order ota_write()
+// filled them. esp_ota_begin() only erased the first sector, Talos erases the
+// rest ahead of the writes when there is nothing to write, so the network
+// doesn't wait for the flash.
+static void talos(void *ignored) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (size_t n = 0;; ++n) {
+            bool taken = xSemaphoreTake(session.buffers_full, 0) == pdTRUE;
+            while (!taken && ota_erase_ahead()) {
+                taken = xSemaphoreTake(session.buffers_full, 0) == pdTRUE;
+            }
+            if (!taken) {
+                xSemaphoreTake(session.buffers_full, portMAX_DELAY);
+            }
+
+            ota_buffer_t *buffer = &session.buffers[n % OTA_BUFFERS];
+            if (!buffer->size) {
+                break;
+            }
+
+            if (!atomic_load(&session.failed)) {
+                mbedtls_sha256_update(&session.sha, buffer->data, buffer->size);
+                while (session.erased < session.written + buffer->size && ota_erase_step()) {
+                }
+
+                if (!atomic_load(&session.failed)) {
+                    esp_err_t err = esp_ota_write(session.update_handle, buffer->data, buffer->size);
+                    if (err != ESP_OK) {
+                        ESP_LOGE(TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
+                        atomic_store(&session.failed, true);
+                    }
+                    session.written += buffer->size;
+                }
+            }
+            xSemaphoreGive(session.buffers_free);
+        }
+
+        xSemaphoreGive(session.writer_done);
+    }
+}
+
+// Hand what ota_write() filled so far to Talos
+static void ota_hand(ota_handle_t session) {
+    if (session->filling && session->filling->size) {
+        session->filling = NULL;
+        ++session->handed;
+        xSemaphoreGive(session->buffers_full);
+    }
+}
+
+static ota_buffer_t *ota_take(ota_handle_t session) {
+    if (!session->filling) {
+        xSemaphoreTake(session->buffers_free, portMAX_DELAY);
+        session->filling       = &session->buffers[session->handed % OTA_BUFFERS];
+        session->filling->size = 0;
+    }
+    return session->filling;
+}
+
+// Wait until Talos wrote everything handed to it
+static void ota_drain(ota_handle_t session) {
+    for (int i = 0; i < OTA_BUFFERS; ++i) {
+        xSemaphoreTake(session->buffers_free, portMAX_DELAY);
+    }
+    for (int i = 0; i < OTA_BUFFERS; ++i) {
+        xSemaphoreGive(session->buffers_free);
+    }
+}
+
+// Let Talos finish and free what the pipeline used. The buffer being filled,
+// if any, is written unless the session is aborted.
+static void ota_pipeline_stop(ota_handle_t session, bool write) {
+    if (session->writing) {
+        if (write) {
+            ota_hand(session);
+        }
+
+        ota_buffer_t *end = ota_take(session);
+        end->size         = 0;
+        xSemaphoreGive(session->buffers_full);
+        xSemaphoreTake(session->writer_done, portMAX_DELAY);
+        session->writing = false;
+        session->filling = NULL;
+    }
+
+    ota_delta_destroy(session->delta);
+    session->delta = NULL;
+
+    for (int i = 0; i < OTA_BUFFERS; ++i) {
+        heap_caps_free(session->buffers[i].data);
+        session->buffers[i].data = NULL;
+    }
+    mbedtls_sha256_free(&session->sha);
+}
+
+// Talos is started by the first session and stays for later ones
+static bool ota_pipeline_start(void) {
+    if (!talos_handle) {
+        session.buffers_free = xSemaphoreCreateCounting(OTA_BUFFERS, 0);
+        session.buffers_full = xSemaphoreCreateCounting(OTA_BUFFERS, 0);
+        session.writer_done  = xSemaphoreCreateBinary();
+        if (!session.buffers_free || !session.buffers_full || !session.writer_done) {
+            ESP_LOGE(TAG, "Unable to create the semaphores");
+            return false;
+        }
+
+        if (create_kernel_task(talos, "Talos", 4096, NULL, TASK_PRIORITY, &talos_handle, TALOS_CORE) != pdTRUE) {
+            ESP_LOGE(TAG, "Failed to create Talos task");
+            talos_handle = NULL;
+            return false;
+        }
+    }
+
+    // Whatever the last session left behind
+    xQueueReset((QueueHandle_t)session.buffers_free);
+    xQueueReset((QueueHandle_t)session.buffers_full);
+    xQueueReset((QueueHandle_t)session.writer_done);
+    for (int i = 0; i < OTA_BUFFERS; ++i) {
+        session.buffers[i].data = heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_SPIRAM);
+        if (!session.buffers[i].data) {
+            ESP_LOGE(TAG, "Out of memory for the buffers");
+            return false;
+        }
+        xSemaphoreGive(session.buffers_free);
+    }
+
+    session.filling = NULL;
+    session.handed  = 0;
+    session.offset  = 0;
+    session.delta   = NULL;
+    session.written = 0;
+    session.erased  = SPI_FLASH_SEC_SIZE;
+    atomic_store(&session.failed, false);
+    mbedtls_sha256_init(&session.sha);
+    mbedtls_sha256_starts(&session.sha, 0);
+
+    session.writing = true;
+    xTaskNotifyGive(talos_handle);
+    return true;
+}
+
 ota_handle_t ota_session_open() {
     esp_err_t err;
 
     if (atomic_flag_test_and_set(&session.open)) {
         return NULL;
     }
+    atomic_store(&session.error, false);
 
     task_record_resource_alloc(RES_OTA, (ota_handle_t)&session);
 
@@ -63,32 +277,99 @@ ota_handle_t ota_session_open() {
 
     session.update_partition = esp_ota_get_next_update_partition(NULL);
     if (session.update_partition == NULL) {
+        task_record_resource_free(RES_OTA, (ota_handle_t)&session);
         atomic_flag_clear(&session.open);
         return NULL;
     }
 
-    err = esp_ota_begin(session.update_partition, OTA_WITH_SEQUENTIAL_WRITES, &(session.update_handle));
+    // The size only decides what is erased up front, the first sector. Talos
+    // erases the rest.
+    err = esp_ota_begin(session.update_partition, SPI_FLASH_SEC_SIZE, &(session.update_handle));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
         ota_session_abort((ota_handle_t)&session);
         return NULL;
     }
 
-    atomic_store(&session.error, false);
+    if (!ota_pipeline_start()) {
+        ota_session_abort((ota_handle_t)&session);
+        return NULL;
+    }
 
     return (ota_handle_t)&session;
 }
 
+// Copy size bytes of the new image at data into the buffers for Talos
+static void ota_feed(void *ctx, void const *data, size_t size) {
+    ota_handle_t   session = ctx;
+    uint8_t const *src     = data;
+    size_t         left    = size;
+
+    while (left) {
+        ota_buffer_t *filling = ota_take(session);
+        size_t        n       = MIN(left, OTA_BUFFER_SIZE - filling->size);
+        memcpy(filling->data + filling->size, src, n);
+        filling->size += n;
+        src           += n;
+        left          -= n;
+
+        if (filling->size == OTA_BUFFER_SIZE) {
+            ota_hand(session);
+        }
+    }
+}
+
 bool ota_write(ota_handle_t session, void *buffer, int block_size) {
-    esp_err_t err;
     if (atomic_load(&session->error)) {
         return false;
     }
-    err = esp_ota_write(session->update_handle, (void const *)buffer, block_size);
-    if (err != ESP_OK) {
+    if (atomic_load(&session->failed)) {
         ota_session_abort(session);
         return false;
     }
+
+    // The first byte tells a patch from an image
+    if (!session->offset && block_size > 0 && *(uint8_t *)buffer == OTA_DELTA_FIRST_BYTE) {
+        session->delta = ota_delta_create(session->running, ota_feed, session);
+        if (!session->delta) {
+            ota_session_abort(session);
+            return false;
+        }
+    }
+
+    if (session->delta) {
+        if (!ota_delta_write(session->delta, buffer, block_size)) {
+            ota_session_abort(session);
+            return false;
+        }
+    } else {
+        ota_feed(session, buffer, block_size);
+    }
+
+    session->offset += block_size;
+    return true;
+}
+
+size_t ota_session_offset(ota_handle_t session) {
+    return session->offset;
+}
+
+bool ota_session_sha256(ota_handle_t session, uint8_t digest[32]) {
+    if (atomic_load(&session->error)) {
+        return false;
+    }
+
+    ota_hand(session);
+    ota_drain(session);
+    if (atomic_load(&session->failed)) {
+        return false;
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_clone(&sha, &session->sha);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
     return true;
 }
 
@@ -97,6 +378,19 @@ bool ota_session_commit(ota_handle_t session) {
     if (atomic_load(&session->error)) {
         return false;
     }
+
+    if (session->delta && !ota_delta_done(session->delta)) {
+        ESP_LOGE(TAG, "The patch is incomplete");
+        ota_session_abort(session);
+        return false;
+    }
+
+    ota_pipeline_stop(session, true);
+    if (atomic_load(&session->failed)) {
+        ota_session_abort(session);
+        return false;
+    }
+
     err = esp_ota_end(session->update_handle);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
@@ -117,6 +411,11 @@ bool ota_session_commit(ota_handle_t session) {
 }
 
 bool ota_session_abort(ota_handle_t session) {
+    if (atomic_load(&session->error)) {
+        return true;
+    }
+
+    ota_pipeline_stop(session, false);
     esp_ota_abort(session->update_handle);
     task_record_resource_free(RES_OTA, session);
     atomic_flag_clear(&session->open);
@@ -138,7 +437,7 @@ bool ota_get_running_version(char *version) {
         return false;
     }
 
-    *version = *running_app_info.version;
+    strlcpy(version, running_app_info.version, sizeof(running_app_info.version));
 
     return true;
 }
@@ -161,7 +460,7 @@ bool ota_get_invalid_version(char *version) {
         return false;
     }
 
-    *version = *invalid_app_info.version;
+    strlcpy(version, invalid_app_info.version, sizeof(invalid_app_info.version));
 
     return true;
 }
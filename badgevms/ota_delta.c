@@ -0,0 +1,281 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ota_delta.h"
+
+#include "compressed_file.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "ota_delta"
+
+// Keep in sync with misc/make_delta.py
+#define OTA_DELTA_MAGIC     0x31445642 // "BVD1"
+#define OTA_DELTA_BLOCK_MAX (64 * 1024)
+// Of the old image read at a time
+#define OTA_DELTA_READ_SIZE 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t old_size;
+    uint32_t new_size;
+    uint32_t block_size;
+    uint8_t  old_sha256[32]; // Of the first old_size bytes of the running partition
+} ota_delta_header_t;
+
+typedef struct {
+    uint32_t packed; // The same as size if it is stored as it is
+    uint32_t size;
+} ota_delta_block_t;
+
+typedef struct {
+    uint32_t add;
+    uint32_t insert;
+    int32_t  seek;
+} ota_delta_command_t;
+
+typedef enum {
+    DELTA_HEADER,
+    DELTA_BLOCK_HEADER,
+    DELTA_BLOCK,
+} ota_delta_stage_t;
+
+struct ota_delta {
+    esp_partition_t const *old;
+    ota_delta_emit_t       emit;
+    void                  *ctx;
+    bool                   failed;
+
+    // What is collected of the patch for the stage
+    ota_delta_stage_t stage;
+    uint8_t          *collect;
+    size_t            collect_size;
+    size_t            collected;
+
+    ota_delta_header_t header;
+    ota_delta_block_t  block_header;
+    uint8_t           *packed;
+    uint8_t           *block;
+    uint8_t           *old_data;
+
+    // Of the commands, which may straddle blocks
+    ota_delta_command_t command;
+    size_t              command_collected;
+    bool                seek_pending;
+    uint32_t            old_pos;
+    uint32_t            produced;
+};
+
+static void ota_delta_collect(ota_delta_t *delta, ota_delta_stage_t stage, void *dst, size_t size) {
+    delta->stage        = stage;
+    delta->collect      = dst;
+    delta->collect_size = size;
+    delta->collected    = 0;
+}
+
+static bool ota_delta_fail(ota_delta_t *delta, char const *why) {
+    ESP_LOGE(TAG, "Unusable patch: %s", why);
+    delta->failed = true;
+    return false;
+}
+
+// Whether the running partition holds the image the patch was made against
+static bool ota_delta_check_old(ota_delta_t *delta) {
+    mbedtls_sha256_context sha;
+    uint8_t                digest[32];
+    bool                   ok = true;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t offset = 0; offset < delta->header.old_size && ok; offset += OTA_DELTA_READ_SIZE) {
+        size_t size = MIN(OTA_DELTA_READ_SIZE, delta->header.old_size - offset);
+        ok          = esp_partition_read(delta->old, offset, delta->old_data, size) == ESP_OK;
+        mbedtls_sha256_update(&sha, delta->old_data, size);
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+
+    return ok && !memcmp(digest, delta->header.old_sha256, sizeof(digest));
+}
+
+static bool ota_delta_header(ota_delta_t *delta) {
+    ota_delta_header_t const *header = &delta->header;
+
+    if (header->magic != OTA_DELTA_MAGIC) {
+        return ota_delta_fail(delta, "not a patch");
+    }
+    if (!header->block_size || header->block_size > OTA_DELTA_BLOCK_MAX || header->old_size > delta->old->size) {
+        return ota_delta_fail(delta, "bad header");
+    }
+    if (!ota_delta_check_old(delta)) {
+        return ota_delta_fail(delta, "made against another firmware");
+    }
+
+    delta->packed = heap_caps_malloc(header->block_size, MALLOC_CAP_SPIRAM);
+    delta->block  = heap_caps_malloc(header->block_size, MALLOC_CAP_SPIRAM);
+    if (!delta->packed || !delta->block) {
+        return ota_delta_fail(delta, "out of memory");
+    }
+
+    ota_delta_collect(delta, DELTA_BLOCK_HEADER, &delta->block_header, sizeof(ota_delta_block_t));
+    return true;
+}
+
+static bool ota_delta_block_header(ota_delta_t *delta) {
+    ota_delta_block_t const *block = &delta->block_header;
+
+    if (!block->size || block->size > delta->header.block_size || !block->packed || block->packed > block->size) {
+        return ota_delta_fail(delta, "bad block");
+    }
+
+    // Stored blocks go where they are used
+    ota_delta_collect(delta, DELTA_BLOCK, block->packed == block->size ? delta->block : delta->packed, block->packed);
+    return true;
+}
+
+// Run the commands in size bytes of the unpacked stream at data
+static bool ota_delta_commands(ota_delta_t *delta, uint8_t const *data, size_t size) {
+    ota_delta_command_t *command = &delta->command;
+
+    while (size) {
+        if (!command->add && !command->insert) {
+            if (delta->seek_pending) {
+                int64_t old_pos = (int64_t)delta->old_pos + command->seek;
+                if (old_pos < 0 || old_pos > delta->header.old_size) {
+                    return ota_delta_fail(delta, "seek out of the old image");
+                }
+                delta->old_pos      = old_pos;
+                delta->seek_pending = false;
+            }
+
+            size_t n = MIN(size, sizeof(ota_delta_command_t) - delta->command_collected);
+            memcpy((uint8_t *)command + delta->command_collected, data, n);
+            delta->command_collected += n;
+            data                     += n;
+            size                     -= n;
+            if (delta->command_collected < sizeof(ota_delta_command_t)) {
+                break;
+            }
+
+            delta->command_collected = 0;
+            delta->seek_pending      = true;
+            if (command->add > delta->header.old_size - delta->old_pos ||
+                (uint64_t)command->add + command->insert > delta->header.new_size - delta->produced) {
+                return ota_delta_fail(delta, "command out of the images");
+            }
+            continue;
+        }
+
+        if (command->add) {
+            size_t n = MIN(MIN(size, command->add), OTA_DELTA_READ_SIZE);
+            if (esp_partition_read(delta->old, delta->old_pos, delta->old_data, n) != ESP_OK) {
+                return ota_delta_fail(delta, "unable to read the old image");
+            }
+            for (size_t i = 0; i < n; ++i) {
+                delta->old_data[i] += data[i];
+            }
+            delta->emit(delta->ctx, delta->old_data, n);
+            delta->old_pos  += n;
+            delta->produced += n;
+            command->add    -= n;
+            data            += n;
+            size            -= n;
+        } else {
+            size_t n = MIN(size, command->insert);
+            delta->emit(delta->ctx, data, n);
+            delta->produced += n;
+            command->insert -= n;
+            data            += n;
+            size            -= n;
+        }
+    }
+    return true;
+}
+
+static bool ota_delta_block(ota_delta_t *delta) {
+    ota_delta_block_t const *block = &delta->block_header;
+
+    if (block->packed != block->size && !lz4_decompress(delta->packed, block->packed, delta->block, block->size)) {
+        return ota_delta_fail(delta, "damaged block");
+    }
+    if (!ota_delta_commands(delta, delta->block, block->size)) {
+        return false;
+    }
+
+    ota_delta_collect(delta, DELTA_BLOCK_HEADER, &delta->block_header, sizeof(ota_delta_block_t));
+    return true;
+}
+
+ota_delta_t *ota_delta_create(esp_partition_t const *old, ota_delta_emit_t emit, void *ctx) {
+    ota_delta_t *delta = heap_caps_calloc(1, sizeof(ota_delta_t), MALLOC_CAP_SPIRAM);
+    if (!delta) {
+        return NULL;
+    }
+
+    delta->old      = old;
+    delta->emit     = emit;
+    delta->ctx      = ctx;
+    delta->old_data = heap_caps_malloc(OTA_DELTA_READ_SIZE, MALLOC_CAP_SPIRAM);
+    if (!delta->old_data) {
+        heap_caps_free(delta);
+        return NULL;
+    }
+
+    ota_delta_collect(delta, DELTA_HEADER, &delta->header, sizeof(ota_delta_header_t));
+    return delta;
+}
+
+void ota_delta_destroy(ota_delta_t *delta) {
+    if (!delta) {
+        return;
+    }
+
+    heap_caps_free(delta->packed);
+    heap_caps_free(delta->block);
+    heap_caps_free(delta->old_data);
+    heap_caps_free(delta);
+}
+
+bool ota_delta_write(ota_delta_t *delta, void const *patch, size_t size) {
+    uint8_t const *data = patch;
+
+    while (size && !delta->failed) {
+        size_t n = MIN(size, delta->collect_size - delta->collected);
+        memcpy(delta->collect + delta->collected, data, n);
+        delta->collected += n;
+        data             += n;
+        size             -= n;
+        if (delta->collected < delta->collect_size) {
+            break;
+        }
+
+        switch (delta->stage) {
+            case DELTA_HEADER: ota_delta_header(delta); break;
+            case DELTA_BLOCK_HEADER: ota_delta_block_header(delta); break;
+            case DELTA_BLOCK: ota_delta_block(delta); break;
+        }
+    }
+    return !delta->failed;
+}
+
+bool ota_delta_done(ota_delta_t const *delta) {
+    return !delta->failed && delta->stage == DELTA_BLOCK_HEADER && !delta->collected && !delta->command_collected &&
+           !delta->command.add && !delta->command.insert && delta->produced == delta->header.new_size;
+}
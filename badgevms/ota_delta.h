@@ -0,0 +1,48 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "esp_partition.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A patch made by misc/make_delta.py turns the image in the running partition
+// into a new one. It is applied as it arrives: the new image comes out in
+// order, reading the old one where it is alike.
+//
+// After a header, the patch is a stream of LZ4 blocks. Unpacked, the stream is
+// a series of commands, each adds the bytes that follow it to as many bytes of
+// the old image, then inserts bytes of its own, then moves in the old image.
+typedef struct ota_delta ota_delta_t;
+
+// The first byte of a patch, firmware images start with 0xe9
+#define OTA_DELTA_FIRST_BYTE 'B'
+
+// Hands size bytes of the new image at data to ctx
+typedef void (*ota_delta_emit_t)(void *ctx, void const *data, size_t size);
+
+ota_delta_t *ota_delta_create(esp_partition_t const *old, ota_delta_emit_t emit, void *ctx);
+// Accepts NULL
+void         ota_delta_destroy(ota_delta_t *delta);
+
+// Apply the next size bytes of the patch. False if it is damaged or made
+// against another image, after that it takes nothing.
+bool ota_delta_write(ota_delta_t *delta, void const *patch, size_t size);
+// Whether the whole patch arrived and made all of the new image
+bool ota_delta_done(ota_delta_t const *delta);
@@ -24,6 +24,7 @@
 
 #include <errno.h>
 #include <string.h>
+#include <sys/stat.h>
 
 static inline bool is_valid_device_char(char c) {
     return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-' ||
@@ -40,17 +41,16 @@ path_parse_result_t parse_path(char const *path, path_t *result) {
         return PATH_PARSE_EMPTY_PATH;
     }
 
-    result->buffer    = NULL;
     result->device    = NULL;
     result->directory = NULL;
     result->filename  = NULL;
     result->unixpath  = NULL;
     result->len       = strlen(path);
 
-    result->buffer = why_strdup(path);
-    if (!result->buffer) {
-        return PATH_PARSE_EMPTY_PATH;
+    if (result->len > PATH_MAX_LEN) {
+        return PATH_PARSE_TOO_LONG;
     }
+    memcpy(result->buffer, path, result->len + 1);
 
     char *p     = result->buffer;
     char *start = p;
@@ -114,54 +114,49 @@ path_parse_result_t parse_path(char const *path, path_t *result) {
     return PATH_PARSE_OK;
 }
 
+// The parts are in order, so they are moved around in the buffer. Only the
+// filename moves right, by the '/' in front, if there is no directory.
 char *path_to_unix(path_t *path) {
     if (path->unixpath) {
         return path->unixpath;
     }
 
-    // Most unix paths are shorter than BadgeVMS paths except for directory-less paths.
-    char  *unixpath      = malloc(path->len + 3);
     size_t device_len    = strlen(path->device);
-    size_t directory_len = 0;
-    size_t filename_len  = 0;
+    size_t directory_len = path->directory ? strlen(path->directory) : 0;
+    size_t filename_len  = path->filename ? strlen(path->filename) : 0;
 
-    if (path->directory) {
-        directory_len = strlen(path->directory);
+    // /DEVICE/ and DEVICE:[ are as long, as are DIR/SUBDIR/ and DIR.SUBDIR]
+    size_t o = device_len + 2;
+    if (directory_len) {
+        o += directory_len + 1;
     }
 
-    if (path->filename) {
-        filename_len = strlen(path->filename);
+    if (filename_len) {
+        memmove(&path->buffer[o], path->filename, filename_len);
     }
-
-    size_t o      = 0;
-    unixpath[o++] = '/';
-    memcpy(&unixpath[o], path->device, device_len);
-    o             += device_len;
-    unixpath[o++]  = '/';
+    path->buffer[o + filename_len] = '\0';
 
     if (directory_len) {
         for (size_t i = 0; i < directory_len; ++i) {
-            char c = path->directory[i];
-            if (c == '.')
-                c = '/';
-            unixpath[o++] = c;
+            if (path->directory[i] == '.')
+                path->directory[i] = '/';
         }
-        unixpath[o++] = '/';
+        path->directory[directory_len] = '/';
     }
 
-    if (filename_len) {
-        memcpy(&unixpath[o], path->filename, filename_len);
-        o += filename_len;
-    }
+    memmove(&path->buffer[1], path->buffer, device_len);
+    path->buffer[0]              = '/';
+    path->buffer[device_len + 1] = '/';
 
-    unixpath[o]    = 0;
-    path->unixpath = unixpath;
-    return unixpath;
+    path->device    = NULL;
+    path->directory = NULL;
+    path->filename  = NULL;
+    path->unixpath  = path->buffer;
+    return path->unixpath;
 }
 
 void path_free(path_t *path) {
-    why_free(path->buffer);
-    free(path->unixpath);
+    (void)path;
 }
 
 bool mkdir_p(char const *path) {
@@ -177,57 +172,38 @@ bool mkdir_p(char const *path) {
     }
 
     if (!parsed_path.directory || strlen(parsed_path.directory) == 0) {
-        path_free(&parsed_path);
         return true;
     }
 
-    char *current_path = NULL;
-    why_asprintf(&current_path, "%s:", parsed_path.device ? parsed_path.device : "");
-    if (!current_path) {
-        path_free(&parsed_path);
-        return false;
-    }
-
-    char *dir_copy = why_strdup(parsed_path.directory);
-    if (!dir_copy) {
-        why_free(current_path);
-        path_free(&parsed_path);
-        return false;
-    }
-
-    bool  success   = true;
-    char *dir_token = strtok(dir_copy, ".");
+    // Never longer than path, each step adds a directory to DEV:[a.b]
+    char   current_path[PATH_MAX_LEN + 1];
+    size_t len = snprintf(current_path, sizeof(current_path), "%s:[", parsed_path.device ? parsed_path.device : "");
 
-    while (dir_token && success) {
-        char *new_path = path_dirconcat(current_path, dir_token);
-        if (!new_path) {
-            success = false;
-            break;
+    char *dir_token = strtok(parsed_path.directory, ".");
+    while (dir_token) {
+        size_t token_len = strlen(dir_token);
+        if (len + token_len + 1 >= sizeof(current_path)) {
+            return false;
         }
+        memcpy(&current_path[len], dir_token, token_len);
+        len                   += token_len;
+        current_path[len]      = ']';
+        current_path[len + 1]  = '\0';
 
         struct stat st;
-        if (why_stat(new_path, &st) != 0) {
-            if (why_mkdir(new_path, 0755) != 0 && errno != EEXIST) {
-                success = false;
-                why_free(new_path);
-                break;
+        if (why_stat(current_path, &st) != 0) {
+            if (why_mkdir(current_path, 0755) != 0 && errno != EEXIST) {
+                return false;
             }
         } else if (!S_ISDIR(st.st_mode)) {
-            success = false;
-            why_free(new_path);
-            break;
+            return false;
         }
 
-        why_free(current_path);
-        current_path = new_path;
-        dir_token    = strtok(NULL, ".");
+        current_path[len++] = '.';
+        dir_token           = strtok(NULL, ".");
     }
 
-    why_free(current_path);
-    why_free(dir_copy);
-    path_free(&parsed_path);
-
-    return success;
+    return true;
 }
 
 bool rm_rf(char const *path) {
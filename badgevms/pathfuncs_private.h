@@ -18,4 +18,6 @@
 
 #include "badgevms/pathfuncs.h"
 
+// /DEVICE/DIR/SUBDIR/FILENAME.EXT, made in the buffer of path so its device,
+// directory and filename are gone afterwards
 char *path_to_unix(path_t *path);
@@ -0,0 +1,164 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms/profiler.h"
+
+#include "esp_attr.h"
+#include "esp_freertos_hooks.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "riscv/rvruntime-frames.h"
+#include "task.h"
+
+#include <stdatomic.h>
+
+#define TAG "profiler"
+
+// Distinct program counters a profile holds, a power of two. The tick hook
+// runs with the caches possibly disabled, so this stays in internal memory.
+#define PROFILER_SLOTS_BITS 11
+#define PROFILER_SLOTS      (1 << PROFILER_SLOTS_BITS)
+// Slots looked at before a sample is dropped
+#define PROFILER_PROBES     16
+
+typedef struct {
+    task_thread_t *_Atomic thread; // Being profiled, NULL when not running
+    // Copied from thread, which may go away while we sample
+    uintptr_t              text_start;
+    uintptr_t              text_end;
+    uintptr_t              elf_bias;
+    uintptr_t              hot_start;
+    uintptr_t              hot_end;
+    uintptr_t              hot_bias;
+    profiler_sample_t     *slots;
+    profiler_summary_t     summary;
+} profiler_t;
+
+static DRAM_ATTR profiler_t profiler;
+static portMUX_TYPE         profiler_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR profiler_tick(void) {
+    task_thread_t *thread = atomic_load(&profiler.thread);
+    if (!thread) {
+        return;
+    }
+
+    TaskHandle_t task      = xTaskGetCurrentTaskHandle();
+    task_info_t *task_info = pvTaskGetThreadLocalStoragePointer(task, 1);
+    if (!task_info || task_info->thread != thread) {
+        return;
+    }
+
+    // The tick interrupted this task. Its registers were saved on its stack,
+    // pxTopOfStack, the first member of the TCB, points at them.
+    RvExcFrame const *frame = *(RvExcFrame *const *)task;
+    uintptr_t         pc    = frame->mepc;
+
+    ++profiler.summary.samples;
+    uint32_t vaddr;
+    if (pc >= profiler.text_start && pc < profiler.text_end) {
+        vaddr = pc - profiler.elf_bias;
+    } else if (pc >= profiler.hot_start && pc < profiler.hot_end) {
+        vaddr = pc - profiler.hot_bias;
+    } else {
+        ++profiler.summary.kernel;
+        return;
+    }
+
+    uint32_t hash  = ((vaddr >> 1) * 2654435761u) >> (32 - PROFILER_SLOTS_BITS);
+    for (int i = 0; i < PROFILER_PROBES; ++i) {
+        profiler_sample_t *slot = &profiler.slots[(hash + i) & (PROFILER_SLOTS - 1)];
+        if (!slot->count) {
+            slot->vaddr = vaddr;
+            ++profiler.summary.num_pcs;
+        }
+        if (slot->vaddr == vaddr) {
+            ++slot->count;
+            return;
+        }
+    }
+    ++profiler.summary.dropped;
+}
+
+bool profiler_start(pid_t pid) {
+    task_info_t *task_info = pid > 0 && pid <= MAX_PID ? get_taskinfo_for_pid(pid) : NULL;
+    // Not loaded yet until the text is there and relocated
+    if (!task_info || task_info->thread->text_end <= task_info->thread->text_start || !task_info->thread->elf_bias) {
+        return false;
+    }
+
+    profiler_sample_t *slots = heap_caps_calloc(PROFILER_SLOTS, sizeof(profiler_sample_t), MALLOC_CAP_INTERNAL);
+    if (!slots) {
+        ESP_LOGE(TAG, "Unable to allocate the histogram");
+        return false;
+    }
+
+    portENTER_CRITICAL(&profiler_lock);
+    if (atomic_load(&profiler.thread)) {
+        portEXIT_CRITICAL(&profiler_lock);
+        heap_caps_free(slots);
+        return false;
+    }
+
+    profiler_sample_t *old = profiler.slots;
+    profiler.text_start    = task_info->thread->text_start;
+    profiler.text_end      = task_info->thread->text_end;
+    profiler.elf_bias      = task_info->thread->elf_bias;
+    profiler.hot_start     = task_info->thread->hot_start;
+    profiler.hot_end       = task_info->thread->hot_end;
+    profiler.hot_bias      = task_info->thread->hot_bias;
+    profiler.slots         = slots;
+    profiler.summary       = (profiler_summary_t){0};
+    atomic_store(&profiler.thread, task_info->thread);
+    portEXIT_CRITICAL(&profiler_lock);
+
+    // Stopped long ago, the hook is done with it
+    heap_caps_free(old);
+
+    if (esp_register_freertos_tick_hook_for_cpu(profiler_tick, USER_TASK_CORE) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to register the tick hook");
+        atomic_store(&profiler.thread, NULL);
+        return false;
+    }
+
+    ESP_LOGW(TAG, "Profiling PID %d", pid);
+    return true;
+}
+
+void profiler_stop(profiler_summary_t *summary) {
+    if (atomic_exchange(&profiler.thread, NULL)) {
+        esp_deregister_freertos_tick_hook_for_cpu(profiler_tick, USER_TASK_CORE);
+    }
+
+    if (summary) {
+        *summary = profiler.summary;
+    }
+}
+
+size_t profiler_histogram(profiler_sample_t *samples, size_t max) {
+    size_t num = 0;
+
+    if (!samples || !profiler.slots) {
+        return 0;
+    }
+
+    for (int i = 0; i < PROFILER_SLOTS && num < max; ++i) {
+        if (profiler.slots[i].count) {
+            samples[num++] = profiler.slots[i];
+        }
+    }
+    return num;
+}
@@ -0,0 +1,237 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "readahead.h"
+
+#include "compressed_file.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "task.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "readahead"
+
+// A compressed block, two of them are read ahead at most
+#define READAHEAD_WINDOW     (16 * 1024)
+#define READAHEAD_WINDOWS    2
+#define READAHEAD_MAX_RANGES 16
+// The loader is on the user core, the other one has time
+#define IRIS_CORE            0
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t offset;
+    uint32_t size;
+    bool     ok;
+} readahead_window_t;
+
+struct readahead {
+    char const         *path;
+    struct {
+        uint32_t offset;
+        uint32_t size;
+    } ranges[READAHEAD_MAX_RANGES];
+    int                 num_ranges;
+    bool                overflow; // Ranges were left out, so no more are taken
+    bool                started;
+    atomic_bool         stop;
+    readahead_window_t  windows[READAHEAD_WINDOWS];
+    // Of the reader, the next byte of the ranges and the window it is in if Iris handed that over
+    int                 range;
+    uint32_t            range_offset;
+    size_t              taken;
+    readahead_window_t *window;
+    uint32_t            window_offset;
+    bool                failed;
+};
+
+static TaskHandle_t      iris_handle;
+static SemaphoreHandle_t windows_free;
+static SemaphoreHandle_t windows_full;
+static SemaphoreHandle_t iris_idle;
+static atomic_bool       busy;
+static readahead_t       job;
+
+// The windows of the ranges in order, the reader goes through them the same way
+static void iris(void *ignored) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        compressed_file_t *file = compressed_file_open(job.path);
+        if (!file) {
+            ESP_LOGW(TAG, "Unable to open %s", job.path);
+        }
+
+        size_t n = 0;
+        for (int r = 0; r < job.num_ranges; ++r) {
+            for (uint32_t offset = 0; offset < job.ranges[r].size; offset += READAHEAD_WINDOW) {
+                xSemaphoreTake(windows_free, portMAX_DELAY);
+                if (atomic_load(&job.stop)) {
+                    goto out;
+                }
+
+                readahead_window_t *window = &job.windows[n++ % READAHEAD_WINDOWS];
+
+                window->offset = job.ranges[r].offset + offset;
+                window->size   = MIN(READAHEAD_WINDOW, job.ranges[r].size - offset);
+                window->ok     = file && compressed_file_pread(file, window->offset, window->buf, window->size);
+                xSemaphoreGive(windows_full);
+                if (!window->ok) {
+                    // The reader stops here and reads the rest itself
+                    goto out;
+                }
+            }
+        }
+
+    out:
+        compressed_file_close(file);
+        xSemaphoreGive(iris_idle);
+    }
+}
+
+bool readahead_init() {
+    windows_free = xSemaphoreCreateCounting(READAHEAD_WINDOWS, 0);
+    windows_full = xSemaphoreCreateCounting(READAHEAD_WINDOWS, 0);
+    iris_idle    = xSemaphoreCreateBinary();
+    if (!windows_free || !windows_full || !iris_idle) {
+        ESP_LOGE(TAG, "Unable to create the semaphores");
+        return false;
+    }
+
+    for (int i = 0; i < READAHEAD_WINDOWS; ++i) {
+        job.windows[i].buf = heap_caps_malloc(READAHEAD_WINDOW, MALLOC_CAP_SPIRAM);
+        if (!job.windows[i].buf) {
+            ESP_LOGE(TAG, "Out of memory for the windows");
+            return false;
+        }
+    }
+
+    if (create_kernel_task(iris, "Iris", 4096, NULL, TASK_PRIORITY, &iris_handle, IRIS_CORE) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create IRIS task");
+        return false;
+    }
+    return true;
+}
+
+readahead_t *readahead_start(char const *path) {
+    bool expected = false;
+    if (!iris_handle || !atomic_compare_exchange_strong(&busy, &expected, true)) {
+        return NULL;
+    }
+
+    // Whatever the last reader left behind
+    xQueueReset((QueueHandle_t)windows_free);
+    xQueueReset((QueueHandle_t)windows_full);
+    for (int i = 0; i < READAHEAD_WINDOWS; ++i) {
+        xSemaphoreGive(windows_free);
+    }
+
+    job.path         = path;
+    job.num_ranges   = 0;
+    job.overflow     = false;
+    job.started      = false;
+    job.range        = 0;
+    job.range_offset = 0;
+    job.taken        = 0;
+    job.window       = NULL;
+    job.failed       = false;
+    atomic_store(&job.stop, false);
+    return &job;
+}
+
+void readahead_add(readahead_t *ra, uint32_t offset, uint32_t size) {
+    if (!ra || ra->started || !size) {
+        return;
+    }
+
+    if (ra->overflow || ra->num_ranges == READAHEAD_MAX_RANGES) {
+        ra->overflow = true;
+        return;
+    }
+
+    ra->ranges[ra->num_ranges].offset = offset;
+    ra->ranges[ra->num_ranges].size   = size;
+    ++ra->num_ranges;
+}
+
+size_t readahead_read(readahead_t *ra, uint32_t offset, void *buf, size_t size) {
+    if (!ra || ra->failed) {
+        return 0;
+    }
+
+    if (!ra->started) {
+        ra->started = true;
+        xTaskNotifyGive(iris_handle);
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        if (!ra->window) {
+            if (ra->range == ra->num_ranges || ra->ranges[ra->range].offset + ra->range_offset != offset + done) {
+                break;
+            }
+
+            xSemaphoreTake(windows_full, portMAX_DELAY);
+            ra->window        = &ra->windows[ra->taken++ % READAHEAD_WINDOWS];
+            ra->window_offset = 0;
+            if (!ra->window->ok) {
+                ra->failed = true;
+                break;
+            }
+        }
+
+        if (ra->window->offset + ra->window_offset != offset + done) {
+            break;
+        }
+
+        size_t n = MIN(size - done, ra->window->size - ra->window_offset);
+        memcpy((uint8_t *)buf + done, ra->window->buf + ra->window_offset, n);
+        ra->window_offset += n;
+        done              += n;
+
+        if (ra->window_offset == ra->window->size) {
+            ra->range_offset += ra->window->size;
+            if (ra->range_offset == ra->ranges[ra->range].size) {
+                ++ra->range;
+                ra->range_offset = 0;
+            }
+            ra->window = NULL;
+            xSemaphoreGive(windows_free);
+        }
+    }
+
+    return done;
+}
+
+void readahead_stop(readahead_t *ra) {
+    if (!ra) {
+        return;
+    }
+
+    if (ra->started) {
+        // Wake Iris if it waits for a window to read into
+        atomic_store(&ra->stop, true);
+        xSemaphoreGive(windows_free);
+        xSemaphoreTake(iris_idle, portMAX_DELAY);
+    }
+
+    atomic_store(&busy, false);
+}
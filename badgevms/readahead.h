@@ -0,0 +1,42 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Iris reads the tables a program is relocated with on the kernel core, so that
+// decompressing them overlaps with loading its segments and relocating. The
+// parts to read are given up front, in the order the loader reads them, and
+// come in windows that are handed over as the loader gets to them. One program
+// at a time, others read for themselves.
+typedef struct readahead readahead_t;
+
+// Allowed to fail, programs then read everything themselves
+bool readahead_init();
+
+// NULL if Iris is busy with another program or isn't there
+readahead_t *readahead_start(char const *path);
+// Add size bytes at offset to what Iris reads, before the first readahead_read()
+void         readahead_add(readahead_t *ra, uint32_t offset, uint32_t size);
+// Copy what Iris read from the front of the range, waiting for it, and return
+// how many bytes that was. The rest has to be read the usual way, 0 if offset
+// is not the next byte Iris reads. The first call sets Iris going. Accepts NULL.
+size_t       readahead_read(readahead_t *ra, uint32_t offset, void *buf, size_t size);
+// Iris is done with ra, accepts NULL
+void         readahead_stop(readahead_t *ra);
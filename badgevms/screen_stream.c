@@ -0,0 +1,438 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "badgevms/screen_stream.h"
+
+#include "badgevms/compositor.h"
+#include "badgevms_config.h"
+#include "drivers/wifi.h"
+#include "esp_h264_alloc.h"
+#include "esp_h264_enc_single.h"
+#include "esp_h264_enc_single_hw.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "screen_stream_nal.h"
+#include "task.h"
+#include "why_io.h"
+
+#include <stdlib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "screen_stream"
+
+#define STREAM_DEFAULT_FPS     30
+#define STREAM_DEFAULT_BITRATE (1000 * 1000)
+// How often Helios looks whether it should stop while the screen is idle
+#define STREAM_READ_TIMEOUT_MS 100
+// Applications run on the other core
+#define HELIOS_CORE            0
+
+// RTP payloads stay below a 1500 byte Ethernet frame with the IP, UDP and RTP headers
+#define RTP_MTU          1400
+#define RTP_HEADER_SIZE  12
+#define RTP_PAYLOAD_TYPE 96
+#define RTP_CLOCK_KHZ    90
+
+// Notification values Helios tells the caller of screen_stream_start_*() with
+#define STREAM_STARTED 1
+#define STREAM_FAILED  2
+
+typedef struct {
+    screen_stream_config_t config;
+    char                  *path; // NULL for RTP
+    char                  *host;
+    uint16_t               port;
+    TaskHandle_t           starter;
+    TaskHandle_t           stopper; // Waiting in screen_stream_stop(), if anyone
+    atomic_bool            stop;
+    bool                   capturing;
+
+    int                fd;
+    int                sock;
+    struct sockaddr_in addr;
+    uint16_t           rtp_sequence;
+    uint32_t           rtp_timestamp;
+    uint32_t           rtp_ssrc;
+    uint32_t           rtp_dropped;
+    uint8_t            packet[RTP_HEADER_SIZE + RTP_MTU];
+
+    esp_h264_enc_handle_t encoder;
+    size_t                frame_bytes;
+    uint8_t              *in;
+    uint32_t              in_size;
+    uint8_t              *out;
+    uint32_t              out_size;
+} stream_t;
+
+// Only changed with stream_lock held, Helios clears it once everything is freed
+static portMUX_TYPE stream_lock = portMUX_INITIALIZER_UNLOCKED;
+static stream_t    *stream;
+
+static bool rtp_send(void *arg, uint8_t const *head, size_t head_size, uint8_t const *data, size_t size, bool end) {
+    stream_t *s = arg;
+    uint8_t  *p = s->packet;
+    p[0]        = 0x80; // Version 2
+    p[1]        = (end ? 0x80 : 0) | RTP_PAYLOAD_TYPE;
+    p[2]        = s->rtp_sequence >> 8;
+    p[3]        = s->rtp_sequence;
+    memcpy(p + 4, &(uint32_t){lwip_htonl(s->rtp_timestamp)}, 4);
+    memcpy(p + 8, &(uint32_t){lwip_htonl(s->rtp_ssrc)}, 4);
+    if (head_size) {
+        memcpy(p + RTP_HEADER_SIZE, head, head_size);
+    }
+    memcpy(p + RTP_HEADER_SIZE + head_size, data, size);
+    ++s->rtp_sequence;
+
+    size_t len = RTP_HEADER_SIZE + head_size + size;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (lwip_sendto(s->sock, p, len, 0, (struct sockaddr *)&s->addr, sizeof(s->addr)) == (ssize_t)len) {
+            return true;
+        }
+        if (errno != ENOMEM && errno != EAGAIN) {
+            ESP_LOGW(TAG, "Unable to send to %s:%u: %s", s->host, s->port, strerror(errno));
+            return false;
+        }
+        // lwIP is out of buffers, let the wifi driver catch up
+        vTaskDelay(1);
+    }
+
+    // Lost like any other UDP packet, the receiver copes
+    ++s->rtp_dropped;
+    return true;
+}
+
+static bool stream_nal(stream_t *s, uint8_t const *nal, size_t size, bool end) {
+    if (!s->path) {
+        return rtp_packetize_nal(nal, size, RTP_MTU, end, rtp_send, s);
+    }
+
+    static uint8_t const start_code[] = {0, 0, 0, 1};
+    return why_write(s->fd, start_code, sizeof(start_code)) == sizeof(start_code) &&
+           why_write(s->fd, nal, size) == (ssize_t)size;
+}
+
+// Pass the NAL units of an encoded frame on, with the timing right before the
+// first slice. The last packet of the frame gets the RTP marker bit.
+static bool stream_frame(stream_t *s, size_t size, screen_stream_timing_t const *timing) {
+    uint8_t const *nal;
+    size_t         nal_size;
+    size_t         pos  = 0;
+    bool           have = nal_next(s->out, size, &pos, &nal, &nal_size);
+
+    while (have) {
+        uint8_t const *next;
+        size_t         next_size;
+        bool           more = nal_next(s->out, size, &pos, &next, &next_size);
+        int            type = nal[0] & 0x1F;
+
+        if (timing && (type == NAL_SLICE || type == NAL_IDR_SLICE)) {
+            uint8_t sei[SEI_MAX_SIZE];
+            if (!stream_nal(s, sei, sei_build(sei, timing), false)) {
+                return false;
+            }
+            timing = NULL;
+        }
+        if (!stream_nal(s, nal, nal_size, !more)) {
+            return false;
+        }
+
+        have     = more;
+        nal      = next;
+        nal_size = next_size;
+    }
+    return true;
+}
+
+static bool stream_setup(stream_t *s) {
+    window_size_t size = {s->config.size, s->config.size};
+    if (!compositor_capture_start(size, BADGEVMS_PIXELFORMAT_YUV420_ESP)) {
+        ESP_LOGW(TAG, "Unable to start a screen capture, is one running already?");
+        return false;
+    }
+    s->capturing = true;
+
+    compositor_capture_info(&size, NULL, &s->frame_bytes);
+
+    // The encoder reads and writes these with DMA. An encoded frame is never
+    // larger than the raw one.
+    s->in  = esp_h264_aligned_calloc(128, 1, s->frame_bytes, &s->in_size, MALLOC_CAP_SPIRAM);
+    s->out = esp_h264_aligned_calloc(128, 1, s->frame_bytes, &s->out_size, MALLOC_CAP_SPIRAM);
+    if (!s->in || !s->out) {
+        ESP_LOGW(TAG, "Out of memory for %zu byte frames", s->frame_bytes);
+        return false;
+    }
+
+    esp_h264_enc_cfg_hw_t cfg = {
+        .pic_type = ESP_H264_RAW_FMT_O_UYY_E_VYY,
+        .gop      = s->config.gop,
+        .fps      = s->config.fps,
+        .res      = {.width = size.w, .height = size.h},
+        .rc =
+            {
+                .bitrate = s->config.bitrate,
+                .qp_min  = 20,
+                .qp_max  = 45,
+            },
+    };
+    if (esp_h264_enc_hw_new(&cfg, &s->encoder) != ESP_H264_ERR_OK || esp_h264_enc_open(s->encoder) != ESP_H264_ERR_OK) {
+        ESP_LOGW(TAG, "Unable to set up the H.264 encoder for %i x %i", size.w, size.h);
+        return false;
+    }
+
+    if (s->path) {
+        s->fd = why_open(s->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (s->fd < 0) {
+            ESP_LOGW(TAG, "Unable to open %s", s->path);
+            return false;
+        }
+    } else {
+        wifi_start();
+
+        struct addrinfo  hints  = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+        struct addrinfo *result = NULL;
+        if (lwip_getaddrinfo(s->host, NULL, &hints, &result) || !result) {
+            ESP_LOGW(TAG, "Unable to resolve %s", s->host);
+            return false;
+        }
+        memcpy(&s->addr, result->ai_addr, sizeof(s->addr));
+        s->addr.sin_port = lwip_htons(s->port);
+        lwip_freeaddrinfo(result);
+
+        s->sock = lwip_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s->sock < 0) {
+            ESP_LOGW(TAG, "Unable to create a socket");
+            return false;
+        }
+        s->rtp_sequence = esp_random();
+        s->rtp_ssrc     = esp_random();
+    }
+
+    ESP_LOGI(
+        TAG,
+        "Streaming %i x %i at %u fps and %lu bit/s to %s",
+        size.w,
+        size.h,
+        s->config.fps,
+        s->config.bitrate,
+        s->path ? s->path : s->host
+    );
+    return true;
+}
+
+static void stream_run(stream_t *s) {
+    int64_t  interval = 1000000 / s->config.fps;
+    int64_t  due      = 0;
+    int64_t  last     = 0;
+    uint32_t sequence = 0;
+
+    while (!atomic_load(&s->stop)) {
+        ssize_t size = compositor_capture_read(s->in, s->in_size, &sequence, STREAM_READ_TIMEOUT_MS);
+        if (size < 0) {
+            ESP_LOGW(TAG, "The screen capture was stopped");
+            return;
+        }
+
+        // Frames come at the panel refresh rate, skip the ones we have no use
+        // for. A little early is fine, panel refreshes aren't exactly even.
+        int64_t now = esp_timer_get_time();
+        if (!size || now + interval / 4 < due) {
+            continue;
+        }
+        due = now - due < interval ? due + interval : now + interval;
+
+        esp_h264_enc_in_frame_t in = {
+            .raw_data = {.buffer = s->in, .len = s->frame_bytes},
+            .pts      = now * RTP_CLOCK_KHZ / 1000,
+        };
+        esp_h264_enc_out_frame_t out = {
+            .raw_data = {.buffer = s->out, .len = s->out_size},
+        };
+        if (esp_h264_enc_process(s->encoder, &in, &out) != ESP_H264_ERR_OK) {
+            ESP_LOGW(TAG, "Unable to encode frame %lu", sequence);
+            return;
+        }
+
+        screen_stream_timing_t timing = {
+            .captured_us = now,
+            .sequence    = sequence,
+            .interval_us = last ? now - last : 0,
+            .encode_us   = esp_timer_get_time() - now,
+        };
+        last             = now;
+        s->rtp_timestamp = in.pts;
+
+        if (!stream_frame(s, out.length, s->config.timing ? &timing : NULL)) {
+            ESP_LOGW(TAG, "Unable to write the stream, stopping it");
+            return;
+        }
+    }
+}
+
+static void stream_teardown(stream_t *s) {
+    if (s->encoder) {
+        esp_h264_enc_close(s->encoder);
+        esp_h264_enc_del(s->encoder);
+    }
+    if (s->capturing) {
+        compositor_capture_stop();
+    }
+    if (s->fd >= 0) {
+        why_close(s->fd);
+    }
+    if (s->sock >= 0) {
+        lwip_close(s->sock);
+    }
+    if (s->rtp_dropped) {
+        ESP_LOGW(TAG, "%lu RTP packets were dropped for lack of buffers", s->rtp_dropped);
+    }
+    if (s->in) {
+        esp_h264_free(s->in);
+    }
+    if (s->out) {
+        esp_h264_free(s->out);
+    }
+    free(s->path);
+    free(s->host);
+}
+
+// Sets up the stream, tells the caller whether that worked and encodes until
+// it is stopped or can't go on. Cleans up after itself.
+static void helios(void *arg) {
+    stream_t *s  = arg;
+    bool      ok = stream_setup(s);
+
+    xTaskNotify(s->starter, ok ? STREAM_STARTED : STREAM_FAILED, eSetValueWithOverwrite);
+    if (ok) {
+        stream_run(s);
+    }
+    stream_teardown(s);
+
+    taskENTER_CRITICAL(&stream_lock);
+    TaskHandle_t stopper = s->stopper;
+    stream               = NULL;
+    taskEXIT_CRITICAL(&stream_lock);
+
+    free(s);
+    if (stopper) {
+        xTaskNotifyGive(stopper);
+    }
+    vTaskDelete(NULL);
+}
+
+static bool stream_start(stream_t *s, screen_stream_config_t const *config) {
+    if (config) {
+        s->config = *config;
+    }
+    if (!s->config.size) {
+        s->config.size = FRAMEBUFFER_MAX_W;
+    }
+    s->config.fps = s->config.fps ? MIN(s->config.fps, FRAMEBUFFER_MAX_REFRESH) : STREAM_DEFAULT_FPS;
+    if (!s->config.bitrate) {
+        s->config.bitrate = STREAM_DEFAULT_BITRATE;
+    }
+    if (!s->config.gop) {
+        s->config.gop = s->config.fps;
+    }
+    s->fd      = -1;
+    s->sock    = -1;
+    s->starter = xTaskGetCurrentTaskHandle();
+
+    taskENTER_CRITICAL(&stream_lock);
+    bool running = stream != NULL;
+    if (!running) {
+        stream = s;
+    }
+    taskEXIT_CRITICAL(&stream_lock);
+
+    if (running) {
+        free(s->path);
+        free(s->host);
+        free(s);
+        return false;
+    }
+
+    if (create_kernel_task(helios, "Helios", 4096, s, TASK_PRIORITY_LOW, NULL, HELIOS_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create Helios task");
+        taskENTER_CRITICAL(&stream_lock);
+        stream = NULL;
+        taskEXIT_CRITICAL(&stream_lock);
+        free(s->path);
+        free(s->host);
+        free(s);
+        return false;
+    }
+
+    uint32_t result = 0;
+    while (!result) {
+        xTaskNotifyWait(0, UINT32_MAX, &result, portMAX_DELAY);
+    }
+    return result == STREAM_STARTED;
+}
+
+bool screen_stream_start_rtp(char const *host, uint16_t port, screen_stream_config_t const *config) {
+    stream_t *s = host ? calloc(1, sizeof(stream_t)) : NULL;
+    if (!s) {
+        return false;
+    }
+
+    s->host = strdup(host);
+    s->port = port;
+    if (!s->host) {
+        free(s);
+        return false;
+    }
+    return stream_start(s, config);
+}
+
+bool screen_stream_start_file(char const *path, screen_stream_config_t const *config) {
+    stream_t *s = path ? calloc(1, sizeof(stream_t)) : NULL;
+    if (!s) {
+        return false;
+    }
+
+    s->path = strdup(path);
+    if (!s->path) {
+        free(s);
+        return false;
+    }
+    return stream_start(s, config);
+}
+
+void screen_stream_stop(void) {
+    taskENTER_CRITICAL(&stream_lock);
+    stream_t *s = stream;
+    if (s) {
+        s->stopper = xTaskGetCurrentTaskHandle();
+        atomic_store(&s->stop, true);
+    }
+    taskEXIT_CRITICAL(&stream_lock);
+
+    if (s) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
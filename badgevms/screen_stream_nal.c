@@ -0,0 +1,317 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "screen_stream_nal.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+bool nal_next(uint8_t const *data, size_t size, size_t *pos, uint8_t const **nal, size_t *nal_size) {
+    size_t i = *pos;
+    while (i + 3 <= size && !(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) {
+        ++i;
+    }
+    if (i + 3 > size) {
+        return false;
+    }
+
+    size_t start = i + 3;
+    size_t end   = start;
+    while (end + 3 <= size && !(data[end] == 0 && data[end + 1] == 0 && data[end + 2] == 1)) {
+        ++end;
+    }
+    if (end + 3 > size) {
+        end = size;
+    }
+    // Zeros before the next start code aren't part of this one
+    while (end > start && data[end - 1] == 0) {
+        --end;
+    }
+
+    *nal      = data + start;
+    *nal_size = end - start;
+    *pos      = end;
+    return end > start;
+}
+
+// Bytes that would look like a start code get an emulation prevention byte
+size_t sei_build(uint8_t *nal, screen_stream_timing_t const *timing) {
+    uint8_t rbsp[2 + 16 + sizeof(screen_stream_timing_t) + 1];
+    rbsp[0] = SEI_USER_DATA_UNREGISTERED;
+    rbsp[1] = 16 + sizeof(screen_stream_timing_t);
+    memcpy(rbsp + 2, SCREEN_STREAM_TIMING_UUID, 16);
+    memcpy(rbsp + 18, timing, sizeof(screen_stream_timing_t));
+    rbsp[sizeof(rbsp) - 1] = 0x80;
+
+    size_t size  = 0;
+    int    zeros = 0;
+    nal[size++]  = NAL_SEI;
+    for (size_t i = 0; i < sizeof(rbsp); ++i) {
+        if (zeros == 2 && rbsp[i] <= 3) {
+            nal[size++] = 3;
+            zeros       = 0;
+        }
+        nal[size++] = rbsp[i];
+        zeros       = rbsp[i] ? 0 : zeros + 1;
+    }
+    return size;
+}
+
+bool rtp_packetize_nal(uint8_t const *nal, size_t size, size_t mtu, bool end, rtp_packet_t packet, void *arg) {
+    if (size <= mtu) {
+        return packet(arg, NULL, 0, nal, size, end);
+    }
+
+    uint8_t fu[2] = {
+        (nal[0] & 0xE0) | NAL_FU_A,
+        0x80 | (nal[0] & 0x1F), // Start bit
+    };
+    for (size_t offset = 1; offset < size;) {
+        size_t chunk = MIN(size - offset, mtu - sizeof(fu));
+        bool   last  = offset + chunk == size;
+        if (last) {
+            fu[1] |= 0x40; // End bit
+        }
+        if (!packet(arg, fu, sizeof(fu), nal + offset, chunk, end && last)) {
+            return false;
+        }
+        fu[1]  &= ~0x80;
+        offset += chunk;
+    }
+    return true;
+}
+
+#ifdef RUN_TEST
+
+#include "test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_MTU         100
+#define TEST_MAX_PACKETS 64
+
+typedef struct {
+    int     count;
+    int     fail_at; // The packet that fails, -1 for none
+    size_t  size[TEST_MAX_PACKETS];
+    bool    end[TEST_MAX_PACKETS];
+    uint8_t data[TEST_MAX_PACKETS][TEST_MTU];
+} test_packets_t;
+
+static bool test_packet(void *arg, uint8_t const *head, size_t head_size, uint8_t const *data, size_t size, bool end) {
+    test_packets_t *packets = arg;
+    int             i       = packets->count;
+
+    if (i == packets->fail_at || i == TEST_MAX_PACKETS || head_size + size > TEST_MTU) {
+        return false;
+    }
+    if (head_size) {
+        memcpy(packets->data[i], head, head_size);
+    }
+    memcpy(packets->data[i] + head_size, data, size);
+    packets->size[i] = head_size + size;
+    packets->end[i]  = end;
+    packets->count++;
+    return true;
+}
+
+// The NAL units nal_next() finds in data, as "type:size" separated by spaces
+static char const *test_split(uint8_t const *data, size_t size) {
+    static char    out[256];
+    uint8_t const *nal;
+    size_t         nal_size;
+    size_t         pos = 0;
+    int            len = 0;
+
+    out[0] = 0;
+    while (nal_next(data, size, &pos, &nal, &nal_size)) {
+        len += snprintf(out + len, sizeof(out) - len, "%s%d:%zu", len ? " " : "", nal[0] & 0x1F, nal_size);
+    }
+    return out;
+}
+
+static void test_nal_split(void) {
+    printf("=== Splitting NAL units ===\n");
+
+    // 4 and 3 byte start codes, a trailing zero, and 00 00 03 inside a unit
+    uint8_t const stream[] = {
+        0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f,          // SPS
+        0, 0, 1, 0x68, 0xce,                         // PPS
+        0, 0, 0, 1, 0x65, 0x88, 0, 0, 3, 1, 0x40, 0, // IDR slice and a trailing zero
+        0, 0, 1, 0x41, 0x9a,                         // Slice, to the end
+    };
+    CHECK(!strcmp(test_split(stream, sizeof(stream)), "7:4 8:2 5:7 1:2"));
+
+    // What comes before the first start code is skipped
+    uint8_t const garbage[] = {0x12, 0, 0x34, 0, 0, 1, 0x41, 0x9a, 0x01};
+    CHECK(!strcmp(test_split(garbage, sizeof(garbage)), "1:3"));
+
+    uint8_t const none[] = {0x65, 0x88, 0, 0, 2, 0};
+    CHECK(!strcmp(test_split(none, sizeof(none)), ""));
+    CHECK(!strcmp(test_split(none, 0), ""));
+
+    // A start code at the very end has nothing behind it
+    uint8_t const cut[] = {0, 0, 1, 0x41, 0x9a, 0, 0, 1};
+    CHECK(!strcmp(test_split(cut, sizeof(cut)), "1:2"));
+}
+
+// Undo emulation prevention, false if there is a start code or an escape
+// that doesn't belong
+static bool test_unescape(uint8_t const *nal, size_t size, uint8_t *rbsp, size_t *rbsp_size) {
+    int zeros = 0;
+
+    *rbsp_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (zeros == 2 && nal[i] <= 2) {
+            return false;
+        }
+        if (zeros == 2 && nal[i] == 3) {
+            if (i + 1 < size && nal[i + 1] > 3) {
+                return false;
+            }
+            zeros = 0;
+            continue;
+        }
+        rbsp[(*rbsp_size)++] = nal[i];
+        zeros                = nal[i] ? 0 : zeros + 1;
+    }
+    return true;
+}
+
+static void test_sei_timing(screen_stream_timing_t const *timing) {
+    uint8_t sei[SEI_MAX_SIZE];
+    uint8_t rbsp[SEI_MAX_SIZE];
+    size_t  rbsp_size;
+    size_t  size = sei_build(sei, timing);
+
+    CHECK(size <= SEI_MAX_SIZE);
+    CHECK(test_unescape(sei, size, rbsp, &rbsp_size));
+    CHECK(rbsp_size == 1 + 2 + 16 + sizeof(screen_stream_timing_t) + 1);
+    CHECK(rbsp[0] == NAL_SEI);
+    CHECK(rbsp[1] == SEI_USER_DATA_UNREGISTERED && rbsp[2] == 16 + sizeof(screen_stream_timing_t));
+    CHECK(!memcmp(rbsp + 3, SCREEN_STREAM_TIMING_UUID, 16));
+    CHECK(!memcmp(rbsp + 19, timing, sizeof(screen_stream_timing_t)));
+    CHECK(rbsp[rbsp_size - 1] == 0x80);
+
+    // Behind a start code it splits out as it is
+    uint8_t        stream[4 + SEI_MAX_SIZE];
+    uint8_t const *nal;
+    size_t         nal_size;
+    size_t         pos = 0;
+    memcpy(stream, (uint8_t[]){0, 0, 0, 1}, 4);
+    memcpy(stream + 4, sei, size);
+    CHECK(nal_next(stream, 4 + size, &pos, &nal, &nal_size));
+    CHECK(nal_size == size && !memcmp(nal, sei, size));
+    CHECK(!nal_next(stream, 4 + size, &pos, &nal, &nal_size));
+}
+
+static void test_sei(void) {
+    screen_stream_timing_t timing;
+
+    printf("=== SEI emulation prevention ===\n");
+
+    // Nothing to escape
+    timing = (screen_stream_timing_t){
+        .captured_us = 0x1122334455667788,
+        .sequence    = 0x11111111,
+        .interval_us = 0x22222222,
+        .encode_us   = 0x33333333,
+    };
+    test_sei_timing(&timing);
+
+    // Zeros and small bytes everywhere, the most escapes there can be
+    for (int fill = 0; fill <= 4; ++fill) {
+        memset(&timing, fill, sizeof(timing));
+        test_sei_timing(&timing);
+        for (size_t i = 0; i < sizeof(timing); i += 3) {
+            ((uint8_t *)&timing)[i] = 0;
+        }
+        test_sei_timing(&timing);
+    }
+
+    srand(1);
+    for (int round = 0; round < 10000; ++round) {
+        for (size_t i = 0; i < sizeof(timing); ++i) {
+            ((uint8_t *)&timing)[i] = rand() % 3 ? 0 : rand() % 5;
+        }
+        test_sei_timing(&timing);
+    }
+}
+
+// Fragments of nal put back together, as a receiver does
+static bool test_reassemble(test_packets_t const *packets, uint8_t const *nal, size_t size, bool end) {
+    if (packets->count == 1) {
+        return packets->size[0] == size && !memcmp(packets->data[0], nal, size) && packets->end[0] == end;
+    }
+
+    uint8_t out[TEST_MAX_PACKETS * TEST_MTU];
+    size_t  out_size = 1;
+    for (int i = 0; i < packets->count; ++i) {
+        uint8_t const *p     = packets->data[i];
+        bool           first = i == 0;
+        bool           last  = i == packets->count - 1;
+
+        if (packets->size[i] <= 2 || packets->size[i] > TEST_MTU || (p[0] & 0x1F) != NAL_FU_A ||
+            (p[0] & 0xE0) != (nal[0] & 0xE0) || (p[1] & 0x1F) != (nal[0] & 0x1F) || !(p[1] & 0x80) != !first ||
+            !(p[1] & 0x40) != !last || (p[1] & 0x20) || packets->end[i] != (end && last)) {
+            return false;
+        }
+        out[0] = (p[0] & 0xE0) | (p[1] & 0x1F);
+        memcpy(out + out_size, p + 2, packets->size[i] - 2);
+        out_size += packets->size[i] - 2;
+    }
+    return out_size == size && !memcmp(out, nal, size);
+}
+
+static void test_fu_a(void) {
+    static size_t const sizes[] = {1, 2, TEST_MTU - 1, TEST_MTU, TEST_MTU + 1, TEST_MTU + 2, 2 * TEST_MTU, 1000};
+    uint8_t             nal[1000];
+
+    printf("=== RTP FU-A packets ===\n");
+    for (size_t i = 0; i < sizeof(nal); ++i) {
+        nal[i] = i * 13 + 5;
+    }
+    nal[0] = 0x65; // IDR slice, NRI 3
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (int end = 0; end < 2; ++end) {
+            test_packets_t packets = {.fail_at = -1};
+            CHECK(rtp_packetize_nal(nal, sizes[s], TEST_MTU, end, test_packet, &packets));
+            CHECK(test_reassemble(&packets, nal, sizes[s], end));
+            CHECK((packets.count == 1) == (sizes[s] <= TEST_MTU));
+            // Full packets but the last
+            for (int p = 0; p < packets.count - 1; ++p) {
+                CHECK(packets.size[p] == TEST_MTU);
+            }
+        }
+    }
+
+    // A packet that can't be sent stops the rest
+    test_packets_t packets = {.fail_at = 2};
+    CHECK(!rtp_packetize_nal(nal, sizeof(nal), TEST_MTU, true, test_packet, &packets));
+    CHECK(packets.count == 2);
+}
+
+int main(void) {
+    test_nal_split();
+    test_sei();
+    test_fu_a();
+
+    return test_summary();
+}
+#endif
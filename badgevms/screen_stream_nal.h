@@ -0,0 +1,51 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "badgevms/screen_stream.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The H.264 bitstream and RTP parts of screen_stream.c that don't need the
+// encoder or a socket
+
+#define NAL_SLICE     1
+#define NAL_IDR_SLICE 5
+#define NAL_SEI       6
+#define NAL_FU_A      28
+
+#define SEI_USER_DATA_UNREGISTERED 5
+// NAL header, SEI header, UUID, timing and the stop bit, with room for emulation prevention
+#define SEI_MAX_SIZE               (2 * (1 + 2 + 16 + sizeof(screen_stream_timing_t) + 1))
+
+// Sends one RTP payload, head and then data, end for the marker bit
+typedef bool (*rtp_packet_t)(
+    void *arg, uint8_t const *head, size_t head_size, uint8_t const *data, size_t size, bool end
+);
+
+// The next NAL unit of an Annex B stream at or after *pos, without its start code
+bool   nal_next(uint8_t const *data, size_t size, size_t *pos, uint8_t const **nal, size_t *nal_size);
+// A user data unregistered SEI message with the timing into nal, up to
+// SEI_MAX_SIZE bytes. Returns its size.
+size_t sei_build(uint8_t *nal, screen_stream_timing_t const *timing);
+// One payload per NAL unit if it fits in mtu, fragmented into FU-A payloads
+// (RFC 6184) if it doesn't. end marks the last of them. False as soon as
+// packet fails.
+bool   rtp_packetize_nal(uint8_t const *nal, size_t size, size_t mtu, bool end, rtp_packet_t packet, void *arg);
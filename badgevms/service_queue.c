@@ -0,0 +1,79 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "service_queue.h"
+
+#include "freertos/task.h"
+
+#include <string.h>
+
+static UBaseType_t pending_priority(service_queue_t const *sq, int index) {
+    UBaseType_t priority;
+    memcpy(&priority, sq->pending + index * sq->item_size + sq->priority_offset, sizeof(priority));
+    return priority;
+}
+
+bool service_queue_create(service_queue_t *sq) {
+    sq->queue = xQueueCreate(sq->length, sq->item_size);
+    return sq->queue != NULL;
+}
+
+void service_queue_send(service_queue_t *sq, void *item) {
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    memcpy((uint8_t *)item + sq->priority_offset, &priority, sizeof(priority));
+    xQueueSend(sq->queue, item, portMAX_DELAY);
+}
+
+bool service_queue_try_send(service_queue_t *sq, void *item) {
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    memcpy((uint8_t *)item + sq->priority_offset, &priority, sizeof(priority));
+    return xQueueSend(sq->queue, item, 0) == pdTRUE;
+}
+
+bool service_queue_receive(service_queue_t *sq, void *item, TickType_t timeout) {
+    if (!sq->num_pending) {
+        if (xQueueReceive(sq->queue, sq->pending, timeout) != pdTRUE) {
+            return false;
+        }
+        sq->num_pending = 1;
+    }
+
+    while (sq->num_pending < sq->length &&
+           xQueueReceive(sq->queue, sq->pending + sq->num_pending * sq->item_size, 0) == pdTRUE) {
+        ++sq->num_pending;
+    }
+
+    // The first of the highest priority, so callers of one priority are served in order
+    int         best          = 0;
+    UBaseType_t best_priority = pending_priority(sq, 0);
+    for (int i = 1; i < sq->num_pending; ++i) {
+        UBaseType_t priority = pending_priority(sq, i);
+        if (priority > best_priority) {
+            best          = i;
+            best_priority = priority;
+        }
+    }
+
+    uint8_t *slot = sq->pending + best * sq->item_size;
+    memcpy(item, slot, sq->item_size);
+    memmove(slot, slot + sq->item_size, (sq->num_pending - best - 1) * sq->item_size);
+    --sq->num_pending;
+    return true;
+}
+
+bool service_queue_pending(service_queue_t const *sq) {
+    return sq->num_pending || uxQueueMessagesWaiting(sq->queue);
+}
@@ -0,0 +1,60 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernel services such as Zeus and Hermes handle the requests of applications
+// one at a time from a FreeRTOS queue. Whatever is queued when the service is
+// ready for the next request moves to a backlog, and the request of the caller
+// with the highest priority is handled first, in order of arrival among
+// callers of the same priority. A background application then holds up the
+// foreground one for at most the request that is being handled.
+//
+// Messages carry the priority of their caller in a UBaseType_t, which
+// service_queue_send() fills in. Queues are defined statically with
+// SERVICE_QUEUE_INIT(), with a backlog as long as the queue.
+
+typedef struct {
+    QueueHandle_t queue;
+    size_t        item_size;
+    size_t        priority_offset;
+    int           length;
+    int           num_pending;
+    uint8_t      *pending;
+} service_queue_t;
+
+#define SERVICE_QUEUE_INIT(_backlog, _type, _priority_field)                                                           \
+    {                                                                                                                  \
+        .item_size = sizeof(_type), .priority_offset = offsetof(_type, _priority_field),                               \
+        .length = sizeof(_backlog) / sizeof(_type), .pending = (uint8_t *)(_backlog),                                  \
+    }
+
+bool service_queue_create(service_queue_t *sq);
+// Blocks while the queue is full
+void service_queue_send(service_queue_t *sq, void *item);
+// Doesn't block, false if the queue is full
+bool service_queue_try_send(service_queue_t *sq, void *item);
+// The most urgent request, false if none came in within timeout
+bool service_queue_receive(service_queue_t *sq, void *item, TickType_t timeout);
+// Whether requests wait, from another task this is only a hint
+bool service_queue_pending(service_queue_t const *sq);
@@ -0,0 +1,414 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "badgevms/settings.h"
+
+#include "application_private.h"
+#include "badgevms_config.h"
+#include "drivers/fatfs.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "settings_log.h"
+#include "settings_private.h"
+#include "task.h"
+#include "why_io.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#define TAG "settings"
+
+typedef struct settings_store {
+    struct settings_store *next;
+    char                  *unique_identifier;
+    char                  *path;
+    settings_log_t         log;
+    flash_deferred_t       flush; // Of what changed, by Hephaestus
+} settings_store_t;
+
+// The files are written by Hephaestus, see flash_work_run(), or by the callers
+// themselves if it isn't running. Reading and writing them goes through
+// Hephaestus too, so settings_lock is never held while doing that.
+static SemaphoreHandle_t settings_lock;       // The stores and their logs
+static SemaphoreHandle_t settings_write_lock; // The files, one flush at a time
+static settings_store_t *store_list;
+
+static bool store_flush(settings_store_t *store);
+
+static void store_flush_work(void *arg) {
+    store_flush(arg);
+}
+
+static uint8_t *file_read(char const *path, size_t *size) {
+    int fd = why_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    uint8_t    *data = NULL;
+    if (why_fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = malloc(st.st_size);
+        if (data && why_read(fd, data, st.st_size) != st.st_size) {
+            free(data);
+            data = NULL;
+        }
+        *size = st.st_size;
+    }
+    why_close(fd);
+    return data;
+}
+
+static char *tmp_path(char const *path) {
+    char *ret = malloc(strlen(path) + sizeof(".tmp"));
+    if (ret) {
+        strcpy(ret, path);
+        strcat(ret, ".tmp");
+    }
+    return ret;
+}
+
+static void store_free(settings_store_t *store) {
+    if (store) {
+        settings_log_clear(&store->log);
+        free(store->unique_identifier);
+        free(store->path);
+        free(store);
+    }
+}
+
+static settings_store_t *store_load(char const *unique_identifier) {
+    settings_store_t *store = calloc(1, sizeof(settings_store_t));
+    char             *path  = application_settings_path(unique_identifier);
+    if (!store || !path) {
+        why_free(path);
+        free(store);
+        return NULL;
+    }
+
+    store->unique_identifier = strdup(unique_identifier);
+    store->path              = strdup(path);
+    store->flush.work        = store_flush_work;
+    store->flush.arg         = store;
+    why_free(path);
+    if (!store->unique_identifier || !store->path) {
+        store_free(store);
+        return NULL;
+    }
+
+    // A rewrite that didn't get to renaming the new file
+    size_t   size = 0;
+    uint8_t *data = file_read(store->path, &size);
+    if (!data) {
+        char *tmp = tmp_path(store->path);
+        data      = tmp ? file_read(tmp, &size) : NULL;
+        free(tmp);
+    }
+
+    if (data) {
+        if (!settings_log_replay(&store->log, data, size)) {
+            ESP_LOGW(TAG, "%s is damaged, keeping what could be read", store->path);
+        }
+        free(data);
+    }
+    return store;
+}
+
+static settings_store_t *store_find_locked(char const *unique_identifier) {
+    settings_store_t *store = store_list;
+    while (store && strcmp(store->unique_identifier, unique_identifier)) {
+        store = store->next;
+    }
+    return store;
+}
+
+// Whatever changed, as records to append, or all of it for a new file. The
+// lock is only held while they are put together, not while they are written.
+static bool store_flush(settings_store_t *store) {
+    xSemaphoreTake(settings_write_lock, portMAX_DELAY);
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    if (!store->log.dirty) {
+        xSemaphoreGive(settings_lock);
+        xSemaphoreGive(settings_write_lock);
+        return true;
+    }
+
+    size_t   size;
+    bool     rewrite;
+    uint8_t *data = settings_log_take(&store->log, &size, &rewrite);
+    xSemaphoreGive(settings_lock);
+    if (!data) {
+        xSemaphoreGive(settings_write_lock);
+        return false;
+    }
+
+    bool ok;
+    if (rewrite) {
+        // Next to the old file, which is only replaced once the new one is complete
+        char *tmp = tmp_path(store->path);
+        int   fd  = tmp ? why_open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+        ok        = fd >= 0 && why_write(fd, data, size) == (ssize_t)size;
+        ok        = fd >= 0 && why_close(fd) == 0 && ok;
+        if (ok) {
+            why_unlink(store->path);
+            ok = why_rename(tmp, store->path) == 0;
+        }
+        free(tmp);
+    } else {
+        int fd = why_open(store->path, O_WRONLY | O_APPEND, 0);
+        ok     = fd >= 0 && why_write(fd, data, size) == (ssize_t)size;
+        ok     = fd >= 0 && why_close(fd) == 0 && ok;
+    }
+    free(data);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Unable to write %s", store->path);
+    }
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    settings_log_written(&store->log, size, rewrite, ok);
+    xSemaphoreGive(settings_lock);
+    xSemaphoreGive(settings_write_lock);
+    return ok;
+}
+
+// A while after the first change, so that a burst of them ends up in a single write
+static void store_schedule(settings_store_t *store) {
+    if (!flash_work_defer(&store->flush, SETTINGS_FLUSH_MS)) {
+        // Nobody to do it later
+        store_flush(store);
+    }
+}
+
+// The store of the application of the caller, loaded on first use
+static settings_store_t *store_current(void) {
+    if (!settings_lock) {
+        return NULL;
+    }
+
+    task_thread_t    *thread = get_task_info()->thread;
+    settings_store_t *store  = thread ? atomic_load(&thread->settings) : NULL;
+    if (store || !thread) {
+        return store;
+    }
+
+    char *unique_identifier = task_application_uid();
+    if (!unique_identifier) {
+        ESP_LOGW(TAG, "Only applications have settings");
+        return NULL;
+    }
+
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    store = store_find_locked(unique_identifier);
+    xSemaphoreGive(settings_lock);
+
+    if (!store) {
+        settings_store_t *loaded = store_load(unique_identifier);
+
+        // Another process of the application may have been quicker
+        bool damaged = false;
+        xSemaphoreTake(settings_lock, portMAX_DELAY);
+        store = store_find_locked(unique_identifier);
+        if (!store && loaded) {
+            loaded->next = store_list;
+            store_list   = loaded;
+            store        = loaded;
+            loaded       = NULL;
+            damaged      = store->log.dirty;
+        }
+        xSemaphoreGive(settings_lock);
+
+        store_free(loaded);
+        if (damaged) {
+            store_schedule(store);
+        }
+    }
+
+    free(unique_identifier);
+    atomic_store(&thread->settings, store);
+    return store;
+}
+
+bool settings_set(char const *key, void const *value, size_t size) {
+    if (!key || !key[0] || strlen(key) >= SETTINGS_KEY_MAX || size > SETTINGS_VALUE_MAX || (size && !value)) {
+        return false;
+    }
+
+    settings_store_t *store = store_current();
+    if (!store) {
+        return false;
+    }
+
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    bool ok = settings_log_set(&store->log, key, value, size);
+    xSemaphoreGive(settings_lock);
+
+    if (ok) {
+        store_schedule(store);
+    }
+    return ok;
+}
+
+ssize_t settings_get(char const *key, void *value, size_t size) {
+    settings_store_t *store = key ? store_current() : NULL;
+    if (!store) {
+        return -1;
+    }
+
+    ssize_t ret = -1;
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    settings_entry_t const *entry = settings_log_get(&store->log, key);
+    if (entry) {
+        if (value) {
+            memcpy(value, entry->value, MIN(size, entry->size));
+        }
+        ret = entry->size;
+    }
+    xSemaphoreGive(settings_lock);
+    return ret;
+}
+
+bool settings_remove(char const *key) {
+    settings_store_t *store = key ? store_current() : NULL;
+    if (!store) {
+        return false;
+    }
+
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    bool ok = settings_log_remove(&store->log, key);
+    xSemaphoreGive(settings_lock);
+
+    if (ok) {
+        store_schedule(store);
+    }
+    return ok;
+}
+
+bool settings_set_int(char const *key, int64_t value) {
+    return settings_set(key, &value, sizeof(value));
+}
+
+int64_t settings_get_int(char const *key, int64_t fallback) {
+    int64_t value;
+    return settings_get(key, &value, sizeof(value)) == sizeof(value) ? value : fallback;
+}
+
+bool settings_set_string(char const *key, char const *value) {
+    return value && settings_set(key, value, strlen(value));
+}
+
+bool settings_get_string(char const *key, char *value, size_t size) {
+    if (!size) {
+        return false;
+    }
+
+    ssize_t len = settings_get(key, value, size - 1);
+    if (len < 0) {
+        value[0] = 0;
+        return false;
+    }
+    value[MIN((size_t)len, size - 1)] = 0;
+    return true;
+}
+
+typedef struct {
+    settings_store_t *store;
+    bool              ok;
+} settings_flush_t;
+
+static void settings_flush_work(void *arg) {
+    settings_flush_t *flush = arg;
+    flush->ok               = store_flush(flush->store);
+}
+
+bool settings_flush(void) {
+    settings_store_t *store = store_current();
+    settings_flush_t *flush = store ? malloc(sizeof(settings_flush_t)) : NULL;
+    if (!flush) {
+        return false;
+    }
+
+    // Hephaestus can't reach the stack of the caller
+    flush->store = store;
+    if (!flash_work_run(settings_flush_work, flush)) {
+        settings_flush_work(flush);
+    }
+
+    bool ok = flush->ok;
+    free(flush);
+    return ok;
+}
+
+static void settings_files_remove(void *arg) {
+    char const *unique_identifier = arg;
+
+    xSemaphoreTake(settings_write_lock, portMAX_DELAY);
+    char *path = application_settings_path(unique_identifier);
+    char *tmp  = path ? tmp_path(path) : NULL;
+    if (path) {
+        why_unlink(path);
+    }
+    if (tmp) {
+        why_unlink(tmp);
+    }
+    free(tmp);
+    why_free(path);
+    xSemaphoreGive(settings_write_lock);
+}
+
+void settings_forget(char const *unique_identifier) {
+    if (!settings_lock) {
+        return;
+    }
+
+    // Running processes may still hold on to the store, it stays empty
+    xSemaphoreTake(settings_lock, portMAX_DELAY);
+    settings_store_t *store = store_find_locked(unique_identifier);
+    if (store) {
+        settings_log_clear(&store->log);
+    }
+    xSemaphoreGive(settings_lock);
+
+    char *copy = strdup(unique_identifier);
+    if (copy && !flash_work_run(settings_files_remove, copy)) {
+        settings_files_remove(copy);
+    }
+    free(copy);
+}
+
+bool settings_init(void) {
+    settings_lock       = xSemaphoreCreateMutex();
+    settings_write_lock = xSemaphoreCreateMutex();
+    if (!settings_lock || !settings_write_lock) {
+        ESP_LOGE(TAG, "Unable to create the locks");
+        if (settings_lock) {
+            vSemaphoreDelete(settings_lock);
+        }
+        if (settings_write_lock) {
+            vSemaphoreDelete(settings_write_lock);
+        }
+        settings_lock       = NULL;
+        settings_write_lock = NULL;
+        return false;
+    }
+    return true;
+}
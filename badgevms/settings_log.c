@@ -0,0 +1,436 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "settings_log.h"
+
+#include "badgevms_config.h"
+#include "esp_rom_crc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SETTINGS_MAGIC 0x31564b53 // "SKV1"
+
+// The file is SETTINGS_MAGIC and then these, each followed by the key and the
+// value. A record cut short or damaged ends the log.
+typedef struct {
+    uint32_t crc; // Of the rest of the record, the key and the value
+    uint8_t  key_len;
+    uint8_t  flags;
+    uint16_t size;
+} __attribute__((packed)) settings_record_t;
+
+#define RECORD_REMOVED (1 << 0)
+
+static size_t record_bytes(size_t key_len, size_t size) {
+    return sizeof(settings_record_t) + key_len + size;
+}
+
+static size_t entry_bytes(settings_entry_t const *entry) {
+    return record_bytes(strlen(entry->key), entry->removed ? 0 : entry->size);
+}
+
+static uint32_t record_crc(settings_record_t const *record, void const *key, void const *value) {
+    uint8_t const *fields = (uint8_t const *)record + sizeof(record->crc);
+    uint32_t       crc    = esp_rom_crc32_le(0, fields, sizeof(*record) - sizeof(record->crc));
+    crc                   = esp_rom_crc32_le(crc, key, record->key_len);
+    return esp_rom_crc32_le(crc, value, record->size);
+}
+
+static settings_entry_t **entry_find(settings_log_t *log, char const *key) {
+    settings_entry_t **link = &log->entries;
+    while (*link && strcmp((*link)->key, key)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static void entry_count(settings_log_t *log, settings_entry_t const *entry, bool add) {
+    size_t *counter = entry->removed ? &log->removed_bytes : &log->live_bytes;
+    if (add) {
+        *counter += entry_bytes(entry);
+    } else {
+        *counter -= entry_bytes(entry);
+    }
+}
+
+// Set or remove key, removed entries stay until they are written
+static bool entry_put(settings_log_t *log, char const *key, void const *value, size_t size, bool removed, bool dirty) {
+    settings_entry_t **link  = entry_find(log, key);
+    settings_entry_t  *entry = *link;
+
+    if (!dirty && removed) {
+        // Replayed from the file, there is nothing to write
+        if (entry) {
+            entry_count(log, entry, false);
+            *link = entry->next;
+            free(entry);
+        }
+        return true;
+    }
+
+    size_t old_bytes = entry ? entry_bytes(entry) : 0;
+    size_t new_bytes = record_bytes(strlen(key), removed ? 0 : size);
+    if (log->live_bytes + log->removed_bytes - old_bytes + new_bytes > SETTINGS_STORE_MAX) {
+        return false;
+    }
+
+    if (!entry || entry->size != size) {
+        settings_entry_t *replacement = malloc(sizeof(settings_entry_t) + size);
+        if (!replacement) {
+            return false;
+        }
+        strcpy(replacement->key, key);
+        replacement->next = entry ? entry->next : NULL;
+        *link             = replacement;
+        if (entry) {
+            entry_count(log, entry, false);
+            free(entry);
+        }
+        entry = replacement;
+    } else {
+        entry_count(log, entry, false);
+    }
+
+    entry->size    = size;
+    entry->removed = removed;
+    entry->dirty   = dirty;
+    if (!removed && size) {
+        memcpy(entry->value, value, size);
+    }
+    entry_count(log, entry, true);
+    return true;
+}
+
+bool settings_log_set(settings_log_t *log, char const *key, void const *value, size_t size) {
+    bool ok    = entry_put(log, key, value, size, false, true);
+    log->dirty = log->dirty || ok;
+    return ok;
+}
+
+bool settings_log_remove(settings_log_t *log, char const *key) {
+    settings_entry_t *entry = *entry_find(log, key);
+    if (!entry || entry->removed) {
+        return false;
+    }
+
+    // The record of a removal is never larger than that of the value
+    entry_count(log, entry, false);
+    entry->removed = true;
+    entry->dirty   = true;
+    entry_count(log, entry, true);
+    log->dirty = true;
+    return true;
+}
+
+settings_entry_t const *settings_log_get(settings_log_t *log, char const *key) {
+    settings_entry_t *entry = *entry_find(log, key);
+    return entry && !entry->removed ? entry : NULL;
+}
+
+bool settings_log_replay(settings_log_t *log, uint8_t const *data, size_t size) {
+    uint32_t magic  = 0;
+    size_t   offset = sizeof(magic);
+
+    if (size >= sizeof(magic)) {
+        memcpy(&magic, data, sizeof(magic));
+    }
+
+    while (magic == SETTINGS_MAGIC && offset + sizeof(settings_record_t) <= size) {
+        settings_record_t record;
+        memcpy(&record, data + offset, sizeof(record));
+
+        char const    *key   = (char const *)data + offset + sizeof(record);
+        uint8_t const *value = (uint8_t const *)key + record.key_len;
+        size_t         bytes = record_bytes(record.key_len, record.size);
+        if (!record.key_len || record.key_len >= SETTINGS_KEY_MAX || record.size > SETTINGS_VALUE_MAX ||
+            offset + bytes > size || record_crc(&record, key, value) != record.crc) {
+            break;
+        }
+
+        char name[SETTINGS_KEY_MAX];
+        memcpy(name, key, record.key_len);
+        name[record.key_len] = 0;
+        if (!entry_put(log, name, value, record.size, record.flags & RECORD_REMOVED, false)) {
+            break;
+        }
+        offset += bytes;
+    }
+
+    if (magic != SETTINGS_MAGIC || offset != size) {
+        log->file_bytes = 0;
+        log->dirty      = true;
+        return false;
+    }
+    log->file_bytes = size;
+    return true;
+}
+
+uint8_t *settings_log_take(settings_log_t *log, size_t *size, bool *rewrite) {
+    *rewrite = !log->file_bytes || log->file_bytes > 2 * log->live_bytes + SETTINGS_COMPACT_MIN;
+    *size    = *rewrite ? sizeof(uint32_t) + log->live_bytes : 0;
+    if (!*rewrite) {
+        for (settings_entry_t *entry = log->entries; entry; entry = entry->next) {
+            *size += entry->dirty ? entry_bytes(entry) : 0;
+        }
+    }
+
+    uint8_t *data = malloc(*size ? *size : 1);
+    if (!data) {
+        return NULL;
+    }
+
+    uint8_t *next = data;
+    if (*rewrite) {
+        uint32_t magic = SETTINGS_MAGIC;
+        memcpy(next, &magic, sizeof(magic));
+        next += sizeof(magic);
+    }
+
+    settings_entry_t **link = &log->entries;
+    while (*link) {
+        settings_entry_t *entry = *link;
+        if (*rewrite ? !entry->removed : entry->dirty) {
+            settings_record_t record = {
+                .key_len = strlen(entry->key),
+                .flags   = entry->removed ? RECORD_REMOVED : 0,
+                .size    = entry->removed ? 0 : entry->size,
+            };
+            record.crc = record_crc(&record, entry->key, entry->value);
+            memcpy(next, &record, sizeof(record));
+            memcpy(next + sizeof(record), entry->key, record.key_len);
+            memcpy(next + sizeof(record) + record.key_len, entry->value, record.size);
+            next += record_bytes(record.key_len, record.size);
+        }
+
+        entry->dirty = false;
+        if (entry->removed) {
+            *link = entry->next;
+            free(entry);
+        } else {
+            link = &entry->next;
+        }
+    }
+    log->removed_bytes = 0;
+    log->dirty         = false;
+    return data;
+}
+
+void settings_log_written(settings_log_t *log, size_t size, bool rewrite, bool ok) {
+    if (ok) {
+        log->file_bytes = rewrite ? size : log->file_bytes + size;
+    } else {
+        // Removed entries are gone already, only a new file leaves them out
+        log->file_bytes = 0;
+        log->dirty      = true;
+    }
+}
+
+void settings_log_clear(settings_log_t *log) {
+    while (log->entries) {
+        settings_entry_t *entry = log->entries;
+        log->entries            = entry->next;
+        free(entry);
+    }
+    log->live_bytes    = 0;
+    log->removed_bytes = 0;
+    log->file_bytes    = 0;
+    log->dirty         = false;
+}
+
+#ifdef RUN_TEST
+
+#include "test_check.h"
+
+#include <stdio.h>
+
+// What the file would hold after writing everything that changed
+typedef struct {
+    uint8_t data[4 * SETTINGS_STORE_MAX];
+    size_t  size;
+    int     rewrites;
+} test_file_t;
+
+static void test_flush(settings_log_t *log, test_file_t *file) {
+    size_t   size;
+    bool     rewrite;
+    uint8_t *data = settings_log_take(log, &size, &rewrite);
+
+    CHECK(data);
+    if (rewrite) {
+        file->size = 0;
+        file->rewrites++;
+    }
+    CHECK(file->size + size <= sizeof(file->data));
+    memcpy(file->data + file->size, data, size);
+    file->size += size;
+    settings_log_written(log, size, rewrite, true);
+    free(data);
+}
+
+// The value of key in log, "" if it isn't set
+static char const *test_get(settings_log_t *log, char const *key) {
+    static char             value[SETTINGS_VALUE_MAX + 1];
+    settings_entry_t const *entry = settings_log_get(log, key);
+    if (!entry) {
+        return "";
+    }
+    memcpy(value, entry->value, entry->size);
+    value[entry->size] = 0;
+    return value;
+}
+
+static void test_set(settings_log_t *log, char const *key, char const *value) {
+    CHECK(settings_log_set(log, key, value, strlen(value)));
+}
+
+// Replaying the file gives the same as what is in log
+static void test_same(settings_log_t *log, test_file_t const *file) {
+    settings_log_t replayed = {0};
+    CHECK(settings_log_replay(&replayed, file->data, file->size));
+    CHECK(!replayed.dirty);
+    CHECK(replayed.file_bytes == file->size);
+    CHECK(replayed.live_bytes == log->live_bytes);
+
+    int count = 0;
+    for (settings_entry_t *entry = log->entries; entry; entry = entry->next) {
+        settings_entry_t const *other = settings_log_get(&replayed, entry->key);
+        CHECK(other && other->size == entry->size && !memcmp(other->value, entry->value, entry->size));
+        ++count;
+    }
+    for (settings_entry_t *entry = replayed.entries; entry; entry = entry->next) {
+        --count;
+    }
+    CHECK(count == 0);
+    settings_log_clear(&replayed);
+}
+
+int main() {
+    static test_file_t file;
+    settings_log_t     log = {0};
+
+    printf("=== Writing and appending ===\n");
+    test_set(&log, "name", "badge");
+    test_set(&log, "volume", "7");
+    test_set(&log, "theme", "dark");
+    test_flush(&log, &file);
+    CHECK(file.rewrites == 1);
+    test_same(&log, &file);
+
+    size_t first = file.size;
+    test_set(&log, "volume", "11");
+    CHECK(settings_log_remove(&log, "theme"));
+    CHECK(!settings_log_remove(&log, "theme"));
+    CHECK(!settings_log_get(&log, "theme"));
+    test_flush(&log, &file);
+    CHECK(file.rewrites == 1);
+    CHECK(file.size > first);
+    test_same(&log, &file);
+    CHECK(!strcmp(test_get(&log, "volume"), "11"));
+
+    printf("=== Replaying cut short ===\n");
+    // Only the lengths that end at a record replay completely
+    bool complete[sizeof(file.data)] = {0};
+    for (size_t offset = 4; offset <= file.size;) {
+        settings_record_t record;
+        complete[offset] = true;
+        memcpy(&record, file.data + offset, sizeof(record));
+        offset += record_bytes(record.key_len, record.size);
+    }
+    for (size_t cut = 0; cut <= file.size; ++cut) {
+        settings_log_t cut_log = {0};
+        bool           ok      = settings_log_replay(&cut_log, file.data, cut);
+        CHECK(ok == complete[cut]);
+        CHECK(ok || (cut_log.dirty && !cut_log.file_bytes));
+        if (cut >= first) {
+            // Everything written by the first flush is there
+            CHECK(!strcmp(test_get(&cut_log, "name"), "badge"));
+        }
+        settings_log_clear(&cut_log);
+    }
+
+    printf("=== Replaying damaged ===\n");
+    for (size_t at = 4; at < file.size; ++at) {
+        static test_file_t damaged;
+        damaged = file;
+        damaged.data[at] ^= 0x20;
+
+        settings_log_t damaged_log = {0};
+        CHECK(!settings_log_replay(&damaged_log, damaged.data, damaged.size));
+        CHECK(damaged_log.dirty && !damaged_log.file_bytes);
+        // Nothing after the damage is applied, so the value is old or right
+        char const *volume = test_get(&damaged_log, "volume");
+        CHECK(!strcmp(volume, "") || !strcmp(volume, "7") || (at >= first && !strcmp(volume, "11")));
+        CHECK(at >= first || !strcmp(test_get(&damaged_log, "theme"), ""));
+
+        // Writing it anew gives a file that replays completely
+        static test_file_t rewritten;
+        rewritten.size = 0;
+        test_flush(&damaged_log, &rewritten);
+        test_same(&damaged_log, &rewritten);
+        settings_log_clear(&damaged_log);
+    }
+
+    settings_log_t empty = {0};
+    CHECK(!settings_log_replay(&empty, (uint8_t const *)"SKV0", 4));
+    CHECK(!settings_log_replay(&empty, (uint8_t const *)"", 0));
+    CHECK(!empty.entries);
+
+    printf("=== Compacting ===\n");
+    char value[SETTINGS_VALUE_MAX];
+    for (int i = 0; file.rewrites < 2; ++i) {
+        memset(value, 'a' + i % 26, sizeof(value));
+        CHECK(settings_log_set(&log, "big", value, sizeof(value)));
+        test_flush(&log, &file);
+        test_same(&log, &file);
+        CHECK(file.size <= 2 * log.live_bytes + SETTINGS_COMPACT_MIN + 2 * sizeof(value));
+    }
+    CHECK(file.size == 4 + log.live_bytes);
+    CHECK(!strcmp(test_get(&log, "volume"), "11"));
+
+    // Appending after compacting still replays to the same
+    CHECK(settings_log_remove(&log, "big"));
+    test_set(&log, "after", "compacting");
+    test_flush(&log, &file);
+    test_same(&log, &file);
+
+    printf("=== Limits ===\n");
+    char key[SETTINGS_KEY_MAX];
+    int  count = 0;
+    while (1) {
+        snprintf(key, sizeof(key), "key%d", count);
+        if (!settings_log_set(&log, key, value, sizeof(value))) {
+            break;
+        }
+        ++count;
+    }
+    CHECK(count > 0 && count < SETTINGS_STORE_MAX / SETTINGS_VALUE_MAX);
+    CHECK(log.live_bytes + log.removed_bytes <= SETTINGS_STORE_MAX);
+    // Removing still works, and makes room again
+    CHECK(settings_log_remove(&log, "key0"));
+    CHECK(settings_log_set(&log, "key0", "small", 5));
+    // Replacing a value with a smaller one always fits
+    CHECK(settings_log_set(&log, "key1", "small", 5));
+    test_flush(&log, &file);
+    test_same(&log, &file);
+
+    settings_log_clear(&log);
+    CHECK(!log.entries && !log.live_bytes && !log.dirty);
+
+    return test_summary();
+}
+#endif
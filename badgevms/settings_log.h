@@ -0,0 +1,65 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "badgevms/settings.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The settings of one application in memory and the log file they are kept
+// in, see settings.c for the locks and the files. Replaying the records of the
+// file in order gives what is set. Changes are appended to it, until it is
+// worth writing only what is still set.
+
+typedef struct settings_entry {
+    struct settings_entry *next;
+    bool                   dirty;   // Not in the file yet
+    bool                   removed; // Written as removed at the next flush, and then freed
+    uint16_t               size;
+    char                   key[SETTINGS_KEY_MAX];
+    uint8_t                value[];
+} settings_entry_t;
+
+typedef struct {
+    settings_entry_t *entries;
+    size_t            live_bytes;    // Of the records of what is set
+    size_t            removed_bytes; // Of the records of removed entries that aren't written yet
+    size_t            file_bytes;    // 0 to write the whole file again
+    bool              dirty;
+} settings_log_t;
+
+// False if out of memory, or if the log would hold more than SETTINGS_STORE_MAX
+bool                    settings_log_set(settings_log_t *log, char const *key, void const *value, size_t size);
+// False if key wasn't set
+bool                    settings_log_remove(settings_log_t *log, char const *key);
+// NULL if key isn't set
+settings_entry_t const *settings_log_get(settings_log_t *log, char const *key);
+
+// Apply the records of a file, false if they don't go up to its end. What
+// could be read is kept, the log is then dirty to write it anew.
+bool     settings_log_replay(settings_log_t *log, uint8_t const *data, size_t size);
+// What a flush of a dirty log writes, the records of what changed to append to
+// the file or the whole file if rewrite is set. Removed entries are freed.
+// NULL if out of memory.
+uint8_t *settings_log_take(settings_log_t *log, size_t *size, bool *rewrite);
+// After writing what settings_log_take() returned
+void     settings_log_written(settings_log_t *log, size_t size, bool rewrite, bool ok);
+// Forget everything, for when the file goes too
+void     settings_log_clear(settings_log_t *log);
@@ -0,0 +1,218 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "slab.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#define TAG "slab"
+
+// Every object is preceded by a pointer to its slab, padded so the object
+// stays 8 byte aligned. Free objects link to each other through their first word.
+#define SLAB_ALIGN         8
+#define SLAB_ROUND(x)      (((x) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+#define SLAB_OBJECT_HEADER SLAB_ALIGN
+
+struct slab {
+    slab_t *next;
+    slab_t *prev;
+    size_t  free_count;
+    void   *free_list;
+};
+
+static portMUX_TYPE  registry_lock = portMUX_INITIALIZER_UNLOCKED;
+static slab_cache_t *caches;
+
+__attribute__((always_inline)) static inline size_t slot_size(slab_cache_t *cache) {
+    return SLAB_OBJECT_HEADER + SLAB_ROUND(MAX(cache->object_size, sizeof(void *)));
+}
+
+__attribute__((always_inline)) static inline slab_t *object_to_slab(void *ptr) {
+    return *(slab_t **)((uint8_t *)ptr - SLAB_OBJECT_HEADER);
+}
+
+__attribute__((always_inline)) static inline void slab_link(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+__attribute__((always_inline)) static inline void slab_unlink(slab_t **list, slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static slab_t *slab_create(slab_cache_t *cache) {
+    size_t  slot = slot_size(cache);
+    slab_t *slab = heap_caps_malloc(SLAB_ROUND(sizeof(slab_t)) + slot * cache->objects_per_slab, cache->caps);
+    if (!slab) {
+        return NULL;
+    }
+
+    uint8_t *objects = (uint8_t *)slab + SLAB_ROUND(sizeof(slab_t));
+    slab->free_count = cache->objects_per_slab;
+    slab->free_list  = NULL;
+    for (size_t i = cache->objects_per_slab; i-- > 0;) {
+        uint8_t *object = objects + i * slot + SLAB_OBJECT_HEADER;
+        slab_t **owner  = (slab_t **)(object - SLAB_OBJECT_HEADER);
+
+        *owner           = slab;
+        *(void **)object = slab->free_list;
+        slab->free_list  = object;
+    }
+
+    return slab;
+}
+
+// With the cache locked
+static void *slab_take(slab_cache_t *cache) {
+    slab_t *slab = cache->partial;
+    if (!slab) {
+        return NULL;
+    }
+
+    void *object    = slab->free_list;
+    slab->free_list = *(void **)object;
+    if (!--slab->free_count) {
+        slab_unlink(&cache->partial, slab);
+        slab_link(&cache->full, slab);
+    }
+
+    --cache->free_objects;
+    ++cache->in_use;
+    ++cache->allocations;
+    cache->peak = MAX(cache->peak, cache->in_use);
+    return object;
+}
+
+void *slab_alloc(slab_cache_t *cache) {
+    portENTER_CRITICAL(&cache->lock);
+    void *object = slab_take(cache);
+    portEXIT_CRITICAL(&cache->lock);
+
+    if (!object) {
+        // Never allocate with the cache locked
+        slab_t *slab = slab_create(cache);
+        if (!slab) {
+            ESP_LOGE(TAG, "Out of memory for a %s slab", cache->name);
+            return NULL;
+        }
+
+        portENTER_CRITICAL(&cache->lock);
+        slab_link(&cache->partial, slab);
+        ++cache->slabs;
+        cache->free_objects += cache->objects_per_slab;
+        object               = slab_take(cache);
+        portEXIT_CRITICAL(&cache->lock);
+
+        portENTER_CRITICAL(&registry_lock);
+        if (!cache->registered) {
+            cache->registered = true;
+            cache->next       = caches;
+            caches            = cache;
+        }
+        portEXIT_CRITICAL(&registry_lock);
+    }
+
+    memset(object, 0, cache->object_size);
+    return object;
+}
+
+// A slab that becomes empty is given back unless it is the only free space
+// left, so a cache that goes up and down by one object doesn't churn the heap
+void slab_free(slab_cache_t *cache, void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    slab_t *slab    = object_to_slab(ptr);
+    slab_t *release = NULL;
+
+    portENTER_CRITICAL(&cache->lock);
+    *(void **)ptr   = slab->free_list;
+    slab->free_list = ptr;
+    if (!slab->free_count++) {
+        slab_unlink(&cache->full, slab);
+        slab_link(&cache->partial, slab);
+    }
+
+    ++cache->free_objects;
+    --cache->in_use;
+
+    if (slab->free_count == cache->objects_per_slab && cache->free_objects > cache->objects_per_slab) {
+        slab_unlink(&cache->partial, slab);
+        --cache->slabs;
+        cache->free_objects -= cache->objects_per_slab;
+        release              = slab;
+    }
+    portEXIT_CRITICAL(&cache->lock);
+
+    heap_caps_free(release);
+}
+
+size_t slab_stats_get(slab_stats_t *stats, size_t max) {
+    size_t num = 0;
+
+    portENTER_CRITICAL(&registry_lock);
+    for (slab_cache_t *cache = caches; cache; cache = cache->next, ++num) {
+        if (num < max) {
+            stats[num] = (slab_stats_t){
+                .name        = cache->name,
+                .object_size = cache->object_size,
+                .slabs       = cache->slabs,
+                .in_use      = cache->in_use,
+                .peak        = cache->peak,
+                .allocations = cache->allocations,
+            };
+        }
+    }
+    portEXIT_CRITICAL(&registry_lock);
+
+    return num;
+}
+
+void slab_dump() {
+    slab_stats_t stats[16];
+    size_t       num = MIN(slab_stats_get(stats, 16), 16);
+
+    esp_rom_printf("\n*********** SLAB CACHES ***********\n");
+    for (size_t i = 0; i < num; ++i) {
+        esp_rom_printf(
+            "%-20s size %5u slabs %3u in use %4u peak %4u allocations %lu\n",
+            stats[i].name,
+            stats[i].object_size,
+            stats[i].slabs,
+            stats[i].in_use,
+            stats[i].peak,
+            stats[i].allocations
+        );
+    }
+    esp_rom_printf("*********** SLAB CACHES END ***********\n");
+}
@@ -0,0 +1,71 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Typed caches for kernel bookkeeping objects. Objects of one type are carved
+// from slabs of objects_per_slab objects, allocated with caps, so they don't
+// fragment the general heap and taking one rarely needs the heap at all.
+// Caches are defined statically with SLAB_CACHE_INIT().
+
+typedef struct slab slab_t;
+
+typedef struct slab_cache {
+    char const        *name;
+    size_t             object_size;
+    size_t             objects_per_slab;
+    uint32_t           caps;
+    portMUX_TYPE       lock;
+    slab_t            *partial; // Slabs with free objects
+    slab_t            *full;
+    size_t             slabs;
+    size_t             free_objects;
+    size_t             in_use;
+    size_t             peak;
+    size_t             allocations;
+    bool               registered;
+    struct slab_cache *next; // All caches that have had a slab
+} slab_cache_t;
+
+#define SLAB_CACHE_INIT(_name, _object_size, _objects_per_slab, _caps)                                                 \
+    {                                                                                                                  \
+        .name = (_name), .object_size = (_object_size), .objects_per_slab = (_objects_per_slab), .caps = (_caps),      \
+        .lock = portMUX_INITIALIZER_UNLOCKED,                                                                          \
+    }
+
+typedef struct {
+    char const *name;
+    size_t      object_size;
+    size_t      slabs;
+    size_t      in_use;
+    size_t      peak;
+    size_t      allocations;
+} slab_stats_t;
+
+// Objects are zeroed, like calloc()
+void *slab_alloc(slab_cache_t *cache);
+void  slab_free(slab_cache_t *cache, void *ptr);
+
+// Fills up to max entries and returns the number of caches in use
+size_t slab_stats_get(slab_stats_t *stats, size_t max);
+void   slab_dump();
@@ -0,0 +1,74 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "syscall_stats.h"
+
+#include "bitops.h"
+#include "esp_attr.h"
+#include "task.h"
+
+#include <stdlib.h>
+
+#include <sys/param.h>
+
+atomic_bool syscall_stats_enabled;
+
+void process_syscall_stats_enable(bool enable) {
+    atomic_store(&syscall_stats_enabled, enable);
+}
+
+// Allocated on the first timed call, so processes that never make one while
+// the stats are on don't pay for them
+static syscall_histogram_t *histograms_get(task_thread_t *thread) {
+    syscall_histogram_t *histograms = atomic_load(&thread->syscall_histograms);
+    if (histograms) {
+        return histograms;
+    }
+
+    syscall_histogram_t *fresh = calloc(SYSCALL_MAX, sizeof(syscall_histogram_t));
+    if (!fresh) {
+        return NULL;
+    }
+
+    // Another thread of the process may have beaten us to it
+    if (!atomic_compare_exchange_strong(&thread->syscall_histograms, &histograms, fresh)) {
+        free(fresh);
+        return histograms;
+    }
+    return fresh;
+}
+
+void IRAM_ATTR syscall_stats_record(syscall_t syscall, int64_t start_us) {
+    uint32_t     us        = esp_timer_get_time() - start_us;
+    task_info_t *task_info = get_task_info();
+    if (task_info == &kernel_task) {
+        return;
+    }
+
+    syscall_histogram_t *histograms = histograms_get(task_info->thread);
+    if (!histograms) {
+        return;
+    }
+
+    // Shared by the threads of the process. Without atomics a count can get
+    // lost now and then, which a histogram doesn't mind.
+    syscall_histogram_t *histogram = &histograms[syscall];
+    int                  bucket    = MIN(32 - clz32(us), SYSCALL_HISTOGRAM_BUCKETS - 1);
+
+    histogram->calls           += 1;
+    histogram->total_us        += us;
+    histogram->buckets[bucket] += 1;
+}
@@ -0,0 +1,47 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/process.h"
+#include "esp_timer.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// See process_syscall_stats_enable()
+extern atomic_bool syscall_stats_enabled;
+
+typedef struct {
+    syscall_t syscall;
+    int64_t   start_us; // 0 if the call isn't timed
+} syscall_timer_t;
+
+void syscall_stats_record(syscall_t syscall, int64_t start_us);
+
+__attribute__((always_inline)) static inline void syscall_timer_stop(syscall_timer_t *timer) {
+    if (timer->start_us) {
+        syscall_stats_record(timer->syscall, timer->start_us);
+    }
+}
+
+// Time the rest of the enclosing block as syscall, however it is left. Only a
+// relaxed load while the stats are off.
+#define SYSCALL_TIMED(call)                                                                                            \
+    __attribute__((cleanup(syscall_timer_stop))) syscall_timer_t syscall_timer = {                                     \
+        .syscall  = (call),                                                                                            \
+        .start_us = atomic_load_explicit(&syscall_stats_enabled, memory_order_relaxed) ? esp_timer_get_time() : 0,     \
+    }
@@ -18,22 +18,52 @@
 
 #include "badgevms/event.h"
 #include "badgevms/ota.h"
+#include "badgevms/process.h"
+#include "boot_profile_private.h"
+#include "cache_counters.h"
 #include "compositor/compositor_private.h"
+#include "compressed_file.h"
 #include "curl/curl.h"
+#include "drivers/ramdisk.h"
+#include "drivers/socket.h"
+#include "drivers/wifi.h"
+#include "elf_hot.h"
 #include "elf_symbols.h"
+#include "esp_cpu.h"
 #include "esp_elf.h"
+#include "esp_freertos_hooks.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "esp_private/esp_clk.h"
+#include "esp_timer.h"
 #include "esp_tls.h"
+#include "file_map.h"
+#include "governor.h"
 #include "hash_helper.h"
+#include "hrtimer_private.h"
+#include "image_cache.h"
+#include "library.h"
+#include "logical_names.h"
+#include "mbedtls/sha256.h"
 #include "memory.h"
+#include "readahead.h"
+#include "service_queue.h"
+#include "slab.h"
 #include "thirdparty/khash.h"
+#include "trace.h"
+#include "wait_private.h"
 #include "why_io.h"
 
 #include <stdatomic.h>
 
+#include <errno.h>
 #include <iconv.h>
+#include <limits.h>
 #include <regex.h>
 #include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
 
 KHASH_MAP_INIT_INT(ptable, void *);
 KHASH_MAP_INIT_INT(restable, int);
@@ -41,21 +71,28 @@ KHASH_MAP_INIT_INT(restable, int);
 static void const *__keep_symbol_elf __attribute__((used)) = &elf_find_sym;
 
 extern void writeback_and_invalidate_task(task_info_t *task_info);
-extern void remap_task(task_info_t *task_info);
+extern bool remap_task(task_info_t *task_info);
 extern void unmap_task(task_info_t *task_info);
 extern void __real_xt_unhandled_exception(void *frame);
 
 static char const *TAG = "task";
 
+// The kernel heap has a fixed vaddr budget, so it grows and shrinks exactly as asked
 task_thread_t kernel_thread = {
-    .start = KERNEL_HEAP_START,
-    .end   = KERNEL_HEAP_START,
+    .start          = KERNEL_HEAP_START,
+    .end            = KERNEL_HEAP_START,
+    .heap_grow_size = SOC_MMU_PAGE_SIZE,
+    .heap_trim_size = 0,
 };
 
 task_info_t kernel_task = {
-    .thread = &kernel_thread,
+    .thread       = &kernel_thread,
+    .malloc_arena = &kernel_thread.malloc_arena,
+    .priority     = TASK_PRIORITY,
 };
 
+__thread task_info_t *current_task_info = &kernel_task;
+
 typedef struct {
     TaskFunction_t entry;
     void          *pvParameters;
@@ -63,14 +100,62 @@ typedef struct {
 
 static uint32_t num_tasks = 0;
 
+// Task infos stay on the kernel heap in PSRAM
+static slab_cache_t task_info_cache = SLAB_CACHE_INIT("task_info", sizeof(task_info_t), 8, MALLOC_CAP_SPIRAM);
+
+// Threads are large, with their MMU snapshot, and only a few are alive at a time
+static slab_cache_t thread_cache =
+    SLAB_CACHE_INIT("task_thread", sizeof(task_thread_t), 2, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+// Arenas of the threads after the first, see malloc_arena_t
+static slab_cache_t malloc_arena_cache =
+    SLAB_CACHE_INIT("malloc_arena", sizeof(malloc_arena_t), 4, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
 static task_info_t      *process_table[NUM_PIDS];
 static SemaphoreHandle_t process_table_lock = NULL;
 
 static TaskHandle_t  hades_handle;
 static QueueHandle_t hades_queue;
 
-static TaskHandle_t  zeus_handle;
-static QueueHandle_t zeus_queue;
+// A task in futex_wait(). Waiters live on the stack of their task, they are
+// taken off the list by whoever wakes them, by the task itself when it times
+// out and by Hades when the task dies.
+typedef struct futex_waiter {
+    task_thread_t       *thread;
+    uintptr_t            address;
+    TaskHandle_t         task;
+    pid_t                pid;
+    bool                 queued;
+    struct futex_waiter *next;
+} futex_waiter_t;
+
+static uint64_t core_user_us[portNUM_PROCESSORS]; // Spent running applications
+
+static futex_waiter_t *futex_waiters;
+static portMUX_TYPE    futex_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Tasks notified per trip through the futex lock, no FreeRTOS calls can be made while holding it
+#define FUTEX_WAKE_BATCH 8
+
+static TaskHandle_t zeus_handle;
+
+// Spawn requests that can be queued before callers block, Zeus handles them back to back
+#define ZEUS_QUEUE_LENGTH 8
+#define ZEUS_PRIORITY     10
+// Hades runs above Zeus and frees this many pages of a dead address space
+// before it lets a waiting spawn go first
+#define HADES_PRIORITY    11
+#define HADES_BATCH_PAGES 64
+// How long Zeus waits for the idle task to free the stacks of dead tasks when
+// it is out of memory for a new one
+#define ZEUS_IDLE_WAIT_MS 100
+// Zeus keeps a process spawned ahead of time, so a launch only has to hand it
+// a program. A new one is spawned once no request came for this long.
+#define ZYGOTE_DELAY_MS 100
+
+static atomic_bool zeus_idle_wait;
+// Only touched by Zeus, see zygote_spawn()
+static task_info_t *zygote;
 
 static SemaphoreHandle_t pid_table_lock = NULL;
 static pid_t             pid_table[NUM_PIDS];
@@ -78,17 +163,25 @@ static uint32_t          head = 0;
 static uint32_t          tail = MAX_PID;
 
 typedef struct {
-    TaskHandle_t caller;
-    task_info_t *parent_task_info;
-    task_type_t  type;
-    int          argc;
-    uint16_t     stack_size;
-    void const  *buffer;
-    char       **argv;
-    size_t       argv_size;
+    TaskHandle_t       caller;
+    task_info_t       *parent_task_info; // Only valid while process_table[parent_pid] points to it
+    pid_t              parent_pid;
+    task_type_t        type;
+    int                argc;
+    uint16_t           stack_size;
+    UBaseType_t        priority;
+    void const        *buffer;
+    char             **argv;
+    size_t             argv_size;
+    task_config_t      config;
+    UBaseType_t        caller_priority;
+    int64_t            sent_us; // For the launch report, see process_launch_get()
     void (*thread_entry)(void *data);
 } zeus_command_message_t;
 
+static zeus_command_message_t zeus_backlog[ZEUS_QUEUE_LENGTH];
+static service_queue_t        zeus_queue = SERVICE_QUEUE_INIT(zeus_backlog, zeus_command_message_t, caller_priority);
+
 static pid_t pid_allocate() {
     if (xSemaphoreTake(pid_table_lock, portMAX_DELAY) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to get pid table mutex");
@@ -127,15 +220,31 @@ task_info_t *get_taskinfo_for_pid(pid_t pid) {
     return process_table[pid];
 }
 
-static void process_table_add_task(task_info_t *task_info) {
+// With process_table_lock held
+static bool process_table_parent_alive(pid_t parent_pid, task_info_t const *parent) {
+    return parent_pid >= 0 && parent_pid <= MAX_PID && process_table[parent_pid] == parent;
+}
+
+// False if the parent died in the meantime, then Hades has already been
+// through its children and this one would be left behind
+static bool process_table_add_task(task_info_t *task_info, pid_t parent_pid, task_info_t *parent) {
     if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to get process table mutex");
         abort();
     }
 
-    process_table[task_info->pid] = task_info;
+    bool alive = !parent || process_table_parent_alive(parent_pid, parent);
+    if (alive) {
+        process_table[task_info->pid] = task_info;
+        if (parent) {
+            task_info->parent_info  = parent;
+            task_info->next_sibling = parent->first_child;
+            parent->first_child     = task_info;
+        }
+    }
 
     xSemaphoreGive(process_table_lock);
+    return alive;
 }
 
 static void process_table_remove_task(task_info_t *task_info) {
@@ -145,6 +254,13 @@ static void process_table_remove_task(task_info_t *task_info) {
     }
 
     process_table[task_info->pid] = NULL;
+    if (task_info->parent_info) {
+        task_info_t **link = &task_info->parent_info->first_child;
+        while (*link != task_info) {
+            link = &(*link)->next_sibling;
+        }
+        *link = task_info->next_sibling;
+    }
 
     xSemaphoreGive(process_table_lock);
 }
@@ -159,6 +275,9 @@ void vTaskPreDeletionHook(TaskHandle_t handle) {
 
     pid_t pid = task_info->pid;
 
+    hrtimer_task_died(task_info);
+    wait_task_died(task_info);
+    trace_event(TRACE_HADES_SEND, pid, 0);
     if (xPortInIsrContext()) {
         BaseType_t xHigherPriorityTaskWoken = pdFALSE;
         if (xQueueSendFromISR(hades_queue, &pid, &xHigherPriorityTaskWoken) == errQUEUE_FULL) {
@@ -170,45 +289,153 @@ void vTaskPreDeletionHook(TaskHandle_t handle) {
     }
 }
 
-static task_thread_t *task_thread_init(uintptr_t start) {
-    task_thread_t *ret = calloc(1, sizeof(task_thread_t));
+// Before anything runs in the address space
+static void task_thread_configure(task_thread_t *thread, task_config_t config) {
+    thread->heap_grow_size = config.grow_size ? config.grow_size : HEAP_GROW_SIZE;
+    thread->heap_grow_size = (thread->heap_grow_size + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1);
+    thread->heap_trim_size = config.trim_size ? config.trim_size : HEAP_TRIM_SIZE;
+
+    thread->max_heap_pages        = config.max_heap_pages;
+    thread->max_framebuffer_pages = config.max_framebuffer_pages;
+    thread->frame_rate            = config.frame_rate;
+    thread->cpu_class             = config.cpu_class;
+    thread->keep_image            = config.keep_image;
+}
+
+static task_thread_t *task_thread_init(uintptr_t start, task_config_t config) {
+    task_thread_t *ret = slab_alloc(&thread_cache);
     if (!ret) {
         return ret;
     }
 
-    ret->current_files           = 3;
-    ret->file_handles[0].is_open = true;
-    ret->file_handles[0].device  = device_get("TT01");
-    ret->file_handles[1].is_open = true;
-    ret->file_handles[1].device  = device_get("TT01");
-    ret->file_handles[2].is_open = true;
-    ret->file_handles[2].device  = device_get("TT01");
+    ret->heap_lock         = xSemaphoreCreateMutex();
+    ret->malloc_arena.lock = xSemaphoreCreateMutex();
+    if (!ret->heap_lock || !ret->malloc_arena.lock) {
+        ESP_LOGE(TAG, "Unable to create the heap locks");
+        if (ret->heap_lock) {
+            vSemaphoreDelete(ret->heap_lock);
+        }
+        if (ret->malloc_arena.lock) {
+            vSemaphoreDelete(ret->malloc_arena.lock);
+        }
+        slab_free(&thread_cache, ret);
+        return NULL;
+    }
+    ret->malloc_arena.in_use = true;
+
+    device_t *tty      = device_get("TT01");
+    ret->current_files = 3;
+    for (int i = 0; i < 3; ++i) {
+        ret->file_handles[i].is_open = true;
+        ret->file_handles[i].device  = tty;
+        ret->file_handles[i].read    = tty ? tty->_read : NULL;
+        ret->file_handles[i].write   = tty ? tty->_write : NULL;
+    }
+    atomic_store(&ret->fd_used[0], 0x7);
 
     for (int i = 0; i < RES_RESOURCE_TYPE_MAX; ++i) {
         ret->resources[i] = kh_init(restable);
     }
+    portMUX_INITIALIZE(&ret->resource_lock);
 
     ret->start    = start;
     ret->end      = start;
     ret->refcount = 1;
+    task_thread_configure(ret, config);
 
     return ret;
 }
 
-static void task_thread_destroy(task_thread_t *thread) {
-    if (!thread) {
+// An arena for a new thread in the address space of its parent, a left over
+// one if a thread exited before
+static malloc_arena_t *malloc_arena_claim(task_thread_t *thread) {
+    for (malloc_arena_t *arena = &thread->malloc_arena; arena; arena = arena->next) {
+        bool in_use = false;
+        if (atomic_compare_exchange_strong(&arena->in_use, &in_use, true)) {
+            return arena;
+        }
+    }
+
+    malloc_arena_t *arena = slab_alloc(&malloc_arena_cache);
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->lock = xSemaphoreCreateMutex();
+    if (!arena->lock) {
+        slab_free(&malloc_arena_cache, arena);
+        return NULL;
+    }
+    arena->in_use = true;
+
+    // Only Zeus adds arenas, the other threads may be walking the list to free
+    // memory, so publish the arena once it is complete
+    arena->next               = thread->malloc_arena.next;
+    thread->malloc_arena.next = arena;
+    return arena;
+}
+
+// A big teardown would hold up the next spawn, so Hades drops below Zeus
+// between batches while one is waiting. Zeus runs right away and Hades goes on
+// once Zeus is blocked again.
+static void hades_yield(void) {
+    if (xTaskGetCurrentTaskHandle() != hades_handle || !service_queue_pending(&zeus_queue)) {
         return;
     }
 
-    int cur  = atomic_load(&thread->refcount);
-    int want = cur - 1;
-    while (!atomic_compare_exchange_weak(&thread->refcount, &cur, want)) {
-        usleep(100);
-        cur  = atomic_load(&thread->refcount);
-        want = cur - 1;
+    trace_event(TRACE_HADES_YIELD, 0, 0);
+    vTaskPrioritySet(NULL, ZEUS_PRIORITY - 1);
+    vTaskPrioritySet(NULL, HADES_PRIORITY);
+}
+
+// Clean up what a process left behind, with no task of it left
+static void task_resource_release(task_thread_t *thread, task_resource_type_t type, void *ptr) {
+    switch (type) {
+        case RES_ICONV_OPEN:
+            ESP_LOGI(TAG, "Cleaning up iconv %p", ptr);
+            iconv_close(ptr);
+            break;
+        case RES_REGCOMP:
+            ESP_LOGI(TAG, "Cleaning up regcomp %p", ptr);
+            regfree(ptr);
+            break;
+        case RES_OPEN:
+            // Closed with the file handles
+            break;
+        case RES_WINDOW:
+            ESP_LOGW(TAG, "Cleaning up window %p", ptr);
+            window_destroy_task(ptr);
+            break;
+        case RES_OVERLAY:
+            ESP_LOGW(TAG, "Cleaning up overlay %p", ptr);
+            overlay_destroy_task(ptr);
+            break;
+        case RES_DEVICE:
+            device_t *dev = (device_t *)ptr;
+            if (dev->_destroy) {
+                dev->_destroy(ptr);
+            }
+            break;
+        case RES_OTA: ota_session_abort(ptr); break;
+        case RES_ESP_TLS: esp_tls_conn_destroy(ptr); break;
+        case RES_DMA_BUFFER:
+            ESP_LOGW(TAG, "Cleaning up DMA buffer %p", ptr);
+            dma_buffer_release(ptr);
+            break;
+        case RES_HRTIMER: hrtimer_destroy_task(ptr); break;
+        case RES_FILE_MAP: file_map_release(thread, ptr); break;
+        case RES_SOCKET_VIEW: socket_view_release_task(ptr); break;
+        case RES_FAST_ALLOC: heap_caps_free(ptr); break;
+        default: ESP_LOGE(TAG, "Unknown resource type %i in thread_delete", type);
+    }
+}
+
+static void task_thread_destroy(task_thread_t *thread) {
+    if (!thread) {
+        return;
     }
 
-    if (want) {
+    if (atomic_fetch_sub(&thread->refcount, 1) != 1) {
         // Still in use
         return;
     }
@@ -224,48 +451,50 @@ static void task_thread_destroy(task_thread_t *thread) {
             }
         }
     }
+    ramdisk_release(thread);
+    wifi_low_latency_release(thread);
+
+    for (task_resource_t *res; (res = thread->linked_resources);) {
+        task_resource_unlink(res);
+        task_resource_release(thread, res->type, res->ptr);
+    }
 
     for (int i = 0; i < RES_RESOURCE_TYPE_MAX; ++i) {
         for (khiter_t k = kh_begin(thread->resources[i]); k != kh_end(thread->resources[i]); ++k) {
             if (kh_exist(thread->resources[i], k)) {
-                void                *ptr  = (void *)kh_key(thread->resources[i], k);
-                task_resource_type_t type = kh_value(thread->resources[i], k);
-
-                switch (type) {
-                    case RES_ICONV_OPEN:
-                        ESP_LOGI(TAG, "Cleaning up iconv %p", ptr);
-                        iconv_close(ptr);
-                        break;
-                    case RES_REGCOMP:
-                        ESP_LOGI(TAG, "Cleaning up regcomp %p", ptr);
-                        regfree(ptr);
-                        break;
-                    case RES_OPEN:
-                        // Already handled above
-                        break;
-                    case RES_WINDOW:
-                        ESP_LOGW(TAG, "Cleaning up window %p", ptr);
-                        window_destroy_task(ptr);
-                        break;
-                    case RES_DEVICE:
-                        device_t *dev = (device_t *)ptr;
-                        if (dev->_destroy) {
-                            dev->_destroy(ptr);
-                        }
-                        break;
-                    case RES_OTA: ota_session_abort(ptr); break;
-                    case RES_ESP_TLS: esp_tls_conn_destroy(ptr); break;
-                    default: ESP_LOGE(TAG, "Unknown resource type %i in thread_delete", type);
-                }
+                task_resource_release(thread, kh_value(thread->resources[i], k), (void *)kh_key(thread->resources[i], k));
             }
         }
 
         kh_destroy(restable, thread->resources[i]);
     }
 
-    pages_deallocate(thread->pages);
+    // Killed while hibernated
+    if (thread->hibernated_pages) {
+        why_unlink(thread->hibernate_path);
+    }
+
+    hades_yield();
+    allocation_range_t *pages = thread->pages;
+    while ((pages = pages_deallocate_some(pages, HADES_BATCH_PAGES))) {
+        hades_yield();
+    }
+    image_cache_put(thread->image);
+    library_put_all(thread);
+
+    malloc_arena_t *arena = thread->malloc_arena.next;
+    while (arena) {
+        malloc_arena_t *next = arena->next;
+        vSemaphoreDelete(arena->lock);
+        slab_free(&malloc_arena_cache, arena);
+        arena = next;
+    }
+    vSemaphoreDelete(thread->malloc_arena.lock);
+    vSemaphoreDelete(thread->heap_lock);
+    logical_name_table_free(atomic_load(&thread->logical_names));
+    free(atomic_load(&thread->syscall_histograms));
 
-    free(thread);
+    slab_free(&thread_cache, thread);
 }
 
 static task_thread_t *task_thread_ref(task_thread_t *heap) {
@@ -273,23 +502,19 @@ static task_thread_t *task_thread_ref(task_thread_t *heap) {
         return heap;
     }
 
-    int cur  = atomic_load(&heap->refcount);
-    int want = cur + 1;
-    while (want && (!atomic_compare_exchange_weak(&heap->refcount, &cur, want))) {
-        usleep(100);
-        cur  = atomic_load(&heap->refcount);
-        want = cur + 1;
-    }
-
-    if (want == 0) {
-        return NULL;
-    }
+    // Not once it dropped to 0, it is being destroyed
+    int cur = atomic_load(&heap->refcount);
+    do {
+        if (!cur) {
+            return NULL;
+        }
+    } while (!atomic_compare_exchange_weak(&heap->refcount, &cur, cur + 1));
 
     return heap;
 }
 
 static task_info_t *task_info_init() {
-    task_info_t *task_info = heap_caps_calloc(1, sizeof(task_info_t), MALLOC_CAP_SPIRAM);
+    task_info_t *task_info = slab_alloc(&task_info_cache);
     if (!task_info) {
         ESP_LOGE(TAG, "Out of memory trying to allocate task info");
         return NULL;
@@ -305,10 +530,14 @@ static void task_info_delete(task_info_t *task_info) {
     }
 
     vQueueDelete(task_info->children);
+    hrtimer_destroy_task(task_info->sleep_timer);
+    if (task_info->wait_eventfd) {
+        close(task_info->wait_eventfd);
+    }
     free(task_info->file_path);
     free(task_info->argv_back);
     free(task_info->application_uid);
-    heap_caps_free(task_info);
+    slab_free(&task_info_cache, task_info);
     ESP_LOGI(TAG, "Cleaned up task");
 }
 
@@ -323,99 +552,482 @@ void IRAM_ATTR cerberos() {
 void IRAM_ATTR __wrap_xt_unhandled_exception(void *frame) {
     task_info_t *task_info = get_task_info();
     if (task_info && task_info->pid) {
-        esp_rom_printf("Task %u caused an unhandled exception, Cerberos will deal with it\n", task_info->pid);
+        uint32_t cause;
+        __asm__ volatile("csrr %0, mcause" : "=r"(cause));
+        if (cause == 3 && task_info->stack_guard) { // Breakpoint, our watchpoint is the only one set
+            esp_rom_printf("Task %u overflowed its stack, Cerberos will deal with it\n", task_info->pid);
+        } else {
+            esp_rom_printf("Task %u caused an unhandled exception, Cerberos will deal with it\n", task_info->pid);
+        }
+
+        // Cerberos gets the whole stack, with the guard off, as the task may
+        // well have run out of it
+        esp_cpu_clear_watchpoint(STACK_GUARD_WATCHPOINT);
+        uintptr_t stack_top = (uintptr_t)pxTaskGetStackStart(NULL) + task_info->stack_size + 2 * STACK_GUARD_SIZE;
 
         // Send task off to think about what it did until its timeslice runs out
-        __asm__ volatile("csrw mepc, %0\n\t" // Set return address
+        __asm__ volatile("mv sp, %1\n\t"
+                         "csrw mepc, %0\n\t" // Set return address
                          "mret\n\t"
                          :
-                         : "r"(cerberos)
+                         : "r"(cerberos), "r"(stack_top & ~(uintptr_t)15)
                          : "t0", "memory");
     }
     __real_xt_unhandled_exception(frame);
 }
 
-static void elf_task(task_info_t *task_info) {
+// Where a program image goes, from the ELF file. The loader lays the segments
+// out from their vaddrs, the read-only ones in front of the first writable one
+// can be shared between instances of the program.
+typedef struct {
+    uint8_t hash[IMAGE_HASH_SIZE]; // Of the file and the libraries it needs
+    size_t  size;                  // Page aligned
+    size_t  shared_size;           // Page aligned, up to the first writable segment
+    // Mapped behind the image, in this order
+    char    needed[LIBRARY_MAX_NEEDED][LIBRARY_NAME_MAX];
+    int     num_needed;
+} elf_image_layout_t;
+
+#define ELF_IMAGE_MAX_PHDRS 16
+#define ELF_IMAGE_MAX_DYN   32
+
+// Microseconds since the end of the last stage of the launch of thread, which ends now
+static uint32_t launch_lap(task_thread_t *thread) {
+    int64_t  now          = esp_timer_get_time();
+    uint32_t lap          = now - thread->launch_lap_us;
+    thread->launch_lap_us = now;
+    return lap;
+}
+
+static void elf_run(task_info_t *task_info, int (*entry)(int argc, char *argv[])) {
+    process_launch_t *launch = &task_info->thread->launch;
+
+    if (task_info->thread->keep_image) {
+        image_cache_pin(task_info->thread->image);
+    }
+
+    ESP_LOGI(TAG, "Writing back and invalidating our address space");
+    launch_lap(task_info->thread);
+    writeback_and_invalidate_task(task_info);
+    launch->writeback_us = launch_lap(task_info->thread);
+    launch->total_us     = task_info->thread->launch_lap_us - task_info->thread->launch_start_us;
+
+    ESP_LOGI(
+        TAG,
+        "Launch of PID %d took %lu us: spawn %lu open %lu map %lu read %lu relocate %lu (%lu relocations) cache %lu "
+        "writeback %lu, image %s",
+        task_info->pid,
+        launch->total_us,
+        launch->spawn_us,
+        launch->open_us,
+        launch->map_us,
+        launch->read_us,
+        launch->relocate_us,
+        launch->relocations,
+        launch->cache_us,
+        launch->writeback_us,
+        launch->image == PROCESS_IMAGE_CACHED      ? "cached"
+        : launch->image == PROCESS_IMAGE_PRELINKED ? "prelinked"
+                                                   : "loaded"
+    );
+
+    ESP_LOGW(TAG, "Start ELF file entrypoint at %p", entry);
+    entry(task_info->argc, task_info->argv);
+
+    ESP_LOGI(TAG, "Successfully exited from ELF file");
+}
+
+// What esp_elf_relocate_stream() reads from. Iris reads the tables on the
+// other core meanwhile if it is free, see readahead.h.
+typedef struct {
+    compressed_file_t *file;
+    readahead_t       *ahead;
+    uint32_t           read_us;
+} elf_stream_t;
+
+static int elf_file_read(void *ctx, uint32_t offset, void *buf, uint32_t size) {
+    elf_stream_t *stream = ctx;
+    uint8_t      *dst    = buf;
+    int64_t       start  = esp_timer_get_time();
+    size_t        ahead  = readahead_read(stream->ahead, offset, dst, size);
+    bool          read   = ahead == size;
+
+    if (!read) {
+        read = compressed_file_pread(stream->file, offset + ahead, dst + ahead, size - ahead);
+    }
+
+    stream->read_us += esp_timer_get_time() - start;
+    return read ? 0 : -EIO;
+}
+
+static void elf_file_prefetch(void *ctx, uint32_t offset, uint32_t size) {
+    elf_stream_t *stream = ctx;
+    readahead_add(stream->ahead, offset, size);
+}
+
+static uintptr_t elf_library_sym(void *ctx, char const *name) {
+    return library_find_sym(ctx, name);
+}
+
+// Map the libraries the program needs behind its image
+static bool elf_map_libraries(task_info_t *task_info, elf_image_layout_t const *layout) {
+    for (int i = 0; i < layout->num_needed; ++i) {
+        if (!library_map(task_info, layout->needed[i])) {
+            ESP_LOGE(TAG, "Unable to load library %s", layout->needed[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Loads into the image mapped at the start of the heap if there is a layout.
+// From task_info->buffer, or streamed from file, which is closed before the
+// program runs, without one.
+static void elf_task_layout(task_info_t *task_info, elf_image_layout_t const *layout, compressed_file_t *file) {
     int ret;
 
     // Allocate in task itself so we don't have to free it
     esp_elf_t *elf = dlcalloc(1, sizeof(esp_elf_t));
     if (!elf) {
         ESP_LOGE(TAG, "Out of memory trying to allocate elf structure");
-        return;
+        goto out;
     }
     task_info->data = elf;
 
-    uint32_t vmem = why_elf_get_vmem_requirements((uint8_t const *)task_info->buffer);
-
-    ESP_LOGI(TAG, "VMEM requirement: %lu\n", vmem);
+    if (task_info->buffer) {
+        uint32_t vmem = why_elf_get_vmem_requirements((uint8_t const *)task_info->buffer);
+        ESP_LOGI(TAG, "VMEM requirement: %lu\n", vmem);
+    }
 
     ret = esp_elf_init(elf);
     if (ret < 0) {
         ESP_LOGE(TAG, "Failed to initialize ELF file errno=%d", ret);
-        return;
+        goto out;
+    }
+    elf->find_sym     = elf_library_sym;
+    elf->find_sym_ctx = task_info->thread;
+
+    if (layout) {
+        elf->psegment      = (uint8_t *)task_info->thread->start;
+        elf->psegment_size = layout->size;
+        memory_mark_executable(elf->psegment, layout->size);
     }
 
-    ret = esp_elf_relocate(elf, (uint8_t const *)task_info->buffer);
+    elf_stream_t stream = {.file = file};
+    launch_lap(task_info->thread);
+    if (task_info->buffer) {
+        ret = esp_elf_relocate(elf, (uint8_t const *)task_info->buffer);
+    } else {
+        stream.ahead  = readahead_start(task_info->file_path);
+        elf->prefetch = elf_file_prefetch;
+        ret           = esp_elf_relocate_stream(elf, elf_file_read, &stream);
+        readahead_stop(stream.ahead);
+    }
     if (ret < 0) {
         ESP_LOGE(TAG, "Failed to relocate ELF file errno=%d", ret);
         goto out;
     }
+    task_info->thread->launch.read_us     = stream.read_us;
+    task_info->thread->launch.relocate_us = launch_lap(task_info->thread) - stream.read_us;
+    task_info->thread->launch.relocations = elf->nr_reloc;
+    task_info->thread->elf_bias = (uintptr_t)elf->psegment - elf->svaddr;
 
-    ESP_LOGI(TAG, "Writing back and invalidating our address space");
-    writeback_and_invalidate_task(task_info);
+    if (file) {
+        elf_hot_load(file, task_info->thread->elf_bias);
+    }
 
-    ESP_LOGW(TAG, "Start ELF file entrypoint at %p", elf->entry);
-    esp_elf_request(elf, 0, task_info->argc, task_info->argv);
+    if (layout) {
+        elf32_hdr_t         ehdr_buf;
+        elf32_phdr_t        phdr_buf[ELF_IMAGE_MAX_PHDRS];
+        elf32_hdr_t const  *ehdr        = task_info->buffer;
+        elf32_phdr_t const *phdr        = NULL;
+        size_t              shared_size = layout->shared_size;
+        size_t              data_end    = 0;
+
+        if (ehdr) {
+            phdr = (elf32_phdr_t const *)((uint8_t const *)task_info->buffer + ehdr->phoff);
+        } else {
+            // elf_image_layout_read() already checked there aren't too many
+            ehdr = &ehdr_buf;
+            phdr = phdr_buf;
+            if (!compressed_file_pread(file, 0, &ehdr_buf, sizeof(ehdr_buf)) ||
+                !compressed_file_pread(file, ehdr_buf.phoff, phdr_buf, ehdr_buf.phnum * sizeof(elf32_phdr_t))) {
+                ESP_LOGE(TAG, "Unable to read the program headers again");
+                goto out;
+            }
+        }
 
-    ESP_LOGI(TAG, "Successfully exited from ELF file");
+        // Relocated, the writable part may start lower than the file suggests
+        for (int i = 0; i < ehdr->phnum; ++i) {
+            if (phdr[i].type != PT_LOAD) {
+                continue;
+            }
+            if (phdr[i].flags & PF_W) {
+                shared_size = MIN(shared_size, ((phdr[i].vaddr - elf->svaddr) & ~(SOC_MMU_PAGE_SIZE - 1)));
+            }
+            data_end = MAX(data_end, phdr[i].vaddr - elf->svaddr + phdr[i].filesz);
+        }
+
+        // Before the program runs, while the image is as relocation left it
+        image_prelink_write(
+            task_info,
+            task_info->file_path,
+            layout->hash,
+            layout->size,
+            shared_size,
+            data_end,
+            elf->entry
+        );
+        task_info->thread->image = image_cache_add(
+            task_info,
+            layout->hash,
+            layout->size,
+            shared_size,
+            data_end > shared_size ? data_end - shared_size : 0,
+            elf->entry
+        );
+        task_info->thread->launch.cache_us = launch_lap(task_info->thread);
+    }
+
+    compressed_file_close(file);
+    elf_run(task_info, elf->entry);
     return;
 
 out:
-    // All allocations will be cleaned up by Hades
+    // All allocations in the task will be cleaned up by Hades, the file is not one of them
+    compressed_file_close(file);
+}
+
+static void elf_task(task_info_t *task_info) {
+    elf_task_layout(task_info, NULL, NULL);
+}
+
+// The names of the libraries in the DT_NEEDED entries of the PT_DYNAMIC segment
+static bool elf_image_needed_read(
+    compressed_file_t *file, elf32_hdr_t const *ehdr, elf32_phdr_t const *phdr, elf_image_layout_t *layout
+) {
+    elf32_dyn_t dyn[ELF_IMAGE_MAX_DYN];
+    uint32_t    needed[LIBRARY_MAX_NEEDED];
+    uint32_t    strtab = 0;
+    ssize_t     bytes  = 0;
+
+    layout->num_needed = 0;
+    for (int i = 0; i < ehdr->phnum; ++i) {
+        if (phdr[i].type == PT_DYNAMIC) {
+            bytes = MIN(phdr[i].filesz, sizeof(dyn));
+            if (!compressed_file_pread(file, phdr[i].offset, dyn, bytes)) {
+                return false;
+            }
+            break;
+        }
+    }
+
+    for (int i = 0; i < bytes / sizeof(elf32_dyn_t) && dyn[i].tag != DT_NULL; ++i) {
+        if (dyn[i].tag == DT_STRTAB) {
+            strtab = dyn[i].val;
+        } else if (dyn[i].tag == DT_NEEDED) {
+            if (layout->num_needed == LIBRARY_MAX_NEEDED) {
+                ESP_LOGE(TAG, "More than %d libraries needed", LIBRARY_MAX_NEEDED);
+                return false;
+            }
+            needed[layout->num_needed++] = dyn[i].val;
+        }
+    }
+    if (!layout->num_needed) {
+        return true;
+    }
+
+    // The string table is in a segment, but not loaded yet
+    int64_t strtab_offset = -1;
+    for (int i = 0; i < ehdr->phnum; ++i) {
+        if (phdr[i].type == PT_LOAD && strtab >= phdr[i].vaddr && strtab < phdr[i].vaddr + phdr[i].filesz) {
+            strtab_offset = strtab - phdr[i].vaddr + phdr[i].offset;
+            break;
+        }
+    }
+    if (strtab_offset < 0) {
+        return false;
+    }
+
+    for (int i = 0; i < layout->num_needed; ++i) {
+        char   *name   = layout->needed[i];
+        int64_t offset = strtab_offset + needed[i];
+        size_t  r      = 0;
+        // Names near the end of the file are shorter than LIBRARY_NAME_MAX
+        if (offset < compressed_file_size(file)) {
+            r = MIN(LIBRARY_NAME_MAX, compressed_file_size(file) - offset);
+        }
+        if (!r || !compressed_file_pread(file, offset, name, r) || !memchr(name, 0, r)) {
+            ESP_LOGE(TAG, "Unable to read the name of needed library %d", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hash the file and read where its image goes, false if it can't be cached
+static bool elf_image_layout_read(compressed_file_t *file, elf_image_layout_t *layout) {
+    elf32_hdr_t  ehdr;
+    elf32_phdr_t phdr[ELF_IMAGE_MAX_PHDRS];
+
+    if (!compressed_file_pread(file, 0, &ehdr, sizeof(ehdr)) || ehdr.phentsize != sizeof(elf32_phdr_t) ||
+        !ehdr.phnum || ehdr.phnum > ELF_IMAGE_MAX_PHDRS) {
+        return false;
+    }
+
+    if (!compressed_file_pread(file, ehdr.phoff, phdr, ehdr.phnum * sizeof(elf32_phdr_t))) {
+        return false;
+    }
+
+    // Matches esp_elf_load_segment(), which lays the segments out from vaddr 0
+    size_t size        = 0;
+    size_t shared_size = SIZE_MAX;
+    for (int i = 0; i < ehdr.phnum; ++i) {
+        if (phdr[i].type != PT_LOAD) {
+            continue;
+        }
+        if (phdr[i].flags & PF_W) {
+            shared_size = MIN(shared_size, (phdr[i].vaddr & ~(SOC_MMU_PAGE_SIZE - 1)));
+        }
+        size = MAX(size, phdr[i].vaddr + phdr[i].memsz);
+    }
+
+    layout->size        = (size + SOC_MMU_PAGE_SIZE - 1) & ~(SOC_MMU_PAGE_SIZE - 1);
+    layout->shared_size = MIN(shared_size, layout->size);
+    if (!layout->shared_size || !elf_image_needed_read(file, &ehdr, phdr, layout)) {
+        return false;
+    }
+
+    // Patched per process when it is loaded
+    if (elf_hot_present(file)) {
+        return false;
+    }
+
+    // The stack is all we have, the heap has to stay empty until the image is mapped
+    uint8_t                buffer[1024];
+    ssize_t                r;
+    int                    fd = compressed_file_fd(file);
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    // As stored, compressed or not, which is less to read
+    why_lseek(fd, 0, SEEK_SET);
+    while ((r = why_read(fd, buffer, sizeof(buffer))) > 0) {
+        mbedtls_sha256_update(&sha, buffer, r);
+    }
+
+    // Relocated against the libraries, a different one is a different image
+    for (int i = 0; i < layout->num_needed; ++i) {
+        struct stat st;
+        if (!library_stat(layout->needed[i], &st)) {
+            r = -1;
+            break;
+        }
+        mbedtls_sha256_update(&sha, (uint8_t const *)layout->needed[i], strlen(layout->needed[i]));
+        mbedtls_sha256_update(&sha, (uint8_t const *)&st.st_size, sizeof(st.st_size));
+        mbedtls_sha256_update(&sha, (uint8_t const *)&st.st_mtime, sizeof(st.st_mtime));
+    }
+    mbedtls_sha256_finish(&sha, layout->hash);
+    mbedtls_sha256_free(&sha);
+
+    return r == 0;
 }
 
 // This runs inside the user task
 static void elf_task_path(task_info_t *task_info) {
-    int fd = why_open(task_info->file_path, O_RDONLY, 0);
-    if (fd == -1) {
+    compressed_file_t *file = compressed_file_open(task_info->file_path);
+    if (!file) {
         ESP_LOGW("elf_task_path", "Unable to open file '%s'", task_info->file_path);
         return;
     }
 
-    off_t size = why_lseek(fd, 0, SEEK_END);
     // 112 bytes is currently the smallest known ELF :)
-    if (size == -1 || size < 112) {
+    if (compressed_file_size(file) < 112) {
         ESP_LOGW("elf_task_path", "Unable to read file");
+        compressed_file_close(file);
         return;
     }
 
-    why_lseek(fd, 0, SEEK_SET);
-
-    // Allocate in task itself so we don't have to free it
-    task_info->buffer = dlcalloc(1, size);
-    if (!task_info->buffer) {
-        ESP_LOGW("elf_task_path", "Unable to allocate memory");
-        return;
-    }
+    // A program that is already running only needs its writable part copied
+    process_launch_t  *launch = &task_info->thread->launch;
+    elf_image_layout_t layout;
+    bool               cache = elf_image_layout_read(file, &layout);
+    launch->open_us          = launch_lap(task_info->thread);
+    if (cache) {
+        image_t *image = image_cache_get(layout.hash, task_info->thread->start);
+        if (image) {
+            int (*entry)(int argc, char *argv[]) = image_cache_map(task_info, image);
+            if (entry) {
+                compressed_file_close(file);
+                // Laid out from vaddr 0, just like elf_image_layout_read() assumes
+                task_info->thread->image    = image;
+                task_info->thread->elf_bias = task_info->thread->start;
+                if (elf_map_libraries(task_info, &layout)) {
+                    launch->image  = PROCESS_IMAGE_CACHED;
+                    launch->map_us = launch_lap(task_info->thread);
+                    elf_run(task_info, entry);
+                }
+                return;
+            }
+            image_cache_put(image);
+        }
 
-    ssize_t r = why_read(fd, task_info->buffer, size);
-    if (r != size) {
-        ESP_LOGW("elf_task_path", "Unable to read file contents");
-        return;
+        cache = heap_map_image(task_info, NULL, layout.shared_size, layout.size);
+        // Before anything is allocated from the heap, relocation needs them
+        if (cache && !elf_map_libraries(task_info, &layout)) {
+            compressed_file_close(file);
+            return;
+        }
+        launch->map_us = launch_lap(task_info->thread);
+
+        // Relocated by an earlier launch, it only has to be read
+        size_t shared_size;
+        size_t data_end;
+        int (*entry)(int argc, char *argv[]) = NULL;
+        if (cache) {
+            entry = image_prelink_read(
+                task_info,
+                task_info->file_path,
+                layout.hash,
+                layout.size,
+                &shared_size,
+                &data_end
+            );
+        }
+        if (entry) {
+            compressed_file_close(file);
+            launch->image               = PROCESS_IMAGE_PRELINKED;
+            launch->read_us             = launch_lap(task_info->thread);
+            task_info->thread->elf_bias = task_info->thread->start;
+            task_info->thread->image    = image_cache_add(
+                task_info,
+                layout.hash,
+                layout.size,
+                shared_size,
+                data_end > shared_size ? data_end - shared_size : 0,
+                entry
+            );
+            launch->cache_us = launch_lap(task_info->thread);
+            elf_run(task_info, entry);
+            return;
+        }
     }
 
-    why_close(fd);
-    elf_task(task_info);
+    // Segments are read straight to where they go, the file is never in memory as a whole
+    elf_task_layout(task_info, cache ? &layout : NULL, file);
 }
 
 // This is the function that runs inside the Task
 static void generic_task(void *ti) {
     // Final setup to be done inside of the task context before we launch our entrypoint
     task_info_t *task_info = ti;
+    current_task_info      = task_info;
     // ESP_LOGI(TAG, "Setting watchpoint on %p core %i", &task_info->pad, esp_cpu_get_core_id());
     // esp_cpu_set_watchpoint(0, &task_info->pad, 4, ESP_CPU_WATCHPOINT_STORE);
 
+    task_info->thread->launch.spawn_us = launch_lap(task_info->thread);
+
     // YOLO
     task_info->task_entry(task_info);
     ESP_LOGI(TAG, "Returning from task entry for Task %u", task_info->pid);
@@ -427,6 +1039,7 @@ static void generic_task(void *ti) {
 static void generic_thread(void *ti) {
     // Final setup to be done inside of the task context before we launch our entrypoint
     task_info_t *task_info = ti;
+    current_task_info      = task_info;
 
     // YOLO
     task_info->thread_entry(task_info->buffer);
@@ -457,7 +1070,75 @@ void task_record_resource_free(task_resource_type_t type, void *ptr) {
     }
 }
 
-pid_t run_task_path(char const *path, uint16_t stack_size, task_type_t type, int argc, char *argv[]) {
+bool task_record_resource_owned(task_resource_type_t type, void *ptr) {
+    task_info_t *task_info = get_task_info();
+
+    if (task_info && task_info->pid) {
+        kh_restable_t *resources = task_info->thread->resources[type];
+        return kh_get(restable, resources, (uintptr_t)ptr) != kh_end(resources);
+    }
+    return true;
+}
+
+void task_resource_link(task_resource_t *res, task_resource_type_t type, void *ptr) {
+    task_info_t *task_info = get_task_info();
+    if (!task_info->pid) {
+        return;
+    }
+
+    if (res->thread) {
+        ESP_LOGE(TAG, "Attempted allocate already allocated resource: %p", ptr);
+        return;
+    }
+
+    task_thread_t *thread = task_info->thread;
+    res->type             = type;
+    res->ptr              = ptr;
+    res->prev             = NULL;
+
+    portENTER_CRITICAL(&thread->resource_lock);
+    res->thread = thread;
+    res->next   = thread->linked_resources;
+    if (res->next) {
+        res->next->prev = res;
+    }
+    thread->linked_resources = res;
+    ++thread->num_linked_resources;
+    portEXIT_CRITICAL(&thread->resource_lock);
+}
+
+void task_resource_unlink(task_resource_t *res) {
+    task_thread_t *thread = res->thread;
+    if (!thread) {
+        // Created by a kernel task, those aren't tracked
+        if (get_task_info()->pid) {
+            ESP_LOGE(TAG, "Attempted to free already freed resource: %p", res->ptr);
+        }
+        return;
+    }
+
+    portENTER_CRITICAL(&thread->resource_lock);
+    if (res->prev) {
+        res->prev->next = res->next;
+    } else {
+        thread->linked_resources = res->next;
+    }
+    if (res->next) {
+        res->next->prev = res->prev;
+    }
+    res->thread = NULL;
+    --thread->num_linked_resources;
+    portEXIT_CRITICAL(&thread->resource_lock);
+}
+
+bool task_resource_owned(task_resource_t const *res) {
+    task_info_t *task_info = get_task_info();
+    return !task_info->pid || res->thread == task_info->thread;
+}
+
+pid_t run_task_path(
+    char const *path, uint16_t stack_size, task_type_t type, int argc, char *argv[], task_config_t const *config
+) {
     if (!(type == TASK_TYPE_ELF || type == TASK_TYPE_ELF_PATH)) {
         ESP_LOGE(TAG, "Can only run ELF files");
         return -1;
@@ -475,11 +1156,11 @@ pid_t run_task_path(char const *path, uint16_t stack_size, task_type_t type, int
     pid_t ret;
 
     if (argc) {
-        ret = run_task(strdup((void const *)path), stack_size, type, argc, argv);
+        ret = run_task(strdup((void const *)path), stack_size, type, argc, argv, config);
     } else {
         char **argv_tmp = malloc(sizeof(char *));
         argv_tmp[0]     = strdup(path);
-        ret             = run_task(strdup((void const *)path), stack_size, type, 1, argv_tmp);
+        ret             = run_task(strdup((void const *)path), stack_size, type, 1, argv_tmp, config);
         free(argv_tmp[0]);
         free(argv_tmp);
     }
@@ -487,7 +1168,9 @@ pid_t run_task_path(char const *path, uint16_t stack_size, task_type_t type, int
     return ret;
 }
 
-pid_t run_task(void const *buffer, uint16_t stack_size, task_type_t type, int argc, char *argv[]) {
+pid_t run_task(
+    void const *buffer, uint16_t stack_size, task_type_t type, int argc, char *argv[], task_config_t const *config
+) {
     if (!(type == TASK_TYPE_ELF || type == TASK_TYPE_ELF_PATH)) {
         ESP_LOGE(TAG, "Can only run ELF files");
         return -1;
@@ -518,41 +1201,72 @@ pid_t run_task(void const *buffer, uint16_t stack_size, task_type_t type, int ar
     zeus_command_message_t c = {
         .caller           = xTaskGetCurrentTaskHandle(),
         .parent_task_info = parent_task_info,
+        .parent_pid       = parent_task_info->pid,
         .type             = type,
         .argc             = argc,
         .stack_size       = stack_size,
+        .priority         = TASK_PRIORITY,
         .buffer           = buffer,
         .argv             = new_argv,
         .argv_size        = argv_size,
+        .config           = config ? *config : (task_config_t){0},
+        .sent_us          = esp_timer_get_time(),
     };
 
-    xQueueSend(zeus_queue, &c, portMAX_DELAY);
+    trace_event(TRACE_ZEUS_SEND, type, 0);
+    service_queue_send(&zeus_queue, &c);
     pid_t pid = ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
     return pid;
 }
 
 pid_t process_create(char const *path, size_t stack_size, int argc, char **argv) {
-    return run_task_path(path, stack_size, TASK_TYPE_ELF_PATH, argc, argv);
+    return run_task_path(path, stack_size, TASK_TYPE_ELF_PATH, argc, argv, NULL);
 }
 
-pid_t thread_create(void (*thread_entry)(void *user_data), void *user_data, uint16_t stack_size) {
+pid_t thread_create_attr(void (*thread_entry)(void *user_data), void *user_data, thread_attr_t const *attr) {
     task_info_t *parent_task_info = get_task_info();
 
+    if (!attr || attr->priority < THREAD_PRIORITY_LOW || attr->priority > THREAD_PRIORITY_HIGH) {
+        return -1;
+    }
+
+    if (attr->core != THREAD_CORE_ANY && attr->core != USER_TASK_CORE) {
+        ESP_LOGW(TAG, "Threads can only run on core %d, not %d", USER_TASK_CORE, attr->core);
+        return -1;
+    }
+
+    // Threads of a batch process stay below everything else too
+    UBaseType_t base =
+        parent_task_info->thread->cpu_class == APPLICATION_CPU_BATCH ? TASK_PRIORITY_LOW : TASK_PRIORITY;
+
     zeus_command_message_t c = {
         .caller           = xTaskGetCurrentTaskHandle(),
         .parent_task_info = parent_task_info,
+        .parent_pid       = parent_task_info->pid,
         .type             = TASK_TYPE_THREAD,
-        .stack_size       = stack_size,
+        .stack_size       = attr->stack_size,
+        .priority         = base + attr->priority,
         .buffer           = user_data,
         .thread_entry     = thread_entry,
     };
 
-    xQueueSend(zeus_queue, &c, portMAX_DELAY);
+    trace_event(TRACE_ZEUS_SEND, TASK_TYPE_THREAD, 0);
+    service_queue_send(&zeus_queue, &c);
     pid_t pid = ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
 
     return pid;
 }
 
+pid_t thread_create(void (*thread_entry)(void *user_data), void *user_data, uint16_t stack_size) {
+    thread_attr_t attr = {
+        .stack_size = stack_size,
+        .priority   = THREAD_PRIORITY_NORMAL,
+        .core       = THREAD_CORE_ANY,
+    };
+
+    return thread_create_attr(thread_entry, user_data, &attr);
+}
+
 pid_t wait(bool block, uint32_t timeout_msec) {
     task_info_t *task_info = get_task_info();
 
@@ -566,50 +1280,638 @@ pid_t wait(bool block, uint32_t timeout_msec) {
     return pid;
 }
 
-void IRAM_ATTR task_switched_in_hook(TaskHandle_t volatile *handle) {
-    task_info_t *task_info = get_task_info();
-    if (task_info && task_info->pid) {
-        // ESP_DRAM_LOGW(DRAM_STR("task_switched_hook"), "Switching to task %u, heap_start %p, heap_end %p",
-        // task_info->pid, (void*)task_info->thread_start, (void*)task_info->thread_end);
-        remap_task(task_info);
+// Unlink waiter, with futex_lock held
+static void futex_unlink(futex_waiter_t *waiter) {
+    for (futex_waiter_t **w = &futex_waiters; *w; w = &(*w)->next) {
+        if (*w == waiter) {
+            *w             = waiter->next;
+            waiter->queued = false;
+            return;
+        }
     }
 }
 
-void IRAM_ATTR task_switched_out_hook(TaskHandle_t volatile *handle) {
-    task_info_t *task_info = get_task_info();
-    if (task_info && task_info->pid) {
-        // ESP_DRAM_LOGW(DRAM_STR("task_switched_hook"), "Switching to task %u, heap_start %p, heap_end %p",
-        // task_info->pid, (void*)task_info->thread_start, (void*)task_info->thread_end);
-        unmap_task(task_info);
+// Take up to max waiters of thread that wait on address off the list, any address if it is 0
+static int futex_dequeue(task_thread_t *thread, uintptr_t address, TaskHandle_t *tasks, int max) {
+    int num = 0;
+
+    portENTER_CRITICAL(&futex_lock);
+    for (futex_waiter_t **w = &futex_waiters; *w && num < max;) {
+        futex_waiter_t *waiter = *w;
+        if (waiter->thread != thread || (address && waiter->address != address)) {
+            w = &waiter->next;
+            continue;
+        }
+        *w             = waiter->next;
+        waiter->queued = false;
+        tasks[num++]   = waiter->task;
     }
-}
+    portEXIT_CRITICAL(&futex_lock);
 
-uint32_t get_num_tasks() {
-    return num_tasks;
+    return num;
 }
 
-static void IRAM_ATTR hades(void *ignored) {
-    pid_t dead_pid;
+static int futex_wake_thread(task_thread_t *thread, uintptr_t address, int count) {
+    TaskHandle_t tasks[FUTEX_WAKE_BATCH];
+    int          woken = 0;
 
-    while (1) {
-        // Block until a task dies
-        if (xQueueReceive(hades_queue, &dead_pid, portMAX_DELAY) == pdTRUE) {
-            ESP_LOGW("HADES", "Stripping PID %d of its worldy possessions", dead_pid);
+    while (woken < count) {
+        int num = futex_dequeue(thread, address, tasks, MIN(count - woken, FUTEX_WAKE_BATCH));
+        for (int i = 0; i < num; ++i) {
+            xTaskNotifyGiveIndexed(tasks[i], TASK_NOTIFY_INDEX_FUTEX);
+        }
+        woken += num;
+        if (num < FUTEX_WAKE_BATCH) {
+            break;
+        }
+    }
 
-            task_info_t *task_info = process_table[dead_pid];
-            if (task_info) {
-                switch (task_info->type) {
-                    case TASK_TYPE_ELF_PATH: // Fallthrough
-                    case TASK_TYPE_ELF:      // Fallthrough
-                    case TASK_TYPE_THREAD: break;
-                    default: ESP_LOGE("HADES", "Unknown task type %i", task_info->type);
-                }
+    return woken;
+}
 
-                pid_t parent_pid = task_info->parent;
+// A waiting task that dies is taken off the list. Everyone else in its address
+// space wakes up, a lock it held would otherwise never be released.
+static void futex_task_died(task_info_t *task_info) {
+    portENTER_CRITICAL(&futex_lock);
+    for (futex_waiter_t **w = &futex_waiters; *w;) {
+        if ((*w)->pid == task_info->pid) {
+            (*w)->queued = false;
+            *w           = (*w)->next;
+        } else {
+            w = &(*w)->next;
+        }
+    }
+    portEXIT_CRITICAL(&futex_lock);
+
+    futex_wake_thread(task_info->thread, 0, INT_MAX);
+}
+
+// Reading the futex word must not fault while we hold futex_lock. Stacks are in
+// internal memory, everything else of the process is in its address space.
+static bool futex_address_valid(task_thread_t *thread, int *address) {
+    uintptr_t a = (uintptr_t)address;
+    if (!address || a % sizeof(int)) {
+        return false;
+    }
+    return (a >= thread->start && a + sizeof(int) <= thread->start + thread->size) || esp_ptr_internal(address);
+}
+
+int futex_wait(int *address, int expected, uint32_t timeout_msec) {
+    task_info_t *task_info = get_task_info();
+
+    if (!futex_address_valid(task_info->thread, address)) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    futex_waiter_t waiter = {
+        .thread  = task_info->thread,
+        .address = (uintptr_t)address,
+        .task    = xTaskGetCurrentTaskHandle(),
+        .pid     = task_info->pid,
+        .queued  = true,
+    };
+
+    portENTER_CRITICAL(&futex_lock);
+    if (atomic_load((atomic_int *)address) != expected) {
+        portEXIT_CRITICAL(&futex_lock);
+        task_info->_errno = EAGAIN;
+        return -1;
+    }
+    waiter.next   = futex_waiters;
+    futex_waiters = &waiter;
+    portEXIT_CRITICAL(&futex_lock);
+
+    TickType_t timeout = timeout_msec == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_msec);
+    TickType_t start   = xTaskGetTickCount();
+    while (1) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        TickType_t wait    = timeout == portMAX_DELAY ? portMAX_DELAY : timeout - MIN(elapsed, timeout);
+        // A late wake up from an earlier wait can end this one early, hence the loop
+        ulTaskNotifyTakeIndexed(TASK_NOTIFY_INDEX_FUTEX, pdTRUE, wait);
+
+        portENTER_CRITICAL(&futex_lock);
+        bool woken     = !waiter.queued;
+        bool timed_out = !woken && timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout;
+        if (timed_out) {
+            futex_unlink(&waiter);
+        }
+        portEXIT_CRITICAL(&futex_lock);
+
+        if (woken) {
+            return 0;
+        }
+        if (timed_out) {
+            task_info->_errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+int futex_wake(int *address, int count) {
+    task_info_t *task_info = get_task_info();
+
+    if (!futex_address_valid(task_info->thread, address)) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    return count > 0 ? futex_wake_thread(task_info->thread, (uintptr_t)address, count) : 0;
+}
+
+bool thread_alive(pid_t pid) {
+    task_info_t *task_info = get_task_info();
+
+    if (pid <= 0 || pid > MAX_PID) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t *target = process_table[pid];
+    bool         alive  = target && target->thread == task_info->thread && eTaskGetState(target->handle) != eDeleted;
+
+    xSemaphoreGive(process_table_lock);
+    return alive;
+}
+
+bool thread_notify(pid_t pid) {
+    task_info_t *task_info = get_task_info();
+
+    if (pid <= 0 || pid > MAX_PID) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t *target = process_table[pid];
+    bool         notify = target && target->thread == task_info->thread && eTaskGetState(target->handle) != eDeleted;
+    if (notify) {
+        xTaskNotifyGiveIndexed(target->handle, TASK_NOTIFY_INDEX_USER);
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return notify;
+}
+
+bool thread_notify_wait(uint32_t timeout_msec) {
+    TickType_t wait = timeout_msec == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_msec);
+    return ulTaskNotifyTakeIndexed(TASK_NOTIFY_INDEX_USER, pdTRUE, wait) != 0;
+}
+
+void IRAM_ATTR task_switched_in_hook(TaskHandle_t volatile *handle) {
+    task_info_t *task_info = get_task_info_tcb();
+    bool         user      = task_info && task_info->pid;
+    uint32_t     start     = esp_cpu_get_cycle_count();
+    // ESP_DRAM_LOGW(DRAM_STR("task_switched_hook"), "Switching to task %u, heap_start %p, heap_end %p",
+    // task_info->pid, (void*)task_info->thread_start, (void*)task_info->thread_end);
+    bool remapped = remap_task(user ? task_info : NULL);
+    trace_event(TRACE_SWITCH_IN, (uintptr_t)*handle, 0);
+    if (!user) {
+        return;
+    }
+
+    // The unmap of whoever ran before is charged to us, it's what we waited on
+    if (remapped) {
+        uint32_t cycles          = esp_cpu_get_cycle_count() - start;
+        task_info->remap_cycles += cycles;
+        ++task_info->remaps;
+        trace_event(TRACE_REMAP, cycles, 0);
+    }
+    task_info->switched_in_us = esp_timer_get_time();
+
+    if (task_info->stack_guard) {
+        esp_cpu_set_watchpoint(
+            STACK_GUARD_WATCHPOINT,
+            (void *)task_info->stack_guard,
+            STACK_GUARD_SIZE,
+            ESP_CPU_WATCHPOINT_STORE
+        );
+    }
+}
+
+void IRAM_ATTR task_switched_out_hook(TaskHandle_t volatile *handle, int preempted) {
+    task_info_t *task_info = get_task_info();
+    bool         user      = task_info && task_info->pid;
+    trace_event(TRACE_SWITCH_OUT, (uintptr_t)*handle, preempted);
+    cache_counters_fold(user ? &task_info->cache : NULL);
+    if (user) {
+        // ESP_DRAM_LOGW(DRAM_STR("task_switched_hook"), "Switching to task %u, heap_start %p, heap_end %p",
+        // task_info->pid, (void*)task_info->thread_start, (void*)task_info->thread_end);
+        unmap_task(task_info);
+        esp_cpu_clear_watchpoint(STACK_GUARD_WATCHPOINT);
+
+        // In microseconds, mcycle is only 32 bits and a task may run a while without switching
+        int64_t run_us                  = esp_timer_get_time() - task_info->switched_in_us;
+        task_info->run_us              += run_us;
+        core_user_us[xPortGetCoreID()] += run_us;
+        if (preempted) {
+            ++task_info->switches_involuntary;
+        } else {
+            ++task_info->switches_voluntary;
+        }
+    }
+}
+
+uint32_t get_num_tasks() {
+    return num_tasks;
+}
+
+// Every task of the address space but the caller, with process_table_lock held
+static void process_suspend_tasks(task_thread_t *thread, bool suspend) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    for (int i = 1; i < MAX_PID; ++i) {
+        if (!process_table[i] || process_table[i]->thread != thread || process_table[i]->handle == self) {
+            continue;
+        }
+
+        TaskHandle_t handle = process_table[i]->handle;
+        if (suspend) {
+            vTaskSuspend(handle);
+            continue;
+        }
+
+        // A process that suspended itself gives up the lock before it gets there
+        eTaskState state;
+        while ((state = eTaskGetState(handle)) == eReady || state == eRunning) {
+            vTaskDelay(1);
+        }
+        vTaskResume(handle);
+    }
+}
+
+// With process_table_lock held, so Hades doesn't destroy the windows. The
+// tasks of the process are suspended, nothing links or unlinks meanwhile.
+static void process_park_windows(task_thread_t *thread, bool parked) {
+    for (task_resource_t *res = thread->linked_resources; res; res = res->next) {
+        if (res->type == RES_WINDOW) {
+            window_park_task((window_handle_t)res->ptr, parked);
+        }
+    }
+}
+
+// Runs on USER_TASK_CORE, where the suspended address space is no longer mapped
+// once we run. If anything fails the process just stays in memory.
+static void process_hibernate(task_thread_t *thread, pid_t pid) {
+    snprintf(thread->hibernate_path, sizeof(thread->hibernate_path), HIBERNATE_PATH, pid);
+
+    int fd = why_open(thread->hibernate_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ESP_LOGW(TAG, "Unable to open %s, PID %d stays in memory", thread->hibernate_path, pid);
+        return;
+    }
+
+    size_t pages = heap_hibernate(thread, fd);
+    why_close(fd);
+    if (!pages) {
+        why_unlink(thread->hibernate_path);
+        return;
+    }
+
+    thread->hibernated_pages = pages;
+    ESP_LOGW(TAG, "Hibernated %zu pages of PID %d to %s", pages, pid, thread->hibernate_path);
+}
+
+bool process_suspend(pid_t pid, bool hibernate) {
+    task_thread_t *self = get_task_info()->thread;
+
+    if (pid <= 0 || pid > MAX_PID) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    // Keep the address space around in case Hades reaps the process while we hibernate it
+    task_info_t   *task_info = process_table[pid];
+    task_thread_t *thread    = NULL;
+    if (task_info && !task_info->thread->suspended) {
+        thread = task_thread_ref(task_info->thread);
+    }
+
+    if (thread) {
+        process_suspend_tasks(thread, true);
+        process_park_windows(thread, true);
+        thread->suspended = true;
+    }
+    xSemaphoreGive(process_table_lock);
+
+    if (!thread) {
+        return false;
+    }
+
+    ESP_LOGW(TAG, "Suspended PID %d", pid);
+    if (thread == self) {
+        // Our address space is in use, it can't be hibernated
+        task_thread_destroy(thread);
+        vTaskSuspend(NULL);
+        return true;
+    }
+
+    if (hibernate && xPortGetCoreID() == USER_TASK_CORE) {
+        process_hibernate(thread, pid);
+    }
+
+    task_thread_destroy(thread);
+    return true;
+}
+
+bool process_resume(pid_t pid) {
+    if (pid <= 0 || pid > MAX_PID) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t   *task_info = process_table[pid];
+    task_thread_t *thread    = NULL;
+    if (task_info && task_info->thread->suspended) {
+        thread = task_thread_ref(task_info->thread);
+    }
+    xSemaphoreGive(process_table_lock);
+
+    if (!thread) {
+        return false;
+    }
+
+    if (thread->hibernated_pages) {
+        int  fd     = why_open(thread->hibernate_path, O_RDONLY, 0);
+        bool thawed = fd >= 0 && heap_thaw(thread, fd);
+        if (fd >= 0) {
+            why_close(fd);
+        }
+
+        if (!thawed) {
+            ESP_LOGW(TAG, "Unable to bring PID %d back from %s", pid, thread->hibernate_path);
+            task_thread_destroy(thread);
+            return false;
+        }
+
+        why_unlink(thread->hibernate_path);
+        thread->hibernated_pages = 0;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+    thread->suspended = false;
+    process_park_windows(thread, false);
+    process_suspend_tasks(thread, false);
+    xSemaphoreGive(process_table_lock);
+
+    ESP_LOGW(TAG, "Resumed PID %d", pid);
+    task_thread_destroy(thread);
+    return true;
+}
+
+bool process_kill(pid_t pid) {
+    task_info_t *self = get_task_info();
+
+    if (pid <= 0 || pid > MAX_PID) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    // Hades does the rest, like when the process returns from main()
+    task_info_t *task_info = process_table[pid];
+    bool         killed    = task_info && task_info->parent_info == self && task_info->thread != self->thread &&
+                    eTaskGetState(task_info->handle) != eDeleted;
+    if (killed) {
+        vTaskDelete(task_info->handle);
+    }
+
+    xSemaphoreGive(process_table_lock);
+
+    if (killed) {
+        ESP_LOGW(TAG, "Killed PID %d", pid);
+    }
+    return killed;
+}
+
+bool process_stats_get(pid_t pid, process_stats_t *stats) {
+    if (pid <= 0 || pid > MAX_PID || !stats) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t *task_info = process_table[pid];
+    if (task_info) {
+        // Updated from the switch hooks of another core, a torn read is off by one switch at most
+        *stats = (process_stats_t){
+            .pid                  = pid,
+            .run_us               = task_info->run_us,
+            .remap_cycles         = task_info->remap_cycles,
+            .remaps               = task_info->remaps,
+            .switches_voluntary   = task_info->switches_voluntary,
+            .switches_involuntary = task_info->switches_involuntary,
+            .cache                = task_info->cache,
+        };
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return task_info != NULL;
+}
+
+bool process_syscall_stats_get(pid_t pid, syscall_stats_t *stats) {
+    if (pid <= 0 || pid > MAX_PID || !stats) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t *task_info = process_table[pid];
+    if (task_info) {
+        // Still being counted, like process_stats_get() a read can be off by a call
+        syscall_histogram_t *histograms = atomic_load(&task_info->thread->syscall_histograms);
+        *stats                          = (syscall_stats_t){.pid = pid};
+        if (histograms) {
+            memcpy(stats->syscalls, histograms, sizeof(stats->syscalls));
+        }
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return task_info != NULL;
+}
+
+bool process_launch_get(pid_t pid, process_launch_t *launch) {
+    if (pid <= 0 || pid > MAX_PID || !launch) {
+        return false;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t *task_info = process_table[pid];
+    if (task_info) {
+        // Filled in by the process as it starts, a launch in progress reads as partly done
+        *launch     = task_info->thread->launch;
+        launch->pid = pid;
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return task_info != NULL;
+}
+
+void task_launch_presented(void) {
+    task_info_t *task_info = get_task_info();
+    if (task_info == &kernel_task || task_info->thread->launch.first_present_us) {
+        return;
+    }
+
+    // Never 0, that is not yet
+    uint32_t first_present_us                  = esp_timer_get_time() - task_info->thread->launch_start_us;
+    task_info->thread->launch.first_present_us = MAX(first_present_us, 1);
+    ESP_LOGI(TAG, "PID %d presented its first frame %lu us after it was created", task_info->pid, first_present_us);
+
+    static atomic_bool presented;
+    if (!atomic_exchange(&presented, true)) {
+        boot_profile_mark("first_app_frame");
+    }
+}
+
+void cpu_stats_get(cpu_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+
+    *stats = (cpu_stats_t){
+        .timestamp_us = esp_timer_get_time(),
+        .cpu_hz       = esp_clk_cpu_freq(),
+        .num_cores    = MIN(portNUM_PROCESSORS, CPU_STATS_MAX_CORES),
+    };
+    for (int i = 0; i < stats->num_cores; ++i) {
+        stats->user_us[i] = core_user_us[i];
+        cache_counters_get(i, &stats->cache[i]);
+    }
+}
+
+bool process_info_get(pid_t pid, process_info_t *info) {
+    if (pid < 0 || pid > MAX_PID || !info) {
+        return false;
+    }
+
+    // Hades takes a process out of the table before he destroys it
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    task_info_t *task_info = process_table[pid];
+    if (!task_info) {
+        xSemaphoreGive(process_table_lock);
+        return false;
+    }
+
+    task_thread_t *thread = task_info->thread;
+
+    *info = (process_info_t){
+        .pid               = pid,
+        .parent            = task_info->parent,
+        .is_thread         = task_info->type == TASK_TYPE_THREAD,
+        .stack_size        = task_info->stack_size,
+        .heap_pages        = thread->size / SOC_MMU_PAGE_SIZE,
+        .heap_peak_pages   = thread->peak_size / SOC_MMU_PAGE_SIZE,
+        .shared_pages      = thread->shared_pages,
+        .heap_used         = thread->end - thread->start,
+        .heap_used_peak    = thread->peak_end > thread->start ? thread->peak_end - thread->start : 0,
+        .framebuffer_pages = atomic_load(&thread->framebuffer_pages),
+        .dma_pages         = atomic_load(&thread->dma_pages),
+        .fast_bytes        = atomic_load(&thread->fast_bytes),
+        .suspended         = thread->suspended,
+        .hibernated_pages  = thread->hibernated_pages,
+    };
+
+    if (task_info->type != TASK_TYPE_THREAD && task_info->file_path) {
+        char const *name = strrchr(task_info->file_path, '/');
+        snprintf(info->name, sizeof(info->name), "%s", name ? name + 1 : task_info->file_path);
+    }
+
+    info->kernel_objects += thread->num_linked_resources;
+    for (int i = 0; i < RES_RESOURCE_TYPE_MAX; ++i) {
+        if (thread->resources[i]) {
+            info->kernel_objects += kh_size(thread->resources[i]);
+        }
+    }
+    if (thread->resources[RES_OPEN]) {
+        info->open_files = kh_size(thread->resources[RES_OPEN]);
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return true;
+}
+
+size_t process_list(pid_t *pids, size_t max) {
+    size_t count = 0;
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    for (pid_t pid = 1; pid <= MAX_PID; ++pid) {
+        if (process_table[pid]) {
+            if (count < max) {
+                pids[count] = pid;
+            }
+            ++count;
+        }
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return count;
+}
+
+static void IRAM_ATTR hades(void *ignored) {
+    pid_t dead_pid;
+
+    while (1) {
+        // Block until a task dies
+        if (xQueueReceive(hades_queue, &dead_pid, portMAX_DELAY) == pdTRUE) {
+            ESP_LOGW("HADES", "Stripping PID %d of its worldy possessions", dead_pid);
+
+            task_info_t *task_info = process_table[dead_pid];
+            if (task_info) {
+                switch (task_info->type) {
+                    case TASK_TYPE_ELF_PATH: // Fallthrough
+                    case TASK_TYPE_ELF:      // Fallthrough
+                    case TASK_TYPE_THREAD: break;
+                    default: ESP_LOGE("HADES", "Unknown task type %i", task_info->type);
+                }
+
+                pid_t parent_pid = task_info->parent;
 
                 process_table_remove_task(task_info);
+                futex_task_died(task_info);
+                if (task_info->malloc_arena) {
+                    atomic_store(&task_info->malloc_arena->in_use, false);
+                }
                 task_thread_destroy(task_info->thread);
-                task_info_delete(task_info);
 
                 if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
                     ESP_LOGE(TAG, "Failed to get process table mutex");
@@ -617,28 +1919,29 @@ static void IRAM_ATTR hades(void *ignored) {
                 }
 
                 // If this process had a parent, and it is still alive, signal it.
-                if (process_table[parent_pid]) {
+                if (process_table[parent_pid] && !task_info->detached) {
                     if (xQueueSend(process_table[parent_pid]->children, &dead_pid, 0) != pdTRUE) {
                         ESP_LOGW("HADES", "Unable to inform parent of their child's journey");
                     }
+                    wait_wake(&process_table[parent_pid]->child_waiter);
                 }
 
                 // Clean up any child processes or threads this process might have left behind
-                for (int i = 1; i < MAX_PID; ++i) {
-                    if (process_table[i] && process_table[i]->parent == dead_pid) {
-                        // See you soon...
-                        vTaskDelete(process_table[i]->handle);
+                for (task_info_t *child = task_info->first_child; child; child = child->next_sibling) {
+                    // See you soon...
+                    child->parent_info = NULL;
+                    if (eTaskGetState(child->handle) != eDeleted) {
+                        vTaskDelete(child->handle);
                     }
                 }
 
                 xSemaphoreGive(process_table_lock);
+                task_info_delete(task_info);
 
                 // Don't free our PID until the last moment
                 pid_free(dead_pid);
                 ESP_LOGW("HADES", "Task %d escorted to my realm", dead_pid);
                 --num_tasks;
-                // Give FreeRTOS a chance to catch up
-                vTaskDelay(10 / portTICK_PERIOD_MS);
             } else {
                 ESP_LOGE("HADES", "Task %d has no task info?", dead_pid);
             }
@@ -646,6 +1949,70 @@ static void IRAM_ATTR hades(void *ignored) {
     }
 }
 
+// Dead user tasks are freed by the idle task of their core, which only runs
+// once everything else there is blocked
+static bool IRAM_ATTR zeus_idle_hook(void) {
+    if (atomic_exchange(&zeus_idle_wait, false)) {
+        xTaskNotifyGiveIndexed(zeus_handle, 1);
+    }
+    return true;
+}
+
+static BaseType_t zeus_task_create(
+    TaskFunction_t entry, char const *name, uint16_t stack_size, UBaseType_t priority, void *param, TaskHandle_t *task
+) {
+    uint32_t   depth = stack_size + 2 * STACK_GUARD_SIZE;
+    BaseType_t res   = xTaskCreatePinnedToCore(entry, name, depth, param, priority, task, USER_TASK_CORE);
+    if (res == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY) {
+        ESP_LOGW("ZEUS", "Out of memory for a stack, waiting for the dead to be cleared away");
+        atomic_store(&zeus_idle_wait, true);
+        ulTaskNotifyTakeIndexed(1, pdTRUE, pdMS_TO_TICKS(ZEUS_IDLE_WAIT_MS));
+        atomic_store(&zeus_idle_wait, false);
+        res = xTaskCreatePinnedToCore(entry, name, depth, param, priority, task, USER_TASK_CORE);
+    }
+    return res;
+}
+
+// A process without a program, it waits until Zeus hands it one
+static void zygote_task(void *ti) {
+    ulTaskNotifyTakeIndexed(0, pdTRUE, portMAX_DELAY);
+    generic_task(ti);
+}
+
+// Spawn the next process ahead of time: its task, stack and empty address
+// space. Only when memory is plentiful, it would hold on to all of that.
+static void zygote_spawn(void) {
+    if (memory_pressure_get() != MEMORY_PRESSURE_NONE) {
+        return;
+    }
+
+    task_info_t *task_info = task_info_init();
+    if (!task_info) {
+        return;
+    }
+
+    task_info->thread = task_thread_init((uintptr_t)VADDR_TASK_START, (task_config_t){0});
+    if (!task_info->thread) {
+        task_info_delete(task_info);
+        return;
+    }
+    task_info->malloc_arena = &task_info->thread->malloc_arena;
+    task_info->stack_size   = MIN_STACK_SIZE;
+
+    TaskHandle_t handle;
+    if (zeus_task_create(zygote_task, "Zygote", MIN_STACK_SIZE, TASK_PRIORITY, task_info, &handle) != pdPASS) {
+        task_thread_destroy(task_info->thread);
+        task_info_delete(task_info);
+        return;
+    }
+
+    task_info->handle      = handle;
+    task_info->stack_guard = ((uintptr_t)pxTaskGetStackStart(handle) + STACK_GUARD_SIZE - 1) & ~(STACK_GUARD_SIZE - 1);
+    vTaskSetThreadLocalStoragePointer(handle, 1, task_info);
+    vTaskSetApplicationTaskTag(handle, (void *)0x12345678);
+    zygote = task_info;
+}
+
 static void IRAM_ATTR zeus(void *ignored) {
     zeus_command_message_t command;
 #if (NUM_PIDS > 999)
@@ -655,8 +2022,12 @@ static void IRAM_ATTR zeus(void *ignored) {
     char task_name[5 + 3 + 1];
 
     while (1) {
-        // Block until a new tasks wants to be born
-        if (xQueueReceive(zeus_queue, &command, portMAX_DELAY) == pdTRUE) {
+        // Block until a new tasks wants to be born, the foreground goes first. Once
+        // nobody did for a while, spawn the next one.
+        TickType_t timeout = zygote ? portMAX_DELAY : pdMS_TO_TICKS(ZYGOTE_DELAY_MS);
+        if (!service_queue_receive(&zeus_queue, &command, timeout)) {
+            zygote_spawn();
+        } else {
             task_info_t *task_info = NULL;
             pid_t        pid       = pid_allocate();
             if (pid <= 0) {
@@ -666,37 +2037,70 @@ static void IRAM_ATTR zeus(void *ignored) {
 
             command.stack_size = command.stack_size < MIN_STACK_SIZE ? MIN_STACK_SIZE : command.stack_size;
 
-            task_info = task_info_init();
+            // Programs on the default stack can take the process spawned ahead
+            bool from_zygote = zygote && command.type == TASK_TYPE_ELF_PATH && command.stack_size == MIN_STACK_SIZE;
+            if (from_zygote) {
+                task_info = zygote;
+                zygote    = NULL;
+            } else {
+                task_info = task_info_init();
+            }
             if (!task_info) {
                 ESP_LOGW(TAG, "Cannot allocate task info");
                 goto error;
             }
 
-            if (command.type == TASK_TYPE_THREAD) {
-                task_info->thread = task_thread_ref(command.parent_task_info->thread);
+            if (from_zygote) {
+                task_thread_configure(task_info->thread, command.config);
+                task_info->thread->launch_start_us = command.sent_us;
+                task_info->thread->launch_lap_us   = command.sent_us;
+            } else if (command.type == TASK_TYPE_THREAD) {
+                if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+                    ESP_LOGE(TAG, "Failed to get process table mutex");
+                    abort();
+                }
+                // The parent may have been killed while the request was queued
+                if (process_table_parent_alive(command.parent_pid, command.parent_task_info)) {
+                    task_info->thread = task_thread_ref(command.parent_task_info->thread);
+                }
+                xSemaphoreGive(process_table_lock);
+
                 if (!task_info->thread) {
                     ESP_LOGW(TAG, "Tried to create a thread from a dying parent, even I can't do this");
                     goto error;
                 }
+                task_info->malloc_arena = malloc_arena_claim(task_info->thread);
+                if (!task_info->malloc_arena) {
+                    ESP_LOGW(TAG, "Cannot allocate a heap arena for the thread");
+                    goto error;
+                }
             } else {
-                task_info->thread = task_thread_init((uintptr_t)VADDR_TASK_START);
+                task_info->thread = task_thread_init((uintptr_t)VADDR_TASK_START, command.config);
                 if (!task_info->thread) {
                     ESP_LOGW(TAG, "Cannot allocate task heap");
                     goto error;
                 }
+                task_info->malloc_arena            = &task_info->thread->malloc_arena;
+                task_info->thread->launch_start_us = command.sent_us;
+                task_info->thread->launch_lap_us   = command.sent_us;
             }
             // ESP_LOGI(TAG, "Setting watchpoint on %p core %i", &task_info->pad, esp_cpu_get_core_id());
             // esp_cpu_set_watchpoint(0, &task_info->pad, 4, ESP_CPU_WATCHPOINT_STORE);
 
             task_info->pid        = pid;
             task_info->type       = command.type;
-            task_info->parent     = command.parent_task_info->pid;
+            task_info->parent     = command.parent_pid;
             task_info->buffer     = command.buffer;
             task_info->file_path  = NULL;
             task_info->argc       = command.argc;
             task_info->argv       = command.argv;
             task_info->argv_size  = command.argv_size;
             task_info->stack_size = command.stack_size;
+            task_info->priority   = command.priority;
+            // A batch process only gets the CPU when nothing else wants it
+            if (command.config.cpu_class == APPLICATION_CPU_BATCH) {
+                task_info->priority = TASK_PRIORITY_LOW;
+            }
 
             // In case someone tries something clever
             task_info->argv_back = task_info->argv;
@@ -719,17 +2123,39 @@ static void IRAM_ATTR zeus(void *ignored) {
             }
 
             ESP_LOGI("ZEUS", "Breathing life into PID %d", task_info->pid);
+            governor_boost();
             snprintf(task_name, 9, "Task %u", task_info->pid);
 
-            TaskHandle_t new_task;
-            BaseType_t   res =
-                xTaskCreatePinnedToCore(task_entry, task_name, task_info->stack_size, param, 5, &new_task, 1);
+            TaskHandle_t new_task = task_info->handle;
+            BaseType_t   res      = pdPASS;
+            if (from_zygote) {
+                vTaskPrioritySet(new_task, task_info->priority);
+            } else {
+                res = zeus_task_create(
+                    task_entry,
+                    task_name,
+                    task_info->stack_size,
+                    task_info->priority,
+                    param,
+                    &new_task
+                );
+            }
             if (res == pdPASS) {
                 // Since Zeus is the highest priority task on the core the task should never be able to run
-                task_info->handle = new_task;
-                process_table_add_task(task_info);
+                task_info->handle      = new_task;
+                task_info->stack_guard =
+                    ((uintptr_t)pxTaskGetStackStart(new_task) + STACK_GUARD_SIZE - 1) & ~(STACK_GUARD_SIZE - 1);
+                if (!process_table_add_task(task_info, command.parent_pid, command.parent_task_info)) {
+                    // It never ran, so there is nothing for Hades to do
+                    ESP_LOGW("ZEUS", "The parent of PID %d died while it was on its way", task_info->pid);
+                    vTaskDelete(new_task);
+                    goto error;
+                }
                 vTaskSetThreadLocalStoragePointer(new_task, 1, task_info);
                 vTaskSetApplicationTaskTag(new_task, (void *)0x12345678);
+                if (from_zygote) {
+                    xTaskNotifyGiveIndexed(new_task, 0);
+                }
                 ESP_LOGV("ZEUS", "PID %d sprung forth fully formed from my forehead", task_info->pid);
                 ++num_tasks;
                 goto out;
@@ -737,6 +2163,13 @@ static void IRAM_ATTR zeus(void *ignored) {
         error:
             ESP_LOGE("ZEUS", "Process could not be started, too good for this world");
             pid_free(pid);
+            pid = -1;
+            if (task_info && task_info->malloc_arena) {
+                atomic_store(&task_info->malloc_arena->in_use, false);
+            }
+            if (task_info) {
+                task_thread_destroy(task_info->thread);
+            }
             task_info_delete(task_info);
         out:
             if (command.caller) {
@@ -744,8 +2177,6 @@ static void IRAM_ATTR zeus(void *ignored) {
                     xTaskNotifyIndexed(command.caller, 0, pid, eSetValueWithOverwrite);
                 }
             }
-            // Give FreeRTOS a chance to catch up
-            vTaskDelay(50 / portTICK_PERIOD_MS);
         }
     }
 }
@@ -792,7 +2223,7 @@ void task_priority_lower() {
 void task_priority_restore() {
     task_info_t *task_info = get_task_info();
     if (eTaskGetState(task_info->handle) != eDeleted) {
-        vTaskPrioritySet(task_info->handle, TASK_PRIORITY);
+        vTaskPrioritySet(task_info->handle, task_info->priority);
     }
 }
 
@@ -833,6 +2264,53 @@ out:
     return ret;
 }
 
+pid_t task_application_pid(char const *unique_id) {
+    if (!unique_id) {
+        return -1;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    pid_t ret = -1;
+    for (int i = 1; i < MAX_PID; ++i) {
+        if (process_table[i] && process_table[i]->application_uid &&
+            (strcmp(process_table[i]->application_uid, unique_id) == 0)) {
+            ret = i;
+            break;
+        }
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return ret;
+}
+
+char *task_application_uid(void) {
+    task_info_t *task_info = get_task_info();
+    if (!task_info->pid) {
+        return NULL;
+    }
+
+    if (xSemaphoreTake(process_table_lock, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to get process table mutex");
+        abort();
+    }
+
+    // Only the main thread has it
+    char *ret = NULL;
+    for (int i = 1; i < MAX_PID; ++i) {
+        if (process_table[i] && process_table[i]->thread == task_info->thread && process_table[i]->application_uid) {
+            ret = strdup(process_table[i]->application_uid);
+            break;
+        }
+    }
+
+    xSemaphoreGive(process_table_lock);
+    return ret;
+}
+
 bool task_init() {
     ESP_DRAM_LOGI(DRAM_STR("task_init"), "Initializing");
 
@@ -868,7 +2346,7 @@ bool task_init() {
     vTaskSetThreadLocalStoragePointer(NULL, 1, &kernel_task);
     vTaskSetApplicationTaskTag(NULL, (void *)0x12345678);
 
-    process_table_add_task(&kernel_task);
+    process_table_add_task(&kernel_task, 0, NULL);
 
     ESP_DRAM_LOGI(DRAM_STR("task_init"), "Starting Hades process");
     hades_queue = xQueueCreate(16, sizeof(pid_t));
@@ -879,22 +2357,25 @@ bool task_init() {
 
     // Hades has higher priority than Zeus. This prevents dead tasks from piling up
     // while Zeus tries to spawn new ones
-    if (create_kernel_task(hades, "Hades", 3072, NULL, 11, &hades_handle, 1) != pdTRUE) {
+    if (create_kernel_task(hades, "Hades", 3072, NULL, HADES_PRIORITY, &hades_handle, 1) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to create HADES task");
         return false;
     }
 
     ESP_DRAM_LOGI(DRAM_STR("task_init"), "Starting Zeus process");
-    zeus_queue = xQueueCreate(1, sizeof(zeus_command_message_t));
-    if (!zeus_queue) {
+    if (!service_queue_create(&zeus_queue)) {
         ESP_LOGE(TAG, "Failed to create ZEUS queue");
         return false;
     }
 
-    if (create_kernel_task(zeus, "Zeus", 3072, NULL, 10, &zeus_handle, 1) != pdTRUE) {
+    if (create_kernel_task(zeus, "Zeus", 3072, NULL, ZEUS_PRIORITY, &zeus_handle, 1) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to create ZEUS task");
         return false;
     }
 
+    if (esp_register_freertos_idle_hook_for_cpu(zeus_idle_hook, USER_TASK_CORE) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to register the idle hook, Zeus won't wait for dead tasks to be freed");
+    }
+
     return true;
 }
@@ -16,8 +16,13 @@
 
 #pragma once
 
+#include "badgevms/application.h"
 #include "badgevms/device.h"
+#include "badgevms/hrtimer.h"
+#include "badgevms/process.h"
+#include "badgevms_config.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "memory.h"
 #include "thirdparty/dlmalloc.h"
@@ -31,11 +36,23 @@
 #define STRERROR_BUFLEN 128
 #define NUM_PIDS        128
 #define MAX_PID         127
+#define CURL_POOL_SIZE  4
+#define CURL_SESSIONS   8
 
 #define TASK_PRIORITY_LOW        4
 #define TASK_PRIORITY            5
 #define TASK_PRIORITY_FOREGROUND 6
 
+// Where applications run. Both cores share the PSRAM MMU, which holds one
+// address space at a time, and core 0 keeps switching between kernel tasks.
+#define USER_TASK_CORE 1
+
+// Notification indices 0 to 2 of user tasks belong to Zeus and the compositor
+#define TASK_NOTIFY_INDEX_USER  3
+#define TASK_NOTIFY_INDEX_FUTEX 4
+// hrtimer_wait() and wait_any()
+#define TASK_NOTIFY_INDEX_WAIT  5
+
 typedef struct kh_restable_s kh_restable_t;
 
 typedef enum {
@@ -44,11 +61,29 @@ typedef enum {
     RES_OPEN,
     RES_OTA,
     RES_WINDOW,
+    RES_OVERLAY,
     RES_DEVICE,
     RES_ESP_TLS,
+    RES_DMA_BUFFER,
+    RES_HRTIMER,
+    RES_FILE_MAP,
+    RES_SOCKET_VIEW,
+    RES_FAST_ALLOC,
     RES_RESOURCE_TYPE_MAX
 } task_resource_type_t;
 
+// Kernel objects a process owns embed this, tracking them for the cleanup when
+// the process exits is a link and an unlink instead of a hash table insert and
+// delete. Handles there is no room in, like those of libraries or LWIP, are
+// tracked with task_record_resource_alloc().
+typedef struct task_resource {
+    struct task_resource *next;
+    struct task_resource *prev;
+    task_thread_t        *thread; // The owner, NULL while not linked
+    task_resource_type_t  type;
+    void                 *ptr; // What the cleanup of type gets
+} task_resource_t;
+
 typedef enum {
     TASK_TYPE_ELF,
     TASK_TYPE_ELF_PATH,
@@ -59,38 +94,132 @@ typedef struct {
     bool      is_open;
     int       dev_fd;
     device_t *device;
+    // Of the device, copied at open so a read or write is a single indirect call
+    ssize_t (*read)(void *dev, int fd, void *buf, size_t count);
+    ssize_t (*write)(void *dev, int fd, void const *buf, size_t count);
 } file_handle_t;
 
+// Heap behaviour and budgets of a new process from its manifest, zero picks the default
 typedef struct {
+    size_t                  grow_size;
+    size_t                  trim_size;
+    size_t                  max_heap_pages;
+    size_t                  max_framebuffer_pages;
+    application_cpu_class_t cpu_class;
+    int                     frame_rate;
+    bool                    keep_image; // Pin the program image, see image_cache_pin()
+} task_config_t;
+
+// The dlmalloc state of a thread. Every thread of a process allocates from an
+// arena of its own so they don't serialize on each other, all arenas grow from
+// the break of the process. Memory freed by another thread goes back to the
+// arena it came from. Arenas live as long as the process, a thread that exits
+// leaves its arena to the next thread.
+typedef struct malloc_arena {
+    struct malloc_state          state;
+    SemaphoreHandle_t            lock;
+    atomic_bool                  in_use;
+    struct malloc_arena *_Atomic next;
+    void *_Atomic                remote_frees; // See malloc_arena_free_remote()
+} malloc_arena_t;
+
+typedef struct task_thread {
     allocation_range_t  *pages;
     uintptr_t            start;
-    uintptr_t            end;
-    size_t               size;
+    uintptr_t            end;  // The break
+    size_t               size; // Mapped from start on, can be more than end - start
+    size_t               heap_grow_size;
+    size_t               heap_trim_size;
+    // Budgets, see task_config_t, 0 for no limit
+    size_t               max_heap_pages;
+    size_t               heap_pages; // Mapped by sbrk()
+    size_t               max_framebuffer_pages;
+    int                  frame_rate;
+    uint8_t              cpu_class; // An application_cpu_class_t
+    bool                 keep_image;
+    // The MMU entries from start on, so switching to this address space is a
+    // straight copy instead of a walk over pages
+    uint32_t             mmu_entries[TASK_MMU_ENTRIES];
+    size_t               mmu_num_entries;
+    // Page aligned span of the loaded code, empty if there is none
+    uintptr_t            text_start;
+    uintptr_t            text_end;
+    uintptr_t            elf_bias; // Where the code is minus its vaddr in the ELF file, see profiler.h
+    // Hot code copied to internal SRAM, see elf_hot.h, the same for it
+    uintptr_t            hot_start;
+    uintptr_t            hot_end;
+    uintptr_t            hot_bias;
+    // Cached image mapped at start, see image_cache.h
+    struct image        *image;
+    // Shared libraries mapped behind the image, see library.h
+    struct library      *libraries[LIBRARY_MAX_NEEDED];
+    uintptr_t            library_bases[LIBRARY_MAX_NEEDED];
+    size_t               num_libraries;
+    // For process_info_get()
+    size_t               peak_size;         // Most mapped at once
+    uintptr_t            peak_end;          // Highest break
+    size_t               shared_pages;      // Mapped from the image cache, included in size
+    atomic_size_t        framebuffer_pages; // Of windows and overlays created by this address space
+    atomic_size_t        dma_pages;
+    atomic_size_t        fast_bytes;        // Of malloc_fast()
     atomic_int           refcount;
     size_t               max_memory;
     size_t               max_files;
     size_t               current_files;
     file_handle_t        file_handles[MAXFD];
-    struct malloc_state  malloc_state;
+    atomic_uint          fd_used[MAXFD / 32]; // A bit per open fd, see fd_alloc()
+    // Idle HTTP connections for the next transfer to the same origin, see curl.c
+    atomic_uintptr_t     curl_pool[CURL_POOL_SIZE];
+    // TLS sessions to resume, by origin
+    atomic_uintptr_t     curl_sessions[CURL_SESSIONS];
+    // Cookies of all curl handles, created on first use
+    atomic_uintptr_t     curl_cookie_jar;
+    // Where the time went starting the process, see process_launch_get()
+    process_launch_t     launch;
+    int64_t              launch_start_us; // Zeus was asked for it
+    int64_t              launch_lap_us;   // End of the last stage
+    // See process_suspend(), the pages are in the file at hibernate_path while hibernated
+    bool                 suspended;
+    size_t               hibernated_pages;
+    char                 hibernate_path[HIBERNATE_PATH_MAX];
+    malloc_arena_t       malloc_arena; // Of the first thread, the head of the list of arenas
+    SemaphoreHandle_t    heap_lock;    // Serializes moving the break between arenas
     struct malloc_params malloc_params;
     kh_restable_t       *resources[RES_RESOURCE_TYPE_MAX];
+    task_resource_t     *linked_resources; // See task_resource_t
+    size_t               num_linked_resources;
+    portMUX_TYPE         resource_lock;
+
+    // Looked up before the system wide ones, see logical_names.h
+    struct logical_name_table *_Atomic logical_names;
+    // Of the application, found on first use, see settings.h
+    struct settings_store *_Atomic settings;
+    // SYSCALL_MAX of them once a call was timed, see syscall_stats.h
+    syscall_histogram_t *_Atomic syscall_histograms;
 } task_thread_t;
 
 typedef struct task_info {
     // Pointers
-    TaskHandle_t   handle;
-    task_thread_t *thread;
-    void const    *buffer;
-    void          *data;
-    char          *file_path;
-    char         **argv;
-    char         **argv_back;
-    char          *strtok_saveptr;
-    char          *application_uid;
-    uint16_t       stack_size;
+    TaskHandle_t    handle;
+    task_thread_t  *thread;
+    malloc_arena_t *malloc_arena;
+    void const     *buffer;
+    void           *data;
+    char           *file_path;
+    char          **argv;
+    char          **argv_back;
+    char           *strtok_saveptr;
+    char           *application_uid;
+    uint16_t        stack_size;
+    uintptr_t       stack_guard; // Start of the watched area, see STACK_GUARD_SIZE
     void (*task_entry)(struct task_info *task_info);
     void (*thread_entry)(void *user_data);
 
+    // Processes and threads started by this one, with process_table_lock held
+    struct task_info *parent_info; // NULL once the parent is gone
+    struct task_info *first_child;
+    struct task_info *next_sibling;
+
     // Small variables
     pid_t        pid;
     pid_t        parent;
@@ -99,12 +228,34 @@ typedef struct task_info {
     task_type_t  type;
     size_t       argv_size;
     unsigned int seed;
+    UBaseType_t  priority; // What task_priority_restore() goes back to
+    bool         detached; // Its exit isn't reported to the parent, see io_ring.c
 
     // Buffers
     char strerror_buf[STRERROR_BUFLEN];
     char asctime_buf[26];
     char ctime_buf[26];
 
+    // CPU accounting, see process_stats_get()
+    int64_t          switched_in_us;
+    uint64_t         run_us;
+    uint64_t         remap_cycles;
+    uint32_t         remaps;
+    uint32_t         switches_voluntary;
+    uint32_t         switches_involuntary;
+    cache_counters_t cache; // See cache_counters.h
+
+    // For usleep() and nanosleep(), made on first use, see hrtimer_private.h
+    hrtimer_t *sleep_timer;
+
+    // Multi-source waits, see wait_private.h
+    struct wait_source *wait_sources; // In wait_any() on these
+    int                 wait_num_sources;
+    struct wait_list   *wait_lists[WAIT_MAX_DEVICES]; // Of the devices among them
+    int                 wait_num_lists;
+    atomic_uintptr_t    child_waiter; // Woken when a child exits
+    int                 wait_eventfd; // Written to wake a select() on sockets, 0 until the first one
+
     // Structured
     struct tm     gmtime_tm;
     struct tm     localtime_tm;
@@ -114,8 +265,17 @@ typedef struct task_info {
 } task_info_t;
 
 extern task_info_t kernel_task;
+// Set by every user task before it runs anything else, kernel tasks keep the
+// initial &kernel_task. A TLS variable is a single load off the thread pointer.
+extern __thread task_info_t *current_task_info;
 
 __attribute__((always_inline)) inline static task_info_t *get_task_info() {
+    return current_task_info;
+}
+
+// The same, from the TCB of the task scheduled on this core. The context switch
+// hooks need this, they run before the thread pointer of the new task is loaded.
+__attribute__((always_inline)) inline static task_info_t *get_task_info_tcb() {
     if (xTaskGetApplicationTaskTag(NULL) == (void *)0x12345678) {
         return pvTaskGetThreadLocalStoragePointer(NULL, 1);
     }
@@ -123,14 +283,32 @@ __attribute__((always_inline)) inline static task_info_t *get_task_info() {
 }
 
 bool         task_init();
-pid_t        run_task(void const *buffer, uint16_t stack_size, task_type_t type, int argc, char *argv[]);
-pid_t        run_task_path(char const *path, uint16_t stack_size, task_type_t type, int argc, char *argv[]);
+pid_t        run_task(
+    void const *buffer, uint16_t stack_size, task_type_t type, int argc, char *argv[], task_config_t const *config
+);
+pid_t        run_task_path(
+    char const *path, uint16_t stack_size, task_type_t type, int argc, char *argv[], task_config_t const *config
+);
 void         task_record_resource_alloc(task_resource_type_t type, void *ptr);
 void         task_record_resource_free(task_resource_type_t type, void *ptr);
+// Whether ptr was recorded for the calling process, always for kernel tasks
+bool         task_record_resource_owned(task_resource_type_t type, void *ptr);
+// Link res to the calling process, ptr is what the cleanup of type gets
+void         task_resource_link(task_resource_t *res, task_resource_type_t type, void *ptr);
+void         task_resource_unlink(task_resource_t *res);
+// Whether res is linked to the calling process, always for kernel tasks
+bool         task_resource_owned(task_resource_t const *res);
 void         task_set_application_uid(pid_t pid, char const *unique_id);
 bool         task_application_is_running(char const *unique_id);
+// The process running unique_id, -1 if there is none
+pid_t        task_application_pid(char const *unique_id);
+// The application the process of the caller was launched as, the caller should
+// free() it. NULL if it wasn't launched as one.
+char        *task_application_uid(void);
 uint32_t     get_num_tasks();
 task_info_t *get_taskinfo_for_pid(pid_t pid);
+// The caller presented a window, the first time that completes its launch report
+void         task_launch_presented(void);
 
 BaseType_t create_kernel_task(
     TaskFunction_t      pvTaskCode,
@@ -141,3 +319,10 @@ BaseType_t create_kernel_task(
     TaskHandle_t *const pvCreatedTask,
     BaseType_t const    xCoreID
 );
+
+// Give ptr back to arena without taking its lock, for frees from a context that
+// shouldn't wait for it. The chunks are linked through their first word and
+// freed by the next allocation from the arena.
+void malloc_arena_free_remote(malloc_arena_t *arena, void *ptr);
+// Free what malloc_arena_free_remote() left, with the lock of arena held
+void malloc_arena_drain(malloc_arena_t *arena);
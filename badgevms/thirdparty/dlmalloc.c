@@ -5103,6 +5103,12 @@ int mspace_trim(mspace msp, size_t pad) {
   return result;
 }
 
+/* BadgeVMS: lets memory freed by another thread go back to its arena */
+int mspace_owns(mspace msp, void* mem) {
+  mstate ms = (mstate)msp;
+  return is_initialized(ms) && segment_holding(ms, (char*)mem) != 0;
+}
+
 #if !NO_MALLOC_STATS
 void mspace_malloc_stats(mspace msp) {
   mstate ms = (mstate)msp;
@@ -604,6 +604,8 @@ size_t mspace_bulk_free(mspace msp, void**, size_t n_elements);
 size_t mspace_usable_size(const void* mem);
 void mspace_malloc_stats(mspace msp);
 int mspace_trim(mspace msp, size_t pad);
+/* BadgeVMS: whether mem lies in memory obtained by msp */
+int mspace_owns(mspace msp, void* mem);
 size_t mspace_footprint(mspace msp);
 size_t mspace_max_footprint(mspace msp);
 size_t mspace_footprint_limit(mspace msp);
@@ -647,8 +649,11 @@ void mspace_inspect_all(mspace msp,
 #define USE_LOCK_BIT               (0U)
 #define INITIAL_LOCK(l)            (0)
 #define DESTROY_LOCK(l)            (0)
-#define ACQUIRE_MALLOC_GLOBAL_LOCK()
-#define RELEASE_MALLOC_GLOBAL_LOCK()
+/* BadgeVMS: the arenas of the threads of a process share its break */
+void heap_lock_take(void);
+void heap_lock_give(void);
+#define ACQUIRE_MALLOC_GLOBAL_LOCK() heap_lock_take()
+#define RELEASE_MALLOC_GLOBAL_LOCK() heap_lock_give()
 #define ACQUIRE_LOCK(lk) 
 #define RELEASE_LOCK(lk) 
 #define TRY_LOCK(lk) 
@@ -0,0 +1,103 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "task.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#if TRACE_EVENTS
+
+_Static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS must be a power of two");
+
+typedef struct {
+    uint32_t time_us; // Low bits of esp_timer_get_time(), wraps after 71 minutes
+    uint8_t  type;
+    uint16_t pid;
+    uint32_t a;
+    uint32_t b;
+} trace_record_t;
+
+typedef struct {
+    // Only its own core writes a ring. An interrupt that comes in while a record
+    // is written claims the next one, so the ring is in order give or take one.
+    atomic_uint    head;
+    trace_record_t records[TRACE_EVENTS];
+} trace_ring_t;
+
+static DRAM_ATTR trace_ring_t trace_rings[portNUM_PROCESSORS];
+static atomic_bool            trace_paused;
+
+void IRAM_ATTR trace_event(trace_event_type_t type, uint32_t a, uint32_t b) {
+    if (atomic_load_explicit(&trace_paused, memory_order_relaxed)) {
+        return;
+    }
+
+    // Called from the context switch hooks too, where the thread pointer is still the previous task's
+    trace_ring_t *ring = &trace_rings[xPortGetCoreID()];
+    uint32_t      head = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+
+    ring->records[head & (TRACE_EVENTS - 1)] = (trace_record_t){
+        .time_us = (uint32_t)esp_timer_get_time(),
+        .type    = type,
+        .pid     = get_task_info_tcb()->pid,
+        .a       = a,
+        .b       = b,
+    };
+}
+
+void trace_dump(void) {
+    bool paused = atomic_exchange(&trace_paused, true);
+
+    esp_rom_printf("TRACE BEGIN %u\n", portNUM_PROCESSORS);
+    for (int core = 0; core < portNUM_PROCESSORS; ++core) {
+        trace_ring_t *ring  = &trace_rings[core];
+        uint32_t      head  = atomic_load(&ring->head);
+        uint32_t      first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+
+        for (uint32_t i = first; i != head; ++i) {
+            trace_record_t const *record = &ring->records[i & (TRACE_EVENTS - 1)];
+            esp_rom_printf(
+                "TRACE %d %08lx %u %u %08lx %08lx\n",
+                core,
+                (unsigned long)record->time_us,
+                record->type,
+                record->pid,
+                (unsigned long)record->a,
+                (unsigned long)record->b
+            );
+        }
+    }
+    esp_rom_printf("TRACE END\n");
+
+    if (!paused) {
+        atomic_store(&trace_paused, false);
+    }
+}
+
+#else
+
+void trace_dump(void) {
+    esp_rom_printf("TRACE disabled, see TRACE_EVENTS\n");
+}
+
+#endif
@@ -0,0 +1,54 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms_config.h"
+
+#include <stdint.h>
+
+// Kernel event trace. Every core records into a ring of TRACE_EVENTS in
+// internal memory, overwriting the oldest events, without taking a lock.
+// trace_dump() prints the rings on the console, FN+T does so on demand and
+// the panic handler before it reboots. misc/trace2json.py turns the console
+// output into a Chrome trace that Perfetto and chrome://tracing can open.
+typedef enum {
+    TRACE_SWITCH_IN,        // a: task handle
+    TRACE_SWITCH_OUT,       // a: task handle, b: preempted
+    TRACE_REMAP,            // a: cycles spent switching the MMU
+    TRACE_FRAME_BEGIN,      // a: refresh count
+    TRACE_FRAME_QUEUE,      // The compositor messages are applied, a: how many
+    TRACE_FRAME_END,        // a: whether anything was composited
+    TRACE_PPA_QUEUE,        // a: ppa_operation_t, b: pixels
+    TRACE_PPA_DONE,         // The PPA finished everything queued
+    TRACE_ZEUS_SEND,        // a: task_type_t
+    TRACE_HADES_SEND,       // a: pid of the dead task
+    TRACE_HERMES_SEND,      // a: wifi_command_t
+    TRACE_SBRK,             // a: increment, b: old break or -1
+    TRACE_HADES_YIELD,      // A teardown lets a waiting spawn go first
+    TRACE_HEPHAESTUS_WRITE, // a: bytes written to flash
+} trace_event_type_t;
+
+// Time stamped with the pid of the running task, from any context
+#if TRACE_EVENTS
+void trace_event(trace_event_type_t type, uint32_t a, uint32_t b);
+#else
+static inline void trace_event(trace_event_type_t type, uint32_t a, uint32_t b) {
+}
+#endif
+
+// Recording stops while the rings are printed, safe to call from the panic handler
+void trace_dump(void);
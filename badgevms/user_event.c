@@ -20,13 +20,5 @@
 #include "task.h"
 
 event_t event_poll(window_t *window, bool block, uint32_t timeout_msec) {
-
-    event_t    e;
-    TickType_t wait = block ? portMAX_DELAY : timeout_msec / portTICK_PERIOD_MS;
-
-    if (xQueueReceive(window->event_queue, &e, wait) != pdTRUE) {
-        e.type = EVENT_NONE;
-    }
-
-    return e;
+    return window_event_poll(window, block, timeout_msec);
 }
@@ -0,0 +1,416 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wait_private.h"
+
+#include "compositor/compositor_private.h"
+#include "curl_private.h"
+#include "esp_log.h"
+#include "esp_vfs_eventfd.h"
+#include "hrtimer_private.h"
+#include "io_ring_private.h"
+
+#include <stdatomic.h>
+
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define TAG "wait"
+
+static portMUX_TYPE wait_lock = portMUX_INITIALIZER_UNLOCKED;
+// Wakers between taking a waiter and notifying it, see wait_task_died()
+static atomic_int   wait_notifying;
+
+bool wait_init(void) {
+    esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    if (esp_vfs_eventfd_register(&config) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to register eventfd");
+        return false;
+    }
+    return true;
+}
+
+void wait_notify(TaskHandle_t task) {
+    xTaskNotifyGiveIndexed(task, TASK_NOTIFY_INDEX_WAIT);
+
+    // Or it is in select() on its sockets
+    task_info_t *task_info = pvTaskGetThreadLocalStoragePointer(task, 1);
+    if (task_info && task_info->wait_eventfd) {
+        uint64_t one = 1;
+        write(task_info->wait_eventfd, &one, sizeof(one));
+    }
+}
+
+void wait_wake(atomic_uintptr_t *waiter) {
+    if (!atomic_load(waiter)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&wait_lock);
+    TaskHandle_t task = (TaskHandle_t)atomic_exchange(waiter, (uintptr_t)NULL);
+    if (task) {
+        atomic_fetch_add(&wait_notifying, 1);
+    }
+    portEXIT_CRITICAL(&wait_lock);
+
+    if (task) {
+        wait_notify(task);
+        atomic_fetch_sub(&wait_notifying, 1);
+    }
+}
+
+void wait_wake_thread(atomic_uintptr_t *waiter) {
+    if (!atomic_load(waiter)) {
+        return;
+    }
+
+    int eventfd = 0;
+
+    // Nothing on our core can delete the waiter meanwhile, and a task deleting
+    // it on the other core only waits for us shortly
+    vTaskSuspendAll();
+    portENTER_CRITICAL(&wait_lock);
+    TaskHandle_t task = (TaskHandle_t)atomic_exchange(waiter, (uintptr_t)NULL);
+    if (task) {
+        atomic_fetch_add(&wait_notifying, 1);
+    }
+    portEXIT_CRITICAL(&wait_lock);
+
+    if (task) {
+        xTaskNotifyGiveIndexed(task, TASK_NOTIFY_INDEX_WAIT);
+        task_info_t *task_info = pvTaskGetThreadLocalStoragePointer(task, 1);
+        eventfd                = task_info ? task_info->wait_eventfd : 0;
+        atomic_fetch_sub(&wait_notifying, 1);
+    }
+    xTaskResumeAll();
+
+    // Or it is in select() on its sockets. Writing may block, Hades closes
+    // the eventfd only after the waiter is gone.
+    if (eventfd) {
+        uint64_t one = 1;
+        write(eventfd, &one, sizeof(one));
+    }
+}
+
+// Drivers wake from tasks of low priority, which whoever deletes the waiter
+// may preempt just like a thread
+void wait_list_wake(wait_list_t *list) {
+    for (int i = 0; i < WAIT_LIST_SLOTS; ++i) {
+        wait_wake_thread(&list->slots[i]);
+    }
+}
+
+static void wait_clear(atomic_uintptr_t *waiter, uintptr_t self) {
+    atomic_compare_exchange_strong(waiter, &self, (uintptr_t)NULL);
+}
+
+// Join the waiters of a device, false if there is no room
+static bool wait_list_add(task_info_t *task_info, wait_list_t *list, uintptr_t self) {
+    if (task_info->wait_num_lists == WAIT_MAX_DEVICES) {
+        return false;
+    }
+
+    for (int i = 0; i < WAIT_LIST_SLOTS; ++i) {
+        uintptr_t none = (uintptr_t)NULL;
+        if (atomic_load(&list->slots[i]) == self || atomic_compare_exchange_strong(&list->slots[i], &none, self)) {
+            task_info->wait_lists[task_info->wait_num_lists++] = list;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wait_lists_clear(task_info_t *task_info, uintptr_t self) {
+    for (int i = 0; i < task_info->wait_num_lists; ++i) {
+        for (int j = 0; j < WAIT_LIST_SLOTS; ++j) {
+            wait_clear(&task_info->wait_lists[i]->slots[j], self);
+        }
+    }
+    task_info->wait_num_lists = 0;
+}
+
+void wait_task_died(task_info_t *task_info) {
+    uintptr_t self = (uintptr_t)task_info->handle;
+
+    portENTER_CRITICAL(&wait_lock);
+    for (int i = 0; i < task_info->wait_num_sources; ++i) {
+        wait_source_t *source = &task_info->wait_sources[i];
+        if (source->type == WAIT_SOURCE_WINDOW && source->window) {
+            wait_clear(&source->window->event_waiter, self);
+        } else if (source->type == WAIT_SOURCE_IO && source->ring) {
+            wait_clear(&source->ring->waiter, self);
+        } else if (source->type == WAIT_SOURCE_CURL && source->curl_multi) {
+            wait_clear(curl_multi_waiter(source->curl_multi), self);
+        }
+    }
+    wait_clear(&task_info->child_waiter, self);
+    wait_lists_clear(task_info, self);
+    portEXIT_CRITICAL(&wait_lock);
+
+    // A waker may have taken us just before. Wakers are the compositor, input
+    // and Hades tasks, nothing that deletes tasks preempts them on their core,
+    // and io ring threads and drivers that suspend the scheduler, so it
+    // finishes soon.
+    while (atomic_load(&wait_notifying)) {
+    }
+}
+
+static bool wait_is_socket(task_info_t *task_info, wait_source_t const *source) {
+    if (source->type != WAIT_SOURCE_FD || source->fd < 0 || source->fd >= MAXFD) {
+        return false;
+    }
+
+    file_handle_t *handle = &task_info->thread->file_handles[source->fd];
+    return handle->is_open && handle->device->type == DEVICE_TYPE_SOCKET;
+}
+
+// Data a socket device holds on to above the socket, select() doesn't see it
+static bool wait_socket_pending(task_info_t *task_info, wait_source_t const *source) {
+    file_handle_t   *handle = &task_info->thread->file_handles[source->fd];
+    socket_device_t *dev    = (socket_device_t *)handle->device;
+    return (source->events & WAIT_READABLE) && dev->_pending && dev->_pending(dev, handle->dev_fd);
+}
+
+// Files, and devices that can't say, are always ready
+static int wait_device_check(task_info_t *task_info, wait_source_t const *source, uintptr_t self) {
+    file_handle_t *handle = &task_info->thread->file_handles[source->fd];
+    device_t      *dev    = handle->device;
+    int            events = source->events & (WAIT_READABLE | WAIT_WRITABLE);
+
+    if (!dev->_ready || !wait_list_add(task_info, dev->_waiters(dev, handle->dev_fd), self)) {
+        return events;
+    }
+    return dev->_ready(dev, handle->dev_fd, events);
+}
+
+// Sets revents if source is ready, otherwise we are woken when it becomes
+// ready. Sockets are left to wait_select().
+static bool wait_check(task_info_t *task_info, wait_source_t *source, uintptr_t self) {
+    switch (source->type) {
+        case WAIT_SOURCE_FD:
+            if (source->fd < 0 || source->fd >= MAXFD || !task_info->thread->file_handles[source->fd].is_open) {
+                source->revents = WAIT_INVALID;
+            } else if (!wait_is_socket(task_info, source)) {
+                source->revents = wait_device_check(task_info, source, self);
+            } else if (wait_socket_pending(task_info, source)) {
+                source->revents = WAIT_READABLE;
+            }
+            break;
+        case WAIT_SOURCE_WINDOW:
+            if (!source->window) {
+                source->revents = WAIT_INVALID;
+                break;
+            }
+            atomic_store(&source->window->event_waiter, self);
+            if (window_events_pending(source->window)) {
+                source->revents = WAIT_READABLE;
+            }
+            break;
+        case WAIT_SOURCE_TIMER:
+            switch (hrtimer_watch(source->timer, (TaskHandle_t)self)) {
+                case -1: source->revents = WAIT_INVALID; break;
+                case 1: source->revents = WAIT_READABLE; break;
+                default:
+            }
+            break;
+        case WAIT_SOURCE_CHILD:
+            atomic_store(&task_info->child_waiter, self);
+            if (uxQueueMessagesWaiting(task_info->children)) {
+                source->revents = WAIT_READABLE;
+            }
+            break;
+        case WAIT_SOURCE_IO:
+            if (!source->ring) {
+                source->revents = WAIT_INVALID;
+                break;
+            }
+            atomic_store(&source->ring->waiter, self);
+            if (io_ring_has_completions(source->ring)) {
+                source->revents = WAIT_READABLE;
+            }
+            break;
+        case WAIT_SOURCE_CURL:
+            if (!source->curl_multi) {
+                source->revents = WAIT_INVALID;
+                break;
+            }
+            atomic_store(curl_multi_waiter(source->curl_multi), self);
+            if (curl_multi_ready(source->curl_multi)) {
+                source->revents = WAIT_READABLE;
+            }
+            break;
+        default:
+    }
+
+    return source->revents;
+}
+
+static void wait_unwatch(task_info_t *task_info, wait_source_t *source, uintptr_t self) {
+    switch (source->type) {
+        case WAIT_SOURCE_WINDOW:
+            if (source->window) {
+                wait_clear(&source->window->event_waiter, self);
+            }
+            break;
+        case WAIT_SOURCE_TIMER: hrtimer_unwatch(source->timer, (TaskHandle_t)self); break;
+        case WAIT_SOURCE_CHILD: wait_clear(&task_info->child_waiter, self); break;
+        case WAIT_SOURCE_IO:
+            if (source->ring) {
+                wait_clear(&source->ring->waiter, self);
+            }
+            break;
+        case WAIT_SOURCE_CURL:
+            if (source->curl_multi) {
+                wait_clear(curl_multi_waiter(source->curl_multi), self);
+            }
+            break;
+        default:
+    }
+}
+
+// Block in select() on the sockets and our eventfd, which the other sources
+// write to. Returns how many sockets are ready that wait_check() didn't count
+// already.
+static int wait_select(task_info_t *task_info, wait_source_t *sources, int num_sources, TickType_t timeout) {
+    fd_set readfds;
+    fd_set writefds;
+    fd_set exceptfds;
+    int    maxfd = task_info->wait_eventfd;
+
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+    FD_SET(task_info->wait_eventfd, &readfds);
+
+    for (int i = 0; i < num_sources; ++i) {
+        if (!wait_is_socket(task_info, &sources[i])) {
+            continue;
+        }
+
+        int sock = task_info->thread->file_handles[sources[i].fd].dev_fd;
+        if (sources[i].events & WAIT_READABLE) {
+            FD_SET(sock, &readfds);
+        }
+        if (sources[i].events & WAIT_WRITABLE) {
+            FD_SET(sock, &writefds);
+        }
+        FD_SET(sock, &exceptfds);
+        maxfd = MAX(maxfd, sock);
+    }
+
+    uint64_t       ms = (uint64_t)timeout * portTICK_PERIOD_MS;
+    struct timeval tv = {.tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000};
+    if (select(maxfd + 1, &readfds, &writefds, &exceptfds, timeout == portMAX_DELAY ? NULL : &tv) < 0) {
+        task_info->_errno = errno;
+        return -1;
+    }
+
+    if (FD_ISSET(task_info->wait_eventfd, &readfds)) {
+        uint64_t count;
+        read(task_info->wait_eventfd, &count, sizeof(count));
+    }
+
+    int ready = 0;
+    for (int i = 0; i < num_sources; ++i) {
+        if (!wait_is_socket(task_info, &sources[i])) {
+            continue;
+        }
+
+        int  sock    = task_info->thread->file_handles[sources[i].fd].dev_fd;
+        bool counted = sources[i].revents != 0;
+        if (FD_ISSET(sock, &readfds)) {
+            sources[i].revents |= WAIT_READABLE;
+        }
+        if (FD_ISSET(sock, &writefds)) {
+            sources[i].revents |= WAIT_WRITABLE;
+        }
+        if (FD_ISSET(sock, &exceptfds)) {
+            sources[i].revents |= WAIT_ERROR;
+        }
+        ready += !counted && sources[i].revents != 0;
+    }
+
+    return ready;
+}
+
+int wait_any(wait_source_t *sources, int num_sources, uint32_t timeout_msec) {
+    task_info_t *task_info = get_task_info();
+    uintptr_t    self      = (uintptr_t)xTaskGetCurrentTaskHandle();
+    bool         sockets   = false;
+
+    if (num_sources < 0 || (num_sources && !sources)) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    for (int i = 0; i < num_sources; ++i) {
+        sources[i].revents  = 0;
+        sockets            |= wait_is_socket(task_info, &sources[i]);
+    }
+
+    if (sockets && !task_info->wait_eventfd) {
+        int fd = eventfd(0, 0);
+        if (fd < 0) {
+            ESP_LOGW(TAG, "Unable to create eventfd");
+            task_info->_errno = ENOMEM;
+            return -1;
+        }
+        task_info->wait_eventfd = fd;
+    }
+
+    TickType_t timeout = timeout_msec == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_msec);
+    TickType_t start   = xTaskGetTickCount();
+    int        ready;
+
+    task_info->wait_sources     = sources;
+    task_info->wait_num_sources = num_sources;
+    while (1) {
+        // Watch first and then check, so nothing that becomes ready in between is missed
+        ready = 0;
+        for (int i = 0; i < num_sources; ++i) {
+            ready += wait_check(task_info, &sources[i], self);
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        TickType_t left    = 0;
+        if (!ready) {
+            left = timeout == portMAX_DELAY ? portMAX_DELAY : timeout - MIN(elapsed, timeout);
+        }
+
+        if (sockets) {
+            int res = wait_select(task_info, sources, num_sources, left);
+            ready   = res < 0 ? -1 : ready + res;
+        } else if (left) {
+            // A late wake up from an earlier wait can end this one early, hence the loop
+            ulTaskNotifyTakeIndexed(TASK_NOTIFY_INDEX_WAIT, pdTRUE, left);
+        }
+
+        for (int i = 0; i < num_sources; ++i) {
+            wait_unwatch(task_info, &sources[i], self);
+        }
+        wait_lists_clear(task_info, self);
+
+        if (ready || !left) {
+            break;
+        }
+    }
+    task_info->wait_num_sources = 0;
+    task_info->wait_sources     = NULL;
+
+    return ready;
+}
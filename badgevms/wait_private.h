@@ -0,0 +1,51 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/wait.h"
+#include "task.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Register the eventfd driver, a thread waiting on sockets is woken through one
+bool wait_init(void);
+
+// Wake the thread stored in waiter by wait_any(), if any, and clear it. For
+// anything that makes a source ready.
+void wait_wake(atomic_uintptr_t *waiter);
+
+// Like wait_wake(), for wakers that are threads of a process. Those can be
+// preempted by whoever deletes the waiter, which must not find them between
+// taking and notifying it, see wait_task_died().
+void wait_wake_thread(atomic_uintptr_t *waiter);
+
+// The threads waiting on a device, several may wait on the same file, like
+// the console every process writes to
+typedef struct wait_list {
+    atomic_uintptr_t slots[WAIT_LIST_SLOTS];
+} wait_list_t;
+
+// Wake everybody on list, from the driver task that made the device ready
+void wait_list_wake(wait_list_t *list);
+
+// Wake task, from hrtimer. The caller makes sure it still exists.
+void wait_notify(TaskHandle_t task);
+
+// From the pre-deletion hook, while the task can still be notified. Sources
+// it waits on must not wake it up anymore.
+void wait_task_died(task_info_t *task_info);
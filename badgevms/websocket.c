@@ -0,0 +1,654 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "badgevms/websocket.h"
+
+#include "badgevms/device.h"
+#include "drivers/wifi.h"
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+#include "task.h"
+#include "websocket_frame.h"
+#include "wrapped_funcs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+
+#define TAG "websocket"
+
+// Open connections of all processes
+#define WEBSOCKET_MAX_CONNECTIONS 16
+// Payload per write, masked into the send buffer behind the header
+#define WEBSOCKET_SEND_CHUNK      1400
+#define WEBSOCKET_RESPONSE_MAX    1024
+#define WEBSOCKET_TIMEOUT_MS      10000
+#define WEBSOCKET_GUID            "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+typedef struct {
+    esp_tls_t          *tls;
+    int                 sock;
+    bool                secure;
+    SemaphoreHandle_t   lock;
+    websocket_message_t message;
+    bool                fin;       // The current frame is the last of the message
+    uint64_t            remaining; // Payload of the current frame not read yet
+    bool                closed;    // Said goodbye, or the server did
+    uint8_t             send_buf[WEBSOCKET_HEADER_MAX + WEBSOCKET_SEND_CHUNK];
+} websocket_t;
+
+static websocket_t *connections[WEBSOCKET_MAX_CONNECTIONS];
+static portMUX_TYPE connections_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static socket_device_t websocket_device;
+
+static websocket_t *websocket_find(int sock) {
+    websocket_t *ws = NULL;
+
+    taskENTER_CRITICAL(&connections_lock);
+    for (int i = 0; i < WEBSOCKET_MAX_CONNECTIONS; ++i) {
+        if (connections[i] && connections[i]->sock == sock) {
+            ws = connections[i];
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&connections_lock);
+    return ws;
+}
+
+static bool websocket_add(websocket_t *ws) {
+    bool added = false;
+
+    taskENTER_CRITICAL(&connections_lock);
+    for (int i = 0; i < WEBSOCKET_MAX_CONNECTIONS; ++i) {
+        if (!connections[i]) {
+            connections[i] = ws;
+            added          = true;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&connections_lock);
+    return added;
+}
+
+static void websocket_remove(websocket_t *ws) {
+    taskENTER_CRITICAL(&connections_lock);
+    for (int i = 0; i < WEBSOCKET_MAX_CONNECTIONS; ++i) {
+        if (connections[i] == ws) {
+            connections[i] = NULL;
+        }
+    }
+    taskEXIT_CRITICAL(&connections_lock);
+}
+
+// The connection behind fd of the calling process, NULL with errno if there is none
+static websocket_t *websocket_lookup(task_info_t *task_info, int fd) {
+    if (fd < 0 || fd >= MAXFD || !task_info->thread->file_handles[fd].is_open) {
+        task_info->_errno = EBADF;
+        return NULL;
+    }
+
+    file_handle_t *handle = &task_info->thread->file_handles[fd];
+    websocket_t   *ws     = handle->device == &websocket_device.device ? websocket_find(handle->dev_fd) : NULL;
+    if (!ws) {
+        task_info->_errno = EINVAL;
+    }
+    return ws;
+}
+
+static bool websocket_write_all(websocket_t *ws, void const *buf, size_t len) {
+    char const *p = buf;
+
+    while (len) {
+        ssize_t n = esp_tls_conn_write(ws->tls, p, len);
+        if (n <= 0) {
+            return false;
+        }
+        p   += n;
+        len -= n;
+    }
+    return true;
+}
+
+// False at the end of the connection too
+static bool websocket_read_all(websocket_t *ws, void *buf, size_t len) {
+    char *p = buf;
+
+    while (len) {
+        ssize_t n = esp_tls_conn_read(ws->tls, p, len);
+        if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p   += n;
+        len -= n;
+    }
+    return true;
+}
+
+// One frame with all of data. It is masked into the send buffer a chunk at a
+// time, so the header and a small payload go out in a single write and data
+// itself stays untouched.
+static bool websocket_send_frame(websocket_t *ws, websocket_opcode_t opcode, void const *data, size_t len) {
+    uint8_t       *buf    = ws->send_buf;
+    uint8_t const *src    = data;
+    uint32_t       key    = esp_random();
+    uint8_t        mask[] = {key, key >> 8, key >> 16, key >> 24};
+    size_t         header = websocket_frame_header(buf, opcode, len, mask);
+
+    size_t done = 0;
+    do {
+        size_t chunk = MIN(len - done, WEBSOCKET_SEND_CHUNK);
+        websocket_frame_mask(buf + header, src + done, chunk, mask, done);
+        if (!websocket_write_all(ws, buf, header + chunk)) {
+            return false;
+        }
+        done   += chunk;
+        header  = 0;
+    } while (done < len);
+
+    return true;
+}
+
+// Control frames are handled here, the server may send them in between the
+// frames of a message. False if the connection is gone.
+static bool websocket_control(websocket_t *ws, websocket_opcode_t opcode, size_t len) {
+    uint8_t payload[WEBSOCKET_CONTROL_MAX];
+
+    if (!websocket_read_all(ws, payload, len)) {
+        return false;
+    }
+
+    switch (opcode) {
+        case WEBSOCKET_PING: return ws->closed || websocket_send_frame(ws, WEBSOCKET_PONG, payload, len);
+        case WEBSOCKET_CLOSE:
+            // Echo the status code back and we are done
+            if (!ws->closed) {
+                websocket_send_frame(ws, WEBSOCKET_CLOSE, payload, MIN(len, 2));
+            }
+            ws->closed = true;
+            return false;
+        default: return true;
+    }
+}
+
+// Read frame headers until there is payload of a data frame to read, or an
+// empty one. 0 when there is, 1 at the end of the connection and -1 with errno
+// set on a protocol error.
+static int websocket_next_frame(websocket_t *ws, task_info_t *task_info) {
+    while (1) {
+        uint8_t           header[WEBSOCKET_HEADER_MAX];
+        websocket_frame_t frame;
+        if (ws->closed || !websocket_read_all(ws, header, 2) ||
+            !websocket_read_all(ws, header + 2, websocket_frame_header_size(header) - 2)) {
+            goto gone;
+        }
+
+        // Servers don't mask
+        if (!websocket_frame_decode(header, &frame) || frame.masked) {
+            goto protocol_error;
+        }
+
+        if (frame.opcode & 0x8) {
+            if (!websocket_control(ws, frame.opcode, frame.len)) {
+                goto gone;
+            }
+            continue;
+        }
+
+        if (!websocket_message_frame(&ws->message, &frame)) {
+            goto protocol_error;
+        }
+
+        ws->fin       = frame.fin;
+        ws->remaining = frame.len;
+        return 0;
+    }
+
+gone:
+    ws->closed = true;
+    return 1;
+
+protocol_error:
+    ESP_LOGW(TAG, "Protocol error on connection %p", ws);
+    websocket_send_frame(ws, WEBSOCKET_CLOSE, (uint8_t[]){1002 >> 8, 1002 & 0xFF}, 2);
+    ws->closed        = true;
+    task_info->_errno = EPROTO;
+    return -1;
+}
+
+// With the lock held
+static ssize_t websocket_recv_locked(
+    websocket_t *ws, task_info_t *task_info, void *buf, size_t len, websocket_opcode_t *opcode, bool *end
+) {
+    bool new_frame = !ws->remaining;
+
+    if (new_frame) {
+        int res = websocket_next_frame(ws, task_info);
+        if (res) {
+            *opcode = WEBSOCKET_CLOSE;
+            *end    = true;
+            return res < 0 ? -1 : 0;
+        }
+    }
+
+    *opcode = ws->message.opcode;
+    if (!ws->remaining) {
+        // An empty frame
+        *end = ws->fin;
+        return 0;
+    }
+
+    ssize_t n = esp_tls_conn_read(ws->tls, buf, MIN(len, ws->remaining));
+    if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        n = 0;
+    } else if (n <= 0) {
+        ws->closed = true;
+        *opcode    = WEBSOCKET_CLOSE;
+        *end       = true;
+        return 0;
+    }
+
+    ws->remaining -= n;
+    *end           = ws->fin && !ws->remaining;
+    return n;
+}
+
+static ssize_t websocket_send_locked(
+    websocket_t *ws, task_info_t *task_info, websocket_opcode_t opcode, void const *data, size_t len
+) {
+    if (ws->closed) {
+        task_info->_errno = EPIPE;
+        return -1;
+    }
+
+    if (!websocket_send_frame(ws, opcode, data, len)) {
+        ws->closed        = true;
+        task_info->_errno = EIO;
+        return -1;
+    }
+    return len;
+}
+
+ssize_t websocket_send(int fd, websocket_opcode_t opcode, void const *data, size_t len) {
+    task_info_t *task_info = get_task_info();
+    websocket_t *ws        = websocket_lookup(task_info, fd);
+    if (!ws) {
+        return -1;
+    }
+
+    if ((opcode != WEBSOCKET_TEXT && opcode != WEBSOCKET_BINARY && opcode != WEBSOCKET_PING) ||
+        (opcode == WEBSOCKET_PING && len > WEBSOCKET_CONTROL_MAX) || (len && !data)) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    xSemaphoreTake(ws->lock, portMAX_DELAY);
+    ssize_t res = websocket_send_locked(ws, task_info, opcode, data, len);
+    xSemaphoreGive(ws->lock);
+    return res;
+}
+
+ssize_t websocket_recv(int fd, void *buf, size_t len, websocket_opcode_t *opcode, bool *end) {
+    task_info_t *task_info = get_task_info();
+    websocket_t *ws        = websocket_lookup(task_info, fd);
+    if (!ws) {
+        return -1;
+    }
+
+    if (!opcode || !end || (len && !buf)) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    xSemaphoreTake(ws->lock, portMAX_DELAY);
+    ssize_t res = websocket_recv_locked(ws, task_info, buf, len, opcode, end);
+    xSemaphoreGive(ws->lock);
+    return res;
+}
+
+static int websocket_open(void *dev, path_t *path, int flags, mode_t mode) {
+    return -1;
+}
+
+// Only the owner says goodbye. Hades closes what is left of a process that
+// ended, and destroys its TLS connections with the rest of its resources.
+static int websocket_close(void *dev, int sock) {
+    websocket_t *ws = websocket_find(sock);
+    if (!ws) {
+        return -1;
+    }
+
+    task_info_t *task_info = get_task_info();
+    websocket_remove(ws);
+    if (task_info && task_info->pid) {
+        if (!ws->closed) {
+            websocket_send_frame(ws, WEBSOCKET_CLOSE, (uint8_t[]){1000 >> 8, 1000 & 0xFF}, 2);
+        }
+        esp_tls_conn_destroy(ws->tls);
+    }
+    vSemaphoreDelete(ws->lock);
+    free(ws);
+    return 0;
+}
+
+// Sends a binary message
+static ssize_t websocket_write(void *dev, int sock, void const *buf, size_t count) {
+    task_info_t *task_info = get_task_info();
+    websocket_t *ws        = websocket_find(sock);
+    if (!ws) {
+        task_info->_errno = EBADF;
+        return -1;
+    }
+
+    xSemaphoreTake(ws->lock, portMAX_DELAY);
+    ssize_t res = websocket_send_locked(ws, task_info, WEBSOCKET_BINARY, buf, count);
+    xSemaphoreGive(ws->lock);
+    return res;
+}
+
+// The payload of the messages, without empty frames, 0 at the end
+static ssize_t websocket_read(void *dev, int sock, void *buf, size_t count) {
+    task_info_t *task_info = get_task_info();
+    websocket_t *ws        = websocket_find(sock);
+    if (!ws) {
+        task_info->_errno = EBADF;
+        return -1;
+    }
+
+    websocket_opcode_t opcode;
+    bool               end;
+    ssize_t            res;
+
+    if (!count) {
+        return 0;
+    }
+
+    xSemaphoreTake(ws->lock, portMAX_DELAY);
+    do {
+        res = websocket_recv_locked(ws, task_info, buf, count, &opcode, &end);
+    } while (!res && opcode != WEBSOCKET_CLOSE);
+    xSemaphoreGive(ws->lock);
+    return res;
+}
+
+static ssize_t websocket_lseek(void *dev, int sock, off_t offset, int whence) {
+    return (off_t)-1;
+}
+
+// What mbedTLS decrypted already. A reader holds the lock while it takes from
+// it, then there is nothing to add.
+static bool websocket_pending(void *dev, int sock) {
+    websocket_t *ws = websocket_find(sock);
+    if (!ws || !ws->secure || !xSemaphoreTake(ws->lock, 0)) {
+        return false;
+    }
+
+    bool pending = esp_tls_get_bytes_avail(ws->tls) > 0;
+    xSemaphoreGive(ws->lock);
+    return pending;
+}
+
+static socket_device_t websocket_device = {
+    .device =
+        {
+            .type   = DEVICE_TYPE_SOCKET,
+            ._open  = websocket_open,
+            ._close = websocket_close,
+            ._write = websocket_write,
+            ._read  = websocket_read,
+            ._lseek = websocket_lseek,
+        },
+    ._pending = websocket_pending,
+};
+
+// Splits ws://host:port/path, true if url is one
+static bool websocket_parse_url(
+    char const *url, bool *secure, char const **host, size_t *host_len, int *port, char const **path
+) {
+    if (!strncasecmp(url, "ws://", 5)) {
+        *secure = false;
+        url    += 5;
+    } else if (!strncasecmp(url, "wss://", 6)) {
+        *secure = true;
+        url    += 6;
+    } else {
+        return false;
+    }
+
+    *host     = url;
+    *host_len = strcspn(url, ":/?#");
+    if (!*host_len) {
+        return false;
+    }
+    url   += *host_len;
+    *port  = *secure ? 443 : 80;
+
+    if (*url == ':') {
+        char *end;
+        long  p = strtol(url + 1, &end, 10);
+        if (end == url + 1 || p <= 0 || p > 65535) {
+            return false;
+        }
+        *port = p;
+        url   = end;
+    }
+
+    if (*url == '#') {
+        url = "";
+    }
+    *path = url;
+    return *url == '\0' || *url == '/' || *url == '?';
+}
+
+// The Sec-WebSocket-Accept the server has to answer key with
+static bool websocket_accept_for(char const *key, char accept[29]) {
+    char    input[24 + sizeof(WEBSOCKET_GUID)];
+    uint8_t hash[20];
+    size_t  len;
+
+    snprintf(input, sizeof(input), "%s%s", key, WEBSOCKET_GUID);
+    return !mbedtls_sha1((uint8_t *)input, strlen(input), hash) &&
+           !mbedtls_base64_encode((uint8_t *)accept, 29, &len, hash, sizeof(hash));
+}
+
+// A header of response, with the whitespace around its value cut off, NULL if it isn't there
+static char *websocket_header(char *response, char const *name) {
+    size_t name_len = strlen(name);
+
+    for (char *line = strstr(response, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) || line[name_len] != ':') {
+            continue;
+        }
+
+        char *value  = line + name_len + 1;
+        value       += strspn(value, " \t");
+        char *end    = strstr(value, "\r\n");
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+            --end;
+        }
+        *end = '\0';
+        return value;
+    }
+    return NULL;
+}
+
+static bool websocket_handshake(
+    websocket_t *ws, char const *host, size_t host_len, int port, char const *path, websocket_config_t const *config
+) {
+    uint8_t nonce[16];
+    char    key[25];
+    char    accept[29];
+    size_t  len;
+
+    esp_fill_random(nonce, sizeof(nonce));
+    if (mbedtls_base64_encode((uint8_t *)key, sizeof(key), &len, nonce, sizeof(nonce)) ||
+        !websocket_accept_for(key, accept)) {
+        return false;
+    }
+
+    bool default_port = port == (ws->secure ? 443 : 80);
+    char port_str[8]  = "";
+    if (!default_port) {
+        snprintf(port_str, sizeof(port_str), ":%d", port);
+    }
+
+    char const *subprotocol = config && config->subprotocol ? config->subprotocol : NULL;
+    char const *headers     = config && config->headers ? config->headers : "";
+    char const *format      = "GET %s%s HTTP/1.1\r\n"
+                              "Host: %.*s%s\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Key: %s\r\n"
+                              "Sec-WebSocket-Version: 13\r\n"
+                              "%s%s%s"
+                              "%s\r\n";
+    char const *path_slash  = *path == '/' ? "" : "/";
+
+#define WEBSOCKET_REQUEST_ARGS                                                                                         \
+    path_slash, path, (int)host_len, host, port_str, key, subprotocol ? "Sec-WebSocket-Protocol: " : "",               \
+        subprotocol ? subprotocol : "", subprotocol ? "\r\n" : "", headers
+
+    int   request_len = snprintf(NULL, 0, format, WEBSOCKET_REQUEST_ARGS);
+    char *request     = malloc(request_len + 1);
+    if (!request) {
+        return false;
+    }
+    snprintf(request, request_len + 1, format, WEBSOCKET_REQUEST_ARGS);
+#undef WEBSOCKET_REQUEST_ARGS
+
+    bool sent = websocket_write_all(ws, request, request_len);
+    free(request);
+    if (!sent) {
+        return false;
+    }
+
+    // A byte at a time, the first frames may follow right behind the response
+    char *response = malloc(WEBSOCKET_RESPONSE_MAX + 1);
+    if (!response) {
+        return false;
+    }
+
+    size_t received = 0;
+    bool   ok       = false;
+    while (received < WEBSOCKET_RESPONSE_MAX && websocket_read_all(ws, response + received, 1)) {
+        ++received;
+        if (received >= 4 && !memcmp(response + received - 4, "\r\n\r\n", 4)) {
+            response[received] = '\0';
+
+            char *value = websocket_header(response, "Sec-WebSocket-Accept");
+            ok          = !strncmp(response, "HTTP/1.1 101", 12) && value && !strcmp(value, accept);
+            if (!ok) {
+                ESP_LOGW(TAG, "Server refused the upgrade: %.*s", (int)strcspn(response, "\r\n"), response);
+            }
+            break;
+        }
+    }
+
+    free(response);
+    return ok;
+}
+
+int websocket_connect(char const *url, websocket_config_t const *config) {
+    task_info_t *task_info = get_task_info();
+    char const  *host;
+    char const  *path;
+    size_t       host_len;
+    bool         secure;
+    int          port;
+
+    if (!url || !websocket_parse_url(url, &secure, &host, &host_len, &port, &path)) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    wifi_start();
+
+    websocket_t *ws = calloc(1, sizeof(websocket_t));
+    if (!ws) {
+        task_info->_errno = ENOMEM;
+        return -1;
+    }
+
+    ws->sock   = -1;
+    ws->secure = secure;
+    ws->lock   = xSemaphoreCreateMutex();
+    ws->tls    = esp_tls_init();
+    if (!ws->lock || !ws->tls) {
+        task_info->_errno = ENOMEM;
+        goto fail;
+    }
+
+    esp_tls_cfg_t cfg = {
+        .timeout_ms        = config && config->timeout_ms ? config->timeout_ms : WEBSOCKET_TIMEOUT_MS,
+        .is_plain_tcp      = !secure,
+        .crt_bundle_attach = secure ? esp_crt_bundle_attach : NULL,
+    };
+    if (esp_tls_conn_new_sync(host, host_len, port, &cfg, ws->tls) != 1) {
+        ESP_LOGW(TAG, "Unable to connect to %.*s:%d", (int)host_len, host, port);
+        task_info->_errno = ECONNREFUSED;
+        goto fail;
+    }
+    esp_tls_get_conn_sockfd(ws->tls, &ws->sock);
+
+    if (!websocket_handshake(ws, host, host_len, port, path, config)) {
+        task_info->_errno = EPROTO;
+        goto fail;
+    }
+
+    // Messages come whenever the server has one, only sends time out
+    struct timeval no_timeout = {0};
+    setsockopt(ws->sock, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
+
+    if (!websocket_add(ws)) {
+        task_info->_errno = EMFILE;
+        goto fail;
+    }
+
+    int fd = fd_alloc(task_info, ws->sock, &websocket_device.device);
+    if (fd < 0) {
+        websocket_remove(ws);
+        goto fail;
+    }
+
+    ESP_LOGD(TAG, "Connected to %s as fd %d", url, fd);
+    return fd;
+
+fail:
+    if (ws->tls) {
+        esp_tls_conn_destroy(ws->tls);
+    }
+    if (ws->lock) {
+        vSemaphoreDelete(ws->lock);
+    }
+    free(ws);
+    return -1;
+}
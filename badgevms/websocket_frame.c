@@ -0,0 +1,312 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "websocket_frame.h"
+
+#include <string.h>
+
+size_t websocket_frame_header(uint8_t *buf, websocket_opcode_t opcode, uint64_t len, uint8_t const mask[4]) {
+    size_t header = 2;
+
+    buf[0] = 0x80 | opcode;
+    if (len < 126) {
+        buf[1] = len;
+    } else if (len <= UINT16_MAX) {
+        buf[1]  = 126;
+        buf[2]  = len >> 8;
+        buf[3]  = len;
+        header += 2;
+    } else {
+        buf[1] = 127;
+        for (int i = 0; i < 8; ++i) {
+            buf[2 + i] = len >> (56 - i * 8);
+        }
+        header += 8;
+    }
+
+    if (mask) {
+        buf[1] |= 0x80;
+        memcpy(buf + header, mask, 4);
+        header += 4;
+    }
+    return header;
+}
+
+size_t websocket_frame_header_size(uint8_t const *header) {
+    size_t  size = header[1] & 0x80 ? 6 : 2;
+    uint8_t len  = header[1] & 0x7F;
+
+    if (len == 126) {
+        size += 2;
+    } else if (len == 127) {
+        size += 8;
+    }
+    return size;
+}
+
+bool websocket_frame_decode(uint8_t const *header, websocket_frame_t *frame) {
+    uint8_t const *p = header + 2;
+
+    frame->opcode = header[0] & 0x0F;
+    frame->fin    = header[0] & 0x80;
+    frame->masked = header[1] & 0x80;
+    frame->len    = header[1] & 0x7F;
+
+    if (frame->len == 126) {
+        frame->len  = (uint64_t)p[0] << 8 | p[1];
+        p          += 2;
+    } else if (frame->len == 127) {
+        frame->len = 0;
+        for (int i = 0; i < 8; ++i) {
+            frame->len = frame->len << 8 | p[i];
+        }
+        p += 8;
+    }
+    if (frame->masked) {
+        memcpy(frame->mask, p, 4);
+    }
+
+    // We agreed on no extensions, and the top bit of a length is always clear
+    if ((header[0] & 0x70) || (frame->len >> 63)) {
+        return false;
+    }
+
+    switch (frame->opcode) {
+        case WEBSOCKET_CONTINUATION:
+        case WEBSOCKET_TEXT:
+        case WEBSOCKET_BINARY: return true;
+        case WEBSOCKET_CLOSE:
+        case WEBSOCKET_PING:
+        case WEBSOCKET_PONG: return frame->fin && frame->len <= WEBSOCKET_CONTROL_MAX;
+        default: return false;
+    }
+}
+
+void websocket_frame_mask(uint8_t *dst, uint8_t const *src, size_t len, uint8_t const mask[4], uint64_t offset) {
+    for (size_t i = 0; i < len; ++i) {
+        dst[i] = src[i] ^ mask[(offset + i) & 3];
+    }
+}
+
+bool websocket_message_frame(websocket_message_t *message, websocket_frame_t const *frame) {
+    if (frame->opcode == WEBSOCKET_CONTINUATION) {
+        if (!message->in_message) {
+            return false;
+        }
+    } else if (message->in_message) {
+        return false;
+    } else {
+        message->opcode = frame->opcode;
+    }
+
+    message->in_message = !frame->fin;
+    return true;
+}
+
+#ifdef RUN_TEST
+
+#include "test_check.h"
+
+#include <stdio.h>
+
+// Decode a whole frame of data, the payload unmasked into payload
+static bool test_decode(uint8_t const *data, size_t size, websocket_frame_t *frame, uint8_t *payload) {
+    if (size < 2 || size < websocket_frame_header_size(data)) {
+        return false;
+    }
+
+    size_t header = websocket_frame_header_size(data);
+    if (!websocket_frame_decode(data, frame) || size - header != frame->len) {
+        return false;
+    }
+
+    if (frame->masked) {
+        websocket_frame_mask(payload, data + header, frame->len, frame->mask, 0);
+    } else {
+        memcpy(payload, data + header, frame->len);
+    }
+    return true;
+}
+
+static void test_rfc_examples(void) {
+    websocket_frame_t frame;
+    uint8_t           payload[16];
+
+    printf("=== Examples of RFC 6455 5.7 ===\n");
+
+    uint8_t const unmasked[] = {0x81, 0x05, 'H', 'e', 'l', 'l', 'o'};
+    CHECK(test_decode(unmasked, sizeof(unmasked), &frame, payload));
+    CHECK(frame.opcode == WEBSOCKET_TEXT && frame.fin && !frame.masked && frame.len == 5);
+    CHECK(!memcmp(payload, "Hello", 5));
+
+    uint8_t const masked[] = {0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58};
+    CHECK(test_decode(masked, sizeof(masked), &frame, payload));
+    CHECK(frame.opcode == WEBSOCKET_TEXT && frame.fin && frame.masked && frame.len == 5);
+    CHECK(!memcmp(payload, "Hello", 5));
+
+    // And what we send for it is the same
+    uint8_t buf[WEBSOCKET_HEADER_MAX + 5];
+    size_t  header = websocket_frame_header(buf, WEBSOCKET_TEXT, 5, masked + 2);
+    websocket_frame_mask(buf + header, (uint8_t const *)"Hello", 5, masked + 2, 0);
+    CHECK(header + 5 == sizeof(masked) && !memcmp(buf, masked, sizeof(masked)));
+
+    uint8_t const ping[] = {0x89, 0x05, 'H', 'e', 'l', 'l', 'o'};
+    CHECK(test_decode(ping, sizeof(ping), &frame, payload));
+    CHECK(frame.opcode == WEBSOCKET_PING && frame.fin && frame.len == 5);
+
+    uint8_t const binary_256[] = {0x82, 0x7E, 0x01, 0x00};
+    CHECK(websocket_frame_header_size(binary_256) == 4);
+    CHECK(websocket_frame_decode(binary_256, &frame));
+    CHECK(frame.opcode == WEBSOCKET_BINARY && frame.len == 256);
+
+    uint8_t const binary_64k[] = {0x82, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00};
+    CHECK(websocket_frame_header_size(binary_64k) == 10);
+    CHECK(websocket_frame_decode(binary_64k, &frame));
+    CHECK(frame.opcode == WEBSOCKET_BINARY && frame.len == 65536);
+}
+
+// Every length takes the smallest encoding and decodes to itself
+static void test_lengths(void) {
+    static uint64_t const lengths[] = {0, 1, 125, 126, 127, 65535, 65536, 0x100000005ull, INT64_MAX};
+    static size_t const   sizes[]   = {2, 2, 2, 4, 4, 4, 10, 10, 10};
+    uint8_t const         mask[4]   = {1, 2, 3, 4};
+
+    printf("=== Lengths ===\n");
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        for (int masked = 0; masked < 2; ++masked) {
+            uint8_t           buf[WEBSOCKET_HEADER_MAX];
+            websocket_frame_t frame;
+            size_t            header = websocket_frame_header(buf, WEBSOCKET_BINARY, lengths[i], masked ? mask : NULL);
+
+            CHECK(header == sizes[i] + (masked ? 4 : 0));
+            CHECK(websocket_frame_header_size(buf) == header);
+            CHECK(websocket_frame_decode(buf, &frame));
+            CHECK(frame.opcode == WEBSOCKET_BINARY && frame.fin && frame.len == lengths[i]);
+            CHECK(frame.masked == masked && (!masked || !memcmp(frame.mask, mask, 4)));
+        }
+    }
+}
+
+// Masking in chunks at any offset gives the same as all at once, and undoes itself
+static void test_mask(void) {
+    uint8_t const mask[4] = {0xde, 0xad, 0xbe, 0xef};
+    uint8_t       data[1000];
+    uint8_t       whole[sizeof(data)];
+    uint8_t       chunked[sizeof(data)];
+    uint8_t       back[sizeof(data)];
+
+    printf("=== Masking ===\n");
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = i * 7;
+    }
+    websocket_frame_mask(whole, data, sizeof(data), mask, 0);
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        CHECK(whole[i] == (data[i] ^ mask[i & 3]));
+    }
+
+    for (size_t chunk = 1; chunk <= 7; ++chunk) {
+        for (size_t done = 0; done < sizeof(data); done += chunk) {
+            size_t n = sizeof(data) - done < chunk ? sizeof(data) - done : chunk;
+            websocket_frame_mask(chunked + done, data + done, n, mask, done);
+        }
+        CHECK(!memcmp(chunked, whole, sizeof(data)));
+    }
+
+    websocket_frame_mask(back, whole, sizeof(data), mask, 0);
+    CHECK(!memcmp(back, data, sizeof(data)));
+}
+
+static void test_bad_headers(void) {
+    static uint8_t const bad[][WEBSOCKET_HEADER_MAX] = {
+        {0xC1, 0x00},                                                 // RSV1 without an extension
+        {0x91, 0x00},                                                 // RSV3
+        {0x83, 0x00},                                                 // A reserved data opcode
+        {0x8B, 0x00},                                                 // A reserved control opcode
+        {0x09, 0x00},                                                 // A ping in fragments
+        {0x89, 0x7E, 0x00, 0x7E},                                     // A ping of 126 bytes
+        {0x82, 0x7F, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // The top bit of a length
+    };
+    websocket_frame_t frame;
+
+    printf("=== Bad headers ===\n");
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        CHECK(!websocket_frame_decode(bad[i], &frame));
+    }
+
+    uint8_t const pong[] = {0x8A, 0x7D};
+    CHECK(websocket_frame_decode(pong, &frame) && frame.len == WEBSOCKET_CONTROL_MAX);
+}
+
+// Follow frames of opcode and fin, as many as are given before the first -1
+static bool test_message(websocket_message_t *message, int const *frames) {
+    for (int const *f = frames; *f >= 0; f += 2) {
+        websocket_frame_t frame = {.opcode = f[0], .fin = f[1]};
+        if (!websocket_message_frame(message, &frame)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_fragments(void) {
+    websocket_message_t message = {0};
+
+    printf("=== Fragments ===\n");
+
+    // Text in three frames, then a whole binary message
+    CHECK(test_message(&message, (int[]){WEBSOCKET_TEXT, 0, -1}));
+    CHECK(message.in_message && message.opcode == WEBSOCKET_TEXT);
+    CHECK(test_message(&message, (int[]){WEBSOCKET_CONTINUATION, 0, -1}));
+    CHECK(message.in_message && message.opcode == WEBSOCKET_TEXT);
+    CHECK(test_message(&message, (int[]){WEBSOCKET_CONTINUATION, 1, -1}));
+    CHECK(!message.in_message && message.opcode == WEBSOCKET_TEXT);
+    CHECK(test_message(&message, (int[]){WEBSOCKET_BINARY, 1, -1}));
+    CHECK(!message.in_message && message.opcode == WEBSOCKET_BINARY);
+
+    // Empty frames are fine
+    message = (websocket_message_t){0};
+    CHECK(test_message(
+        &message, (int[]){WEBSOCKET_BINARY, 0, WEBSOCKET_CONTINUATION, 0, WEBSOCKET_CONTINUATION, 1, -1}
+    ));
+
+    // A continuation without a message
+    message = (websocket_message_t){0};
+    CHECK(!test_message(&message, (int[]){WEBSOCKET_CONTINUATION, 1, -1}));
+
+    // A new message before the last one ended
+    message = (websocket_message_t){0};
+    CHECK(!test_message(&message, (int[]){WEBSOCKET_TEXT, 0, WEBSOCKET_BINARY, 1, -1}));
+    message = (websocket_message_t){0};
+    CHECK(!test_message(&message, (int[]){WEBSOCKET_TEXT, 0, WEBSOCKET_TEXT, 0, -1}));
+
+    // After the end of a message a continuation is wrong again
+    message = (websocket_message_t){0};
+    CHECK(!test_message(
+        &message, (int[]){WEBSOCKET_TEXT, 0, WEBSOCKET_CONTINUATION, 1, WEBSOCKET_CONTINUATION, 1, -1}
+    ));
+}
+
+int main(void) {
+    test_rfc_examples();
+    test_lengths();
+    test_mask();
+    test_bad_headers();
+    test_fragments();
+
+    return test_summary();
+}
+#endif
@@ -0,0 +1,57 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "badgevms/websocket.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The framing of RFC 6455 without the connection, see websocket.c for that.
+
+// Largest frame header, 2 bytes, a 64 bit length and a mask
+#define WEBSOCKET_HEADER_MAX  14
+// Control frames carry at most this much
+#define WEBSOCKET_CONTROL_MAX 125
+
+typedef struct {
+    websocket_opcode_t opcode;
+    bool               fin;
+    bool               masked;
+    uint8_t            mask[4];
+    uint64_t           len;
+} websocket_frame_t;
+
+// Where the frames of a message are at, on the receiving side
+typedef struct {
+    websocket_opcode_t opcode;     // Of the message being received
+    bool               in_message; // More frames of it follow
+} websocket_message_t;
+
+// Write the header of a final frame into buf, masked with mask unless it is
+// NULL. Returns its size.
+size_t websocket_frame_header(uint8_t *buf, websocket_opcode_t opcode, uint64_t len, uint8_t const mask[4]);
+// The size of a header from its first 2 bytes
+size_t websocket_frame_header_size(uint8_t const *header);
+// False if the header breaks the protocol, without extensions
+bool   websocket_frame_decode(uint8_t const *header, websocket_frame_t *frame);
+// Mask or unmask len bytes that are offset bytes into the payload
+void   websocket_frame_mask(uint8_t *dst, uint8_t const *src, size_t len, uint8_t const mask[4], uint64_t offset);
+// Follow a data frame, false if it doesn't belong where it came
+bool   websocket_message_frame(websocket_message_t *message, websocket_frame_t const *frame);
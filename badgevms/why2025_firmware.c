@@ -24,11 +24,17 @@
 #include "badgevms/device.h"
 #include "badgevms/process.h"
 #include "badgevms_config.h"
+#include "boot_profile_private.h"
+#include "cache_counters.h"
 #include "compositor/compositor_private.h"
 #include "device_private.h"
+#include "dma_mem.h"
+#include "dns_cache.h"
 #include "drivers/badgevms_i2c_bus.h"
 #include "drivers/bosch_bmi270.h"
 #include "drivers/fatfs.h"
+#include "drivers/littlefs.h"
+#include "drivers/ramdisk.h"
 #include "drivers/socket.h"
 #include "drivers/st7703.h"
 #include "drivers/tca8418.h"
@@ -37,15 +43,25 @@
 #include "esp_debug_helpers.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_partition.h"
 #include "esp_private/panic_internal.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "governor.h"
 #include "init.h"
+#include "jpeg_private.h"
 #include "logical_names.h"
 #include "memory.h"
 #include "nvs_flash.h"
 #include "ota_private.h"
+#include "readahead.h"
+#include "settings_private.h"
 #include "task.h"
+#include "trace.h"
+#include "wait_private.h"
 
 #include <errno.h>
 #include <string.h>
@@ -73,98 +89,326 @@ void IRAM_ATTR __wrap_esp_panic_handler(panic_info_t *info) {
         esp_rom_printf("Crashing in ESP-IDF task\n");
     }
 
+    trace_dump();
     __real_esp_panic_handler(info);
 }
 
-int app_main(void) {
-    printf("BadgeVMS Initializing...\n");
-    size_t free_ram = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
-    ESP_LOGW(TAG, "Free main memory: %zi", free_ram);
+// Device bring-up as a small dependency graph. Steps run as soon as the ones
+// they come after are done, app_main() and Prometheus on the other core take
+// them in order. Steps that set up interrupts the kernel wants on core 0 stay
+// there, interrupts go to the core their driver was started on.
+typedef enum {
+    BOOT_FLASH,
+    BOOT_SD,
+    BOOT_NETWORK,
+    BOOT_PANEL,
+    BOOT_KEYBOARD,
+    BOOT_PERIPHERALS,
+    BOOT_COMPOSITOR,
+    BOOT_NUM_STEPS,
+} boot_step_id_t;
 
-    // If this fails we won't make it past here
-    memory_init();
+#define BOOT_AFTER(step) (1u << (step))
+#define BOOT_ALL         ((1u << BOOT_NUM_STEPS) - 1)
 
-    if (!task_init()) {
-        ESP_LOGE(TAG, "Failed to initialize tasking subsystem");
-        invalidate_ota_partition();
-    }
+typedef struct {
+    char const *name;
+    // false for a failure that makes this firmware unfit to boot again
+    bool (*run)(void);
+    uint32_t after;
+    bool     any_core;
+} boot_step_t;
 
-    if (!device_init()) {
-        ESP_LOGE(TAG, "Failed to initialize device subsystem");
-        invalidate_ota_partition();
+// Register a driver that was created since start_us, timed under its name
+static bool boot_register(char const *name, int64_t start_us, device_t *device) {
+    boot_profile_stage(name, start_us);
+    return device_register(name, device);
+}
+
+static esp_partition_t const *flash_partition(char const *label) {
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+}
+
+// The file system of a partition is picked by its subtype, fat or littlefs
+static device_t *flash_fs_create(char const *devname, char const *label) {
+    esp_partition_t const *partition = flash_partition(label);
+    if (!partition) {
+        ESP_LOGE(TAG, "No partition %s for %s", label, devname);
+        return NULL;
     }
 
-    if (!logical_names_system_init()) {
-        ESP_LOGE(TAG, "Failed to initialize logical names subsystem");
-        invalidate_ota_partition();
+    if (partition->subtype == ESP_PARTITION_SUBTYPE_DATA_LITTLEFS) {
+        return littlefs_create_spi(devname, label, true);
     }
+    return fatfs_create_spi(devname, label, true);
+}
 
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+static bool boot_flash(void) {
+    int64_t start = esp_timer_get_time();
+    if (!boot_register("FLASH0", start, flash_fs_create("FLASH0", "storage"))) {
+        ESP_LOGE(TAG, "Failed to initialize FLASH0 driver");
+        return false;
+    }
 
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+    // Allowed to fail, applications then keep their data on FLASH0:
+    if (flash_partition(CONFIG_BADGEVMS_APPDATA_PARTITION)) {
+        start = esp_timer_get_time();
+        if (boot_register("FLASH1", start, flash_fs_create("FLASH1", CONFIG_BADGEVMS_APPDATA_PARTITION))) {
+            logical_name_set("APPDATA:", "FLASH1:", false);
+        }
     }
 
-    if (!device_register("FLASH0", fatfs_create_spi("FLASH0", "storage", true))) {
-        ESP_LOGE(TAG, "Failed to initialize FLASH0 driver");
-        invalidate_ota_partition();
+    // Made on first use, it costs nothing until then
+    if (device_register_lazy("TMP0", ramdisk_create)) {
+        logical_name_set("TMP:", "TMP0:", false);
     }
+    return true;
+}
 
+// After FLASH0, FatFS hands out drive numbers without a lock
+static bool boot_sd(void) {
     // Allowed to fail
-    device_register("SD0", fatfs_create_sd("SD0", true));
+    int64_t start = esp_timer_get_time();
+    boot_register("SD0", start, fatfs_create_sd("SD0", true));
 
     if (device_get("SD0")) {
         logical_name_set("STORAGE:", "SD0:, FLASH0:", false);
         logical_name_set("APPS:", "SD0:[BADGEVMS.APPS], FLASH0:[BADGEVMS.APPS]", false);
+        logical_name_set("LIBS:", "SD0:[BADGEVMS.LIBS], FLASH0:[BADGEVMS.LIBS]", false);
         application_init("APPS:", "SD0:[BADGEVMS.APPS]", "FLASH0:[BADGEVMS.APPS]");
     } else {
         logical_name_set("STORAGE:", "FLASH0:", false);
         logical_name_set("APPS:", "FLASH0:[BADGEVMS.APPS]", false);
+        logical_name_set("LIBS:", "FLASH0:[BADGEVMS.LIBS]", false);
         application_init("APPS:", NULL, "FLASH0:[BADGEVMS.APPS]");
     }
+    return true;
+}
+
+// Hermes brings up the C6 in the background once something wants the network,
+// see wifi_start(). SOCKET0 is created for the first socket.
+static bool boot_network(void) {
+    bool ok = true;
 
-    if (!device_register("WIFI0", wifi_create())) {
+    int64_t start = esp_timer_get_time();
+    if (!boot_register("WIFI0", start, wifi_create())) {
         ESP_LOGE(TAG, "Failed to initialize WIFI0 driver");
-        invalidate_ota_partition();
+        ok = false;
     }
 
-    if (!device_register("SOCKET0", socket_create())) {
+    if (!device_register_lazy("SOCKET0", socket_create)) {
         ESP_LOGE(TAG, "Failed to initialize SOCKET0 driver");
-        invalidate_ota_partition();
+        ok = false;
     }
+    return ok;
+}
 
-    if (!device_register("PANEL0", st7703_create())) {
+static bool boot_panel(void) {
+    int64_t start = esp_timer_get_time();
+    if (!boot_register("PANEL0", start, st7703_create(display_framebuffers_configured()))) {
         ESP_LOGE(TAG, "Failed to initialize PANEL0 driver");
-        invalidate_ota_partition();
+        return false;
+    }
+    return true;
+}
+
+// Argus reads the keyboard through Charon, so I2CBUS0 comes first
+static bool boot_keyboard(void) {
+    bool ok = true;
+
+    int64_t start = esp_timer_get_time();
+    if (!boot_register("I2CBUS0", start, badgevms_i2c_bus_create("I2CBUS0", 0, I2C0_MASTER_FREQ_HZ))) {
+        ESP_LOGE(TAG, "Failed to initialize I2CBUS0 driver");
+        ok = false;
     }
 
-    if (!device_register("KEYBOARD0", tca8418_keyboard_create())) {
+    start = esp_timer_get_time();
+    if (!boot_register("KEYBOARD0", start, tca8418_keyboard_create())) {
         ESP_LOGE(TAG, "Failed to initialize KEYBOARD0 driver");
-        invalidate_ota_partition();
+        ok = false;
     }
+    return ok;
+}
+
+// In the order they always came up in, the I2C drivers share ports
+static bool boot_peripherals(void) {
+    bool ok = true;
 
-    if (!device_register("TT01", tty_create(true, true))) {
+    int64_t start = esp_timer_get_time();
+    if (!boot_register("TT01", start, tty_create(true, true))) {
         ESP_LOGE(TAG, "Failed to initialize TT01 driver");
-        invalidate_ota_partition();
+        ok = false;
     }
 
-    if (!device_register("I2CBUS0", badgevms_i2c_bus_create("I2CBUS0", 0, I2C0_MASTER_FREQ_HZ))) {
-        ESP_LOGE(TAG, "Failed to initialize I2CBUS0 driver");
+    // Only started for the programs that look at it, after I2CBUS0 has set up the port
+    device_register_lazy("ORIENTATION0", bosch_bmi270_sensor_create);
+    return ok;
+}
+
+static bool boot_compositor(void) {
+    int64_t start = esp_timer_get_time();
+    bool    ok    = compositor_init("PANEL0", "KEYBOARD0");
+    boot_profile_stage("compositor", start);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to initialize compositor");
+        return false;
+    }
+
+    // Allowed to fail
+    device_register("COMPOSITOR0", compositor_device_create());
+    device_register("CAPTURE0", capture_device_create());
+    return true;
+}
+
+static boot_step_t const boot_steps[BOOT_NUM_STEPS] = {
+    [BOOT_FLASH]       = {"flash", boot_flash, 0, true},
+    [BOOT_SD]          = {"sd", boot_sd, BOOT_AFTER(BOOT_FLASH), true},
+    [BOOT_NETWORK]     = {"network", boot_network, 0, true},
+    [BOOT_PANEL]       = {"panel", boot_panel, 0, false},
+    [BOOT_KEYBOARD]    = {"keyboard", boot_keyboard, 0, false},
+    [BOOT_PERIPHERALS] = {"peripherals", boot_peripherals, BOOT_AFTER(BOOT_KEYBOARD), false},
+    [BOOT_COMPOSITOR]  = {"compositor", boot_compositor, BOOT_AFTER(BOOT_PANEL) | BOOT_AFTER(BOOT_KEYBOARD), false},
+};
+
+static StaticEventGroup_t boot_done_buffer;
+static EventGroupHandle_t boot_done;
+static StaticSemaphore_t  boot_lock_buffer;
+static SemaphoreHandle_t  boot_lock;
+static uint32_t           boot_started;
+
+// Run steps until there are none left this core may take
+static void boot_work(bool core0) {
+    while (1) {
+        uint32_t done = xEventGroupGetBits(boot_done);
+        int      next = -1;
+
+        xSemaphoreTake(boot_lock, portMAX_DELAY);
+        for (int i = 0; i < BOOT_NUM_STEPS; ++i) {
+            boot_step_t const *step = &boot_steps[i];
+            if (!(boot_started & BOOT_AFTER(i)) && (core0 || step->any_core) && (step->after & done) == step->after) {
+                next          = i;
+                boot_started |= BOOT_AFTER(i);
+                break;
+            }
+        }
+        uint32_t pending = BOOT_ALL & ~boot_started;
+        uint32_t running = boot_started & ~done;
+        xSemaphoreGive(boot_lock);
+
+        if (next >= 0) {
+            int64_t start = esp_timer_get_time();
+            if (!boot_steps[next].run()) {
+                invalidate_ota_partition();
+            }
+            ESP_LOGI(
+                TAG,
+                "Boot step %s done in %lld ms on core %d",
+                boot_steps[next].name,
+                (esp_timer_get_time() - start) / 1000,
+                xPortGetCoreID()
+            );
+            xEventGroupSetBits(boot_done, BOOT_AFTER(next));
+        } else if (pending && running) {
+            // Something still to do waits for a step that is running
+            xEventGroupWaitBits(boot_done, running, pdFALSE, pdFALSE, portMAX_DELAY);
+        } else {
+            return;
+        }
+    }
+}
+
+static void prometheus(void *ignored) {
+    boot_work(false);
+    vTaskDelete(NULL);
+}
+
+static void boot_devices(void) {
+    boot_done = xEventGroupCreateStatic(&boot_done_buffer);
+    boot_lock = xSemaphoreCreateMutexStatic(&boot_lock_buffer);
+
+    // Without it everything is done here
+    if (create_kernel_task(prometheus, "Prometheus", 4096, NULL, uxTaskPriorityGet(NULL), NULL, 1) != pdPASS) {
+        ESP_LOGW(TAG, "Booting on a single core");
+    }
+
+    boot_work(true);
+    xEventGroupWaitBits(boot_done, BOOT_ALL, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+int app_main(void) {
+    printf("BadgeVMS Initializing...\n");
+    size_t free_ram = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    ESP_LOGW(TAG, "Free main memory: %zi", free_ram);
+
+    // Before memory_init(), which keeps the result of the memory test in NVS
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+
+    // If this fails we won't make it past here
+    int64_t start = esp_timer_get_time();
+    memory_init();
+    boot_profile_stage("memory_init", start);
+
+    start = esp_timer_get_time();
+    if (!task_init()) {
+        ESP_LOGE(TAG, "Failed to initialize tasking subsystem");
         invalidate_ota_partition();
     }
+    boot_profile_stage("task_init", start);
+
+    // Allowed to fail, boot profiles are then only kept until the next boot
+    boot_profile_init();
+
+    // Allowed to fail, copies and fills are then done by the CPU
+    dma_mem_init();
+
+    // Allowed to fail, memory is then cleared when it is allocated
+    page_zeroer_init();
+
+    // Allowed to fail, programs then read their relocation tables themselves
+    readahead_init();
+
+    // Allowed to fail, the cache counters are then only folded when tasks switch
+    cache_counters_init();
+
+    // Allowed to fail, the CPU then stays at full speed
+    governor_init();
+
+    // Allowed to fail, applications then only learn about memory pressure by polling
+    memory_pressure_init();
 
-    if (!device_register("ORIENTATION0", bosch_bmi270_sensor_create())) {
-        ESP_LOGE(TAG, "Failed to initialize ORIENTATION0 driver");
-        // invalidate_ota_partition();
+    // Allowed to fail, waiting on sockets then fails
+    wait_init();
+
+    // Allowed to fail, every name is then looked up by lwIP
+    dns_cache_init();
+
+    // Allowed to fail, applications then decode JPEGs themselves
+    jpeg_init();
+
+    // Allowed to fail, applications then can't keep settings
+    settings_init();
+
+    start = esp_timer_get_time();
+    if (!device_init()) {
+        ESP_LOGE(TAG, "Failed to initialize device subsystem");
+        invalidate_ota_partition();
     }
+    boot_profile_stage("device_init", start);
 
-    if (!compositor_init("PANEL0", "KEYBOARD0")) {
-        ESP_LOGE(TAG, "Failed to initialize compositor");
+    if (!logical_names_system_init()) {
+        ESP_LOGE(TAG, "Failed to initialize logical names subsystem");
         invalidate_ota_partition();
     }
 
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    // Every driver and the compositor, on both cores
+    boot_devices();
+
     logical_name_set("SEARCH", "FLASH0:[SUBDIR], FLASH0:[SUBDIR.ANOTHER]", false);
 
     printf("BadgeVMS is ready\n");
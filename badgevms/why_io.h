@@ -34,6 +34,10 @@ off_t   why_lseek(int fd, off_t offset, int whence);
 int     why_open(char const *pathname, int flags, mode_t mode);
 int     why_close(int fd);
 
+// How stdio should buffer fd opened with flags, _IOFBF or _IOLBF. size is set
+// to the buffer to use or 0 for the default.
+int why_fd_buffering(int fd, int flags, size_t *size);
+
 FILE *why_fopen(char const *restrict pathname, char const *restrict mode);
 int   why_fclose(FILE *stream);
 
@@ -85,3 +89,7 @@ DIR           *why_opendir(char const *name);
 struct dirent *why_readdir(DIR *dirp);
 int            why_closedir(DIR *dirp);
 void           why_rewinddir(DIR *dirp);
+
+// Drop the cached listings that resolved_path, which was created or removed,
+// shows up in, see why_opendir()
+void dir_cache_invalidate(char const *resolved_path);
@@ -15,13 +15,19 @@
  */
 
 #include "badgevms/pathfuncs.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
 #include "logical_names.h"
+#include "syscall_stats.h"
 #include "task.h"
 #include "why_io.h"
 
 #include <dirent.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/errno.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -38,19 +44,70 @@ typedef khash_t(seen) * seen_names_t;
 typedef int (*fs_operation_func)(filesystem_device_t *fs_dev, path_t *path, void *extra_data);
 typedef int (*why_helper_func)(char const *resolved_path, void *extra_data);
 
-typedef struct why_dirent_entry {
-    struct dirent            dirent;        // Standard dirent structure
-    char                    *badgevms_name; // BadgeVMS name
-    struct why_dirent_entry *next;
+// Merged listings of the most recently opened directories
+#define DIR_CACHE_SLOTS 8
+
+// A name in a merged listing, the names follow the entries
+typedef struct {
+    uint32_t name; // Offset from the first entry
+    ino_t    ino;
+    uint8_t  type;
 } why_dirent_entry_t;
 
-typedef struct why_dir {
-    char               *original_badgevms_path; // Original BadgeVMS path requested
+// The merged listing of the locations a search list resolved to, in SPIRAM
+// so every process can copy it. The entries with their names are one block.
+typedef struct {
+    int                 refs; // The cache's and those of why_opendir() copying it
+    uint32_t            last_use;
+    size_t              count;
+    size_t              size;          // Of the entries with their names
+    size_t              locations_len; // The locations one after another, each 0 terminated
+    char const         *locations;
     why_dirent_entry_t *entries;
-    why_dirent_entry_t *current;
-    size_t              entry_count;
+} dir_listing_t;
+
+typedef struct why_dir {
+    struct dirent      dirent; // Returned by why_readdir(), the next call overwrites it
+    size_t             count;
+    size_t             current;
+    why_dirent_entry_t entries[]; // Copied from the listing
 } why_dir_t;
 
+// Entries and names while reading the locations
+typedef struct {
+    why_dirent_entry_t *entries;
+    size_t              count;
+    size_t              capacity;
+    char               *names;
+    size_t              names_size;
+    size_t              names_capacity;
+    seen_names_t        seen;
+} dir_builder_t;
+
+static portMUX_TYPE   dir_cache_lock = portMUX_INITIALIZER_UNLOCKED;
+static dir_listing_t *dir_cache[DIR_CACHE_SLOTS];
+static uint32_t       dir_cache_clock;
+static uint32_t       dir_cache_generation; // Bumped by every invalidation
+
+logical_name_table_t *_Atomic *logical_name_process_table(void) {
+    task_info_t *task_info = get_task_info();
+    return task_info && task_info->thread ? &task_info->thread->logical_names : NULL;
+}
+
+int process_logical_name_set(char const *logical_name, char const *target) {
+    if (!logical_name || !target || !*logical_name) {
+        return -1;
+    }
+    return logical_name_process_set(logical_name, target, false) ? -1 : 0;
+}
+
+int process_logical_name_del(char const *logical_name) {
+    if (!logical_name) {
+        return -1;
+    }
+    return logical_name_process_del(logical_name) ? -1 : 0;
+}
+
 static int _why_filesystem_op(char const *resolved_path, fs_operation_func operation, void *extra_data) {
     path_t parsed_path;
     int    res = parse_path(resolved_path, &parsed_path);
@@ -77,30 +134,26 @@ static int _why_searchlist_first_found(
     char const *pathname, char const *operation_name, why_helper_func helper_func, void *extra_data
 ) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI(operation_name, "Calling %s from task %p for path %s", operation_name, task_info->handle, pathname);
+    ESP_LOGV(operation_name, "Calling %s from task %p for path %s", operation_name, task_info->handle, pathname);
 
-    logical_name_result_t lname        = logical_name_resolve_const(pathname, 0);
-    size_t                result_count = lname.result_count;
+    logical_name_list_t *lname        = logical_name_resolve_all(pathname);
+    size_t               result_count = lname ? lname->result_count : 0;
 
-    ESP_LOGI(operation_name, "Processing %s, %zi options", pathname, result_count);
+    ESP_LOGV(operation_name, "Processing %s, %zi options", pathname, result_count);
     for (int i = 0; i < result_count; ++i) {
-        ESP_LOGI(operation_name, "Trying location: %s", lname.result);
+        ESP_LOGV(operation_name, "Trying location: %s", lname->results[i]);
 
-        int result = helper_func(lname.result, extra_data);
+        int result = helper_func(lname->results[i], extra_data);
         if (result == 0) {
-            ESP_LOGI(operation_name, "Success at %s", lname.result);
-            logical_name_result_free(lname);
+            ESP_LOGV(operation_name, "Success at %s", lname->results[i]);
+            logical_name_list_free(lname);
             return 0;
         }
-
-        logical_name_result_free(lname);
-        ESP_LOGI(operation_name, "Resolving at index %i", i + 1);
-        lname = logical_name_resolve_const(pathname, i + 1);
     }
 
     task_info->_errno = ENOENT;
-    logical_name_result_free(lname);
-    ESP_LOGI(operation_name, "%s failed in all search locations", pathname);
+    logical_name_list_free(lname);
+    ESP_LOGV(operation_name, "%s failed in all search locations", pathname);
     return -1;
 }
 
@@ -108,35 +161,31 @@ static int _why_searchlist_try_all(
     char const *pathname, char const *operation_name, why_helper_func helper_func, void *extra_data
 ) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI(operation_name, "Calling %s from task %p for path %s", operation_name, task_info->handle, pathname);
+    ESP_LOGV(operation_name, "Calling %s from task %p for path %s", operation_name, task_info->handle, pathname);
 
-    logical_name_result_t lname        = logical_name_resolve_const(pathname, 0);
-    size_t                result_count = lname.result_count;
-    bool                  any_success  = false;
+    logical_name_list_t *lname        = logical_name_resolve_all(pathname);
+    size_t               result_count = lname ? lname->result_count : 0;
+    bool                 any_success  = false;
 
-    ESP_LOGI(operation_name, "Processing %s in all %zi locations", pathname, result_count);
+    ESP_LOGV(operation_name, "Processing %s in all %zi locations", pathname, result_count);
     for (int i = 0; i < result_count; ++i) {
-        ESP_LOGI(operation_name, "Trying location: %s", lname.result);
+        ESP_LOGV(operation_name, "Trying location: %s", lname->results[i]);
 
-        int result = helper_func(lname.result, extra_data);
+        int result = helper_func(lname->results[i], extra_data);
         if (result == 0) {
-            ESP_LOGI(operation_name, "Success at %s", lname.result);
+            ESP_LOGV(operation_name, "Success at %s", lname->results[i]);
             any_success = true;
         }
-
-        logical_name_result_free(lname);
-        ESP_LOGI(operation_name, "Resolving at index %i", i + 1);
-        lname = logical_name_resolve_const(pathname, i + 1);
     }
 
-    logical_name_result_free(lname);
+    logical_name_list_free(lname);
 
     if (any_success) {
-        ESP_LOGI(operation_name, "%s succeeded in at least one location", pathname);
+        ESP_LOGV(operation_name, "%s succeeded in at least one location", pathname);
         return 0;
     } else {
         task_info->_errno = ENOENT;
-        ESP_LOGI(operation_name, "%s failed in all search locations", pathname);
+        ESP_LOGV(operation_name, "%s failed in all search locations", pathname);
         return -1;
     }
 }
@@ -170,6 +219,10 @@ static int _why_rename_single(char const *oldpath_resolved, char const *newpath_
     }
 
     int result = fs_device->_rename(fs_device, &parsed_oldpath, &parsed_newpath);
+    if (result == 0) {
+        dir_cache_invalidate(oldpath_resolved);
+        dir_cache_invalidate(newpath_resolved);
+    }
 
     path_free(&parsed_oldpath);
     path_free(&parsed_newpath);
@@ -207,20 +260,30 @@ static int _why_stat_wrapper(char const *resolved_path, void *extra_data) {
     return _why_filesystem_op(resolved_path, _stat_operation, statbuf);
 }
 
+// The operations below change directories, so cached listings of them go
+static int _why_changed(char const *resolved_path, int result) {
+    if (result == 0) {
+        dir_cache_invalidate(resolved_path);
+    }
+    return result;
+}
+
 static int _why_unlink_wrapper(char const *resolved_path, void *extra_data) {
-    return _why_filesystem_op(resolved_path, _unlink_operation, NULL);
+    return _why_changed(resolved_path, _why_filesystem_op(resolved_path, _unlink_operation, NULL));
 }
 
 static int _why_mkdir_wrapper(char const *resolved_path, void *extra_data) {
     mode_t mode = *(mode_t *)extra_data;
-    return _why_filesystem_op(resolved_path, _mkdir_operation, &mode);
+    return _why_changed(resolved_path, _why_filesystem_op(resolved_path, _mkdir_operation, &mode));
 }
 
 static int _why_rmdir_wrapper(char const *resolved_path, void *extra_data) {
-    return _why_filesystem_op(resolved_path, _rmdir_operation, NULL);
+    return _why_changed(resolved_path, _why_filesystem_op(resolved_path, _rmdir_operation, NULL));
 }
 
 int why_stat(char const *restrict pathname, struct stat *restrict statbuf) {
+    SYSCALL_TIMED(SYSCALL_STAT);
+
     if (!pathname || !statbuf) {
         get_task_info()->_errno = EINVAL;
         return -1;
@@ -253,8 +316,10 @@ int why_rmdir(char const *pathname) {
 }
 
 int why_fstat(int fd, struct stat *restrict statbuf) {
+    SYSCALL_TIMED(SYSCALL_STAT);
+
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_fstat", "Calling fstat from task %p for fd %d", task_info->handle, fd);
+    ESP_LOGV("why_fstat", "Calling fstat from task %p for fd %d", task_info->handle, fd);
 
     if (!statbuf) {
         task_info->_errno = EINVAL;
@@ -283,7 +348,7 @@ int why_fstat(int fd, struct stat *restrict statbuf) {
 
 int why_rename(char const *oldpath, char const *newpath) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_rename", "Calling rename from task %p: %s -> %s", task_info->handle, oldpath, newpath);
+    ESP_LOGV("why_rename", "Calling rename from task %p: %s -> %s", task_info->handle, oldpath, newpath);
 
     if (!oldpath || !newpath) {
         task_info->_errno = EINVAL;
@@ -292,31 +357,27 @@ int why_rename(char const *oldpath, char const *newpath) {
 
     // For rename, we use first-found semantics on oldpath
     // and assume newpath should be on the same filesystem
-    logical_name_result_t oldname   = logical_name_resolve_const(oldpath, 0);
+    logical_name_list_t  *oldname   = logical_name_resolve_all(oldpath);
     logical_name_result_t newname   = logical_name_resolve_const(newpath, 0);
-    size_t                old_count = oldname.result_count;
+    size_t                old_count = oldname ? oldname->result_count : 0;
 
-    ESP_LOGI("why_rename", "Finding oldpath %s, %zi options", oldpath, old_count);
+    ESP_LOGV("why_rename", "Finding oldpath %s, %zi options", oldpath, old_count);
     for (int i = 0; i < old_count; ++i) {
-        ESP_LOGI("why_rename", "Trying oldpath location: %s", oldname.result);
+        ESP_LOGV("why_rename", "Trying oldpath location: %s", oldname->results[i]);
 
-        int rename_result = _why_rename_single(oldname.result, newname.result);
+        int rename_result = _why_rename_single(oldname->results[i], newname.result);
         if (rename_result == 0) {
-            ESP_LOGI("why_rename", "Successfully renamed %s to %s", oldname.result, newname.result);
-            logical_name_result_free(oldname);
+            ESP_LOGV("why_rename", "Successfully renamed %s to %s", oldname->results[i], newname.result);
+            logical_name_list_free(oldname);
             logical_name_result_free(newname);
             return 0;
         }
-
-        logical_name_result_free(oldname);
-        ESP_LOGI("why_rename", "Resolving oldpath at index %i", i + 1);
-        oldname = logical_name_resolve_const(oldpath, i + 1);
     }
 
     task_info->_errno = ENOENT;
-    logical_name_result_free(oldname);
+    logical_name_list_free(oldname);
     logical_name_result_free(newname);
-    ESP_LOGI("why_rename", "Rename %s -> %s failed in all search locations", oldpath, newpath);
+    ESP_LOGV("why_rename", "Rename %s -> %s failed in all search locations", oldpath, newpath);
     return -1;
 }
 
@@ -377,40 +438,166 @@ static void seen_names_cleanup(seen_names_t seen) {
     kh_destroy(seen, seen);
 }
 
-static why_dirent_entry_t *create_dirent_entry(const struct dirent *original_dirent, char const *badgevms_name) {
-    why_dirent_entry_t *entry = why_malloc(sizeof(why_dirent_entry_t));
-    if (!entry)
-        return NULL;
+static void dir_listing_put(dir_listing_t *listing) {
+    portENTER_CRITICAL(&dir_cache_lock);
+    bool last = !--listing->refs;
+    portEXIT_CRITICAL(&dir_cache_lock);
 
-    memcpy(&entry->dirent, original_dirent, sizeof(struct dirent));
+    if (last) {
+        heap_caps_free(listing);
+    }
+}
 
-    entry->badgevms_name = why_strdup(badgevms_name);
-    if (!entry->badgevms_name) {
-        why_free(entry);
-        return NULL;
+// The cached listing of these locations with a reference taken, or NULL
+static dir_listing_t *dir_cache_get(char const *locations, size_t locations_len, uint32_t *generation) {
+    dir_listing_t *listing = NULL;
+
+    portENTER_CRITICAL(&dir_cache_lock);
+    *generation = dir_cache_generation;
+    for (int i = 0; i < DIR_CACHE_SLOTS; ++i) {
+        dir_listing_t *l = dir_cache[i];
+        if (l && l->locations_len == locations_len && !memcmp(l->locations, locations, locations_len)) {
+            listing           = l;
+            listing->last_use = ++dir_cache_clock;
+            ++listing->refs;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&dir_cache_lock);
+
+    return listing;
+}
+
+// Unless something changed since generation, when listing may be stale
+// already. Replaces the least recently used listing.
+static void dir_cache_insert(dir_listing_t *listing, uint32_t generation) {
+    dir_listing_t *evicted = NULL;
+
+    portENTER_CRITICAL(&dir_cache_lock);
+    if (generation == dir_cache_generation) {
+        int slot = 0;
+        for (int i = 0; i < DIR_CACHE_SLOTS; ++i) {
+            if (!dir_cache[i]) {
+                slot = i;
+                break;
+            }
+            if (dir_cache[i]->last_use < dir_cache[slot]->last_use) {
+                slot = i;
+            }
+        }
+        evicted           = dir_cache[slot];
+        dir_cache[slot]   = listing;
+        listing->last_use = ++dir_cache_clock;
+        ++listing->refs;
+    }
+    portEXIT_CRITICAL(&dir_cache_lock);
+
+    if (evicted) {
+        dir_listing_put(evicted);
     }
+}
 
-    strncpy(entry->dirent.d_name, badgevms_name, sizeof(entry->dirent.d_name) - 1);
-    entry->dirent.d_name[sizeof(entry->dirent.d_name) - 1] = '\0';
+// The directory a location lists, [A.B]C is A.B.C
+static void dir_cache_directory(path_t const *path, char *buf, size_t size) {
+    char const *directory = path->directory ? path->directory : "";
+    if (path->filename) {
+        snprintf(buf, size, "%s%s%s", directory, *directory ? "." : "", path->filename);
+    } else {
+        snprintf(buf, size, "%s", directory);
+    }
+}
 
-    entry->next = NULL;
-    return entry;
+// Whether something created or removed at changed can show up in the listing
+// of location. It can if it's in the directory or below it, below only
+// affects a subdirectory's entry but is cheaper to check than to miss.
+static bool dir_cache_covers(char const *location, path_t const *changed) {
+    path_t parsed;
+    if (parse_path(location, &parsed) != PATH_PARSE_OK) {
+        return true;
+    }
+    if (strcasecmp(parsed.device, changed->device)) {
+        return false;
+    }
+
+    char directory[PATH_MAX_LEN + 1];
+    dir_cache_directory(&parsed, directory, sizeof(directory));
+
+    char const *changed_directory = changed->directory ? changed->directory : "";
+    size_t      len               = strlen(directory);
+    if (!len) {
+        return true;
+    }
+    return !strncasecmp(changed_directory, directory, len) &&
+           (changed_directory[len] == '\0' || changed_directory[len] == '.');
 }
 
-static void free_dirent_entry(why_dirent_entry_t *entry) {
-    if (entry) {
-        why_free(entry->badgevms_name);
-        why_free(entry);
+void dir_cache_invalidate(char const *resolved_path) {
+    path_t changed;
+    bool   parsed = parse_path(resolved_path, &changed) == PATH_PARSE_OK;
+
+    dir_listing_t *stale[DIR_CACHE_SLOTS];
+    int            num_stale = 0;
+
+    portENTER_CRITICAL(&dir_cache_lock);
+    ++dir_cache_generation;
+    for (int i = 0; i < DIR_CACHE_SLOTS; ++i) {
+        dir_listing_t *listing = dir_cache[i];
+        if (!listing) {
+            continue;
+        }
+
+        bool        covers   = !parsed;
+        char const *location = listing->locations;
+        while (!covers && location < listing->locations + listing->locations_len) {
+            covers    = dir_cache_covers(location, &changed);
+            location += strlen(location) + 1;
+        }
+        if (covers) {
+            stale[num_stale++] = listing;
+            dir_cache[i]       = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&dir_cache_lock);
+
+    for (int i = 0; i < num_stale; ++i) {
+        dir_listing_put(stale[i]);
     }
 }
 
-static void add_entry_to_list(why_dir_t *dir, why_dirent_entry_t *entry) {
-    entry->next  = dir->entries;
-    dir->entries = entry;
-    dir->entry_count++;
+static bool dir_builder_add(dir_builder_t *builder, struct dirent const *dirent) {
+    size_t name_len = strlen(dirent->d_name) + 1;
+
+    if (builder->count == builder->capacity) {
+        size_t              capacity = builder->capacity ? builder->capacity * 2 : 32;
+        why_dirent_entry_t *entries  = why_realloc(builder->entries, capacity * sizeof(why_dirent_entry_t));
+        if (!entries) {
+            return false;
+        }
+        builder->entries  = entries;
+        builder->capacity = capacity;
+    }
+
+    if (builder->names_size + name_len > builder->names_capacity) {
+        size_t capacity = MAX(builder->names_capacity * 2, builder->names_size + name_len + 512);
+        char  *names    = why_realloc(builder->names, capacity);
+        if (!names) {
+            return false;
+        }
+        builder->names          = names;
+        builder->names_capacity = capacity;
+    }
+
+    builder->entries[builder->count++] = (why_dirent_entry_t){
+        .name = builder->names_size,
+        .ino  = dirent->d_ino,
+        .type = dirent->d_type,
+    };
+    memcpy(builder->names + builder->names_size, dirent->d_name, name_len);
+    builder->names_size += name_len;
+    return true;
 }
 
-static bool read_directory_location(char const *resolved_path, why_dir_t *merged_dir, seen_names_t seen) {
+static bool read_directory_location(char const *resolved_path, dir_builder_t *builder) {
     path_t parsed_path;
     int    res = parse_path(resolved_path, &parsed_path);
 
@@ -442,11 +629,8 @@ static bool read_directory_location(char const *resolved_path, why_dir_t *merged
             continue;
         }
 
-        if (seen_names_add(seen, entry->d_name)) {
-            why_dirent_entry_t *new_entry = create_dirent_entry(entry, entry->d_name);
-            if (new_entry) {
-                add_entry_to_list(merged_dir, new_entry);
-            }
+        if (seen_names_add(builder->seen, entry->d_name)) {
+            dir_builder_add(builder, entry);
         }
     }
 
@@ -456,72 +640,124 @@ static bool read_directory_location(char const *resolved_path, why_dir_t *merged
     return true;
 }
 
+// Read every location, the first one with a name shadows the others. NULL if
+// none of them could be read.
+static dir_listing_t *dir_listing_read(
+    logical_name_list_t const *lname, char const *locations, size_t locations_len, int *error
+) {
+    dir_builder_t builder             = {0};
+    bool          found_any_directory = false;
+
+    seen_names_init(&builder.seen);
+    for (size_t i = 0; i < lname->result_count; ++i) {
+        if (!lname->results[i]) {
+            continue;
+        }
+
+        ESP_LOGV("why_opendir", "Trying location: %s", lname->results[i]);
+        if (read_directory_location(lname->results[i], &builder)) {
+            ESP_LOGV("why_opendir", "Successfully read entries from %s", lname->results[i]);
+            found_any_directory = true;
+        }
+    }
+    seen_names_cleanup(builder.seen);
+
+    dir_listing_t *listing = NULL;
+    *error                 = ENOENT;
+    if (found_any_directory) {
+        size_t entries_size = builder.count * sizeof(why_dirent_entry_t);
+        size_t size         = entries_size + builder.names_size;
+
+        *error  = ENOMEM;
+        listing = heap_caps_malloc(sizeof(dir_listing_t) + size + locations_len, MALLOC_CAP_SPIRAM);
+        if (listing) {
+            listing->refs          = 1;
+            listing->last_use      = 0;
+            listing->count         = builder.count;
+            listing->size          = size;
+            listing->locations_len = locations_len;
+            listing->entries       = (why_dirent_entry_t *)(listing + 1);
+            listing->locations     = (char *)listing->entries + size;
+
+            for (size_t i = 0; i < builder.count; ++i) {
+                builder.entries[i].name += entries_size;
+            }
+            memcpy(listing->entries, builder.entries, entries_size);
+            memcpy((char *)listing->entries + entries_size, builder.names, builder.names_size);
+            memcpy((char *)listing->locations, locations, locations_len);
+        }
+    }
+
+    why_free(builder.entries);
+    why_free(builder.names);
+    return listing;
+}
+
+// Reading a search list merges the listings of every location it resolves
+// to. The merged listing is cached until something is created or removed in
+// one of the locations, see dir_cache_invalidate().
 DIR *why_opendir(char const *name) {
+    SYSCALL_TIMED(SYSCALL_OPEN);
+
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_opendir", "Calling opendir from task %p for path %s", task_info->handle, name);
+    ESP_LOGV("why_opendir", "Calling opendir from task %p for path %s", task_info->handle, name);
 
     if (!name) {
         task_info->_errno = EINVAL;
         return NULL;
     }
 
-    why_dir_t *merged_dir = why_malloc(sizeof(why_dir_t));
-    if (!merged_dir) {
-        task_info->_errno = ENOMEM;
+    logical_name_list_t *lname = logical_name_resolve_all(name);
+    if (!lname) {
+        task_info->_errno = ENOENT;
         return NULL;
     }
 
-    merged_dir->original_badgevms_path = why_strdup(name);
-    merged_dir->entries                = NULL;
-    merged_dir->current                = NULL;
-    merged_dir->entry_count            = 0;
-
-    if (!merged_dir->original_badgevms_path) {
-        why_free(merged_dir);
-        task_info->_errno = ENOMEM;
-        return NULL;
+    // The strings follow the array, they are the key of the cache
+    char const *locations     = (char const *)&lname->results[lname->result_count];
+    size_t      locations_len = 0;
+    for (size_t i = 0; i < lname->result_count; ++i) {
+        locations_len += lname->results[i] ? strlen(lname->results[i]) + 1 : 0;
     }
 
-    seen_names_t seen;
-    seen_names_init(&seen);
-
-    logical_name_result_t lname               = logical_name_resolve_const(name, 0);
-    size_t                result_count        = lname.result_count;
-    bool                  found_any_directory = false;
+    uint32_t       generation;
+    dir_listing_t *listing = dir_cache_get(locations, locations_len, &generation);
+    if (!listing) {
+        ESP_LOGV("why_opendir", "Reading directory %s from %zi locations", name, lname->result_count);
 
-    ESP_LOGI("why_opendir", "Reading directory %s from %zi locations", name, result_count);
-    for (int i = 0; i < result_count; ++i) {
-        ESP_LOGI("why_opendir", "Trying location: %s", lname.result);
-
-        if (read_directory_location(lname.result, merged_dir, seen)) {
-            ESP_LOGI("why_opendir", "Successfully read entries from %s", lname.result);
-            found_any_directory = true;
+        int error;
+        listing = dir_listing_read(lname, locations, locations_len, &error);
+        if (!listing) {
+            ESP_LOGV("why_opendir", "No readable directories found for %s", name);
+            logical_name_list_free(lname);
+            task_info->_errno = error;
+            return NULL;
         }
-
-        logical_name_result_free(lname);
-        ESP_LOGI("why_opendir", "Resolving at index %i", i + 1);
-        lname = logical_name_resolve_const(name, i + 1);
+        dir_cache_insert(listing, generation);
     }
+    logical_name_list_free(lname);
 
-    logical_name_result_free(lname);
-    seen_names_cleanup(seen);
+    why_dir_t *merged_dir = why_malloc(sizeof(why_dir_t) + listing->size);
+    if (merged_dir) {
+        merged_dir->count   = listing->count;
+        merged_dir->current = 0;
+        memcpy(merged_dir->entries, listing->entries, listing->size);
+    }
+    dir_listing_put(listing);
 
-    if (!found_any_directory) {
-        ESP_LOGI("why_opendir", "No readable directories found for %s", name);
-        why_free(merged_dir->original_badgevms_path);
-        why_free(merged_dir);
-        task_info->_errno = ENOENT;
+    if (!merged_dir) {
+        task_info->_errno = ENOMEM;
         return NULL;
     }
 
-    merged_dir->current = merged_dir->entries;
-
-    ESP_LOGI("why_opendir", "Successfully opened merged directory %s with %zi entries", name, merged_dir->entry_count);
+    ESP_LOGV("why_opendir", "Successfully opened merged directory %s with %zi entries", name, merged_dir->count);
 
     return (DIR *)merged_dir;
 }
 
 struct dirent *why_readdir(DIR *dirp) {
+    SYSCALL_TIMED(SYSCALL_READDIR);
+
     if (!dirp) {
         get_task_info()->_errno = EBADF;
         return NULL;
@@ -529,36 +765,33 @@ struct dirent *why_readdir(DIR *dirp) {
 
     why_dir_t *merged_dir = (why_dir_t *)dirp;
 
-    if (!merged_dir->current) {
+    if (merged_dir->current == merged_dir->count) {
         return NULL;
     }
 
-    why_dirent_entry_t *current_entry = merged_dir->current;
-    merged_dir->current               = current_entry->next;
+    why_dirent_entry_t const *entry = &merged_dir->entries[merged_dir->current++];
+    char const               *name  = (char const *)merged_dir->entries + entry->name;
 
-    return &current_entry->dirent;
+    merged_dir->dirent.d_ino  = entry->ino;
+    merged_dir->dirent.d_type = entry->type;
+    strncpy(merged_dir->dirent.d_name, name, sizeof(merged_dir->dirent.d_name) - 1);
+    merged_dir->dirent.d_name[sizeof(merged_dir->dirent.d_name) - 1] = '\0';
+
+    return &merged_dir->dirent;
 }
 
 int why_closedir(DIR *dirp) {
+    SYSCALL_TIMED(SYSCALL_CLOSE);
+
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_closedir", "Calling closedir from task %p", task_info->handle);
+    ESP_LOGV("why_closedir", "Calling closedir from task %p", task_info->handle);
 
     if (!dirp) {
         task_info->_errno = EBADF;
         return -1;
     }
 
-    why_dir_t *merged_dir = (why_dir_t *)dirp;
-
-    why_dirent_entry_t *current = merged_dir->entries;
-    while (current) {
-        why_dirent_entry_t *next = current->next;
-        free_dirent_entry(current);
-        current = next;
-    }
-
-    why_free(merged_dir->original_badgevms_path);
-    why_free(merged_dir);
+    why_free(dirp);
 
     return 0;
 }
@@ -571,7 +804,7 @@ void why_rewinddir(DIR *dirp) {
 
     why_dir_t *merged_dir = (why_dir_t *)dirp;
 
-    merged_dir->current = merged_dir->entries;
+    merged_dir->current = 0;
 
     get_task_info()->_errno = 0;
 }
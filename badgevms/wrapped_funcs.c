@@ -15,16 +15,21 @@
  */
 
 #include "badgevms/pathfuncs.h"
+#include "bitops.h"
 #include "esp_flash.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "hrtimer_private.h"
 #include "logical_names.h"
+#include "malloc_cache.h"
 #include "lwip/ip4_addr.h"
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
 #include "rom/uart.h"
+#include "syscall_stats.h"
 #include "task.h"
 #include "thirdparty/dlmalloc.h"
+#include "wait_private.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,15 +41,32 @@
 #include <regex.h>
 #include <string.h>
 #include <sys/errno.h>
+#include <sys/param.h>
+#include <sys/poll.h>
+#include <sys/select.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <wchar.h>
 
 static char const *TAG = "wrapped_functions";
 
-// Our implementation of dlmalloc is not thread safe.
-// Protect the kernel from itself only.
-static SemaphoreHandle_t kernel_malloc_lock = NULL;
+// Of a FILE on a file system, smaller files get what they hold
+#define FILE_BUFFER_SIZE (16 * 1024)
+// What sendfile() reads from the file at a time, four full TCP segments
+#define SENDFILE_CHUNK_SIZE (4 * 1436)
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Of sdk_include/sys/socket.h, lwIP has no recvmmsg() or sendmmsg()
+#define MSG_WAITFORONE 0x10000
+
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int  msg_len;
+};
 
 char *why_environ = NULL;
 
@@ -104,25 +126,44 @@ long why_random() {
 
 int *why___errno() {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_errno", "Calling __errno from task %p", task_info->handle);
+    ESP_LOGV("why_errno", "Calling __errno from task %p", task_info->handle);
     return &task_info->_errno;
 }
 
 int *why_errno() {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_errno", "Calling errno from task %p", task_info->handle);
+    ESP_LOGV("why_errno", "Calling errno from task %p", task_info->handle);
     return &task_info->_errno;
 }
 
+int why_usleep(useconds_t us) {
+    hrtimer_sleep_us(us);
+    return 0;
+}
+
+// Nothing interrupts a sleep, rem is always 0
+int why_nanosleep(struct timespec const *req, struct timespec *rem) {
+    if (!req || req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+
+    hrtimer_sleep_us((uint64_t)req->tv_sec * 1000000 + (req->tv_nsec + 999) / 1000);
+    if (rem) {
+        *rem = (struct timespec){0};
+    }
+    return 0;
+}
+
 int why_isatty(int fd) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_isatty", "Calling isatty from task %p", task_info->handle);
+    ESP_LOGV("why_isatty", "Calling isatty from task %p", task_info->handle);
     return 1;
 }
 
 char *why_getenv(char const *name) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGW("why_getenv", "Calling getenv from task %p variable %s", task_info->handle, name);
+    ESP_LOGV("why_getenv", "Calling getenv from task %p variable %s", task_info->handle, name);
 
     if (strcmp(name, "TERM") == 0) {
         return "line";
@@ -133,86 +174,186 @@ char *why_getenv(char const *name) {
 
 int why_atexit(void (*function)(void)) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_atexit", "Calling atexit from task %p", task_info->handle);
+    ESP_LOGV("why_atexit", "Calling atexit from task %p", task_info->handle);
 
     return 0;
 }
 
+// A process with a single thread has nobody to race with. The kernel arena is
+// shared by all kernel tasks.
+__attribute__((always_inline)) static inline bool malloc_needs_lock(task_info_t *task_info) {
+    return !task_info->pid || atomic_load(&task_info->thread->refcount) > 1;
+}
+
+// The arena ptr was allocated from, locked if need be. Memory allocated by
+// another thread goes back to the arena of that thread, anything else is left
+// to dlmalloc to complain about.
+static IRAM_ATTR malloc_arena_t *malloc_arena_for(task_info_t *task_info, void *ptr, bool lock) {
+    malloc_arena_t *own = task_info->malloc_arena;
+
+    if (lock) {
+        xSemaphoreTake(own->lock, portMAX_DELAY);
+    }
+    if (mspace_owns(&own->state, ptr)) {
+        return own;
+    }
+    if (lock) {
+        xSemaphoreGive(own->lock);
+    }
+
+    for (malloc_arena_t *arena = &task_info->thread->malloc_arena; arena; arena = arena->next) {
+        if (arena == own) {
+            continue;
+        }
+        if (lock) {
+            xSemaphoreTake(arena->lock, portMAX_DELAY);
+        }
+        if (mspace_owns(&arena->state, ptr)) {
+            return arena;
+        }
+        if (lock) {
+            xSemaphoreGive(arena->lock);
+        }
+    }
+
+    if (lock) {
+        xSemaphoreTake(own->lock, portMAX_DELAY);
+    }
+    return own;
+}
+
+void IRAM_ATTR malloc_arena_free_remote(malloc_arena_t *arena, void *ptr) {
+    void *head = atomic_load_explicit(&arena->remote_frees, memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &arena->remote_frees,
+        &head,
+        ptr,
+        memory_order_release,
+        memory_order_relaxed
+    ));
+}
+
+void IRAM_ATTR malloc_arena_drain(malloc_arena_t *arena) {
+    if (likely(!atomic_load_explicit(&arena->remote_frees, memory_order_relaxed))) {
+        return;
+    }
+
+    // Taking the whole list at once, pushing can't race with that
+    void *ptr = atomic_exchange_explicit(&arena->remote_frees, NULL, memory_order_acquire);
+    while (ptr) {
+        void *next = *(void **)ptr;
+        mspace_free(&arena->state, ptr);
+        ptr = next;
+    }
+}
+
 void IRAM_ATTR *why_malloc(size_t size) {
-    task_info_t *task_info = get_task_info();
+    SYSCALL_TIMED(SYSCALL_MALLOC);
 
+    task_info_t *task_info = get_task_info();
     if (!task_info->pid) {
-        xSemaphoreTake(kernel_malloc_lock, portMAX_DELAY);
+        void *ptr = malloc_cache_alloc(size);
+        if (ptr) {
+            return ptr;
+        }
     }
+
+    malloc_arena_t *arena = task_info->malloc_arena;
+    bool            lock  = malloc_needs_lock(task_info);
+
+    if (lock) {
+        xSemaphoreTake(arena->lock, portMAX_DELAY);
+    }
+    malloc_arena_drain(arena);
     // ESP_LOGW("malloc", "Calling malloc(%zi) from task %d", size, task_info->pid);
     void *ptr = dlmalloc(size);
 
     // ESP_LOGI("malloc", "Calling malloc(%zi) from task %d, returning %p", size, task_info->pid, ptr);
-    if (!task_info->pid) {
-        xSemaphoreGive(kernel_malloc_lock);
+    if (lock) {
+        xSemaphoreGive(arena->lock);
     }
     return ptr;
 }
 
 void IRAM_ATTR *why_calloc(size_t nmemb, size_t size) {
+    SYSCALL_TIMED(SYSCALL_MALLOC);
+
     task_info_t *task_info = get_task_info();
+    size_t       total;
+    if (!task_info->pid && !__builtin_mul_overflow(nmemb, size, &total)) {
+        void *ptr = malloc_cache_alloc(total);
+        if (ptr) {
+            return memset(ptr, 0, total);
+        }
+    }
 
-    if (!task_info->pid) {
-        xSemaphoreTake(kernel_malloc_lock, portMAX_DELAY);
+    malloc_arena_t *arena = task_info->malloc_arena;
+    bool            lock  = malloc_needs_lock(task_info);
+
+    if (lock) {
+        xSemaphoreTake(arena->lock, portMAX_DELAY);
     }
+    malloc_arena_drain(arena);
 
-    // task_info_t *task_info = get_task_info();
     // ESP_LOGI("calloc", "Calling calloc(%zi, %zi) from task %d", nmemb, size, task_info->pid);
     void *ptr = dlcalloc(nmemb, size);
 
-    if (!task_info->pid) {
-        xSemaphoreGive(kernel_malloc_lock);
+    if (lock) {
+        xSemaphoreGive(arena->lock);
     }
     return ptr;
 }
 
 void IRAM_ATTR *why_realloc(void *_Nullable ptr, size_t size) {
-    task_info_t *task_info = get_task_info();
-
-    if (!task_info->pid) {
-        xSemaphoreTake(kernel_malloc_lock, portMAX_DELAY);
+    if (!ptr) {
+        return why_malloc(size);
     }
 
-    // task_info_t *task_info = get_task_info();
+    SYSCALL_TIMED(SYSCALL_MALLOC);
+
+    task_info_t    *task_info = get_task_info();
+    bool            lock      = malloc_needs_lock(task_info);
+    malloc_arena_t *arena     = malloc_arena_for(task_info, ptr, lock);
+
     // ESP_LOGI("realloc", "Calling realloc(%p, %zi) from task %d", ptr, size, task_info->pid);
-    void *new_ptr = dlrealloc(ptr, size);
+    void *new_ptr = arena == task_info->malloc_arena ? dlrealloc(ptr, size) : mspace_realloc(&arena->state, ptr, size);
 
-    if (!task_info->pid) {
-        xSemaphoreGive(kernel_malloc_lock);
+    if (lock) {
+        xSemaphoreGive(arena->lock);
     }
     return new_ptr;
 }
 
 void *why_reallocarray(void *_Nullable ptr, size_t nmemb, size_t size) {
-    task_info_t *task_info = get_task_info();
-
-    if (!task_info->pid) {
-        xSemaphoreTake(kernel_malloc_lock, portMAX_DELAY);
-    }
-    // task_info_t *task_info = get_task_info();
     // ESP_LOGI("reallocarray", "Calling reallocarray(%p, %zi, %zi) from task %d", ptr, nmemb, size, task_info->pid);
-    void *new_ptr = dlrealloc(ptr, nmemb * size);
-
-    if (!task_info->pid) {
-        xSemaphoreGive(kernel_malloc_lock);
-    }
-    return new_ptr;
+    return why_realloc(ptr, nmemb * size);
 }
 
 void IRAM_ATTR why_free(void *_Nullable ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    SYSCALL_TIMED(SYSCALL_FREE);
+
     task_info_t *task_info = get_task_info();
+    if (!task_info->pid && malloc_cache_free(ptr)) {
+        return;
+    }
 
-    if (!task_info->pid) {
-        xSemaphoreTake(kernel_malloc_lock, portMAX_DELAY);
+    bool            lock  = malloc_needs_lock(task_info);
+    malloc_arena_t *arena = malloc_arena_for(task_info, ptr, lock);
+
+    if (arena == task_info->malloc_arena) {
+        dlfree(ptr);
+    } else {
+        mspace_free(&arena->state, ptr);
     }
-    dlfree(ptr);
-    if (!task_info->pid) {
-        xSemaphoreGive(kernel_malloc_lock);
+
+    if (lock) {
+        xSemaphoreGive(arena->lock);
     }
 }
 
@@ -288,75 +429,247 @@ char *why_strndup(char const *s, size_t n) {
     return ptr;
 }
 
+// The open file behind fd, NULL with errno EBADF if there is none
+__attribute__((always_inline)) static inline file_handle_t *fd_get(task_info_t *task_info, int fd) {
+    if (fd < 0 || fd >= MAXFD || !task_info->thread->file_handles[fd].is_open) {
+        task_info->_errno = EBADF;
+        return NULL;
+    }
+    return &task_info->thread->file_handles[fd];
+}
+
+// The lowest free fd of task_info, set up for dev_fd on device. -1 with errno
+// EMFILE if there is none. Threads of a process open files at the same time,
+// so fds are claimed in the bitmap rather than by a scan of file_handles.
+int fd_alloc(task_info_t *task_info, int dev_fd, device_t *device) {
+    task_thread_t *thread = task_info->thread;
+
+    for (int i = 0; i < MAXFD / 32; ++i) {
+        unsigned int used = atomic_load(&thread->fd_used[i]);
+        while (~used) {
+            int bit = ffs32(~used) - 1;
+            if (atomic_compare_exchange_weak(&thread->fd_used[i], &used, used | (1u << bit))) {
+                file_handle_t *handle = &thread->file_handles[i * 32 + bit];
+                handle->dev_fd        = dev_fd;
+                handle->device        = device;
+                handle->read          = device->_read;
+                handle->write         = device->_write;
+                handle->is_open       = true;
+                return i * 32 + bit;
+            }
+        }
+    }
+
+    task_info->_errno = EMFILE;
+    return -1;
+}
+
+static void fd_release(task_thread_t *thread, int fd) {
+    memset(&thread->file_handles[fd], 0, sizeof(file_handle_t));
+    atomic_fetch_and(&thread->fd_used[fd / 32], ~(1u << (fd % 32)));
+}
+
 IRAM_ATTR
 ssize_t why_write(int fd, void const *buf, size_t count) {
-    if (fd < 0 || fd >= MAXFD || !get_task_info()->thread->file_handles[fd].is_open) {
-        get_task_info()->_errno = EBADF;
+    SYSCALL_TIMED(SYSCALL_WRITE);
+
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
         return -1;
     }
 
-    task_info_t *task_info = get_task_info();
-    ESP_LOGD("why_write", "Calling write from task %p fd = %i count = %zi", task_info->handle, fd, count);
-    if (task_info->thread->file_handles[fd].device->_write) {
-        return task_info->thread->file_handles[fd].device->_write(
-            task_info->thread->file_handles[fd].device,
-            task_info->thread->file_handles[fd].dev_fd,
-            buf,
-            count
-        );
-    } else {
-        ESP_LOGE("why_write", "fd %i has no valid write function", fd);
+    if (handle->write) {
+        return handle->write(handle->device, handle->dev_fd, buf, count);
     }
+    ESP_LOGE("why_write", "fd %i has no valid write function", fd);
     return 0;
 }
 
 IRAM_ATTR
 ssize_t why_read(int fd, void *buf, size_t count) {
-    if (fd < 0 || fd >= MAXFD || !get_task_info()->thread->file_handles[fd].is_open) {
-        get_task_info()->_errno = EBADF;
+    SYSCALL_TIMED(SYSCALL_READ);
+
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
         return -1;
     }
 
-    task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_read", "Calling read from task %p fd = %i count = %zi", task_info->handle, fd, count);
-    if (task_info->thread->file_handles[fd].device->_read) {
-        ESP_LOGD(
-            "why_read",
-            "Calling driver _read(%p, %i, %p, %zi)",
-            task_info->thread->file_handles[fd].device,
-            task_info->thread->file_handles[fd].dev_fd,
-            buf,
-            count
-        );
-        return task_info->thread->file_handles[fd].device->_read(
-            task_info->thread->file_handles[fd].device,
-            task_info->thread->file_handles[fd].dev_fd,
-            buf,
-            count
-        );
-    } else {
-        ESP_LOGE("why_read", "fd %i has no valid read function", fd);
+    if (handle->read) {
+        return handle->read(handle->device, handle->dev_fd, buf, count);
     }
-
+    ESP_LOGE("why_read", "fd %i has no valid read function", fd);
     return 0;
 }
 
+// Stops at the first short read, like a single read() would
+ssize_t why_readv(int fd, struct iovec const *iov, int iovcnt) {
+    SYSCALL_TIMED(SYSCALL_READ);
+
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
+        return -1;
+    }
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX || !handle->read) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t done = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        ssize_t bytes = handle->read(handle->device, handle->dev_fd, iov[i].iov_base, iov[i].iov_len);
+        if (bytes < 0) {
+            return done ? done : -1;
+        }
+        done += bytes;
+        if ((size_t)bytes < iov[i].iov_len) {
+            break;
+        }
+    }
+    return done;
+}
+
+ssize_t why_writev(int fd, struct iovec const *iov, int iovcnt) {
+    SYSCALL_TIMED(SYSCALL_WRITE);
+
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
+        return -1;
+    }
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX || !handle->write) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t done = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        ssize_t bytes = handle->write(handle->device, handle->dev_fd, iov[i].iov_base, iov[i].iov_len);
+        if (bytes < 0) {
+            return done ? done : -1;
+        }
+        done += bytes;
+        if ((size_t)bytes < iov[i].iov_len) {
+            break;
+        }
+    }
+    return done;
+}
+
+// A file system that can't read at an offset gets a seek there and back, which
+// other threads using the same fd at the same time may see
+static ssize_t fd_transfer_at(file_handle_t *handle, void *buf, size_t count, off_t offset, bool write) {
+    device_t *dev = handle->device;
+    off_t     position;
+
+    if ((position = dev->_lseek(dev, handle->dev_fd, 0, SEEK_CUR)) < 0 ||
+        dev->_lseek(dev, handle->dev_fd, offset, SEEK_SET) < 0) {
+        return -1;
+    }
+
+    ssize_t ret = write ? handle->write(dev, handle->dev_fd, buf, count)
+                        : handle->read(dev, handle->dev_fd, buf, count);
+    dev->_lseek(dev, handle->dev_fd, position, SEEK_SET);
+    return ret;
+}
+
+ssize_t why_pread(int fd, void *buf, size_t count, off_t offset) {
+    SYSCALL_TIMED(SYSCALL_READ);
+
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
+        return -1;
+    }
+
+    if (handle->device->type != DEVICE_TYPE_FILESYSTEM) {
+        task_info->_errno = ESPIPE;
+        return -1;
+    }
+    if (!handle->read || offset < 0) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    filesystem_device_t *filesystem = (filesystem_device_t *)handle->device;
+    if (filesystem->_pread) {
+        return filesystem->_pread(handle->device, handle->dev_fd, buf, count, offset);
+    }
+    return fd_transfer_at(handle, buf, count, offset, false);
+}
+
+ssize_t why_pwrite(int fd, void const *buf, size_t count, off_t offset) {
+    SYSCALL_TIMED(SYSCALL_WRITE);
+
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
+        return -1;
+    }
+
+    if (handle->device->type != DEVICE_TYPE_FILESYSTEM) {
+        task_info->_errno = ESPIPE;
+        return -1;
+    }
+    if (!handle->write || offset < 0) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    filesystem_device_t *filesystem = (filesystem_device_t *)handle->device;
+    if (filesystem->_pwrite) {
+        return filesystem->_pwrite(handle->device, handle->dev_fd, buf, count, offset);
+    }
+    return fd_transfer_at(handle, (void *)buf, count, offset, true);
+}
+
 off_t why_lseek(int fd, off_t offset, int whence) {
-    task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_lseek", "Calling lseek from task %p", task_info->handle);
-    if (task_info->thread->file_handles[fd].device->_lseek) {
-        return task_info->thread->file_handles[fd].device->_lseek(
-            task_info->thread->file_handles[fd].device,
-            task_info->thread->file_handles[fd].dev_fd,
-            offset,
-            whence
-        );
-    } else {
-        ESP_LOGE("why_lseek", "fd %i has no valid lseek function", fd);
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+    if (!handle) {
+        return -1;
+    }
+
+    if (handle->device->_lseek) {
+        return handle->device->_lseek(handle->device, handle->dev_fd, offset, whence);
     }
+    ESP_LOGE("why_lseek", "fd %i has no valid lseek function", fd);
     return 0;
 }
 
+int why_fd_buffering(int fd, int flags, size_t *size) {
+    task_info_t   *task_info = get_task_info();
+    file_handle_t *handle    = fd_get(task_info, fd);
+
+    *size = 0;
+    if (!handle) {
+        return _IOFBF;
+    }
+
+    switch (handle->device->type) {
+        // Answers on the console come a line at a time
+        case DEVICE_TYPE_TTY: return _IOLBF;
+        case DEVICE_TYPE_FILESYSTEM: break;
+        default: return _IOFBF;
+    }
+
+    // Every call down to FatFS costs, so read and write in large blocks. A
+    // file that is only read needs no more than it holds.
+    *size = FILE_BUFFER_SIZE;
+    if ((flags & O_ACCMODE) == O_RDONLY) {
+        filesystem_device_t *filesystem = (filesystem_device_t *)handle->device;
+        struct stat          st;
+        if (filesystem->_fstat && filesystem->_fstat(handle->device, handle->dev_fd, &st) == 0) {
+            *size = MIN(*size, (size_t)st.st_size);
+        }
+    }
+    return _IOFBF;
+}
+
 static int _why_open(char const *pathname, int flags, mode_t mode, device_t **device) {
     int    dev_fd = -1;
     path_t parsed_path;
@@ -371,7 +684,7 @@ static int _why_open(char const *pathname, int flags, mode_t mode, device_t **de
         goto out;
     }
 
-    dev_fd = (*device)->_open(device, &parsed_path, flags, mode);
+    dev_fd = (*device)->_open(*device, &parsed_path, flags, mode);
     if (dev_fd < 0) {
         goto out;
     }
@@ -382,10 +695,14 @@ out:
 }
 
 int why_socket(int domain, int type, int protocol) {
+    SYSCALL_TIMED(SYSCALL_SOCKET);
+
     task_info_t *task_info = get_task_info();
-    ESP_LOGW("why_socket", "Calling socket from task %p", task_info->handle);
+    ESP_LOGV("why_socket", "Calling socket from task %p", task_info->handle);
 
-    if (domain != AF_INET || type != SOCK_STREAM || protocol != 0) {
+    int default_protocol = type == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP;
+    if (domain != AF_INET || (type != SOCK_STREAM && type != SOCK_DGRAM) ||
+        (protocol != 0 && protocol != default_protocol)) {
         task_info->_errno = EAFNOSUPPORT;
         return -1;
     }
@@ -396,38 +713,25 @@ int why_socket(int domain, int type, int protocol) {
         return -1;
     }
 
-    int fd = -1;
-
-    for (int i = 0; i < MAXFD; ++i) {
-        if (task_info->thread->file_handles[i].is_open == false) {
-            fd = i;
-            break;
-        }
-    }
-
-    if (fd == -1) {
-        task_info->_errno = ENOMEM;
-        return -1;
-    }
-
-
     int dev_fd = socket(domain, type, protocol);
     if (dev_fd < 0) {
         task_info->_errno = ENOMEM;
         return -1;
     }
 
-    ESP_LOGW("why_socket", "Got device specific fd %i for task fd %i", dev_fd, fd);
-    task_info->thread->file_handles[fd].is_open = true;
-    task_info->thread->file_handles[fd].dev_fd  = dev_fd;
-    task_info->thread->file_handles[fd].device  = dev;
+    int fd = fd_alloc(task_info, dev_fd, dev);
+    if (fd == -1) {
+        close(dev_fd);
+        return -1;
+    }
 
+    ESP_LOGV("why_socket", "Got device specific fd %i for task fd %i", dev_fd, fd);
     return fd;
 }
 
 static inline int _why_task_get_socket(int fd) {
     task_info_t *task_info = get_task_info();
-    ESP_LOGW("why_open_socket", "Calling open socket from task %p fd %i", task_info->handle, fd);
+    ESP_LOGV("why_open_socket", "Calling open socket from task %p fd %i", task_info->handle, fd);
 
     if (fd < 0 || fd >= MAXFD || !task_info->thread->file_handles[fd].is_open) {
         task_info->_errno = EBADF;
@@ -444,6 +748,8 @@ static inline int _why_task_get_socket(int fd) {
 }
 
 int why_listen(int sockfd, int backlog) {
+    SYSCALL_TIMED(SYSCALL_SOCKET);
+
     int sock = _why_task_get_socket(sockfd);
 
     if (sock < 0) {
@@ -456,6 +762,8 @@ int why_listen(int sockfd, int backlog) {
 
 
 int why_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+    SYSCALL_TIMED(SYSCALL_SOCKET);
+
     int sock = _why_task_get_socket(sockfd);
 
     if (sock < 0) {
@@ -474,6 +782,8 @@ int why_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int why_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+    SYSCALL_TIMED(SYSCALL_SOCKET);
+
     int sock = _why_task_get_socket(sockfd);
     if (sock < 0) {
         get_task_info()->_errno = EBADF;
@@ -489,23 +799,20 @@ int why_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 
     task_info_t *task_info = get_task_info();
     ESP_LOGW("why_accept", "Accepted connection on socket %i, new fd %i", sockfd, newfd);
-    for (int i = 0; i < MAXFD; ++i) {
-        if (task_info->thread->file_handles[i].is_open == false) {
-            task_info->thread->file_handles[i].is_open = true;
-            task_info->thread->file_handles[i].dev_fd  = newfd;
-            task_info->thread->file_handles[i].device  = task_info->thread->file_handles[sockfd].device;
-            ESP_LOGW("why_accept", "Assigned new fd %i to accepted socket %i", i, newfd);
-            return i;
-        }
+    int fd = fd_alloc(task_info, newfd, task_info->thread->file_handles[sockfd].device);
+    if (fd == -1) {
+        ESP_LOGE("why_accept", "No free file handles available for new socket %i", newfd);
+        close(newfd);
+        return -1;
     }
 
-    ESP_LOGE("why_accept", "No free file handles available for new socket %i", newfd);
-    get_task_info()->_errno = EMFILE;
-    close(newfd);
-    return -1;
+    ESP_LOGW("why_accept", "Assigned new fd %i to accepted socket %i", fd, newfd);
+    return fd;
 }
 
 int why_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+    SYSCALL_TIMED(SYSCALL_SOCKET);
+
     int sock = _why_task_get_socket(sockfd);
     if (sock < 0) {
         get_task_info()->_errno = EBADF;
@@ -522,29 +829,337 @@ int why_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     return bind(sock, (struct sockaddr *)addr_in, addrlen);
 }
 
+// The socket calls go to lwIP directly, after a single lookup of the descriptor
+ssize_t why_recv(int sockfd, void *buf, size_t len, int flags) {
+    SYSCALL_TIMED(SYSCALL_RECV);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    ssize_t ret = lwip_recv(sock, buf, len, flags);
+    if (ret < 0) {
+        get_task_info()->_errno = errno;
+    }
+    return ret;
+}
+
+ssize_t why_recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen) {
+    SYSCALL_TIMED(SYSCALL_RECV);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    ssize_t ret = lwip_recvfrom(sock, buf, len, flags, from, fromlen);
+    if (ret < 0) {
+        get_task_info()->_errno = errno;
+    }
+    return ret;
+}
+
+ssize_t why_recvmsg(int sockfd, struct msghdr *msg, int flags) {
+    SYSCALL_TIMED(SYSCALL_RECV);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    ssize_t ret = lwip_recvmsg(sock, msg, flags);
+    if (ret < 0) {
+        get_task_info()->_errno = errno;
+    }
+    return ret;
+}
+
+ssize_t why_send(int sockfd, void const *buf, size_t len, int flags) {
+    SYSCALL_TIMED(SYSCALL_SEND);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    ssize_t ret = lwip_send(sock, buf, len, flags);
+    if (ret < 0) {
+        get_task_info()->_errno = errno;
+    }
+    return ret;
+}
+
+ssize_t why_sendto(int sockfd, void const *buf, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
+    SYSCALL_TIMED(SYSCALL_SEND);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    ssize_t ret = lwip_sendto(sock, buf, len, flags, to, tolen);
+    if (ret < 0) {
+        get_task_info()->_errno = errno;
+    }
+    return ret;
+}
+
+ssize_t why_sendmsg(int sockfd, struct msghdr const *msg, int flags) {
+    SYSCALL_TIMED(SYSCALL_SEND);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    ssize_t ret = lwip_sendmsg(sock, msg, flags);
+    if (ret < 0) {
+        get_task_info()->_errno = errno;
+    }
+    return ret;
+}
+
+// Always as with MSG_WAITFORONE, which makes the timeout of Linux moot
+int why_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    SYSCALL_TIMED(SYSCALL_RECV);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    flags &= ~MSG_WAITFORONE;
+
+    unsigned int received = 0;
+    while (received < vlen) {
+        ssize_t ret = lwip_recvmsg(sock, &msgvec[received].msg_hdr, received ? flags | MSG_DONTWAIT : flags);
+        if (ret < 0) {
+            if (!received) {
+                get_task_info()->_errno = errno;
+                return -1;
+            }
+            break;
+        }
+        msgvec[received++].msg_len = ret;
+    }
+    return received;
+}
+
+int why_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    SYSCALL_TIMED(SYSCALL_SEND);
+
+    int sock = _why_task_get_socket(sockfd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    unsigned int sent = 0;
+    while (sent < vlen) {
+        ssize_t ret = lwip_sendmsg(sock, &msgvec[sent].msg_hdr, flags);
+        if (ret < 0) {
+            if (!sent) {
+                get_task_info()->_errno = errno;
+                return -1;
+            }
+            break;
+        }
+        msgvec[sent++].msg_len = ret;
+    }
+    return sent;
+}
+
+// Moves the bytes from the file device to LWIP in the kernel, so they never
+// pass through the caller. Like Linux, with an offset the file position is
+// left alone and *offset is moved on instead.
+ssize_t why_sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    SYSCALL_TIMED(SYSCALL_SEND);
+
+    task_info_t *task_info = get_task_info();
+    int          sock      = _why_task_get_socket(out_fd);
+    if (sock < 0) {
+        return -1;
+    }
+
+    file_handle_t *in = fd_get(task_info, in_fd);
+    if (!in) {
+        return -1;
+    }
+
+    device_t *dev = in->device;
+    if (dev->type != DEVICE_TYPE_FILESYSTEM || !in->read || !dev->_lseek) {
+        task_info->_errno = EINVAL;
+        return -1;
+    }
+
+    off_t position = 0;
+    if (offset) {
+        position = dev->_lseek(dev, in->dev_fd, 0, SEEK_CUR);
+        if (position < 0 || dev->_lseek(dev, in->dev_fd, *offset, SEEK_SET) < 0) {
+            task_info->_errno = EINVAL;
+            return -1;
+        }
+    }
+
+    size_t   chunk = MIN(count, SENDFILE_CHUNK_SIZE);
+    uint8_t *buf   = chunk ? malloc(chunk) : NULL;
+    int      error = chunk && !buf ? ENOMEM : 0;
+    ssize_t  sent  = 0;
+
+    while (buf && (size_t)sent < count) {
+        ssize_t bytes = in->read(dev, in->dev_fd, buf, MIN(count - sent, chunk));
+        if (bytes <= 0) {
+            error = bytes < 0 ? EIO : 0;
+            break;
+        }
+
+        // Only the last segment gets pushed out right away
+        int     flags = (size_t)(sent + bytes) < count ? MSG_MORE : 0;
+        ssize_t done  = 0;
+        while (done < bytes) {
+            ssize_t res = send(sock, buf + done, bytes - done, flags);
+            if (res < 0) {
+                error = errno;
+                break;
+            }
+            done += res;
+        }
+
+        sent += done;
+        if (done < bytes) {
+            // Leave the file at the first byte that didn't go out
+            dev->_lseek(dev, in->dev_fd, done - bytes, SEEK_CUR);
+            break;
+        }
+    }
+    free(buf);
+
+    if (offset) {
+        *offset += sent;
+        dev->_lseek(dev, in->dev_fd, position, SEEK_SET);
+    }
+
+    if (!sent && error) {
+        task_info->_errno = error;
+        return -1;
+    }
+    return sent;
+}
+
+int why_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    SYSCALL_TIMED(SYSCALL_POLL);
+
+    if (nfds > MAXFD || (nfds && !fds)) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+
+    wait_source_t sources[nfds ? nfds : 1];
+    for (nfds_t i = 0; i < nfds; ++i) {
+        sources[i] = (wait_source_t){
+            .type   = fds[i].fd < 0 ? WAIT_SOURCE_NONE : WAIT_SOURCE_FD,
+            .fd     = fds[i].fd,
+            .events = (fds[i].events & (POLLIN | POLLRDNORM) ? WAIT_READABLE : 0) |
+                      (fds[i].events & (POLLOUT | POLLWRNORM) ? WAIT_WRITABLE : 0),
+        };
+    }
+
+    int res = wait_any(sources, nfds, timeout < 0 ? UINT32_MAX : timeout);
+    if (res < 0) {
+        return -1;
+    }
+
+    for (nfds_t i = 0; i < nfds; ++i) {
+        uint16_t revents = sources[i].revents;
+        fds[i].revents   = (revents & WAIT_READABLE ? fds[i].events & (POLLIN | POLLRDNORM) : 0) |
+                           (revents & WAIT_WRITABLE ? fds[i].events & (POLLOUT | POLLWRNORM) : 0) |
+                           (revents & WAIT_ERROR ? POLLERR : 0) | (revents & WAIT_INVALID ? POLLNVAL : 0);
+    }
+    return res;
+}
+
+// Our file descriptors are not the ones of the VFS, so this goes through wait_any() like poll()
+int why_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    SYSCALL_TIMED(SYSCALL_POLL);
+
+    if (nfds < 0 || nfds > MIN(MAXFD, FD_SETSIZE)) {
+        get_task_info()->_errno = EINVAL;
+        return -1;
+    }
+
+    wait_source_t sources[nfds ? nfds : 1];
+    bool          except[nfds ? nfds : 1];
+    int           num_sources = 0;
+    for (int fd = 0; fd < nfds; ++fd) {
+        uint16_t events = (readfds && FD_ISSET(fd, readfds) ? WAIT_READABLE : 0) |
+                          (writefds && FD_ISSET(fd, writefds) ? WAIT_WRITABLE : 0);
+        bool     exc    = exceptfds && FD_ISSET(fd, exceptfds);
+        if (events || exc) {
+            except[num_sources]    = exc;
+            sources[num_sources++] = (wait_source_t){.type = WAIT_SOURCE_FD, .fd = fd, .events = events};
+        }
+    }
+
+    uint32_t timeout_msec = UINT32_MAX;
+    if (timeout) {
+        uint64_t msec = (uint64_t)timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+        timeout_msec  = MIN(msec, UINT32_MAX - 1);
+    }
+
+    if (wait_any(sources, num_sources, timeout_msec) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < num_sources; ++i) {
+        if (sources[i].revents & WAIT_INVALID) {
+            get_task_info()->_errno = EBADF;
+            return -1;
+        }
+    }
+
+    int ready = 0;
+    for (int i = 0; i < num_sources; ++i) {
+        int      fd      = sources[i].fd;
+        uint16_t revents = sources[i].revents;
+        if (readfds && FD_ISSET(fd, readfds) && !(revents & WAIT_READABLE)) {
+            FD_CLR(fd, readfds);
+        }
+        if (writefds && FD_ISSET(fd, writefds) && !(revents & WAIT_WRITABLE)) {
+            FD_CLR(fd, writefds);
+        }
+        if (except[i] && !(revents & WAIT_ERROR)) {
+            FD_CLR(fd, exceptfds);
+        }
+        ready += (readfds && FD_ISSET(fd, readfds)) + (writefds && FD_ISSET(fd, writefds)) +
+                 (except[i] && FD_ISSET(fd, exceptfds));
+    }
+    return ready;
+}
+
 int why_open(char const *pathname, int flags, mode_t mode) {
+    SYSCALL_TIMED(SYSCALL_OPEN);
+
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_open", "Calling open from task %p for path %s", task_info->handle, pathname);
+    ESP_LOGV("why_open", "Calling open from task %p for path %s", task_info->handle, pathname);
 
     int       fd     = -1;
     int       dev_fd = -1;
     device_t *device;
 
-    logical_name_result_t lname        = logical_name_resolve_const(pathname, 0);
-    size_t                result_count = lname.result_count;
+    logical_name_list_t *lname        = logical_name_resolve_all(pathname);
+    size_t               result_count = lname ? lname->result_count : 0;
     // search the list.
-    ESP_LOGI("why_open", "Finding file %s, %zi options\n", pathname, result_count);
+    ESP_LOGV("why_open", "Finding file %s, %zi options", pathname, result_count);
     for (int i = 0; i < result_count; ++i) {
-        ESP_LOGI("why_open", "Trying location: %s\n", lname.result);
-        dev_fd = _why_open(lname.result, flags, mode, &device);
+        ESP_LOGV("why_open", "Trying location: %s", lname->results[i]);
+        dev_fd = _why_open(lname->results[i], flags, mode, &device);
         if (dev_fd >= 0) {
-            ESP_LOGI("why_open", "Found file at %s\n", lname.result);
+            ESP_LOGV("why_open", "Found file at %s", lname->results[i]);
+            if (flags & O_CREAT) {
+                dir_cache_invalidate(lname->results[i]);
+            }
             break;
         }
-
-        logical_name_result_free(lname);
-        ESP_LOGI("why_open", "Resolving at index %i\n", i + 1);
-        lname = logical_name_resolve_const(pathname, i + 1);
     }
 
     if (dev_fd < 0) {
@@ -552,49 +1167,38 @@ int why_open(char const *pathname, int flags, mode_t mode) {
         goto out;
     }
 
-    for (int i = 0; i < MAXFD; ++i) {
-        if (task_info->thread->file_handles[i].is_open == false) {
-            fd = i;
-            break;
-        }
-    }
-
+    fd = fd_alloc(task_info, dev_fd, device);
     if (fd == -1) {
-        task_info->_errno = ENOMEM;
+        device->_close(device, dev_fd);
         goto out;
     }
 
-    ESP_LOGD("why_open", "Got device specific fd %i for task fd %i", dev_fd, fd);
-
-    task_info->thread->file_handles[fd].is_open = true;
-    task_info->thread->file_handles[fd].dev_fd  = dev_fd;
-    task_info->thread->file_handles[fd].device  = device;
+    ESP_LOGV("why_open", "Got device specific fd %i for task fd %i", dev_fd, fd);
 
 out:
-    ESP_LOGI("why_open", "Calling open from task %p for path %s returning %i", task_info->handle, pathname, fd);
-    logical_name_result_free(lname);
+    ESP_LOGV("why_open", "Calling open from task %p for path %s returning %i", task_info->handle, pathname, fd);
+    logical_name_list_free(lname);
     return fd;
 }
 
 int why_close(int fd) {
+    SYSCALL_TIMED(SYSCALL_CLOSE);
+
     task_info_t *task_info = get_task_info();
-    ESP_LOGI("why_close", "Calling close from task %p", task_info->handle);
+    ESP_LOGV("why_close", "Calling close from task %p", task_info->handle);
 
-    if (fd > MAXFD)
-        goto out;
+    file_handle_t *handle = fd_get(task_info, fd);
+    if (!handle) {
+        return -1;
+    }
 
-    if (task_info->thread->file_handles[fd].device->_close) {
-        int ret = task_info->thread->file_handles[fd].device->_close(
-            task_info->thread->file_handles[fd].device,
-            task_info->thread->file_handles[fd].dev_fd
-        );
-        memset(&task_info->thread->file_handles[fd], 0, sizeof(file_handle_t));
+    if (handle->device->_close) {
+        int ret = handle->device->_close(handle->device, handle->dev_fd);
+        fd_release(task_info->thread, fd);
         return ret;
-    } else {
-        ESP_LOGE("why_close", "fd %i has no valid close function", fd);
     }
 
-out:
+    ESP_LOGE("why_close", "fd %i has no valid close function", fd);
     task_info->_errno = EBADF;
     return -1;
 }
@@ -658,7 +1262,8 @@ char const *get_mac_address() {
 void wrapped_functions_init(void) {
     ESP_LOGI(TAG, "Initializing");
 
-    kernel_malloc_lock = xSemaphoreCreateMutex();
+    // dlmalloc itself isn't thread safe, see malloc_arena_t
+    kernel_task.malloc_arena->lock = xSemaphoreCreateMutex();
 }
 
 static __always_inline uint32_t asuint(float f) {
@@ -16,6 +16,12 @@
 
 #pragma once
 
+#include "badgevms/device.h"
+#include "task.h"
+
 char *inet_ntoa(struct in_addr __in);
 int   inet_aton(char const *__cp, struct in_addr *__inp);
 void  wrapped_functions_init(void);
+// The lowest free fd of task_info, set up for dev_fd on device. -1 with errno
+// EMFILE if there is none.
+int   fd_alloc(task_info_t *task_info, int dev_fd, device_t *device);
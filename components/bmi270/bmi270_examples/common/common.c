@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "bmi2_defs.h"
+#include "badgevms_config.h"
 
 #include "esp_log.h"
 
@@ -99,7 +100,7 @@ int8_t bmi2_interface_init(struct bmi2_dev *bmi, uint8_t intf, uint8_t dev_addr,
 
         if (BMI2_OK == result) {
             /* Assign device address and bus instance to interface pointer */
-            i2c_bus_device_handle_t i2c_device_handle = i2c_bus_device_create(bus_inst, dev_addr, 0);
+            i2c_bus_device_handle_t i2c_device_handle = i2c_bus_device_create(bus_inst, dev_addr, BMI270_I2C_FREQ_HZ);
             if (NULL == i2c_device_handle) {
                 ESP_LOGE("BMI2", "i2c_bus_device_create failed");
                 rslt = BMI2_E_NULL_PTR;
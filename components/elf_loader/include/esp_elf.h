@@ -41,6 +41,33 @@ int esp_elf_init(esp_elf_t *elf);
  */
 int esp_elf_relocate(esp_elf_t *elf, const uint8_t *pbuf);
 
+/**
+ * @brief Read from an ELF file for esp_elf_relocate_stream().
+ *
+ * @param ctx    - As passed to esp_elf_relocate_stream()
+ * @param offset - Offset in the ELF file
+ * @param buf    - Where the data goes
+ * @param size   - Bytes to read
+ *
+ * @return 0 if all of size was read or other if failed.
+ */
+typedef int (*esp_elf_read_t)(void *ctx, uint32_t offset, void *buf, uint32_t size);
+
+/**
+ * @brief Decode and relocate an ELF file that is not in memory.
+ *
+ * Only the headers, the symbol and string tables and a few relocation
+ * entries at a time are kept in memory, the loadable segments are read
+ * straight to where they run. Not available with the section loader.
+ *
+ * @param elf  - ELF object pointer
+ * @param read - Reads from the ELF file
+ * @param ctx  - Passed to read
+ *
+ * @return ESP_OK if success or other if failed.
+ */
+int esp_elf_relocate_stream(esp_elf_t *elf, esp_elf_read_t read, void *ctx);
+
 /**
  * @brief Request running relocated ELF function.
  *
@@ -41,6 +41,18 @@ extern "C" {
 #define PT_LOPROC       0x70000000      /*!< Start of processor-specific */
 #define PT_HIPROC       0x7fffffff      /*!< End of processor-specific */
 
+/** @brief Segment flags */
+
+#define PF_X            (1 << 0)        /*!< Segment is executable */
+#define PF_W            (1 << 1)        /*!< Segment is writable */
+#define PF_R            (1 << 2)        /*!< Segment is readable */
+
+/** @brief Dynamic Section Tags */
+
+#define DT_NULL         0               /*!< end of the dynamic section */
+#define DT_NEEDED       1               /*!< string table offset of the name of a needed library */
+#define DT_STRTAB       5               /*!< address of the string table */
+
 /** @brief Section Type */
 
 #define SHT_NULL        0               /*!< invalid section header */
@@ -209,6 +221,13 @@ typedef struct elf32_rela {
     Elf32_Sword     addend;             /*!< Added information */
 } elf32_rela_t;
 
+/** @brief Dynamic section entry */
+
+typedef struct elf32_dyn {
+    Elf32_Sword     tag;                /*!< entry type */
+    Elf32_Word      val;                /*!< integer or address value */
+} elf32_dyn_t;
+
 /** @brief ELF section object */
 
 typedef struct esp_elf_sec {
@@ -224,6 +243,8 @@ typedef struct esp_elf_sec {
 typedef struct esp_elf {
     unsigned char   *psegment;          /*!< segment buffer pointer */
 
+    uint32_t         psegment_size;     /*!< size of a segment buffer set up by the caller, 0 to allocate one */
+
     uint32_t         svaddr;            /*!< start virtual address of segment */
 
     unsigned char   *ptext;             /*!< instruction buffer pointer */
@@ -234,6 +255,14 @@ typedef struct esp_elf {
 
     int (*entry)(int argc, char *argv[]);               /*!< Entry pointer of ELF */
 
+    uintptr_t (*find_sym)(void *ctx, const char *name); /*!< Looks up symbols the firmware doesn't export, may be NULL */
+
+    void            *find_sym_ctx;      /*!< passed to find_sym */
+
+    void (*prefetch)(void *ctx, uint32_t offset, uint32_t size); /*!< Told the tables to read next, may be NULL */
+
+    uint32_t         nr_reloc;          /*!< relocations done, for statistics */
+
 #ifdef CONFIG_ELF_LOADER_SET_MMU
     uint32_t        text_off;           /* .text symbol offset */
 
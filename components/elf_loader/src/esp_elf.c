@@ -19,12 +19,15 @@
 
 //#include "private/elf_symbol.h"
 #include "private/elf_platform.h"
+#include "esp_elf.h"
 
 extern uintptr_t elf_find_sym(const char *sym_name);
 
 #define stype(_s, _t)               ((_s)->type == (_t))
 #define sflags(_s, _f)              (((_s)->flags & (_f)) == (_f))
 #define ADDR_OFFSET                 (0x400)
+/* Relocations read at a time by esp_elf_relocate_stream(), on the stack */
+#define ELF_RELA_CHUNK              (32)
 
 static const char *TAG = "ELF";
 
@@ -211,24 +214,38 @@ static int esp_elf_load_section(esp_elf_t *elf, const uint8_t *pbuf)
 #else
 
 /**
- * @brief Load ELF segment.
+ * @brief Free the segment buffer, unless the caller set it up.
  *
  * @param elf - ELF object pointer
- * @param pbuf - ELF data buffer
+ *
+ * @return None
+ */
+
+static void esp_elf_free_segment(esp_elf_t *elf)
+{
+    if (!elf->psegment_size) {
+        esp_elf_free(elf->psegment);
+    }
+    elf->psegment = NULL;
+}
+
+/**
+ * @brief Check the ELF segments and set up the buffer they go to.
+ *
+ * @param elf - ELF object pointer
+ * @param ehdr - ELF header
+ * @param phdr - ELF program headers
  *
  * @return ESP_OK if success or other if failed.
  */
 
-static int esp_elf_load_segment(esp_elf_t *elf, const uint8_t *pbuf)
+static int esp_elf_alloc_segment(esp_elf_t *elf, const elf32_hdr_t *ehdr, const elf32_phdr_t *phdr)
 {
     uint32_t size;
     bool first_segment = false;
     Elf32_Addr vaddr_s = 0;
     Elf32_Addr vaddr_e = 0;
 
-    const elf32_hdr_t *ehdr = (const elf32_hdr_t *)pbuf;
-    const elf32_phdr_t *phdr = (const elf32_phdr_t *)(pbuf + ehdr->phoff);
-
     for (int i = 0; i < ehdr->phnum; i++) {
         if (phdr[i].type != PT_LOAD) {
             continue;
@@ -280,22 +297,54 @@ static int esp_elf_load_segment(esp_elf_t *elf, const uint8_t *pbuf)
     }
 
     elf->svaddr = vaddr_s;
-    elf->psegment = esp_elf_malloc(size, true);
-    if (!elf->psegment) {
-	ESP_LOGE(TAG, "esp_elf_load_segment !elf->psegment");
-        return -ENOMEM;
+    if (elf->psegment_size) {
+        if (!elf->psegment || size > elf->psegment_size) {
+            ESP_LOGE(TAG, "esp_elf_load_segment segment needs %d bytes, %d provided",
+                     (int)size, (int)elf->psegment_size);
+            return -ENOMEM;
+        }
+    } else {
+        elf->psegment = esp_elf_malloc(size, true);
+        if (!elf->psegment) {
+	    ESP_LOGE(TAG, "esp_elf_load_segment !elf->psegment");
+            return -ENOMEM;
+        }
     }
 
     memset(elf->psegment, 0, size);
 
+    return 0;
+}
+
+/**
+ * @brief Load ELF segment.
+ *
+ * @param elf - ELF object pointer
+ * @param pbuf - ELF data buffer
+ *
+ * @return ESP_OK if success or other if failed.
+ */
+
+static int esp_elf_load_segment(esp_elf_t *elf, const uint8_t *pbuf)
+{
+    int ret;
+
+    const elf32_hdr_t *ehdr = (const elf32_hdr_t *)pbuf;
+    const elf32_phdr_t *phdr = (const elf32_phdr_t *)(pbuf + ehdr->phoff);
+
+    ret = esp_elf_alloc_segment(elf, ehdr, phdr);
+    if (ret) {
+        return ret;
+    }
+
     /* Dump "PT_LOAD" from ELF to memory space */
 
     for (int i = 0; i < ehdr->phnum; i++) {
         if (phdr[i].type == PT_LOAD) {
-            memcpy(elf->psegment + phdr[i].vaddr - vaddr_s,
+            memcpy(elf->psegment + phdr[i].vaddr - elf->svaddr,
                    (uint8_t *)pbuf + phdr[i].offset, phdr[i].filesz);
             ESP_LOGD(TAG, "Copy segment[%d], mem_addr: 0x%x, vaddr: 0x%x, size: 0x%08x",
-                     i, (int)((uint8_t *)elf->psegment + phdr[i].vaddr - vaddr_s),
+                     i, (int)((uint8_t *)elf->psegment + phdr[i].vaddr - elf->svaddr),
                      phdr[i].vaddr, phdr[i].filesz);
         }
     }
@@ -304,7 +353,50 @@ static int esp_elf_load_segment(esp_elf_t *elf, const uint8_t *pbuf)
     cache_ll_writeback_all(CACHE_LL_LEVEL_INT_MEM, CACHE_TYPE_DATA, CACHE_LL_ID_ALL);
 #endif
 
-    elf->entry = (void *)((uint8_t *)elf->psegment + ehdr->entry - vaddr_s);
+    elf->entry = (void *)((uint8_t *)elf->psegment + ehdr->entry - elf->svaddr);
+
+    return 0;
+}
+
+/**
+ * @brief Load ELF segment straight from the file.
+ *
+ * @param elf - ELF object pointer
+ * @param ehdr - ELF header
+ * @param phdr - ELF program headers
+ * @param read - Reads from the ELF file
+ * @param ctx - Passed to read
+ *
+ * @return ESP_OK if success or other if failed.
+ */
+
+static int esp_elf_load_segment_stream(esp_elf_t *elf, const elf32_hdr_t *ehdr, const elf32_phdr_t *phdr,
+                                       esp_elf_read_t read, void *ctx)
+{
+    int ret;
+
+    ret = esp_elf_alloc_segment(elf, ehdr, phdr);
+    if (ret) {
+        return ret;
+    }
+
+    /* Read "PT_LOAD" from ELF file into memory space */
+
+    for (int i = 0; i < ehdr->phnum; i++) {
+        if (phdr[i].type == PT_LOAD && phdr[i].filesz) {
+            if (read(ctx, phdr[i].offset, elf->psegment + phdr[i].vaddr - elf->svaddr, phdr[i].filesz)) {
+                ESP_LOGE(TAG, "Unable to read segment[%d]", i);
+                esp_elf_free_segment(elf);
+                return -EIO;
+            }
+        }
+    }
+
+#if SOC_CACHE_INTERNAL_MEM_VIA_L1CACHE
+    cache_ll_writeback_all(CACHE_LL_LEVEL_INT_MEM, CACHE_TYPE_DATA, CACHE_LL_ID_ALL);
+#endif
+
+    elf->entry = (void *)((uint8_t *)elf->psegment + ehdr->entry - elf->svaddr);
 
     return 0;
 }
@@ -330,6 +422,123 @@ uintptr_t esp_elf_map_sym(esp_elf_t *elf, uintptr_t sym)
     return 0;
 }
 
+/**
+ * @brief Allocate the lookup memo for a symbol table.
+ *
+ * @param shdr - Section header of the symbol table
+ *
+ * @return The memo, NULL if there is no memory for it.
+ */
+static uintptr_t *esp_elf_memo_alloc(const elf32_shdr_t *shdr)
+{
+    uint32_t size = shdr->size / sizeof(elf32_sym_t) * sizeof(uintptr_t);
+    uintptr_t *memo = esp_elf_malloc(size, false);
+
+    if (memo) {
+        memset(memo, 0, size);
+    }
+
+    return memo;
+}
+
+/**
+ * @brief Find a symbol of the kernel or the caller, remembering it per symbol table index.
+ *
+ * @param elf - ELF object pointer
+ * @param name - Symbol name
+ * @param memo - Slot of the symbol in the memo, NULL to always look up
+ *
+ * @return The address or 0 if not found.
+ */
+static uintptr_t esp_elf_find_sym_memo(esp_elf_t *elf, const char *name, uintptr_t *memo)
+{
+    if (memo && *memo) {
+        return *memo;
+    }
+
+    uintptr_t addr = elf_find_sym(name);
+    if (!addr && elf->find_sym) {
+        addr = elf->find_sym(elf->find_sym_ctx, name);
+    }
+    if (memo) {
+        *memo = addr;
+    }
+
+    return addr;
+}
+
+/**
+ * @brief Relocate one entry.
+ *
+ * @param elf - ELF object pointer
+ * @param rela - Relocation entry
+ * @param symtab - Symbol table of the relocation section
+ * @param strtab - String table of the symbol table
+ * @param memo - Addresses found per symbol table index, or NULL
+ *
+ * @return ESP_OK if success or other if failed.
+ */
+static int esp_elf_relocate_entry(esp_elf_t *elf, const elf32_rela_t *rela,
+                                  const elf32_sym_t *symtab, const char *strtab, uintptr_t *memo)
+{
+    int type;
+    uintptr_t addr = 0;
+    elf32_rela_t rela_buf;
+
+    memcpy(&rela_buf, rela, sizeof(elf32_rela_t));
+
+    const elf32_sym_t *sym = &symtab[ELF_R_SYM(rela_buf.info)];
+    uintptr_t *sym_memo = memo ? &memo[ELF_R_SYM(rela_buf.info)] : NULL;
+
+    type = ELF_R_TYPE(rela_buf.info);
+    if (type == STT_COMMON || type == STT_OBJECT || type == STT_SECTION) {
+        const char *comm_name = strtab + sym->name;
+
+        if (comm_name[0]) {
+            addr = esp_elf_find_sym_memo(elf, comm_name, sym_memo);
+
+            if (!addr) {
+                ESP_LOGE(TAG, "Can't find common %s", strtab + sym->name);
+#if CONFIG_ELF_LOADER_BUS_ADDRESS_MIRROR
+                esp_elf_free(elf->pdata);
+                esp_elf_free(elf->ptext);
+#else
+                esp_elf_free_segment(elf);
+#endif
+                return -ENOSYS;
+            }
+
+            ESP_LOGD(TAG, "Find common %s addr=%x", comm_name, addr);
+        }
+    } else if (type == STT_FILE) {
+        const char *func_name = strtab + sym->name;
+
+        if (sym->value) {
+            addr = esp_elf_map_sym(elf, sym->value);
+        } else {
+            addr = esp_elf_find_sym_memo(elf, func_name, sym_memo);
+        }
+
+        if (!addr) {
+            ESP_LOGE(TAG, "Can't find symbol %s", func_name);
+#if CONFIG_ELF_LOADER_BUS_ADDRESS_MIRROR
+            esp_elf_free(elf->pdata);
+            esp_elf_free(elf->ptext);
+#else
+            esp_elf_free_segment(elf);
+#endif
+            return -ENOSYS;
+        }
+
+        ESP_LOGD(TAG, "Find function %s addr=%x", func_name, addr);
+    }
+
+    esp_elf_arch_relocate(elf, &rela_buf, sym, addr);
+    elf->nr_reloc++;
+
+    return 0;
+}
+
 /**
  * @brief Initialize ELF object.
  *
@@ -411,68 +620,198 @@ int esp_elf_relocate(esp_elf_t *elf, const uint8_t *pbuf)
 
             ESP_LOGD(TAG, "Section %s has %d symbol tables", shstrab + shdr[i].name, (int)nr_reloc);
 
+            /* Many relocations are against the same symbol, without memory for the memo all are looked up */
+            uintptr_t *memo = esp_elf_memo_alloc(&shdr[shdr[i].link]);
+
             for (int i = 0; i < nr_reloc; i++) {
-                int type;
-                uintptr_t addr = 0;
-                elf32_rela_t rela_buf;
+                ret = esp_elf_relocate_entry(elf, &rela[i], symtab, strtab, memo);
+                if (ret) {
+                    esp_elf_free(memo);
+                    return ret;
+                }
+            }
 
-                memcpy(&rela_buf, &rela[i], sizeof(elf32_rela_t));
+            esp_elf_free(memo);
+        }
+    }
 
-                const elf32_sym_t *sym = &symtab[ELF_R_SYM(rela_buf.info)];
+#ifdef CONFIG_ELF_LOADER_LOAD_PSRAM
+    // esp_elf_arch_flush();
+#endif
 
-                type = ELF_R_TYPE(rela_buf.info);
-                if (type == STT_COMMON || type == STT_OBJECT || type == STT_SECTION) {
-                    const char *comm_name = strtab + sym->name;
+    return 0;
+}
 
-                    if (comm_name[0]) {
-                        addr = elf_find_sym(comm_name);
+/**
+ * @brief Allocate a buffer and read part of the ELF file into it.
+ *
+ * @param read - Reads from the ELF file
+ * @param ctx - Passed to read
+ * @param offset - Offset in the ELF file
+ * @param size - Bytes to read, a 0 is put behind them
+ *
+ * @return The buffer or NULL if failed.
+ */
+static void *esp_elf_read_alloc(esp_elf_read_t read, void *ctx, uint32_t offset, uint32_t size)
+{
+    uint8_t *buf = esp_elf_malloc(size + 1, false);
 
-                        if (!addr) {
-                            ESP_LOGE(TAG, "Can't find common %s", strtab + sym->name);
-#if CONFIG_ELF_LOADER_BUS_ADDRESS_MIRROR
-                            esp_elf_free(elf->pdata);
-                            esp_elf_free(elf->ptext);
-#else
-                            esp_elf_free(elf->psegment);
-#endif
-                            return -ENOSYS;
-                        }
+    if (!buf) {
+        return NULL;
+    }
 
-                        ESP_LOGD(TAG, "Find common %s addr=%x", comm_name, addr);
-                    }
-                } else if (type == STT_FILE) {
-                    const char *func_name = strtab + sym->name;
+    if (size && read(ctx, offset, buf, size)) {
+        esp_elf_free(buf);
+        return NULL;
+    }
+    buf[size] = 0;
 
-                    if (sym->value) {
-                        addr = esp_elf_map_sym(elf, sym->value);
-                    } else {
-                        addr = elf_find_sym(func_name);
-                    }
+    return buf;
+}
 
-                    if (!addr) {
-                        ESP_LOGE(TAG, "Can't find symbol %s", func_name);
+/**
+ * @brief Decode and relocate an ELF file without reading all of it into memory.
+ *
+ * @param elf - ELF object pointer
+ * @param read - Reads from the ELF file
+ * @param ctx - Passed to read
+ *
+ * @return ESP_OK if success or other if failed.
+ */
+int esp_elf_relocate_stream(esp_elf_t *elf, esp_elf_read_t read, void *ctx)
+{
 #if CONFIG_ELF_LOADER_BUS_ADDRESS_MIRROR
-                        esp_elf_free(elf->pdata);
-                        esp_elf_free(elf->ptext);
+    ESP_LOGE(TAG, "Streaming needs the segment loader");
+    return -ENOTSUP;
 #else
-                        esp_elf_free(elf->psegment);
-#endif
-                        return -ENOSYS;
-                    }
+    int ret;
+    elf32_hdr_t ehdr;
+    elf32_phdr_t *phdr = NULL;
+    elf32_shdr_t *shdr = NULL;
+    elf32_sym_t *symtab = NULL;
+    char *strtab = NULL;
+    uintptr_t *memo = NULL;
+    uint32_t symtab_shndx = 0;
+    uint32_t nr_sym = 0;
+    elf32_rela_t rela[ELF_RELA_CHUNK];
+
+    if (!elf || !read) {
+        return -EINVAL;
+    }
+
+    if (read(ctx, 0, &ehdr, sizeof(ehdr)) ||
+        ehdr.phentsize != sizeof(elf32_phdr_t) ||
+        ehdr.shentsize != sizeof(elf32_shdr_t)) {
+        ESP_LOGE(TAG, "Invalid ELF header");
+        return -EINVAL;
+    }
+
+    phdr = esp_elf_read_alloc(read, ctx, ehdr.phoff, ehdr.phnum * sizeof(elf32_phdr_t));
+    shdr = esp_elf_read_alloc(read, ctx, ehdr.shoff, ehdr.shnum * sizeof(elf32_shdr_t));
+    if (!phdr || !shdr) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    /* The tables are read in the order of the relocation loop below, ahead of it if the caller can */
+
+    if (elf->prefetch) {
+        uint32_t prefetch_shndx = ehdr.shnum;
+
+        for (uint32_t i = 0; i < ehdr.shnum; i++) {
+            uint32_t link = shdr[i].link;
+
+            if (!stype(&shdr[i], SHT_RELA)) {
+                continue;
+            }
+            if (link >= ehdr.shnum || shdr[link].link >= ehdr.shnum) {
+                break;
+            }
+
+            if (link != prefetch_shndx) {
+                elf->prefetch(ctx, shdr[link].offset, shdr[link].size);
+                elf->prefetch(ctx, shdr[shdr[link].link].offset, shdr[shdr[link].link].size);
+                prefetch_shndx = link;
+            }
+            elf->prefetch(ctx, shdr[i].offset, shdr[i].size / sizeof(elf32_rela_t) * sizeof(elf32_rela_t));
+        }
+    }
 
-                    ESP_LOGD(TAG, "Find function %s addr=%x", func_name, addr);
+    ret = esp_elf_load_segment_stream(elf, &ehdr, phdr, read, ctx);
+    if (ret) {
+        ESP_LOGE(TAG, "Error loading elf file (esp_elf_load_segment_stream failed), ret=%d", ret);
+        goto out;
+    }
+
+    ESP_LOGI(TAG, "elf->entry=%p\n", elf->entry);
+
+    /* Relocation section data, symbol tables are read and memoized once, relocations a chunk at a time */
+
+    for (uint32_t i = 0; i < ehdr.shnum; i++) {
+        if (!stype(&shdr[i], SHT_RELA)) {
+            continue;
+        }
+
+        uint32_t link = shdr[i].link;
+        if (link >= ehdr.shnum || shdr[link].link >= ehdr.shnum) {
+            ret = -EINVAL;
+            goto fail;
+        }
+
+        if (!symtab || link != symtab_shndx) {
+            esp_elf_free(memo);
+            esp_elf_free(symtab);
+            esp_elf_free(strtab);
+            memo = esp_elf_memo_alloc(&shdr[link]);
+            symtab = esp_elf_read_alloc(read, ctx, shdr[link].offset, shdr[link].size);
+            strtab = esp_elf_read_alloc(read, ctx, shdr[shdr[link].link].offset, shdr[shdr[link].link].size);
+            if (!symtab || !strtab) {
+                ret = -ENOMEM;
+                goto fail;
+            }
+            symtab_shndx = link;
+            nr_sym = shdr[link].size / sizeof(elf32_sym_t);
+        }
+
+        uint32_t nr_reloc = shdr[i].size / sizeof(elf32_rela_t);
+        uint32_t n;
+
+        for (uint32_t done = 0; done < nr_reloc; done += n) {
+            n = MIN(ELF_RELA_CHUNK, nr_reloc - done);
+            if (read(ctx, shdr[i].offset + done * sizeof(elf32_rela_t), rela, n * sizeof(elf32_rela_t))) {
+                ret = -EIO;
+                goto fail;
+            }
+
+            for (uint32_t j = 0; j < n; j++) {
+                if (ELF_R_SYM(rela[j].info) >= nr_sym) {
+                    ret = -EINVAL;
+                    goto fail;
                 }
 
-                esp_elf_arch_relocate(elf, &rela_buf, sym, addr);
+                ret = esp_elf_relocate_entry(elf, &rela[j], symtab, strtab, memo);
+                if (ret) {
+                    goto out;
+                }
             }
         }
     }
 
-#ifdef CONFIG_ELF_LOADER_LOAD_PSRAM
-    // esp_elf_arch_flush();
-#endif
+    ret = 0;
+    goto out;
 
-    return 0;
+fail:
+    ESP_LOGE(TAG, "Error relocating elf file, ret=%d", ret);
+    esp_elf_free_segment(elf);
+
+out:
+    esp_elf_free(memo);
+    esp_elf_free(strtab);
+    esp_elf_free(symtab);
+    esp_elf_free(shdr);
+    esp_elf_free(phdr);
+    return ret;
+#endif
 }
 
 /**
@@ -517,8 +856,7 @@ void esp_elf_deinit(esp_elf_t *elf)
     }
 #else
     if (elf->psegment) {
-        esp_elf_free(elf->psegment);
-        elf->psegment = NULL;
+        esp_elf_free_segment(elf);
     }
 #endif
 
@@ -14,6 +14,7 @@
 
 extern void *why_malloc(size_t size);
 extern void why_free(void *_Nullable ptr);
+extern void memory_mark_executable(void *ptr, size_t size);
 
 #ifdef CONFIG_ELF_LOADER_LOAD_PSRAM
 #ifdef CONFIG_IDF_TARGET_ESP32S3
@@ -51,7 +52,11 @@ void *esp_elf_malloc(uint32_t n, bool exec)
 #endif
 
     //return heap_caps_malloc(n, caps);
-    return why_malloc(n);
+    void *ptr = why_malloc(n);
+    if (ptr && exec) {
+        memory_mark_executable(ptr, n);
+    }
+    return ptr;
 }
 
 /**
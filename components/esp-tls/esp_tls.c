@@ -167,6 +167,9 @@ int esp_tls_conn_destroy(esp_tls_t *tls)
             free(tls->client_session);
         }
 #endif // CONFIG_MBEDTLS_SSL_PROTO_TLS1_3 && CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+#if CONFIG_ESP_TLS_USING_MBEDTLS && CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        free(tls->session_key);
+#endif
         task_record_resource_free(RES_ESP_TLS, tls);
         free(tls);
         tls = NULL;
@@ -520,6 +523,11 @@ static int esp_tls_low_level_conn(const char *hostname, int hostlen, int port, c
             }
         }
         /* By now, the connection has been established */
+#if CONFIG_ESP_TLS_USING_MBEDTLS && CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        if (cfg && !cfg->client_session) {
+            esp_mbedtls_set_session_key(tls, hostname, hostlen, port, cfg);
+        }
+#endif
         esp_ret = create_ssl_handle(hostname, hostlen, cfg, tls);
         if (esp_ret != ESP_OK) {
             ESP_LOGE(TAG, "create_ssl_handle failed");
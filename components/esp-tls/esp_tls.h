@@ -800,6 +800,38 @@ esp_tls_client_session_t *esp_tls_get_client_session(esp_tls_t *tls);
  */
 void esp_tls_free_client_session(esp_tls_client_session_t *client_session);
 #endif /* CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+
+#ifdef CONFIG_ESP_TLS_USING_MBEDTLS
+/**
+ * @brief Caches shared between client connections
+ *
+ * The callbacks run in the task that makes the connection. Any of them may be NULL.
+ */
+typedef struct esp_tls_client_cache {
+    unsigned char *(*session_get)(const char *key, size_t *session_len);
+                                            /*!< Return a copy of the serialized session saved under key, to be released
+                                                 with free(), or NULL. The key holds the origin and how its certificate
+                                                 is verified */
+    void (*session_put)(const char *key, const unsigned char *session, size_t session_len);
+                                            /*!< Save a serialized session under key, NULL forgets the saved one */
+    mbedtls_x509_crt *(*ca_chain_get)(const unsigned char *cacert_buf, size_t cacert_bytes);
+                                            /*!< Return a parsed chain of cacert_buf shared with other connections,
+                                                 or NULL to parse it for this connection */
+    void (*ca_chain_put)(mbedtls_x509_crt *ca_chain);
+                                            /*!< Release a chain returned by ca_chain_get */
+} esp_tls_client_cache_t;
+
+/**
+ * @brief Set the caches used by client connections
+ *
+ * Client sessions are resumed from and saved to the cache when esp_tls_cfg_t
+ * has no client_session, CA chains in cacert_buf are taken from it. Set it once,
+ * before the first connection.
+ *
+ * @param[in]  cache  The caches, must stay valid
+ */
+void esp_tls_set_client_cache(const esp_tls_client_cache_t *cache);
+#endif /* CONFIG_ESP_TLS_USING_MBEDTLS */
 #ifdef __cplusplus
 }
 #endif
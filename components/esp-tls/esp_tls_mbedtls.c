@@ -48,6 +48,7 @@ static esp_err_t esp_mbedtls_init_pk_ctx_for_ds(const void *pki);
 
 static const char *TAG = "esp-tls-mbedtls";
 static mbedtls_x509_crt *global_cacert = NULL;
+static const esp_tls_client_cache_t *client_cache = NULL;
 
 #if CONFIG_NEWLIB_NANO_FORMAT
 #define NEWLIB_NANO_SSIZE_T_COMPAT_FORMAT           "X"
@@ -84,6 +85,9 @@ typedef struct esp_tls_pki_t {
 } esp_tls_pki_t;
 
 static esp_err_t set_server_config(esp_tls_cfg_server_t *cfg, esp_tls_t *tls);
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+static void esp_mbedtls_resume_cached_session(esp_tls_t *tls);
+#endif
 
 esp_err_t esp_create_mbedtls_handle(const char *hostname, size_t hostlen, const void *cfg, esp_tls_t *tls, void *server_params)
 {
@@ -167,6 +171,11 @@ esp_err_t esp_create_mbedtls_handle(const char *hostname, size_t hostlen, const
     }
     mbedtls_ssl_set_bio(&tls->ssl, &tls->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (tls->role == ESP_TLS_CLIENT) {
+        esp_mbedtls_resume_cached_session(tls);
+    }
+#endif
     return ESP_OK;
 
 exit:
@@ -242,6 +251,91 @@ void esp_mbedtls_free_client_session(esp_tls_client_session_t *client_session)
         free(client_session);
     }
 }
+
+void esp_mbedtls_set_session_key(esp_tls_t *tls, const char *hostname, size_t hostlen, int port, const esp_tls_cfg_t *cfg)
+{
+    if (client_cache == NULL || client_cache->session_get == NULL || client_cache->session_put == NULL ||
+        tls->session_key != NULL) {
+        return;
+    }
+
+    /* A resumed session skips verifying the server certificate, so only share
+     * sessions between connections that would have verified it the same way */
+    char trust[16];
+    if (cfg->skip_common_name || cfg->common_name != NULL) {
+        return;
+    } else if (cfg->crt_bundle_attach != NULL) {
+        snprintf(trust, sizeof(trust), "bundle");
+    } else if (cfg->use_global_ca_store) {
+        snprintf(trust, sizeof(trust), "global");
+    } else if (cfg->cacert_buf != NULL) {
+        uint32_t hash = 2166136261u;
+        for (unsigned int i = 0; i < cfg->cacert_bytes; ++i) {
+            hash = (hash ^ cfg->cacert_buf[i]) * 16777619u;
+        }
+        snprintf(trust, sizeof(trust), "ca %08" PRIx32, hash);
+    } else {
+        return;
+    }
+
+    /* "host:port trust", a port has at most 5 digits */
+    size_t key_len = hostlen + 1 + 5 + 1 + strlen(trust) + 1;
+    tls->session_key = malloc(key_len);
+    if (tls->session_key != NULL) {
+        snprintf(tls->session_key, key_len, "%.*s:%d %s", (int)hostlen, hostname, port, trust);
+    }
+}
+
+/* Resume the session the client cache has for the origin of tls, if any */
+static void esp_mbedtls_resume_cached_session(esp_tls_t *tls)
+{
+    if (tls->session_key == NULL) {
+        return;
+    }
+
+    size_t session_len = 0;
+    unsigned char *session_buf = client_cache->session_get(tls->session_key, &session_len);
+    if (session_buf == NULL) {
+        return;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    int ret = mbedtls_ssl_session_load(&session, session_buf, session_len);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_session(&tls->ssl, &session);
+    }
+    if (ret == 0) {
+        ESP_LOGD(TAG, "Resuming the cached session of %s", tls->session_key);
+    } else {
+        /* Saved by another version of mbedtls, or expired */
+        ESP_LOGD(TAG, "Unable to resume the cached session of %s, returned -0x%04X", tls->session_key, -ret);
+        client_cache->session_put(tls->session_key, NULL, 0);
+    }
+    mbedtls_ssl_session_free(&session);
+    free(session_buf);
+}
+
+/* Save a serialized session in the client cache, for the next connection to the origin of tls */
+static void esp_mbedtls_cache_session(esp_tls_t *tls, const mbedtls_ssl_session *session)
+{
+    if (tls->session_key == NULL) {
+        return;
+    }
+
+    size_t session_len = 0;
+    if (mbedtls_ssl_session_save(session, NULL, 0, &session_len) != MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
+        return;
+    }
+    unsigned char *session_buf = malloc(session_len);
+    if (session_buf == NULL) {
+        return;
+    }
+    if (mbedtls_ssl_session_save(session, session_buf, session_len, &session_len) == 0) {
+        client_cache->session_put(tls->session_key, session_buf, session_len);
+    }
+    free(session_buf);
+}
 #endif /* CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
 
 int esp_mbedtls_handshake(esp_tls_t *tls, const esp_tls_cfg_t *cfg)
@@ -260,6 +354,18 @@ int esp_mbedtls_handshake(esp_tls_t *tls, const esp_tls_cfg_t *cfg)
     if (ret == 0) {
         tls->conn_state = ESP_TLS_DONE;
 
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        /* A TLS 1.3 server sends its tickets after the handshake, see esp_mbedtls_read() */
+        if (mbedtls_ssl_get_version_number(&tls->ssl) != MBEDTLS_SSL_VERSION_TLS1_3) {
+            mbedtls_ssl_session session;
+            mbedtls_ssl_session_init(&session);
+            if (mbedtls_ssl_get_session(&tls->ssl, &session) == 0) {
+                esp_mbedtls_cache_session(tls, &session);
+            }
+            mbedtls_ssl_session_free(&session);
+        }
+#endif
+
 #ifdef CONFIG_ESP_TLS_USE_DS_PERIPHERAL
         esp_ds_release_ds_lock();
 #endif
@@ -274,6 +380,12 @@ int esp_mbedtls_handshake(esp_tls_t *tls, const esp_tls_cfg_t *cfg)
                 /* This is to check whether handshake failed due to invalid certificate*/
                 esp_mbedtls_verify_certificate(tls);
             }
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            /* Don't offer the server a session it may have choked on */
+            if (tls->session_key != NULL) {
+                client_cache->session_put(tls->session_key, NULL, 0);
+            }
+#endif
             tls->conn_state = ESP_TLS_FAIL;
             return -1;
         }
@@ -351,6 +463,9 @@ ssize_t esp_mbedtls_read(esp_tls_t *tls, char *data, size_t datalen)
 
                 ESP_LOGD(TAG, "Session ticket saved in the client session context");
                 tls->client_session_len = session_ticket_len;
+                if (tls->session_key != NULL) {
+                    client_cache->session_put(tls->session_key, tls->client_session, tls->client_session_len);
+                }
                 mbedtls_ssl_session_free(&tls13_saved_client_session->saved_session);
                 free(tls13_saved_client_session);
                 tls13_saved_client_session = NULL;
@@ -454,7 +569,10 @@ void esp_mbedtls_cleanup(esp_tls_t *tls)
     if (!tls) {
         return;
     }
-    if (tls->cacert_ptr != global_cacert) {
+    if (tls->cacert_shared) {
+        client_cache->ca_chain_put(tls->cacert_ptr);
+        tls->cacert_shared = false;
+    } else if (tls->cacert_ptr != global_cacert) {
         mbedtls_x509_crt_free(tls->cacert_ptr);
     }
     tls->cacert_ptr = NULL;
@@ -476,6 +594,17 @@ void esp_mbedtls_cleanup(esp_tls_t *tls)
 static esp_err_t set_ca_cert(esp_tls_t *tls, const unsigned char *cacert, size_t cacert_len)
 {
     assert(tls);
+    if (tls->role == ESP_TLS_CLIENT && client_cache != NULL && client_cache->ca_chain_get != NULL) {
+        /* Parsed once, for every connection that trusts the same chain */
+        mbedtls_x509_crt *ca_chain = client_cache->ca_chain_get(cacert, cacert_len);
+        if (ca_chain != NULL) {
+            tls->cacert_ptr = ca_chain;
+            tls->cacert_shared = true;
+            mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+            mbedtls_ssl_conf_ca_chain(&tls->conf, tls->cacert_ptr, NULL);
+            return ESP_OK;
+        }
+    }
     tls->cacert_ptr = &tls->cacert;
     mbedtls_x509_crt_init(tls->cacert_ptr);
     int ret = mbedtls_x509_crt_parse(tls->cacert_ptr, cacert, cacert_len);
@@ -1167,6 +1296,11 @@ void esp_mbedtls_free_global_ca_store(void)
     }
 }
 
+void esp_tls_set_client_cache(const esp_tls_client_cache_t *cache)
+{
+    client_cache = cache;
+}
+
 const int *esp_mbedtls_get_ciphersuites_list(void)
 {
     return mbedtls_ssl_list_ciphersuites();
@@ -119,6 +119,11 @@ esp_tls_client_session_t *esp_mbedtls_get_client_session(esp_tls_t *tls);
  * Internal Callback for mbedtls_free_client_session
  */
 void esp_mbedtls_free_client_session(esp_tls_client_session_t *client_session);
+
+/**
+ * Set the key the session of a client connection is cached under, if it can be
+ */
+void esp_mbedtls_set_session_key(esp_tls_t *tls, const char *hostname, size_t hostlen, int port, const esp_tls_cfg_t *cfg);
 #endif
 
 /**
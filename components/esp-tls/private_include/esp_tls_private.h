@@ -72,6 +72,11 @@ struct esp_tls {
     unsigned char *client_session;                                              /*!< Pointer for the serialized client session ticket context. */
     size_t client_session_len;                                                  /*!< Length of the serialized client session ticket context. */
 #endif /* CONFIG_MBEDTLS_SSL_PROTO_TLS1_3 && CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    char *session_key;                                                          /*!< Key the session is cached under, NULL when
+                                                                                     it isn't */
+#endif /* CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+    bool cacert_shared;                                                         /*!< cacert_ptr came from the client cache */
 #elif CONFIG_ESP_TLS_USING_WOLFSSL
     void *priv_ctx;
     void *priv_ssl;
@@ -41,6 +41,8 @@ struct esp_lcd_dpi_panel_t {
     uint8_t *fbs[DPI_PANEL_MAX_FB_NUM]; // Frame buffers
     uint32_t h_pixels;            // Horizontal pixels
     uint32_t v_pixels;            // Vertical pixels
+    uint32_t vsync_pulse_width;   // Vertical sync width, in lines
+    uint32_t vsync_back_porch;    // Vertical back porch, in lines
     size_t fb_size;               // Frame buffer size, in bytes
     size_t bits_per_pixel;        // Bits per pixel
     lcd_color_format_t in_color_format;  // Input color format
@@ -226,7 +228,7 @@ esp_err_t esp_lcd_new_panel_dpi(esp_lcd_dsi_bus_handle_t bus, const esp_lcd_dpi_
     size_t fb_size = panel_config->video_timing.h_size * panel_config->video_timing.v_size * bits_per_pixel / 8;
     framebuffer_t *frame_buffer = NULL;
     for (int i = 0; i < num_fbs; i++) {
-        frame_buffer = framebuffer_allocate(720, 720);
+        frame_buffer = display_framebuffer_allocate(720, 720);
         ESP_GOTO_ON_FALSE(frame_buffer, ESP_ERR_NO_MEM, err, TAG, "no memory for frame buffer");
         dpi_panel->fbs[i] = (void*)frame_buffer->pixels;
         ESP_LOGD(TAG, "fb[%d] @%p", i, frame_buffer->pixels);
@@ -241,6 +243,8 @@ esp_err_t esp_lcd_new_panel_dpi(esp_lcd_dsi_bus_handle_t bus, const esp_lcd_dpi_
     dpi_panel->bits_per_pixel = bits_per_pixel;
     dpi_panel->h_pixels = panel_config->video_timing.h_size;
     dpi_panel->v_pixels = panel_config->video_timing.v_size;
+    dpi_panel->vsync_pulse_width = panel_config->video_timing.vsync_pulse_width;
+    dpi_panel->vsync_back_porch = panel_config->video_timing.vsync_back_porch;
 
 #if SOC_DMA2D_SUPPORTED
     if (panel_config->flags.use_dma2d) {
@@ -607,6 +611,21 @@ esp_err_t esp_lcd_dpi_panel_set_pattern(esp_lcd_panel_handle_t panel, mipi_dsi_p
     return ESP_OK;
 }
 
+esp_err_t esp_lcd_dpi_panel_set_vertical_front_porch(esp_lcd_panel_handle_t panel, uint32_t vsync_front_porch)
+{
+    ESP_RETURN_ON_FALSE(panel && vsync_front_porch, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    esp_lcd_dpi_panel_t *dpi_panel = __containerof(panel, esp_lcd_dpi_panel_t, base);
+    esp_lcd_dsi_bus_handle_t bus = dpi_panel->bus;
+    mipi_dsi_hal_context_t *hal = &bus->hal;
+
+    // only the blanking after the active lines changes, so the frame buffer and the DMA stay as they are
+    mipi_dsi_hal_host_dpi_set_vertical_timing(hal, dpi_panel->vsync_pulse_width, dpi_panel->vsync_back_porch,
+                                              dpi_panel->v_pixels, vsync_front_porch);
+    mipi_dsi_brg_ll_update_dpi_config(hal->bridge);
+
+    return ESP_OK;
+}
+
 esp_err_t esp_lcd_dpi_panel_register_event_callbacks(esp_lcd_panel_handle_t panel, const esp_lcd_dpi_panel_event_callbacks_t *cbs, void *user_ctx)
 {
     ESP_RETURN_ON_FALSE(panel && cbs, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
@@ -150,6 +150,19 @@ esp_err_t esp_lcd_dpi_panel_set_pattern(esp_lcd_panel_handle_t dpi_panel, mipi_d
  */
 esp_err_t esp_lcd_dpi_panel_set_color_conversion(esp_lcd_panel_handle_t dpi_panel, const esp_lcd_color_conv_config_t *config);
 
+/**
+ * @brief Change the vertical front porch of a running DPI panel, which changes its refresh rate
+ *
+ * @note A longer front porch keeps the pixel clock, but leaves the DMA idle for longer between frames
+ *
+ * @param[in] dpi_panel MIPI DPI panel handle, returned from esp_lcd_new_panel_dpi()
+ * @param[in] vsync_front_porch Vertical front porch, in lines
+ * @return
+ *      - ESP_OK: Set vertical front porch successfully
+ *      - ESP_ERR_INVALID_ARG: Set vertical front porch failed because of invalid argument
+ */
+esp_err_t esp_lcd_dpi_panel_set_vertical_front_porch(esp_lcd_panel_handle_t dpi_panel, uint32_t vsync_front_porch);
+
 /**
  * @brief Type of LCD DPI panel event data
  */
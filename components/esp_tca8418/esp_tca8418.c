@@ -16,6 +16,7 @@
 #include "esp_tca8418.h"
 
 // TCA8418 register constants
+#define REG_CFG 0x01
 #define REG_INTERRUPT_STATUS 0x02
 #define REG_KEY_LOCK_EVT_COUNT 0x03
 #define REG_KEY_EVENT_A 0x04
@@ -41,6 +42,10 @@
 #define REG_DEBOUNCE_DIS2 0x2A
 #define REG_DEBOUNCE_DIS3 0x2B
 
+// REG_CFG bits
+#define CFG_KE_IEN 0x01  // Key events assert INT
+#define CFG_INT_CFG 0x10 // INT deasserts briefly when cleared with events still pending
+
 static const char *TAG = "tca8418";
 
 static uint8_t readRegister(tca8418_dev_t *tca8418_dev, uint8_t reg);
@@ -106,7 +111,7 @@ tca8418_dev_t *tca8418_create(gpio_num_t scl_pin, gpio_num_t sda_pin, uint8_t i2
     }
 
     ESP_LOGI(TAG, "Initializing device:%02x", tca8418_dev->i2c_address);
-    tca8418_dev->dev_handle = i2c_bus_device_create(tca8418_dev->bus_handle, tca8418_dev->i2c_address, 0);
+    tca8418_dev->dev_handle = i2c_bus_device_create(tca8418_dev->bus_handle, tca8418_dev->i2c_address, TCA8418_I2C_FREQ_HZ);
     if (tca8418_dev->dev_handle == NULL)
     {
         ESP_LOGE(TAG, "failed creating i2c device handle");
@@ -150,7 +155,7 @@ tca8418_dev_t *tca8418_create(gpio_num_t scl_pin, gpio_num_t sda_pin, uint8_t i2
     {
         gpio_config_t cfg =
             {
-                .pin_bit_mask = (uint64_t)(1 << tca8418_dev->notify_pin),
+                .pin_bit_mask = 1ULL << tca8418_dev->notify_pin,
                 .mode = GPIO_MODE_INPUT,
                 .pull_up_en = GPIO_PULLUP_ENABLE,
                 .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -160,6 +165,7 @@ tca8418_dev_t *tca8418_create(gpio_num_t scl_pin, gpio_num_t sda_pin, uint8_t i2
 #endif
             };
         ESP_ERROR_CHECK(gpio_config(&cfg));
+        writeRegister(tca8418_dev, REG_CFG, CFG_KE_IEN | CFG_INT_CFG);
     }
 
     return tca8418_dev;
@@ -214,6 +220,11 @@ void tca8418_flush(tca8418_dev_t *tca8418_dev)
     writeRegister(tca8418_dev, REG_INTERRUPT_STATUS, 0x03);
 }
 
+void tca8418_clear_interrupts(tca8418_dev_t *tca8418_dev)
+{
+    writeRegister(tca8418_dev, REG_INTERRUPT_STATUS, 0x03);
+}
+
 /// Reads a single register from the TCA8418 IC.
 ///
 /// @param reg Register to read the value of.
@@ -223,7 +234,14 @@ static uint8_t readRegister(tca8418_dev_t *tca8418_dev, uint8_t reg)
 {
     uint8_t receive_buf[1] = {0};
     ESP_LOGV(TAG, "Reading register %02x from dev %02x", reg, tca8418_dev->i2c_address);
-    ESP_ERROR_CHECK(i2c_bus_read_byte(tca8418_dev->dev_handle, reg, receive_buf));
+    if (tca8418_dev->transfer)
+    {
+        ESP_ERROR_CHECK(tca8418_dev->transfer(tca8418_dev->transfer_arg, reg, true, receive_buf, 1));
+    }
+    else
+    {
+        ESP_ERROR_CHECK(i2c_bus_read_byte(tca8418_dev->dev_handle, reg, receive_buf));
+    }
     return receive_buf[0];
 }
 
@@ -234,5 +252,12 @@ static uint8_t readRegister(tca8418_dev_t *tca8418_dev, uint8_t reg)
 static void writeRegister(tca8418_dev_t *tca8418_dev, uint8_t reg, uint8_t value)
 {
     ESP_LOGV(TAG, "Writing %02x to register %02x on dev %02x", value, reg, tca8418_dev->i2c_address);
-    ESP_ERROR_CHECK(i2c_bus_write_byte(tca8418_dev->dev_handle, reg, value));
+    if (tca8418_dev->transfer)
+    {
+        ESP_ERROR_CHECK(tca8418_dev->transfer(tca8418_dev->transfer_arg, reg, false, &value, 1));
+    }
+    else
+    {
+        ESP_ERROR_CHECK(i2c_bus_write_byte(tca8418_dev->dev_handle, reg, value));
+    }
 }
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "esp_err.h"
@@ -34,6 +35,9 @@ extern "C"
         uint8_t cols;                       // Number of rows to configure the TCA8418 to use, default to maximum (10).
         i2c_bus_handle_t bus_handle;        // I2C bus handle
         i2c_bus_device_handle_t dev_handle; // I2C device handle to use for I2C communication.
+        // Optional, does the register reads and writes after tca8418_create() instead of dev_handle.
+        esp_err_t (*transfer)(void *arg, uint8_t reg, bool read, uint8_t *data, uint16_t len);
+        void *transfer_arg;                 // Passed to transfer.
     } tca8418_dev_t;
 
     typedef struct
@@ -83,6 +87,9 @@ extern "C"
     /// Discards all remaining keypress events.
     void tca8418_flush(tca8418_dev_t *tca8418_dev);
 
+    /// Acknowledges the interrupt, INT is asserted again by the next keypress event.
+    void tca8418_clear_interrupts(tca8418_dev_t *tca8418_dev);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
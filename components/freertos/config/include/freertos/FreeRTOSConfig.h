@@ -312,7 +312,11 @@
     // For task swiching in BadgeVMS
     struct tskTaskControlBlock;
     extern void task_switched_in_hook(struct tskTaskControlBlock * volatile*);
-    extern void task_switched_out_hook(struct tskTaskControlBlock * volatile*);
+    extern void task_switched_out_hook(struct tskTaskControlBlock * volatile*, int preempted);
+    // A task that is switched out while still on its ready list was preempted
+    #define taskSWITCHED_OUT_PREEMPTED() \
+        listIS_CONTAINED_WITHIN( &pxReadyTasksLists[ pxCurrentTCBs[ portGET_CORE_ID() ]->uxPriority ], \
+                                 &pxCurrentTCBs[ portGET_CORE_ID() ]->xStateListItem )
     #define traceTASK_SWITCHED_IN()  task_switched_in_hook(pxCurrentTCBs)
-    #define traceTASK_SWITCHED_OUT()  task_switched_out_hook(pxCurrentTCBs)
+    #define traceTASK_SWITCHED_OUT()  task_switched_out_hook(pxCurrentTCBs, taskSWITCHED_OUT_PREEMPTED())
 #endif /* def __ASSEMBLER__ */
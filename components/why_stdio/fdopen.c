@@ -42,13 +42,21 @@ why_fdopen(int fd, const char *mode)
 	int open_flags;
 	struct __file_bufio *bf;
     char *buf;
+        size_t size;
+        uint8_t bflags = __BFALL;
 
 	stdio_flags = __why_stdio_flags(mode, &open_flags);
 	if (stdio_flags == 0)
 		return NULL;
 
-	/* Allocate file structure and necessary buffers */
-	bf = why_calloc(1, sizeof(struct __file_bufio) + BUFSIZ);
+        /* The device picks the buffer, large for files, lines for the console */
+        if (why_fd_buffering(fd, open_flags, &size) == _IOLBF)
+                bflags |= __BLBF;
+        if (size < BUFSIZ)
+                size = BUFSIZ;
+
+	/* Allocate file structure and necessary buffers, the buffer needs no clearing */
+	bf = why_malloc(sizeof(struct __file_bufio) + size);
 
 	if (bf == NULL) {
 		why_close(fd);
@@ -57,7 +65,7 @@ why_fdopen(int fd, const char *mode)
         buf = (char *) (bf + 1);
 
         *bf = (struct __file_bufio)
-                FDEV_SETUP_POSIX(fd, buf, BUFSIZ, stdio_flags, __BFALL);
+                FDEV_SETUP_POSIX(fd, buf, size, stdio_flags, bflags);
 
 	if (open_flags & O_APPEND)
                 (void) why_fseeko(&(bf->xfile.cfile.file), 0, SEEK_END);
@@ -17,7 +17,8 @@
 /* Use atomics for fgetc/ungetc for re-entrancy */
 #define __ATOMIC_UNGETC
 
-#undef __FAST_BUFIO
+/* Copy fread/fwrite through the bufio buffer instead of a byte at a time */
+#define __FAST_BUFIO
 
 /* Always optimize strcmp for performance */
 #define __FAST_STRCMP
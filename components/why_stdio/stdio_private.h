@@ -68,6 +68,7 @@ extern int why_close(int fd);
 extern ssize_t why_write(int fd, const void *buf, size_t count);
 extern ssize_t why_read(int fd, void *buf, size_t count);
 extern off_t why_lseek(int fd, off_t offset, int whence);
+extern int why_fd_buffering(int fd, int flags, size_t *size);
 
 extern void *why_malloc(size_t size);
 extern void why_free(void *ptr);
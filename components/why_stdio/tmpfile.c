@@ -35,20 +35,33 @@
 
 #include "stdio_private.h"
 
-FILE *tmpfile(void)
+#include <stdatomic.h>
+
+extern int why_unlink(const char *pathname);
+extern pid_t why_getpid(void);
+
+/* On the RAM disk, temporary files never touch the flash */
+#define TMPFILE_PATH     "TMP:T%d_%u"
+#define TMPFILE_ATTEMPTS 16
+
+FILE *why_tmpfile(void)
 {
-    char        tmpnam[L_tmpnam];
-    int         fd;
+    static atomic_uint  counter;
+    char        tmpnam[32];
+    int         fd = -1;
     FILE        *f;
 
-    strcpy(tmpnam, "TXXXXXX");
-    fd = mkstemp(tmpnam);
+    /* Names are unique already, unless something else picked the same one */
+    for (int i = 0; fd < 0 && i < TMPFILE_ATTEMPTS; i++) {
+        why_snprintf(tmpnam, sizeof(tmpnam), TMPFILE_PATH, (int)why_getpid(), atomic_fetch_add(&counter, 1));
+        fd = why_open(tmpnam, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
     if (fd < 0)
         return NULL;
     /* Assume POSIX semantics for unlinking in-use files */
-    unlink(tmpnam);
-    f = fdopen(fd, "w+");
+    why_unlink(tmpnam);
+    f = why_fdopen(fd, "w+");
     if (f == NULL)
-        close(fd);
+        why_close(fd);
     return f;
 }
@@ -497,6 +497,117 @@ _wcslen(const char *s, size_t maxlen)
 }
 #endif
 
+#if !defined(WIDE_CHARS) && !defined(_NEED_IO_SHRINK)
+/*
+ * Bare %d, %i, %u, %x and %X, and %f and %.Nf up to FAST_FIXED_PREC, are
+ * most of what gets printed. They are converted here without parsing
+ * flags, widening to ultoa_unsigned_t or running the dtoa engine.
+ */
+#define _NEED_IO_FAST_PATHS
+
+/* Sign, 10 integer digits, '.', FAST_FIXED_PREC digits */
+#define FAST_FIXED_PREC 9
+#define FAST_BUF_SIZE   (12 + FAST_FIXED_PREC)
+
+static const char __fast_digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Writes val backwards, ending at end. Returns the first character */
+static char *
+__fast_utoa(uint32_t val, char *end)
+{
+    while (val >= 100) {
+        unsigned pair = (val % 100) * 2;
+        val /= 100;
+        *--end = __fast_digit_pairs[pair + 1];
+        *--end = __fast_digit_pairs[pair];
+    }
+    if (val >= 10) {
+        *--end = __fast_digit_pairs[val * 2 + 1];
+        *--end = __fast_digit_pairs[val * 2];
+    } else {
+        *--end = '0' + val;
+    }
+    return end;
+}
+
+static char *
+__fast_xtoa(uint32_t val, char *end, bool upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    do {
+        *--end = digits[val & 15];
+        val >>= 4;
+    } while (val);
+    return end;
+}
+
+#if IO_VARIANT_IS_FLOAT(PRINTF_VARIANT)
+#ifdef _NEED_IO_FLOAT32
+typedef uint32_t fast_fixed_t;
+#define FAST_FIXED_MAX  0x1p22f
+#define FAST_FIXED_EPS  0x1p-23f
+#else
+typedef uint64_t fast_fixed_t;
+#define FAST_FIXED_MAX  0x1p51
+#define FAST_FIXED_EPS  0x1p-52
+#endif
+
+static const FLOAT __fast_fixed_scale[FAST_FIXED_PREC + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+static const uint32_t __fast_fixed_div[FAST_FIXED_PREC + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+/*
+ * %.Nf by scaling with 10^N and rounding to an integer. The multiply
+ * rounds, so values that land close enough to a tie that it could
+ * have picked the wrong side, along with anything too large, inf and
+ * nan, return NULL and are left to the dtoa engine.
+ */
+static char *
+__fast_fixed(FLOAT fval, int prec, char *end)
+{
+    bool neg = signbit(fval);
+
+    if (neg)
+        fval = -fval;
+
+    FLOAT scaled = fval * __fast_fixed_scale[prec];
+    if (!(scaled < FAST_FIXED_MAX && fval < (FLOAT) UINT32_MAX))
+        return NULL;
+
+    fast_fixed_t whole = (fast_fixed_t) scaled;
+    FLOAT tie = scaled - (FLOAT) whole - (FLOAT) 0.5;
+    if (tie < 0 ? -tie <= scaled * FAST_FIXED_EPS : tie <= scaled * FAST_FIXED_EPS)
+        return NULL;
+    if (tie > 0)
+        whole++;
+
+    uint32_t ipart = (uint32_t) (whole / __fast_fixed_div[prec]);
+    uint32_t fpart = (uint32_t) (whole - (fast_fixed_t) ipart * __fast_fixed_div[prec]);
+
+    if (prec) {
+        for (int i = 0; i < prec; i++) {
+            *--end = '0' + fpart % 10;
+            fpart /= 10;
+        }
+        *--end = '.';
+    }
+    end = __fast_utoa(ipart, end);
+    if (neg)
+        *--end = '-';
+    return end;
+}
+#endif
+#endif
+
 #ifdef VFPRINTF_S
 int
 why_vfprintf_s(FILE *__restrict stream, const char *__restrict fmt, va_list ap_orig)
@@ -581,6 +692,47 @@ int why_vfprintf (FILE * stream, const CHAR *fmt, va_list ap_orig)
 	    my_putc (c, stream);
 	}
 
+#ifdef _NEED_IO_FAST_PATHS
+	if (c == 'd' || c == 'i' || c == 'u' || TOLOWER(c) == 'x') {
+	    char fast[FAST_BUF_SIZE];
+	    char *end = fast + sizeof(fast);
+	    uint32_t x = va_arg(ap, unsigned);
+
+	    if (TOLOWER(c) == 'x') {
+		pnt = __fast_xtoa(x, end, c == 'X');
+	    } else if (c == 'u' || (int32_t) x >= 0) {
+		pnt = __fast_utoa(x, end);
+	    } else {
+		char *neg = __fast_utoa(-x, end);
+		*--neg = '-';
+		pnt = neg;
+	    }
+	    while (pnt < end)
+		my_putc (*pnt++, stream);
+	    continue;
+	}
+#if IO_VARIANT_IS_FLOAT(PRINTF_VARIANT)
+	if (c == 'f' || (c == '.' && fmt[0] >= '0' && fmt[0] <= '0' + FAST_FIXED_PREC && fmt[1] == 'f')) {
+	    char fast[FAST_BUF_SIZE];
+	    char *end = fast + sizeof(fast);
+	    va_list peek;
+
+	    /* Only consume the argument once it is known to fit */
+	    va_copy(peek, ap);
+	    pnt = __fast_fixed(PRINTF_FLOAT_ARG(peek), c == 'f' ? 6 : fmt[0] - '0', end);
+	    va_end(peek);
+	    if (pnt) {
+		(void) PRINTF_FLOAT_ARG(ap);
+		if (c == '.')
+		    fmt += 2;
+		while (pnt < end)
+		    my_putc (*pnt++, stream);
+		continue;
+	    }
+	}
+#endif
+#endif
+
 	flags = 0;
 	width = 0;
 	prec = 0;
@@ -53,15 +53,7 @@ static const char *TAG = "fg_mcu_slave";
 
 #define UNKNOWN_RPC_MSG_ID              0
 
-#if CONFIG_ESP_SPI_HOST_INTERFACE
-  #ifdef CONFIG_IDF_TARGET_ESP32S2
-    #define TO_HOST_QUEUE_SIZE           5
-  #else
-    #define TO_HOST_QUEUE_SIZE           20
-  #endif
-#else
-  #define TO_HOST_QUEUE_SIZE             20
-#endif
+#define TO_HOST_QUEUE_SIZE              CONFIG_ESP_TO_HOST_Q_SIZE
 
 #define ETH_DATA_LEN                     1500
 #define MAX_WIFI_STA_TX_RETRY            6
@@ -596,6 +588,15 @@ static ssize_t serial_read_data(uint8_t *data, ssize_t len)
 	return len;
 }
 
+int to_host_queue_pending(void)
+{
+#if BYPASS_TX_PRIORITY_Q
+	return 0;
+#else
+	return uxQueueMessagesWaiting(meta_to_host_queue);
+#endif
+}
+
 int send_to_host_queue(interface_buffer_handle_t *buf_handle, uint8_t queue_type)
 {
 #if BYPASS_TX_PRIORITY_Q
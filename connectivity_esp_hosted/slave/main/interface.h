@@ -129,6 +129,8 @@ interface_context_t * interface_insert_driver(int (*callback)(uint8_t val));
 int interface_remove_driver();
 void generate_startup_event(uint8_t cap, uint32_t ext_cap);
 int send_to_host_queue(interface_buffer_handle_t *buf_handle, uint8_t queue_type);
+/* Packets queued for the host behind the one being written */
+int to_host_queue_pending(void);
 
 #ifndef min
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -46,6 +46,23 @@ static const char TAG[] = "SDIO_SLAVE";
 
 #define SDIO_TX_QUEUE_SIZE           CONFIG_ESP_SDIO_TX_Q_SIZE
 
+#if CONFIG_ESP_SDIO_TX_AGGREGATION && !SIMPLIFIED_SDIO_SLAVE
+/* Packets written while more wait in the queues to the host are gathered in
+ * one buffer, which is queued once the next packet would not fit or nothing
+ * more waits. In streaming mode the host reads the same bytes either way.
+ */
+#define SDIO_TX_AGGREGATION          1
+#define SDIO_TX_AGGR_SIZE            CONFIG_ESP_SDIO_TX_AGGREGATION_SIZE
+#define SDIO_TX_AGGR_NUM_BLOCKS      4
+/* Set in the send queue argument of an aggregated buffer, buffers are word aligned */
+#define SDIO_TX_AGGR_TAG             1
+
+static struct hosted_mempool * buf_mp_aggr_g;
+static uint8_t *aggr_buf;
+static uint32_t aggr_len;
+static uint32_t aggr_pkts;
+#endif
+
 #if !SIMPLIFIED_SDIO_SLAVE
 static SemaphoreHandle_t sdio_rx_sem;
 static QueueHandle_t sdio_rx_queue[MAX_PRIORITY_QUEUES];
@@ -97,11 +114,20 @@ static inline void sdio_mempool_create(void)
 #ifdef CONFIG_ESP_CACHE_MALLOC
 	assert(buf_mp_tx_g);
 #endif
+#if SDIO_TX_AGGREGATION
+	buf_mp_aggr_g = hosted_mempool_create(NULL, 0, SDIO_TX_AGGR_NUM_BLOCKS, SDIO_TX_AGGR_SIZE);
+#ifdef CONFIG_ESP_CACHE_MALLOC
+	assert(buf_mp_aggr_g);
+#endif
+#endif
 }
 
 static inline void sdio_mempool_destroy(void)
 {
 	hosted_mempool_destroy(buf_mp_tx_g);
+#if SDIO_TX_AGGREGATION
+	hosted_mempool_destroy(buf_mp_aggr_g);
+#endif
 }
 
 static inline void *sdio_buffer_tx_alloc(size_t nbytes, uint need_memset)
@@ -413,18 +439,109 @@ static void sdio_tx_done_task(void* pvParameters)
 			continue;
 		}
 		xSemaphoreGive(sdio_send_queue_sem);
+#if SDIO_TX_AGGREGATION
+		if ((uintptr_t)sendbuf_p & SDIO_TX_AGGR_TAG) {
+			hosted_mempool_free(buf_mp_aggr_g,
+					(void *)((uintptr_t)sendbuf_p & ~SDIO_TX_AGGR_TAG));
+			continue;
+		}
+#endif
 		sdio_buffer_tx_free(sendbuf_p);
 	}
 }
 #endif
 
+/* Header and payload of one packet to host at sendbuf */
+static void sdio_fill_tx_buf(uint8_t *sendbuf, interface_buffer_handle_t *buf_handle)
+{
+	uint16_t offset = sizeof(struct esp_payload_header);
+	struct esp_payload_header *header = (struct esp_payload_header *) sendbuf;
+
+	memset (header, 0, sizeof(struct esp_payload_header));
+
+	/* Initialize header */
+	header->if_type = buf_handle->if_type;
+	header->if_num = buf_handle->if_num;
+	header->len = htole16(buf_handle->payload_len);
+	header->offset = htole16(offset);
+	header->seq_num = htole16(buf_handle->seq_num);
+	header->flags = buf_handle->flag;
+
+	memcpy(sendbuf + offset, buf_handle->payload, buf_handle->payload_len);
+
+#if CONFIG_ESP_SDIO_CHECKSUM
+	header->checksum = htole16(compute_checksum(sendbuf,
+				offset+buf_handle->payload_len));
+#endif
+}
+
+#if SDIO_TX_AGGREGATION
+static esp_err_t sdio_aggr_flush(void)
+{
+	esp_err_t ret = ESP_OK;
+	uint8_t *sendbuf = aggr_buf;
+
+	if (!sendbuf)
+		return ESP_OK;
+	aggr_buf = NULL;
+
+	ESP_HEXLOGD("sdio_tx", sendbuf, min(32,aggr_len));
+
+	xSemaphoreTake(sdio_send_queue_sem, portMAX_DELAY);
+	ret = sdio_slave_send_queue(sendbuf, aggr_len,
+			(void *)((uintptr_t)sendbuf | SDIO_TX_AGGR_TAG), portMAX_DELAY);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG , "sdio slave transmit error, ret : 0x%x\r\n", ret);
+		xSemaphoreGive(sdio_send_queue_sem);
+		hosted_mempool_free(buf_mp_aggr_g, sendbuf);
+		return ESP_FAIL;
+	}
+
+#if ESP_PKT_STATS
+	pkt_stats.sdio_tx_bufs++;
+	pkt_stats.sdio_tx_pkts += aggr_pkts;
+#endif
+	return ESP_OK;
+}
+
+/* Returns ESP_ERR_NOT_SUPPORTED if buf_handle is to be sent on its own */
+static esp_err_t sdio_aggr_write(interface_buffer_handle_t *buf_handle, uint32_t total_len)
+{
+	/* Nothing to gather it with */
+	if (!aggr_buf && !to_host_queue_pending())
+		return ESP_ERR_NOT_SUPPORTED;
+
+	if (aggr_buf && aggr_len + total_len > SDIO_TX_AGGR_SIZE) {
+		if (sdio_aggr_flush())
+			return ESP_FAIL;
+	}
+
+	if (!aggr_buf) {
+		aggr_buf = hosted_mempool_alloc(buf_mp_aggr_g, SDIO_TX_AGGR_SIZE, MEMSET_REQUIRED);
+		if (!aggr_buf)
+			return ESP_ERR_NOT_SUPPORTED;
+		aggr_len = 0;
+		aggr_pkts = 0;
+	}
+
+	sdio_fill_tx_buf(aggr_buf + aggr_len, buf_handle);
+	aggr_len += total_len;
+	aggr_pkts++;
+
+	/* send_task() is about to write the next one */
+	if (to_host_queue_pending() && aggr_len + BUFFER_SIZE <= SDIO_TX_AGGR_SIZE)
+		return ESP_OK;
+
+	return sdio_aggr_flush();
+}
+#endif
+
 static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t *buf_handle)
 {
 	esp_err_t ret = ESP_OK;
 	int32_t total_len = 0;
 	uint8_t* sendbuf = NULL;
 	uint16_t offset = sizeof(struct esp_payload_header);
-	struct esp_payload_header *header = NULL;
 
 	if (!handle || !buf_handle) {
 		ESP_LOGE(TAG , "Invalid arguments");
@@ -442,30 +559,22 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 
 	total_len = buf_handle->payload_len + offset;
 
+#if SDIO_TX_AGGREGATION
+	ret = sdio_aggr_write(buf_handle, total_len);
+	if (ret != ESP_ERR_NOT_SUPPORTED) {
+		if (ret != ESP_OK)
+			return ESP_FAIL;
+		goto sent;
+	}
+#endif
+
 	sendbuf = sdio_buffer_tx_alloc(total_len, MEMSET_REQUIRED);
 	if (sendbuf == NULL) {
 		ESP_LOGE(TAG , "send buffer[%"PRIu32"] malloc fail", total_len);
 		return ESP_FAIL;
 	}
 
-	header = (struct esp_payload_header *) sendbuf;
-
-	memset (header, 0, sizeof(struct esp_payload_header));
-
-	/* Initialize header */
-	header->if_type = buf_handle->if_type;
-	header->if_num = buf_handle->if_num;
-	header->len = htole16(buf_handle->payload_len);
-	header->offset = htole16(offset);
-	header->seq_num = htole16(buf_handle->seq_num);
-	header->flags = buf_handle->flag;
-
-	memcpy(sendbuf + offset, buf_handle->payload, buf_handle->payload_len);
-
-#if CONFIG_ESP_SDIO_CHECKSUM
-	header->checksum = htole16(compute_checksum(sendbuf,
-				offset+buf_handle->payload_len));
-#endif
+	sdio_fill_tx_buf(sendbuf, buf_handle);
 
 	ESP_HEXLOGD("sdio_tx", sendbuf, min(32,total_len));
 
@@ -486,9 +595,16 @@ static int32_t sdio_write(interface_handle_t *handle, interface_buffer_handle_t
 #endif
 
 #if ESP_PKT_STATS
-	if (header->if_type == ESP_STA_IF)
+	pkt_stats.sdio_tx_bufs++;
+	pkt_stats.sdio_tx_pkts++;
+#endif
+#if SDIO_TX_AGGREGATION
+sent:
+#endif
+#if ESP_PKT_STATS
+	if (buf_handle->if_type == ESP_STA_IF)
 		pkt_stats.sta_sh_out++;
-	else if (header->if_type == ESP_SERIAL_IF)
+	else if (buf_handle->if_type == ESP_SERIAL_IF)
 		pkt_stats.serial_tx_total++;
 #endif
 	return buf_handle->payload_len;
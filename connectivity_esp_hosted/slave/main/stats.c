@@ -213,6 +213,9 @@ static void stats_timer_func(void* arg)
 			pkt_stats.hs_bus_sta_in,pkt_stats.hs_bus_sta_out, pkt_stats.hs_bus_sta_fail,
 			pkt_stats.sta_sh_in,pkt_stats.sta_sh_out,
 			pkt_stats.serial_rx, pkt_stats.serial_tx_total, pkt_stats.serial_tx_evt);
+#if CONFIG_ESP_SDIO_HOST_INTERFACE
+	ESP_LOGI(TAG, "H<=S: sdio bufs: %8lu pkts: %8lu", pkt_stats.sdio_tx_bufs, pkt_stats.sdio_tx_pkts);
+#endif
 
 #endif
 }
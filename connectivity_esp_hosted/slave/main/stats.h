@@ -115,6 +115,10 @@ struct pkt_stats_t {
 	uint32_t serial_tx_total;
 	uint32_t serial_tx_evt;
 	uint32_t slave_wifi_rx_msg_loaded;
+	/* Buffers queued to the SDIO driver and the packets in them,
+	 * more packets than buffers is TX aggregation at work */
+	uint32_t sdio_tx_bufs;
+	uint32_t sdio_tx_pkts;
 };
 
 extern struct pkt_stats_t pkt_stats;
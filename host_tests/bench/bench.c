@@ -0,0 +1,98 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+
+// Runs shorter than this are repeated with twice the iterations
+#define BENCH_MIN_NS 200000000ull
+
+static bool        quick;
+static char const *filter;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void bench_run(char const *name, bench_fn_t fn, void *ctx) {
+    if (filter && !strstr(name, filter)) {
+        return;
+    }
+
+    size_t   iterations = 1;
+    uint64_t took;
+    while (1) {
+        uint64_t start = now_ns();
+        fn(ctx, iterations);
+        took = now_ns() - start;
+        if (quick || took >= BENCH_MIN_NS) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    printf("%-40s %12zu %12.1f ns\n", name, iterations, (double)took / iterations);
+}
+
+uint32_t bench_random(uint32_t *state) {
+    // xorshift32
+    uint32_t x  = *state;
+    x          ^= x << 13;
+    x          ^= x >> 17;
+    x          ^= x << 5;
+    *state      = x;
+    return x;
+}
+
+// kernel_bench [--quick] [--elf program.elf] [filter]
+//
+// Times the pure algorithmic parts of the kernel on the host, so a slower
+// algorithm shows up before it is flashed. Compare the time per iteration
+// against a run of the previous version on the same machine. --quick runs
+// everything once, to check that it still works.
+int main(int argc, char **argv) {
+    char const *elf = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--quick")) {
+            quick = true;
+        } else if (!strcmp(argv[i], "--elf") && i + 1 < argc) {
+            elf = argv[++i];
+        } else if (argv[i][0] != '-') {
+            filter = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [--quick] [--elf program.elf] [filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%-40s %12s %12s\n", "benchmark", "iterations", "per iter");
+    bench_buddy();
+    bench_region();
+    bench_logical_names();
+    bench_path();
+    bench_json();
+    bench_elf(elf);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs the body of a benchmark iterations times
+typedef void (*bench_fn_t)(void *ctx, size_t iterations);
+
+// Time fn, doubling the iterations until a run takes long enough to measure,
+// and print the time per iteration. Skipped if the name doesn't match the
+// filter given on the command line.
+void bench_run(char const *name, bench_fn_t fn, void *ctx);
+
+// Repeatable pseudo random numbers, so every run sees the same inputs
+uint32_t bench_random(uint32_t *state);
+
+void bench_buddy(void);
+void bench_region(void);
+void bench_logical_names(void);
+void bench_path(void);
+void bench_json(void);
+// Relocates the program at path if it isn't NULL, a made up one otherwise
+void bench_elf(char const *path);
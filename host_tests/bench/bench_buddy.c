@@ -0,0 +1,117 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "buddy_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Like the PSRAM pool, the pages themselves are never touched
+#define POOL_SIZE   (32 * 1024 * 1024)
+#define BATCH_PAGES 16
+#define MIXED_SLOTS 64
+
+static allocator_t allocator;
+
+static void allocate_page(void *ctx, size_t iterations) {
+    (void)ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        void *page = buddy_allocate(&allocator, PAGE_SIZE, BLOCK_TYPE_PAGE, BUDDY_FLAG_PREFER_ZEROED);
+        buddy_deallocate(&allocator, page);
+    }
+}
+
+// What a page magazine refill and drain do
+static void allocate_batch(void *ctx, size_t iterations) {
+    (void)ctx;
+    void *pages[BATCH_PAGES];
+    for (size_t i = 0; i < iterations; ++i) {
+        size_t count = buddy_allocate_pages(&allocator, pages, BATCH_PAGES, BLOCK_TYPE_PAGE, BUDDY_FLAG_PREFER_ZEROED);
+        buddy_deallocate_pages(&allocator, pages, count);
+    }
+}
+
+static void allocate_contiguous(void *ctx, size_t iterations) {
+    (void)ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        void *run = buddy_allocate_contiguous(&allocator, 5 * PAGE_SIZE, BLOCK_TYPE_PAGE, 0);
+        buddy_deallocate_contiguous(&allocator, run, 5 * PAGE_SIZE);
+    }
+}
+
+// Blocks of 1 to 8 pages coming and going in a pool of which a random quarter
+// of the pages is in use, so the larger ones don't always fit
+static void allocate_mixed(void *ctx, size_t iterations) {
+    (void)ctx;
+    void    *slots[MIXED_SLOTS] = {0};
+    uint32_t state              = 1;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        uint32_t r    = bench_random(&state);
+        size_t   slot = r % MIXED_SLOTS;
+        if (slots[slot]) {
+            buddy_deallocate(&allocator, slots[slot]);
+            slots[slot] = NULL;
+        } else {
+            slots[slot] = buddy_allocate(&allocator, ((r >> 8) % 8 + 1) * PAGE_SIZE, BLOCK_TYPE_PAGE, 0);
+        }
+    }
+
+    for (size_t i = 0; i < MIXED_SLOTS; ++i) {
+        if (slots[i]) {
+            buddy_deallocate(&allocator, slots[i]);
+        }
+    }
+}
+
+void bench_buddy(void) {
+    void *pool = aligned_alloc(PAGE_SIZE, POOL_SIZE);
+    if (!pool) {
+        return;
+    }
+
+    memset(&allocator, 0, sizeof(allocator));
+    init_pool(&allocator, pool, pool + POOL_SIZE, 0);
+
+    bench_run("buddy/allocate_page", allocate_page, NULL);
+    bench_run("buddy/allocate_batch", allocate_batch, NULL);
+    bench_run("buddy/allocate_contiguous", allocate_contiguous, NULL);
+
+    size_t pages = buddy_get_free_pages(&allocator);
+    void **held  = malloc(pages * sizeof(void *));
+    if (held) {
+        uint32_t state = 1;
+        size_t   count = buddy_allocate_pages(&allocator, held, pages, BLOCK_TYPE_PAGE, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (bench_random(&state) & 3) {
+                buddy_deallocate(&allocator, held[i]);
+                held[i] = NULL;
+            }
+        }
+
+        bench_run("buddy/allocate_mixed_fragmented", allocate_mixed, NULL);
+
+        for (size_t i = 0; i < count; ++i) {
+            if (held[i]) {
+                buddy_deallocate(&allocator, held[i]);
+            }
+        }
+        free(held);
+    }
+
+    free(pool);
+}
@@ -0,0 +1,200 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "esp_elf.h"
+#include "private/elf_platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A made up program with the mix of relocations a typical one has, mostly
+// relative ones and some against the symbols of the firmware
+#define SYNTH_SEGMENT_SIZE (256 * 1024)
+#define SYNTH_RELOCS       8192
+#define SYNTH_SYMBOLS      300
+
+#define R_RISCV_32        1
+#define R_RISCV_RELATIVE  3
+#define R_RISCV_JUMP_SLOT 5
+
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    uint8_t *segment;
+    uint32_t segment_size;
+} elf_case_t;
+
+void *esp_elf_malloc(uint32_t n, bool exec) {
+    (void)exec;
+    return malloc(n);
+}
+
+void esp_elf_free(void *ptr) {
+    free(ptr);
+}
+
+// The generated one hashes the name and nearly always finds it in the first
+// slot, this does the hashing and finds everything
+uintptr_t elf_find_sym(char const *sym_name) {
+    uint32_t hash = 2166136261u;
+    while (*sym_name) {
+        hash = (hash ^ (uint8_t)*sym_name++) * 16777619u;
+    }
+    return 0x40000000 | (hash & 0xFFFFFC);
+}
+
+static int elf_case_read(void *ctx, uint32_t offset, void *buf, uint32_t size) {
+    elf_case_t const *c = ctx;
+    if (offset > c->size || size > c->size - offset) {
+        return -1;
+    }
+    memcpy(buf, c->data + offset, size);
+    return 0;
+}
+
+// What task.c does once the program is open, into memory set aside for it
+static void relocate(void *ctx, size_t iterations) {
+    elf_case_t *c = ctx;
+    esp_elf_t   elf;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        esp_elf_init(&elf);
+        elf.psegment      = c->segment;
+        elf.psegment_size = c->segment_size;
+        if (esp_elf_relocate_stream(&elf, elf_case_read, c)) {
+            printf("Relocation failed\n");
+            return;
+        }
+    }
+}
+
+static bool synth_program(elf_case_t *c) {
+    size_t rela_offset   = sizeof(elf32_hdr_t) + sizeof(elf32_phdr_t) + SYNTH_SEGMENT_SIZE;
+    size_t symtab_offset = rela_offset + SYNTH_RELOCS * sizeof(elf32_rela_t);
+    size_t strtab_offset = symtab_offset + (SYNTH_SYMBOLS + 1) * sizeof(elf32_sym_t);
+    size_t strtab_size   = 1 + SYNTH_SYMBOLS * 16;
+    size_t shdr_offset   = strtab_offset + strtab_size;
+
+    c->size = shdr_offset + 4 * sizeof(elf32_shdr_t);
+    c->data = calloc(1, c->size);
+    if (!c->data) {
+        return false;
+    }
+
+    elf32_hdr_t *ehdr = (elf32_hdr_t *)c->data;
+    ehdr->phoff       = sizeof(elf32_hdr_t);
+    ehdr->phnum       = 1;
+    ehdr->phentsize   = sizeof(elf32_phdr_t);
+    ehdr->shoff       = shdr_offset;
+    ehdr->shnum       = 4;
+    ehdr->shentsize   = sizeof(elf32_shdr_t);
+
+    elf32_phdr_t *phdr = (elf32_phdr_t *)(c->data + ehdr->phoff);
+    phdr->type         = PT_LOAD;
+    phdr->offset       = ehdr->phoff + sizeof(elf32_phdr_t);
+    phdr->filesz       = SYNTH_SEGMENT_SIZE;
+    phdr->memsz        = SYNTH_SEGMENT_SIZE;
+
+    elf32_rela_t *rela  = (elf32_rela_t *)(c->data + rela_offset);
+    uint32_t      state = 1;
+    for (int i = 0; i < SYNTH_RELOCS; ++i) {
+        uint32_t r     = bench_random(&state);
+        uint32_t sym   = r % SYNTH_SYMBOLS + 1;
+        rela[i].offset = (r >> 4) % (SYNTH_SEGMENT_SIZE / 4) * 4;
+        if (r % 100 < 85) {
+            rela[i].info   = ELF_R_INFO(0, R_RISCV_RELATIVE);
+            rela[i].addend = rela[i].offset;
+        } else if (r % 100 < 95) {
+            rela[i].info = ELF_R_INFO(sym, R_RISCV_JUMP_SLOT);
+        } else {
+            rela[i].info = ELF_R_INFO(sym, R_RISCV_32);
+        }
+    }
+
+    elf32_sym_t *symtab = (elf32_sym_t *)(c->data + symtab_offset);
+    char        *strtab = (char *)(c->data + strtab_offset);
+    size_t       name   = 1;
+    for (int i = 1; i <= SYNTH_SYMBOLS; ++i) {
+        symtab[i].name  = name;
+        name           += sprintf(strtab + name, "firmware_fn%d", i) + 1;
+    }
+
+    elf32_shdr_t *shdr = (elf32_shdr_t *)(c->data + shdr_offset);
+    shdr[1].type       = SHT_RELA;
+    shdr[1].offset     = rela_offset;
+    shdr[1].size       = SYNTH_RELOCS * sizeof(elf32_rela_t);
+    shdr[1].link       = 2;
+    shdr[2].type       = SHT_SYMTAB;
+    shdr[2].offset     = symtab_offset;
+    shdr[2].size       = (SYNTH_SYMBOLS + 1) * sizeof(elf32_sym_t);
+    shdr[2].link       = 3;
+    shdr[3].type       = SHT_STRTAB;
+    shdr[3].offset     = strtab_offset;
+    shdr[3].size       = strtab_size;
+    return true;
+}
+
+static bool load_program(elf_case_t *c, char const *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    c->size = ftell(f);
+    c->data = malloc(c->size);
+    fseek(f, 0, SEEK_SET);
+    bool ok = c->data && fread(c->data, 1, c->size, f) == c->size;
+    fclose(f);
+    return ok;
+}
+
+// All LOAD segments from the first to the end of the last
+static uint32_t segment_size(elf_case_t const *c) {
+    elf32_hdr_t const  *ehdr  = (elf32_hdr_t const *)c->data;
+    elf32_phdr_t const *phdr  = (elf32_phdr_t const *)(c->data + ehdr->phoff);
+    uint32_t            start = UINT32_MAX;
+    uint32_t            end   = 0;
+
+    for (int i = 0; i < ehdr->phnum; ++i) {
+        if (phdr[i].type == PT_LOAD) {
+            start = phdr[i].vaddr < start ? phdr[i].vaddr : start;
+            end   = phdr[i].vaddr + phdr[i].memsz > end ? phdr[i].vaddr + phdr[i].memsz : end;
+        }
+    }
+    return end > start ? end - start : 0;
+}
+
+void bench_elf(char const *path) {
+    elf_case_t c = {0};
+
+    if (path ? !load_program(&c, path) : !synth_program(&c)) {
+        printf("Unable to %s %s\n", path ? "read" : "make up", path ? path : "a program");
+        free(c.data);
+        return;
+    }
+
+    c.segment_size = segment_size(&c);
+    c.segment      = malloc(c.segment_size);
+    if (c.segment) {
+        bench_run(path ? "elf/relocate_recorded" : "elf/relocate", relocate, &c);
+    }
+
+    free(c.segment);
+    free(c.data);
+}
@@ -0,0 +1,123 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "badgevms/json.h"
+#include "bench.h"
+#include "cJSON.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Talks in a made up event schedule, about the size of a real one
+#define NUM_EVENTS 250
+
+typedef struct {
+    char         *text;
+    json_token_t *tokens;
+    int           num_tokens;
+} json_ctx_t;
+
+static char *make_schedule(void) {
+    size_t size = NUM_EVENTS * 512;
+    char  *text = malloc(size);
+    size_t len  = snprintf(text, size, "{\"version\":\"2025\",\"events\":[");
+
+    for (int i = 0; i < NUM_EVENTS; ++i) {
+        len += snprintf(
+            text + len,
+            size - len,
+            "%s{\"id\":%d,\"title\":\"Talk number %d about \\\"things\\\"\",\"room\":\"Room %c\","
+            "\"start\":\"2025-08-0%dT%02d:00:00+02:00\",\"duration\":%d.5,\"recorded\":%s,"
+            "\"speakers\":[\"Speaker %d\",\"Speaker %d\"],\"abstract\":\"A talk about caf\\u00e9s, "
+            "hardware and badges, with a rather long abstract so the strings dominate like they do in the real "
+            "thing.\",\"links\":null}",
+            i ? "," : "",
+            i,
+            i,
+            'A' + i % 5,
+            1 + i % 5,
+            10 + i % 12,
+            i % 3 + 1,
+            i % 2 ? "true" : "false",
+            i,
+            i + 1
+        );
+    }
+    snprintf(text + len, size - len, "]}");
+    return text;
+}
+
+static void parse(void *ctx, size_t iterations) {
+    json_ctx_t *c = ctx;
+    json_t      json;
+    for (size_t i = 0; i < iterations; ++i) {
+        json_parse(&json, c->text, SIZE_MAX, c->tokens, c->num_tokens);
+    }
+}
+
+static void parse_cjson(void *ctx, size_t iterations) {
+    json_ctx_t *c = ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        cJSON_Delete(cJSON_Parse(c->text));
+    }
+}
+
+// The title of every event, like a schedule app listing them
+static void titles(void *ctx, size_t iterations) {
+    json_ctx_t *c = ctx;
+    json_t      json;
+    char        title[64];
+
+    json_parse(&json, c->text, SIZE_MAX, c->tokens, c->num_tokens);
+    int events = json_object_get(&json, 0, "events");
+    for (size_t i = 0; i < iterations; ++i) {
+        for (int event = events + 1; event < json.tokens[events].next; event = json.tokens[event].next) {
+            json_string_get(&json, json_object_get(&json, event, "title"), title, sizeof(title));
+        }
+    }
+}
+
+void bench_json(void) {
+    json_ctx_t ctx = {.text = make_schedule()};
+    json_t     json;
+
+    ctx.num_tokens = json_parse(&json, ctx.text, SIZE_MAX, NULL, 0);
+    ctx.tokens     = malloc(ctx.num_tokens * sizeof(json_token_t));
+
+    // Not a test suite, but a parser that gets this wrong isn't worth timing
+    char      title[64];
+    long long id;
+    int       events = -1;
+    if (json_parse(&json, ctx.text, SIZE_MAX, ctx.tokens, ctx.num_tokens) != ctx.num_tokens ||
+        (events = json_object_get(&json, 0, "events")) < 0 || json.tokens[events].size != NUM_EVENTS ||
+        !json_int_get(&json, json_object_get(&json, json_array_get(&json, events, 7), "id"), &id) || id != 7 ||
+        json_string_get(&json, json_object_get(&json, events + 1, "title"), title, sizeof(title)) < 0 ||
+        strcmp(title, "Talk number 0 about \"things\"") ||
+        json_parse(&json, "{\"a\":[1,2}", SIZE_MAX, ctx.tokens, ctx.num_tokens) != JSON_ERROR_INVALID ||
+        json_parse(&json, "{\"a\":[1,2", SIZE_MAX, ctx.tokens, ctx.num_tokens) != JSON_ERROR_PARTIAL) {
+        fprintf(stderr, "json: schedule parsed wrong\n");
+        exit(1);
+    }
+
+    bench_run("json/parse", parse, &ctx);
+    bench_run("json/parse_cjson", parse_cjson, &ctx);
+    bench_run("json/titles", titles, &ctx);
+
+    free(ctx.tokens);
+    free(ctx.text);
+}
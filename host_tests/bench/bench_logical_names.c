@@ -0,0 +1,92 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include "logical_names.h"
+
+#include <stdio.h>
+
+#define UNCACHED_PATHS 256
+#define FILLER_NAMES   32
+
+// The kernel keeps this in the process, there is only one here
+static logical_name_table_t *_Atomic process_table;
+
+logical_name_table_t *_Atomic *logical_name_process_table(void) {
+    return &process_table;
+}
+
+static void resolve_one(void *ctx, size_t iterations) {
+    char const *path = ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        logical_name_result_free(logical_name_resolve_const(path, 0));
+    }
+}
+
+static void resolve_all(void *ctx, size_t iterations) {
+    char const *path = ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        logical_name_list_free(logical_name_resolve_all(path));
+    }
+}
+
+// More paths than the cache holds, so nearly every one is resolved again
+static void resolve_uncached(void *ctx, size_t iterations) {
+    char (*paths)[32] = ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        logical_name_result_free(logical_name_resolve_const(paths[i % UNCACHED_PATHS], 0));
+    }
+}
+
+// Every change publishes a new copy of the table
+static void set_del(void *ctx, size_t iterations) {
+    (void)ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        logical_name_set("BENCH", "SD0:[BENCH]", false);
+        logical_name_del("BENCH");
+    }
+}
+
+void bench_logical_names(void) {
+    static char paths[UNCACHED_PATHS][32];
+
+    logical_names_system_init();
+
+    // What the firmware sets up with an SD card, and then some
+    logical_name_set("STORAGE:", "SD0:, FLASH0:", false);
+    logical_name_set("APPS:", "SD0:[BADGEVMS.APPS], FLASH0:[BADGEVMS.APPS]", false);
+    logical_name_set("LIBS:", "SD0:[BADGEVMS.LIBS], FLASH0:[BADGEVMS.LIBS]", false);
+    logical_name_set("SYS$SYSDEVICE", "FLASH0:", false);
+    logical_name_set("SYS$LIBRARY", "SYS$SYSDEVICE:[BADGEVMS.LIBS]", false);
+    for (int i = 0; i < FILLER_NAMES; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "APP%d$DATA", i);
+        logical_name_set(name, "STORAGE:[DATA]", false);
+    }
+    for (int i = 0; i < UNCACHED_PATHS; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "APPS:[app%d]app%d.elf", i, i);
+    }
+
+    bench_run("lname/resolve_cached", resolve_one, "APPS:[doom]doom.elf");
+    bench_run("lname/resolve_nested", resolve_one, "SYS$LIBRARY:libc.so");
+    bench_run("lname/resolve_all", resolve_all, "APPS:[doom]doom.wad");
+    bench_run("lname/resolve_uncached", resolve_uncached, paths);
+    bench_run("lname/set_del", set_del, NULL);
+
+    logical_name_process_set("DATA", "SD0:[DOOM], FLASH0:[DOOM]", false);
+    bench_run("lname/resolve_process_name", resolve_one, "DATA:doom.wad");
+    logical_name_process_del("DATA");
+}
@@ -0,0 +1,50 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms/pathfuncs.h"
+#include "bench.h"
+
+#include <stdlib.h>
+
+static char const *const paths[] = {
+    "FLASH0:",
+    "SD0:file.txt",
+    "APPS:[doom]doom.elf",
+    "SD0:[BADGEVMS.APPS.why2025_sponsors]why2025_sponsors.elf",
+    "FLASH0:[a.b.c.d.e.f.g.h]a_rather_long_file_name.with_an_extension",
+};
+
+#define NUM_PATHS (sizeof(paths) / sizeof(paths[0]))
+
+static void parse(void *ctx, size_t iterations) {
+    (void)ctx;
+    path_t path;
+    for (size_t i = 0; i < iterations; ++i) {
+        parse_path(paths[i % NUM_PATHS], &path);
+    }
+}
+
+static void fileconcat(void *ctx, size_t iterations) {
+    (void)ctx;
+    for (size_t i = 0; i < iterations; ++i) {
+        free(path_fileconcat(paths[i % NUM_PATHS], "manifest.json"));
+    }
+}
+
+void bench_path(void) {
+    bench_run("path/parse", parse, NULL);
+    bench_run("path/fileconcat", fileconcat, NULL);
+}
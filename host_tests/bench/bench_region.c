@@ -0,0 +1,144 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms_config.h"
+#include "bench.h"
+#include "compositor/region.h"
+
+// As in window_decorations.h
+#define BORDER_TOP_PX 25
+#define BORDER_PX     2
+
+#define DAMAGE_RECTS 16
+
+typedef struct {
+    window_rect_t content;
+    window_rect_t outer;
+    window_rect_t occluders[MAX_WINDOWS * 4];
+    int           num_occluders;
+} visible_case_t;
+
+typedef struct {
+    rect_array_t visible;
+    rect_array_t old_visible;
+} subtract_case_t;
+
+static window_rect_t clip(window_rect_t a, window_rect_t b) {
+    int left   = a.x > b.x ? a.x : b.x;
+    int top    = a.y > b.y ? a.y : b.y;
+    int right  = a.x + a.w < b.x + b.w ? a.x + a.w : b.x + b.w;
+    int bottom = a.y + a.h < b.y + b.h ? a.y + a.h : b.y + b.h;
+    return (window_rect_t){left, top, right > left ? right - left : 0, bottom > top ? bottom - top : 0};
+}
+
+// The bottom one of a cascade of decorated windows, covered by the ones
+// above it. Translucent windows only cover it with their frame.
+static void visible_case_init(visible_case_t *c, bool translucent) {
+    c->content       = (window_rect_t){BORDER_PX, BORDER_TOP_PX, 400, 300};
+    c->outer         = (window_rect_t){0, 0, 400 + 2 * BORDER_PX, 300 + BORDER_TOP_PX + 1};
+    c->num_occluders = 0;
+
+    for (int i = 1; i < MAX_WINDOWS; ++i) {
+        window_rect_t outer = {i * 37, i * 29, 200 + 2 * BORDER_PX, 150 + BORDER_TOP_PX + BORDER_PX};
+        window_rect_t rects[4];
+        int           count = 0;
+        if (!translucent) {
+            rects[count++] = outer;
+        } else {
+            rects[count++] = (window_rect_t){outer.x, outer.y, outer.w, BORDER_TOP_PX};
+            rects[count++] = (window_rect_t){outer.x, outer.y + BORDER_TOP_PX, BORDER_PX, 150};
+            rects[count++] = (window_rect_t){outer.x + BORDER_PX + 200, outer.y + BORDER_TOP_PX, BORDER_PX, 150};
+            rects[count++] = (window_rect_t){outer.x, outer.y + BORDER_TOP_PX + 150, outer.w, BORDER_PX};
+        }
+        for (int j = 0; j < count; ++j) {
+            window_rect_t overlap = clip(rects[j], c->outer);
+            if (overlap.w && overlap.h) {
+                c->occluders[c->num_occluders++] = overlap;
+            }
+        }
+    }
+}
+
+// What window_calculate_visible_regions() does
+static void visible_regions(void *ctx, size_t iterations) {
+    visible_case_t const *c = ctx;
+    rect_array_t          visible;
+    rect_array_t          decoration_visible;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        region_init(&visible, c->content);
+        region_init(&decoration_visible, c->outer);
+        region_subtract_rect(&decoration_visible, c->content);
+        for (int j = 0; j < c->num_occluders; ++j) {
+            region_subtract_rect(&visible, c->occluders[j]);
+            region_subtract_rect(&decoration_visible, c->occluders[j]);
+        }
+    }
+}
+
+// Damage of a frame collected into one region
+static void union_damage(void *ctx, size_t iterations) {
+    window_rect_t const *damage = ctx;
+    rect_array_t         region;
+    rect_array_t         rect;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        region.count = 0;
+        for (int j = 0; j < DAMAGE_RECTS; ++j) {
+            region_init(&rect, damage[j]);
+            region_union(&region, &region, &rect);
+        }
+    }
+}
+
+// What became visible when an occluder moved
+static void subtract_exposed(void *ctx, size_t iterations) {
+    subtract_case_t const *c = ctx;
+    rect_array_t           exposed;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        region_subtract(&exposed, &c->visible, &c->old_visible);
+    }
+}
+
+void bench_region(void) {
+    visible_case_t c;
+    visible_case_init(&c, false);
+    bench_run("region/visible_regions", visible_regions, &c);
+    visible_case_init(&c, true);
+    bench_run("region/visible_regions_translucent", visible_regions, &c);
+
+    window_rect_t damage[DAMAGE_RECTS];
+    uint32_t      state = 1;
+    for (int i = 0; i < DAMAGE_RECTS; ++i) {
+        uint32_t r = bench_random(&state);
+        damage[i]  = (window_rect_t){r % (FRAMEBUFFER_MAX_W - 64), (r >> 10) % (FRAMEBUFFER_MAX_H - 64), 16, 16};
+        damage[i].w += (r >> 20) % 48;
+        damage[i].h += (r >> 26) % 48;
+    }
+    bench_run("region/union_damage", union_damage, damage);
+
+    subtract_case_t s;
+    region_init(&s.visible, c.content);
+    region_init(&s.old_visible, c.content);
+    for (int i = 0; i < c.num_occluders; ++i) {
+        window_rect_t moved = c.occluders[i];
+        moved.x            += 5;
+        region_subtract_rect(&s.visible, moved);
+        region_subtract_rect(&s.old_visible, c.occluders[i]);
+    }
+    bench_run("region/subtract_exposed", subtract_exposed, &s);
+}
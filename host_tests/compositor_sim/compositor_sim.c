@@ -0,0 +1,521 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compositor/pixel_functions.h"
+#include "compositor/region.h"
+#include "compositor/scene.h"
+#include "ppa_sw.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+
+// Replays a window command trace through the compositor's scene code, with
+// ppa_sw.c standing in for the PPA, and reports how long every refresh took.
+// A trace is a text file with one command per line, # starts a comment:
+//
+//   create <id> <w> <h> <fb_w> <fb_h> [argb8888] [fullscreen] [alpha]
+//   move <id> <x> <y>
+//   resize <id> <w> <h>
+//   opacity <id> <0-255>
+//   fullscreen <id> <0|1>
+//   focus_next
+//   present <id> [<x> <y> <w> <h>]...
+//   destroy <id>
+//   frame [count]
+//
+// ids are 0 to MAX_WINDOWS - 1. Commands up to a frame are applied as one
+// batch, like the compositor does with its queue. present without rects
+// damages the whole framebuffer.
+
+#define BACKGROUND_COLOR 0xaaaa
+#define LETTERBOX_COLOR  0x0000
+// Stand-ins for draw_window_box(), only the area it touches matters here
+#define FOCUSED_COLOR    0xffff
+#define UNFOCUSED_COLOR  0x8410
+
+#define SLOWEST_FRAMES 5
+
+typedef struct {
+    int      line; // Of the frame command in the trace
+    int      commands;
+    int64_t  took_ns;
+    uint64_t pixels;
+} frame_t;
+
+static window_t *windows[MAX_WINDOWS];
+static uint16_t *screens[DISPLAY_FRAMEBUFFERS];
+static int       cur_fb;
+
+static frame_t *frames;
+static int      num_frames;
+static int      frames_size;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static window_t *sim_window_create(window_size_t size, window_size_t fb_size, pixel_format_t format, window_flag_t flags) {
+    window_t              *window      = calloc(1, sizeof(window_t));
+    managed_framebuffer_t *framebuffer = calloc(1, sizeof(managed_framebuffer_t));
+    int                    bpp         = BADGEVMS_BYTESPERPIXEL(format);
+    if (!window || !framebuffer) {
+        free(window);
+        free(framebuffer);
+        return NULL;
+    }
+
+    framebuffer->w                  = fb_size.w;
+    framebuffer->h                  = fb_size.h;
+    framebuffer->format             = format;
+    framebuffer->framebuffer.w      = fb_size.w;
+    framebuffer->framebuffer.h      = fb_size.h;
+    framebuffer->framebuffer.format = format;
+    framebuffer->framebuffer.pixels = malloc((size_t)fb_size.w * fb_size.h * bpp);
+    if (!framebuffer->framebuffer.pixels) {
+        free(window);
+        free(framebuffer);
+        return NULL;
+    }
+    // Half opaque, so blending has something to do
+    memset(framebuffer->framebuffer.pixels, 0x80, (size_t)fb_size.w * fb_size.h * bpp);
+
+    // As window_create() and window_framebuffer_create() leave it
+    window->opacity         = 255;
+    window->flags           = flags;
+    size                    = window_clamp_size(window, size);
+    window->rect            = (window_rect_t){0, 0, size.w, size.h};
+    window->framebuffers[0] = framebuffer;
+    window->fb_dirty        = ALL_DISPLAY_FB_MASK;
+    push_window(window);
+    return window;
+}
+
+static void sim_window_destroy(window_t *window) {
+    remove_window(window);
+    free(window->framebuffers[0]->framebuffer.pixels);
+    free(window->framebuffers[0]);
+    free(window);
+}
+
+static void blit(uint16_t *screen, window_t *window, managed_framebuffer_t *framebuffer, float scale, window_rect_t rect) {
+    if (rect.w <= 0 || rect.h <= 0) {
+        return;
+    }
+
+    window_rect_t fb_rect = content_to_framebuffer_rect(rect, window, scale);
+    if (fb_rect.w <= 0 || fb_rect.h <= 0) {
+        return;
+    }
+    ppa_sw_srm(screen, &framebuffer->framebuffer, fb_rect, (window_coords_t){rect.x, rect.y}, scale);
+}
+
+// See background_clear() in compositor.c
+static void background_clear(uint16_t *screen) {
+    window_rect_t full       = {0, 0, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H};
+    rect_array_t  background = {.rects[0] = full, .count = 1};
+
+    if (window_stack) {
+        window_t *window = window_stack;
+        do {
+            if (!window_is_translucent(window) && !region_subtract_rect(&background, window_visible_content(window))) {
+                region_init(&background, full);
+                break;
+            }
+            window = window->next;
+        } while (window != window_stack);
+    }
+
+    for (int i = 0; i < background.count; ++i) {
+        ppa_sw_fill(screen, background.rects[i], BACKGROUND_COLOR);
+    }
+}
+
+// See window_fill_letterbox() in compositor.c
+static void fill_letterbox(uint16_t *screen, window_t *window, managed_framebuffer_t *framebuffer) {
+    window_rect_t content = window_content_rect(window, framebuffer);
+    window_rect_t area    = window_visible_content(window);
+    if (content.w == area.w && content.h == area.h) {
+        return;
+    }
+
+    rect_array_t bars = window->visible;
+    region_subtract_rect(&bars, content);
+    for (int i = 0; i < bars.count; ++i) {
+        ppa_sw_fill(screen, bars.rects[i], LETTERBOX_COLOR);
+    }
+}
+
+// One refresh, the same steps as the compositor task takes
+static void frame_draw(void) {
+    uint16_t *screen = screens[cur_fb];
+    int       bit    = 1 << cur_fb;
+
+    translucent_damage_check(cur_fb);
+
+    bool cleared = false;
+    if (background_damaged & bit) {
+        background_clear(screen);
+        background_damaged &= ~bit;
+        cleared             = true;
+    }
+
+    if (!window_stack) {
+        return;
+    }
+
+    window_t *window = window_stack->prev;
+    do {
+        managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+        if (!visible_regions_valid) {
+            window_update_visible_regions(window, framebuffer, window_scale(window, framebuffer));
+        }
+        if ((cleared || (decoration_damaged & bit)) && !(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+            uint16_t color = window == window_stack ? FOCUSED_COLOR : UNFOCUSED_COLOR;
+            for (int i = 0; i < window->decoration_visible.count; ++i) {
+                ppa_sw_fill(screen, window->decoration_visible.rects[i], color);
+            }
+        }
+        window = window->prev;
+    } while (window != window_stack->prev);
+
+    window = window_stack->prev;
+    do {
+        managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+        float                  scale       = window_scale(window, framebuffer);
+        bool                   is_clean    = atomic_flag_test_and_set(&framebuffer->clean);
+
+        if (!is_clean) {
+            window_collect_present_damage(window);
+        }
+
+        bool full_redraw = window->fb_dirty & bit;
+        if ((full_redraw || (window->letterbox_dirty & bit)) && !window_is_translucent(window)) {
+            fill_letterbox(screen, window, framebuffer);
+        }
+        window->letterbox_dirty &= ~bit;
+
+        damage_rect_array_t *damage = &window->fb_damage[cur_fb];
+        if (!is_clean || full_redraw || damage->count) {
+            if (window_is_translucent(window)) {
+                // translucent_damage_check() made sure everything below us was redrawn
+                window_rect_t content = window_content_rect(window, framebuffer);
+                window_rect_t fb_rect = {0, 0, framebuffer->w, framebuffer->h};
+                ppa_sw_blend(
+                    screen,
+                    &framebuffer->framebuffer,
+                    fb_rect,
+                    (window_coords_t){content.x, content.y},
+                    scale,
+                    window->opacity
+                );
+            } else {
+                for (int i = 0; i < window->visible.count; i++) {
+                    window_rect_t visible_content = window->visible.rects[i];
+                    if (full_redraw) {
+                        blit(screen, window, framebuffer, scale, visible_content);
+                        continue;
+                    }
+                    for (int j = 0; j < damage->count; j++) {
+                        window_rect_t damaged = framebuffer_to_content_rect(damage->rects[j], window, scale);
+                        blit(screen, window, framebuffer, scale, rect_intersection(visible_content, damaged));
+                    }
+                }
+            }
+            window->fb_dirty &= ~bit;
+            damage->count     = 0;
+        }
+        window = window->prev;
+    } while (window != window_stack->prev);
+
+    visible_regions_valid  = true;
+    decoration_damaged    &= ~bit;
+}
+
+static void frame_run(int line, int commands) {
+    if (num_frames == frames_size) {
+        frames_size = frames_size ? frames_size * 2 : 256;
+        frames      = realloc(frames, frames_size * sizeof(frame_t));
+        if (!frames) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    uint64_t pixels = ppa_sw_stats.pixels;
+    int64_t  start  = now_ns();
+    frame_draw();
+    frames[num_frames++] = (frame_t){
+        .line     = line,
+        .commands = commands,
+        .took_ns  = now_ns() - start,
+        .pixels   = ppa_sw_stats.pixels - pixels,
+    };
+    cur_fb = (cur_fb + 1) % display_fb_count;
+}
+
+static window_t *window_arg(char const *path, int line, int id) {
+    if (id < 0 || id >= MAX_WINDOWS || !windows[id]) {
+        fprintf(stderr, "%s:%d: no window %d\n", path, line, id);
+        return NULL;
+    }
+    return windows[id];
+}
+
+// Apply the commands of a trace the way the compositor task applies its queue
+static bool replay(char const *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    char      buf[512];
+    int       line          = 0;
+    int       commands      = 0;
+    bool      scene_changed = false;
+    bool      ok            = true;
+    window_t *window;
+
+    while (ok && fgets(buf, sizeof(buf), f)) {
+        char cmd[32];
+        int  id, a, b, c, d, n;
+        ++line;
+
+        char *comment = strchr(buf, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        if (sscanf(buf, "%31s%n", cmd, &n) != 1) {
+            continue;
+        }
+        char *args = buf + n;
+
+        if (!strcmp(cmd, "frame")) {
+            int count = 1;
+            sscanf(args, "%d", &count);
+            if (scene_changed) {
+                mark_scene_damaged();
+                scene_changed = false;
+            }
+            for (int i = 0; i < count; ++i) {
+                frame_run(line, commands);
+                commands = 0;
+            }
+            continue;
+        }
+
+        ++commands;
+        if (!strcmp(cmd, "create") && sscanf(args, "%d %d %d %d %d%n", &id, &a, &b, &c, &d, &n) == 5) {
+            if (id < 0 || id >= MAX_WINDOWS || windows[id]) {
+                fprintf(stderr, "%s:%d: window %d can't be created\n", path, line, id);
+                ok = false;
+                continue;
+            }
+            pixel_format_t format = strstr(args + n, "argb8888") ? BADGEVMS_PIXELFORMAT_ARGB8888
+                                                                  : BADGEVMS_PIXELFORMAT_RGB565;
+            window_flag_t  flags  = WINDOW_FLAG_DOUBLE_BUFFERED;
+            if (strstr(args + n, "fullscreen")) {
+                flags |= WINDOW_FLAG_FULLSCREEN;
+            }
+            if (strstr(args + n, "alpha")) {
+                flags |= WINDOW_FLAG_ALPHA_BLEND;
+            }
+            windows[id]   = sim_window_create((window_size_t){a, b}, (window_size_t){c, d}, format, flags);
+            ok            = windows[id] != NULL;
+            scene_changed = true;
+        } else if (!strcmp(cmd, "move") && sscanf(args, "%d %d %d", &id, &a, &b) == 3) {
+            window = window_arg(path, line, id);
+            ok     = window != NULL;
+            if (ok) {
+                window_coords_t coords = window_clamp_position(window, (window_coords_t){a, b});
+                if (coords.x != window->rect.x || coords.y != window->rect.y) {
+                    window->rect.x = coords.x;
+                    window->rect.y = coords.y;
+                    scene_changed  = true;
+                }
+            }
+        } else if (!strcmp(cmd, "resize") && sscanf(args, "%d %d %d", &id, &a, &b) == 3) {
+            window = window_arg(path, line, id);
+            ok     = window != NULL;
+            if (ok) {
+                window_size_t size = window_clamp_size(window, (window_size_t){a, b});
+                if (size.w != window->rect.w || size.h != window->rect.h) {
+                    window->rect.w = size.w;
+                    window->rect.h = size.h;
+                    scene_changed  = true;
+                }
+            }
+        } else if (!strcmp(cmd, "opacity") && sscanf(args, "%d %d", &id, &a) == 2) {
+            window = window_arg(path, line, id);
+            ok     = window != NULL;
+            if (ok) {
+                window->opacity = a;
+                scene_changed   = true;
+            }
+        } else if (!strcmp(cmd, "fullscreen") && sscanf(args, "%d %d", &id, &a) == 2) {
+            window = window_arg(path, line, id);
+            ok     = window != NULL;
+            if (ok && a && !(window->flags & WINDOW_FLAG_FULLSCREEN)) {
+                window->rect_orig  = window->rect;
+                window->rect       = (window_rect_t){0, 0, FRAMEBUFFER_MAX_W, FRAMEBUFFER_MAX_H};
+                window->flags     |= WINDOW_FLAG_FULLSCREEN;
+                scene_changed      = true;
+            } else if (ok && !a && (window->flags & WINDOW_FLAG_FULLSCREEN)) {
+                window->rect   = window->rect_orig;
+                window->flags &= ~WINDOW_FLAG_FULLSCREEN;
+                scene_changed  = true;
+            }
+        } else if (!strcmp(cmd, "focus_next")) {
+            if (window_stack) {
+                window_stack          = window_stack->next;
+                visible_regions_valid = false;
+                decoration_damaged    = ALL_DISPLAY_FB_MASK;
+            }
+        } else if (!strcmp(cmd, "present") && sscanf(args, "%d%n", &id, &n) == 1) {
+            window = window_arg(path, line, id);
+            ok     = window != NULL;
+            if (!ok) {
+                continue;
+            }
+            // See window_present()
+            managed_framebuffer_t *framebuffer = window->framebuffers[window->front_fb];
+            window_rect_t          bounds      = {0, 0, framebuffer->w, framebuffer->h};
+            int                    num_rects   = 0;
+            char                  *rects       = args + n;
+            while (sscanf(rects, "%d %d %d %d%n", &a, &b, &c, &d, &n) == 4) {
+                if (!window->present_damage_full) {
+                    damage_add(&window->present_damage, rect_intersection((window_rect_t){a, b, c, d}, bounds));
+                }
+                rects += n;
+                ++num_rects;
+            }
+            if (!num_rects) {
+                window->present_damage_full = true;
+            }
+            atomic_flag_clear(&framebuffer->clean);
+        } else if (!strcmp(cmd, "destroy") && sscanf(args, "%d", &id) == 1) {
+            window = window_arg(path, line, id);
+            ok     = window != NULL;
+            if (ok) {
+                sim_window_destroy(window);
+                windows[id]   = NULL;
+                scene_changed = true;
+            }
+        } else {
+            fprintf(stderr, "%s:%d: can't parse '%s'\n", path, line, cmd);
+            ok = false;
+        }
+    }
+
+    fclose(f);
+    return ok;
+}
+
+static int compare_took(void const *a, void const *b) {
+    int64_t x = ((frame_t const *)a)->took_ns;
+    int64_t y = ((frame_t const *)b)->took_ns;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void report(char const *path) {
+    if (!num_frames) {
+        printf("%s: no frames\n", path);
+        return;
+    }
+
+    int64_t  total  = 0;
+    uint64_t pixels = 0;
+    for (int i = 0; i < num_frames; ++i) {
+        total  += frames[i].took_ns;
+        pixels += frames[i].pixels;
+    }
+
+    qsort(frames, num_frames, sizeof(frame_t), compare_took);
+    printf(
+        "%s: %d frames, %.1f us average, %.1f us median, %.1f us worst, %.0f pixels per frame\n",
+        path,
+        num_frames,
+        (double)total / num_frames / 1000,
+        (double)frames[num_frames / 2].took_ns / 1000,
+        (double)frames[0].took_ns / 1000,
+        (double)pixels / num_frames
+    );
+    for (int i = 0; i < num_frames && i < SLOWEST_FRAMES; ++i) {
+        printf(
+            "  %8.1f us  %8llu pixels  %2d commands  frame at line %d\n",
+            (double)frames[i].took_ns / 1000,
+            (unsigned long long)frames[i].pixels,
+            frames[i].commands,
+            frames[i].line
+        );
+    }
+}
+
+static void reset(void) {
+    for (int i = 0; i < MAX_WINDOWS; ++i) {
+        if (windows[i]) {
+            sim_window_destroy(windows[i]);
+            windows[i] = NULL;
+        }
+    }
+    num_frames = 0;
+    cur_fb     = 0;
+    mark_scene_damaged();
+}
+
+// compositor_sim [-b buffers] trace...
+//
+// Prints the frame time statistics of every trace and the frames that took
+// longest, with the trace line they were drawn at. -b sets the number of
+// display framebuffers, DISPLAY_FRAMEBUFFERS by default.
+int main(int argc, char *argv[]) {
+    int first = 1;
+    if (argc > 2 && !strcmp(argv[1], "-b")) {
+        display_fb_count = atoi(argv[2]);
+        first            = 3;
+    }
+
+    if (argc <= first || display_fb_count < DISPLAY_FRAMEBUFFERS_MIN || display_fb_count > DISPLAY_FRAMEBUFFERS) {
+        fprintf(stderr, "Usage: %s [-b buffers] trace...\n", argv[0]);
+        return 1;
+    }
+
+    window_stack_lock = xSemaphoreCreateMutex();
+    for (int i = 0; i < display_fb_count; ++i) {
+        screens[i] = calloc(FRAMEBUFFER_MAX_W * FRAMEBUFFER_MAX_H, sizeof(uint16_t));
+        if (!screens[i]) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    for (int i = first; i < argc; ++i) {
+        reset();
+        if (!replay(argv[i])) {
+            ret = 1;
+            continue;
+        }
+        report(argv[i]);
+    }
+    return ret;
+}
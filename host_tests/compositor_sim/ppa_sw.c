@@ -0,0 +1,109 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ppa_sw.h"
+
+#include "badgevms_config.h"
+
+#include <stdbool.h>
+
+ppa_sw_stats_t ppa_sw_stats;
+
+static uint16_t argb_to_565(uint32_t p) {
+    return ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+}
+
+static uint16_t blend_565(uint16_t bg, uint16_t fg, uint32_t a) {
+    uint32_t r = ((fg >> 11) * a + (bg >> 11) * (255 - a)) / 255;
+    uint32_t g = (((fg >> 5) & 0x3F) * a + ((bg >> 5) & 0x3F) * (255 - a)) / 255;
+    uint32_t b = ((fg & 0x1F) * a + (bg & 0x1F) * (255 - a)) / 255;
+    return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+// The output block clipped to the screen, false if nothing of it is left
+static bool clip_to_screen(window_rect_t *out) {
+    int x0 = out->x < 0 ? 0 : out->x;
+    int y0 = out->y < 0 ? 0 : out->y;
+    int x1 = out->x + out->w > FRAMEBUFFER_MAX_W ? FRAMEBUFFER_MAX_W : out->x + out->w;
+    int y1 = out->y + out->h > FRAMEBUFFER_MAX_H ? FRAMEBUFFER_MAX_H : out->y + out->h;
+
+    *out = (window_rect_t){x0, y0, x1 - x0, y1 - y0};
+    return out->w > 0 && out->h > 0;
+}
+
+void ppa_sw_fill(uint16_t *screen, window_rect_t rect, uint16_t color) {
+    if (!clip_to_screen(&rect)) {
+        return;
+    }
+
+    for (int y = rect.y; y < rect.y + rect.h; ++y) {
+        uint16_t *row = screen + y * FRAMEBUFFER_MAX_W;
+        for (int x = rect.x; x < rect.x + rect.w; ++x) {
+            row[x] = color;
+        }
+    }
+    ppa_sw_stats.ops++;
+    ppa_sw_stats.pixels += rect.w * rect.h;
+}
+
+static void scaled_copy(
+    uint16_t            *screen,
+    framebuffer_t const *in,
+    window_rect_t        src_rect,
+    window_coords_t      dst,
+    float                scale,
+    bool                 blend,
+    uint8_t              alpha
+) {
+    window_rect_t out = {dst.x, dst.y, (int)(src_rect.w * scale), (int)(src_rect.h * scale)};
+    int           dx  = out.x;
+    int           dy  = out.y;
+    if (!clip_to_screen(&out)) {
+        return;
+    }
+
+    bool wide = BADGEVMS_BYTESPERPIXEL(in->format) == 4;
+    for (int y = out.y; y < out.y + out.h; ++y) {
+        uint16_t *row = screen + y * FRAMEBUFFER_MAX_W;
+        int       sy  = src_rect.y + (int)((y - dy) / scale);
+        for (int x = out.x; x < out.x + out.w; ++x) {
+            int      sx = src_rect.x + (int)((x - dx) / scale);
+            uint32_t a  = 255;
+            uint16_t c;
+            if (wide) {
+                uint32_t p = ((uint32_t const *)in->pixels)[sy * in->w + sx];
+                c          = argb_to_565(p);
+                a          = (p >> 24) * alpha / 255;
+            } else {
+                c = in->pixels[sy * in->w + sx];
+                a = alpha;
+            }
+            row[x] = blend ? blend_565(row[x], c, a) : c;
+        }
+    }
+    ppa_sw_stats.ops++;
+    ppa_sw_stats.pixels += out.w * out.h;
+}
+
+void ppa_sw_srm(uint16_t *screen, framebuffer_t const *in, window_rect_t src_rect, window_coords_t dst, float scale) {
+    scaled_copy(screen, in, src_rect, dst, scale, false, 255);
+}
+
+void ppa_sw_blend(
+    uint16_t *screen, framebuffer_t const *in, window_rect_t src_rect, window_coords_t dst, float scale, uint8_t alpha
+) {
+    scaled_copy(screen, in, src_rect, dst, scale, true, alpha);
+}
@@ -0,0 +1,40 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "badgevms/compositor.h"
+#include "badgevms/framebuffer.h"
+
+#include <stdint.h>
+
+// What the compositor asks of the PPA, done on the CPU. Output is an RGB565
+// screen of FRAMEBUFFER_MAX_W pixels wide, in screen orientation.
+
+typedef struct {
+    uint64_t ops;
+    uint64_t pixels; // Written to the screen
+} ppa_sw_stats_t;
+
+extern ppa_sw_stats_t ppa_sw_stats;
+
+void ppa_sw_fill(uint16_t *screen, window_rect_t rect, uint16_t color);
+// src_rect of in, scaled by scale to the screen at dst, nearest neighbour like the SRM
+void ppa_sw_srm(uint16_t *screen, framebuffer_t const *in, window_rect_t src_rect, window_coords_t dst, float scale);
+// Like ppa_sw_srm(), blended over the screen by the alpha of in times alpha
+void ppa_sw_blend(
+    uint16_t *screen, framebuffer_t const *in, window_rect_t src_rect, window_coords_t dst, float scale, uint8_t alpha
+);
@@ -0,0 +1,328 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Checks of the raster library: which pixels triangles cover, the fill rule
+// where they share edges, textures, depth, lines and batches drawn in bands
+// by a pool. Built with threadpool_host.c, so the bands really are drawn at
+// the same time.
+
+#include "raster/raster.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define W 200
+#define H 150 // Not a whole number of bands
+
+#define SHARED_EDGE_ROUNDS 2000
+#define BATCH_TRIANGLES    300
+
+static uint16_t pixels[W * H];
+static uint16_t depth[W * H];
+static uint8_t  counts[W * H];
+static bool     error = false;
+
+static raster_target_t target = {
+    .pixels = pixels,
+    .depth  = depth,
+    .stride = W,
+    .w      = W,
+    .h      = H,
+};
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("\033[31m%s:%d: %s failed\033[0m\n", __FILE__, __LINE__, #cond);                                  \
+            error = true;                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+static raster_vertex_t vertex(double x, double y) {
+    return (raster_vertex_t){.x = RASTER_FIXED(x), .y = RASTER_FIXED(y)};
+}
+
+// A random coordinate in 1/64 pixels, so that edges go through pixel centres
+// now and then
+static double random_coord(double min, double max) {
+    return min + (rand() % (int)((max - min) * 64)) / 64.0;
+}
+
+// Add the pixels triangle v covers to counts
+static void count_triangle(raster_vertex_t const v[3]) {
+    raster_paint_t paint = {.mode = RASTER_FLAT, .color = 1};
+    memset(pixels, 0, sizeof(pixels));
+    raster_triangle(&target, v, &paint);
+    for (int i = 0; i < W * H; ++i) {
+        counts[i] += pixels[i];
+    }
+}
+
+static int count_pixels(uint16_t color) {
+    int n = 0;
+    for (int i = 0; i < W * H; ++i) {
+        n += pixels[i] == color;
+    }
+    return n;
+}
+
+// Two triangles that make up a rectangle cover every pixel whose centre is in
+// it once, centres on the top and left edges included
+static void test_rect_coverage(double x0, double y0, double x1, double y1) {
+    raster_vertex_t a[3] = {vertex(x0, y0), vertex(x1, y0), vertex(x1, y1)};
+    raster_vertex_t b[3] = {vertex(x0, y0), vertex(x1, y1), vertex(x0, y1)};
+
+    memset(counts, 0, sizeof(counts));
+    count_triangle(a);
+    count_triangle(b);
+
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            bool inside = x + 0.5 >= x0 && x + 0.5 < x1 && y + 0.5 >= y0 && y + 0.5 < y1;
+            CHECK(counts[y * W + x] == inside);
+        }
+    }
+}
+
+// A convex quad split along either diagonal covers the same pixels, each once
+static void test_shared_edges(void) {
+    static uint8_t first[W * H];
+
+    for (int round = 0; round < SHARED_EDGE_ROUNDS; ++round) {
+        double cx     = random_coord(0, W);
+        double cy     = random_coord(0, H);
+        double radius = random_coord(4, 80);
+        double angle  = random_coord(0, 6.28);
+
+        // Corners on a circle and far enough apart that snapping keeps it convex
+        raster_vertex_t q[4];
+        for (int i = 0; i < 4; ++i) {
+            q[i]   = vertex(cx + radius * cos(angle), cy + radius * sin(angle));
+            angle += random_coord(0.3, 1.5);
+        }
+
+        memset(counts, 0, sizeof(counts));
+        count_triangle((raster_vertex_t[3]){q[0], q[1], q[2]});
+        count_triangle((raster_vertex_t[3]){q[2], q[3], q[0]});
+        memcpy(first, counts, sizeof(counts));
+
+        memset(counts, 0, sizeof(counts));
+        count_triangle((raster_vertex_t[3]){q[1], q[2], q[3]});
+        count_triangle((raster_vertex_t[3]){q[0], q[3], q[1]}); // Other winding
+
+        bool same = true;
+        for (int i = 0; i < W * H; ++i) {
+            same = same && first[i] <= 1 && counts[i] == first[i];
+        }
+        CHECK(same);
+    }
+}
+
+static void test_clip(void) {
+    raster_paint_t  paint  = {.mode = RASTER_FLAT, .color = 1};
+    raster_vertex_t big[3] = {vertex(-500, -500), vertex(900, -500), vertex(-500, 900)};
+
+    memset(pixels, 0, sizeof(pixels));
+    target.clip = (raster_rect_t){20, 25, 30, 40};
+    raster_triangle(&target, big, &paint);
+    target.clip = (raster_rect_t){0};
+
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            bool inside = x >= 20 && x < 50 && y >= 25 && y < 65;
+            CHECK(pixels[y * W + x] == inside);
+        }
+    }
+}
+
+static void test_gouraud(void) {
+    raster_paint_t  paint = {.mode = RASTER_GOURAUD};
+    raster_vertex_t v[3]  = {vertex(3, 2), vertex(170, 40), vertex(20, 140)};
+    for (int i = 0; i < 3; ++i) {
+        v[i].color = 0x5aeb;
+    }
+
+    // One colour everywhere shades to exactly that colour
+    memset(pixels, 0, sizeof(pixels));
+    raster_triangle(&target, v, &paint);
+    CHECK(count_pixels(0x5aeb) + count_pixels(0) == W * H);
+    CHECK(count_pixels(0x5aeb) > 5000);
+}
+
+static void test_texture(void) {
+    uint16_t texels[4 * 4];
+    for (int i = 0; i < 4 * 4; ++i) {
+        texels[i] = i + 1;
+    }
+    texels[5] = RASTER_COLORKEY_565;
+
+    raster_texture_t texture = {.pixels = texels, .w_log2 = 2, .h_log2 = 2};
+    raster_paint_t   paint   = {.mode = RASTER_TEXTURED, .texture = &texture};
+
+    // 40 texels across 40 pixels, the texture repeats every 4
+    raster_vertex_t a[3] = {vertex(0, 0), vertex(40, 0), vertex(40, 40)};
+    raster_vertex_t b[3] = {vertex(0, 0), vertex(40, 40), vertex(0, 40)};
+    for (int i = 0; i < 3; ++i) {
+        a[i].u = a[i].x;
+        a[i].v = a[i].y;
+        b[i].u = b[i].x;
+        b[i].v = b[i].y;
+    }
+
+    memset(pixels, 0, sizeof(pixels));
+    raster_triangle(&target, a, &paint);
+    raster_triangle(&target, b, &paint);
+    for (int y = 0; y < 40; ++y) {
+        for (int x = 0; x < 40; ++x) {
+            CHECK(pixels[y * W + x] == texels[(y & 3) * 4 + (x & 3)]);
+        }
+    }
+
+    // Left out where the texture has the colour key
+    memset(pixels, 0, sizeof(pixels));
+    paint.flags = RASTER_COLORKEY;
+    raster_triangle(&target, a, &paint);
+    raster_triangle(&target, b, &paint);
+    for (int y = 0; y < 40; ++y) {
+        for (int x = 0; x < 40; ++x) {
+            uint16_t texel = texels[(y & 3) * 4 + (x & 3)];
+            CHECK(pixels[y * W + x] == (texel == RASTER_COLORKEY_565 ? 0 : texel));
+        }
+    }
+}
+
+static void test_depth(void) {
+    raster_vertex_t v[3] = {vertex(0, 0), vertex(100, 0), vertex(0, 100)};
+
+    raster_clear(&target, 0);
+    CHECK(depth[10 * W + 10] == 0xffff);
+
+    uint16_t const z[]      = {100, 200, 50};
+    uint16_t const colors[] = {1, 2, 3};
+    uint16_t const seen[]   = {1, 1, 3};
+    for (int i = 0; i < 3; ++i) {
+        raster_paint_t paint = {.mode = RASTER_FLAT, .flags = RASTER_DEPTH, .color = colors[i]};
+        v[0].z = v[1].z = v[2].z = z[i];
+        raster_triangle(&target, v, &paint);
+        CHECK(pixels[10 * W + 10] == seen[i]);
+    }
+    CHECK(depth[10 * W + 10] == 50);
+    CHECK(depth[10 * W + 150] == 0xffff);
+}
+
+static void test_line(void) {
+    raster_clear(&target, 0);
+    raster_line(&target, RASTER_FIXED(5.5), RASTER_FIXED(5.5), RASTER_FIXED(15.5), RASTER_FIXED(10.5), 7);
+    CHECK(count_pixels(7) == 11);
+    CHECK(pixels[5 * W + 5] == 7);
+    CHECK(pixels[10 * W + 15] == 7);
+
+    // Mostly off the target, only the part inside the clip is drawn
+    raster_clear(&target, 0);
+    target.clip = (raster_rect_t){10, 10, 40, 40};
+    raster_line(&target, RASTER_FIXED(-50.5), RASTER_FIXED(-50.5), RASTER_FIXED(500.5), RASTER_FIXED(500.5), 9);
+    target.clip = (raster_rect_t){0};
+    CHECK(count_pixels(9) == 40);
+    CHECK(pixels[10 * W + 10] == 9);
+    CHECK(pixels[49 * W + 49] == 9);
+}
+
+// Batches draw what the same calls one after the other draw, on any number of
+// workers and with a clip that doesn't start at a band
+static void test_batch(void) {
+    static uint16_t expected[W * H];
+    static uint16_t expected_depth[W * H];
+
+    raster_vertex_t (*triangles)[3] = malloc(sizeof(raster_vertex_t[3]) * BATCH_TRIANGLES);
+    raster_paint_t paint            = {.mode = RASTER_GOURAUD, .flags = RASTER_DEPTH};
+    raster_batch_t *batch           = raster_batch_create(BATCH_TRIANGLES);
+    CHECK(triangles && batch);
+    if (!triangles || !batch) {
+        return;
+    }
+
+    for (int i = 0; i < BATCH_TRIANGLES; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            triangles[i][k]       = vertex(random_coord(-20, W + 20), random_coord(-15, H + 15));
+            triangles[i][k].z     = rand();
+            triangles[i][k].color = rand();
+        }
+    }
+
+    raster_rect_t const clips[] = {{0}, {13, 7, 150, 133}, {0, 40, W, 1}};
+    for (size_t c = 0; c < sizeof(clips) / sizeof(clips[0]); ++c) {
+        target.clip = clips[c];
+        raster_clear(&target, 0);
+        for (int i = 0; i < BATCH_TRIANGLES; ++i) {
+            raster_triangle(&target, triangles[i], &paint);
+        }
+        memcpy(expected, pixels, sizeof(pixels));
+        memcpy(expected_depth, depth, sizeof(depth));
+
+        for (int workers = 0; workers <= 3; ++workers) {
+            threadpool_t *pool = workers ? threadpool_create(workers, 0) : NULL;
+            raster_clear(&target, 0);
+            for (int i = 0; i < BATCH_TRIANGLES; ++i) {
+                CHECK(raster_batch_triangle(batch, triangles[i], &paint));
+            }
+            raster_batch_draw(batch, &target, pool);
+            CHECK(!memcmp(pixels, expected, sizeof(pixels)));
+            CHECK(!memcmp(depth, expected_depth, sizeof(depth)));
+
+            // Drawing empties the batch
+            raster_batch_draw(batch, &target, pool);
+            CHECK(!memcmp(pixels, expected, sizeof(pixels)));
+            if (pool) {
+                threadpool_destroy(pool);
+            }
+        }
+    }
+    target.clip = (raster_rect_t){0};
+
+    raster_vertex_t v[3] = {vertex(0, 0), vertex(1, 0), vertex(0, 1)};
+    for (int i = 0; i < BATCH_TRIANGLES; ++i) {
+        raster_batch_triangle(batch, v, &paint);
+    }
+    CHECK(!raster_batch_triangle(batch, v, &paint));
+
+    raster_batch_destroy(batch);
+    free(triangles);
+}
+
+int main(void) {
+    srand(1);
+
+    test_rect_coverage(10, 10, 110, 60);
+    test_rect_coverage(10.5, 10.5, 20.5, 15.5);
+    test_rect_coverage(-7.25, 3.75, 33.3, 149.9);
+    test_shared_edges();
+    test_clip();
+    test_gouraud();
+    test_texture();
+    test_depth();
+    test_line();
+    test_batch();
+
+    if (error) {
+        printf("\033[31mSome tests failed\033[0m\n");
+        return 1;
+    }
+    printf("\033[32mAll tests passed\033[0m\n");
+    return 0;
+}
@@ -0,0 +1,36 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Just enough of ESP-IDF to build kernel sources on the host, for the
+// benchmarks. Logging is dropped, the arguments are still evaluated.
+
+#include <stdio.h>
+
+static inline void esp_log_discard(char const *tag, ...) {
+    (void)tag;
+}
+
+#define ESP_LOGE(tag, ...)      esp_log_discard(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...)      esp_log_discard(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...)      esp_log_discard(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...)      esp_log_discard(tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...)      esp_log_discard(tag, __VA_ARGS__)
+#define ESP_DRAM_LOGE(tag, ...) esp_log_discard(tag, __VA_ARGS__)
+#define ESP_DRAM_LOGW(tag, ...) esp_log_discard(tag, __VA_ARGS__)
+#define ESP_DRAM_LOGI(tag, ...) esp_log_discard(tag, __VA_ARGS__)
+#define esp_rom_printf(...)     esp_log_discard(NULL, __VA_ARGS__)
@@ -0,0 +1,66 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// The benchmarks run on a single thread, locks always succeed and waiting
+// returns at once
+
+#include "sdkconfig.h"
+#include "soc/soc_caps.h"
+
+#include <stdint.h>
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+typedef void        *SemaphoreHandle_t;
+typedef void        *QueueHandle_t;
+typedef void        *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef int portMUX_TYPE;
+
+#define pdTRUE        1
+#define pdFALSE       0
+#define portMAX_DELAY UINT32_MAX
+
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define taskENTER_CRITICAL(mux)      ((void)(mux))
+#define taskEXIT_CRITICAL(mux)       ((void)(mux))
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    static char mutex;
+    return &mutex;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t timeout) {
+    (void)semaphore;
+    (void)timeout;
+    return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    (void)semaphore;
+    return pdTRUE;
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    (void)semaphore;
+}
+
+static inline void vTaskDelay(TickType_t ticks) {
+    (void)ticks;
+}
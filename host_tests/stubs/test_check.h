@@ -0,0 +1,42 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// For the tests built into kernel sources with RUN_TEST. CHECK() reports what
+// failed and carries on, test_summary() is what main() returns.
+
+static bool error = false;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("\033[31m%s:%d: %s failed\033[0m\n", __FILE__, __LINE__, #cond);                                  \
+            error = true;                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+static inline int test_summary(void) {
+    if (error) {
+        printf("\033[31mSome tests failed\033[0m\n");
+        return 1;
+    }
+    printf("\033[32mAll tests passed\033[0m\n");
+    return 0;
+}
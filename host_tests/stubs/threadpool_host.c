@@ -0,0 +1,98 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// threadpool_parallel_for() for the host, on pthreads. Every call starts the
+// workers afresh, which is slow but enough to run the chunks at the same time.
+
+#include "threadpool/threadpool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define THREADPOOL_MAX_WORKERS 8
+
+struct threadpool {
+    int num_workers;
+};
+
+typedef struct {
+    threadpool_range_func_t func;
+    void                   *data;
+    int                     end;
+    int                     grain;
+    atomic_int              next;
+} parallel_for_t;
+
+threadpool_t *threadpool_create(int workers, uint16_t stack_size) {
+    (void)stack_size;
+    if (workers <= 0) {
+        workers = 2;
+    }
+    if (workers > THREADPOOL_MAX_WORKERS) {
+        workers = THREADPOOL_MAX_WORKERS;
+    }
+
+    threadpool_t *pool = malloc(sizeof(threadpool_t));
+    if (pool) {
+        pool->num_workers = workers;
+    }
+    return pool;
+}
+
+void threadpool_destroy(threadpool_t *pool) {
+    free(pool);
+}
+
+int threadpool_workers(threadpool_t *pool) {
+    return pool->num_workers;
+}
+
+static void *parallel_for_run(void *arg) {
+    parallel_for_t *range = arg;
+    while (true) {
+        int start = atomic_fetch_add(&range->next, range->grain);
+        if (start >= range->end) {
+            return NULL;
+        }
+        int end = start + range->grain < range->end ? start + range->grain : range->end;
+        range->func(range->data, start, end);
+    }
+}
+
+void threadpool_parallel_for(
+    threadpool_t *pool, int start, int end, int grain, threadpool_range_func_t func, void *data
+) {
+    parallel_for_t range = {
+        .func  = func,
+        .data  = data,
+        .end   = end,
+        .grain = grain > 0 ? grain : 1,
+    };
+    atomic_init(&range.next, start);
+
+    pthread_t threads[THREADPOOL_MAX_WORKERS];
+    int       started = 0;
+    while (started < pool->num_workers && !pthread_create(&threads[started], NULL, parallel_for_run, &range)) {
+        ++started;
+    }
+
+    parallel_for_run(&range);
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
@@ -0,0 +1,75 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The why_ functions pathfuncs.c uses, on top of the host's libc
+
+#define _GNU_SOURCE
+
+#include "why_io.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+void *why_malloc(size_t size) {
+    return malloc(size);
+}
+
+void why_free(void *ptr) {
+    free(ptr);
+}
+
+char *why_strdup(char const *s) {
+    return strdup(s);
+}
+
+int why_asprintf(char **restrict strp, char const *restrict fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = vasprintf(strp, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int why_stat(char const *restrict pathname, struct stat *restrict statbuf) {
+    return stat(pathname, statbuf);
+}
+
+int why_mkdir(char const *pathname, mode_t mode) {
+    return mkdir(pathname, mode);
+}
+
+int why_rmdir(char const *pathname) {
+    return rmdir(pathname);
+}
+
+int why_unlink(char const *pathname) {
+    return unlink(pathname);
+}
+
+DIR *why_opendir(char const *name) {
+    return opendir(name);
+}
+
+struct dirent *why_readdir(DIR *dirp) {
+    return readdir(dirp);
+}
+
+int why_closedir(DIR *dirp) {
+    return closedir(dirp);
+}
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# This file is part of BadgeVMS
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Compress an application ELF file for BadgeVMS, which decompresses it while
+# loading, see badgevms/compressed_file.h. The file is split in blocks that are
+# compressed with LZ4 on their own. Blocks that don't get smaller are stored as
+# they are, and so is the whole file if it doesn't get smaller.
+#
+#   misc/compress_elf.py app.elf app.elf
+
+import struct
+import sys
+
+# Keep in sync with badgevms/compressed_file.c
+MAGIC = 0x345A5642  # "BVZ4"
+BLOCK_SIZE = 16 * 1024
+
+MIN_MATCH = 4
+MAX_OFFSET = 65535
+# Matches start at least 12 bytes before the end, the last 5 bytes are literals
+MF_LIMIT = 12
+LAST_LITERALS = 5
+
+
+def lz4_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def lz4_sequence(out, literals, offset=0, length=0):
+    match = length - MIN_MATCH
+    out.append(min(len(literals), 15) << 4 | (min(match, 15) if offset else 0))
+    if len(literals) >= 15:
+        lz4_length(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += struct.pack("<H", offset)
+        if match >= 15:
+            lz4_length(out, match - 15)
+
+
+def lz4_compress(data):
+    out = bytearray()
+    table = {}
+    anchor = 0
+    pos = 0
+    match_end = len(data) - LAST_LITERALS
+
+    while pos < len(data) - MF_LIMIT:
+        key = data[pos : pos + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = pos
+        if candidate is None or pos - candidate > MAX_OFFSET:
+            pos += 1
+            continue
+
+        length = MIN_MATCH
+        while pos + length < match_end and data[candidate + length] == data[pos + length]:
+            length += 1
+
+        lz4_sequence(out, data[anchor:pos], pos - candidate, length)
+        pos += length
+        anchor = pos
+
+    lz4_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def compress(data):
+    blocks = []
+    for start in range(0, len(data), BLOCK_SIZE):
+        block = data[start : start + BLOCK_SIZE]
+        packed = lz4_compress(block)
+        blocks.append(packed if len(packed) < len(block) else block)
+
+    offset = 16 + 4 * (len(blocks) + 1)
+    offsets = [offset]
+    for block in blocks:
+        offset += len(block)
+        offsets.append(offset)
+
+    header = struct.pack("<4I", MAGIC, len(data), BLOCK_SIZE, len(blocks))
+    return header + struct.pack(f"<{len(offsets)}I", *offsets) + b"".join(blocks)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f"usage: {sys.argv[0]} input.elf output.elf")
+
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+
+    compressed = compress(data)
+    if len(compressed) >= len(data):
+        compressed = data
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(compressed)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+# This file is part of BadgeVMS
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Convert a PNG to a sprite an application can load without decoding it, see
+# badgevms/sprite.h: RGB565 pixels and, unless the image is opaque, an alpha
+# mask. Used by build_app()'s ASSETS.
+#
+#   misc/convert_sprite.py image.png image.spr
+#
+# With --icon the image is scaled to an application icon thumbnail the way
+# application_set_icon() does it, for build_app()'s ICON.
+#
+#   misc/convert_sprite.py --icon icon.png icon_thumbnail.spr
+
+import struct
+import sys
+import zlib
+
+# Keep in sync with badgevms/sprite.h
+MAGIC = 0x52505342  # "BSPR"
+FLAG_ALPHA = 1 << 0
+# Keep in sync with badgevms/application.h
+ICON_SIZE = 48
+
+PNG_SIGNATURE = b"\x89PNG\r\n\x1a\n"
+# Samples per pixel of each PNG color type
+CHANNELS = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def unfilter(data, width, height, bpp):
+    stride = width * bpp
+    rows = []
+    prev = bytearray(stride)
+    pos = 0
+    for _ in range(height):
+        kind = data[pos]
+        row = bytearray(data[pos + 1 : pos + 1 + stride])
+        pos += 1 + stride
+        for i in range(stride):
+            left = row[i - bpp] if i >= bpp else 0
+            up = prev[i]
+            upleft = prev[i - bpp] if i >= bpp else 0
+            if kind == 1:
+                row[i] = (row[i] + left) & 0xFF
+            elif kind == 2:
+                row[i] = (row[i] + up) & 0xFF
+            elif kind == 3:
+                row[i] = (row[i] + ((left + up) >> 1)) & 0xFF
+            elif kind == 4:
+                row[i] = (row[i] + paeth(left, up, upleft)) & 0xFF
+            elif kind != 0:
+                raise ValueError(f"Unknown filter {kind}")
+        rows.append(row)
+        prev = row
+    return rows
+
+
+# Returns width, height and a list of (r, g, b, a)
+def read_png(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if not data.startswith(PNG_SIGNATURE):
+        raise ValueError("Not a PNG")
+
+    pos = len(PNG_SIGNATURE)
+    idat = bytearray()
+    palette = []
+    trns = b""
+    while pos < len(data):
+        length, kind = struct.unpack(">I4s", data[pos : pos + 8])
+        chunk = data[pos + 8 : pos + 8 + length]
+        pos += 12 + length
+        if kind == b"IHDR":
+            width, height, depth, color, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+        elif kind == b"PLTE":
+            palette = [tuple(chunk[i : i + 3]) for i in range(0, length, 3)]
+        elif kind == b"tRNS":
+            trns = chunk
+        elif kind == b"IDAT":
+            idat += chunk
+        elif kind == b"IEND":
+            break
+
+    # Everything the assets use, and what stb_image turns most PNGs into
+    if depth not in (8, 16) or color not in CHANNELS or interlace:
+        raise ValueError(f"Only 8 and 16 bit non-interlaced PNGs, not depth {depth} color {color}")
+
+    channels = CHANNELS[color]
+    size = depth // 8
+    rows = unfilter(zlib.decompress(idat), width, height, channels * size)
+
+    pixels = []
+    for row in rows:
+        # Only the high byte of 16 bit samples
+        samples = row[::size]
+        for x in range(width):
+            s = samples[x * channels : (x + 1) * channels]
+            if color == 0:
+                pixels.append((s[0], s[0], s[0], 255))
+            elif color == 2:
+                pixels.append((s[0], s[1], s[2], 255))
+            elif color == 3:
+                r, g, b = palette[s[0]]
+                pixels.append((r, g, b, trns[s[0]] if s[0] < len(trns) else 255))
+            elif color == 4:
+                pixels.append((s[0], s[0], s[0], s[1]))
+            else:
+                pixels.append((s[0], s[1], s[2], s[3]))
+    return width, height, pixels
+
+
+# Fit into an ICON_SIZE square, centered and transparent around it. Every
+# pixel is the average of the ones it covers, weighted by their alpha.
+def icon_thumbnail(width, height, pixels):
+    longest = max(width, height)
+    dst_w = width * ICON_SIZE // longest or 1
+    dst_h = height * ICON_SIZE // longest or 1
+    off_x = (ICON_SIZE - dst_w) // 2
+    off_y = (ICON_SIZE - dst_h) // 2
+
+    thumbnail = [(0, 0, 0, 0)] * (ICON_SIZE * ICON_SIZE)
+    for y in range(dst_h):
+        y0 = y * height // dst_h
+        y1 = max((y + 1) * height // dst_h, y0 + 1)
+        for x in range(dst_w):
+            x0 = x * width // dst_w
+            x1 = max((x + 1) * width // dst_w, x0 + 1)
+
+            covered = [pixels[sy * width + sx] for sy in range(y0, y1) for sx in range(x0, x1)]
+            a = sum(p[3] for p in covered)
+            if a:
+                color = tuple(sum(p[c] * p[3] for p in covered) // a for c in range(3))
+            else:
+                color = (0, 0, 0)
+            thumbnail[(off_y + y) * ICON_SIZE + off_x + x] = color + (a // len(covered),)
+    return ICON_SIZE, ICON_SIZE, thumbnail
+
+
+def main():
+    args = sys.argv[1:]
+    icon = args[:1] == ["--icon"]
+    if icon:
+        args = args[1:]
+    if len(args) != 2:
+        print(f"Usage: {sys.argv[0]} [--icon] <image.png> <image.spr>")
+        sys.exit(1)
+
+    width, height, pixels = read_png(args[0])
+    if icon:
+        width, height, pixels = icon_thumbnail(width, height, pixels)
+    if width > 0xFFFF or height > 0xFFFF:
+        raise ValueError("Too large for a sprite")
+
+    # Thumbnails always have alpha, like those application_set_icon() makes
+    alpha = icon or any(p[3] != 255 for p in pixels)
+    rgb565 = bytearray()
+    for r, g, b, _ in pixels:
+        # Rounded rather than cut off
+        value = ((r * 31 + 127) // 255) << 11 | ((g * 63 + 127) // 255) << 5 | (b * 31 + 127) // 255
+        rgb565 += struct.pack("<H", value)
+
+    with open(args[1], "wb") as f:
+        f.write(struct.pack("<IHHH3H", MAGIC, width, height, FLAG_ALPHA if alpha else 0, 0, 0, 0))
+        f.write(rgb565)
+        if alpha:
+            f.write(bytes(p[3] for p in pixels))
+
+    print(f"{args[0]}: {width}x{height}{' with alpha' if alpha else ''}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# This file is part of BadgeVMS
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# Pack an application in a single file to install with
+# application_bundle_install(), see badgevms/include/badgevms/application.h.
+# The files are packed in LZ4 blocks like OTA deltas. Prints the SHA-256 to
+# publish next to the bundle.
+#
+#   misc/make_bundle.py manifest.json build/doom doom.bundle
+
+import hashlib
+import os
+import struct
+import sys
+
+from compress_elf import lz4_compress
+
+# Keep in sync with badgevms/application_bundle.c
+MAGIC = 0x31425642  # "BVB1"
+BLOCK_SIZE = 16 * 1024
+MANIFEST = "manifest.json"
+
+
+def bundle_name(relative):
+    """doom/doom1.wad as [doom]doom1.wad, like application_create_file()"""
+    parts = relative.split(os.sep)
+    if len(parts) == 1:
+        return parts[0]
+    return "[" + ".".join(parts[:-1]) + "]" + parts[-1]
+
+
+def entry(name, data):
+    encoded = name.encode()
+    out = bytearray(struct.pack("<2I", len(data), len(encoded)) + encoded)
+    for start in range(0, len(data), BLOCK_SIZE):
+        block = data[start : start + BLOCK_SIZE]
+        packed = lz4_compress(block)
+        if len(packed) >= len(block):
+            packed = block
+        out += struct.pack("<2I", len(packed), len(block)) + packed
+    return bytes(out)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(f"usage: {sys.argv[0]} manifest.json app_dir output.bundle")
+
+    with open(sys.argv[1], "rb") as f:
+        entries = [entry(MANIFEST, f.read())]
+
+    app_dir = sys.argv[2]
+    for root, dirs, files in os.walk(app_dir):
+        dirs.sort()
+        for file in sorted(files):
+            path = os.path.join(root, file)
+            with open(path, "rb") as f:
+                entries.append(entry(bundle_name(os.path.relpath(path, app_dir)), f.read()))
+
+    bundle = struct.pack("<3I", MAGIC, len(entries), BLOCK_SIZE) + b"".join(entries)
+    with open(sys.argv[3], "wb") as f:
+        f.write(bundle)
+    print(f"{len(entries)} files, {len(bundle)} bytes, SHA-256 {hashlib.sha256(bundle).hexdigest()}")
+
+
+if __name__ == "__main__":
+    main()
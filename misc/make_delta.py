@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+# This file is part of BadgeVMS
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Make a patch that turns one firmware image into another, for badges running
+# the old one to update with ota_write(), see badgevms/ota_delta.h.
+#
+# Like bsdiff, the new image is made of regions that are alike in the old one
+# and bytes of its own. Alike regions store the difference to the old bytes,
+# mostly zeros where code only moved, so the patch packs well. It is packed in
+# LZ4 blocks like compressed applications.
+#
+#   misc/make_delta.py old/badgevms.bin new/badgevms.bin badgevms.patch
+
+import hashlib
+import struct
+import sys
+
+from compress_elf import lz4_compress
+
+# Keep in sync with badgevms/ota_delta.c
+MAGIC = 0x31445642  # "BVD1"
+BLOCK_SIZE = 16 * 1024
+
+# Regions are found by the old positions of these many bytes, every STEP bytes
+KEY_SIZE = 16
+STEP = 4
+# Candidates tried for a key, the latest ones
+MAX_CANDIDATES = 8
+# A region shorter than this is stored as bytes of its own
+MIN_REGION = 32
+
+
+def index(old):
+    table = {}
+    for pos in range(0, len(old) - KEY_SIZE + 1, STEP):
+        candidates = table.setdefault(old[pos : pos + KEY_SIZE], [])
+        candidates.append(pos)
+        if len(candidates) > MAX_CANDIDATES:
+            del candidates[0]
+    return table
+
+
+def extend(old, new, old_pos, new_pos, back_limit):
+    """Grow the exact match at old_pos and new_pos both ways, past a few
+    differing bytes as long as at least half of them match like bsdiff does.
+    Returns where it starts in both and its length."""
+    back = 0
+    while back < back_limit and back < old_pos and old[old_pos - back - 1] == new[new_pos - back - 1]:
+        back += 1
+
+    score = best_score = 0
+    length = 0
+    i = 0
+    limit = min(len(old) - old_pos, len(new) - new_pos)
+    while i < limit:
+        score += 1 if old[old_pos + i] == new[new_pos + i] else -1
+        i += 1
+        if score > best_score:
+            best_score = score
+            length = i
+        elif score < best_score - 64:
+            break
+
+    return old_pos - back, new_pos - back, length + back
+
+
+def find(old, new, table, new_pos, expected, back_limit):
+    """The best alike region for the new bytes at new_pos, trying where the
+    last region would continue first"""
+    best = None
+    candidates = list(table.get(new[new_pos : new_pos + KEY_SIZE], ()))
+    if 0 <= expected < len(old):
+        candidates.insert(0, expected)
+    for old_pos in candidates:
+        if old[old_pos : old_pos + KEY_SIZE] != new[new_pos : new_pos + KEY_SIZE]:
+            continue
+        region = extend(old, new, old_pos, new_pos, back_limit)
+        if not best or region[2] > best[2]:
+            best = region
+    return best
+
+
+def regions(old, new):
+    """The alike regions in the order of the new image, as old start, new
+    start and length"""
+    table = index(old)
+    found = []
+    literal_start = 0
+    pos = 0
+
+    while pos <= len(new) - KEY_SIZE:
+        expected = -1
+        if found:
+            old_start, new_start, _ = found[-1]
+            expected = old_start + pos - new_start
+
+        region = find(old, new, table, pos, expected, pos - literal_start)
+        if not region or region[2] < MIN_REGION:
+            pos += 1
+            continue
+
+        found.append(region)
+        literal_start = pos = region[1] + region[2]
+
+    return found
+
+
+def encode(old, new, found):
+    """The command stream: bytes of its own before the first region, then for
+    each region its difference to the old bytes and the bytes of its own up to
+    the next one"""
+    out = bytearray()
+    # The decoder starts at 0 in the old image with nothing to add
+    steps = [(0, 0, 0)] + found
+    for i, (old_start, new_start, length) in enumerate(steps):
+        if i + 1 < len(steps):
+            next_old, literal_end, _ = steps[i + 1]
+        else:
+            next_old, literal_end = old_start + length, len(new)
+
+        out += struct.pack("<IIi", length, literal_end - new_start - length, next_old - old_start - length)
+        out += bytes((new[new_start + j] - old[old_start + j]) & 0xFF for j in range(length))
+        out += new[new_start + length : literal_end]
+    return bytes(out)
+
+
+def pack(old, new, stream):
+    header = struct.pack("<4I", MAGIC, len(old), len(new), BLOCK_SIZE) + hashlib.sha256(old).digest()
+    blocks = bytearray()
+    for start in range(0, len(stream), BLOCK_SIZE):
+        block = stream[start : start + BLOCK_SIZE]
+        packed = lz4_compress(block)
+        if len(packed) >= len(block):
+            packed = block
+        blocks += struct.pack("<2I", len(packed), len(block)) + packed
+    return header + bytes(blocks)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(f"usage: {sys.argv[0]} old.bin new.bin output.patch")
+
+    with open(sys.argv[1], "rb") as f:
+        old = f.read()
+    with open(sys.argv[2], "rb") as f:
+        new = f.read()
+
+    patch = pack(old, new, encode(old, new, regions(old, new)))
+    with open(sys.argv[3], "wb") as f:
+        f.write(patch)
+    print(f"{len(patch)} bytes, {100 * len(patch) // max(len(new), 1)}% of the new image")
+
+
+if __name__ == "__main__":
+    main()
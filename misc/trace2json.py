@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+# This file is part of BadgeVMS
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Convert a BadgeVMS kernel trace, as printed on the console by trace_dump(),
+# to the Chrome trace event format. Open the result in https://ui.perfetto.dev
+# or chrome://tracing.
+#
+#   misc/trace2json.py monitor.log > trace.json
+
+import json
+import sys
+
+# Keep in sync with trace_event_type_t in badgevms/trace.h
+(
+    SWITCH_IN,
+    SWITCH_OUT,
+    REMAP,
+    FRAME_BEGIN,
+    FRAME_QUEUE,
+    FRAME_END,
+    PPA_QUEUE,
+    PPA_DONE,
+    ZEUS_SEND,
+    HADES_SEND,
+    HERMES_SEND,
+    SBRK,
+    HADES_YIELD,
+    HEPHAESTUS_WRITE,
+) = range(14)
+
+PPA_OPERATIONS = {0: "srm", 1: "blend", 2: "fill"}
+TASK_TYPES = {0: "elf", 1: "elf_path", 2: "thread"}
+
+# Tracks within the single BadgeVMS "process" of the trace
+COMPOSITOR_TID = 100
+PPA_TID = 101
+
+
+def read_records(lines):
+    records = []
+    last = {}
+    wraps = {}
+
+    for line in lines:
+        fields = line.split()
+        if len(fields) != 7 or fields[0] != "TRACE":
+            continue
+        core = int(fields[1])
+        time = int(fields[2], 16)
+
+        # The device keeps 32 bits of microseconds
+        if core in last and time < last[core] and last[core] - time > 1 << 31:
+            wraps[core] = wraps.get(core, 0) + 1
+        last[core] = time
+        time += wraps.get(core, 0) << 32
+
+        records.append(
+            {
+                "core": core,
+                "time": time,
+                "type": int(fields[3]),
+                "pid": int(fields[4]),
+                "a": int(fields[5], 16),
+                "b": int(fields[6], 16),
+            }
+        )
+
+    records.sort(key=lambda r: r["time"])
+    return records
+
+
+def to_signed(value):
+    return value - (1 << 32) if value & (1 << 31) else value
+
+
+def convert(records):
+    events = []
+    running = {}
+    frame = None
+
+    def add(ph, name, time, tid, args=None):
+        event = {"ph": ph, "name": name, "ts": time, "pid": 0, "tid": tid}
+        if ph == "i":
+            event["s"] = "t"
+        if args:
+            event["args"] = args
+        events.append(event)
+
+    for r in records:
+        core, time, kind, pid, a, b = r["core"], r["time"], r["type"], r["pid"], r["a"], r["b"]
+
+        if kind == SWITCH_IN:
+            name = "pid %d" % pid if pid else "kernel %08x" % a
+            running[core] = name
+            add("B", name, time, core, {"handle": "%08x" % a})
+        elif kind == SWITCH_OUT:
+            # The ring may start in the middle of a slice
+            name = running.pop(core, None)
+            if name:
+                add("E", name, time, core, {"preempted": bool(b)})
+        elif kind == REMAP:
+            add("i", "remap", time, core, {"cycles": a, "pid": pid})
+        elif kind == FRAME_BEGIN:
+            frame = "frame %d" % a
+            add("B", frame, time, COMPOSITOR_TID)
+            add("B", "messages", time, COMPOSITOR_TID)
+        elif kind == FRAME_QUEUE and frame:
+            add("E", "messages", time, COMPOSITOR_TID, {"messages": a})
+            add("B", "compose", time, COMPOSITOR_TID)
+        elif kind == FRAME_END and frame:
+            add("E", "compose", time, COMPOSITOR_TID, {"composited": bool(a)})
+            add("E", frame, time, COMPOSITOR_TID)
+            frame = None
+        elif kind == PPA_QUEUE:
+            add("i", "ppa " + PPA_OPERATIONS.get(a, str(a)), time, PPA_TID, {"pixels": b})
+        elif kind == PPA_DONE:
+            add("i", "ppa done", time, PPA_TID)
+        elif kind == ZEUS_SEND:
+            add("i", "zeus " + TASK_TYPES.get(a, str(a)), time, core, {"pid": pid})
+        elif kind == HADES_SEND:
+            add("i", "hades", time, core, {"dead": a})
+        elif kind == HERMES_SEND:
+            add("i", "hermes", time, core, {"command": a, "pid": pid})
+        elif kind == SBRK:
+            add("i", "sbrk", time, core, {"increment": to_signed(a), "break": "%08x" % b, "pid": pid})
+        elif kind == HADES_YIELD:
+            add("i", "hades yield", time, core)
+        elif kind == HEPHAESTUS_WRITE:
+            add("i", "flash write", time, core, {"bytes": a})
+
+    names = {core: "core %d" % core for core in {r["core"] for r in records}}
+    names[COMPOSITOR_TID] = "compositor"
+    names[PPA_TID] = "ppa"
+    for tid, name in names.items():
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid, "args": {"name": name}})
+    events.append({"ph": "M", "name": "process_name", "pid": 0, "args": {"name": "BadgeVMS"}})
+
+    return events
+
+
+def main():
+    with open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin as f:
+        records = read_records(f)
+    json.dump({"traceEvents": convert(records), "displayTimeUnit": "ms"}, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,5 +1,3 @@
-#include "font.h"
-
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -7,11 +5,15 @@
 #include <badgevms/compositor.h>
 #include <badgevms/event.h>
 #include <badgevms/keyboard.h>
+#include <badgevms/text.h>
 #include <string.h>
 
 #define SCREEN_WIDTH  720
 #define SCREEN_HEIGHT 720
 
+#define FONT_WIDTH  TEXT_FONT_LARGE_WIDTH
+#define FONT_HEIGHT TEXT_FONT_LARGE_HEIGHT
+
 #define CDE_BG_COLOR      0x9CA0A0
 #define CDE_PANEL_COLOR   0xAEB2B2
 #define CDE_BORDER_LIGHT  0xFFFFFF
@@ -23,20 +25,90 @@
 #define CDE_TITLE_BG      0x808080
 #define CDE_INACTIVE_TEXT 0x808080
 
+// Layout
+#define LAUNCHER_X  30
+#define LAUNCHER_Y  30
+#define LAUNCHER_W  (SCREEN_WIDTH - 60)
+#define LAUNCHER_H  (SCREEN_HEIGHT - 60)
+#define TITLE_H     45
+#define LIST_X      (LAUNCHER_X + 15)
+#define LIST_Y      (LAUNCHER_Y + TITLE_H + 55)
+#define LIST_W      (LAUNCHER_W - 30)
+#define LIST_H      (LAUNCHER_H - TITLE_H - 110)
+#define ITEM_HEIGHT 85
+#define DIALOG_W    400
+#define DIALOG_H    350
+#define DIALOG_X    ((SCREEN_WIDTH - DIALOG_W) / 2)
+#define DIALOG_Y    ((SCREEN_HEIGHT - DIALOG_H) / 2)
+
+// What changed since the last frame, when these run out it becomes one rect
+#define MAX_DAMAGE 8
+
+// Installed but left out of the list, see launchable(). The first page asks
+// for this many more so that it is still full.
+#define HIDDEN_APPLICATIONS 2
+
 static int quit = 0;
 
 typedef struct {
-    window_handle_t window;
-    framebuffer_t  *framebuffer;
-    uint16_t       *pixels;
-    application_t **applications;
-    int             scroll_offset;
-    int             selected_item;
-    int             total_items;
-    int             items_per_page;
-    int             show_about;
+    window_rect_t rects[MAX_DAMAGE];
+    int           num;
+} damage_t;
+
+typedef struct {
+    window_handle_t         window;
+    framebuffer_t          *framebuffer;
+    framebuffer_t           background; // Everything that never changes, drawn once
+    framebuffer_t          *target;     // What draw_*() draw into
+    application_list_handle list;
+    application_t         **applications;
+    bool                    loading; // Only the first page is in applications
+    int                     scroll_offset;
+    int                     selected_item;
+    int                     total_items;
+    int                     items_per_page;
+    int                     show_about;
+    damage_t                last_damage; // Of the frame before, still missing from the buffer we draw into
 } Launcher_Context;
 
+static window_rect_t rect_union(window_rect_t a, window_rect_t b) {
+    int x1 = a.x < b.x ? a.x : b.x;
+    int y1 = a.y < b.y ? a.y : b.y;
+    int x2 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+    int y2 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+    return (window_rect_t){x1, y1, x2 - x1, y2 - y1};
+}
+
+static bool rects_intersect(window_rect_t a, window_rect_t b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static void damage_add(damage_t *damage, window_rect_t rect) {
+    if (rect.w <= 0 || rect.h <= 0) {
+        return;
+    }
+
+    if (damage->num == MAX_DAMAGE) {
+        for (int i = 1; i < damage->num; i++) {
+            damage->rects[0] = rect_union(damage->rects[0], damage->rects[i]);
+        }
+        damage->rects[0] = rect_union(damage->rects[0], rect);
+        damage->num      = 1;
+        return;
+    }
+
+    damage->rects[damage->num++] = rect;
+}
+
+static bool damage_intersects(damage_t const *damage, window_rect_t rect) {
+    for (int i = 0; i < damage->num; i++) {
+        if (rects_intersect(damage->rects[i], rect)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 static inline uint16_t rgb888_to_rgb565_color(uint32_t rgb888) {
     uint8_t r = (rgb888 >> 16) & 0xFF;
     uint8_t g = (rgb888 >> 8) & 0xFF;
@@ -59,7 +131,7 @@ static void draw_rect(Launcher_Context *ctx, int x, int y, int w, int h, uint32_
         y2 = SCREEN_HEIGHT;
 
     for (int py = y; py < y2; py++) {
-        uint16_t *row   = &ctx->pixels[py * SCREEN_WIDTH + x];
+        uint16_t *row   = &ctx->target->pixels[py * SCREEN_WIDTH + x];
         int       width = x2 - x;
         for (int i = 0; i < width; i++) {
             row[i] = rgb565;
@@ -67,39 +139,8 @@ static void draw_rect(Launcher_Context *ctx, int x, int y, int w, int h, uint32_
     }
 }
 
-static void draw_char(Launcher_Context *ctx, int x, int y, char c, uint32_t color) {
-    if (c < FONT_FIRST_CHAR || c > FONT_LAST_CHAR)
-        return;
-
-    int             char_index = c - FONT_FIRST_CHAR;
-    uint16_t const *char_data  = pixel_font[char_index];
-    uint16_t        rgb565     = rgb888_to_rgb565_color(color);
-
-    for (int row = 0; row < FONT_HEIGHT; row++) {
-        uint16_t row_data = char_data[row];
-        int      py       = y + row;
-
-        if (py < 0 || py >= SCREEN_HEIGHT)
-            continue;
-
-        for (int col = 0; col < FONT_WIDTH; col++) {
-            if (row_data & (0x800 >> col)) {
-                int px = x + col;
-                if (px >= 0 && px < SCREEN_WIDTH) {
-                    ctx->pixels[py * SCREEN_WIDTH + px] = rgb565;
-                }
-            }
-        }
-    }
-}
-
 static void draw_text(Launcher_Context *ctx, int x, int y, char const *text, uint32_t color) {
-    int current_x = x;
-    while (*text) {
-        draw_char(ctx, current_x, y, *text, color);
-        current_x += FONT_WIDTH;
-        text++;
-    }
+    text_draw(ctx->target, TEXT_FONT_LARGE, x, y, text, rgb888_to_rgb565_color(color), false);
 }
 
 static void draw_text_bold(Launcher_Context *ctx, int x, int y, char const *text, uint32_t color) {
@@ -108,7 +149,7 @@ static void draw_text_bold(Launcher_Context *ctx, int x, int y, char const *text
 }
 
 static int get_text_width(char const *text) {
-    return strlen(text) * FONT_WIDTH;
+    return text_width(TEXT_FONT_LARGE, text);
 }
 
 static void draw_text_centered(Launcher_Context *ctx, int x, int y, int width, char const *text, uint32_t color) {
@@ -139,11 +180,16 @@ static void draw_button(Launcher_Context *ctx, int x, int y, int w, int h, char
     draw_text_centered(ctx, x, text_y, w, text, CDE_TEXT_COLOR);
 }
 
+// Including its shadow
+static window_rect_t dialog_rect(void) {
+    return (window_rect_t){DIALOG_X, DIALOG_Y, DIALOG_W + 5, DIALOG_H + 5};
+}
+
 static void draw_about_dialog(Launcher_Context *ctx) {
-    int dialog_w = 400;
-    int dialog_h = 350;
-    int dialog_x = (SCREEN_WIDTH - dialog_w) / 2;
-    int dialog_y = (SCREEN_HEIGHT - dialog_h) / 2;
+    int dialog_w = DIALOG_W;
+    int dialog_h = DIALOG_H;
+    int dialog_x = DIALOG_X;
+    int dialog_y = DIALOG_Y;
 
     // Draw shadow
     draw_rect(ctx, dialog_x + 5, dialog_y + 5, dialog_w, dialog_h, 0x505050);
@@ -180,11 +226,13 @@ static void draw_about_dialog(Launcher_Context *ctx) {
     draw_text_centered(ctx, dialog_x, btn_y - 25, dialog_w, "Press ENTER or ESC to close", CDE_INACTIVE_TEXT);
 }
 
-static void draw_launcher_window(Launcher_Context *ctx) {
-    int window_x = 30;
-    int window_y = 30;
-    int window_w = SCREEN_WIDTH - 60;
-    int window_h = SCREEN_HEIGHT - 60;
+// The part of the window that doesn't depend on the selection or scrolling,
+// drawn once into ctx->background
+static void draw_background(Launcher_Context *ctx) {
+    int window_x = LAUNCHER_X;
+    int window_y = LAUNCHER_Y;
+    int window_w = LAUNCHER_W;
+    int window_h = LAUNCHER_H;
 
     // Draw desktop background
     draw_rect(ctx, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, CDE_BG_COLOR);
@@ -194,134 +242,188 @@ static void draw_launcher_window(Launcher_Context *ctx) {
     draw_3d_border(ctx, window_x, window_y, window_w, window_h, 0);
 
     // Title bar
-    int title_h = 45;
+    int title_h = TITLE_H;
     draw_rect(ctx, window_x + 3, window_y + 3, window_w - 6, title_h, CDE_TITLE_BG);
     draw_text_bold(ctx, window_x + 15, window_y + 11, "WHY Application Launcher", CDE_SELECTED_TEXT);
 
     // Application count
     char count_text[64];
-    if (ctx->total_items == 1) {
+    if (ctx->loading) {
+        snprintf(count_text, sizeof(count_text), "Loading applications...");
+    } else if (ctx->total_items == 1) {
         snprintf(count_text, sizeof(count_text), "1 Application Available");
     } else {
         snprintf(count_text, sizeof(count_text), "%d Applications Available", ctx->total_items);
     }
     draw_text(ctx, window_x + 15, window_y + title_h + 20, count_text, CDE_TEXT_COLOR);
 
-    // Application list area
-    int list_y      = window_y + title_h + 55;
-    int list_h      = window_h - title_h - 110;
-    int item_height = 85;
-
     // List background
-    draw_rect(ctx, window_x + 15, list_y, window_w - 30, list_h, 0xFFFFFF);
-    draw_3d_border(ctx, window_x + 15, list_y, window_w - 30, list_h, 1);
-
-    // Calculate visible items
-    ctx->items_per_page = (list_h - 6) / item_height;
-    int visible_start   = ctx->scroll_offset;
-    int visible_end     = visible_start + ctx->items_per_page;
-    if (visible_end > ctx->total_items)
-        visible_end = ctx->total_items;
-
-    // Draw application items
-    for (int i = visible_start; i < visible_end; i++) {
-        int item_y = list_y + 3 + (i - visible_start) * item_height;
-        int item_x = window_x + 18;
-        int item_w = window_w - 36;
-
-        // Selection highlight
-        if (i == ctx->selected_item) {
-            draw_rect(ctx, item_x, item_y, item_w, item_height - 2, CDE_SELECTED_BG);
-        }
+    draw_rect(ctx, LIST_X, LIST_Y, LIST_W, LIST_H, 0xFFFFFF);
+    draw_3d_border(ctx, LIST_X, LIST_Y, LIST_W, LIST_H, 1);
+
+    // Status bar / instructions
+    draw_rect(ctx, window_x + 3, window_y + window_h - 42, window_w - 6, 39, CDE_BUTTON_COLOR);
+    draw_3d_border(ctx, window_x + 3, window_y + window_h - 42, window_w - 6, 39, 1);
+
+    draw_text(
+        ctx,
+        window_x + 15,
+        window_y + window_h - 35,
+        "UP/DOWN: Navigate  ENTER: Launch  A: About  ESC: Exit",
+        CDE_TEXT_COLOR
+    );
+}
 
-        uint32_t text_color = (i == ctx->selected_item) ? CDE_SELECTED_TEXT : CDE_TEXT_COLOR;
+static int visible_end(Launcher_Context *ctx) {
+    int end = ctx->scroll_offset + ctx->items_per_page;
+    return end > ctx->total_items ? ctx->total_items : end;
+}
 
-        // Draw app icon placeholder (a simple box)
-        int icon_size = 48;
-        int icon_x    = item_x + 10;
-        int icon_y    = item_y + (item_height - icon_size) / 2;
+// Of a visible item, with its separator line
+static window_rect_t item_rect(Launcher_Context *ctx, int i) {
+    int item_y = LIST_Y + 3 + (i - ctx->scroll_offset) * ITEM_HEIGHT;
+    return (window_rect_t){LAUNCHER_X + 18, item_y, LAUNCHER_W - 36, ITEM_HEIGHT - 1};
+}
 
-        uint32_t icon_color = (i == ctx->selected_item) ? CDE_SELECTED_TEXT : CDE_BUTTON_COLOR;
-        draw_rect(ctx, icon_x, icon_y, icon_size, icon_size, icon_color);
-        draw_3d_border(ctx, icon_x, icon_y, icon_size, icon_size, 1);
+// All items and the scrollbar
+static window_rect_t list_rect(void) {
+    return (window_rect_t){LIST_X + 3, LIST_Y + 3, LIST_W - 6, LIST_H - 6};
+}
 
-        // App name and details
-        int text_x = icon_x + icon_size + 15;
-        draw_text_bold(ctx, text_x, item_y + 10, ctx->applications[i]->name, text_color);
+static window_rect_t count_rect(void) {
+    return (window_rect_t){LAUNCHER_X + 15, LAUNCHER_Y + TITLE_H + 20, LAUNCHER_W - 30, FONT_HEIGHT};
+}
 
-        // Version
-        if (ctx->applications[i]->version) {
-            char version_text[64];
-            snprintf(version_text, sizeof(version_text), "v%s", ctx->applications[i]->version);
-            draw_text(ctx, text_x, item_y + 35, version_text, text_color);
-        }
+static window_rect_t scrollbar_rect(void) {
+    return (window_rect_t){LAUNCHER_X + LAUNCHER_W - 35, LIST_Y + 3, 20, LIST_H - 6};
+}
+
+static void draw_item(Launcher_Context *ctx, int i) {
+    window_rect_t rect        = item_rect(ctx, i);
+    int           item_y      = rect.y;
+    int           item_x      = rect.x;
+    int           item_w      = rect.w;
+    int           item_height = ITEM_HEIGHT;
+
+    // Selection highlight
+    if (i == ctx->selected_item) {
+        draw_rect(ctx, item_x, item_y, item_w, item_height - 2, CDE_SELECTED_BG);
+    }
+
+    uint32_t text_color = (i == ctx->selected_item) ? CDE_SELECTED_TEXT : CDE_TEXT_COLOR;
+
+    // Draw app icon placeholder (a simple box)
+    int icon_size = 48;
+    int icon_x    = item_x + 10;
+    int icon_y    = item_y + (item_height - icon_size) / 2;
+
+    uint32_t icon_color = (i == ctx->selected_item) ? CDE_SELECTED_TEXT : CDE_BUTTON_COLOR;
+    draw_rect(ctx, icon_x, icon_y, icon_size, icon_size, icon_color);
+    draw_3d_border(ctx, icon_x, icon_y, icon_size, icon_size, 1);
+
+    // App name and details
+    int text_x = icon_x + icon_size + 15;
+    draw_text_bold(ctx, text_x, item_y + 10, ctx->applications[i]->name, text_color);
+
+    // Version
+    if (ctx->applications[i]->version) {
+        char version_text[64];
+        snprintf(version_text, sizeof(version_text), "v%s", ctx->applications[i]->version);
+        draw_text(ctx, text_x, item_y + 35, version_text, text_color);
+    }
 
 #if 0
-        // Description (truncated if needed)
-        if (ctx->applications[i].description) {
-            char desc[60] = {0};
-            int max_desc_chars = ((item_w - text_x + item_x - 16) / FONT_WIDTH);
-            if (max_desc_chars > 59) max_desc_chars = 59;
-            
-            strncpy(desc, ctx->applications[i].description, max_desc_chars);
-            desc[max_desc_chars] = '\0';
-            
-            if (strlen(ctx->applications[i].description) > max_desc_chars) {
-                desc[max_desc_chars - 3] = '.';
-                desc[max_desc_chars - 2] = '.';
-                desc[max_desc_chars - 1] = '.';
-            }
-            draw_text(ctx, text_x, item_y + 58, desc, text_color);
+    // Description (truncated if needed)
+    if (ctx->applications[i].description) {
+        char desc[60] = {0};
+        int max_desc_chars = ((item_w - text_x + item_x - 16) / FONT_WIDTH);
+        if (max_desc_chars > 59) max_desc_chars = 59;
+        
+        strncpy(desc, ctx->applications[i].description, max_desc_chars);
+        desc[max_desc_chars] = '\0';
+        
+        if (strlen(ctx->applications[i].description) > max_desc_chars) {
+            desc[max_desc_chars - 3] = '.';
+            desc[max_desc_chars - 2] = '.';
+            desc[max_desc_chars - 1] = '.';
         }
+        draw_text(ctx, text_x, item_y + 58, desc, text_color);
+    }
 #endif
 
-        // Separator line
-        if (i < visible_end - 1) {
-            draw_rect(ctx, item_x, item_y + item_height - 2, item_w, 1, CDE_BORDER_DARK);
-        }
+    // Separator line
+    if (i < visible_end(ctx) - 1) {
+        draw_rect(ctx, item_x, item_y + item_height - 2, item_w, 1, CDE_BORDER_DARK);
     }
+}
+
+static void draw_scrollbar(Launcher_Context *ctx) {
+    window_rect_t rect        = scrollbar_rect();
+    int           scrollbar_x = rect.x;
+    int           scrollbar_y = rect.y;
+    int           scrollbar_h = rect.h;
+
+    // Scrollbar track
+    draw_rect(ctx, scrollbar_x, scrollbar_y, 20, scrollbar_h, CDE_BUTTON_COLOR);
+    draw_3d_border(ctx, scrollbar_x, scrollbar_y, 20, scrollbar_h, 1);
 
-    // Scrollbar (if needed)
+    // Scrollbar thumb
+    int thumb_h = (scrollbar_h * ctx->items_per_page) / ctx->total_items;
+    if (thumb_h < 30)
+        thumb_h = 30;
+
+    int thumb_y = scrollbar_y;
     if (ctx->total_items > ctx->items_per_page) {
-        int scrollbar_x = window_x + window_w - 35;
-        int scrollbar_y = list_y + 3;
-        int scrollbar_h = list_h - 6;
-
-        // Scrollbar track
-        draw_rect(ctx, scrollbar_x, scrollbar_y, 20, scrollbar_h, CDE_BUTTON_COLOR);
-        draw_3d_border(ctx, scrollbar_x, scrollbar_y, 20, scrollbar_h, 1);
-
-        // Scrollbar thumb
-        int thumb_h = (scrollbar_h * ctx->items_per_page) / ctx->total_items;
-        if (thumb_h < 30)
-            thumb_h = 30;
-
-        int thumb_y = scrollbar_y;
-        if (ctx->total_items > ctx->items_per_page) {
-            thumb_y += ((scrollbar_h - thumb_h) * ctx->scroll_offset) / (ctx->total_items - ctx->items_per_page);
+        thumb_y += ((scrollbar_h - thumb_h) * ctx->scroll_offset) / (ctx->total_items - ctx->items_per_page);
+    }
+
+    draw_rect(ctx, scrollbar_x + 3, thumb_y, 14, thumb_h, CDE_PANEL_COLOR);
+    draw_3d_border(ctx, scrollbar_x + 3, thumb_y, 14, thumb_h, 0);
+}
+
+// Bring the window's framebuffer up to date where damage says. The background
+// is copied back, then every widget that overlaps the damage is drawn whole.
+// Outside the damage the framebuffer is already right, so that only writes
+// what was there. A widget drawn becomes damage, for the ones on top of it.
+static void redraw(Launcher_Context *ctx, damage_t *damage) {
+    for (int i = 0; i < damage->num; i++) {
+        window_rect_t r = damage->rects[i];
+        for (int y = r.y; y < r.y + r.h; y++) {
+            memcpy(
+                &ctx->framebuffer->pixels[y * SCREEN_WIDTH + r.x],
+                &ctx->background.pixels[y * SCREEN_WIDTH + r.x],
+                r.w * sizeof(uint16_t)
+            );
         }
+    }
 
-        draw_rect(ctx, scrollbar_x + 3, thumb_y, 14, thumb_h, CDE_PANEL_COLOR);
-        draw_3d_border(ctx, scrollbar_x + 3, thumb_y, 14, thumb_h, 0);
+    ctx->target = ctx->framebuffer;
+
+    for (int i = ctx->scroll_offset; i < visible_end(ctx); i++) {
+        if (damage_intersects(damage, item_rect(ctx, i))) {
+            draw_item(ctx, i);
+            damage_add(damage, item_rect(ctx, i));
+        }
     }
 
-    // Status bar / instructions
-    draw_rect(ctx, window_x + 3, window_y + window_h - 42, window_w - 6, 39, CDE_BUTTON_COLOR);
-    draw_3d_border(ctx, window_x + 3, window_y + window_h - 42, window_w - 6, 39, 1);
+    if (ctx->total_items > ctx->items_per_page && damage_intersects(damage, scrollbar_rect())) {
+        draw_scrollbar(ctx);
+        damage_add(damage, scrollbar_rect());
+    }
 
-    draw_text(
-        ctx,
-        window_x + 15,
-        window_y + window_h - 35,
-        "UP/DOWN: Navigate  ENTER: Launch  A: About  ESC: Exit",
-        CDE_TEXT_COLOR
-    );
+    if (ctx->show_about && damage_intersects(damage, dialog_rect())) {
+        draw_about_dialog(ctx);
+    }
 }
 
-static void handle_keyboard(Launcher_Context *ctx, keyboard_scancode_t key_code) {
+static void handle_keyboard(Launcher_Context *ctx, keyboard_scancode_t key_code, damage_t *changed) {
+    int selected_item = ctx->selected_item;
+    int scroll_offset = ctx->scroll_offset;
+
     if (ctx->show_about) {
         if (key_code == KEY_SCANCODE_ESCAPE || key_code == KEY_SCANCODE_RETURN || key_code == KEY_SCANCODE_SPACE) {
             ctx->show_about = 0;
+            damage_add(changed, dialog_rect());
         }
         return;
     }
@@ -351,23 +453,90 @@ static void handle_keyboard(Launcher_Context *ctx, keyboard_scancode_t key_code)
             application_launch(ctx->applications[ctx->selected_item]->unique_identifier);
             break;
 
-        case KEY_SCANCODE_A: ctx->show_about = 1; break;
+        case KEY_SCANCODE_A:
+            ctx->show_about = 1;
+            damage_add(changed, dialog_rect());
+            break;
 
         case KEY_SCANCODE_ESCAPE: {
             quit = 1;
         } break;
     }
+
+    if (ctx->scroll_offset != scroll_offset) {
+        damage_add(changed, list_rect());
+    } else if (ctx->selected_item != selected_item) {
+        damage_add(changed, item_rect(ctx, selected_item));
+        damage_add(changed, item_rect(ctx, ctx->selected_item));
+    }
+}
+
+static bool launchable(application_t const *app) {
+    return app->binary_path && strlen(app->binary_path) && app->unique_identifier &&
+           (strcmp(app->unique_identifier, "badgevms_launcher") != 0) &&
+           (strcmp(app->unique_identifier, "why2025_firmware_ota_c6") != 0);
 }
 
-static bool run_launcher(application_t **applications, size_t num) {
-    printf("Starting application launcher with %zu applications\n", num);
+// Show the launchable applications of list, which starts at app, instead of
+// the ones before. expected is roughly how many there are.
+static bool load_applications(Launcher_Context *ctx, application_list_handle list, application_t *app, size_t expected) {
+    size_t          capacity = expected ? expected : 16;
+    size_t          num      = 0;
+    application_t **apps     = malloc(sizeof(application_t *) * capacity);
 
+    for (; apps && app; app = application_list_get_next(list)) {
+        if (!launchable(app)) {
+            continue;
+        }
+        if (num == capacity) {
+            capacity            *= 2;
+            application_t **more = realloc(apps, sizeof(application_t *) * capacity);
+            if (!more) {
+                free(apps);
+                apps = NULL;
+                break;
+            }
+            apps = more;
+        }
+        apps[num++] = app;
+    }
+
+    if (!apps) {
+        application_list_close(list);
+        return false;
+    }
+
+    free(ctx->applications);
+    application_list_close(ctx->list);
+    ctx->list         = list;
+    ctx->applications = apps;
+    ctx->total_items  = num;
+    return true;
+}
+
+// The first page is on screen, now get all of them
+static void finish_loading(Launcher_Context *ctx, size_t installed, damage_t *changed) {
+    application_t          *app;
+    application_list_handle list = application_list(&app);
+
+    if (list) {
+        load_applications(ctx, list, app, installed);
+    }
+    printf("Starting application launcher with %d applications\n", ctx->total_items);
+
+    ctx->loading = false;
+    ctx->target  = &ctx->background;
+    draw_background(ctx);
+    damage_add(changed, count_rect());
+    damage_add(changed, list_rect());
+}
+
+static bool run_launcher(void) {
     Launcher_Context ctx = {0};
-    ctx.applications     = applications;
-    ctx.total_items      = num;
     ctx.selected_item    = 0;
     ctx.scroll_offset    = 0;
     ctx.show_about       = 0;
+    ctx.items_per_page   = (LIST_H - 6) / ITEM_HEIGHT;
 
     ctx.window = window_create(
         "Application Launcher",
@@ -391,53 +560,75 @@ static bool run_launcher(application_t **applications, size_t num) {
         return false;
     }
 
-    ctx.pixels = ctx.framebuffer->pixels;
+    ctx.background        = *ctx.framebuffer;
+    ctx.background.pixels = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint16_t));
+    if (ctx.background.pixels == NULL) {
+        printf("Background could not be allocated\n");
+        return false;
+    }
+
+    // Only as much as fits on the first screen, straight from the application
+    // index. The rest is loaded once that is up.
+    size_t                  installed = 0;
+    application_t          *app;
+    application_list_handle first_page =
+        application_list_range(0, ctx.items_per_page + HIDDEN_APPLICATIONS, &app, &installed);
+    if (first_page) {
+        load_applications(&ctx, first_page, app, ctx.items_per_page + HIDDEN_APPLICATIONS);
+    }
+    ctx.loading = true;
+
+    ctx.target = &ctx.background;
+    draw_background(&ctx);
+
     event_t e;
     quit = false;
 
-    while (!quit) {
-        memset(ctx.pixels, 0, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint16_t));
+    // Nothing is on screen yet
+    damage_t changed = {0};
+    damage_add(&changed, (window_rect_t){0, 0, SCREEN_WIDTH, SCREEN_HEIGHT});
+    ctx.last_damage = changed;
 
-        draw_launcher_window(&ctx);
+    while (!quit) {
+        // Only present when something changed. The window is double buffered,
+        // what we draw into holds the frame before last, so what changed in
+        // the last frame is drawn again as well.
+        if (changed.num) {
+            damage_t damage = changed;
+            for (int i = 0; i < ctx.last_damage.num; i++) {
+                damage_add(&damage, ctx.last_damage.rects[i]);
+            }
+            redraw(&ctx, &damage);
 
-        if (ctx.show_about) {
-            draw_about_dialog(&ctx);
+            window_present(ctx.window, true, changed.rects, changed.num);
+            ctx.last_damage = changed;
+            changed.num     = 0;
         }
 
-        window_present(ctx.window, true, NULL, 0);
+        if (ctx.loading) {
+            finish_loading(&ctx, installed, &changed);
+            continue;
+        }
 
         e = window_event_poll(ctx.window, true, 0);
         if (e.type == EVENT_QUIT) {
             quit = 1;
         } else if (e.type == EVENT_KEY_DOWN) {
-            handle_keyboard(&ctx, e.keyboard.scancode);
+            handle_keyboard(&ctx, e.keyboard.scancode, &changed);
+        }
+
+        // Stay around so that coming back to the launcher is instant
+        if (quit && application_park()) {
+            quit = 0;
         }
     }
 
+    free(ctx.background.pixels);
+    free(ctx.applications);
+    application_list_close(ctx.list);
     return true;
 }
 
 int main(int argc, char *argv[]) {
-    size_t                  num_apps = 0;
-    application_t          *app;
-    application_list_handle app_list = application_list(&app);
-    application_t         **apps     = NULL;
-
-    printf("Currently installed applications: \n");
-    while (app) {
-        printf("Name: %s\n", app->name);
-        printf("  UID: %s\n", app->unique_identifier);
-        printf("  Version: %s\n", app->version);
-        printf("  Binary : %s\n", app->binary_path);
-        if (app->binary_path && strlen(app->binary_path) && app->unique_identifier &&
-            (strcmp(app->unique_identifier, "badgevms_launcher") != 0) &&
-            (strcmp(app->unique_identifier, "why2025_firmware_ota_c6") != 0)) {
-            ++num_apps;
-            apps               = realloc(apps, sizeof(application_t *) * num_apps);
-            apps[num_apps - 1] = app;
-        }
-        app = application_list_get_next(app_list);
-    }
-
-    run_launcher(apps, num_apps);
+    run_launcher();
 }
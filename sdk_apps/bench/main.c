@@ -0,0 +1,608 @@
+#include "badgevms/application.h"
+#include "badgevms/compositor.h"
+#include "badgevms/ota.h"
+#include "badgevms/process.h"
+#include "badgevms/wifi.h"
+#include "curl/curl.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_RESULTS 128
+
+#define SWITCH_ROUNDS   10000
+#define SLEEP_ROUNDS    10000
+#define MALLOC_ROUNDS   100000
+#define MALLOC_SLOTS    256
+#define LARGE_ROUNDS    100
+#define LARGE_SIZE      (1024 * 1024)
+#define WINDOW_ROUNDS   50
+#define PRESENT_FRAMES  60
+#define PPA_ROUNDS      100
+#define MEMORY_SIZE     (1024 * 1024)
+#define FILE_SIZE       (1024 * 1024)
+#define FILE_CHUNK      4096
+#define HTTP_ROUNDS     10
+#define LAUNCH_ROUNDS   5
+#define LAUNCH_POLL_MS  10
+#define CHILD_STACK     16384
+#define DEFAULT_OUTPUT  "SD0:bench.json"
+#define DEFAULT_URL     "http://example.com/"
+
+typedef struct {
+    char   test[24];
+    char   metric[32];
+    double value;
+    char   unit[8];
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static int      num_results;
+
+static char const *self_path;
+static char const *url = DEFAULT_URL;
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void result(char const *test, char const *metric, double value, char const *unit) {
+    printf("%-12s %-32s %12.2f %s\n", test, metric, value, unit);
+    if (num_results == MAX_RESULTS) {
+        return;
+    }
+
+    result_t *r = &results[num_results++];
+    snprintf(r->test, sizeof(r->test), "%s", test);
+    snprintf(r->metric, sizeof(r->metric), "%s", metric);
+    snprintf(r->unit, sizeof(r->unit), "%s", unit);
+    r->value = value;
+}
+
+// Start this program again with a subcommand, for the tests that need a
+// second process
+static pid_t spawn_self(char *subcommand) {
+    char *argv[] = {(char *)self_path, subcommand};
+    return process_create(self_path, CHILD_STACK, 2, argv);
+}
+
+static void reap(pid_t pid) {
+    process_kill(pid);
+    while (wait(true, 0) != pid) {
+    }
+}
+
+static pid_t ping_pid;
+static pid_t pong_pid;
+
+static void pong(void *arg) {
+    (void)arg;
+    for (int i = 0; i < SWITCH_ROUNDS; ++i) {
+        thread_notify_wait(UINT32_MAX);
+        thread_notify(ping_pid);
+    }
+}
+
+// Two threads of this process waking each other, and the same sleep loop with
+// and without another process doing it too, which makes every wakeup switch
+// address spaces
+static void bench_context_switch() {
+    ping_pid = getpid();
+    pong_pid = thread_create(pong, NULL, 4096);
+    if (pong_pid == -1) {
+        printf("Unable to create a thread\n");
+        return;
+    }
+
+    int64_t start = now_us();
+    for (int i = 0; i < SWITCH_ROUNDS; ++i) {
+        thread_notify(pong_pid);
+        thread_notify_wait(UINT32_MAX);
+    }
+    int64_t took = now_us() - start;
+    while (wait(true, 0) != pong_pid) {
+    }
+    result("ctx_switch", "thread_switch_us", (double)took / (2 * SWITCH_ROUNDS), "us");
+
+    start = now_us();
+    for (int i = 0; i < SLEEP_ROUNDS; ++i) {
+        usleep(1);
+    }
+    result("ctx_switch", "sleep_alone_us", (double)(now_us() - start) / SLEEP_ROUNDS, "us");
+
+    pid_t child = spawn_self("spin");
+    if (child == -1) {
+        printf("Unable to start %s\n", self_path);
+        return;
+    }
+
+    process_stats_t before, after;
+    process_stats_get(getpid(), &before);
+    start = now_us();
+    for (int i = 0; i < SLEEP_ROUNDS; ++i) {
+        usleep(1);
+    }
+    took = now_us() - start;
+    process_stats_get(getpid(), &after);
+    reap(child);
+
+    result("ctx_switch", "sleep_with_process_us", (double)took / SLEEP_ROUNDS, "us");
+    result("ctx_switch", "remaps", after.remaps - before.remaps, "");
+}
+
+// Small blocks from the arena, and large ones that grow and shrink the heap
+static void bench_malloc() {
+    static void *slots[MALLOC_SLOTS];
+    uint32_t     state = 1;
+
+    int64_t start = now_us();
+    for (int i = 0; i < MALLOC_ROUNDS; ++i) {
+        state        = state * 1103515245 + 12345;
+        size_t slot  = (state >> 8) % MALLOC_SLOTS;
+        free(slots[slot]);
+        slots[slot]  = malloc(16 + (state >> 16) % 1024);
+    }
+    int64_t took = now_us() - start;
+    for (int i = 0; i < MALLOC_SLOTS; ++i) {
+        free(slots[i]);
+        slots[i] = NULL;
+    }
+    result("malloc", "small_ns", (double)took * 1000 / MALLOC_ROUNDS, "ns");
+
+    start = now_us();
+    for (int i = 0; i < LARGE_ROUNDS; ++i) {
+        char *p = malloc(LARGE_SIZE);
+        if (!p) {
+            printf("Unable to allocate %d bytes\n", LARGE_SIZE);
+            return;
+        }
+        // Touch every page, so they are really mapped
+        for (size_t off = 0; off < LARGE_SIZE; off += 4096) {
+            p[off] = 1;
+        }
+        free(p);
+    }
+    result("malloc", "large_us", (double)(now_us() - start) / LARGE_ROUNDS, "us");
+}
+
+static void bench_window() {
+    window_size_t size  = {360, 360};
+    int64_t       start = now_us();
+    for (int i = 0; i < WINDOW_ROUNDS; ++i) {
+        window_handle_t window = window_create("bench", size, WINDOW_FLAG_DOUBLE_BUFFERED);
+        if (!window) {
+            printf("Unable to create a window\n");
+            return;
+        }
+        window_framebuffer_create(window, size, BADGEVMS_PIXELFORMAT_RGB565);
+        window_destroy(window);
+    }
+    result("window", "create_destroy_us", (double)(now_us() - start) / WINDOW_ROUNDS, "us");
+}
+
+static bool my_window_stats(compositor_window_stats_t *stats) {
+    compositor_stats_t all;
+    compositor_stats_get(&all);
+    for (int i = 0; i < all.num_windows; ++i) {
+        if (all.windows[i].pid == getpid()) {
+            *stats = all.windows[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Full frames, each waiting until the one before it was drawn
+static void bench_present() {
+    static window_size_t const sizes[] = {{160, 120}, {320, 240}, {640, 480}};
+    static struct {
+        char const    *name;
+        pixel_format_t format;
+    } const formats[] = {
+        {"rgb565", BADGEVMS_PIXELFORMAT_RGB565},
+        {"argb8888", BADGEVMS_PIXELFORMAT_ARGB8888},
+        {"index8", BADGEVMS_PIXELFORMAT_INDEX8},
+    };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+            window_handle_t window = window_create("bench", sizes[s], WINDOW_FLAG_DOUBLE_BUFFERED);
+            if (!window) {
+                printf("Unable to create a window\n");
+                return;
+            }
+            if (!window_framebuffer_create(window, sizes[s], formats[f].format)) {
+                window_destroy(window);
+                continue;
+            }
+
+            // The first frame maps the window
+            window_present(window, true, NULL, 0);
+
+            // The compositor does the work on the other core, so the whole system is counted
+            cpu_stats_t before, after;
+            cpu_stats_get(&before);
+            int64_t start = now_us();
+            for (int i = 0; i < PRESENT_FRAMES; ++i) {
+                window_present(window, true, NULL, 0);
+            }
+            int64_t took = now_us() - start;
+            cpu_stats_get(&after);
+
+            char metric[32];
+            snprintf(metric, sizeof(metric), "%dx%d_%s_us", sizes[s].w, sizes[s].h, formats[f].name);
+            result("present", metric, (double)took / PRESENT_FRAMES, "us");
+
+            uint64_t l2_misses = 0;
+            for (int c = 0; c < after.num_cores; ++c) {
+                l2_misses += after.cache[c].l2_misses - before.cache[c].l2_misses;
+            }
+            snprintf(metric, sizeof(metric), "%dx%d_%s_l2_miss", sizes[s].w, sizes[s].h, formats[f].name);
+            result("present", metric, (double)l2_misses / PRESENT_FRAMES, "/frame");
+
+            compositor_window_stats_t stats;
+            if (my_window_stats(&stats)) {
+                snprintf(metric, sizeof(metric), "%dx%d_%s_max_us", sizes[s].w, sizes[s].h, formats[f].name);
+                result("present", metric, stats.latency_max_us, "us");
+            }
+            window_destroy(window);
+        }
+    }
+}
+
+// Fills, copies, scaled copies and blends through the PPA, in megapixels per second
+static void bench_ppa() {
+    window_size_t   size   = {640, 480};
+    window_handle_t window = window_create("bench", size, WINDOW_FLAG_DOUBLE_BUFFERED);
+    if (!window || !window_framebuffer_create(window, size, BADGEVMS_PIXELFORMAT_RGB565)) {
+        printf("Unable to create a window\n");
+        if (window) {
+            window_destroy(window);
+        }
+        return;
+    }
+
+    framebuffer_t src = {.w = 320, .h = 240, .format = BADGEVMS_PIXELFORMAT_ARGB8888};
+    src.pixels        = malloc(src.w * src.h * 4);
+    if (!src.pixels) {
+        window_destroy(window);
+        return;
+    }
+    memset(src.pixels, 0x80, src.w * src.h * 4);
+
+    window_rect_t full      = {0, 0, size.w, size.h};
+    window_rect_t src_rect  = {0, 0, src.w, src.h};
+    double        mpix_full = (double)size.w * size.h * PPA_ROUNDS;
+    double        mpix_src  = (double)src.w * src.h * PPA_ROUNDS;
+
+    int64_t start = now_us();
+    for (int i = 0; i < PPA_ROUNDS; ++i) {
+        if (!window_framebuffer_fill(window, full, 0xFF204080)) {
+            break;
+        }
+    }
+    result("ppa", "fill_mpix_s", mpix_full / (now_us() - start), "Mpix/s");
+
+    start = now_us();
+    for (int i = 0; i < PPA_ROUNDS; ++i) {
+        if (!window_framebuffer_blit(window, &src, src_rect, src_rect, 255, false)) {
+            break;
+        }
+    }
+    result("ppa", "blit_mpix_s", mpix_src / (now_us() - start), "Mpix/s");
+
+    start = now_us();
+    for (int i = 0; i < PPA_ROUNDS; ++i) {
+        if (!window_framebuffer_blit(window, &src, src_rect, full, 255, false)) {
+            break;
+        }
+    }
+    result("ppa", "blit_scaled_mpix_s", mpix_full / (now_us() - start), "Mpix/s");
+
+    start = now_us();
+    for (int i = 0; i < PPA_ROUNDS; ++i) {
+        if (!window_framebuffer_blit(window, &src, src_rect, src_rect, 200, true)) {
+            break;
+        }
+    }
+    result("ppa", "blend_mpix_s", mpix_src / (now_us() - start), "Mpix/s");
+
+    free(src.pixels);
+    window_destroy(window);
+}
+
+static void memory_result(
+    char const *name, int64_t took_us, size_t reads, process_stats_t const *before, process_stats_t const *after
+) {
+    cache_counters_t const *b = &before->cache;
+    cache_counters_t const *a = &after->cache;
+    char                    metric[32];
+
+    snprintf(metric, sizeof(metric), "%s_read_ns", name);
+    result("memory", metric, (double)took_us * 1000 / reads, "ns");
+    snprintf(metric, sizeof(metric), "%s_l1d_miss_pct", name);
+    result("memory", metric, 100.0 * (a->l1d_misses - b->l1d_misses) / reads, "%");
+    snprintf(metric, sizeof(metric), "%s_l2_miss_pct", name);
+    result("memory", metric, 100.0 * (a->l2_misses - b->l2_misses) / reads, "%");
+}
+
+// Word reads from PSRAM in order and all over a buffer larger than the caches,
+// with what the cache counters saw, to check them against
+static void bench_memory() {
+    size_t    n   = MEMORY_SIZE / sizeof(uint32_t);
+    uint32_t *buf = malloc(MEMORY_SIZE);
+    if (!buf) {
+        printf("Unable to allocate %d bytes\n", MEMORY_SIZE);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        buf[i] = i;
+    }
+
+    process_stats_t   before, after;
+    uint32_t          sum = 0;
+    volatile uint32_t sink;
+
+    process_stats_get(getpid(), &before);
+    int64_t start = now_us();
+    for (size_t i = 0; i < n; ++i) {
+        sum += buf[i];
+    }
+    int64_t took = now_us() - start;
+    process_stats_get(getpid(), &after);
+    memory_result("seq", took, n, &before, &after);
+
+    uint32_t state = 1;
+    process_stats_get(getpid(), &before);
+    start = now_us();
+    for (size_t i = 0; i < n; ++i) {
+        state  = state * 1103515245 + 12345;
+        sum   += buf[(state >> 8) % n];
+    }
+    took = now_us() - start;
+    process_stats_get(getpid(), &after);
+    memory_result("random", took, n, &before, &after);
+
+    sink = sum;
+    (void)sink;
+    free(buf);
+}
+
+// Sequential, in chunks like stdio uses, in kilobytes per second
+static void bench_file(char const *device) {
+    static char buf[FILE_CHUNK];
+    char        path[32];
+    char        metric[32];
+
+    snprintf(path, sizeof(path), "%s:bench.tmp", device);
+    memset(buf, 0xa5, sizeof(buf));
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Unable to open %s, skipping %s\n", path, device);
+        return;
+    }
+    int64_t start = now_us();
+    for (int i = 0; i < FILE_SIZE / FILE_CHUNK; ++i) {
+        fwrite(buf, 1, sizeof(buf), f);
+    }
+    fclose(f);
+    int64_t took = now_us() - start;
+    snprintf(metric, sizeof(metric), "%s_write_kb_s", device);
+    result("file", metric, (double)FILE_SIZE * 1000 / 1024 / took, "KB/s");
+
+    f = fopen(path, "r");
+    if (f) {
+        start = now_us();
+        while (fread(buf, 1, sizeof(buf), f) == sizeof(buf)) {
+        }
+        took = now_us() - start;
+        fclose(f);
+        snprintf(metric, sizeof(metric), "%s_read_kb_s", device);
+        result("file", metric, (double)FILE_SIZE * 1000 / 1024 / took, "KB/s");
+    }
+    remove(path);
+}
+
+static size_t discard(void *data, size_t size, size_t nmemb, void *user) {
+    (void)data;
+    (void)user;
+    return size * nmemb;
+}
+
+// Every request on its own connection, like most applications do
+static void bench_http() {
+    if (wifi_connect() != WIFI_CONNECTED) {
+        printf("Unable to connect to wifi, skipping http\n");
+        return;
+    }
+
+    int64_t min = INT64_MAX, max = 0, sum = 0;
+    int     done = 0;
+    for (int i = 0; i < HTTP_ROUNDS; ++i) {
+        CURL *curl = curl_easy_init();
+        if (!curl) {
+            break;
+        }
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+
+        int64_t  start = now_us();
+        CURLcode res   = curl_easy_perform(curl);
+        int64_t  took  = now_us() - start;
+        curl_easy_cleanup(curl);
+
+        if (res != CURLE_OK) {
+            printf("GET %s failed: %s\n", url, curl_easy_strerror(res));
+            break;
+        }
+        min  = took < min ? took : min;
+        max  = took > max ? took : max;
+        sum += took;
+        ++done;
+    }
+
+    if (done) {
+        result("http", "get_min_ms", (double)min / 1000, "ms");
+        result("http", "get_avg_ms", (double)sum / done / 1000, "ms");
+        result("http", "get_max_ms", (double)max / 1000, "ms");
+    }
+}
+
+// Until main() of this program, the first launch relocates it and the later
+// ones find it cached or prelinked
+static void bench_launch() {
+    uint64_t total = 0, relocate = 0;
+    int      done  = 0;
+
+    for (int i = 0; i < LAUNCH_ROUNDS; ++i) {
+        pid_t pid = spawn_self("idle");
+        if (pid == -1) {
+            printf("Unable to start %s\n", self_path);
+            break;
+        }
+
+        process_launch_t launch = {0};
+        while (process_launch_get(pid, &launch) && !launch.total_us) {
+            usleep(LAUNCH_POLL_MS * 1000);
+        }
+        reap(pid);
+
+        if (!launch.total_us) {
+            break;
+        }
+        if (i == 0) {
+            result("launch", "first_total_us", launch.total_us, "us");
+            result("launch", "first_relocate_us", launch.relocate_us, "us");
+            continue;
+        }
+        total    += launch.total_us;
+        relocate += launch.relocate_us;
+        ++done;
+    }
+
+    if (done) {
+        result("launch", "again_total_us", (double)total / done, "us");
+        result("launch", "again_relocate_us", (double)relocate / done, "us");
+    }
+}
+
+static bool write_json(char const *output) {
+    FILE *f = fopen(output, "w");
+    if (!f) {
+        return false;
+    }
+
+    char version[32] = "unknown";
+    ota_get_running_version(version);
+
+    fprintf(f, "{\n  \"firmware\": \"%s\",\n  \"time\": %lld,\n  \"results\": [\n", version, (long long)time(NULL));
+    for (int i = 0; i < num_results; ++i) {
+        result_t const *r = &results[i];
+        fprintf(
+            f,
+            "    {\"test\": \"%s\", \"metric\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}%s\n",
+            r->test,
+            r->metric,
+            r->value,
+            r->unit,
+            i + 1 < num_results ? "," : ""
+        );
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+static bool wanted(int argc, char *argv[], int first, char const *test) {
+    if (first == argc) {
+        return true;
+    }
+    for (int i = first; i < argc; ++i) {
+        if (!strcmp(argv[i], test)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// bench [-o output] [-u url] [test...]
+//
+// Runs the tests given, or all of them, and writes the results to output as
+// JSON, to compare firmware releases. The tests are ctx_switch, malloc,
+// window, present, ppa, memory, file, http and launch. http fetches url, which is
+// http://example.com/ by default.
+int main(int argc, char *argv[]) {
+    // Started by ourselves, see spawn_self()
+    if (argc == 2 && !strcmp(argv[1], "spin")) {
+        while (1) {
+            usleep(1);
+        }
+    }
+    if (argc == 2 && !strcmp(argv[1], "idle")) {
+        while (1) {
+            sleep(1);
+        }
+    }
+
+    char const *output = DEFAULT_OUTPUT;
+    int         first  = 1;
+    while (first + 1 < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-o")) {
+            output = argv[first + 1];
+        } else if (!strcmp(argv[first], "-u")) {
+            url = argv[first + 1];
+        } else {
+            break;
+        }
+        first += 2;
+    }
+
+    application_t *self = application_get("bench");
+    self_path           = self && self->binary_path ? self->binary_path : argv[0];
+
+    if (wanted(argc, argv, first, "ctx_switch")) {
+        bench_context_switch();
+    }
+    if (wanted(argc, argv, first, "malloc")) {
+        bench_malloc();
+    }
+    if (wanted(argc, argv, first, "window")) {
+        bench_window();
+    }
+    if (wanted(argc, argv, first, "present")) {
+        bench_present();
+    }
+    if (wanted(argc, argv, first, "ppa")) {
+        bench_ppa();
+    }
+    if (wanted(argc, argv, first, "memory")) {
+        bench_memory();
+    }
+    if (wanted(argc, argv, first, "file")) {
+        bench_file("FLASH0");
+        bench_file("SD0");
+    }
+    if (wanted(argc, argv, first, "http")) {
+        bench_http();
+    }
+    if (wanted(argc, argv, first, "launch")) {
+        bench_launch();
+    }
+
+    if (!write_json(output)) {
+        printf("Unable to write %s\n", output);
+        application_free(self);
+        return 1;
+    }
+    printf("Results written to %s\n", output);
+    application_free(self);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "badgevms/boot_profile.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void print_profile(int ago, boot_profile_t const *profile) {
+    if (ago == 0) {
+        printf("This boot");
+    } else {
+        printf("%d boot%s ago", ago, ago == 1 ? "" : "s");
+    }
+    if (profile->boot) {
+        printf(" (#%lu)", (unsigned long)profile->boot);
+    }
+    printf(", %lu stages\n", (unsigned long)profile->num_stages);
+
+    for (uint32_t i = 0; i < profile->num_stages; ++i) {
+        boot_stage_t const *stage = &profile->stages[i];
+        if (stage->duration_us) {
+            printf(
+                "  %-16s %7lu ms  took %6lu.%03lu ms\n",
+                stage->name,
+                (unsigned long)(stage->start_us / 1000),
+                (unsigned long)(stage->duration_us / 1000),
+                (unsigned long)(stage->duration_us % 1000)
+            );
+        } else {
+            printf("  %-16s %7lu ms\n", stage->name, (unsigned long)(stage->start_us / 1000));
+        }
+    }
+}
+
+// boot_profile [boots]
+//
+// Prints when every stage of the last boots started and how long it took,
+// this boot first. Times are from the moment the CPU started.
+int main(int argc, char *argv[]) {
+    int boots = BOOT_PROFILE_HISTORY;
+    if (argc > 1) {
+        boots = atoi(argv[1]);
+    }
+
+    boot_profile_t *profile = malloc(sizeof(boot_profile_t));
+    if (!profile) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    for (int ago = 0; ago < boots; ++ago) {
+        if (!boot_profile_get(ago, profile)) {
+            break;
+        }
+        print_profile(ago, profile);
+    }
+
+    free(profile);
+    return 0;
+}
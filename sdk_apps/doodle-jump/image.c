@@ -1,4 +0,0 @@
-#define STBI_ASSERT(x)
-#define STBI_NO_THREAD_LOCALS  // BadgeVMS doesn't support TLS
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
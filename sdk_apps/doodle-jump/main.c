@@ -13,15 +13,17 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
-// Image loading support - declaration only
-// Implementation is in image.c to avoid TLS issues
-unsigned char *stbi_load(char const *filename, int *x, int *y, int *comp, int req_comp);
-void stbi_image_free(void *retval_from_stbi_load);
-const char *stbi_failure_reason(void);
+// Images are converted to sprites when the app is built, see ASSETS in
+// sdk_apps/CMakeLists.txt, so nothing is decoded here
+#include "badgevms/sprite.h"
+#include "pixel/pixel.h"
 
 // Include BadgeVMS device support for BMI270 (only when building for badge hardware)
 #ifdef BADGEVMS_BUILD
-#include "badgevms/device.h"
+#include "badgevms/motion.h"
+#include "badgevms/process.h"
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 // Memory optimization flag
@@ -57,6 +59,31 @@ const char *stbi_failure_reason(void);
 #define MONSTER_MAX_SCORE      5000
 #define MONSTER_SPEED          0.03f
 
+// Physics runs at a fixed rate whatever the frame rate, drawing interpolates
+// between the last two steps. Speeds are per 16ms, the step's delta_time is
+// PHYSICS_STEP_MS / 16.
+#define PHYSICS_HZ             120
+#define PHYSICS_STEP_MS        (1000.0f / PHYSICS_HZ)
+#define PHYSICS_MAX_FRAME_MS   100  // Dropped beyond this rather than catching up
+
+// Platforms and monsters further than this off screen are not simulated, and
+// removed once they are this far below it
+#define OFFSCREEN_MARGIN       200
+
+// Tilt controls
+#define TILT_MAX_DEGREES       30.0f  // Tilt for full speed
+#define TILT_DEAD_ZONE         0.1f   // Of full speed
+#define TILT_SMOOTHING         0.15f  // Per sample, low pass over the accelerometer
+#define TILT_CALIBRATION       50     // Samples averaged for the zero, half a second
+#define TILT_READ_SAMPLES      16
+
+// Benchmark mode, `doodle-jump benchmark [frames] [seed]` (args in init.toml
+// work too): the same game every run, for comparing firmware builds
+#define BENCHMARK_FRAMES       3000
+#define BENCHMARK_SEED         1
+#define BENCHMARK_STEPS_PER_FRAME 2     // Simulated 60 FPS, whatever the real frame rate
+#define BENCHMARK_LOOP_STEPS   2400     // benchmark_inputs repeats every 20 seconds of game time
+
 // Platform types
 typedef enum {
     PLATFORM_NORMAL = 0,
@@ -65,9 +92,65 @@ typedef enum {
     PLATFORM_SPRING
 } PlatformType;
 
+// A tile of a sprite sheet, drawn with a source rect so a sheet is decoded once
+typedef struct {
+    SDL_Texture *texture; // The sheet, owned by GameState
+    SDL_FRect rect;
+} Sprite;
+
+// Input from this physics step on, `doodle-jump record` prints these as they change
+typedef struct {
+    Uint32 step;
+    bool left;
+    bool right;
+    bool shoot;
+} BenchmarkInput;
+
+// Steering left and right, shooting now and then
+static const BenchmarkInput benchmark_inputs[] = {
+    {0, false, false, false},
+    {120, false, true, false},
+    {300, false, false, true},
+    {330, true, false, false},
+    {600, false, false, false},
+    {660, false, true, true},
+    {700, false, true, false},
+    {900, true, false, false},
+    {1080, false, false, true},
+    {1110, false, false, false},
+    {1200, true, false, false},
+    {1440, false, true, false},
+    {1700, false, false, true},
+    {1730, true, false, false},
+    {2000, false, true, false},
+    {2200, false, false, false},
+};
+
+typedef struct {
+    bool enabled;
+    bool record; // Print the input as it changes, for benchmark_inputs
+    int frames; // To run
+    int frame;
+    Uint32 step; // Physics steps so far, the input timeline's clock
+    int next_input; // In benchmark_inputs
+    BenchmarkInput last_input; // Recorded
+    Uint64 *frame_ns; // Of every frame
+    Uint64 update_ns; // All frames
+    Uint64 render_ns;
+} Benchmark;
+
+// A string drawn by render_text(), kept as a texture until it changes
+typedef struct {
+    char text[32];
+    float scale;
+    SDL_Color color;
+    SDL_Texture *texture;
+} TextCache;
+
 // Projectile structure
 typedef struct {
     float x, y;
+    float prev_x, prev_y; // Before the last physics step
     float vy; // Only vertical velocity needed
     bool active;
 } Projectile;
@@ -80,6 +163,7 @@ typedef enum {
 // Monster structure
 typedef struct {
     float x, y;
+    float prev_x, prev_y; // Before the last physics step
     float vx; // Horizontal velocity
     float width, height;
     MonsterType type;
@@ -90,6 +174,7 @@ typedef struct {
 // Platform structure
 typedef struct {
     float x, y;
+    float prev_x, prev_y; // Before the last physics step
     float width, height;
     PlatformType type;
     bool active;
@@ -100,6 +185,7 @@ typedef struct {
 // Player structure
 typedef struct {
     float x, y;
+    float prev_x, prev_y; // Before the last physics step
     float vx, vy; // velocity
     float width, height;
     bool on_ground;
@@ -113,18 +199,28 @@ typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
     Player player;
+    // Platforms and monsters are created going up and removed from below, so
+    // both are rings sorted from the lowest up, see platform_at()
     Platform platforms[MAX_PLATFORMS];
+    int first_platform; // Slot of the lowest platform
     int num_platforms;
     Projectile projectiles[MAX_PROJECTILES];
     int num_projectiles;
     Monster monsters[MAX_MONSTERS];
+    int first_monster; // Slot of the lowest monster
     int num_monsters;
     float camera_y; // Camera position for scrolling
+    float prev_camera_y; // Before the last physics step
+    float draw_camera_y; // Interpolated, for this frame
     int score;
     int platforms_landed; // Count of platforms landed on
-    int last_platform_landed; // Index of last platform landed on to avoid double counting
+    int last_platform_landed; // Slot of last platform landed on to avoid double counting
     bool game_running;
+    bool game_over_drawn; // And presented, nothing is drawn until the game restarts
+    Benchmark benchmark;
     Uint32 last_time;  // Changed from Uint64 to avoid 64-bit float conversion issues
+    float physics_accumulator; // Milliseconds not yet simulated
+    float render_alpha; // How far this frame is between the last two steps
     
     // Input state for event-based controls
     bool left_pressed;
@@ -137,28 +233,45 @@ typedef struct {
     SDL_Texture *player_right_texture;
     SDL_Texture *player_shoot_texture;
     SDL_Texture *projectile_texture;
-    SDL_Texture *monster_basic_texture;
-    SDL_Texture *platform_normal_texture;
-    SDL_Texture *platform_moving_texture;
-    SDL_Texture *platform_breakable_texture;
-    SDL_Texture *platform_spring_texture;
+    SDL_Texture *tiles_texture; // game_tiles.png, the sprites below are in it
+    Sprite monster_basic_sprite;
+    Sprite platform_normal_sprite;
+    Sprite platform_moving_sprite;
+    Sprite platform_breakable_sprite;
+    Sprite platform_spring_sprite;
     SDL_Texture *background_texture;
     
+    // Text, see render_text()
+    TextCache score_text; // Shared by the game and the game over screen
+    TextCache game_over_text;
+    TextCache game_over_shadow_text;
+    TextCache hint_text;
+    
 #ifdef BADGEVMS_BUILD
-    orientation_device_t *orientation; // BMI270 orientation sensor
+    // BMI270 samples, read without waiting so the render loop never stalls
+    int motion_fd;
+    float tilt;            // Smoothed, degrees
+    float tilt_zero;       // How the badge was held when the game started
+    float tilt_sum;        // Of the calibration samples so far, relative to the first
+    int tilt_samples;      // Calibration samples so far
 #endif
 } GameState;
 
 // Function declarations
 void init_game(GameState *game);
 void generate_platforms(GameState *game, bool is_initial_generation);
+Platform *platform_at(GameState *game, int i);
+int platform_search(GameState *game, float y);
+Monster *monster_at(GameState *game, int i);
+int monster_search(GameState *game, float y);
 void update_game(GameState *game, float delta_time);
+void save_positions(GameState *game);
 void render_game(GameState *game);
+void render_game_over(GameState *game);
 void handle_input(GameState *game, const bool *keyboard_state, float delta_time);
 void update_camera(GameState *game);
 bool check_platform_collision(Player *player, Platform *platform);
-void render_number(SDL_Renderer *renderer, int number, float x, float y, float scale);
-void render_text(SDL_Renderer *renderer, const char *text, float x, float y, float scale, int r, int g, int b, int a);
+void render_text(SDL_Renderer *renderer, TextCache *cache, const char *text, float x, float y, float scale, int r, int g, int b, int a);
 void shoot_projectile(GameState *game);
 void update_projectiles(GameState *game, float delta_time);
 void render_projectiles(GameState *game);
@@ -170,158 +283,180 @@ bool check_projectile_monster_collision(Projectile *projectile, Monster *monster
 bool is_monster_nearby(GameState *game, float x, float y, float min_distance);
 
 // Image loading functions
+sprite_header_t *read_sprite(const char *filename);
+SDL_Texture *texture_from_sprite(SDL_Renderer *renderer, const sprite_header_t *sprite, const char *filename);
 SDL_Texture* load_texture_from_file(SDL_Renderer *renderer, const char *filename);
-SDL_Texture* load_tile_from_sprite_sheet(SDL_Renderer *renderer, const char *filename, int tile_x, int tile_y, int tile_width, int tile_height);
+SDL_Texture *load_background(SDL_Renderer *renderer, const char *filename);
+Sprite sprite_from_sheet(SDL_Texture *sheet, int tile_x, int tile_y, int tile_width, int tile_height);
 void load_game_textures(GameState *game);
 void cleanup_textures(GameState *game);
 
-// Load texture from image file using stb_image
-SDL_Texture* load_texture_from_file(SDL_Renderer *renderer, const char *filename) {
-    int width, height, channels;
-    unsigned char *image_data = stbi_load(filename, &width, &height, &channels, 4); // Force 4 channels (RGBA)
+// Read a sprite file, free() it when done
+sprite_header_t *read_sprite(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        printf("Failed to open image %s\n", filename);
+        return NULL;
+    }
     
-    if (!image_data) {
-        printf("Failed to load image %s: %s\n", filename, stbi_failure_reason());
+    sprite_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != SPRITE_MAGIC) {
+        printf("Failed to load image %s: not a sprite\n", filename);
+        fclose(file);
         return NULL;
     }
     
-    // Create SDL surface from image data
-    SDL_Surface *surface = SDL_CreateSurfaceFrom(width, height, SDL_PIXELFORMAT_RGBA32, image_data, width * 4);
-    if (!surface) {
-        printf("Failed to create surface from image %s: %s\n", filename, SDL_GetError());
-        stbi_image_free(image_data);
+    size_t size = sprite_size(&header);
+    sprite_header_t *sprite = (sprite_header_t *)malloc(size);
+    if (!sprite) {
+        printf("Failed to allocate memory for image %s\n", filename);
+        fclose(file);
+        return NULL;
+    }
+    *sprite = header;
+    size_t read_ok = fread(sprite + 1, size - sizeof(header), 1, file);
+    fclose(file);
+    if (read_ok != 1) {
+        printf("Failed to load image %s: truncated\n", filename);
+        free(sprite);
         return NULL;
     }
     
-    // Create texture from surface
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+    return sprite;
+}
+
+// Create a texture holding a sprite
+SDL_Texture *texture_from_sprite(SDL_Renderer *renderer, const sprite_header_t *sprite, const char *filename) {
+    int width = sprite->width;
+    int height = sprite->height;
+    const uint16_t *pixels = sprite_pixels(sprite);
+    const uint8_t *alpha = sprite_alpha(sprite);
+    SDL_Texture *texture;
+    
+    if (!alpha) {
+        // Already what the window is, copied in as is
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB565, SDL_TEXTUREACCESS_STATIC, width, height);
+        if (texture) {
+            SDL_UpdateTexture(texture, NULL, pixels, width * 2);
+        }
+    } else {
+        // Blending takes the alpha from the pixels themselves
+        uint32_t *argb = (uint32_t *)malloc((size_t)width * height * 4);
+        texture = NULL;
+        if (argb) {
+            pixel_rgb565a8_to_argb8888(argb, pixels, alpha, (size_t)width * height);
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, width, height);
+            if (texture) {
+                SDL_UpdateTexture(texture, NULL, argb, width * 4);
+                SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+            }
+            free(argb);
+        }
+    }
+    
     if (!texture) {
         printf("Failed to create texture from image %s: %s\n", filename, SDL_GetError());
     }
     
-    // Cleanup
-    SDL_DestroySurface(surface);
-    stbi_image_free(image_data);
-    
     return texture;
 }
 
-// Load a specific tile from a sprite sheet
-SDL_Texture* load_tile_from_sprite_sheet(SDL_Renderer *renderer, const char *filename, int tile_x, int tile_y, int tile_width, int tile_height) {
-    int width, height, channels;
-    unsigned char *image_data = stbi_load(filename, &width, &height, &channels, 4); // Force 4 channels (RGBA)
-    
-    if (!image_data) {
-        printf("Failed to load sprite sheet %s: %s\n", filename, stbi_failure_reason());
-        return NULL;
-    }
+// Load texture from a sprite file
+SDL_Texture* load_texture_from_file(SDL_Renderer *renderer, const char *filename) {
+    sprite_header_t *sprite = read_sprite(filename);
+    if (!sprite) return NULL;
     
-    // Create a smaller image buffer for the tile
-    unsigned char *tile_data = (unsigned char*)malloc(tile_width * tile_height * 4);
-    if (!tile_data) {
-        printf("Failed to allocate memory for tile\n");
-        stbi_image_free(image_data);
+    SDL_Texture *texture = texture_from_sprite(renderer, sprite, filename);
+    free(sprite);
+    return texture;
+}
+
+// Load the background scaled to the window width once, cropped to the window
+// height like renderBackground() centers it, so every frame is a plain copy
+SDL_Texture *load_background(SDL_Renderer *renderer, const char *filename) {
+    sprite_header_t *sprite = read_sprite(filename);
+    if (!sprite) return NULL;
+    
+    int scaled_height = sprite->height * WINDOW_WIDTH / sprite->width;
+    int height = SDL_min(scaled_height, WINDOW_HEIGHT);
+    int first_row = (scaled_height - height) / 2;
+    
+    sprite_header_t header = *sprite;
+    header.width = WINDOW_WIDTH;
+    header.height = height;
+    sprite_header_t *scaled = (sprite_header_t *)malloc(sprite_size(&header));
+    if (!scaled) {
+        printf("Failed to allocate memory for image %s\n", filename);
+        free(sprite);
         return NULL;
     }
-    
-    // Extract the tile from the sprite sheet
-    for (int y = 0; y < tile_height; y++) {
-        for (int x = 0; x < tile_width; x++) {
-            int src_x = tile_x + x;
-            int src_y = tile_y + y;
-            
-            // Make sure we don't go out of bounds
-            if (src_x >= width || src_y >= height) {
-                // Fill with transparent pixels if out of bounds
-                tile_data[(y * tile_width + x) * 4 + 0] = 0;     // R
-                tile_data[(y * tile_width + x) * 4 + 1] = 0;     // G
-                tile_data[(y * tile_width + x) * 4 + 2] = 0;     // B
-                tile_data[(y * tile_width + x) * 4 + 3] = 0;     // A
-            } else {
-                // Copy pixel from source
-                int src_index = (src_y * width + src_x) * 4;
-                int dst_index = (y * tile_width + x) * 4;
-                tile_data[dst_index + 0] = image_data[src_index + 0]; // R
-                tile_data[dst_index + 1] = image_data[src_index + 1]; // G
-                tile_data[dst_index + 2] = image_data[src_index + 2]; // B
-                tile_data[dst_index + 3] = image_data[src_index + 3]; // A
-            }
+    *scaled = header;
+    
+    // Nearest neighbour, what the renderer did every frame
+    const uint16_t *pixels = sprite_pixels(sprite);
+    const uint8_t *alpha = sprite_alpha(sprite);
+    uint16_t *scaled_pixels = (uint16_t *)sprite_pixels(scaled);
+    uint8_t *scaled_alpha = (uint8_t *)sprite_alpha(scaled);
+    for (int y = 0; y < height; y++) {
+        int src_row = (y + first_row) * sprite->height / scaled_height * sprite->width;
+        for (int x = 0; x < WINDOW_WIDTH; x++) {
+            int src = src_row + x * sprite->width / WINDOW_WIDTH;
+            scaled_pixels[y * WINDOW_WIDTH + x] = pixels[src];
+            if (alpha) scaled_alpha[y * WINDOW_WIDTH + x] = alpha[src];
         }
     }
+    free(sprite);
     
-    // Create SDL surface from tile data
-    SDL_Surface *surface = SDL_CreateSurfaceFrom(tile_width, tile_height, SDL_PIXELFORMAT_RGBA32, tile_data, tile_width * 4);
-    if (!surface) {
-        printf("Failed to create surface from tile: %s\n", SDL_GetError());
-        free(tile_data);
-        stbi_image_free(image_data);
-        return NULL;
-    }
-    
-    // Create texture from surface
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if (!texture) {
-        printf("Failed to create texture from tile: %s\n", SDL_GetError());
-    }
-    
-    // Cleanup
-    SDL_DestroySurface(surface);
-    free(tile_data);
-    stbi_image_free(image_data);
-    
+    SDL_Texture *texture = texture_from_sprite(renderer, scaled, filename);
+    free(scaled);
     return texture;
 }
 
+// A tile of a sheet loaded with load_texture_from_file(), nothing is copied
+Sprite sprite_from_sheet(SDL_Texture *sheet, int tile_x, int tile_y, int tile_width, int tile_height) {
+    Sprite sprite = { sheet, { (float)tile_x, (float)tile_y, (float)tile_width, (float)tile_height } };
+    return sprite;
+}
+
 // Load all game textures
 void load_game_textures(GameState *game) {
-    // Initialize all textures to NULL
-    game->player_left_texture = NULL;
-    game->player_right_texture = NULL;
-    game->player_shoot_texture = NULL;
-    game->projectile_texture = NULL;
-    game->monster_basic_texture = NULL;
-    game->platform_normal_texture = NULL;
-    game->platform_moving_texture = NULL;
     // Initialize all texture pointers to NULL first
     game->player_left_texture = NULL;
     game->player_right_texture = NULL;
     game->player_shoot_texture = NULL;
     game->projectile_texture = NULL;
-    game->monster_basic_texture = NULL;
-    game->platform_normal_texture = NULL;
-    game->platform_moving_texture = NULL;
-    game->platform_breakable_texture = NULL;
-    game->platform_spring_texture = NULL;
+    game->tiles_texture = NULL;
     game->background_texture = NULL;
     
 #if USE_IMAGES
     printf("Loading textures using BadgeVMS file paths...\n");
     // Try to load textures using BadgeVMS file paths
-    game->player_left_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]player_left.png");
-    game->player_right_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]player_right.png");
-    game->player_shoot_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]player_shoot.png");
-    game->projectile_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]projectile.png");
-    
-    // Load platform textures from sprite sheet using BadgeVMS file paths
-    // Standard platform: made taller to include bottom pixels
-    game->platform_normal_texture = load_tile_from_sprite_sheet(game->renderer, "APPS:[DOODLE-JUMP]game_tiles.png", 0, 0, 65, 18);
-    // Moving platform: works perfectly, keep as is
-    game->platform_moving_texture = load_tile_from_sprite_sheet(game->renderer, "APPS:[DOODLE-JUMP]game_tiles.png", 0, 18, 65, 18);
-    // Breakable platform: normal state
-    game->platform_breakable_texture = load_tile_from_sprite_sheet(game->renderer, "APPS:[DOODLE-JUMP]game_tiles.png", 0, 70, 65, 18);
-    // Spring platform: try different position
-    game->platform_spring_texture = load_tile_from_sprite_sheet(game->renderer, "APPS:[DOODLE-JUMP]game_tiles.png", 0, 35, 65, 18);
-
-    // Load monster textures from sprite sheet (to the right of platforms)
-    game->monster_basic_texture = load_tile_from_sprite_sheet(game->renderer, "APPS:[DOODLE-JUMP]game_tiles.png", 65, 0, 70, 90);
-
-    game->background_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]background.png");
-    
-    printf("Loaded textures: left=%p, right=%p, normal=%p, moving=%p, breakable=%p, spring=%p, monster=%p, bg=%p\n",
-           (void*)game->player_left_texture, (void*)game->player_right_texture, 
-           (void*)game->platform_normal_texture, (void*)game->platform_moving_texture,
-           (void*)game->platform_breakable_texture, (void*)game->platform_spring_texture,
-           (void*)game->monster_basic_texture, (void*)game->background_texture);
+    game->player_left_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]player_left.spr");
+    game->player_right_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]player_right.spr");
+    game->player_shoot_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]player_shoot.spr");
+    game->projectile_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]projectile.spr");
+    
+    // Platforms and monsters share one sprite sheet, decoded once
+    game->tiles_texture = load_texture_from_file(game->renderer, "APPS:[DOODLE-JUMP]game_tiles.spr");
+    if (game->tiles_texture) {
+        // Standard platform: made taller to include bottom pixels
+        game->platform_normal_sprite = sprite_from_sheet(game->tiles_texture, 0, 0, 65, 18);
+        // Moving platform: works perfectly, keep as is
+        game->platform_moving_sprite = sprite_from_sheet(game->tiles_texture, 0, 18, 65, 18);
+        // Breakable platform: normal state
+        game->platform_breakable_sprite = sprite_from_sheet(game->tiles_texture, 0, 70, 65, 18);
+        // Spring platform: try different position
+        game->platform_spring_sprite = sprite_from_sheet(game->tiles_texture, 0, 35, 65, 18);
+
+        // Monsters are to the right of the platforms
+        game->monster_basic_sprite = sprite_from_sheet(game->tiles_texture, 65, 0, 70, 90);
+    }
+
+    game->background_texture = load_background(game->renderer, "APPS:[DOODLE-JUMP]background.spr");
+    
+    printf("Loaded textures: left=%p, right=%p, tiles=%p, bg=%p\n",
+           (void*)game->player_left_texture, (void*)game->player_right_texture,
+           (void*)game->tiles_texture, (void*)game->background_texture);
 #else
     printf("Skipping texture loading - using colored rectangles for better memory usage\n");
 #endif
@@ -333,12 +468,12 @@ void cleanup_textures(GameState *game) {
     if (game->player_right_texture) SDL_DestroyTexture(game->player_right_texture);
     if (game->player_shoot_texture) SDL_DestroyTexture(game->player_shoot_texture);
     if (game->projectile_texture) SDL_DestroyTexture(game->projectile_texture);
-    if (game->monster_basic_texture) SDL_DestroyTexture(game->monster_basic_texture);
-    if (game->platform_normal_texture) SDL_DestroyTexture(game->platform_normal_texture);
-    if (game->platform_moving_texture) SDL_DestroyTexture(game->platform_moving_texture);
-    if (game->platform_breakable_texture) SDL_DestroyTexture(game->platform_breakable_texture);
-    if (game->platform_spring_texture) SDL_DestroyTexture(game->platform_spring_texture);
+    if (game->tiles_texture) SDL_DestroyTexture(game->tiles_texture);
     if (game->background_texture) SDL_DestroyTexture(game->background_texture);
+    if (game->score_text.texture) SDL_DestroyTexture(game->score_text.texture);
+    if (game->game_over_text.texture) SDL_DestroyTexture(game->game_over_text.texture);
+    if (game->game_over_shadow_text.texture) SDL_DestroyTexture(game->game_over_shadow_text.texture);
+    if (game->hint_text.texture) SDL_DestroyTexture(game->hint_text.texture);
 }
 
 // Initialize the game state
@@ -361,10 +496,8 @@ void init_game(GameState *game) {
     }
     
     // Initialize monsters
+    game->first_monster = 0;
     game->num_monsters = 0;
-    for (int i = 0; i < MAX_MONSTERS; i++) {
-        game->monsters[i].active = false;
-    }
     
     // Initialize game state
     game->score = 0;
@@ -379,22 +512,17 @@ void init_game(GameState *game) {
     game->restart_pressed = false;
     
 #ifdef BADGEVMS_BUILD
-    // Initialize BMI270 orientation sensor
-    game->orientation = (orientation_device_t *)device_get("ORIENTATION0");
-    if (game->orientation == NULL) {
-        printf("Warning: BMI270 orientation sensor not found - tilt controls disabled\n");
-    }
+    // Zero the tilt on how the badge is held now
+    game->tilt_samples = 0;
+    game->tilt_sum = 0;
 #endif
     
-    // Load game textures
-    load_game_textures(game);
-    
     // Generate initial platforms FIRST
     generate_platforms(game, true);
     
     // NOW position player on the starting platform (first platform should be the starting one)
     if (game->num_platforms > 0) {
-        Platform *start_platform = &game->platforms[0];
+        Platform *start_platform = platform_at(game, 0);
         game->player.y = start_platform->y - game->player.height - 40;
         // Center player on the starting platform
         game->player.x = start_platform->x + (start_platform->width - game->player.width) / 2;
@@ -407,137 +535,115 @@ void init_game(GameState *game) {
         game->player.y = starting_platform_y - PLAYER_HEIGHT;
         game->camera_y = starting_platform_y - WINDOW_HEIGHT + 100;
     }
+    
+    // Nothing to interpolate from yet
+    save_positions(game);
+    game->draw_camera_y = game->camera_y;
+}
+
+// The i-th platform from the lowest up
+Platform *platform_at(GameState *game, int i) {
+    return &game->platforms[(game->first_platform + i) % MAX_PLATFORMS];
+}
+
+// Position from the lowest of the first platform whose top is above y, the
+// platforms from there on are all above it
+int platform_search(GameState *game, float y) {
+    int low = 0;
+    int high = game->num_platforms;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (platform_at(game, mid)->y < y) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+// A new highest platform at height y, NULL when the ring is full
+static Platform *add_platform(GameState *game, float y) {
+    if (game->num_platforms >= MAX_PLATFORMS) return NULL;
+    
+    Platform *platform = platform_at(game, game->num_platforms++);
+    platform->x = (float)(SDL_rand(WINDOW_WIDTH - (int)PLATFORM_WIDTH));
+    platform->y = y;
+    platform->width = PLATFORM_WIDTH;
+    platform->height = PLATFORM_HEIGHT;
+    platform->active = true;
+    
+    // Set platform type and properties using helper logic
+    int rand_type = SDL_rand(100);
+    if (rand_type < 85) {
+        platform->type = PLATFORM_NORMAL;
+        platform->move_direction = 0;
+        platform->move_speed = 0;
+    } else if (rand_type < 90) {
+        platform->type = PLATFORM_MOVING;
+        platform->move_direction = (SDL_rand(2) == 0) ? 1.0f : -1.0f;
+        platform->move_speed = game->score / 800.0f + (float)(SDL_rand(4)) / 20.0f;
+        if (platform->move_speed < 0.5f) platform->move_speed = 0.5f;
+        else if (platform->move_speed > 1.0f) platform->move_speed = 1.0f;
+    } else if (rand_type < 95) {
+        platform->type = PLATFORM_BREAKABLE;
+        platform->move_direction = 0;
+        platform->move_speed = 0;
+    } else {
+        platform->type = PLATFORM_SPRING;
+        platform->move_direction = 0;
+        platform->move_speed = 0;
+    }
+    
+    platform->prev_x = platform->x;
+    platform->prev_y = platform->y;
+    return platform;
+}
+
+// Spacing to the next platform up from y, with difficulty scaling
+static float platform_spacing(float y) {
+    float height_factor = (-y) / 500.0f;
+    int additional_spacing = (int)(height_factor * 15);
+    if (additional_spacing > 30) additional_spacing = 30;
+    
+    return PLATFORM_SPACING_MIN + (SDL_rand(PLATFORM_SPACING_MAX - PLATFORM_SPACING_MIN)) + additional_spacing;
 }
 
 // Generate platforms for the game (unified function for initial and ongoing generation)
 void generate_platforms(GameState *game, bool is_initial_generation) {
+    float current_y;
+    float target_height;
+    
     if (is_initial_generation) {
         // Reset platform count for initial generation
+        game->first_platform = 0;
         game->num_platforms = 0;
         
         // Add a starting platform at the bottom - always clearly visible with good padding
-        Platform *start_platform = &game->platforms[game->num_platforms++];
+        Platform *start_platform = add_platform(game, WINDOW_HEIGHT - PLATFORM_HEIGHT - 50); // 50px offset from bottom for better visibility
         start_platform->x = WINDOW_WIDTH / 2 - PLATFORM_WIDTH / 2;
-        start_platform->y = WINDOW_HEIGHT - PLATFORM_HEIGHT - 50; // 50px offset from bottom for better visibility
-        start_platform->width = PLATFORM_WIDTH;
-        start_platform->height = PLATFORM_HEIGHT;
         start_platform->type = PLATFORM_NORMAL;
-        start_platform->active = true;
         start_platform->move_direction = 0;
         start_platform->move_speed = 0;
+        start_platform->prev_x = start_platform->x;
         
         // Generate initial platforms going upward
-        float current_y = start_platform->y - PLATFORM_SPACING_MIN;
-        
-        for (int i = 1; i < MAX_PLATFORMS && current_y > -1000; i++) {
-            Platform *platform = &game->platforms[game->num_platforms++];
-            
-            platform->x = (float)(SDL_rand(WINDOW_WIDTH - (int)PLATFORM_WIDTH));
-            platform->y = current_y;
-            platform->width = PLATFORM_WIDTH;
-            platform->height = PLATFORM_HEIGHT;
-            platform->active = true;
-            
-            // Set platform type and properties using helper logic
-            int rand_type = SDL_rand(100);
-            if (rand_type < 85) {
-                platform->type = PLATFORM_NORMAL;
-                platform->move_direction = 0;
-                platform->move_speed = 0;
-            } else if (rand_type < 90) {
-                platform->type = PLATFORM_MOVING;
-                platform->move_direction = (SDL_rand(2) == 0) ? 1.0f : -1.0f;
-                platform->move_speed = game->score / 800.0f + (float)(SDL_rand(4)) / 20.0f;
-                if (platform->move_speed < 0.5f) platform->move_speed = 0.5f;
-                else if (platform->move_speed > 1.0f) platform->move_speed = 1.0f;
-            } else if (rand_type < 95) {
-                platform->type = PLATFORM_BREAKABLE;
-                platform->move_direction = 0;
-                platform->move_speed = 0;
-            } else {
-                platform->type = PLATFORM_SPRING;
-                platform->move_direction = 0;
-                platform->move_speed = 0;
-            }
-            
-            // Calculate next platform position with difficulty scaling
-            float height_factor = (-current_y) / 500.0f;
-            int additional_spacing = (int)(height_factor * 15);
-            if (additional_spacing > 30) additional_spacing = 30;
-            
-            current_y -= PLATFORM_SPACING_MIN + (SDL_rand(PLATFORM_SPACING_MAX - PLATFORM_SPACING_MIN)) + additional_spacing;
-        }
+        current_y = start_platform->y - PLATFORM_SPACING_MIN;
+        target_height = -1000;
     } else {
-        // Continuous generation during gameplay
-        // Find the highest platform
+        // Continuous generation during gameplay, above the highest platform
         float highest_y = game->camera_y;
-        for (int i = 0; i < game->num_platforms; i++) {
-            if (game->platforms[i].active && game->platforms[i].y < highest_y) {
-                highest_y = game->platforms[i].y;
-            }
+        if (game->num_platforms > 0 && platform_at(game, game->num_platforms - 1)->y < highest_y) {
+            highest_y = platform_at(game, game->num_platforms - 1)->y;
         }
         
         // Generate new platforms if we need more above the highest point
-        float target_height = game->camera_y - WINDOW_HEIGHT - 200;
-        float current_y = highest_y - PLATFORM_SPACING_MIN;
-        
-        while (current_y > target_height && game->num_platforms < MAX_PLATFORMS) {
-            // Find an inactive platform slot to reuse
-            int slot = -1;
-            for (int i = 0; i < game->num_platforms; i++) {
-                if (!game->platforms[i].active) {
-                    slot = i;
-                    break;
-                }
-            }
-            
-            // If no inactive slot, try to add a new one
-            if (slot == -1 && game->num_platforms < MAX_PLATFORMS) {
-                slot = game->num_platforms++;
-            }
-            
-            // If we found a slot, create a new platform
-            if (slot != -1) {
-                Platform *platform = &game->platforms[slot];
-                
-                platform->x = (float)(SDL_rand(WINDOW_WIDTH - (int)PLATFORM_WIDTH));
-                platform->y = current_y;
-                platform->width = PLATFORM_WIDTH;
-                platform->height = PLATFORM_HEIGHT;
-                platform->active = true;
-                
-                // Set platform type and properties using helper logic
-                int rand_type = SDL_rand(100);
-                if (rand_type < 85) {
-                    platform->type = PLATFORM_NORMAL;
-                    platform->move_direction = 0;
-                    platform->move_speed = 0;
-                } else if (rand_type < 90) {
-                    platform->type = PLATFORM_MOVING;
-                    platform->move_direction = (SDL_rand(2) == 0) ? 1.0f : -1.0f;
-                    platform->move_speed = game->score / 800.0f + (float)(SDL_rand(4)) / 20.0f;
-                    if (platform->move_speed < 0.5f) platform->move_speed = 0.5f;
-                    else if (platform->move_speed > 1.0f) platform->move_speed = 1.0f;
-                } else if (rand_type < 95) {
-                    platform->type = PLATFORM_BREAKABLE;
-                    platform->move_direction = 0;
-                    platform->move_speed = 0;
-                } else {
-                    platform->type = PLATFORM_SPRING;
-                    platform->move_direction = 0;
-                    platform->move_speed = 0;
-                }
-                
-                // Calculate next platform position with difficulty scaling
-                float height_factor = (-current_y) / 500.0f;
-                int additional_spacing = (int)(height_factor * 15);
-                if (additional_spacing > 30) additional_spacing = 30;
-                
-                current_y -= PLATFORM_SPACING_MIN + (SDL_rand(PLATFORM_SPACING_MAX - PLATFORM_SPACING_MIN)) + additional_spacing;
-            } else {
-                break;
-            }
-        }
+        current_y = highest_y - PLATFORM_SPACING_MIN;
+        target_height = game->camera_y - WINDOW_HEIGHT - OFFSCREEN_MARGIN;
+    }
+    
+    while (current_y > target_height && add_platform(game, current_y)) {
+        current_y -= platform_spacing(current_y);
     }
 }
 
@@ -563,87 +669,10 @@ bool check_platform_collision(Player *player, Platform *platform) {
     return false;
 }
 
-// Render a number using simple pixel patterns
-void render_number(SDL_Renderer *renderer, int number, float x, float y, float scale) {
-    // Define digit patterns as 3x5 bitmaps
-    static const unsigned char digit_patterns[10][5] = {
-        // 0
-        {0b111, 0b101, 0b101, 0b101, 0b111},
-        // 1
-        {0b010, 0b110, 0b010, 0b010, 0b111},
-        // 2
-        {0b111, 0b001, 0b111, 0b100, 0b111},
-        // 3
-        {0b111, 0b001, 0b111, 0b001, 0b111},
-        // 4
-        {0b101, 0b101, 0b111, 0b001, 0b001},
-        // 5
-        {0b111, 0b100, 0b111, 0b001, 0b111},
-        // 6
-        {0b111, 0b100, 0b111, 0b101, 0b111},
-        // 7
-        {0b111, 0b001, 0b001, 0b001, 0b001},
-        // 8
-        {0b111, 0b101, 0b111, 0b101, 0b111},
-        // 9
-        {0b111, 0b101, 0b111, 0b001, 0b111}
-    };
-    
-    if (number == 0) {
-        // Special case for 0
-        const unsigned char *pattern = digit_patterns[0];
-        for (int row = 0; row < 5; row++) {
-            for (int col = 0; col < 3; col++) {
-                if (pattern[row] & (1 << (2 - col))) {
-                    SDL_FRect pixel = {
-                        x + col * scale,
-                        y + row * scale,
-                        scale,
-                        scale
-                    };
-                    SDL_RenderFillRect(renderer, &pixel);
-                }
-            }
-        }
-        return;
-    }
-    
-    // Convert number to string to render digits
-    char buffer[16];
-    snprintf(buffer, sizeof(buffer), "%d", number);
-    
-    float current_x = x;
-    for (int i = 0; buffer[i] != '\0'; i++) {
-        int digit = buffer[i] - '0';
-        if (digit >= 0 && digit <= 9) {
-            const unsigned char *pattern = digit_patterns[digit];
-            
-            // Render the digit
-            for (int row = 0; row < 5; row++) {
-                for (int col = 0; col < 3; col++) {
-                    if (pattern[row] & (1 << (2 - col))) {
-                        SDL_FRect pixel = {
-                            current_x + col * scale,
-                            y + row * scale,
-                            scale,
-                            scale
-                        };
-                        SDL_RenderFillRect(renderer, &pixel);
-                    }
-                }
-            }
-        }
-        
-        // Move to next digit position (3 pixels + 1 space)
-        current_x += 4 * scale;
-    }
-}
-
-// Render text using bitmap font patterns (A-Z, 0-9)
-void render_text(SDL_Renderer *renderer, const char *text, float x, float y, float scale, int r, int g, int b, int a) {
-    // Set the color
-    SDL_SetRenderDrawColor(renderer, r, g, b, a);
-    
+// Render text using bitmap font patterns (A-Z, 0-9). The glyphs are drawn into
+// a texture once, after that this is a single SDL_RenderTexture() until the
+// text, scale or color changes.
+void render_text(SDL_Renderer *renderer, TextCache *cache, const char *text, float x, float y, float scale, int r, int g, int b, int a) {
     // Define character patterns as 5x7 bitmaps for better quality
     // Each character is represented as 7 rows of 5-bit patterns
     static const unsigned char char_patterns[36][7] = {
@@ -721,49 +750,82 @@ void render_text(SDL_Renderer *renderer, const char *text, float x, float y, flo
         {0b01110, 0b10001, 0b10001, 0b01111, 0b00001, 0b00010, 0b01100}
     };
     
-    float current_x = x;
+    SDL_Color color = { (Uint8)r, (Uint8)g, (Uint8)b, (Uint8)a };
+    int width = (int)SDL_ceilf(SDL_strlen(text) * 6 * scale);
+    int height = (int)SDL_ceilf(7 * scale);
     
-    for (int i = 0; text[i] != '\0'; i++) {
-        char c = text[i];
-        int char_index = -1;
+    if (cache->texture && (SDL_strcmp(cache->text, text) != 0 || cache->scale != scale ||
+                           SDL_memcmp(&cache->color, &color, sizeof(color)) != 0)) {
+        SDL_DestroyTexture(cache->texture);
+        cache->texture = NULL;
+    }
+    
+    if (!cache->texture && width > 0) {
+        Uint32 *pixels = (Uint32 *)SDL_calloc((size_t)width * height, sizeof(Uint32));
+        if (!pixels) return;
         
-        // Convert character to index
-        if (c >= 'A' && c <= 'Z') {
-            char_index = c - 'A';
-        } else if (c >= 'a' && c <= 'z') {
-            char_index = c - 'a'; // Convert lowercase to uppercase
-        } else if (c >= '0' && c <= '9') {
-            char_index = 26 + (c - '0');
-        } else if (c == ' ') {
-            // Space character - just advance position
-            current_x += 6 * scale;
-            continue;
-        } else {
-            // Unknown character - skip
-            continue;
-        }
+        Uint32 pixel_color = (Uint32)color.a << 24 | (Uint32)color.r << 16 | (Uint32)color.g << 8 | color.b;
+        float current_x = 0;
         
-        // Render the character
-        if (char_index >= 0 && char_index < 36) {
-            const unsigned char *pattern = char_patterns[char_index];
+        for (int i = 0; text[i] != '\0'; i++) {
+            char c = text[i];
+            int char_index = -1;
+            
+            // Convert character to index
+            if (c >= 'A' && c <= 'Z') {
+                char_index = c - 'A';
+            } else if (c >= 'a' && c <= 'z') {
+                char_index = c - 'a'; // Convert lowercase to uppercase
+            } else if (c >= '0' && c <= '9') {
+                char_index = 26 + (c - '0');
+            } else if (c == ' ') {
+                // Space character - just advance position
+                current_x += 6 * scale;
+                continue;
+            } else {
+                // Unknown character - skip
+                continue;
+            }
             
-            for (int row = 0; row < 7; row++) {
-                for (int col = 0; col < 5; col++) {
-                    if (pattern[row] & (1 << (4 - col))) {
-                        SDL_FRect pixel = {
-                            current_x + col * scale,
-                            y + row * scale,
-                            scale,
-                            scale
-                        };
-                        SDL_RenderFillRect(renderer, &pixel);
+            // Render the character, each lit cell a scale sized square
+            if (char_index >= 0 && char_index < 36) {
+                const unsigned char *pattern = char_patterns[char_index];
+                
+                for (int row = 0; row < 7; row++) {
+                    for (int col = 0; col < 5; col++) {
+                        if (pattern[row] & (1 << (4 - col))) {
+                            int x0 = (int)(current_x + col * scale);
+                            int x1 = SDL_min((int)(current_x + (col + 1) * scale), width);
+                            int y0 = (int)(row * scale);
+                            int y1 = SDL_min((int)((row + 1) * scale), height);
+                            for (int py = y0; py < y1; py++) {
+                                for (int px = x0; px < x1; px++) {
+                                    pixels[py * width + px] = pixel_color;
+                                }
+                            }
+                        }
                     }
                 }
             }
+            
+            // Move to next character position (5 pixels + 1 space)
+            current_x += 6 * scale;
         }
         
-        // Move to next character position (5 pixels + 1 space)
-        current_x += 6 * scale;
+        cache->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, width, height);
+        if (cache->texture) {
+            SDL_UpdateTexture(cache->texture, NULL, pixels, width * 4);
+            SDL_SetTextureBlendMode(cache->texture, SDL_BLENDMODE_BLEND);
+            SDL_strlcpy(cache->text, text, sizeof(cache->text));
+            cache->scale = scale;
+            cache->color = color;
+        }
+        SDL_free(pixels);
+    }
+    
+    if (cache->texture) {
+        SDL_FRect rect = { x, y, (float)width, (float)height };
+        SDL_RenderTexture(renderer, cache->texture, NULL, &rect);
     }
 }
 
@@ -792,6 +854,8 @@ void shoot_projectile(GameState *game) {
     projectile->y = player->y;
     projectile->vy = PROJECTILE_SPEED; // Negative speed means upward
     projectile->active = true;
+    projectile->prev_x = projectile->x;
+    projectile->prev_y = projectile->y;
     
     game->num_projectiles++;
     
@@ -837,14 +901,19 @@ void update_projectiles(GameState *game, float delta_time) {
     game->num_projectiles = write_index;
 }
 
+// Where something is drawn, between its positions before and after the last physics step
+static float interpolate(float prev, float current, float alpha) {
+    return prev + (current - prev) * alpha;
+}
+
 void render_projectiles(GameState *game) {
     for (int i = 0; i < game->num_projectiles; i++) {
         Projectile *projectile = &game->projectiles[i];
         if (!projectile->active) continue;
         
         SDL_FRect dest_rect = {
-            projectile->x,
-            projectile->y - game->camera_y,
+            interpolate(projectile->prev_x, projectile->x, game->render_alpha),
+            interpolate(projectile->prev_y, projectile->y, game->render_alpha) - game->draw_camera_y,
             PROJECTILE_WIDTH,
             PROJECTILE_HEIGHT
         };
@@ -862,15 +931,15 @@ void render_projectiles(GameState *game) {
 
 // Check if there's already a monster nearby to prevent clustering
 bool is_monster_nearby(GameState *game, float x, float y, float min_distance) {
-    for (int i = 0; i < game->num_monsters; i++) {
-        Monster *monster = &game->monsters[i];
+    int end = monster_search(game, y - min_distance);
+    for (int i = monster_search(game, y + min_distance); i < end; i++) {
+        Monster *monster = monster_at(game, i);
         if (!monster->active) continue;
         
         float dx = monster->x - x;
         float dy = monster->y - y;
-        float distance = sqrtf(dx * dx + dy * dy);
         
-        if (distance < min_distance) {
+        if (dx * dx + dy * dy < min_distance * min_distance) {
             return true;
         }
     }
@@ -878,6 +947,28 @@ bool is_monster_nearby(GameState *game, float x, float y, float min_distance) {
 }
 
 // Monster system functions
+
+// The i-th monster from the lowest up
+Monster *monster_at(GameState *game, int i) {
+    return &game->monsters[(game->first_monster + i) % MAX_MONSTERS];
+}
+
+// Position from the lowest of the first monster whose top is above y, like platform_search()
+int monster_search(GameState *game, float y) {
+    int low = 0;
+    int high = game->num_monsters;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (monster_at(game, mid)->y < y) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+// Monsters spawn above the camera, which only goes up, so a new one is always the highest
 void spawn_monster(GameState *game, float x, float y) {
     if (game->num_monsters >= MAX_MONSTERS) return;
     
@@ -886,7 +977,7 @@ void spawn_monster(GameState *game, float x, float y) {
         return;
     }
     
-    Monster *monster = &game->monsters[game->num_monsters];
+    Monster *monster = monster_at(game, game->num_monsters);
     monster->x = x;
     monster->y = y;
     monster->vx = MONSTER_SPEED;
@@ -894,15 +985,18 @@ void spawn_monster(GameState *game, float x, float y) {
     monster->height = MONSTER_HEIGHT;
     monster->type = MONSTER_BASIC;
     monster->active = true;
+    monster->prev_x = monster->x;
+    monster->prev_y = monster->y;
     monster->move_direction = (rand() % 2) * 2 - 1; // Random -1 or 1
     
     game->num_monsters++;
 }
 
 void update_monsters(GameState *game, float delta_time) {
-    // Update all monsters
-    for (int i = 0; i < game->num_monsters; i++) {
-        Monster *monster = &game->monsters[i];
+    // Update the monsters near the screen
+    int end = monster_search(game, game->camera_y - OFFSCREEN_MARGIN - MONSTER_HEIGHT);
+    for (int i = 0; i < end; i++) {
+        Monster *monster = monster_at(game, i);
         if (!monster->active) continue;
         
         // Update position (horizontal movement)
@@ -916,24 +1010,15 @@ void update_monsters(GameState *game, float delta_time) {
             monster->x = WINDOW_WIDTH - monster->width;
             monster->move_direction = -1.0f; // Move left
         }
-        
-        // Deactivate monsters that are too far below the camera (off-screen cleanup)
-        if (monster->y > game->camera_y + WINDOW_HEIGHT + 200) {
-            monster->active = false;
-        }
     }
     
-    // Remove inactive monsters by compacting the array
-    int write_index = 0;
-    for (int read_index = 0; read_index < game->num_monsters; read_index++) {
-        if (game->monsters[read_index].active) {
-            if (write_index != read_index) {
-                game->monsters[write_index] = game->monsters[read_index];
-            }
-            write_index++;
-        }
+    // Remove the lowest monsters once shot or too far below the camera (off-screen cleanup)
+    while (game->num_monsters > 0) {
+        Monster *lowest = monster_at(game, 0);
+        if (lowest->active && lowest->y <= game->camera_y + WINDOW_HEIGHT + OFFSCREEN_MARGIN) break;
+        game->first_monster = (game->first_monster + 1) % MAX_MONSTERS;
+        game->num_monsters--;
     }
-    game->num_monsters = write_index;
     
     // Spawn new monsters based on score
     if (game->score >= MONSTER_SPAWN_SCORE_MIN) {
@@ -942,9 +1027,9 @@ void update_monsters(GameState *game, float delta_time) {
         float screen_top = game->camera_y - WINDOW_HEIGHT;
         float screen_bottom = game->camera_y + WINDOW_HEIGHT;
         
-        for (int i = 0; i < game->num_monsters; i++) {
-            Monster *monster = &game->monsters[i];
-            if (monster->active && monster->y >= screen_top && monster->y <= screen_bottom) {
+        int screen_end = monster_search(game, screen_top);
+        for (int i = monster_search(game, screen_bottom); i < screen_end; i++) {
+            if (monster_at(game, i)->active) {
                 monsters_on_screen++;
             }
         }
@@ -961,8 +1046,8 @@ void update_monsters(GameState *game, float delta_time) {
                 spawn_chance = 0.0005f + progress * 0.0045f; // Increase to 0.005f
             }
             
-            // Try to spawn a monster (small random chance each frame)
-            if ((float)rand() / RAND_MAX < spawn_chance) {
+            // Try to spawn a monster (small random chance each 16ms)
+            if ((float)rand() / RAND_MAX < spawn_chance * delta_time) {
                 float spawn_x = rand() % (WINDOW_WIDTH - MONSTER_WIDTH);
                 float spawn_y = game->camera_y - 100; // Spawn above camera view
                 spawn_monster(game, spawn_x, spawn_y);
@@ -972,20 +1057,21 @@ void update_monsters(GameState *game, float delta_time) {
 }
 
 void render_monsters(GameState *game) {
-    for (int i = 0; i < game->num_monsters; i++) {
-        Monster *monster = &game->monsters[i];
+    int end = monster_search(game, game->draw_camera_y - MONSTER_HEIGHT);
+    for (int i = monster_search(game, game->draw_camera_y + WINDOW_HEIGHT); i < end; i++) {
+        Monster *monster = monster_at(game, i);
         if (!monster->active) continue;
         
         SDL_FRect dest_rect = {
-            monster->x,
-            monster->y - game->camera_y,
+            interpolate(monster->prev_x, monster->x, game->render_alpha),
+            interpolate(monster->prev_y, monster->y, game->render_alpha) - game->draw_camera_y,
             monster->width,
             monster->height
         };
         
-        if (game->monster_basic_texture) {
-            // Render monster texture
-            SDL_RenderTexture(game->renderer, game->monster_basic_texture, NULL, &dest_rect);
+        if (game->monster_basic_sprite.texture) {
+            // Render monster sprite
+            SDL_RenderTexture(game->renderer, game->monster_basic_sprite.texture, &game->monster_basic_sprite.rect, &dest_rect);
         } else {
             // Fallback: render red rectangle
             SDL_SetRenderDrawColor(game->renderer, 255, 0, 0, 255); // Red
@@ -1009,6 +1095,30 @@ bool check_projectile_monster_collision(Projectile *projectile, Monster *monster
 }
 
 // Update game logic
+// Remember where everything is before a physics step, for render interpolation
+void save_positions(GameState *game) {
+    game->player.prev_x = game->player.x;
+    game->player.prev_y = game->player.y;
+    // Only what is simulated moves, what isn't already has prev == current
+    int platforms_end = platform_search(game, game->camera_y - OFFSCREEN_MARGIN - PLATFORM_HEIGHT);
+    for (int i = 0; i < platforms_end; i++) {
+        Platform *platform = platform_at(game, i);
+        platform->prev_x = platform->x;
+        platform->prev_y = platform->y;
+    }
+    for (int i = 0; i < game->num_projectiles; i++) {
+        game->projectiles[i].prev_x = game->projectiles[i].x;
+        game->projectiles[i].prev_y = game->projectiles[i].y;
+    }
+    int monsters_end = monster_search(game, game->camera_y - OFFSCREEN_MARGIN - MONSTER_HEIGHT);
+    for (int i = 0; i < monsters_end; i++) {
+        Monster *monster = monster_at(game, i);
+        monster->prev_x = monster->x;
+        monster->prev_y = monster->y;
+    }
+    game->prev_camera_y = game->camera_y;
+}
+
 void update_game(GameState *game, float delta_time) {
     if (!game->game_running) return;
     
@@ -1028,9 +1138,10 @@ void update_game(GameState *game, float delta_time) {
         player->x = -player->width;
     }
     
-    // Update platforms
-    for (int i = 0; i < game->num_platforms; i++) {
-        Platform *platform = &game->platforms[i];
+    // Update the platforms near the screen, the ones above it start moving once close
+    int platforms_end = platform_search(game, game->camera_y - OFFSCREEN_MARGIN - PLATFORM_HEIGHT);
+    for (int i = 0; i < platforms_end; i++) {
+        Platform *platform = platform_at(game, i);
         if (!platform->active) continue;
         
         // Update moving platforms
@@ -1052,22 +1163,24 @@ void update_game(GameState *game, float delta_time) {
         }
     }
     
-    // Deactivate platforms that are too far below the camera (off-screen cleanup)
-    for (int i = 0; i < game->num_platforms; i++) {
-        Platform *platform = &game->platforms[i];
-        if (platform->active && platform->y > game->camera_y + WINDOW_HEIGHT + 200) {
-            platform->active = false; // Deactivate platforms far below screen
-        }
+    // Remove the lowest platforms once broken or too far below the camera (off-screen cleanup)
+    while (game->num_platforms > 0) {
+        Platform *lowest = platform_at(game, 0);
+        if (lowest->active && lowest->y <= game->camera_y + WINDOW_HEIGHT + OFFSCREEN_MARGIN) break;
+        game->first_platform = (game->first_platform + 1) % MAX_PLATFORMS;
+        game->num_platforms--;
     }
     
     // Generate new platforms as needed for infinite gameplay
     generate_platforms(game, false);
     
-    // Check platform collisions
+    // Check platform collisions, only the ones level with the player
     player->on_ground = false;
-    for (int i = 0; i < game->num_platforms; i++) {
-        if (check_platform_collision(player, &game->platforms[i])) {
-            Platform *platform = &game->platforms[i];
+    int collide_end = platform_search(game, player->y - PLATFORM_HEIGHT);
+    for (int i = platform_search(game, player->y + player->height); i < collide_end; i++) {
+        Platform *platform = platform_at(game, i);
+        if (check_platform_collision(player, platform)) {
+            int slot = (int)(platform - game->platforms);
             
             player->y = platform->y - player->height;
             
@@ -1088,9 +1201,9 @@ void update_game(GameState *game, float delta_time) {
             }
             
             // Increment platforms landed counter if this is a new platform
-            if (i != game->last_platform_landed) {
+            if (slot != game->last_platform_landed) {
                 game->platforms_landed++;
-                game->last_platform_landed = i;
+                game->last_platform_landed = slot;
             }
             break;
         }
@@ -1105,27 +1218,37 @@ void update_game(GameState *game, float delta_time) {
     // Update monsters
     update_monsters(game, delta_time);
     
-    // Check projectile-monster collisions
+    // Check projectile-monster collisions, only for the monsters level with some projectile
+    float projectiles_top = 0;
+    float projectiles_bottom = 0;
     for (int i = 0; i < game->num_projectiles; i++) {
         Projectile *projectile = &game->projectiles[i];
-        if (!projectile->active) continue;
+        if (i == 0 || projectile->y < projectiles_top) projectiles_top = projectile->y;
+        if (i == 0 || projectile->y + PROJECTILE_HEIGHT > projectiles_bottom) projectiles_bottom = projectile->y + PROJECTILE_HEIGHT;
+    }
+    
+    int shootable_end = game->num_projectiles ? monster_search(game, projectiles_top - MONSTER_HEIGHT) : 0;
+    for (int i = monster_search(game, projectiles_bottom); i < shootable_end; i++) {
+        Monster *monster = monster_at(game, i);
+        if (!monster->active) continue;
         
-        for (int j = 0; j < game->num_monsters; j++) {
-            Monster *monster = &game->monsters[j];
-            if (!monster->active) continue;
+        for (int j = 0; j < game->num_projectiles; j++) {
+            Projectile *projectile = &game->projectiles[j];
+            if (!projectile->active) continue;
             
             if (check_projectile_monster_collision(projectile, monster)) {
                 // Destroy both projectile and monster
                 projectile->active = false;
                 monster->active = false;
-                break; // Exit inner loop since projectile is destroyed
+                break; // Exit inner loop since monster is destroyed
             }
         }
     }
     
     // Check player-monster collisions (game over)
-    for (int i = 0; i < game->num_monsters; i++) {
-        Monster *monster = &game->monsters[i];
+    int monsters_end = monster_search(game, player->y - MONSTER_HEIGHT);
+    for (int i = monster_search(game, player->y + player->height); i < monsters_end; i++) {
+        Monster *monster = monster_at(game, i);
         if (!monster->active) continue;
         
         if (check_monster_collision(player, monster)) {
@@ -1146,6 +1269,61 @@ void update_game(GameState *game, float delta_time) {
     }
 }
 
+#ifdef BADGEVMS_BUILD
+// Angle of gravity in the plane of the screen, like the driver's orientation
+static float tilt_angle(const motion_sample_t *sample) {
+    return atan2f(sample->accel[0], sample->accel[1]) * 180.0f / (float)M_PI;
+}
+
+// Difference between two angles in [-180, 180)
+static float tilt_difference(float a, float b) {
+    float d = fmodf(a - b + 180.0f, 360.0f);
+    return d < 0 ? d + 180.0f : d - 180.0f;
+}
+
+void open_tilt(GameState *game) {
+    game->motion_fd = open("ORIENTATION0:", O_RDONLY);
+    if (game->motion_fd < 0) {
+        printf("Warning: BMI270 orientation sensor not found - tilt controls disabled\n");
+    }
+}
+
+// Take in whatever the sensor queued since the last frame, read() doesn't wait
+void update_tilt(GameState *game) {
+    motion_sample_t samples[TILT_READ_SAMPLES];
+    ssize_t n;
+
+    if (game->motion_fd < 0) {
+        return;
+    }
+
+    while ((n = read(game->motion_fd, samples, sizeof(samples))) > 0) {
+        for (int i = 0; i < n / (ssize_t)sizeof(motion_sample_t); i++) {
+            if (samples[i].accel[0] == 0 && samples[i].accel[1] == 0) {
+                continue; // Lying flat, no gravity to go by
+            }
+            float angle = tilt_angle(&samples[i]);
+
+            if (game->tilt_samples < TILT_CALIBRATION) {
+                if (game->tilt_samples == 0) {
+                    game->tilt_zero = angle;
+                    game->tilt = angle;
+                }
+                game->tilt_sum += tilt_difference(angle, game->tilt_zero);
+                if (++game->tilt_samples == TILT_CALIBRATION) {
+                    game->tilt_zero += game->tilt_sum / TILT_CALIBRATION;
+                }
+            }
+
+            game->tilt += TILT_SMOOTHING * tilt_difference(angle, game->tilt);
+        }
+        if (n < (ssize_t)sizeof(samples)) {
+            break;
+        }
+    }
+}
+#endif
+
 // Handle player input
 void handle_input(GameState *game, const bool *keyboard_state, float delta_time) {
     Player *player = &game->player;
@@ -1164,38 +1342,16 @@ void handle_input(GameState *game, const bool *keyboard_state, float delta_time)
     }
     
 #ifdef BADGEVMS_BUILD
-    // BMI270 tilt controls (if sensor is available)
-    if (game->orientation != NULL) {
-        int degrees = game->orientation->_get_orientation_degrees(game->orientation);
-        
-        // Convert tilt angle to movement speed
-        // Tilt range: -45° to +45° for left/right movement
-        // 0° = no movement, -45° = full left, +45° = full right
-        if (degrees >= 0 && degrees <= 180) {
-            // Right tilt (0° to 45°)
-            if (degrees <= 45) {
-                float tilt_factor = (float)degrees / 45.0f; // 0.0 to 1.0
-                target_vx = PLAYER_SPEED * tilt_factor;
-                if (tilt_factor > 0.1f) player->facing_direction = 1; // Face right
-            }
-            // Left tilt (135° to 180°, then 180° to 225° mapped to negative)
-            else if (degrees >= 135) {
-                float tilt_factor;
-                if (degrees <= 180) {
-                    tilt_factor = (180.0f - (float)degrees) / 45.0f; // 1.0 to 0.0
-                } else {
-                    tilt_factor = ((float)degrees - 180.0f) / 45.0f; // 0.0 to 1.0
-                }
-                target_vx = -PLAYER_SPEED * tilt_factor;
-                if (tilt_factor > 0.1f) player->facing_direction = -1; // Face left
-            }
-        } else if (degrees > 180) {
-            // Handle 315° to 360° range (left tilt)
-            if (degrees >= 315) {
-                float tilt_factor = (360.0f - (float)degrees) / 45.0f; // 1.0 to 0.0
-                target_vx = -PLAYER_SPEED * tilt_factor;
-                if (tilt_factor > 0.1f) player->facing_direction = -1; // Face left
-            }
+    // BMI270 tilt controls, once the zero is known
+    update_tilt(game);
+    if (game->motion_fd >= 0 && game->tilt_samples >= TILT_CALIBRATION && !game->left_pressed && !game->right_pressed) {
+        // Tilting to the right is a positive angle
+        float tilt_factor = tilt_difference(game->tilt, game->tilt_zero) / TILT_MAX_DEGREES;
+        tilt_factor = SDL_clamp(tilt_factor, -1.0f, 1.0f);
+
+        if (fabsf(tilt_factor) > TILT_DEAD_ZONE) {
+            target_vx = PLAYER_SPEED * tilt_factor;
+            player->facing_direction = tilt_factor > 0 ? 1 : -1;
         }
     }
 #endif
@@ -1204,8 +1360,8 @@ void handle_input(GameState *game, const bool *keyboard_state, float delta_time)
     if (target_vx != 0) {
         player->vx += (target_vx - player->vx) * PLAYER_ACCELERATION * delta_time;
     } else {
-        // Apply friction when no input
-        player->vx *= PLAYER_FRICTION;
+        // Apply friction when no input, PLAYER_FRICTION is per 16ms
+        player->vx *= powf(PLAYER_FRICTION, delta_time);
     }
     
     // Shooting input - use event-based controls
@@ -1221,40 +1377,96 @@ void handle_input(GameState *game, const bool *keyboard_state, float delta_time)
 
 void renderBackground(GameState *game){
     if (game->background_texture) {
-        // Get background texture dimensions
+        // Already scaled to the window width by load_background(), copied as is
         float tex_width, tex_height;
         SDL_GetTextureSize(game->background_texture, &tex_width, &tex_height);
 
-        // Calculate scale to fit width and maintain aspect ratio
-        float scale = (float)WINDOW_WIDTH / tex_width;
-        float scaled_height = tex_height * scale;
+        // Center the background vertically
+        float bg_y = SDL_floorf((WINDOW_HEIGHT - tex_height) / 2.0f);
 
-        // Center the background vertically (allow height overflow)
-        float bg_y = (WINDOW_HEIGHT - scaled_height) / 2.0f;
-
-        SDL_FRect bg_rect = {0, bg_y, WINDOW_WIDTH, scaled_height};
+        SDL_FRect bg_rect = {0, bg_y, tex_width, tex_height};
         SDL_RenderTexture(game->renderer, game->background_texture, NULL, &bg_rect);
     }
 }
 
+// Game over screen with big banner, over the background
+void render_game_over(GameState *game) {
+    renderBackground(game);
+    
+    // Large "GAME OVER" banner using our new text rendering function
+    float text_scale = 6.5f; // Make it much bigger
+    float text_x = WINDOW_WIDTH / 2 - (strlen("GAME OVER") * 6 * text_scale) / 2; // Center text
+    float text_y = (WINDOW_HEIGHT / 2 - (7 * text_scale) / 2) - 60; // Center vertically
+    
+    // Create bold effect by rendering multiple times with slight offsets
+    // Shadow effect (darker red)
+    render_text(game->renderer, &game->game_over_shadow_text, "GAME OVER", text_x + 2, text_y + 2, text_scale, 128, 0, 0, 255);
+    // Main text (bright red)
+    render_text(game->renderer, &game->game_over_text, "GAME OVER", text_x, text_y, text_scale, 255, 0, 0, 255);
+    // Bold effect (render again slightly offset)
+    render_text(game->renderer, &game->game_over_text, "GAME OVER", text_x + 1, text_y, text_scale, 255, 0, 0, 255);
+    render_text(game->renderer, &game->game_over_text, "GAME OVER", text_x, text_y + 1, text_scale, 255, 0, 0, 255);
+    
+    // Score display below banner
+    char score_text[32];
+    snprintf(score_text, sizeof(score_text), "SCORE %d", game->score);
+    float score_text_scale = 2.0f;
+    float score_text_x = WINDOW_WIDTH / 2 - (strlen(score_text) * 6 * score_text_scale) / 2;
+    float score_text_y = WINDOW_HEIGHT / 2 + 40;
+    
+    render_text(game->renderer, &game->score_text, score_text, score_text_x, score_text_y, score_text_scale, 0, 0, 0, 255); // Black text
+    
+    // Restart hint - "PRESS R" 
+    float hint_text_scale = 1.5f;
+    float hint_text_x = WINDOW_WIDTH / 2 - (strlen("PRESS R") * 6 * hint_text_scale) / 2;
+    float hint_text_y = WINDOW_HEIGHT / 2 + 100;
+    
+    render_text(game->renderer, &game->hint_text, "PRESS R", hint_text_x, hint_text_y, hint_text_scale, 255, 165, 0, 255);
+}
+
+// Whether the background hides everything behind it
+static bool background_covers_screen(GameState *game) {
+    if (!game->background_texture) return false;
+    
+    SDL_BlendMode blend_mode;
+    float tex_width, tex_height;
+    if (!SDL_GetTextureBlendMode(game->background_texture, &blend_mode) || blend_mode != SDL_BLENDMODE_NONE) return false;
+    if (!SDL_GetTextureSize(game->background_texture, &tex_width, &tex_height)) return false;
+    
+    return tex_width >= WINDOW_WIDTH && tex_height >= WINDOW_HEIGHT;
+}
+
 // Render the game
 void render_game(GameState *game) {
-    // Clear screen
-    SDL_SetRenderDrawColor(game->renderer, 135, 206, 235, 255); // Sky blue fallback
-    SDL_RenderClear(game->renderer);
+    game->draw_camera_y = interpolate(game->prev_camera_y, game->camera_y, game->render_alpha);
+    bool background_covers = background_covers_screen(game);
+    
+    // The game over screen's background hides the game, don't draw it underneath
+    if (!game->game_running && background_covers) {
+        render_game_over(game);
+        SDL_RenderPresent(game->renderer);
+        return;
+    }
+    
+    // Clear screen, unless the background is about to cover all of it
+    if (!background_covers) {
+        SDL_SetRenderDrawColor(game->renderer, 135, 206, 235, 255); // Sky blue fallback
+        SDL_RenderClear(game->renderer);
+    }
     
     // Render background if available
     renderBackground(game);
  
-    // Render platforms
-    for (int i = 0; i < game->num_platforms; i++) {
-        Platform *platform = &game->platforms[i];
+    // Render the platforms on screen
+    int platforms_end = platform_search(game, game->draw_camera_y - PLATFORM_HEIGHT);
+    for (int i = platform_search(game, game->draw_camera_y + WINDOW_HEIGHT); i < platforms_end; i++) {
+        Platform *platform = platform_at(game, i);
         if (!platform->active) continue;
         
         // Convert world coordinates to screen coordinates
         SDL_FRect rect = {
-            platform->x,
-            platform->y - game->camera_y,
+            interpolate(platform->prev_x, platform->x, game->render_alpha),
+            interpolate(platform->prev_y, platform->y, game->render_alpha) - game->draw_camera_y,
             platform->width,
             platform->height
         };
@@ -1262,29 +1474,29 @@ void render_game(GameState *game) {
         // Only render if platform is visible on screen
         if (rect.y > -platform->height && rect.y < WINDOW_HEIGHT + platform->height) {
             // Try to use texture first, fall back to colored rectangle
-            SDL_Texture *texture = NULL;
+            const Sprite *sprite = NULL;
             switch (platform->type) {
                 case PLATFORM_NORMAL:
-                    texture = game->platform_normal_texture;
+                    sprite = &game->platform_normal_sprite;
                     SDL_SetRenderDrawColor(game->renderer, 34, 139, 34, 255); // Forest green fallback
                     break;
                 case PLATFORM_MOVING:
-                    texture = game->platform_moving_texture;
+                    sprite = &game->platform_moving_sprite;
                     SDL_SetRenderDrawColor(game->renderer, 255, 165, 0, 255); // Orange fallback
                     break;
                 case PLATFORM_BREAKABLE:
-                    texture = game->platform_breakable_texture;
+                    sprite = &game->platform_breakable_sprite;
                     SDL_SetRenderDrawColor(game->renderer, 139, 69, 19, 255); // Brown fallback
                     break;
                 case PLATFORM_SPRING:
-                    texture = game->platform_spring_texture;
+                    sprite = &game->platform_spring_sprite;
                     SDL_SetRenderDrawColor(game->renderer, 255, 20, 147, 255); // Deep pink fallback
                     break;
             }
             
-            if (texture) {
-                // Render using texture
-                SDL_RenderTexture(game->renderer, texture, NULL, &rect);
+            if (sprite && sprite->texture) {
+                // Render using the sprite sheet
+                SDL_RenderTexture(game->renderer, sprite->texture, &sprite->rect, &rect);
             } else {
                 // Fallback to colored rectangle
                 SDL_RenderFillRect(game->renderer, &rect);
@@ -1298,10 +1510,14 @@ void render_game(GameState *game) {
     // Render monsters
     render_monsters(game);
     
-    // Render player
+    // Render player, snapping rather than sliding across the screen when it wraps around
+    float player_x = game->player.x;
+    if (fabsf(player_x - game->player.prev_x) < WINDOW_WIDTH / 2) {
+        player_x = interpolate(game->player.prev_x, player_x, game->render_alpha);
+    }
     SDL_FRect player_rect = {
-        game->player.x,
-        game->player.y - game->camera_y,
+        player_x,
+        interpolate(game->player.prev_y, game->player.y, game->render_alpha) - game->draw_camera_y,
         game->player.width,
         game->player.height
     };
@@ -1335,47 +1551,114 @@ void render_game(GameState *game) {
     // Render the score using our new text rendering function
     char score_text[32];
     snprintf(score_text, sizeof(score_text), "SCORE %d", game->score);
-    render_text(game->renderer, score_text, 10, 10, 2.0f, 0, 0, 0, 255); // Black text
+    render_text(game->renderer, &game->score_text, score_text, 10, 10, 2.0f, 0, 0, 0, 255); // Black text
     
     // Game over screen with big banner
     if (!game->game_running) {
+        render_game_over(game);
+    }
+    
+    SDL_RenderPresent(game->renderer);
+}
 
+// Feed the benchmark's input for this physics step, or record the player's
+static void benchmark_input(GameState *game) {
+    Benchmark *benchmark = &game->benchmark;
+    
+    if (benchmark->enabled) {
+        Uint32 step = benchmark->step % BENCHMARK_LOOP_STEPS;
+        if (step == 0) benchmark->next_input = 0;
         
-        renderBackground(game);
-
-        
-        // Large "GAME OVER" banner using our new text rendering function
-        float text_scale = 6.5f; // Make it much bigger
-        float text_x = WINDOW_WIDTH / 2 - (strlen("GAME OVER") * 6 * text_scale) / 2; // Center text
-        float text_y = (WINDOW_HEIGHT / 2 - (7 * text_scale) / 2) - 60; // Center vertically
-        
-        // Create bold effect by rendering multiple times with slight offsets
-        // Shadow effect (darker red)
-        render_text(game->renderer, "GAME OVER", text_x + 2, text_y + 2, text_scale, 128, 0, 0, 255);
-        // Main text (bright red)
-        render_text(game->renderer, "GAME OVER", text_x, text_y, text_scale, 255, 0, 0, 255);
-        // Bold effect (render again slightly offset)
-        render_text(game->renderer, "GAME OVER", text_x + 1, text_y, text_scale, 255, 0, 0, 255);
-        render_text(game->renderer, "GAME OVER", text_x, text_y + 1, text_scale, 255, 0, 0, 255);
-        
-        // Score display below banner
-        char score_text[32];
-        snprintf(score_text, sizeof(score_text), "SCORE %d", game->score);
-        float score_text_scale = 2.0f;
-        float score_text_x = WINDOW_WIDTH / 2 - (strlen(score_text) * 6 * score_text_scale) / 2;
-        float score_text_y = WINDOW_HEIGHT / 2 + 40;
-        
-        render_text(game->renderer, score_text, score_text_x, score_text_y, score_text_scale, 0, 0, 0, 0); // Black text
-        
-        // Restart hint - "PRESS R" 
-        float hint_text_scale = 1.5f;
-        float hint_text_x = WINDOW_WIDTH / 2 - (strlen("PRESS R") * 6 * hint_text_scale) / 2;
-        float hint_text_y = WINDOW_HEIGHT / 2 + 100;
+        int num_inputs = (int)SDL_arraysize(benchmark_inputs);
+        while (benchmark->next_input < num_inputs && benchmark_inputs[benchmark->next_input].step <= step) {
+            const BenchmarkInput *input = &benchmark_inputs[benchmark->next_input++];
+            game->left_pressed = input->left;
+            game->right_pressed = input->right;
+            game->shoot_pressed = input->shoot;
+        }
         
-        render_text(game->renderer, "PRESS R", hint_text_x, hint_text_y, hint_text_scale, 255, 165, 0, 255);
+        // Play on right away
+        game->restart_pressed = !game->game_running;
+    } else if (benchmark->record) {
+        BenchmarkInput input = { benchmark->step, game->left_pressed, game->right_pressed, game->shoot_pressed };
+        if (input.left != benchmark->last_input.left || input.right != benchmark->last_input.right ||
+            input.shoot != benchmark->last_input.shoot) {
+            printf("    {%u, %s, %s, %s},\n", (unsigned)input.step, input.left ? "true" : "false",
+                   input.right ? "true" : "false", input.shoot ? "true" : "false");
+            benchmark->last_input = input;
+        }
     }
     
-    SDL_RenderPresent(game->renderer);
+    benchmark->step++;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    Uint64 x = *(const Uint64 *)a;
+    Uint64 y = *(const Uint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void benchmark_report(GameState *game) {
+    Benchmark *benchmark = &game->benchmark;
+    int frames = benchmark->frame;
+    if (!frames) return;
+    
+    Uint64 total_ns = 0;
+    for (int i = 0; i < frames; i++) {
+        total_ns += benchmark->frame_ns[i];
+    }
+    SDL_qsort(benchmark->frame_ns, frames, sizeof(Uint64), compare_ns);
+    
+    printf("benchmark: %d frames, %u steps\n", frames, (unsigned)benchmark->step);
+    printf("frame: min %lu avg %lu p99 %lu max %lu us\n",
+           (unsigned long)(benchmark->frame_ns[0] / 1000),
+           (unsigned long)(total_ns / frames / 1000),
+           (unsigned long)(benchmark->frame_ns[(frames - 1) * 99 / 100] / 1000),
+           (unsigned long)(benchmark->frame_ns[frames - 1] / 1000));
+    printf("update: avg %lu us, render: avg %lu us\n",
+           (unsigned long)(benchmark->update_ns / frames / 1000),
+           (unsigned long)(benchmark->render_ns / frames / 1000));
+    
+#ifdef BADGEVMS_BUILD
+    process_info_t info;
+    if (process_info_get(getpid(), &info)) {
+        printf("memory: heap peak %lu KiB in %lu pages, framebuffers %lu pages\n",
+               (unsigned long)(info.heap_used_peak / 1024),
+               (unsigned long)info.heap_peak_pages,
+               (unsigned long)info.framebuffer_pages);
+    }
+#endif
+}
+
+// A fixed number of physics steps per frame, no waiting for anything
+static SDL_AppResult benchmark_iterate(GameState *game) {
+    Benchmark *benchmark = &game->benchmark;
+    const bool *keyboard_state = SDL_GetKeyboardState(NULL);
+    const float delta_time = PHYSICS_STEP_MS / 16.0f;
+    
+    Uint64 start = SDL_GetTicksNS();
+    for (int i = 0; i < BENCHMARK_STEPS_PER_FRAME; i++) {
+        save_positions(game);
+        benchmark_input(game);
+        handle_input(game, keyboard_state, delta_time);
+        update_game(game, delta_time);
+    }
+    Uint64 updated = SDL_GetTicksNS();
+    
+    game->render_alpha = 1.0f;
+    render_game(game);
+    Uint64 rendered = SDL_GetTicksNS();
+    
+    benchmark->update_ns += updated - start;
+    benchmark->render_ns += rendered - updated;
+    benchmark->frame_ns[benchmark->frame++] = rendered - start;
+    
+    if (benchmark->frame < benchmark->frames) {
+        return SDL_APP_CONTINUE;
+    }
+    
+    benchmark_report(game);
+    return SDL_APP_SUCCESS;
 }
 
 // SDL Callback functions
@@ -1392,6 +1675,24 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
     
     *appstate = game;
     
+    if (argc > 1 && SDL_strcmp(argv[1], "benchmark") == 0) {
+        game->benchmark.enabled = true;
+        game->benchmark.frames = argc > 2 ? SDL_atoi(argv[2]) : BENCHMARK_FRAMES;
+        if (game->benchmark.frames <= 0) game->benchmark.frames = BENCHMARK_FRAMES;
+        game->benchmark.frame_ns = (Uint64 *)SDL_calloc(game->benchmark.frames, sizeof(Uint64));
+        if (!game->benchmark.frame_ns) {
+            return SDL_APP_FAILURE;
+        }
+        
+        // The same platforms and monsters every run
+        Uint64 seed = argc > 3 ? (Uint64)SDL_atoi(argv[3]) : BENCHMARK_SEED;
+        SDL_srand(seed);
+        srand((unsigned)seed);
+        printf("Benchmark: %d frames, seed %lu\n", game->benchmark.frames, (unsigned long)seed);
+    } else if (argc > 1 && SDL_strcmp(argv[1], "record") == 0) {
+        game->benchmark.record = true;
+    }
+    
     // Create fullscreen window
     game->window = SDL_CreateWindow("Doodle Jump - BadgeVMS", WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_FULLSCREEN);
     if (!game->window) {
@@ -1406,6 +1707,17 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
         return SDL_APP_FAILURE;
     }
     
+#ifdef BADGEVMS_BUILD
+    // The benchmark steers itself
+    game->motion_fd = -1;
+    if (!game->benchmark.enabled) {
+        open_tilt(game);
+    }
+#endif
+
+    // Load game textures, once and not on every restart
+    load_game_textures(game);
+
     // Initialize game
     init_game(game);
     game->last_time = (Uint32)SDL_GetTicks();  // Cast to 32-bit
@@ -1416,24 +1728,47 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
 SDL_AppResult SDL_AppIterate(void *appstate) {
     GameState *game = (GameState *)appstate;
     
+    if (game->benchmark.enabled) {
+        return benchmark_iterate(game);
+    }
+    
     // Calculate delta time using 32-bit arithmetic to avoid __floatundisf
     Uint32 current_time = (Uint32)SDL_GetTicks();  // Cast to 32-bit
     Uint32 time_diff = current_time - game->last_time;
     
-    // Cap delta_time to prevent physics explosions on first frame or long pauses
-    if (time_diff > 100) time_diff = 100;  // Max 100ms per frame
+    // Cap the catching up after the first frame or long pauses
+    if (time_diff > PHYSICS_MAX_FRAME_MS) time_diff = PHYSICS_MAX_FRAME_MS;
     
-    float delta_time = (float)time_diff / 16.0f; // Normalize to ~60 FPS
     game->last_time = current_time;
+    game->physics_accumulator += (float)time_diff;
     
-    // Handle input
+    // Step the physics at a fixed rate, the same jumps whatever the frame rate
     const bool *keyboard_state = SDL_GetKeyboardState(NULL);
-    handle_input(game, keyboard_state, delta_time);
+    const float delta_time = PHYSICS_STEP_MS / 16.0f; // Normalize to the ~60 FPS units
+    while (game->physics_accumulator >= PHYSICS_STEP_MS) {
+        save_positions(game);
+        benchmark_input(game);
+        handle_input(game, keyboard_state, delta_time);
+        update_game(game, delta_time);
+        game->physics_accumulator -= PHYSICS_STEP_MS;
+    }
     
-    // Update game
-    update_game(game, delta_time);
+    // The game over screen doesn't change, draw it once and then only run when a key is pressed
+    if (!game->game_running) {
+        if (!game->game_over_drawn) {
+            render_game(game);
+            game->game_over_drawn = true;
+            SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "waitevent");
+        }
+        return SDL_APP_CONTINUE;
+    }
+    if (game->game_over_drawn) {
+        game->game_over_drawn = false;
+        SDL_ResetHint(SDL_HINT_MAIN_CALLBACK_RATE);
+    }
     
-    // Render game
+    // Render game, the remainder is how far we are into the next step
+    game->render_alpha = game->physics_accumulator / PHYSICS_STEP_MS;
     render_game(game);
     
     return SDL_APP_CONTINUE;
@@ -1498,6 +1833,12 @@ void SDL_AppQuit(void *appstate, SDL_AppResult result) {
     if (appstate != NULL) {
         GameState *game = (GameState *)appstate;
         cleanup_textures(game);
+        SDL_free(game->benchmark.frame_ns);
+#ifdef BADGEVMS_BUILD
+        if (game->motion_fd >= 0) {
+            close(game->motion_fd);
+        }
+#endif
         SDL_DestroyRenderer(game->renderer);
         SDL_DestroyWindow(game->window);
         SDL_free(game);
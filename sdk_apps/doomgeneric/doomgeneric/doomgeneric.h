@@ -13,6 +13,9 @@
 #endif  // DOOMGENERIC_RESY
 
 
+// BadgeVMS: the compositor looks the palette up, see doomgeneric_badgevms.c
+#define CMAP256
+
 #ifdef CMAP256
 
 typedef uint8_t pixel_t;
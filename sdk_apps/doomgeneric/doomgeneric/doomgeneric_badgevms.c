@@ -1,9 +1,9 @@
 //doomgeneric for cross-platform development library 'Simple DirectMedia Layer'
 
+#include "doomgeneric.h"
 #include "doomkeys.h"
 #include "i_video.h"
 #include "m_argv.h"
-#include "doomgeneric.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -150,8 +150,8 @@ static void handleKeyInput()
 void DG_Init()
 {
   window = window_create("DOOM", (window_size_t){DOOMGENERIC_RESX, DOOMGENERIC_RESY}, WINDOW_FLAG_DOUBLE_BUFFERED);
-  // Let BadgeVMS do hardware scaling for us
-  framebuffer = window_framebuffer_create(window, (window_size_t){SCREENWIDTH, SCREENHEIGHT}, BADGEVMS_PIXELFORMAT_BGR565);
+  // Let BadgeVMS do hardware scaling for us, and the palette lookup
+  framebuffer = window_framebuffer_create(window, (window_size_t){SCREENWIDTH, SCREENHEIGHT}, BADGEVMS_PIXELFORMAT_INDEX8);
 
   DG_ScreenBuffer = (void*)framebuffer->pixels;
   clock_gettime(CLOCK_MONOTONIC, &start_time);
@@ -159,13 +159,22 @@ void DG_Init()
 
 void DG_DrawFrame()
 {
+    if (palette_changed) {
+      uint32_t palette[256];
+      for (int i = 0; i < 256; i++) {
+        palette[i] = (colors[i].r << 16) | (colors[i].g << 8) | colors[i].b;
+      }
+      window_palette_set(window, palette, 0, 256);
+      palette_changed = false;
+    }
+
     window_present(window, false, NULL, 0);
     handleKeyInput();
 }
 
 void DG_SleepMs(uint32_t ms)
 {
-  usleep(ms);
+  usleep(ms * 1000);
 }
 
 uint32_t DG_GetTicksMs()
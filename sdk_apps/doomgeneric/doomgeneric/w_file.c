@@ -26,6 +26,7 @@
 #include "w_file.h"
 
 extern wad_file_class_t stdc_wad_file;
+extern wad_file_class_t badgevms_wad_file;
 
 /*
 #ifdef _WIN32
@@ -47,6 +48,7 @@ static wad_file_class_t *wad_file_classes[] =
 #ifdef HAVE_MMAP
     &posix_wad_file,
 #endif
+    &badgevms_wad_file,
     &stdc_wad_file,
 };
 
@@ -60,7 +62,9 @@ wad_file_t *W_OpenFile(char *path)
     // directly into memory.
     //
 
-    if (!M_CheckParm("-mmap"))
+    // BadgeVMS: mapped unless told otherwise, see w_file_badgevms.c
+
+    if (M_CheckParm("-nommap"))
     {
         return stdc_wad_file.OpenFile(path);
     }
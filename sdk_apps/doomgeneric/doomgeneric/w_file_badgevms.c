@@ -0,0 +1,88 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	WAD I/O functions, BadgeVMS: the whole WAD mapped with file_map().
+//	W_CacheLumpNum() then points straight into it, instead of reading
+//	every lump into the zone a small read at a time.
+//
+
+#include <string.h>
+
+#include "w_file.h"
+#include "z_zone.h"
+
+// After doomtype.h, which has its own true and false
+#include <badgevms/misc_funcs.h>
+
+extern wad_file_class_t badgevms_wad_file;
+
+static wad_file_t *W_BadgeVMS_OpenFile(char *path)
+{
+    wad_file_t *result;
+    void const *mapped;
+    size_t length;
+
+    mapped = file_map(path, &length);
+
+    if (mapped == NULL)
+    {
+        return NULL;
+    }
+
+    // The mapping is shared with every other process that has the WAD
+    // mapped, lumps are only ever read.
+
+    result = Z_Malloc(sizeof(wad_file_t), PU_STATIC, 0);
+    result->file_class = &badgevms_wad_file;
+    result->mapped = (byte *) mapped;
+    result->length = length;
+
+    return result;
+}
+
+static void W_BadgeVMS_CloseFile(wad_file_t *wad)
+{
+    file_unmap(wad->mapped);
+    Z_Free(wad);
+}
+
+// Read data from the specified position in the file into the
+// provided buffer.  Returns the number of bytes read.
+
+size_t W_BadgeVMS_Read(wad_file_t *wad, unsigned int offset,
+                       void *buffer, size_t buffer_len)
+{
+    if (offset >= wad->length)
+    {
+        return 0;
+    }
+
+    if (buffer_len > wad->length - offset)
+    {
+        buffer_len = wad->length - offset;
+    }
+
+    memcpy(buffer, wad->mapped + offset, buffer_len);
+
+    return buffer_len;
+}
+
+
+wad_file_class_t badgevms_wad_file =
+{
+    W_BadgeVMS_OpenFile,
+    W_BadgeVMS_CloseFile,
+    W_BadgeVMS_Read,
+};
@@ -0,0 +1,131 @@
+#include "badgevms/application.h"
+#include "badgevms/process.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#define POLL_MS 10
+
+static char const *image_name(process_image_t image) {
+    switch (image) {
+        case PROCESS_IMAGE_CACHED: return "cached";
+        case PROCESS_IMAGE_PRELINKED: return "prelinked";
+        default: return "loaded";
+    }
+}
+
+// Launch unique_identifier and wait until it presented a window, or settle_ms
+// after it reached main() for programs without one, then kill it
+static bool launch_once(char const *unique_identifier, int settle_ms, process_launch_t *launch) {
+    memset(launch, 0, sizeof(process_launch_t));
+
+    pid_t pid = application_launch(unique_identifier);
+    if (pid == -1) {
+        return false;
+    }
+
+    int  settled = 0;
+    bool alive   = true;
+    while ((alive = process_launch_get(pid, launch))) {
+        if (launch->first_present_us || (launch->total_us && settled >= settle_ms)) {
+            break;
+        }
+        if (launch->total_us) {
+            settled += POLL_MS;
+        }
+        usleep(POLL_MS * 1000);
+    }
+
+    if (alive) {
+        process_kill(pid);
+    }
+    while (wait(true, 0) != pid) {
+    }
+
+    // It may have exited before we got its report
+    return launch->total_us != 0;
+}
+
+// launch_bench [runs] [settle_ms] [output]
+//
+// Launches every installed application runs times, one at a time, and writes
+// where the time went to output, one CSV line per launch. The first launch of
+// a program reads and relocates it, later ones find it prelinked.
+int main(int argc, char *argv[]) {
+    int         runs      = argc > 1 ? atoi(argv[1]) : 5;
+    int         settle_ms = argc > 2 ? atoi(argv[2]) : 1000;
+    char const *output    = argc > 3 ? argv[3] : "SD0:launch_bench.csv";
+
+    FILE *f = fopen(output, "w");
+    if (!f) {
+        printf("Unable to open %s\n", output);
+        return 1;
+    }
+    fprintf(
+        f,
+        "app,run,image,spawn_us,open_us,map_us,read_us,relocate_us,relocations,cache_us,writeback_us,total_us,"
+        "first_present_us\n"
+    );
+
+    application_t          *app;
+    application_list_handle list = application_list(&app);
+    for (; app; app = application_list_get_next(list)) {
+        if (!app->binary_path || !strcmp(app->unique_identifier, "launch_bench")) {
+            continue;
+        }
+
+        uint32_t min = UINT32_MAX, max = 0;
+        uint64_t sum      = 0;
+        int      launched = 0;
+        for (int run = 0; run < runs; ++run) {
+            process_launch_t launch;
+            if (!launch_once(app->unique_identifier, settle_ms, &launch)) {
+                printf("Unable to launch %s\n", app->unique_identifier);
+                break;
+            }
+
+            fprintf(
+                f,
+                "%s,%d,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+                app->unique_identifier,
+                run,
+                image_name(launch.image),
+                (unsigned long)launch.spawn_us,
+                (unsigned long)launch.open_us,
+                (unsigned long)launch.map_us,
+                (unsigned long)launch.read_us,
+                (unsigned long)launch.relocate_us,
+                (unsigned long)launch.relocations,
+                (unsigned long)launch.cache_us,
+                (unsigned long)launch.writeback_us,
+                (unsigned long)launch.total_us,
+                (unsigned long)launch.first_present_us
+            );
+
+            min  = launch.total_us < min ? launch.total_us : min;
+            max  = launch.total_us > max ? launch.total_us : max;
+            sum += launch.total_us;
+            ++launched;
+        }
+
+        if (launched) {
+            printf(
+                "%s: %d launches, until main() min %lu avg %lu max %lu us\n",
+                app->unique_identifier,
+                launched,
+                (unsigned long)min,
+                (unsigned long)(sum / launched),
+                (unsigned long)max
+            );
+        }
+    }
+    application_list_close(list);
+
+    fclose(f);
+    printf("Launch reports written to %s\n", output);
+    return 0;
+}
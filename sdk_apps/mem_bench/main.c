@@ -0,0 +1,115 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+
+// Fits the L1 data cache, so it runs at the speed of internal RAM, and one
+// that is much larger than the L2 cache, so every line comes from PSRAM
+#define CACHED_SIZE (16 * 1024)
+#define PSRAM_SIZE  (1024 * 1024)
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+typedef void (*bench_fn)(uint8_t *dst, uint8_t *src, size_t n);
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// What the libc versions the kernel falls back to do, a word at a time. Kept
+// from being turned back into calls to memcpy() and memset().
+#define REFERENCE __attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+
+REFERENCE static void word_copy(uint8_t *dst, uint8_t *src, size_t n) {
+    uint32_t       *d = (uint32_t *)dst;
+    uint32_t const *s = (uint32_t const *)src;
+    for (size_t i = 0; i < n / 4; i += 4) {
+        d[i]     = s[i];
+        d[i + 1] = s[i + 1];
+        d[i + 2] = s[i + 2];
+        d[i + 3] = s[i + 3];
+    }
+}
+
+REFERENCE static void word_set(uint8_t *dst, uint8_t *src, size_t n) {
+    (void)src;
+    uint32_t *d = (uint32_t *)dst;
+    for (size_t i = 0; i < n / 4; i += 4) {
+        d[i]     = 0x5a5a5a5a;
+        d[i + 1] = 0x5a5a5a5a;
+        d[i + 2] = 0x5a5a5a5a;
+        d[i + 3] = 0x5a5a5a5a;
+    }
+}
+
+static void pie_copy(uint8_t *dst, uint8_t *src, size_t n) {
+    memcpy(dst, src, n);
+}
+
+static void pie_set(uint8_t *dst, uint8_t *src, size_t n) {
+    (void)src;
+    memset(dst, 0x5a, n);
+}
+
+// Overlapping, down by a cache line, like scrolling a framebuffer
+static void pie_move(uint8_t *dst, uint8_t *src, size_t n) {
+    (void)src;
+    memmove(dst, dst + 64, n - 64);
+}
+
+static void run(char const *what, bench_fn fn, uint8_t *dst, uint8_t *src, size_t size) {
+    int     rounds = BENCH_BYTES / size;
+    int64_t start  = now_us();
+    for (int i = 0; i < rounds; ++i) {
+        fn(dst, src, size);
+    }
+    int64_t took = now_us() - start;
+
+    printf(
+        "%-8s %-6s %7zu bytes: %5lu MB/s\n",
+        what,
+        size == CACHED_SIZE ? "cached" : "psram",
+        size,
+        (unsigned long)(took > 0 ? (int64_t)BENCH_BYTES / took : 0)
+    );
+}
+
+// mem_bench
+//
+// Compares memcpy(), memset() and memmove(), which move large blocks through
+// the PIE, with plain word loops, on a block that stays in the cache and one
+// that has to go out to PSRAM. Programs have no internal RAM of their own, the
+// cached block stands in for it.
+int main() {
+    size_t sizes[] = {CACHED_SIZE, PSRAM_SIZE};
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        size_t   size      = sizes[i];
+        uint8_t *src_alloc = malloc(size + 64);
+        uint8_t *dst_alloc = malloc(size + 64);
+        if (!src_alloc || !dst_alloc) {
+            printf("Unable to allocate 2 x %zu bytes\n", size);
+            free(src_alloc);
+            free(dst_alloc);
+            return 1;
+        }
+
+        // Both on a cache line, or memcpy() leaves it to the word loops
+        uint8_t *src = (uint8_t *)(((uintptr_t)src_alloc + 63) & ~(uintptr_t)63);
+        uint8_t *dst = (uint8_t *)(((uintptr_t)dst_alloc + 63) & ~(uintptr_t)63);
+        memset(src, 0xa5, size);
+
+        run("wordcpy", word_copy, dst, src, size);
+        run("memcpy", pie_copy, dst, src, size);
+        run("wordset", word_set, dst, src, size);
+        run("memset", pie_set, dst, src, size);
+        run("memmove", pie_move, dst, src, size);
+
+        free(src_alloc);
+        free(dst_alloc);
+    }
+    return 0;
+}
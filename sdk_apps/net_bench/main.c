@@ -0,0 +1,151 @@
+#include "badgevms/wifi.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RPC_ROUNDS 200
+#define CHUNK_SIZE 4096
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Every request to the wifi co-processor crosses the transport twice
+static void bench_rpc() {
+    int64_t min = INT64_MAX, max = 0, sum = 0;
+    for (int i = 0; i < RPC_ROUNDS; ++i) {
+        int64_t start = now_us();
+        wifi_get_rssi();
+        int64_t took = now_us() - start;
+
+        min  = took < min ? took : min;
+        max  = took > max ? took : max;
+        sum += took;
+    }
+
+    printf(
+        "rpc: %d round trips, min %lu avg %lu max %lu us\n",
+        RPC_ROUNDS,
+        (unsigned long)min,
+        (unsigned long)(sum / RPC_ROUNDS),
+        (unsigned long)max
+    );
+}
+
+static int tcp_connect(char const *host, char const *port) {
+    struct addrinfo  hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res   = NULL;
+    if (getaddrinfo(host, port, &hints, &res)) {
+        printf("Unable to resolve %s\n", host);
+        return -1;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen)) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        printf("Unable to connect to %s:%s\n", host, port);
+    }
+    return fd;
+}
+
+static void report(char const *what, uint64_t bytes, int64_t took_us) {
+    if (took_us <= 0) {
+        return;
+    }
+    printf(
+        "%s: %llu bytes in %lu ms, %lu kbit/s\n",
+        what,
+        (unsigned long long)bytes,
+        (unsigned long)(took_us / 1000),
+        (unsigned long)(bytes * 8 * 1000 / took_us)
+    );
+}
+
+// To a sink like `nc -l <port> > /dev/null`
+static void bench_send(char const *host, char const *port, int seconds) {
+    int fd = tcp_connect(host, port);
+    if (fd < 0) {
+        return;
+    }
+
+    static char buf[CHUNK_SIZE];
+    memset(buf, 0xa5, sizeof(buf));
+
+    uint64_t bytes = 0;
+    int64_t  start = now_us();
+    int64_t  end   = start + seconds * 1000000LL;
+    while (now_us() < end) {
+        ssize_t n = send(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            printf("send: connection lost\n");
+            break;
+        }
+        bytes += n;
+    }
+    report("tcp send", bytes, now_us() - start);
+    close(fd);
+}
+
+// From a source like `nc -l <port> < /dev/zero`
+static void bench_recv(char const *host, char const *port, int seconds) {
+    int fd = tcp_connect(host, port);
+    if (fd < 0) {
+        return;
+    }
+
+    static char buf[CHUNK_SIZE];
+
+    uint64_t bytes = 0;
+    int64_t  start = now_us();
+    int64_t  end   = start + seconds * 1000000LL;
+    while (now_us() < end) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            printf("recv: connection lost\n");
+            break;
+        }
+        bytes += n;
+    }
+    report("tcp recv", bytes, now_us() - start);
+    close(fd);
+}
+
+// net_bench [host] [port] [seconds]
+//
+// Measures the link to the wifi co-processor: the round trip of a request to
+// it, then TCP throughput to host:port and from host:port+1. The co-processor
+// logs its own transport statistics, see connectivity_esp_hosted/slave.
+int main(int argc, char *argv[]) {
+    char const *host    = argc > 1 ? argv[1] : "192.168.4.1";
+    int         port    = argc > 2 ? atoi(argv[2]) : 5001;
+    int         seconds = argc > 3 ? atoi(argv[3]) : 10;
+
+    if (wifi_connect() != WIFI_CONNECTED) {
+        printf("Unable to connect to wifi\n");
+        return 1;
+    }
+
+    bench_rpc();
+
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    bench_send(host, port_str, seconds);
+    snprintf(port_str, sizeof(port_str), "%d", port + 1);
+    bench_recv(host, port_str, seconds);
+    return 0;
+}
@@ -45,6 +45,8 @@ typedef struct {
 
     ota_handle_t ota_session;
     bool         ota_error;
+    CURL        *ota_curl;
+    bool         ota_refused; // The server has no such file
 } app_state_t;
 
 typedef struct {
@@ -380,16 +382,19 @@ static size_t WriteOTACallback(void *contents, size_t size, size_t nmemb, app_st
 
     printf("Size: %d \n", realsize);
 
-    char *buffer = (char *)calloc(realsize + 1, sizeof(char));
-
-    memcpy(buffer, contents, realsize);
+    // Not an error page
+    long response_code;
+    curl_easy_getinfo(app->ota_curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if (response_code < 200 || response_code > 299) {
+        app->ota_refused = true;
+        return 0;
+    }
 
-    err = ota_write(app->ota_session, buffer, realsize);
+    err = ota_write(app->ota_session, contents, realsize);
     if (err == false) {
         app->ota_error = true;
     }
 
-    free(buffer);
     return realsize;
 }
 
@@ -487,19 +492,40 @@ void update_badge(void *data) {
 
     if (curl) {
         char *url = (char *)calloc(256, sizeof(char));
-        sprintf(
-            url,
-            "https://badge.why2025.org/api/v3/projects/heplaphon_why_firmware_ota_test/rev%s/files/badgevms.bin",
-            app->badgehub_revision
-        );
-        curl_easy_setopt(curl, CURLOPT_URL, url);
         curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 1024);
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteOTACallback);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)app);
         curl_easy_setopt(curl, CURLOPT_USERAGENT, "BadgeVMS-libcurl/1.0");
+        app->ota_curl = curl;
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
+        // A patch against the running firmware is much smaller, if there is one
+        snprintf(
+            url,
+            256,
+            "https://badge.why2025.org/api/v3/projects/heplaphon_why_firmware_ota_test/rev%s/files/badgevms-%s.patch",
+            app->badgehub_revision,
+            app->running_version
+        );
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        app->ota_refused = false;
+        res              = curl_easy_perform(curl);
+
+        if (res != CURLE_OK || app->ota_refused) {
+            if (ota_session_offset(app->ota_session)) {
+                ota_session_abort(app->ota_session);
+                app->ota_session = ota_session_open();
+            }
+
+            sprintf(
+                url,
+                "https://badge.why2025.org/api/v3/projects/heplaphon_why_firmware_ota_test/rev%s/files/badgevms.bin",
+                app->badgehub_revision
+            );
+            curl_easy_setopt(curl, CURLOPT_URL, url);
+            app->ota_refused = false;
+            res              = curl_easy_perform(curl);
+        }
+        if (res != CURLE_OK || app->ota_refused) {
             printf("curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
             app->ota_error = true;
         }
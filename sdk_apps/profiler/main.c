@@ -0,0 +1,86 @@
+#include "badgevms/process.h"
+#include "badgevms/profiler.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+
+#define MAX_SAMPLES 2048
+
+// profiler <program> [seconds] [output]
+//
+// Runs program and writes one "vaddr count" line per sampled program counter
+// to output. Resolve them on the host with addr2line -f -e program.elf, the
+// binary on the badge is stripped.
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <program> [seconds] [output]\n", argv[0]);
+        return 1;
+    }
+
+    int         seconds = argc > 2 ? atoi(argv[2]) : 10;
+    char const *output  = argc > 3 ? argv[3] : "SD0:profile.txt";
+
+    pid_t pid = process_create(argv[1], 8192, 0, NULL);
+    if (pid == -1) {
+        printf("Unable to start %s\n", argv[1]);
+        return 1;
+    }
+
+    // Give it time to load
+    bool started = false;
+    for (int i = 0; i < 200 && !started; ++i) {
+        started = profiler_start(pid);
+        if (!started) {
+            usleep(10000);
+        }
+    }
+
+    if (!started) {
+        printf("Unable to profile PID %d\n", pid);
+        return 1;
+    }
+
+    // Stop early when the program exits
+    for (int i = 0; i < seconds; ++i) {
+        if (wait(false, 1000) == pid) {
+            break;
+        }
+    }
+
+    profiler_summary_t summary;
+    profiler_stop(&summary);
+
+    profiler_sample_t *samples = malloc(MAX_SAMPLES * sizeof(profiler_sample_t));
+    if (!samples) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    size_t num = profiler_histogram(samples, MAX_SAMPLES);
+
+    FILE *f = fopen(output, "w");
+    if (!f) {
+        printf("Unable to open %s\n", output);
+        free(samples);
+        return 1;
+    }
+
+    fprintf(
+        f,
+        "# samples %lu kernel %lu dropped %lu pcs %lu\n",
+        (unsigned long)summary.samples,
+        (unsigned long)summary.kernel,
+        (unsigned long)summary.dropped,
+        (unsigned long)summary.num_pcs
+    );
+    for (size_t i = 0; i < num; ++i) {
+        fprintf(f, "%08lx %lu\n", (unsigned long)samples[i].vaddr, (unsigned long)samples[i].count);
+    }
+    fclose(f);
+    free(samples);
+
+    printf("%lu samples, %u program counters written to %s\n", (unsigned long)summary.samples, (unsigned)num, output);
+    return 0;
+}
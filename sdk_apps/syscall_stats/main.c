@@ -0,0 +1,98 @@
+#include "badgevms/process.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+
+#define DEFAULT_SECONDS 10
+
+static char const *syscall_names[SYSCALL_MAX] = {
+    [SYSCALL_OPEN]    = "open",
+    [SYSCALL_CLOSE]   = "close",
+    [SYSCALL_READ]    = "read",
+    [SYSCALL_WRITE]   = "write",
+    [SYSCALL_STAT]    = "stat",
+    [SYSCALL_READDIR] = "readdir",
+    [SYSCALL_MALLOC]  = "malloc",
+    [SYSCALL_FREE]    = "free",
+    [SYSCALL_SOCKET]  = "socket",
+    [SYSCALL_SEND]    = "send",
+    [SYSCALL_RECV]    = "recv",
+    [SYSCALL_POLL]    = "poll",
+};
+
+static syscall_stats_t before;
+static syscall_stats_t after;
+
+static void print_histogram(syscall_t syscall, syscall_histogram_t const *a, syscall_histogram_t const *b) {
+    uint32_t calls = b->calls - a->calls;
+    if (!calls) {
+        return;
+    }
+
+    uint64_t total_us = b->total_us - a->total_us;
+    printf(
+        "%-8s %8lu calls %10llu us total %8llu us average\n",
+        syscall_names[syscall],
+        (unsigned long)calls,
+        (unsigned long long)total_us,
+        (unsigned long long)(total_us / calls)
+    );
+
+    for (int i = 0; i < SYSCALL_HISTOGRAM_BUCKETS; ++i) {
+        uint32_t count = b->buckets[i] - a->buckets[i];
+        if (!count) {
+            continue;
+        }
+
+        char range[24];
+        if (i == 0) {
+            snprintf(range, sizeof(range), "< 1 us");
+        } else if (i == SYSCALL_HISTOGRAM_BUCKETS - 1) {
+            snprintf(range, sizeof(range), ">= %lu us", 1ul << (i - 1));
+        } else {
+            snprintf(range, sizeof(range), "%lu-%lu us", 1ul << (i - 1), (1ul << i) - 1);
+        }
+        printf("    %-18s %8lu %3d%%\n", range, (unsigned long)count, (int)((uint64_t)count * 100 / calls));
+    }
+}
+
+// syscall_stats pid [seconds]
+//
+// Times the system calls of the process pid for a while, 10 seconds by
+// default, and prints how long they took, to see whether a slow program waits
+// on files, the network or the heap. Timing stays on for every process until
+// this returns.
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s pid [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    pid_t pid     = atoi(argv[1]);
+    int   seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+
+    process_syscall_stats_enable(true);
+    if (!process_syscall_stats_get(pid, &before)) {
+        printf("No process %d\n", pid);
+        process_syscall_stats_enable(false);
+        return 1;
+    }
+
+    sleep(seconds);
+
+    bool running = process_syscall_stats_get(pid, &after);
+    process_syscall_stats_enable(false);
+    if (!running) {
+        printf("Process %d exited\n", pid);
+        return 1;
+    }
+
+    printf("System calls of process %d in %d seconds\n", pid, seconds);
+    for (int i = 0; i < SYSCALL_MAX; ++i) {
+        print_histogram(i, &before.syscalls[i], &after.syscalls[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <badgevms/compositor.h>
+#include <badgevms/event.h>
+#include <badgevms/memory_pressure.h>
+#include <badgevms/process.h>
+#include <badgevms/text.h>
+#include <string.h>
+#include <sys/param.h>
+
+#define WINDOW_WIDTH  720
+#define WINDOW_HEIGHT 480
+
+#define FONT_HEIGHT TEXT_FONT_LARGE_HEIGHT
+#define MAX_ROWS    ((WINDOW_HEIGHT / FONT_HEIGHT) - 2)
+
+#define PAGE_KB 64
+// Pids are below this
+#define MAX_PIDS 128
+
+#define TEXT_COLOR     0xFFFF
+#define HEADER_COLOR   0x07E0
+#define LOW_COLOR      0xFFE0
+#define CRITICAL_COLOR 0xF800
+
+static char const *pressure_names[] = {
+    [MEMORY_PRESSURE_NONE]     = "none",
+    [MEMORY_PRESSURE_LOW]      = "LOW",
+    [MEMORY_PRESSURE_CRITICAL] = "CRITICAL",
+};
+
+static uint16_t const pressure_colors[] = {
+    [MEMORY_PRESSURE_NONE]     = HEADER_COLOR,
+    [MEMORY_PRESSURE_LOW]      = LOW_COLOR,
+    [MEMORY_PRESSURE_CRITICAL] = CRITICAL_COLOR,
+};
+
+// What the previous refresh saw, to show the load since then
+static cpu_stats_t     prev_cpu;
+static process_stats_t prev_stats[MAX_PIDS];
+
+static void draw_line(framebuffer_t *framebuffer, int row, char const *text, uint16_t color) {
+    text_draw(framebuffer, TEXT_FONT_LARGE, 4, row * FONT_HEIGHT, text, color, false);
+}
+
+static int percent(uint64_t part, int64_t total) {
+    return total > 0 ? (int)(part * 100 / total) : 0;
+}
+
+static void draw(framebuffer_t *framebuffer, memory_pressure_t pressure) {
+    pid_t  pids[MAX_ROWS];
+    size_t num_pids = process_list(pids, MAX_ROWS);
+    char   line[64];
+
+    cpu_stats_t cpu;
+    cpu_stats_get(&cpu);
+    int64_t elapsed_us = cpu.timestamp_us - prev_cpu.timestamp_us;
+
+    memset(framebuffer->pixels, 0, WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(uint16_t));
+
+    int load = 0;
+    for (int i = 0; i < cpu.num_cores; ++i) {
+        load = MAX(load, percent(cpu.user_us[i] - prev_cpu.user_us[i], elapsed_us));
+    }
+    snprintf(
+        line,
+        sizeof(line),
+        "%zu tasks, apps %d%% CPU, memory pressure %s",
+        num_pids,
+        load,
+        pressure_names[pressure]
+    );
+    draw_line(framebuffer, 0, line, pressure_colors[pressure]);
+    // All sizes in KB, switches and remaps per second
+    draw_line(framebuffer, 1, "PID NAME           HEAP  PEAK   FB OBJ CPU%  CSW REMAP", HEADER_COLOR);
+
+    int row = 2;
+    for (size_t i = 0; i < num_pids && i < MAX_ROWS; ++i) {
+        process_info_t  info;
+        process_stats_t stats;
+        if (!process_info_get(pids[i], &info) || !process_stats_get(pids[i], &stats) || pids[i] >= MAX_PIDS) {
+            continue;
+        }
+
+        process_stats_t *prev = &prev_stats[pids[i]];
+        if (prev->pid != pids[i] || prev->run_us > stats.run_us) {
+            // New since the last refresh, or the pid was reused
+            *prev = (process_stats_t){.pid = pids[i]};
+        }
+
+        uint32_t switches = stats.switches_voluntary + stats.switches_involuntary -
+                            (prev->switches_voluntary + prev->switches_involuntary);
+        int      per_sec  = elapsed_us > 0 ? (int)((uint64_t)switches * 1000000 / elapsed_us) : 0;
+        int      remaps   = elapsed_us > 0 ? (int)((uint64_t)(stats.remaps - prev->remaps) * 1000000 / elapsed_us) : 0;
+
+        snprintf(
+            line,
+            sizeof(line),
+            "%3d %-12.12s %6zu %5zu %4zu %3zu %4d %4d %5d",
+            info.pid,
+            info.is_thread ? "(thread)" : info.name,
+            (info.heap_pages - info.shared_pages) * PAGE_KB,
+            info.heap_peak_pages * PAGE_KB,
+            (info.framebuffer_pages + info.dma_pages) * PAGE_KB,
+            info.kernel_objects,
+            percent(stats.run_us - prev->run_us, elapsed_us),
+            per_sec,
+            remaps
+        );
+        draw_line(framebuffer, row++, line, TEXT_COLOR);
+        *prev = stats;
+    }
+
+    prev_cpu = cpu;
+}
+
+int main(int argc, char *argv[]) {
+    window_handle_t window = window_create(
+        "System Monitor",
+        (window_size_t){WINDOW_WIDTH, WINDOW_HEIGHT},
+        WINDOW_FLAG_DOUBLE_BUFFERED | WINDOW_FLAG_LOW_PRIORITY
+    );
+    if (!window) {
+        printf("Window could not be created\n");
+        return 1;
+    }
+
+    framebuffer_t *framebuffer =
+        window_framebuffer_create(window, (window_size_t){WINDOW_WIDTH, WINDOW_HEIGHT}, BADGEVMS_PIXELFORMAT_RGB565);
+    if (!framebuffer) {
+        printf("Framebuffer could not be created\n");
+        return 1;
+    }
+
+    memory_pressure_t pressure = memory_pressure_get();
+    while (1) {
+        draw(framebuffer, pressure);
+        window_present(window, true, NULL, 0);
+
+        // Refresh once a second, or right away when the pressure changes
+        event_t e = window_event_poll(window, false, 1000);
+        if (e.type == EVENT_QUIT) {
+            break;
+        }
+        if (e.type == EVENT_MEMORY_PRESSURE) {
+            pressure = e.memory_pressure.level;
+        }
+    }
+
+    window_destroy(window);
+    return 0;
+}
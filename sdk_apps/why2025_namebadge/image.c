@@ -1,9 +1,8 @@
-#define STBI_ASSERT(x)
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "image/image.h"
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 // RGB565 color conversion macro (same as yours)
 #define RGB565(r, g, b)           ((((r) & 0x1F) << 11) | (((g) & 0x3F) << 5) | ((b) & 0x1F))
@@ -12,9 +11,10 @@
 int render_png_to_framebuffer(
     uint16_t *framebuffer, int fb_width, int fb_height, char const *filename, int dest_x, int dest_y
 ) {
-    int img_width, img_height, channels;
+    int            img_width, img_height;
+    uint8_t const *alpha;
 
-    unsigned char *img_data = stbi_load(filename, &img_width, &img_height, &channels, 0);
+    uint16_t *img_data = image_load_rgb565(filename, &img_width, &img_height, &alpha);
     if (!img_data) {
         return -1;
     }
@@ -31,42 +31,36 @@ int render_png_to_framebuffer(
 
     for (int y = start_y; y < end_y; y++) {
         int fb_y = dest_y + y;
-        if (fb_y < 0 || fb_y >= fb_height)
+        if (fb_y < 0 || fb_y >= fb_height || start_x >= end_x)
             continue;
 
-        uint16_t *fb_row = framebuffer + (fb_y * fb_width);
-
-        for (int x = start_x; x < end_x; x++) {
-            int fb_x = dest_x + x;
-            if (fb_x < 0 || fb_x >= fb_width)
-                continue;
-
-            int pixel_index = (y * img_width + x) * channels;
+        uint16_t       *fb_row  = framebuffer + (fb_y * fb_width);
+        uint16_t const *img_row = img_data + y * img_width;
 
-            uint8_t r = img_data[pixel_index];
-            uint8_t g = img_data[pixel_index + 1];
-            uint8_t b = img_data[pixel_index + 2];
+        if (!alpha) {
+            memcpy(fb_row + dest_x + start_x, img_row + start_x, (end_x - start_x) * sizeof(uint16_t));
+            continue;
+        }
 
-            if (channels == 4) {
-                uint8_t a = img_data[pixel_index + 3];
-                if (a < 128)
-                    continue; // Skip transparent pixels
-            }
+        for (int x = start_x; x < end_x; x++) {
+            if (alpha[y * img_width + x] < 128)
+                continue; // Skip transparent pixels
 
-            fb_row[fb_x] = RGB888_TO_RGB565(r, g, b);
+            fb_row[dest_x + x] = img_row[x];
         }
     }
 
-    stbi_image_free(img_data);
+    image_free(img_data);
     return 0;
 }
 
 int render_png_with_alpha_scaled(
     uint16_t *framebuffer, int fb_width, int fb_height, char const *filename, int dest_x, int dest_y, int scale_factor
 ) {
-    int img_width, img_height, channels;
+    int            img_width, img_height;
+    uint8_t const *alpha_data;
 
-    unsigned char *img_data = stbi_load(filename, &img_width, &img_height, &channels, 4);
+    uint16_t *img_data = image_load_rgb565(filename, &img_width, &img_height, &alpha_data);
     if (!img_data) {
         return -1;
     }
@@ -88,22 +82,15 @@ int render_png_with_alpha_scaled(
 
     for (int y = start_y; y < end_y; y++) {
         for (int x = start_x; x < end_x; x++) {
-            int     pixel_index = (y * img_width + x) * 4;
-            uint8_t src_r       = img_data[pixel_index];
-            uint8_t src_g       = img_data[pixel_index + 1];
-            uint8_t src_b       = img_data[pixel_index + 2];
-            uint8_t alpha       = img_data[pixel_index + 3];
+            uint16_t pixel_color = img_data[y * img_width + x];
+            uint8_t  alpha       = alpha_data ? alpha_data[y * img_width + x] : 255;
 
             if (alpha == 0)
                 continue; // Fully transparent
 
-            uint16_t pixel_color;
-            if (alpha == 255) {
-                // Fully opaque - no blending needed
-                pixel_color = RGB888_TO_RGB565(src_r, src_g, src_b);
-            } else {
-                pixel_color = RGB888_TO_RGB565(src_r, src_g, src_b);
-            }
+            uint8_t src_r = ((pixel_color >> 11) & 0x1F) << 3;
+            uint8_t src_g = ((pixel_color >> 5) & 0x3F) << 2;
+            uint8_t src_b = (pixel_color & 0x1F) << 3;
 
             for (int dy = 0; dy < scale_factor; dy++) {
                 for (int dx = 0; dx < scale_factor; dx++) {
@@ -136,16 +123,16 @@ int render_png_with_alpha_scaled(
         }
     }
 
-    stbi_image_free(img_data);
+    image_free(img_data);
     return 0;
 }
 
 int render_jpg_to_framebuffer(
     uint16_t *framebuffer, int fb_width, int fb_height, char const *filename, int dest_x, int dest_y
 ) {
-    int img_width, img_height, channels;
+    int img_width, img_height;
 
-    unsigned char *img_data = stbi_load(filename, &img_width, &img_height, &channels, 3);
+    uint16_t *img_data = image_load_rgb565(filename, &img_width, &img_height, NULL);
     if (!img_data) {
         return -1;
     }
@@ -162,27 +149,14 @@ int render_jpg_to_framebuffer(
 
     for (int y = start_y; y < end_y; y++) {
         int fb_y = dest_y + y;
-        if (fb_y < 0 || fb_y >= fb_height)
+        if (fb_y < 0 || fb_y >= fb_height || start_x >= end_x)
             continue;
 
         uint16_t *fb_row = framebuffer + (fb_y * fb_width);
-
-        for (int x = start_x; x < end_x; x++) {
-            int fb_x = dest_x + x;
-            if (fb_x < 0 || fb_x >= fb_width)
-                continue;
-
-            int pixel_index = (y * img_width + x) * channels;
-
-            uint8_t r = img_data[pixel_index];
-            uint8_t g = img_data[pixel_index + 1];
-            uint8_t b = img_data[pixel_index + 2];
-
-            fb_row[fb_x] = RGB888_TO_RGB565(r, g, b);
-        }
+        memcpy(fb_row + dest_x + start_x, img_data + y * img_width + start_x, (end_x - start_x) * sizeof(uint16_t));
     }
 
-    stbi_image_free(img_data);
+    image_free(img_data);
     return 0;
 }
 
@@ -20,6 +20,8 @@
 #define BADGEHUB_PING            BADGEHUB_BASE_URL "/ping?id=%s-v1&mac=%s"
 #define BADGEHUB_DEFAULT_APPS    BADGEHUB_BASE_URL "/project-summaries?category=Default"
 #define BADGEHUB_FIRMWARE_URL    BADGEHUB_BASE_URL "/projects/" FIRMWARE_PROJECT "/rev%i/files/badgevms.bin"
+#define BADGEHUB_FIRMWARE_PATCH  BADGEHUB_BASE_URL "/projects/" FIRMWARE_PROJECT "/rev%i/files/badgevms-%s.patch"
+#define FIRMWARE_ATTEMPTS        5
 
 char *source_to_name(application_source_t s) {
     switch (s) {
@@ -47,38 +49,37 @@ static size_t mem_cb(void *contents, size_t size, size_t nmemb, void *userp) {
     return realsize;
 }
 
-static size_t file_cb(void *contents, size_t size, size_t nmemb, void *userp) {
-    debug_printf("file_cb(%p, %zu, %zu, %p)\n", contents, size, nmemb, userp);
-
-    size_t       realsize = size * nmemb;
-    http_file_t *file     = (http_file_t *)userp;
-    FILE        *f        = file->fp;
+// A firmware download, continued with the same OTA session after a dropped connection
+typedef struct {
+    ota_handle_t session;
+    CURL        *curl;
+    bool         resumed;
+    bool         refused; // Not the part of the image we asked for
+    bool         failed;
+} firmware_download_t;
+
+static size_t firmware_cb(void *contents, size_t size, size_t nmemb, void *userp) {
+    firmware_download_t *download = (firmware_download_t *)userp;
+    debug_printf("firmware_cb(%p, %zu, %zu, %p)\n", contents, size, nmemb, download->session);
+    size_t realsize = size * nmemb;
 
-    size_t s = fwrite(contents, 1, size * nmemb, f);
-    if (s != size * nmemb) {
-        printf("Failure writing to file\n");
+    // A server that ignores the range sends the image from the start
+    long response_code;
+    curl_easy_getinfo(download->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if (download->resumed ? response_code != 206 : response_code < 200 || response_code > 299) {
+        download->refused = true;
+    }
+    if (download->refused || download->failed) {
         return 0;
     }
 
-    file->size += realsize;
-    return realsize;
-}
-
-static size_t firmware_cb(void *contents, size_t size, size_t nmemb, ota_handle_t handle) {
-    debug_printf("firmware_cb(%p, %zu, %zu, %p)\n", contents, size, nmemb, handle);
-    bool   err;
-    size_t realsize = size * nmemb;
-
-    char *buffer = (char *)calloc(realsize + 1, sizeof(char));
-    memcpy(buffer, contents, realsize);
-
-    err = ota_write(handle, buffer, realsize);
-    if (err == false) {
+    // ota_write() takes a copy
+    if (!ota_write(download->session, contents, realsize)) {
         printf("ota_write() failed\n");
+        download->failed = true;
         return 0;
     }
 
-    free(buffer);
     return realsize;
 }
 
@@ -112,8 +113,7 @@ bool do_http(char const *url, http_data_t *response_data, http_file_t *http_file
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, mem_cb);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)response_data);
     } else {
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, file_cb);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)http_file);
+        curl_easy_setopt(curl, CURLOPT_DOWNLOAD_TO_PATH, http_file->path);
     }
 
     curl_easy_setopt(curl, CURLOPT_USERAGENT, HTTP_USERAGENT);
@@ -138,6 +138,9 @@ bool do_http(char const *url, http_data_t *response_data, http_file_t *http_file
         response_data->memory                      = realloc(response_data->memory, response_data->size + 1);
         response_data->memory[response_data->size] = 0;
     } else {
+        double size;
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &size);
+        http_file->size = size;
         debug_printf("do_http(%s) response code: %ld, bytes received: %zu\n", url, response_code, http_file->size);
     }
 
@@ -233,7 +236,6 @@ bool update_application_file(application_t *app, char const *relative_file_name,
     bool  ret                = false;
     char *absolute_file_name = NULL;
     char *tmpfile            = NULL;
-    FILE *f                  = NULL;
 
     absolute_file_name = application_create_file_string(app, relative_file_name);
     if (!absolute_file_name) {
@@ -247,24 +249,15 @@ bool update_application_file(application_t *app, char const *relative_file_name,
         goto out;
     }
 
-    f = fopen(tmpfile, "w");
-    if (!f) {
-        printf("Unable to open tmpfile %s\n", tmpfile);
-        goto out;
-    }
-
     http_file_t file_op;
     file_op.size = 0;
-    file_op.fp   = f;
+    file_op.path = tmpfile;
 
     if (!do_http(file_url, NULL, &file_op)) {
         printf("Unable to write save tmpfile %s\n", tmpfile);
         goto out;
     }
 
-    fclose(f);
-    f = NULL;
-
     remove(absolute_file_name);
 
     if (rename(tmpfile, absolute_file_name)) {
@@ -277,9 +270,6 @@ bool update_application_file(application_t *app, char const *relative_file_name,
 out:
     free(tmpfile);
     free(absolute_file_name);
-    if (f) {
-        fclose(f);
-    }
     return ret;
 }
 
@@ -297,8 +287,10 @@ bool update_application(application_t *app, char const *version) {
     cJSON *app_application  = NULL;
     cJSON *name_field       = NULL;
     cJSON *executable_field = NULL;
+    cJSON *icon_field       = NULL;
     char  *name             = NULL;
     char  *executable       = NULL;
+    char  *icon             = NULL;
     long   file_size        = 0;
     bool   result           = false;
 
@@ -336,6 +328,12 @@ bool update_application(application_t *app, char const *version) {
             name = name_field->valuestring;
         }
 
+        // A sprite among the files, see badgevms/sprite.h
+        icon_field = cJSON_GetObjectItemCaseSensitive(app_metadata, "icon");
+        if (icon_field && cJSON_IsString(icon_field)) {
+            icon = icon_field->valuestring;
+        }
+
         app_application = cJSON_GetObjectItemCaseSensitive(app_metadata, "application");
         debug_printf("Found 'application' in 'app_metadata'\n");
         if (app_application && cJSON_IsArray(app_application)) {
@@ -405,6 +403,11 @@ bool update_application(application_t *app, char const *version) {
         if (executable) {
             application_set_binary_path(app, executable);
         }
+
+        // Rendered to a thumbnail now, so that launchers only have to draw it
+        if (icon && !application_set_icon(app, icon)) {
+            printf("Unable to render icon %s\n", icon);
+        }
     }
 out:
     cJSON_Delete(json);
@@ -509,14 +512,41 @@ bool do_firmware_http(char const *url, ota_handle_t ota_session) {
         return false;
     }
 
+    firmware_download_t download = {
+        .session = ota_session,
+        .curl    = curl,
+    };
+
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 1024);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, firmware_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)ota_session);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&download);
     curl_easy_setopt(curl, CURLOPT_USERAGENT, HTTP_USERAGENT);
     curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
 
-    CURLcode res = curl_easy_perform(curl);
+    // After a dropped connection, ask for the rest of the image
+    CURLcode res;
+    for (int attempt = 0;; ++attempt) {
+        long offset      = ota_session_offset(ota_session);
+        download.resumed = offset != 0;
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM, offset);
+
+        res = curl_easy_perform(curl);
+        if (res == CURLE_OK || download.refused || download.failed || attempt + 1 == FIRMWARE_ATTEMPTS) {
+            break;
+        }
+        printf(
+            "do_firmware_http(%s) interrupted at %zu bytes, resuming\n",
+            url,
+            ota_session_offset(ota_session)
+        );
+    }
+
+    if (download.refused || download.failed) {
+        printf("do_firmware_http(%s) error: unable to continue the download\n", url);
+        goto out;
+    }
+
     if (res != CURLE_OK) {
         char const *error_string = curl_easy_strerror(res);
         if (error_string) {
@@ -562,10 +592,27 @@ bool update_firmware() {
         goto out;
     }
 
-    asprintf(&url, BADGEHUB_FIRMWARE_URL, revision);
+    // A patch against the running firmware is much smaller, if there is one
+    char running[32] = {0};
+    ota_get_running_version(running);
+    asprintf(&url, BADGEHUB_FIRMWARE_PATCH, revision, running);
     if (!do_firmware_http(url, ota_session)) {
-        printf("Failed to update firmware\n");
-        goto out;
+        printf("No usable firmware patch, getting the full image\n");
+        if (ota_session_offset(ota_session)) {
+            ota_session_abort(ota_session);
+            ota_session = ota_session_open();
+            if (!ota_session) {
+                printf("Failed to open OTA session\n");
+                goto out;
+            }
+        }
+
+        free(url);
+        asprintf(&url, BADGEHUB_FIRMWARE_URL, revision);
+        if (!do_firmware_http(url, ota_session)) {
+            printf("Failed to update firmware\n");
+            goto out;
+        }
     }
 
     ota_session_commit(ota_session);
@@ -28,8 +28,8 @@ typedef struct http_data {
 } http_data_t;
 
 typedef struct http_file {
-    FILE  *fp;
-    size_t size;
+    char const *path;
+    size_t      size;
 } http_file_t;
 
 bool   check_for_updates(application_t *app, char **version);
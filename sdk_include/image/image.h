@@ -0,0 +1,37 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "image/stb_image.h"
+
+#include <stdint.h>
+
+// PNG and JPEG decoding, link with the image library. It has the stb_image
+// API, stbi_load() and friends, built once for every application. Don't
+// define STB_IMAGE_IMPLEMENTATION.
+//
+// Images that are known when the application is built are better converted
+// to sprites then, see ASSETS in build_app(). Baseline JPEGs decode a lot
+// quicker in hardware, see badgevms/jpeg.h.
+
+// Decode straight to BADGEVMS_PIXELFORMAT_RGB565, in the memory stb_image
+// decoded into, so there is no second image sized buffer. If alpha isn't NULL
+// it is set to width * height bytes of alpha after the pixels for an image
+// with an alpha channel, and to NULL for an opaque one. Free the pixels with
+// image_free(), NULL on error, see stbi_failure_reason().
+uint16_t *image_load_rgb565(char const *filename, int *width, int *height, uint8_t const **alpha);
+void      image_free(uint16_t *pixels);
@@ -0,0 +1,46 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pixel conversion, blending and rectangle fills and copies on the CPU, link
+// with the pixel library. For the small things that aren't worth setting up
+// the PPA for, see window_framebuffer_blit() and window_framebuffer_fill().
+//
+// Formats are named like BADGEVMS_PIXELFORMAT_*, ARGB8888 is a uint32_t with
+// alpha in the top byte. ABGR8888 is R, G, B, A in memory, what image loaders
+// hand out. RGB24 is R, G, B in memory.
+
+// Convert n pixels, dst and src must not overlap
+void pixel_argb8888_to_rgb565(uint16_t *dst, uint32_t const *src, size_t n);
+void pixel_abgr8888_to_rgb565(uint16_t *dst, uint32_t const *src, size_t n);
+void pixel_rgb24_to_rgb565(uint16_t *dst, uint8_t const *src, size_t n);
+void pixel_index8_to_rgb565(uint16_t *dst, uint8_t const *src, uint16_t const palette[256], size_t n);
+// An RGB565 image with a separate alpha plane, like a sprite, for blending
+void pixel_rgb565a8_to_argb8888(uint32_t *dst, uint16_t const *src, uint8_t const *alpha, size_t n);
+
+// Blend n pixels over dst by their alpha channel times alpha, in 5 bit steps
+void pixel_blend_argb8888_rgb565(uint16_t *dst, uint32_t const *src, uint8_t alpha, size_t n);
+void pixel_blend_abgr8888_rgb565(uint16_t *dst, uint32_t const *src, uint8_t alpha, size_t n);
+
+// Rectangles, stride is the distance between rows in pixels or bytes as named
+void pixel_fill_rgb565(uint16_t *dst, size_t stride, int w, int h, uint16_t color);
+void pixel_copy_rect(
+    void *dst, size_t dst_stride_bytes, void const *src, size_t src_stride_bytes, size_t row_bytes, int h
+);
@@ -0,0 +1,109 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "threadpool/threadpool.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Spans, lines and triangles into RGB565 buffers, link with the raster and
+// pixel libraries, and threadpool for batches. Coordinates are 16.16 fixed
+// point, the centre of pixel (x, y) is at (x + 0.5, y + 0.5). A pixel belongs
+// to a triangle if its centre is inside, or on a top or left edge, so
+// triangles that share an edge draw every pixel along it once.
+//
+// Flat spans are filled with the PIE. Gouraud shading, affine texture
+// mapping, colour keys and a 16 bit depth buffer are done a pixel at a time
+// in fixed point.
+typedef int32_t raster_fixed_t;
+
+#define RASTER_FIXED_ONE    65536
+#define RASTER_FIXED(x)     ((raster_fixed_t)((x) * RASTER_FIXED_ONE))
+#define RASTER_FIXED_INT(i) ((raster_fixed_t)(i) * RASTER_FIXED_ONE)
+
+// Texels of this colour are left out with RASTER_COLORKEY
+#define RASTER_COLORKEY_565 0xF81F
+
+typedef struct {
+    int x, y, w, h;
+} raster_rect_t;
+
+typedef struct {
+    uint16_t     *pixels;
+    uint16_t     *depth;  // The same size and stride, NULL if there is none
+    int           stride; // In pixels
+    int           w, h;
+    raster_rect_t clip; // Nothing is drawn outside, all of the target if empty
+} raster_target_t;
+
+// Both sizes a power of two, texture coordinates wrap around
+typedef struct {
+    uint16_t const *pixels;
+    int             w_log2;
+    int             h_log2;
+} raster_texture_t;
+
+typedef struct {
+    raster_fixed_t x, y;
+    raster_fixed_t u, v;  // In texels, for RASTER_TEXTURED
+    uint16_t       z;     // Depth, nearer is smaller
+    uint16_t       color; // For RASTER_GOURAUD
+    uint8_t        light; // For RASTER_LIT, 255 leaves the texture as it is
+} raster_vertex_t;
+
+typedef enum {
+    RASTER_FLAT,     // paint->color
+    RASTER_GOURAUD,  // The colours of the vertices blended across
+    RASTER_TEXTURED, // paint->texture, without perspective correction
+} raster_mode_t;
+
+#define RASTER_DEPTH    (1 << 0) // Only draw what is nearer than the depth buffer, and write it
+#define RASTER_COLORKEY (1 << 1) // Leave out texels of RASTER_COLORKEY_565
+#define RASTER_LIT      (1 << 2) // Darken the texture by the light of the vertices
+
+typedef struct {
+    raster_mode_t           mode;
+    uint32_t                flags;
+    uint16_t                color;
+    raster_texture_t const *texture;
+} raster_paint_t;
+
+// Fill the clip rect with color, and the depth buffer with the farthest depth
+void raster_clear(raster_target_t const *target, uint16_t color);
+// Pixels x0 up to x1 of row y, in whole pixels
+void raster_span(raster_target_t const *target, int y, int x0, int x1, uint16_t color);
+void raster_rect(raster_target_t const *target, raster_rect_t rect, uint16_t color);
+// One pixel wide, both ends included
+void raster_line(
+    raster_target_t const *target, raster_fixed_t x0, raster_fixed_t y0, raster_fixed_t x1, raster_fixed_t y1,
+    uint16_t color
+);
+// In either winding order
+void raster_triangle(raster_target_t const *target, raster_vertex_t const v[3], raster_paint_t const *paint);
+
+// Triangles collected and then drawn in bands of rows, by the workers of a
+// pool in parallel. Within a band they are drawn in the order they were added.
+typedef struct raster_batch raster_batch_t;
+
+raster_batch_t *raster_batch_create(int max_triangles);
+void            raster_batch_destroy(raster_batch_t *batch);
+// False once the batch is full. The texture of paint has to stay until drawn.
+bool            raster_batch_triangle(raster_batch_t *batch, raster_vertex_t const v[3], raster_paint_t const *paint);
+// Draw everything added since the last draw, pool may be NULL to draw it here
+void            raster_batch_draw(raster_batch_t *batch, raster_target_t const *target, threadpool_t *pool);
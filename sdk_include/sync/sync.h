@@ -0,0 +1,60 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Locks for the threads of an application, link with the sync library. They
+// only enter the kernel when a thread has to wait, see futex_wait(). Unlike
+// FreeRTOS primitives they are safe when a thread gets killed: a mutex whose
+// owner died goes to the next thread that tries to lock it. Zero initialized
+// is the same as the initializers below.
+typedef struct {
+    int word; // 0 when unlocked, otherwise the owner pid and SYNC_MUTEX_CONTENDED
+} sync_mutex_t;
+
+typedef struct {
+    int sequence;
+} sync_cond_t;
+
+typedef struct {
+    int value;
+    int waiters;
+} sync_sem_t;
+
+#define SYNC_MUTEX_INITIALIZER  {0}
+#define SYNC_COND_INITIALIZER   {0}
+#define SYNC_SEM_INITIALIZER(v) {(v), 0}
+
+#define SYNC_WAIT_FOREVER UINT32_MAX
+
+void sync_mutex_lock(sync_mutex_t *mutex);
+bool sync_mutex_trylock(sync_mutex_t *mutex);
+void sync_mutex_unlock(sync_mutex_t *mutex);
+
+// Unlock mutex, wait for a signal and lock it again. Wake ups can be spurious,
+// check the condition in a loop. False if timeout_msec passed.
+bool sync_cond_wait(sync_cond_t *cond, sync_mutex_t *mutex, uint32_t timeout_msec);
+void sync_cond_signal(sync_cond_t *cond);
+void sync_cond_broadcast(sync_cond_t *cond);
+
+void sync_sem_init(sync_sem_t *sem, int value);
+// False if timeout_msec passed before the semaphore could be taken
+bool sync_sem_wait(sync_sem_t *sem, uint32_t timeout_msec);
+bool sync_sem_trywait(sync_sem_t *sem);
+void sync_sem_post(sync_sem_t *sem);
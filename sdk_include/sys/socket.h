@@ -10,6 +10,8 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define AF_UNIX             1
 #define PF_LOCAL            AF_UNIX
@@ -57,6 +59,16 @@ extern "C" {
 #define SO_NO_CHECK     0x100a /* don't create UDP checksum */
 #define SO_BINDTODEVICE 0x100b /* bind to device */
 
+#define MSG_PEEK       0x01 /* Peeks at an incoming message */
+#define MSG_WAITALL    0x02 /* Unimplemented */
+#define MSG_OOB        0x04 /* Unimplemented */
+#define MSG_DONTWAIT   0x08 /* Nonblocking i/o for this operation only */
+#define MSG_MORE       0x10 /* Sender will send more */
+#define MSG_NOSIGNAL   0x20 /* Unimplemented */
+#define MSG_TRUNC      0x04 /* In msg_flags, a datagram was longer than the buffers */
+#define MSG_CTRUNC     0x08 /* In msg_flags, control data was truncated */
+#define MSG_WAITFORONE 0x10000 /* recvmmsg() only waits for the first message, always the case */
+
 typedef uint32_t socklen_t;
 typedef uint8_t sa_family_t;
 typedef uint16_t in_port_t;
@@ -94,6 +106,23 @@ struct sockaddr_storage {
   uint32_t       s2_data3[3];
 };
 
+struct msghdr {
+  void         *msg_name;
+  socklen_t     msg_namelen;
+  struct iovec *msg_iov;
+  int           msg_iovlen;
+  void         *msg_control;
+  socklen_t     msg_controllen;
+  int           msg_flags;
+};
+
+struct mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int  msg_len; /* Bytes sent or received */
+};
+
+struct timespec;
+
 int socketpair(int domain, int type, int protocol, int sv[2]);
 
 int accept(int s,struct sockaddr *addr,socklen_t *addrlen);
@@ -113,6 +142,12 @@ ssize_t send(int s,const void *dataptr,size_t size,int flags);
 ssize_t sendmsg(int s,const struct msghdr *message,int flags);
 ssize_t sendto(int s,const void *dataptr,size_t size,int flags,const struct sockaddr *to,socklen_t to_len);
 int socket(int domain,int type,int protocol);
+/* BadgeVMS: one call for up to vlen datagrams. Only the first message is
+ * waited for, the rest are taken as long as they are there. timeout is
+ * ignored. Returns the number of messages, their msg_len is set. */
+int recvmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+/* Stops at the first message that can't be sent, -1 only if that is the first */
+int sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
 const char *inet_ntop(int af, const void *src, char *dst, socklen_t size);
 int inet_pton(int af, const char *src, void *dst);
 
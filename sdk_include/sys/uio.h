@@ -0,0 +1,39 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOV_MAX 1024
+
+struct iovec {
+    void  *iov_base;
+    size_t iov_len;
+};
+
+// Read into or write from iovcnt buffers in order with a single call. Stops
+// at the first buffer that isn't filled or written completely.
+ssize_t readv(int fd, struct iovec const *iov, int iovcnt);
+ssize_t writev(int fd, struct iovec const *iov, int iovcnt);
+
+#ifdef __cplusplus
+}
+#endif
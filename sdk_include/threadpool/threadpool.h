@@ -0,0 +1,56 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A fixed set of worker threads, link with the threadpool library. Every
+// worker has a deque of its own and steals from the others when it runs dry.
+// Workers are threads of the application, switching between them and the
+// main thread keeps its address space mapped. Applications share a core for
+// now, so workers help most with work that blocks.
+typedef struct threadpool      threadpool_t;
+typedef struct threadpool_task threadpool_task_t;
+
+typedef void (*threadpool_func_t)(void *data);
+// Called for [start, end) of the range given to threadpool_parallel_for()
+typedef void (*threadpool_range_func_t)(void *data, int start, int end);
+
+// 0 workers picks a default, NULL if the workers couldn't be started
+threadpool_t *threadpool_create(int workers, uint16_t stack_size);
+// Waits for outstanding tasks first
+void          threadpool_destroy(threadpool_t *pool);
+int           threadpool_workers(threadpool_t *pool);
+
+// Split [start, end) into chunks of grain and run func on them, the caller
+// takes part. 0 picks a grain. Returns once all chunks are done.
+void threadpool_parallel_for(
+    threadpool_t *pool, int start, int end, int grain, threadpool_range_func_t func, void *data
+);
+
+// Task graphs. Create the tasks, declare their dependencies and then submit
+// them, in any order. A task runs once it is submitted and everything it
+// depends on has run, and is freed after it ran. Don't touch a task after
+// submitting it.
+threadpool_task_t *threadpool_task_create(threadpool_t *pool, threadpool_func_t func, void *data);
+// Run task after on, false if on has too many dependents already
+bool               threadpool_task_depends(threadpool_task_t *task, threadpool_task_t *on);
+void               threadpool_task_submit(threadpool_task_t *task);
+
+// Help running tasks until everything submitted so far has run, not from a task
+void threadpool_wait(threadpool_t *pool);
@@ -0,0 +1,87 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Only what applications load at runtime, and nothing that goes through floats
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#define STBI_NO_HDR
+#define STBI_NO_LINEAR
+#define STBI_ASSERT(x)
+#define STB_IMAGE_IMPLEMENTATION
+#include "image/image.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// In place, each pixel is written over bytes of itself or of pixels before it
+static void rgb_to_565(uint16_t *dst, uint8_t const *src, size_t n, int channels) {
+    for (size_t i = 0; i < n; ++i, src += channels) {
+        dst[i] = ((src[0] & 0xF8) << 8) | ((src[1] & 0xFC) << 3) | (src[2] >> 3);
+    }
+}
+
+uint16_t *image_load_rgb565(char const *filename, int *width, int *height, uint8_t const **alpha) {
+    int channels;
+    if (!stbi_info(filename, width, height, &channels)) {
+        return NULL;
+    }
+
+    // Grey is expanded, so there are always at least two bytes to write over
+    bool      has_alpha = alpha && (channels == 2 || channels == 4);
+    int       decoded   = has_alpha ? 4 : 3;
+    uint8_t  *data      = stbi_load(filename, width, height, &channels, decoded);
+    size_t    n         = (size_t)*width * *height;
+    uint8_t  *plane     = NULL;
+    uint16_t *pixels;
+
+    if (!data) {
+        return NULL;
+    }
+
+    if (has_alpha) {
+        plane = malloc(n);
+        if (!plane) {
+            stbi_image_free(data);
+            stbi__err("outofmem", "Out of memory");
+            return NULL;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            plane[i] = data[i * 4 + 3];
+        }
+    }
+
+    pixels = (uint16_t *)data;
+    rgb_to_565(pixels, data, n, decoded);
+
+    if (has_alpha) {
+        // Fits in what was decoded into either way
+        uint16_t *shrunk = realloc(pixels, n * 3);
+        if (shrunk) {
+            pixels = shrunk;
+        }
+        memcpy(pixels + n, plane, n);
+        free(plane);
+        *alpha = (uint8_t const *)(pixels + n);
+    } else if (alpha) {
+        *alpha = NULL;
+    }
+    return pixels;
+}
+
+void image_free(uint16_t *pixels) {
+    stbi_image_free(pixels);
+}
@@ -0,0 +1,195 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pixel/pixel.h"
+
+#include <string.h>
+
+// Red and blue in the low half, green in the high half, with room between them
+// to multiply all three by a 5 bit alpha at once
+#define SPREAD_MASK 0x07E0F81Fu
+
+// Rows shorter than this are filled without the PIE
+#define PIE_MIN_ROW 32
+
+__attribute__((always_inline)) static inline uint16_t argb_to_565(uint32_t p) {
+    return ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+}
+
+__attribute__((always_inline)) static inline uint16_t abgr_to_565(uint32_t p) {
+    return ((p & 0xF8) << 8) | ((p >> 5) & 0x07E0) | ((p >> 19) & 0x001F);
+}
+
+__attribute__((always_inline)) static inline uint32_t spread(uint16_t c) {
+    return (c | (uint32_t)c << 16) & SPREAD_MASK;
+}
+
+// fg over bg by a, 0 to 32
+__attribute__((always_inline)) static inline uint16_t blend_565(uint16_t bg, uint16_t fg, uint32_t a) {
+    uint32_t b = spread(bg);
+    uint32_t r = ((((spread(fg) - b) * a) >> 5) + b) & SPREAD_MASK;
+    return (uint16_t)(r | r >> 16);
+}
+
+// Two pixels per store once dst is on a word, the first one in the low half
+#define CONVERT_PAIRS(dst, n, convert)                                                                                 \
+    do {                                                                                                               \
+        size_t i = 0;                                                                                                  \
+        if (((uintptr_t)(dst) & 2) && n) {                                                                             \
+            (dst)[0] = convert(0);                                                                                     \
+            i        = 1;                                                                                              \
+        }                                                                                                              \
+        for (; i + 1 < n; i += 2) {                                                                                    \
+            *(uint32_t *)((dst) + i) = convert(i) | (uint32_t)convert(i + 1) << 16;                                    \
+        }                                                                                                              \
+        if (i < n) {                                                                                                   \
+            (dst)[i] = convert(i);                                                                                     \
+        }                                                                                                              \
+    } while (0)
+
+void pixel_argb8888_to_rgb565(uint16_t *dst, uint32_t const *src, size_t n) {
+#define CONVERT(i) argb_to_565(src[i])
+    CONVERT_PAIRS(dst, n, CONVERT);
+#undef CONVERT
+}
+
+void pixel_abgr8888_to_rgb565(uint16_t *dst, uint32_t const *src, size_t n) {
+#define CONVERT(i) abgr_to_565(src[i])
+    CONVERT_PAIRS(dst, n, CONVERT);
+#undef CONVERT
+}
+
+void pixel_rgb24_to_rgb565(uint16_t *dst, uint8_t const *src, size_t n) {
+#define CONVERT(i) (uint16_t)((src[(i) * 3] & 0xF8) << 8 | (src[(i) * 3 + 1] & 0xFC) << 3 | src[(i) * 3 + 2] >> 3)
+    CONVERT_PAIRS(dst, n, CONVERT);
+#undef CONVERT
+}
+
+void pixel_index8_to_rgb565(uint16_t *dst, uint8_t const *src, uint16_t const palette[256], size_t n) {
+#define CONVERT(i) palette[src[i]]
+    CONVERT_PAIRS(dst, n, CONVERT);
+#undef CONVERT
+}
+
+void pixel_rgb565a8_to_argb8888(uint32_t *dst, uint16_t const *src, uint8_t const *alpha, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t c = src[i];
+        uint32_t r = (c >> 11) & 0x1F;
+        uint32_t g = (c >> 5) & 0x3F;
+        uint32_t b = c & 0x1F;
+        // Repeat the top bits, so white stays white
+        dst[i] = (uint32_t)alpha[i] << 24 | ((r << 3) | (r >> 2)) << 16 | ((g << 2) | (g >> 4)) << 8 |
+                 ((b << 3) | (b >> 2));
+    }
+}
+
+// Most pixels of a sprite are either fully transparent or fully opaque, only
+// the edges are blended
+#define BLEND_LOOP(to_565)                                                                                             \
+    do {                                                                                                               \
+        for (size_t i = 0; i < n; ++i) {                                                                               \
+            uint32_t p = src[i];                                                                                       \
+            uint32_t a = p >> 24;                                                                                      \
+            if (alpha != 255) {                                                                                        \
+                a = (a * alpha + 255) >> 8;                                                                            \
+            }                                                                                                          \
+            if (a == 255) {                                                                                            \
+                dst[i] = to_565(p);                                                                                    \
+            } else if (a >= 4) {                                                                                       \
+                dst[i] = blend_565(dst[i], to_565(p), (a + 4) >> 3);                                                   \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+void pixel_blend_argb8888_rgb565(uint16_t *dst, uint32_t const *src, uint8_t alpha, size_t n) {
+    BLEND_LOOP(argb_to_565);
+}
+
+void pixel_blend_abgr8888_rgb565(uint16_t *dst, uint32_t const *src, uint8_t alpha, size_t n) {
+    BLEND_LOOP(abgr_to_565);
+}
+
+static void fill_row_565(uint16_t *dst, int w, uint32_t pair) {
+    int i = 0;
+    if (((uintptr_t)dst & 2) && w) {
+        dst[0] = (uint16_t)pair;
+        i      = 1;
+    }
+    for (; i + 1 < w; i += 2) {
+        *(uint32_t *)(dst + i) = pair;
+    }
+    if (i < w) {
+        dst[i] = (uint16_t)pair;
+    }
+}
+
+#ifdef __riscv_xesppie
+
+// Eight pixels per store. q3 is left alone, the kernel doesn't save it when
+// switching tasks.
+static void pie_fill_row_565(uint16_t *dst, int w, uint16_t color) {
+    uint32_t pair = color | (uint32_t)color << 16;
+    int      head = (-(uintptr_t)dst & 15) / 2;
+    fill_row_565(dst, head, pair);
+    dst += head;
+    w   -= head;
+
+    uint16_t *end = dst + (w & ~7);
+    if (dst != end) {
+        asm volatile("esp.vldbc.16.ip q0, %[c], 0\n"
+                     "1:\n"
+                     "esp.vst.128.ip q0, %[dst], 16\n"
+                     "bltu %[dst], %[end], 1b\n"
+                     : [dst] "+r"(dst)
+                     : [c] "r"(&color), [end] "r"(end)
+                     : "memory");
+    }
+    fill_row_565(dst, w & 7, pair);
+}
+
+#endif
+
+void pixel_fill_rgb565(uint16_t *dst, size_t stride, int w, int h, uint16_t color) {
+    uint32_t pair = color | (uint32_t)color << 16;
+
+    for (int y = 0; y < h; ++y, dst += stride) {
+#ifdef __riscv_xesppie
+        if (w >= PIE_MIN_ROW) {
+            pie_fill_row_565(dst, w, color);
+            continue;
+        }
+#endif
+        fill_row_565(dst, w, pair);
+    }
+}
+
+void pixel_copy_rect(
+    void *dst, size_t dst_stride_bytes, void const *src, size_t src_stride_bytes, size_t row_bytes, int h
+) {
+    uint8_t       *d = dst;
+    uint8_t const *s = src;
+
+    // Without gaps between the rows it is a single block, which memcpy() moves
+    // through the PIE when it is large
+    if (dst_stride_bytes == row_bytes && src_stride_bytes == row_bytes) {
+        memcpy(d, s, row_bytes * h);
+        return;
+    }
+
+    for (int y = 0; y < h; ++y, d += dst_stride_bytes, s += src_stride_bytes) {
+        memcpy(d, s, row_bytes);
+    }
+}
@@ -0,0 +1,443 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pixel/pixel.h"
+#include "raster_private.h"
+
+#include <sys/param.h>
+
+// Vertices are snapped to 1/16 of a pixel for the triangle setup, which keeps
+// its products within 64 bits
+#define SUB_BITS 4
+#define SUB_ONE  (1 << SUB_BITS)
+#define SUB_HALF (SUB_ONE / 2)
+
+// Fraction bits depth is interpolated with
+#define DEPTH_SHIFT 12
+// Gradients of triangles thinner than a pixel are clamped to this
+#define GRADIENT_MAX (1 << 30)
+
+// Red and blue in the low half, green in the high half, as in the pixel library
+#define SPREAD_MASK 0x07E0F81Fu
+
+#define SWAP(a, b)                                                                                                     \
+    do {                                                                                                               \
+        __typeof__(a) swap_ = (a);                                                                                     \
+        (a)                 = (b);                                                                                     \
+        (b)                 = swap_;                                                                                   \
+    } while (0)
+
+// What is interpolated across a triangle. Gouraud shading uses the colour
+// channels, texturing the texture coordinates and the light.
+enum {
+    ATTR_Z,
+    ATTR_R,
+    ATTR_G,
+    ATTR_B,
+    ATTRS,
+    ATTR_U     = ATTR_R,
+    ATTR_V     = ATTR_G,
+    ATTR_LIGHT = ATTR_B,
+};
+
+typedef struct {
+    int32_t x, y;
+} point_t;
+
+// Attributes as planes over the triangle, at the first vertex and per pixel
+typedef struct {
+    point_t origin;
+    int32_t value[ATTRS];
+    int32_t dx[ATTRS];
+    int32_t dy[ATTRS];
+    int32_t min[ATTRS]; // Over the vertices, pixels inside stay in between
+    int32_t max[ATTRS];
+} setup_t;
+
+// Where an edge crosses the pixel centres of a row, stepped from row to row
+// without rounding errors. x is the first pixel whose centre is on or right of
+// the edge, e how far that centre is past it in 1/d.
+typedef struct {
+    int32_t x;
+    int32_t e;
+    int32_t d;
+    int32_t q; // Whole pixels per row
+    int32_t r; // And the rest of it, in 1/d
+} edge_t;
+
+static int64_t floor_div(int64_t n, int64_t d) {
+    int64_t q = n / d;
+    return n % d < 0 ? q - 1 : q;
+}
+
+// The first row whose pixel centres are at or below y
+static int first_row(int32_t y) {
+    return (y + SUB_HALF - 1) >> SUB_BITS;
+}
+
+static void edge_init(edge_t *edge, point_t a, point_t b, int row) {
+    int64_t den = b.y - a.y;
+    int64_t d   = den * SUB_ONE;
+    int64_t n   = (int64_t)(a.x - SUB_HALF) * den + (int64_t)(row * SUB_ONE + SUB_HALF - a.y) * (b.x - a.x);
+    int64_t x   = -floor_div(-n, d);
+    int64_t s   = (int64_t)(b.x - a.x) * SUB_ONE;
+    int64_t q   = floor_div(s, d);
+
+    edge->x = x;
+    edge->e = x * d - n;
+    edge->d = d;
+    edge->q = q;
+    edge->r = s - q * d;
+}
+
+__attribute__((always_inline)) static inline void edge_step(edge_t *edge) {
+    edge->x += edge->q;
+    edge->e -= edge->r;
+    if (edge->e < 0) {
+        edge->x += 1;
+        edge->e += edge->d;
+    }
+}
+
+static int32_t gradient_clamp(int64_t g) {
+    return MAX(-GRADIENT_MAX, MIN(GRADIENT_MAX, g));
+}
+
+static void setup_init(setup_t *setup, point_t const p[3], int32_t const a[3][ATTRS], int64_t area) {
+    int64_t dx1 = p[1].x - p[0].x;
+    int64_t dy1 = p[1].y - p[0].y;
+    int64_t dx2 = p[2].x - p[0].x;
+    int64_t dy2 = p[2].y - p[0].y;
+
+    setup->origin = p[0];
+    for (int i = 0; i < ATTRS; ++i) {
+        int64_t da1      = (int64_t)a[1][i] - a[0][i];
+        int64_t da2      = (int64_t)a[2][i] - a[0][i];
+        setup->value[i] = a[0][i];
+        setup->dx[i]    = gradient_clamp((da1 * dy2 - da2 * dy1) * SUB_ONE / area);
+        setup->dy[i]    = gradient_clamp((da2 * dx1 - da1 * dx2) * SUB_ONE / area);
+        setup->min[i]   = MIN(a[0][i], MIN(a[1][i], a[2][i]));
+        setup->max[i]   = MAX(a[0][i], MAX(a[1][i], a[2][i]));
+    }
+}
+
+// The attributes at the centre of pixel (x, y). Clamped gradients of slivers
+// would take them anywhere, so they are kept between those of the vertices.
+static void setup_at(setup_t const *setup, int x, int y, int32_t out[ATTRS]) {
+    int64_t ox = x * SUB_ONE + SUB_HALF - setup->origin.x;
+    int64_t oy = y * SUB_ONE + SUB_HALF - setup->origin.y;
+    for (int i = 0; i < ATTRS; ++i) {
+        int64_t value = setup->value[i] + ((setup->dx[i] * ox + setup->dy[i] * oy) >> SUB_BITS);
+        out[i]        = MAX(setup->min[i], MIN(setup->max[i], value));
+    }
+}
+
+// c times light, 0 to 255, in 5 bit steps
+__attribute__((always_inline)) static inline uint16_t shade_565(uint16_t c, int32_t light) {
+    uint32_t s = ((light >> 16) + 1) >> 3;
+    uint32_t p = (c | (uint32_t)c << 16) & SPREAD_MASK;
+    p          = ((p * s) >> 5) & SPREAD_MASK;
+    return (uint16_t)(p | p >> 16);
+}
+
+__attribute__((always_inline)) static inline bool depth_pass(uint16_t *depth, int x, int32_t z) {
+    uint16_t d = z >> DEPTH_SHIFT;
+    if (depth && d >= depth[x]) {
+        return false;
+    }
+    if (depth) {
+        depth[x] = d;
+    }
+    return true;
+}
+
+static void span_textured(
+    uint16_t *dst, uint16_t *depth, int xa, int xb, int32_t a[ATTRS], setup_t const *setup, raster_paint_t const *paint
+) {
+    raster_texture_t const *texture = paint->texture;
+    uint16_t const         *texels  = texture->pixels;
+    int                     w_log2  = texture->w_log2;
+    uint32_t                w_mask  = (1u << texture->w_log2) - 1;
+    uint32_t                h_mask  = (1u << texture->h_log2) - 1;
+    int32_t                 u       = a[ATTR_U];
+    int32_t                 v       = a[ATTR_V];
+    int32_t                 du      = setup->dx[ATTR_U];
+    int32_t                 dv      = setup->dx[ATTR_V];
+
+#define TEXEL() texels[((uint32_t)(v >> 16) & h_mask) << w_log2 | ((uint32_t)(u >> 16) & w_mask)]
+
+    if (!depth && !(paint->flags & (RASTER_COLORKEY | RASTER_LIT))) {
+        for (int x = xa; x < xb; ++x, u += du, v += dv) {
+            dst[x] = TEXEL();
+        }
+        return;
+    }
+
+    bool    colorkey = paint->flags & RASTER_COLORKEY;
+    bool    lit      = paint->flags & RASTER_LIT;
+    int32_t z        = a[ATTR_Z];
+    int32_t dz       = setup->dx[ATTR_Z];
+    int32_t light    = a[ATTR_LIGHT];
+    int32_t dlight   = setup->dx[ATTR_LIGHT];
+    for (int x = xa; x < xb; ++x, u += du, v += dv, z += dz, light += dlight) {
+        uint16_t texel = TEXEL();
+        if ((colorkey && texel == RASTER_COLORKEY_565) || !depth_pass(depth, x, z)) {
+            continue;
+        }
+        dst[x] = lit ? shade_565(texel, light) : texel;
+    }
+
+#undef TEXEL
+}
+
+static void span_gouraud(uint16_t *dst, uint16_t *depth, int xa, int xb, int32_t a[ATTRS], setup_t const *setup) {
+    int32_t z  = a[ATTR_Z];
+    int32_t r  = a[ATTR_R];
+    int32_t g  = a[ATTR_G];
+    int32_t b  = a[ATTR_B];
+    int32_t dz = setup->dx[ATTR_Z];
+    int32_t dr = setup->dx[ATTR_R];
+    int32_t dg = setup->dx[ATTR_G];
+    int32_t db = setup->dx[ATTR_B];
+
+    for (int x = xa; x < xb; ++x, z += dz, r += dr, g += dg, b += db) {
+        if (depth_pass(depth, x, z)) {
+            dst[x] = (r >> 16) << 11 | (g >> 16) << 5 | (b >> 16);
+        }
+    }
+}
+
+static void
+    span_flat(uint16_t *dst, uint16_t *depth, int xa, int xb, int32_t a[ATTRS], setup_t const *setup, uint16_t color) {
+    if (!depth) {
+        pixel_fill_rgb565(dst + xa, 0, xb - xa, 1, color);
+        return;
+    }
+
+    int32_t z  = a[ATTR_Z];
+    int32_t dz = setup->dx[ATTR_Z];
+    for (int x = xa; x < xb; ++x, z += dz) {
+        if (depth_pass(depth, x, z)) {
+            dst[x] = color;
+        }
+    }
+}
+
+static void triangle_rows(
+    raster_target_t const *target,
+    raster_clip_t const   *clip,
+    setup_t const         *setup,
+    raster_paint_t const  *paint,
+    edge_t                *left,
+    edge_t                *right,
+    int                    y0,
+    int                    y1
+) {
+    bool depth_test = (paint->flags & RASTER_DEPTH) && target->depth;
+
+    for (int y = y0; y < y1; ++y, edge_step(left), edge_step(right)) {
+        int xa = MAX(left->x, clip->x0);
+        int xb = MIN(right->x, clip->x1);
+        if (xa >= xb) {
+            continue;
+        }
+
+        uint16_t *dst   = target->pixels + y * target->stride;
+        uint16_t *depth = depth_test ? target->depth + y * target->stride : NULL;
+        int32_t   a[ATTRS];
+        setup_at(setup, xa, y, a);
+
+        switch (paint->mode) {
+            case RASTER_FLAT: span_flat(dst, depth, xa, xb, a, setup, paint->color); break;
+            case RASTER_GOURAUD: span_gouraud(dst, depth, xa, xb, a, setup); break;
+            case RASTER_TEXTURED: span_textured(dst, depth, xa, xb, a, setup, paint); break;
+        }
+    }
+}
+
+static void vertex_attributes(raster_vertex_t const *v, raster_paint_t const *paint, int32_t a[ATTRS]) {
+    a[ATTR_Z] = (int32_t)v->z << DEPTH_SHIFT;
+    if (paint->mode == RASTER_GOURAUD) {
+        // Half a step up, so the truncation to 5 and 6 bits rounds
+        a[ATTR_R] = ((v->color >> 11) << 16) + 0x8000;
+        a[ATTR_G] = (((v->color >> 5) & 0x3F) << 16) + 0x8000;
+        a[ATTR_B] = ((v->color & 0x1F) << 16) + 0x8000;
+    } else {
+        a[ATTR_U]     = v->u;
+        a[ATTR_V]     = v->v;
+        a[ATTR_LIGHT] = (v->light << 16) + 0x8000;
+    }
+}
+
+void raster_triangle_clipped(
+    raster_target_t const *target, raster_clip_t const *clip, raster_vertex_t const v[3], raster_paint_t const *paint
+) {
+    if (paint->mode == RASTER_TEXTURED && (!paint->texture || !paint->texture->pixels)) {
+        return;
+    }
+
+    // Top to bottom
+    raster_vertex_t const *sorted[3] = {&v[0], &v[1], &v[2]};
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2 - i; ++j) {
+            if (sorted[j]->y > sorted[j + 1]->y) {
+                SWAP(sorted[j], sorted[j + 1]);
+            }
+        }
+    }
+
+    point_t p[3];
+    for (int i = 0; i < 3; ++i) {
+        p[i] = (point_t){sorted[i]->x >> (16 - SUB_BITS), sorted[i]->y >> (16 - SUB_BITS)};
+    }
+
+    int64_t area = (int64_t)(p[1].x - p[0].x) * (p[2].y - p[0].y) - (int64_t)(p[2].x - p[0].x) * (p[1].y - p[0].y);
+    if (!area) {
+        return;
+    }
+
+    int top    = first_row(p[0].y);
+    int middle = first_row(p[1].y);
+    int bottom = first_row(p[2].y);
+    int y0     = MAX(top, clip->y0);
+    int y1     = MIN(bottom, clip->y1);
+    if (y0 >= y1 || clip->x0 >= clip->x1) {
+        return;
+    }
+
+    int32_t a[3][ATTRS];
+    for (int i = 0; i < 3; ++i) {
+        vertex_attributes(sorted[i], paint, a[i]);
+    }
+    setup_t setup;
+    setup_init(&setup, p, a, area);
+
+    // The long edge is on the left if the middle vertex is to the right of it
+    bool   long_left = area > 0;
+    edge_t long_edge;
+    edge_t short_edge;
+    edge_init(&long_edge, p[0], p[2], y0);
+
+    if (y0 < middle) {
+        int end = MIN(middle, y1);
+        edge_init(&short_edge, p[0], p[1], y0);
+        if (long_left) {
+            triangle_rows(target, clip, &setup, paint, &long_edge, &short_edge, y0, end);
+        } else {
+            triangle_rows(target, clip, &setup, paint, &short_edge, &long_edge, y0, end);
+        }
+        y0 = end;
+    }
+
+    if (y0 < y1) {
+        edge_init(&short_edge, p[1], p[2], y0);
+        if (long_left) {
+            triangle_rows(target, clip, &setup, paint, &long_edge, &short_edge, y0, y1);
+        } else {
+            triangle_rows(target, clip, &setup, paint, &short_edge, &long_edge, y0, y1);
+        }
+    }
+}
+
+void raster_triangle(raster_target_t const *target, raster_vertex_t const v[3], raster_paint_t const *paint) {
+    raster_clip_t clip = raster_target_clip(target);
+    raster_triangle_clipped(target, &clip, v, paint);
+}
+
+raster_clip_t raster_target_clip(raster_target_t const *target) {
+    raster_clip_t clip = {0, 0, target->w, target->h};
+    if (target->clip.w > 0 && target->clip.h > 0) {
+        clip.x0 = MAX(clip.x0, target->clip.x);
+        clip.y0 = MAX(clip.y0, target->clip.y);
+        clip.x1 = MIN(clip.x1, target->clip.x + target->clip.w);
+        clip.y1 = MIN(clip.y1, target->clip.y + target->clip.h);
+    }
+    return clip;
+}
+
+void raster_rect(raster_target_t const *target, raster_rect_t rect, uint16_t color) {
+    raster_clip_t clip = raster_target_clip(target);
+    int           x0   = MAX(rect.x, clip.x0);
+    int           y0   = MAX(rect.y, clip.y0);
+    int           x1   = MIN(rect.x + rect.w, clip.x1);
+    int           y1   = MIN(rect.y + rect.h, clip.y1);
+    if (x0 < x1 && y0 < y1) {
+        pixel_fill_rgb565(target->pixels + y0 * target->stride + x0, target->stride, x1 - x0, y1 - y0, color);
+    }
+}
+
+void raster_span(raster_target_t const *target, int y, int x0, int x1, uint16_t color) {
+    raster_rect(target, (raster_rect_t){x0, y, x1 - x0, 1}, color);
+}
+
+void raster_clear(raster_target_t const *target, uint16_t color) {
+    raster_clip_t clip = raster_target_clip(target);
+    if (clip.x0 >= clip.x1 || clip.y0 >= clip.y1) {
+        return;
+    }
+
+    size_t offset = clip.y0 * target->stride + clip.x0;
+    pixel_fill_rgb565(target->pixels + offset, target->stride, clip.x1 - clip.x0, clip.y1 - clip.y0, color);
+    if (target->depth) {
+        pixel_fill_rgb565(target->depth + offset, target->stride, clip.x1 - clip.x0, clip.y1 - clip.y0, UINT16_MAX);
+    }
+}
+
+// Steps along the longer axis a pixel at a time, the other coordinate in 16.16
+void raster_line(
+    raster_target_t const *target, raster_fixed_t x0, raster_fixed_t y0, raster_fixed_t x1, raster_fixed_t y1,
+    uint16_t color
+) {
+    raster_clip_t clip  = raster_target_clip(target);
+    int64_t       dx    = (int64_t)x1 - x0;
+    int64_t       dy    = (int64_t)y1 - y0;
+    bool          steep = (dy < 0 ? -dy : dy) > (dx < 0 ? -dx : dx);
+
+    // Walk along x, with x and y swapped for steep lines
+    if (steep) {
+        SWAP(x0, y0);
+        SWAP(x1, y1);
+        SWAP(dx, dy);
+    }
+    if (dx < 0) {
+        SWAP(x0, x1);
+        SWAP(y0, y1);
+        dx = -dx;
+        dy = -dy;
+    }
+
+    int     major_min = steep ? clip.y0 : clip.x0;
+    int     major_max = steep ? clip.y1 : clip.x1;
+    int     minor_min = steep ? clip.x0 : clip.y0;
+    int     minor_max = steep ? clip.x1 : clip.y1;
+    int     start     = MAX(x0 >> 16, major_min);
+    int     end       = MIN((x1 >> 16) + 1, major_max);
+    int64_t slope     = dx ? (dy << 16) / dx : 0;
+    int64_t minor     = y0 + ((((int64_t)start << 16) + 0x8000 - x0) * slope >> 16);
+
+    for (int major = start; major < end; ++major, minor += slope) {
+        int m = minor >> 16;
+        if (m < minor_min || m >= minor_max) {
+            continue;
+        }
+        if (steep) {
+            target->pixels[major * target->stride + m] = color;
+        } else {
+            target->pixels[m * target->stride + major] = color;
+        }
+    }
+}
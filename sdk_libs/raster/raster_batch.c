@@ -0,0 +1,116 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "raster_private.h"
+
+#include <stdlib.h>
+#include <sys/param.h>
+
+// Rows per band, each band is one piece of work for the pool
+#define BAND_ROWS 32
+
+typedef struct {
+    raster_vertex_t v[3];
+    raster_paint_t  paint;
+    int             y0, y1; // The rows it can touch, y1 excluded
+} batch_triangle_t;
+
+struct raster_batch {
+    int              count;
+    int              max;
+    batch_triangle_t triangles[];
+};
+
+typedef struct {
+    raster_batch_t const  *batch;
+    raster_target_t const *target;
+    raster_clip_t          clip;
+    int                    first_band;
+} batch_draw_t;
+
+raster_batch_t *raster_batch_create(int max_triangles) {
+    if (max_triangles <= 0) {
+        return NULL;
+    }
+
+    raster_batch_t *batch = malloc(sizeof(raster_batch_t) + sizeof(batch_triangle_t) * max_triangles);
+    if (!batch) {
+        return NULL;
+    }
+
+    batch->count = 0;
+    batch->max   = max_triangles;
+    return batch;
+}
+
+void raster_batch_destroy(raster_batch_t *batch) {
+    free(batch);
+}
+
+bool raster_batch_triangle(raster_batch_t *batch, raster_vertex_t const v[3], raster_paint_t const *paint) {
+    if (batch->count == batch->max) {
+        return false;
+    }
+
+    batch_triangle_t *triangle = &batch->triangles[batch->count++];
+    triangle->v[0]             = v[0];
+    triangle->v[1]             = v[1];
+    triangle->v[2]             = v[2];
+    triangle->paint            = *paint;
+    triangle->y0               = MIN(v[0].y, MIN(v[1].y, v[2].y)) >> 16;
+    triangle->y1               = (MAX(v[0].y, MAX(v[1].y, v[2].y)) >> 16) + 1;
+    return true;
+}
+
+static void batch_draw_bands(void *data, int start, int end) {
+    batch_draw_t const *draw = data;
+
+    for (int band = draw->first_band + start; band < draw->first_band + end; ++band) {
+        raster_clip_t clip = draw->clip;
+        clip.y0            = MAX(clip.y0, band * BAND_ROWS);
+        clip.y1            = MIN(clip.y1, (band + 1) * BAND_ROWS);
+
+        for (int i = 0; i < draw->batch->count; ++i) {
+            batch_triangle_t const *triangle = &draw->batch->triangles[i];
+            if (triangle->y1 <= clip.y0 || triangle->y0 >= clip.y1) {
+                continue;
+            }
+            raster_triangle_clipped(draw->target, &clip, triangle->v, &triangle->paint);
+        }
+    }
+}
+
+void raster_batch_draw(raster_batch_t *batch, raster_target_t const *target, threadpool_t *pool) {
+    batch_draw_t draw = {
+        .batch  = batch,
+        .target = target,
+        .clip   = raster_target_clip(target),
+    };
+
+    if (batch->count && draw.clip.x0 < draw.clip.x1 && draw.clip.y0 < draw.clip.y1) {
+        // Bands don't share rows, so the workers never touch the same pixels
+        draw.first_band = draw.clip.y0 / BAND_ROWS;
+        int bands       = (draw.clip.y1 + BAND_ROWS - 1) / BAND_ROWS - draw.first_band;
+        if (pool) {
+            threadpool_parallel_for(pool, 0, bands, 1, batch_draw_bands, &draw);
+        } else {
+            batch_draw_bands(&draw, 0, bands);
+        }
+    }
+
+    batch->count = 0;
+}
@@ -0,0 +1,30 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "raster/raster.h"
+
+// Where drawing is allowed in whole pixels, x1 and y1 excluded
+typedef struct {
+    int x0, y0, x1, y1;
+} raster_clip_t;
+
+raster_clip_t raster_target_clip(raster_target_t const *target);
+void          raster_triangle_clipped(
+    raster_target_t const *target, raster_clip_t const *clip, raster_vertex_t const v[3], raster_paint_t const *paint
+);
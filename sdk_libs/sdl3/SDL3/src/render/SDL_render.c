@@ -108,6 +108,9 @@ this should probably be removed at some point in the future.  --ryan. */
 
 #ifndef SDL_RENDER_DISABLED
 static const SDL_RenderDriver *render_drivers[] = {
+#ifdef SDL_VIDEO_RENDER_BADGEVMS
+    &BADGEVMS_RenderDriver,
+#endif
 #ifdef SDL_VIDEO_RENDER_D3D11
     &D3D11_RenderDriver,
 #endif
@@ -1676,6 +1679,13 @@ SDL_Texture *SDL_CreateTextureFromSurface(SDL_Renderer *renderer, SDL_Surface *s
                 }
             }
         }
+#ifdef SDL_VIDEO_RENDER_BADGEVMS
+    } else if (!needAlpha && renderer->name == BADGEVMS_RenderDriver.name &&
+               !SDL_ISPIXELFORMAT_10BIT(surface->format) && !SDL_ISPIXELFORMAT_FLOAT(surface->format)) {
+        // Opaque images are converted to the window's format once, here, so
+        // that every copy after is a straight PPA copy of half the bytes
+        format = renderer->texture_formats[0];
+#endif
     } else {
         // Exact match would be fine
         for (i = 0; i < renderer->num_texture_formats; ++i) {
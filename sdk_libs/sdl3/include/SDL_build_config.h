@@ -547,6 +547,7 @@ typedef unsigned int uintptr_t;
 
 /* BADGEVMS config */
 #define SDL_VIDEO_DRIVER_BADGEVMS 1
+#define SDL_VIDEO_RENDER_BADGEVMS 1
 #define SDL_PLATFORM_BADGEVMS 1
 #define SDL_TIMER_UNIX 1
 
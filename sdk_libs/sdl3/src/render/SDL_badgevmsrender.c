@@ -0,0 +1,607 @@
+/*
+  Simple DirectMedia Layer
+  Copyright (C) 1997-2025 Sam Lantinga <slouken@libsdl.org>
+  Copyright (C) 2025 HP van Braam <hp@tmm.cx>
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+#include "SDL_internal.h"
+
+#ifdef SDL_VIDEO_RENDER_BADGEVMS
+
+#include "../../SDL3/src/render/SDL_sysrender.h"
+#include "../../SDL3/src/render/software/SDL_render_sw_c.h"
+#include "../video/SDL_badgevmsvideo.h"
+
+#include "badgevms/misc_funcs.h"
+#include "pixel/pixel.h"
+
+/* The software renderer with the PPA doing copies, fills and clears into the
+ * window, and the pixel library the ones too small for the PPA. Everything
+ * else, and everything drawn into a texture, is left to the software
+ * renderer, in order.
+ */
+
+// Textures the PPA reads live in memory from dma_buffer_alloc(), which comes
+// in pages. Small textures share a chunk, which is freed with its last texture.
+#define BADGEVMS_TEXTURE_CHUNK (256 * 1024)
+#define BADGEVMS_TEXTURE_ALIGN 64
+
+// Below this many pixels the CPU is done before a PPA operation is set up
+#define BADGEVMS_PPA_MIN_PIXELS 1024
+
+typedef struct BADGEVMS_TextureChunk
+{
+    Uint8 *pixels;
+    size_t size;
+    size_t used;
+    int textures;
+    struct BADGEVMS_TextureChunk *next;
+} BADGEVMS_TextureChunk;
+
+typedef struct
+{
+    const SDL_Rect *viewport;
+    const SDL_Rect *cliprect;
+    SDL_Color color;
+    // What the software renderer needs to pick up where we are
+    SDL_RenderCommand *viewport_cmd;
+    SDL_RenderCommand *cliprect_cmd;
+    SDL_RenderCommand *color_cmd;
+} BADGEVMS_DrawState;
+
+static BADGEVMS_TextureChunk *texture_chunks;
+
+// The software renderer's, for everything we don't do
+static bool (*sw_create_texture)(SDL_Renderer *renderer, SDL_Texture *texture, SDL_PropertiesID create_props);
+static void (*sw_destroy_texture)(SDL_Renderer *renderer, SDL_Texture *texture);
+static bool (*sw_run_command_queue)(SDL_Renderer *renderer, SDL_RenderCommand *cmd, void *vertices, size_t vertsize);
+
+static void *BADGEVMS_TextureAlloc(size_t size)
+{
+    BADGEVMS_TextureChunk *chunk;
+
+    size = (size + BADGEVMS_TEXTURE_ALIGN - 1) & ~(size_t)(BADGEVMS_TEXTURE_ALIGN - 1);
+
+    for (chunk = texture_chunks; chunk; chunk = chunk->next) {
+        if (chunk->size - chunk->used >= size) {
+            break;
+        }
+    }
+
+    if (!chunk) {
+        chunk = (BADGEVMS_TextureChunk *)SDL_calloc(1, sizeof(*chunk));
+        if (!chunk) {
+            return NULL;
+        }
+
+        chunk->size = SDL_max(size, BADGEVMS_TEXTURE_CHUNK);
+        chunk->pixels = (Uint8 *)dma_buffer_alloc(chunk->size, NULL);
+        if (!chunk->pixels) {
+            SDL_free(chunk);
+            return NULL;
+        }
+        chunk->next = texture_chunks;
+        texture_chunks = chunk;
+    }
+
+    void *pixels = chunk->pixels + chunk->used;
+    chunk->used += size;
+    chunk->textures++;
+    return pixels;
+}
+
+static bool BADGEVMS_TextureFree(void *pixels)
+{
+    for (BADGEVMS_TextureChunk **chunk = &texture_chunks; *chunk; chunk = &(*chunk)->next) {
+        BADGEVMS_TextureChunk *c = *chunk;
+        if ((Uint8 *)pixels < c->pixels || (Uint8 *)pixels >= c->pixels + c->size) {
+            continue;
+        }
+
+        if (--c->textures == 0) {
+            *chunk = c->next;
+            dma_buffer_free(c->pixels);
+            SDL_free(c);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool BADGEVMS_IsTexture(const void *pixels)
+{
+    for (BADGEVMS_TextureChunk *chunk = texture_chunks; chunk; chunk = chunk->next) {
+        if ((const Uint8 *)pixels >= chunk->pixels && (const Uint8 *)pixels < chunk->pixels + chunk->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// How the compositor reads a texture format, the padding byte of the X formats
+// is taken for alpha, so those are only ever copied
+static pixel_format_t BADGEVMS_TextureFormat(SDL_PixelFormat format, bool *alpha)
+{
+    *alpha = SDL_ISPIXELFORMAT_ALPHA(format);
+
+    // BadgeVMS pixel formats are the same as this version of SDL
+    switch (format) {
+    case SDL_PIXELFORMAT_XRGB8888:
+        return BADGEVMS_PIXELFORMAT_ARGB8888;
+    case SDL_PIXELFORMAT_XBGR8888:
+        return BADGEVMS_PIXELFORMAT_ABGR8888;
+    case SDL_PIXELFORMAT_RGBX8888:
+        return BADGEVMS_PIXELFORMAT_RGBA8888;
+    case SDL_PIXELFORMAT_BGRX8888:
+        return BADGEVMS_PIXELFORMAT_BGRA8888;
+    case SDL_PIXELFORMAT_ARGB8888:
+    case SDL_PIXELFORMAT_ABGR8888:
+    case SDL_PIXELFORMAT_RGBA8888:
+    case SDL_PIXELFORMAT_BGRA8888:
+    case SDL_PIXELFORMAT_RGB24:
+    case SDL_PIXELFORMAT_BGR24:
+    case SDL_PIXELFORMAT_RGB565:
+    case SDL_PIXELFORMAT_BGR565:
+        return (pixel_format_t)format;
+    default:
+        return BADGEVMS_PIXELFORMAT_UNKNOWN;
+    }
+}
+
+static bool BADGEVMS_CreateTexture(SDL_Renderer *renderer, SDL_Texture *texture, SDL_PropertiesID create_props)
+{
+    bool alpha;
+    pixel_format_t format = BADGEVMS_TextureFormat(texture->format, &alpha);
+    int pitch = texture->w * SDL_BYTESPERPIXEL(texture->format);
+
+    if (format == BADGEVMS_PIXELFORMAT_UNKNOWN) {
+        return sw_create_texture(renderer, texture, create_props);
+    }
+
+    void *pixels = BADGEVMS_TextureAlloc((size_t)pitch * texture->h);
+    if (!pixels) {
+        return sw_create_texture(renderer, texture, create_props);
+    }
+
+    // Like the software renderer's, without RLE which the PPA can't read
+    SDL_Surface *surface = SDL_CreateSurfaceFrom(texture->w, texture->h, texture->format, pixels, pitch);
+    if (!SDL_SurfaceValid(surface)) {
+        BADGEVMS_TextureFree(pixels);
+        return SDL_SetError("Cannot create surface");
+    }
+    texture->internal = surface;
+
+    Uint8 r = (Uint8)SDL_roundf(SDL_clamp(texture->color.r, 0.0f, 1.0f) * 255.0f);
+    Uint8 g = (Uint8)SDL_roundf(SDL_clamp(texture->color.g, 0.0f, 1.0f) * 255.0f);
+    Uint8 b = (Uint8)SDL_roundf(SDL_clamp(texture->color.b, 0.0f, 1.0f) * 255.0f);
+    Uint8 a = (Uint8)SDL_roundf(SDL_clamp(texture->color.a, 0.0f, 1.0f) * 255.0f);
+    SDL_SetSurfaceColorMod(surface, r, g, b);
+    SDL_SetSurfaceAlphaMod(surface, a);
+    SDL_SetSurfaceBlendMode(surface, texture->blendMode);
+
+    return true;
+}
+
+static void BADGEVMS_DestroyTexture(SDL_Renderer *renderer, SDL_Texture *texture)
+{
+    SDL_Surface *surface = (SDL_Surface *)texture->internal;
+    void *pixels = surface ? surface->pixels : NULL;
+
+    sw_destroy_texture(renderer, texture);
+    if (pixels) {
+        BADGEVMS_TextureFree(pixels);
+    }
+}
+
+// What the software renderer clips to, see SetDrawState() there
+static bool BADGEVMS_ClipRect(const BADGEVMS_DrawState *drawstate, const framebuffer_t *fb, SDL_Rect *clip)
+{
+    const SDL_Rect bounds = { 0, 0, (int)fb->w, (int)fb->h };
+
+    if (!drawstate->viewport) {
+        return false;
+    }
+
+    *clip = *drawstate->viewport;
+    if (drawstate->cliprect) {
+        SDL_Rect rect = *drawstate->cliprect;
+        rect.x += drawstate->viewport->x;
+        rect.y += drawstate->viewport->y;
+        if (!SDL_GetRectIntersection(clip, &rect, clip)) {
+            clip->w = clip->h = 0;
+            return true;
+        }
+    }
+    if (!SDL_GetRectIntersection(clip, &bounds, clip)) {
+        clip->w = clip->h = 0;
+    }
+    return true;
+}
+
+static Uint32 BADGEVMS_Color(SDL_Color color)
+{
+    return ((Uint32)color.a << 24) | ((Uint32)color.r << 16) | ((Uint32)color.g << 8) | color.b;
+}
+
+static SDL_Color BADGEVMS_CommandColor(const SDL_RenderCommand *cmd)
+{
+    SDL_Color color;
+    color.r = (Uint8)SDL_roundf(SDL_clamp(cmd->data.color.color.r * cmd->data.color.color_scale, 0.0f, 1.0f) * 255.0f);
+    color.g = (Uint8)SDL_roundf(SDL_clamp(cmd->data.color.color.g * cmd->data.color.color_scale, 0.0f, 1.0f) * 255.0f);
+    color.b = (Uint8)SDL_roundf(SDL_clamp(cmd->data.color.color.b * cmd->data.color.color_scale, 0.0f, 1.0f) * 255.0f);
+    color.a = (Uint8)SDL_roundf(SDL_clamp(cmd->data.color.color.a, 0.0f, 1.0f) * 255.0f);
+    return color;
+}
+
+static window_rect_t BADGEVMS_WindowRect(SDL_Rect rect)
+{
+    window_rect_t r = { rect.x, rect.y, rect.w, rect.h };
+    return r;
+}
+
+static bool BADGEVMS_FillRects(window_handle_t window, const framebuffer_t *fb, const SDL_RenderCommand *cmd, void *vertices, const BADGEVMS_DrawState *drawstate)
+{
+    const SDL_Rect *verts = (const SDL_Rect *)((Uint8 *)vertices + cmd->data.draw.first);
+    const int count = (int)cmd->data.draw.count;
+    SDL_Rect clip;
+
+    // Blending with anything but an opaque color is left to the CPU
+    if (cmd->data.draw.blend != SDL_BLENDMODE_NONE && (cmd->data.draw.blend != SDL_BLENDMODE_BLEND || drawstate->color.a != 255)) {
+        return false;
+    }
+    if (!BADGEVMS_ClipRect(drawstate, fb, &clip)) {
+        return false;
+    }
+
+    // All or nothing, the software renderer gets the command as a whole. The
+    // CPU only fills small rects of the usual window format.
+    if (fb->format != BADGEVMS_PIXELFORMAT_RGB565) {
+        for (int i = 0; i < count; i++) {
+            SDL_Rect rect = verts[i];
+            SDL_Rect clipped;
+            rect.x += drawstate->viewport->x;
+            rect.y += drawstate->viewport->y;
+            if (SDL_GetRectIntersection(&rect, &clip, &clipped) && clipped.w * clipped.h < BADGEVMS_PPA_MIN_PIXELS) {
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        SDL_Rect rect = verts[i];
+        SDL_Rect clipped;
+        rect.x += drawstate->viewport->x;
+        rect.y += drawstate->viewport->y;
+        if (!SDL_GetRectIntersection(&rect, &clip, &clipped)) {
+            continue;
+        }
+
+        if (clipped.w * clipped.h < BADGEVMS_PPA_MIN_PIXELS) {
+            pixel_fill_rgb565(fb->pixels + (size_t)clipped.y * fb->w + clipped.x, fb->w, clipped.w, clipped.h,
+                              rgb888_to_rgb565(drawstate->color.r, drawstate->color.g, drawstate->color.b));
+        } else if (!window_framebuffer_fill(window, BADGEVMS_WindowRect(clipped), BADGEVMS_Color(drawstate->color))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// An unscaled copy too small for the PPA, into the usual window format
+static bool BADGEVMS_CopyCPU(const framebuffer_t *fb, const SDL_Surface *surface, SDL_Rect src, SDL_Rect dst, Uint8 alpha, bool blend)
+{
+    const Uint8 *from = (const Uint8 *)surface->pixels + src.y * surface->pitch + src.x * SDL_BYTESPERPIXEL(surface->format);
+    Uint16 *to = fb->pixels + (size_t)dst.y * fb->w + dst.x;
+
+    if (fb->format != BADGEVMS_PIXELFORMAT_RGB565) {
+        return false;
+    }
+
+    switch (surface->format) {
+    case SDL_PIXELFORMAT_RGB565:
+        if (blend) {
+            return false;
+        }
+        pixel_copy_rect(to, fb->w * sizeof(Uint16), from, surface->pitch, dst.w * sizeof(Uint16), dst.h);
+        return true;
+    case SDL_PIXELFORMAT_RGB24:
+        if (blend) {
+            return false;
+        }
+        for (int y = 0; y < dst.h; y++, from += surface->pitch, to += fb->w) {
+            pixel_rgb24_to_rgb565(to, from, dst.w);
+        }
+        return true;
+    case SDL_PIXELFORMAT_ARGB8888:
+    case SDL_PIXELFORMAT_XRGB8888:
+        for (int y = 0; y < dst.h; y++, from += surface->pitch, to += fb->w) {
+            if (blend) {
+                pixel_blend_argb8888_rgb565(to, (const Uint32 *)from, alpha, dst.w);
+            } else {
+                pixel_argb8888_to_rgb565(to, (const Uint32 *)from, dst.w);
+            }
+        }
+        return true;
+    case SDL_PIXELFORMAT_ABGR8888:
+    case SDL_PIXELFORMAT_XBGR8888:
+        for (int y = 0; y < dst.h; y++, from += surface->pitch, to += fb->w) {
+            if (blend) {
+                pixel_blend_abgr8888_rgb565(to, (const Uint32 *)from, alpha, dst.w);
+            } else {
+                pixel_abgr8888_to_rgb565(to, (const Uint32 *)from, dst.w);
+            }
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool BADGEVMS_Copy(window_handle_t window, const framebuffer_t *fb, const SDL_RenderCommand *cmd, void *vertices, const BADGEVMS_DrawState *drawstate)
+{
+    const SDL_Rect *verts = (const SDL_Rect *)((Uint8 *)vertices + cmd->data.draw.first);
+    SDL_Surface *surface = (SDL_Surface *)cmd->data.draw.texture->internal;
+    SDL_Rect src = verts[0];
+    SDL_Rect dst = verts[1];
+    SDL_Rect clip;
+    SDL_Rect clipped;
+    bool alpha_channel;
+    bool blend;
+
+    // The color modulation is left to the CPU
+    if (!surface || !BADGEVMS_IsTexture(surface->pixels) || (drawstate->color.r & drawstate->color.g & drawstate->color.b) != 255) {
+        return false;
+    }
+    if (!BADGEVMS_ClipRect(drawstate, fb, &clip)) {
+        return false;
+    }
+
+    framebuffer_t texture = {
+        .w = (uint32_t)surface->w,
+        .h = (uint32_t)surface->h,
+        .format = BADGEVMS_TextureFormat(surface->format, &alpha_channel),
+        .pixels = (uint16_t *)surface->pixels,
+    };
+
+    switch (cmd->data.draw.blend) {
+    case SDL_BLENDMODE_NONE:
+        blend = false;
+        break;
+    case SDL_BLENDMODE_BLEND:
+        // The X formats have no alpha the PPA could scale
+        if (!alpha_channel && drawstate->color.a != 255 && SDL_BYTESPERPIXEL(surface->format) == 4) {
+            return false;
+        }
+        blend = alpha_channel || drawstate->color.a != 255;
+        break;
+    default:
+        return false;
+    }
+
+    dst.x += drawstate->viewport->x;
+    dst.y += drawstate->viewport->y;
+    if (!SDL_GetRectIntersection(&dst, &clip, &clipped)) {
+        // Nothing of it is visible
+        return true;
+    }
+
+    if (src.w == dst.w && src.h == dst.h) {
+        src.x += clipped.x - dst.x;
+        src.y += clipped.y - dst.y;
+        src.w = clipped.w;
+        src.h = clipped.h;
+        dst = clipped;
+    } else if (!SDL_RectsEqual(&dst, &clipped)) {
+        // Clipping a scaled copy doesn't come out in whole pixels
+        return false;
+    }
+
+    if (dst.w * dst.h < BADGEVMS_PPA_MIN_PIXELS) {
+        if (src.w != dst.w || src.h != dst.h) {
+            return false;
+        }
+        return BADGEVMS_CopyCPU(fb, surface, src, dst, drawstate->color.a, blend);
+    }
+
+    return window_framebuffer_blit(window, &texture, BADGEVMS_WindowRect(src), BADGEVMS_WindowRect(dst), drawstate->color.a, blend);
+}
+
+static bool BADGEVMS_Clear(window_handle_t window, const framebuffer_t *fb, const SDL_RenderCommand *cmd)
+{
+    // By definition the clear ignores the clip rect
+    window_rect_t all = { 0, 0, (int)fb->w, (int)fb->h };
+    return window_framebuffer_fill(window, all, BADGEVMS_Color(BADGEVMS_CommandColor(cmd)));
+}
+
+// Hand first up to and including last to the software renderer, after the
+// state it would have had if it had run everything before
+static bool BADGEVMS_RunSoftware(SDL_Renderer *renderer, SDL_RenderCommand *state, int num_state,
+                                 SDL_RenderCommand *first, SDL_RenderCommand *last, void *vertices, size_t vertsize)
+{
+    SDL_RenderCommand *next = last->next;
+    bool result;
+
+    for (int i = 0; i < num_state; i++) {
+        state[i].next = (i + 1 < num_state) ? &state[i + 1] : first;
+    }
+
+    last->next = NULL;
+    result = sw_run_command_queue(renderer, num_state ? state : first, vertices, vertsize);
+    last->next = next;
+
+    return result;
+}
+
+static int BADGEVMS_SaveState(const BADGEVMS_DrawState *drawstate, SDL_RenderCommand *state)
+{
+    int num_state = 0;
+
+    if (drawstate->viewport_cmd) {
+        state[num_state++] = *drawstate->viewport_cmd;
+    }
+    if (drawstate->cliprect_cmd) {
+        state[num_state++] = *drawstate->cliprect_cmd;
+    }
+    if (drawstate->color_cmd) {
+        state[num_state++] = *drawstate->color_cmd;
+    }
+    return num_state;
+}
+
+static bool BADGEVMS_RunCommandQueue(SDL_Renderer *renderer, SDL_RenderCommand *cmd, void *vertices, size_t vertsize)
+{
+    SDL_WindowData *data = renderer->window ? renderer->window->internal : NULL;
+    // Only the window, textures are drawn into by the CPU
+    window_handle_t window = (data && !renderer->target) ? data->badgevms_window : NULL;
+    framebuffer_t *fb = window ? window_framebuffer_get(window) : NULL;
+    BADGEVMS_DrawState drawstate;
+    SDL_RenderCommand state[3];
+    SDL_RenderCommand *run_first = NULL;
+    SDL_RenderCommand *run_last = NULL;
+    int num_state = 0;
+    bool result = true;
+
+    if (!fb) {
+        return sw_run_command_queue(renderer, cmd, vertices, vertsize);
+    }
+
+    SDL_zero(drawstate);
+
+    for (; cmd; cmd = cmd->next) {
+        bool accelerated = false;
+
+        switch (cmd->command) {
+        case SDL_RENDERCMD_SETDRAWCOLOR:
+            drawstate.color = BADGEVMS_CommandColor(cmd);
+            drawstate.color_cmd = cmd;
+            break;
+
+        case SDL_RENDERCMD_SETVIEWPORT:
+            drawstate.viewport = &cmd->data.viewport.rect;
+            drawstate.viewport_cmd = cmd;
+            break;
+
+        case SDL_RENDERCMD_SETCLIPRECT:
+            drawstate.cliprect = cmd->data.cliprect.enabled ? &cmd->data.cliprect.rect : NULL;
+            drawstate.cliprect_cmd = cmd;
+            break;
+
+        case SDL_RENDERCMD_CLEAR:
+        case SDL_RENDERCMD_FILL_RECTS:
+        case SDL_RENDERCMD_COPY:
+            // Whatever the CPU was given goes first
+            if (run_first) {
+                result &= BADGEVMS_RunSoftware(renderer, state, num_state, run_first, run_last, vertices, vertsize);
+                run_first = NULL;
+            }
+
+            if (cmd->command == SDL_RENDERCMD_CLEAR) {
+                accelerated = BADGEVMS_Clear(window, fb, cmd);
+            } else if (cmd->command == SDL_RENDERCMD_FILL_RECTS) {
+                accelerated = BADGEVMS_FillRects(window, fb, cmd, vertices, &drawstate);
+            } else {
+                accelerated = BADGEVMS_Copy(window, fb, cmd, vertices, &drawstate);
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (accelerated || (!run_first && (cmd->command == SDL_RENDERCMD_SETDRAWCOLOR ||
+                                           cmd->command == SDL_RENDERCMD_SETVIEWPORT ||
+                                           cmd->command == SDL_RENDERCMD_SETCLIPRECT ||
+                                           cmd->command == SDL_RENDERCMD_NO_OP))) {
+            continue;
+        }
+
+        if (!run_first) {
+            num_state = BADGEVMS_SaveState(&drawstate, state);
+            run_first = cmd;
+        }
+        run_last = cmd;
+    }
+
+    if (run_first) {
+        result &= BADGEVMS_RunSoftware(renderer, state, num_state, run_first, run_last, vertices, vertsize);
+    }
+
+    return result;
+}
+
+// Paced by the window, see SDL_BADGEVMS_SetWindowFramebufferVSync()
+static bool BADGEVMS_SetVSync(SDL_Renderer *renderer, const int vsync)
+{
+    if (!renderer->window) {
+        return vsync == 0;
+    }
+    return SDL_SetWindowSurfaceVSync(renderer->window, vsync);
+}
+
+static bool BADGEVMS_CreateRenderer(SDL_Renderer *renderer, SDL_Window *window, SDL_PropertiesID create_props)
+{
+    // Set the vsync hint based on our flags, if it's not already set
+    const char *hint = SDL_GetHint(SDL_HINT_RENDER_VSYNC);
+    const bool no_hint_set = (!hint || !*hint);
+
+    if (no_hint_set) {
+        if (SDL_GetBooleanProperty(create_props, SDL_PROP_RENDERER_CREATE_PRESENT_VSYNC_NUMBER, 0)) {
+            SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
+        } else {
+            SDL_SetHint(SDL_HINT_RENDER_VSYNC, "0");
+        }
+    }
+
+    SDL_Surface *surface = SDL_GetWindowSurface(window);
+
+    // Reset the vsync hint if we set it above
+    if (no_hint_set) {
+        SDL_SetHint(SDL_HINT_RENDER_VSYNC, "");
+    }
+
+    if (!SDL_SurfaceValid(surface)) {
+        return false;
+    }
+
+    if (!SW_CreateRendererForSurface(renderer, surface, create_props)) {
+        return false;
+    }
+
+    /* The window's format comes first, SDL_CreateTextureFromSurface() stores
+     * opaque images in it. RGBA32, which is what image loaders hand out, is
+     * read by the PPA as is, so it is taken without a conversion.
+     */
+    SDL_AddSupportedTextureFormat(renderer, SDL_PIXELFORMAT_ABGR8888);
+
+    sw_create_texture = renderer->CreateTexture;
+    sw_destroy_texture = renderer->DestroyTexture;
+    sw_run_command_queue = renderer->RunCommandQueue;
+
+    renderer->CreateTexture = BADGEVMS_CreateTexture;
+    renderer->DestroyTexture = BADGEVMS_DestroyTexture;
+    renderer->RunCommandQueue = BADGEVMS_RunCommandQueue;
+    renderer->SetVSync = BADGEVMS_SetVSync;
+    renderer->name = BADGEVMS_RenderDriver.name;
+
+    return true;
+}
+
+SDL_RenderDriver BADGEVMS_RenderDriver = {
+    BADGEVMS_CreateRenderer, "badgevms"
+};
+
+#endif // SDL_VIDEO_RENDER_BADGEVMS
@@ -29,6 +29,77 @@
 #include "SDL_badgevmsevents_c.h"
 #include "SDL_badgevmsvideo.h"
 
+// Without a window nothing can wake us, SDL looks at its queue this often
+#define BADGEVMS_NO_WINDOW_WAIT_NS SDL_MS_TO_NS(10)
+
+// Events taken out of a window's queue per call in BADGEVMS_PumpEvents()
+#define BADGEVMS_EVENTS_PER_DRAIN 16
+
+// Returns whether it made an SDL event out of it
+static bool BADGEVMS_DispatchEvent(SDL_Window *sdl_window, const event_t *badgevms_event)
+{
+    SDL_Event sdl_event;
+
+    SDL_zero(sdl_event);
+
+    switch (badgevms_event->type) {
+    case EVENT_QUIT:
+        sdl_event.type = SDL_EVENT_QUIT;
+        SDL_PushEvent(&sdl_event);
+        return true;
+
+    case EVENT_KEY_DOWN:
+    case EVENT_KEY_UP:
+        sdl_event.type = badgevms_event->keyboard.down ? SDL_EVENT_KEY_DOWN : SDL_EVENT_KEY_UP;
+        sdl_event.key.windowID = SDL_GetWindowID(sdl_window);
+        sdl_event.key.scancode = badgevms_event->keyboard.scancode;
+        sdl_event.key.key = SDL_GetKeyFromScancode(badgevms_event->keyboard.scancode, badgevms_event->keyboard.mod, true);
+        sdl_event.key.mod = badgevms_event->keyboard.mod;
+        sdl_event.key.down = badgevms_event->keyboard.down;
+        sdl_event.key.repeat = badgevms_event->keyboard.repeat;
+        sdl_event.key.timestamp = SDL_GetTicksNS();
+        SDL_PushEvent(&sdl_event);
+
+        if (badgevms_event->keyboard.down && badgevms_event->keyboard.text != 0) {
+            char text[2] = { badgevms_event->keyboard.text, 0 };
+            SDL_SendKeyboardText(text);
+        }
+        return true;
+
+    case EVENT_WINDOW_RESIZE:
+        return false;
+
+    case EVENT_WINDOW_OCCLUDED:
+        // SDL_WINDOW_OCCLUDED tells the application it can stop drawing
+        SDL_SendWindowEvent(sdl_window, SDL_EVENT_WINDOW_OCCLUDED, 0, 0);
+        return true;
+
+    case EVENT_WINDOW_VISIBLE:
+        SDL_SendWindowEvent(sdl_window, SDL_EVENT_WINDOW_EXPOSED, 0, 0);
+        return true;
+
+    default:
+        // Unknown event type, or a wakeup from BADGEVMS_SendWakeupEvent()
+        return false;
+    }
+}
+
+static SDL_WindowData *BADGEVMS_WaitWindow(SDL_VideoDevice *_this)
+{
+    SDL_Window *window = (SDL_Window *)SDL_GetAtomicPointer(&_this->wakeup_window);
+
+    if (!window) {
+        window = _this->windows;
+    }
+    for (; window; window = window->next) {
+        SDL_WindowData *window_data = (SDL_WindowData *)window->internal;
+        if (!window->is_destroying && window_data && window_data->badgevms_window) {
+            return window_data;
+        }
+    }
+    return NULL;
+}
+
 void BADGEVMS_PumpEvents(SDL_VideoDevice *_this)
 {
     SDL_DisplayID display_id = SDL_GetPrimaryDisplay();
@@ -54,53 +125,64 @@ void BADGEVMS_PumpEvents(SDL_VideoDevice *_this)
             continue;
         }
 
-        event_t badgevms_event;
-        SDL_Event sdl_event;
+        // Whatever piled up during a slow frame comes in a few calls
+        event_t badgevms_events[BADGEVMS_EVENTS_PER_DRAIN];
+        size_t count;
+        do {
+            count = window_events_drain(window_data->badgevms_window, badgevms_events, SDL_arraysize(badgevms_events));
+            for (size_t j = 0; j < count; j++) {
+                BADGEVMS_DispatchEvent(sdl_window, &badgevms_events[j]);
+            }
+        } while (count == SDL_arraysize(badgevms_events));
+    }
 
-        while (true) {
-            badgevms_event = window_event_poll(window_data->badgevms_window, false, 0);
+    SDL_free(windows);
+}
 
-            if (badgevms_event.type == EVENT_NONE) {
-                break; // No more events from this window
-            }
+/* Sleeps in the window's event queue until something arrives, instead of
+ * SDL pumping and sleeping in turns. With SDL_HINT_MAIN_CALLBACK_RATE set to
+ * "waitevent" an application that has nothing to animate, a menu or a game
+ * over screen, then only runs when a key is pressed.
+ */
+int BADGEVMS_WaitEventTimeout(SDL_VideoDevice *_this, Sint64 timeoutNS)
+{
+    SDL_WindowData *window_data = BADGEVMS_WaitWindow(_this);
 
-            SDL_zero(sdl_event);
-
-            switch (badgevms_event.type) {
-            case EVENT_QUIT:
-                sdl_event.type = SDL_EVENT_QUIT;
-                SDL_PushEvent(&sdl_event);
-                break;
-
-            case EVENT_KEY_DOWN:
-            case EVENT_KEY_UP:
-                sdl_event.type = badgevms_event.keyboard.down ? SDL_EVENT_KEY_DOWN : SDL_EVENT_KEY_UP;
-                sdl_event.key.windowID = SDL_GetWindowID(sdl_window);
-                sdl_event.key.scancode = badgevms_event.keyboard.scancode;
-                sdl_event.key.key = SDL_GetKeyFromScancode(badgevms_event.keyboard.scancode, badgevms_event.keyboard.mod, true);
-                sdl_event.key.mod = badgevms_event.keyboard.mod;
-                sdl_event.key.down = badgevms_event.keyboard.down;
-                sdl_event.key.repeat = badgevms_event.keyboard.repeat;
-                sdl_event.key.timestamp = SDL_GetTicksNS();
-                SDL_PushEvent(&sdl_event);
-
-                if (badgevms_event.keyboard.down && badgevms_event.keyboard.text != 0) {
-                    char text[2] = { badgevms_event.keyboard.text, 0 };
-                    SDL_SendKeyboardText(text);
-                }
-                break;
-
-            case EVENT_WINDOW_RESIZE:
-                break;
-
-            default:
-                // Unknown event type, ignore
-                break;
-            }
-        }
+    if (!window_data) {
+        // Nothing to wait on, SDL looks at its own queue again
+        SDL_DelayNS(timeoutNS >= 0 ? SDL_min(timeoutNS, BADGEVMS_NO_WINDOW_WAIT_NS) : BADGEVMS_NO_WINDOW_WAIT_NS);
+        return timeoutNS >= 0 ? 0 : 1;
     }
 
-    SDL_free(windows);
+    event_t badgevms_event;
+    if (timeoutNS < 0) {
+        badgevms_event = window_event_poll(window_data->badgevms_window, true, 0);
+    } else {
+        // Rounded up, so that a short timeout doesn't turn into polling
+        Uint32 timeout_msec = (Uint32)SDL_min((timeoutNS + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS, SDL_MAX_UINT32);
+        badgevms_event = window_event_poll(window_data->badgevms_window, false, timeout_msec);
+    }
+
+    if (badgevms_event.type == EVENT_NONE) {
+        return 0;
+    }
+
+    // The rest is picked up by BADGEVMS_PumpEvents()
+    BADGEVMS_DispatchEvent(window_data->window, &badgevms_event);
+    return 1;
+}
+
+/* An event pushed from another thread. The window's queue can't be written
+ * to from here, so the waiting thread is woken by the frame event of the
+ * next refresh the window is due for.
+ */
+void BADGEVMS_SendWakeupEvent(SDL_VideoDevice *_this, SDL_Window *window)
+{
+    SDL_WindowData *window_data = (SDL_WindowData *)window->internal;
+
+    if (window_data && window_data->badgevms_window) {
+        window_frame_callback_request(window_data->badgevms_window);
+    }
 }
 
 #endif // SDL_VIDEO_DRIVER_BADGEVMS
@@ -28,5 +28,7 @@
 #include "SDL_badgevmsvideo.h"
 
 extern void BADGEVMS_PumpEvents(SDL_VideoDevice *_this);
+extern int BADGEVMS_WaitEventTimeout(SDL_VideoDevice *_this, Sint64 timeoutNS);
+extern void BADGEVMS_SendWakeupEvent(SDL_VideoDevice *_this, SDL_Window *window);
 
 #endif // SDL_badgevmsevents_c_h_
@@ -30,6 +30,9 @@
 
 #define BADGEVMS_SURFACE "SDL.internal.window.surface"
 
+// More than this is presented as a whole, the compositor merges them anyway
+#define BADGEVMS_MAX_UPDATE_RECTS 16
+
 bool SDL_BADGEVMS_CreateWindowFramebuffer(SDL_VideoDevice *_this, SDL_Window *window, SDL_PixelFormat *format, void **pixels, int *pitch)
 {
     SDL_WindowData *data = window->internal;
@@ -59,6 +62,72 @@ bool SDL_BADGEVMS_CreateWindowFramebuffer(SDL_VideoDevice *_this, SDL_Window *wi
     return true;
 }
 
+/* Frames are paced by the compositor's refreshes: an interval of n waits for
+ * every n-th refresh, so that nothing is drawn that is never shown. Adaptive
+ * vsync doesn't wait with a frame that is already late, so a slow frame
+ * doesn't halve the frame rate.
+ */
+static void BADGEVMS_WaitVSync(SDL_WindowData *data)
+{
+    if (data->vsync == SDL_WINDOW_SURFACE_VSYNC_DISABLED) {
+        return;
+    }
+
+    Uint64 now = SDL_GetTicksNS();
+    if (data->vsync == SDL_WINDOW_SURFACE_VSYNC_ADAPTIVE) {
+        int fps = window_frame_rate_get(data->badgevms_window);
+        if (fps > 0 && now - data->last_vsync >= SDL_NS_PER_SECOND / fps) {
+            data->last_vsync = now;
+            return;
+        }
+    }
+
+    window_wait_vsync(data->badgevms_window);
+    data->last_vsync = SDL_GetTicksNS();
+}
+
+bool SDL_BADGEVMS_SetWindowFramebufferVSync(SDL_VideoDevice *_this, SDL_Window *window, int vsync)
+{
+    SDL_WindowData *data = window->internal;
+
+    if (!data || !data->badgevms_window) {
+        return SDL_SetError("Window not properly initialized");
+    }
+
+    if (vsync < SDL_WINDOW_SURFACE_VSYNC_ADAPTIVE) {
+        return SDL_Unsupported();
+    }
+
+    // The compositor rounds this to a divisor of the panel refresh rate
+    int fps = 0;
+    if (vsync > 1) {
+        int width, height;
+        pixel_format_t format;
+        float refresh_rate;
+        get_screen_info(&width, &height, &format, &refresh_rate);
+        fps = SDL_max((int)SDL_roundf(refresh_rate / vsync), 1);
+    }
+    window_frame_rate_set(data->badgevms_window, fps);
+
+    data->vsync = vsync;
+    data->last_vsync = SDL_GetTicksNS();
+
+    return true;
+}
+
+bool SDL_BADGEVMS_GetWindowFramebufferVSync(SDL_VideoDevice *_this, SDL_Window *window, int *vsync)
+{
+    SDL_WindowData *data = window->internal;
+
+    if (!data || !data->badgevms_window) {
+        return SDL_SetError("Window not properly initialized");
+    }
+
+    *vsync = data->vsync;
+
+    return true;
+}
+
 bool SDL_BADGEVMS_UpdateWindowFramebuffer(SDL_VideoDevice *_this, SDL_Window *window, const SDL_Rect *rects, int numrects)
 {
     SDL_WindowData *data = window->internal;
@@ -73,7 +142,26 @@ bool SDL_BADGEVMS_UpdateWindowFramebuffer(SDL_VideoDevice *_this, SDL_Window *wi
         return SDL_SetError("Couldn't find BadgeVMS surface for window");
     }
 
-    window_present(data->badgevms_window, true, NULL, 0);
+    // Only what changed gets composited again
+    window_rect_t damage[BADGEVMS_MAX_UPDATE_RECTS];
+    int num_damage = 0;
+    if (rects && numrects <= BADGEVMS_MAX_UPDATE_RECTS) {
+        SDL_Rect bounds = { 0, 0, surface->w, surface->h };
+        for (int i = 0; i < numrects; ++i) {
+            SDL_Rect clipped;
+            if (SDL_GetRectIntersection(&rects[i], &bounds, &clipped)) {
+                damage[num_damage++] = (window_rect_t){ clipped.x, clipped.y, clipped.w, clipped.h };
+            }
+        }
+
+        // Nothing on the surface changed
+        if (numrects > 0 && num_damage == 0) {
+            return true;
+        }
+    }
+
+    BADGEVMS_WaitVSync(data);
+    window_present(data->badgevms_window, true, num_damage ? damage : NULL, num_damage);
 
     return true;
 }
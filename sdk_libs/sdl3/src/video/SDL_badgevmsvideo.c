@@ -49,7 +49,7 @@ bool BADGEVMS_CreateWindow(SDL_VideoDevice *_this, SDL_Window *window, SDL_Prope
     }
 
     window_size_t size = { window->w, window->h };
-    window_flag_t flags = WINDOW_FLAG_DOUBLE_BUFFERED;
+    window_flag_t flags = WINDOW_FLAG_DOUBLE_BUFFERED | WINDOW_FLAG_TRIPLE_BUFFERED;
     SDL_WindowFlags sdl_flags = SDL_GetWindowFlags(window);
 
     if (sdl_flags & SDL_WINDOW_FULLSCREEN) {
@@ -118,12 +118,16 @@ static SDL_VideoDevice *BADGEVMS_InternalCreateDevice(const char *enable_hint)
     device->VideoInit = BADGEVMS_VideoInit;
     device->VideoQuit = BADGEVMS_VideoQuit;
     device->PumpEvents = BADGEVMS_PumpEvents;
+    device->WaitEventTimeout = BADGEVMS_WaitEventTimeout;
+    device->SendWakeupEvent = BADGEVMS_SendWakeupEvent;
     device->SetWindowSize = BADGEVMS_SetWindowSize;
     device->SetWindowPosition = BADGEVMS_SetWindowPosition;
     device->CreateSDLWindow = BADGEVMS_CreateWindow;
     device->DestroyWindow = BADGEVMS_DestroyWindow;
     device->CreateWindowFramebuffer = SDL_BADGEVMS_CreateWindowFramebuffer;
     device->UpdateWindowFramebuffer = SDL_BADGEVMS_UpdateWindowFramebuffer;
+    device->SetWindowFramebufferVSync = SDL_BADGEVMS_SetWindowFramebufferVSync;
+    device->GetWindowFramebufferVSync = SDL_BADGEVMS_GetWindowFramebufferVSync;
     device->DestroyWindowFramebuffer = SDL_BADGEVMS_DestroyWindowFramebuffer;
 
     device->GetDisplayModes = NULL; // Use default
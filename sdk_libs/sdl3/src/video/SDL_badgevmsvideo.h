@@ -34,6 +34,8 @@ typedef struct SDL_WindowData
 {
     SDL_Window *window;
     window_handle_t badgevms_window;
+    int vsync;         // As SDL_SetWindowSurfaceVSync() takes it
+    Uint64 last_vsync; // When the last frame went out, for adaptive vsync
 } SDL_WindowData;
 
 extern bool BADGEVMS_CreateWindow(SDL_VideoDevice *_this, SDL_Window *window, SDL_PropertiesID create_props);
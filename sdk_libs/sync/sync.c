@@ -0,0 +1,151 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms/process.h"
+#include "sync/sync.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <unistd.h>
+
+// Set in the mutex word when someone might be sleeping on it
+#define SYNC_MUTEX_CONTENDED INT_MIN
+
+static uint64_t now_msec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// What is left of timeout_msec since start, 0 when it passed
+static uint32_t remaining_msec(uint32_t timeout_msec, uint64_t start) {
+    if (timeout_msec == SYNC_WAIT_FOREVER) {
+        return SYNC_WAIT_FOREVER;
+    }
+
+    uint64_t elapsed = now_msec() - start;
+    return elapsed >= timeout_msec ? 0 : timeout_msec - elapsed;
+}
+
+#define WORD(p) ((atomic_int *)(p))
+
+void sync_mutex_lock(sync_mutex_t *mutex) {
+    int self     = getpid();
+    int expected = 0;
+
+    if (atomic_compare_exchange_strong(WORD(&mutex->word), &expected, self)) {
+        return;
+    }
+
+    while (1) {
+        int word = atomic_load(WORD(&mutex->word));
+        if (!word) {
+            // We can't know whether others still sleep, so keep them in mind
+            if (atomic_compare_exchange_strong(WORD(&mutex->word), &word, self | SYNC_MUTEX_CONTENDED)) {
+                return;
+            }
+            continue;
+        }
+
+        if (!(word & SYNC_MUTEX_CONTENDED)) {
+            if (!atomic_compare_exchange_strong(WORD(&mutex->word), &word, word | SYNC_MUTEX_CONTENDED)) {
+                continue;
+            }
+            word |= SYNC_MUTEX_CONTENDED;
+        }
+
+        futex_wait(&mutex->word, word, SYNC_WAIT_FOREVER);
+
+        // Unchanged after a wake up, the owner might have died with the lock
+        if (atomic_load(WORD(&mutex->word)) == word && !thread_alive(word & ~SYNC_MUTEX_CONTENDED)) {
+            if (atomic_compare_exchange_strong(WORD(&mutex->word), &word, self | SYNC_MUTEX_CONTENDED)) {
+                return;
+            }
+        }
+    }
+}
+
+bool sync_mutex_trylock(sync_mutex_t *mutex) {
+    int expected = 0;
+    return atomic_compare_exchange_strong(WORD(&mutex->word), &expected, getpid());
+}
+
+void sync_mutex_unlock(sync_mutex_t *mutex) {
+    if (atomic_exchange(WORD(&mutex->word), 0) & SYNC_MUTEX_CONTENDED) {
+        futex_wake(&mutex->word, 1);
+    }
+}
+
+bool sync_cond_wait(sync_cond_t *cond, sync_mutex_t *mutex, uint32_t timeout_msec) {
+    int sequence = atomic_load(WORD(&cond->sequence));
+
+    sync_mutex_unlock(mutex);
+    bool timed_out = futex_wait(&cond->sequence, sequence, timeout_msec) && errno == ETIMEDOUT;
+    sync_mutex_lock(mutex);
+
+    return !timed_out;
+}
+
+void sync_cond_signal(sync_cond_t *cond) {
+    atomic_fetch_add(WORD(&cond->sequence), 1);
+    futex_wake(&cond->sequence, 1);
+}
+
+void sync_cond_broadcast(sync_cond_t *cond) {
+    atomic_fetch_add(WORD(&cond->sequence), 1);
+    futex_wake(&cond->sequence, INT_MAX);
+}
+
+void sync_sem_init(sync_sem_t *sem, int value) {
+    atomic_init(WORD(&sem->value), value);
+    atomic_init(WORD(&sem->waiters), 0);
+}
+
+bool sync_sem_trywait(sync_sem_t *sem) {
+    int value = atomic_load(WORD(&sem->value));
+    while (value > 0) {
+        if (atomic_compare_exchange_weak(WORD(&sem->value), &value, value - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sync_sem_wait(sync_sem_t *sem, uint32_t timeout_msec) {
+    uint64_t start = now_msec();
+
+    while (!sync_sem_trywait(sem)) {
+        uint32_t remaining = remaining_msec(timeout_msec, start);
+        if (!remaining) {
+            return false;
+        }
+
+        atomic_fetch_add(WORD(&sem->waiters), 1);
+        futex_wait(&sem->value, 0, remaining);
+        atomic_fetch_sub(WORD(&sem->waiters), 1);
+    }
+    return true;
+}
+
+void sync_sem_post(sync_sem_t *sem) {
+    atomic_fetch_add(WORD(&sem->value), 1);
+    if (atomic_load(WORD(&sem->waiters))) {
+        futex_wake(&sem->value, 1);
+    }
+}
@@ -0,0 +1,461 @@
+/* This file is part of BadgeVMS
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "badgevms/process.h"
+#include "threadpool/threadpool.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+
+#define THREADPOOL_DEFAULT_WORKERS 2
+#define THREADPOOL_MAX_WORKERS     8
+#define THREADPOOL_DEQUE_SIZE      256 // Power of two
+#define THREADPOOL_MAX_DEPENDENTS  8
+// Rounds an idle worker looks for work before it goes to sleep. Keep this low,
+// spinning takes time from the threads that would make new work.
+#define THREADPOOL_SPIN_ROUNDS     8
+// Waiters also get woken when they are done, this only covers several of them
+#define THREADPOOL_WAIT_POLL_MS    10
+
+struct threadpool_task {
+    threadpool_t      *pool;
+    threadpool_func_t  func;
+    void              *data;
+    atomic_int         pending; // Dependencies that didn't run, plus one until submitted
+    int                num_dependents;
+    threadpool_task_t *dependents[THREADPOOL_MAX_DEPENDENTS];
+    threadpool_task_t *next; // On the injected list
+};
+
+// Chase-Lev deque. The owner pushes and pops at the bottom, thieves take from
+// the top.
+typedef struct {
+    atomic_int                 top;
+    atomic_int                 bottom;
+    threadpool_task_t *_Atomic tasks[THREADPOOL_DEQUE_SIZE];
+} deque_t;
+
+typedef struct {
+    threadpool_t *pool;
+    pid_t         pid;
+    unsigned int  seed; // For picking whom to steal from
+    atomic_bool   sleeping;
+    atomic_bool   exited;
+    deque_t       deque;
+} worker_t;
+
+struct threadpool {
+    int                        num_workers;
+    atomic_bool                started; // Every worker pid is known
+    atomic_bool                stop;
+    atomic_int                 outstanding; // Submitted tasks that didn't run yet
+    atomic_int                 waiter;      // Last thread in threadpool_wait()
+    threadpool_task_t *_Atomic injected;    // Submitted by threads that aren't workers
+    worker_t                   workers[THREADPOOL_MAX_WORKERS];
+};
+
+typedef struct {
+    threadpool_range_func_t func;
+    void                   *data;
+    int                     end;
+    int                     grain;
+    pid_t                   caller;
+    atomic_int              next;    // Start of the first chunk nobody took yet
+    atomic_int              helpers; // Helper tasks that didn't finish
+} parallel_for_t;
+
+static bool deque_push(deque_t *deque, threadpool_task_t *task) {
+    int bottom = atomic_load(&deque->bottom);
+    int top    = atomic_load(&deque->top);
+    if (bottom - top >= THREADPOOL_DEQUE_SIZE) {
+        return false;
+    }
+
+    atomic_store(&deque->tasks[bottom & (THREADPOOL_DEQUE_SIZE - 1)], task);
+    atomic_store(&deque->bottom, bottom + 1);
+    return true;
+}
+
+static threadpool_task_t *deque_pop(deque_t *deque) {
+    int bottom = atomic_load(&deque->bottom) - 1;
+    atomic_store(&deque->bottom, bottom);
+    int top = atomic_load(&deque->top);
+
+    if (top > bottom) {
+        atomic_store(&deque->bottom, bottom + 1);
+        return NULL;
+    }
+
+    threadpool_task_t *task = atomic_load(&deque->tasks[bottom & (THREADPOOL_DEQUE_SIZE - 1)]);
+    if (top == bottom) {
+        // The last one, a thief might be after it too
+        if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) {
+            task = NULL;
+        }
+        atomic_store(&deque->bottom, bottom + 1);
+    }
+    return task;
+}
+
+static threadpool_task_t *deque_steal(deque_t *deque) {
+    int top    = atomic_load(&deque->top);
+    int bottom = atomic_load(&deque->bottom);
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    threadpool_task_t *task = atomic_load(&deque->tasks[top & (THREADPOOL_DEQUE_SIZE - 1)]);
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) {
+        return NULL;
+    }
+    return task;
+}
+
+static bool deque_empty(deque_t *deque) {
+    return atomic_load(&deque->top) >= atomic_load(&deque->bottom);
+}
+
+static worker_t *current_worker(threadpool_t *pool) {
+    pid_t pid = getpid();
+    for (int i = 0; i < pool->num_workers; ++i) {
+        if (pool->workers[i].pid == pid) {
+            return &pool->workers[i];
+        }
+    }
+    return NULL;
+}
+
+// Put the chain first to last on the injected list
+static void inject(threadpool_t *pool, threadpool_task_t *first, threadpool_task_t *last) {
+    threadpool_task_t *head = atomic_load(&pool->injected);
+    do {
+        last->next = head;
+    } while (!atomic_compare_exchange_weak(&pool->injected, &head, first));
+}
+
+// Only ever taken as a whole, so nodes can't come back while someone pops
+static threadpool_task_t *take_injected(threadpool_t *pool, worker_t *self) {
+    threadpool_task_t *task = atomic_exchange(&pool->injected, NULL);
+    if (!task) {
+        return NULL;
+    }
+
+    threadpool_task_t *rest = task->next;
+    while (rest && self && deque_push(&self->deque, rest)) {
+        rest = rest->next;
+    }
+
+    if (rest) {
+        threadpool_task_t *last = rest;
+        while (last->next) {
+            last = last->next;
+        }
+        inject(pool, rest, last);
+    }
+    return task;
+}
+
+static bool has_work(threadpool_t *pool) {
+    if (atomic_load(&pool->injected)) {
+        return true;
+    }
+    for (int i = 0; i < pool->num_workers; ++i) {
+        if (!deque_empty(&pool->workers[i].deque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wake_one(threadpool_t *pool) {
+    for (int i = 0; i < pool->num_workers; ++i) {
+        if (atomic_exchange(&pool->workers[i].sleeping, false)) {
+            thread_notify(pool->workers[i].pid);
+            return;
+        }
+    }
+}
+
+static void schedule(threadpool_t *pool, threadpool_task_t *task) {
+    worker_t *self = current_worker(pool);
+    if (!self || !deque_push(&self->deque, task)) {
+        inject(pool, task, task);
+    }
+    wake_one(pool);
+}
+
+static void task_run(threadpool_task_t *task) {
+    threadpool_t *pool = task->pool;
+
+    task->func(task->data);
+    for (int i = 0; i < task->num_dependents; ++i) {
+        threadpool_task_t *dependent = task->dependents[i];
+        if (atomic_fetch_sub(&dependent->pending, 1) == 1) {
+            schedule(pool, dependent);
+        }
+    }
+    free(task);
+
+    if (atomic_fetch_sub(&pool->outstanding, 1) == 1) {
+        pid_t waiter = atomic_load(&pool->waiter);
+        if (waiter) {
+            thread_notify(waiter);
+        }
+    }
+}
+
+// Run one task from anywhere in the pool, self is NULL for other threads
+static bool run_one(threadpool_t *pool, worker_t *self) {
+    threadpool_task_t *task = self ? deque_pop(&self->deque) : NULL;
+    if (!task) {
+        task = take_injected(pool, self);
+    }
+
+    if (!task) {
+        int first = self ? rand_r(&self->seed) : 0;
+        for (int i = 0; i < pool->num_workers && !task; ++i) {
+            worker_t *victim = &pool->workers[(first + i) % pool->num_workers];
+            if (victim != self) {
+                task = deque_steal(&victim->deque);
+            }
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+
+    task_run(task);
+    return true;
+}
+
+static void worker_main(void *data) {
+    worker_t     *self = data;
+    threadpool_t *pool = self->pool;
+
+    while (!atomic_load(&pool->started)) {
+        thread_notify_wait(UINT32_MAX);
+    }
+
+    int idle = 0;
+    while (!atomic_load(&pool->stop)) {
+        if (run_one(pool, self)) {
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < THREADPOOL_SPIN_ROUNDS) {
+            continue;
+        }
+
+        // Anything scheduled after this sees us sleeping and wakes us up
+        atomic_store(&self->sleeping, true);
+        if (!has_work(pool) && !atomic_load(&pool->stop)) {
+            thread_notify_wait(UINT32_MAX);
+        }
+        atomic_store(&self->sleeping, false);
+        idle = 0;
+    }
+
+    atomic_store(&self->exited, true);
+}
+
+threadpool_t *threadpool_create(int workers, uint16_t stack_size) {
+    if (workers <= 0) {
+        workers = THREADPOOL_DEFAULT_WORKERS;
+    }
+    if (workers > THREADPOOL_MAX_WORKERS) {
+        workers = THREADPOOL_MAX_WORKERS;
+    }
+
+    threadpool_t *pool = calloc(1, sizeof(threadpool_t));
+    if (!pool) {
+        return NULL;
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        worker_t *worker = &pool->workers[i];
+        worker->pool     = pool;
+        worker->seed     = i + 1;
+        worker->pid      = thread_create(worker_main, worker, stack_size);
+        if (worker->pid <= 0) {
+            break;
+        }
+        pool->num_workers = i + 1;
+    }
+
+    atomic_store(&pool->started, true);
+    for (int i = 0; i < pool->num_workers; ++i) {
+        thread_notify(pool->workers[i].pid);
+    }
+
+    if (pool->num_workers != workers) {
+        threadpool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void threadpool_destroy(threadpool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    threadpool_wait(pool);
+
+    atomic_store(&pool->stop, true);
+    for (int i = 0; i < pool->num_workers; ++i) {
+        thread_notify(pool->workers[i].pid);
+    }
+    for (int i = 0; i < pool->num_workers; ++i) {
+        while (!atomic_load(&pool->workers[i].exited)) {
+            usleep(1000);
+        }
+    }
+
+    free(pool);
+}
+
+int threadpool_workers(threadpool_t *pool) {
+    return pool ? pool->num_workers : 0;
+}
+
+threadpool_task_t *threadpool_task_create(threadpool_t *pool, threadpool_func_t func, void *data) {
+    if (!pool || !func) {
+        return NULL;
+    }
+
+    threadpool_task_t *task = calloc(1, sizeof(threadpool_task_t));
+    if (!task) {
+        return NULL;
+    }
+
+    task->pool = pool;
+    task->func = func;
+    task->data = data;
+    atomic_init(&task->pending, 1);
+    return task;
+}
+
+bool threadpool_task_depends(threadpool_task_t *task, threadpool_task_t *on) {
+    if (!task || !on || on->num_dependents == THREADPOOL_MAX_DEPENDENTS) {
+        return false;
+    }
+
+    on->dependents[on->num_dependents++] = task;
+    atomic_fetch_add(&task->pending, 1);
+    return true;
+}
+
+void threadpool_task_submit(threadpool_task_t *task) {
+    if (!task) {
+        return;
+    }
+
+    threadpool_t *pool = task->pool;
+    atomic_fetch_add(&pool->outstanding, 1);
+    if (atomic_fetch_sub(&task->pending, 1) == 1) {
+        schedule(pool, task);
+    }
+}
+
+void threadpool_wait(threadpool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    worker_t *self = current_worker(pool);
+    while (atomic_load(&pool->outstanding)) {
+        if (run_one(pool, self)) {
+            continue;
+        }
+
+        atomic_store(&pool->waiter, getpid());
+        if (atomic_load(&pool->outstanding)) {
+            thread_notify_wait(THREADPOOL_WAIT_POLL_MS);
+        }
+    }
+}
+
+static void parallel_for_chunks(parallel_for_t *pf) {
+    while (1) {
+        int start = atomic_fetch_add(&pf->next, pf->grain);
+        if (start >= pf->end) {
+            break;
+        }
+        pf->func(pf->data, start, pf->end - start < pf->grain ? pf->end : start + pf->grain);
+    }
+}
+
+static void parallel_for_helper(void *data) {
+    parallel_for_t *pf     = data;
+    pid_t           caller = pf->caller;
+
+    parallel_for_chunks(pf);
+    // pf lives on the stack of the caller, which may return once we are done
+    if (atomic_fetch_sub(&pf->helpers, 1) == 1) {
+        thread_notify(caller);
+    }
+}
+
+void threadpool_parallel_for(
+    threadpool_t *pool, int start, int end, int grain, threadpool_range_func_t func, void *data
+) {
+    if (!pool || !func || start >= end) {
+        return;
+    }
+
+    int range = end - start;
+    if (grain <= 0) {
+        // A few chunks per thread, so that a slow one can be made up for
+        grain = range / (4 * (pool->num_workers + 1));
+        grain = grain ? grain : 1;
+    }
+
+    int chunks  = (range + grain - 1) / grain;
+    int helpers = chunks - 1 < pool->num_workers ? chunks - 1 : pool->num_workers;
+
+    parallel_for_t pf = {
+        .func   = func,
+        .data   = data,
+        .end    = end,
+        .grain  = grain,
+        .caller = getpid(),
+    };
+    atomic_init(&pf.next, start);
+    atomic_init(&pf.helpers, helpers);
+
+    for (int i = 0; i < helpers; ++i) {
+        threadpool_task_t *task = threadpool_task_create(pool, parallel_for_helper, &pf);
+        if (!task) {
+            // The others and we pick up the chunks it would have taken
+            atomic_fetch_sub(&pf.helpers, 1);
+            continue;
+        }
+        threadpool_task_submit(task);
+    }
+
+    parallel_for_chunks(&pf);
+
+    worker_t *self = current_worker(pool);
+    while (atomic_load(&pf.helpers)) {
+        if (!run_one(pool, self)) {
+            thread_notify_wait(THREADPOOL_WAIT_POLL_MS);
+        }
+    }
+}